@@ -6,7 +6,6 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
-#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,6 +20,7 @@
 #include <myst/libc.h>
 #include <myst/syscall.h>
 #include <myst/syscallext.h>
+#include <myst/vdso.h>
 
 void _dlstart_c(size_t* sp, size_t* dynv);
 
@@ -34,15 +34,34 @@ void myst_trace(const char* msg);
 
 void myst_dump_argv(int argc, const char* argv[]);
 
-static void _create_itimer_thread(void);
+/* Get the kernel's clock state (null if the target does not provide one) */
+static myst_vdso_t* _get_vdso(void)
+{
+    static myst_vdso_t* _vdso;
+    static volatile int _initialized;
+
+    if (!_initialized)
+    {
+        long params[6] = {0};
+        _vdso = (myst_vdso_t*)(*_syscall_callback)(SYS_myst_get_vdso, params);
+        __atomic_store_n(&_initialized, 1, __ATOMIC_RELEASE);
+    }
+
+    return _vdso;
+}
 
 long myst_syscall(long n, long params[6])
 {
-    static pthread_once_t _once = PTHREAD_ONCE_INIT;
+    /* read the clock without entering the kernel when possible */
+    if (n == SYS_clock_gettime)
+    {
+        myst_vdso_t* vdso = _get_vdso();
+        clockid_t clk_id = (clockid_t)params[0];
+        struct timespec* tp = (struct timespec*)params[1];
 
-    /* create the itimer thread on demand (only if needed) */
-    if (n == SYS_setitimer)
-        pthread_once(&_once, _create_itimer_thread);
+        if (vdso && tp && myst_vdso_clock_gettime(vdso, clk_id, tp) == 0)
+            return 0;
+    }
 
     return (*_syscall_callback)(n, params);
 }
@@ -93,6 +112,14 @@ long myst_add_symbol_file(const char* path, const void* text, size_t text_size)
     return (*_syscall_callback)(SYS_myst_add_symbol_file, params);
 }
 
+/* Tell the kernel that the dynamic loader is done (see --startup-trace):
+ * the constructors of libc run before those of the other modules */
+__attribute__((constructor)) static void _startup_trace(void)
+{
+    long params[6] = {0};
+    (*_syscall_callback)(SYS_myst_startup_trace, params);
+}
+
 /* Replacement for __clone() defined in clone.s */
 int __clone(int (*fn)(void*), void* child_stack, int flags, void* arg, ...)
 {
@@ -155,43 +182,3 @@ void myst_enter_crt(void* stack, void* dynv, syscall_callback_t callback)
 
     _dlstart_c((size_t*)stack, (size_t*)dynv);
 }
-
-static void* _itimer_thread(void* arg)
-{
-    (void)arg;
-
-    /* Enter the kernel on the itimer thread */
-    long params[6] = {0};
-    myst_syscall(SYS_myst_run_itimer, params);
-
-    return NULL;
-}
-
-// Create the itimer thread in user-space and then enter the kernel with the
-// SYS_myst_run_itimer syscall. We create a user-space thread since
-// kernel-space threads are not supported. Two complications include aligning
-// with pthread struct and having a place to land on thread exit.
-static void _create_itimer_thread(void)
-{
-    pthread_attr_t attr;
-    pthread_t thread;
-    const char* func = __FUNCTION__;
-
-    if (pthread_attr_init(&attr) != 0)
-    {
-        fprintf(stderr, "%s(): pthread_attr_init() failed\n", func);
-        abort();
-    }
-
-    if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0)
-    {
-        fprintf(stderr, "%s(): pthread_attr_setdetachstate() failed\n", func);
-        abort();
-    }
-
-    if (pthread_create(&thread, &attr, _itimer_thread, NULL) != 0)
-    {
-        fprintf(stderr, "%s(): pthread_create() failed\n", func);
-        abort();
-    }
-}
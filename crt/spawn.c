@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <myst/spawn.h>
+#include <myst/syscallext.h>
+
+long myst_syscall(long n, long params[6]);
+
+/* The file actions as musl keeps them (see musl's src/process/fdop.h): the
+ * list starts with the most recent action */
+struct fdop
+{
+    struct fdop *next, *prev;
+    int cmd, fd, srcfd, oflag;
+    mode_t mode;
+    char path[];
+};
+
+/* Find the program in the PATH as posix_spawnp() does */
+static int _find_program(const char* file, char* buf, size_t size)
+{
+    const char* path = getenv("PATH");
+    const char* p;
+
+    if (!path)
+        path = "/usr/local/bin:/bin:/usr/bin";
+
+    for (p = path;; p++)
+    {
+        const char* end = strchrnul(p, ':');
+        const int len = (int)(end - p);
+
+        if (len && snprintf(buf, size, "%.*s/%s", len, p, file) < (int)size &&
+            access(buf, X_OK) == 0)
+        {
+            return 0;
+        }
+
+        if (!*(p = end))
+            break;
+    }
+
+    return ENOENT;
+}
+
+/* Replacement for musl's posix_spawn() (which the Makefile leaves out): the
+ * kernel creates the child without a vfork() of the caller */
+int posix_spawn(
+    pid_t* restrict res,
+    const char* restrict path,
+    const posix_spawn_file_actions_t* fa,
+    const posix_spawnattr_t* restrict attr,
+    char* const argv[restrict],
+    char* const envp[restrict])
+{
+    myst_spawn_args_t args;
+    myst_spawn_action_t* actions = NULL;
+    char buf[PATH_MAX];
+    long r;
+
+    memset(&args, 0, sizeof(args));
+    args.path = path;
+    args.argv = argv;
+    args.envp = envp;
+
+    if (attr)
+    {
+        /* posix_spawnp() sets __fn (to its exec function) */
+        if (attr->__fn && !strchr(path, '/'))
+        {
+            if ((r = _find_program(path, buf, sizeof(buf))) != 0)
+                return (int)r;
+
+            args.path = buf;
+        }
+
+        if (attr->__flags & POSIX_SPAWN_SETSIGDEF)
+        {
+            args.flags |= MYST_SPAWN_SETSIGDEF;
+            args.sigdefault = attr->__def;
+        }
+
+        if (attr->__flags & POSIX_SPAWN_SETSIGMASK)
+        {
+            args.flags |= MYST_SPAWN_SETSIGMASK;
+            args.sigmask = attr->__mask;
+        }
+
+#ifdef POSIX_SPAWN_SETSID
+        if (attr->__flags & POSIX_SPAWN_SETSID)
+            args.flags |= MYST_SPAWN_SETSID;
+#endif
+
+        /* the IDs and the process group cannot change in Mystikos, so
+         * POSIX_SPAWN_RESETIDS and POSIX_SPAWN_SETPGROUP have no effect */
+    }
+
+    /* pass the actions to the kernel from the oldest to the newest */
+    if (fa && fa->__actions)
+    {
+        struct fdop* op = fa->__actions;
+        size_t n = 1;
+
+        for (; op->next; op = op->next)
+            n++;
+
+        if (!(actions = calloc(n, sizeof(myst_spawn_action_t))))
+            return ENOMEM;
+
+        for (size_t i = 0; op; op = op->prev, i++)
+        {
+            actions[i].cmd = op->cmd;
+            actions[i].fd = op->fd;
+            actions[i].srcfd = op->srcfd;
+            actions[i].oflag = op->oflag;
+            actions[i].mode = op->mode;
+            actions[i].path = op->path;
+        }
+
+        args.actions = actions;
+        args.num_actions = n;
+    }
+
+    {
+        long params[6] = {(long)&args};
+        r = myst_syscall(SYS_myst_spawn, params);
+    }
+
+    free(actions);
+
+    if (r < 0)
+        return (int)-r;
+
+    if (res)
+        *res = (pid_t)r;
+
+    return 0;
+}
@@ -187,6 +187,10 @@ ifdef MYST_DEBUG
 MYST_DEFINES += -DMYST_DEBUG
 endif
 
+# Also build the kernels specialized for SGX and Linux (see kernel/Makefile),
+# which myst prefers to the generic kernel (set to 0 for the generic only)
+MYST_ENABLE_TARGET_KERNELS ?= 1
+
 ##==============================================================================
 ##
 ## Define $(EXEC) macro in terms of $(TARGET). This macro should be used in
@@ -336,8 +340,14 @@ RUNTEST_COMMAND=$(TOP)/scripts/runtest
 ##
 ##==============================================================================
 
+# The counters are shared by all threads: prefer-atomic updates them with
+# atomic adds, so the counts of multithreaded load tests are not lost (set
+# MYST_GCOV_UPDATE=single for the faster plain increments of unit tests)
+MYST_GCOV_UPDATE ?= prefer-atomic
+
 ifdef MYST_ENABLE_GCOV
 GCOV_CFLAGS = -fprofile-arcs -ftest-coverage
+GCOV_CFLAGS += -fprofile-update=$(MYST_GCOV_UPDATE)
 GCOV_LDFLAGS = -lgcov
 endif
 
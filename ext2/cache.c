@@ -0,0 +1,518 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/blkdev.h>
+#include <myst/eraise.h>
+#include <myst/spinlock.h>
+#include "ext2common.h"
+
+/*
+**==============================================================================
+**
+** The ext2 buffer cache:
+**
+**     Keeps recently used file system blocks in memory, keyed by their ext2
+**     block number, so metadata (group descriptors, bitmaps, inode tables
+**     and directories) is read from the device (and verified or decrypted
+**     by it) once rather than on every access.
+**
+**     Writes only update the cached block and mark it dirty; dirty blocks
+**     reach the device on ext2_cache_sync() (fsync and release) or when
+**     they are evicted to make room. Eviction takes the least recently used
+**     block.
+**
+**     ext2_read() reads ahead of sequential readers with
+**     ext2_cache_prefetch(), which loads a run of blocks with one device
+**     request.
+**
+**==============================================================================
+*/
+
+/* Number of hash chains (a power of two) */
+#define CACHE_CHAINS 4096
+
+typedef struct cache_block
+{
+    /* link for the hash table chain */
+    struct cache_block* next;
+
+    /* links for the LRU list (where first is least recently used) */
+    struct cache_block* lru_prev;
+    struct cache_block* lru_next;
+
+    /* the ext2 block number of this data */
+    uint64_t blkno;
+
+    /* whether the block was written since it was last on the device */
+    bool dirty;
+
+    /* the data for this block */
+    uint8_t data[];
+} cache_block_t;
+
+struct ext2_cache
+{
+    myst_blkdev_t* dev;
+    uint32_t block_size;
+    size_t max_blocks;
+    cache_block_t* chains[CACHE_CHAINS];
+    struct
+    {
+        cache_block_t* head;
+        cache_block_t* tail;
+        size_t size;
+    } lru;
+    ext2_cache_stats_t stats;
+    myst_spinlock_t lock;
+};
+
+/* the device requests of every cache (see ext2_get_blkdev_stats()) */
+static uint64_t _dev_gets;
+static uint64_t _dev_puts;
+
+static void _lru_append(ext2_cache_t* cache, cache_block_t* cb)
+{
+    cb->lru_next = NULL;
+    cb->lru_prev = cache->lru.tail;
+
+    if (cache->lru.tail)
+        cache->lru.tail->lru_next = cb;
+    else
+        cache->lru.head = cb;
+
+    cache->lru.tail = cb;
+    cache->lru.size++;
+}
+
+static void _lru_remove(ext2_cache_t* cache, cache_block_t* cb)
+{
+    if (cb->lru_prev)
+        cb->lru_prev->lru_next = cb->lru_next;
+    else
+        cache->lru.head = cb->lru_next;
+
+    if (cb->lru_next)
+        cb->lru_next->lru_prev = cb->lru_prev;
+    else
+        cache->lru.tail = cb->lru_prev;
+
+    cache->lru.size--;
+}
+
+static cache_block_t** _chain(ext2_cache_t* cache, uint64_t blkno)
+{
+    return &cache->chains[blkno & (CACHE_CHAINS - 1)];
+}
+
+static cache_block_t* _find_block(ext2_cache_t* cache, uint64_t blkno)
+{
+    cache_block_t* cb;
+
+    for (cb = *_chain(cache, blkno); cb; cb = cb->next)
+    {
+        if (cb->blkno == blkno)
+            break;
+    }
+
+    return cb;
+}
+
+/* Transfer ext2 blocks as the device blocks that make them up */
+static int _dev_get(
+    ext2_cache_t* cache,
+    uint64_t blkno,
+    size_t nblocks,
+    uint8_t* data)
+{
+    const size_t n = cache->block_size / MYST_BLKSIZE;
+
+    __atomic_fetch_add(&_dev_gets, 1, __ATOMIC_RELAXED);
+
+    if (myst_blkdev_get_n(cache->dev, blkno * n, nblocks * n, data) != 0)
+        return -EIO;
+
+    return 0;
+}
+
+static int _dev_put(ext2_cache_t* cache, cache_block_t* cb)
+{
+    const size_t n = cache->block_size / MYST_BLKSIZE;
+
+    __atomic_fetch_add(&_dev_puts, 1, __ATOMIC_RELAXED);
+
+    if (myst_blkdev_put_n(cache->dev, cb->blkno * n, n, cb->data) != 0)
+        return -EIO;
+
+    cb->dirty = false;
+    cache->stats.writebacks++;
+
+    return 0;
+}
+
+/* Drop least recently used blocks (writing them back first if dirty) until
+ * there is room for one more */
+static int _evict(ext2_cache_t* cache)
+{
+    int ret = 0;
+
+    while (cache->lru.size && cache->lru.size >= cache->max_blocks)
+    {
+        cache_block_t* cb = cache->lru.head;
+        cache_block_t** pp = _chain(cache, cb->blkno);
+
+        if (cb->dirty)
+            ECHECK(_dev_put(cache, cb));
+
+        while (*pp != cb)
+            pp = &(*pp)->next;
+
+        *pp = cb->next;
+        _lru_remove(cache, cb);
+        free(cb);
+        cache->stats.evictions++;
+    }
+
+done:
+    return ret;
+}
+
+/* Find the block, loading it from the device unless whole (it will be
+ * overwritten entirely, so a miss need not read it) */
+static int _get_block(
+    ext2_cache_t* cache,
+    uint64_t blkno,
+    bool whole,
+    cache_block_t** cb_out)
+{
+    int ret = 0;
+    cache_block_t** chain = _chain(cache, blkno);
+    cache_block_t* cb;
+
+    if ((cb = _find_block(cache, blkno)))
+    {
+        cache->stats.hits++;
+
+        /* move to the back of the LRU list */
+        if (cb != cache->lru.tail)
+        {
+            _lru_remove(cache, cb);
+            _lru_append(cache, cb);
+        }
+
+        *cb_out = cb;
+        goto done;
+    }
+
+    cache->stats.misses++;
+
+    ECHECK(_evict(cache));
+
+    if (!(cb = malloc(sizeof(cache_block_t) + cache->block_size)))
+        ERAISE(-ENOMEM);
+
+    cb->blkno = blkno;
+    cb->dirty = false;
+
+    if (!whole && (ret = _dev_get(cache, blkno, 1, cb->data)) != 0)
+    {
+        free(cb);
+        ERAISE(ret);
+    }
+
+    cb->next = *chain;
+    *chain = cb;
+    _lru_append(cache, cb);
+
+    *cb_out = cb;
+
+done:
+    return ret;
+}
+
+int ext2_cache_create(
+    myst_blkdev_t* dev,
+    uint32_t block_size,
+    size_t max_blocks,
+    ext2_cache_t** cache_out)
+{
+    int ret = 0;
+    ext2_cache_t* cache;
+
+    if (!dev || !cache_out || !block_size || block_size % MYST_BLKSIZE)
+        ERAISE(-EINVAL);
+
+    if (!(cache = calloc(1, sizeof(ext2_cache_t))))
+        ERAISE(-ENOMEM);
+
+    cache->dev = dev;
+    cache->block_size = block_size;
+    cache->max_blocks = max_blocks;
+    cache->lock = MYST_SPINLOCK_INITIALIZER;
+
+    *cache_out = cache;
+
+done:
+    return ret;
+}
+
+void ext2_cache_release(ext2_cache_t* cache)
+{
+    if (cache)
+    {
+        for (cache_block_t* p = cache->lru.head; p;)
+        {
+            cache_block_t* next = p->lru_next;
+            free(p);
+            p = next;
+        }
+
+        free(cache);
+    }
+}
+
+ssize_t ext2_cache_read(
+    ext2_cache_t* cache,
+    uint64_t offset,
+    void* data,
+    size_t size)
+{
+    ssize_t ret = 0;
+    const uint32_t bs = cache->block_size;
+    uint8_t* p = data;
+    size_t rem = size;
+
+    myst_spin_lock(&cache->lock);
+
+    while (rem)
+    {
+        const size_t off = offset % bs;
+        const size_t n = (rem < bs - off) ? rem : bs - off;
+        cache_block_t* cb;
+
+        ECHECK(_get_block(cache, offset / bs, false, &cb));
+        memcpy(p, cb->data + off, n);
+
+        offset += n;
+        p += n;
+        rem -= n;
+    }
+
+    ret = (ssize_t)size;
+
+done:
+    myst_spin_unlock(&cache->lock);
+    return ret;
+}
+
+int ext2_cache_read_blocks(
+    ext2_cache_t* cache,
+    uint64_t blkno,
+    size_t n,
+    void* data)
+{
+    int ret = 0;
+    const uint32_t bs = cache->block_size;
+    uint8_t* p = data;
+
+    myst_spin_lock(&cache->lock);
+
+    while (n)
+    {
+        cache_block_t* cb;
+        size_t count = 0;
+
+        /* cached blocks may be newer than the device (if dirty) */
+        if ((cb = _find_block(cache, blkno)))
+        {
+            cache->stats.hits++;
+            memcpy(p, cb->data, bs);
+            count = 1;
+        }
+        else
+        {
+            /* read the run of uncached blocks at once, bypassing the cache */
+            while (count < n && !_find_block(cache, blkno + count))
+                count++;
+
+            ECHECK(_dev_get(cache, blkno, count, p));
+        }
+
+        blkno += count;
+        p += count * bs;
+        n -= count;
+    }
+
+done:
+    myst_spin_unlock(&cache->lock);
+    return ret;
+}
+
+int ext2_cache_prefetch(ext2_cache_t* cache, uint64_t blkno, size_t n)
+{
+    int ret = 0;
+    const uint32_t bs = cache->block_size;
+    uint8_t* buf = NULL;
+    bool locked = false;
+
+    /* leave the cache room for everything else */
+    if (n > cache->max_blocks / 2)
+        n = cache->max_blocks / 2;
+
+    if (n == 0)
+        goto done;
+
+    if (!(buf = malloc(n * bs)))
+        ERAISE(-ENOMEM);
+
+    myst_spin_lock(&cache->lock);
+    locked = true;
+
+    while (n)
+    {
+        size_t count = 0;
+
+        if (_find_block(cache, blkno))
+        {
+            blkno++;
+            n--;
+            continue;
+        }
+
+        while (count < n && !_find_block(cache, blkno + count))
+            count++;
+
+        ECHECK(_dev_get(cache, blkno, count, buf));
+
+        for (size_t i = 0; i < count; i++)
+        {
+            cache_block_t** chain = _chain(cache, blkno + i);
+            cache_block_t* cb;
+
+            ECHECK(_evict(cache));
+
+            if (!(cb = malloc(sizeof(cache_block_t) + bs)))
+                ERAISE(-ENOMEM);
+
+            cb->blkno = blkno + i;
+            cb->dirty = false;
+            memcpy(cb->data, buf + i * bs, bs);
+
+            cb->next = *chain;
+            *chain = cb;
+            _lru_append(cache, cb);
+        }
+
+        cache->stats.prefetched += count;
+        blkno += count;
+        n -= count;
+    }
+
+done:
+
+    if (locked)
+        myst_spin_unlock(&cache->lock);
+
+    if (buf)
+        free(buf);
+
+    return ret;
+}
+
+ssize_t ext2_cache_write(
+    ext2_cache_t* cache,
+    uint64_t offset,
+    const void* data,
+    size_t size)
+{
+    ssize_t ret = 0;
+    const uint32_t bs = cache->block_size;
+    const uint8_t* p = data;
+    size_t rem = size;
+
+    myst_spin_lock(&cache->lock);
+
+    while (rem)
+    {
+        const size_t off = offset % bs;
+        const size_t n = (rem < bs - off) ? rem : bs - off;
+        cache_block_t* cb;
+
+        ECHECK(_get_block(cache, offset / bs, n == bs, &cb));
+        memcpy(cb->data + off, p, n);
+        cb->dirty = true;
+
+        /* without room for a dirty block, write through */
+        if (cache->max_blocks == 0)
+            ECHECK(_evict(cache));
+
+        offset += n;
+        p += n;
+        rem -= n;
+    }
+
+    ret = (ssize_t)size;
+
+done:
+    myst_spin_unlock(&cache->lock);
+    return ret;
+}
+
+int ext2_cache_sync(ext2_cache_t* cache)
+{
+    int ret = 0;
+
+    myst_spin_lock(&cache->lock);
+
+    for (cache_block_t* p = cache->lru.head; p; p = p->lru_next)
+    {
+        if (p->dirty)
+            ECHECK(_dev_put(cache, p));
+    }
+
+done:
+    myst_spin_unlock(&cache->lock);
+    return ret;
+}
+
+int ext2_cache_resize(ext2_cache_t* cache, size_t max_blocks)
+{
+    int ret = 0;
+
+    myst_spin_lock(&cache->lock);
+
+    /* evict down to the new size (evicting leaves room for one more) */
+    cache->max_blocks = max_blocks + 1;
+    ret = _evict(cache);
+    cache->max_blocks = max_blocks;
+
+    myst_spin_unlock(&cache->lock);
+
+    return ret;
+}
+
+void ext2_cache_stats(ext2_cache_t* cache, ext2_cache_stats_t* stats)
+{
+    myst_spin_lock(&cache->lock);
+
+    *stats = cache->stats;
+    stats->blocks = cache->lru.size;
+    stats->dirty = 0;
+
+    for (cache_block_t* p = cache->lru.head; p; p = p->lru_next)
+    {
+        if (p->dirty)
+            stats->dirty++;
+    }
+
+    myst_spin_unlock(&cache->lock);
+}
+
+void ext2_get_blkdev_stats(uint64_t* gets, uint64_t* puts)
+{
+    *gets = __atomic_load_n(&_dev_gets, __ATOMIC_RELAXED);
+    *puts = __atomic_load_n(&_dev_puts, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,217 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "ext2common.h"
+
+/*
+**==============================================================================
+**
+** Hashes of file names as used by indexed (htree) directories: the legacy,
+** half-MD4 and TEA hashes, each in the signed and unsigned char variants.
+**
+**==============================================================================
+*/
+
+static uint32_t _legacy_hash(const char* name, size_t len, bool is_unsigned)
+{
+    uint32_t hash;
+    uint32_t hash0 = 0x12a3fe2d;
+    uint32_t hash1 = 0x37abe8f9;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        int c = is_unsigned ? (int)(unsigned char)name[i]
+                            : (int)(signed char)name[i];
+
+        hash = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+
+        if (hash & 0x80000000)
+            hash -= 0x7fffffff;
+
+        hash1 = hash0;
+        hash0 = hash;
+    }
+
+    return hash0 << 1;
+}
+
+/* Pack up to num * 4 bytes of the name into words, padded with the length */
+static void _str2hashbuf(
+    const char* msg,
+    size_t len,
+    uint32_t* buf,
+    int num,
+    bool is_unsigned)
+{
+    uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+    uint32_t val;
+
+    pad |= pad << 16;
+    val = pad;
+
+    if (len > (size_t)num * 4)
+        len = (size_t)num * 4;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        int c = is_unsigned ? (int)(unsigned char)msg[i]
+                            : (int)(signed char)msg[i];
+
+        val = (uint32_t)c + (val << 8);
+
+        if (i % 4 == 3)
+        {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+
+    if (--num >= 0)
+        *buf++ = val;
+
+    while (--num >= 0)
+        *buf++ = pad;
+}
+
+static uint32_t _rol32(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + x, a = _rol32(a, s))
+#define K1 0
+#define K2 013240474631U
+#define K3 015666365641U
+
+static void _half_md4_transform(uint32_t buf[4], const uint32_t in[8])
+{
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    /* round 1 */
+    ROUND(F, a, b, c, d, in[0] + K1, 3);
+    ROUND(F, d, a, b, c, in[1] + K1, 7);
+    ROUND(F, c, d, a, b, in[2] + K1, 11);
+    ROUND(F, b, c, d, a, in[3] + K1, 19);
+    ROUND(F, a, b, c, d, in[4] + K1, 3);
+    ROUND(F, d, a, b, c, in[5] + K1, 7);
+    ROUND(F, c, d, a, b, in[6] + K1, 11);
+    ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+    /* round 2 */
+    ROUND(G, a, b, c, d, in[1] + K2, 3);
+    ROUND(G, d, a, b, c, in[3] + K2, 5);
+    ROUND(G, c, d, a, b, in[5] + K2, 9);
+    ROUND(G, b, c, d, a, in[7] + K2, 13);
+    ROUND(G, a, b, c, d, in[0] + K2, 3);
+    ROUND(G, d, a, b, c, in[2] + K2, 5);
+    ROUND(G, c, d, a, b, in[4] + K2, 9);
+    ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+    /* round 3 */
+    ROUND(H, a, b, c, d, in[3] + K3, 3);
+    ROUND(H, d, a, b, c, in[7] + K3, 9);
+    ROUND(H, c, d, a, b, in[2] + K3, 11);
+    ROUND(H, b, c, d, a, in[6] + K3, 15);
+    ROUND(H, a, b, c, d, in[1] + K3, 3);
+    ROUND(H, d, a, b, c, in[5] + K3, 9);
+    ROUND(H, c, d, a, b, in[0] + K3, 11);
+    ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+static void _tea_transform(uint32_t buf[4], const uint32_t in[4])
+{
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0], b1 = buf[1];
+    uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+
+    for (int n = 0; n < 16; n++)
+    {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+int ext2_dirhash(
+    const char* name,
+    size_t len,
+    uint8_t version,
+    const uint32_t seed[4],
+    uint32_t* hash_out)
+{
+    uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    uint32_t in[8];
+    uint32_t hash;
+    bool is_unsigned = false;
+
+    if (seed[0] || seed[1] || seed[2] || seed[3])
+        memcpy(buf, seed, sizeof(buf));
+
+    switch (version)
+    {
+        case EXT2_HASH_LEGACY_UNSIGNED:
+            is_unsigned = true;
+            /* fall through */
+        case EXT2_HASH_LEGACY:
+        {
+            hash = _legacy_hash(name, len, is_unsigned);
+            break;
+        }
+        case EXT2_HASH_HALF_MD4_UNSIGNED:
+            is_unsigned = true;
+            /* fall through */
+        case EXT2_HASH_HALF_MD4:
+        {
+            for (size_t i = 0; i < len; i += 32)
+            {
+                _str2hashbuf(name + i, len - i, in, 8, is_unsigned);
+                _half_md4_transform(buf, in);
+            }
+
+            hash = buf[1];
+            break;
+        }
+        case EXT2_HASH_TEA_UNSIGNED:
+            is_unsigned = true;
+            /* fall through */
+        case EXT2_HASH_TEA:
+        {
+            for (size_t i = 0; i < len; i += 16)
+            {
+                _str2hashbuf(name + i, len - i, in, 4, is_unsigned);
+                _tea_transform(buf, in);
+            }
+
+            hash = buf[0];
+            break;
+        }
+        default:
+            return -EINVAL;
+    }
+
+    /* the low bit is reserved (to flag hash collisions across blocks) */
+    hash &= ~1U;
+
+    /* avoid the end-of-directory marker */
+    if (hash == (0x7fffffffU << 1))
+        hash = (0x7fffffffU - 1) << 1;
+
+    *hash_out = hash;
+    return 0;
+}
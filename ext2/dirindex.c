@@ -0,0 +1,427 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/eraise.h>
+#include <myst/spinlock.h>
+#include "ext2common.h"
+
+/*
+**==============================================================================
+**
+** The in-memory directory index:
+**
+**     Maps the names in a classic (linear) directory to their entries with a
+**     hash table, built from the directory data on its first lookup so that
+**     later lookups need not load and scan the whole directory. The indexes
+**     of the least recently used directories are dropped to keep the total
+**     number of indexed entries bounded.
+**
+**==============================================================================
+*/
+
+/* Number of hash chains for directories (a power of two) */
+#define DIR_CHAINS 256
+
+typedef struct entry
+{
+    struct entry* next;
+    uint32_t hash;
+    uint32_t inode;
+    uint8_t file_type;
+    uint8_t name_len;
+    char name[];
+} entry_t;
+
+typedef struct dir
+{
+    /* link for the hash table chain */
+    struct dir* next;
+
+    /* links for the LRU list (where first is least recently used) */
+    struct dir* lru_prev;
+    struct dir* lru_next;
+
+    ext2_ino_t ino;
+    size_t count;
+    size_t nchains; /* a power of two */
+    entry_t** chains;
+} dir_t;
+
+struct ext2_dirindex
+{
+    dir_t* chains[DIR_CHAINS];
+    struct
+    {
+        dir_t* head;
+        dir_t* tail;
+    } lru;
+    size_t count; /* indexed entries in all directories */
+    size_t max_entries;
+    myst_spinlock_t lock;
+};
+
+/* FNV-1a */
+static uint32_t _hash(const char* name, size_t len)
+{
+    uint32_t h = 2166136261U;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)name[i];
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static void _lru_append(ext2_dirindex_t* index, dir_t* dir)
+{
+    dir->lru_next = NULL;
+    dir->lru_prev = index->lru.tail;
+
+    if (index->lru.tail)
+        index->lru.tail->lru_next = dir;
+    else
+        index->lru.head = dir;
+
+    index->lru.tail = dir;
+}
+
+static void _lru_remove(ext2_dirindex_t* index, dir_t* dir)
+{
+    if (dir->lru_prev)
+        dir->lru_prev->lru_next = dir->lru_next;
+    else
+        index->lru.head = dir->lru_next;
+
+    if (dir->lru_next)
+        dir->lru_next->lru_prev = dir->lru_prev;
+    else
+        index->lru.tail = dir->lru_prev;
+}
+
+static dir_t** _dir_chain(ext2_dirindex_t* index, ext2_ino_t ino)
+{
+    return &index->chains[ino & (DIR_CHAINS - 1)];
+}
+
+static dir_t* _find_dir(ext2_dirindex_t* index, ext2_ino_t ino)
+{
+    dir_t* dir;
+
+    for (dir = *_dir_chain(index, ino); dir; dir = dir->next)
+    {
+        if (dir->ino == ino)
+            break;
+    }
+
+    return dir;
+}
+
+static void _free_dir(dir_t* dir)
+{
+    for (size_t i = 0; i < dir->nchains; i++)
+    {
+        for (entry_t* p = dir->chains[i]; p;)
+        {
+            entry_t* next = p->next;
+            free(p);
+            p = next;
+        }
+    }
+
+    free(dir->chains);
+    free(dir);
+}
+
+static void _drop_dir(ext2_dirindex_t* index, dir_t* dir)
+{
+    dir_t** pp = _dir_chain(index, dir->ino);
+
+    while (*pp != dir)
+        pp = &(*pp)->next;
+
+    *pp = dir->next;
+    _lru_remove(index, dir);
+    index->count -= dir->count;
+    _free_dir(dir);
+}
+
+static entry_t** _find_entry(dir_t* dir, const char* name, size_t len)
+{
+    const uint32_t hash = _hash(name, len);
+    entry_t** pp = &dir->chains[hash & (dir->nchains - 1)];
+
+    for (; *pp; pp = &(*pp)->next)
+    {
+        const entry_t* p = *pp;
+
+        if (p->hash == hash && p->name_len == len &&
+            memcmp(p->name, name, len) == 0)
+        {
+            break;
+        }
+    }
+
+    return pp;
+}
+
+static int _add_entry(
+    dir_t* dir,
+    uint32_t inode,
+    uint8_t type,
+    const char* name,
+    size_t len)
+{
+    int ret = 0;
+    const uint32_t hash = _hash(name, len);
+    entry_t** chain = &dir->chains[hash & (dir->nchains - 1)];
+    entry_t* p;
+
+    if (!(p = malloc(sizeof(entry_t) + len)))
+        ERAISE(-ENOMEM);
+
+    p->hash = hash;
+    p->inode = inode;
+    p->file_type = type;
+    p->name_len = (uint8_t)len;
+    memcpy(p->name, name, len);
+
+    p->next = *chain;
+    *chain = p;
+    dir->count++;
+
+done:
+    return ret;
+}
+
+int ext2_dirindex_create(size_t max_entries, ext2_dirindex_t** index_out)
+{
+    int ret = 0;
+    ext2_dirindex_t* index;
+
+    if (!index_out)
+        ERAISE(-EINVAL);
+
+    if (!(index = calloc(1, sizeof(ext2_dirindex_t))))
+        ERAISE(-ENOMEM);
+
+    index->max_entries = max_entries;
+    index->lock = MYST_SPINLOCK_INITIALIZER;
+
+    *index_out = index;
+
+done:
+    return ret;
+}
+
+void ext2_dirindex_release(ext2_dirindex_t* index)
+{
+    if (index)
+    {
+        for (dir_t* p = index->lru.head; p;)
+        {
+            dir_t* next = p->lru_next;
+            _free_dir(p);
+            p = next;
+        }
+
+        free(index);
+    }
+}
+
+int ext2_dirindex_lookup(
+    ext2_dirindex_t* index,
+    ext2_ino_t dino,
+    const char* name,
+    ext2_dirent_t* ent)
+{
+    int ret = 0;
+    const size_t len = strlen(name);
+    dir_t* dir;
+    const entry_t* p;
+
+    myst_spin_lock(&index->lock);
+
+    if (!(dir = _find_dir(index, dino)))
+    {
+        ret = 1;
+        goto done;
+    }
+
+    /* move to the back of the LRU list */
+    if (dir != index->lru.tail)
+    {
+        _lru_remove(index, dir);
+        _lru_append(index, dir);
+    }
+
+    if (len > UINT8_MAX || !(p = *_find_entry(dir, name, len)))
+    {
+        ret = -ENOENT;
+        goto done;
+    }
+
+    memset(ent, 0, sizeof(ext2_dirent_t));
+    ent->inode = p->inode;
+    ent->name_len = p->name_len;
+    ent->file_type = p->file_type;
+    memcpy(ent->name, p->name, p->name_len);
+
+done:
+    myst_spin_unlock(&index->lock);
+    return ret;
+}
+
+int ext2_dirindex_build(
+    ext2_dirindex_t* index,
+    ext2_ino_t dino,
+    const void* data,
+    size_t size)
+{
+    int ret = 0;
+    const uint8_t* p = data;
+    const uint8_t* end = p + size;
+    size_t count = 0;
+    dir_t* dir = NULL;
+
+    /* count the entries to size the table */
+    while (p + 8 <= end)
+    {
+        const ext2_dirent_t* ent = (const ext2_dirent_t*)p;
+
+        if (ent->rec_len < 8 || p + ent->rec_len > end)
+            ERAISE(-EINVAL);
+
+        if (ent->inode)
+            count++;
+
+        p += ent->rec_len;
+    }
+
+    /* leave directories too large for the whole index unindexed */
+    if (count > index->max_entries)
+        goto done;
+
+    if (!(dir = calloc(1, sizeof(dir_t))))
+        ERAISE(-ENOMEM);
+
+    dir->ino = dino;
+
+    for (dir->nchains = 16; dir->nchains < count; dir->nchains *= 2)
+        ;
+
+    if (!(dir->chains = calloc(dir->nchains, sizeof(entry_t*))))
+        ERAISE(-ENOMEM);
+
+    for (p = data; p + 8 <= end; p += ((const ext2_dirent_t*)p)->rec_len)
+    {
+        const ext2_dirent_t* ent = (const ext2_dirent_t*)p;
+
+        if (ent->inode && 8 + (size_t)ent->name_len <= ent->rec_len)
+        {
+            ECHECK(_add_entry(
+                dir, ent->inode, ent->file_type, ent->name, ent->name_len));
+        }
+    }
+
+    myst_spin_lock(&index->lock);
+    {
+        dir_t* old;
+
+        if ((old = _find_dir(index, dino)))
+            _drop_dir(index, old);
+
+        /* make room by dropping the least recently used indexes */
+        while (index->lru.head &&
+               index->count + dir->count > index->max_entries)
+        {
+            _drop_dir(index, index->lru.head);
+        }
+
+        dir->next = *_dir_chain(index, dino);
+        *_dir_chain(index, dino) = dir;
+        _lru_append(index, dir);
+        index->count += dir->count;
+        dir = NULL;
+    }
+    myst_spin_unlock(&index->lock);
+
+done:
+
+    if (dir)
+        _free_dir(dir);
+
+    return ret;
+}
+
+void ext2_dirindex_add(
+    ext2_dirindex_t* index,
+    ext2_ino_t dino,
+    const ext2_dirent_t* ent)
+{
+    dir_t* dir;
+
+    myst_spin_lock(&index->lock);
+
+    if ((dir = _find_dir(index, dino)))
+    {
+        /* drop the index rather than let it go stale (or grow past its
+         * table, in which case the next lookup rebuilds it) */
+        if (dir->count >= 2 * dir->nchains ||
+            _add_entry(
+                dir, ent->inode, ent->file_type, ent->name, ent->name_len) != 0)
+        {
+            _drop_dir(index, dir);
+        }
+        else
+        {
+            index->count++;
+        }
+    }
+
+    myst_spin_unlock(&index->lock);
+}
+
+void ext2_dirindex_remove(
+    ext2_dirindex_t* index,
+    ext2_ino_t dino,
+    const char* name)
+{
+    const size_t len = strlen(name);
+    dir_t* dir;
+
+    myst_spin_lock(&index->lock);
+
+    if ((dir = _find_dir(index, dino)) && len <= UINT8_MAX)
+    {
+        entry_t** pp = _find_entry(dir, name, len);
+        entry_t* p;
+
+        if ((p = *pp))
+        {
+            *pp = p->next;
+            free(p);
+            dir->count--;
+            index->count--;
+        }
+    }
+
+    myst_spin_unlock(&index->lock);
+}
+
+void ext2_dirindex_drop(ext2_dirindex_t* index, ext2_ino_t dino)
+{
+    dir_t* dir;
+
+    myst_spin_lock(&index->lock);
+
+    if ((dir = _find_dir(index, dino)))
+        _drop_dir(index, dir);
+
+    myst_spin_unlock(&index->lock);
+}
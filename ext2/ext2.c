@@ -24,25 +24,51 @@
 #define EXT2_DOUBLE_INDIRECT_BLOCK 13
 #define EXT2_TRIPLE_INDIRECT_BLOCK 14
 
+/* The most file data ext2_read() asks the device for at once */
+#define EXT2_MAX_READ_SIZE (1024 * 1024)
+
+/* The most blocks allocated at once ahead of an appending writer */
+#define EXT2_PREALLOC_BLOCKS 32
+
+/* The range of the read-ahead window for sequential readers */
+#define EXT2_READAHEAD_MIN (16 * 1024)
+#define EXT2_READAHEAD_MAX (1024 * 1024)
+
 #if 0
 #define CHECKS
 #endif
 
+/* A directory stream, which reads the directory one block at a time (so
+ * through the block map and the read-ahead of its file) rather than loading
+ * it whole. Entries never span blocks, so the cursor is just the offset of
+ * the next entry. */
 struct ext2_dir
 {
-    void* data;
-    size_t size;
-    const void* next;
+    myst_file_t* file; /* the directory (null if embedded in its file) */
+    uint64_t offset;   /* of the next entry */
+    uint8_t* block;    /* a copy of the block at block_offset (or null) */
+    uint64_t block_offset;
+    size_t block_size; /* the bytes of block[] (zero if none) */
     struct dirent ent;
 };
 
 #define FILE_MAGIC 0x0e6fc76762264945
 
+/* A run of logical blocks that map to contiguous physical blocks (or to a
+ * hole when pblk is zero) */
+typedef struct extent
+{
+    uint32_t lblk;
+    uint32_t pblk;
+    uint32_t len;
+} extent_t;
+
 struct myst_file
 {
     uint64_t magic;
     ext2_ino_t ino;
-    ext2_inode_t inode;
+    ext2_inode_t* inode; /* the shared inode (unless an internal file) */
+    ext2_icache_entry_t* ientry;
     uint64_t offset;
     int open_flags;
     uint32_t access;    /* (O_RDONLY | O_RDWR | O_WRONLY) */
@@ -50,6 +76,31 @@ struct myst_file
     int fdflags;        /* file descriptor flags: FD_CLOEXEC */
     char realpath[EXT2_PATH_MAX];
     ext2_dir_t dir;
+
+    /* read-ahead state (see _readahead()) */
+    struct
+    {
+        uint64_t next;   /* where the next sequential read would start */
+        uint32_t window; /* blocks to keep read ahead (zero if random) */
+        uint32_t end;    /* the logical block after the last one read ahead */
+    } ra;
+
+    /* the decoded block map, built lazily (see _file_get_blkno()) */
+    struct
+    {
+        extent_t* extents; /* sorted by lblk and never overlapping */
+        size_t size;
+        size_t capacity;
+        uint64_t gen; /* the inode's generation the map is current with */
+    } map;
+
+    /* blocks allocated ahead of appending writes (see _file_get_new_blkno())
+     */
+    struct
+    {
+        uint32_t blkno;
+        uint32_t count;
+    } prealloc;
 };
 
 static bool _file_valid(const myst_file_t* file)
@@ -59,14 +110,24 @@ static bool _file_valid(const myst_file_t* file)
 
 static void _file_clear(myst_file_t* file)
 {
+    if (file->map.extents)
+        free(file->map.extents);
+
+    if (file->dir.block)
+        free(file->dir.block);
+
     memset(file, 0xdd, sizeof(myst_file_t));
 }
 
-static void _file_free(myst_file_t* file)
+static void _file_free(ext2_t* ext2, myst_file_t* file)
 {
     if (file)
     {
         assert(_file_valid(file));
+
+        if (file->ientry)
+            ext2_icache_put(ext2->icache, file->ientry);
+
         _file_clear(file);
         free(file);
     }
@@ -177,7 +238,12 @@ static bool _zero_filled_u32(const uint32_t* s, size_t n)
     return p == end;
 }
 
-static ssize_t _read(myst_blkdev_t* dev, size_t offset, void* data, size_t size)
+/* Read from the device itself (only until the buffer cache exists) */
+static ssize_t _dev_read(
+    myst_blkdev_t* dev,
+    size_t offset,
+    void* data,
+    size_t size)
 {
     uint32_t blkno;
     uint32_t i;
@@ -236,71 +302,19 @@ static ssize_t _read(myst_blkdev_t* dev, size_t offset, void* data, size_t size)
     return size;
 }
 
+/* Read and write through the buffer cache */
+static ssize_t _read(const ext2_t* ext2, size_t offset, void* data, size_t size)
+{
+    return ext2_cache_read(ext2->cache, offset, data, size);
+}
+
 static ssize_t _write(
-    myst_blkdev_t* dev,
+    const ext2_t* ext2,
     size_t offset,
     const void* data,
     size_t size)
 {
-    uint32_t blkno;
-    uint32_t i;
-    uint32_t rem;
-    uint8_t* ptr;
-    const size_t blksz = MYST_BLKSIZE;
-
-    if (!dev || !data)
-        return -1;
-
-    blkno = offset / blksz;
-
-    /* optimize for common case where offset and size are divisible by blksz */
-    if ((offset % blksz) == 0 && (size % blksz) == 0)
-    {
-        const size_t n = size / blksz;
-        ptr = (uint8_t*)data;
-
-        for (i = 0; i < n; i++)
-        {
-            if (dev->put(dev, i + blkno, ptr) != 0)
-                return -1;
-
-            ptr += blksz;
-        }
-    }
-    else
-    {
-        for (i = blkno, rem = size, ptr = (uint8_t*)data; rem; i++)
-        {
-            uint8_t blk[MYST_BLKSIZE];
-            uint32_t off; /* offset into this block */
-            uint32_t len; /* bytes to write from this block */
-
-            /* Fetch the block */
-            if (dev->get(dev, i, blk) != 0)
-                return -1;
-
-            /* If first block */
-            if (i == blkno)
-                off = offset % MYST_BLKSIZE;
-            else
-                off = 0;
-
-            len = MYST_BLKSIZE - off;
-
-            if (len > rem)
-                len = rem;
-
-            memcpy(&blk[off], ptr, len);
-            rem -= len;
-            ptr += len;
-
-            /* Rewrite the block */
-            if (dev->put(dev, i, blk) != 0)
-                return -1;
-        }
-    }
-
-    return size;
+    return ext2_cache_write(ext2->cache, offset, data, size);
 }
 
 const uint8_t ext2_count_bits_table[] = {
@@ -418,7 +432,7 @@ static int _write_block(
 #endif
 
     /* Write the block */
-    if (_write(ext2->dev, offset, block->data, block->size) != block->size)
+    if (_write(ext2, offset, block->data, block->size) != block->size)
     {
         ERAISE(-EIO);
     }
@@ -430,7 +444,8 @@ done:
     return ret;
 }
 
-static int _write_group(const ext2_t* ext2, uint32_t grpno)
+/* Write count group descriptors from grpno on */
+static int _write_groups(const ext2_t* ext2, uint32_t grpno, uint32_t count)
 {
     int ret = 0;
     uint32_t blkno;
@@ -440,11 +455,12 @@ static int _write_group(const ext2_t* ext2, uint32_t grpno)
     else
         blkno = 1;
 
-    const size_t size = sizeof(ext2_group_desc_t);
-    const size_t offset = _blk_offset(blkno, ext2->block_size) + (grpno * size);
+    const size_t size = count * sizeof(ext2_group_desc_t);
+    const size_t offset = _blk_offset(blkno, ext2->block_size) +
+                          (grpno * sizeof(ext2_group_desc_t));
 
-    /* Read the block */
-    if (_write(ext2->dev, offset, &ext2->groups[grpno], size) != size)
+    /* Write the descriptors */
+    if (_write(ext2, offset, &ext2->groups[grpno], size) != size)
     {
         ERAISE(-EIO);
     }
@@ -460,7 +476,7 @@ static int _write_super_block(const ext2_t* ext2)
     const size_t size = sizeof(ext2_super_block_t);
 
     /* Read the superblock */
-    if (_write(ext2->dev, EXT2_BASE_OFFSET, &ext2->sb, size) != size)
+    if (_write(ext2, EXT2_BASE_OFFSET, &ext2->sb, size) != size)
     {
         ERAISE(-EIO);
     }
@@ -493,50 +509,95 @@ done:
 }
 #endif
 
-static int _write_block_bitmap(
-    const ext2_t* ext2,
-    uint32_t group_index,
-    const ext2_block_t* block)
+/*
+**==============================================================================
+**
+** Metadata write-back:
+**
+**     Allocating or releasing a block or an inode changes a bitmap, a group
+**     descriptor and the superblock. The bitmap bytes that changed are
+**     written to the buffer cache at once, while the counts in the group
+**     descriptors and the superblock are only marked dirty here and written
+**     by _flush_metadata() on ext2_sync() and ext2_release(). So a large
+**     write updates each of these blocks once rather than per allocation.
+**     The flush writes the descriptors before the superblock.
+**
+**==============================================================================
+*/
+
+static void _dirty_group(ext2_t* ext2, uint32_t grpno)
+{
+    _set_bit(ext2->dirty_groups, (ext2->group_count + 7) / 8, grpno);
+}
+
+static void _dirty_super_block(ext2_t* ext2)
+{
+    ext2->sb_dirty = true;
+}
+
+static int _flush_metadata(ext2_t* ext2)
 {
     int ret = 0;
-    uint32_t bitmap_size_bytes;
+    const uint32_t size = (ext2->group_count + 7) / 8;
+    uint32_t grpno = 0;
 
-    bitmap_size_bytes = ext2->sb.s_blocks_per_group / 8;
+    while (grpno < ext2->group_count)
+    {
+        uint32_t n = 0;
 
-    if (block->size != bitmap_size_bytes)
-        ERAISE(-EINVAL);
+        /* write each run of dirty descriptors at once */
+        while (grpno + n < ext2->group_count &&
+               ext2_test_bit(ext2->dirty_groups, size, grpno + n))
+        {
+            n++;
+        }
 
-    if (group_index > ext2->group_count)
-        ERAISE(-EINVAL);
+        if (n)
+        {
+            ECHECK(_write_groups(ext2, grpno, n));
+
+            for (uint32_t i = grpno; i < grpno + n; i++)
+                _clear_bit(ext2->dirty_groups, size, i);
+        }
 
-    ECHECK(
-        _write_block(ext2, ext2->groups[group_index].bg_block_bitmap, block));
+        grpno += n + 1;
+    }
+
+    if (ext2->sb_dirty)
+    {
+        ECHECK(_write_super_block(ext2));
+        ext2->sb_dirty = false;
+    }
 
 done:
     return ret;
 }
 
-static int _write_group_with_bitmap(
-    ext2_t* ext2,
-    uint32_t grpno,
-    ext2_block_t* bitmap)
+/* Write the bytes of a bitmap that hold bits first to first + count - 1 */
+static int _write_bitmap_bits(
+    const ext2_t* ext2,
+    uint32_t blkno,
+    const ext2_block_t* bitmap,
+    uint32_t first,
+    uint32_t count)
 {
     int ret = 0;
+    const uint32_t start = first / 8;
+    const uint32_t end = (first + count + 7) / 8;
+    const size_t offset = _blk_offset(blkno, ext2->block_size) + start;
 
-    /* Write the group */
-    ECHECK(_write_group(ext2, grpno));
-
-    /* Write the bitmap */
-    ECHECK(_write_block_bitmap(ext2, grpno, bitmap));
+    if (count == 0 || end > bitmap->size)
+        ERAISE(-EINVAL);
 
-    ret = 0;
+    if (_write(ext2, offset, bitmap->data + start, end - start) != end - start)
+        ERAISE(-EIO);
 
 done:
     return ret;
 }
 
-/* comparison function for qsort */
-static int _put_blkno(ext2_t* ext2, uint32_t blkno)
+/* Release count blocks from blkno on (all in the same group) */
+static int _put_blknos(ext2_t* ext2, uint32_t blkno, uint32_t count)
 {
     int ret = 0;
     const uint32_t grpno = _blkno_to_grpno(ext2, blkno);
@@ -550,120 +611,166 @@ static int _put_blkno(ext2_t* ext2, uint32_t blkno)
     /* read the block bitmap */
     ECHECK(ext2_read_block_bitmap(ext2, grpno, &bitmap));
 
-#ifdef CHECK
-    /* be sure the bit for this block number is actually set */
-    if (!_test_bit(bitmap.data, bitmap.size, lblkno))
+    if (lblkno + count > bitmap.size * 8)
         ERAISE(-EINVAL);
+
+    for (uint32_t i = lblkno; i < lblkno + count; i++)
+    {
+#ifdef CHECK
+        /* be sure the bit for this block number is actually set */
+        if (!_test_bit(bitmap.data, bitmap.size, i))
+            ERAISE(-EINVAL);
 #endif
 
-    /* clear the bit for the block number */
-    _clear_bit(bitmap.data, bitmap.size, lblkno);
+        /* clear the bit for the block number */
+        _clear_bit(bitmap.data, bitmap.size, i);
+    }
+
+    /* write the bitmap */
+    ECHECK(_write_bitmap_bits(
+        ext2, ext2->groups[grpno].bg_block_bitmap, &bitmap, lblkno, count));
 
     /* update the block count in the super block */
-    ext2->sb.s_free_blocks_count++;
+    ext2->sb.s_free_blocks_count += count;
+    _dirty_super_block(ext2);
 
     /* update the group block count */
-    ext2->groups[grpno].bg_free_blocks_count++;
-
-    /* write the group and bitmap */
-    ECHECK(_write_group_with_bitmap(ext2, grpno, &bitmap));
-
-    /* ATTN: minimize super block writes */
-    /* update super block. */
-    ECHECK(_write_super_block(ext2));
+    ext2->groups[grpno].bg_free_blocks_count += count;
+    _dirty_group(ext2, grpno);
 
 done:
     return ret;
 }
 
-static int _get_blkno(ext2_t* ext2, uint32_t* blkno)
+static int _put_blkno(ext2_t* ext2, uint32_t blkno)
 {
-    int ret = 0;
-    ext2_block_t bitmap;
-    uint32_t grpno;
+    return _put_blknos(ext2, blkno, 1);
+}
 
-    /* Clear any block number */
-    *blkno = 0;
+/* Find the first clear bit from start on (or nbits if there is none) */
+static uint32_t _find_clear_bit(
+    const uint8_t* data,
+    uint32_t nbits,
+    uint32_t start)
+{
+    const uint64_t* words = (const uint64_t*)data;
+    const uint32_t size = nbits / 8;
+    uint32_t i = start;
 
-    /* Use brute force search for a free block */
-    for (grpno = 0; grpno < ext2->group_count; grpno++)
+    /* check bit-by-bit up to a word boundary */
+    for (; i < nbits && i % 64; i++)
     {
-        uint32_t lblkno;
+        if (!ext2_test_bit(data, size, i))
+            return i;
+    }
 
-        /* Read the bitmap */
+    /* skip over full words */
+    while (i + 64 <= nbits && words[i / 64] == 0xffffffffffffffff)
+        i += 64;
 
-        ECHECK(ext2_read_block_bitmap(ext2, grpno, &bitmap));
+    for (; i < nbits; i++)
+    {
+        if (!ext2_test_bit(data, size, i))
+            return i;
+    }
 
-        /* Scan the bitmap, looking for free bit */
-        {
-            const uint64_t* p = (const uint64_t*)bitmap.data;
+    return nbits;
+}
 
-            /* skip over full long words */
-            {
-                const uint64_t x = 0xffffffffffffffff;
-                size_t n = bitmap.size / sizeof(uint64_t);
-                size_t i = n;
+/* Allocate the first free block at or after goal (wrapping around to the
+ * start of the file system) along with up to count - 1 free blocks that
+ * follow it, skipping groups that have no free blocks */
+static int _get_blknos(
+    ext2_t* ext2,
+    uint32_t goal,
+    uint32_t count,
+    uint32_t* blkno_out,
+    uint32_t* count_out)
+{
+    int ret = 0;
+    const uint32_t group_count = ext2->group_count;
+    uint32_t first_grpno = 0;
+    uint32_t first_lblkno = 0;
 
-                while (n > 4 && p[0] == x && p[1] == x && p[2] == x &&
-                       p[3] == x)
-                {
-                    p += 4;
-                    i -= 4;
-                }
+    *blkno_out = 0;
+    *count_out = 0;
 
-                while (i && p[0] == x)
-                {
-                    p++;
-                    i--;
-                }
+    if (goal)
+    {
+        first_grpno = _blkno_to_grpno(ext2, goal);
+        first_lblkno = _blkno_to_lblkno(ext2, goal);
 
-                lblkno = (8 * sizeof(uint64_t)) * (n - i);
-            }
+        if (first_grpno >= group_count)
+            first_grpno = first_lblkno = 0;
+    }
 
-            for (; lblkno < bitmap.size * 8; lblkno++)
-            {
-                if (!ext2_test_bit(bitmap.data, bitmap.size, lblkno))
-                {
-                    _set_bit(bitmap.data, bitmap.size, lblkno);
-                    *blkno = _make_blkno(ext2, grpno, lblkno);
-                    break;
-                }
-            }
-        }
+    /* revisit the first group from its start (if skipped) last */
+    for (uint32_t k = 0; k <= group_count; k++)
+    {
+        const uint32_t grpno = (first_grpno + k) % group_count;
+        const uint32_t start = (k == 0) ? first_lblkno : 0;
+        ext2_block_t bitmap;
+        uint32_t nbits;
+        uint32_t lblkno;
+        uint32_t n = 1;
 
-        if (*blkno)
+        if (k == group_count && first_lblkno == 0)
             break;
-    }
 
-    /* If no free blocks found */
-    if (!*blkno)
-        ERAISE(-ENOSPC);
+        if (ext2->groups[grpno].bg_free_blocks_count == 0)
+            continue;
 
-    /* Write the superblock */
-    {
-        ext2->sb.s_free_blocks_count--;
-        ECHECK(_write_super_block(ext2));
-    }
+        ECHECK(ext2_read_block_bitmap(ext2, grpno, &bitmap));
+        nbits = bitmap.size * 8;
 
-    /* Write the group */
-    {
-        ext2->groups[grpno].bg_free_blocks_count--;
-        ECHECK(_write_group(ext2, grpno));
+        if ((lblkno = _find_clear_bit(bitmap.data, nbits, start)) == nbits)
+            continue;
+
+        while (n < count && lblkno + n < nbits &&
+               !ext2_test_bit(bitmap.data, bitmap.size, lblkno + n))
+        {
+            n++;
+        }
+
+        for (uint32_t i = lblkno; i < lblkno + n; i++)
+            _set_bit(bitmap.data, bitmap.size, i);
+
+        /* Write the bitmap */
+        ECHECK(_write_bitmap_bits(
+            ext2, ext2->groups[grpno].bg_block_bitmap, &bitmap, lblkno, n));
+
+        /* Update the superblock */
+        ext2->sb.s_free_blocks_count -= n;
+        _dirty_super_block(ext2);
+
+        /* Update the group */
+        ext2->groups[grpno].bg_free_blocks_count -= n;
+        _dirty_group(ext2, grpno);
+
+        *blkno_out = _make_blkno(ext2, grpno, lblkno);
+        *count_out = n;
+        goto done;
     }
 
-    /* Write the bitmap */
-    ECHECK(_write_block_bitmap(ext2, grpno, &bitmap));
+    /* If no free blocks found */
+    ERAISE(-ENOSPC);
 
 done:
     return ret;
 }
 
+static int _get_blkno(ext2_t* ext2, uint32_t* blkno)
+{
+    uint32_t count;
+    return _get_blknos(ext2, 0, 1, blkno, &count);
+}
+
 static int _read_super_block(myst_blkdev_t* dev, ext2_super_block_t* sb)
 {
     int ret = 0;
 
     /* Read the superblock */
-    if (_read(dev, EXT2_BASE_OFFSET, sb, sizeof(ext2_super_block_t)) !=
+    if (_dev_read(dev, EXT2_BASE_OFFSET, sb, sizeof(ext2_super_block_t)) !=
         sizeof(ext2_super_block_t))
     {
         ERAISE(-EIO);
@@ -681,6 +788,18 @@ static ext2_group_desc_t* _read_groups(const ext2_t* ext2)
     ext2_group_desc_t* groups = NULL;
     uint32_t groups_size = 0;
     uint32_t blkno;
+    uint32_t desc_size = sizeof(ext2_group_desc_t);
+
+    if ((ext2->sb.s_feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT))
+    {
+        if (ext2->sb.s_desc_size < sizeof(ext2_group_desc_t) ||
+            ext2->sb.s_desc_size > ext2->block_size)
+        {
+            ERAISE(-EINVAL);
+        }
+
+        desc_size = ext2->sb.s_desc_size;
+    }
 
     /* Allocate the groups list */
     {
@@ -701,13 +820,31 @@ static ext2_group_desc_t* _read_groups(const ext2_t* ext2)
         blkno = 1;
 
     /* Read the block */
-    if (_read(
-            ext2->dev,
-            _blk_offset(blkno, ext2->block_size),
-            groups,
-            groups_size) != groups_size)
+    if (desc_size == sizeof(ext2_group_desc_t))
     {
-        ERAISE(-EIO);
+        if (_read(
+                ext2,
+                _blk_offset(blkno, ext2->block_size),
+                groups,
+                groups_size) != groups_size)
+        {
+            ERAISE(-EIO);
+        }
+    }
+    else
+    {
+        /* keep the low halves (the first 32 bytes) of larger descriptors */
+        for (uint32_t i = 0; i < ext2->group_count; i++)
+        {
+            const uint64_t offset =
+                _blk_offset(blkno, ext2->block_size) + i * desc_size;
+
+            if (_read(ext2, offset, &groups[i], sizeof(ext2_group_desc_t)) !=
+                sizeof(ext2_group_desc_t))
+            {
+                ERAISE(-EIO);
+            }
+        }
     }
 
 done:
@@ -742,75 +879,51 @@ static uint32_t _ino_to_lino(const ext2_t* ext2, ext2_ino_t ino)
     return (ino - 1) % ext2->sb.s_inodes_per_group;
 }
 
-static int _write_inode_bitmap(
-    const ext2_t* ext2,
-    uint32_t group_index,
-    const ext2_block_t* block)
-{
-    int ret = 0;
-    uint32_t bitmap_size_bytes;
-
-    bitmap_size_bytes = ext2->sb.s_inodes_per_group / 8;
-
-    if (block->size != bitmap_size_bytes)
-        ERAISE(-EINVAL);
-
-    if (group_index > ext2->group_count)
-        ERAISE(-EINVAL);
-
-    ECHECK(
-        _write_block(ext2, ext2->groups[group_index].bg_inode_bitmap, block));
-
-done:
-    return ret;
-}
-
 static int _get_ino(ext2_t* ext2, ext2_ino_t* ino)
 {
     int ret = 0;
     ext2_block_t bitmap;
     uint32_t grpno;
+    uint32_t lino = 0;
 
     /* Clear the node number */
     *ino = 0;
 
-    /* Use brute force search for a free inode number */
+    /* Search the groups that have free inodes for a free inode number */
     for (grpno = 0; grpno < ext2->group_count; grpno++)
     {
-        uint32_t lino;
+        if (ext2->groups[grpno].bg_free_inodes_count == 0)
+            continue;
 
         /* Read the bitmap */
         ECHECK(ext2_read_inode_bitmap(ext2, grpno, &bitmap));
 
         /* Scan the bitmap, looking for free bit */
-        for (lino = 0; lino < bitmap.size * 8; lino++)
-        {
-            if (!ext2_test_bit(bitmap.data, bitmap.size, lino))
-            {
-                _set_bit(bitmap.data, bitmap.size, lino);
-                *ino = ext2_make_ino(ext2, grpno, lino);
-                break;
-            }
-        }
+        lino = _find_clear_bit(bitmap.data, bitmap.size * 8, 0);
 
-        if (*ino)
+        if (lino < bitmap.size * 8)
+        {
+            _set_bit(bitmap.data, bitmap.size, lino);
+            *ino = ext2_make_ino(ext2, grpno, lino);
             break;
+        }
     }
 
     /* If no free inode numbers */
     if (!*ino)
         ERAISE(-ENOSPC);
 
-    /* Write the superblock */
+    /* Write the bitmap */
+    ECHECK(_write_bitmap_bits(
+        ext2, ext2->groups[grpno].bg_inode_bitmap, &bitmap, lino, 1));
+
+    /* Update the superblock */
     ext2->sb.s_free_inodes_count--;
-    ERAISE(_write_super_block(ext2));
+    _dirty_super_block(ext2);
 
-    /* Write the group */
+    /* Update the group */
     ext2->groups[grpno].bg_free_inodes_count--;
-    ECHECK(_write_group(ext2, grpno));
-
-    /* Write the bitmap */
-    ECHECK(_write_inode_bitmap(ext2, grpno, &bitmap));
+    _dirty_group(ext2, grpno);
 
 done:
     return ret;
@@ -839,16 +952,20 @@ static int _put_ino(ext2_t* ext2, ext2_ino_t ino)
     /* clear the bitmap bit */
     _clear_bit(bitmap.data, bitmap.size, lino);
 
-    /* update the global inode count and write the superblock */
+    /* the inode number may next be used by another directory */
+    ext2_dirindex_drop(ext2->dirindex, ino);
+
+    /* Write the bitmap */
+    ECHECK(_write_bitmap_bits(
+        ext2, ext2->groups[grpno].bg_inode_bitmap, &bitmap, lino, 1));
+
+    /* update the global inode count */
     ext2->sb.s_free_inodes_count++;
-    ERAISE(_write_super_block(ext2));
+    _dirty_super_block(ext2);
 
-    /* update the group inode count and write the group */
+    /* update the group inode count */
     ext2->groups[grpno].bg_free_inodes_count++;
-    ECHECK(_write_group(ext2, grpno));
-
-    /* Write the bitmap */
-    ECHECK(_write_inode_bitmap(ext2, grpno, &bitmap));
+    _dirty_group(ext2, grpno);
 
 done:
     return ret;
@@ -859,19 +976,53 @@ static int _write_inode(
     ext2_ino_t ino,
     const ext2_inode_t* inode)
 {
-    int ret = 0;
-    uint32_t lino = _ino_to_lino(ext2, ino);
-    uint32_t grpno = _ino_to_grpno(ext2, ino);
-    const ext2_group_desc_t* group = &ext2->groups[grpno];
-    uint32_t inode_size = ext2->sb.s_inode_size;
-    uint64_t offset;
+    return ext2_icache_write(ext2->icache, ino, inode);
+}
 
-#ifdef CHECK
-    /* Check the reverse mapping */
-    {
-        ext2_ino_t tmp;
-        tmp = ext2_make_ino(ext2, grpno, lino);
-        assert(tmp == ino);
+/* Update the access time of a file that is read (per the mount flags); the
+ * inode cache writes the inode back with its other changes or on sync */
+static int _touch_atime(ext2_t* ext2, myst_file_t* file)
+{
+    ext2_inode_t* inode = file->inode;
+    const struct timespec atime = {inode->i_atime, 0};
+    const struct timespec mtime = {inode->i_mtime, 0};
+    const struct timespec ctime = {inode->i_ctime, 0};
+    struct timespec now = {0};
+
+    if (ext2->base.atime == MYST_ATIME_NONE || ext2->read_only)
+        return 0;
+
+    now.tv_sec = time(NULL);
+
+    /* timestamps only have a granularity of a second */
+    if (now.tv_sec == atime.tv_sec ||
+        !myst_atime_due(ext2->base.atime, &atime, &mtime, &ctime, &now))
+    {
+        return 0;
+    }
+
+    inode->i_atime = (uint32_t)now.tv_sec;
+    return _write_inode(ext2, file->ino, inode);
+}
+
+int ext2_store_inode(
+    const ext2_t* ext2,
+    ext2_ino_t ino,
+    const ext2_inode_t* inode)
+{
+    int ret = 0;
+    uint32_t lino = _ino_to_lino(ext2, ino);
+    uint32_t grpno = _ino_to_grpno(ext2, ino);
+    const ext2_group_desc_t* group = &ext2->groups[grpno];
+    uint32_t inode_size = ext2->sb.s_inode_size;
+    uint64_t offset;
+
+#ifdef CHECK
+    /* Check the reverse mapping */
+    {
+        ext2_ino_t tmp;
+        tmp = ext2_make_ino(ext2, grpno, lino);
+        assert(tmp == ino);
     }
 #endif
 
@@ -879,7 +1030,7 @@ static int _write_inode(
              lino * inode_size;
 
     /* Read the inode */
-    if (_write(ext2->dev, offset, inode, inode_size) != inode_size)
+    if (_write(ext2, offset, inode, inode_size) != inode_size)
         ERAISE(-ENOSPC);
 
     ret = 0;
@@ -911,9 +1062,9 @@ static int _load_file(
         ERAISE(-ENOMEM);
 
     /* handle symlinks shorter than 60 bytes up front */
-    if (S_ISLNK(file->inode.i_mode) && file->inode.i_size < 60)
+    if (S_ISLNK(file->inode->i_mode) && file->inode->i_size < 60)
     {
-        memcpy(data, file->inode.i_block, file->inode.i_size);
+        memcpy(data, file->inode->i_block, file->inode->i_size);
     }
     else
     {
@@ -939,44 +1090,6 @@ done:
     return ret;
 }
 
-static int _load_file_by_path(
-    ext2_t* ext2,
-    const char* path,
-    void** data_out,
-    size_t* size_out)
-{
-    int ret = 0;
-    myst_file_t* file = NULL;
-    void* data = NULL;
-    size_t size;
-
-    if (data_out)
-        *data_out = NULL;
-
-    if (size_out)
-        *size_out = 0;
-
-    if (!path || !data_out || !size_out)
-        ERAISE(-EINVAL);
-
-    ECHECK(ext2_open(&ext2->base, path, O_RDONLY, 0000, NULL, &file));
-    ECHECK(_load_file(ext2, file, &data, &size));
-
-    *data_out = data;
-    data = NULL;
-    *size_out = size;
-
-done:
-
-    if (file)
-        ext2_close(&ext2->base, file);
-
-    if (data)
-        free(data);
-
-    return ret;
-}
-
 static int _load_file_by_inode(
     ext2_t* ext2,
     ext2_ino_t ino,
@@ -992,19 +1105,21 @@ static int _load_file_by_inode(
 
     /* load the contents of the file */
     {
-        /* create a dummy file struct */
+        /* create a dummy file struct (with its own copy of the inode) */
+        ext2_inode_t copy = *inode;
         myst_file_t file = {
             .magic = FILE_MAGIC,
             .ino = ino,
-            .inode = *inode,
+            .inode = &copy,
             .offset = 0,
             .access = O_RDONLY,
             .open_flags = O_RDONLY,
         };
 
         /* load the data */
-        ECHECK(_load_file(ext2, &file, data, size));
+        ret = _load_file(ext2, &file, data, size);
         _file_clear(&file);
+        ECHECK(ret);
     }
 
 done:
@@ -1029,15 +1144,16 @@ static int _load_file_by_ino(
         myst_file_t file = {
             .magic = FILE_MAGIC,
             .ino = ino,
-            .inode = inode,
+            .inode = &inode,
             .offset = 0,
             .access = O_RDONLY,
             .open_flags = O_RDONLY,
         };
 
         /* load the data */
-        ECHECK(_load_file(ext2, &file, data, size));
+        ret = _load_file(ext2, &file, data, size);
         _file_clear(&file);
+        ECHECK(ret);
     }
 
 done:
@@ -1074,6 +1190,214 @@ static const ext2_dirent_t* _find_dirent(
     return NULL;
 }
 
+static int _inode_get_blkno(
+    ext2_t* ext2,
+    ext2_inode_t* inode,
+    size_t index,
+    uint32_t* blkno_out);
+
+/* Read the directory's logical block */
+static int _read_dir_block(
+    ext2_t* ext2,
+    ext2_inode_t* inode,
+    uint32_t lblkno,
+    ext2_block_t* block)
+{
+    int ret = 0;
+    uint32_t blkno;
+
+    if ((uint64_t)lblkno * ext2->block_size >= _inode_get_size(inode))
+        ERAISE(-EINVAL);
+
+    ECHECK(_inode_get_blkno(ext2, inode, lblkno, &blkno));
+
+    if (blkno == 0)
+        ERAISE(-EINVAL);
+
+    ECHECK(ext2_read_block(ext2, blkno, block));
+
+done:
+    return ret;
+}
+
+/* Copy a directory entry (only as far as its name goes) */
+static void _copy_dirent(ext2_dirent_t* ent, const ext2_dirent_t* p)
+{
+    memset(ent, 0, sizeof(ext2_dirent_t));
+    memcpy(ent, p, offsetof(ext2_dirent_t, name) + p->name_len);
+}
+
+/*
+**==============================================================================
+**
+** Lookup in indexed (htree) directories:
+**
+**     Block 0 of an indexed directory holds the "." and ".." entries and,
+**     within the ".." record, the root of a tree of (hash, block) pairs
+**     sorted by the hash of the names in each leaf block. A lookup hashes
+**     the name, descends the tree to the one leaf block that can hold it
+**     and scans only that block (and the next ones when a run of names with
+**     the same hash spans blocks).
+**
+**==============================================================================
+*/
+
+#define HTREE_MAX_LEVELS 2
+
+typedef struct htree_entry
+{
+    uint32_t hash;
+    uint32_t block;
+} htree_entry_t;
+
+/* Find the entry for the hash among the count entries of an index node
+ * (the first entry stands for every hash below the second entry's) */
+static size_t _htree_find(
+    const htree_entry_t* entries,
+    size_t count,
+    uint32_t hash)
+{
+    size_t lo = 1;
+    size_t hi = count;
+
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+
+        if (entries[mid].hash <= hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo - 1;
+}
+
+/* Look the name up in an indexed directory: returns 0 if found, -ENOENT if
+ * not, or 1 if the index can't be used (the caller then scans the blocks) */
+static int _htree_lookup(
+    ext2_t* ext2,
+    ext2_inode_t* inode,
+    const char* name,
+    ext2_dirent_t* ent)
+{
+    int ret = 0;
+    const size_t len = strlen(name);
+    const uint32_t bs = ext2->block_size;
+    ext2_block_t block;
+    const uint8_t* root_info = block.data + 24;
+    uint8_t version;
+    uint8_t levels;
+    uint32_t hash;
+    size_t offset;
+    const htree_entry_t* entries;
+    size_t count;
+    size_t i;
+    uint32_t next_hash = 0;
+    bool last = false;
+
+    if (_read_dir_block(ext2, inode, 0, &block) != 0)
+        goto unusable;
+
+    /* reserved_zero (4), hash_version, info_length, indirect_levels */
+    version = root_info[4];
+    levels = root_info[6];
+    offset = 24 + root_info[5];
+
+    if (*(const uint32_t*)root_info != 0 || root_info[5] != 8 ||
+        levels >= HTREE_MAX_LEVELS)
+    {
+        goto unusable;
+    }
+
+    if (version <= EXT2_HASH_TEA &&
+        (ext2->sb.s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+    {
+        version += EXT2_HASH_LEGACY_UNSIGNED;
+    }
+
+    if (ext2_dirhash(name, len, version, ext2->sb.s_hash_seed, &hash) != 0)
+        goto unusable;
+
+    /* descend from the root to the leaf */
+    for (uint8_t level = 0;; level++)
+    {
+        /* the limit and count take the place of the first entry's hash */
+        const uint16_t limit = *(const uint16_t*)(block.data + offset);
+
+        entries = (const htree_entry_t*)(block.data + offset);
+        count = *(const uint16_t*)(block.data + offset + 2);
+
+        if (count == 0 || count > limit || offset + limit * 8 > bs)
+            goto unusable;
+
+        i = _htree_find(entries, count, hash);
+
+        if (level == levels)
+            break;
+
+        if (_read_dir_block(ext2, inode, entries[i].block, &block) != 0)
+            goto unusable;
+
+        /* index nodes start with an empty entry spanning the block */
+        offset = 8;
+    }
+
+    /* scan the leaf (and any that continue its run of equal hashes) */
+    for (;;)
+    {
+        const uint32_t leaf = entries[i].block;
+
+        if (i + 1 < count)
+            next_hash = entries[i + 1].hash;
+        else
+            last = true;
+
+        if (_read_dir_block(ext2, inode, leaf, &block) != 0)
+            goto unusable;
+
+        for (const uint8_t* p = block.data; p + 8 <= block.data + bs;)
+        {
+            const ext2_dirent_t* e = (const ext2_dirent_t*)p;
+
+            if (e->rec_len < 8 || p + e->rec_len > block.data + bs ||
+                8 + (size_t)e->name_len > e->rec_len)
+            {
+                goto unusable;
+            }
+
+            if (e->inode && _streq(e->name, e->name_len, name, len))
+            {
+                _copy_dirent(ent, e);
+                goto done;
+            }
+
+            p += e->rec_len;
+        }
+
+        /* the next leaf is under another index node (scan instead) */
+        if (last)
+        {
+            if (levels > 0)
+                goto unusable;
+
+            ERAISE_QUIET(-ENOENT);
+        }
+
+        /* the run of names with this hash continues in the next leaf */
+        if ((next_hash & ~1U) != hash)
+            ERAISE_QUIET(-ENOENT);
+
+        i++;
+    }
+
+unusable:
+    ret = 1;
+
+done:
+    return ret;
+}
+
 static int _load_dirent(
     ext2_t* ext2,
     ext2_ino_t dino,
@@ -1084,13 +1408,37 @@ static int _load_dirent(
     void* data = NULL;
     size_t size;
     const ext2_dirent_t* p;
+    ext2_inode_t inode;
+    int r;
+
+    /* try the in-memory index of this directory */
+    if ((r = ext2_dirindex_lookup(ext2->dirindex, dino, name, ent)) <= 0)
+    {
+        ECHECK(r);
+        goto done;
+    }
+
+    ECHECK(ext2_read_inode(ext2, dino, &inode));
+
+    /* try the on-disk index of this directory */
+    if ((inode.i_flags & EXT2_INDEX_FL))
+    {
+        ECHECK(r = _htree_lookup(ext2, &inode, name, ent));
+
+        if (r == 0)
+            goto done;
+    }
 
-    ECHECK((_load_file_by_ino(ext2, dino, &data, &size)));
+    ECHECK(_load_file_by_inode(ext2, dino, &inode, &data, &size));
+
+    /* index the directory for later lookups (this may fail harmlessly) */
+    if (!(inode.i_flags & EXT2_INDEX_FL))
+        ext2_dirindex_build(ext2->dirindex, dino, data, size);
 
     if (!(p = _find_dirent(name, data, size)))
         ERAISE(-ENOENT);
 
-    memcpy(ent, p, sizeof(ext2_dirent_t));
+    _copy_dirent(ent, p);
 
 done:
 
@@ -1117,13 +1465,8 @@ static int _path_to_ino_recursive(
     char target_out[PATH_MAX])
 {
     int ret = 0;
-    char buf[EXT2_PATH_MAX];
-    const char* toks[32];
-    const uint8_t NELEMENTS = sizeof(toks) / sizeof(toks[0]);
-    uint8_t ntoks = 0;
-    char* p;
-    char* save;
-    uint8_t i;
+    myst_path_iter_t it;
+    char name[EXT2_PATH_MAX];
     ext2_ino_t previous_ino = 0;
     void* data = NULL;
     size_t size;
@@ -1134,28 +1477,22 @@ static int _path_to_ino_recursive(
     if (file_ino_out)
         *file_ino_out = 0;
 
-    if (myst_strlcpy(buf, path, sizeof(buf)) >= EXT2_PATH_MAX)
+    if (strlen(path) >= EXT2_PATH_MAX)
         ERAISE(-ENAMETOOLONG);
 
     if (path[0] == '/')
         current_ino = EXT2_ROOT_INO;
 
-    /* split the path into components */
-    for (p = strtok_r(buf, "/", &save); p; p = strtok_r(NULL, "/", &save))
-    {
-        if (ntoks == NELEMENTS)
-            ERAISE(-ENAMETOOLONG);
-
-        toks[ntoks++] = p;
-    }
-
     /* load each inode along the path until found */
-    for (i = 0; i < ntoks; i++)
+    myst_path_iter_init(&it, path);
+
+    while (myst_path_next(&it))
     {
         ext2_dirent_t ent;
         ext2_ino_t ino;
 
-        ECHECK(_load_dirent(ext2, current_ino, toks[i], &ent));
+        ECHECK(myst_path_copy_name(&it, name, sizeof(name)));
+        ECHECK(_load_dirent(ext2, current_ino, name, &ent));
         assert(ent.inode != 0);
         ino = ent.inode;
 
@@ -1163,7 +1500,7 @@ static int _path_to_ino_recursive(
         if (ent.file_type == EXT2_FT_SYMLINK)
         {
             /* only check follow tag on final element */
-            if (i + 1 != ntoks || follow == FOLLOW)
+            if (!myst_path_last(&it) || follow == FOLLOW)
             {
                 char target[EXT2_PATH_MAX];
 
@@ -1181,20 +1518,20 @@ static int _path_to_ino_recursive(
                     if (target_out)
                     {
                         myst_strlcpy(target_out, target, PATH_MAX);
-                        // Copy over rest of unresolved tokens
-                        if (i + 1 != ntoks)
+
+                        // Copy over rest of unresolved components
+                        while (myst_path_next(&it))
                         {
-                            for (size_t j = i + 1; j < ntoks; j++)
-                            {
-                                if (myst_strlcat(target_out, "/", PATH_MAX) >=
-                                    PATH_MAX)
-                                    ERAISE_QUIET(-ENAMETOOLONG);
-
-                                if (myst_strlcat(
-                                        target_out, toks[j], PATH_MAX) >=
-                                    PATH_MAX)
-                                    ERAISE_QUIET(-ENAMETOOLONG);
-                            }
+                            if (myst_strlcat(target_out, "/", PATH_MAX) >=
+                                PATH_MAX)
+                                ERAISE_QUIET(-ENAMETOOLONG);
+
+                            ECHECK(myst_path_copy_name(
+                                &it, name, sizeof(name)));
+
+                            if (myst_strlcat(target_out, name, PATH_MAX) >=
+                                PATH_MAX)
+                                ERAISE_QUIET(-ENAMETOOLONG);
                         }
                         goto done;
                     }
@@ -1222,7 +1559,7 @@ static int _path_to_ino_recursive(
         else
         {
             myst_strlcat(realpath, "/", PATH_MAX);
-            myst_strlcat(realpath, toks[i], PATH_MAX);
+            myst_strlcat(realpath, name, PATH_MAX);
         }
 
         previous_ino = current_ino;
@@ -1486,6 +1823,138 @@ static size_t _inode_get_num_blocks(ext2_t* ext2, ext2_inode_t* inode)
     return (_inode_get_size(inode) + ext2->block_size - 1) / ext2->block_size;
 }
 
+/* Check an extent tree node (the root or a block of up to size bytes) */
+static bool _extent_node_valid(const ext4_extent_header_t* eh, size_t size)
+{
+    const size_t max_entries = (size - sizeof(*eh)) / sizeof(ext4_extent_t);
+
+    return eh->eh_magic == EXT4_EXTENT_MAGIC && eh->eh_max <= max_entries &&
+           eh->eh_entries <= eh->eh_max;
+}
+
+/* Find the last entry of the node whose key is at most lblk (or -1). Index
+ * and leaf entries are both 12 bytes and both start with their key */
+static int _extent_node_find(const ext4_extent_header_t* eh, uint32_t lblk)
+{
+    const ext4_extent_t* entries = (const ext4_extent_t*)(eh + 1);
+    int lo = 0;
+    int hi = eh->eh_entries;
+
+    while (lo < hi)
+    {
+        const int mid = (lo + hi) / 2;
+
+        if (entries[mid].ee_block <= lblk)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo - 1;
+}
+
+/* Look the logical block up in the inode's extent tree, yielding the run of
+ * blocks that contains it (where a pblk of zero denotes a hole, including
+ * the unwritten extents, which read as zeros) */
+static int _extent_find(
+    ext2_t* ext2,
+    const ext2_inode_t* inode,
+    uint32_t lblk,
+    extent_t* extent)
+{
+    int ret = 0;
+    const ext4_extent_header_t* eh;
+    ext2_block_t block;
+    uint32_t next = UINT32_MAX; /* where the next entry starts */
+
+    eh = (const ext4_extent_header_t*)inode->i_block;
+
+    if (!_extent_node_valid(eh, sizeof(inode->i_block)))
+        ERAISE(-EIO);
+
+    /* descend through the index nodes */
+    for (size_t level = 0; eh->eh_depth > 0; level++)
+    {
+        const ext4_extent_idx_t* idx = (const ext4_extent_idx_t*)(eh + 1);
+        const int i = _extent_node_find(eh, lblk);
+        const uint16_t depth = eh->eh_depth;
+
+        if (level == EXT4_EXTENT_MAX_DEPTH)
+            ERAISE(-EIO);
+
+        /* no index covers the block */
+        if (i < 0)
+        {
+            next = (eh->eh_entries > 0) ? idx[0].ei_block : next;
+            goto hole;
+        }
+
+        if (i + 1 < eh->eh_entries)
+            next = idx[i + 1].ei_block;
+
+        if (idx[i].ei_leaf_hi != 0)
+            ERAISE(-EOVERFLOW);
+
+        ECHECK(ext2_read_block(ext2, idx[i].ei_leaf_lo, &block));
+        eh = (const ext4_extent_header_t*)block.data;
+
+        if (!_extent_node_valid(eh, ext2->block_size) ||
+            eh->eh_depth != depth - 1)
+        {
+            ERAISE(-EIO);
+        }
+    }
+
+    /* find the extent in the leaf */
+    {
+        const ext4_extent_t* ee = (const ext4_extent_t*)(eh + 1);
+        const int i = _extent_node_find(eh, lblk);
+
+        if (i >= 0)
+        {
+            const bool unwritten = ee[i].ee_len > EXT4_EXTENT_INIT_MAX_LEN;
+            const uint32_t len = unwritten
+                                     ? ee[i].ee_len - EXT4_EXTENT_INIT_MAX_LEN
+                                     : ee[i].ee_len;
+
+            if (ee[i].ee_start_hi != 0)
+                ERAISE(-EOVERFLOW);
+
+            if (lblk - ee[i].ee_block < len)
+            {
+                extent->lblk = ee[i].ee_block;
+                extent->pblk = unwritten ? 0 : ee[i].ee_start_lo;
+                extent->len = len;
+                goto done;
+            }
+        }
+
+        /* the block lies in the hole before the next extent */
+        if (i + 1 < eh->eh_entries)
+            next = ee[i + 1].ee_block;
+
+        if (i >= 0)
+        {
+            const uint32_t len = ee[i].ee_len > EXT4_EXTENT_INIT_MAX_LEN
+                                     ? ee[i].ee_len - EXT4_EXTENT_INIT_MAX_LEN
+                                     : ee[i].ee_len;
+
+            extent->lblk = ee[i].ee_block + len;
+            extent->pblk = 0;
+            extent->len = next - extent->lblk;
+            goto done;
+        }
+    }
+
+hole:
+    extent->lblk = lblk;
+    extent->pblk = 0;
+    extent->len = next - lblk;
+
+done:
+    return ret;
+}
+
 static int _inode_get_blkno(
     ext2_t* ext2,
     ext2_inode_t* inode,
@@ -1504,6 +1973,22 @@ static int _inode_get_blkno(
 
     *blkno_out = 0;
 
+    /* handle inodes mapped by extents (ext4) */
+    if ((inode->i_flags & EXT4_EXTENTS_FL))
+    {
+        extent_t extent;
+
+        if (index > UINT32_MAX)
+            goto done;
+
+        ECHECK(_extent_find(ext2, inode, index, &extent));
+
+        if (extent.pblk)
+            *blkno_out = extent.pblk + (index - extent.lblk);
+
+        goto done;
+    }
+
     /* handle direct block numbers */
     if (index < direct_max)
     {
@@ -1610,6 +2095,10 @@ static int _inode_add_blkno(
     if (new_blkno == 0)
         ERAISE(-EINVAL);
 
+    /* extent trees are read-only */
+    if ((inode->i_flags & EXT4_EXTENTS_FL))
+        ERAISE(-EROFS);
+
     /* handle direct block numbers */
     if (index < direct_max)
     {
@@ -1819,233 +2308,660 @@ static int _inode_add_blkno(
                 ECHECK(ext2_read_block(ext2, jblkno, &jblock));
                 kblkno = jdata[j];
 
-                if (kblkno == 0)
-                {
-                    /* assign a new k-block number */
-                    ECHECK(_get_blkno(ext2, &kblkno));
+                if (kblkno == 0)
+                {
+                    /* assign a new k-block number */
+                    ECHECK(_get_blkno(ext2, &kblkno));
+
+                    /* write the j-blkno-block */
+                    jdata[j] = kblkno;
+                    ECHECK(_write_block(ext2, jblkno, &jblock));
+
+                    /* write the k-blkno-block */
+                    _init_block(&kblock, ext2->block_size);
+                    kdata[k] = new_blkno;
+                    ECHECK(_write_block(ext2, kblkno, &kblock));
+                }
+                else
+                {
+                    /* read the k-blkno-block */
+                    ECHECK(ext2_read_block(ext2, kblkno, &kblock));
+
+                    /* if entry is already in use */
+                    if (kdata[k] != 0)
+                        ERAISE(-EEXIST);
+
+                    /* update and write the k-blkno-block */
+                    kdata[k] = new_blkno;
+                    ECHECK(_write_block(ext2, kblkno, &kblock));
+                }
+            }
+        }
+
+        ret = 0;
+        goto done;
+    }
+
+done:
+
+    return ret;
+}
+
+/* the caller is responsible for writing the inode */
+/*
+**==============================================================================
+**
+** The per-file block map:
+**
+**     _inode_get_blkno() reads every indirect block on the path to a logical
+**     block on each call. Open files instead decode the block numbers held
+**     by one direct or indirect leaf at a time into a sorted list of extents
+**     that _file_get_blkno() searches, so runs of contiguous blocks resolve
+**     without touching the indirect blocks again.
+**
+**==============================================================================
+*/
+
+/* Get the block numbers of the leaf (the direct blocks or the last-level
+ * indirect block) that maps the given logical block */
+static int _inode_get_leaf(
+    ext2_t* ext2,
+    ext2_inode_t* inode,
+    size_t index,
+    size_t* first_out,
+    size_t* count_out,
+    ext2_block_t* block)
+{
+    int ret = 0;
+    const size_t blknos_per_block = ext2->block_size / sizeof(uint32_t);
+    const size_t direct_max = EXT2_SINGLE_INDIRECT_BLOCK;
+    const size_t single_indirect_max = direct_max + blknos_per_block;
+    const size_t double_indirect_max =
+        single_indirect_max + blknos_per_block * blknos_per_block;
+    const size_t triple_indirect_max = double_indirect_max +
+        blknos_per_block * blknos_per_block * blknos_per_block;
+    const uint32_t* data = (const uint32_t*)block->data;
+    uint32_t blkno;
+    size_t n;
+
+    if (index < direct_max)
+    {
+        memcpy(block->data, inode->i_block, direct_max * sizeof(uint32_t));
+        *first_out = 0;
+        *count_out = direct_max;
+        goto done;
+    }
+
+    if (index >= triple_indirect_max)
+        ERAISE(-EFBIG);
+
+    *count_out = blknos_per_block;
+
+    if (index < single_indirect_max)
+    {
+        *first_out = direct_max;
+        blkno = inode->i_block[EXT2_SINGLE_INDIRECT_BLOCK];
+    }
+    else if (index < double_indirect_max)
+    {
+        n = index - single_indirect_max;
+        *first_out = index - n % blknos_per_block;
+
+        if ((blkno = inode->i_block[EXT2_DOUBLE_INDIRECT_BLOCK]))
+        {
+            ECHECK(ext2_read_block(ext2, blkno, block));
+            blkno = data[n / blknos_per_block];
+        }
+    }
+    else
+    {
+        n = index - double_indirect_max;
+        *first_out = index - n % blknos_per_block;
+
+        if ((blkno = inode->i_block[EXT2_TRIPLE_INDIRECT_BLOCK]))
+        {
+            ECHECK(ext2_read_block(ext2, blkno, block));
+
+            if ((blkno = data[n / (blknos_per_block * blknos_per_block)]))
+            {
+                ECHECK(ext2_read_block(ext2, blkno, block));
+                blkno = data[(n / blknos_per_block) % blknos_per_block];
+            }
+        }
+    }
+
+    if (blkno)
+        ECHECK(ext2_read_block(ext2, blkno, block));
+    else
+        memset(block->data, 0, ext2->block_size);
+
+done:
+    return ret;
+}
+
+/* Find the first extent that ends after the logical block */
+static size_t _map_find(const myst_file_t* file, uint32_t lblk)
+{
+    size_t lo = 0;
+    size_t hi = file->map.size;
+
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        const extent_t* e = &file->map.extents[mid];
+
+        if (e->lblk + e->len <= lblk)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static bool _extents_adjacent(const extent_t* e1, const extent_t* e2)
+{
+    if (e1->lblk + e1->len != e2->lblk)
+        return false;
+
+    if (e1->pblk == 0 || e2->pblk == 0)
+        return e1->pblk == e2->pblk;
+
+    return e1->pblk + e1->len == e2->pblk;
+}
+
+/* Insert an extent over logical blocks that are not in the map yet */
+static int _map_insert(myst_file_t* file, const extent_t* extent)
+{
+    int ret = 0;
+    const size_t pos = _map_find(file, extent->lblk);
+    extent_t* extents = file->map.extents;
+
+    if (pos > 0 && _extents_adjacent(&extents[pos - 1], extent))
+    {
+        extents[pos - 1].len += extent->len;
+
+        /* the new extent may also close the gap to the next one */
+        if (pos < file->map.size &&
+            _extents_adjacent(&extents[pos - 1], &extents[pos]))
+        {
+            extents[pos - 1].len += extents[pos].len;
+            memmove(
+                &extents[pos],
+                &extents[pos + 1],
+                (file->map.size - pos - 1) * sizeof(extent_t));
+            file->map.size--;
+        }
+
+        goto done;
+    }
+
+    if (pos < file->map.size && _extents_adjacent(extent, &extents[pos]))
+    {
+        extents[pos].lblk = extent->lblk;
+        extents[pos].pblk = extent->pblk;
+        extents[pos].len += extent->len;
+        goto done;
+    }
+
+    if (file->map.size == file->map.capacity)
+    {
+        size_t capacity = file->map.capacity * 2;
+        size_t size;
+
+        if (capacity == 0)
+            capacity = 16;
+
+        size = capacity * sizeof(extent_t);
+
+        if (!(extents = realloc(file->map.extents, size)))
+            ERAISE(-ENOMEM);
+
+        file->map.extents = extents;
+        file->map.capacity = capacity;
+    }
+
+    memmove(
+        &extents[pos + 1],
+        &extents[pos],
+        (file->map.size - pos) * sizeof(extent_t));
+    extents[pos] = *extent;
+    file->map.size++;
+
+done:
+    return ret;
+}
+
+/* Decode the leaf that maps the logical block into the map */
+static int _map_load(ext2_t* ext2, myst_file_t* file, size_t index)
+{
+    int ret = 0;
+    ext2_block_t block;
+    const uint32_t* data = (const uint32_t*)block.data;
+    size_t first;
+    size_t count;
+    extent_t extent;
+
+    /* take the whole extent (or hole) from the extent tree */
+    if ((file->inode->i_flags & EXT4_EXTENTS_FL))
+    {
+        size_t pos;
+
+        if (index > UINT32_MAX)
+            ERAISE(-EFBIG);
+
+        ECHECK(_extent_find(ext2, file->inode, index, &extent));
+
+        /* clip the extent to the gap in the map around the block (as holes
+         * may run into blocks the map already has) */
+        pos = _map_find(file, index);
+
+        if (pos > 0)
+        {
+            const extent_t* e = &file->map.extents[pos - 1];
+            const uint32_t end = e->lblk + e->len;
+
+            if (end > extent.lblk)
+            {
+                extent.len -= end - extent.lblk;
+                extent.lblk = end;
+            }
+        }
+
+        if (pos < file->map.size)
+        {
+            const extent_t* e = &file->map.extents[pos];
+
+            if (e->lblk < extent.lblk + extent.len)
+                extent.len = e->lblk - extent.lblk;
+        }
+
+        ECHECK(_map_insert(file, &extent));
+        goto done;
+    }
+
+    ECHECK(_inode_get_leaf(ext2, file->inode, index, &first, &count, &block));
+
+    extent.lblk = first;
+    extent.pblk = data[0];
+    extent.len = 1;
+
+    for (size_t i = 1; i <= count; i++)
+    {
+        const extent_t next = {first + i, i < count ? data[i] : 0, 1};
+
+        if (i < count && _extents_adjacent(&extent, &next))
+        {
+            extent.len++;
+            continue;
+        }
+
+        ECHECK(_map_insert(file, &extent));
+        extent = next;
+    }
+
+done:
+    return ret;
+}
+
+static void _map_clear(myst_file_t* file)
+{
+    file->map.size = 0;
+}
+
+/* Drop the map if another open file has since changed the blocks */
+static void _map_check(myst_file_t* file)
+{
+    if (file->ientry && file->map.gen != file->ientry->gen)
+    {
+        _map_clear(file);
+        file->map.gen = file->ientry->gen;
+    }
+}
+
+/* Note that this file changed the blocks (making others' maps stale) */
+static void _map_changed(myst_file_t* file)
+{
+    if (file->ientry)
+        file->map.gen = ++file->ientry->gen;
+}
+
+/* Record that the logical block (a hole in the map) is now mapped */
+static int _map_set(myst_file_t* file, uint32_t lblk, uint32_t pblk)
+{
+    int ret = 0;
+    const size_t pos = _map_find(file, lblk);
+    extent_t hole;
+    const extent_t extent = {lblk, pblk, 1};
+
+    _map_check(file);
+
+    /* drop the map if the block is not a known hole */
+    if (pos == file->map.size || file->map.extents[pos].lblk > lblk ||
+        file->map.extents[pos].pblk != 0)
+    {
+        _map_clear(file);
+        goto done;
+    }
+
+    /* cut the hole around the block, then insert the block and the rest */
+    hole = file->map.extents[pos];
+
+    if (hole.lblk == lblk)
+    {
+        memmove(
+            &file->map.extents[pos],
+            &file->map.extents[pos + 1],
+            (file->map.size - pos - 1) * sizeof(extent_t));
+        file->map.size--;
+    }
+    else
+    {
+        file->map.extents[pos].len = lblk - hole.lblk;
+    }
+
+    if (hole.lblk + hole.len > lblk + 1)
+    {
+        const uint32_t lblk_end = hole.lblk + hole.len;
+        const extent_t rest = {lblk + 1, 0, lblk_end - (lblk + 1)};
+
+        if (_map_insert(file, &rest) != 0)
+        {
+            _map_clear(file);
+            goto done;
+        }
+    }
+
+    if (_map_insert(file, &extent) != 0)
+        _map_clear(file);
+
+done:
+    _map_changed(file);
+    return ret;
+}
+
+/* Get the physical block (zero for a hole) of the file's logical block and
+ * the number of logical blocks from there that map contiguously */
+static int _file_get_blkno(
+    ext2_t* ext2,
+    myst_file_t* file,
+    size_t index,
+    uint32_t* blkno_out,
+    size_t* count_out)
+{
+    int ret = 0;
+    size_t pos;
+    const extent_t* e;
+
+    _map_check(file);
+    pos = _map_find(file, index);
 
-                    /* write the j-blkno-block */
-                    jdata[j] = kblkno;
-                    ECHECK(_write_block(ext2, jblkno, &jblock));
+    if (pos == file->map.size || file->map.extents[pos].lblk > index)
+    {
+        ECHECK(_map_load(ext2, file, index));
+        pos = _map_find(file, index);
+        assert(pos < file->map.size);
+    }
 
-                    /* write the k-blkno-block */
-                    _init_block(&kblock, ext2->block_size);
-                    kdata[k] = new_blkno;
-                    ECHECK(_write_block(ext2, kblkno, &kblock));
-                }
-                else
-                {
-                    /* read the k-blkno-block */
-                    ECHECK(ext2_read_block(ext2, kblkno, &kblock));
+    e = &file->map.extents[pos];
+    assert(index >= e->lblk && index < e->lblk + e->len);
 
-                    /* if entry is already in use */
-                    if (kdata[k] != 0)
-                        ERAISE(-EEXIST);
+    *blkno_out = e->pblk ? e->pblk + (index - e->lblk) : 0;
 
-                    /* update and write the k-blkno-block */
-                    kdata[k] = new_blkno;
-                    ECHECK(_write_block(ext2, kblkno, &kblock));
-                }
-            }
-        }
+    if (count_out)
+        *count_out = e->lblk + e->len - index;
 
-        ret = 0;
-        goto done;
+done:
+    return ret;
+}
+
+/* Give back the blocks preallocated for the file */
+static int _file_put_prealloc(ext2_t* ext2, myst_file_t* file)
+{
+    int ret = 0;
+
+    if (file->prealloc.count)
+    {
+        const uint32_t blkno = file->prealloc.blkno;
+        const uint32_t count = file->prealloc.count;
+
+        file->prealloc.blkno = 0;
+        file->prealloc.count = 0;
+        ECHECK(_put_blknos(ext2, blkno, count));
     }
 
 done:
-
     return ret;
 }
 
-/* the caller is responsible for writing the inode */
-static int _inode_put_blkno(
+/* Allocate a block for the file's logical block, right after the block
+ * mapped before it if possible (else in the inode's group). Appending
+ * writers allocate a run of blocks at once and take the rest from it
+ * later, so large files come out contiguous even when written by many
+ * files at once. Nearly full file systems allocate one block at a time. */
+static int _file_get_new_blkno(
     ext2_t* ext2,
-    ext2_ino_t ino,
-    ext2_inode_t* inode,
-    size_t index)
+    myst_file_t* file,
+    size_t index,
+    uint32_t* blkno)
 {
     int ret = 0;
-    size_t blknos_per_block = ext2->block_size / sizeof(uint32_t);
-    size_t direct_max = EXT2_SINGLE_INDIRECT_BLOCK;
-    size_t single_indirect_count = blknos_per_block;
-    size_t single_indirect_max = direct_max + single_indirect_count;
-    size_t double_indirect_count = single_indirect_count * blknos_per_block;
-    size_t double_indirect_max = single_indirect_max + double_indirect_count;
-    size_t triple_indirect_count = double_indirect_count * blknos_per_block;
-    size_t triple_indirect_max = double_indirect_max + triple_indirect_count;
+    uint32_t goal = 0;
+    uint32_t want = 1;
+    uint32_t count;
 
-    /* handle direct block numbers */
-    if (index < direct_max)
-    {
-        uint32_t blkno = inode->i_block[index];
+    if (index > 0)
+        ECHECK(_file_get_blkno(ext2, file, index - 1, &goal, NULL));
 
-        if (blkno == 0)
-            goto done;
+    if (goal)
+        goal++;
+    else
+        goal = _make_blkno(ext2, _ino_to_grpno(ext2, file->ino), 0);
 
-        ECHECK(_put_blkno(ext2, blkno));
-        inode->i_block[index] = 0;
+    /* continue the preallocated run */
+    if (file->prealloc.count && file->prealloc.blkno == goal)
+    {
+        *blkno = file->prealloc.blkno++;
+        file->prealloc.count--;
         goto done;
     }
 
-    /* handle single-indirect block numbers */
-    if (index < single_indirect_max)
+    ECHECK(_file_put_prealloc(ext2, file));
+
+    if (S_ISREG(file->inode->i_mode) &&
+        index >= _inode_get_num_blocks(ext2, file->inode) &&
+        ext2->sb.s_free_blocks_count > ext2->sb.s_blocks_count / 16)
     {
-        const size_t i = index - direct_max;
-        const uint32_t iblkno = inode->i_block[EXT2_SINGLE_INDIRECT_BLOCK];
-        ext2_block_t iblock;
-        uint32_t* idata = (uint32_t*)iblock.data;
-        uint32_t blkno;
+        want = EXT2_PREALLOC_BLOCKS;
+    }
 
-        if (iblkno == 0)
-            goto done;
+    ECHECK(_get_blknos(ext2, goal, want, blkno, &count));
 
-        ECHECK(ext2_read_block(ext2, iblkno, &iblock));
+    if (count > 1)
+    {
+        file->prealloc.blkno = *blkno + 1;
+        file->prealloc.count = count - 1;
+    }
 
-        if ((blkno = idata[i]) == 0)
-            goto done;
+done:
+    return ret;
+}
+
+/* A run of adjacent blocks of one group waiting to be released */
+typedef struct put_run
+{
+    uint32_t blkno;
+    uint32_t count;
+} put_run_t;
+
+static int _put_run_flush(ext2_t* ext2, put_run_t* run)
+{
+    int ret = 0;
+
+    if (run->count)
+    {
+        ECHECK(_put_blknos(ext2, run->blkno, run->count));
+        run->count = 0;
+    }
+
+done:
+    return ret;
+}
 
-        ECHECK(_put_blkno(ext2, blkno));
-        idata[i] = 0;
+/* Add the block to the run (releasing the run first unless adjacent) */
+static int _put_run_add(ext2_t* ext2, put_run_t* run, uint32_t blkno)
+{
+    int ret = 0;
 
-        if (_zero_filled_u32(idata, blknos_per_block))
+    if (run->count &&
+        _blkno_to_grpno(ext2, run->blkno) == _blkno_to_grpno(ext2, blkno))
+    {
+        if (blkno == run->blkno + run->count)
         {
-            ECHECK(_put_blkno(ext2, iblkno));
-            inode->i_block[EXT2_SINGLE_INDIRECT_BLOCK] = 0;
+            run->count++;
+            goto done;
         }
-        else
+
+        if (blkno + 1 == run->blkno)
         {
-            ECHECK(_write_block(ext2, iblkno, &iblock));
+            run->blkno--;
+            run->count++;
+            goto done;
         }
-
-        goto done;
     }
 
-    /* handle double-indirect block numbers */
-    if (index < double_indirect_max)
-    {
-        const size_t n = index - single_indirect_max;
-        const size_t i = n / blknos_per_block;
-        const size_t j = n % blknos_per_block;
-        uint32_t iblkno = inode->i_block[EXT2_DOUBLE_INDIRECT_BLOCK];
-        uint32_t jblkno;
-        ext2_block_t iblock;
-        uint32_t* idata = (uint32_t*)iblock.data;
-        ext2_block_t jblock;
-        uint32_t* jdata = (uint32_t*)jblock.data;
-        uint32_t blkno;
+    ECHECK(_put_run_flush(ext2, run));
+    run->blkno = blkno;
+    run->count = 1;
 
-        if (iblkno == 0)
-            goto done;
+done:
+    return ret;
+}
 
-        ECHECK(ext2_read_block(ext2, iblkno, &iblock));
+/* Release what the indirect block blkno maps from its logical block first
+ * on, where each of its entries maps span logical blocks, and release the
+ * block itself once it maps nothing (setting *empty) */
+static int _put_indirect(
+    ext2_t* ext2,
+    uint32_t blkno,
+    size_t span,
+    size_t first,
+    put_run_t* run,
+    bool* empty)
+{
+    int ret = 0;
+    const size_t n = ext2->block_size / sizeof(uint32_t);
+    ext2_block_t* block = NULL;
+    uint32_t* data;
+    bool changed = false;
 
-        if ((jblkno = idata[i]) == 0)
-            goto done;
+    *empty = false;
 
-        ECHECK(ext2_read_block(ext2, jblkno, &jblock));
+    if (!(block = malloc(sizeof(ext2_block_t))))
+        ERAISE(-ENOMEM);
 
-        if ((blkno = jdata[j]) == 0)
-            goto done;
+    ECHECK(ext2_read_block(ext2, blkno, block));
+    data = (uint32_t*)block->data;
 
-        ECHECK(_put_blkno(ext2, blkno));
-        jdata[j] = 0;
+    /* a block released as a whole goes before the blocks it maps, which
+     * follow it on disk when written in order (and so join its run) */
+    if (first == 0)
+        ECHECK(_put_run_add(ext2, run, blkno));
 
-        if (_zero_filled_u32(jdata, blknos_per_block))
-        {
-            ECHECK(_put_blkno(ext2, jblkno));
-            idata[i] = 0;
+    for (size_t i = first / span; i < n; i++)
+    {
+        const size_t from = (i == first / span) ? first % span : 0;
+        bool released = true;
 
-            if (_zero_filled_u32(idata, blknos_per_block))
-            {
-                ECHECK(_put_blkno(ext2, iblkno));
-                inode->i_block[EXT2_DOUBLE_INDIRECT_BLOCK] = 0;
-            }
-            else
-            {
-                ECHECK(_write_block(ext2, iblkno, &iblock));
-            }
-        }
+        if (data[i] == 0)
+            continue;
+
+        if (span == 1)
+            ECHECK(_put_run_add(ext2, run, data[i]));
         else
+            ECHECK(_put_indirect(
+                ext2, data[i], span / n, from, run, &released));
+
+        if (released)
         {
-            ECHECK(_write_block(ext2, jblkno, &jblock));
+            data[i] = 0;
+            changed = true;
         }
-
-        goto done;
     }
 
-    /* handle triple-indirect block numbers */
-    if (index < triple_indirect_max)
+    if (first == 0)
     {
-        const size_t n = index - double_indirect_max;
-        const size_t i = n / (blknos_per_block * blknos_per_block);
-        const size_t j = (n / blknos_per_block) % blknos_per_block;
-        const size_t k = n % blknos_per_block;
-        uint32_t iblkno = inode->i_block[EXT2_TRIPLE_INDIRECT_BLOCK];
-        uint32_t jblkno;
-        uint32_t kblkno;
-        ext2_block_t iblock;
-        uint32_t* idata = (uint32_t*)iblock.data;
-        ext2_block_t jblock;
-        uint32_t* jdata = (uint32_t*)jblock.data;
-        ext2_block_t kblock;
-        uint32_t* kdata = (uint32_t*)kblock.data;
-        uint32_t blkno;
-
-        if (iblkno == 0)
-            goto done;
+        *empty = true;
+    }
+    else if (_zero_filled_u32(data, n))
+    {
+        ECHECK(_put_run_add(ext2, run, blkno));
+        *empty = true;
+    }
+    else if (changed)
+    {
+        ECHECK(_write_block(ext2, blkno, block));
+    }
 
-        ECHECK(ext2_read_block(ext2, iblkno, &iblock));
+done:
 
-        if ((jblkno = idata[i]) == 0)
-            goto done;
+    if (block)
+        free(block);
 
-        ECHECK(ext2_read_block(ext2, jblkno, &jblock));
+    return ret;
+}
 
-        if ((kblkno = jdata[j]) == 0)
-            goto done;
+/* Release the blocks of the inode from its logical block first on. Each
+ * indirect block is read once, and each run of adjacent blocks is cleared
+ * from its bitmap at once. On failure, the blocks of the run not yet
+ * released are leaked rather than risk releasing blocks still mapped. */
+static int _inode_put_blknos(ext2_t* ext2, ext2_inode_t* inode, size_t first)
+{
+    int ret = 0;
+    const size_t n = ext2->block_size / sizeof(uint32_t);
+    size_t start = EXT2_SINGLE_INDIRECT_BLOCK;
+    size_t span = 1;
+    put_run_t run = {0};
 
-        ECHECK(ext2_read_block(ext2, kblkno, &kblock));
+    /* extent trees are read-only */
+    if ((inode->i_flags & EXT4_EXTENTS_FL))
+        ERAISE(-EROFS);
 
-        if ((blkno = kdata[k]) == 0)
-            goto done;
+    /* handle direct block numbers */
+    for (size_t i = first; i < EXT2_SINGLE_INDIRECT_BLOCK; i++)
+    {
+        if (inode->i_block[i])
+        {
+            ECHECK(_put_run_add(ext2, &run, inode->i_block[i]));
+            inode->i_block[i] = 0;
+        }
+    }
 
-        ECHECK(_put_blkno(ext2, blkno));
-        kdata[k] = 0;
+    /* handle the single, double and triple indirect trees */
+    for (size_t k = EXT2_SINGLE_INDIRECT_BLOCK;
+         k <= EXT2_TRIPLE_INDIRECT_BLOCK;
+         k++)
+    {
+        const size_t count = span * n; /* the logical blocks of the tree */
+        const uint32_t blkno = inode->i_block[k];
+        bool empty;
 
-        if (_zero_filled_u32(kdata, blknos_per_block))
+        if (blkno && first < start + count)
         {
-            ECHECK(_put_blkno(ext2, kblkno));
-            jdata[i] = 0;
+            const size_t from = first > start ? first - start : 0;
 
-            if (_zero_filled_u32(jdata, blknos_per_block))
-            {
-                ECHECK(_put_blkno(ext2, jblkno));
-                idata[i] = 0;
+            ECHECK(_put_indirect(ext2, blkno, span, from, &run, &empty));
 
-                if (_zero_filled_u32(idata, blknos_per_block))
-                {
-                    ECHECK(_put_blkno(ext2, iblkno));
-                    inode->i_block[EXT2_TRIPLE_INDIRECT_BLOCK] = 0;
-                }
-                else
-                {
-                    ECHECK(_write_block(ext2, iblkno, &iblock));
-                }
-            }
-            else
-            {
-                ECHECK(_write_block(ext2, jblkno, &jblock));
-            }
-        }
-        else
-        {
-            ECHECK(_write_block(ext2, kblkno, &kblock));
+            if (empty)
+                inode->i_block[k] = 0;
         }
 
-        goto done;
+        start += count;
+        span *= n;
     }
 
+    ECHECK(_put_run_flush(ext2, &run));
+
 done:
     return ret;
 }
@@ -2093,15 +3009,16 @@ static int _ftruncate(ext2_t* ext2, myst_file_t* file, off_t length, bool isdir)
 {
     int ret = 0;
     size_t file_size;
-    size_t num_blocks;
     size_t first;
 
     /* Fail if directory */
-    if (!isdir && S_ISDIR(file->inode.i_mode))
+    if (!isdir && S_ISDIR(file->inode->i_mode))
         ERAISE(-EINVAL);
 
+    ECHECK(_file_put_prealloc(ext2, file));
+
     /* get the file size */
-    file_size = _inode_get_size(&file->inode);
+    file_size = _inode_get_size(file->inode);
 
     /* fail if length is out of range */
     if (length < 0)
@@ -2109,16 +3026,15 @@ static int _ftruncate(ext2_t* ext2, myst_file_t* file, off_t length, bool isdir)
 
     if (length < file_size)
     {
-        /* get the total number of blocks */
-        num_blocks = _inode_get_num_blocks(ext2, &file->inode);
-
         /* find the index of the first block number to delete */
         ECHECK(myst_round_up(length, ext2->block_size, &first));
         first /= ext2->block_size;
 
         /* release the selected block numbers */
-        for (size_t i = first; i < num_blocks; i++)
-            ECHECK(_inode_put_blkno(ext2, file->ino, &file->inode, i));
+        _map_clear(file);
+        _map_changed(file);
+
+        ECHECK(_inode_put_blknos(ext2, file->inode, first));
 
         /* Fill the last partial block with zeros */
         if (first > 0)
@@ -2126,7 +3042,7 @@ static int _ftruncate(ext2_t* ext2, myst_file_t* file, off_t length, bool isdir)
             uint32_t blkno;
 
             /* get the block number of the last block */
-            ECHECK(_inode_get_blkno(ext2, &file->inode, first - 1, &blkno));
+            ECHECK(_file_get_blkno(ext2, file, first - 1, &blkno, NULL));
 
             if (blkno != 0)
             {
@@ -2147,16 +3063,16 @@ static int _ftruncate(ext2_t* ext2, myst_file_t* file, off_t length, bool isdir)
             }
         }
 
-        _inode_set_size(&file->inode, (size_t)length);
-        _update_timestamps(&file->inode, CHANGE | MODIFY);
-        ECHECK(_write_inode(ext2, file->ino, &file->inode));
+        _inode_set_size(file->inode, (size_t)length);
+        _update_timestamps(file->inode, CHANGE | MODIFY);
+        ECHECK(_write_inode(ext2, file->ino, file->inode));
     }
     else if (length > file_size)
     {
         /* make file larger (with a hole) */
-        _inode_set_size(&file->inode, length);
-        _update_timestamps(&file->inode, CHANGE | MODIFY);
-        ECHECK(_write_inode(ext2, file->ino, &file->inode));
+        _inode_set_size(file->inode, length);
+        _update_timestamps(file->inode, CHANGE | MODIFY);
+        ECHECK(_write_inode(ext2, file->ino, file->inode));
     }
 
 done:
@@ -2175,7 +3091,7 @@ static int _inode_write_data(
     myst_file_t file = {
         .magic = FILE_MAGIC,
         .ino = ino,
-        .inode = *inode,
+        .inode = inode,
         .offset = 0,
         .access = O_WRONLY,
         .open_flags = O_WRONLY,
@@ -2198,7 +3114,6 @@ static int _inode_write_data(
 
     ECHECK(_ftruncate(ext2, &file, size, isdir));
 
-    memcpy(inode, &file.inode, sizeof(ext2_inode_t));
     _inode_set_size(inode, size);
 
 done:
@@ -2277,8 +3192,8 @@ static int _remove_dirent(ext2_t* ext2, const char* path)
 
             assert(e->rec_len != 0);
 
-            /* add entry if not the one being removed */
-            if (e != ent)
+            /* add entry if not the one being removed (or unused) */
+            if (e != ent && e->inode)
             {
                 size_t recsz = _dirent_size(e);
                 size_t rem = block_size - (buf.size % block_size);
@@ -2335,17 +3250,25 @@ static int _remove_dirent(ext2_t* ext2, const char* path)
 
     /* rewrite the directory, one block at a time */
     ECHECK(_inode_write_data(ext2, ino, &inode, buf.data, buf.size));
+    ext2_dirindex_remove(ext2->dirindex, ino, filename);
 
     /* if child was a directory, then decrement the link count */
     if (ent->file_type == EXT2_FT_DIR)
         inode.i_links_count--;
 
+    /* the rewritten directory no longer has its hashed index */
+    inode.i_flags &= ~EXT2_INDEX_FL;
+
     _update_timestamps(&inode, CHANGE | MODIFY);
 
     ECHECK(_write_inode(ext2, ino, &inode));
 
 done:
 
+    /* do not trust the index of a half-rewritten directory */
+    if (ret != 0)
+        ext2_dirindex_drop(ext2->dirindex, ino);
+
     if (data)
         free(data);
 
@@ -2543,6 +3466,13 @@ static int _add_dirent(
             size_t rem = block_size - (buf.size % block_size);
             size_t curr;
 
+            /* skip unused entries (and the nodes of an indexed directory) */
+            if (e->inode == 0)
+            {
+                p += e->rec_len;
+                continue;
+            }
+
             /* if there's room for another entry in this block */
             if (recsz <= rem)
             {
@@ -2640,17 +3570,25 @@ static int _add_dirent(
 
     /* rewrite the directory, one block at a time */
     ECHECK(_inode_write_data(ext2, ino, inode, buf.data, buf.size));
+    ext2_dirindex_add(ext2->dirindex, ino, new_ent);
 
     /* update the number of links if new entry is a directory */
     if (new_ent->file_type == EXT2_FT_DIR)
         inode->i_links_count++;
 
+    /* the rewritten directory no longer has its hashed index */
+    inode->i_flags &= ~EXT2_INDEX_FL;
+
     _update_timestamps(inode, CHANGE | MODIFY);
 
     ECHECK(_write_inode(ext2, ino, inode));
 
 done:
 
+    /* do not trust the index of a half-rewritten directory */
+    if (ret != 0 && ret != -EEXIST)
+        ext2_dirindex_drop(ext2->dirindex, ino);
+
     if (data)
         free(data);
 
@@ -2668,15 +3606,9 @@ static int _inode_unlink(ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
     /* if this is the final link */
     if (inode->i_links_count == 1)
     {
-        size_t num_blocks = _inode_get_num_blocks(ext2, inode);
-
-        if (S_ISLNK(inode->i_mode) && inode->i_size < 60)
-            num_blocks = 0;
-
-        for (size_t i = 0; i < num_blocks; i++)
-        {
-            ECHECK(_inode_put_blkno(ext2, ino, inode, i));
-        }
+        /* short symbolic links keep their target in i_block */
+        if (!S_ISLNK(inode->i_mode) || inode->i_size >= 60)
+            ECHECK(_inode_put_blknos(ext2, inode, 0));
 
         /* return the inode to the free list */
         ECHECK(_put_ino(ext2, ino));
@@ -2757,117 +3689,195 @@ done:
     return ret;
 }
 
-int ext2_check(const ext2_t* ext2)
+/* Check the used inodes of the group, reading its inode table in runs of
+ * up to EXT2_MAX_READ_SIZE (and skipping the runs with no used inodes) */
+static int _check_inode_table(
+    const ext2_t* ext2,
+    uint32_t grpno,
+    const ext2_block_t* bitmap,
+    uint8_t* buf)
 {
     int ret = 0;
+    const uint32_t inode_size = ext2->sb.s_inode_size;
+    const uint32_t inodes_per_block = ext2->block_size / inode_size;
+    const uint32_t inodes_per_run =
+        EXT2_MAX_READ_SIZE / ext2->block_size * inodes_per_block;
+    const uint32_t inodes_per_group = ext2->sb.s_inodes_per_group;
 
-    /* Check the block bitmaps */
+    for (uint32_t first = 0; first < inodes_per_group; first += inodes_per_run)
     {
-        uint32_t i;
-        uint32_t n = 0;
-        uint32_t nused = 0;
-        uint32_t nfree = 0;
+        const uint32_t n = _min_u32(inodes_per_run, inodes_per_group - first);
+        uint32_t lino = first;
+        uint32_t nblocks;
 
-        for (i = 0; i < ext2->group_count; i++)
+        /* skip to the first used inode in this run (if any) */
+        while (lino < first + n &&
+               !ext2_test_bit(bitmap->data, bitmap->size, lino))
         {
-            ext2_block_t bitmap;
+            lino++;
+        }
 
-            nfree += ext2->groups[i].bg_free_blocks_count;
+        if (lino == first + n)
+            continue;
 
-            ECHECK(ext2_read_block_bitmap(ext2, i, &bitmap));
-            nused += ext2_count_bits_n(bitmap.data, bitmap.size);
-            n += bitmap.size * 8;
-        }
+        nblocks = _next_mult(n, inodes_per_block) / inodes_per_block;
 
-        if (ext2->sb.s_free_blocks_count != nfree)
+        ECHECK(ext2_cache_read_blocks(
+            ext2->cache,
+            ext2->groups[grpno].bg_inode_table + first / inodes_per_block,
+            nblocks,
+            buf));
+
+        for (; lino < first + n; lino++)
         {
-            printf(
-                "s_free_blocks_count{%u}, nfree{%u}\n",
-                ext2->sb.s_free_blocks_count,
-                nfree);
-            ERAISE(-EINVAL);
-        }
+            const ext2_inode_t* inode;
 
-        if (ext2->sb.s_free_blocks_count != n - nused)
-            ERAISE(-EINVAL);
+            if (!ext2_test_bit(bitmap->data, bitmap->size, lino))
+                continue;
+
+            if ((lino + 1) < EXT2_FIRST_INO && (lino + 1) != EXT2_ROOT_INO)
+                continue;
+
+            inode = (const ext2_inode_t*)(buf + (lino - first) * inode_size);
+
+            /* Mode can never be zero */
+            if (inode->i_mode == 0)
+                ERAISE(-EINVAL);
+        }
     }
 
-    /* Check the inode bitmaps */
-    {
-        uint32_t i;
-        uint32_t n = 0;
-        uint32_t nused = 0;
-        uint32_t nfree = 0;
+done:
+    return ret;
+}
 
-        /* Check the bitmaps for the inodes */
-        for (i = 0; i < ext2->group_count; i++)
-        {
-            ext2_block_t bitmap;
+static int _check_group(
+    const ext2_t* ext2,
+    uint32_t grpno,
+    uint8_t* buf,
+    ext2_check_counts_t* counts)
+{
+    int ret = 0;
+    const ext2_group_desc_t* group = &ext2->groups[grpno];
+    ext2_block_t bitmap;
+
+    /* Check the block bitmap */
+    ECHECK(ext2_read_block_bitmap(ext2, grpno, &bitmap));
+    counts->free_blocks += group->bg_free_blocks_count;
+    counts->clear_blocks +=
+        bitmap.size * 8 - ext2_count_bits_n(bitmap.data, bitmap.size);
+
+    /* Check the inode bitmap and the inodes it marks as used */
+    ECHECK(ext2_read_inode_bitmap(ext2, grpno, &bitmap));
+    counts->free_inodes += group->bg_free_inodes_count;
+    counts->clear_inodes +=
+        bitmap.size * 8 - ext2_count_bits_n(bitmap.data, bitmap.size);
+
+    ECHECK(_check_inode_table(ext2, grpno, &bitmap, buf));
+
+done:
+    return ret;
+}
+
+static int _check_groups(
+    const ext2_t* ext2,
+    uint32_t first,
+    uint32_t count,
+    ext2_check_counts_t* counts,
+    ext2_check_progress_t progress,
+    void* arg)
+{
+    int ret = 0;
+    uint8_t* buf = NULL;
+
+    if (!_ext2_valid(ext2) || !counts)
+        ERAISE(-EINVAL);
+
+    if (first > ext2->group_count || count > ext2->group_count - first)
+        ERAISE(-EINVAL);
 
-            nfree += ext2->groups[i].bg_free_inodes_count;
+    /* the inode tables are read in place, so write back the cached inodes */
+    ECHECK(ext2_icache_sync(ext2->icache));
 
-            ECHECK(ext2_read_inode_bitmap(ext2, i, &bitmap));
-            nused += ext2_count_bits_n(bitmap.data, bitmap.size);
-            n += bitmap.size * 8;
-        }
+    if (!(buf = malloc(EXT2_MAX_READ_SIZE)))
+        ERAISE(-ENOMEM);
 
-        if (ext2->sb.s_free_inodes_count != n - nused)
-            ERAISE(-EINVAL);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ECHECK(_check_group(ext2, first + i, buf, counts));
 
-        if (ext2->sb.s_free_inodes_count != nfree)
-            ERAISE(-EINVAL);
+        if (progress)
+            (*progress)(i + 1, count, arg);
     }
 
-    /* Check the inodes */
-    {
-        uint32_t grpno;
-        uint32_t nbits = 0;
-        uint32_t mbits = 0;
+done:
 
-        /* Check the inode tables */
-        for (grpno = 0; grpno < ext2->group_count; grpno++)
-        {
-            ext2_block_t bitmap;
-            uint32_t lino;
+    if (buf)
+        free(buf);
 
-            /* Get inode bitmap for this group */
-            ECHECK(ext2_read_inode_bitmap(ext2, grpno, &bitmap));
+    return ret;
+}
 
-            nbits += ext2_count_bits_n(bitmap.data, bitmap.size);
+int ext2_check_groups(
+    const ext2_t* ext2,
+    uint32_t first,
+    uint32_t count,
+    ext2_check_counts_t* counts)
+{
+    return _check_groups(ext2, first, count, counts, NULL, NULL);
+}
 
-            /* For each bit set in the bit map */
-            for (lino = 0; lino < ext2->sb.s_inodes_per_group; lino++)
-            {
-                ext2_inode_t inode;
-                ext2_ino_t ino;
+int ext2_check_counts(const ext2_t* ext2, const ext2_check_counts_t* counts)
+{
+    int ret = 0;
 
-                if (!ext2_test_bit(bitmap.data, bitmap.size, lino))
-                    continue;
+    if (!_ext2_valid(ext2) || !counts)
+        ERAISE(-EINVAL);
 
-                mbits++;
+    if (ext2->sb.s_free_blocks_count != counts->free_blocks)
+    {
+        printf(
+            "s_free_blocks_count{%u}, nfree{%lu}\n",
+            ext2->sb.s_free_blocks_count,
+            counts->free_blocks);
+        ERAISE(-EINVAL);
+    }
 
-                if ((lino + 1) < EXT2_FIRST_INO && (lino + 1) != EXT2_ROOT_INO)
-                    continue;
+    if (ext2->sb.s_free_blocks_count != counts->clear_blocks)
+        ERAISE(-EINVAL);
 
-                ino = ext2_make_ino(ext2, grpno, lino);
+    if (ext2->sb.s_free_inodes_count != counts->clear_inodes)
+        ERAISE(-EINVAL);
 
-                ECHECK(ext2_read_inode(ext2, ino, &inode));
+    if (ext2->sb.s_free_inodes_count != counts->free_inodes)
+        ERAISE(-EINVAL);
 
-                /* Mode can never be zero */
-                if (inode.i_mode == 0)
-                    ERAISE(-EINVAL);
-            }
-        }
+done:
+    return ret;
+}
 
-        /* The number of bits in bitmap must match number of active inodes */
-        if (nbits != mbits)
-            ERAISE(-EINVAL);
-    }
+int ext2_check_ex(
+    const ext2_t* ext2,
+    ext2_check_progress_t progress,
+    void* arg)
+{
+    int ret = 0;
+    ext2_check_counts_t counts = {0};
+
+    if (!_ext2_valid(ext2))
+        ERAISE(-EINVAL);
+
+    ECHECK(_check_groups(ext2, 0, ext2->group_count, &counts, progress, arg));
+    ECHECK(ext2_check_counts(ext2, &counts));
 
 done:
     return ret;
 }
 
+int ext2_check(const ext2_t* ext2)
+{
+    return ext2_check_ex(ext2, NULL, NULL);
+}
+
 int ext2_read_block(const ext2_t* ext2, uint32_t blkno, ext2_block_t* block)
 {
     int ret = 0;
@@ -2887,7 +3897,7 @@ int ext2_read_block(const ext2_t* ext2, uint32_t blkno, ext2_block_t* block)
 
     /* Read the block */
     if (_read(
-            ext2->dev,
+            ext2,
             _blk_offset(blkno, ext2->block_size),
             block->data,
             block->size) != block->size)
@@ -2903,6 +3913,19 @@ done:
 }
 
 int ext2_read_inode(const ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
+{
+    int ret = 0;
+
+    if (ino == 0)
+        ERAISE(-EINVAL);
+
+    ECHECK(ext2_icache_read(ext2->icache, ino, inode));
+
+done:
+    return ret;
+}
+
+int ext2_load_inode(const ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
 {
     int ret = 0;
     uint32_t lino = _ino_to_lino(ext2, ino);
@@ -2925,7 +3948,7 @@ int ext2_read_inode(const ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
              lino * inode_size;
 
     /* Read the inode */
-    if (_read(ext2->dev, offset, inode, inode_size) != inode_size)
+    if (_read(ext2, offset, inode, inode_size) != inode_size)
         ERAISE(-EIO);
 
 done:
@@ -3004,7 +4027,7 @@ static int _stat(
         myst_file_t file = {
             .magic = FILE_MAGIC,
             .ino = *ino,
-            .inode = *inode,
+            .inode = inode,
             .offset = 0,
             .access = O_RDONLY,
             .open_flags = O_RDONLY,
@@ -3034,8 +4057,6 @@ int ext2_open(
     int r;
     ext2_dirent_t ent;
     follow_t follow = FOLLOW;
-    void* dir_data = NULL;
-    size_t dir_size = 0;
     char suffix[PATH_MAX];
     myst_fs_t* tfs = NULL;
 
@@ -3083,6 +4104,9 @@ int ext2_open(
         if ((flags & O_DIRECTORY))
             ERAISE(-ENOENT);
 
+        if (ext2->read_only)
+            ERAISE(-EROFS);
+
         /* split the path into directory and filename components */
         ECHECK(_split_path(path, dirname, filename));
 
@@ -3107,6 +4131,13 @@ int ext2_open(
         ERAISE(-ENOTDIR);
     }
 
+    /* fail if opening for write on a read-only file system */
+    if (ext2->read_only &&
+        ((flags & (O_RDWR | O_WRONLY)) || (flags & O_TRUNC)))
+    {
+        ERAISE(-EROFS);
+    }
+
     /* Allocate and initialize the file object */
     {
         if (!(file = (myst_file_t*)calloc(1, sizeof(myst_file_t))))
@@ -3114,11 +4145,14 @@ int ext2_open(
 
         file->magic = FILE_MAGIC;
         file->ino = ino;
-        file->inode = inode;
         file->offset = 0;
         file->open_flags = flags;
         file->access = (flags & (O_RDONLY | O_RDWR | O_WRONLY));
         file->operating = (flags & O_APPEND);
+
+        /* share the inode with the other opens of this file */
+        ECHECK(ext2_icache_get(ext2->icache, ino, &file->ientry));
+        file->inode = &file->ientry->inode;
     }
 
     /* truncate the file if requested and if not zero-sized */
@@ -3127,18 +4161,6 @@ int ext2_open(
         ECHECK(ext2_ftruncate(&ext2->base, file, 0));
     }
 
-    /* if it is a directory, then open directory */
-    if ((flags & O_DIRECTORY))
-    {
-        /* load the directory blocks into memory */
-        ECHECK((_load_file_by_path(ext2, path, &dir_data, &dir_size)));
-
-        file->dir.data = dir_data;
-        file->dir.size = dir_size;
-        file->dir.next = file->dir.data;
-        dir_data = NULL;
-    }
-
     /* Get the realpath of this file */
     {
         char buf[PATH_MAX];
@@ -3153,14 +4175,85 @@ int ext2_open(
 done:
 
     if (file)
-        _file_free(file);
-
-    if (dir_data)
-        free(dir_data);
+        _file_free(ext2, file);
 
     return ret;
 }
 
+/* Detect sequential reads of the file and keep a growing window of blocks
+ * beyond this read in the buffer cache, resetting on random access.
+ * Read-ahead is only a hint, so errors just end it. */
+static void _readahead(
+    ext2_t* ext2,
+    myst_file_t* file,
+    uint64_t size,
+    size_t num_blocks)
+{
+    const uint32_t bs = ext2->block_size;
+    const uint64_t file_size = _inode_get_size(file->inode);
+    uint32_t next;
+    uint32_t stop;
+
+    if (file->offset != file->ra.next)
+    {
+        file->ra.window = 0;
+        file->ra.end = 0;
+        return;
+    }
+
+    /* larger reads already go to the device in big requests */
+    if (size == 0 || size >= EXT2_READAHEAD_MAX || file->offset >= file_size)
+        return;
+
+    if (size > file_size - file->offset)
+        size = file_size - file->offset;
+
+    /* the logical block after the last one this read touches */
+    next = (file->offset + size - 1) / bs + 1;
+
+    /* nothing to do while at least half the window is still ahead */
+    if (file->ra.window && next + file->ra.window / 2 < file->ra.end)
+        return;
+
+    if (file->ra.window == 0)
+        file->ra.window = _next_mult(EXT2_READAHEAD_MIN, bs) / bs;
+    else if (file->ra.window < EXT2_READAHEAD_MAX / bs)
+        file->ra.window *= 2;
+
+    if (file->ra.end < next)
+        file->ra.end = next;
+
+    stop = next + file->ra.window;
+
+    if (stop > num_blocks)
+        stop = num_blocks;
+
+    /* prefetch each run of blocks that are contiguous on disk */
+    while (file->ra.end < stop)
+    {
+        uint32_t blkno;
+        size_t nblocks;
+
+        if (_file_get_blkno(ext2, file, file->ra.end, &blkno, &nblocks))
+            break;
+
+        if (nblocks > stop - file->ra.end)
+            nblocks = stop - file->ra.end;
+
+        /* skip holes */
+        if (blkno == 0)
+        {
+            file->ra.end += nblocks;
+            continue;
+        }
+
+        if (ext2_cache_prefetch(ext2->cache, blkno, nblocks) != 0)
+            break;
+
+        file->ra.end += nblocks;
+    }
+}
+
 int64_t ext2_read(myst_fs_t* fs, myst_file_t* file, void* data, uint64_t size)
 {
     int64_t ret = 0;
@@ -3186,7 +4279,9 @@ int64_t ext2_read(myst_fs_t* fs, myst_file_t* file, void* data, uint64_t size)
     /* The number of bytes r to be read */
     r = size;
 
-    num_blocks = _inode_get_num_blocks(ext2, &file->inode);
+    num_blocks = _inode_get_num_blocks(ext2, file->inode);
+
+    _readahead(ext2, file, size, num_blocks);
 
     /* Read the data block-by-block */
     for (i = first; i < num_blocks && r > 0 && !eof; i++)
@@ -3194,8 +4289,51 @@ int64_t ext2_read(myst_fs_t* fs, myst_file_t* file, void* data, uint64_t size)
         ext2_block_t block;
         uint32_t offset;
         uint32_t blkno;
+        size_t nblocks;
 
-        ECHECK(_inode_get_blkno(ext2, &file->inode, i, &blkno));
+        ECHECK(_file_get_blkno(ext2, file, i, &blkno, &nblocks));
+
+        /* read whole blocks that are contiguous on disk in one request */
+        if (blkno && file->offset % ext2->block_size == 0 &&
+            file->offset < _inode_get_size(file->inode))
+        {
+            const uint64_t left = _inode_get_size(file->inode) - file->offset;
+            uint64_t max = _min_size(_min_size(r, left), EXT2_MAX_READ_SIZE);
+
+            max /= ext2->block_size;
+
+            /* extend the run through the extents that follow */
+            while (nblocks < max)
+            {
+                uint32_t next;
+                size_t count;
+
+                if (_file_get_blkno(ext2, file, i + nblocks, &next, &count) ||
+                    next != blkno + nblocks)
+                {
+                    break;
+                }
+
+                nblocks += count;
+            }
+
+            if (nblocks > max)
+                nblocks = max;
+
+            if (max > 0)
+            {
+                const size_t n = nblocks * ext2->block_size;
+
+                ECHECK(ext2_cache_read_blocks(
+                    ext2->cache, blkno, nblocks, end));
+
+                r -= n;
+                end += n;
+                file->offset += n;
+                i += nblocks - 1;
+                continue;
+            }
+        }
 
         /* handle holes */
         if (blkno == 0)
@@ -3212,7 +4350,7 @@ int64_t ext2_read(myst_fs_t* fs, myst_file_t* file, void* data, uint64_t size)
 
             /* reduce n to bytes remaining in the file */
             {
-                uint64_t t = _inode_get_size(&file->inode) - file->offset;
+                uint64_t t = _inode_get_size(file->inode) - file->offset;
 
                 if (t < n)
                 {
@@ -3229,7 +4367,10 @@ int64_t ext2_read(myst_fs_t* fs, myst_file_t* file, void* data, uint64_t size)
         }
     }
 
-    /* ATTN.TIMESTAMPS */
+    /* as on Linux, failing to update the access time does not fail a read */
+    _touch_atime(ext2, file);
+
+    file->ra.next = file->offset;
 
     /* Calculate number of bytes read */
     ret = size - r;
@@ -3265,7 +4406,7 @@ int64_t ext2_write(
         goto done;
 
     /* save the file size */
-    file_size = _inode_get_size(&file->inode);
+    file_size = _inode_get_size(file->inode);
 
     /* get the index of the first block to written */
     first = file->offset / ext2->block_size;
@@ -3281,12 +4422,12 @@ int64_t ext2_write(
         bool found_blkno = false;
 
         /* get the block number for the i-th data block */
-        ECHECK(_inode_get_blkno(ext2, &file->inode, i, &blkno));
+        ECHECK(_file_get_blkno(ext2, file, i, &blkno, NULL));
 
         /* if the block number is zero, create a new block */
         if (blkno == 0)
         {
-            ECHECK(_get_blkno(ext2, &blkno));
+            ECHECK(_file_get_new_blkno(ext2, file, i, &blkno));
             _init_block(&block, ext2->block_size);
         }
         else
@@ -3316,7 +4457,8 @@ int64_t ext2_write(
             if (!found_blkno)
             {
                 ECHECK(
-                    _inode_add_blkno(ext2, file->ino, &file->inode, i, blkno));
+                    _inode_add_blkno(ext2, file->ino, file->inode, i, blkno));
+                ECHECK(_map_set(file, i, blkno));
             }
 
             /* set to zero to prevent it from being released below */
@@ -3332,12 +4474,12 @@ int64_t ext2_write(
 
     /* update the inode size */
     if (file->offset > file_size)
-        _inode_set_size(&file->inode, _max_size(file->offset, file_size));
+        _inode_set_size(file->inode, _max_size(file->offset, file_size));
 
-    _update_timestamps(&file->inode, CHANGE | MODIFY);
+    _update_timestamps(file->inode, CHANGE | MODIFY);
 
     /* flush the inode to disk */
-    ECHECK(_write_inode(ext2, file->ino, &file->inode));
+    ECHECK(_write_inode(ext2, file->ino, file->inode));
 
     /* calculate the number of bytes written */
     ret = size - r;
@@ -3373,7 +4515,7 @@ off_t ext2_lseek(myst_fs_t* fs, myst_file_t* file, off_t offset, int whence)
         }
         case SEEK_END:
         {
-            new_offset = _inode_get_size(&file->inode) + offset;
+            new_offset = _inode_get_size(file->inode) + offset;
             break;
         }
         default:
@@ -3400,14 +4542,13 @@ int ext2_close(myst_fs_t* fs, myst_file_t* file)
     if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
-    /* if a diretory, then release the directory memory contents */
-    if (file->dir.data)
-        free(file->dir.data);
+    /* give back any unused preallocated blocks */
+    ret = _file_put_prealloc(ext2, file);
 
     /* ATTN:TIMESTAMPS */
 
     /* release the file object */
-    _file_free(file);
+    _file_free(ext2, file);
 
 done:
     return ret;
@@ -3483,6 +4624,9 @@ int ext2_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
         goto done;
     }
 
+    if (ext2->read_only)
+        ERAISE(-EROFS);
+
     /* oldpath must not be a directory */
     if (S_ISDIR(inode.i_mode))
         ERAISE(-EISDIR);
@@ -3534,6 +4678,9 @@ int ext2_unlink(myst_fs_t* fs, const char* path)
         goto done;
     }
 
+    if (ext2->read_only)
+        ERAISE(-EROFS);
+
     /* fail if inode refers to a directory */
     if (S_ISDIR(inode.i_mode))
     {
@@ -3592,6 +4739,9 @@ int ext2_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
         goto done;
     }
 
+    if (ext2->read_only)
+        ERAISE(-EROFS);
+
     /* create the new link inode */
     ECHECK(_create_inode(ext2, 0, (S_IFLNK | 0777), &inode, &ino));
 
@@ -3714,6 +4864,9 @@ int ext2_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
         goto done;
     }
 
+    if (ext2->read_only)
+        ERAISE(-EROFS);
+
     /* find the newpath inode if it exists */
     if (_path_to_inode(
             ext2,
@@ -3804,17 +4957,17 @@ int ext2_fstat(myst_fs_t* fs, myst_file_t* file, struct stat* statbuf)
     memset(statbuf, 0, sizeof(struct stat));
     statbuf->st_dev = 0; /* ATTN: ignore device number */
     statbuf->st_ino = file->ino;
-    statbuf->st_mode = file->inode.i_mode;
-    statbuf->st_nlink = file->inode.i_links_count;
-    statbuf->st_uid = file->inode.i_uid;
-    statbuf->st_gid = file->inode.i_gid;
+    statbuf->st_mode = file->inode->i_mode;
+    statbuf->st_nlink = file->inode->i_links_count;
+    statbuf->st_uid = file->inode->i_uid;
+    statbuf->st_gid = file->inode->i_gid;
     statbuf->st_rdev = 0; /* only for special files */
-    statbuf->st_size = _inode_get_size(&file->inode);
+    statbuf->st_size = _inode_get_size(file->inode);
     statbuf->st_blksize = ext2->block_size;
-    statbuf->st_blocks = file->inode.i_blocks;
-    statbuf->st_atim.tv_sec = file->inode.i_atime;
-    statbuf->st_ctim.tv_sec = file->inode.i_ctime;
-    statbuf->st_mtim.tv_sec = file->inode.i_mtime;
+    statbuf->st_blocks = file->inode->i_blocks;
+    statbuf->st_atim.tv_sec = file->inode->i_atime;
+    statbuf->st_ctim.tv_sec = file->inode->i_ctime;
+    statbuf->st_mtim.tv_sec = file->inode->i_mtime;
 
 done:
     return ret;
@@ -3882,6 +5035,9 @@ int ext2_ftruncate(myst_fs_t* fs, myst_file_t* file, off_t length)
     if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    if (ext2->read_only)
+        ERAISE(-EROFS);
+
     ECHECK(_ftruncate(ext2, file, length, false));
 
 done:
@@ -3911,19 +5067,22 @@ int ext2_truncate(myst_fs_t* fs, const char* path, off_t length)
         goto done;
     }
 
+    if (ext2->read_only)
+        ERAISE(-EROFS);
+
     /* call _ftruncate() */
     {
         myst_file_t file = {
             .magic = FILE_MAGIC,
             .ino = ino,
-            .inode = inode,
+            .inode = &inode,
             .offset = 0,
             .access = O_WRONLY,
             .open_flags = O_WRONLY,
         };
-        ECHECK(_ftruncate(ext2, &file, length, false));
-        inode = file.inode;
+        ret = _ftruncate(ext2, &file, length, false);
         _file_clear(&file);
+        ECHECK(ret);
     }
 
     ret = 0;
@@ -3974,6 +5133,9 @@ int ext2_mkdir(myst_fs_t* fs, const char* path, mode_t mode)
         goto done;
     }
 
+    if (ext2->read_only)
+        ERAISE(-EROFS);
+
     /* Fail if the directory already exists */
     if (_path_to_inode(
             ext2,
@@ -4025,6 +5187,9 @@ int ext2_rmdir(myst_fs_t* fs, const char* path)
         goto done;
     }
 
+    if (ext2->read_only)
+        ERAISE(-EROFS);
+
     /* fail if not a directory */
     if (!S_ISDIR(inode.i_mode))
         ERAISE(-ENOTDIR);
@@ -4057,23 +5222,19 @@ int ext2_rmdir(myst_fs_t* fs, const char* path)
         myst_file_t file = {
             .magic = FILE_MAGIC,
             .ino = ino,
-            .inode = inode,
+            .inode = &inode,
             .offset = 0,
             .access = O_WRONLY,
             .open_flags = O_WRONLY,
         };
 
         ECHECK(_ftruncate(ext2, &file, 0, true));
-        inode = file.inode;
         _file_clear(&file);
     }
 
-    /* return the inode to the free list */
+    /* return the inode to the free list (which updates the super block) */
     ECHECK(_put_ino(ext2, ino));
 
-    /* update the super block */
-    ECHECK(_write_super_block(ext2));
-
 done:
 
     if (data)
@@ -4099,11 +5260,9 @@ int ext2_opendir(myst_fs_t* fs, const char* path, ext2_dir_t** dir_out)
     if (!(dir = (ext2_dir_t*)calloc(1, sizeof(ext2_dir_t))))
         ERAISE(-ENOMEM);
 
-    /* load the blocks for this inode into memory */
-    ECHECK((_load_file_by_path(ext2, path, &dir->data, &dir->size)));
-
-    /* set pointer to current directory */
-    dir->next = dir->data;
+    /* the blocks are read as the entries are */
+    ECHECK(ext2_open(
+        &ext2->base, path, O_RDONLY | O_DIRECTORY, 0000, NULL, &dir->file));
 
     /* set output parameter */
     *dir_out = dir;
@@ -4117,90 +5276,129 @@ done:
     return ret;
 }
 
-int ext2_readdir(myst_fs_t* fs, ext2_dir_t* dir, struct dirent** ent_out)
+/* Copy the directory block that holds dir->offset to dir->block (unless it
+ * is there already); returns 0 at the end of the directory */
+static int _dir_load_block(ext2_t* ext2, myst_file_t* file, ext2_dir_t* dir)
 {
     int ret = 0;
-    ext2_t* ext2 = (ext2_t*)fs;
-    struct dirent* ent = NULL;
+    const uint64_t bs = ext2->block_size;
+    const uint64_t block_offset = dir->offset / bs * bs;
+    int64_t n;
 
-    if (ent_out)
-        *ent_out = NULL;
+    if (dir->block_size && dir->block_offset == block_offset)
+        return 1;
 
-    if (!_ext2_valid(ext2) || !dir || !dir->data || !dir->next)
-        ERAISE(-EINVAL);
+    if (!dir->block && !(dir->block = malloc(bs)))
+        ERAISE(-ENOMEM);
+
+    /* in order, so that the read-ahead of the file keeps ahead of it */
+    dir->block_size = 0;
+    file->offset = block_offset;
+    ECHECK((n = ext2_read(&ext2->base, file, dir->block, bs)));
+
+    dir->block_offset = block_offset;
+    dir->block_size = (size_t)n;
+    ret = n > 0;
+
+done:
+    return ret;
+}
+
+static int _readdir(
+    ext2_t* ext2,
+    myst_file_t* file,
+    ext2_dir_t* dir,
+    struct dirent** ent_out)
+{
+    int ret = 0;
+    struct dirent* ent = NULL;
+    int r;
+
+    *ent_out = NULL;
 
     /* Find the next entry (possibly skipping padding entries) */
+    while (!ent && dir->offset < _inode_get_size(file->inode))
     {
-        const void* end = (void*)((char*)dir->data + dir->size);
+        const ext2_dirent_t* de;
+        const size_t hdr = offsetof(ext2_dirent_t, name);
+        size_t pos;
 
-        while (!ent && dir->next < end)
-        {
-            const ext2_dirent_t* de = (ext2_dirent_t*)dir->next;
+        ECHECK((r = _dir_load_block(ext2, file, dir)));
 
-            if (de->rec_len == 0)
-                break;
+        if (r == 0)
+            break;
 
-            if (de->name_len > 0)
-            {
-                /* Found! */
+        pos = dir->offset - dir->block_offset;
+        de = (const ext2_dirent_t*)(dir->block + pos);
 
-                /* Set struct dirent.d_ino */
-                dir->ent.d_ino = de->inode;
+        /* the entry (with its name) must lie within the block */
+        if (pos + hdr > dir->block_size || de->rec_len < hdr ||
+            de->rec_len > dir->block_size - pos ||
+            de->name_len > de->rec_len - hdr)
+        {
+            break;
+        }
 
-                /* Set struct dirent.d_off (not used) */
-                dir->ent.d_off = 0;
+        if (de->name_len > 0)
+        {
+            /* Found! */
 
-                /* Set struct dirent.d_reclen (not used) */
-                dir->ent.d_reclen = sizeof(struct dirent);
+            /* Set struct dirent.d_ino */
+            dir->ent.d_ino = de->inode;
 
-                /* Set struct dirent.type */
-                switch (de->file_type)
-                {
-                    case EXT2_FT_UNKNOWN:
-                        dir->ent.d_type = DT_UNKNOWN;
-                        break;
-                    case EXT2_FT_REG_FILE:
-                        dir->ent.d_type = DT_REG;
-                        break;
-                    case EXT2_FT_DIR:
-                        dir->ent.d_type = DT_DIR;
-                        break;
-                    case EXT2_FT_CHRDEV:
-                        dir->ent.d_type = DT_CHR;
-                        break;
-                    case EXT2_FT_BLKDEV:
-                        dir->ent.d_type = DT_BLK;
-                        break;
-                    case EXT2_FT_FIFO:
-                        dir->ent.d_type = DT_FIFO;
-                        break;
-                    case EXT2_FT_SOCK:
-                        dir->ent.d_type = DT_SOCK;
-                        break;
-                    case EXT2_FT_SYMLINK:
-                        dir->ent.d_type = DT_LNK;
-                        break;
-                    default:
-                        dir->ent.d_type = DT_UNKNOWN;
-                        break;
-                }
+            /* Set struct dirent.d_off (not used) */
+            dir->ent.d_off = 0;
 
-                /* Set struct dirent.d_name */
-                {
-                    size_t n1 = sizeof(dir->ent.d_name);
-                    size_t n2 = de->name_len;
-                    size_t n = _min_size(n1 - 1, n2);
-                    memcpy(dir->ent.d_name, de->name, n);
-                    memset(dir->ent.d_name + n, '\0', n1 - n);
-                }
+            /* Set struct dirent.d_reclen (not used) */
+            dir->ent.d_reclen = sizeof(struct dirent);
+
+            /* Set struct dirent.type */
+            switch (de->file_type)
+            {
+                case EXT2_FT_UNKNOWN:
+                    dir->ent.d_type = DT_UNKNOWN;
+                    break;
+                case EXT2_FT_REG_FILE:
+                    dir->ent.d_type = DT_REG;
+                    break;
+                case EXT2_FT_DIR:
+                    dir->ent.d_type = DT_DIR;
+                    break;
+                case EXT2_FT_CHRDEV:
+                    dir->ent.d_type = DT_CHR;
+                    break;
+                case EXT2_FT_BLKDEV:
+                    dir->ent.d_type = DT_BLK;
+                    break;
+                case EXT2_FT_FIFO:
+                    dir->ent.d_type = DT_FIFO;
+                    break;
+                case EXT2_FT_SOCK:
+                    dir->ent.d_type = DT_SOCK;
+                    break;
+                case EXT2_FT_SYMLINK:
+                    dir->ent.d_type = DT_LNK;
+                    break;
+                default:
+                    dir->ent.d_type = DT_UNKNOWN;
+                    break;
+            }
 
-                /* Success! */
-                ent = &dir->ent;
+            /* Set struct dirent.d_name */
+            {
+                size_t n1 = sizeof(dir->ent.d_name);
+                size_t n2 = de->name_len;
+                size_t n = _min_size(n1 - 1, n2);
+                memcpy(dir->ent.d_name, de->name, n);
+                memset(dir->ent.d_name + n, '\0', n1 - n);
             }
 
-            /* Position to the next entry (for next call to readdir) */
-            dir->next = (void*)((char*)dir->next + de->rec_len);
+            /* Success! */
+            ent = &dir->ent;
         }
+
+        /* Position to the next entry (for next call to readdir) */
+        dir->offset += de->rec_len;
     }
 
     if ((*ent_out = ent))
@@ -4210,6 +5408,23 @@ done:
     return ret;
 }
 
+int ext2_readdir(myst_fs_t* fs, ext2_dir_t* dir, struct dirent** ent_out)
+{
+    int ret = 0;
+    ext2_t* ext2 = (ext2_t*)fs;
+
+    if (ent_out)
+        *ent_out = NULL;
+
+    if (!_ext2_valid(ext2) || !dir || !_file_valid(dir->file) || !ent_out)
+        ERAISE(-EINVAL);
+
+    ret = _readdir(ext2, dir->file, dir, ent_out);
+
+done:
+    return ret;
+}
+
 int ext2_closedir(myst_fs_t* fs, ext2_dir_t* dir)
 {
     int ret = 0;
@@ -4218,7 +5433,10 @@ int ext2_closedir(myst_fs_t* fs, ext2_dir_t* dir)
     if (!_ext2_valid(ext2) || !dir)
         ERAISE(-EINVAL);
 
-    free(dir->data);
+    if (dir->file)
+        ext2_close(&ext2->base, dir->file);
+
+    free(dir->block);
     free(dir);
 
     ret = 0;
@@ -4283,6 +5501,14 @@ static int _ext2_dup(
             ERAISE(-ENOMEM);
 
         *new_file = *file;
+
+        /* the copy builds its own block map and preallocates its own */
+        memset(&new_file->map, 0, sizeof(new_file->map));
+        memset(&new_file->prealloc, 0, sizeof(new_file->prealloc));
+        memset(&new_file->dir, 0, sizeof(new_file->dir));
+
+        if (new_file->ientry)
+            ext2_icache_ref(ext2->icache, new_file->ientry);
     }
 
     *file_out = new_file;
@@ -4291,7 +5517,7 @@ static int _ext2_dup(
 done:
 
     if (new_file)
-        _file_free(new_file);
+        _file_free(ext2, new_file);
 
     return ret;
 }
@@ -4384,7 +5610,7 @@ static ssize_t _ext2_pread(
         ERAISE(-EFAULT);
 
     /* fail for directories */
-    if (S_ISDIR(file->inode.i_mode))
+    if (S_ISDIR(file->inode->i_mode))
         ERAISE(-EISDIR);
 
     old_offset = file->offset;
@@ -4426,7 +5652,7 @@ static ssize_t _ext2_pwrite(
     // When opened for append, Linux pwrite() appends data to the end of file
     // regadless of the offset.
     if ((file->operating & O_APPEND))
-        file->offset = _inode_get_size(&file->inode);
+        file->offset = _inode_get_size(file->inode);
     else
         file->offset = offset;
 
@@ -4560,16 +5786,19 @@ static int _ext2_getdents64(
     if (count == 0)
         goto done;
 
-    /* set next relative to offset in case rewinddir() was called */
-    file->dir.next = (uint8_t*)file->dir.data + file->offset;
+    /* resume at the offset (in case rewinddir() or lseek() moved it), and
+     * read the blocks again in case the directory changed since */
+    file->dir.offset = file->offset;
+    file->dir.block_size = 0;
 
     for (size_t i = 0; i < n; i++)
     {
         int r;
         struct dirent* ent = NULL;
 
-        if ((r = ext2_readdir(&ext2->base, &file->dir, &ent)) < 0)
+        if ((r = _readdir(ext2, file, &file->dir, &ent)) < 0)
         {
+            file->offset = file->dir.offset;
             ERAISE(r);
         }
 
@@ -4581,10 +5810,11 @@ static int _ext2_getdents64(
         bytes += sizeof(struct dirent);
         dirp++;
 
-        /* update the file offset */
-        file->offset = (uint8_t*)file->dir.next - (uint8_t*)file->dir.data;
     }
 
+    /* the cursor (which reading the blocks moved) */
+    file->offset = file->dir.offset;
+
     ret = (int)bytes;
 
 done:
@@ -4660,6 +5890,9 @@ static int _ext2_futimens(
     if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    if (ext2->read_only)
+        ERAISE(-EROFS);
+
     if (times)
     {
         switch (times[0].tv_nsec)
@@ -4667,13 +5900,13 @@ static int _ext2_futimens(
             case UTIME_OMIT:
                 break;
             case UTIME_NOW:
-                _update_timestamps(&file->inode, ACCESS);
+                _update_timestamps(file->inode, ACCESS);
                 break;
             default:
             {
                 const struct timespec* ts = &times[0];
                 uint32_t sec = ts->tv_sec + (ts->tv_nsec / NANO_IN_SECOND);
-                file->inode.i_atime = sec;
+                file->inode->i_atime = sec;
                 break;
             }
         }
@@ -4683,13 +5916,13 @@ static int _ext2_futimens(
             case UTIME_OMIT:
                 break;
             case UTIME_NOW:
-                _update_timestamps(&file->inode, MODIFY);
+                _update_timestamps(file->inode, MODIFY);
                 break;
             default:
             {
                 const struct timespec* ts = &times[1];
                 uint32_t sec = ts->tv_sec + (ts->tv_nsec / NANO_IN_SECOND);
-                file->inode.i_mtime = sec;
+                file->inode->i_mtime = sec;
                 break;
             }
         }
@@ -4697,14 +5930,28 @@ static int _ext2_futimens(
     else
     {
         /* set to current time */
-        _update_timestamps(&file->inode, ACCESS | MODIFY);
-        ECHECK(_write_inode(ext2, file->ino, &file->inode));
+        _update_timestamps(file->inode, ACCESS | MODIFY);
+        ECHECK(_write_inode(ext2, file->ino, file->inode));
     }
 
 done:
     return ret;
 }
 
+static int _ext2_fsync(myst_fs_t* fs, myst_file_t* file)
+{
+    int ret = 0;
+
+    if (!_file_valid(file))
+        ERAISE(-EINVAL);
+
+    /* the cache keeps no per-file lists, so write back everything */
+    ECHECK(ext2_sync(fs));
+
+done:
+    return ret;
+}
+
 static myst_fs_t _base = {
     {
         .fd_read = (void*)ext2_read,
@@ -4754,6 +6001,9 @@ static myst_fs_t _base = {
     .fs_statfs = _ext2_statfs,
     .fs_fstatfs = _ext2_fstatfs,
     .fs_futimens = _ext2_futimens,
+    .fs_fsync = _ext2_fsync,
+    /* reads leave the access time alone unless mount() asks otherwise */
+    .atime = MYST_ATIME_NONE,
 };
 
 int ext2_create(
@@ -4804,6 +6054,17 @@ int ext2_create(
     if (ext2->sb.s_inode_size > sizeof(ext2_inode_t))
         ERAISE(-EINVAL);
 
+    /* Reject features the driver does not know */
+    if (ext2->sb.s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPPORTED)
+        ERAISE(-EINVAL);
+
+    /* Mount read-only if the driver cannot keep the features up to date */
+    if ((ext2->sb.s_feature_incompat & EXT2_FEATURE_INCOMPAT_READ_ONLY) ||
+        (ext2->sb.s_feature_ro_compat & ~EXT2_FEATURE_RO_COMPAT_SUPPORTED))
+    {
+        ext2->read_only = true;
+    }
+
     /* Calcualte the block size in bytes */
     ext2->block_size = 1024 << ext2->sb.s_log_block_size;
 
@@ -4811,10 +6072,22 @@ int ext2_create(
     ext2->group_count =
         1 + (ext2->sb.s_blocks_count - 1) / ext2->sb.s_blocks_per_group;
 
+    /* Create the buffer cache (all reads and writes go through it) */
+    ECHECK(ext2_cache_create(
+        ext2->dev, ext2->block_size, EXT2_CACHE_BLOCKS, &ext2->cache));
+
+    ECHECK(ext2_dirindex_create(EXT2_DIRINDEX_ENTRIES, &ext2->dirindex));
+
+    /* Create the inode cache (all inode reads and writes go through it) */
+    ECHECK(ext2_icache_create(ext2, EXT2_ICACHE_INODES, &ext2->icache));
+
     /* Get the groups list */
     if (!(ext2->groups = _read_groups(ext2)))
         ERAISE(-EIO);
 
+    if (!(ext2->dirty_groups = calloc(1, (ext2->group_count + 7) / 8)))
+        ERAISE(-ENOMEM);
+
     /* Read the root inode */
     if ((ret = ext2_read_inode(ext2, EXT2_ROOT_INO, &ext2->root_inode)))
         ERAISE(-EIO);
@@ -4831,6 +6104,10 @@ done:
         if (ext2->groups)
             free(ext2->groups);
 
+        free(ext2->dirty_groups);
+        ext2_cache_release(ext2->cache);
+        ext2_dirindex_release(ext2->dirindex);
+        ext2_icache_release(ext2->icache);
         free(ext2);
     }
 
@@ -4841,13 +6118,29 @@ int ext2_release(myst_fs_t* fs)
 {
     int ret = 0;
     ext2_t* ext2 = (ext2_t*)fs;
+    int r;
 
     if (!_ext2_valid(ext2))
         ERAISE(-EINVAL);
 
+    /* write back before the device goes (but release even if that fails) */
+    ret = ext2_icache_sync(ext2->icache);
+
+    if ((r = _flush_metadata(ext2)) != 0 && ret == 0)
+        ret = r;
+
+    if ((r = ext2_cache_sync(ext2->cache)) != 0 && ret == 0)
+        ret = r;
+
+    ext2_icache_release(ext2->icache);
+    ext2_cache_release(ext2->cache);
+    ext2_dirindex_release(ext2->dirindex);
+
     if (ext2->groups)
         free(ext2->groups);
 
+    free(ext2->dirty_groups);
+
     if (ext2->dev)
         (*ext2->dev->close)(ext2->dev);
 
@@ -4856,3 +6149,47 @@ int ext2_release(myst_fs_t* fs)
 done:
     return ret;
 }
+
+int ext2_sync(myst_fs_t* fs)
+{
+    int ret = 0;
+    ext2_t* ext2 = (ext2_t*)fs;
+
+    if (!_ext2_valid(ext2))
+        ERAISE(-EINVAL);
+
+    ECHECK(ext2_icache_sync(ext2->icache));
+    ECHECK(_flush_metadata(ext2));
+    ECHECK(ext2_cache_sync(ext2->cache));
+
+done:
+    return ret;
+}
+
+int ext2_set_cache_size(myst_fs_t* fs, size_t max_blocks)
+{
+    int ret = 0;
+    ext2_t* ext2 = (ext2_t*)fs;
+
+    if (!_ext2_valid(ext2))
+        ERAISE(-EINVAL);
+
+    ECHECK(ext2_cache_resize(ext2->cache, max_blocks));
+
+done:
+    return ret;
+}
+
+int ext2_get_cache_stats(myst_fs_t* fs, ext2_cache_stats_t* stats)
+{
+    int ret = 0;
+    ext2_t* ext2 = (ext2_t*)fs;
+
+    if (!_ext2_valid(ext2) || !stats)
+        ERAISE(-EINVAL);
+
+    ext2_cache_stats(ext2->cache, stats);
+
+done:
+    return ret;
+}
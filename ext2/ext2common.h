@@ -30,4 +30,140 @@ ext2_make_ino(const ext2_t* ext2, uint32_t grpno, uint32_t lino)
     return (grpno * ext2->sb.s_inodes_per_group) + (lino + 1);
 }
 
+/* The buffer cache (see cache.c) */
+
+int ext2_cache_create(
+    myst_blkdev_t* dev,
+    uint32_t block_size,
+    size_t max_blocks,
+    ext2_cache_t** cache);
+
+/* Frees the cache without writing dirty blocks (see ext2_cache_sync()) */
+void ext2_cache_release(ext2_cache_t* cache);
+
+ssize_t ext2_cache_read(
+    ext2_cache_t* cache,
+    uint64_t offset,
+    void* data,
+    size_t size);
+
+/* Read whole blocks, reading uncached ones without adding them */
+int ext2_cache_read_blocks(
+    ext2_cache_t* cache,
+    uint64_t blkno,
+    size_t n,
+    void* data);
+
+/* Load uncached blocks ahead of their use (the rest are left alone) */
+int ext2_cache_prefetch(ext2_cache_t* cache, uint64_t blkno, size_t n);
+
+ssize_t ext2_cache_write(
+    ext2_cache_t* cache,
+    uint64_t offset,
+    const void* data,
+    size_t size);
+
+int ext2_cache_sync(ext2_cache_t* cache);
+
+int ext2_cache_resize(ext2_cache_t* cache, size_t max_blocks);
+
+void ext2_cache_stats(ext2_cache_t* cache, ext2_cache_stats_t* stats);
+
+/* Hash a file name the way htree directories do (see dirhash.c) */
+int ext2_dirhash(
+    const char* name,
+    size_t len,
+    uint8_t version,
+    const uint32_t seed[4],
+    uint32_t* hash);
+
+/* The in-memory directory index (see dirindex.c) */
+
+int ext2_dirindex_create(size_t max_entries, ext2_dirindex_t** index);
+
+void ext2_dirindex_release(ext2_dirindex_t* index);
+
+/* Look up a name in the directory's index: returns 0 if found, -ENOENT if
+ * not, or 1 if the directory has no index */
+int ext2_dirindex_lookup(
+    ext2_dirindex_t* index,
+    ext2_ino_t dino,
+    const char* name,
+    ext2_dirent_t* ent);
+
+/* Index the directory from its data (unless too large to index) */
+int ext2_dirindex_build(
+    ext2_dirindex_t* index,
+    ext2_ino_t dino,
+    const void* data,
+    size_t size);
+
+/* Keep the directory's index (if any) up to date with its entries */
+void ext2_dirindex_add(
+    ext2_dirindex_t* index,
+    ext2_ino_t dino,
+    const ext2_dirent_t* ent);
+
+void ext2_dirindex_remove(
+    ext2_dirindex_t* index,
+    ext2_ino_t dino,
+    const char* name);
+
+/* Forget the directory's index (when it is removed) */
+void ext2_dirindex_drop(ext2_dirindex_t* index, ext2_ino_t dino);
+
+/* The inode cache (see icache.c) */
+
+typedef struct ext2_icache_entry
+{
+    ext2_inode_t inode;
+    ext2_ino_t ino;
+    uint64_t gen;  /* changed whenever the inode maps its blocks anew */
+    size_t refs;   /* open files that share this inode */
+    bool dirty;    /* not yet written back to the inode table */
+    struct ext2_icache_entry* next;
+    struct ext2_icache_entry* lru_prev;
+    struct ext2_icache_entry* lru_next;
+} ext2_icache_entry_t;
+
+int ext2_icache_create(
+    ext2_t* ext2,
+    size_t max_unused,
+    ext2_icache_t** icache);
+
+/* Frees the cache without writing dirty inodes (see ext2_icache_sync()) */
+void ext2_icache_release(ext2_icache_t* icache);
+
+/* Copy the inode in or out of the cache (writes are written back later) */
+int ext2_icache_read(
+    ext2_icache_t* icache,
+    ext2_ino_t ino,
+    ext2_inode_t* inode);
+
+int ext2_icache_write(
+    ext2_icache_t* icache,
+    ext2_ino_t ino,
+    const ext2_inode_t* inode);
+
+/* Hold the inode in the cache (for an open file, which shares it) */
+int ext2_icache_get(
+    ext2_icache_t* icache,
+    ext2_ino_t ino,
+    ext2_icache_entry_t** entry);
+
+void ext2_icache_ref(ext2_icache_t* icache, ext2_icache_entry_t* entry);
+
+int ext2_icache_put(ext2_icache_t* icache, ext2_icache_entry_t* entry);
+
+/* Write the dirty inodes back to the inode tables */
+int ext2_icache_sync(ext2_icache_t* icache);
+
+/* Access the inode tables directly (see ext2.c) */
+int ext2_load_inode(const ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode);
+
+int ext2_store_inode(
+    const ext2_t* ext2,
+    ext2_ino_t ino,
+    const ext2_inode_t* inode);
+
 #endif /* _EXT2COMMON_H */
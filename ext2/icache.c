@@ -0,0 +1,365 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/eraise.h>
+#include <myst/spinlock.h>
+#include "ext2common.h"
+
+/*
+**==============================================================================
+**
+** The inode cache:
+**
+**     Holds the in-memory inodes, one per inode number, so that lookups need
+**     not go to the inode tables and so that every open of a file shares the
+**     same inode (and sees the others' changes to its size and timestamps).
+**     Changed inodes are written back to the inode tables lazily (when the
+**     cache is synced or when they are evicted). Entries held by open files
+**     are never evicted; the rest are kept on an LRU list and the least
+**     recently used are evicted to keep their number bounded.
+**
+**==============================================================================
+*/
+
+/* Number of hash chains (a power of two) */
+#define ICACHE_CHAINS 4096
+
+struct ext2_icache
+{
+    ext2_t* ext2;
+    ext2_icache_entry_t* chains[ICACHE_CHAINS];
+
+    /* the entries no open file holds (where head is least recently used) */
+    struct
+    {
+        ext2_icache_entry_t* head;
+        ext2_icache_entry_t* tail;
+        size_t size;
+    } lru;
+
+    size_t max_unused;
+    myst_spinlock_t lock;
+};
+
+static ext2_icache_entry_t** _chain(ext2_icache_t* icache, ext2_ino_t ino)
+{
+    return &icache->chains[ino & (ICACHE_CHAINS - 1)];
+}
+
+static void _lru_append(ext2_icache_t* icache, ext2_icache_entry_t* entry)
+{
+    entry->lru_next = NULL;
+    entry->lru_prev = icache->lru.tail;
+
+    if (icache->lru.tail)
+        icache->lru.tail->lru_next = entry;
+    else
+        icache->lru.head = entry;
+
+    icache->lru.tail = entry;
+    icache->lru.size++;
+}
+
+static void _lru_remove(ext2_icache_t* icache, ext2_icache_entry_t* entry)
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        icache->lru.head = entry->lru_next;
+
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        icache->lru.tail = entry->lru_prev;
+
+    icache->lru.size--;
+}
+
+static ext2_icache_entry_t* _find(ext2_icache_t* icache, ext2_ino_t ino)
+{
+    ext2_icache_entry_t* p;
+
+    for (p = *_chain(icache, ino); p; p = p->next)
+    {
+        if (p->ino == ino)
+            break;
+    }
+
+    return p;
+}
+
+static int _writeback(ext2_icache_t* icache, ext2_icache_entry_t* entry)
+{
+    int ret = 0;
+
+    if (entry->dirty)
+    {
+        ECHECK(ext2_store_inode(icache->ext2, entry->ino, &entry->inode));
+        entry->dirty = false;
+    }
+
+done:
+    return ret;
+}
+
+/* Remove the least recently used entry (writing it back first) */
+static int _remove_lru(ext2_icache_t* icache, ext2_icache_entry_t** entry_out)
+{
+    int ret = 0;
+    ext2_icache_entry_t* entry = icache->lru.head;
+    ext2_icache_entry_t** pp = _chain(icache, entry->ino);
+
+    /* keep the entry if it cannot be written back */
+    ECHECK(_writeback(icache, entry));
+
+    while (*pp != entry)
+        pp = &(*pp)->next;
+
+    *pp = entry->next;
+    _lru_remove(icache, entry);
+    *entry_out = entry;
+
+done:
+    return ret;
+}
+
+/* Evict unused entries beyond the limit (least recently used first) */
+static int _evict(ext2_icache_t* icache)
+{
+    int ret = 0;
+
+    while (icache->lru.size > icache->max_unused)
+    {
+        ext2_icache_entry_t* entry;
+
+        ECHECK(_remove_lru(icache, &entry));
+        free(entry);
+    }
+
+done:
+    return ret;
+}
+
+/* Find the entry (reading the inode into a new one if not cached) */
+static int _lookup(
+    ext2_icache_t* icache,
+    ext2_ino_t ino,
+    ext2_icache_entry_t** entry_out)
+{
+    int ret = 0;
+    ext2_icache_entry_t* entry;
+
+    if ((entry = _find(icache, ino)))
+    {
+        /* move to the back of the LRU list */
+        if (entry->refs == 0 && entry != icache->lru.tail)
+        {
+            _lru_remove(icache, entry);
+            _lru_append(icache, entry);
+        }
+
+        goto done;
+    }
+
+    /* reuse the least recently used entry once the cache is full */
+    if (icache->lru.size >= icache->max_unused && icache->lru.head)
+    {
+        ECHECK(_remove_lru(icache, &entry));
+        memset(entry, 0, sizeof(ext2_icache_entry_t));
+    }
+    else if (!(entry = calloc(1, sizeof(ext2_icache_entry_t))))
+    {
+        ERAISE(-ENOMEM);
+    }
+
+    if ((ret = ext2_load_inode(icache->ext2, ino, &entry->inode)) != 0)
+    {
+        free(entry);
+        ERAISE(ret);
+    }
+
+    entry->ino = ino;
+    entry->next = *_chain(icache, ino);
+    *_chain(icache, ino) = entry;
+    _lru_append(icache, entry);
+
+done:
+
+    if (ret == 0)
+        *entry_out = entry;
+
+    return ret;
+}
+
+/* Whether the new inode maps its blocks differently than the old one */
+static bool _blocks_changed(const ext2_inode_t* old, const ext2_inode_t* new)
+{
+    return old->i_size != new->i_size || old->i_dir_acl != new->i_dir_acl ||
+           old->i_blocks != new->i_blocks ||
+           memcmp(old->i_block, new->i_block, sizeof(old->i_block)) != 0;
+}
+
+int ext2_icache_create(
+    ext2_t* ext2,
+    size_t max_unused,
+    ext2_icache_t** icache_out)
+{
+    int ret = 0;
+    ext2_icache_t* icache;
+
+    if (!ext2 || !icache_out)
+        ERAISE(-EINVAL);
+
+    if (!(icache = calloc(1, sizeof(ext2_icache_t))))
+        ERAISE(-ENOMEM);
+
+    icache->ext2 = ext2;
+    icache->max_unused = max_unused;
+    icache->lock = MYST_SPINLOCK_INITIALIZER;
+
+    *icache_out = icache;
+
+done:
+    return ret;
+}
+
+void ext2_icache_release(ext2_icache_t* icache)
+{
+    if (icache)
+    {
+        for (size_t i = 0; i < ICACHE_CHAINS; i++)
+        {
+            for (ext2_icache_entry_t* p = icache->chains[i]; p;)
+            {
+                ext2_icache_entry_t* next = p->next;
+                free(p);
+                p = next;
+            }
+        }
+
+        free(icache);
+    }
+}
+
+int ext2_icache_read(
+    ext2_icache_t* icache,
+    ext2_ino_t ino,
+    ext2_inode_t* inode)
+{
+    int ret = 0;
+    ext2_icache_entry_t* entry;
+
+    myst_spin_lock(&icache->lock);
+
+    ECHECK(_lookup(icache, ino, &entry));
+    memcpy(inode, &entry->inode, sizeof(ext2_inode_t));
+    ECHECK(_evict(icache));
+
+done:
+    myst_spin_unlock(&icache->lock);
+    return ret;
+}
+
+int ext2_icache_write(
+    ext2_icache_t* icache,
+    ext2_ino_t ino,
+    const ext2_inode_t* inode)
+{
+    int ret = 0;
+    ext2_icache_entry_t* entry;
+
+    myst_spin_lock(&icache->lock);
+
+    ECHECK(_lookup(icache, ino, &entry));
+
+    /* the open files' inodes are updated in place (see ext2_icache_get()) */
+    if (inode != &entry->inode)
+    {
+        /* let the open files know their block maps are stale */
+        if (_blocks_changed(&entry->inode, inode))
+            entry->gen++;
+
+        memcpy(&entry->inode, inode, sizeof(ext2_inode_t));
+    }
+
+    entry->dirty = true;
+    ECHECK(_evict(icache));
+
+done:
+    myst_spin_unlock(&icache->lock);
+    return ret;
+}
+
+int ext2_icache_get(
+    ext2_icache_t* icache,
+    ext2_ino_t ino,
+    ext2_icache_entry_t** entry_out)
+{
+    int ret = 0;
+    ext2_icache_entry_t* entry;
+
+    if (!entry_out)
+        ERAISE(-EINVAL);
+
+    myst_spin_lock(&icache->lock);
+    {
+        if ((ret = _lookup(icache, ino, &entry)) == 0)
+        {
+            if (entry->refs++ == 0)
+                _lru_remove(icache, entry);
+
+            *entry_out = entry;
+        }
+    }
+    myst_spin_unlock(&icache->lock);
+
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+void ext2_icache_ref(ext2_icache_t* icache, ext2_icache_entry_t* entry)
+{
+    myst_spin_lock(&icache->lock);
+    entry->refs++;
+    myst_spin_unlock(&icache->lock);
+}
+
+int ext2_icache_put(ext2_icache_t* icache, ext2_icache_entry_t* entry)
+{
+    int ret = 0;
+
+    myst_spin_lock(&icache->lock);
+
+    if (--entry->refs == 0)
+    {
+        _lru_append(icache, entry);
+        ECHECK(_evict(icache));
+    }
+
+done:
+    myst_spin_unlock(&icache->lock);
+    return ret;
+}
+
+int ext2_icache_sync(ext2_icache_t* icache)
+{
+    int ret = 0;
+
+    myst_spin_lock(&icache->lock);
+
+    for (size_t i = 0; i < ICACHE_CHAINS; i++)
+    {
+        for (ext2_icache_entry_t* p = icache->chains[i]; p; p = p->next)
+            ECHECK(_writeback(icache, p));
+    }
+
+done:
+    myst_spin_unlock(&icache->lock);
+    return ret;
+}
@@ -1,40 +1,130 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <myst/blockdevice.h>
 #include <myst/eraise.h>
 #include "strings.h"
 
-static ssize_t _readn(int fd, void* data, size_t size, off_t off)
+/*
+**==============================================================================
+**
+** Direct I/O (MYST_BLKDEV_DIRECT_IO=1).
+**
+**     The enclave caches the blocks it reads, so with this set the host
+**     opens images with O_DIRECT rather than caching them a second time.
+**     That is only done when the file system allows direct I/O at the
+**     granularity of a block (512 bytes). Requests whose buffers are not
+**     aligned for direct I/O go through an aligned bounce buffer, and a
+**     device that rejects a direct request goes back to buffered I/O.
+**
+**==============================================================================
+*/
+
+#define BLOCK_SIZE sizeof(myst_block_t)
+
+/* alignment of the bounce buffers (enough for any direct I/O) */
+#define BOUNCE_ALIGN 4096
+
+/* descriptors beyond this always use buffered I/O */
+#define MAX_DIRECT_FDS 4096
+
+/* the memory alignment for direct I/O on each descriptor (0 if buffered) */
+static uint16_t _direct_align[MAX_DIRECT_FDS];
+
+static bool _want_direct_io(void)
+{
+    const char* val = getenv("MYST_BLKDEV_DIRECT_IO");
+    return val && strcmp(val, "1") == 0;
+}
+
+/* The memory alignment for direct I/O (0 if not at block granularity) */
+static size_t _get_direct_align(int fd)
+{
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN))
+    {
+        if (stx.stx_dio_offset_align == 0 ||
+            stx.stx_dio_offset_align > BLOCK_SIZE ||
+            stx.stx_dio_mem_align > BOUNCE_ALIGN)
+        {
+            return 0;
+        }
+
+        return stx.stx_dio_mem_align ? stx.stx_dio_mem_align : BLOCK_SIZE;
+    }
+#else
+    (void)fd;
+#endif
+
+    /* unknown: a request that the device rejects falls back to buffered */
+    return BLOCK_SIZE;
+}
+
+static void _clear_direct_io(int fd)
+{
+    int flags;
+
+    __atomic_store_n(&_direct_align[fd], 0, __ATOMIC_RELAXED);
+
+    if ((flags = fcntl(fd, F_GETFL)) >= 0)
+        fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+}
+
+static size_t _direct_io_align(int fd)
+{
+    if (fd < 0 || fd >= MAX_DIRECT_FDS)
+        return 0;
+
+    return __atomic_load_n(&_direct_align[fd], __ATOMIC_RELAXED);
+}
+
+/* Transfer all of [data:data+size] at the given offset */
+static ssize_t _transfern(
+    int fd,
+    void* data,
+    size_t size,
+    off_t off,
+    bool write)
 {
     ssize_t ret = 0;
-    unsigned char* p = (unsigned char*)data;
+    uint8_t* p = data;
     size_t r = size;
 
     while (r)
     {
-        ssize_t n = pread(fd, p, r, off);
+        ssize_t n;
 
-        if (n > 0)
-        {
-            p += n;
-            r -= n;
-            off += n;
-        }
-        else if (n == 0)
-        {
-            ERAISE(-EIO);
-        }
+        if (write)
+            n = pwrite(fd, p, r, off);
         else
+            n = pread(fd, p, r, off);
+
+        if (n < 0)
         {
+            if (errno == EINTR)
+                continue;
+
             ERAISE(-errno);
         }
+
+        if (n == 0)
+            ERAISE(-EIO);
+
+        p += n;
+        r -= n;
+        off += n;
     }
 
     ret = size;
@@ -43,33 +133,69 @@ done:
     return ret;
 }
 
-static ssize_t _writen(int fd, const void* data, size_t size, off_t off)
+/* Transfer through an aligned bounce buffer */
+static ssize_t _transfern_bounce(
+    int fd,
+    void* data,
+    size_t size,
+    off_t off,
+    bool write)
 {
     ssize_t ret = 0;
-    const unsigned char* p = (const unsigned char*)data;
-    size_t r = size;
+    void* buf = NULL;
 
-    while (r)
-    {
-        ssize_t n = pwrite(fd, p, r, off);
+    if (posix_memalign(&buf, BOUNCE_ALIGN, size) != 0)
+        ERAISE(-ENOMEM);
 
-        if (n > 0)
-        {
-            p += n;
-            r -= n;
-            off += n;
-        }
-        else if (n == 0)
-        {
-            ERAISE(-EIO);
-        }
-        else
-        {
-            ERAISE(-errno);
-        }
+    if (write)
+        memcpy(buf, data, size);
+
+    ECHECK(ret = _transfern(fd, buf, size, off, write));
+
+    if (!write)
+        memcpy(data, buf, size);
+
+done:
+
+    if (buf)
+        free(buf);
+
+    return ret;
+}
+
+static int _transfer_blocks(
+    int blkdev,
+    uint64_t blkno,
+    void* blocks,
+    size_t num_blocks,
+    bool write)
+{
+    int ret = 0;
+    const off_t offset = blkno * BLOCK_SIZE;
+    const size_t size = num_blocks * BLOCK_SIZE;
+    size_t align;
+    ssize_t n;
+
+    if (blkdev < 0 || !blocks || num_blocks == 0)
+        ERAISE(-EINVAL);
+
+    if ((align = _direct_io_align(blkdev)) && ((uintptr_t)blocks & (align - 1)))
+        n = _transfern_bounce(blkdev, blocks, size, offset, write);
+    else
+        n = _transfern(blkdev, blocks, size, offset, write);
+
+    /* the device does not take this direct request, so stop using it */
+    if (n == -EINVAL && align)
+    {
+        _clear_direct_io(blkdev);
+        n = _transfern(blkdev, blocks, size, offset, write);
     }
 
-    ret = size;
+    if (n < 0)
+        ERAISE((int)n);
+
+    if ((size_t)n != size)
+        ERAISE(-EIO);
 
 done:
     return ret;
@@ -78,11 +204,29 @@ done:
 int myst_open_block_device(const char* path, bool read_only)
 {
     int ret = 0;
-    int blkdev;
+    int blkdev = -1;
     int flags = read_only ? O_RDONLY : O_RDWR;
 
-    if ((blkdev = open(path, flags)) < 0)
+    /* file systems without direct I/O (such as tmpfs) fail with EINVAL */
+    if (_want_direct_io() && (blkdev = open(path, flags | O_DIRECT)) >= 0)
+    {
+        size_t align = 0;
+
+        if (blkdev < MAX_DIRECT_FDS)
+            align = _get_direct_align(blkdev);
+
+        if (align)
+            __atomic_store_n(&_direct_align[blkdev], align, __ATOMIC_RELAXED);
+        else if (fcntl(blkdev, F_SETFL, flags) != 0)
+        {
+            close(blkdev);
+            ERAISE(-errno);
+        }
+    }
+    else if ((blkdev = open(path, flags)) < 0)
+    {
         ERAISE(-errno);
+    }
 
     ret = blkdev;
 
@@ -97,6 +241,9 @@ int myst_close_block_device(int blkdev)
     if (blkdev < 0)
         ERAISE(-EINVAL);
 
+    if (blkdev < MAX_DIRECT_FDS)
+        __atomic_store_n(&_direct_align[blkdev], 0, __ATOMIC_RELAXED);
+
     if (close(blkdev) != 0)
         ERAISE(-errno);
 
@@ -110,18 +257,7 @@ int myst_write_block_device(
     const struct myst_block* blocks,
     size_t num_blocks)
 {
-    int ret = 0;
-    off_t offset = blkno * sizeof(myst_block_t);
-    size_t size = num_blocks * sizeof(myst_block_t);
-
-    if (blkdev < 0 || !blocks || num_blocks == 0)
-        ERAISE(-EINVAL);
-
-    if (_writen(blkdev, blocks, size, offset) != size)
-        ERAISE(-EIO);
-
-done:
-    return ret;
+    return _transfer_blocks(blkdev, blkno, (void*)blocks, num_blocks, true);
 }
 
 int myst_read_block_device(
@@ -130,16 +266,5 @@ int myst_read_block_device(
     struct myst_block* blocks,
     size_t num_blocks)
 {
-    int ret = 0;
-    off_t offset = blkno * sizeof(myst_block_t);
-    size_t size = num_blocks * sizeof(myst_block_t);
-
-    if (blkdev < 0 || !blocks || num_blocks == 0)
-        ERAISE(-EINVAL);
-
-    if (_readn(blkdev, blocks, size, offset) != size)
-        ERAISE(-EIO);
-
-done:
-    return ret;
+    return _transfer_blocks(blkdev, blkno, blocks, num_blocks, false);
 }
@@ -7,18 +7,123 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
 
 #include <myst/eraise.h>
 #include <myst/fdtable.h>
+#include <myst/file.h>
 #include <myst/fs.h>
+#include <myst/hostclose.h>
+#include <myst/hostfs.h>
 #include <myst/iov.h>
+#include <myst/mutex.h>
 #include <myst/realpath.h>
+#include <myst/round.h>
+#include <myst/sha256.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
 #include <myst/tcall.h>
+#include <myst/thread.h>
+#include <myst/time.h>
+#include <myst/workers.h>
+
+/*
+**==============================================================================
+**
+** attribute and directory cache:
+**
+**     Without a cache, every stat(), lstat(), access() and getdents64() is a
+**     tcall into the host. A mount may instead keep their results (see
+**     myst_hostfs_set_cache()) in one of two coherence modes:
+**
+**     MYST_HOSTFS_CACHE_TTL - results expire after a fixed time, so changes
+**         made by the host (or by anyone else) show up after at most that.
+**
+**     MYST_HOSTFS_CACHE_EXCLUSIVE - results never expire, which is only
+**         coherent when nothing but this kernel changes the host directory
+**         while it is mounted.
+**
+**     In both modes the kernel's own mutations drop what they affect: the
+**     path, its parent directory (whose listing and link count change) and
+**     every other name of the inode, such as hard links and symbolic links
+**     whose stat() reached it. Creating a name that might be a symbolic link
+**     expires all negative (ENOENT or ENOTDIR) results, and rename() and the
+**     removal of a symbolic link flush the cache, since paths through the
+**     old names are not tracked.
+**
+**     The first getdents64() on a directory reads it from the host in full.
+**     Later calls, and other opens of the directory until it changes, are
+**     served from this snapshot (directories too large to snapshot are read
+**     from the host as before).
+**
+**     Results are keyed by the path relative to the mount, which the kernel
+**     has made canonical before calling in here.
+**
+**==============================================================================
+*/
+
+#define CACHE_CHAINS 1024
+#define CACHE_MAX_ENTRIES 4096
+
+/* The largest directory snapshot and the most bytes that all may use */
+#define CACHE_MAX_DIR_SIZE (1024 * 1024)
+#define CACHE_MAX_DIR_BYTES (8 * 1024 * 1024)
+
+/* The initial size of the buffer that a directory is read into */
+#define CACHE_DIR_CHUNK 32768
+
+typedef struct dir_snapshot
+{
+    _Atomic(size_t) refs; /* the cache entry and the files that read it */
+    size_t size;
+    uint8_t data[]; /* the records with their d_off within the snapshot */
+} dir_snapshot_t;
+
+typedef struct cache_entry cache_entry_t;
+
+struct cache_entry
+{
+    cache_entry_t* chain_next; /* next in the path chain */
+    cache_entry_t* ino_next;   /* next in the inode chain (if have_ino) */
+    cache_entry_t* prev;       /* LRU list (most recently used first) */
+    cache_entry_t* next;
+    uint64_t hash;
+    long expires; /* monotonic msec (MYST_HOSTFS_CACHE_TTL) */
+    uint64_t neg_gen;
+    bool negative; /* has an ENOENT or ENOTDIR result */
+    bool have_ino; /* the inode that stat() of path reaches */
+    dev_t dev;
+    ino_t ino;
+    bool have_stat;
+    bool have_lstat;
+    int stat_ret;
+    int lstat_ret;
+    struct stat st;
+    struct stat lst;
+    uint8_t access_mask; /* the modes (0 to 7) whose result is cached */
+    int access_ret[8];
+    dir_snapshot_t* dir;
+    char path[];
+};
+
+typedef struct cache
+{
+    myst_mutex_t lock;
+    myst_hostfs_cache_t mode;
+    long ttl;
+    uint64_t gen;     /* advanced by every invalidation */
+    uint64_t neg_gen; /* advanced to expire the negative results */
+    cache_entry_t* chains[CACHE_CHAINS];
+    cache_entry_t* ino_chains[CACHE_CHAINS];
+    cache_entry_t* head;
+    cache_entry_t* tail;
+    size_t count;
+    size_t dir_bytes;
+} cache_t;
 
 /*
 **==============================================================================
@@ -28,80 +133,1365 @@
 **==============================================================================
 */
 
-#define HOSTFS_MAGIC 0x72bd543fe97e4fec
+#define HOSTFS_MAGIC 0x72bd543fe97e4fec
+
+typedef struct inode inode_t;
+
+/* Writes expire read-ahead by the inode number modulo this */
+#define IO_GEN_SLOTS 64
+
+/* A file listed by the manifest of a MYST_HOSTFS_MMAP_HOST mount */
+typedef struct manifest_entry
+{
+    char* path; /* relative to the mount (starting with a slash) */
+    myst_sha256_t hash;
+    _Atomic(bool) verified; /* the host file matched the hash */
+} manifest_entry_t;
+
+typedef struct hostfs
+{
+    myst_fs_t base;
+    uint64_t magic;
+    char source[PATH_MAX]; /* source argument to myst_mount() */
+    char target[PATH_MAX]; /* target argument to myst_mount() */
+    cache_t cache;
+    size_t io_buffer_size; /* zero unless buffering (see below) */
+    uint64_t flush_msec;
+    myst_mutex_t dirty_lock;
+    myst_file_t* dirty; /* the files with pending writes */
+    _Atomic(uint64_t) io_gens[IO_GEN_SLOTS]; /* advanced by writes */
+    _Atomic(bool) flusher_running;
+    _Atomic(bool) flusher_stopping;
+    myst_hostfs_mmap_t mmap_mode;
+    manifest_entry_t* manifest; /* sorted by path (null without one) */
+    size_t manifest_size;
+} hostfs_t;
+
+static bool _hostfs_valid(const hostfs_t* hostfs)
+{
+    return hostfs && hostfs->magic == HOSTFS_MAGIC;
+}
+
+static int _to_host_path(
+    hostfs_t* hostfs,
+    char* buf,
+    size_t size,
+    const char* path)
+{
+    if (myst_strlcpy(buf, hostfs->source, size) >= size)
+        return -ENAMETOOLONG;
+
+    if (path[0] != '/')
+    {
+        if (myst_strlcat(buf, "/", size) >= size)
+            return -ENAMETOOLONG;
+    }
+
+    if (myst_strlcat(buf, path, size) >= size)
+        return -ENAMETOOLONG;
+
+    return 0;
+}
+
+static int _to_local_path(
+    hostfs_t* hostfs,
+    char* buf,
+    size_t size,
+    const char* path)
+{
+    const size_t len = strlen(hostfs->source);
+
+    if (strncmp(hostfs->source, path, len) == 0)
+        path += len;
+
+    myst_strlcpy(buf, path, size);
+
+    return 0;
+}
+
+/*
+**==============================================================================
+**
+** myst_file_t
+**
+**==============================================================================
+*/
+
+#define FILE_MAGIC 0xb02950b846ff4d31
+
+struct myst_file
+{
+    uint64_t magic;
+    char realpath[PATH_MAX];
+    int fd;
+    bool have_ino; /* dev and ino (learned by _cache_drop_file()) */
+    dev_t dev;
+    ino_t ino;
+    dir_snapshot_t* dir; /* the directory snapshot that getdents64() reads */
+    size_t dir_offset;
+    bool dir_host; /* getdents64() reads from the host (not a snapshot) */
+    int flags;     /* the open flags (O_APPEND as F_SETFL changes it) */
+    myst_mutex_t lock; /* guards the buffer and the host offset */
+    bool unbuffered;
+    uint8_t* buf; /* pending writes (if dirty) or read-ahead data */
+    size_t buf_len;
+    size_t buf_pos;   /* the next read-ahead byte to read */
+    uint64_t buf_gen; /* the inode's io_gens[] slot when read ahead */
+    bool dirty;
+    long dirty_time; /* when the oldest pending write was made */
+    int werr;        /* the error of a deferred write */
+    myst_file_t* dirty_prev;
+    myst_file_t* dirty_next;
+};
+
+static bool _file_valid(const myst_file_t* file)
+{
+    return file && file->magic == FILE_MAGIC;
+}
+
+/*
+**==============================================================================
+**
+** cache implementation:
+**
+**==============================================================================
+*/
+
+static bool _cache_enabled(hostfs_t* hostfs)
+{
+    return hostfs->cache.mode != MYST_HOSTFS_CACHE_NONE;
+}
+
+static long _now_msec(void)
+{
+    struct timespec ts;
+
+    if (myst_syscall_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a */
+static uint64_t _hash_path(const char* path)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (const uint8_t* p = (const uint8_t*)path; *p; p++)
+        hash = (hash ^ *p) * 0x100000001b3;
+
+    return hash;
+}
+
+static size_t _ino_chain(dev_t dev, ino_t ino)
+{
+    return (size_t)((ino ^ (dev * 0x9e3779b97f4a7c15)) % CACHE_CHAINS);
+}
+
+/* Only results that do not depend on timing or resources are cached */
+static bool _cacheable(int ret)
+{
+    return ret == 0 || ret == -ENOENT || ret == -ENOTDIR || ret == -EACCES;
+}
+
+static void _release_dir(dir_snapshot_t* dir)
+{
+    if (dir && --dir->refs == 0)
+        free(dir);
+}
+
+/* The functions below up to the next comment require the cache lock */
+
+static void _unlink_ino(cache_t* cache, cache_entry_t* entry)
+{
+    if (entry->have_ino)
+    {
+        const size_t i = _ino_chain(entry->dev, entry->ino);
+        cache_entry_t** p = &cache->ino_chains[i];
+
+        while (*p != entry)
+            p = &(*p)->ino_next;
+
+        *p = entry->ino_next;
+        entry->ino_next = NULL;
+        entry->have_ino = false;
+    }
+}
+
+static void _set_ino(
+    cache_t* cache,
+    cache_entry_t* entry,
+    const struct stat* st)
+{
+    size_t i;
+
+    if (entry->have_ino && entry->dev == st->st_dev &&
+        entry->ino == st->st_ino)
+    {
+        return;
+    }
+
+    _unlink_ino(cache, entry);
+
+    i = _ino_chain(st->st_dev, st->st_ino);
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->have_ino = true;
+    entry->ino_next = cache->ino_chains[i];
+    cache->ino_chains[i] = entry;
+}
+
+static void _lru_unlink(cache_t* cache, cache_entry_t* entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void _lru_push(cache_t* cache, cache_entry_t* entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+
+    if (cache->head)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+
+    cache->head = entry;
+}
+
+static void _remove_entry(cache_t* cache, cache_entry_t* entry)
+{
+    cache_entry_t** p = &cache->chains[entry->hash % CACHE_CHAINS];
+
+    while (*p != entry)
+        p = &(*p)->chain_next;
+
+    *p = entry->chain_next;
+
+    _unlink_ino(cache, entry);
+    _lru_unlink(cache, entry);
+
+    if (entry->dir)
+    {
+        cache->dir_bytes -= entry->dir->size;
+        _release_dir(entry->dir);
+    }
+
+    cache->count--;
+    free(entry);
+}
+
+static void _flush(cache_t* cache)
+{
+    while (cache->head)
+        _remove_entry(cache, cache->head);
+
+    cache->gen++;
+}
+
+/* Evict the least recently used entries while over the limits */
+static void _trim(cache_t* cache)
+{
+    while (cache->tail && (cache->count > CACHE_MAX_ENTRIES ||
+                           cache->dir_bytes > CACHE_MAX_DIR_BYTES))
+    {
+        _remove_entry(cache, cache->tail);
+    }
+}
+
+/* Find the entry of the path (dropping it if it is out of date) */
+static cache_entry_t* _find_entry(cache_t* cache, const char* path)
+{
+    const uint64_t hash = _hash_path(path);
+    cache_entry_t* entry = cache->chains[hash % CACHE_CHAINS];
+
+    for (; entry; entry = entry->chain_next)
+    {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0)
+            break;
+    }
+
+    if (!entry)
+        return NULL;
+
+    const bool expired =
+        cache->mode == MYST_HOSTFS_CACHE_TTL && _now_msec() >= entry->expires;
+
+    if (expired || (entry->negative && entry->neg_gen != cache->neg_gen))
+    {
+        _remove_entry(cache, entry);
+        return NULL;
+    }
+
+    _lru_unlink(cache, entry);
+    _lru_push(cache, entry);
+
+    return entry;
+}
+
+/* Find or add the entry of the path */
+static cache_entry_t* _get_entry(cache_t* cache, const char* path)
+{
+    cache_entry_t* entry;
+    size_t len;
+
+    if ((entry = _find_entry(cache, path)))
+        return entry;
+
+    len = strlen(path);
+
+    if (!(entry = calloc(1, sizeof(cache_entry_t) + len + 1)))
+        return NULL;
+
+    memcpy(entry->path, path, len + 1);
+    entry->hash = _hash_path(path);
+
+    if (cache->mode == MYST_HOSTFS_CACHE_TTL)
+        entry->expires = _now_msec() + cache->ttl;
+
+    entry->chain_next = cache->chains[entry->hash % CACHE_CHAINS];
+    cache->chains[entry->hash % CACHE_CHAINS] = entry;
+    _lru_push(cache, entry);
+    cache->count++;
+
+    /* the new entry is the most recently used, so it stays */
+    _trim(cache);
+
+    return entry;
+}
+
+static void _set_negative(cache_t* cache, cache_entry_t* entry, int ret)
+{
+    if (ret == -ENOENT || ret == -ENOTDIR)
+    {
+        entry->negative = true;
+        entry->neg_gen = cache->neg_gen;
+    }
+}
+
+static void _drop_path(cache_t* cache, const char* path)
+{
+    cache_entry_t* entry;
+
+    if ((entry = _find_entry(cache, path)))
+        _remove_entry(cache, entry);
+}
+
+static void _drop_parent(cache_t* cache, const char* path)
+{
+    char parent[PATH_MAX];
+    char* slash;
+
+    myst_strlcpy(parent, path, sizeof(parent));
+
+    if (!(slash = strrchr(parent, '/')))
+        return;
+
+    if (slash == parent)
+        slash[1] = '\0';
+    else
+        *slash = '\0';
+
+    _drop_path(cache, parent);
+}
+
+/* Drop every entry whose stat() reached the inode */
+static void _drop_ino(cache_t* cache, dev_t dev, ino_t ino)
+{
+    cache_entry_t** p = &cache->ino_chains[_ino_chain(dev, ino)];
+
+    while (*p)
+    {
+        cache_entry_t* entry = *p;
+
+        /* removing the entry unlinks it from this chain */
+        if (entry->dev == dev && entry->ino == ino)
+            _remove_entry(cache, entry);
+        else
+            p = &entry->ino_next;
+    }
+}
+
+/* The functions below take the cache lock themselves */
+
+static uint64_t _cache_gen(hostfs_t* hostfs)
+{
+    uint64_t gen;
+
+    myst_mutex_lock(&hostfs->cache.lock);
+    gen = hostfs->cache.gen;
+    myst_mutex_unlock(&hostfs->cache.lock);
+
+    return gen;
+}
+
+/* Get the cached result of stat() or lstat() of the path */
+static bool _cache_get_stat(
+    hostfs_t* hostfs,
+    const char* path,
+    bool lstat,
+    struct stat* statbuf,
+    int* ret)
+{
+    cache_t* cache = &hostfs->cache;
+    cache_entry_t* entry;
+    bool found = false;
+
+    if (!_cache_enabled(hostfs))
+        return false;
+
+    myst_mutex_lock(&cache->lock);
+
+    if ((entry = _find_entry(cache, path)))
+    {
+        /* without a symbolic link, lstat() and stat() agree */
+        const bool link = !entry->have_lstat || (entry->lstat_ret == 0 &&
+                                                 S_ISLNK(entry->lst.st_mode));
+
+        if (entry->have_lstat && (lstat || !link))
+        {
+            if ((*ret = entry->lstat_ret) == 0)
+                *statbuf = entry->lst;
+
+            found = true;
+        }
+        else if (entry->have_stat && !lstat)
+        {
+            if ((*ret = entry->stat_ret) == 0)
+                *statbuf = entry->st;
+
+            found = true;
+        }
+    }
+
+    myst_mutex_unlock(&cache->lock);
+
+    return found;
+}
+
+static void _cache_put_stat(
+    hostfs_t* hostfs,
+    uint64_t gen,
+    const char* path,
+    bool lstat,
+    const struct stat* statbuf,
+    int ret)
+{
+    cache_t* cache = &hostfs->cache;
+    cache_entry_t* entry;
+
+    if (!_cache_enabled(hostfs) || !_cacheable(ret))
+        return;
+
+    myst_mutex_lock(&cache->lock);
+
+    /* skip results that an invalidation may have overtaken */
+    if (cache->gen == gen && (entry = _get_entry(cache, path)))
+    {
+        if (lstat)
+        {
+            entry->have_lstat = true;
+            entry->lstat_ret = ret;
+
+            if (ret == 0)
+                entry->lst = *statbuf;
+        }
+        else
+        {
+            entry->have_stat = true;
+            entry->stat_ret = ret;
+
+            if (ret == 0)
+                entry->st = *statbuf;
+        }
+
+        /* the inode of a symbolic link's own lstat() is not indexed */
+        if (ret == 0 && (!lstat || !S_ISLNK(statbuf->st_mode)))
+            _set_ino(cache, entry, statbuf);
+
+        _set_negative(cache, entry, ret);
+    }
+
+    myst_mutex_unlock(&cache->lock);
+}
+
+static bool _cache_get_access(
+    hostfs_t* hostfs,
+    const char* path,
+    int mode,
+    int* ret)
+{
+    cache_t* cache = &hostfs->cache;
+    cache_entry_t* entry;
+    bool found = false;
+
+    if (!_cache_enabled(hostfs) || (mode & ~7))
+        return false;
+
+    myst_mutex_lock(&cache->lock);
+
+    if ((entry = _find_entry(cache, path)) &&
+        (entry->access_mask & (1 << mode)))
+    {
+        *ret = entry->access_ret[mode];
+        found = true;
+    }
+
+    myst_mutex_unlock(&cache->lock);
+
+    return found;
+}
+
+static void _cache_put_access(
+    hostfs_t* hostfs,
+    uint64_t gen,
+    const char* path,
+    int mode,
+    int ret)
+{
+    cache_t* cache = &hostfs->cache;
+    cache_entry_t* entry;
+
+    if (!_cache_enabled(hostfs) || (mode & ~7) || !_cacheable(ret))
+        return;
+
+    myst_mutex_lock(&cache->lock);
+
+    if (cache->gen == gen && (entry = _get_entry(cache, path)))
+    {
+        entry->access_mask |= (1 << mode);
+        entry->access_ret[mode] = ret;
+        _set_negative(cache, entry, ret);
+    }
+
+    myst_mutex_unlock(&cache->lock);
+}
+
+/* Get a reference to the cached snapshot of the directory */
+static dir_snapshot_t* _cache_get_dir(hostfs_t* hostfs, const char* path)
+{
+    cache_t* cache = &hostfs->cache;
+    cache_entry_t* entry;
+    dir_snapshot_t* dir = NULL;
+
+    myst_mutex_lock(&cache->lock);
+
+    if ((entry = _find_entry(cache, path)) && (dir = entry->dir))
+        dir->refs++;
+
+    myst_mutex_unlock(&cache->lock);
+
+    return dir;
+}
+
+static void _cache_put_dir(
+    hostfs_t* hostfs,
+    uint64_t gen,
+    const char* path,
+    dir_snapshot_t* dir)
+{
+    cache_t* cache = &hostfs->cache;
+    cache_entry_t* entry;
+
+    myst_mutex_lock(&cache->lock);
+
+    if (cache->gen == gen && (entry = _get_entry(cache, path)) && !entry->dir)
+    {
+        dir->refs++;
+        entry->dir = dir;
+        cache->dir_bytes += dir->size;
+        _trim(cache);
+    }
+
+    myst_mutex_unlock(&cache->lock);
+}
+
+/* Find the inode that the path names, from the cache or else the host */
+static int _cache_lookup_ino(
+    hostfs_t* hostfs,
+    const char* hpath,
+    const char* path,
+    bool follow,
+    struct stat* statbuf)
+{
+    int ret = 0;
+    long tret;
+
+    if (_cache_get_stat(hostfs, path, !follow, statbuf, &ret))
+        return ret;
+
+    long params[6] = {(long)hpath, (long)statbuf};
+    ECHECK((tret = myst_tcall(follow ? SYS_stat : SYS_lstat, params)));
+
+done:
+    return ret;
+}
+
+/* Drop the path and optionally its parent directory; if the path might
+ * have been a symbolic link, expire the negative results too, since paths
+ * through the new name may now exist */
+static void _cache_drop(
+    hostfs_t* hostfs,
+    const char* path,
+    bool parent,
+    bool maybe_link)
+{
+    cache_t* cache = &hostfs->cache;
+
+    if (!_cache_enabled(hostfs))
+        return;
+
+    myst_mutex_lock(&cache->lock);
+
+    _drop_path(cache, path);
+
+    if (parent)
+        _drop_parent(cache, path);
+
+    if (maybe_link)
+        cache->neg_gen++;
+
+    cache->gen++;
+
+    myst_mutex_unlock(&cache->lock);
+}
+
+/* Drop every name of the inode whose attributes or links changed */
+static void _cache_drop_ino(hostfs_t* hostfs, const struct stat* statbuf)
+{
+    cache_t* cache = &hostfs->cache;
+
+    if (!_cache_enabled(hostfs))
+        return;
+
+    myst_mutex_lock(&cache->lock);
+    _drop_ino(cache, statbuf->st_dev, statbuf->st_ino);
+    cache->gen++;
+    myst_mutex_unlock(&cache->lock);
+}
+
+/* Drop every name of the open file after a change to its data or times */
+static void _cache_drop_file(hostfs_t* hostfs, myst_file_t* file)
+{
+    cache_t* cache = &hostfs->cache;
+
+    if (!_cache_enabled(hostfs))
+        return;
+
+    /* learn the inode once per file (unless nothing is cached) */
+    if (!file->have_ino && cache->count)
+    {
+        struct stat statbuf;
+        long params[6] = {file->fd, (long)&statbuf};
+
+        if (myst_tcall(SYS_fstat, params) == 0)
+        {
+            file->dev = statbuf.st_dev;
+            file->ino = statbuf.st_ino;
+            file->have_ino = true;
+        }
+    }
+
+    myst_mutex_lock(&cache->lock);
+
+    if (file->have_ino)
+        _drop_ino(cache, file->dev, file->ino);
+    else if (cache->count)
+        _flush(cache);
+
+    cache->gen++;
+
+    myst_mutex_unlock(&cache->lock);
+}
+
+static void _cache_flush(hostfs_t* hostfs)
+{
+    if (!_cache_enabled(hostfs))
+        return;
+
+    myst_mutex_lock(&hostfs->cache.lock);
+    _flush(&hostfs->cache);
+    myst_mutex_unlock(&hostfs->cache.lock);
+}
+
+/* Drop what removing the path changed, given what it named before */
+static void _cache_removed(
+    hostfs_t* hostfs,
+    const char* path,
+    const struct stat* statbuf)
+{
+    cache_t* cache = &hostfs->cache;
+
+    if (!_cache_enabled(hostfs))
+        return;
+
+    myst_mutex_lock(&cache->lock);
+
+    /* paths through a symbolic link are not tracked */
+    if (!statbuf || S_ISLNK(statbuf->st_mode))
+    {
+        _flush(cache);
+    }
+    else
+    {
+        _drop_ino(cache, statbuf->st_dev, statbuf->st_ino);
+        _drop_path(cache, path);
+        _drop_parent(cache, path);
+        cache->gen++;
+    }
+
+    myst_mutex_unlock(&cache->lock);
+}
+
+/* Read the whole directory from the host into a new snapshot, or return
+ * null (positioned at the start) if it is too large for one */
+static int _read_dir(myst_file_t* file, dir_snapshot_t** dir_out)
+{
+    int ret = 0;
+    dir_snapshot_t* dir = NULL;
+    size_t capacity = CACHE_DIR_CHUNK;
+    long tret;
+
+    *dir_out = NULL;
+
+    if (!(dir = malloc(sizeof(dir_snapshot_t) + capacity)))
+        ERAISE(-ENOMEM);
+
+    dir->size = 0;
+
+    for (;;)
+    {
+        /* leave room for the largest record */
+        if (capacity - dir->size < sizeof(struct dirent))
+        {
+            dir_snapshot_t* p;
+
+            if (capacity * 2 > CACHE_MAX_DIR_SIZE)
+            {
+                long params[6] = {file->fd, 0, SEEK_SET};
+                ECHECK(myst_tcall(SYS_lseek, params));
+                goto done;
+            }
+
+            capacity *= 2;
+
+            if (!(p = realloc(dir, sizeof(dir_snapshot_t) + capacity)))
+                ERAISE(-ENOMEM);
+
+            dir = p;
+        }
+
+        long params[6] = {
+            file->fd, (long)(dir->data + dir->size), capacity - dir->size};
+        ECHECK((tret = myst_tcall(SYS_getdents64, params)));
+
+        if (tret == 0)
+            break;
+
+        dir->size += tret;
+    }
+
+    /* the offset of the next record is where it lies in the snapshot */
+    for (size_t off = 0; off < dir->size;)
+    {
+        struct dirent* ent = (struct dirent*)(dir->data + off);
+
+        off += ent->d_reclen;
+        ent->d_off = off;
+    }
+
+    dir->refs = 1;
+    *dir_out = dir;
+    dir = NULL;
+
+done:
+
+    if (dir)
+        free(dir);
+
+    return ret;
+}
+
+/* Decide where getdents64() reads the directory from */
+static int _acquire_dir(hostfs_t* hostfs, myst_file_t* file)
+{
+    int ret = 0;
+    uint64_t gen;
+
+    if (!_cache_enabled(hostfs))
+    {
+        file->dir_host = true;
+        goto done;
+    }
+
+    file->dir_offset = 0;
+
+    if ((file->dir = _cache_get_dir(hostfs, file->realpath)))
+        goto done;
+
+    gen = _cache_gen(hostfs);
+    ECHECK(_read_dir(file, &file->dir));
+
+    if (file->dir)
+        _cache_put_dir(hostfs, gen, file->realpath, file->dir);
+    else
+        file->dir_host = true;
+
+done:
+    return ret;
+}
+
+static off_t _seek_dir(myst_file_t* file, off_t offset, int whence)
+{
+    off_t ret = 0;
+    const dir_snapshot_t* dir = file->dir;
+    size_t pos = 0;
+
+    if (whence == SEEK_CUR)
+        offset += (off_t)file->dir_offset;
+    else if (whence != SEEK_SET)
+        ERAISE(-EINVAL);
+
+    if (offset < 0 || (size_t)offset > dir->size)
+        ERAISE(-EINVAL);
+
+    /* only offsets at record boundaries (which d_off gives) are valid */
+    while (pos < (size_t)offset)
+        pos += ((const struct dirent*)(dir->data + pos))->d_reclen;
+
+    if (pos != (size_t)offset)
+        ERAISE(-EINVAL);
+
+    file->dir_offset = pos;
+    ret = offset;
+
+done:
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** buffered and parallel I/O:
+**
+**     With an I/O buffer size (see myst_hostfs_set_buffering()), each open
+**     regular file has a buffer that holds either pending writes or data
+**     read ahead, never both:
+**
+**     - write() collects consecutive writes in the buffer, which goes to
+**       the host when full, on fsync() or close(), before any other
+**       operation of the mount that looks at file data or attributes, and
+**       (by the flusher thread) once it has waited for the flush interval.
+**       Since other operations flush first, programs in the kernel see
+**       their writes at once; the host sees them within the interval.
+**       Errors of deferred writes are returned by the next write(),
+**       fsync() or close() of the file.
+**
+**     - read() fills the buffer with what follows, so that sequential
+**       reads are served without the host. Writes through the mount
+**       expire what other files read ahead of the same inode. The host
+**       offset is moved back over the unread bytes whenever the buffer is
+**       dropped, so lseek() and the host agree on the file offset.
+**
+**     Files opened with O_SYNC or O_DSYNC are not buffered, and neither
+**     are files passed to dup(), whose copies share the host offset.
+**
+**     Independently of the buffer, read() and write() calls of at least
+**     LARGE_IO_SIZE are split into chunks that the kernel worker threads
+**     (see myst/workers.h) transfer with pread() and pwrite() at once, so
+**     that several host calls are in flight.
+**
+**==============================================================================
+*/
+
+/* Reads and writes of at least this many bytes are split into chunks */
+#define LARGE_IO_SIZE (2 * LARGE_IO_CHUNK)
+#define LARGE_IO_CHUNK (1024 * 1024)
+
+/* A chunk of a large read or write for a kernel worker thread */
+typedef struct io_work
+{
+    myst_work_t base;
+    int fd;
+    bool write;
+    uint8_t* buf;
+    size_t count;
+    off_t offset;
+    ssize_t ret; /* bytes transferred or a negative errno */
+} io_work_t;
+
+static int _io_work(myst_work_t* work_)
+{
+    io_work_t* work = (io_work_t*)work_;
+    const long n = work->write ? SYS_pwrite64 : SYS_pread64;
+    size_t done = 0;
+
+    /* the chunk ends early only at the end of the file (or on error) */
+    while (done < work->count)
+    {
+        long params[6] = {
+            work->fd,
+            (long)(work->buf + done),
+            work->count - done,
+            work->offset + done};
+        long r = myst_tcall(n, params);
+
+        if (r < 0 && done == 0)
+        {
+            work->ret = r;
+            return 0;
+        }
+
+        if (r <= 0)
+            break;
+
+        done += r;
+    }
+
+    work->ret = (ssize_t)done;
+    return 0;
+}
+
+/* Transfer count bytes at offset in chunks on the worker threads and return
+ * how far the transfer got before the first chunk that fell short */
+static ssize_t _parallel_io(
+    int fd,
+    bool write,
+    uint8_t* buf,
+    size_t count,
+    off_t offset)
+{
+    io_work_t works[MYST_MAX_WORKERS + 1];
+    myst_workgroup_t group = MYST_WORKGROUP_INITIALIZER;
+    const size_t max_works = myst_num_workers() + 1;
+    size_t total = 0;
+
+    while (total < count)
+    {
+        size_t nworks = 0;
+        size_t size = 0;
+
+        for (; nworks < max_works && total + size < count; nworks++)
+        {
+            io_work_t* work = &works[nworks];
+            size_t n = count - (total + size);
+
+            if (n > LARGE_IO_CHUNK)
+                n = LARGE_IO_CHUNK;
+
+            work->base.fn = _io_work;
+            work->fd = fd;
+            work->write = write;
+            work->buf = buf + total + size;
+            work->count = n;
+            work->offset = offset + (off_t)(total + size);
+            work->ret = 0;
+            myst_submit_work(&group, &work->base);
+            size += n;
+        }
+
+        /* the works report their errors in ret */
+        myst_wait_workgroup(&group);
+
+        for (size_t i = 0; i < nworks; i++)
+        {
+            if (works[i].ret < 0)
+                return total ? (ssize_t)total : works[i].ret;
+
+            total += works[i].ret;
+
+            if ((size_t)works[i].ret < works[i].count)
+                return (ssize_t)total;
+        }
+    }
+
+    return (ssize_t)total;
+}
+
+/* Whether the file offset can take part in a large parallel transfer */
+static bool _large_io(myst_file_t* file, bool write, size_t count)
+{
+    if (count < LARGE_IO_SIZE || myst_num_workers() == 0)
+        return false;
+
+    /* pwrite() ignores O_APPEND */
+    return !(write && (file->flags & O_APPEND));
+}
+
+/* read() or write() straight from or to the host */
+static ssize_t _host_io(
+    myst_file_t* file,
+    bool write,
+    void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+    long tret;
+
+    if (_large_io(file, write, count))
+    {
+        long params[6] = {file->fd, 0, SEEK_CUR};
+        const off_t offset = myst_tcall(SYS_lseek, params);
+
+        /* fall back to one call if the file is not seekable (pipes) */
+        if (offset >= 0)
+        {
+            ECHECK(ret = _parallel_io(file->fd, write, buf, count, offset));
+
+            long seek[6] = {file->fd, offset + ret, SEEK_SET};
+            ECHECK(myst_tcall(SYS_lseek, seek));
+            goto done;
+        }
+    }
+
+    long params[6] = {file->fd, (long)buf, count};
+    ECHECK((tret = myst_tcall(write ? SYS_write : SYS_read, params)));
 
-typedef struct inode inode_t;
+    ret = tret;
 
-typedef struct hostfs
+done:
+    return ret;
+}
+
+/* Expire the read-ahead of the file's inode in all files of the mount (or
+ * everything read ahead if the inode is unknown) */
+static void _expire_read_ahead(hostfs_t* hostfs, const myst_file_t* file)
 {
-    myst_fs_t base;
-    uint64_t magic;
-    char source[PATH_MAX]; /* source argument to myst_mount() */
-    char target[PATH_MAX]; /* target argument to myst_mount() */
-} hostfs_t;
+    if (!hostfs->io_buffer_size)
+        return;
 
-static bool _hostfs_valid(const hostfs_t* hostfs)
+    if (file && file->have_ino)
+    {
+        hostfs->io_gens[file->ino % IO_GEN_SLOTS]++;
+        return;
+    }
+
+    for (size_t i = 0; i < IO_GEN_SLOTS; i++)
+        hostfs->io_gens[i]++;
+}
+
+static void _link_dirty(hostfs_t* hostfs, myst_file_t* file)
 {
-    return hostfs && hostfs->magic == HOSTFS_MAGIC;
+    myst_mutex_lock(&hostfs->dirty_lock);
+
+    file->dirty_prev = NULL;
+    file->dirty_next = hostfs->dirty;
+
+    if (hostfs->dirty)
+        hostfs->dirty->dirty_prev = file;
+
+    hostfs->dirty = file;
+
+    myst_mutex_unlock(&hostfs->dirty_lock);
 }
 
-static int _to_host_path(
-    hostfs_t* hostfs,
-    char* buf,
-    size_t size,
-    const char* path)
+static void _unlink_dirty(hostfs_t* hostfs, myst_file_t* file)
 {
-    if (myst_strlcpy(buf, hostfs->source, size) >= size)
-        return -ENAMETOOLONG;
+    myst_mutex_lock(&hostfs->dirty_lock);
 
-    if (path[0] != '/')
+    if (file->dirty_prev)
+        file->dirty_prev->dirty_next = file->dirty_next;
+    else
+        hostfs->dirty = file->dirty_next;
+
+    if (file->dirty_next)
+        file->dirty_next->dirty_prev = file->dirty_prev;
+
+    file->dirty_prev = NULL;
+    file->dirty_next = NULL;
+
+    myst_mutex_unlock(&hostfs->dirty_lock);
+}
+
+/* Write the pending writes of the file to the host (requires its lock) */
+static int _flush_file(hostfs_t* hostfs, myst_file_t* file)
+{
+    int ret = 0;
+    size_t done = 0;
+
+    if (!file->dirty)
+        goto done;
+
+    while (done < file->buf_len)
     {
-        if (myst_strlcat(buf, "/", size) >= size)
-            return -ENAMETOOLONG;
+        long params[6] = {
+            file->fd, (long)(file->buf + done), file->buf_len - done};
+        long r = myst_tcall(SYS_write, params);
+
+        if (r == 0)
+            r = -EIO;
+
+        if (r < 0)
+        {
+            ret = (int)r;
+            break;
+        }
+
+        done += r;
     }
 
-    if (myst_strlcat(buf, path, size) >= size)
-        return -ENAMETOOLONG;
+    /* whatever failed is dropped (its error is reported once) */
+    file->dirty = false;
+    file->buf_len = 0;
+    _unlink_dirty(hostfs, file);
+    _expire_read_ahead(hostfs, file);
 
-    return 0;
+done:
+    return ret;
 }
 
-static int _to_local_path(
+/* Drop the read-ahead of the file, moving the host offset back over the
+ * bytes not read yet (requires the file lock) */
+static int _drop_read_ahead(myst_file_t* file)
+{
+    int ret = 0;
+    const size_t unread = file->buf_len - file->buf_pos;
+
+    if (file->dirty)
+        goto done;
+
+    file->buf_len = 0;
+    file->buf_pos = 0;
+
+    if (unread)
+    {
+        long params[6] = {file->fd, -(long)unread, SEEK_CUR};
+        ECHECK(myst_tcall(SYS_lseek, params));
+    }
+
+done:
+    return ret;
+}
+
+/* Flush the pending writes of the files of the mount that have waited since
+ * before the given time (and are of the same inode as the given file, if
+ * any). Files busy in another thread are left alone, since their operations
+ * are not ordered with the caller's anyway. */
+static void _flush_dirty_before(
     hostfs_t* hostfs,
-    char* buf,
-    size_t size,
-    const char* path)
+    long before,
+    const myst_file_t* same)
 {
-    const size_t len = strlen(hostfs->source);
+    myst_file_t* next;
 
-    if (strncmp(hostfs->source, path, len) == 0)
-        path += len;
+    myst_mutex_lock(&hostfs->dirty_lock);
 
-    myst_strlcpy(buf, path, size);
+    for (myst_file_t* p = hostfs->dirty; p; p = next)
+    {
+        next = p->dirty_next;
+
+        if (same && (p == same || p->dev != same->dev || p->ino != same->ino))
+            continue;
+
+        /* the list lock keeps the file from being closed meanwhile */
+        if (p->dirty_time <= before && myst_mutex_trylock(&p->lock) == 0)
+        {
+            int r = _flush_file(hostfs, p);
+
+            if (r != 0 && p->werr == 0)
+                p->werr = r;
+
+            myst_mutex_unlock(&p->lock);
+        }
+    }
+
+    myst_mutex_unlock(&hostfs->dirty_lock);
+}
+
+/* Flush all pending writes before an operation that might observe them */
+static void _flush_dirty(hostfs_t* hostfs)
+{
+    if (__atomic_load_n(&hostfs->dirty, __ATOMIC_ACQUIRE))
+        _flush_dirty_before(hostfs, LONG_MAX, NULL);
+}
+
+static int _flusher(void* arg)
+{
+    hostfs_t* hostfs = arg;
+
+    while (!hostfs->flusher_stopping)
+    {
+        myst_sleep_msec(hostfs->flush_msec);
+        const long before = _now_msec() - (long)hostfs->flush_msec;
+        _flush_dirty_before(hostfs, before, NULL);
+    }
+
+    hostfs->flusher_running = false;
 
     return 0;
 }
 
-/*
-**==============================================================================
-**
-** myst_file_t
-**
-**==============================================================================
-*/
+/* Whether read() and write() go through the file's buffer (allocated on
+ * first use once the file turns out to be a regular file) */
+static bool _buffered(hostfs_t* hostfs, myst_file_t* file)
+{
+    if (!hostfs->io_buffer_size || file->unbuffered)
+        return false;
 
-#define FILE_MAGIC 0xb02950b846ff4d31
+    if (!file->buf)
+    {
+        struct stat statbuf;
+        long params[6] = {file->fd, (long)&statbuf};
 
-struct myst_file
+        if ((file->flags & (O_SYNC | O_DSYNC)) ||
+            myst_tcall(SYS_fstat, params) != 0 || !S_ISREG(statbuf.st_mode) ||
+            !(file->buf = malloc(hostfs->io_buffer_size)))
+        {
+            file->unbuffered = true;
+            return false;
+        }
+
+        file->dev = statbuf.st_dev;
+        file->ino = statbuf.st_ino;
+        file->have_ino = true;
+    }
+
+    return true;
+}
+
+static ssize_t _buffered_read(
+    hostfs_t* hostfs,
+    myst_file_t* file,
+    uint8_t* buf,
+    size_t count)
 {
-    uint64_t magic;
-    char realpath[PATH_MAX];
-    int fd;
-};
+    ssize_t ret = 0;
+    const size_t size = hostfs->io_buffer_size;
+    const size_t slot = file->ino % IO_GEN_SLOTS;
+    size_t n = 0;
 
-static bool _file_valid(const myst_file_t* file)
+    /* writes of another thread may have raced with the caller's flush */
+    ECHECK(_flush_file(hostfs, file));
+
+    /* a write through the mount may have changed what was read ahead */
+    if (file->buf_gen != hostfs->io_gens[slot])
+        ECHECK(_drop_read_ahead(file));
+
+    while (n < count)
+    {
+        long tret;
+
+        if (file->buf_pos < file->buf_len)
+        {
+            size_t m = file->buf_len - file->buf_pos;
+
+            if (m > count - n)
+                m = count - n;
+
+            memcpy(buf + n, file->buf + file->buf_pos, m);
+            file->buf_pos += m;
+            n += m;
+            continue;
+        }
+
+        /* what is left would not fit in the buffer anyway */
+        if (count - n >= size)
+        {
+            tret = _host_io(file, false, buf + n, count - n);
+        }
+        else
+        {
+            file->buf_gen = hostfs->io_gens[slot];
+            file->buf_len = 0;
+            file->buf_pos = 0;
+
+            long params[6] = {file->fd, (long)file->buf, size};
+
+            if ((tret = myst_tcall(SYS_read, params)) > 0)
+            {
+                file->buf_len = tret;
+                continue;
+            }
+        }
+
+        if (tret < 0 && n == 0)
+            ERAISE(tret);
+
+        if (tret > 0)
+            n += tret;
+
+        break;
+    }
+
+    ret = (ssize_t)n;
+
+done:
+    return ret;
+}
+
+static ssize_t _buffered_write(
+    hostfs_t* hostfs,
+    myst_file_t* file,
+    const void* buf,
+    size_t count)
 {
-    return file && file->magic == FILE_MAGIC;
+    ssize_t ret = 0;
+    const size_t size = hostfs->io_buffer_size;
+
+    if (file->werr)
+    {
+        ret = file->werr;
+        file->werr = 0;
+        ERAISE(ret);
+    }
+
+    ECHECK(_drop_read_ahead(file));
+
+    /* keep the order of writes through other files of the inode */
+    if (__atomic_load_n(&hostfs->dirty, __ATOMIC_ACQUIRE))
+        _flush_dirty_before(hostfs, LONG_MAX, file);
+
+    if (file->buf_len + count > size)
+        ECHECK(_flush_file(hostfs, file));
+
+    if (count >= size)
+    {
+        ECHECK(ret = _host_io(file, true, (void*)buf, count));
+        _expire_read_ahead(hostfs, file);
+        goto done;
+    }
+
+    memcpy(file->buf + file->buf_len, buf, count);
+    file->buf_len += count;
+
+    if (!file->dirty)
+    {
+        file->dirty = true;
+        file->dirty_time = _now_msec();
+        _link_dirty(hostfs, file);
+    }
+
+    ret = (ssize_t)count;
+
+done:
+    return ret;
+}
+
+/* Flush and drop the file's buffer for good (requires the file lock) */
+static int _unbuffer(hostfs_t* hostfs, myst_file_t* file)
+{
+    int ret = 0;
+
+    ECHECK(_flush_file(hostfs, file));
+    ECHECK(_drop_read_ahead(file));
+
+    free(file->buf);
+    file->buf = NULL;
+    file->unbuffered = true;
+
+done:
+    return ret;
 }
 
 /*
@@ -120,6 +1510,24 @@ static int _fs_release(myst_fs_t* fs)
     if (!_hostfs_valid(hostfs))
         ERAISE(-EINVAL);
 
+    _cache_flush(hostfs);
+
+    /* Wait for the flusher thread to exit (it sleeps one interval) */
+    hostfs->flusher_stopping = true;
+
+    for (uint64_t i = 0; i < hostfs->flush_msec + 1000; i++)
+    {
+        if (!hostfs->flusher_running)
+            break;
+
+        myst_sleep_msec(1);
+    }
+
+    for (size_t i = 0; i < hostfs->manifest_size; i++)
+        free(hostfs->manifest[i].path);
+
+    free(hostfs->manifest);
+
     memset(hostfs, 0xdd, sizeof(hostfs_t));
     free(hostfs);
 
@@ -158,6 +1566,7 @@ static int _fs_open(
     myst_file_t* file = NULL;
     char path[PATH_MAX];
     long tret;
+    bool maybe_link = false;
 
     if (!_hostfs_valid(hostfs) || !pathname || !file_out)
         ERAISE(-EINVAL);
@@ -169,6 +1578,21 @@ static int _fs_open(
 
     ECHECK(_to_host_path(hostfs, path, sizeof(path), pathname));
 
+    /* O_CREAT without O_EXCL creates the target of a dangling link */
+    if ((flags & O_CREAT) && !(flags & O_EXCL) && _cache_enabled(hostfs))
+    {
+        struct stat statbuf;
+        int r;
+
+        maybe_link = !_cache_get_stat(hostfs, pathname, true, &statbuf, &r) ||
+                     (r == 0 && S_ISLNK(statbuf.st_mode)) ||
+                     (r != 0 && r != -ENOENT);
+    }
+
+    /* pending writes must not land after the truncation */
+    if (flags & O_TRUNC)
+        _flush_dirty(hostfs);
+
     long params[6] = {(long)path, flags, mode};
     ECHECK((tret = myst_tcall(SYS_open, params)));
 
@@ -177,6 +1601,16 @@ static int _fs_open(
 
     file->magic = FILE_MAGIC;
     file->fd = (int)tret;
+    file->flags = flags;
+
+    if (flags & O_TRUNC)
+        _expire_read_ahead(hostfs, NULL);
+
+    if (flags & O_CREAT)
+        _cache_drop(hostfs, pathname, true, maybe_link);
+
+    if (flags & O_TRUNC)
+        _cache_drop_file(hostfs, file);
 
     *file_out = file;
     file = NULL;
@@ -211,16 +1645,45 @@ static off_t _fs_lseek(
     hostfs_t* hostfs = (hostfs_t*)fs;
     off_t ret = 0;
     off_t tret;
+    bool locked = false;
 
     if (!_hostfs_valid(hostfs) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    myst_mutex_lock(&file->lock);
+    locked = true;
+
+    /* the buffer goes, so the host offset is the file offset */
+    ECHECK(_flush_file(hostfs, file));
+    ECHECK(_drop_read_ahead(file));
+
+    /* a snapshot is positioned without the host (except to rewind it) */
+    if (file->dir && !(whence == SEEK_SET && offset == 0))
+    {
+        ret = _seek_dir(file, offset, whence);
+        goto done;
+    }
+
     long params[6] = {file->fd, offset, whence};
     ECHECK((tret = myst_tcall(SYS_lseek, params)));
 
+    /* rewinding takes the snapshot anew (with any changes since) */
+    if (file->dir)
+    {
+        _release_dir(file->dir);
+        file->dir = NULL;
+    }
+
+    /* getdents64() takes snapshots from the start of directories only */
+    file->dir_host = (tret != 0);
+
     ret = tret;
 
 done:
+
+    if (locked)
+        myst_mutex_unlock(&file->lock);
+
     return ret;
 }
 
@@ -232,7 +1695,7 @@ static ssize_t _fs_read(
 {
     hostfs_t* hostfs = (hostfs_t*)fs;
     ssize_t ret = 0;
-    long tret;
+    bool locked = false;
 
     if (!_hostfs_valid(hostfs) || !_file_valid(file))
         ERAISE(-EINVAL);
@@ -240,12 +1703,21 @@ static ssize_t _fs_read(
     if (!buf && count)
         ERAISE(-EINVAL);
 
-    long params[6] = {file->fd, (long)buf, count};
-    ECHECK((tret = myst_tcall(SYS_read, params)));
+    _flush_dirty(hostfs);
 
-    ret = tret;
+    myst_mutex_lock(&file->lock);
+    locked = true;
+
+    if ((file->flags & O_ACCMODE) != O_WRONLY && _buffered(hostfs, file))
+        ECHECK(ret = _buffered_read(hostfs, file, buf, count));
+    else
+        ECHECK(ret = _host_io(file, false, buf, count));
 
 done:
+
+    if (locked)
+        myst_mutex_unlock(&file->lock);
+
     return ret;
 }
 
@@ -257,7 +1729,7 @@ static ssize_t _fs_write(
 {
     hostfs_t* hostfs = (hostfs_t*)fs;
     ssize_t ret = 0;
-    long tret;
+    bool locked = false;
 
     if (!_hostfs_valid(hostfs) || !_file_valid(file))
         ERAISE(-EINVAL);
@@ -265,12 +1737,27 @@ static ssize_t _fs_write(
     if (!buf && count)
         ERAISE(-EINVAL);
 
-    long params[6] = {file->fd, (long)buf, count};
-    ECHECK((tret = myst_tcall(SYS_write, params)));
+    myst_mutex_lock(&file->lock);
+    locked = true;
 
-    ret = tret;
+    if ((file->flags & O_ACCMODE) != O_RDONLY && _buffered(hostfs, file))
+    {
+        ECHECK(ret = _buffered_write(hostfs, file, buf, count));
+    }
+    else
+    {
+        _flush_dirty(hostfs);
+        ECHECK(ret = _host_io(file, true, (void*)buf, count));
+        _expire_read_ahead(hostfs, file);
+    }
+
+    _cache_drop_file(hostfs, file);
 
 done:
+
+    if (locked)
+        myst_mutex_unlock(&file->lock);
+
     return ret;
 }
 
@@ -291,6 +1778,14 @@ static ssize_t _fs_pread(
     if (!buf && count)
         ERAISE(-EINVAL);
 
+    _flush_dirty(hostfs);
+
+    if (_large_io(file, false, count))
+    {
+        ECHECK(ret = _parallel_io(file->fd, false, buf, count, offset));
+        goto done;
+    }
+
     long params[6] = {file->fd, (long)buf, count, offset};
     ECHECK((tret = myst_tcall(SYS_pread64, params)));
 
@@ -317,8 +1812,21 @@ static ssize_t _fs_pwrite(
     if (!buf && count)
         ERAISE(-EINVAL);
 
-    long params[6] = {file->fd, (long)buf, count, offset};
-    ECHECK((tret = myst_tcall(SYS_pwrite64, params)));
+    _flush_dirty(hostfs);
+
+    if (_large_io(file, true, count))
+    {
+        void* p = (void*)buf;
+        ECHECK(tret = _parallel_io(file->fd, true, p, count, offset));
+    }
+    else
+    {
+        long params[6] = {file->fd, (long)buf, count, offset};
+        ECHECK((tret = myst_tcall(SYS_pwrite64, params)));
+    }
+
+    _expire_read_ahead(hostfs, file);
+    _cache_drop_file(hostfs, file);
 
     ret = tret;
 
@@ -370,19 +1878,33 @@ static int _fs_close(myst_fs_t* fs, myst_file_t* file)
     hostfs_t* hostfs = (hostfs_t*)fs;
     long tret;
 
+    int werr;
+
     if (!_hostfs_valid(hostfs) || !_file_valid(file))
         ERAISE(-EINVAL);
 
-    long params[6] = {file->fd};
-    ECHECK((tret = myst_tcall(SYS_close, params)));
+    /* write what is pending (reporting the first deferred error) */
+    myst_mutex_lock(&file->lock);
+    werr = _flush_file(hostfs, file);
+
+    if (file->werr)
+        werr = file->werr;
+
+    myst_mutex_unlock(&file->lock);
+
+    /* the host close may be deferred (see --async-close) */
+    ECHECK((tret = myst_host_close(file->fd)));
 
     if (tret != 0)
         ERAISE(-EINVAL);
 
+    _release_dir(file->dir);
+    free(file->buf);
+
     memset(file, 0xdd, sizeof(myst_file_t));
     free(file);
 
-    ret = tret;
+    ret = werr ? werr : tret;
 
 done:
     return ret;
@@ -394,14 +1916,25 @@ static int _fs_access(myst_fs_t* fs, const char* pathname, int mode)
     hostfs_t* hostfs = (hostfs_t*)fs;
     long tret;
     char path[PATH_MAX];
+    uint64_t gen;
+    int r;
 
     if (!_hostfs_valid(hostfs) || !pathname)
         ERAISE(-EINVAL);
 
+    if (_cache_get_access(hostfs, pathname, mode, &r))
+    {
+        ECHECK(r);
+        goto done;
+    }
+
     ECHECK(_to_host_path(hostfs, path, sizeof(path), pathname));
 
+    gen = _cache_gen(hostfs);
     long params[6] = {(long)path, mode};
-    ECHECK((tret = myst_tcall(SYS_access, params)));
+    tret = myst_tcall(SYS_access, params);
+    _cache_put_access(hostfs, gen, pathname, mode, (int)tret);
+    ECHECK(tret);
 
     if (tret != 0)
         ERAISE(-EINVAL);
@@ -419,6 +1952,8 @@ static int _fs_stat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     hostfs_t* hostfs = (hostfs_t*)fs;
     long tret;
     char path[PATH_MAX];
+    uint64_t gen;
+    int r;
 
     // ATTN: special handling needed for symbolic links. Check to see if it
     // is a link, and if so, use readlink to get the name of the file.
@@ -426,10 +1961,21 @@ static int _fs_stat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     if (!_hostfs_valid(hostfs) || !pathname || !statbuf)
         ERAISE(-EINVAL);
 
+    if (_cache_get_stat(hostfs, pathname, false, statbuf, &r))
+    {
+        ECHECK(r);
+        goto done;
+    }
+
     ECHECK(_to_host_path(hostfs, path, sizeof(path), pathname));
 
+    _flush_dirty(hostfs);
+
+    gen = _cache_gen(hostfs);
     long params[6] = {(long)path, (long)statbuf};
-    ECHECK((tret = myst_tcall(SYS_stat, params)));
+    tret = myst_tcall(SYS_stat, params);
+    _cache_put_stat(hostfs, gen, pathname, false, statbuf, (int)tret);
+    ECHECK(tret);
 
     if (tret != 0)
         ERAISE(-EINVAL);
@@ -446,14 +1992,27 @@ static int _fs_lstat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     hostfs_t* hostfs = (hostfs_t*)fs;
     long tret;
     char path[PATH_MAX];
+    uint64_t gen;
+    int r;
 
     if (!_hostfs_valid(hostfs) || !pathname || !statbuf)
         ERAISE(-EINVAL);
 
+    if (_cache_get_stat(hostfs, pathname, true, statbuf, &r))
+    {
+        ECHECK(r);
+        goto done;
+    }
+
     ECHECK(_to_host_path(hostfs, path, sizeof(path), pathname));
 
+    _flush_dirty(hostfs);
+
+    gen = _cache_gen(hostfs);
     long params[6] = {(long)path, (long)statbuf};
-    ECHECK((tret = myst_tcall(SYS_lstat, params)));
+    tret = myst_tcall(SYS_lstat, params);
+    _cache_put_stat(hostfs, gen, pathname, true, statbuf, (int)tret);
+    ECHECK(tret);
 
     if (tret != 0)
         ERAISE(-EINVAL);
@@ -473,6 +2032,8 @@ static int _fs_fstat(myst_fs_t* fs, myst_file_t* file, struct stat* statbuf)
     if (!_hostfs_valid(hostfs) || !_file_valid(file) || !statbuf)
         ERAISE(-EINVAL);
 
+    _flush_dirty(hostfs);
+
     long params[6] = {file->fd, (long)statbuf};
     ECHECK((tret = myst_tcall(SYS_fstat, params)));
 
@@ -505,6 +2066,22 @@ static int _fs_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
     if (tret != 0)
         ERAISE(-EINVAL);
 
+    /* the link count of the inode changed under all of its names */
+    if (_cache_enabled(hostfs))
+    {
+        struct stat statbuf;
+
+        if (_cache_lookup_ino(hostfs, opath, oldpath, false, &statbuf) == 0)
+        {
+            _cache_drop_ino(hostfs, &statbuf);
+            _cache_drop(hostfs, newpath, true, S_ISLNK(statbuf.st_mode));
+        }
+        else
+        {
+            _cache_flush(hostfs);
+        }
+    }
+
     ret = tret;
 
 done:
@@ -518,17 +2095,25 @@ static int _fs_unlink(myst_fs_t* fs, const char* pathname)
     long tret;
     char path[PATH_MAX];
 
+    struct stat statbuf;
+    bool known = false;
+
     if (!_hostfs_valid(hostfs) || !pathname)
         ERAISE(-EINVAL);
 
     ECHECK(_to_host_path(hostfs, path, sizeof(path), pathname));
 
+    if (_cache_enabled(hostfs))
+        known = _cache_lookup_ino(hostfs, path, pathname, false, &statbuf) == 0;
+
     long params[6] = {(long)path};
     ECHECK((tret = myst_tcall(SYS_unlink, params)));
 
     if (tret != 0)
         ERAISE(-EINVAL);
 
+    _cache_removed(hostfs, pathname, known ? &statbuf : NULL);
+
     ret = tret;
 
 done:
@@ -555,6 +2140,9 @@ static int _fs_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
     if (tret != 0)
         ERAISE(-EINVAL);
 
+    /* paths below a renamed directory are not tracked */
+    _cache_flush(hostfs);
+
     ret = tret;
 
 done:
@@ -573,12 +2161,26 @@ static int _fs_truncate(myst_fs_t* fs, const char* path, off_t length)
 
     ECHECK(_to_host_path(hostfs, hpath, sizeof(hpath), path));
 
+    _flush_dirty(hostfs);
+
     long params[6] = {(long)hpath, length};
     ECHECK((tret = myst_tcall(SYS_truncate, params)));
 
     if (tret != 0)
         ERAISE(-EINVAL);
 
+    _expire_read_ahead(hostfs, NULL);
+
+    if (_cache_enabled(hostfs))
+    {
+        struct stat statbuf;
+
+        if (_cache_lookup_ino(hostfs, hpath, path, true, &statbuf) == 0)
+            _cache_drop_ino(hostfs, &statbuf);
+        else
+            _cache_flush(hostfs);
+    }
+
     ret = tret;
 
 done:
@@ -594,12 +2196,18 @@ static int _fs_ftruncate(myst_fs_t* fs, myst_file_t* file, off_t length)
     if (!_hostfs_valid(hostfs) || !_file_valid(file) || length < 0)
         ERAISE(-EINVAL);
 
+    _flush_dirty(hostfs);
+
     long params[6] = {file->fd, length};
     ECHECK((tret = myst_tcall(SYS_ftruncate, params)));
 
     if (tret != 0)
         ERAISE(-EINVAL);
 
+    _expire_read_ahead(hostfs, file);
+
+    _cache_drop_file(hostfs, file);
+
     ret = tret;
 
 done:
@@ -624,6 +2232,8 @@ static int _fs_mkdir(myst_fs_t* fs, const char* pathname, mode_t mode)
     if (tret != 0)
         ERAISE(-EINVAL);
 
+    _cache_drop(hostfs, pathname, true, false);
+
     ret = tret;
 
 done:
@@ -637,17 +2247,25 @@ static int _fs_rmdir(myst_fs_t* fs, const char* pathname)
     long tret;
     char path[PATH_MAX];
 
+    struct stat statbuf;
+    bool known = false;
+
     if (!_hostfs_valid(hostfs) || !pathname)
         ERAISE(-EINVAL);
 
     ECHECK(_to_host_path(hostfs, path, sizeof(path), pathname));
 
+    if (_cache_enabled(hostfs))
+        known = _cache_lookup_ino(hostfs, path, pathname, false, &statbuf) == 0;
+
     long params[6] = {(long)path};
     ECHECK((tret = myst_tcall(SYS_rmdir, params)));
 
     if (tret != 0)
         ERAISE(-EINVAL);
 
+    _cache_removed(hostfs, pathname, known ? &statbuf : NULL);
+
     ret = tret;
 
 done:
@@ -670,6 +2288,36 @@ static int _fs_getdents64(
     if (count == 0)
         goto done;
 
+    if (!file->dir && !file->dir_host)
+        ECHECK(_acquire_dir(hostfs, file));
+
+    /* copy the whole records that fit */
+    if (file->dir)
+    {
+        const dir_snapshot_t* dir = file->dir;
+        const uint8_t* p = dir->data + file->dir_offset;
+        const size_t rem = dir->size - file->dir_offset;
+        size_t n = 0;
+
+        while (n < rem)
+        {
+            const size_t reclen = ((const struct dirent*)(p + n))->d_reclen;
+
+            if (n + reclen > count)
+                break;
+
+            n += reclen;
+        }
+
+        if (n == 0 && rem)
+            ERAISE(-EINVAL);
+
+        memcpy(dirp, p, n);
+        file->dir_offset += n;
+        ret = (int)n;
+        goto done;
+    }
+
     /* ATTN: check sizes of respective dirent structures */
 
     long params[6] = {file->fd, (long)dirp, count};
@@ -739,6 +2387,8 @@ static int _fs_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
     long params[6] = {(long)host_target, (long)host_linkpath};
     ECHECK((tret = myst_tcall(SYS_symlink, params)));
 
+    _cache_drop(hostfs, linkpath, true, true);
+
     ret = tret;
 
 done:
@@ -785,9 +2435,16 @@ static int _fs_fcntl(myst_fs_t* fs, myst_file_t* file, int cmd, long arg)
     if (!_hostfs_valid(hostfs) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    /* pending writes were made under the old flags */
+    if (cmd == F_SETFL)
+        _flush_dirty(hostfs);
+
     long params[6] = {file->fd, cmd, arg};
     ECHECK((tret = myst_tcall(SYS_fcntl, params)));
 
+    if (cmd == F_SETFL)
+        file->flags = (file->flags & ~O_APPEND) | (arg & O_APPEND);
+
     ret = tret;
 
 done:
@@ -831,15 +2488,33 @@ static int _fs_dup(
     if (!_hostfs_valid(hostfs) || !_file_valid(file) || !file_out)
         ERAISE(-EINVAL);
 
+    /* the copies share the host offset, so neither may buffer from now on
+     * (the original is this file system's own to change) */
+    {
+        myst_file_t* original = (myst_file_t*)file;
+
+        myst_mutex_lock(&original->lock);
+        ret = _unbuffer(hostfs, original);
+        myst_mutex_unlock(&original->lock);
+        ECHECK(ret);
+    }
+
     if (!(new_file = calloc(1, sizeof(myst_file_t))))
         ERAISE(-ENOMEM);
 
     *new_file = *file;
+    new_file->dir = NULL;
+    memset(&new_file->lock, 0, sizeof(new_file->lock));
+    new_file->werr = 0;
 
     long params[6] = {file->fd};
     ECHECK((tret = myst_tcall(SYS_dup, params)));
 
     new_file->fd = tret;
+
+    /* the copy reads the same snapshot (from its own offset) */
+    if ((new_file->dir = file->dir))
+        new_file->dir->refs++;
     ret = tret;
 
     *file_out = new_file;
@@ -856,6 +2531,43 @@ done:
     return ret;
 }
 
+static ssize_t _fs_host_sendfile(
+    myst_fs_t* fs,
+    myst_file_t* file,
+    int out_fd,
+    off_t* offset,
+    size_t count)
+{
+    hostfs_t* hostfs = (hostfs_t*)fs;
+    ssize_t ret = 0;
+    bool locked = false;
+
+    if (!_hostfs_valid(hostfs) || !_file_valid(file) || out_fd < 0)
+        ERAISE(-EINVAL);
+
+    /* the host must see the pending writes of other opens of the file */
+    _flush_dirty(hostfs);
+
+    myst_mutex_lock(&file->lock);
+    locked = true;
+
+    /* the buffer goes, so the host offset is the file offset */
+    ECHECK(_flush_file(hostfs, file));
+    ECHECK(_drop_read_ahead(file));
+
+    {
+        long params[6] = {out_fd, file->fd, (long)offset, (long)count};
+        ECHECK(ret = myst_tcall(SYS_sendfile, params));
+    }
+
+done:
+
+    if (locked)
+        myst_mutex_unlock(&file->lock);
+
+    return ret;
+}
+
 static int _fs_target_fd(myst_fs_t* fs, myst_file_t* file)
 {
     int ret = 0;
@@ -896,6 +2608,8 @@ static int _fs_statfs(myst_fs_t* fs, const char* pathname, struct statfs* buf)
 
     ECHECK(_to_host_path(hostfs, path, sizeof(path), pathname));
 
+    _flush_dirty(hostfs);
+
     long params[6] = {(long)path, (long)buf};
     ECHECK((tret = myst_tcall(SYS_statfs, params)));
 
@@ -917,6 +2631,8 @@ static int _fs_fstatfs(myst_fs_t* fs, myst_file_t* file, struct statfs* buf)
     if (!_hostfs_valid(hostfs) || !_file_valid(file) || !buf)
         ERAISE(-EINVAL);
 
+    _flush_dirty(hostfs);
+
     long params[6] = {file->fd, (long)buf};
     ECHECK((tret = myst_tcall(SYS_fstatfs, params)));
 
@@ -941,10 +2657,300 @@ static int _fs_futimens(
     if (!_hostfs_valid(hostfs) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    /* a later flush would set the modification time again */
+    _flush_dirty(hostfs);
+
     long params[6] = {(long)file->fd, (long)NULL, (long)times, 0};
     ECHECK((tret = myst_tcall(SYS_utimensat, params)));
+    _cache_drop_file(hostfs, file);
+    ret = tret;
+
+done:
+    return ret;
+}
+
+static int _fs_fsync(myst_fs_t* fs, myst_file_t* file)
+{
+    int ret = 0;
+    hostfs_t* hostfs = (hostfs_t*)fs;
+    bool locked = false;
+    long tret;
+
+    if (!_hostfs_valid(hostfs) || !_file_valid(file))
+        ERAISE(-EINVAL);
+
+    myst_mutex_lock(&file->lock);
+    locked = true;
+
+    ECHECK(_flush_file(hostfs, file));
+
+    if (file->werr)
+    {
+        ret = file->werr;
+        file->werr = 0;
+        ERAISE(ret);
+    }
+
+    long params[6] = {file->fd};
+    ECHECK((tret = myst_tcall(SYS_fsync, params)));
+
     ret = tret;
 
+done:
+
+    if (locked)
+        myst_mutex_unlock(&file->lock);
+
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** mmap() from host memory:
+**
+**     mmap() normally reads the mapped part of a file into enclave memory.
+**     A mount made with MYST_HOSTFS_MMAP_HOST holds public data (published
+**     model weights, static web content, time zone data) that needs no
+**     confidentiality, so its read-only shared mappings are host mappings
+**     of the host file instead, which cost no enclave memory at all.
+**     Private, writable and executable mappings are copied as before (code
+**     cannot run from host memory), and so are mappings that reach a page
+**     past the end of the file, which would fault on the host.
+**
+**     With a manifest, only the files that it lists are mapped this way,
+**     and the first mapping of each checks the SHA-256 of the whole host
+**     file. Since the pages stay in host memory, that check finds files
+**     that differed before they were mapped, not changes that the host
+**     makes to them later.
+**
+**==============================================================================
+*/
+
+static int _compare_entries(const void* a, const void* b)
+{
+    const manifest_entry_t* x = a;
+    const manifest_entry_t* y = b;
+    return strcmp(x->path, y->path);
+}
+
+static int _hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+/* Parse a line of sha256sum(1) output: the hash in hex, a space, a space or
+ * an asterisk (for binary mode) and the path */
+static int _parse_entry(char* line, manifest_entry_t* entry)
+{
+    int ret = 0;
+    const char* path = line + 2 * MYST_SHA256_SIZE + 2;
+    size_t size;
+
+    if (strlen(line) <= 2 * MYST_SHA256_SIZE + 2)
+        ERAISE(-EINVAL);
+
+    for (size_t i = 0; i < MYST_SHA256_SIZE; i++)
+    {
+        int hi = _hex_digit(line[2 * i]);
+        int lo = _hex_digit(line[2 * i + 1]);
+
+        if (hi < 0 || lo < 0)
+            ERAISE(-EINVAL);
+
+        entry->hash.data[i] = (uint8_t)(hi << 4 | lo);
+    }
+
+    if (line[2 * MYST_SHA256_SIZE] != ' ')
+        ERAISE(-EINVAL);
+
+    if (line[2 * MYST_SHA256_SIZE + 1] != ' ' &&
+        line[2 * MYST_SHA256_SIZE + 1] != '*')
+    {
+        ERAISE(-EINVAL);
+    }
+
+    /* as with the file's realpath, the path starts with one slash */
+    if (strncmp(path, "./", 2) == 0)
+        path++;
+
+    while (path[0] == '/' && path[1] == '/')
+        path++;
+
+    size = strlen(path) + 2;
+
+    if (!(entry->path = malloc(size)))
+        ERAISE(-ENOMEM);
+
+    snprintf(entry->path, size, "%s%s", path[0] == '/' ? "" : "/", path);
+
+done:
+    return ret;
+}
+
+static int _load_manifest(hostfs_t* hostfs, const char* path)
+{
+    int ret = 0;
+    char* data = NULL;
+    size_t size;
+    size_t n = 0;
+    char* line;
+    char* next;
+
+    ECHECK(myst_load_file(path, (void**)&data, &size));
+
+    for (size_t i = 0; i < size; i++)
+        n += (data[i] == '\n');
+
+    if (!(hostfs->manifest = calloc(n + 1, sizeof(manifest_entry_t))))
+        ERAISE(-ENOMEM);
+
+    for (line = data; line && *line; line = next)
+    {
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+
+        if (!*line)
+            continue;
+
+        ECHECK(_parse_entry(line, &hostfs->manifest[hostfs->manifest_size]));
+        hostfs->manifest_size++;
+    }
+
+    qsort(
+        hostfs->manifest,
+        hostfs->manifest_size,
+        sizeof(manifest_entry_t),
+        _compare_entries);
+
+done:
+    free(data);
+    return ret;
+}
+
+/* Check the whole host file against its manifest entry (once) */
+static int _verify_file(hostfs_t* hostfs, myst_file_t* file, size_t size)
+{
+    int ret = 0;
+    manifest_entry_t key = {.path = file->realpath};
+    manifest_entry_t* entry;
+    void* addr = NULL;
+    size_t length = 0;
+    myst_sha256_t hash;
+
+    if (!(entry = bsearch(
+              &key,
+              hostfs->manifest,
+              hostfs->manifest_size,
+              sizeof(manifest_entry_t),
+              _compare_entries)))
+    {
+        ERAISE_QUIET(-ENOTSUP);
+    }
+
+    if (entry->verified)
+        goto done;
+
+    ECHECK(myst_round_up(size, PAGE_SIZE, &length));
+    ECHECK(myst_tcall_map_host_file(file->fd, 0, length, &addr));
+    ECHECK(myst_sha256(&hash, addr, size));
+
+    if (memcmp(&hash, &entry->hash, sizeof(hash)) != 0)
+        ERAISE(-EIO);
+
+    entry->verified = true;
+
+done:
+
+    if (addr)
+        myst_tcall_unmap_host_file(addr, length);
+
+    return ret;
+}
+
+int myst_hostfs_set_mmap(
+    myst_fs_t* fs,
+    myst_hostfs_mmap_t mode,
+    const char* manifest)
+{
+    int ret = 0;
+    hostfs_t* hostfs = (hostfs_t*)fs;
+
+    if (!_hostfs_valid(hostfs))
+        ERAISE(-EINVAL);
+
+    if (mode != MYST_HOSTFS_MMAP_COPY && mode != MYST_HOSTFS_MMAP_HOST)
+        ERAISE(-EINVAL);
+
+    /* only the files mapped from host memory are checked */
+    if (manifest && mode != MYST_HOSTFS_MMAP_HOST)
+        ERAISE(-EINVAL);
+
+    if (hostfs->manifest)
+        ERAISE(-EBUSY);
+
+    if (manifest)
+        ECHECK(_load_manifest(hostfs, manifest));
+
+    hostfs->mmap_mode = mode;
+
+done:
+    return ret;
+}
+
+int myst_hostfs_map(
+    myst_fs_t* fs,
+    myst_file_t* file,
+    off_t offset,
+    size_t length,
+    void** addr_out)
+{
+    int ret = 0;
+    hostfs_t* hostfs = (hostfs_t*)fs;
+    struct stat statbuf;
+    size_t size;
+
+    if (addr_out)
+        *addr_out = NULL;
+
+    /* fs may be a file system of another type */
+    if (!fs || fs->fs_release != _fs_release)
+        return -ENOTSUP;
+
+    if (!_hostfs_valid(hostfs) || !_file_valid(file) || !addr_out)
+        ERAISE(-EINVAL);
+
+    if (hostfs->mmap_mode != MYST_HOSTFS_MMAP_HOST)
+        ERAISE_QUIET(-ENOTSUP);
+
+    if (offset < 0 || offset % PAGE_SIZE || !length)
+        ERAISE(-EINVAL);
+
+    /* this writes back any buffered writes too */
+    ECHECK(_fs_fstat(fs, file, &statbuf));
+    ECHECK(myst_round_up((size_t)statbuf.st_size, PAGE_SIZE, &size));
+
+    if ((size_t)offset > size || length > size - (size_t)offset)
+        ERAISE_QUIET(-ENOTSUP);
+
+    /* the files that the manifest does not list are copied */
+    if (hostfs->manifest &&
+        (ret = _verify_file(hostfs, file, (size_t)statbuf.st_size)) != 0)
+    {
+        goto done;
+    }
+
+    ECHECK(myst_tcall_map_host_file(file->fd, offset, length, addr_out));
+
 done:
     return ret;
 }
@@ -1004,6 +3010,8 @@ int myst_init_hostfs(myst_fs_t** fs_out)
         .fs_statfs = _fs_statfs,
         .fs_fstatfs = _fs_fstatfs,
         .fs_futimens = _fs_futimens,
+        .fs_fsync = _fs_fsync,
+        .fs_host_sendfile = _fs_host_sendfile,
     };
     // clang-format on
 
@@ -1031,4 +3039,82 @@ done:
     return ret;
 }
 
+int myst_hostfs_set_cache(
+    myst_fs_t* fs,
+    myst_hostfs_cache_t mode,
+    uint64_t ttl_msec)
+{
+    int ret = 0;
+    hostfs_t* hostfs = (hostfs_t*)fs;
+
+    if (!_hostfs_valid(hostfs))
+        ERAISE(-EINVAL);
+
+    if (mode != MYST_HOSTFS_CACHE_NONE && mode != MYST_HOSTFS_CACHE_TTL &&
+        mode != MYST_HOSTFS_CACHE_EXCLUSIVE)
+    {
+        ERAISE(-EINVAL);
+    }
+
+    /* a day at most */
+    if (ttl_msec > 24 * 60 * 60 * 1000)
+        ERAISE(-EINVAL);
+
+    if (ttl_msec == 0)
+        ttl_msec = MYST_HOSTFS_DEFAULT_CACHE_TTL_MSEC;
+
+    myst_mutex_lock(&hostfs->cache.lock);
+    _flush(&hostfs->cache);
+    hostfs->cache.mode = mode;
+    hostfs->cache.ttl = (long)ttl_msec;
+    myst_mutex_unlock(&hostfs->cache.lock);
+
+done:
+    return ret;
+}
+
+int myst_hostfs_set_buffering(
+    myst_fs_t* fs,
+    size_t buffer_size,
+    uint64_t flush_msec)
+{
+    int ret = 0;
+    hostfs_t* hostfs = (hostfs_t*)fs;
+
+    if (!_hostfs_valid(hostfs))
+        ERAISE(-EINVAL);
+
+    /* the files opened so far have no buffers */
+    if (hostfs->io_buffer_size || hostfs->flusher_running)
+        ERAISE(-EBUSY);
+
+    if (buffer_size > MYST_HOSTFS_MAX_IO_BUFFER_SIZE)
+        ERAISE(-EINVAL);
+
+    /* a day at most */
+    if (flush_msec > 24 * 60 * 60 * 1000)
+        ERAISE(-EINVAL);
+
+    if (buffer_size == 0)
+        goto done;
+
+    hostfs->io_buffer_size = buffer_size;
+    hostfs->flush_msec = flush_msec;
+
+    if (flush_msec)
+    {
+        hostfs->flusher_running = true;
+
+        if (myst_create_kernel_thread(_flusher, hostfs, "hostfs") != 0)
+        {
+            hostfs->flusher_running = false;
+            hostfs->io_buffer_size = 0;
+            ERAISE(-EAGAIN);
+        }
+    }
+
+done:
+    return ret;
+}
+
 #endif /* MYST_ENABLE_HOSTFS */
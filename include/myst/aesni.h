@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_AESNI_H
+#define _MYST_AESNI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define MYST_AESNI_BLOCK_SIZE 16
+
+#define MYST_AESNI_GCM_IV_SIZE 12
+
+/* The round keys of an AES-128 or AES-256 key (for both directions) */
+typedef struct myst_aesni_key
+{
+    uint8_t enc[15][MYST_AESNI_BLOCK_SIZE] __attribute__((aligned(16)));
+    uint8_t dec[15][MYST_AESNI_BLOCK_SIZE] __attribute__((aligned(16)));
+    uint32_t rounds;
+} myst_aesni_key_t;
+
+/* The AES key of GCM and the first powers of its hash key (H, H^2, H^3 and
+ * H^4, byte-reflected) */
+typedef struct myst_aesni_gcm_key
+{
+    myst_aesni_key_t aes;
+    uint8_t h[4][MYST_AESNI_BLOCK_SIZE] __attribute__((aligned(16)));
+} myst_aesni_gcm_key_t;
+
+/* Whether the CPU has the AES instructions (checked once) */
+bool myst_aesni_supported(void);
+
+/* Whether the CPU also has VAES with AVX-512 (which the functions below use
+ * on their own whenever it is there) */
+bool myst_aesni_vaes_supported(void);
+
+/* Whether the CPU also has PCLMULQDQ and PSHUFB (which GCM needs) */
+bool myst_aesni_gcm_supported(void);
+
+/* Expand a 16-byte or 32-byte key */
+int myst_aesni_setkey(myst_aesni_key_t* key, const void* data, size_t size);
+
+void myst_aesni_ecb(
+    const myst_aesni_key_t* key,
+    bool encrypt,
+    const void* in,
+    void* out,
+    size_t nblocks);
+
+void myst_aesni_cbc(
+    const myst_aesni_key_t* key,
+    bool encrypt,
+    const uint8_t iv[MYST_AESNI_BLOCK_SIZE],
+    const void* in,
+    void* out,
+    size_t nblocks);
+
+/* Encrypt or decrypt one XTS data unit (whose tweak is the encrypted iv) */
+void myst_aesni_xts(
+    const myst_aesni_key_t* key,
+    const myst_aesni_key_t* tweak_key,
+    bool encrypt,
+    const uint8_t iv[MYST_AESNI_BLOCK_SIZE],
+    const void* in,
+    void* out,
+    size_t nblocks);
+
+/* Expand a 16-byte or 32-byte GCM key */
+int myst_aesni_gcm_setkey(
+    myst_aesni_gcm_key_t* key,
+    const void* data,
+    size_t size);
+
+/* Encrypt or decrypt the bytes of in with GCM to out (which may be in) and
+ * compute the tag, which the caller compares after a decryption; each byte
+ * of in is read once and out is only written */
+void myst_aesni_gcm(
+    const myst_aesni_gcm_key_t* key,
+    bool encrypt,
+    const uint8_t iv[MYST_AESNI_GCM_IV_SIZE],
+    const void* aad,
+    size_t aad_size,
+    const struct iovec* in,
+    int iovcnt,
+    void* out,
+    uint8_t tag[MYST_AESNI_BLOCK_SIZE]);
+
+#endif /* _MYST_AESNI_H */
@@ -0,0 +1,109 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_AFFINITY_H
+#define _MYST_AFFINITY_H
+
+#include <myst/buf.h>
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** CPU affinity.
+**
+**     The online CPUs are the ones the host lets the first thread run on.
+**     Each thread keeps its own mask (empty until set, which means all the
+**     online CPUs), which children inherit. A thread applies a mask to the
+**     host thread that runs it; a mask set by another thread is applied by
+**     the thread itself on its next syscall, since the kernel does not know
+**     the host thread ids.
+**
+**==============================================================================
+*/
+
+/* The size of cpu_set_t (as in musl and glibc) */
+#define MYST_MAX_CPUS 1024
+
+typedef struct myst_cpuset
+{
+    uint64_t bits[MYST_MAX_CPUS / 64];
+} myst_cpuset_t;
+
+struct myst_thread;
+
+/* Ask the host for the online CPUs (falls back to CPU 0 alone) */
+int myst_affinity_init(void);
+
+/* The number of online CPUs */
+size_t myst_get_num_cpus(void);
+
+long myst_syscall_sched_setaffinity(
+    pid_t pid,
+    size_t cpusetsize,
+    const void* mask);
+
+long myst_syscall_sched_getaffinity(pid_t pid, size_t cpusetsize, void* mask);
+
+/* The lowest CPU that the thread may run on (for getcpu()) */
+unsigned int myst_affinity_first_cpu(struct myst_thread* thread);
+
+/* Apply a mask that another thread set for this one */
+void myst_affinity_apply_pending(struct myst_thread* thread);
+
+/* Give a new thread the mask of its parent (which its host thread may not
+ * have, since the host reuses threads) */
+void myst_affinity_inherit(
+    struct myst_thread* child,
+    struct myst_thread* parent);
+
+/* Format /proc/cpuinfo (one entry per online CPU) */
+int myst_format_cpuinfo(myst_buf_t* buf);
+
+/* Format the online CPUs as a list of ranges, such as "0-3,8" */
+int myst_format_cpu_list(myst_buf_t* buf);
+
+/*
+**==============================================================================
+**
+** Memory policy.
+**
+**     The kernel memory is one region that the host (or the SGX driver)
+**     placed, so it is a single node here: the policies are checked and
+**     reported back, but they do not move memory. With --numa the host
+**     spreads its threads and the pages of the region over the nodes.
+**
+**==============================================================================
+*/
+
+#define MYST_MPOL_DEFAULT 0
+#define MYST_MPOL_PREFERRED 1
+#define MYST_MPOL_BIND 2
+#define MYST_MPOL_INTERLEAVE 3
+#define MYST_MPOL_LOCAL 4
+
+#define MYST_MPOL_F_NODE (1 << 0)
+#define MYST_MPOL_F_ADDR (1 << 1)
+#define MYST_MPOL_F_MEMS_ALLOWED (1 << 2)
+
+long myst_syscall_get_mempolicy(
+    int* mode,
+    unsigned long* nodemask,
+    unsigned long maxnode,
+    void* addr,
+    unsigned long flags);
+
+long myst_syscall_set_mempolicy(
+    int mode,
+    const unsigned long* nodemask,
+    unsigned long maxnode);
+
+long myst_syscall_mbind(
+    void* addr,
+    unsigned long len,
+    int mode,
+    const unsigned long* nodemask,
+    unsigned long maxnode,
+    unsigned int flags);
+
+#endif /* _MYST_AFFINITY_H */
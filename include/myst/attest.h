@@ -0,0 +1,96 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_ATTEST_H
+#define _MYST_ATTEST_H
+
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** Attestation evidence cache (see --attestation-cache-ttl).
+**
+**     These take the arguments of SYS_myst_oe_get_report_v2,
+**     SYS_myst_oe_generate_attestation_certificate and SYS_myst_gen_creds
+**     and return what the target returns. With a TTL, the evidence for the
+**     same inputs is generated once and returned as a copy until it expires,
+**     and evidence still in use is generated again before then. The seal
+**     keys of SYS_myst_oe_get_seal_key_by_policy_v2 and
+**     SYS_myst_oe_get_seal_key_v2 are derived once in any case. The free
+**     functions take both copies and buffers of the target.
+**
+**==============================================================================
+*/
+
+typedef struct myst_oe_report_args
+{
+    uint32_t flags;
+    const uint8_t* report_data;
+    size_t report_data_size;
+    const void* opt_params;
+    size_t opt_params_size;
+    uint8_t** report_buffer;
+    size_t* report_buffer_size;
+} myst_oe_report_args_t;
+
+typedef struct myst_oe_cert_args
+{
+    const unsigned char* subject_name;
+    const uint8_t* private_key;
+    size_t private_key_size;
+    const uint8_t* public_key;
+    size_t public_key_size;
+    uint8_t** output_cert;
+    size_t* output_cert_size;
+} myst_oe_cert_args_t;
+
+/* Set the lifetime of the cached evidence (zero disables the cache) */
+void myst_attest_cache_init(uint64_t ttl_sec);
+
+/* Stop the refresh thread, release the cached evidence and zero the keys */
+void myst_attest_cache_stop(void);
+
+long myst_attest_get_report(const myst_oe_report_args_t* args);
+
+void myst_attest_free_report(uint8_t* report_buffer);
+
+long myst_attest_generate_certificate(const myst_oe_cert_args_t* args);
+
+void myst_attest_free_certificate(uint8_t* cert);
+
+/* Programs free the certificates of myst_gen_creds() with oe_free_key() */
+void myst_attest_free_key(
+    uint8_t* key,
+    size_t key_size,
+    uint8_t* key_info,
+    size_t key_info_size);
+
+long myst_attest_get_seal_key_by_policy(
+    uint64_t policy,
+    uint8_t** key_buffer,
+    size_t* key_buffer_size,
+    uint8_t** key_info,
+    size_t* key_info_size);
+
+long myst_attest_get_seal_key(
+    const uint8_t* key_info,
+    size_t key_info_size,
+    uint8_t** key_buffer,
+    size_t* key_buffer_size);
+
+void myst_attest_free_seal_key(uint8_t* key_buffer, uint8_t* key_info);
+
+long myst_attest_gen_creds(
+    uint8_t** cert,
+    size_t* cert_size,
+    uint8_t** private_key,
+    size_t* private_key_size);
+
+void myst_attest_free_creds(
+    uint8_t* cert,
+    size_t cert_size,
+    uint8_t* private_key,
+    size_t private_key_size);
+
+#endif /* _MYST_ATTEST_H */
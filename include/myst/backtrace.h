@@ -8,6 +8,12 @@
 
 size_t myst_backtrace(void** buffer, size_t size);
 
+/* The return addresses of the frames from START_FRAME upwards */
+size_t myst_backtrace_impl(void** start_frame, void** buffer, size_t size);
+
 void myst_dump_backtrace(void** buffer, size_t size);
 
+/* The kernel function that contains ADDR, and the offset of ADDR in it */
+int myst_backtrace_symbol(const void* addr, const char** name, size_t* offset);
+
 #endif /* _MYST_BACKTRACE_H */
@@ -4,12 +4,15 @@
 #ifndef _MYST_BLKDEV_H
 #define _MYST_BLKDEV_H
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/stat.h>
 
+#include <myst/defs.h>
+
 #define MYST_BLKSIZE 512
 
 typedef struct myst_blkdev myst_blkdev_t;
@@ -21,11 +24,66 @@ struct myst_blkdev
     int (*get)(myst_blkdev_t* dev, uint64_t blkno, void* data);
 
     int (*put)(myst_blkdev_t* dev, uint64_t blkno, const void* data);
+
+    /* Transfer n consecutive blocks starting at blkno in one request.
+     * Optional: devices without these are used one block at a time (see
+     * myst_blkdev_get_n() and myst_blkdev_put_n()). */
+    int (*get_n)(myst_blkdev_t* dev, uint64_t blkno, size_t n, void* data);
+
+    int (*put_n)(
+        myst_blkdev_t* dev,
+        uint64_t blkno,
+        size_t n,
+        const void* data);
 };
 
+MYST_INLINE int myst_blkdev_get_n(
+    myst_blkdev_t* dev,
+    uint64_t blkno,
+    size_t n,
+    void* data)
+{
+    int r;
+    uint8_t* p = (uint8_t*)data;
+
+    if (dev->get_n)
+        return (*dev->get_n)(dev, blkno, n, data);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if ((r = (*dev->get)(dev, blkno + i, p + i * MYST_BLKSIZE)))
+            return r;
+    }
+
+    return 0;
+}
+
+MYST_INLINE int myst_blkdev_put_n(
+    myst_blkdev_t* dev,
+    uint64_t blkno,
+    size_t n,
+    const void* data)
+{
+    int r;
+    const uint8_t* p = (const uint8_t*)data;
+
+    if (dev->put_n)
+        return (*dev->put_n)(dev, blkno, n, data);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if ((r = (*dev->put)(dev, blkno + i, p + i * MYST_BLKSIZE)))
+            return r;
+    }
+
+    return 0;
+}
+
+/* Open a raw image (a read-only device caches the blocks read, and rejects
+ * writes with -EROFS) */
 int myst_rawblkdev_open(
     const char* path,
-    bool ephemeral,
+    bool read_only,
     uint64_t blkno_offset, /* add to blkno to obtain the raw block number */
     myst_blkdev_t** dev);
 
@@ -42,6 +100,39 @@ int myst_verityblkdev_open(
     size_t hash_offset,
     const uint8_t* roothash,
     size_t roothash_size,
+    size_t cache_blocks,    /* verified blocks cached (zero for the default) */
+    size_t prefetch_blocks, /* blocks read ahead (zero for the default) */
     myst_blkdev_t** blkdev);
 
+/* Copy the hash tree nodes that the verity device has verified (and still
+ * keeps) to one new image, which the caller frees */
+int myst_verityblkdev_export_nodes(
+    myst_blkdev_t* blkdev,
+    void** data,
+    size_t* size);
+
+/* Take the nodes of an image of myst_verityblkdev_export_nodes() as verified,
+ * without hashing them. Nothing here checks them against the hash tree, so
+ * the caller must have authenticated the image (see kernel/fs.c). Fails with
+ * -EINVAL for the image of another tree. */
+int myst_verityblkdev_import_nodes(
+    myst_blkdev_t* blkdev,
+    const void* data,
+    size_t size);
+
+/* Open a compressed image (see myst/zimage.h) on the lower device, which is
+ * closed along with the new device */
+int myst_zblkdev_open(
+    myst_blkdev_t* lower,
+    size_t cache_chunks, /* chunks cached (zero for the default) */
+    myst_blkdev_t** blkdev);
+
+/* Return zero if the lower device holds a compressed image */
+int myst_zblkdev_check_header(myst_blkdev_t* lower);
+
+/* Open a writable overlay on the lower device, which is closed along with
+ * the new device: the blocks written are kept in memory and the others are
+ * read from the lower device (which is never written) */
+int myst_cowblkdev_open(myst_blkdev_t* lower, myst_blkdev_t** blkdev);
+
 #endif /* _MYST_BLKDEV_H */
@@ -8,17 +8,29 @@
 #include <stdint.h>
 
 // clang-format off
-#define MYST_BUF_INITIALIZER { NULL, 0, 0, 0 }
+#define MYST_BUF_INITIALIZER { NULL, 0, 0, 0, 0 }
 // clang-format on
 
+/* myst_buf_t.flags: the data is the caller's storage (not the heap) */
+#define MYST_BUF_STORAGE 1
+
+/* Capacities below this double; larger ones grow by half (in pages) */
+#define MYST_BUF_LARGE_SIZE (1024 * 1024)
+
 typedef struct myst_buf
 {
     uint8_t* data;
     size_t size;
     size_t cap;
     size_t offset;
+    uint32_t flags;
 } myst_buf_t;
 
+/* Start an empty buffer in the caller's storage (such as an array on the
+ * stack), which small contents never leave: a buffer that outgrows it moves
+ * to the heap, so it must still be released */
+void myst_buf_init_storage(myst_buf_t* buf, void* storage, size_t size);
+
 void myst_buf_release(myst_buf_t* buf);
 
 int myst_buf_clear(myst_buf_t* buf);
@@ -14,6 +14,9 @@ struct clock_ctrl
     volatile long now;
     unsigned long interval;
     volatile int done;
+
+    /* the host TSC at the last update of now (rdtsc traps in SGX1) */
+    volatile unsigned long tsc;
 };
 
 int myst_setup_clock(struct clock_ctrl*);
@@ -33,6 +33,9 @@ int myst_cond_signal(myst_cond_t* c);
 /* Wake up n waiters */
 int myst_cond_broadcast(myst_cond_t* c, size_t n);
 
+/* Wake up n waiters whose signal.futex_bitset intersects bitset */
+size_t myst_cond_wake_bitset(myst_cond_t* c, size_t n, uint32_t bitset);
+
 int myst_cond_requeue(
     myst_cond_t* c1,
     myst_cond_t* c2,
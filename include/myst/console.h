@@ -0,0 +1,42 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_CONSOLE_H
+#define _MYST_CONSOLE_H
+
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** The console buffer (see kernel/console.c).
+**
+**     Writes to the standard output and standard error TTYs collect in one
+**     kernel buffer, so that the target sees a single call per line (or per
+**     buffer) rather than one per write(). Both descriptors share the buffer
+**     so that their output reaches the host in the order it was written.
+**     The buffer is flushed according to the mode, when it fills, shortly
+**     after the first byte is buffered, before reading the console, on
+**     fsync() of a TTY and when the kernel exits.
+**
+**==============================================================================
+*/
+
+/* myst_kernel_args_t.console_buffering (zero is the default) */
+#define MYST_CONSOLE_LINE_BUFFERED 0 /* flush on newlines (for terminals) */
+#define MYST_CONSOLE_FULLY_BUFFERED 1 /* flush when full (for redirects) */
+#define MYST_CONSOLE_UNBUFFERED 2     /* one target call per write */
+
+/* The buffer size (writes at least this large bypass the buffer) */
+#define MYST_CONSOLE_BUFFER_SIZE 4096
+
+/* How long buffered output may wait for a flush (in nanoseconds) */
+#define MYST_CONSOLE_FLUSH_DELAY 10000000
+
+/* Write to a console descriptor (buffering standard output and error) */
+ssize_t myst_console_write(int fd, const void* buf, size_t count);
+
+/* Write out the buffered output */
+void myst_console_flush(void);
+
+#endif /* _MYST_CONSOLE_H */
@@ -0,0 +1,79 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_COUNTERS_H
+#define _MYST_COUNTERS_H
+
+#include <myst/buf.h>
+#include <myst/defs.h>
+#include <myst/fs.h>
+#include <myst/types.h>
+
+/* Events counted by the kernel (see /proc/myst/stats) */
+typedef enum myst_counter
+{
+    MYST_COUNTER_FUTEX_WAITS,
+    MYST_COUNTER_FUTEX_WAKES,
+    MYST_COUNTER_FUTEX_WOKEN, /* waiters woken by the wakes */
+    MYST_COUNTER_MMAPS,
+    MYST_COUNTER_MUNMAPS,
+    MYST_COUNTER_STACK_CACHE_HITS, /* mmaps served by the stack cache */
+    MYST_COUNTER_POLL_WAITS,
+    MYST_COUNTER_POLL_WAKEUPS, /* waits ended by an event (not a timeout) */
+    MYST_COUNTER_EPOLL_WAITS,
+    MYST_COUNTER_EPOLL_WAKEUPS,
+    MYST_NUM_COUNTERS,
+} myst_counter_t;
+
+/* Add N to the counter (a relaxed atomic add to one of a few copies) */
+void myst_counter_add(myst_counter_t counter, uint64_t n);
+
+MYST_INLINE void myst_counter_inc(myst_counter_t counter)
+{
+    myst_counter_add(counter, 1);
+}
+
+/* Count a tcall of NSEC nanoseconds (zero unless --syscall-stats is given) */
+void myst_counters_tcall(long n, uint64_t nsec);
+
+/* Report the buffer cache of this ext2 file system (the rootfs) */
+void myst_counters_set_ext2(myst_fs_t* fs);
+
+/*
+**==============================================================================
+**
+** The binary snapshot (/proc/myst/stats.bin): a header followed by count
+** records, each naming one value in the same way as /proc/myst/stats.
+**
+**==============================================================================
+*/
+
+#define MYST_STATS_MAGIC 0x544154535453594d /* "MYSTSTAT" */
+
+#define MYST_STATS_VERSION 1
+
+#define MYST_STATS_NAME_SIZE 56
+
+typedef struct myst_stats_header
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;
+
+    /* CLOCK_MONOTONIC when the snapshot was taken */
+    uint64_t nsec;
+} myst_stats_header_t;
+
+typedef struct myst_stats_record
+{
+    char name[MYST_STATS_NAME_SIZE];
+    uint64_t value;
+} myst_stats_record_t;
+
+/* Format the statistics as "name value" lines */
+int myst_format_stats(myst_buf_t* buf);
+
+/* Format the statistics as a binary snapshot */
+int myst_format_stats_binary(myst_buf_t* buf);
+
+#endif /* _MYST_COUNTERS_H */
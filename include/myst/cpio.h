@@ -67,6 +67,8 @@ typedef struct _myst_cpio_entry
 {
     size_t size;
     uint32_t mode;
+    uint32_t ino;   /* zero unless the data may be shared (see below) */
+    uint32_t nlink; /* zero is taken as one when writing */
     char name[MYST_CPIO_PATH_MAX];
 } myst_cpio_entry_t;
 
@@ -82,6 +84,19 @@ int myst_cpio_write_entry(myst_cpio_t* cpio, const myst_cpio_entry_t* entry);
 
 ssize_t myst_cpio_write_data(myst_cpio_t* cpio, const void* data, size_t size);
 
+/* The most bytes that myst_cpio_format_entry() writes */
+#define MYST_CPIO_ENTRY_MAX_SIZE (110 + MYST_CPIO_PATH_MAX + 3)
+
+/* The name of the entry that ends an archive */
+#define MYST_CPIO_TRAILER "TRAILER!!!"
+
+/* Format the header and the name of the entry (as myst_cpio_write_entry()
+ * writes them at a four-byte aligned offset) into buf; returns the size */
+ssize_t myst_cpio_format_entry(
+    const myst_cpio_entry_t* entry,
+    void* buf,
+    size_t size);
+
 int myst_cpio_pack(const char* source, const char* target);
 
 int myst_cpio_unpack(const char* source, const char* target);
@@ -104,6 +119,52 @@ int myst_cpio_mem_unpack(
     const char* target,
     myst_cpio_create_file_function_t create_file);
 
+/*
+**==============================================================================
+**
+** Shared file data:
+**
+**     myst_cpio_pack() stores the data of identical files once. The regular
+**     files with data are numbered from one (in the ino field) in archive
+**     order, and a later file with the same contents is written as a hard
+**     link: with the number of the first file, a link count of two and no
+**     data. Readers record the files with data (myst_cpio_files_add()) and
+**     look up the data of such links (myst_cpio_files_find()).
+**
+**==============================================================================
+*/
+
+typedef struct myst_cpio_file
+{
+    uint32_t ino;
+    size_t size;
+    size_t offset; /* the offset of the data in the archive */
+} myst_cpio_file_t;
+
+typedef struct myst_cpio_files
+{
+    myst_cpio_file_t* data;
+    size_t size;
+    size_t capacity;
+} myst_cpio_files_t;
+
+// clang-format off
+#define MYST_CPIO_FILES_INITIALIZER { NULL, 0, 0 }
+// clang-format on
+
+/* Record the data of a regular file (which is ignored if there is none) */
+int myst_cpio_files_add(
+    myst_cpio_files_t* files,
+    const myst_cpio_entry_t* entry,
+    size_t offset);
+
+/* Find the data of a hard link without data (or return NULL) */
+const myst_cpio_file_t* myst_cpio_files_find(
+    const myst_cpio_files_t* files,
+    const myst_cpio_entry_t* entry);
+
+void myst_cpio_files_release(myst_cpio_files_t* files);
+
 /* Test for CPIO magic string: "070701"; return 0 or ENOTSUP */
 int myst_cpio_test(const char* path);
 
@@ -0,0 +1,16 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_DRBG_H
+#define _MYST_DRBG_H
+
+#include <stddef.h>
+
+/* Gather size bytes of full entropy from the hardware or host (0: success) */
+typedef int (*myst_drbg_entropy_t)(void* data, size_t size);
+
+/* Fill data with random bytes from the calling thread's CTR_DRBG, which is
+ * seeded (and periodically reseeded) with the entropy function */
+int myst_drbg_generate(void* data, size_t size, myst_drbg_entropy_t entropy);
+
+#endif /* _MYST_DRBG_H */
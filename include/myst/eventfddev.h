@@ -0,0 +1,82 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_EVENTFDDEV_H
+#define _MYST_EVENTFDDEV_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <myst/fdops.h>
+
+typedef struct myst_eventfddev myst_eventfddev_t;
+
+typedef struct myst_eventfd myst_eventfd_t;
+
+struct myst_eventfddev
+{
+    myst_fdops_t fdops;
+
+    int (*ev_eventfd)(
+        myst_eventfddev_t* dev,
+        unsigned int initval,
+        int flags,
+        myst_eventfd_t** obj);
+
+    ssize_t (*ev_read)(
+        myst_eventfddev_t* dev,
+        myst_eventfd_t* obj,
+        void* buf,
+        size_t count);
+
+    ssize_t (*ev_write)(
+        myst_eventfddev_t* dev,
+        myst_eventfd_t* obj,
+        const void* buf,
+        size_t count);
+
+    ssize_t (*ev_readv)(
+        myst_eventfddev_t* dev,
+        myst_eventfd_t* obj,
+        const struct iovec* iov,
+        int iovcnt);
+
+    ssize_t (*ev_writev)(
+        myst_eventfddev_t* dev,
+        myst_eventfd_t* obj,
+        const struct iovec* iov,
+        int iovcnt);
+
+    int (*ev_fstat)(
+        myst_eventfddev_t* dev,
+        myst_eventfd_t* obj,
+        struct stat* statbuf);
+
+    int (*ev_fcntl)(
+        myst_eventfddev_t* dev,
+        myst_eventfd_t* obj,
+        int cmd,
+        long arg);
+
+    int (*ev_ioctl)(
+        myst_eventfddev_t* dev,
+        myst_eventfd_t* obj,
+        unsigned long request,
+        long arg);
+
+    int (*ev_dup)(
+        myst_eventfddev_t* dev,
+        const myst_eventfd_t* obj,
+        myst_eventfd_t** obj_out);
+
+    int (*ev_close)(myst_eventfddev_t* dev, myst_eventfd_t* obj);
+
+    int (*ev_target_fd)(myst_eventfddev_t* dev, myst_eventfd_t* obj);
+
+    int (*ev_get_events)(myst_eventfddev_t* dev, myst_eventfd_t* obj);
+};
+
+myst_eventfddev_t* myst_eventfddev_get(void);
+
+#endif /* _MYST_EVENTFDDEV_H */
@@ -0,0 +1,221 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_EVENTTRACE_H
+#define _MYST_EVENTTRACE_H
+
+#include <myst/buf.h>
+#include <myst/defs.h>
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** The event trace (--event-trace).
+**
+**     A binary record of kernel events, cheap enough to leave on under load
+**     (unlike --strace, which formats each syscall and writes it through the
+**     console). The host allocates the trace in its own memory and passes it
+**     to the kernel (through myst_shm for SGX, which accepts it only in
+**     debug mode). Each thread claims a ring of its own on its first event
+**     and is the only writer of that ring, so recording needs no lock: it
+**     fills the next slot and then publishes it by advancing the head. A
+**     full ring overwrites its oldest events. The ring of an exited thread
+**     is reused when no free ring is left (each event names its thread).
+**
+**     The categories to record come from --event-trace-categories and can
+**     be changed at run time through /proc/myst/events. On exit the host
+**     writes the trace to a file, which "myst decode-trace" turns into text
+**     or into a JSON trace for Perfetto (or chrome://tracing).
+**
+**     The timestamps are CLOCK_MONOTONIC nanoseconds from the clock that the
+**     host shares with the kernel: rdtsc traps inside an SGX1 enclave.
+**
+**==============================================================================
+*/
+
+#define MYST_EVENT_TRACE_MAGIC 0x525456455453594d /* "MYSTEVTR" */
+
+#define MYST_EVENT_TRACE_VERSION 1
+
+#define MYST_EVENT_TRACE_RINGS 64
+
+/* the events in each ring (a power of two) */
+#define MYST_EVENT_TRACE_RING_SIZE 8192
+
+/* the syscall numbers that the trace has names for */
+#define MYST_EVENT_TRACE_MAX_SYSCALLS 1152
+
+/* The categories */
+#define MYST_EVENT_SYSCALL (1 << 0) /* syscall entry and exit */
+#define MYST_EVENT_TCALL (1 << 1)   /* calls from the kernel to the target */
+#define MYST_EVENT_FUTEX (1 << 2)   /* futex waits and wakes */
+#define MYST_EVENT_SCHED (1 << 3)   /* threads starting, blocking, waking */
+#define MYST_EVENT_FS (1 << 4)      /* file opens, closes, reads, writes */
+#define MYST_EVENT_ARGS (1 << 5)    /* syscall arguments (see myst/replay.h) */
+#define MYST_EVENT_ALL 0x3f
+
+/* The types (argument 0 and argument 1) */
+typedef enum myst_event_type
+{
+    MYST_EVENT_SYSCALL_ENTER = 1, /* syscall number */
+    MYST_EVENT_SYSCALL_EXIT,      /* syscall number, return value */
+    MYST_EVENT_TCALL_ENTER,       /* tcall number */
+    MYST_EVENT_TCALL_EXIT,        /* tcall number, return value */
+    MYST_EVENT_FUTEX_WAIT,        /* address, expected value */
+    MYST_EVENT_FUTEX_WOKE,        /* address, return value */
+    MYST_EVENT_FUTEX_WAKE,        /* address, waiters woken */
+    MYST_EVENT_SCHED_START,       /* pid, whether a kernel thread */
+    MYST_EVENT_SCHED_EXIT,        /* exit status */
+    MYST_EVENT_SCHED_BLOCK,       /* condition variable */
+    MYST_EVENT_SCHED_UNBLOCK,     /* condition variable, return value */
+    MYST_EVENT_SCHED_WAKEUP,      /* the tid of the thread woken */
+    MYST_EVENT_SCHED_YIELD,       /* - */
+    MYST_EVENT_FS_OPEN,           /* file descriptor (or error), flags */
+    MYST_EVENT_FS_CLOSE,          /* file descriptor, return value */
+    MYST_EVENT_FS_READ,           /* file descriptor, bytes (or error) */
+    MYST_EVENT_FS_WRITE,          /* file descriptor, bytes (or error) */
+    MYST_EVENT_SYSCALL_ARGS01,    /* syscall arguments 0 and 1 */
+    MYST_EVENT_SYSCALL_ARGS23,    /* syscall arguments 2 and 3 */
+    MYST_EVENT_SYSCALL_ARGS45,    /* syscall arguments 4 and 5 */
+} myst_event_type_t;
+
+typedef struct myst_event
+{
+    uint64_t time;
+    uint32_t tid;
+    uint16_t category;
+    uint16_t type;
+    uint64_t arg0;
+    uint64_t arg1;
+} myst_event_t;
+
+#define MYST_EVENT_RING_FREE 0
+#define MYST_EVENT_RING_OWNED 1
+#define MYST_EVENT_RING_EXITED 2
+
+typedef struct myst_event_ring
+{
+    uint32_t state; /* MYST_EVENT_RING_* */
+    uint32_t owner; /* the tid of the last thread to claim it */
+
+    /* the events written (the last ones are in events[head % size]) */
+    uint64_t head;
+
+    myst_event_t events[MYST_EVENT_TRACE_RING_SIZE];
+} myst_event_ring_t;
+
+typedef struct myst_event_trace
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+
+    /* the categories to record from the start (written by the host) */
+    uint32_t categories;
+
+    /* the rings in use (in a file, the rings that follow the header) */
+    uint32_t nrings;
+
+    /* the events of threads that found no ring */
+    uint64_t dropped;
+
+    /* the syscall names (written by the kernel) */
+    char syscalls[MYST_EVENT_TRACE_MAX_SYSCALLS][24];
+
+    myst_event_ring_t rings[MYST_EVENT_TRACE_RINGS];
+} myst_event_trace_t;
+
+/* The name of a category (such as "syscall"), or null */
+const char* myst_event_category_name(uint32_t category);
+
+/* The name of an event type (such as "futex_wait"), or null */
+const char* myst_event_type_name(uint32_t type);
+
+/* The name of a tcall above the Linux syscall numbers, or null */
+const char* myst_event_tcall_name(long n);
+
+/* Parse a list of categories, separated by commas, spaces or newlines
+ * ("syscall,futex", "all" or "none") */
+int myst_parse_event_categories(const char* list, uint32_t* categories);
+
+/* Append the names of the categories (separated by commas) */
+int myst_format_event_categories(myst_buf_t* buf, uint32_t categories);
+
+/* Host: start tracing (the kernel gets the returned trace) */
+myst_event_trace_t* myst_event_trace_start(uint32_t categories);
+
+/* Host: the trace (null unless started) */
+myst_event_trace_t* myst_event_trace_get(void);
+
+/* Host: write the rings in use to the file */
+int myst_event_trace_write(const char* path);
+
+/* Host: the "decode-trace" action */
+int decode_trace_action(int argc, const char* argv[]);
+
+/*
+**==============================================================================
+**
+** Kernel
+**
+**==============================================================================
+*/
+
+struct myst_thread;
+
+/* the categories being recorded (zero unless the host passed a trace) */
+extern uint32_t __myst_event_categories;
+
+/* Start recording (if the host passed a trace) */
+int myst_event_trace_init(void);
+
+/* Change the categories (fails unless recording) */
+int myst_set_event_categories(uint32_t categories);
+
+/* Record an event for the calling thread (see myst_event()) */
+void myst_event_record(
+    uint32_t category,
+    uint32_t type,
+    uint64_t arg0,
+    uint64_t arg1);
+
+/* Release the ring of an exiting thread */
+void myst_event_trace_release(struct myst_thread* thread);
+
+/* Read and write /proc/myst/events */
+int myst_format_event_trace(myst_buf_t* buf);
+
+int myst_control_event_trace(const void* data, size_t size);
+
+MYST_INLINE bool myst_event_enabled(uint32_t category)
+{
+    return __atomic_load_n(&__myst_event_categories, __ATOMIC_RELAXED) &
+           category;
+}
+
+MYST_INLINE void myst_event(
+    uint32_t category,
+    uint32_t type,
+    uint64_t arg0,
+    uint64_t arg1)
+{
+    if (myst_event_enabled(category))
+        myst_event_record(category, type, arg0, arg1);
+}
+
+/* Record the arguments of the syscall being entered (as three events) */
+MYST_INLINE void myst_event_syscall_args(const long params[6])
+{
+    const uint32_t c = MYST_EVENT_ARGS;
+
+    if (myst_event_enabled(c))
+    {
+        const uint64_t* a = (const uint64_t*)params;
+        myst_event_record(c, MYST_EVENT_SYSCALL_ARGS01, a[0], a[1]);
+        myst_event_record(c, MYST_EVENT_SYSCALL_ARGS23, a[2], a[3]);
+        myst_event_record(c, MYST_EVENT_SYSCALL_ARGS45, a[4], a[5]);
+    }
+}
+
+#endif /* _MYST_EVENTTRACE_H */
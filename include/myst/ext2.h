@@ -50,6 +50,60 @@
 #define EXT2_FT_SOCK 6
 #define EXT2_FT_SYMLINK 7
 
+/* Inode flag of directories with a hashed (htree) index */
+#define EXT2_INDEX_FL 0x00001000
+
+/* Inode flag of files whose blocks are mapped by an extent tree (ext4) */
+#define EXT4_EXTENTS_FL 0x00080000
+
+/* Incompatible features (the driver refuses to mount any others) */
+#define EXT2_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT4_FEATURE_INCOMPAT_EXTENTS 0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT 0x0080
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG 0x0200
+
+/* Read-only compatible features (the driver mounts any others read-only) */
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002
+
+/* Features with which the driver mounts the file system read-only */
+#define EXT2_FEATURE_INCOMPAT_READ_ONLY \
+    (EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT)
+
+#define EXT2_FEATURE_INCOMPAT_SUPPORTED                                \
+    (EXT2_FEATURE_INCOMPAT_FILETYPE | EXT4_FEATURE_INCOMPAT_FLEX_BG | \
+     EXT2_FEATURE_INCOMPAT_READ_ONLY)
+
+#define EXT2_FEATURE_RO_COMPAT_SUPPORTED \
+    (EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
+
+/* Magic number of ext4 extent tree nodes and the deepest trees */
+#define EXT4_EXTENT_MAGIC 0xF30A
+#define EXT4_EXTENT_MAX_DEPTH 5
+
+/* Extents longer than this are preallocated but unwritten (read as zeros) */
+#define EXT4_EXTENT_INIT_MAX_LEN 32768
+
+/* Superblock flag: htree hashes treat names as unsigned chars */
+#define EXT2_FLAGS_UNSIGNED_HASH 0x0002
+
+/* Hash versions of htree directory indexes */
+#define EXT2_HASH_LEGACY 0
+#define EXT2_HASH_HALF_MD4 1
+#define EXT2_HASH_TEA 2
+#define EXT2_HASH_LEGACY_UNSIGNED 3
+#define EXT2_HASH_HALF_MD4_UNSIGNED 4
+#define EXT2_HASH_TEA_UNSIGNED 5
+
+/* Most entries held by the in-memory directory indexes at once */
+#define EXT2_DIRINDEX_ENTRIES (256 * 1024)
+
+/* Default size of the buffer cache in blocks (see ext2_set_cache_size()) */
+#define EXT2_CACHE_BLOCKS 2048
+
+/* Most inodes kept in the inode cache beyond those of open files */
+#define EXT2_ICACHE_INODES 4096
+
 /*
 **==============================================================================
 **
@@ -68,6 +122,12 @@ typedef struct ext2_group_desc ext2_group_desc_t;
 typedef struct ext2_inode ext2_inode_t;
 typedef struct ext2_dirent ext2_dirent_t;
 typedef struct ext2_dir ext2_dir_t;
+typedef struct ext2_cache ext2_cache_t;
+typedef struct ext2_dirindex ext2_dirindex_t;
+typedef struct ext2_icache ext2_icache_t;
+typedef struct ext4_extent_header ext4_extent_header_t;
+typedef struct ext4_extent ext4_extent_t;
+typedef struct ext4_extent_idx ext4_extent_idx_t;
 
 struct ext2_block
 {
@@ -130,12 +190,15 @@ struct ext2_super_block
     /* Directory Indexing Support */
     uint32_t s_hash_seed[4];
     uint8_t s_def_hash_version;
-    uint8_t padding[3];
+    uint8_t s_jnl_backup_type;
+    uint16_t s_desc_size; /* group descriptor size (with the 64bit feature) */
 
     /* Other options */
     uint32_t s_default_mount_options;
     uint32_t s_first_meta_bg;
-    uint8_t __unused[760];
+    uint8_t __unused1[88];
+    uint32_t s_flags;
+    uint8_t __unused[668];
 };
 
 _Static_assert(sizeof(ext2_super_block_t) == 1024, "");
@@ -181,6 +244,32 @@ struct ext2_inode
     uint8_t dummy[128]; /* sometimes the inode is bigger */
 };
 
+/* The nodes of ext4 extent trees (the root fills the inode's i_block) */
+struct ext4_extent_header
+{
+    uint16_t eh_magic;
+    uint16_t eh_entries;
+    uint16_t eh_max;
+    uint16_t eh_depth; /* zero for leaves */
+    uint32_t eh_generation;
+};
+
+struct ext4_extent
+{
+    uint32_t ee_block;
+    uint16_t ee_len;
+    uint16_t ee_start_hi;
+    uint32_t ee_start_lo;
+};
+
+struct ext4_extent_idx
+{
+    uint32_t ei_block;
+    uint32_t ei_leaf_lo;
+    uint16_t ei_leaf_hi;
+    uint16_t ei_unused;
+};
+
 struct ext2_dirent
 {
     uint32_t inode;
@@ -201,8 +290,25 @@ struct ext2
     ext2_inode_t root_inode;
     char target[EXT2_PATH_MAX];
     myst_mount_resolve_callback_t resolve;
+    ext2_cache_t* cache;
+    ext2_dirindex_t* dirindex;
+    ext2_icache_t* icache;
+    bool read_only; /* has features the driver can only read (see ext2.h) */
+    uint8_t* dirty_groups; /* a bit per group descriptor not yet written */
+    bool sb_dirty;         /* the superblock is not yet written */
 };
 
+typedef struct ext2_cache_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writebacks; /* dirty blocks written to the device */
+    uint64_t evictions;
+    uint64_t prefetched; /* blocks read ahead of ext2_read() */
+    size_t blocks; /* blocks in the cache */
+    size_t dirty;  /* blocks not yet written to the device */
+} ext2_cache_stats_t;
+
 /*
 **==============================================================================
 **
@@ -218,6 +324,18 @@ int ext2_create(
 
 int ext2_release(myst_fs_t* fs);
 
+/* Write the dirty blocks of the buffer cache to the device */
+int ext2_sync(myst_fs_t* fs);
+
+/* Limit the buffer cache to max_blocks blocks (zero writes through) */
+int ext2_set_cache_size(myst_fs_t* fs, size_t max_blocks);
+
+int ext2_get_cache_stats(myst_fs_t* fs, ext2_cache_stats_t* stats);
+
+/* The requests that all ext2 file systems (not just one) made of their
+ * block devices: the reads of blocks missed and the dirty block writes */
+void ext2_get_blkdev_stats(uint64_t* gets, uint64_t* puts);
+
 /*
 **==============================================================================
 **
@@ -230,6 +348,39 @@ int ext2_lsr(ext2_t* ext2, const char* root, myst_strarr_t* paths);
 
 int ext2_check(const ext2_t* ext2);
 
+/* Totals gathered by ext2_check_groups() (summed over the groups) */
+typedef struct ext2_check_counts
+{
+    uint64_t free_blocks; /* as the group descriptors count them */
+    uint64_t clear_blocks; /* as the block bitmaps count them */
+    uint64_t free_inodes;
+    uint64_t clear_inodes;
+} ext2_check_counts_t;
+
+/* Called as the check goes, with the number of groups checked so far */
+typedef void (*ext2_check_progress_t)(
+    uint32_t groups_checked,
+    uint32_t group_count,
+    void* arg);
+
+/* Check the group count groups from first, adding to the counts. This only
+ * reads the file system, so callers may check disjoint ranges of groups on
+ * as many threads as they like and then add up the counts */
+int ext2_check_groups(
+    const ext2_t* ext2,
+    uint32_t first,
+    uint32_t count,
+    ext2_check_counts_t* counts);
+
+/* Check the counts of all the groups against the superblock */
+int ext2_check_counts(const ext2_t* ext2, const ext2_check_counts_t* counts);
+
+/* ext2_check() reporting its progress (by group) to the callback */
+int ext2_check_ex(
+    const ext2_t* ext2,
+    ext2_check_progress_t progress,
+    void* arg);
+
 int ext2_read_block(const ext2_t* ext2, uint32_t blkno, ext2_block_t* block);
 
 int ext2_read_inode(const ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode);
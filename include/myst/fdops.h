@@ -10,6 +10,8 @@
 
 typedef struct myst_fdops myst_fdops_t;
 
+struct myst_pollq;
+
 struct myst_fdops
 {
     ssize_t (*fd_read)(void* device, void* object, void* buf, size_t count);
@@ -44,6 +46,9 @@ struct myst_fdops
 
     /* returns POLLIN | POLLOUT | POLLERR */
     int (*fd_get_events)(void* device, void* object);
+
+    /* optional: the queue notified when the events of this object change */
+    struct myst_pollq* (*fd_pollq)(void* device, void* object);
 };
 
 ssize_t myst_fdops_readv(
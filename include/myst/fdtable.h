@@ -7,19 +7,32 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 #include <myst/defs.h>
 #include <myst/epolldev.h>
+#include <myst/eventfddev.h>
 #include <myst/fs.h>
 #include <myst/inotifydev.h>
 #include <myst/pipedev.h>
+#include <myst/rwlock.h>
 #include <myst/sockdev.h>
 #include <myst/spinlock.h>
+#include <myst/timerfddev.h>
 #include <myst/ttydev.h>
 
+/* The table grows by chunks of this many descriptors */
 #define MYST_FDTABLE_SIZE 1024
 
+/* The largest number of descriptors of a table (the Linux nr_open default) */
+#define MYST_FDTABLE_MAX (1024 * 1024)
+
+#define MYST_FDTABLE_CHUNKS (MYST_FDTABLE_MAX / MYST_FDTABLE_SIZE)
+
+/* The number of lookups per syscall that a concurrent close() respects */
+#define MYST_FDTABLE_HOLDS 8
+
 typedef enum myst_fdtable_type
 {
     MYST_FDTABLE_TYPE_NONE,
@@ -29,6 +42,8 @@ typedef enum myst_fdtable_type
     MYST_FDTABLE_TYPE_SOCK,
     MYST_FDTABLE_TYPE_EPOLL,
     MYST_FDTABLE_TYPE_INOTIFY,
+    MYST_FDTABLE_TYPE_EVENTFD,
+    MYST_FDTABLE_TYPE_TIMERFD,
 } myst_fdtable_type_t;
 
 typedef struct myst_fdtable_entry
@@ -38,10 +53,57 @@ typedef struct myst_fdtable_entry
     void* object; /* example: myst_file_t */
 } myst_fdtable_entry_t;
 
-typedef struct myst_fdtable
+/* A chunk of descriptors; tables share chunks after a clone until a write
+ * (see myst_fdtable_clone()) */
+typedef struct myst_fdtable_chunk
 {
+    /* the number of tables using this chunk */
+    size_t refs;
+
+    /* one bit per used[] word with no free descriptor */
+    uint64_t full;
+
+    /* one bit per descriptor in use */
+    uint64_t used[MYST_FDTABLE_SIZE / 64];
+
+    /* one bit per descriptor with FD_CLOEXEC (what exec closes) */
+    uint64_t cloexec[MYST_FDTABLE_SIZE / 64];
+
     myst_fdtable_entry_t entries[MYST_FDTABLE_SIZE];
-    myst_spinlock_t lock;
+} myst_fdtable_chunk_t;
+
+/* An object closed while other threads may still use it */
+typedef struct myst_fdtable_retired
+{
+    struct myst_fdtable_retired* next;
+    myst_fdops_t* fdops;
+    void* object;
+} myst_fdtable_retired_t;
+
+typedef struct myst_fdtable
+{
+    /* null until the first descriptor of the chunk is assigned */
+    myst_fdtable_chunk_t* chunks[MYST_FDTABLE_CHUNKS];
+
+    /* one bit per chunk with no free descriptor */
+    uint64_t full[MYST_FDTABLE_CHUNKS / 64];
+
+    /* one bit per chunk with a descriptor with FD_CLOEXEC */
+    uint64_t cloexec[MYST_FDTABLE_CHUNKS / 64];
+
+    /* RLIMIT_NOFILE: descriptors are always below nofile_cur */
+    size_t nofile_cur;
+    size_t nofile_max;
+
+    /* serializes writers */
+    myst_ticketlock_t lock;
+
+    /* see myst_fdtable_retire() */
+    myst_fdtable_retired_t* retired;
+    myst_spinlock_t retired_lock;
+
+    /* bumped around every entry update (lets readers skip the lock) */
+    myst_seqcount_t seq;
 } myst_fdtable_t;
 
 int myst_fdtable_create(myst_fdtable_t** fdtable_out);
@@ -57,6 +119,15 @@ int myst_fdtable_assign(
     void* device,
     void* object);
 
+/* myst_fdtable_assign() for a caller that knows whether the object has
+ * FD_CLOEXEC (which saves asking the object) */
+int myst_fdtable_assign_cloexec(
+    myst_fdtable_t* fdtable,
+    myst_fdtable_type_t type,
+    void* device,
+    void* object,
+    bool cloexec);
+
 typedef enum
 {
     MYST_DUP,           /* dup() */
@@ -75,6 +146,16 @@ int myst_fdtable_dup(
 
 int myst_fdtable_remove(myst_fdtable_t* fdtable, int fd);
 
+/* Swap the object behind fd; fails with -EBADF unless fd still refers to
+ * old_object (the caller closes old_object) */
+int myst_fdtable_replace(
+    myst_fdtable_t* fdtable,
+    int fd,
+    void* old_object,
+    myst_fdtable_type_t type,
+    void* device,
+    void* object);
+
 int myst_fdtable_get(
     myst_fdtable_t* fdtable,
     int fd,
@@ -142,6 +223,16 @@ MYST_INLINE int myst_fdtable_get_inotify(
     return myst_fdtable_get(fdtable, fd, type, (void**)device, (void**)inotify);
 }
 
+MYST_INLINE int myst_fdtable_get_timerfd(
+    myst_fdtable_t* fdtable,
+    int fd,
+    myst_timerfddev_t** device,
+    myst_timerfd_t** timerfd)
+{
+    const myst_fdtable_type_t type = MYST_FDTABLE_TYPE_TIMERFD;
+    return myst_fdtable_get(fdtable, fd, type, (void**)device, (void**)timerfd);
+}
+
 int myst_fdtable_get_any(
     myst_fdtable_t* fdtable,
     int fd,
@@ -152,11 +243,40 @@ int myst_fdtable_get_any(
 /* get the fdtable for the current thread */
 myst_fdtable_t* myst_fdtable_current(void);
 
+/* The new table shares the objects of fdtable until either table changes
+ * the chunk of descriptors they are in (which then gets its own copies) */
 int myst_fdtable_clone(myst_fdtable_t* fdtable, myst_fdtable_t** fdtable_out);
 
+/* Give fd an object of its own (call before changing a per-descriptor
+ * property such as FD_CLOEXEC, or before closing the object behind fd) */
+int myst_fdtable_unshare(myst_fdtable_t* fdtable, int fd);
+
+/* Close an object that was just removed from the table: at once, unless
+ * another thread sharing the table looked it up during its current syscall
+ * (lookups never take the lock), in which case the object is closed when
+ * the last such syscall returns */
+int myst_fdtable_retire(
+    myst_fdtable_t* fdtable,
+    myst_fdops_t* fdops,
+    void* object);
+
+struct myst_thread;
+
+/* Forget the lookups of the thread (called when each syscall returns) */
+void myst_fdtable_drop_holds(struct myst_thread* thread);
+
+/* Record a change of the FD_CLOEXEC flag of fd (after fd_fcntl(F_SETFD)) */
+int myst_fdtable_set_cloexec(myst_fdtable_t* fdtable, int fd, bool cloexec);
+
+/* get or set RLIMIT_NOFILE (either may be null) */
+int myst_fdtable_rlimit(
+    myst_fdtable_t* fdtable,
+    const struct rlimit* new_rlim,
+    struct rlimit* old_rlim);
+
 MYST_INLINE bool myst_valid_fd(int fd)
 {
-    return fd >= 0 && fd < MYST_FDTABLE_SIZE;
+    return fd >= 0 && fd < MYST_FDTABLE_MAX;
 }
 
 #endif /* _MYST_FDTABLE_H */
@@ -7,6 +7,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
 #include <sys/types.h>
@@ -32,11 +33,23 @@ typedef struct myst_fs myst_fs_t;
 
 typedef struct myst_file myst_file_t;
 
+/* Receives file bytes straight from fs_pread_direct(); returns the number of
+ * bytes taken or a negative errno */
+typedef ssize_t (*myst_fs_consume_t)(void* arg, const void* data, size_t n);
+
 typedef int (*myst_mount_resolve_callback_t)(
     const char* path,
     char suffix[PATH_MAX],
     myst_fs_t** fs);
 
+/* How reading a file updates its access time (see myst_atime_due()) */
+typedef enum myst_atime
+{
+    MYST_ATIME_RELATIME, /* the default, as on Linux */
+    MYST_ATIME_STRICT,   /* MS_STRICTATIME */
+    MYST_ATIME_NONE,     /* MS_NOATIME */
+} myst_atime_t;
+
 struct myst_fs
 {
     myst_fdops_t fdops;
@@ -164,8 +177,66 @@ struct myst_fs
         myst_fs_t* fs,
         myst_file_t* file,
         const struct timespec times[2]);
+
+    /* Pass up to count bytes at offset to consume() straight from where the
+     * file system keeps them, without copying them into a buffer first.
+     * Optional: file systems without in-memory storage leave this null. */
+    ssize_t (*fs_pread_direct)(
+        myst_fs_t* fs,
+        myst_file_t* file,
+        myst_fs_consume_t consume,
+        void* arg,
+        size_t count,
+        off_t offset);
+
+    /* Write the file's buffered changes to the backing store. Optional:
+     * file systems that write through (or keep nothing) leave this null. */
+    int (*fs_fsync)(myst_fs_t* fs, myst_file_t* file);
+
+    /* Have the host send up to count bytes at *offset (or at the file
+     * offset if offset is null) to out_fd, a target file descriptor, without
+     * the bytes entering the kernel; updates whichever offset was used.
+     * Optional: only file systems of host files provide it. */
+    ssize_t (*fs_host_sendfile)(
+        myst_fs_t* fs,
+        myst_file_t* file,
+        int out_fd,
+        off_t* offset,
+        size_t count);
+
+    /* set from the flags given to mount() */
+    myst_atime_t atime;
+    bool nodiratime;
 };
 
+/* Whether a read at time now updates the access time: relatime updates it
+ * when it is not later than the last change, or is a day old */
+MYST_INLINE bool myst_atime_due(
+    myst_atime_t how,
+    const struct timespec* atime,
+    const struct timespec* mtime,
+    const struct timespec* ctime,
+    const struct timespec* now)
+{
+    const time_t day = 24 * 60 * 60;
+
+    if (how == MYST_ATIME_NONE)
+        return false;
+
+    if (how == MYST_ATIME_STRICT)
+        return true;
+
+    if (atime->tv_sec < mtime->tv_sec ||
+        (atime->tv_sec == mtime->tv_sec && atime->tv_nsec <= mtime->tv_nsec))
+        return true;
+
+    if (atime->tv_sec < ctime->tv_sec ||
+        (atime->tv_sec == ctime->tv_sec && atime->tv_nsec <= ctime->tv_nsec))
+        return true;
+
+    return now->tv_sec - atime->tv_sec >= day;
+}
+
 int myst_remove_fd_link(int fd);
 
 int myst_load_fs(
@@ -174,4 +245,9 @@ int myst_load_fs(
     const char* key,
     myst_fs_t** fs_out);
 
+/* Seal the hash nodes that the verity device of the rootfs verified to the
+ * enclave and write them to the --verity-node-cache file (if given), for
+ * myst_load_fs() of the next boot to take as verified */
+void myst_save_verity_nodes(void);
+
 #endif /* _MYST_FS_H */
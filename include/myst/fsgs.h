@@ -4,8 +4,82 @@
 #ifndef _MYST_FSGS_H
 #define _MYST_FSGS_H
 
+#include <sys/syscall.h>
+
+#include <myst/defs.h>
 #include <myst/types.h>
 
+/*
+** The kernels built for one target (see MYST_KERNEL_TARGET in kernel/Makefile)
+** inline the fs and gs base accessors: the SGX kernel uses the fsgsbase
+** instructions and the Linux kernel asks the host with arch_prctl(). The
+** generic kernel chooses at runtime (see kernel/fsgs.c).
+*/
+
+#if defined(MYST_KERNEL_TARGET_LINUX)
+
+MYST_INLINE long __myst_arch_prctl(long code, void* addr)
+{
+    unsigned long ret;
+
+    __asm__ __volatile__("syscall"
+                         : "=a"(ret)
+                         : "a"(SYS_arch_prctl), "D"(code), "S"(addr)
+                         : "rcx", "r11", "memory");
+
+    return (long)ret;
+}
+
+MYST_INLINE void* myst_get_fsbase(void)
+{
+    void* p;
+    __myst_arch_prctl(0x1003 /* ARCH_GET_FS */, &p);
+    return p;
+}
+
+MYST_INLINE void myst_set_fsbase(void* p)
+{
+    __myst_arch_prctl(0x1002 /* ARCH_SET_FS */, p);
+}
+
+MYST_INLINE void* myst_get_gsbase(void)
+{
+    void* p;
+    __myst_arch_prctl(0x1004 /* ARCH_GET_GS */, &p);
+    return p;
+}
+
+MYST_INLINE void myst_set_gsbase(void* p)
+{
+    __myst_arch_prctl(0x1001 /* ARCH_SET_GS */, p);
+}
+
+#elif defined(MYST_KERNEL_TARGET_SGX)
+
+MYST_INLINE void* myst_get_fsbase(void)
+{
+    void* p;
+    __asm__ volatile("mov %%fs:0, %0" : "=r"(p));
+    return p;
+}
+
+MYST_INLINE void myst_set_fsbase(void* p)
+{
+    __asm__ volatile("wrfsbase %0" ::"r"(p));
+}
+
+MYST_INLINE void* myst_get_gsbase(void)
+{
+    void* p;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(p));
+    return p;
+}
+
+/* unsupported (panics) but not needed */
+void myst_set_gsbase(void* p);
+
+#else
+
 void* myst_get_fsbase(void);
 
 void myst_set_fsbase(void* p);
@@ -14,4 +88,6 @@ void* myst_get_gsbase(void);
 
 void myst_set_gsbase(void* p);
 
+#endif
+
 #endif /* _MYST_FSGS_H */
@@ -18,12 +18,30 @@
 #define FUTEX_UNLOCK_PI      7
 #define FUTEX_TRYLOCK_PI     8
 #define FUTEX_WAIT_BITSET    9
+#define FUTEX_WAKE_BITSET    10
 #define FUTEX_PRIVATE        128
 #define FUTEX_CLOCK_REALTIME 256
+
+#define FUTEX_BITSET_MATCH_ANY 0xffffffff
+
+/* FUTEX_WAKE_OP operations and comparisons */
+#define FUTEX_OP_SET         0
+#define FUTEX_OP_ADD         1
+#define FUTEX_OP_OR          2
+#define FUTEX_OP_ANDN        3
+#define FUTEX_OP_XOR         4
+#define FUTEX_OP_OPARG_SHIFT 8
+#define FUTEX_OP_CMP_EQ      0
+#define FUTEX_OP_CMP_NE      1
+#define FUTEX_OP_CMP_LT      2
+#define FUTEX_OP_CMP_LE      3
+#define FUTEX_OP_CMP_GT      4
+#define FUTEX_OP_CMP_GE      5
 // clang-format on
 
 int myst_futex_wait(int* uaddr, int val, const struct timespec* to);
 
+/* Returns the number of woken waiters */
 int myst_futex_wake(int* uaddr, int val);
 
 #endif /* _MYST_FUTEX_H */
@@ -0,0 +1,51 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_GCM_H
+#define _MYST_GCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* AES-GCM with the key expanded once (with AES-NI when the CPU has it) */
+
+#define MYST_GCM_IV_SIZE 12
+#define MYST_GCM_TAG_SIZE 16
+#define MYST_GCM_MAX_AAD_SIZE 16
+
+typedef struct myst_gcm myst_gcm_t;
+
+/* The nonce and the additional authenticated data of one message */
+typedef struct myst_gcm_auth
+{
+    uint8_t iv[MYST_GCM_IV_SIZE];
+    uint8_t aad[MYST_GCM_MAX_AAD_SIZE];
+    size_t aad_size;
+} myst_gcm_auth_t;
+
+/* Set up a context for a 16-byte or 32-byte key */
+int myst_gcm_new(const void* key, size_t key_size, myst_gcm_t** gcm);
+
+int myst_gcm_free(myst_gcm_t* gcm);
+
+/* Encrypt the bytes of the vector to out (which may overlap it) and write
+ * the tag right after them; out may be host memory, since nothing written
+ * there is read back */
+int myst_gcm_seal(
+    myst_gcm_t* gcm,
+    const myst_gcm_auth_t* auth,
+    const struct iovec* iov,
+    int iovcnt,
+    void* out);
+
+/* Decrypt size bytes of in (which the tag follows) to out (which may be in);
+ * fails with -EBADMSG if the tag does not match */
+int myst_gcm_open(
+    myst_gcm_t* gcm,
+    const myst_gcm_auth_t* auth,
+    const void* in,
+    void* out,
+    size_t size);
+
+#endif /* _MYST_GCM_H */
@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_HASHMAP_H
+#define _MYST_HASHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** A map from 64-bit keys to non-null pointers, with open addressing (linear
+** probing). When the table fills up, a larger one replaces it a few slots at
+** a time: each put and remove moves MYST_HASHMAP_MIGRATE_SLOTS slots of the
+** old table over, and lookups try both tables until the move is done, so no
+** call pays for rehashing the whole table. The map does no locking; callers
+** serialize access with their own lock.
+*/
+
+/* the slots of the first table (a power of two) */
+#define MYST_HASHMAP_MIN_SLOTS 16
+
+/* the old slots moved to the new table by each put and remove */
+#define MYST_HASHMAP_MIGRATE_SLOTS 8
+
+typedef struct myst_hashmap_slot
+{
+    uint64_t key;
+    void* value; /* null if unused, or a removed marker */
+} myst_hashmap_slot_t;
+
+typedef struct myst_hashmap
+{
+    myst_hashmap_slot_t* slots;
+    size_t nslots; /* a power of two (or zero before the first put) */
+    size_t nused;  /* the slots with values or removed markers */
+    size_t size;   /* the values in both tables */
+
+    /* the table being moved into slots[] (null unless resizing) */
+    myst_hashmap_slot_t* old;
+    size_t old_nslots;
+    size_t old_pos; /* the next old slot to move */
+} myst_hashmap_t;
+
+#define MYST_HASHMAP_INITIALIZER {NULL, 0, 0, 0, NULL, 0, 0}
+
+/* Get the value of a key (or null) */
+void* myst_hashmap_get(const myst_hashmap_t* map, uint64_t key);
+
+/* Set the value of a key (replacing any value it had); value may not be null.
+ * Returns 0, -EINVAL or -ENOMEM */
+int myst_hashmap_put(myst_hashmap_t* map, uint64_t key, void* value);
+
+/* Remove a key, returning its value (or null if it had none) */
+void* myst_hashmap_remove(myst_hashmap_t* map, uint64_t key);
+
+/* Call f for each value (which f may not remove) */
+void myst_hashmap_foreach(
+    const myst_hashmap_t* map,
+    void (*f)(uint64_t key, void* value, void* arg),
+    void* arg);
+
+/* Release the tables (but not the values) */
+void myst_hashmap_release(myst_hashmap_t* map);
+
+static __inline__ size_t myst_hashmap_size(const myst_hashmap_t* map)
+{
+    return map->size;
+}
+
+#endif /* _MYST_HASHMAP_H */
@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_HOSTCLOSE_H
+#define _MYST_HOSTCLOSE_H
+
+#include <myst/types.h>
+
+/* The most host fds waiting for the closer thread (see --async-close) */
+#define MYST_HOST_CLOSE_QUEUE_SIZE 256
+
+/* Start the closer thread if --async-close was given */
+int myst_start_host_closer(void);
+
+/* Close the queued host fds and stop the closer thread */
+void myst_stop_host_closer(void);
+
+/* Close a host fd, on the closer thread if it is running (and has room),
+ * else now. The host keeps the fd number until the close happens. */
+long myst_host_close(int fd);
+
+#endif /* _MYST_HOSTCLOSE_H */
@@ -4,8 +4,70 @@
 #ifndef _MYST_HOSTFS_H
 #define _MYST_HOSTFS_H
 
+#include <stdint.h>
+#include <sys/types.h>
+
 #include <myst/fs.h>
 
+/* How a hostfs mount caches attributes and directories (see hostfs.c) */
+typedef enum myst_hostfs_cache
+{
+    MYST_HOSTFS_CACHE_NONE,      /* every operation goes to the host */
+    MYST_HOSTFS_CACHE_TTL,       /* results expire after a fixed time */
+    MYST_HOSTFS_CACHE_EXCLUSIVE, /* the kernel is the only writer */
+} myst_hostfs_cache_t;
+
+/* The time that MYST_HOSTFS_CACHE_TTL keeps results by default */
+#define MYST_HOSTFS_DEFAULT_CACHE_TTL_MSEC 1000
+
+/* The interval of the flusher thread by default and the largest buffer (see
+ * myst_hostfs_set_buffering() below) */
+#define MYST_HOSTFS_DEFAULT_FLUSH_MSEC 100
+#define MYST_HOSTFS_MAX_IO_BUFFER_SIZE (16 * 1024 * 1024)
+
 int myst_init_hostfs(myst_fs_t** fs_out);
 
+/* Select the cache mode of the file system (ttl_msec of zero selects the
+ * default time to live); this drops whatever was cached. */
+int myst_hostfs_set_cache(
+    myst_fs_t* fs,
+    myst_hostfs_cache_t mode,
+    uint64_t ttl_msec);
+
+/* Give each open regular file a read-ahead and write-behind buffer of the
+ * given size (zero disables it), with pending writes flushed after at most
+ * flush_msec (zero flushes them only when needed); call it before opening
+ * files. */
+int myst_hostfs_set_buffering(
+    myst_fs_t* fs,
+    size_t buffer_size,
+    uint64_t flush_msec);
+
+/* How a hostfs mount serves mmap() of its files (see hostfs.c) */
+typedef enum myst_hostfs_mmap
+{
+    MYST_HOSTFS_MMAP_COPY, /* the pages are read into enclave memory */
+    MYST_HOSTFS_MMAP_HOST, /* read-only shared mappings stay in host memory */
+} myst_hostfs_mmap_t;
+
+/* Select how mmap() maps the files of the mount. With MYST_HOSTFS_MMAP_HOST
+ * and a manifest (the path of a sha256sum(1) listing of paths relative to
+ * the mount, which should be on a trusted file system), only the files that
+ * it lists are mapped from host memory, once their hash is checked. */
+int myst_hostfs_set_mmap(
+    myst_fs_t* fs,
+    myst_hostfs_mmap_t mode,
+    const char* manifest);
+
+/* Map [offset:offset+length] of a file of a MYST_HOSTFS_MMAP_HOST mount
+ * read-only from host memory (see myst_tcall_map_host_file()). Returns
+ * -ENOTSUP if the file is to be copied instead (fs may be any file system),
+ * or -EIO if the file does not match the manifest. */
+int myst_hostfs_map(
+    myst_fs_t* fs,
+    myst_file_t* file,
+    off_t offset,
+    size_t length,
+    void** addr_out);
+
 #endif /* _MYST_HOSTFS_H */
@@ -8,7 +8,9 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 
+#include <myst/defs.h>
 #include <myst/fdops.h>
+#include <myst/fs.h>
 
 typedef struct myst_inotifydev myst_inotifydev_t;
 
@@ -89,4 +91,47 @@ struct myst_inotifydev
 
 myst_inotifydev_t* myst_inotifydev_get(void);
 
+/*
+**==============================================================================
+**
+** Posting events: the syscall layer calls these after it changes a file, with
+** the IN_* event (and IN_ISDIR for a directory). They cost one load while no
+** watch exists anywhere.
+**
+**==============================================================================
+*/
+
+/* the number of watches (of all instances) */
+extern size_t __myst_inotify_watches;
+
+void myst_inotify_post(const char* path, uint32_t mask);
+
+void myst_inotify_post_file(myst_fs_t* fs, myst_file_t* file, uint32_t mask);
+
+/* IN_CLOSE_WRITE or IN_CLOSE_NOWRITE, as the file was opened */
+void myst_inotify_post_close(myst_fs_t* fs, myst_file_t* file);
+
+/* IN_MOVED_FROM and IN_MOVED_TO (after the rename) */
+void myst_inotify_post_rename(const char* oldpath, const char* newpath);
+
+MYST_INLINE bool myst_inotify_watching(void)
+{
+    return __atomic_load_n(&__myst_inotify_watches, __ATOMIC_RELAXED) != 0;
+}
+
+MYST_INLINE void myst_inotify_notify(const char* path, uint32_t mask)
+{
+    if (myst_inotify_watching())
+        myst_inotify_post(path, mask);
+}
+
+MYST_INLINE void myst_inotify_notify_file(
+    myst_fs_t* fs,
+    myst_file_t* file,
+    uint32_t mask)
+{
+    if (myst_inotify_watching())
+        myst_inotify_post_file(fs, file, mask);
+}
+
 #endif /* _MYST_INOTIFYDEV_H */
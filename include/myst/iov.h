@@ -8,6 +8,9 @@
 
 ssize_t myst_iov_len(const struct iovec* iov, int iovcnt);
 
+/* Copy the iov onto buf (which has room for myst_iov_len() bytes) */
+void myst_iov_copy(const struct iovec* iov, int iovcnt, void* buf);
+
 ssize_t myst_iov_gather(const struct iovec* iov, int iovcnt, void** buf);
 
 long myst_iov_scatter(
@@ -117,12 +117,13 @@ struct _json_parser
 };
 
 /* This function initializes the JSON parser. The parser destroys its input
- * text.
+ * text: names and string values passed to the callback point into it (with
+ * escapes decoded in place), so parsing never allocates memory.
  *     - json_data - zero-terminated JSON text (modified during parsing).
  *     - json_size - length of the JSON text excluding the zero terminator.
  *     - callback - called repeatedly during parsing.
  *     - callback_data - user data passed to the callback.
- *     - allocator - required custom allocator.
+ *     - allocator - optional custom allocator (may be null).
  *     - allow_whitespace - allow whitespace.
  */
 json_result_t json_parser_init(
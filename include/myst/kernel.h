@@ -80,6 +80,70 @@ typedef struct myst_kernel_args
     bool trace_syscalls;
     bool have_syscall_instruction;
     bool export_ramfs;
+    bool export_ramfs_changed; /* only the files modified after startup */
+    bool export_gcov;          /* only the coverage data (*.gcda) */
+
+    /* Collect syscall statistics (see myst/syscallstats.h) */
+    bool syscall_stats;
+
+    /* Upper bound for F_SETPIPE_SZ (zero selects MYST_PIPE_MAX_SIZE) */
+    size_t max_pipe_size;
+
+    /* Serve loopback TCP and UDP inside the kernel (see myst/loopback.h) */
+    bool enclave_loopback;
+
+    /* Let the host send hostfs files to host sockets (see --host-sendfile) */
+    bool host_sendfile;
+
+    /* Close host fds on a kernel thread (see myst/hostclose.h) */
+    bool async_close;
+
+    /* Read the libraries of exec'd programs ahead (see myst/libprefetch.h) */
+    bool prefetch_libs;
+
+    /* Let sockets hand their TLS record layer to the kernel (see ktls.h) */
+    bool kernel_tls;
+
+    /* Receive-ahead size for stream sockets (zero disables prefetching) */
+    size_t socket_prefetch_size;
+
+    /* Connections accepted per OCALL by TCP listeners (zero or one for one) */
+    size_t accept_batch;
+
+    /* Microseconds to busy poll before a blocking wait (see myst/pollq.h) */
+    unsigned int busy_poll_usec;
+
+    /* Kernel threads that decrypt and verify block reads (zero for none) */
+    size_t crypto_threads;
+
+    /* Seconds that attestation evidence is reused (zero to disable it) */
+    size_t attestation_cache_ttl;
+
+    /* When console output is flushed (see myst/console.h) */
+    int console_buffering;
+
+    /* Verity data blocks cached and read ahead (zero for the defaults) */
+    size_t verity_cache_blocks;
+    size_t verity_prefetch_blocks;
+
+    /* The file of sealed verity hash nodes (empty unless given, see
+     * myst_save_verity_nodes()) */
+    char verity_node_cache[PATH_MAX];
+
+    /* Startup timeline in host memory (null unless --startup-trace) */
+    struct myst_startup_trace* startup_trace;
+
+    /* Rootfs layout profile in host memory (null unless --layout-profile) */
+    struct myst_layout_profile* layout_profile;
+
+    /* Sampling profile in host memory (null unless --profile) */
+    struct myst_profile* profile;
+
+    /* Event trace in host memory (null unless --event-trace) */
+    struct myst_event_trace* event_trace;
+
+    /* Clock state readable by user code (null if not supported) */
+    struct myst_vdso* vdso;
 
     /* The event object for the main thread */
     uint64_t event;
@@ -99,12 +163,29 @@ extern myst_kernel_args_t __myst_kernel_args;
 
 typedef struct myst_malloc_stats
 {
+    /* usable bytes (only tracked when MYST_ENABLE_LEAK_CHECKER is defined) */
     size_t usage;
     size_t peak_usage;
+
+    /* allocations satisfied from (or missed by) the per-thread caches */
+    size_t cache_hits;
+    size_t cache_misses;
 } myst_malloc_stats_t;
 
 int myst_get_malloc_stats(myst_malloc_stats_t* stats);
 
+typedef struct myst_malloc_cache myst_malloc_cache_t;
+
+/* Flush the calling thread's allocation cache back to the central heap */
+void myst_release_malloc_cache(myst_malloc_cache_t** cache);
+
 int myst_find_leaks(void);
 
+/* Wait until the TLS credentials are written if the path names one of them
+ * (they are generated in the background, see MYST_WANT_TLS_CREDENTIAL) */
+void myst_wait_tls_credentials(const char* path);
+
+/* Print the MAX allocation sites holding the most memory (leak checker) */
+int myst_dump_malloc_top(size_t max);
+
 #endif /* _MYST_KERNEL_H */
@@ -0,0 +1,117 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_KTLS_H
+#define _MYST_KTLS_H
+
+#include <sys/socket.h>
+
+#include <myst/gcm.h>
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** Kernel TLS (--kernel-tls):
+**
+**     After a TLS handshake in user space, a program may hand the record
+**     layer to the kernel as on Linux: setsockopt(TCP_ULP, "tls") and then
+**     setsockopt(SOL_TLS, TLS_TX or TLS_RX) with the keys of a direction.
+**     From then on the socket sends and receives plaintext, and the kernel
+**     seals and opens the TLS records inside the enclave. Only ciphertext
+**     reaches the host, and the keys never do. TLS 1.2 and 1.3 with
+**     AES-128-GCM and AES-256-GCM are supported.
+**
+**==============================================================================
+*/
+
+/* The definitions of linux/tls.h (which musl does not have) */
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+#define TLS_TX 1
+#define TLS_RX 2
+
+#define TLS_SET_RECORD_TYPE 1
+#define TLS_GET_RECORD_TYPE 2
+
+#define TLS_1_2_VERSION 0x0303
+#define TLS_1_3_VERSION 0x0304
+
+#define TLS_CIPHER_AES_GCM_128 51
+#define TLS_CIPHER_AES_GCM_256 52
+
+/* The record types */
+#define MYST_TLS_ALERT 21
+#define MYST_TLS_APPLICATION_DATA 23
+
+#define MYST_TLS_HEADER_SIZE 5
+#define MYST_TLS_MAX_PLAINTEXT 16384
+
+/* TLS 1.3 allows this much more ciphertext (for padding) */
+#define MYST_TLS_MAX_EXPANSION 256
+
+/* The largest record sent and received */
+#define MYST_TLS_MAX_RECORD \
+    (MYST_TLS_HEADER_SIZE + MYST_TLS_MAX_PLAINTEXT + MYST_TLS_MAX_EXPANSION)
+
+/* The most a sealed record adds to its plaintext (the header, the TLS 1.2
+ * explicit nonce and the tag) */
+#define MYST_TLS_OVERHEAD (MYST_TLS_HEADER_SIZE + 8 + MYST_GCM_TAG_SIZE)
+
+/* The largest crypto info (tls12_crypto_info_aes_gcm_256) */
+#define MYST_TLS_MAX_CRYPTO_INFO 56
+
+/* The keys and record sequence number of one direction */
+typedef struct myst_ktls
+{
+    myst_gcm_t* gcm; /* null until the keys are set */
+    uint16_t version;
+    uint8_t salt[4];
+    uint8_t iv[8];
+    uint64_t seq;
+
+    /* the crypto info that was set (for getsockopt) */
+    uint8_t info[MYST_TLS_MAX_CRYPTO_INFO];
+    socklen_t info_size;
+} myst_ktls_t;
+
+/* Set the keys from a tls12_crypto_info_aes_gcm_128 or _256 */
+int myst_ktls_init(myst_ktls_t* tls, const void* info, socklen_t size);
+
+void myst_ktls_release(myst_ktls_t* tls);
+
+/* Get the crypto info (with the current record sequence number) */
+int myst_ktls_get_info(const myst_ktls_t* tls, void* info, socklen_t* size);
+
+/* Seal a record of size bytes of plaintext (at most MYST_TLS_MAX_PLAINTEXT)
+ * into out, which has room for MYST_TLS_OVERHEAD more; returns the size of
+ * the record. out is only written (so it may be host memory) */
+ssize_t myst_ktls_seal(
+    myst_ktls_t* tls,
+    uint8_t type,
+    const void* in,
+    size_t size,
+    uint8_t* out);
+
+/* Get the size of the whole record that starts with this header */
+ssize_t myst_ktls_record_size(
+    const myst_ktls_t* tls,
+    const uint8_t header[MYST_TLS_HEADER_SIZE]);
+
+/* Open a whole record in place; returns the size of its plaintext, which
+ * starts at *data, and its type */
+ssize_t myst_ktls_open(
+    myst_ktls_t* tls,
+    uint8_t* record,
+    size_t size,
+    uint8_t* type,
+    uint8_t** data);
+
+#endif /* _MYST_KTLS_H */
@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_LAYOUTPROFILE_H
+#define _MYST_LAYOUTPROFILE_H
+
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** The rootfs layout profile (--layout-profile).
+**
+**     The host allocates the profile in its own memory and passes it to the
+**     kernel (through myst_shm for SGX). The kernel appends the path of each
+**     regular file of the EXT2 rootfs the first time it is opened, one per
+**     line, so the profile lists the files in the order of their first use.
+**     The host writes it out when the program exits, in the format of the
+**     order file of "myst mkext2 --order", which lays those files out first.
+**
+**==============================================================================
+*/
+
+#define MYST_LAYOUT_PROFILE_SIZE (1024 * 1024)
+
+typedef struct myst_layout_profile
+{
+    /* the number of bytes of data in use (only the kernel writes this) */
+    uint64_t size;
+
+    /* the number of paths that did not fit */
+    uint64_t dropped;
+
+    /* the paths, each ending with a newline */
+    char data[MYST_LAYOUT_PROFILE_SIZE];
+} myst_layout_profile_t;
+
+/* Host: start profiling (the kernel gets the returned profile) */
+myst_layout_profile_t* myst_layout_profile_start(void);
+
+/* Host: the profile (null unless started) */
+myst_layout_profile_t* myst_layout_profile_get(void);
+
+/* Host: write the paths to the file (an order file for mkext2) */
+int myst_layout_profile_write(const char* path);
+
+struct myst_fs;
+struct myst_file;
+
+/* Kernel: profile the files opened on this file system (the rootfs) */
+int myst_layout_profile_set_fs(struct myst_fs* fs);
+
+/* Kernel: record the file just opened (if profiling its file system) */
+void myst_layout_profile_record(struct myst_fs* fs, struct myst_file* file);
+
+#endif /* _MYST_LAYOUTPROFILE_H */
@@ -0,0 +1,30 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_LIBPREFETCH_H
+#define _MYST_LIBPREFETCH_H
+
+#include <myst/types.h>
+
+/* The most execs waiting for the prefetch thread (see --prefetch-libs) */
+#define MYST_LIB_PREFETCH_QUEUE_SIZE 16
+
+/* The most shared libraries prefetched for one exec */
+#define MYST_LIB_PREFETCH_MAX_LIBS 256
+
+/* The bytes read from a library at once */
+#define MYST_LIB_PREFETCH_CHUNK_SIZE (64 * 1024)
+
+/* Start the prefetch thread if --prefetch-libs was given */
+int myst_start_lib_prefetcher(void);
+
+/* Stop the prefetch thread (dropping the execs it has not reached) */
+void myst_stop_lib_prefetcher(void);
+
+/* Queue the shared libraries that the program at path needs (DT_NEEDED,
+ * found as the dynamic loader would with the LD_LIBRARY_PATH of envp) for
+ * the prefetch thread, which reads them into the file system caches. Does
+ * nothing unless the thread is running (or if the queue is full). */
+void myst_prefetch_libs(const char* path, size_t envc, const char* envp[]);
+
+#endif /* _MYST_LIBPREFETCH_H */
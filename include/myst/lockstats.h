@@ -0,0 +1,109 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_LOCKSTATS_H
+#define _MYST_LOCKSTATS_H
+
+#include <myst/buf.h>
+#include <myst/defs.h>
+#include <myst/spinlock.h>
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** Lock statistics (make MYST_ENABLE_LOCK_STATS=1).
+**
+**     In this build, each call in the kernel that locks a spinlock, a ticket
+**     lock or a mutex goes through a wrapper that counts the acquisitions at
+**     that call site, how many of them found the lock held, how long they
+**     waited for it and the longest time the lock was then held. Sites sit
+**     in static storage and add themselves to a list on first use, so counting
+**     allocates nothing. The statistics are read from /proc/myst/locks and
+**     printed at exit.
+**
+**     Times come from CLOCK_MONOTONIC (rdtsc traps in SGX1 enclaves), so they
+**     include the cost of reading the clock. Uncontended acquisitions only
+**     read it to measure the hold time.
+**
+**     The code in mutex.c and lockstats.c defines MYST_NO_LOCK_STATS, since
+**     it implements the locks that are counted.
+**
+**==============================================================================
+*/
+
+typedef enum myst_lock_kind
+{
+    MYST_LOCK_SPIN,
+    MYST_LOCK_TICKET,
+    MYST_LOCK_MUTEX,
+} myst_lock_kind_t;
+
+typedef struct myst_lock_site
+{
+    struct myst_lock_site* next;
+    const char* file;
+    const char* func;
+    uint32_t line;
+    uint32_t kind;
+    uint32_t registered;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_nsec;
+    uint64_t max_hold_nsec;
+} myst_lock_site_t;
+
+struct _myst_mutex;
+
+void myst_lockstats_spin_lock(myst_spinlock_t* s, myst_lock_site_t* site);
+
+void myst_lockstats_spin_unlock(myst_spinlock_t* s);
+
+void myst_lockstats_ticket_lock(myst_ticketlock_t* t, myst_lock_site_t* site);
+
+bool myst_lockstats_ticket_trylock(
+    myst_ticketlock_t* t,
+    myst_lock_site_t* site);
+
+void myst_lockstats_ticket_unlock(myst_ticketlock_t* t);
+
+int myst_lockstats_mutex_lock(struct _myst_mutex* m, myst_lock_site_t* site);
+
+int myst_lockstats_mutex_trylock(
+    struct _myst_mutex* m,
+    myst_lock_site_t* site);
+
+int myst_lockstats_mutex_unlock(struct _myst_mutex* m);
+
+/* Format the sites as a table, in decreasing order of wait time */
+int myst_format_lock_stats(myst_buf_t* buf);
+
+/* Print the table to stderr */
+void myst_dump_lock_stats(void);
+
+#define MYST_LOCK_SITE(KIND)                                       \
+    ({                                                             \
+        static myst_lock_site_t _myst_lock_site = {                \
+            .file = __FILE__, .func = __func__, .line = __LINE__, \
+            .kind = KIND};                                         \
+        &_myst_lock_site;                                          \
+    })
+
+#if defined(MYST_ENABLE_LOCK_STATS) && !defined(MYST_NO_LOCK_STATS)
+
+#define myst_spin_lock(S) \
+    myst_lockstats_spin_lock(S, MYST_LOCK_SITE(MYST_LOCK_SPIN))
+
+#define myst_spin_unlock(S) myst_lockstats_spin_unlock(S)
+
+#define myst_ticket_lock(T) \
+    myst_lockstats_ticket_lock(T, MYST_LOCK_SITE(MYST_LOCK_TICKET))
+
+#define myst_ticket_trylock(T) \
+    myst_lockstats_ticket_trylock(T, MYST_LOCK_SITE(MYST_LOCK_TICKET))
+
+#define myst_ticket_unlock(T) myst_lockstats_ticket_unlock(T)
+
+#endif
+
+#endif /* _MYST_LOCKSTATS_H */
@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_LOOPBACK_H
+#define _MYST_LOOPBACK_H
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/*
+**==============================================================================
+**
+** The enclave loopback (enabled with --enclave-loopback).
+**
+**     TCP and UDP sockets bound to a loopback address (127.0.0.0/8 or ::1)
+**     are served by the in-kernel socket device (see myst/unixdev.h), so
+**     traffic between the processes of the enclave never reaches the host,
+**     neither as OCALLs nor in plaintext. A socket starts on the host as
+**     usual and moves into the kernel when it binds to a loopback address,
+**     or when it connects or sends to a loopback address that an enclave
+**     socket is bound to. Other loopback traffic still goes to the host.
+**
+**     A socket that moves keeps its file descriptor, O_NONBLOCK and
+**     FD_CLOEXEC, but not other options set before the move. Duplicates
+**     and epoll registrations made before the move refer to the host socket.
+**
+**==============================================================================
+*/
+
+bool myst_loopback_address(const struct sockaddr* addr, socklen_t addrlen);
+
+/* These return -ENOTSUP when the host socket should handle the call */
+
+long myst_loopback_bind(
+    int sockfd,
+    const struct sockaddr* addr,
+    socklen_t addrlen);
+
+long myst_loopback_connect(
+    int sockfd,
+    const struct sockaddr* addr,
+    socklen_t addrlen);
+
+long myst_loopback_sendto(
+    int sockfd,
+    const void* buf,
+    size_t len,
+    int flags,
+    const struct sockaddr* dest_addr,
+    socklen_t addrlen);
+
+long myst_loopback_sendmsg(int sockfd, const struct msghdr* msg, int flags);
+
+#endif /* _MYST_LOOPBACK_H */
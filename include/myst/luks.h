@@ -4,10 +4,12 @@
 #ifndef _MYST_LUKS_H
 #define _MYST_LUKS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define LUKS_SALT_SIZE 32
 #define LUKS_SECTOR_SIZE 512
+#define LUKS_MAX_SECTOR_SIZE 4096
 #define LUKS_MAGIC_SIZE 6
 #define LUKS_CIPHER_NAME_SIZE 32
 #define LUKS_CIPHER_MODE_SIZE 32
@@ -39,9 +41,16 @@ typedef struct
     uint32_t mk_digest_iter;
     char uuid[LUKS_UUID_STRING_SIZE];
     luks_keyslot_t slots[LUKS_SLOTS_SIZE];
+
+    /* The fields above are those of the LUKS1 header (a LUKS2 header is
+     * converted to them) and those below are set when a header is read */
+
+    /* bytes encrypted with each IV (zero for LUKS_SECTOR_SIZE); the sector
+     * numbers passed below count sectors of this size */
+    uint32_t sector_size;
 } luks_phdr_t;
 
-_Static_assert(sizeof(luks_phdr_t) == 592, "");
+_Static_assert(offsetof(luks_phdr_t, sector_size) == 592, "");
 
 int myst_luks_encrypt(
     const luks_phdr_t* phdr,
@@ -0,0 +1,43 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_LZ_H
+#define _MYST_LZ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+**==============================================================================
+**
+** A small LZ77 block codec (in the manner of the LZ4 block format).
+**
+**     The compressed data is a series of sequences, each of which is a token
+**     byte (the literal count in the upper four bits and the match length,
+**     less four, in the lower four), any extra literal count bytes, the
+**     literals, a little-endian 16-bit match offset and any extra match
+**     length bytes. A count of 15 in the token is continued by bytes that are
+**     added to it (up to the first byte that is less than 255). The last
+**     sequence has literals only. Decompression checks every length and
+**     offset, so malformed input fails rather than overruns a buffer.
+**
+**==============================================================================
+*/
+
+/* Compress in[] into out[] and return the compressed size, or -ENOSPC if
+ * the result would not fit in out_size bytes */
+ssize_t myst_lz_compress(
+    const void* in,
+    size_t in_size,
+    void* out,
+    size_t out_size);
+
+/* Decompress in[] into out[] and return the decompressed size, or -EINVAL
+ * if the data is malformed or would not fit in out_size bytes */
+ssize_t myst_lz_decompress(
+    const void* in,
+    size_t in_size,
+    void* out,
+    size_t out_size);
+
+#endif /* _MYST_LZ_H */
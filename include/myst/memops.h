@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_MEMOPS_H
+#define _MYST_MEMOPS_H
+
+#include <myst/defs.h>
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** Vector and string-instruction versions of memcpy(), memset(), memcmp() and
+** strlen() for the kernel libc, which picks one per size once it knows the
+** CPU features (see myst_init_memops()).
+**
+**     The SSE2 versions need nothing beyond x86-64. The others need their
+**     cpuid bit and, for the vector registers, the state enabled in XCR0
+**     (for an enclave, its XFRM attributes). The code is inline assembly, so
+**     it builds without -mavx2 and the compiler never uses the registers on
+**     its own.
+**
+**     Each copy or fill needs at least one vector of bytes (16, 32 or 64),
+**     since it finishes with one overlapping vector at the end.
+**
+**==============================================================================
+*/
+
+#define MYST_MEMOPS_ERMS (1 << 0)   /* fast rep movsb and rep stosb */
+#define MYST_MEMOPS_FSRM (1 << 1)   /* fast rep movsb for short copies */
+#define MYST_MEMOPS_AVX2 (1 << 2)   /* with the ymm state enabled */
+#define MYST_MEMOPS_AVX512 (1 << 3) /* AVX512F with the zmm state enabled */
+
+/* The size from which rep movsb and rep stosb beat the vector loops (even
+ * with FSRM, the AVX-512 loop is faster below this; see tests/memops) */
+#define MYST_MEMOPS_ERMS_THRESHOLD 2048
+
+/* Read the features of this CPU (MYST_MEMOPS_*) */
+uint32_t myst_memops_detect(void);
+
+void myst_memcpy_erms(void* dest, const void* src, size_t n);
+
+void myst_memcpy_sse2(void* dest, const void* src, size_t n);
+
+void myst_memcpy_avx2(void* dest, const void* src, size_t n);
+
+void myst_memcpy_avx512(void* dest, const void* src, size_t n);
+
+void myst_memset_erms(void* s, int c, size_t n);
+
+void myst_memset_sse2(void* s, int c, size_t n);
+
+void myst_memset_avx2(void* s, int c, size_t n);
+
+void myst_memset_avx512(void* s, int c, size_t n);
+
+/* The offset of the first byte that differs (n if none) */
+size_t myst_mismatch_sse2(const void* s1, const void* s2, size_t n);
+
+size_t myst_mismatch_avx2(const void* s1, const void* s2, size_t n);
+
+/* These read whole aligned vectors, so never cross into an unmapped page */
+size_t myst_strlen_sse2(const char* s);
+
+size_t myst_strlen_avx2(const char* s);
+
+/* The size from which myst_memset_nt() and myst_memcpy_nt() bypass the
+ * caches (about the L2 size, beyond which a fill would evict it anyway) */
+#define MYST_MEMOPS_NT_THRESHOLD (1024 * 1024)
+
+/* For large buffers that will not be read soon (scrubbing, zero-filling and
+ * bulk copies): the stores go straight to memory instead of evicting the
+ * working set from the caches. Below MYST_MEMOPS_NT_THRESHOLD these are
+ * memset() and memcpy(). The copy must not overlap. */
+void myst_memset_nt(void* s, int c, size_t n);
+
+void myst_memcpy_nt(void* dest, const void* src, size_t n);
+
+MYST_INLINE void myst_memzero_nt(void* s, size_t n)
+{
+    myst_memset_nt(s, 0, n);
+}
+
+/* Kernel: choose the versions that the kernel libc uses */
+void myst_init_memops(void);
+
+/* Kernel: the features chosen (MYST_MEMOPS_*) */
+uint32_t myst_get_memops(void);
+
+#endif /* _MYST_MEMOPS_H */
@@ -19,6 +19,10 @@
 #define MYST_MAP_FIXED 16
 #define MYST_MAP_ANONYMOUS 32
 
+/* VAD flag: mremap() has grown the mapping, so the gap after it is kept for
+ * growing it again where possible (see myst_mman_mremap()) */
+#define MYST_MAP_GROWING 0x8000
+
 #define MYST_MREMAP_MAYMOVE 1
 
 #define MYST_MMAN_ERROR_SIZE 256
@@ -32,6 +36,12 @@ typedef struct myst_vad
     /* Pointer to previous myst_vad_t on linked list */
     struct myst_vad* prev;
 
+    /* Pointer to left child in the VAD tree (lower addresses) */
+    struct myst_vad* left;
+
+    /* Pointer to right child in the VAD tree (higher addresses) */
+    struct myst_vad* right;
+
     /* Address of this memory region */
     uintptr_t addr;
 
@@ -43,9 +53,75 @@ typedef struct myst_vad
 
     /* Mapping flags for this region: MYST_MAP_???? */
     uint16_t flags;
+
+    /* Largest right gap (in pages) of any VAD in this subtree */
+    uint32_t max_gap;
+
+    /* Height of the subtree rooted at this VAD (leaves have height 1) */
+    uint32_t height;
 } myst_vad_t;
 
-_Static_assert(sizeof(myst_vad_t) == 32, "");
+_Static_assert(sizeof(myst_vad_t) == 56, "");
+
+/* Number of allocation arenas (see myst_mman_arena_mmap()) */
+#define MYST_MMAN_NUM_ARENAS 16
+
+/* Number of pages reserved by each arena */
+#define MYST_MMAN_ARENA_PAGES 256
+
+/* Largest mapping (in pages) that is served from an arena */
+#define MYST_MMAN_ARENA_MAX_PAGES 16
+
+/* A chunk of mapped memory from which small mappings are carved */
+typedef struct myst_mman_arena
+{
+    /* Protects the fields below (acquired before the mman lock) */
+    myst_spinlock_t lock;
+
+    /* Base address of the reserved chunk (zero if none) */
+    uintptr_t base;
+
+    /* Number of pages in the chunk that are not handed out */
+    size_t nfree;
+
+    /* One bit per page of the chunk (set if the page is handed out) */
+    uint8_t bits[MYST_MMAN_ARENA_PAGES / 8];
+} myst_mman_arena_t;
+
+/* Mappings of up to MYST_MMAN_SMALL_MAP bytes prefer the gaps between VADs
+ * that are smaller than MYST_MMAN_LARGE_GAP, so that the large gaps are
+ * left whole for large mappings (see _mman_find_gap()) */
+#define MYST_MMAN_SMALL_MAP (64 * 1024)
+#define MYST_MMAN_LARGE_GAP (1024 * 1024)
+
+/* The most VADs visited looking for a small gap */
+#define MYST_MMAN_SMALL_GAP_SEARCH 64
+
+/* The buckets of the gap histogram (see myst_mman_stats_t) */
+#define MYST_MMAN_GAP_BUCKETS 8
+
+/* Maximum number of unmapped ranges awaiting a deferred scrub */
+#define MYST_MMAN_MAX_DIRTY 64
+
+/* Maximum bytes of deferred scrubbing performed by each mapping operation */
+#define MYST_MMAN_SCRUB_STEP (64 * 1024)
+
+/* A range of unmapped memory that has not been scrubbed yet */
+typedef struct myst_mman_range
+{
+    uintptr_t addr;
+    size_t size;
+} myst_mman_range_t;
+
+/* Granularity with which memory is committed on demand */
+#define MYST_MMAN_COMMIT_CHUNK (2 * 1024 * 1024)
+
+/* Commits (or decommits) a page-aligned range (see myst_mman_set_commit()) */
+typedef int (*myst_mman_commit_t)(
+    void* addr,
+    size_t size,
+    bool commit,
+    void* arg);
 
 #define MYST_MMAN_MAGIC 0xcc8e1732ebd80b0b
 
@@ -90,14 +166,38 @@ typedef struct myst_mman
     /* Linked list of VADs (sorted by address and doubly linked) */
     myst_vad_t* vad_list;
 
+    /* Root of the AVL tree of VADs (keyed by address, augmented by gaps) */
+    myst_vad_t* vad_tree;
+
     /* Whether sanity checks are enabled: see MYST_HeapEnableSanityChecks() */
     bool sanity;
 
     /* Whether to scrub memory when it is unmapped (fill with 0xDD) */
     bool scrub;
 
-    /* Heap locking */
-    myst_spinlock_t lock;
+    /* Whether scrubbing is deferred and amortized over later operations */
+    bool defer_scrub;
+
+    /* Unmapped ranges waiting to be scrubbed (when defer_scrub is true) */
+    myst_mman_range_t dirty[MYST_MMAN_MAX_DIRTY];
+    size_t num_dirty;
+
+    /* Commits memory on demand (null if all memory is committed upfront) */
+    myst_mman_commit_t commit;
+    void* commit_arg;
+
+    /* Committed memory is [START, brk_commit) and [map_commit, END) */
+    uintptr_t brk_commit;
+    uintptr_t map_commit;
+
+    /* Heap locking (a fair lock since every mapping contends for it) */
+    myst_ticketlock_t lock;
+
+    /* Whether small mappings are served from arenas */
+    bool arenas_enabled;
+
+    /* Arenas selected by key (see myst_mman_arena_mmap()) */
+    myst_mman_arena_t arenas[MYST_MMAN_NUM_ARENAS];
 
     /* Error string */
     char err[MYST_MMAN_ERROR_SIZE];
@@ -114,6 +214,14 @@ int myst_mman_mmap(
     int flags,
     void** ptr);
 
+int myst_mman_arena_mmap(
+    myst_mman_t* mman,
+    uint64_t key,
+    size_t length,
+    int prot,
+    int flags,
+    void** ptr);
+
 int myst_mman_mremap(
     myst_mman_t* heap,
     void* addr,
@@ -134,10 +242,64 @@ void myst_mman_set_sanity(myst_mman_t* heap, bool sanity);
 
 bool myst_mman_is_sane(myst_mman_t* heap);
 
+int myst_mman_set_commit(
+    myst_mman_t* mman,
+    myst_mman_commit_t commit,
+    void* commit_arg);
+
+void myst_mman_set_arenas(myst_mman_t* mman, bool enable);
+
+void myst_mman_set_defer_scrub(myst_mman_t* mman, bool defer);
+
+size_t myst_mman_scrub(myst_mman_t* mman, size_t max_bytes);
+
+void myst_mman_release_arenas(myst_mman_t* mman);
+
 int myst_mman_total_size(myst_mman_t* mman, size_t* size);
 
 int myst_mman_free_size(myst_mman_t* mman, size_t* size);
 
+typedef struct myst_mman_stats
+{
+    /* The break memory partition [start, brk) */
+    uintptr_t start;
+    uintptr_t brk;
+
+    /* The number of VADs and the bytes they map */
+    size_t count;
+    size_t mapped;
+
+    /* The bytes that are committed (used and reserved memory) */
+    size_t committed;
+
+    /* The largest free range (the largest mapping that would succeed) */
+    size_t largest_free;
+
+    /* The free range between the break and the lowest mapping, which both
+     * grow into */
+    size_t unassigned;
+
+    /* The free ranges between mappings: bucket i counts those of up to
+     * PAGE_SIZE << (2 * i) bytes (and the last bucket the larger ones) */
+    size_t gaps;
+    size_t gap_histogram[MYST_MMAN_GAP_BUCKETS];
+} myst_mman_stats_t;
+
+int myst_mman_stats(myst_mman_t* mman, myst_mman_stats_t* stats);
+
+/* Whether [addr:addr+length) lies in the break memory or in mappings (with
+ * no gaps between them) */
+bool myst_mman_is_mapped(myst_mman_t* mman, const void* addr, size_t length);
+
+/* Copy up to count VADs (sorted by address) that end above addr, in which
+ * the list and tree links are null, and return the number copied. The VADs
+ * are copied because formatting them may allocate (and so call into mman) */
+size_t myst_mman_get_vads(
+    myst_mman_t* mman,
+    uintptr_t addr,
+    myst_vad_t* vads,
+    size_t count);
+
 void myst_mman_dump_vads(myst_mman_t* mman);
 
 #endif /* _MYST_INTERNAL_MMAN_H */
@@ -34,12 +34,21 @@ int myst_get_total_ram(size_t* size);
 
 int myst_get_free_ram(size_t* size);
 
+/* The accounting and the VADs of the kernel's mman (see mman.h) */
+int myst_get_mman_stats(myst_mman_stats_t* stats);
+
+size_t myst_get_vads(uintptr_t addr, myst_vad_t* vads, size_t count);
+
 int myst_register_process_mapping(pid_t pid, void* addr, size_t size);
 
 int myst_release_process_mappings(pid_t pid);
 
 int myst_msync(void* addr, size_t length, int flags);
 
-void myst_mman_close_notify(int fd);
+int myst_madvise(void* addr, size_t length, int advice);
+
+int myst_mincore(void* addr, size_t length, unsigned char* vec);
+
+void myst_msync_release_process(pid_t pid);
 
 #endif /* _MYST_MMANUTILS_H */
@@ -5,6 +5,7 @@
 #define _MYST_MOUNT_H
 
 #include <limits.h>
+#include <myst/buf.h>
 #include <myst/fs.h>
 
 /* Mount a file system onto a target path */
@@ -16,4 +17,8 @@ int myst_umount(const char* target);
 /* Use mounter to resolve this path to a target path */
 int myst_mount_resolve(const char* path, char suffix[PATH_MAX], myst_fs_t** fs);
 
+/* Format the mount table as /proc/[pid]/mountinfo (the type of each file
+ * system is named after the f_type that its statfs() reports) */
+int myst_format_mountinfo(myst_buf_t* buf);
+
 #endif /* _MYST_MOUNT_H */
@@ -10,16 +10,29 @@
 #include <myst/spinlock.h>
 #include <myst/thread.h>
 
+/* Default number of spins before a contended lock parks the caller */
+#define MYST_MUTEX_SPIN 256
+
 typedef struct _myst_mutex myst_mutex_t;
 
 struct _myst_mutex
 {
     myst_spinlock_t lock;
+    /* spin budget (zero selects MYST_MUTEX_SPIN) */
+    uint32_t spin;
     uint64_t refs;
     myst_thread_t* owner;
     myst_thread_queue_t queue;
 };
 
+typedef struct myst_mutex_stats
+{
+    /* contended locks obtained by spinning */
+    size_t spins;
+    /* waits on the host (each one is an OCALL) */
+    size_t parks;
+} myst_mutex_stats_t;
+
 int myst_mutex_init(myst_mutex_t* mutex);
 
 int myst_mutex_lock(myst_mutex_t* mutex);
@@ -30,10 +43,27 @@ int myst_mutex_unlock(myst_mutex_t* mutex);
 
 int myst_mutex_destroy(myst_mutex_t* mutex);
 
+/* Set the spin budget of this mutex (1 effectively disables spinning) */
+void myst_mutex_set_spin(myst_mutex_t* mutex, uint32_t spin);
+
+void myst_mutex_get_stats(myst_mutex_stats_t* stats);
+
 myst_thread_t* myst_mutex_owner(myst_mutex_t* m);
 
 int __myst_mutex_trylock(myst_mutex_t* m, myst_thread_t* self);
 
 int __myst_mutex_unlock(myst_mutex_t* mutex, myst_thread_t** waiter);
 
+#if defined(MYST_ENABLE_LOCK_STATS) && !defined(MYST_NO_LOCK_STATS)
+
+#define myst_mutex_lock(M) \
+    myst_lockstats_mutex_lock(M, MYST_LOCK_SITE(MYST_LOCK_MUTEX))
+
+#define myst_mutex_trylock(M) \
+    myst_lockstats_mutex_trylock(M, MYST_LOCK_SITE(MYST_LOCK_MUTEX))
+
+#define myst_mutex_unlock(M) myst_lockstats_mutex_unlock(M)
+
+#endif
+
 #endif /* _MYST_MUTEX_H */
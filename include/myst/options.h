@@ -14,9 +14,46 @@ typedef struct myst_options
     bool trace_syscalls;
     bool have_syscall_instruction;
     bool export_ramfs;
+    bool export_ramfs_changed;
+    bool export_gcov;
+    bool syscall_stats;
+    bool profile; /* sample syscall entries and exits (see myst/profile.h) */
+    size_t max_pipe_size; /* zero selects MYST_PIPE_MAX_SIZE */
+    bool enclave_loopback;
+    bool host_sendfile; /* see myst_syscall_sendfile() */
+    bool async_close;   /* see myst/hostclose.h */
+    bool prefetch_libs; /* see myst/libprefetch.h */
+    bool kernel_tls;    /* see myst/ktls.h */
+    size_t socket_prefetch_size; /* zero disables the prefetch buffer */
+    size_t accept_batch;         /* zero or one disables accept batching */
+    size_t busy_poll_usec;       /* see myst/pollq.h (zero disables it) */
+    size_t crypto_threads;       /* see myst/workers.h (zero for none) */
+    int console_buffering;       /* see myst/console.h */
+    /* seconds to reuse attestation evidence (see myst/attest.h) */
+    size_t attestation_cache_ttl;
     char rootfs[PATH_MAX];
+    char verity_node_cache[PATH_MAX]; /* see myst_save_verity_nodes() */
 } myst_options_t;
 
 extern myst_options_t __options;
 
+/* A kernel built for one target (make MYST_KERNEL_TARGET=sgx or linux, see
+ * kernel/Makefile) knows whether the syscall instruction works, so its hot
+ * paths test a constant; the generic kernel tests the option. */
+#if defined(MYST_KERNEL_TARGET_LINUX)
+#define MYST_HAVE_SYSCALL_INSTRUCTION true
+#elif defined(MYST_KERNEL_TARGET_SGX)
+#define MYST_HAVE_SYSCALL_INSTRUCTION false
+#else
+#define MYST_HAVE_SYSCALL_INSTRUCTION (__options.have_syscall_instruction)
+#endif
+
+/* Syscall tracing (--strace) is compiled out of MYST_KERNEL_NO_TRACE kernels
+ * (the SGX kernel of release builds) */
+#ifdef MYST_KERNEL_NO_TRACE
+#define MYST_TRACE_SYSCALLS false
+#else
+#define MYST_TRACE_SYSCALLS (__options.trace_syscalls)
+#endif
+
 #endif /* _MYST_OPTIONS_H */
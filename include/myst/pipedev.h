@@ -4,6 +4,8 @@
 #ifndef _MYST_PIPEDEV_H
 #define _MYST_PIPEDEV_H
 
+#include <limits.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -14,6 +16,24 @@ typedef struct myst_pipedev myst_pipedev_t;
 
 typedef struct myst_pipe myst_pipe_t;
 
+/* Capacity of a new pipe (the buffer itself only grows as it fills) */
+#define MYST_PIPE_DEFAULT_SIZE (16 * PIPE_BUF)
+
+/* Largest capacity F_SETPIPE_SZ may set unless --max-pipe-size says so */
+#define MYST_PIPE_MAX_SIZE (1024 * 1024)
+
+/* flags for pd_splice_read() and pd_splice_write() */
+#define MYST_PIPE_PEEK 1     /* leave the bytes in the pipe (for tee) */
+#define MYST_PIPE_NONBLOCK 2 /* do not block on the pipe (SPLICE_F_NONBLOCK) */
+
+/* Take up to n bytes straight from the pipe buffer; returns the number of
+ * bytes taken or a negative errno */
+typedef ssize_t (*myst_pipe_consume_t)(void* arg, const void* data, size_t n);
+
+/* Put up to n bytes straight into the pipe buffer; returns the number of
+ * bytes stored (zero at end of input) or a negative errno */
+typedef ssize_t (*myst_pipe_produce_t)(void* arg, void* space, size_t n);
+
 struct myst_pipedev
 {
     myst_fdops_t fdops;
@@ -71,8 +91,31 @@ struct myst_pipedev
     int (*pd_target_fd)(myst_pipedev_t* pipedev, myst_pipe_t* pipe);
 
     int (*pd_get_events)(myst_pipedev_t* pipedev, myst_pipe_t* pipe);
+
+    /* Move the bytes that are available (waiting for some unless non-block)
+     * from the pipe to consume() without an intermediate buffer */
+    ssize_t (*pd_splice_read)(
+        myst_pipedev_t* pipedev,
+        myst_pipe_t* pipe,
+        myst_pipe_consume_t consume,
+        void* arg,
+        size_t count,
+        int flags);
+
+    /* Fill the free space of the pipe (waiting for some unless non-block)
+     * from produce() without an intermediate buffer */
+    ssize_t (*pd_splice_write)(
+        myst_pipedev_t* pipedev,
+        myst_pipe_t* pipe,
+        myst_pipe_produce_t produce,
+        void* arg,
+        size_t count,
+        int flags);
 };
 
 myst_pipedev_t* myst_pipedev_get(void);
 
+/* return true if both are ends of the same pipe */
+bool myst_pipe_same(const myst_pipe_t* pipe1, const myst_pipe_t* pipe2);
+
 #endif /* _MYST_PIPEDEV_H */
@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_POLLQ_H
+#define _MYST_POLLQ_H
+
+#include <myst/defs.h>
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** myst_pollq_t: the queue of poll() and epoll_wait() callers waiting on a
+** kernel object.
+**
+**     A kernel object (such as a pipe) embeds a poll queue and notifies it
+**     whenever its poll events may have changed. Waiters subscribe to the
+**     queues of the objects they are interested in, so a notification wakes
+**     only those waiters. Notifying a queue with no subscribers costs a
+**     single atomic load and never leaves the kernel.
+**
+**     A waiter that only waits on kernel objects sleeps on its own thread
+**     event. A waiter that is also blocked in a host poll (because it waits
+**     on host file descriptors too) is woken with myst_tcall_poll_wake().
+**
+**     A waiter may subscribe exclusively (for EPOLLEXCLUSIVE). Each
+**     notification wakes every other waiter but only one of the exclusive
+**     waiters that are asleep, so a thundering herd of epoll_wait() callers
+**     on one listening socket or pipe wakes one thread per event.
+**
+**==============================================================================
+*/
+
+struct myst_thread;
+
+typedef struct myst_poller
+{
+    struct myst_thread* thread;
+    volatile int woken; /* set by the first notification */
+    bool host;          /* the waiter is blocked in a host poll */
+} myst_poller_t;
+
+typedef struct myst_pollq_link
+{
+    struct myst_pollq_link* prev;
+    struct myst_pollq_link* next;
+    struct myst_pollq* pollq; /* null once unsubscribed or destroyed */
+    myst_poller_t* poller;
+    bool exclusive; /* woken only if no other exclusive waiter is */
+} myst_pollq_link_t;
+
+typedef struct myst_pollq
+{
+    myst_pollq_link_t* head;
+
+    /* incremented by every notification (used for EPOLLET) */
+    volatile uint64_t generation;
+} myst_pollq_t;
+
+void myst_poller_init(myst_poller_t* poller, bool host);
+
+/* Wait up to timeout milliseconds (-1 for no limit) for a notification;
+ * returns -ETIMEDOUT on timeout and may return 0 early, so callers recheck */
+int myst_poller_wait(myst_poller_t* poller, int timeout);
+
+void myst_pollq_subscribe(
+    myst_pollq_t* pollq,
+    myst_pollq_link_t* link,
+    myst_poller_t* poller);
+
+/* Subscribe so that a notification wakes at most one exclusive waiter */
+void myst_pollq_subscribe_exclusive(
+    myst_pollq_t* pollq,
+    myst_pollq_link_t* link,
+    myst_poller_t* poller);
+
+void myst_pollq_unsubscribe(myst_pollq_link_t* link);
+
+/* Wake the waiters on this queue, but only one exclusive waiter (call after
+ * the object state changes) */
+void myst_pollq_notify(myst_pollq_t* pollq);
+
+/* Wake and detach all waiters (call before the object is freed) */
+void myst_pollq_destroy(myst_pollq_t* pollq);
+
+/* Turn a poll() timeout in milliseconds into a monotonic deadline */
+long myst_poll_deadline(int timeout);
+
+/*
+** Busy polling (--busy-poll and SO_BUSY_POLL): a caller about to block on
+** host file descriptors first probes them without blocking for up to a
+** budget of microseconds. An event that arrives meanwhile is then seen
+** without the host wait, context switch and enclave re-entry of a blocking
+** OCALL, at the cost of a busy CPU.
+*/
+
+/* The busy-poll deadline for a budget of usec microseconds */
+long myst_busy_poll_deadline(unsigned int usec);
+
+/* Pause briefly and return whether to probe again before the deadline */
+bool myst_busy_poll_again(long deadline);
+
+/* The part of a poll() timeout left before its deadline (or the timeout
+ * itself if it is zero or negative) */
+int myst_poll_remaining(int timeout, long deadline);
+
+MYST_INLINE uint64_t myst_pollq_generation(const myst_pollq_t* pollq)
+{
+    return __atomic_load_n(&pollq->generation, __ATOMIC_ACQUIRE);
+}
+
+#endif /* _MYST_POLLQ_H */
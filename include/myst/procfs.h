@@ -22,6 +22,10 @@ int procfs_setup();
 
 int procfs_teardown();
 
+/* Create the generated /proc/[pid] files (stat, statm, status, maps, cgroup
+ * and mountinfo) */
+int procfs_pid_setup(pid_t pid);
+
 /* Cleanup /proc/[pid] entries */
 int procfs_pid_cleanup(pid_t pid);
 
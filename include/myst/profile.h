@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_PROFILE_H
+#define _MYST_PROFILE_H
+
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** The sampling profiler (--profile).
+**
+**     The host allocates the profile in its own memory and passes it to the
+**     kernel (through myst_shm for SGX, which accepts it only in debug
+**     mode). A kernel timer advances a tick count every interval. Each
+**     thread takes a sample when it enters a syscall (charging the ticks
+**     since it last left the kernel to the user stack) and when it leaves
+**     one (charging the ticks spent in the syscall, under its name). A
+**     sample is the frame-pointer backtrace of the thread, which runs
+**     through the kernel into the C runtime and the program, weighted by
+**     those ticks. Samples collect in a small per-thread ring and are
+**     copied to the profile when it fills or the thread exits.
+**
+**     The host symbolizes the return addresses with the symbol files it is
+**     given for gdb (see myst_tcall_add_symbol_file()) and with the kernel
+**     image, then writes them out as folded stacks for flame graphs.
+**
+**     Code that makes no syscalls between two ticks is not interrupted: its
+**     ticks go to the stack of the next syscall it makes.
+**
+**==============================================================================
+*/
+
+#define MYST_PROFILE_MAX_SAMPLES 32768
+
+#define MYST_PROFILE_MAX_FRAMES 30
+
+#define MYST_PROFILE_INTERVAL_NSEC 1000000 /* one millisecond */
+
+typedef struct myst_profile_sample
+{
+    uint32_t tid;
+
+    /* the ticks charged to this stack */
+    uint32_t weight;
+
+    /* the syscall for time in the kernel (empty for time in user code) */
+    char syscall[24];
+
+    /* return addresses, innermost first */
+    uint64_t nframes;
+    uint64_t frames[MYST_PROFILE_MAX_FRAMES];
+} myst_profile_sample_t;
+
+typedef struct myst_profile
+{
+    /* the kernel image, as loaded (written by the kernel) */
+    uint64_t kernel_base;
+    uint64_t kernel_size;
+
+    /* the number of samples in use (only the kernel writes this) */
+    uint64_t nsamples;
+
+    /* the number of samples that did not fit */
+    uint64_t dropped;
+
+    myst_profile_sample_t samples[MYST_PROFILE_MAX_SAMPLES];
+} myst_profile_t;
+
+/* Host: start profiling (the kernel gets the returned profile) */
+myst_profile_t* myst_profile_start(void);
+
+/* Host: the profile (null unless started) */
+myst_profile_t* myst_profile_get(void);
+
+/* Host: keep the symbols of an ELF image loaded at text (if profiling) */
+int myst_profile_add_symbols(
+    const void* file_data,
+    size_t file_size,
+    const void* text,
+    size_t text_size);
+
+/* Host: write the samples to the file as folded stacks */
+int myst_profile_write(const char* path);
+
+struct myst_thread;
+
+/* Kernel: start the sampling timer (if the host passed a profile) */
+int myst_profile_start_sampling(void);
+
+/* Kernel: stop the sampling timer (before the timer thread stops) */
+void myst_profile_stop_sampling(void);
+
+/* Kernel: sample the calling thread on syscall entry or exit (syscall is
+ * null on entry) */
+void myst_profile_sample(struct myst_thread* thread, const char* syscall);
+
+/* Kernel: copy the samples of an exiting thread to the profile */
+void myst_profile_release(struct myst_thread* thread);
+
+#endif /* _MYST_PROFILE_H */
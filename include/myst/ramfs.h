@@ -12,17 +12,50 @@ int myst_init_ramfs(
     myst_mount_resolve_callback_t resolve_cb,
     myst_fs_t** fs_out);
 
+/* The f_type that statfs() reports for a ramfs (RAMFS_MAGIC on Linux) */
+#define MYST_RAMFS_TYPE 0x858458f6
+
+/* The f_types of the file systems that a ramfs stands in for */
+#define MYST_PROC_TYPE 0x9fa0        /* PROC_SUPER_MAGIC */
+#define MYST_SYSFS_TYPE 0x62656572   /* SYSFS_MAGIC */
+#define MYST_CGROUP2_TYPE 0x63677270 /* CGROUP2_SUPER_MAGIC */
+
+/* Report another f_type for a ramfs that stands in for another file system
+ * (such as PROC_SUPER_MAGIC for procfs) */
+int myst_ramfs_set_type(myst_fs_t* fs, long f_type);
+
 int myst_ramfs_set_buf(
     myst_fs_t* fs,
     const char* pathname,
     const void* buf,
     size_t buf_size);
 
+/* Build the tree of a CPIO archive: regular files read the archive data in
+ * place until first changed, so the archive must outlive the file system */
+int myst_ramfs_load_cpio(myst_fs_t* fs, const void* cpio_data, size_t size);
+
+/* Fills buf with the contents of a virtual file (or the target of a virtual
+ * link) each time it is opened; arg is the one given on creation */
+typedef int (*myst_vcallback_t)(myst_buf_t* buf, void* arg);
+
 int myst_create_virtual_file(
     myst_fs_t* fs,
     const char* pathname,
     mode_t mode,
-    int (*vcallback)(myst_buf_t* buf));
+    myst_vcallback_t vcallback,
+    void* arg);
+
+/* Takes the data of each write() to a virtual file (returns zero or -errno,
+ * which the write() returns); arg is the one given on creation */
+typedef int (*myst_vwrite_callback_t)(const void* data, size_t size, void* arg);
+
+/* Create a virtual file that also takes writes (such as a control file) */
+int myst_create_writable_virtual_file(
+    myst_fs_t* fs,
+    const char* pathname,
+    myst_vcallback_t vcallback,
+    myst_vwrite_callback_t vwrite,
+    void* arg);
 
 int myst_release_tree(
     myst_fs_t* fs,
@@ -0,0 +1,53 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_REPLAY_H
+#define _MYST_REPLAY_H
+
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** Syscall replay traces.
+**
+**     "myst decode-trace --replay <file>" turns the syscalls of an event
+**     trace (recorded with --event-trace-categories syscall,args) into this
+**     compact form: a header followed by the calls in the order they were
+**     entered. tests/replay runs such a file against the kernel again,
+**     synthesizing the buffers and the file descriptors of the calls, and
+**     compares the time of each syscall with the recorded one.
+**
+**     The pointer arguments are the addresses of the recording process and
+**     mean nothing to the replayer, which sizes its buffers from the count
+**     arguments (or from the return value, such as for readv()). The file
+**     descriptors are those of the recording process (pid), which the
+**     replayer maps to its own.
+**
+**==============================================================================
+*/
+
+#define MYST_REPLAY_MAGIC 0x594c505254535953 /* "SYSTRPLY" */
+
+#define MYST_REPLAY_VERSION 1
+
+typedef struct myst_replay_header
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t ncalls;
+} myst_replay_header_t;
+
+typedef struct myst_replay_call
+{
+    uint64_t start; /* nanoseconds from the first call */
+    uint64_t nsec;  /* from entry to exit in the kernel */
+    int64_t ret;
+    uint64_t args[6];
+    uint32_t pid; /* zero if the trace lost the start of the thread */
+    uint32_t tid;
+    uint32_t n; /* the syscall number */
+    uint32_t reserved;
+} myst_replay_call_t;
+
+#endif /* _MYST_REPLAY_H */
@@ -0,0 +1,170 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_RWLOCK_H
+#define _MYST_RWLOCK_H
+
+#include <myst/defs.h>
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** myst_rwlock_t: a spinning reader-writer lock for read-mostly data.
+**
+**     Any number of readers may hold the lock at once. A waiting writer sets
+**     the WAITING bit, which keeps new readers out, so writers cannot be
+**     starved by a steady stream of readers.
+**
+**==============================================================================
+*/
+
+#define MYST_RWLOCK_WRITER 0x80000000U
+#define MYST_RWLOCK_WAITING 0x40000000U
+
+typedef struct myst_rwlock
+{
+    /* number of readers plus the WRITER and WAITING bits */
+    volatile uint32_t value;
+} myst_rwlock_t;
+
+#define MYST_RWLOCK_INITIALIZER \
+    {                           \
+        0                       \
+    }
+
+MYST_INLINE void myst_rwlock_rdlock(myst_rwlock_t* rw)
+{
+    const uint32_t mask = MYST_RWLOCK_WRITER | MYST_RWLOCK_WAITING;
+
+    for (;;)
+    {
+        uint32_t v = __atomic_load_n(&rw->value, __ATOMIC_RELAXED);
+
+        if (!(v & mask) &&
+            __atomic_compare_exchange_n(
+                &rw->value,
+                &v,
+                v + 1,
+                true,
+                __ATOMIC_ACQUIRE,
+                __ATOMIC_RELAXED))
+        {
+            return;
+        }
+
+        __asm__ __volatile__("pause" : : : "memory");
+    }
+}
+
+MYST_INLINE void myst_rwlock_rdunlock(myst_rwlock_t* rw)
+{
+    __atomic_fetch_sub(&rw->value, 1, __ATOMIC_RELEASE);
+}
+
+MYST_INLINE void myst_rwlock_wrlock(myst_rwlock_t* rw)
+{
+    for (;;)
+    {
+        uint32_t v = __atomic_load_n(&rw->value, __ATOMIC_RELAXED);
+
+        /* acquire once the readers and the previous writer have left */
+        if ((v & ~MYST_RWLOCK_WAITING) == 0)
+        {
+            if (__atomic_compare_exchange_n(
+                    &rw->value,
+                    &v,
+                    MYST_RWLOCK_WRITER,
+                    true,
+                    __ATOMIC_ACQUIRE,
+                    __ATOMIC_RELAXED))
+            {
+                return;
+            }
+
+            continue;
+        }
+
+        /* the bit is cleared by each acquiring writer, so set it again */
+        if (!(v & MYST_RWLOCK_WAITING))
+        {
+            __atomic_fetch_or(
+                &rw->value, MYST_RWLOCK_WAITING, __ATOMIC_RELAXED);
+        }
+
+        __asm__ __volatile__("pause" : : : "memory");
+    }
+}
+
+/* Take the lock for writing only if nobody holds it; unlike a waiting
+ * myst_rwlock_wrlock() this never keeps new readers out */
+MYST_INLINE bool myst_rwlock_trywrlock(myst_rwlock_t* rw)
+{
+    uint32_t v = __atomic_load_n(&rw->value, __ATOMIC_RELAXED);
+
+    if (v & ~MYST_RWLOCK_WAITING)
+        return false;
+
+    return __atomic_compare_exchange_n(
+        &rw->value,
+        &v,
+        MYST_RWLOCK_WRITER,
+        false,
+        __ATOMIC_ACQUIRE,
+        __ATOMIC_RELAXED);
+}
+
+MYST_INLINE void myst_rwlock_wrunlock(myst_rwlock_t* rw)
+{
+    __atomic_fetch_and(&rw->value, ~MYST_RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
+
+/*
+**==============================================================================
+**
+** myst_seqcount_t: lock-free reads of small, inline records.
+**
+**     Writers (which must already be serialized by a lock) make the count
+**     odd while they update the record. Readers copy the record without
+**     taking any lock and retry if the count was odd or changed meanwhile.
+**     This only suits data that is copied out by value; readers must never
+**     follow pointers into memory that a writer may free.
+**
+**==============================================================================
+*/
+
+typedef struct myst_seqcount
+{
+    volatile uint32_t seq;
+} myst_seqcount_t;
+
+MYST_INLINE uint32_t myst_seqcount_read_begin(const myst_seqcount_t* s)
+{
+    uint32_t seq;
+
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+        __asm__ __volatile__("pause" : : : "memory");
+
+    return seq;
+}
+
+MYST_INLINE bool myst_seqcount_read_retry(
+    const myst_seqcount_t* s,
+    uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq;
+}
+
+MYST_INLINE void myst_seqcount_write_begin(myst_seqcount_t* s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+MYST_INLINE void myst_seqcount_write_end(myst_seqcount_t* s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* _MYST_RWLOCK_H */
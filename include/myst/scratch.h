@@ -0,0 +1,54 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_SCRATCH_H
+#define _MYST_SCRATCH_H
+
+#include <stddef.h>
+
+/*
+**==============================================================================
+**
+** The scratch arena: per-thread memory for the short-lived buffers of a
+** syscall. Blocks are carved from the thread's arena and are released in
+** one step when the syscall returns; blocks that do not fit come from the
+** heap and are released at the same time. Blocks may also be freed earlier
+** with myst_scratch_free(), which reclaims the space if the block is the
+** latest one.
+**
+** Do not keep a block beyond the syscall that allocated it.
+**
+**==============================================================================
+*/
+
+/* Bytes in the arena of each thread (allocated on first use) */
+#define MYST_SCRATCH_SIZE (16 * 1024)
+
+struct myst_thread;
+
+/* The state of the arena when a syscall starts */
+typedef struct myst_scratch_mark
+{
+    size_t used;
+    void* overflow;
+} myst_scratch_mark_t;
+
+/* Allocate SIZE bytes (aligned to 16 bytes) or return NULL */
+void* myst_scratch_alloc(size_t size);
+
+/* Allocate SIZE bytes and zero-fill them */
+void* myst_scratch_calloc(size_t size);
+
+/* Free a block (or leave it to the end of the syscall) */
+void myst_scratch_free(void* ptr);
+
+/* Called on syscall entry and exit: exit frees what the syscall left */
+void myst_scratch_enter(struct myst_thread* thread, myst_scratch_mark_t* mark);
+void myst_scratch_leave(
+    struct myst_thread* thread,
+    const myst_scratch_mark_t* mark);
+
+/* Free the arena of an exiting thread */
+void myst_release_scratch(struct myst_thread* thread);
+
+#endif /* _MYST_SCRATCH_H */
@@ -27,4 +27,15 @@ int myst_sha256_update(myst_sha256_ctx_t* ctx, const void* data, size_t size);
 
 int myst_sha256_finish(myst_sha256_ctx_t* ctx, myst_sha256_t* sha256);
 
+/* Hash count messages of the same size, each the prefix followed by the next
+ * size bytes of data (such as the salted blocks of a verity device), several
+ * at a time when the CPU allows */
+int myst_sha256_n(
+    myst_sha256_t* hashes,
+    const void* prefix,
+    size_t prefix_size,
+    const void* data,
+    size_t size,
+    size_t count);
+
 #endif /* _MYST_SHA256_H */
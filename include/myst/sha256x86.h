@@ -0,0 +1,37 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_SHA256X86_H
+#define _MYST_SHA256X86_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MYST_SHA256_X86_BLOCK_SIZE 64
+
+/* The number of messages that myst_sha256_x86_compress_lanes() hashes */
+#define MYST_SHA256_X86_LANES 16
+
+/* Whether the CPU has the SHA extensions (checked once) */
+bool myst_sha256_x86_supported(void);
+
+/* Whether the CPU has AVX2 (and so the multi-buffer function below) */
+bool myst_sha256_x86_lanes_supported(void);
+
+/* Whether the CPU also has AVX-512, which the multi-buffer function below
+ * uses on its own whenever it is there */
+bool myst_sha256_x86_avx512_supported(void);
+
+/* Run the SHA-256 compression function over consecutive 64-byte blocks */
+void myst_sha256_x86_compress(
+    uint32_t state[8],
+    const void* blocks,
+    size_t nblocks);
+
+/* Run the compression function of each lane over its own 64-byte block */
+void myst_sha256_x86_compress_lanes(
+    uint32_t state[MYST_SHA256_X86_LANES][8],
+    const void* const blocks[MYST_SHA256_X86_LANES]);
+
+#endif /* _MYST_SHA256X86_H */
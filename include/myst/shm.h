@@ -11,6 +11,18 @@ struct myst_shm
 {
     /* clock related shared fields */
     struct clock_ctrl* clock;
+
+    /* the startup timeline (null unless --startup-trace) */
+    struct myst_startup_trace* startup_trace;
+
+    /* the rootfs layout profile (null unless --layout-profile) */
+    struct myst_layout_profile* layout_profile;
+
+    /* the sampling profile (null unless --profile) */
+    struct myst_profile* profile;
+
+    /* the event trace (null unless --event-trace) */
+    struct myst_event_trace* event_trace;
 };
 
 int shm_create_clock(struct myst_shm* shm, unsigned long clock_tick);
@@ -7,6 +7,21 @@
 #include <myst/thread.h>
 #include <signal.h>
 
+/* The first realtime signal (multiple instances of these are queued) */
+#define MYST_SIGRTMIN 32
+
+/* The siginfo_t of the pending signals of a thread */
+typedef struct myst_signal_infos
+{
+    /* The siginfo_t of each pending signal (if its bit is in info) */
+    siginfo_t siginfos[NSIG - 1];
+    uint64_t info;
+
+    /* Realtime signals queued behind pending ones (oldest first) */
+    siginfo_t queue[MYST_SIGNAL_QUEUE_SIZE];
+    size_t queue_size;
+} myst_signal_infos_t;
+
 typedef void (*sigaction_handler_t)(int);
 
 typedef void (*sigaction_function_t)(int, siginfo_t*, void*);
@@ -15,6 +30,12 @@ int myst_signal_init(myst_thread_t* t);
 
 void myst_signal_free(myst_thread_t* t);
 
+/* Free the siginfo_t storage of a thread struct that is freed or reused */
+void myst_signal_release_infos(myst_thread_t* t);
+
+/* The bytes of siginfo_t storage allocated for all threads */
+size_t myst_signal_infos_bytes(void);
+
 long myst_signal_sigaction(
     unsigned signum,
     const posix_sigaction_t* new_action,
@@ -24,10 +45,18 @@ long myst_signal_sigprocmask(int how, const sigset_t* set, sigset_t* oldset);
 
 long myst_signal_process(myst_thread_t* thread);
 
+/* Check for pending signals without a call (as on every syscall return) */
+MYST_INLINE void myst_signal_process_pending(myst_thread_t* thread)
+{
+    if (thread->signal.pending)
+        myst_signal_process(thread);
+}
+
+/* Make the signal pending for the thread (copying the siginfo, if any) */
 long myst_signal_deliver(
     myst_thread_t* thread,
     unsigned signum,
-    siginfo_t* siginfo);
+    const siginfo_t* siginfo);
 
 long myst_signal_sigpending(sigset_t* set, unsigned size);
 
@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_SLAB_H
+#define _MYST_SLAB_H
+
+#include <stddef.h>
+
+#include <myst/defs.h>
+#include <myst/spinlock.h>
+#include <myst/types.h>
+
+/* Size and alignment of each slab (the objects follow the slab header) */
+#define MYST_SLAB_SIZE (16 * 1024)
+
+typedef struct myst_slab myst_slab_t;
+
+typedef struct myst_slab_cache myst_slab_cache_t;
+
+/* A cache of fixed-size objects of one type (see MYST_SLAB_CACHE_INIT) */
+struct myst_slab_cache
+{
+    const char* name;
+    size_t object_size;
+    myst_spinlock_t lock;
+
+    /* slabs with at least one free object */
+    myst_slab_t* partial;
+
+    /* statistics */
+    size_t num_slabs;
+    size_t num_empty;
+    size_t in_use;
+    size_t num_allocs;
+    size_t num_frees;
+
+    /* next cache in the list of all caches (see myst_slab_get_stats()) */
+    myst_slab_cache_t* next;
+    bool registered;
+};
+
+/* Statically initialize a slab cache for objects of the given type */
+#define MYST_SLAB_CACHE_INIT(NAME, TYPE)  \
+    {                                     \
+        .name = NAME,                     \
+        .object_size = sizeof(TYPE),      \
+        .lock = MYST_SPINLOCK_INITIALIZER \
+    }
+
+typedef struct myst_slab_stats
+{
+    const char* name;
+    size_t object_size;
+    size_t num_slabs;
+    size_t in_use;
+    size_t num_allocs;
+    size_t num_frees;
+} myst_slab_stats_t;
+
+/* Allocate a zero-filled object (objects must not exceed 1/8 of a slab) */
+void* myst_slab_alloc(myst_slab_cache_t* cache);
+
+/* Return an object to the cache it was allocated from */
+void myst_slab_free(void* object);
+
+/* Release the empty slabs held by the cache */
+void myst_slab_shrink(myst_slab_cache_t* cache);
+
+/* Get statistics for up to COUNT caches; returns the total number of caches */
+size_t myst_slab_get_stats(myst_slab_stats_t* stats, size_t count);
+
+#endif /* _MYST_SLAB_H */
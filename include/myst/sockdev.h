@@ -14,6 +14,9 @@ typedef struct myst_sockdev myst_sockdev_t;
 
 typedef struct myst_sock myst_sock_t;
 
+struct mmsghdr;
+struct timespec;
+
 struct myst_sockdev
 {
     myst_fdops_t fdops;
@@ -84,6 +87,22 @@ struct myst_sockdev
         struct msghdr* msg,
         int flags);
 
+    /* Send or receive up to vlen messages; returns the number moved */
+    int (*sd_sendmmsg)(
+        myst_sockdev_t* sd,
+        myst_sock_t* sock,
+        struct mmsghdr* msgvec,
+        unsigned int vlen,
+        int flags);
+
+    int (*sd_recvmmsg)(
+        myst_sockdev_t* sd,
+        myst_sock_t* sock,
+        struct mmsghdr* msgvec,
+        unsigned int vlen,
+        int flags,
+        struct timespec* timeout);
+
     int (*sd_shutdown)(myst_sockdev_t* sd, myst_sock_t* sock, int how);
 
     int (*sd_getsockopt)(
@@ -163,4 +182,28 @@ struct myst_sockdev
 
 myst_sockdev_t* myst_sockdev_get(void);
 
+/* The busy-poll budget of a socket of myst_sockdev_get() in microseconds
+ * (its SO_BUSY_POLL, which starts as --busy-poll; see myst/pollq.h) */
+unsigned int myst_sockdev_busy_poll(myst_sock_t* sock);
+
+/* Whether the kernel seals the sends of a socket of myst_sockdev_get() (see
+ * myst/ktls.h) */
+bool myst_sockdev_kernel_tls(myst_sock_t* sock);
+
+/* Socket sends and receives go through a pool of host-memory buffers */
+#define MYST_SOCKBUF_COUNT 32
+#define MYST_SOCKBUF_SIZE (64 * 1024)
+
+typedef struct myst_sockbuf_stats
+{
+    size_t count;    /* buffers allocated so far (at most MYST_SOCKBUF_COUNT) */
+    size_t in_use;   /* buffers currently lent out */
+    size_t hits;     /* operations served from the pool */
+    size_t misses;   /* operations that fell back because the pool was empty */
+    size_t bytes_sent;
+    size_t bytes_received;
+} myst_sockbuf_stats_t;
+
+void myst_sockdev_get_sockbuf_stats(myst_sockbuf_stats_t* stats);
+
 #endif /* _MYST_SOCKDEV_H */
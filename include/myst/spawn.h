@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_SPAWN_H
+#define _MYST_SPAWN_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+**==============================================================================
+**
+** SYS_myst_spawn: the kernel side of posix_spawn().
+**
+**     The C runtime passes the file actions and attributes of posix_spawn()
+**     to the kernel, which creates the child process, applies them on the
+**     child's own descriptor table and runs the program, without running
+**     the caller's code on a vfork() stack in between. The call returns once
+**     the child enters the new program (or fails to).
+**
+**==============================================================================
+*/
+
+/* myst_spawn_action_t.cmd (the same as musl's FDOP_* numbers) */
+#define MYST_SPAWN_CLOSE 1
+#define MYST_SPAWN_DUP2 2
+#define MYST_SPAWN_OPEN 3
+#define MYST_SPAWN_CHDIR 4
+#define MYST_SPAWN_FCHDIR 5
+
+/* myst_spawn_args_t.flags */
+#define MYST_SPAWN_SETSIGDEF 1
+#define MYST_SPAWN_SETSIGMASK 2
+#define MYST_SPAWN_SETSID 4
+
+typedef struct myst_spawn_action
+{
+    int cmd;
+    int fd;
+    int srcfd;
+    int oflag;
+    mode_t mode;
+    const char* path;
+} myst_spawn_action_t;
+
+typedef struct myst_spawn_args
+{
+    const char* path; /* the program (relative to the child's cwd) */
+    char* const* argv;
+    char* const* envp;
+    const myst_spawn_action_t* actions; /* applied in this order */
+    size_t num_actions;
+    int flags;
+    sigset_t sigdefault; /* with MYST_SPAWN_SETSIGDEF */
+    sigset_t sigmask;    /* with MYST_SPAWN_SETSIGMASK */
+} myst_spawn_args_t;
+
+#endif /* _MYST_SPAWN_H */
@@ -86,4 +86,64 @@ MYST_INLINE void myst_spin_unlock(myst_spinlock_t* spinlock)
 
 #endif /* MYST_SPINLOCK_ASSEMBLY */
 
+/*
+**==============================================================================
+**
+** myst_ticketlock_t: a fair (FIFO) spinlock for heavily contended locks.
+**
+**     Each locker takes a ticket and waits for its turn, so waiters are
+**     served in arrival order. Waiters back off in proportion to their
+**     distance from the head of the line, and the unlocker is the only
+**     writer of the owner field, which keeps cache-line traffic low.
+**
+**==============================================================================
+*/
+
+typedef struct myst_ticketlock
+{
+    volatile uint32_t next;
+    volatile uint32_t owner;
+} myst_ticketlock_t;
+
+#define MYST_TICKETLOCK_INITIALIZER \
+    {                               \
+        0, 0                        \
+    }
+
+MYST_INLINE void myst_ticket_lock(myst_ticketlock_t* t)
+{
+    uint32_t ticket = __atomic_fetch_add(&t->next, 1, __ATOMIC_RELAXED);
+    uint32_t owner;
+
+    while ((owner = __atomic_load_n(&t->owner, __ATOMIC_ACQUIRE)) != ticket)
+    {
+        for (uint32_t i = ticket - owner; i > 0; i--)
+            __asm__ __volatile__("pause" : : : "memory");
+    }
+}
+
+MYST_INLINE bool myst_ticket_trylock(myst_ticketlock_t* t)
+{
+    uint32_t owner = __atomic_load_n(&t->owner, __ATOMIC_ACQUIRE);
+    uint32_t ticket = owner;
+
+    return __atomic_compare_exchange_n(
+        &t->next,
+        &ticket,
+        owner + 1,
+        false,
+        __ATOMIC_ACQUIRE,
+        __ATOMIC_RELAXED);
+}
+
+MYST_INLINE void myst_ticket_unlock(myst_ticketlock_t* t)
+{
+    __atomic_store_n(&t->owner, t->owner + 1, __ATOMIC_RELEASE);
+}
+
+/* count the lock sites of the kernel (see lockstats.h) */
+#ifdef MYST_ENABLE_LOCK_STATS
+#include <myst/lockstats.h>
+#endif
+
 #endif /* _MYST_SPINLOCK_H */
@@ -0,0 +1,69 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_STARTUPTRACE_H
+#define _MYST_STARTUPTRACE_H
+
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** The startup timeline (--startup-trace).
+**
+**     The host allocates the trace in its own memory and passes it to the
+**     kernel (through myst_shm for SGX), so that both sides record the
+**     phases between the start of myst and the application's main() with
+**     CLOCK_MONOTONIC timestamps. The host writes the events as a Chrome
+**     trace (JSON) when the program exits.
+**
+**==============================================================================
+*/
+
+#define MYST_STARTUP_TRACE_MAX_EVENTS 64
+
+/* myst_startup_event_t.side */
+#define MYST_STARTUP_TRACE_HOST 1
+#define MYST_STARTUP_TRACE_ENCLAVE 2
+
+typedef struct myst_startup_event
+{
+    char name[32];
+    uint64_t side;
+    uint64_t start; /* nanoseconds */
+    uint64_t end;
+} myst_startup_event_t;
+
+typedef struct myst_startup_trace
+{
+    /* when the host called into the enclave (or the Linux kernel) */
+    uint64_t enter_time;
+
+    /* the events (slots are claimed atomically) */
+    uint64_t num_events;
+    myst_startup_event_t events[MYST_STARTUP_TRACE_MAX_EVENTS];
+} myst_startup_trace_t;
+
+/* The CLOCK_MONOTONIC time in nanoseconds (zero if not tracing) */
+uint64_t myst_startup_trace_now(void);
+
+/* Record the phase from start until now (if tracing) */
+void myst_startup_trace_event(const char* name, uint64_t start);
+
+/* Host: start tracing (the kernel gets the returned trace) */
+myst_startup_trace_t* myst_startup_trace_start(void);
+
+/* Host: the trace (null unless started) */
+myst_startup_trace_t* myst_startup_trace_get(void);
+
+/* Host: write the events to the file as a Chrome trace (JSON) */
+int myst_startup_trace_write(const char* path);
+
+/* Kernel: the first program enters the C runtime (and its dynamic loader) */
+void myst_startup_trace_enter_crt(void);
+
+/* Kernel: SYS_myst_startup_trace, which the C runtime calls once its
+ * dynamic loader is done (which ends the trace) */
+long myst_syscall_startup_trace(void);
+
+#endif /* _MYST_STARTUPTRACE_H */
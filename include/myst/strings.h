@@ -20,6 +20,36 @@ int myst_strsplit(
     char*** toks,
     size_t* ntoks);
 
+/*
+** Walk the components of a path without copying it: each call to
+** myst_path_next() skips any slashes and then points name and len at the
+** next component, within the path itself. For example:
+**
+**     myst_path_iter_t it;
+**
+**     myst_path_iter_init(&it, path);
+**
+**     while (myst_path_next(&it))
+**         use(it.name, it.len, myst_path_last(&it));
+*/
+typedef struct myst_path_iter
+{
+    const char* name; /* the current component (not null terminated) */
+    size_t len;       /* the length of the current component */
+    const char* rest; /* the path after the current component */
+} myst_path_iter_t;
+
+void myst_path_iter_init(myst_path_iter_t* it, const char* path);
+
+/* Move to the next component (return false after the last one) */
+bool myst_path_next(myst_path_iter_t* it);
+
+/* Whether the current component is the last one */
+bool myst_path_last(const myst_path_iter_t* it);
+
+/* Copy the current component as a string (-ENAMETOOLONG if it won't fit) */
+int myst_path_copy_name(const myst_path_iter_t* it, char* buf, size_t size);
+
 int myst_strjoin(
     const char* toks[],
     size_t ntoks,
@@ -16,6 +16,7 @@
 #include <time.h>
 
 #include <myst/defs.h>
+#include <myst/spawn.h>
 #include <myst/syscallext.h>
 
 MYST_INLINE long myst_syscall0(long n)
@@ -116,10 +117,23 @@ const char* syscall_str(long n);
 
 void myst_set_rootfs(const char* path);
 
+/* Export only the files modified from now on (see --export-ramfs-changed) */
+void myst_export_ramfs_start(void);
+
+/* Export only the coverage data of gcov builds (the *.gcda files) */
+void myst_export_ramfs_gcov(void);
+
 long myst_syscall_ret(long r);
 
 long myst_syscall(long n, long params[6]);
 
+/* Where the target resumes a trapped syscall instruction (syscalltrap.s) */
+void myst_syscall_trampoline(void);
+
+/* The size of the XSAVE area of the trampoline: the legacy region, the
+ * header and the components enabled in XCR0 (set before the trampoline) */
+extern uint64_t myst_syscall_xsave_size;
+
 long myst_syscall_creat(const char* pathname, mode_t mode);
 
 long myst_syscall_open(const char* pathname, int flags, mode_t mode);
@@ -180,6 +194,8 @@ long myst_syscall_getcwd(char* buf, size_t size);
 
 long myst_syscall_fcntl(int fd, int cmd, long arg);
 
+long myst_syscall_dup2(int oldfd, int newfd);
+
 long myst_syscall_add_symbol_file(
     const char* path,
     const void* text,
@@ -189,6 +205,9 @@ long myst_syscall_load_symbols(void);
 
 long myst_syscall_unload_symbols(void);
 
+/* Register the symbols of the CRT being entered (see kernel/debugsyms.c) */
+long myst_add_crt_symbols(const void* text, size_t text_size);
+
 long myst_syscall_clock_getres(clockid_t clk_id, struct timespec* res);
 
 long myst_syscall_clock_gettime(clockid_t clk_id, struct timespec* tp);
@@ -208,6 +227,8 @@ long myst_syscall_clone(
     void* newtls,
     pid_t* ctid);
 
+long myst_syscall_spawn(const myst_spawn_args_t* args);
+
 long myst_syscall_futex(
     int* uaddr,
     int op,
@@ -241,6 +262,13 @@ long myst_syscall_exit_group(int status);
 
 long myst_syscall_tgkill(int tgid, int tid, int sig);
 
+/* Queue a signal with its siginfo to a thread (to the process if tid is 0) */
+long myst_syscall_rt_tgsigqueueinfo(
+    int tgid,
+    int tid,
+    int sig,
+    const siginfo_t* uinfo);
+
 long myst_syscall_mount(
     const char* source,
     const char* target,
@@ -257,6 +285,30 @@ long myst_syscall_kill(int pid, int sig);
 
 long myst_syscall_sendfile(int out_fd, int in_fd, off_t* offset, size_t count);
 
+long myst_syscall_copy_file_range(
+    int fd_in,
+    off_t* off_in,
+    int fd_out,
+    off_t* off_out,
+    size_t len,
+    unsigned int flags);
+
+long myst_syscall_splice(
+    int fd_in,
+    off_t* off_in,
+    int fd_out,
+    off_t* off_out,
+    size_t len,
+    unsigned int flags);
+
+long myst_syscall_tee(int fd_in, int fd_out, size_t len, unsigned int flags);
+
+long myst_syscall_vmsplice(
+    int fd,
+    const struct iovec* iov,
+    size_t nr_segs,
+    unsigned int flags);
+
 long myst_syscall_sethostname(const char* hostname, size_t len);
 
 long myst_syscall_umask(mode_t mask);
@@ -270,6 +322,23 @@ long myst_syscall_setitimer(
 
 int myst_syscall_getitimer(int which, struct itimerval* curr_value);
 
+long myst_syscall_timer_create(
+    clockid_t clockid,
+    const void* sevp,
+    int* timerid);
+
+long myst_syscall_timer_settime(
+    int timerid,
+    int flags,
+    const struct itimerspec* new_value,
+    struct itimerspec* old_value);
+
+long myst_syscall_timer_gettime(int timerid, struct itimerspec* curr_value);
+
+long myst_syscall_timer_getoverrun(int timerid);
+
+long myst_syscall_timer_delete(int timerid);
+
 long myst_syscall_fsync(int fd);
 
 #endif /* _MYST_SYSCALL_H */
@@ -46,6 +46,16 @@ enum
     SYS_myst_oe_free_attestation_certificate,
     SYS_myst_oe_verify_attestation_certificate,
     SYS_myst_oe_result_str,
+
+    /* Diagnostics (appended to keep the numbers above stable) */
+    SYS_myst_dump_malloc_top,
+    SYS_myst_get_vdso,
+
+    /* Processes */
+    SYS_myst_spawn,
+
+    /* Diagnostics (see myst/startuptrace.h) */
+    SYS_myst_startup_trace,
 };
 
 #endif /* _MYST_SYSCALLEXT_H */
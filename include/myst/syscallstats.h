@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_SYSCALLSTATS_H
+#define _MYST_SYSCALLSTATS_H
+
+#include <myst/buf.h>
+#include <myst/thread.h>
+#include <myst/types.h>
+
+/* Number of log2 latency buckets: bucket i counts calls of [2^i, 2^(i+1)) ns
+ * (the last bucket also counts anything slower)
+ */
+#define MYST_SYSCALL_STATS_BUCKETS 32
+
+typedef struct myst_syscall_stat
+{
+    /* the syscall number */
+    long n;
+
+    size_t calls;
+    size_t errors;
+
+    /* total time spent in the syscall (nanoseconds) */
+    uint64_t nsec;
+
+    /* the part of nsec spent outside the kernel making tcalls */
+    uint64_t tcall_nsec;
+
+    size_t hist[MYST_SYSCALL_STATS_BUCKETS];
+} myst_syscall_stat_t;
+
+/* Read the clock used for syscall statistics (nanoseconds) */
+uint64_t myst_syscall_stats_now(void);
+
+/* Record one call (only called when __options.syscall_stats is set) */
+void myst_syscall_stats_record(
+    myst_thread_t* thread,
+    long n,
+    long ret,
+    uint64_t nsec,
+    uint64_t tcall_nsec);
+
+/* Get the statistics of up to COUNT syscalls (those called at least once),
+ * sorted by total time; returns the number of syscalls called.
+ */
+size_t myst_get_syscall_stats(myst_syscall_stat_t* stats, size_t count);
+
+/* Format the statistics as a table (as read from /proc/myst/syscalls) */
+int myst_format_syscall_stats(myst_buf_t* buf);
+
+/* Print the statistics to standard error */
+void myst_dump_syscall_stats(void);
+
+#endif /* _MYST_SYSCALLSTATS_H */
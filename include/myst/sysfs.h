@@ -0,0 +1,12 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_SYSFS_H
+#define _MYST_SYSFS_H
+
+/* Mount /sys with the CPU lists and the cgroup v2 view of the enclave */
+int sysfs_setup(void);
+
+int sysfs_teardown(void);
+
+#endif /* _MYST_SYSFS_H */
@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_SYSVSHM_H
+#define _MYST_SYSVSHM_H
+
+#include <myst/types.h>
+
+/* The x86-64 layout of the kernel's struct ipc64_perm */
+struct myst_ipc_perm
+{
+    int32_t key;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t cuid;
+    uint32_t cgid;
+    uint32_t mode;
+    uint16_t seq;
+    uint16_t pad;
+    uint64_t unused1;
+    uint64_t unused2;
+};
+
+/* The x86-64 layout of the kernel's struct shmid64_ds (for SYS_shmctl) */
+struct myst_shmid_ds
+{
+    struct myst_ipc_perm shm_perm;
+    uint64_t shm_segsz;
+    int64_t shm_atime;
+    int64_t shm_dtime;
+    int64_t shm_ctime;
+    int32_t shm_cpid;
+    int32_t shm_lpid;
+    uint64_t shm_nattch;
+    uint64_t unused1;
+    uint64_t unused2;
+};
+
+/* The limits returned by IPC_INFO (struct shminfo64) */
+struct myst_shminfo
+{
+    uint64_t shmmax;
+    uint64_t shmmin;
+    uint64_t shmmni;
+    uint64_t shmseg;
+    uint64_t shmall;
+    uint64_t unused[4];
+};
+
+/* The usage returned by SHM_INFO (struct shm_info) */
+struct myst_shm_info
+{
+    int32_t used_ids;
+    uint64_t shm_tot;
+    uint64_t shm_rss;
+    uint64_t shm_swp;
+    uint64_t swap_attempts;
+    uint64_t swap_successes;
+};
+
+long myst_syscall_shmget(key_t key, size_t size, int shmflg);
+
+long myst_syscall_shmat(int shmid, const void* shmaddr, int shmflg);
+
+long myst_syscall_shmdt(const void* shmaddr);
+
+long myst_syscall_shmctl(int shmid, int cmd, void* buf);
+
+/* Detach the segments an exiting process left attached */
+void myst_shm_release_process(pid_t pid);
+
+#endif /* _MYST_SYSVSHM_H */
@@ -53,6 +53,21 @@ typedef enum myst_tcall_number
     MYST_TCALL_VERIFY_SIGNATURE = 2081,
     MYST_TCALL_LOAD_FSSIG = 2082,
     MYST_TCALL_CLOCK_GETRES = 2083,
+    MYST_TCALL_HOSTBUF_ALLOC = 2084,
+    MYST_TCALL_HOSTBUF_SEND = 2085,
+    MYST_TCALL_HOSTBUF_RECV = 2086,
+    MYST_TCALL_ACCEPT_BATCH = 2087,
+    MYST_TCALL_SHA256_N = 2088,
+    MYST_TCALL_SET_SYSCALL_TRAMPOLINE = 2089,
+    MYST_TCALL_WAKE_MANY = 2090,
+    MYST_TCALL_GCM_NEW = 2091,
+    MYST_TCALL_GCM_FREE = 2092,
+    MYST_TCALL_GCM_SEAL = 2093,
+    MYST_TCALL_GCM_OPEN = 2094,
+    MYST_TCALL_EXPORT_CPIO = 2095,
+    MYST_TCALL_DEBUGGER_ATTACHED = 2096,
+    MYST_TCALL_MAP_HOST_FILE = 2097,
+    MYST_TCALL_UNMAP_HOST_FILE = 2098,
 } myst_tcall_number_t;
 
 long myst_tcall(long n, long params[6]);
@@ -79,6 +94,13 @@ long myst_tcall_wait(uint64_t event, const struct timespec* timeout);
 
 long myst_tcall_wake(uint64_t event);
 
+/* the most events that one MYST_TCALL_WAKE_MANY takes */
+#define MYST_TCALL_WAKE_MANY_MAX 64
+
+/* Wake several events with one call into the host (returns zero or the
+ * first error) */
+long myst_tcall_wake_many(const uint64_t* events, size_t count);
+
 long myst_tcall_wake_wait(
     uint64_t waiter_event,
     uint64_t self_event,
@@ -86,6 +108,24 @@ long myst_tcall_wake_wait(
 
 long myst_tcall_export_file(const char* path, const void* data, size_t size);
 
+/* Write the next part of a CPIO stream of files to export (as files that
+ * myst_tcall_export_file() writes); the stream ends with its trailer */
+long myst_tcall_export_cpio(const void* data, size_t size);
+
+/* Return 1 if a debugger is attached to the host process (else 0) */
+long myst_tcall_debugger_attached(void);
+
+/* Map [offset:offset+length] of a host file (fd is the host's descriptor)
+ * read-only and shared into host memory (offset is a page multiple) */
+long myst_tcall_map_host_file(
+    int fd,
+    off_t offset,
+    size_t length,
+    void** addr_out);
+
+/* Unmap memory mapped by myst_tcall_map_host_file() */
+long myst_tcall_unmap_host_file(void* addr, size_t length);
+
 long myst_tcall_add_symbol_file(
     const void* file_data,
     size_t file_size,
@@ -100,6 +140,10 @@ typedef long (*myst_run_thread_t)(uint64_t cookie, uint64_t event);
 
 long myst_tcall_set_run_thread_function(myst_run_thread_t function);
 
+/* Where the target sends trapped syscall instructions (SGX), which is
+ * entered with the return address pushed below the 128-byte red zone */
+long myst_tcall_set_syscall_trampoline(void (*trampoline)(void));
+
 /* for getting statistical information from the target */
 typedef struct myst_target_stat
 {
@@ -120,8 +164,24 @@ long myst_tcall_get_errno_location(int** ptr);
 /* break out of poll() */
 long myst_tcall_poll_wake(void);
 
+/* number of myst_tcall_poll_wake() calls so far (kernel only) */
+uint64_t myst_get_poll_wake_count(void);
+
 long myst_tcall_poll(struct pollfd* fds, nfds_t nfds, int timeout);
 
+struct epoll_event;
+
+/* create a target epoll instance (myst_tcall_poll_wake() also wakes it) */
+long myst_tcall_epoll_create1(int flags);
+
+long myst_tcall_epoll_ctl(int epfd, int op, int fd, struct epoll_event* event);
+
+long myst_tcall_epoll_wait(
+    int epfd,
+    struct epoll_event* events,
+    int maxevents,
+    int timeout);
+
 int myst_tcall_open_block_device(const char* path, bool read_only);
 
 int myst_tcall_close_block_device(int blkdev);
@@ -149,4 +209,36 @@ int myst_tcall_verify_signature(
 
 int myst_tcall_load_fssig(const char* path, myst_fssig_t* fssig);
 
+/* allocate a buffer in host memory (it is never freed) */
+long myst_tcall_hostbuf_alloc(size_t size, void** ptr_out);
+
+/* send() from a buffer obtained with myst_tcall_hostbuf_alloc() */
+long myst_tcall_hostbuf_send(
+    int sockfd,
+    const void* buf,
+    size_t len,
+    int flags);
+
+/* recv() into a buffer obtained with myst_tcall_hostbuf_alloc() */
+long myst_tcall_hostbuf_recv(int sockfd, void* buf, size_t len, int flags);
+
+/* The most connections that one myst_tcall_accept_batch() accepts */
+#define MYST_ACCEPT_BATCH_MAX 64
+
+/* A connection accepted by myst_tcall_accept_batch() */
+typedef struct myst_tcall_accepted
+{
+    int fd;
+    uint32_t addrlen;  /* the full size of the peer address */
+    uint8_t addr[128]; /* sizeof(struct sockaddr_storage) */
+} myst_tcall_accepted_t;
+
+/* accept4() one connection (blocking as the listener does) and then up to
+ * count - 1 more that are already pending; returns the number accepted */
+long myst_tcall_accept_batch(
+    int sockfd,
+    myst_tcall_accepted_t* conns,
+    size_t count,
+    int flags);
+
 #endif /* _MYST_TCALL_H */
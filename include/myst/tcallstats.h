@@ -0,0 +1,40 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_TCALLSTATS_H
+#define _MYST_TCALLSTATS_H
+
+#include <myst/buf.h>
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** Tcall statistics per call site (--syscall-stats).
+**
+**     Each call out of the kernel goes through myst_tcall() and, for SGX,
+**     becomes an OCALL unless the enclave answers it itself (such as the
+**     clock and the thread data). With --syscall-stats, each tcall is
+**     counted and timed by its number and by the kernel code that made it:
+**     the return address of myst_tcall() and the one above it, so that a
+**     call through a myst_tcall_*() wrapper is charged to the caller of the
+**     wrapper (such as the pipe that calls myst_tcall_poll_wake()). The
+**     sites are named from the kernel symbol table when printed
+**     (/proc/myst/tcalls, and at exit).
+**
+**==============================================================================
+*/
+
+/* the distinct (tcall, site) pairs counted; later ones are dropped */
+#define MYST_TCALL_STATS_SITES 1024
+
+/* Count a tcall of NSEC nanoseconds made from the frame of myst_tcall() */
+void myst_tcall_stats_record(long n, void* frame, uint64_t nsec);
+
+/* Format the sites as a table, in decreasing order of time */
+int myst_format_tcall_stats(myst_buf_t* buf);
+
+/* Print the table to standard error */
+void myst_dump_tcall_stats(void);
+
+#endif /* _MYST_TCALLSTATS_H */
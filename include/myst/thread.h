@@ -8,6 +8,7 @@
 #include <sys/times.h>
 #include <unistd.h>
 
+#include <myst/affinity.h>
 #include <myst/assume.h>
 #include <myst/defs.h>
 #include <myst/fdtable.h>
@@ -18,6 +19,9 @@
 
 #define MYST_THREAD_MAGIC 0xc79c53d9ad134ad4
 
+/* The number of realtime signals that can be queued behind pending ones */
+#define MYST_SIGNAL_QUEUE_SIZE 16
+
 typedef struct myst_thread myst_thread_t;
 
 typedef struct myst_td myst_td_t;
@@ -47,6 +51,28 @@ struct myst_td
 
 bool myst_valid_td(const void* td);
 
+/*
+** The kernel finds the thread bound to the calling host thread in the tsd
+** field of the descriptor that gsbase points to, with a single load. On SGX
+** that is the enclave's own descriptor, whose tsd field the target sets. With
+** the syscall instruction (the Linux target), the kernel owns gsbase and
+** points it at a myst_td_t of its own whose self field is the target
+** descriptor (see myst_bind_thread()).
+*/
+#define MYST_TD_TSD_OFFSET 48
+
+MYST_STATIC_ASSERT(MYST_OFFSETOF(myst_td_t, tsd) == MYST_TD_TSD_OFFSET);
+
+/* Get the thread bound to the calling host thread (or zero before one is) */
+MYST_INLINE uint64_t myst_get_tsd(void)
+{
+    uint64_t value;
+    __asm__ volatile("mov %%gs:%c1, %0"
+                     : "=r"(value)
+                     : "i"(MYST_TD_TSD_OFFSET));
+    return value;
+}
+
 extern myst_spinlock_t myst_process_list_lock;
 
 typedef struct
@@ -65,9 +91,20 @@ struct myst_thread
     /* used by myst_thread_queue_t (condition variables and mutexes) */
     struct myst_thread* qnext;
 
-    /* used by zombie-list */
+    /* used by the zombie list and the list of reaped threads */
     struct myst_thread* next;
 
+    /* whether the thread left the kernel (see myst_release_thread()) and
+     * whether wait4() has collected its exit status (process threads) */
+    bool released;
+    bool reaped;
+
+    /* references taken by lookups (see myst_put_thread()) */
+    size_t refs;
+
+    /* used by the tid map (see myst_tid_map_insert()) */
+    struct myst_thread* tid_next;
+
     /* the session id (see getsid() function) */
     pid_t sid;
 
@@ -92,6 +129,13 @@ struct myst_thread
     /* Timespec at when the thread last crossed over to userspace */
     struct timespec leave_kernel_ts;
 
+    /* Nanoseconds spent in user space and in the kernel (see times.c) */
+    long utime;
+    long stime;
+
+    /* Nanoseconds spent in tcalls (only counted with --syscall-stats) */
+    uint64_t tcall_nsec;
+
     /* the C-runtime thread descriptor */
     myst_td_t* crt_td;
 
@@ -110,6 +154,11 @@ struct myst_thread
     /* the file-descriptor table is inherited from process thread */
     myst_fdtable_t* fdtable;
 
+    /* the objects looked up in fdtable by the current syscall (see
+     * myst_fdtable_retire()) */
+    void* volatile fd_holds[MYST_FDTABLE_HOLDS];
+    size_t fd_nholds;
+
     /* arguments passed in from SYS_clone */
     struct
     {
@@ -144,6 +193,7 @@ struct myst_thread
         /* process CWD. Can be set on differnt threads so need to protect it too
          */
         char* cwd;
+        size_t cwd_len; /* strlen(cwd), for myst_realpath() */
         myst_spinlock_t cwd_lock;
 
         /* The current umask this process */
@@ -164,6 +214,9 @@ struct myst_thread
         /* The condition we were waiting on a futex */
         void* cond_wait;
 
+        /* The bitset passed to FUTEX_WAIT_BITSET (all ones for FUTEX_WAIT) */
+        uint32_t futex_bitset;
+
         /* The mask of blocked signals */
         uint64_t mask;
 
@@ -173,8 +226,9 @@ struct myst_thread
         /* The lock to ensure sequential delivery of signals */
         myst_spinlock_t lock;
 
-        /* The list of siginfo_t for pending signals */
-        siginfo_t* siginfos[NSIG - 1];
+        /* The siginfo_t of pending signals, allocated on the first signal
+         * that needs one (see myst_signal_deliver()) */
+        struct myst_signal_infos* infos;
     } signal;
 
     /* the parameters passed to the munmap syscall by __unmapself() */
@@ -190,6 +244,36 @@ struct myst_thread
 
     /* thread name */
     char name[16];
+
+    /* whether this is a kernel thread (see myst_create_kernel_thread()) */
+    bool kernel;
+
+    /* per-thread cache of small heap blocks (see kernel/malloc.c) */
+    struct myst_malloc_cache* malloc_cache;
+
+    /* samples not yet copied to the profile (see kernel/profile.c) */
+    struct myst_profile_ring* profile_ring;
+    uint64_t profile_ticks;
+
+    /* the event trace ring: its index plus one, zero until the first event
+     * or -1 if none was free (see kernel/eventtrace.c) */
+    int event_ring;
+
+    /* the CPUs this thread may run on, empty for all (see kernel/affinity.c)
+     * and whether it still has to apply them to its host thread */
+    myst_cpuset_t affinity;
+    bool affinity_pending;
+
+    /* scratch space reused by poll() for large fd sets (see kernel/poll.c) */
+    void* poll_scratch;
+    size_t poll_scratch_size;
+    bool poll_scratch_busy;
+
+    /* the arena of short-lived syscall buffers (see kernel/scratch.c) */
+    struct myst_scratch* scratch;
+
+    /* the sched_yield() calls made (see myst_syscall_sched_yield()) */
+    unsigned int yields;
 };
 
 MYST_INLINE bool myst_valid_thread(const myst_thread_t* thread)
@@ -199,8 +283,22 @@ MYST_INLINE bool myst_valid_thread(const myst_thread_t* thread)
 
 myst_thread_t* myst_thread_self(void);
 
+/* Point gsbase at gs_td for a host thread about to run kernel code, with no
+ * thread bound yet (only with the syscall instruction) */
+void myst_init_gs(myst_td_t* gs_td, myst_td_t* target_td);
+
+/* Bind the calling host thread to a thread: for the target and for
+ * myst_thread_self() (through gs_td, passed to myst_init_gs() before) */
+void myst_bind_thread(myst_thread_t* thread, myst_td_t* gs_td);
+
 void myst_zombify_thread(myst_thread_t* thread);
 
+/* Called last by an exiting thread, once it no longer uses its struct */
+void myst_release_thread(myst_thread_t* thread);
+
+/* Free the poll() scratch space of an exiting thread */
+void myst_release_poll_scratch(myst_thread_t* thread);
+
 extern myst_thread_t* __myst_main_thread;
 
 typedef struct myst_thread_queue
@@ -294,8 +392,38 @@ void myst_wait_on_child_processes(void);
 
 int myst_get_num_threads(void);
 
+/* Create a kernel thread that runs fn(arg) and exits when fn returns. Kernel
+ * threads belong to no process (their pid is zero), so signals, wait4() and
+ * /proc never see them, but they count against the thread limit */
+long myst_create_kernel_thread(int (*fn)(void*), void* arg, const char* name);
+
+/* find a thread of the calling process by its tid (NULL if none) and take
+ * a reference to it */
 myst_thread_t* myst_find_thread(int tid);
 
+/* make a running thread visible to myst_tid_map_find() */
+void myst_tid_map_insert(myst_thread_t* thread);
+
+/* remove a thread from the tid map (done when it becomes a zombie) */
+void myst_tid_map_remove(myst_thread_t* thread);
+
+/* find a running thread of any process by its tid (NULL if none) and take
+ * a reference to it */
+myst_thread_t* myst_tid_map_find(pid_t tid);
+
+/* take a reference to a thread, keeping its struct from being recycled or
+ * freed after it exits (only while it can still be found) */
+void myst_get_thread(myst_thread_t* thread);
+
+/* release a reference taken by myst_get_thread() or a lookup (NULL is
+ * ignored) */
+void myst_put_thread(myst_thread_t* thread);
+
+/* call CALLBACK for every running thread (which must not modify the map) */
+void myst_tid_map_foreach(
+    void (*callback)(myst_thread_t* thread, void* arg),
+    void* arg);
+
 size_t myst_kill_thread_group();
 
 MYST_INLINE char* myst_get_thread_name(myst_thread_t* thread)
@@ -0,0 +1,53 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_TIMER_H
+#define _MYST_TIMER_H
+
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** myst_timer_t: a kernel timer (see kernel/timer.c).
+**
+**     The caller embeds the timer in a larger structure, sets fn, and arms
+**     the timer with a CLOCK_MONOTONIC deadline in nanoseconds. The timer
+**     thread calls fn (without any lock held) once the deadline passes. The
+**     function may rearm its own timer (as periodic timers do).
+**
+**==============================================================================
+*/
+
+typedef struct myst_timer myst_timer_t;
+
+struct myst_timer
+{
+    void (*fn)(myst_timer_t* timer);
+
+    /* the fields below belong to kernel/timer.c */
+    myst_timer_t* prev;
+    myst_timer_t* next;
+    myst_timer_t** list; /* the list that holds the timer (null if none) */
+    uint64_t deadline;
+    uint64_t expires; /* the deadline in ticks */
+};
+
+/* Get the CLOCK_MONOTONIC time in nanoseconds (as deadlines are given) */
+uint64_t myst_timer_now(void);
+
+/* Arm (or rearm) the timer to expire at the deadline (which may be past) */
+int myst_timer_arm(myst_timer_t* timer, uint64_t deadline);
+
+/* Disarm the timer; once this returns, fn is not running and will not run
+ * (unless fn calls this on its own timer, which then only disarms it) */
+void myst_timer_cancel(myst_timer_t* timer);
+
+/* Disarm the interval timer and delete the POSIX timers of an exiting
+ * process (see kernel/itimer.c) */
+void myst_release_process_timers(pid_t pid);
+
+/* Stop the timer thread (called once at kernel exit) */
+void myst_stop_timers(void);
+
+#endif /* _MYST_TIMER_H */
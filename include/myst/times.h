@@ -6,6 +6,8 @@
 
 #include <time.h>
 
+#include <myst/thread.h>
+
 /* Start tracking time for current thread */
 void myst_times_start();
 
@@ -15,6 +17,9 @@ void myst_times_enter_kernel();
 /* Time tracking while leaving the kernel to user space */
 void myst_times_leave_kernel();
 
+/* Fold the time of an exiting thread into the process totals */
+void myst_times_exit_thread(myst_thread_t* thread);
+
 /* Return the time (in nanoseconds) spent on kernel execution */
 long myst_times_system_time();
 
@@ -0,0 +1,39 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_UNIXDEV_H
+#define _MYST_UNIXDEV_H
+
+#include <sys/types.h>
+
+#include <myst/sockdev.h>
+
+/*
+**==============================================================================
+**
+** The AF_UNIX socket device.
+**
+**     Unix domain sockets (stream, seqpacket and datagram) are implemented
+**     entirely in the kernel: each socket has a receive queue of messages
+**     that its peers append to, so local IPC between threads and processes
+**     of the enclave never leaves it. File descriptors can be passed with
+**     SCM_RIGHTS. Sockets are polled like pipes (see myst/pollq.h).
+**
+**     The same device serves loopback TCP and UDP sockets (AF_INET and
+**     AF_INET6 with SOCK_STREAM or SOCK_DGRAM) for myst/loopback.h.
+**
+**==============================================================================
+*/
+
+/* Default receive queue limit of a socket in bytes (net.core.rmem_default) */
+#define MYST_UNIX_RCVBUF 212992
+
+myst_sockdev_t* myst_unixdev_get(void);
+
+/* The type of the socket bound to addr (or -ECONNREFUSED if none) */
+int myst_unixdev_bound_type(const struct sockaddr* addr, socklen_t addrlen);
+
+/* The fchmod() of a unix socket (which has no host file descriptor) */
+int myst_unixdev_fchmod(myst_sockdev_t* sd, myst_sock_t* sock, mode_t mode);
+
+#endif /* _MYST_UNIXDEV_H */
@@ -0,0 +1,153 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_VDSO_H
+#define _MYST_VDSO_H
+
+#include <errno.h>
+#include <time.h>
+
+#include <myst/clock.h>
+#include <myst/defs.h>
+#include <myst/types.h>
+
+/*
+**==============================================================================
+**
+** myst_vdso_t:
+**
+**     The clock state shared by the target and the C runtime. The target
+**     fills it in from the host clock page (see tools/myst/host/shm.c) and
+**     the kernel hands its address to the C runtime (SYS_myst_get_vdso), so
+**     user code can read the clock without making a syscall. Every reader
+**     goes through the functions below, which keep the clock monotonic even
+**     if the host moves the shared time backwards.
+**
+**==============================================================================
+*/
+
+typedef struct myst_vdso
+{
+    /* host-updated monotonic time in nanoseconds (untrusted) */
+    const volatile long* monotime_now;
+
+    /* clocks at startup (copied into the enclave) */
+    long monotime0;
+    long realtime0;
+
+    /* adjustment made by clock_settime(CLOCK_REALTIME) */
+    long realtime_delta;
+
+    /* the latest monotonic time returned by any reader */
+    long monotime_prev;
+
+    /* host-updated TSC (untrusted) and the latest value returned for it */
+    const volatile unsigned long* tsc_now;
+    unsigned long tsc_prev;
+} myst_vdso_t;
+
+/* Return the monotonic clock in nanoseconds (never goes backwards) */
+MYST_INLINE long myst_vdso_monotime(myst_vdso_t* vdso)
+{
+    long now = *vdso->monotime_now;
+    long prev = __atomic_load_n(&vdso->monotime_prev, __ATOMIC_RELAXED);
+
+    while (now > prev)
+    {
+        if (__atomic_compare_exchange_n(
+                &vdso->monotime_prev,
+                &prev,
+                now,
+                true,
+                __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED))
+        {
+            return now;
+        }
+    }
+
+    /* maintain monotonicity (the host may be playing tricks) */
+    return __atomic_add_fetch(&vdso->monotime_prev, 1, __ATOMIC_RELAXED);
+}
+
+/* Return the TSC as of the last clock update (never goes backwards) */
+MYST_INLINE unsigned long myst_vdso_rdtsc(myst_vdso_t* vdso)
+{
+    unsigned long now = *vdso->tsc_now;
+    unsigned long prev = __atomic_load_n(&vdso->tsc_prev, __ATOMIC_RELAXED);
+
+    while (now > prev)
+    {
+        if (__atomic_compare_exchange_n(
+                &vdso->tsc_prev,
+                &prev,
+                now,
+                true,
+                __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED))
+        {
+            return now;
+        }
+    }
+
+    /* successive reads between updates still differ */
+    return __atomic_add_fetch(&vdso->tsc_prev, 1, __ATOMIC_RELAXED);
+}
+
+/* Get the realtime clock in nanoseconds; returns -EOVERFLOW on overflow */
+MYST_INLINE int myst_vdso_realtime(myst_vdso_t* vdso, long* realtime)
+{
+    // Derive the realtime clock from the monotonic clock. Any adjustment to
+    // the system clock is invisible to the enclave once it is launched.
+    long delta = __atomic_load_n(&vdso->realtime_delta, __ATOMIC_RELAXED);
+    long ret = myst_vdso_monotime(vdso) - vdso->monotime0;
+
+    if (__builtin_saddl_overflow(ret, vdso->realtime0, &ret) ||
+        __builtin_saddl_overflow(ret, delta, &ret))
+    {
+        return -EOVERFLOW;
+    }
+
+    *realtime = ret;
+    return 0;
+}
+
+/* Handle the clocks backed by the vdso; returns -EINVAL for other clocks */
+MYST_INLINE int myst_vdso_clock_gettime(
+    myst_vdso_t* vdso,
+    clockid_t clk_id,
+    struct timespec* tp)
+{
+    long nanoseconds;
+
+    switch (clk_id)
+    {
+        case CLOCK_MONOTONIC_COARSE:
+        case CLOCK_MONOTONIC:
+        case CLOCK_BOOTTIME:
+        {
+            /* Boottime clock relies on monotonic clock */
+            nanoseconds = myst_vdso_monotime(vdso);
+            break;
+        }
+        case CLOCK_REALTIME_COARSE:
+        case CLOCK_REALTIME:
+        {
+            int r;
+
+            if ((r = myst_vdso_realtime(vdso, &nanoseconds)) != 0)
+                return r;
+
+            break;
+        }
+        default:
+            return -EINVAL;
+    }
+
+    tp->tv_sec = nanoseconds / NANO_IN_SECOND;
+    tp->tv_nsec = nanoseconds % NANO_IN_SECOND;
+
+    return 0;
+}
+
+#endif /* _MYST_VDSO_H */
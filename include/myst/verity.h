@@ -64,4 +64,28 @@ MYST_STATIC_ASSERT(MYST_OFFSETOF(myst_verity_sb_t, _pad1) == 82);
 MYST_STATIC_ASSERT(MYST_OFFSETOF(myst_verity_sb_t, salt) == 88);
 MYST_STATIC_ASSERT(MYST_OFFSETOF(myst_verity_sb_t, _pad2) == 344);
 
+/* Data block cache statistics of all the verity devices */
+typedef struct myst_verity_stats
+{
+    /* the reads of a block served by the cache or not */
+    size_t hits;
+    size_t misses;
+
+    /* the blocks evicted from the cache */
+    size_t evictions;
+
+    /* the blocks read ahead by sequential readers (and how many of them were
+     * read from the cache later) */
+    size_t prefetched;
+    size_t prefetch_hits;
+
+    /* the hash tree nodes read and checked against their parent (or the
+     * root hash), and the ones taken as verified from a saved image (see
+     * myst_verityblkdev_import_nodes()) */
+    size_t nodes_hashed;
+    size_t nodes_imported;
+} myst_verity_stats_t;
+
+void myst_verityblkdev_get_stats(myst_verity_stats_t* stats);
+
 #endif /* _MYST_VERITY_H */
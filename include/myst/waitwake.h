@@ -0,0 +1,118 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_WAITWAKE_H
+#define _MYST_WAITWAKE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <myst/defs.h>
+
+/*
+**==============================================================================
+**
+** The event word behind myst_tcall_wait() and myst_tcall_wake().
+**
+**     The word lives in host memory and takes these values:
+**
+**         > 0  -- that many wakes are pending
+**           0  -- idle
+**          -1  -- a waiter is sleeping on the host futex
+**          -2  -- a waiter is spinning and will notice a wake by itself
+**
+**     Only a sleeping waiter needs a host futex wake (an OCALL on SGX). A
+**     spinning waiter is woken by changing -2 into 1, which it consumes.
+**
+**==============================================================================
+*/
+
+#define MYST_EVENT_SPINNING (-2)
+
+/* Number of pause iterations a waiter spins before sleeping on the host */
+#define MYST_EVENT_SPIN_COUNT 1000
+
+/* Post a wake; returns true if a sleeping waiter needs a host futex wake */
+MYST_INLINE bool myst_event_post(volatile int* uaddr)
+{
+    for (;;)
+    {
+        int v = __atomic_load_n(uaddr, __ATOMIC_RELAXED);
+        int nv;
+
+        if (v == -1)
+            return true;
+
+        nv = (v == MYST_EVENT_SPINNING) ? 1 : v + 1;
+
+        if (__atomic_compare_exchange_n(
+                uaddr, &v, nv, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            return false;
+        }
+    }
+}
+
+/* Spin for a wake; returns false if the caller must sleep on the host */
+MYST_INLINE bool myst_event_spin(volatile int* uaddr, size_t spin_count)
+{
+    int v = __atomic_load_n(uaddr, __ATOMIC_RELAXED);
+
+    /* consume a pending wake or announce that we are spinning */
+    for (;;)
+    {
+        if (v > 0)
+        {
+            if (__atomic_compare_exchange_n(
+                    uaddr,
+                    &v,
+                    v - 1,
+                    false,
+                    __ATOMIC_ACQUIRE,
+                    __ATOMIC_RELAXED))
+            {
+                return true;
+            }
+        }
+        else if (v == 0)
+        {
+            if (__atomic_compare_exchange_n(
+                    uaddr,
+                    &v,
+                    MYST_EVENT_SPINNING,
+                    false,
+                    __ATOMIC_ACQUIRE,
+                    __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else
+        {
+            /* not in a state this waiter can handle */
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < spin_count; i++)
+    {
+        if (__atomic_load_n(uaddr, __ATOMIC_RELAXED) != MYST_EVENT_SPINNING)
+            break;
+
+        __asm__ __volatile__("pause" : : : "memory");
+    }
+
+    /* stop spinning; if this fails then a waker turned -2 into a wake */
+    v = MYST_EVENT_SPINNING;
+
+    if (__atomic_compare_exchange_n(
+            uaddr, &v, 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        return false;
+    }
+
+    __atomic_fetch_sub(uaddr, 1, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+#endif /* _MYST_WAITWAKE_H */
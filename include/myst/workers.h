@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_WORKERS_H
+#define _MYST_WORKERS_H
+
+#include <myst/types.h>
+
+/* The most kernel worker threads (see --crypto-threads) */
+#define MYST_MAX_WORKERS 64
+
+typedef struct myst_work myst_work_t;
+typedef struct myst_workgroup myst_workgroup_t;
+
+/* A unit of work for the kernel worker threads (typically the first field of
+ * a larger structure that holds the arguments) */
+struct myst_work
+{
+    int (*fn)(myst_work_t* work);
+    myst_work_t* next;
+    myst_workgroup_t* group;
+};
+
+/* The works submitted together by one caller, who waits for all of them */
+struct myst_workgroup
+{
+    size_t pending;
+    int ret; /* the first error returned by any of the works */
+};
+
+#define MYST_WORKGROUP_INITIALIZER {0, 0}
+
+/* Start count worker threads (called once at kernel startup) */
+int myst_start_workers(size_t count);
+
+/* Stop the worker threads (after the queued works have run) */
+void myst_stop_workers(void);
+
+/* The number of worker threads (zero if the works run on their callers) */
+size_t myst_num_workers(void);
+
+/* Queue the work for the worker threads (or run it now if there are none) */
+void myst_submit_work(myst_workgroup_t* group, myst_work_t* work);
+
+/* Wait for the works of the group, running any still queued on the caller,
+ * and return the first error (the group may then be reused) */
+int myst_wait_workgroup(myst_workgroup_t* group);
+
+#endif /* _MYST_WORKERS_H */
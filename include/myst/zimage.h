@@ -0,0 +1,66 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_ZIMAGE_H
+#define _MYST_ZIMAGE_H
+
+#include <stdint.h>
+
+#include <myst/defs.h>
+
+/*
+**==============================================================================
+**
+** The compressed disk image format (see myst_zblkdev_open()).
+**
+**     [HEADER|INDEX|CHUNK-0|CHUNK-1|...|CHUNK-N-1|PADDING]
+**
+**     The disk image is split into chunks of chunk_size bytes (the last may
+**     be shorter), which are compressed one by one (see myst/lz.h), so any
+**     block is read by decompressing only the chunk that holds it. The index
+**     is an array of num_chunks + 1 little-endian offsets, where chunk i
+**     occupies the bytes from index[i] up to index[i + 1]. A chunk that did
+**     not get smaller is stored as is (its stored size is its own size). The
+**     whole is padded to a multiple of 4096 bytes, so that a hash tree may be
+**     appended to it (in which case verity checks the compressed bytes).
+**
+**==============================================================================
+*/
+
+#define MYST_ZIMAGE_MAGIC 0x7a1f3d6b09c24e85
+
+#define MYST_ZIMAGE_VERSION 1
+
+/* the default chunk size (the size must be a power of two) */
+#define MYST_ZIMAGE_CHUNK_SIZE (64 * 1024)
+
+/* the largest chunk size that readers accept */
+#define MYST_ZIMAGE_MAX_CHUNK_SIZE (1024 * 1024)
+
+typedef struct myst_zimage_header
+{
+    /* the magic number (must be MYST_ZIMAGE_MAGIC) */
+    uint64_t magic;
+
+    /* the version number (must be MYST_ZIMAGE_VERSION) */
+    uint64_t version;
+
+    /* the size in bytes of the disk image before compression */
+    uint64_t size;
+
+    /* the size in bytes of each chunk before compression */
+    uint64_t chunk_size;
+
+    /* the number of chunks */
+    uint64_t num_chunks;
+
+    /* the offset in bytes of the index (from the start of the image) */
+    uint64_t index_offset;
+
+    /* padding */
+    uint8_t padding[464];
+} myst_zimage_header_t;
+
+MYST_STATIC_ASSERT(sizeof(myst_zimage_header_t) == 512);
+
+#endif /* _MYST_ZIMAGE_H */
@@ -67,50 +67,6 @@ static void _trace_result(
     }
 }
 
-static void* _malloc(json_parser_t* parser, size_t size)
-{
-    if (!parser || !parser->allocator || !parser->allocator->ja_malloc)
-        return NULL;
-
-    return (*parser->allocator->ja_malloc)(size);
-}
-
-static void _free(json_parser_t* parser, void* ptr)
-{
-    if (!parser || !parser->allocator || !parser->allocator->ja_free || !ptr)
-        return;
-
-    return (*parser->allocator->ja_free)(ptr);
-}
-
-static size_t _split(
-    char* s,
-    const char sep,
-    const char* tokens[],
-    size_t num_tokens)
-{
-    size_t n = 0;
-
-    for (;;)
-    {
-        if (n == num_tokens)
-            return (size_t)-1;
-
-        tokens[n++] = s;
-
-        /* Skip non-separator characters */
-        while (*s && *s != sep)
-            s++;
-
-        if (!*s)
-            break;
-
-        *s++ = '\0';
-    }
-
-    return n;
-}
-
 static unsigned char _char_to_nibble(char c)
 {
     c = (char)tolower(c);
@@ -193,36 +149,72 @@ done:
     return result;
 }
 
+/* Return the first '"' or '\\' character in [p, end) or end if none. This
+ * tests eight characters at a time (a word has a zero byte where it matches
+ * the character exactly when (x - 0x01..01) & ~x & 0x80..80 is non-zero) */
+static char* _find_quote_or_escape(char* p, const char* end)
+{
+    const uint64_t ones = 0x0101010101010101UL;
+    const uint64_t highs = 0x8080808080808080UL;
+    const uint64_t quotes = ones * '"';
+    const uint64_t escapes = ones * '\\';
+
+    while (end - p >= 8)
+    {
+        uint64_t x;
+        uint64_t q;
+        uint64_t e;
+
+        memcpy(&x, p, sizeof(x));
+        q = x ^ quotes;
+        e = x ^ escapes;
+
+        if (((q - ones) & ~q & highs) | ((e - ones) & ~e & highs))
+            break;
+
+        p += 8;
+    }
+
+    while (p != end && *p != '"' && *p != '\\')
+        p++;
+
+    return p;
+}
+
 static json_result_t _get_string(json_parser_t* parser, char** str)
 {
     json_result_t result = JSON_OK;
     char* start = parser->ptr;
     char* p = start;
     const char* end = parser->end;
-    int escaped = 0;
+    char* escape = NULL;
 
     /* Save the start of the string */
     *str = p;
 
     /* Find the closing quote */
-    while (p != end && *p != '"')
+    for (;;)
     {
-        if (*p++ == '\\')
-        {
-            escaped = 1;
+        if ((p = _find_quote_or_escape(p, end)) == end || *p == '"')
+            break;
 
-            if (*p == 'u')
-            {
-                if (end - p < 4)
-                    RAISE(JSON_EOF);
-                p += 4;
-            }
-            else
-            {
-                if (p == end)
-                    RAISE(JSON_EOF);
-                p++;
-            }
+        /* Remember the first escape sequence */
+        if (!escape)
+            escape = p;
+
+        p++;
+
+        if (*p == 'u')
+        {
+            if (end - p < 4)
+                RAISE(JSON_EOF);
+            p += 4;
+        }
+        else
+        {
+            if (p == end)
+                RAISE(JSON_EOF);
+            p++;
         }
     }
 
@@ -243,103 +235,78 @@ static json_result_t _get_string(json_parser_t* parser, char** str)
     *p = '\0';
     end = p;
 
-    /* Process escaped characters (if any) */
-    if (escaped)
+    /* Unescape in place in one pass (the text never grows) */
+    if (escape)
     {
-        p = start;
+        const char* in = escape;
+        char* out = escape;
 
-        while (*p)
+        while (in != end)
         {
-            /* Handled escaped characters */
-            if (*p == '\\')
+            if (*in != '\\')
             {
-                p++;
+                *out++ = *in++;
+                continue;
+            }
 
-                if (!*p)
-                    RAISE(JSON_EOF);
+            if (++in == end)
+                RAISE(JSON_EOF);
 
-                switch (*p)
+            switch (*in++)
+            {
+                case '"':
+                    *out++ = '"';
+                    break;
+                case '\\':
+                    *out++ = '\\';
+                    break;
+                case '/':
+                    *out++ = '/';
+                    break;
+                case 'b':
+                    *out++ = '\b';
+                    break;
+                case 'f':
+                    *out++ = '\f';
+                    break;
+                case 'n':
+                    *out++ = '\n';
+                    break;
+                case 'r':
+                    *out++ = '\r';
+                    break;
+                case 't':
+                    *out++ = '\t';
+                    break;
+                case 'u':
                 {
-                    case '"':
-                        p[-1] = '"';
-                        memmove(p, p + 1, (size_t)(end - p));
-                        end--;
-                        break;
-                    case '\\':
-                        p[-1] = '\\';
-                        memmove(p, p + 1, (size_t)(end - p));
-                        end--;
-                        break;
-                    case '/':
-                        p[-1] = '/';
-                        memmove(p, p + 1, (size_t)(end - p));
-                        end--;
-                        break;
-                    case 'b':
-                        p[-1] = '\b';
-                        memmove(p, p + 1, (size_t)(end - p));
-                        end--;
-                        break;
-                    case 'f':
-                        p[-1] = '\f';
-                        memmove(p, p + 1, (size_t)(end - p));
-                        end--;
-                        break;
-                    case 'n':
-                        p[-1] = '\n';
-                        memmove(p, p + 1, (size_t)(end - p));
-                        end--;
-                        break;
-                    case 'r':
-                        p[-1] = '\r';
-                        memmove(p, p + 1, (size_t)(end - p));
-                        end--;
-                        break;
-                    case 't':
-                        p[-1] = '\t';
-                        memmove(p, p + 1, (size_t)(end - p));
-                        end--;
-                        break;
-                    case 'u':
-                    {
-                        uint32_t x;
-
-                        p++;
-
-                        /* Expecting 4 hex digits: XXXX */
-                        if (end - p < 4)
-                            RAISE(JSON_EOF);
-
-                        if (_hex_str4_to_u32(p, &x) != 0)
-                            RAISE(JSON_BAD_SYNTAX);
+                    uint32_t x;
 
-                        if (x >= 256)
-                        {
-                            /* ATTN.B: UTF-8 not supported yet! */
-                            RAISE(JSON_UNSUPPORTED);
-                        }
+                    /* Expecting 4 hex digits: XXXX */
+                    if (end - in < 4)
+                        RAISE(JSON_EOF);
 
-                        /* Overwrite '\' character */
-                        p[-2] = (char)x;
+                    if (_hex_str4_to_u32(in, &x) != 0)
+                        RAISE(JSON_BAD_SYNTAX);
 
-                        /* Remove "uXXXX" */
-                        memmove(p - 1, p + 4, (size_t)(end - p - 3));
-
-                        p = p - 1;
-                        end -= 5;
-                        break;
-                    }
-                    default:
+                    if (x >= 256)
                     {
-                        RAISE(JSON_FAILED);
+                        /* ATTN.B: UTF-8 not supported yet! */
+                        RAISE(JSON_UNSUPPORTED);
                     }
+
+                    *out++ = (char)x;
+                    in += 4;
+                    break;
+                }
+                default:
+                {
+                    RAISE(JSON_FAILED);
                 }
-            }
-            else
-            {
-                p++;
             }
         }
+
+        *out = '\0';
     }
 
 #if 0
@@ -563,7 +530,6 @@ static json_result_t _get_value(json_parser_t* parser)
 {
     json_result_t result = JSON_OK;
     char c;
-    json_parser_t* scanner = NULL;
 
     /* Skip whitespace */
     CHECK(skip_whitespace(parser));
@@ -625,24 +591,30 @@ static json_result_t _get_value(json_parser_t* parser)
         }
         case '[':
         {
-            json_union_t un;
+            json_union_t un = {0};
 
-            /* Scan ahead to determine the size of the array */
+            /* Scan ahead to determine the size of the array (in place: the
+             * scan only moves the position and overwrites the path below the
+             * current node, so save and restore those). The size is not
+             * needed when already scanning since no callbacks are invoked */
+            if (!parser->scan)
             {
                 size_t array_size = 0;
-
-                if (!(scanner = _malloc(parser, sizeof(json_parser_t))))
-                    RAISE(JSON_OUT_OF_MEMORY);
-
-                memcpy(scanner, parser, sizeof(json_parser_t));
-                scanner->scan = 1;
-
-                if (_get_array(scanner, &array_size) != JSON_OK)
+                char* ptr = parser->ptr;
+                size_t depth = parser->depth;
+                json_node_t node = parser->path[depth - 1];
+                json_result_t r;
+
+                parser->scan = 1;
+                r = _get_array(parser, &array_size);
+                parser->scan = 0;
+                parser->ptr = ptr;
+                parser->depth = depth;
+                parser->path[depth - 1] = node;
+
+                if (r != JSON_OK)
                     RAISE(JSON_BAD_SYNTAX);
 
-                _free(parser, scanner);
-                scanner = NULL;
-
                 un.integer = (signed long long)array_size;
 
                 parser->path[parser->depth - 1].size = array_size;
@@ -686,10 +658,6 @@ static json_result_t _get_value(json_parser_t* parser)
     }
 
 done:
-
-    if (scanner)
-        _free(parser, scanner);
-
     return result;
 }
 
@@ -705,7 +673,8 @@ json_result_t json_parser_init(
     if (!parser || !data || !size || !callback)
         return JSON_BAD_PARAMETER;
 
-    if (!allocator || !allocator->ja_malloc || !allocator->ja_free)
+    /* The parser never allocates, so the allocator is optional */
+    if (allocator && (!allocator->ja_malloc || !allocator->ja_free))
         return JSON_BAD_PARAMETER;
 
     memset(parser, 0, sizeof(json_parser_t));
@@ -760,34 +729,22 @@ done:
 json_result_t json_match(json_parser_t* parser, const char* pattern)
 {
     json_result_t result = JSON_UNEXPECTED;
-    char buf[256];
-    char* ptr = NULL;
-    const char* pattern_path[JSON_MAX_NESTING];
-    size_t pattern_depth = 0;
+    size_t pattern_depth = 1;
     unsigned long n = 0;
-    size_t pattern_len;
+    const char* p;
 
     if (!parser || !pattern)
         RAISE(JSON_BAD_PARAMETER);
 
-    /* Make a copy of the pattern that can be modified */
+    /* Count the '.' separated elements of the pattern */
+    for (p = pattern; *p; p++)
     {
-        pattern_len = strlen(pattern);
-
-        if (pattern_len < sizeof(buf))
-            ptr = buf;
-        else if (!(ptr = _malloc(parser, pattern_len + 1)))
-            RAISE(JSON_OUT_OF_MEMORY);
-
-        strcpy(ptr, pattern);
+        if (*p == '.')
+            pattern_depth++;
     }
 
-    /* Split the pattern into tokens */
-    if ((pattern_depth = _split(ptr, '.', pattern_path, JSON_MAX_NESTING)) ==
-        (size_t)-1)
-    {
+    if (pattern_depth > JSON_MAX_NESTING)
         RAISE(JSON_NESTING_OVERFLOW);
-    }
 
     /* Return false if the path sizes are different */
     if (parser->depth != pattern_depth)
@@ -796,28 +753,34 @@ json_result_t json_match(json_parser_t* parser, const char* pattern)
         goto done;
     }
 
-    /* Compare the elements */
+    /* Compare the elements (in place rather than splitting a copy) */
+    p = pattern;
+
     for (size_t i = 0; i < pattern_depth; i++)
     {
-        if (strcmp(pattern_path[i], "#") == 0)
+        const char* name = parser->path[i].name;
+        size_t len = 0;
+
+        while (p[len] && p[len] != '.')
+            len++;
+
+        if (len == 1 && p[0] == '#')
         {
-            if (strtou64(&n, parser->path[i].name) != 0)
+            if (strtou64(&n, name) != 0)
                 RAISE(JSON_TYPE_MISMATCH);
         }
-        else if (strcmp(pattern_path[i], parser->path[i].name) != 0)
+        else if (strncmp(p, name, len) != 0 || name[len] != '\0')
         {
             result = JSON_NO_MATCH;
             goto done;
         }
+
+        p += len + 1;
     }
 
     result = JSON_OK;
 
 done:
-
-    if (ptr && ptr != buf)
-        _free(parser, ptr);
-
     return result;
 }
 
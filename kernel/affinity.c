@@ -0,0 +1,413 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+#include <myst/affinity.h>
+#include <myst/eraise.h>
+#include <myst/spinlock.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+
+#define WORD_BITS 64
+
+static myst_cpuset_t _online;
+static size_t _num_cpus;
+
+/* the CPU ids are below this (rounded up to a whole word) */
+static size_t _nr_cpu_ids;
+
+/* guards the masks of all threads (which change rarely) */
+static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
+
+static bool _isset(const myst_cpuset_t* set, size_t cpu)
+{
+    return set->bits[cpu / WORD_BITS] & (1UL << (cpu % WORD_BITS));
+}
+
+static size_t _count(const myst_cpuset_t* set)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < MYST_COUNTOF(set->bits); i++)
+        n += (size_t)__builtin_popcountl(set->bits[i]);
+
+    return n;
+}
+
+int myst_affinity_init(void)
+{
+    long params[6] = {0, sizeof(_online), (long)&_online};
+    size_t last = 0;
+
+    memset(&_online, 0, sizeof(_online));
+
+    if (myst_tcall(SYS_sched_getaffinity, params) <= 0 ||
+        _count(&_online) == 0)
+    {
+        memset(&_online, 0, sizeof(_online));
+        _online.bits[0] = 1;
+    }
+
+    for (size_t i = 0; i < MYST_MAX_CPUS; i++)
+    {
+        if (_isset(&_online, i))
+            last = i;
+    }
+
+    _num_cpus = _count(&_online);
+    _nr_cpu_ids = (last / WORD_BITS + 1) * WORD_BITS;
+
+    return 0;
+}
+
+size_t myst_get_num_cpus(void)
+{
+    return _num_cpus ? _num_cpus : 1;
+}
+
+/* The mask of the thread (empty means all the online CPUs) */
+static void _get_mask(myst_thread_t* thread, myst_cpuset_t* mask)
+{
+    myst_spin_lock(&_lock);
+    *mask = thread->affinity;
+    myst_spin_unlock(&_lock);
+
+    if (_count(mask) == 0)
+        *mask = _online;
+}
+
+static long _set_host_mask(const myst_cpuset_t* mask)
+{
+    long params[6] = {0, sizeof(myst_cpuset_t), (long)mask};
+    long ret = myst_tcall(SYS_sched_setaffinity, params);
+    return ret > 0 ? 0 : ret;
+}
+
+static myst_thread_t* _find_thread(pid_t pid)
+{
+    if (pid < 0)
+        return NULL;
+
+    /* take a reference for the caller itself too (it is in the tid map) */
+    return myst_find_thread(pid == 0 ? myst_thread_self()->tid : pid);
+}
+
+long myst_syscall_sched_setaffinity(
+    pid_t pid,
+    size_t cpusetsize,
+    const void* mask)
+{
+    long ret = 0;
+    myst_thread_t* thread = NULL;
+    myst_cpuset_t set;
+
+    if (!mask)
+        ERAISE(-EFAULT);
+
+    if (!(thread = _find_thread(pid)))
+        ERAISE(-ESRCH);
+
+    /* CPUs beyond the set do not exist, so ignore them */
+    memset(&set, 0, sizeof(set));
+    memcpy(&set, mask, cpusetsize < sizeof(set) ? cpusetsize : sizeof(set));
+
+    for (size_t i = 0; i < MYST_COUNTOF(set.bits); i++)
+        set.bits[i] &= _online.bits[i];
+
+    if (_count(&set) == 0)
+        ERAISE(-EINVAL);
+
+    if (thread == myst_thread_self())
+    {
+        ECHECK(_set_host_mask(&set));
+
+        myst_spin_lock(&_lock);
+        thread->affinity = set;
+        thread->affinity_pending = false;
+        myst_spin_unlock(&_lock);
+    }
+    else
+    {
+        myst_spin_lock(&_lock);
+        thread->affinity = set;
+        thread->affinity_pending = true;
+        myst_spin_unlock(&_lock);
+    }
+
+done:
+    myst_put_thread(thread);
+    return ret;
+}
+
+long myst_syscall_sched_getaffinity(pid_t pid, size_t cpusetsize, void* mask)
+{
+    long ret = 0;
+    myst_thread_t* thread = NULL;
+    myst_cpuset_t set;
+    size_t size = _nr_cpu_ids / 8;
+
+    if (!mask)
+        ERAISE(-EFAULT);
+
+    /* as in Linux, the buffer must hold every CPU id in whole words */
+    if (cpusetsize * 8 < _nr_cpu_ids || (cpusetsize % sizeof(long)) != 0)
+        ERAISE(-EINVAL);
+
+    if (!(thread = _find_thread(pid)))
+        ERAISE(-ESRCH);
+
+    _get_mask(thread, &set);
+
+    memset(mask, 0, cpusetsize);
+    memcpy(mask, &set, size);
+    ret = (long)size;
+
+done:
+    myst_put_thread(thread);
+    return ret;
+}
+
+unsigned int myst_affinity_first_cpu(myst_thread_t* thread)
+{
+    myst_cpuset_t set;
+
+    _get_mask(thread, &set);
+
+    for (size_t i = 0; i < MYST_COUNTOF(set.bits); i++)
+    {
+        if (set.bits[i])
+            return (unsigned int)(i * WORD_BITS + __builtin_ctzl(set.bits[i]));
+    }
+
+    return 0;
+}
+
+void myst_affinity_apply_pending(myst_thread_t* thread)
+{
+    myst_cpuset_t set;
+    bool pending;
+
+    myst_spin_lock(&_lock);
+    set = thread->affinity;
+    pending = thread->affinity_pending;
+    thread->affinity_pending = false;
+    myst_spin_unlock(&_lock);
+
+    /* the mask only narrows the online CPUs, so this should not fail */
+    if (pending)
+        _set_host_mask(&set);
+}
+
+void myst_affinity_inherit(myst_thread_t* child, myst_thread_t* parent)
+{
+    myst_spin_lock(&_lock);
+    child->affinity = parent->affinity;
+    child->affinity_pending = _count(&parent->affinity) != 0;
+    myst_spin_unlock(&_lock);
+}
+
+int myst_format_cpuinfo(myst_buf_t* buf)
+{
+    int ret = 0;
+    size_t core = 0;
+
+    if (!buf)
+        ERAISE(-EINVAL);
+
+    /* one socket, one thread per core */
+    for (size_t i = 0; i < MYST_MAX_CPUS; i++)
+    {
+        char tmp[256];
+        int n;
+
+        if (!_isset(&_online, i))
+            continue;
+
+        n = snprintf(
+            tmp,
+            sizeof(tmp),
+            "processor\t: %zu\n"
+            "physical id\t: 0\n"
+            "siblings\t: %zu\n"
+            "core id\t\t: %zu\n"
+            "cpu cores\t: %zu\n"
+            "apicid\t\t: %zu\n"
+            "\n",
+            i,
+            _num_cpus,
+            core++,
+            _num_cpus,
+            i);
+
+        if (n < 0 || (size_t)n >= sizeof(tmp))
+            ERAISE(-EINVAL);
+
+        ECHECK(myst_buf_append(buf, tmp, (size_t)n));
+    }
+
+done:
+    return ret;
+}
+
+int myst_format_cpu_list(myst_buf_t* buf)
+{
+    int ret = 0;
+    const char* sep = "";
+    size_t i = 0;
+
+    if (!buf)
+        ERAISE(-EINVAL);
+
+    /* one range per run of consecutive online CPUs */
+    while (i < MYST_MAX_CPUS)
+    {
+        char tmp[32];
+        size_t j;
+        int n;
+
+        if (!_isset(&_online, i))
+        {
+            i++;
+            continue;
+        }
+
+        for (j = i; j + 1 < MYST_MAX_CPUS && _isset(&_online, j + 1); j++)
+            ;
+
+        if (i == j)
+            n = snprintf(tmp, sizeof(tmp), "%s%zu", sep, i);
+        else
+            n = snprintf(tmp, sizeof(tmp), "%s%zu-%zu", sep, i, j);
+
+        ECHECK(myst_buf_append(buf, tmp, (size_t)n));
+        sep = ",";
+        i = j + 1;
+    }
+
+    ECHECK(myst_buf_append(buf, "\n", 1));
+
+done:
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** Memory policy (a single node).
+**
+**==============================================================================
+*/
+
+#define MPOL_MODE_FLAGS ((1 << 15) | (1 << 14)) /* static, relative nodes */
+
+/* the policy set by set_mempolicy(), for get_mempolicy() */
+static int _mempolicy = MYST_MPOL_DEFAULT;
+
+/* Check the mode and that the nodes (if needed) include node 0 */
+static int _check_policy(
+    int mode,
+    const unsigned long* nodemask,
+    unsigned long maxnode)
+{
+    int ret = 0;
+    const int base = mode & ~MPOL_MODE_FLAGS;
+    const bool has_node0 = nodemask && maxnode && (nodemask[0] & 1);
+
+    if (base < MYST_MPOL_DEFAULT || base > MYST_MPOL_LOCAL)
+        ERAISE(-EINVAL);
+
+    if ((base == MYST_MPOL_BIND || base == MYST_MPOL_INTERLEAVE) && !has_node0)
+        ERAISE(-EINVAL);
+
+    if ((base == MYST_MPOL_DEFAULT || base == MYST_MPOL_LOCAL) &&
+        (mode & MPOL_MODE_FLAGS))
+    {
+        ERAISE(-EINVAL);
+    }
+
+done:
+    return ret;
+}
+
+long myst_syscall_get_mempolicy(
+    int* mode,
+    unsigned long* nodemask,
+    unsigned long maxnode,
+    void* addr,
+    unsigned long flags)
+{
+    long ret = 0;
+    const unsigned long all = MYST_MPOL_F_NODE | MYST_MPOL_F_ADDR;
+
+    if (flags & ~(all | MYST_MPOL_F_MEMS_ALLOWED))
+        ERAISE(-EINVAL);
+
+    if ((flags & MYST_MPOL_F_MEMS_ALLOWED) && (flags & all))
+        ERAISE(-EINVAL);
+
+    if (!(flags & MYST_MPOL_F_ADDR) && addr)
+        ERAISE(-EINVAL);
+
+    if (nodemask && maxnode == 0)
+        ERAISE(-EINVAL);
+
+    if (mode)
+    {
+        /* each page and each thread is on node 0 */
+        if (flags & MYST_MPOL_F_NODE)
+            *mode = 0;
+        else
+            *mode = (flags & MYST_MPOL_F_MEMS_ALLOWED) ? 0 : _mempolicy;
+    }
+
+    if (nodemask)
+    {
+        const size_t nwords = (maxnode + WORD_BITS - 1) / WORD_BITS;
+
+        memset(nodemask, 0, nwords * sizeof(long));
+        nodemask[0] = 1;
+    }
+
+done:
+    return ret;
+}
+
+long myst_syscall_set_mempolicy(
+    int mode,
+    const unsigned long* nodemask,
+    unsigned long maxnode)
+{
+    long ret = 0;
+
+    ECHECK(_check_policy(mode, nodemask, maxnode));
+    _mempolicy = mode & ~MPOL_MODE_FLAGS;
+
+done:
+    return ret;
+}
+
+long myst_syscall_mbind(
+    void* addr,
+    unsigned long len,
+    int mode,
+    const unsigned long* nodemask,
+    unsigned long maxnode,
+    unsigned int flags)
+{
+    long ret = 0;
+    const unsigned int all = (1 << 0) | (1 << 1) | (1 << 2); /* MPOL_MF_* */
+
+    (void)len;
+
+    if (((uintptr_t)addr % PAGE_SIZE) != 0 || (flags & ~all))
+        ERAISE(-EINVAL);
+
+    ECHECK(_check_policy(mode, nodemask, maxnode));
+
+done:
+    return ret;
+}
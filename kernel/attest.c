@@ -0,0 +1,1124 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/attest.h>
+#include <myst/clock.h>
+#include <myst/cond.h>
+#include <myst/eraise.h>
+#include <myst/mutex.h>
+#include <myst/sha256.h>
+#include <myst/syscallext.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+#include <myst/time.h>
+#include <myst/timer.h>
+
+/*
+**==============================================================================
+**
+** Attestation evidence cache (enabled by --attestation-cache-ttl).
+**
+**     A quote takes the quoting enclave a long time, and every report and
+**     attested certificate needs a fresh one. Yet programs (and TLS servers
+**     in particular) keep asking for the evidence of the same inputs. So the
+**     evidence is kept for the TTL, keyed by the call and a hash of all its
+**     inputs (the flags, the report data and the optional parameters, or
+**     the subject and the key pair), and each caller gets a copy of it.
+**
+**     A refresh thread generates the evidence again a quarter of the TTL
+**     before it expires, if it was handed out since it was generated, so a
+**     caller only waits for a quote the first time. Evidence that nobody
+**     asked for again is dropped when it expires. Failures are never cached.
+**
+**     The cache keeps at most MAX_ENTRIES entries and evicts the least
+**     recently used one. A single mutex guards the entries and the copies;
+**     the target is never called with it held.
+**
+**     The derived seal keys are cached too (see below), with or without a
+**     TTL.
+**
+**==============================================================================
+*/
+
+#define MAX_ENTRIES 32
+#define MAX_INPUTS 3
+#define MAX_OUTPUTS 2
+
+/* How long after a failed refresh to try again */
+#define RETRY_NSEC NANO_IN_SECOND
+
+enum
+{
+    KIND_REPORT,
+    KIND_CERT,
+    KIND_CREDS,
+};
+
+typedef struct blob
+{
+    uint8_t* data;
+    size_t size;
+} blob_t;
+
+typedef struct entry entry_t;
+
+struct entry
+{
+    entry_t* next;
+    _Atomic(size_t) refs; /* the list and the refresh thread */
+    int kind;
+    uint32_t flags;
+    myst_sha256_t key;
+    blob_t in[MAX_INPUTS];   /* kernel copies of the inputs */
+    blob_t out[MAX_OUTPUTS]; /* the evidence as the target returned it */
+    uint64_t expires;
+    uint64_t refresh; /* when the refresh thread looks at it next */
+    bool used;        /* handed out since it was generated */
+    bool refreshing;
+};
+
+/* A copy of cached evidence, handed out until a free function takes it */
+typedef struct copy copy_t;
+
+struct copy
+{
+    copy_t* next;
+    size_t size;
+    uint8_t data[];
+};
+
+static uint64_t _ttl; /* nanoseconds (zero if the cache is disabled) */
+static myst_mutex_t _lock;
+static myst_cond_t _cond;
+static entry_t* _entries;
+static size_t _num_entries;
+static copy_t* _copies;
+static bool _started;
+static bool _stopping;
+static _Atomic(size_t) _num_running;
+
+/*
+**==============================================================================
+**
+** The calls into the target
+**
+**==============================================================================
+*/
+
+static long _target_get_report(const myst_oe_report_args_t* a)
+{
+    uint64_t args[7] = {a->flags,
+                        (uint64_t)a->report_data,
+                        a->report_data_size,
+                        (uint64_t)a->opt_params,
+                        a->opt_params_size,
+                        (uint64_t)a->report_buffer,
+                        (uint64_t)a->report_buffer_size};
+    long params[6] = {(long)args};
+
+    return myst_tcall(SYS_myst_oe_get_report_v2, params);
+}
+
+static void _target_free_report(uint8_t* report_buffer)
+{
+    uint64_t args[1] = {(uint64_t)report_buffer};
+    long params[6] = {(long)args};
+
+    myst_tcall(SYS_myst_oe_free_report, params);
+}
+
+static long _target_generate_certificate(const myst_oe_cert_args_t* a)
+{
+    uint64_t args[7] = {(uint64_t)a->subject_name,
+                        (uint64_t)a->private_key,
+                        a->private_key_size,
+                        (uint64_t)a->public_key,
+                        a->public_key_size,
+                        (uint64_t)a->output_cert,
+                        (uint64_t)a->output_cert_size};
+    long params[6] = {(long)args};
+
+    return myst_tcall(SYS_myst_oe_generate_attestation_certificate, params);
+}
+
+static void _target_free_certificate(uint8_t* cert)
+{
+    uint64_t args[1] = {(uint64_t)cert};
+    long params[6] = {(long)args};
+
+    myst_tcall(SYS_myst_oe_free_attestation_certificate, params);
+}
+
+static long _target_gen_creds(
+    uint8_t** cert,
+    size_t* cert_size,
+    uint8_t** private_key,
+    size_t* private_key_size)
+{
+    long params[6] = {
+        (long)cert, (long)cert_size, (long)private_key, (long)private_key_size};
+
+    return myst_tcall(MYST_TCALL_GEN_CREDS, params);
+}
+
+static void _target_free_creds(
+    uint8_t* cert,
+    size_t cert_size,
+    uint8_t* private_key,
+    size_t private_key_size)
+{
+    long params[6] = {
+        (long)cert, (long)cert_size, (long)private_key, (long)private_key_size};
+
+    myst_tcall(MYST_TCALL_FREE_CREDS, params);
+}
+
+/*
+**==============================================================================
+**
+** Entries
+**
+**==============================================================================
+*/
+
+static void _free_entry(entry_t* e)
+{
+    switch (e->kind)
+    {
+        case KIND_REPORT:
+            if (e->out[0].data)
+                _target_free_report(e->out[0].data);
+            break;
+        case KIND_CERT:
+            if (e->out[0].data)
+                _target_free_certificate(e->out[0].data);
+            break;
+        case KIND_CREDS:
+            if (e->out[0].data || e->out[1].data)
+            {
+                _target_free_creds(
+                    e->out[0].data,
+                    e->out[0].size,
+                    e->out[1].data,
+                    e->out[1].size);
+            }
+            break;
+    }
+
+    /* the inputs may hold a private key */
+    for (size_t i = 0; i < MAX_INPUTS; i++)
+    {
+        if (e->in[i].data)
+        {
+            memset(e->in[i].data, 0, e->in[i].size);
+            free(e->in[i].data);
+        }
+    }
+
+    free(e);
+}
+
+static void _put(entry_t* e)
+{
+    if (--e->refs == 0)
+        _free_entry(e);
+}
+
+/* Copy an input into the entry (false if the target should see it as is) */
+static bool _set_input(entry_t* e, size_t i, const void* data, size_t size)
+{
+    if (!data)
+        return size == 0;
+
+    /* keep a non-null pointer for an empty input too */
+    if (!(e->in[i].data = malloc(size ? size : 1)))
+        return false;
+
+    memcpy(e->in[i].data, data, size);
+    e->in[i].size = size;
+    return true;
+}
+
+static entry_t* _new_entry(int kind, uint32_t flags)
+{
+    entry_t* e;
+
+    if (!(e = calloc(1, sizeof(entry_t))))
+        return NULL;
+
+    e->kind = kind;
+    e->flags = flags;
+    return e;
+}
+
+/* The key covers the call and every byte of its inputs */
+static int _compute_key(entry_t* e)
+{
+    int ret = 0;
+    myst_sha256_ctx_t ctx;
+    const uint64_t header[2] = {(uint64_t)e->kind, e->flags};
+
+    ECHECK(myst_sha256_start(&ctx));
+    ECHECK(myst_sha256_update(&ctx, header, sizeof(header)));
+
+    for (size_t i = 0; i < MAX_INPUTS; i++)
+    {
+        const uint64_t prefix[2] = {e->in[i].data != NULL, e->in[i].size};
+
+        ECHECK(myst_sha256_update(&ctx, prefix, sizeof(prefix)));
+
+        if (e->in[i].size)
+            ECHECK(myst_sha256_update(&ctx, e->in[i].data, e->in[i].size));
+    }
+
+    ECHECK(myst_sha256_finish(&ctx, &e->key));
+
+done:
+    return ret;
+}
+
+/* Generate the evidence of the entry's inputs into its outputs */
+static long _generate(entry_t* e)
+{
+    switch (e->kind)
+    {
+        case KIND_REPORT:
+        {
+            myst_oe_report_args_t args = {
+                e->flags,
+                e->in[0].data,
+                e->in[0].size,
+                e->in[1].data,
+                e->in[1].size,
+                &e->out[0].data,
+                &e->out[0].size,
+            };
+
+            return _target_get_report(&args);
+        }
+        case KIND_CERT:
+        {
+            myst_oe_cert_args_t args = {
+                e->in[0].data,
+                e->in[1].data,
+                e->in[1].size,
+                e->in[2].data,
+                e->in[2].size,
+                &e->out[0].data,
+                &e->out[0].size,
+            };
+
+            return _target_generate_certificate(&args);
+        }
+        case KIND_CREDS:
+        {
+            return _target_gen_creds(
+                &e->out[0].data,
+                &e->out[0].size,
+                &e->out[1].data,
+                &e->out[1].size);
+        }
+    }
+
+    return -EINVAL;
+}
+
+/* Give the outputs of the entry to the caller (the entry then has none) */
+static void _hand_over(entry_t* e, uint8_t** out[], size_t* out_size[])
+{
+    for (size_t i = 0; i < MAX_OUTPUTS && out[i]; i++)
+    {
+        *out[i] = e->out[i].data;
+        *out_size[i] = e->out[i].size;
+        e->out[i].data = NULL;
+        e->out[i].size = 0;
+    }
+}
+
+/* Hand out copies of the blobs (call with the lock) */
+static int _copy_out(const blob_t* blobs, uint8_t** out[], size_t* out_size[])
+{
+    copy_t* copies[MAX_OUTPUTS] = {NULL};
+    size_t n = 0;
+
+    for (; n < MAX_OUTPUTS && out[n]; n++)
+    {
+        const size_t size = blobs[n].size;
+
+        if (!(copies[n] = malloc(sizeof(copy_t) + size)))
+        {
+            while (n--)
+                free(copies[n]);
+
+            return -ENOMEM;
+        }
+
+        copies[n]->size = size;
+        memcpy(copies[n]->data, blobs[n].data, size);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        copies[i]->next = _copies;
+        _copies = copies[i];
+        *out[i] = copies[i]->data;
+        *out_size[i] = copies[i]->size;
+    }
+
+    return 0;
+}
+
+/* Take a copy back (false if the buffer is not one of the copies) */
+static bool _free_copy(uint8_t* data)
+{
+    copy_t* copy = NULL;
+
+    if (!data)
+        return false;
+
+    myst_mutex_lock(&_lock);
+
+    for (copy_t **p = &_copies; *p; p = &(*p)->next)
+    {
+        if ((*p)->data == data)
+        {
+            copy = *p;
+            *p = copy->next;
+            break;
+        }
+    }
+
+    myst_mutex_unlock(&_lock);
+
+    if (!copy)
+        return false;
+
+    memset(copy->data, 0, copy->size);
+    free(copy);
+    return true;
+}
+
+/* Call with the lock */
+static void _unlink(entry_t* e)
+{
+    for (entry_t** p = &_entries; *p; p = &(*p)->next)
+    {
+        if (*p == e)
+        {
+            *p = e->next;
+            e->next = NULL;
+            _num_entries--;
+            return;
+        }
+    }
+}
+
+/* Call with the lock */
+static entry_t* _find(const myst_sha256_t* key)
+{
+    for (entry_t* e = _entries; e; e = e->next)
+    {
+        if (memcmp(&e->key, key, sizeof(myst_sha256_t)) == 0)
+            return e;
+    }
+
+    return NULL;
+}
+
+/*
+**==============================================================================
+**
+** The refresh thread
+**
+**==============================================================================
+*/
+
+static void _install(entry_t* e, entry_t** replaced, entry_t** evicted);
+
+static void _refresh(entry_t* old)
+{
+    entry_t* e;
+    entry_t* replaced = NULL;
+    entry_t* evicted = NULL;
+    bool ok = false;
+
+    if ((e = _new_entry(old->kind, old->flags)))
+    {
+        ok = true;
+
+        for (size_t i = 0; i < MAX_INPUTS; i++)
+            ok = ok && _set_input(e, i, old->in[i].data, old->in[i].size);
+
+        e->key = old->key;
+        e->refs = 1;
+
+        if (!ok || _generate(e) != 0)
+        {
+            ok = false;
+            _put(e);
+        }
+    }
+
+    myst_mutex_lock(&_lock);
+
+    if (ok && !_stopping)
+    {
+        _install(e, &replaced, &evicted);
+    }
+    else if (ok)
+    {
+        /* the cache is going away */
+        replaced = e;
+    }
+    else
+    {
+        old->refreshing = false;
+        old->refresh = myst_timer_now() + RETRY_NSEC;
+    }
+
+    myst_mutex_unlock(&_lock);
+
+    if (replaced)
+        _put(replaced);
+
+    if (evicted)
+        _put(evicted);
+}
+
+static int _refresh_thread(void* arg)
+{
+    (void)arg;
+
+    myst_mutex_lock(&_lock);
+
+    while (!_stopping)
+    {
+        const uint64_t now = myst_timer_now();
+        uint64_t next = UINT64_MAX;
+        entry_t* e = NULL;
+
+        for (entry_t* p = _entries; p; p = p->next)
+        {
+            if (p->refreshing)
+                continue;
+
+            if (p->expires <= now || p->refresh <= now)
+            {
+                e = p;
+                break;
+            }
+
+            if (p->refresh < next)
+                next = p->refresh;
+        }
+
+        if (e && (e->expires <= now || !e->used))
+        {
+            /* drop it when it expires unless it is used again */
+            if (e->expires <= now)
+            {
+                _unlink(e);
+                myst_mutex_unlock(&_lock);
+                _put(e);
+                myst_mutex_lock(&_lock);
+            }
+            else
+            {
+                e->refresh = e->expires;
+            }
+        }
+        else if (e)
+        {
+            e->refreshing = true;
+            e->refs++;
+            myst_mutex_unlock(&_lock);
+
+            _refresh(e);
+            _put(e);
+
+            myst_mutex_lock(&_lock);
+        }
+        else if (next == UINT64_MAX)
+        {
+            myst_cond_wait(&_cond, &_lock);
+        }
+        else
+        {
+            struct timespec ts;
+            const uint64_t wait = next - now;
+
+            ts.tv_sec = (time_t)(wait / NANO_IN_SECOND);
+            ts.tv_nsec = (long)(wait % NANO_IN_SECOND);
+            myst_cond_timedwait(&_cond, &_lock, &ts);
+        }
+    }
+
+    myst_mutex_unlock(&_lock);
+    _num_running--;
+
+    return 0;
+}
+
+/* Add a newly generated entry to the front (call with the lock) */
+static void _install(entry_t* e, entry_t** replaced, entry_t** evicted)
+{
+    const uint64_t now = myst_timer_now();
+
+    e->expires = now + _ttl;
+    e->refresh = e->expires - _ttl / 4;
+    e->used = false;
+    e->refreshing = false;
+
+    if ((*replaced = _find(&e->key)))
+        _unlink(*replaced);
+
+    if (_num_entries == MAX_ENTRIES)
+    {
+        entry_t* last = NULL;
+
+        for (entry_t* p = _entries; p; p = p->next)
+        {
+            if (!p->refreshing)
+                last = p;
+        }
+
+        if ((*evicted = last))
+            _unlink(last);
+    }
+
+    e->next = _entries;
+    _entries = e;
+    _num_entries++;
+
+    /* start the refresh thread with the first entry */
+    if (!_started && !_stopping)
+    {
+        _num_running++;
+
+        if (myst_create_kernel_thread(_refresh_thread, NULL, "attest") != 0)
+            _num_running--;
+        else
+            _started = true;
+    }
+
+    myst_cond_signal(&_cond);
+}
+
+/*
+**==============================================================================
+**
+** Seal keys
+**
+**     EGETKEY derives the same key from the same key request for as long as
+**     the enclave runs, so the derived seal keys are kept, whatever the TTL.
+**     Each entry holds a key request (the key info) and the key that it
+**     derives, and the key of a seal policy is found by the policy as well.
+**     Callers get copies, and the cached keys are zeroed when evicted and
+**     when the kernel exits.
+**
+**==============================================================================
+*/
+
+#define MAX_SEAL_KEYS 16
+
+/* The policy of an entry whose key came by key info */
+#define NO_POLICY UINT64_MAX
+
+typedef struct seal_key seal_key_t;
+
+struct seal_key
+{
+    seal_key_t* next;
+    uint64_t policy;
+    blob_t blobs[MAX_OUTPUTS]; /* the key and the key info */
+};
+
+static seal_key_t* _seal_keys;
+static size_t _num_seal_keys;
+
+static void _free_seal_key(seal_key_t* k)
+{
+    for (size_t i = 0; i < MAX_OUTPUTS; i++)
+    {
+        if (k->blobs[i].data)
+        {
+            memset(k->blobs[i].data, 0, k->blobs[i].size);
+            free(k->blobs[i].data);
+        }
+    }
+
+    free(k);
+}
+
+static void _target_free_seal_key(uint8_t* key_buffer, uint8_t* key_info)
+{
+    uint64_t args[2] = {(uint64_t)key_buffer, (uint64_t)key_info};
+    long params[6] = {(long)args};
+
+    myst_tcall(SYS_myst_oe_free_seal_key, params);
+}
+
+/* Find the key of the policy or of the key info (call with the lock) */
+static seal_key_t* _find_seal_key(
+    uint64_t policy,
+    const uint8_t* key_info,
+    size_t key_info_size)
+{
+    seal_key_t* prev = NULL;
+
+    for (seal_key_t* k = _seal_keys; k; prev = k, k = k->next)
+    {
+        const blob_t* info = &k->blobs[1];
+        bool match;
+
+        if (policy == NO_POLICY)
+        {
+            match = info->size == key_info_size &&
+                    memcmp(info->data, key_info, key_info_size) == 0;
+        }
+        else
+        {
+            match = k->policy == policy;
+        }
+
+        if (match)
+        {
+            /* move it to the front */
+            if (prev)
+            {
+                prev->next = k->next;
+                k->next = _seal_keys;
+                _seal_keys = k;
+            }
+
+            return k;
+        }
+    }
+
+    return NULL;
+}
+
+/* Keep a copy of a key that the target derived (errors are ignored) */
+static void _add_seal_key(
+    uint64_t policy,
+    const uint8_t* key,
+    size_t key_size,
+    const uint8_t* key_info,
+    size_t key_info_size)
+{
+    seal_key_t* k;
+    seal_key_t* evicted = NULL;
+
+    if (!key || !key_info || !(k = calloc(1, sizeof(seal_key_t))))
+        return;
+
+    k->policy = policy;
+
+    if (!(k->blobs[0].data = malloc(key_size)) ||
+        !(k->blobs[1].data = malloc(key_info_size)))
+    {
+        _free_seal_key(k);
+        return;
+    }
+
+    memcpy(k->blobs[0].data, key, key_size);
+    k->blobs[0].size = key_size;
+    memcpy(k->blobs[1].data, key_info, key_info_size);
+    k->blobs[1].size = key_info_size;
+
+    myst_mutex_lock(&_lock);
+
+    if (_stopping || _find_seal_key(policy, key_info, key_info_size))
+    {
+        /* another thread was faster (or the kernel is exiting) */
+        evicted = k;
+    }
+    else
+    {
+        k->next = _seal_keys;
+        _seal_keys = k;
+
+        if (++_num_seal_keys > MAX_SEAL_KEYS)
+        {
+            seal_key_t** p = &_seal_keys;
+
+            while ((*p)->next)
+                p = &(*p)->next;
+
+            evicted = *p;
+            *p = NULL;
+            _num_seal_keys--;
+        }
+    }
+
+    myst_mutex_unlock(&_lock);
+
+    if (evicted)
+        _free_seal_key(evicted);
+}
+
+/* Hand out copies of a cached key (false if it is not cached) */
+static bool _get_seal_key(
+    uint64_t policy,
+    const uint8_t* key_info,
+    size_t key_info_size,
+    uint8_t** out[],
+    size_t* out_size[])
+{
+    seal_key_t* k;
+    bool ret = false;
+
+    myst_mutex_lock(&_lock);
+
+    if ((k = _find_seal_key(policy, key_info, key_info_size)))
+        ret = _copy_out(k->blobs, out, out_size) == 0;
+
+    myst_mutex_unlock(&_lock);
+
+    return ret;
+}
+
+long myst_attest_get_seal_key_by_policy(
+    uint64_t policy,
+    uint8_t** key_buffer,
+    size_t* key_buffer_size,
+    uint8_t** key_info,
+    size_t* key_info_size)
+{
+    long ret;
+    uint8_t* info = NULL;
+    size_t info_size = 0;
+    uint64_t args[5] = {
+        policy, (uint64_t)key_buffer, (uint64_t)key_buffer_size};
+    long params[6] = {(long)args};
+    uint8_t** out[MAX_OUTPUTS] = {key_buffer, key_info};
+    size_t* out_size[MAX_OUTPUTS] = {key_buffer_size, key_info_size};
+
+    if (!key_buffer || !key_buffer_size || (key_info && !key_info_size) ||
+        policy == NO_POLICY)
+    {
+        args[3] = (uint64_t)key_info;
+        args[4] = (uint64_t)key_info_size;
+        return myst_tcall(SYS_myst_oe_get_seal_key_by_policy_v2, params);
+    }
+
+    if (_get_seal_key(policy, NULL, 0, out, out_size))
+        return 0;
+
+    /* the key info is needed to cache the key */
+    args[3] = (uint64_t)&info;
+    args[4] = (uint64_t)&info_size;
+
+    if ((ret = myst_tcall(SYS_myst_oe_get_seal_key_by_policy_v2, params)) != 0)
+        return ret;
+
+    _add_seal_key(policy, *key_buffer, *key_buffer_size, info, info_size);
+
+    if (key_info)
+    {
+        *key_info = info;
+        *key_info_size = info_size;
+    }
+    else if (info)
+    {
+        _target_free_seal_key(NULL, info);
+    }
+
+    return 0;
+}
+
+long myst_attest_get_seal_key(
+    const uint8_t* key_info,
+    size_t key_info_size,
+    uint8_t** key_buffer,
+    size_t* key_buffer_size)
+{
+    long ret;
+    uint64_t args[4] = {(uint64_t)key_info,
+                        key_info_size,
+                        (uint64_t)key_buffer,
+                        (uint64_t)key_buffer_size};
+    long params[6] = {(long)args};
+    uint8_t** out[MAX_OUTPUTS] = {key_buffer};
+    size_t* out_size[MAX_OUTPUTS] = {key_buffer_size};
+
+    if (!key_info || !key_buffer || !key_buffer_size)
+        return myst_tcall(SYS_myst_oe_get_seal_key_v2, params);
+
+    if (_get_seal_key(NO_POLICY, key_info, key_info_size, out, out_size))
+        return 0;
+
+    if ((ret = myst_tcall(SYS_myst_oe_get_seal_key_v2, params)) != 0)
+        return ret;
+
+    _add_seal_key(
+        NO_POLICY, *key_buffer, *key_buffer_size, key_info, key_info_size);
+
+    return 0;
+}
+
+void myst_attest_free_seal_key(uint8_t* key_buffer, uint8_t* key_info)
+{
+    if (_free_copy(key_buffer))
+        key_buffer = NULL;
+
+    if (_free_copy(key_info))
+        key_info = NULL;
+
+    if (key_buffer || key_info)
+        _target_free_seal_key(key_buffer, key_info);
+}
+
+/*
+**==============================================================================
+**
+** The cached calls
+**
+**==============================================================================
+*/
+
+/* Return copies of the evidence of the entry's inputs (taking the entry) */
+static long _get(entry_t* e, uint8_t** out[], size_t* out_size[])
+{
+    long ret;
+    entry_t* found;
+    entry_t* replaced = NULL;
+    entry_t* evicted = NULL;
+
+    e->refs = 1;
+
+    /* without a key, nothing is cached */
+    if (_compute_key(e) != 0)
+    {
+        if ((ret = _generate(e)) == 0)
+            _hand_over(e, out, out_size);
+
+        _put(e);
+        return ret;
+    }
+
+    myst_mutex_lock(&_lock);
+
+    found = _find(&e->key);
+
+    if (found && found->expires > myst_timer_now() &&
+        _copy_out(found->out, out, out_size) == 0)
+    {
+        found->used = true;
+
+        /* move it to the front */
+        _unlink(found);
+        found->next = _entries;
+        _entries = found;
+        _num_entries++;
+
+        myst_mutex_unlock(&_lock);
+        _put(e);
+        return 0;
+    }
+
+    myst_mutex_unlock(&_lock);
+
+    if ((ret = _generate(e)) != 0)
+    {
+        _put(e);
+        return ret;
+    }
+
+    myst_mutex_lock(&_lock);
+
+    if (_stopping || _copy_out(e->out, out, out_size) != 0)
+    {
+        /* hand the target's evidence to the caller instead */
+        myst_mutex_unlock(&_lock);
+        _hand_over(e, out, out_size);
+        _put(e);
+        return 0;
+    }
+
+    _install(e, &replaced, &evicted);
+    myst_mutex_unlock(&_lock);
+
+    if (replaced)
+        _put(replaced);
+
+    if (evicted)
+        _put(evicted);
+
+    return 0;
+}
+
+void myst_attest_cache_init(uint64_t ttl_sec)
+{
+    /* the TTL is at most a day */
+    if (ttl_sec > 24 * 60 * 60)
+        ttl_sec = 24 * 60 * 60;
+
+    _ttl = ttl_sec * NANO_IN_SECOND;
+}
+
+void myst_attest_cache_stop(void)
+{
+    entry_t* entries;
+    seal_key_t* seal_keys;
+    copy_t* copies;
+
+    myst_mutex_lock(&_lock);
+    _stopping = true;
+    entries = _entries;
+    _entries = NULL;
+    _num_entries = 0;
+    seal_keys = _seal_keys;
+    _seal_keys = NULL;
+    _num_seal_keys = 0;
+    copies = _copies;
+    _copies = NULL;
+    myst_cond_signal(&_cond);
+    myst_mutex_unlock(&_lock);
+
+    /* zero the cached keys and the copies that programs did not free */
+    while (copies)
+    {
+        copy_t* next = copies->next;
+        memset(copies->data, 0, copies->size);
+        free(copies);
+        copies = next;
+    }
+
+    while (seal_keys)
+    {
+        seal_key_t* next = seal_keys->next;
+        _free_seal_key(seal_keys);
+        seal_keys = next;
+    }
+
+    /* Wait ~1 second for the thread to exit */
+    for (size_t i = 0; i < 1000 && _num_running; i++)
+        myst_sleep_msec(1);
+
+    while (entries)
+    {
+        entry_t* next = entries->next;
+        _put(entries);
+        entries = next;
+    }
+}
+
+long myst_attest_get_report(const myst_oe_report_args_t* args)
+{
+    entry_t* e;
+    uint8_t** out[MAX_OUTPUTS] = {args->report_buffer};
+    size_t* out_size[MAX_OUTPUTS] = {args->report_buffer_size};
+
+    if (!_ttl || !args->report_buffer || !args->report_buffer_size)
+        return _target_get_report(args);
+
+    if (!(e = _new_entry(KIND_REPORT, args->flags)))
+        return _target_get_report(args);
+
+    if (!_set_input(e, 0, args->report_data, args->report_data_size) ||
+        !_set_input(e, 1, args->opt_params, args->opt_params_size))
+    {
+        _free_entry(e);
+        return _target_get_report(args);
+    }
+
+    return _get(e, out, out_size);
+}
+
+void myst_attest_free_report(uint8_t* report_buffer)
+{
+    if (!_free_copy(report_buffer))
+        _target_free_report(report_buffer);
+}
+
+long myst_attest_generate_certificate(const myst_oe_cert_args_t* args)
+{
+    entry_t* e;
+    uint8_t** out[MAX_OUTPUTS] = {args->output_cert};
+    size_t* out_size[MAX_OUTPUTS] = {args->output_cert_size};
+    const char* subject = (const char*)args->subject_name;
+
+    if (!_ttl || !subject || !args->output_cert || !args->output_cert_size)
+        return _target_generate_certificate(args);
+
+    if (!(e = _new_entry(KIND_CERT, 0)))
+        return _target_generate_certificate(args);
+
+    if (!_set_input(e, 0, subject, strlen(subject) + 1) ||
+        !_set_input(e, 1, args->private_key, args->private_key_size) ||
+        !_set_input(e, 2, args->public_key, args->public_key_size))
+    {
+        _free_entry(e);
+        return _target_generate_certificate(args);
+    }
+
+    return _get(e, out, out_size);
+}
+
+void myst_attest_free_certificate(uint8_t* cert)
+{
+    if (!_free_copy(cert))
+        _target_free_certificate(cert);
+}
+
+void myst_attest_free_key(
+    uint8_t* key,
+    size_t key_size,
+    uint8_t* key_info,
+    size_t key_info_size)
+{
+    if (_free_copy(key))
+        key = NULL;
+
+    if (_free_copy(key_info))
+        key_info = NULL;
+
+    if (key || key_info)
+    {
+        uint64_t args[4] = {
+            (uint64_t)key, key_size, (uint64_t)key_info, key_info_size};
+        long params[6] = {(long)args};
+
+        myst_tcall(SYS_myst_oe_free_key, params);
+    }
+}
+
+long myst_attest_gen_creds(
+    uint8_t** cert,
+    size_t* cert_size,
+    uint8_t** private_key,
+    size_t* private_key_size)
+{
+    entry_t* e;
+    uint8_t** out[MAX_OUTPUTS] = {cert, private_key};
+    size_t* out_size[MAX_OUTPUTS] = {cert_size, private_key_size};
+
+    if (!_ttl || !cert || !cert_size || !private_key || !private_key_size ||
+        !(e = _new_entry(KIND_CREDS, 0)))
+    {
+        return _target_gen_creds(
+            cert, cert_size, private_key, private_key_size);
+    }
+
+    return _get(e, out, out_size);
+}
+
+void myst_attest_free_creds(
+    uint8_t* cert,
+    size_t cert_size,
+    uint8_t* private_key,
+    size_t private_key_size)
+{
+    if (_free_copy(cert))
+        cert = NULL;
+
+    if (_free_copy(private_key))
+        private_key = NULL;
+
+    if (cert || private_key)
+        _target_free_creds(cert, cert_size, private_key, private_key_size);
+}
@@ -4,11 +4,14 @@
 #include <elf.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include <myst/backtrace.h>
 #include <myst/defs.h>
 #include <myst/eraise.h>
 #include <myst/kernel.h>
+#include <myst/mmanutils.h>
 #include <myst/printf.h>
 
 const void* _check_address(const void* ptr)
@@ -68,7 +71,8 @@ static int _symtab_find_name(
     const void* strtab,
     size_t strtab_size,
     uint64_t addr,
-    const char** name)
+    const char** name,
+    uint64_t* start)
 {
     int ret = 0;
     const Elf64_Sym* s = symtab;
@@ -98,6 +102,7 @@ static int _symtab_find_name(
             {
                 ECHECK(
                     _symtab_get_string(strtab, strtab_size, p->st_name, name));
+                *start = lo;
                 goto done;
             }
         }
@@ -109,10 +114,259 @@ done:
     return ret;
 }
 
-static int _addr_to_func_name(uint64_t addr, const char** name)
+/*
+**==============================================================================
+**
+** The symbol index:
+**
+**     The first lookup sorts the functions of the symbol tables by address,
+**     which later lookups binary-search, so that dumping the backtraces of
+**     thousands of leaks does not scan the tables for every frame. A
+**     direct-mapped memo of recent addresses (each entry a single word, so
+**     that concurrent lookups need no lock) saves even the search for the
+**     frames that every backtrace shares.
+**
+**     The index comes from myst_mmap() rather than malloc(), since the leak
+**     checker symbolizes while it walks the allocations. Until the index is
+**     built (or if it cannot be), lookups scan the tables as before: this
+**     includes a panic while the index is being built.
+**
+**==============================================================================
+*/
+
+typedef struct symbol
+{
+    uint32_t lo;   /* the offset of the function in the kernel image */
+    uint32_t size; /* the size of the function */
+    const char* name;
+} symbol_t;
+
+#define INDEX_NONE 0
+#define INDEX_BUILDING 1
+#define INDEX_READY 2
+#define INDEX_FAILED 3
+
+#define MEMO_SIZE 4096 /* a power of two */
+
+static int _index_state;
+static symbol_t* _symbols;
+static size_t _nsymbols;
+
+/* (kernel offset << 32) | (symbol index + 1), or zero */
+static uint64_t _memo[MEMO_SIZE];
+
+/* Count (or, if symbols is non-null, add) the functions of a table */
+static size_t _index_table(
+    const void* symtab,
+    size_t symtab_size,
+    const void* strtab,
+    size_t strtab_size,
+    symbol_t* symbols)
+{
+    const Elf64_Sym* s = symtab;
+    size_t n = 0;
+
+    if (!symtab || !strtab)
+        return 0;
+
+    for (size_t i = 0; i < symtab_size / sizeof(Elf64_Sym); i++)
+    {
+        const Elf64_Sym* p = &s[i];
+        const char* name;
+
+        if (ELF64_ST_TYPE(p->st_info) != STT_FUNC ||
+            p->st_value > UINT32_MAX || p->st_size > UINT32_MAX)
+        {
+            continue;
+        }
+
+        if (symbols)
+        {
+            if (_symtab_get_string(strtab, strtab_size, p->st_name, &name))
+                continue;
+
+            symbols[n].lo = (uint32_t)p->st_value;
+            symbols[n].size = (uint32_t)p->st_size;
+            symbols[n].name = name;
+        }
+
+        n++;
+    }
+
+    return n;
+}
+
+/* By address, and the aliases at an address by name (to be repeatable) */
+static int _compare_symbols(const void* a, const void* b)
+{
+    const symbol_t* x = a;
+    const symbol_t* y = b;
+
+    if (x->lo != y->lo)
+        return x->lo < y->lo ? -1 : 1;
+
+    return strcmp(x->name, y->name);
+}
+
+static void _build_index(void)
+{
+    const myst_kernel_args_t* args = &__myst_kernel_args;
+    size_t n;
+    size_t size;
+    symbol_t* symbols;
+    long r;
+
+    n = _index_table(
+        args->symtab_data,
+        args->symtab_size,
+        args->strtab_data,
+        args->strtab_size,
+        NULL);
+    n += _index_table(
+        args->dynsym_data,
+        args->dynsym_size,
+        args->dynstr_data,
+        args->dynstr_size,
+        NULL);
+
+    size = n * sizeof(symbol_t);
+    r = (long)myst_mmap(
+        NULL,
+        size ? size : 1,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+
+    if (r < 0)
+    {
+        __atomic_store_n(&_index_state, INDEX_FAILED, __ATOMIC_RELEASE);
+        return;
+    }
+
+    symbols = (symbol_t*)r;
+    n = _index_table(
+        args->symtab_data,
+        args->symtab_size,
+        args->strtab_data,
+        args->strtab_size,
+        symbols);
+    n += _index_table(
+        args->dynsym_data,
+        args->dynsym_size,
+        args->dynstr_data,
+        args->dynstr_size,
+        symbols + n);
+
+    qsort(symbols, n, sizeof(symbol_t), _compare_symbols);
+
+    _symbols = symbols;
+    _nsymbols = n;
+    __atomic_store_n(&_index_state, INDEX_READY, __ATOMIC_RELEASE);
+}
+
+/* Whether the index is ready (building it on the first call) */
+static bool _index_ready(void)
+{
+    int state = __atomic_load_n(&_index_state, __ATOMIC_ACQUIRE);
+
+    if (state == INDEX_NONE)
+    {
+        if (__atomic_compare_exchange_n(
+                &_index_state,
+                &state,
+                INDEX_BUILDING,
+                false,
+                __ATOMIC_ACQ_REL,
+                __ATOMIC_ACQUIRE))
+        {
+            _build_index();
+        }
+
+        state = __atomic_load_n(&_index_state, __ATOMIC_ACQUIRE);
+    }
+
+    return state == INDEX_READY;
+}
+
+/* The index of the function containing the kernel offset, or -1 */
+static ssize_t _index_find(uint64_t off)
+{
+    size_t lo = 0;
+    size_t hi = _nsymbols;
+    size_t i;
+
+    /* find the first function that starts after the offset */
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (_symbols[mid].lo <= off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return -1;
+
+    /* of the functions that start at the nearest address below, take the
+     * first that contains the offset */
+    i = lo - 1;
+
+    while (i > 0 && _symbols[i - 1].lo == _symbols[lo - 1].lo)
+        i--;
+
+    for (; i < lo; i++)
+    {
+        if (off <= (uint64_t)_symbols[i].lo + _symbols[i].size)
+            return (ssize_t)i;
+    }
+
+    return -1;
+}
+
+static int _index_lookup(uint64_t addr, const char** name, uint64_t* start)
+{
+    const uint64_t base = (uint64_t)__myst_kernel_args.kernel_data;
+    const uint64_t end = base + __myst_kernel_args.kernel_size;
+    uint64_t off;
+    uint64_t* slot;
+    uint64_t memo;
+    ssize_t i;
+
+    if (addr < base || addr >= end || addr - base > UINT32_MAX)
+        return -ENOENT;
+
+    off = addr - base;
+    slot = &_memo[(off ^ (off >> 12)) & (MEMO_SIZE - 1)];
+    memo = __atomic_load_n(slot, __ATOMIC_RELAXED);
+
+    if (memo && (memo >> 32) == off)
+    {
+        i = (ssize_t)(memo & UINT32_MAX) - 1;
+    }
+    else
+    {
+        if ((i = _index_find(off)) < 0)
+            return -ENOENT;
+
+        memo = (off << 32) | ((uint64_t)i + 1);
+        __atomic_store_n(slot, memo, __ATOMIC_RELAXED);
+    }
+
+    *name = _symbols[i].name;
+    *start = base + _symbols[i].lo;
+    return 0;
+}
+
+static int _addr_to_func(uint64_t addr, const char** name, uint64_t* start)
 {
     int ret = 0;
 
+    if (_index_ready())
+        return _index_lookup(addr, name, start);
+
     /* search the symbol table */
     if (_symtab_find_name(
             __myst_kernel_args.symtab_data,
@@ -120,7 +374,8 @@ static int _addr_to_func_name(uint64_t addr, const char** name)
             __myst_kernel_args.strtab_data,
             __myst_kernel_args.strtab_size,
             addr,
-            name) == 0)
+            name,
+            start) == 0)
     {
         goto done;
     }
@@ -132,7 +387,8 @@ static int _addr_to_func_name(uint64_t addr, const char** name)
             __myst_kernel_args.dynstr_data,
             __myst_kernel_args.dynstr_size,
             addr,
-            name) == 0)
+            name,
+            start) == 0)
     {
         goto done;
     }
@@ -143,14 +399,29 @@ done:
     return ret;
 }
 
+int myst_backtrace_symbol(const void* addr, const char** name, size_t* offset)
+{
+    uint64_t start;
+
+    if (!name || !offset)
+        return -EINVAL;
+
+    if (_addr_to_func((uint64_t)addr, name, &start) != 0)
+        return -ENOENT;
+
+    *offset = (size_t)((uint64_t)addr - start);
+    return 0;
+}
+
 void myst_dump_backtrace(void** buffer, size_t size)
 {
     for (size_t i = 0; i < size; i++)
     {
         const uint64_t addr = (uint64_t)buffer[i];
         const char* name;
+        uint64_t start;
 
-        if (_addr_to_func_name(addr, &name) == 0)
+        if (_addr_to_func(addr, &name, &start) == 0)
             myst_eprintf("%p: %s()\n", buffer[i], name);
         else
             myst_eprintf("%p: unknown\n", buffer[i]);
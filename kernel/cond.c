@@ -9,10 +9,49 @@
 #include <string.h>
 
 #include <myst/cond.h>
+#include <myst/eventtrace.h>
 #include <myst/mutex.h>
 #include <myst/strings.h>
 #include <myst/tcall.h>
 
+/* Wake a thread taken off a queue (which may exit as soon as it wakes) */
+static void _wake(myst_thread_t* waiter)
+{
+    myst_event(
+        MYST_EVENT_SCHED, MYST_EVENT_SCHED_WAKEUP, (uint64_t)waiter->tid, 0);
+    myst_tcall_wake(waiter->event);
+}
+
+/* Wake the threads taken off a queue with as few host calls as possible */
+static void _wake_all(myst_thread_queue_t* waiters)
+{
+    uint64_t events[MYST_TCALL_WAKE_MANY_MAX];
+    size_t n = 0;
+    myst_thread_t* next = NULL;
+
+    if (waiters->front && !waiters->front->qnext)
+    {
+        _wake(waiters->front);
+        return;
+    }
+
+    /* each thread may exit once woken, so read its links first */
+    for (myst_thread_t* p = waiters->front; p; p = next)
+    {
+        next = p->qnext;
+
+        myst_event(
+            MYST_EVENT_SCHED, MYST_EVENT_SCHED_WAKEUP, (uint64_t)p->tid, 0);
+        events[n++] = p->event;
+
+        if (n == MYST_COUNTOF(events) || !next)
+        {
+            myst_tcall_wake_many(events, n);
+            n = 0;
+        }
+    }
+}
+
 int myst_cond_init(myst_cond_t* c)
 {
     if (!c)
@@ -57,6 +96,8 @@ int myst_cond_timedwait(
     if (!c || !mutex)
         return EINVAL;
 
+    myst_event(MYST_EVENT_SCHED, MYST_EVENT_SCHED_BLOCK, (uint64_t)c, 0);
+
     myst_spin_lock(&c->lock);
     {
         myst_thread_t* waiter = NULL;
@@ -77,6 +118,12 @@ int myst_cond_timedwait(
             {
                 if (waiter)
                 {
+                    myst_event(
+                        MYST_EVENT_SCHED,
+                        MYST_EVENT_SCHED_WAKEUP,
+                        (uint64_t)waiter->tid,
+                        0);
+
                     ret = (int)myst_tcall_wake_wait(
                         waiter->event, self->event, timeout);
 
@@ -98,6 +145,10 @@ int myst_cond_timedwait(
         }
     }
     myst_spin_unlock(&c->lock);
+
+    myst_event(
+        MYST_EVENT_SCHED, MYST_EVENT_SCHED_UNBLOCK, (uint64_t)c, (uint64_t)ret);
+
     myst_mutex_lock(mutex);
 
     return ret;
@@ -122,7 +173,7 @@ int myst_cond_signal(myst_cond_t* c)
     if (!waiter)
         return 0;
 
-    myst_tcall_wake(waiter->event);
+    _wake(waiter);
     return 0;
 }
 
@@ -147,15 +198,53 @@ int myst_cond_broadcast(myst_cond_t* c, size_t n)
     }
     myst_spin_unlock(&c->lock);
 
-    myst_thread_t* next = NULL;
+    _wake_all(&waiters);
 
-    for (myst_thread_t* p = waiters.front; p; p = next)
+    return 0;
+}
+
+size_t myst_cond_wake_bitset(myst_cond_t* c, size_t n, uint32_t bitset)
+{
+    myst_thread_queue_t waiters = {NULL, NULL};
+    size_t count = 0;
+
+    if (!c)
+        return 0;
+
+    myst_spin_lock(&c->lock);
     {
-        next = p->qnext;
-        myst_tcall_wake(p->event);
+        myst_thread_t* prev = NULL;
+        myst_thread_t* next;
+
+        /* Select at most n matching waiters in queue order */
+        for (myst_thread_t* p = c->queue.front; p && count < n; p = next)
+        {
+            next = p->qnext;
+
+            if (!(p->signal.futex_bitset & bitset))
+            {
+                prev = p;
+                continue;
+            }
+
+            /* Unlink P from the queue */
+            if (prev)
+                prev->qnext = next;
+            else
+                c->queue.front = next;
+
+            if (c->queue.back == p)
+                c->queue.back = prev;
+
+            myst_thread_queue_push_back(&waiters, p);
+            count++;
+        }
     }
+    myst_spin_unlock(&c->lock);
 
-    return 0;
+    _wake_all(&waiters);
+
+    return count;
 }
 
 int myst_cond_requeue(
@@ -198,15 +287,7 @@ int myst_cond_requeue(
     myst_spin_unlock(&c1->lock);
 
     /* Wake the threads in the wakers queue */
-    {
-        myst_thread_t* next = NULL;
-
-        for (myst_thread_t* p = wakers.front; p; p = next)
-        {
-            next = p->qnext;
-            myst_tcall_wake(p->event);
-        }
-    }
+    _wake_all(&wakers);
 
     /* Requeue the threads in the requeues queue */
     myst_spin_lock(&c2->lock);
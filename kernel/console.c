@@ -0,0 +1,118 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <myst/console.h>
+#include <myst/kernel.h>
+#include <myst/spinlock.h>
+#include <myst/tcall.h>
+#include <myst/timer.h>
+
+/* The buffered output, which all belongs to one descriptor (_fd) */
+static char _buf[MYST_CONSOLE_BUFFER_SIZE];
+static size_t _len;
+static int _fd;
+static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
+
+/* Flushes output that waits too long for a newline or a full buffer */
+static myst_timer_t _timer;
+static bool _timer_armed;
+
+/* Call with the lock held (which keeps the flushes in order) */
+static void _flush(void)
+{
+    if (_len)
+    {
+        myst_tcall_write_console(_fd, _buf, _len);
+        _len = 0;
+    }
+}
+
+static void _timer_fn(myst_timer_t* timer)
+{
+    (void)timer;
+
+    myst_spin_lock(&_lock);
+    _timer_armed = false;
+    _flush();
+    myst_spin_unlock(&_lock);
+}
+
+ssize_t myst_console_write(int fd, const void* buf, size_t count)
+{
+    const int mode = __myst_kernel_args.console_buffering;
+    ssize_t ret = (ssize_t)count;
+    bool arm = false;
+
+    if (!buf && count)
+        return -EINVAL;
+
+    if (mode == MYST_CONSOLE_UNBUFFERED)
+        return myst_tcall_write_console(fd, buf, count);
+
+    /* other descriptors (as when writing to the standard input) */
+    if (fd != STDOUT_FILENO && fd != STDERR_FILENO)
+    {
+        myst_spin_lock(&_lock);
+        _flush();
+        ret = myst_tcall_write_console(fd, buf, count);
+        myst_spin_unlock(&_lock);
+        return ret;
+    }
+
+    myst_spin_lock(&_lock);
+    {
+        /* output for the other descriptor goes out first */
+        if (_len && (fd != _fd || _len + count > sizeof(_buf)))
+            _flush();
+
+        if (count >= sizeof(_buf))
+        {
+            ret = myst_tcall_write_console(fd, buf, count);
+        }
+        else
+        {
+            memcpy(_buf + _len, buf, count);
+            _len += count;
+            _fd = fd;
+
+            const bool line = mode == MYST_CONSOLE_LINE_BUFFERED;
+
+            if (_len == sizeof(_buf) || (line && memchr(buf, '\n', count)))
+                _flush();
+
+            if (_len && !_timer_armed)
+                arm = _timer_armed = true;
+        }
+    }
+    myst_spin_unlock(&_lock);
+
+    /* arm outside the lock (the timer function takes it) */
+    if (arm)
+    {
+        const uint64_t deadline = myst_timer_now() + MYST_CONSOLE_FLUSH_DELAY;
+
+        _timer.fn = _timer_fn;
+
+        /* without the timer thread (as at exit), flush right away */
+        if (myst_timer_arm(&_timer, deadline) != 0)
+        {
+            myst_spin_lock(&_lock);
+            _timer_armed = false;
+            _flush();
+            myst_spin_unlock(&_lock);
+        }
+    }
+
+    return ret;
+}
+
+void myst_console_flush(void)
+{
+    myst_spin_lock(&_lock);
+    _flush();
+    myst_spin_unlock(&_lock);
+}
@@ -0,0 +1,468 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <myst/counters.h>
+#include <myst/defs.h>
+#include <myst/eraise.h>
+#include <myst/ext2.h>
+#include <myst/kernel.h>
+#include <myst/mmanutils.h>
+#include <myst/mutex.h>
+#include <myst/signal.h>
+#include <myst/strings.h>
+#include <myst/syscall.h>
+#include <myst/syscallstats.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+#include <myst/verity.h>
+
+/*
+**==============================================================================
+**
+** Kernel performance counters (read from /proc/myst/stats).
+**
+**     As with the syscall statistics, counters are updated with relaxed
+**     atomics in one of SHARDS copies, which are summed when read. The copy
+**     is chosen by the stack address rather than by tid, since tcalls are
+**     counted where there may be no current thread (or no kernel fsbase).
+**
+**     Linux syscall numbers (forwarded to the target) map directly to tcall
+**     slots; the myst-specific tcalls (from MYST_TCALL_RANDOM) follow them.
+**
+**==============================================================================
+*/
+
+#define SHARDS 4
+#define NUM_LINUX_TCALLS 512
+#define NUM_MYST_TCALLS 64
+#define NUM_TCALL_SLOTS (NUM_LINUX_TCALLS + NUM_MYST_TCALLS)
+
+typedef struct shard
+{
+    uint64_t counters[MYST_NUM_COUNTERS];
+    uint64_t tcalls[NUM_TCALL_SLOTS];
+    uint64_t tcall_nsec[NUM_TCALL_SLOTS];
+} __attribute__((aligned(64))) shard_t;
+
+static shard_t _shards[SHARDS];
+
+static myst_fs_t* _ext2;
+
+static const char* _counter_names[] = {
+    "myst_futex_waits",
+    "myst_futex_wakes",
+    "myst_futex_woken",
+    "myst_mmaps",
+    "myst_munmaps",
+    "myst_stack_cache_hits",
+    "myst_poll_waits",
+    "myst_poll_wakeups",
+    "myst_epoll_waits",
+    "myst_epoll_wakeups",
+};
+
+MYST_STATIC_ASSERT(MYST_COUNTOF(_counter_names) == MYST_NUM_COUNTERS);
+
+/* Names of the myst-specific tcalls (indexed from MYST_TCALL_RANDOM) */
+static const char* _tcall_names[] = {
+    "random",
+    "vsnprintf",
+    "write_console",
+    "gen_creds",
+    "free_creds",
+    "verify_cert",
+    "clock_gettime",
+    "clock_settime",
+    "isatty",
+    "add_symbol_file",
+    "load_symbols",
+    "unload_symbols",
+    "create_thread",
+    "wait",
+    "wake",
+    "wake_wait",
+    "export_file",
+    "set_run_thread_function",
+    "target_stat",
+    "set_tsd",
+    "get_tsd",
+    "get_errno_location",
+    "read_console",
+    "poll_wake",
+    "open_block_device",
+    "close_block_device",
+    "read_block_device",
+    "write_block_device",
+    "luks_encrypt",
+    "luks_decrypt",
+    "sha256_start",
+    "sha256_update",
+    "sha256_finish",
+    "verify_signature",
+    "load_fssig",
+    "clock_getres",
+    "hostbuf_alloc",
+    "hostbuf_send",
+    "hostbuf_recv",
+    "accept_batch",
+    "sha256_n",
+    "set_syscall_trampoline",
+    "wake_many",
+    "gcm_new",
+    "gcm_free",
+    "gcm_seal",
+    "gcm_open",
+    "export_cpio",
+    "debugger_attached",
+    "map_host_file",
+    "unmap_host_file",
+};
+
+MYST_STATIC_ASSERT(
+    MYST_COUNTOF(_tcall_names) ==
+    MYST_TCALL_UNMAP_HOST_FILE - MYST_TCALL_RANDOM + 1);
+
+static shard_t* _shard(void)
+{
+    /* thread stacks are far enough apart that bit 16 and up differ */
+    uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+    return &_shards[(sp >> 16) % SHARDS];
+}
+
+static ssize_t _tcall_to_slot(long n)
+{
+    if (n >= 0 && n < NUM_LINUX_TCALLS)
+        return n;
+
+    if (n >= MYST_TCALL_RANDOM && n < MYST_TCALL_RANDOM + NUM_MYST_TCALLS)
+        return NUM_LINUX_TCALLS + (n - MYST_TCALL_RANDOM);
+
+    return -1;
+}
+
+static const char* _slot_name(size_t slot)
+{
+    const char* name;
+
+    if (slot < NUM_LINUX_TCALLS)
+    {
+        name = syscall_str((long)slot);
+
+        if (strncmp(name, "SYS_", 4) == 0)
+            name += 4;
+
+        return name;
+    }
+
+    slot -= NUM_LINUX_TCALLS;
+
+    if (slot < MYST_COUNTOF(_tcall_names))
+        return _tcall_names[slot];
+
+    return "unknown";
+}
+
+void myst_counter_add(myst_counter_t counter, uint64_t n)
+{
+    if (counter < MYST_NUM_COUNTERS)
+    {
+        uint64_t* p = &_shard()->counters[counter];
+        __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+    }
+}
+
+void myst_counters_tcall(long n, uint64_t nsec)
+{
+    ssize_t index = _tcall_to_slot(n);
+    shard_t* shard;
+
+    if (index < 0)
+        return;
+
+    shard = _shard();
+    __atomic_fetch_add(&shard->tcalls[index], 1, __ATOMIC_RELAXED);
+
+    if (nsec)
+        __atomic_fetch_add(&shard->tcall_nsec[index], nsec, __ATOMIC_RELAXED);
+}
+
+void myst_counters_set_ext2(myst_fs_t* fs)
+{
+    _ext2 = fs;
+}
+
+static uint64_t _sum_counter(size_t index)
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < SHARDS; i++)
+        sum += __atomic_load_n(&_shards[i].counters[index], __ATOMIC_RELAXED);
+
+    return sum;
+}
+
+static void _sum_tcall(size_t index, uint64_t* calls, uint64_t* nsec)
+{
+    *calls = 0;
+    *nsec = 0;
+
+    for (size_t i = 0; i < SHARDS; i++)
+    {
+        const shard_t* p = &_shards[i];
+        *calls += __atomic_load_n(&p->tcalls[index], __ATOMIC_RELAXED);
+        *nsec += __atomic_load_n(&p->tcall_nsec[index], __ATOMIC_RELAXED);
+    }
+}
+
+/*
+**==============================================================================
+**
+** Collecting and formatting the statistics
+**
+**==============================================================================
+*/
+
+typedef struct collector
+{
+    myst_buf_t* buf;
+    bool binary;
+    uint32_t count;
+    int err;
+} collector_t;
+
+static void _emit(collector_t* c, const char* name, uint64_t value)
+{
+    if (c->err)
+        return;
+
+    if (c->binary)
+    {
+        myst_stats_record_t r;
+
+        memset(&r, 0, sizeof(r));
+        myst_strlcpy(r.name, name, sizeof(r.name));
+        r.value = value;
+        c->err = myst_buf_append(c->buf, &r, sizeof(r));
+    }
+    else
+    {
+        char tmp[MYST_STATS_NAME_SIZE + 32];
+        int n = snprintf(tmp, sizeof(tmp), "%s %lu\n", name, value);
+
+        if (n < 0 || (size_t)n >= sizeof(tmp))
+            c->err = -ENAMETOOLONG;
+        else
+            c->err = myst_buf_append(c->buf, tmp, (size_t)n);
+    }
+
+    c->count++;
+}
+
+/* Emit a value of one tcall, as in myst_tcalls{tcall="read"} */
+static void _emit_tcall(
+    collector_t* c,
+    const char* metric,
+    size_t slot,
+    uint64_t value)
+{
+    char name[MYST_STATS_NAME_SIZE];
+
+    snprintf(
+        name, sizeof(name), "%s{tcall=\"%s\"}", metric, _slot_name(slot));
+    _emit(c, name, value);
+}
+
+static int _collect(collector_t* c)
+{
+    int ret = 0;
+
+    for (size_t i = 0; i < MYST_NUM_COUNTERS; i++)
+        _emit(c, _counter_names[i], _sum_counter(i));
+
+    /* the tcalls made, and their time with --syscall-stats */
+    for (size_t i = 0; i < NUM_TCALL_SLOTS; i++)
+    {
+        uint64_t calls;
+        uint64_t nsec;
+
+        _sum_tcall(i, &calls, &nsec);
+
+        if (calls)
+        {
+            _emit_tcall(c, "myst_tcalls", i, calls);
+
+            if (nsec)
+                _emit_tcall(c, "myst_tcall_usecs", i, nsec / 1000);
+        }
+    }
+
+    /* contended kernel mutexes: spinning vs. waiting on the host */
+    {
+        myst_mutex_stats_t stats;
+
+        myst_mutex_get_stats(&stats);
+        _emit(c, "myst_mutex_spins", stats.spins);
+        _emit(c, "myst_mutex_parks", stats.parks);
+    }
+
+    /* the kernel memory of the threads (siginfo storage comes on demand) */
+    {
+        const int n = myst_get_num_threads();
+
+        _emit(c, "myst_threads", (uint64_t)n);
+        _emit(c, "myst_thread_bytes", (uint64_t)n * sizeof(myst_thread_t));
+        _emit(c, "myst_signal_info_bytes", myst_signal_infos_bytes());
+    }
+
+    {
+        myst_malloc_stats_t stats;
+
+        if (myst_get_malloc_stats(&stats) == 0)
+        {
+            _emit(c, "myst_malloc_usage_bytes", stats.usage);
+            _emit(c, "myst_malloc_peak_usage_bytes", stats.peak_usage);
+            _emit(c, "myst_malloc_cache_hits", stats.cache_hits);
+            _emit(c, "myst_malloc_cache_misses", stats.cache_misses);
+        }
+    }
+
+    /* fragmentation is the part of the free memory outside the largest
+     * free range (so a large mapping may fail although enough is free) */
+    {
+        myst_mman_stats_t stats;
+        size_t total = 0;
+        size_t free = 0;
+
+        if (myst_get_mman_stats(&stats) == 0 &&
+            myst_get_total_ram(&total) == 0 && myst_get_free_ram(&free) == 0)
+        {
+            _emit(c, "myst_mman_total_bytes", total);
+            _emit(c, "myst_mman_free_bytes", free);
+            _emit(c, "myst_mman_largest_free_bytes", stats.largest_free);
+            _emit(c, "myst_mman_mapped_bytes", stats.mapped);
+            _emit(c, "myst_mman_committed_bytes", stats.committed);
+            _emit(c, "myst_mman_brk_bytes", stats.brk - stats.start);
+            _emit(c, "myst_mman_vads", stats.count);
+            _emit(c, "myst_mman_unassigned_bytes", stats.unassigned);
+            _emit(c, "myst_mman_gaps", stats.gaps);
+
+            /* the gaps between mappings as a (cumulative) histogram */
+            for (size_t i = 0, n = 0; i < MYST_MMAN_GAP_BUCKETS; i++)
+            {
+                const char* metric = "myst_mman_gap_bytes";
+                const size_t max = (size_t)PAGE_SIZE << (2 * i);
+                char name[MYST_STATS_NAME_SIZE];
+                char le[32] = "+Inf";
+
+                if (i + 1 < MYST_MMAN_GAP_BUCKETS)
+                    snprintf(le, sizeof(le), "%zu", max);
+
+                snprintf(name, sizeof(name), "%s{le=\"%s\"}", metric, le);
+                n += stats.gap_histogram[i];
+                _emit(c, name, n);
+            }
+
+            if (free && stats.largest_free < free)
+            {
+                _emit(
+                    c,
+                    "myst_mman_fragmentation_percent",
+                    (free - stats.largest_free) * 100 / free);
+            }
+            else
+            {
+                _emit(c, "myst_mman_fragmentation_percent", 0);
+            }
+        }
+    }
+
+    /* the block device requests of every ext2 mount (the traffic through
+     * the LUKS and verity layers) */
+    {
+        uint64_t gets;
+        uint64_t puts;
+
+        ext2_get_blkdev_stats(&gets, &puts);
+        _emit(c, "myst_ext2_blkdev_gets", gets);
+        _emit(c, "myst_ext2_blkdev_puts", puts);
+    }
+
+    /* the buffer cache of the rootfs (which also caches LUKS reads) */
+    if (_ext2)
+    {
+        ext2_cache_stats_t stats;
+
+        if (ext2_get_cache_stats(_ext2, &stats) == 0)
+        {
+            _emit(c, "myst_ext2_cache_hits", stats.hits);
+            _emit(c, "myst_ext2_cache_misses", stats.misses);
+            _emit(c, "myst_ext2_cache_writebacks", stats.writebacks);
+            _emit(c, "myst_ext2_cache_evictions", stats.evictions);
+            _emit(c, "myst_ext2_cache_prefetched", stats.prefetched);
+            _emit(c, "myst_ext2_cache_blocks", stats.blocks);
+            _emit(c, "myst_ext2_cache_dirty", stats.dirty);
+        }
+    }
+
+    {
+        myst_verity_stats_t stats;
+
+        myst_verityblkdev_get_stats(&stats);
+        _emit(c, "myst_verity_cache_hits", stats.hits);
+        _emit(c, "myst_verity_cache_misses", stats.misses);
+        _emit(c, "myst_verity_cache_evictions", stats.evictions);
+        _emit(c, "myst_verity_prefetched", stats.prefetched);
+        _emit(c, "myst_verity_prefetch_hits", stats.prefetch_hits);
+        _emit(c, "myst_verity_nodes_hashed", stats.nodes_hashed);
+        _emit(c, "myst_verity_nodes_imported", stats.nodes_imported);
+    }
+
+    ECHECK(c->err);
+
+done:
+    return ret;
+}
+
+int myst_format_stats(myst_buf_t* buf)
+{
+    int ret = 0;
+    collector_t c = {.buf = buf};
+
+    if (!buf)
+        ERAISE(-EINVAL);
+
+    ECHECK(_collect(&c));
+
+done:
+    return ret;
+}
+
+int myst_format_stats_binary(myst_buf_t* buf)
+{
+    int ret = 0;
+    collector_t c = {.buf = buf, .binary = true};
+    myst_stats_header_t header;
+    size_t offset;
+
+    if (!buf)
+        ERAISE(-EINVAL);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = MYST_STATS_MAGIC;
+    header.version = MYST_STATS_VERSION;
+    header.nsec = myst_syscall_stats_now();
+
+    /* the count is filled in once the records are written */
+    offset = buf->size;
+    ECHECK(myst_buf_append(buf, &header, sizeof(header)));
+    ECHECK(_collect(&c));
+
+    header.count = c.count;
+    memcpy(buf->data + offset, &header, sizeof(header));
+
+done:
+    return ret;
+}
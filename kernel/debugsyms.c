@@ -0,0 +1,193 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/eraise.h>
+#include <myst/file.h>
+#include <myst/mutex.h>
+#include <myst/options.h>
+#include <myst/strings.h>
+#include <myst/syscall.h>
+#include <myst/tcall.h>
+
+/*
+**==============================================================================
+**
+** Lazy registration of debugger symbols.
+**
+**     The CRT and the loader register every image they map (the CRT and
+**     each shared library) with myst_syscall_add_symbol_file(). Handing an
+**     image to the host means reading the whole file from the enclave's
+**     file system and an OCALL for each one, which only a debugger (or
+**     --profile) needs. So a registration only records the path and the
+**     load address of the image, and myst_syscall_load_symbols() sends the
+**     recorded images (followed by a single load) once the host reports a
+**     debugger attached. A debugger that attaches later gets the pending
+**     images at the next load (the next dlopen() or exec).
+**
+**     The host cannot read the images itself, since they come from the
+**     enclave's file system (except for the CRT, whose path is null here).
+**
+**==============================================================================
+*/
+
+typedef struct pending
+{
+    struct pending* next;
+    char* path; /* null for the CRT (which the host finds itself) */
+    const void* text;
+    size_t text_size;
+} pending_t;
+
+static myst_mutex_t _lock;
+static pending_t* _head;
+static pending_t* _tail;
+static bool _attached; /* once seen attached, the images are sent at once */
+
+static long _send(const pending_t* p)
+{
+    long ret = 0;
+    void* file_data = NULL;
+    size_t file_size = 0;
+    long params[6] = {0};
+
+    if (p->path)
+        ECHECK(myst_load_file(p->path, &file_data, &file_size));
+
+    params[0] = (long)file_data;
+    params[1] = (long)file_size;
+    params[2] = (long)p->text;
+    params[3] = (long)p->text_size;
+
+    ECHECK(myst_tcall(MYST_TCALL_ADD_SYMBOL_FILE, params));
+
+done:
+
+    if (file_data)
+        free(file_data);
+
+    return ret;
+}
+
+static long _add(const char* path, const void* text, size_t text_size)
+{
+    long ret = 0;
+    pending_t* p;
+
+    if (!text || !text_size)
+        ERAISE(-EINVAL);
+
+    if (!(p = calloc(1, sizeof(pending_t))))
+        ERAISE(-ENOMEM);
+
+    if (path && !(p->path = strdup(path)))
+    {
+        free(p);
+        ERAISE(-ENOMEM);
+    }
+
+    p->text = text;
+    p->text_size = text_size;
+
+    myst_mutex_lock(&_lock);
+    {
+        if (_tail)
+            _tail->next = p;
+        else
+            _head = p;
+
+        _tail = p;
+    }
+    myst_mutex_unlock(&_lock);
+
+done:
+    return ret;
+}
+
+long myst_syscall_add_symbol_file(
+    const char* path,
+    const void* text,
+    size_t text_size)
+{
+    if (!path)
+        return -EINVAL;
+
+    return _add(path, text, text_size);
+}
+
+long myst_add_crt_symbols(const void* text, size_t text_size)
+{
+    long ret = 0;
+
+    ECHECK(_add(NULL, text, text_size));
+
+    /* the CRT is registered (and loaded) before it runs */
+    ECHECK(myst_syscall_load_symbols());
+
+done:
+    return ret;
+}
+
+long myst_syscall_load_symbols(void)
+{
+    long ret = 0;
+    long params[6] = {0};
+    pending_t* head;
+
+    myst_mutex_lock(&_lock);
+
+    if (!_head)
+        goto done;
+
+    /* --profile needs the symbols whether or not a debugger is attached */
+    if (!_attached && !__options.profile)
+    {
+        if (myst_tcall_debugger_attached() != 1)
+            goto done;
+
+        _attached = true;
+    }
+
+    head = _head;
+    _head = _tail = NULL;
+
+    /* an image that cannot be read is skipped (it may be gone by now) */
+    for (pending_t* p = head; p;)
+    {
+        pending_t* next = p->next;
+
+        _send(p);
+        free(p->path);
+        free(p);
+        p = next;
+    }
+
+    ret = myst_tcall(MYST_TCALL_LOAD_SYMBOLS, params);
+
+done:
+    myst_mutex_unlock(&_lock);
+    return ret;
+}
+
+long myst_syscall_unload_symbols(void)
+{
+    long params[6] = {0};
+
+    myst_mutex_lock(&_lock);
+
+    for (pending_t* p = _head; p;)
+    {
+        pending_t* next = p->next;
+
+        free(p->path);
+        free(p);
+        p = next;
+    }
+
+    _head = _tail = NULL;
+    myst_mutex_unlock(&_lock);
+
+    return myst_tcall(MYST_TCALL_UNLOAD_SYMBOLS, params);
+}
@@ -5,10 +5,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <myst/affinity.h>
 #include <myst/atexit.h>
+#include <myst/attest.h>
+#include <myst/clock.h>
+#include <myst/cond.h>
+#include <myst/counters.h>
+#include <myst/console.h>
 #include <myst/cpio.h>
 #include <myst/crash.h>
 #include <myst/eraise.h>
+#include <myst/eventtrace.h>
 #include <myst/errno.h>
 #include <myst/exec.h>
 #include <myst/fdtable.h>
@@ -16,42 +23,135 @@
 #include <myst/fs.h>
 #include <myst/fsgs.h>
 #include <myst/hex.h>
+#include <myst/hostclose.h>
 #include <myst/hostfs.h>
 #include <myst/initfini.h>
 #include <myst/kernel.h>
+#include <myst/layoutprofile.h>
+#include <myst/libprefetch.h>
+#include <myst/lockstats.h>
+#include <myst/memops.h>
 #include <myst/mmanutils.h>
 #include <myst/mount.h>
+#include <myst/mutex.h>
 #include <myst/options.h>
 #include <myst/panic.h>
 #include <myst/printf.h>
 #include <myst/process.h>
 #include <myst/procfs.h>
+#include <myst/profile.h>
 #include <myst/pubkey.h>
 #include <myst/ramfs.h>
+#include <myst/scratch.h>
 #include <myst/signal.h>
+#include <myst/slab.h>
+#include <myst/startuptrace.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
+#include <myst/syscallstats.h>
+#include <myst/sysfs.h>
+#include <myst/tcall.h>
+#include <myst/tcallstats.h>
 #include <myst/tee.h>
 #include <myst/thread.h>
+#include <myst/time.h>
+#include <myst/timer.h>
 #include <myst/times.h>
 #include <myst/trace.h>
 #include <myst/ttydev.h>
+#include <myst/workers.h>
 
 #define WANT_TLS_CREDENTIAL "MYST_WANT_TLS_CREDENTIAL"
 
 static myst_fs_t* _fs;
 
+static uint64_t _tcall_clock(void)
+{
+    struct timespec ts;
+    long params[6] = {CLOCK_MONOTONIC, (long)&ts};
+
+    if ((__myst_kernel_args.tcall)(MYST_TCALL_CLOCK_GETTIME, params) != 0)
+        return 0;
+
+    return (uint64_t)ts.tv_sec * NANO_IN_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+/* Charge the time spent in the tcall to the current thread and to the
+ * site that made it (the frame of myst_tcall()) */
+static long _timed_tcall(long n, long params[6], void* frame)
+{
+    myst_thread_t* thread;
+    uint64_t start;
+    uint64_t nsec;
+    long ret;
+
+    /* these are used for the accounting itself */
+    if (n == MYST_TCALL_CLOCK_GETTIME || n == MYST_TCALL_GET_TSD)
+    {
+        myst_counters_tcall(n, 0);
+        return (__myst_kernel_args.tcall)(n, params);
+    }
+
+    start = _tcall_clock();
+    ret = (__myst_kernel_args.tcall)(n, params);
+    nsec = _tcall_clock() - start;
+    myst_counters_tcall(n, nsec);
+    myst_tcall_stats_record(n, frame, nsec);
+
+    if (myst_valid_thread((thread = (myst_thread_t*)myst_get_tsd())))
+    {
+        thread->tcall_nsec += nsec;
+    }
+
+    return ret;
+}
+
 long myst_tcall(long n, long params[6])
 {
     void* fs = NULL;
 
-    if (__options.have_syscall_instruction)
+    /* the event trace itself uses these (for the time and the thread) */
+    const bool traced = myst_event_enabled(MYST_EVENT_TCALL) &&
+                        n != MYST_TCALL_CLOCK_GETTIME &&
+                        n != MYST_TCALL_GET_TSD;
+
+    /* tcalls run on the target descriptor, the self field of the one that
+     * gsbase points to (see myst_init_gs()) */
+    if (MYST_HAVE_SYSCALL_INSTRUCTION)
+    {
+        myst_td_t* target_td;
+
+        __asm__ volatile("mov %%gs:0, %0" : "=r"(target_td));
+
+        if ((fs = myst_get_fsbase()) == target_td)
+            fs = NULL;
+        else
+            myst_set_fsbase(target_td);
+    }
+
+    long ret;
+
+    if (traced)
+    {
+        const uint32_t type = MYST_EVENT_TCALL_ENTER;
+        myst_event_record(MYST_EVENT_TCALL, type, (uint64_t)n, 0);
+    }
+
+    if (__options.syscall_stats)
+    {
+        ret = _timed_tcall(n, params, __builtin_frame_address(0));
+    }
+    else
     {
-        fs = myst_get_fsbase();
-        myst_set_fsbase(myst_get_gsbase());
+        myst_counters_tcall(n, 0);
+        ret = (__myst_kernel_args.tcall)(n, params);
     }
 
-    long ret = (__myst_kernel_args.tcall)(n, params);
+    if (traced)
+    {
+        const uint32_t type = MYST_EVENT_TCALL_EXIT;
+        myst_event_record(MYST_EVENT_TCALL, type, (uint64_t)n, (uint64_t)ret);
+    }
 
     if (fs)
         myst_set_fsbase(fs);
@@ -67,6 +167,24 @@ void myst_dump_malloc_stats(void)
     {
         myst_eprintf("kernel: memory used: %zu\n", stats.usage);
         myst_eprintf("kernel: peak memory used: %zu\n", stats.peak_usage);
+        myst_eprintf("kernel: malloc cache hits: %zu\n", stats.cache_hits);
+        myst_eprintf(
+            "kernel: malloc cache misses: %zu\n", stats.cache_misses);
+    }
+
+    {
+        myst_slab_stats_t slabs[16];
+        size_t n = myst_slab_get_stats(slabs, MYST_COUNTOF(slabs));
+
+        for (size_t i = 0; i < n && i < MYST_COUNTOF(slabs); i++)
+        {
+            myst_eprintf(
+                "kernel: slab %s: size=%zu slabs=%zu in_use=%zu\n",
+                slabs[i].name,
+                slabs[i].object_size,
+                slabs[i].num_slabs,
+                slabs[i].in_use);
+        }
     }
 }
 
@@ -189,6 +307,10 @@ static int _create_standard_directories(void)
         ERAISE(-EINVAL);
     }
 
+    /* shm_open() creates the POSIX shared memory objects here (a read-only
+     * rootfs without it only goes without them) */
+    myst_mkdirhier("/dev/shm", mode);
+
 done:
     return ret;
 }
@@ -235,6 +357,16 @@ static int _setup_ext2(const char* rootfs, char* err, size_t err_size)
         ERAISE(-EINVAL);
     }
 
+    /* report its buffer cache in /proc/myst/stats */
+    myst_counters_set_ext2(_fs);
+
+    /* record the files opened on the rootfs (with --layout-profile) */
+    if (myst_layout_profile_set_fs(_fs) != 0)
+    {
+        snprintf(err, err_size, "cannot start the EXT2 layout profile");
+        ERAISE(-ENOMEM);
+    }
+
     if (_create_standard_directories() != 0)
     {
         snprintf(err, err_size, "cannot create EXT2 standard directories");
@@ -317,9 +449,7 @@ static int _create_tls_credentials(myst_fs_t* fs)
     myst_file_t* file = NULL;
     int flags = O_CREAT | O_WRONLY;
 
-    long params[6] = {
-        (long)&cert, (long)&cert_size, (long)&pkey, (long)&pkey_size};
-    ECHECK(myst_tcall(MYST_TCALL_GEN_CREDS, params));
+    ECHECK(myst_attest_gen_creds(&cert, &cert_size, &pkey, &pkey_size));
 
     // Save the certificate
     ECHECK((fs->fs_open)(fs, certificate_path, flags, 0444, NULL, &file));
@@ -337,11 +467,7 @@ static int _create_tls_credentials(myst_fs_t* fs)
 
 done:
     if (cert || pkey)
-    {
-        long params[6] = {
-            (long)cert, (long)cert_size, (long)pkey, (long)pkey_size};
-        myst_tcall(MYST_TCALL_FREE_CREDS, params);
-    }
+        myst_attest_free_creds(cert, cert_size, pkey, pkey_size);
 
     if (file)
     {
@@ -351,33 +477,86 @@ done:
     return ret;
 }
 
-static int _create_mem_file(
-    const char* path,
-    const void* file_data,
-    size_t file_size)
+/*
+**==============================================================================
+**
+** The TLS credentials are generated on a kernel thread while the program
+** starts, since the key pair and the attestation take a while. Until the
+** files are written, resolving either path waits for them.
+**
+**==============================================================================
+*/
+
+static myst_mutex_t _creds_lock;
+static myst_cond_t _creds_cond;
+static _Atomic(bool) _creds_pending;
+static _Atomic(size_t) _creds_running;
+
+static int _creds_thread(void* arg)
 {
-    int ret = 0;
-    int fd = -1;
+    const uint64_t start = myst_startup_trace_now();
 
-    if (!path || !file_data)
-        ERAISE(-EINVAL);
+    if (_create_tls_credentials((myst_fs_t*)arg) != 0)
+        myst_eprintf("kernel: failed to create the TLS credentials\n");
 
-    if ((fd = open(path, O_WRONLY | O_CREAT, 0444)) < 0)
+    myst_startup_trace_event("create_tls_credentials", start);
+
+    myst_mutex_lock(&_creds_lock);
+    _creds_pending = false;
+    myst_cond_broadcast(&_creds_cond, SIZE_MAX);
+    myst_mutex_unlock(&_creds_lock);
+
+    _creds_running--;
+    return 0;
+}
+
+static int _start_tls_credentials(myst_fs_t* fs)
+{
+    _creds_pending = true;
+    _creds_running++;
+
+    if (myst_create_kernel_thread(_creds_thread, fs, "tlscreds") != 0)
     {
-        myst_panic("kernel: open(): %s\n", path);
-        ERAISE(-ENOENT);
+        _creds_pending = false;
+        _creds_running--;
+        return _create_tls_credentials(fs);
     }
 
-    ECHECK(myst_ramfs_set_buf(_fs, path, file_data, file_size));
+    return 0;
+}
 
-    ret = 0;
+void myst_wait_tls_credentials(const char* path)
+{
+    if (!_creds_pending)
+        return;
 
-done:
+    if (strcmp(path, MYST_CERTIFICATE_PATH) != 0 &&
+        strcmp(path, MYST_PRIVATE_KEY_PATH) != 0)
+    {
+        return;
+    }
 
-    if (fd >= 0)
-        close(fd);
+    myst_mutex_lock(&_creds_lock);
 
-    return ret;
+    while (_creds_pending)
+        myst_cond_wait(&_creds_cond, &_creds_lock);
+
+    myst_mutex_unlock(&_creds_lock);
+}
+
+/* Wait for the credentials thread before the file systems go away */
+static void _stop_tls_credentials(void)
+{
+    myst_mutex_lock(&_creds_lock);
+
+    while (_creds_pending)
+        myst_cond_wait(&_creds_cond, &_creds_lock);
+
+    myst_mutex_unlock(&_creds_lock);
+
+    /* Wait ~1 second for the thread to exit */
+    for (size_t i = 0; i < 1000 && _creds_running; i++)
+        myst_sleep_msec(1);
 }
 
 static int _teardown_ramfs(void)
@@ -404,6 +583,9 @@ static int _teardown_tmpfs(void)
 }
 #endif
 
+/* gsbase of the main host thread (see myst_init_gs()) */
+static myst_td_t _main_gs_td;
+
 static int _create_main_thread(uint64_t event, myst_thread_t** thread_out)
 {
     int ret = 0;
@@ -444,7 +626,10 @@ static int _create_main_thread(uint64_t event, myst_thread_t** thread_out)
     ECHECK(myst_signal_init(thread));
 
     /* bind this thread to the target */
-    myst_assume(myst_tcall_set_tsd((uint64_t)thread) == 0);
+    myst_bind_thread(thread, &_main_gs_td);
+
+    /* make the thread visible to myst_find_thread() */
+    myst_tid_map_insert(thread);
 
     *thread_out = thread;
     thread = NULL;
@@ -504,6 +689,15 @@ static int _mount_rootfs(myst_kernel_args_t* args, myst_fstype_t fstype)
                 ERAISE(-EINVAL);
             }
 
+            /* files read the archive in place (so mounts made later, such
+             * as /proc, cover whatever the archive has below them) */
+            if (myst_ramfs_load_cpio(
+                    _fs, args->rootfs_data, args->rootfs_size) != 0)
+            {
+                myst_eprintf("failed to unpack root file system\n");
+                ERAISE(-EINVAL);
+            }
+
             break;
         }
 #if defined(MYST_ENABLE_EXT2FS)
@@ -563,6 +757,49 @@ done:
     return ret;
 }
 
+/* Called by myst_exec() just before the first program is entered */
+uint64_t myst_syscall_xsave_size;
+
+/* The XSAVE area size for the components enabled in XCR0 (standard form) */
+static uint64_t _get_xsave_size(void)
+{
+    uint64_t size = 512 + 64; /* the legacy region and the header */
+    uint32_t lo;
+    uint32_t hi;
+    uint64_t xcr0;
+
+    /* SGX requires XSAVE, so XGETBV is always enabled here */
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    xcr0 = ((uint64_t)hi << 32) | lo;
+
+    /* leaf 0xd reports the size and offset of each component past SSE */
+    for (uint32_t i = 2; i < 63; i++)
+    {
+        uint32_t eax;
+        uint32_t ebx;
+        uint32_t ecx;
+        uint32_t edx;
+
+        if (!(xcr0 & ((uint64_t)1 << i)))
+            continue;
+
+        __asm__ volatile("cpuid"
+                         : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                         : "a"(0xd), "c"(i));
+
+        if (ebx + eax > size)
+            size = ebx + eax;
+    }
+
+    return size;
+}
+
+static void _enter_crt_callback(void* arg)
+{
+    myst_startup_trace_event("exec", (uint64_t)arg);
+    myst_startup_trace_enter_crt();
+}
+
 int myst_enter_kernel(myst_kernel_args_t* args)
 {
     int ret = 0;
@@ -570,6 +807,8 @@ int myst_enter_kernel(myst_kernel_args_t* args)
     myst_thread_t* thread = NULL;
     const char* want_tls_creds;
     myst_fstype_t fstype;
+    bool want_creds = false;
+    uint64_t start;
 
     if (!args)
         myst_crash();
@@ -577,17 +816,42 @@ int myst_enter_kernel(myst_kernel_args_t* args)
     /* Save the aguments */
     __myst_kernel_args = *args;
 
+    /* Choose the memcpy() and friends for this CPU */
+    myst_init_memops();
+
+    /* The time from the host's call until here (with --startup-trace) */
+    if ((start = myst_startup_trace_now()) != 0)
+    {
+        const uint64_t enter_time = args->startup_trace->enter_time;
+        myst_startup_trace_event("enclave_entry", enter_time);
+    }
+
     /* ATTN: it seems __options can be eliminated */
     __options.trace_syscalls = args->trace_syscalls;
     __options.have_syscall_instruction = args->have_syscall_instruction;
     __options.export_ramfs = args->export_ramfs;
+    __options.syscall_stats = args->syscall_stats;
+    __options.profile = args->profile && args->tee_debug_mode;
+
+    /* a kernel built for one target cannot run on the other */
+#if defined(MYST_KERNEL_TARGET_SGX) || defined(MYST_KERNEL_TARGET_LINUX)
+    if (args->have_syscall_instruction != MYST_HAVE_SYSCALL_INSTRUCTION)
+    {
+        myst_eprintf("kernel: this kernel was built for another target\n");
+        ERAISE(-EINVAL);
+    }
+#endif
+
+#ifdef MYST_KERNEL_NO_TRACE
+    if (args->trace_syscalls)
+        myst_eprintf("kernel: --strace is compiled out of this kernel\n");
+#endif
 
     /* enable error tracing if requested */
     if (args->trace_errors)
         myst_set_trace(true);
 
-    if (__options.have_syscall_instruction)
-        myst_set_gsbase(myst_get_fsbase());
+    myst_init_gs(&_main_gs_td, myst_get_fsbase());
 
     myst_call_init_functions();
 
@@ -637,6 +901,12 @@ int myst_enter_kernel(myst_kernel_args_t* args)
         ERAISE(-EINVAL);
     }
 
+    /* Find the CPUs that the host lets the enclave threads run on */
+    ECHECK(myst_affinity_init());
+
+    /* Start recording events for --event-trace */
+    ECHECK(myst_event_trace_init());
+
     /* determine the rootfs file system type (RAMFS, EXT2FS, OR HOSTFS) */
     if (_get_fstype(args, &fstype) != 0)
     {
@@ -644,20 +914,20 @@ int myst_enter_kernel(myst_kernel_args_t* args)
         ERAISE(-EINVAL);
     }
 
+    myst_startup_trace_event("kernel_setup", start);
+
     /* Mount the root file system */
+    start = myst_startup_trace_now();
     ECHECK(_mount_rootfs(args, fstype));
+    myst_startup_trace_event("mount_rootfs", start);
 
-    /* Generate TLS credentials if needed */
+    /* Check whether TLS credentials are wanted */
     want_tls_creds = _getenv(args->envp, WANT_TLS_CREDENTIAL);
     if (want_tls_creds != NULL)
     {
         if (strcmp(want_tls_creds, "1") == 0)
         {
-#ifdef USE_TMPFS
-            ECHECK(_create_tls_credentials(_tmpfs));
-#else
-            ECHECK(_create_tls_credentials(_fs));
-#endif
+            want_creds = true;
         }
         else if (strcmp(want_tls_creds, "0") != 0)
         {
@@ -668,6 +938,13 @@ int myst_enter_kernel(myst_kernel_args_t* args)
         }
     }
 
+    /* The files modified from now on are the ones the program changed */
+    if (args->export_ramfs_changed)
+        myst_export_ramfs_start();
+
+    if (args->export_gcov)
+        myst_export_ramfs_gcov();
+
     /* Create the main thread */
     ECHECK(_create_main_thread(args->event, &thread));
     __myst_main_thread = thread;
@@ -676,38 +953,82 @@ int myst_enter_kernel(myst_kernel_args_t* args)
     thread->main.cwd = strdup(args->cwd);
     if (thread->main.cwd == NULL)
         ERAISE(-ENOMEM);
+    thread->main.cwd_len = strlen(thread->main.cwd);
 
     thread->main.umask = MYST_DEFAULT_UMASK;
 
     /* Setup virtual proc filesystem */
+    start = myst_startup_trace_now();
     procfs_setup();
+    myst_startup_trace_event("procfs_setup", start);
 
     if (args->hostname)
         ECHECK(
             myst_syscall_sethostname(args->hostname, strlen(args->hostname)));
 
     /* setup the TTY devices */
+    start = myst_startup_trace_now();
     if (_setup_tty() != 0)
     {
         myst_eprintf("kernel: failed to setup of TTY devices\n");
         ERAISE(-EINVAL);
     }
-
-    /* Unpack the CPIO from memory */
-    if (fstype == MYST_FSTYPE_RAMFS &&
-        myst_cpio_mem_unpack(
-            args->rootfs_data, args->rootfs_size, "/", _create_mem_file) != 0)
-    {
-        myst_eprintf("failed to unpack root file system\n");
-        ERAISE(-EINVAL);
-    }
+    myst_startup_trace_event("setup_tty", start);
 
     /* Create top-level proc entries */
     create_proc_root_entries();
 
+    /* Mount /sys (the cgroup limits that runtimes size themselves from) */
+    start = myst_startup_trace_now();
+    sysfs_setup();
+    myst_startup_trace_event("sysfs_setup", start);
+
     /* Set the 'run-proc' which is called by the target to run new threads */
     ECHECK(myst_tcall_set_run_thread_function(myst_run_thread));
 
+    /* Let the target emulate syscall instructions that it cannot run */
+    if (!MYST_HAVE_SYSCALL_INSTRUCTION)
+    {
+        myst_syscall_xsave_size = _get_xsave_size();
+        ECHECK(myst_tcall_set_syscall_trampoline(myst_syscall_trampoline));
+    }
+
+    /* Start the kernel worker threads requested by --crypto-threads */
+    start = myst_startup_trace_now();
+    if (myst_start_workers(args->crypto_threads) != 0)
+    {
+        myst_eprintf("kernel: failed to start the crypto threads\n");
+        ERAISE(-EINVAL);
+    }
+    myst_startup_trace_event("start_workers", start);
+
+    /* Start the thread that closes host fds for --async-close */
+    if (myst_start_host_closer() != 0)
+    {
+        myst_eprintf("kernel: failed to start the host closer thread\n");
+        ERAISE(-EINVAL);
+    }
+
+    /* Start the thread that reads libraries ahead for --prefetch-libs */
+    if (myst_start_lib_prefetcher() != 0)
+    {
+        myst_eprintf("kernel: failed to start the library prefetcher\n");
+        ERAISE(-EINVAL);
+    }
+
+    /* Cache attestation evidence for --attestation-cache-ttl seconds */
+    myst_attest_cache_init(args->attestation_cache_ttl);
+
+    /* Generate the TLS credentials in the background */
+    if (want_creds)
+    {
+#ifdef USE_TMPFS
+        ECHECK(_start_tls_credentials(_tmpfs));
+#else
+        ECHECK(_start_tls_credentials(_fs));
+#endif
+    }
+
 #ifdef MYST_ENABLE_LEAK_CHECKER
     /* print out memory statistics */
     // myst_dump_malloc_stats();
@@ -715,9 +1036,18 @@ int myst_enter_kernel(myst_kernel_args_t* args)
 
     myst_times_start();
 
+    /* Start sampling for the profile requested by --profile */
+    if (myst_profile_start_sampling() != 0)
+    {
+        myst_eprintf("kernel: failed to start the profiler\n");
+        ERAISE(-EINVAL);
+    }
+
     /* Run the main program: wait for SYS_exit to perform longjmp() */
     if (myst_setjmp(&thread->jmpbuf) == 0)
     {
+        start = myst_startup_trace_now();
+
         /* enter the C-runtime on the target thread descriptor */
         if (myst_exec(
                 thread,
@@ -729,8 +1059,8 @@ int myst_enter_kernel(myst_kernel_args_t* args)
                 args->argv,
                 args->envc,
                 args->envp,
-                NULL,
-                NULL) != 0)
+                _enter_crt_callback,
+                (void*)start) != 0)
         {
             myst_panic("myst_exec() failed");
         }
@@ -753,6 +1083,8 @@ int myst_enter_kernel(myst_kernel_args_t* args)
 
         /* release signal related heap memory */
         myst_signal_free(thread);
+        myst_signal_release_infos(thread);
+        myst_release_scratch(thread);
 
         /* release the exec stack */
         if (thread->main.exec_stack)
@@ -777,6 +1109,34 @@ int myst_enter_kernel(myst_kernel_args_t* args)
         myst_set_fsbase(thread->target_td);
     }
 
+    /* Wait for the TLS credentials (which are written to the file system) */
+    _stop_tls_credentials();
+
+    /* Stop reading libraries ahead (before the block devices go away) */
+    myst_stop_lib_prefetcher();
+
+    /* Stop the kernel worker threads */
+    myst_stop_workers();
+
+    /* Close the host fds still queued by --async-close */
+    myst_stop_host_closer();
+
+#ifdef MYST_ENABLE_EXT2FS
+    /* Keep the verified verity hash nodes for the next boot (which needs
+     * the seal key) */
+    myst_save_verity_nodes();
+#endif
+
+    /* Release the cached attestation evidence and zero the seal keys */
+    myst_attest_cache_stop();
+
+    /* Stop sampling and then the kernel timer thread */
+    myst_profile_stop_sampling();
+    myst_stop_timers();
+
+    /* Write out what is left in the console buffer */
+    myst_console_flush();
+
     /* unload the debugger symbols */
     myst_syscall_unload_symbols();
 
@@ -785,8 +1145,20 @@ int myst_enter_kernel(myst_kernel_args_t* args)
     _teardown_tmpfs();
 #endif
 
-    /* Tear down the proc file system */
+    /* Print the syscall statistics requested by --syscall-stats */
+    if (__options.syscall_stats)
+    {
+        myst_dump_syscall_stats();
+        myst_dump_tcall_stats();
+    }
+
+#ifdef MYST_ENABLE_LOCK_STATS
+    myst_dump_lock_stats();
+#endif
+
+    /* Tear down the proc and sys file systems */
     procfs_teardown();
+    sysfs_teardown();
 
     /* Tear down the RAM file system */
     _teardown_ramfs();
@@ -2,35 +2,68 @@
 // Licensed under the MIT License.
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include <myst/assume.h>
-#include <myst/bufalloc.h>
+#include <myst/counters.h>
 #include <myst/epolldev.h>
 #include <myst/eraise.h>
 #include <myst/fdtable.h>
 #include <myst/id.h>
+#include <myst/kernel.h>
 #include <myst/list.h>
+#include <myst/pollq.h>
+#include <myst/slab.h>
 #include <myst/spinlock.h>
 #include <myst/syscall.h>
 #include <myst/tcall.h>
 
 #define MAGIC 0xc436d7e6
 
+/* initial number of hash buckets (must be a power of two) */
+#define INITIAL_BUCKETS 64
+
+/* maximum number of target events fetched by one target epoll_wait() */
+#define MAX_TARGET_EVENTS 64
+
 typedef struct epoll_entry epoll_entry_t;
 
+/*
+** An entry is either target-backed (tfd >= 0), in which case the target epoll
+** instance tracks its readiness, or a kernel object (tfd < 0), which is
+** polled with fd_get_events() and kept on the kernel list. A target-backed
+** entry with a poll queue (a socket that prefetches received bytes) is on
+** the kernel list as well, for the events that the target cannot see. Every
+** entry is in the hash table, which maps fds to entries. The target reports
+** the fd and the sequence number of the registration, so an event that was
+** in flight when its fd was deleted (and perhaps added again for another
+** object, such as after a close and a dup) is dropped instead of being
+** reported for the new entry.
+*/
 struct epoll_entry
 {
     /* these leading fields align with the same fields in myst_list_node_t */
     epoll_entry_t* prev;
     epoll_entry_t* next;
+    epoll_entry_t* hash_next;
     int fd;
+    int tfd;
+    myst_fdops_t* fdops;
+    void* object; /* detects that fd was closed and reused */
+    uint32_t seq; /* the registration (see _target_data) */
+    myst_pollq_t* pollq; /* the kernel object's poll queue (or null) */
+    bool disabled; /* an EPOLLONESHOT entry that has fired in the kernel */
+    uint32_t last_events; /* EPOLLET: the events last seen for this entry */
+    uint64_t last_wake;   /* EPOLLET: poll-wake count when last reported */
     struct epoll_event event;
 };
 
@@ -39,12 +72,42 @@ struct myst_epoll
     uint32_t magic; /* MAGIC */
     int flags;      /* flags passed to epoll_create1() or set by fcntl() */
     myst_spinlock_t lock;
-    myst_list_t list;
+    int tfd;              /* the target epoll instance (created lazily) */
+    epoll_entry_t** hash; /* hash table of all entries */
+    size_t nbuckets;
+    size_t nentries;
+    uint32_t next_seq; /* the sequence number of the next entry */
+    myst_list_t klist; /* the kernel entries */
+    myst_pollq_t pollq; /* notified when entries are added or modified */
 };
 
+/* the poll queue subscriptions of one epoll_wait() call */
+typedef struct epoll_waiter
+{
+    myst_poller_t poller;
+    myst_pollq_link_t buf[16];
+    myst_pollq_link_t* links; /* buf or heap memory */
+    size_t capacity;
+    size_t nlinks;
+} epoll_waiter_t;
+
+static myst_slab_cache_t _entry_cache =
+    MYST_SLAB_CACHE_INIT("epoll_entry_t", epoll_entry_t);
+
+/* Whether the entry is polled in the kernel (see above) */
+static bool _on_klist(const epoll_entry_t* entry)
+{
+    return entry->tfd < 0 || entry->pollq;
+}
+
+static epoll_entry_t** _bucket(myst_epoll_t* epoll, int fd)
+{
+    return &epoll->hash[(uint32_t)fd & (epoll->nbuckets - 1)];
+}
+
 static epoll_entry_t* _find(myst_epoll_t* epoll, int fd)
 {
-    for (epoll_entry_t* p = (epoll_entry_t*)epoll->list.head; p; p = p->next)
+    for (epoll_entry_t* p = *_bucket(epoll, fd); p; p = p->hash_next)
     {
         if (p->fd == fd)
             return p;
@@ -53,6 +116,94 @@ static epoll_entry_t* _find(myst_epoll_t* epoll, int fd)
     return NULL;
 }
 
+static int _grow(myst_epoll_t* epoll)
+{
+    size_t nbuckets = epoll->nbuckets * 2;
+    epoll_entry_t** hash;
+    epoll_entry_t** old = epoll->hash;
+    size_t old_nbuckets = epoll->nbuckets;
+
+    if (!(hash = calloc(nbuckets, sizeof(epoll_entry_t*))))
+        return -ENOMEM;
+
+    epoll->hash = hash;
+    epoll->nbuckets = nbuckets;
+
+    for (size_t i = 0; i < old_nbuckets; i++)
+    {
+        for (epoll_entry_t* p = old[i]; p;)
+        {
+            epoll_entry_t* next = p->hash_next;
+            epoll_entry_t** bucket = _bucket(epoll, p->fd);
+
+            p->hash_next = *bucket;
+            *bucket = p;
+            p = next;
+        }
+    }
+
+    free(old);
+    return 0;
+}
+
+static void _insert(myst_epoll_t* epoll, epoll_entry_t* entry)
+{
+    epoll_entry_t** bucket = _bucket(epoll, entry->fd);
+
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    epoll->nentries++;
+
+    if (_on_klist(entry))
+        myst_list_append(&epoll->klist, (myst_list_node_t*)entry);
+}
+
+/* Unlink and free an entry (without touching the target epoll instance) */
+static void _remove(myst_epoll_t* epoll, epoll_entry_t* entry)
+{
+    for (epoll_entry_t** pp = _bucket(epoll, entry->fd); *pp;
+         pp = &(*pp)->hash_next)
+    {
+        if (*pp == entry)
+        {
+            *pp = entry->hash_next;
+            break;
+        }
+    }
+
+    if (_on_klist(entry))
+        myst_list_remove(&epoll->klist, (myst_list_node_t*)entry);
+
+    epoll->nentries--;
+    myst_slab_free(entry);
+}
+
+/* Remove an entry, including its registration with the target instance */
+static void _delete(myst_epoll_t* epoll, epoll_entry_t* entry)
+{
+    /* fails harmlessly if the target fd was already closed */
+    if (entry->tfd >= 0 && epoll->tfd >= 0)
+        myst_tcall_epoll_ctl(epoll->tfd, EPOLL_CTL_DEL, entry->tfd, NULL);
+
+    _remove(epoll, entry);
+}
+
+/* Return true if fd still refers to the object the entry was added for */
+static bool _current(myst_fdtable_t* fdtable, const epoll_entry_t* entry)
+{
+    myst_fdtable_type_t type;
+    myst_fdops_t* fdops;
+    void* object;
+
+    if (myst_fdtable_get_any(
+            fdtable, entry->fd, &type, (void**)&fdops, (void**)&object) != 0)
+    {
+        return false;
+    }
+
+    return object == entry->object;
+}
+
 static bool _valid_epoll(const myst_epoll_t* epoll)
 {
     return epoll && epoll->magic == MAGIC;
@@ -79,6 +230,11 @@ static int _ed_epoll_create1(
 
         epoll->magic = MAGIC;
         epoll->flags = flags;
+        epoll->tfd = -1;
+        epoll->nbuckets = INITIAL_BUCKETS;
+
+        if (!(epoll->hash = calloc(epoll->nbuckets, sizeof(epoll_entry_t*))))
+            ERAISE(-ENOMEM);
     }
 
     *epoll_out = epoll;
@@ -87,8 +243,47 @@ static int _ed_epoll_create1(
 done:
 
     if (epoll)
+    {
+        free(epoll->hash);
         free(epoll);
+    }
+
+    return ret;
+}
 
+/* the events that may be combined with EPOLLEXCLUSIVE (as on Linux) */
+#define EXCLUSIVE_OK_EVENTS                                                  \
+    (EPOLLIN | EPOLLOUT | EPOLLRDNORM | EPOLLRDBAND | EPOLLWRNORM |          \
+     EPOLLWRBAND | EPOLLERR | EPOLLHUP | EPOLLWAKEUP | EPOLLET |             \
+     EPOLLEXCLUSIVE)
+
+/* The data of the target event of an entry: its fd and its sequence */
+static uint64_t _target_data(const epoll_entry_t* entry)
+{
+    return ((uint64_t)entry->seq << 32) | (uint32_t)entry->fd;
+}
+
+/* Register an entry with the target epoll instance */
+static int _target_ctl(myst_epoll_t* epoll, int op, epoll_entry_t* entry)
+{
+    int ret = 0;
+    struct epoll_event event;
+
+    if (epoll->tfd < 0)
+    {
+        long tfd;
+
+        ECHECK((tfd = myst_tcall_epoll_create1(EPOLL_CLOEXEC)));
+        epoll->tfd = (int)tfd;
+    }
+
+    /* the target reports the kernel fd, which is mapped back to the entry */
+    event.events = entry->event.events;
+    event.data.u64 = _target_data(entry);
+
+    ECHECK(myst_tcall_epoll_ctl(epoll->tfd, op, entry->tfd, &event));
+
+done:
     return ret;
 }
 
@@ -101,13 +296,39 @@ static int _ed_epoll_ctl(
 {
     ssize_t ret = 0;
     bool locked = false;
+    myst_fdtable_t* fdtable;
+    myst_fdtable_type_t type;
+    myst_fdops_t* fdops;
+    void* object;
 
-    if (!epolldev || !_valid_epoll(epoll) || !event)
+    if (!epolldev || !_valid_epoll(epoll))
         ERAISE(-EBADF);
 
+    if (!event && op != EPOLL_CTL_DEL)
+        ERAISE(-EFAULT);
+
     if (!myst_valid_fd(fd))
         ERAISE(-EBADF);
 
+    if (!(fdtable = myst_fdtable_current()))
+        ERAISE(-ENOSYS);
+
+    ECHECK(myst_fdtable_get_any(
+        fdtable, fd, &type, (void**)&fdops, (void**)&object));
+
+    if (object == epoll)
+        ERAISE(-EINVAL);
+
+    if (event && (event->events & EPOLLEXCLUSIVE))
+    {
+        /* EPOLLEXCLUSIVE may only be given to EPOLL_CTL_ADD */
+        if (op == EPOLL_CTL_MOD)
+            ERAISE(-EINVAL);
+
+        if (op == EPOLL_CTL_ADD && (event->events & ~EXCLUSIVE_OK_EVENTS))
+            ERAISE(-EINVAL);
+    }
+
     myst_spin_lock(&epoll->lock);
     locked = true;
 
@@ -117,33 +338,77 @@ static int _ed_epoll_ctl(
         case EPOLL_CTL_ADD:
         {
             epoll_entry_t* entry;
+            int tfd;
 
-            /* fail if entry already exists for this fd */
-            if (_find(epoll, fd))
-                ERAISE(-EEXIST);
+            /* an entry left behind by a closed fd is dropped silently */
+            if ((entry = _find(epoll, fd)))
+            {
+                if (entry->object == object)
+                    ERAISE(-EEXIST);
+
+                _delete(epoll, entry);
+            }
+
+            /* get the target fd for this object (or -ENOTSUP) */
+            if ((tfd = (*fdops->fd_target_fd)(fdops, object)) < 0 &&
+                tfd != -ENOTSUP)
+            {
+                ERAISE(-EINVAL);
+            }
 
-            if (!(entry = calloc(1, sizeof(epoll_entry_t))))
+            if (epoll->nentries >= epoll->nbuckets)
+                ECHECK(_grow(epoll));
+
+            if (!(entry = myst_slab_alloc(&_entry_cache)))
                 ERAISE(-ENOMEM);
 
             /* Initialize the entry */
+            memset(entry, 0, sizeof(epoll_entry_t));
             entry->fd = fd;
+            entry->tfd = tfd;
+            entry->fdops = fdops;
+            entry->object = object;
+            entry->seq = ++epoll->next_seq;
             entry->event = *event;
 
-            /* add the entry to the list */
-            myst_list_append(&epoll->list, (myst_list_node_t*)entry);
+            if (fdops->fd_pollq)
+                entry->pollq = (*fdops->fd_pollq)(fdops, object);
+
+            if (tfd >= 0 && (ret = _target_ctl(epoll, EPOLL_CTL_ADD, entry)))
+            {
+                myst_slab_free(entry);
+                ERAISE(ret);
+            }
 
+            _insert(epoll, entry);
             break;
         }
         case EPOLL_CTL_MOD:
         {
             epoll_entry_t* entry;
+            struct epoll_event old;
 
             /* fail if entry not found */
-            if (!(entry = _find(epoll, fd)))
+            if (!(entry = _find(epoll, fd)) || entry->object != object)
                 ERAISE(-ENOENT);
 
-            /* update the event */
+            /* an exclusive entry cannot be modified */
+            if (entry->event.events & EPOLLEXCLUSIVE)
+                ERAISE(-EINVAL);
+
+            /* update the event (this also rearms an EPOLLONESHOT entry) */
+            old = entry->event;
             entry->event = *event;
+            entry->disabled = false;
+            entry->last_events = 0;
+
+            if (entry->tfd >= 0 &&
+                (ret = _target_ctl(epoll, EPOLL_CTL_MOD, entry)))
+            {
+                entry->event = old;
+                ERAISE(ret);
+            }
+
             break;
         }
         case EPOLL_CTL_DEL:
@@ -151,11 +416,10 @@ static int _ed_epoll_ctl(
             epoll_entry_t* entry = NULL;
 
             /* fail if entry not found */
-            if (!(entry = _find(epoll, fd)))
+            if (!(entry = _find(epoll, fd)) || entry->object != object)
                 ERAISE(-ENOENT);
 
-            myst_list_remove(&epoll->list, (myst_list_node_t*)entry);
-            free(entry);
+            _delete(epoll, entry);
             break;
         }
         default:
@@ -169,161 +433,383 @@ done:
     if (locked)
         myst_spin_unlock(&epoll->lock);
 
+    /* let waiters pick up new or rearmed entries */
+    if (ret == 0 && op != EPOLL_CTL_DEL)
+        myst_pollq_notify(&epoll->pollq);
+
     return ret;
 }
 
-static int _ed_epoll_wait(
-    myst_epolldev_t* epolldev,
+/*
+** Decide whether a ready EPOLLET kernel entry has a new edge. Kernel devices
+** notify their poll queue (or call myst_tcall_poll_wake() if they have none)
+** whenever their state changes, so an entry that reports the same events at
+** the same count has not changed since the last report. A device without a
+** poll queue may see spurious reports from other devices' wakes, but an
+** edge is never lost.
+*/
+static bool _new_edge(epoll_entry_t* entry, uint32_t events, uint64_t wake)
+{
+    bool edge = (events & ~entry->last_events) || wake != entry->last_wake;
+
+    entry->last_events = events;
+
+    if (edge)
+        entry->last_wake = wake;
+
+    return edge;
+}
+
+/* Collect the ready kernel entries into events[] */
+static int _poll_kernel(
     myst_epoll_t* epoll,
+    myst_fdtable_t* fdtable,
     struct epoll_event* events,
-    int maxevents,
-    int timeout) /* milliseconds */
+    int maxevents)
 {
-    int ret = 0;
-    bool locked = false;
-    nfds_t nfds;
-    struct pollfd buf[16];
-    const size_t buflen = sizeof(buf);
-    struct pollfd* fds = NULL;
-    int n;
+    int nevents = 0;
 
-    if (!epolldev || !epoll || !events || maxevents < 0)
-        ERAISE(-EINVAL);
+    for (epoll_entry_t* p = (epoll_entry_t*)epoll->klist.head; p;)
+    {
+        epoll_entry_t* next = p->next;
+        uint32_t mask = p->event.events | EPOLLERR | EPOLLHUP;
+        uint64_t wake;
+        int revents;
 
-    myst_spin_lock(&epoll->lock);
-    locked = true;
+        if (nevents >= maxevents)
+            break;
 
-    /* Prune the interested FDs that have been closed */
-    {
-        myst_fdtable_t* fdtable = NULL;
-        myst_fdtable_type_t type;
-        myst_fdops_t* fdops;
-        void* object;
+        /* prune entries whose fds have been closed */
+        if (!_current(fdtable, p))
+        {
+            _delete(epoll, p);
+            p = next;
+            continue;
+        }
+
+        if (p->disabled)
+        {
+            p = next;
+            continue;
+        }
 
-        if (!(fdtable = myst_fdtable_current()))
-            ERAISE(-ENOSYS);
+        /* read the count first so a concurrent change is seen next time */
+        wake = p->pollq ? myst_pollq_generation(p->pollq)
+                        : myst_get_poll_wake_count();
 
-        for (epoll_entry_t* src = (epoll_entry_t*)epoll->list.head; src;)
+        if ((revents = (*p->fdops->fd_get_events)(p->fdops, p->object)) < 0)
+            revents = 0;
+
+        revents &= mask;
+
+        if (!revents)
         {
-            epoll_entry_t* next = src->next;
-            if (myst_fdtable_get_any(
-                    fdtable, src->fd, &type, (void**)&fdops, (void**)&object))
-            {
-                myst_list_remove(&epoll->list, (myst_list_node_t*)src);
-                free(src);
-            }
-            src = next;
+            /* the entry is not ready, so the next readiness is an edge */
+            p->last_events = 0;
+        }
+        else if (!(p->event.events & EPOLLET) || _new_edge(p, revents, wake))
+        {
+            /* poll and epoll events have the same values on Linux */
+            events[nevents].events = (uint32_t)revents;
+            events[nevents].data = p->event.data;
+            nevents++;
+
+            if (p->event.events & EPOLLONESHOT)
+                p->disabled = true;
         }
+
+        p = next;
     }
 
-    /* Get the number of events */
-    nfds = epoll->list.size;
+    return nevents;
+}
 
-    /* allocates the fds array */
-    if (!(fds = myst_buf_calloc(buf, buflen, nfds, sizeof(struct pollfd))))
-        ERAISE(-ENOMEM);
+/*
+** Subscribe a waiter to the epoll's own queue and to the queues of all its
+** kernel entries. Returns true if every kernel entry has a poll queue, so
+** that the waiter can sleep in the kernel unless there is a target instance.
+*/
+static int _subscribe(myst_epoll_t* epoll, epoll_waiter_t* w, bool* all)
+{
+    const size_t need = epoll->klist.size + 1;
+    bool host = epoll->tfd >= 0;
 
-    /* convert from epoll-set to poll-set */
+    if (need > w->capacity)
     {
-        const epoll_entry_t* src = (epoll_entry_t*)epoll->list.head;
+        myst_pollq_link_t* links;
 
-        for (size_t i = 0; i < nfds; i++)
-        {
-            struct pollfd* dest = &fds[i];
+        if (!(links = malloc(need * sizeof(myst_pollq_link_t))))
+            return -ENOMEM;
 
-            dest->fd = src->fd;
+        if (w->links != w->buf)
+            free(w->links);
 
-            if (src->event.events & EPOLLIN)
-                dest->events |= POLLIN;
+        w->links = links;
+        w->capacity = need;
+    }
 
-            if (src->event.events & EPOLLOUT)
-                dest->events |= POLLOUT;
+    /* entries without a poll queue need the host poll-wake pipe */
+    for (epoll_entry_t* p = (epoll_entry_t*)epoll->klist.head; p; p = p->next)
+    {
+        if (!p->pollq)
+            host = true;
+    }
 
-            if (src->event.events & EPOLLRDHUP)
-                dest->events |= POLLRDHUP;
+    myst_poller_init(&w->poller, host);
+    myst_pollq_subscribe(&epoll->pollq, &w->links[0], &w->poller);
+    w->nlinks = 1;
 
-            if (src->event.events & EPOLLPRI)
-                dest->events |= POLLPRI;
+    for (epoll_entry_t* p = (epoll_entry_t*)epoll->klist.head; p; p = p->next)
+    {
+        if (p->pollq)
+        {
+            myst_pollq_link_t* link = &w->links[w->nlinks++];
+
+            /* of the waiters on the object, each event wakes only one of
+             * those that hold it exclusively (in any epoll instance) */
+            if (p->event.events & EPOLLEXCLUSIVE)
+                myst_pollq_subscribe_exclusive(p->pollq, link, &w->poller);
+            else
+                myst_pollq_subscribe(p->pollq, link, &w->poller);
+        }
+    }
 
-            if (src->event.events & EPOLLERR)
-                dest->events |= POLLERR;
+    *all = !host;
+    return 0;
+}
 
-            if (src->event.events & EPOLLHUP)
-                dest->events |= POLLHUP;
+static void _unsubscribe(epoll_waiter_t* w)
+{
+    for (size_t i = 0; i < w->nlinks; i++)
+        myst_pollq_unsubscribe(&w->links[i]);
 
-            /* ATTN: EPOLLET not supported */
-            /* ATTN: EPOLLONESHOT not supported */
-            /* ATTN: EPOLLWAKEUP not supported */
-            /* ATTN: EPOLLEXCLUSIVE not supported */
+    w->nlinks = 0;
+}
 
-            src = src->next;
+/* Merge the target events of an entry that is also on the kernel list into
+ * its kernel report in events[0..nkernel) (if there is one) */
+static bool _merge(
+    const epoll_entry_t* entry,
+    struct epoll_event* events,
+    int nkernel,
+    uint32_t tevents)
+{
+    for (int i = 0; i < nkernel; i++)
+    {
+        if (events[i].data.u64 == entry->event.data.u64)
+        {
+            events[i].events |= tevents;
+            return true;
         }
     }
 
-    myst_spin_unlock(&epoll->lock);
-    locked = false;
+    return false;
+}
 
-    ECHECK((n = myst_syscall_poll(fds, nfds, timeout)));
+/* Wait once on the target instance and map its events back to entries,
+ * appending them to the nkernel kernel events already in events[] */
+static int _wait_target(
+    myst_epoll_t* epoll,
+    myst_fdtable_t* fdtable,
+    int tfd,
+    struct epoll_event* events,
+    int nkernel,
+    int maxevents,
+    int timeout)
+{
+    int ret = 0;
+    struct epoll_event tevents[MAX_TARGET_EVENTS];
+    int room = maxevents - nkernel;
+    int max = (room > MAX_TARGET_EVENTS) ? MAX_TARGET_EVENTS : room;
+    int nevents = 0;
+    long n;
+
+    /* myst_tcall_poll_wake() breaks out of either wait */
+    if (tfd < 0)
+    {
+        ECHECK(myst_tcall_poll(NULL, 0, timeout));
+        goto done;
+    }
+
+    ECHECK((n = myst_tcall_epoll_wait(tfd, tevents, max, timeout)));
 
     /* this should never happen */
-    if ((size_t)n > nfds)
+    if (n > max)
         ERAISE(-EINVAL);
 
     myst_spin_lock(&epoll->lock);
-    locked = true;
 
-    /* convert from poll-set back to epoll-set */
+    for (long i = 0; i < n; i++)
     {
-        int nevents = 0;
-        const epoll_entry_t* ent = (epoll_entry_t*)epoll->list.head;
+        const uint64_t data = tevents[i].data.u64;
+        const uint32_t fd = (uint32_t)data;
+        epoll_entry_t* entry;
 
-        for (size_t i = 0; i < nfds; i++)
+        /* skip events for entries that were deleted during the wait */
+        if (fd > INT_MAX || !(entry = _find(epoll, (int)fd)) ||
+            entry->tfd < 0 || _target_data(entry) != data)
         {
-            const struct pollfd* src = &fds[i];
+            continue;
+        }
 
-            if (src->revents)
-            {
-                struct epoll_event* dest;
+        if (!_current(fdtable, entry))
+        {
+            _delete(epoll, entry);
+            continue;
+        }
 
-                if (nevents >= maxevents)
-                    break;
+        if (_on_klist(entry))
+        {
+            if (entry->disabled)
+                continue;
+
+            /* the kernel side of an EPOLLONESHOT entry fires only once too */
+            if (entry->event.events & EPOLLONESHOT)
+                entry->disabled = true;
+
+            if (_merge(entry, events, nkernel, tevents[i].events))
+                continue;
+        }
+
+        events[nkernel + nevents].events = tevents[i].events;
+        events[nkernel + nevents].data = entry->event.data;
+        nevents++;
+    }
+
+    myst_spin_unlock(&epoll->lock);
 
-                dest = &events[nevents++];
+    ret = nevents;
 
-                if (src->events & POLLIN)
-                    dest->events |= EPOLLIN;
+done:
+    return ret;
+}
 
-                if (src->events & POLLOUT)
-                    dest->events |= EPOLLOUT;
+static int _ed_epoll_wait(
+    myst_epolldev_t* epolldev,
+    myst_epoll_t* epoll,
+    struct epoll_event* events,
+    int maxevents,
+    int timeout) /* milliseconds */
+{
+    int ret = 0;
+    myst_fdtable_t* fdtable;
+    const long deadline = myst_poll_deadline(timeout);
+    const unsigned int busy_poll_usec = __myst_kernel_args.busy_poll_usec;
+    epoll_waiter_t w;
+
+    w.links = w.buf;
+    w.capacity = MYST_COUNTOF(w.buf);
+    w.nlinks = 0;
+
+    if (!epolldev || !_valid_epoll(epoll) || !events || maxevents <= 0)
+        ERAISE(-EINVAL);
+
+    if (!(fdtable = myst_fdtable_current()))
+        ERAISE(-ENOSYS);
+
+    /*
+    ** Each pass subscribes to the poll queues before polling, so no change
+    ** is missed, and then sleeps in the kernel if only kernel objects are
+    ** involved or in the host otherwise. A host wait also ends early when
+    ** an unrelated device calls myst_tcall_poll_wake(), so keep waiting
+    ** until an event arrives or the timeout expires rather than returning 0.
+    */
+    for (;;)
+    {
+        int nevents;
+        int tfd;
+        int wait_timeout;
+        bool kernel_wait;
+        int n = 0;
+        int r;
+
+        myst_spin_lock(&epoll->lock);
+
+        if ((r = _subscribe(epoll, &w, &kernel_wait)) != 0)
+        {
+            myst_spin_unlock(&epoll->lock);
+            ERAISE(r);
+        }
 
-                if (src->events & POLLRDHUP)
-                    dest->events |= EPOLLRDHUP;
+        nevents = _poll_kernel(epoll, fdtable, events, maxevents);
+        tfd = epoll->tfd;
+        myst_spin_unlock(&epoll->lock);
 
-                if (src->events & POLLPRI)
-                    dest->events |= EPOLLPRI;
+        if (nevents == maxevents)
+        {
+            ret = nevents;
+            break;
+        }
 
-                if (src->events & POLLERR)
-                    dest->events |= EPOLLERR;
+        /* if any kernel entries are ready, do not block */
+        wait_timeout = nevents ? 0 : myst_poll_remaining(timeout, deadline);
 
-                if (src->events & POLLHUP)
-                    dest->events |= EPOLLHUP;
+        if (wait_timeout != 0)
+            myst_counter_inc(MYST_COUNTER_EPOLL_WAITS);
 
-                dest->data = ent->event.data;
+        if (kernel_wait)
+        {
+            if (wait_timeout != 0)
+                myst_poller_wait(&w.poller, wait_timeout);
+        }
+        else
+        {
+            /* busy poll the host first (see myst/pollq.h) */
+            if (wait_timeout != 0 && tfd >= 0 && busy_poll_usec)
+            {
+                const long busy = myst_busy_poll_deadline(busy_poll_usec);
+
+                do
+                {
+                    ECHECK((n = _wait_target(
+                                epoll,
+                                fdtable,
+                                tfd,
+                                events,
+                                nevents,
+                                maxevents,
+                                0)));
+                } while (n == 0 &&
+                         !__atomic_load_n(&w.poller.woken, __ATOMIC_ACQUIRE) &&
+                         myst_busy_poll_again(busy));
+
+                wait_timeout = myst_poll_remaining(timeout, deadline);
             }
 
-            ent = ent->next;
+            /* after a wake the next pass polls the kernel entries again */
+            if (n == 0 && !__atomic_load_n(&w.poller.woken, __ATOMIC_ACQUIRE))
+            {
+                ECHECK((n = _wait_target(
+                            epoll,
+                            fdtable,
+                            tfd,
+                            events,
+                            nevents,
+                            maxevents,
+                            wait_timeout)));
+            }
         }
 
-        ret = nevents;
+        _unsubscribe(&w);
+        nevents += n;
+
+        /* the wait ended with events (rather than a timeout or a wake) */
+        if (wait_timeout != 0 && nevents)
+            myst_counter_inc(MYST_COUNTER_EPOLL_WAKEUPS);
+
+        if (nevents || wait_timeout == 0)
+        {
+            ret = nevents;
+            break;
+        }
     }
 
 done:
 
-    if (fds)
-        myst_buf_free(buf, fds);
+    _unsubscribe(&w);
 
-    if (locked)
-        myst_spin_unlock(&epoll->lock);
+    if (w.links != w.buf)
+        free(w.links);
 
     return ret;
 }
@@ -527,6 +1013,25 @@ static int _ed_close(myst_epolldev_t* epolldev, myst_epoll_t* epoll)
     if (!epolldev || !_valid_epoll(epoll))
         ERAISE(-EBADF);
 
+    for (size_t i = 0; i < epoll->nbuckets; i++)
+    {
+        for (epoll_entry_t* p = epoll->hash[i]; p;)
+        {
+            epoll_entry_t* next = p->hash_next;
+            myst_slab_free(p);
+            p = next;
+        }
+    }
+
+    if (epoll->tfd >= 0)
+    {
+        long params[6] = {epoll->tfd};
+        myst_tcall(SYS_close, params);
+    }
+
+    free(epoll->hash);
+    myst_pollq_destroy(&epoll->pollq);
+
     memset(epoll, 0, sizeof(myst_epoll_t));
     free(epoll);
 
@@ -0,0 +1,563 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+#include <myst/cond.h>
+#include <myst/defs.h>
+#include <myst/eraise.h>
+#include <myst/eventfddev.h>
+#include <myst/id.h>
+#include <myst/mutex.h>
+#include <myst/pollq.h>
+
+#define MAGIC 0x5e7f0b12
+
+/* the largest count (a write that would pass it blocks) */
+#define MAX_COUNT 0xfffffffffffffffe
+
+/*
+** The count is only ever changed with compare-and-swap, so a read or write
+** that does not block takes no lock: signaling an eventfd costs one atomic
+** update, plus a wake of the threads blocked on it (if any) and of the
+** pollers subscribed to its poll queue (if any). A thread that has to block
+** counts itself in nwaiters before it rechecks the count under the mutex,
+** so an update either happens before that recheck or sees the waiter and
+** takes the mutex to wake it.
+*/
+typedef struct eventfd_impl
+{
+    _Atomic(uint64_t) count;
+    _Atomic(size_t) nwaiters; /* threads blocked in read() or write() */
+    myst_mutex_t mutex;       /* held by waiters around the wait */
+    myst_cond_t cond;         /* broadcast when the count changes */
+    size_t nrefs;             /* the eventfds sharing this (see dup) */
+    bool semaphore;           /* EFD_SEMAPHORE */
+    myst_pollq_t pollq;
+} eventfd_impl_t;
+
+struct myst_eventfd
+{
+    uint32_t magic;
+    int flags;   /* O_NONBLOCK */
+    int fdflags; /* FD_CLOEXEC */
+    eventfd_impl_t* impl;
+};
+
+MYST_INLINE bool _valid_eventfd(const myst_eventfd_t* obj)
+{
+    return obj && obj->magic == MAGIC && obj->impl;
+}
+
+/* Wake the threads and pollers that wait for the count to change */
+static void _wake(eventfd_impl_t* p)
+{
+    if (p->nwaiters)
+    {
+        myst_mutex_lock(&p->mutex);
+        myst_cond_broadcast(&p->cond, SIZE_MAX);
+        myst_mutex_unlock(&p->mutex);
+    }
+
+    myst_pollq_notify(&p->pollq);
+}
+
+/* Take the count (or one from it in semaphore mode) unless it is zero */
+static bool _try_read(eventfd_impl_t* p, uint64_t* value)
+{
+    uint64_t count = p->count;
+
+    while (count)
+    {
+        const uint64_t new_count = p->semaphore ? count - 1 : 0;
+
+        if (__atomic_compare_exchange_n(
+                &p->count,
+                &count,
+                new_count,
+                false,
+                __ATOMIC_SEQ_CST,
+                __ATOMIC_SEQ_CST))
+        {
+            *value = p->semaphore ? 1 : count;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Add value to the count unless the sum would pass MAX_COUNT */
+static bool _try_write(eventfd_impl_t* p, uint64_t value)
+{
+    uint64_t count = p->count;
+
+    while (MAX_COUNT - count >= value)
+    {
+        if (__atomic_compare_exchange_n(
+                &p->count,
+                &count,
+                count + value,
+                false,
+                __ATOMIC_SEQ_CST,
+                __ATOMIC_SEQ_CST))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int _ev_eventfd(
+    myst_eventfddev_t* dev,
+    unsigned int initval,
+    int flags,
+    myst_eventfd_t** obj_out)
+{
+    int ret = 0;
+    const int mask = EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC;
+    myst_eventfd_t* obj = NULL;
+    eventfd_impl_t* impl = NULL;
+
+    if (obj_out)
+        *obj_out = NULL;
+
+    if (!dev || (flags & ~mask) || !obj_out)
+        ERAISE(-EINVAL);
+
+    if (!(impl = calloc(1, sizeof(eventfd_impl_t))))
+        ERAISE(-ENOMEM);
+
+    impl->count = initval;
+    impl->nrefs = 1;
+    impl->semaphore = (flags & EFD_SEMAPHORE);
+
+    if (!(obj = calloc(1, sizeof(myst_eventfd_t))))
+        ERAISE(-ENOMEM);
+
+    obj->magic = MAGIC;
+    obj->flags = flags & O_NONBLOCK;
+    obj->impl = impl;
+    impl = NULL;
+
+    if (flags & EFD_CLOEXEC)
+        obj->fdflags = FD_CLOEXEC;
+
+    *obj_out = obj;
+    obj = NULL;
+
+done:
+
+    if (impl)
+        free(impl);
+
+    if (obj)
+        free(obj);
+
+    return ret;
+}
+
+static ssize_t _ev_read(
+    myst_eventfddev_t* dev,
+    myst_eventfd_t* obj,
+    void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+    eventfd_impl_t* p;
+    uint64_t value;
+
+    if (!dev || !_valid_eventfd(obj))
+        ERAISE(-EBADF);
+
+    if (!buf && count)
+        ERAISE(-EINVAL);
+
+    if (count < sizeof(uint64_t))
+        ERAISE(-EINVAL);
+
+    p = obj->impl;
+
+    if (!_try_read(p, &value))
+    {
+        if (obj->flags & O_NONBLOCK)
+            ERAISE(-EAGAIN);
+
+        myst_mutex_lock(&p->mutex);
+        p->nwaiters++;
+
+        while (!_try_read(p, &value))
+        {
+            if (myst_cond_wait(&p->cond, &p->mutex) != 0)
+            {
+                ret = -EINTR;
+                break;
+            }
+        }
+
+        p->nwaiters--;
+        myst_mutex_unlock(&p->mutex);
+        ECHECK(ret);
+    }
+
+    memcpy(buf, &value, sizeof(value));
+    ret = sizeof(value);
+
+    /* writers blocked on a full count may proceed */
+    _wake(p);
+
+done:
+    return ret;
+}
+
+static ssize_t _ev_write(
+    myst_eventfddev_t* dev,
+    myst_eventfd_t* obj,
+    const void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+    eventfd_impl_t* p;
+    uint64_t value;
+
+    if (!dev || !_valid_eventfd(obj))
+        ERAISE(-EBADF);
+
+    if (!buf && count)
+        ERAISE(-EINVAL);
+
+    if (count < sizeof(uint64_t))
+        ERAISE(-EINVAL);
+
+    memcpy(&value, buf, sizeof(value));
+
+    if (value == UINT64_MAX)
+        ERAISE(-EINVAL);
+
+    p = obj->impl;
+
+    if (!_try_write(p, value))
+    {
+        if (obj->flags & O_NONBLOCK)
+            ERAISE(-EAGAIN);
+
+        myst_mutex_lock(&p->mutex);
+        p->nwaiters++;
+
+        while (!_try_write(p, value))
+        {
+            if (myst_cond_wait(&p->cond, &p->mutex) != 0)
+            {
+                ret = -EINTR;
+                break;
+            }
+        }
+
+        p->nwaiters--;
+        myst_mutex_unlock(&p->mutex);
+        ECHECK(ret);
+    }
+
+    ret = sizeof(value);
+
+    if (value)
+        _wake(p);
+
+done:
+    return ret;
+}
+
+static ssize_t _ev_readv(
+    myst_eventfddev_t* dev,
+    myst_eventfd_t* obj,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+
+    if (!dev || !_valid_eventfd(obj))
+        ERAISE(-EINVAL);
+
+    ret = myst_fdops_readv(&dev->fdops, obj, iov, iovcnt);
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static ssize_t _ev_writev(
+    myst_eventfddev_t* dev,
+    myst_eventfd_t* obj,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+
+    if (!dev || !_valid_eventfd(obj))
+        ERAISE(-EINVAL);
+
+    ret = myst_fdops_writev(&dev->fdops, obj, iov, iovcnt);
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static int _ev_fstat(
+    myst_eventfddev_t* dev,
+    myst_eventfd_t* obj,
+    struct stat* statbuf)
+{
+    int ret = 0;
+    struct stat buf;
+
+    if (!dev || !_valid_eventfd(obj) || !statbuf)
+        ERAISE(-EINVAL);
+
+    memset(&buf, 0, sizeof(buf));
+    buf.st_dev = 14; /* magic number for eventfd device */
+    buf.st_ino = (ino_t)obj->impl;
+    buf.st_mode = S_IRUSR | S_IWUSR;
+    buf.st_nlink = 1;
+    buf.st_uid = MYST_DEFAULT_UID;
+    buf.st_gid = MYST_DEFAULT_GID;
+    buf.st_blksize = 4096;
+
+    *statbuf = buf;
+
+done:
+    return ret;
+}
+
+static int _ev_fcntl(
+    myst_eventfddev_t* dev,
+    myst_eventfd_t* obj,
+    int cmd,
+    long arg)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_eventfd(obj))
+        ERAISE(-EBADF);
+
+    switch (cmd)
+    {
+        case F_GETFL:
+        {
+            ret = O_RDWR | obj->flags;
+            break;
+        }
+        case F_SETFL:
+        {
+            obj->flags = (int)(arg & O_NONBLOCK);
+            break;
+        }
+        case F_GETFD:
+        {
+            ret = obj->fdflags;
+            break;
+        }
+        case F_SETFD:
+        {
+            if (arg != FD_CLOEXEC && arg != 0)
+                ERAISE(-EINVAL);
+
+            obj->fdflags = (int)arg;
+            break;
+        }
+        default:
+        {
+            ERAISE(-ENOTSUP);
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _ev_ioctl(
+    myst_eventfddev_t* dev,
+    myst_eventfd_t* obj,
+    unsigned long request,
+    long arg)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_eventfd(obj))
+        ERAISE(-EBADF);
+
+    switch (request)
+    {
+        case FIONBIO:
+        {
+            if (!arg)
+                ERAISE(-EFAULT);
+
+            if (*(const int*)arg)
+                obj->flags |= O_NONBLOCK;
+            else
+                obj->flags &= ~O_NONBLOCK;
+
+            break;
+        }
+        case TIOCGWINSZ:
+        {
+            ERAISE(-EINVAL);
+        }
+        default:
+        {
+            ERAISE(-ENOTSUP);
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _ev_dup(
+    myst_eventfddev_t* dev,
+    const myst_eventfd_t* obj,
+    myst_eventfd_t** obj_out)
+{
+    int ret = 0;
+    myst_eventfd_t* new_obj = NULL;
+
+    if (obj_out)
+        *obj_out = NULL;
+
+    if (!dev || !_valid_eventfd(obj) || !obj_out)
+        ERAISE(-EINVAL);
+
+    if (!(new_obj = calloc(1, sizeof(myst_eventfd_t))))
+        ERAISE(-ENOMEM);
+
+    *new_obj = *obj;
+
+    /* file descriptor flags are not propagated */
+    new_obj->fdflags = 0;
+
+    myst_mutex_lock(&obj->impl->mutex);
+    obj->impl->nrefs++;
+    myst_mutex_unlock(&obj->impl->mutex);
+
+    *obj_out = new_obj;
+
+done:
+    return ret;
+}
+
+static int _ev_close(myst_eventfddev_t* dev, myst_eventfd_t* obj)
+{
+    int ret = 0;
+    eventfd_impl_t* p;
+    size_t nrefs;
+
+    if (!dev || !_valid_eventfd(obj))
+        ERAISE(-EBADF);
+
+    p = obj->impl;
+
+    myst_mutex_lock(&p->mutex);
+    nrefs = --p->nrefs;
+    myst_mutex_unlock(&p->mutex);
+
+    /* release the count once no descriptor refers to it */
+    if (nrefs == 0)
+    {
+        myst_pollq_destroy(&p->pollq);
+        memset(p, 0, sizeof(eventfd_impl_t));
+        free(p);
+    }
+
+    memset(obj, 0, sizeof(myst_eventfd_t));
+    free(obj);
+
+done:
+    return ret;
+}
+
+static int _ev_target_fd(myst_eventfddev_t* dev, myst_eventfd_t* obj)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_eventfd(obj))
+        ERAISE(-EINVAL);
+
+    ret = -ENOTSUP;
+
+done:
+    return ret;
+}
+
+static int _ev_get_events(myst_eventfddev_t* dev, myst_eventfd_t* obj)
+{
+    int ret = 0;
+    uint64_t count;
+
+    if (!dev || !_valid_eventfd(obj))
+        ERAISE(-EINVAL);
+
+    count = obj->impl->count;
+
+    if (count > 0)
+        ret |= POLLIN;
+
+    if (count < MAX_COUNT)
+        ret |= POLLOUT;
+
+done:
+    return ret;
+}
+
+static myst_pollq_t* _ev_pollq(myst_eventfddev_t* dev, myst_eventfd_t* obj)
+{
+    if (!dev || !_valid_eventfd(obj))
+        return NULL;
+
+    return &obj->impl->pollq;
+}
+
+extern myst_eventfddev_t* myst_eventfddev_get(void)
+{
+    // clang-format-off
+    static myst_eventfddev_t _dev = {
+        {
+            .fd_read = (void*)_ev_read,
+            .fd_write = (void*)_ev_write,
+            .fd_readv = (void*)_ev_readv,
+            .fd_writev = (void*)_ev_writev,
+            .fd_fstat = (void*)_ev_fstat,
+            .fd_fcntl = (void*)_ev_fcntl,
+            .fd_ioctl = (void*)_ev_ioctl,
+            .fd_dup = (void*)_ev_dup,
+            .fd_close = (void*)_ev_close,
+            .fd_target_fd = (void*)_ev_target_fd,
+            .fd_get_events = (void*)_ev_get_events,
+            .fd_pollq = (void*)_ev_pollq,
+        },
+        .ev_eventfd = _ev_eventfd,
+        .ev_read = _ev_read,
+        .ev_write = _ev_write,
+        .ev_readv = _ev_readv,
+        .ev_writev = _ev_writev,
+        .ev_fstat = _ev_fstat,
+        .ev_fcntl = _ev_fcntl,
+        .ev_ioctl = _ev_ioctl,
+        .ev_dup = _ev_dup,
+        .ev_close = _ev_close,
+        .ev_target_fd = _ev_target_fd,
+        .ev_get_events = _ev_get_events,
+    };
+    // clang-format on
+
+    return &_dev;
+}
@@ -0,0 +1,228 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <myst/eraise.h>
+#include <myst/eventtrace.h>
+#include <myst/kernel.h>
+#include <myst/strings.h>
+#include <myst/syscall.h>
+#include <myst/syscallstats.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+
+#define RINGS MYST_EVENT_TRACE_RINGS
+#define RING_SIZE MYST_EVENT_TRACE_RING_SIZE
+
+uint32_t __myst_event_categories;
+
+static myst_event_trace_t* _trace;
+
+/* the kernel's own copies of the ring states and heads, so that the host
+ * (which may change the trace) cannot make two threads share a ring */
+static uint32_t _states[RINGS];
+static uint64_t _heads[RINGS];
+static uint64_t _dropped;
+
+int myst_event_trace_init(void)
+{
+    myst_event_trace_t* trace = __myst_kernel_args.event_trace;
+    uint32_t categories;
+
+    /* the events expose the syscalls and the timing of the program */
+    if (!trace || !__myst_kernel_args.tee_debug_mode)
+        return 0;
+
+    /* the trace is in host memory: read the categories once, then only
+     * write it */
+    categories = trace->categories & MYST_EVENT_ALL;
+
+    trace->magic = MYST_EVENT_TRACE_MAGIC;
+    trace->version = MYST_EVENT_TRACE_VERSION;
+    trace->ring_size = RING_SIZE;
+    trace->nrings = RINGS;
+    trace->dropped = 0;
+
+    /* name the syscalls, so that the trace describes itself */
+    for (size_t n = 0; n < MYST_EVENT_TRACE_MAX_SYSCALLS; n++)
+    {
+        const char* name = syscall_str((long)n);
+
+        if (strcmp(name, "unknown") != 0)
+            MYST_STRLCPY(trace->syscalls[n], name);
+        else
+            trace->syscalls[n][0] = '\0';
+    }
+
+    _trace = trace;
+    __atomic_store_n(&__myst_event_categories, categories, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int myst_set_event_categories(uint32_t categories)
+{
+    if (!_trace || (categories & ~MYST_EVENT_ALL))
+        return -EINVAL;
+
+    __atomic_store_n(&__myst_event_categories, categories, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Claim a free ring, or else the ring of an exited thread */
+static void _claim(myst_thread_t* thread)
+{
+    const uint32_t from[] = {MYST_EVENT_RING_FREE, MYST_EVENT_RING_EXITED};
+
+    for (size_t i = 0; i < MYST_COUNTOF(from); i++)
+    {
+        for (size_t j = 0; j < RINGS; j++)
+        {
+            uint32_t expected = from[i];
+
+            if (__atomic_compare_exchange_n(
+                    &_states[j],
+                    &expected,
+                    MYST_EVENT_RING_OWNED,
+                    false,
+                    __ATOMIC_ACQ_REL,
+                    __ATOMIC_RELAXED))
+            {
+                _trace->rings[j].owner = (uint32_t)thread->tid;
+                _trace->rings[j].state = MYST_EVENT_RING_OWNED;
+                thread->event_ring = (int)j + 1;
+                return;
+            }
+        }
+    }
+
+    thread->event_ring = -1;
+}
+
+void myst_event_record(
+    uint32_t category,
+    uint32_t type,
+    uint64_t arg0,
+    uint64_t arg1)
+{
+    myst_thread_t* thread;
+    myst_event_t* event;
+    uint64_t head;
+    size_t i;
+
+    if (!_trace)
+        return;
+
+    /* not myst_thread_self(), since this may run before the thread is set */
+    if (!myst_valid_thread((thread = (myst_thread_t*)myst_get_tsd())))
+        return;
+
+    if (thread->event_ring == 0)
+        _claim(thread);
+
+    if (thread->event_ring < 0)
+    {
+        _trace->dropped = __atomic_add_fetch(&_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* only this thread writes the ring, so fill the slot and publish it */
+    i = (size_t)thread->event_ring - 1;
+    head = _heads[i];
+    event = &_trace->rings[i].events[head % RING_SIZE];
+    event->time = myst_syscall_stats_now();
+    event->tid = (uint32_t)thread->tid;
+    event->category = (uint16_t)category;
+    event->type = (uint16_t)type;
+    event->arg0 = arg0;
+    event->arg1 = arg1;
+
+    _heads[i] = head + 1;
+    __atomic_store_n(&_trace->rings[i].head, head + 1, __ATOMIC_RELEASE);
+}
+
+void myst_event_trace_release(myst_thread_t* thread)
+{
+    size_t i;
+
+    if (!_trace || thread->event_ring <= 0)
+        return;
+
+    /* its events stay until another thread needs the ring */
+    i = (size_t)thread->event_ring - 1;
+    _trace->rings[i].state = MYST_EVENT_RING_EXITED;
+    __atomic_store_n(&_states[i], MYST_EVENT_RING_EXITED, __ATOMIC_RELEASE);
+    thread->event_ring = 0;
+}
+
+int myst_format_event_trace(myst_buf_t* buf)
+{
+    int ret = 0;
+    char tmp[128];
+    size_t used = 0;
+    int n;
+
+    if (!buf)
+        ERAISE(-EINVAL);
+
+    if (!_trace)
+    {
+        const char msg[] = "event tracing is off "
+                           "(run with --event-trace <file>)\n";
+        ECHECK(myst_buf_append(buf, msg, sizeof(msg) - 1));
+        goto done;
+    }
+
+    for (size_t i = 0; i < RINGS; i++)
+    {
+        if (__atomic_load_n(&_states[i], __ATOMIC_RELAXED) !=
+            MYST_EVENT_RING_FREE)
+        {
+            used++;
+        }
+    }
+
+    ECHECK(myst_buf_append(buf, "categories: ", 12));
+    ECHECK(myst_format_event_categories(
+        buf, __atomic_load_n(&__myst_event_categories, __ATOMIC_RELAXED)));
+    ECHECK(myst_buf_append(buf, "\navailable: ", 12));
+    ECHECK(myst_format_event_categories(buf, MYST_EVENT_ALL));
+
+    n = snprintf(
+        tmp,
+        sizeof(tmp),
+        "\nrings: %zu of %u\ndropped: %lu\n",
+        used,
+        RINGS,
+        __atomic_load_n(&_dropped, __ATOMIC_RELAXED));
+
+    if (n < 0 || (size_t)n >= sizeof(tmp))
+        ERAISE(-EINVAL);
+
+    ECHECK(myst_buf_append(buf, tmp, (size_t)n));
+
+done:
+    return ret;
+}
+
+int myst_control_event_trace(const void* data, size_t size)
+{
+    int ret = 0;
+    char list[256];
+    uint32_t categories;
+
+    if (!data || size >= sizeof(list))
+        ERAISE(-EINVAL);
+
+    memcpy(list, data, size);
+    list[size] = '\0';
+
+    ECHECK(myst_parse_event_categories(list, &categories));
+    ECHECK(myst_set_event_categories(categories));
+
+done:
+    return ret;
+}
@@ -15,12 +15,14 @@
 #include <myst/file.h>
 #include <myst/fsgs.h>
 #include <myst/libc.h>
+#include <myst/libprefetch.h>
+#include <myst/memops.h>
 #include <myst/mmanutils.h>
 #include <myst/panic.h>
 #include <myst/paths.h>
 #include <myst/printf.h>
 #include <myst/process.h>
-#include <myst/reloc.h>
+#include <myst/procfs.h>
 #include <myst/round.h>
 #include <myst/setjmp.h>
 #include <myst/spinlock.h>
@@ -672,7 +674,8 @@ void* elf_make_stack(
     if (!(stack = memalign(PAGE_SIZE, stack_size)))
         goto done;
 
-    memset(stack, 0, stack_size);
+    /* only the top of the stack is written before the program runs */
+    myst_memzero_nt(stack, stack_size);
 
     /*  Example:
         AT_SYSINFO_EHDR=7ffebe5c8000
@@ -757,13 +760,14 @@ typedef struct entry_args
     int (*liboc_libc_init)(libc_t* libc, FILE* const stderr_file);
 } entry_args_t;
 
-/* Create the "/proc/<pid>/exe" link */
+/* Create the "/proc/<pid>/exe" link and the generated /proc/<pid> files */
 static int _setup_exe_link(const char* path)
 {
     int ret = 0;
     char buf[PATH_MAX];
     char target[PATH_MAX];
     pid_t pid = (pid_t)myst_getpid();
+    const char* slash;
 
     if (myst_normalize(path, target, sizeof(target)) != 0)
         ERAISE(-EINVAL);
@@ -774,24 +778,210 @@ static int _setup_exe_link(const char* path)
     snprintf(buf, sizeof(buf), "/proc/%u/exe", pid);
     ECHECK(myst_syscall_symlink(target, buf));
 
+    ECHECK(procfs_pid_setup(pid));
+
+    /* as on Linux, the process is named after its program (/proc/<pid>/stat
+     * and PR_GET_NAME report this name) */
+    slash = strrchr(target, '/');
+    path = slash ? slash + 1 : target;
+    ECHECK(myst_set_thread_name(myst_thread_self(), path));
+
 done:
     return ret;
 }
 
-static long _add_crt_symbols(const void* text, size_t text_size)
+/*
+**==============================================================================
+**
+** The prepared C runtime.
+**
+**     Every exec loads the same CRT image, so the first exec checks the
+**     image once and reduces it to what is needed to load another copy: the
+**     loadable segments, the offsets of the dynamic vector, program headers
+**     and entry point, and the R_X86_64_RELATIVE relocations as bare
+**     (offset, addend) pairs. Later execs of that image just copy the
+**     segments and store the relocated addresses.
+**
+**==============================================================================
+*/
+
+typedef struct crt_segment
 {
-    long ret = 0;
-    long params[6] = {0};
+    uint64_t vaddr;
+    uint64_t memsz;
+} crt_segment_t;
+
+typedef struct crt_reloc
+{
+    uint64_t offset;
+    uint64_t addend;
+} crt_reloc_t;
+
+typedef struct prepared_crt
+{
+    /* the image that was prepared */
+    const void* data;
+    size_t size;
+    const void* reloc_data;
+    size_t reloc_size;
+
+    crt_segment_t* segments;
+    size_t num_segments;
+    crt_reloc_t* relocs;
+    size_t num_relocs;
+    uint64_t dynv;  /* the offset of the dynamic vector */
+    uint64_t phoff; /* the offset of the program headers */
+    uint64_t entry; /* the offset of the entry point */
+    size_t phnum;
+    size_t phentsize;
+} prepared_crt_t;
+
+static prepared_crt_t _prepared_crt;
+static myst_spinlock_t _prepared_crt_lock = MYST_SPINLOCK_INITIALIZER;
+
+static void _free_prepared_crt(prepared_crt_t* crt)
+{
+    free(crt->segments);
+    free(crt->relocs);
+    memset(crt, 0, sizeof(prepared_crt_t));
+}
+
+static int _prepare_crt(
+    const void* data,
+    size_t size,
+    const void* reloc_data,
+    size_t reloc_size,
+    prepared_crt_t* crt)
+{
+    int ret = 0;
+    const Elf64_Ehdr* eh = data;
+    const uint8_t* p;
+    const Elf64_Rela* rela = reloc_data;
+    const size_t nrela = reloc_size / sizeof(Elf64_Rela);
+    size_t ending_vaddr = 0;
+    bool have_dynv = false;
+
+    memset(crt, 0, sizeof(prepared_crt_t));
+
+    /* fail if image does not have a valid ELF header */
+    if (_test_header(eh) != 0)
+        ERAISE(-EINVAL);
+
+    /* fail if the CRT size is not a multiple of the page size */
+    if ((size % PAGE_SIZE) != 0)
+        ERAISE(-EINVAL);
+
+    if (eh->e_phoff + (size_t)eh->e_phnum * eh->e_phentsize > size)
+        ERAISE(-EINVAL);
+
+    if (!(crt->segments = calloc(eh->e_phnum + 1, sizeof(crt_segment_t))))
+        ERAISE(-ENOMEM);
+
+    /* Find the loadable segments and the dynamic vector */
+    p = (const uint8_t*)data + eh->e_phoff;
+
+    for (size_t i = 0; i < eh->e_phnum; i++, p += eh->e_phentsize)
+    {
+        const Elf64_Phdr* ph = (const Elf64_Phdr*)p;
+
+        if (ph->p_type == PT_LOAD)
+        {
+            if (ph->p_vaddr < ending_vaddr)
+                myst_panic("unsorted segments");
+
+            if (ph->p_vaddr + ph->p_memsz > size)
+                ERAISE(-EINVAL);
+
+            /* ATTN-8185D7BF: the gaps between segments stay mapped */
+            crt->segments[crt->num_segments].vaddr = ph->p_vaddr;
+            crt->segments[crt->num_segments].memsz = ph->p_memsz;
+            crt->num_segments++;
+
+            /* remember the end of this segment for the next pass */
+            ending_vaddr = ph->p_vaddr + ph->p_memsz;
+        }
+        else if (ph->p_type == PT_DYNAMIC && !have_dynv)
+        {
+            crt->dynv = ph->p_vaddr;
+            have_dynv = true;
+        }
+    }
+
+    if (!have_dynv)
+        ERAISE(-EINVAL);
+
+    /* Keep the relative relocations (the others are not applied) */
+    if (!(crt->relocs = calloc(nrela + 1, sizeof(crt_reloc_t))))
+        ERAISE(-ENOMEM);
+
+    for (size_t i = 0; i < nrela; i++)
+    {
+        const Elf64_Rela* r = &rela[i];
+
+        /* If zero-padded bytes reached */
+        if (r->r_offset == 0)
+            break;
 
-    params[0] = (long)NULL;
-    params[1] = 0;
-    params[2] = (long)text;
-    params[3] = (long)text_size;
+        if (r->r_offset + sizeof(uint64_t) > size)
+            ERAISE(-EINVAL);
 
-    ECHECK(myst_tcall(MYST_TCALL_ADD_SYMBOL_FILE, params));
+        if (ELF64_R_TYPE(r->r_info) == R_X86_64_RELATIVE)
+        {
+            crt->relocs[crt->num_relocs].offset = r->r_offset;
+            crt->relocs[crt->num_relocs].addend = (uint64_t)r->r_addend;
+            crt->num_relocs++;
+        }
+    }
+
+    crt->data = data;
+    crt->size = size;
+    crt->reloc_data = reloc_data;
+    crt->reloc_size = reloc_size;
+    crt->phoff = eh->e_phoff;
+    crt->entry = eh->e_entry;
+    crt->phnum = eh->e_phnum;
+    crt->phentsize = eh->e_phentsize;
 
 done:
 
+    if (ret != 0)
+        _free_prepared_crt(crt);
+
+    return ret;
+}
+
+/* Get the prepared form of the image (which the first exec prepares); an
+ * image other than the one prepared first is prepared into *tmp */
+static int _get_prepared_crt(
+    const void* data,
+    size_t size,
+    const void* reloc_data,
+    size_t reloc_size,
+    prepared_crt_t* tmp,
+    const prepared_crt_t** crt_out)
+{
+    int ret = 0;
+    prepared_crt_t* crt = &_prepared_crt;
+
+    myst_spin_lock(&_prepared_crt_lock);
+
+    if (!crt->data)
+        ret = _prepare_crt(data, size, reloc_data, reloc_size, crt);
+
+    myst_spin_unlock(&_prepared_crt_lock);
+    ECHECK(ret);
+
+    /* the prepared image never changes once the lock has been released */
+    if (crt->data != data || crt->size != size ||
+        crt->reloc_data != reloc_data || crt->reloc_size != reloc_size)
+    {
+        ECHECK(_prepare_crt(data, size, reloc_data, reloc_size, tmp));
+        crt = tmp;
+    }
+
+    *crt_out = crt;
+
+done:
     return ret;
 }
 
@@ -813,11 +1003,14 @@ int myst_exec(
     void* sp = NULL;
     const size_t stack_size = 64 * PAGE_SIZE;
     void* crt_data = NULL;
-    const Elf64_Ehdr* ehdr = NULL;
     const Elf64_Phdr* phdr = NULL;
     uint64_t* dynv = NULL;
     enter_t enter;
     char* envp_buf[] = {NULL};
+    const prepared_crt_t* crt;
+    prepared_crt_t tmp_crt;
+
+    memset(&tmp_crt, 0, sizeof(tmp_crt));
 
     if (!envp)
         envp = (const char**)envp_buf;
@@ -825,13 +1018,18 @@ int myst_exec(
     if (!thread || !crt_data_in || !crt_size || !argv)
         ERAISE(-EINVAL);
 
-    /* fail if image does not have a valid ELF header */
-    if (_test_header(crt_data_in) != 0)
-        ERAISE(-EINVAL);
+    /* start reading the program's libraries while the CRT is loaded (and
+     * then loads and relocates the program) */
+    myst_prefetch_libs(argv[0], envc, envp);
 
-    /* fail if the CRT size is not a multiple of the page size */
-    if ((crt_size % PAGE_SIZE) != 0)
-        ERAISE(-EINVAL);
+    /* check the image (unless an earlier exec prepared it already) */
+    ECHECK(_get_prepared_crt(
+        crt_data_in,
+        crt_size,
+        crt_reloc_data,
+        crt_reloc_size,
+        &tmp_crt,
+        &crt));
 
     /* allocate and zero-fill the new CRT image */
     {
@@ -845,86 +1043,28 @@ int myst_exec(
     }
 
     /* Copy over the loadable segments */
+    for (size_t i = 0; i < crt->num_segments; i++)
     {
-        const Elf64_Ehdr* eh = crt_data_in;
-        const uint8_t* p = (const uint8_t*)crt_data_in + eh->e_phoff;
-        size_t ending_vaddr = 0;
-
-        for (size_t i = 0; i < eh->e_phnum; i++)
-        {
-            const Elf64_Phdr* ph = (const Elf64_Phdr*)p;
-
-            if (ph->p_type == PT_LOAD)
-            {
-                void* dest = (uint8_t*)crt_data + ph->p_vaddr;
-                const void* src = (const uint8_t*)crt_data_in + ph->p_vaddr;
-                size_t gap_size;
-
-                if (ph->p_vaddr < ending_vaddr)
-                    myst_panic("unsorted segments");
-
-                memcpy(dest, src, ph->p_memsz);
-
-                /* unmap any gap between this segment and the last */
-                if ((gap_size = ph->p_vaddr - ending_vaddr))
-                {
-                    uint8_t* gap = (uint8_t*)crt_data + ending_vaddr;
-
-                    /* round gap up to page size */
-                    const uint64_t m = PAGE_SIZE;
-                    ECHECK(myst_round_up((uint64_t)gap, m, (uint64_t*)&gap));
-
-                    /* round the gap size down to the page size */
-                    gap_size = myst_round_down_to_page_size(gap_size);
+        const crt_segment_t* seg = &crt->segments[i];
+        void* dest = (uint8_t*)crt_data + seg->vaddr;
+        const void* src = (const uint8_t*)crt_data_in + seg->vaddr;
 
-#if 0
-                    // ATTN-8185D7BF: prevents CRT region from being released
-                    ECHECK(myst_munmap(gap, gap_size));
-#endif
-                }
-
-                /* remember the end of this segment for the next pass */
-                ending_vaddr = ph->p_vaddr + ph->p_memsz;
-            }
-
-            p += eh->e_phentsize;
-        }
+        memcpy(dest, src, seg->memsz);
     }
 
-    /* Find the dynamic vector: dynv */
+    /* apply the relocations to the new CRT data */
+    for (size_t i = 0; i < crt->num_relocs; i++)
     {
-        ehdr = crt_data;
-        const uint8_t* p = (const uint8_t*)crt_data + ehdr->e_phoff;
+        const crt_reloc_t* r = &crt->relocs[i];
+        uint64_t* dest = (uint64_t*)((uint8_t*)crt_data + r->offset);
 
-        for (size_t i = 0; i < ehdr->e_phnum; i++)
-        {
-            const Elf64_Phdr* ph = (const Elf64_Phdr*)p;
-
-            if (ph->p_type == PT_DYNAMIC)
-            {
-                dynv = (uint64_t*)((uint8_t*)crt_data + ph->p_vaddr);
-                break;
-            }
-
-            p += ehdr->e_phentsize;
-        }
-    }
-
-    /* apply relocations to the new CRT data */
-    if (myst_apply_relocations(
-            crt_data, crt_size, crt_reloc_data, crt_reloc_size) != 0)
-    {
-        ERAISE(-EINVAL);
+        *dest = (uint64_t)crt_data + r->addend;
     }
 
-    /* save the phdr */
-    phdr = (const Elf64_Phdr*)((const uint8_t*)crt_data + ehdr->e_phoff);
-
-    /* save the entry point */
-    enter = (enter_t)((uint8_t*)crt_data + ehdr->e_entry);
-
-    if (!dynv)
-        ERAISE(-EINVAL);
+    /* find the dynamic vector, the program headers and the entry point */
+    dynv = (uint64_t*)((uint8_t*)crt_data + crt->dynv);
+    phdr = (const Elf64_Phdr*)((const uint8_t*)crt_data + crt->phoff);
+    enter = (enter_t)((uint8_t*)crt_data + crt->entry);
 
     if (!(stack = elf_make_stack(
               argc,
@@ -934,8 +1074,8 @@ int myst_exec(
               stack_size,
               crt_data,
               phdr,
-              ehdr->e_phnum,
-              ehdr->e_phentsize,
+              crt->phnum,
+              crt->phentsize,
               enter,
               &sp)))
     {
@@ -944,6 +1084,9 @@ int myst_exec(
 
     assert(elf_check_stack(stack, stack_size) == 0);
 
+    /* the image is loaded (crt is not used below) */
+    _free_prepared_crt(&tmp_crt);
+
     /* create "/proc/<pid>/exe" which is a link to the program executable */
     if (_setup_exe_link(argv[0]) != 0)
         ERAISE(-EIO);
@@ -960,7 +1103,7 @@ int myst_exec(
     }
 
     /* register the new CRT symbols with the debugger */
-    ECHECK(_add_crt_symbols(crt_data, crt_size));
+    ECHECK(myst_add_crt_symbols(crt_data, crt_size));
 
     /* invoke the caller's callback here */
     if (callback)
@@ -977,6 +1120,8 @@ int myst_exec(
 
 done:
 
+    _free_prepared_crt(&tmp_crt);
+
     if (stack)
         free(stack);
 
@@ -18,6 +18,275 @@
 #include <myst/thread.h>
 #include <myst/ttydev.h>
 
+/* RLIMIT_NOFILE of the first table (tables inherit the limits on clone) */
+#define NOFILE_DEFAULT 65536
+
+#define CHUNK_WORDS (MYST_FDTABLE_SIZE / 64)
+#define CHUNK_FULL ((1UL << CHUNK_WORDS) - 1)
+
+MYST_STATIC_ASSERT(CHUNK_WORDS <= 64);
+MYST_STATIC_ASSERT(MYST_FDTABLE_CHUNKS % 64 == 0);
+
+/* The entry of fd (null if its chunk was never allocated); caller locks */
+static myst_fdtable_entry_t* _entry(myst_fdtable_t* fdtable, size_t fd)
+{
+    myst_fdtable_chunk_t* chunk = fdtable->chunks[fd / MYST_FDTABLE_SIZE];
+    return chunk ? &chunk->entries[fd % MYST_FDTABLE_SIZE] : NULL;
+}
+
+/* Update the free bitmaps after fd was assigned or released */
+static void _mark(myst_fdtable_t* fdtable, size_t fd, bool used)
+{
+    const size_t c = fd / MYST_FDTABLE_SIZE;
+    const size_t i = fd % MYST_FDTABLE_SIZE;
+    myst_fdtable_chunk_t* chunk = fdtable->chunks[c];
+    uint64_t* word = &chunk->used[i / 64];
+
+    if (used)
+    {
+        *word |= 1UL << (i % 64);
+
+        if (*word == ~0UL)
+            chunk->full |= 1UL << (i / 64);
+
+        if (chunk->full == CHUNK_FULL)
+            fdtable->full[c / 64] |= 1UL << (c % 64);
+    }
+    else
+    {
+        *word &= ~(1UL << (i % 64));
+        chunk->full &= ~(1UL << (i / 64));
+        fdtable->full[c / 64] &= ~(1UL << (c % 64));
+    }
+}
+
+/* Set or clear the FD_CLOEXEC bit of fd in the bitmaps */
+static void _mark_cloexec(myst_fdtable_t* fdtable, size_t fd, bool cloexec)
+{
+    const size_t c = fd / MYST_FDTABLE_SIZE;
+    const size_t i = fd % MYST_FDTABLE_SIZE;
+    myst_fdtable_chunk_t* chunk = fdtable->chunks[c];
+
+    if (cloexec)
+    {
+        chunk->cloexec[i / 64] |= 1UL << (i % 64);
+        fdtable->cloexec[c / 64] |= 1UL << (c % 64);
+        return;
+    }
+
+    chunk->cloexec[i / 64] &= ~(1UL << (i % 64));
+
+    for (size_t w = 0; w < CHUNK_WORDS; w++)
+    {
+        if (chunk->cloexec[w])
+            return;
+    }
+
+    fdtable->cloexec[c / 64] &= ~(1UL << (c % 64));
+}
+
+/* Whether the object has FD_CLOEXEC (for objects entering the table) */
+static bool _object_cloexec(myst_fdops_t* fdops, void* object)
+{
+    int r = (*fdops->fd_fcntl)(fdops, object, F_GETFD, 0);
+    return r > 0 && (r & FD_CLOEXEC);
+}
+
+/* The lowest free descriptor in [start, limit), found by skipping full
+ * chunks and full words of the bitmaps (or -EMFILE if there is none) */
+static long _find_free(myst_fdtable_t* fdtable, size_t start, size_t limit)
+{
+    size_t fd = start;
+
+    while (fd < limit)
+    {
+        const size_t i = fd % MYST_FDTABLE_SIZE;
+        size_t c = fd / MYST_FDTABLE_SIZE;
+        uint64_t chunks = ~fdtable->full[c / 64] & (~0UL << (c % 64));
+        const myst_fdtable_chunk_t* chunk;
+        uint64_t words;
+
+        if (!chunks)
+        {
+            fd = (c / 64 + 1) * 64 * MYST_FDTABLE_SIZE;
+            continue;
+        }
+
+        /* the first chunk (from c) with a free descriptor */
+        if ((c = (c / 64) * 64 + __builtin_ctzl(chunks)) * MYST_FDTABLE_SIZE >
+            fd)
+        {
+            fd = c * MYST_FDTABLE_SIZE;
+            continue;
+        }
+
+        /* an unallocated chunk is all free */
+        if (!(chunk = fdtable->chunks[c]))
+            break;
+
+        words = ~chunk->full & CHUNK_FULL & (~0UL << (i / 64));
+
+        while (words)
+        {
+            const size_t w = __builtin_ctzl(words);
+            uint64_t free_bits = ~chunk->used[w];
+
+            if (w == i / 64)
+                free_bits &= ~0UL << (i % 64);
+
+            if (free_bits)
+            {
+                fd = c * MYST_FDTABLE_SIZE + w * 64 + __builtin_ctzl(free_bits);
+                goto found;
+            }
+
+            words &= words - 1;
+        }
+
+        fd = (c + 1) * MYST_FDTABLE_SIZE;
+    }
+
+found:
+    return fd < limit ? (long)fd : -EMFILE;
+}
+
+/* Drop a reference to a chunk, closing its objects with the last one */
+static void _release_chunk(myst_fdtable_chunk_t* chunk)
+{
+    if (__atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    for (size_t w = 0; w < CHUNK_WORDS; w++)
+    {
+        for (uint64_t bits = chunk->used[w]; bits; bits &= bits - 1)
+        {
+            myst_fdtable_entry_t* entry =
+                &chunk->entries[w * 64 + __builtin_ctzl(bits)];
+            myst_fdops_t* fdops = entry->device;
+
+            (*fdops->fd_close)(fdops, entry->object);
+        }
+    }
+
+    /* Files are released by ramfs */
+    memset(chunk, 0, sizeof(myst_fdtable_chunk_t));
+    free(chunk);
+}
+
+/* Copy a shared chunk with a duplicate of each of its objects */
+static int _copy_chunk(
+    const myst_fdtable_chunk_t* chunk,
+    myst_fdtable_chunk_t** copy_out)
+{
+    int ret = 0;
+    myst_fdtable_chunk_t* copy = NULL;
+    size_t n = 0;
+    size_t w;
+    uint64_t bits;
+
+    if (!(copy = malloc(sizeof(myst_fdtable_chunk_t))))
+        ERAISE(-ENOMEM);
+
+    memcpy(copy, chunk, sizeof(myst_fdtable_chunk_t));
+    copy->refs = 1;
+
+    for (w = 0; w < CHUNK_WORDS; w++)
+    {
+        for (bits = chunk->used[w]; bits; bits &= bits - 1, n++)
+        {
+            myst_fdtable_entry_t* entry =
+                &copy->entries[w * 64 + __builtin_ctzl(bits)];
+            myst_fdops_t* fdops = entry->device;
+            const size_t i = w * 64 + __builtin_ctzl(bits);
+            void* object;
+
+            ECHECK((*fdops->fd_dup)(fdops, entry->object, &object));
+
+            /* the copy must not look any different (fd_dup() drops it) */
+            if (chunk->cloexec[w] & (1UL << (i % 64)))
+                (*fdops->fd_fcntl)(fdops, object, F_SETFD, FD_CLOEXEC);
+
+            entry->object = object;
+        }
+    }
+
+    *copy_out = copy;
+    copy = NULL;
+
+done:
+
+    if (copy)
+    {
+        /* close the first n duplicates */
+        for (w = 0; n && w < CHUNK_WORDS; w++)
+        {
+            for (bits = chunk->used[w]; n && bits; bits &= bits - 1, n--)
+            {
+                myst_fdtable_entry_t* entry =
+                    &copy->entries[w * 64 + __builtin_ctzl(bits)];
+                myst_fdops_t* fdops = entry->device;
+
+                (*fdops->fd_close)(fdops, entry->object);
+            }
+        }
+
+        free(copy);
+    }
+
+    return ret;
+}
+
+/* Get a chunk of this table only (allocating or copying it); caller locks */
+static int _writable_chunk(
+    myst_fdtable_t* fdtable,
+    size_t c,
+    myst_fdtable_chunk_t** chunk_out)
+{
+    int ret = 0;
+    myst_fdtable_chunk_t* chunk = fdtable->chunks[c];
+    myst_fdtable_chunk_t* old = NULL;
+
+    if (!chunk)
+    {
+        if (!(chunk = calloc(1, sizeof(myst_fdtable_chunk_t))))
+            ERAISE(-ENOMEM);
+
+        chunk->refs = 1;
+    }
+    else if (__atomic_load_n(&chunk->refs, __ATOMIC_ACQUIRE) != 1)
+    {
+        old = chunk;
+        ECHECK(_copy_chunk(old, &chunk));
+    }
+
+    if (chunk != fdtable->chunks[c])
+    {
+        myst_seqcount_write_begin(&fdtable->seq);
+        __atomic_store_n(&fdtable->chunks[c], chunk, __ATOMIC_RELEASE);
+        myst_seqcount_write_end(&fdtable->seq);
+    }
+
+    if (old)
+        _release_chunk(old);
+
+    *chunk_out = chunk;
+
+done:
+    return ret;
+}
+
+/* Clear the entry of fd in a writable chunk */
+static void _clear(myst_fdtable_t* fdtable, size_t fd)
+{
+    myst_fdtable_entry_t* entry = _entry(fdtable, fd);
+
+    myst_seqcount_write_begin(&fdtable->seq);
+    memset(entry, 0, sizeof(myst_fdtable_entry_t));
+    myst_seqcount_write_end(&fdtable->seq);
+    _mark(fdtable, fd, false);
+    _mark_cloexec(fdtable, fd, false);
+}
+
 int myst_fdtable_create(myst_fdtable_t** fdtable_out)
 {
     int ret = 0;
@@ -33,6 +302,9 @@ int myst_fdtable_create(myst_fdtable_t** fdtable_out)
     if (!(fdtable = calloc(1, sizeof(myst_fdtable_t))))
         ERAISE(-ENOMEM);
 
+    fdtable->nofile_cur = NOFILE_DEFAULT;
+    fdtable->nofile_max = NOFILE_DEFAULT;
+
     *fdtable_out = fdtable;
     fdtable = NULL;
 
@@ -59,32 +331,27 @@ int myst_fdtable_clone(myst_fdtable_t* fdtable, myst_fdtable_t** fdtable_out)
     if (!(new_fdtable = calloc(1, sizeof(myst_fdtable_t))))
         ERAISE(-ENOMEM);
 
-    myst_spin_lock(&fdtable->lock);
+    /* share the chunks: the first write to one of them copies it */
+    myst_ticket_lock(&fdtable->lock);
     {
-        for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
+        for (size_t c = 0; c < MYST_FDTABLE_CHUNKS; c++)
         {
-            const myst_fdtable_entry_t* entry = &fdtable->entries[i];
+            myst_fdtable_chunk_t* chunk = fdtable->chunks[c];
 
-            if (entry->type != MYST_FDTABLE_TYPE_NONE)
+            if (chunk)
             {
-                myst_fdtable_entry_t* new_entry = &new_fdtable->entries[i];
-                myst_fdops_t* fdops = entry->device;
-                void* object;
-                long r;
-
-                if ((r = (*fdops->fd_dup)(fdops, entry->object, &object)) != 0)
-                {
-                    myst_spin_unlock(&fdtable->lock);
-                    ERAISE(r);
-                }
-
-                new_entry->type = entry->type;
-                new_entry->device = entry->device;
-                new_entry->object = object;
+                __atomic_add_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL);
+                new_fdtable->chunks[c] = chunk;
             }
         }
+
+        memcpy(new_fdtable->full, fdtable->full, sizeof(fdtable->full));
+        memcpy(
+            new_fdtable->cloexec, fdtable->cloexec, sizeof(fdtable->cloexec));
+        new_fdtable->nofile_cur = fdtable->nofile_cur;
+        new_fdtable->nofile_max = fdtable->nofile_max;
     }
-    myst_spin_unlock(&fdtable->lock);
+    myst_ticket_unlock(&fdtable->lock);
 
     *fdtable_out = new_fdtable;
     new_fdtable = NULL;
@@ -100,45 +367,52 @@ done:
 int myst_fdtable_cloexec(myst_fdtable_t* fdtable)
 {
     int ret = 0;
+    bool locked = false;
 
     if (!fdtable)
         ERAISE(-EINVAL);
 
-    myst_spin_lock(&fdtable->lock);
+    myst_ticket_lock(&fdtable->lock);
+    locked = true;
+
+    /* close the file descriptors whose FD_CLOEXEC bit is set */
+    for (size_t k = 0; k < MYST_COUNTOF(fdtable->cloexec); k++)
     {
-        /* close any file descriptors with FD_CLOEXEC flag */
-        for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
+        /* the chunk bit goes away with the last descriptor of the chunk */
+        while (fdtable->cloexec[k])
         {
-            myst_fdtable_entry_t* entry = &fdtable->entries[i];
+            const size_t c = k * 64 + __builtin_ctzl(fdtable->cloexec[k]);
+            myst_fdtable_chunk_t* chunk;
 
-            if (entry->type != MYST_FDTABLE_TYPE_NONE)
-            {
-                myst_fdops_t* fdops = entry->device;
-                int r = (*fdops->fd_fcntl)(fdops, entry->object, F_GETFD, 0);
+            ECHECK(_writable_chunk(fdtable, c, &chunk));
 
-                if (r < 0)
+            for (size_t w = 0; w < CHUNK_WORDS; w++)
+            {
+                while (chunk->cloexec[w])
                 {
-                    myst_spin_unlock(&fdtable->lock);
-                    ERAISE(r);
-                }
+                    const size_t i = w * 64 + __builtin_ctzl(chunk->cloexec[w]);
+                    const size_t fd = c * MYST_FDTABLE_SIZE + i;
+                    myst_fdtable_entry_t* entry = &chunk->entries[i];
+                    myst_fdops_t* fdops = entry->device;
 
-                if ((r & FD_CLOEXEC))
-                {
                     (*fdops->fd_close)(fdops, entry->object);
 
                     if (entry->type == MYST_FDTABLE_TYPE_FILE)
                     {
-                        myst_remove_fd_link(i);
+                        myst_remove_fd_link(fd);
                     }
 
-                    memset(entry, 0, sizeof(myst_fdtable_entry_t));
+                    _clear(fdtable, fd);
                 }
             }
         }
     }
-    myst_spin_unlock(&fdtable->lock);
 
 done:
+
+    if (locked)
+        myst_ticket_unlock(&fdtable->lock);
+
     return ret;
 }
 
@@ -149,26 +423,39 @@ int myst_fdtable_free(myst_fdtable_t* fdtable)
     if (!fdtable)
         ERAISE(-EINVAL);
 
-    /* Close all objects */
-    for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
+    /* Close all objects (of chunks no other table shares) */
+    for (size_t c = 0; c < MYST_FDTABLE_CHUNKS; c++)
     {
-        myst_fdtable_entry_t* entry = &fdtable->entries[i];
+        myst_fdtable_chunk_t* chunk = fdtable->chunks[c];
 
-        if (entry->type != MYST_FDTABLE_TYPE_NONE)
-        {
-            myst_fdops_t* fdops = entry->device;
-            (*fdops->fd_close)(fdops, entry->object);
+        if (!chunk)
+            continue;
 
-            if (entry->type == MYST_FDTABLE_TYPE_FILE)
+        for (size_t w = 0; w < CHUNK_WORDS; w++)
+        {
+            for (uint64_t bits = chunk->used[w]; bits; bits &= bits - 1)
             {
-                myst_remove_fd_link(i);
-            }
+                const size_t i = w * 64 + __builtin_ctzl(bits);
 
-            memset(entry, 0, sizeof(myst_fdtable_entry_t));
+                if (chunk->entries[i].type == MYST_FDTABLE_TYPE_FILE)
+                {
+                    myst_remove_fd_link(c * MYST_FDTABLE_SIZE + i);
+                }
+            }
         }
+
+        _release_chunk(chunk);
+    }
+
+    /* no thread that may still use these is left */
+    while (fdtable->retired)
+    {
+        myst_fdtable_retired_t* p = fdtable->retired;
+        fdtable->retired = p->next;
+        (*p->fdops->fd_close)(p->fdops, p->object);
+        free(p);
     }
 
-    /* Files are released by ramfs */
     memset(fdtable, 0, sizeof(myst_fdtable_t));
     free(fdtable);
 
@@ -181,36 +468,53 @@ int myst_fdtable_assign(
     myst_fdtable_type_t type,
     void* device,
     void* object)
+{
+    if (!device || !object)
+        return -EINVAL;
+
+    return myst_fdtable_assign_cloexec(
+        fdtable, type, device, object, _object_cloexec(device, object));
+}
+
+int myst_fdtable_assign_cloexec(
+    myst_fdtable_t* fdtable,
+    myst_fdtable_type_t type,
+    void* device,
+    void* object,
+    bool cloexec)
 {
     int ret = 0;
+    bool locked = false;
+    myst_fdtable_chunk_t* chunk;
+    myst_fdtable_entry_t* entry;
+    long fd;
 
     if (!fdtable || !object)
         ERAISE(-EINVAL);
 
-    myst_spin_lock(&fdtable->lock);
-    {
-        /* Use the first available entry */
-        for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
-        {
-            myst_fdtable_entry_t* entry = &fdtable->entries[i];
+    myst_ticket_lock(&fdtable->lock);
+    locked = true;
 
-            if (entry->type == MYST_FDTABLE_TYPE_NONE)
-            {
-                entry->type = type;
-                entry->device = device;
-                entry->object = object;
-                ret = i;
-                myst_spin_unlock(&fdtable->lock);
-                goto done;
-            }
-        }
-    }
-    myst_spin_unlock(&fdtable->lock);
+    /* Use the first available entry */
+    ECHECK(fd = _find_free(fdtable, 0, fdtable->nofile_cur));
+    ECHECK(_writable_chunk(fdtable, fd / MYST_FDTABLE_SIZE, &chunk));
+    entry = &chunk->entries[fd % MYST_FDTABLE_SIZE];
 
-    ERAISE(-EMFILE);
+    myst_seqcount_write_begin(&fdtable->seq);
+    entry->type = type;
+    entry->device = device;
+    entry->object = object;
+    myst_seqcount_write_end(&fdtable->seq);
+    _mark(fdtable, fd, true);
+    _mark_cloexec(fdtable, fd, cloexec);
+
+    ret = fd;
 
 done:
 
+    if (locked)
+        myst_ticket_unlock(&fdtable->lock);
+
     return ret;
 }
 
@@ -226,6 +530,7 @@ int myst_fdtable_dup(
     bool use_next_available_fd = false;
     bool set_cloexec = false;
     size_t start_fd = 0;
+    myst_fdtable_entry_t prev = {0};
 
     if (!fdtable)
         ERAISE(-EINVAL);
@@ -283,17 +588,18 @@ int myst_fdtable_dup(
         }
     }
 
-    myst_spin_lock(&fdtable->lock);
+    myst_ticket_lock(&fdtable->lock);
     locked = true;
 
     {
-        myst_fdtable_entry_t* old = &fdtable->entries[oldfd];
-        myst_fdtable_entry_t* new = NULL;
-        myst_fdops_t* old_fdops = old->device;
+        myst_fdtable_entry_t* old = _entry(fdtable, oldfd);
+        myst_fdtable_entry_t* new;
+        myst_fdtable_chunk_t* chunk;
+        myst_fdops_t* old_fdops;
         void* newobj;
-        int r;
+        long fd;
 
-        if (old->type == MYST_FDTABLE_TYPE_NONE)
+        if (!old || old->type == MYST_FDTABLE_TYPE_NONE)
             ERAISE(-ENOENT);
 
         if (newfd == oldfd) /* dup2() */
@@ -305,49 +611,39 @@ int myst_fdtable_dup(
 
         if (use_next_available_fd)
         {
-            /* find the first free file descriptor */
-            for (size_t i = start_fd; i < MYST_COUNTOF(fdtable->entries); i++)
-            {
-                myst_fdtable_entry_t* p = &fdtable->entries[i];
-
-                if (p->type == MYST_FDTABLE_TYPE_NONE)
-                {
-                    new = p;
-                    newfd = i;
-                    break;
-                }
-            }
+            /* F_DUPFD fails with EINVAL beyond RLIMIT_NOFILE */
+            if (start_fd >= fdtable->nofile_cur && duptype != MYST_DUP)
+                ERAISE(-EINVAL);
 
-            if (!new)
-                ERAISE(-EMFILE);
+            /* find the first free file descriptor */
+            ECHECK(fd = _find_free(fdtable, start_fd, fdtable->nofile_cur));
+            newfd = fd;
         }
-        else
+        else if ((size_t)newfd >= fdtable->nofile_cur)
         {
-            new = &fdtable->entries[newfd];
-
-            /* if new entry is not empty, close the descriptor */
-            if (new->type != MYST_FDTABLE_TYPE_NONE)
-            {
-                myst_fdops_t* new_fdops = new->device;
-                (new_fdops->fd_close)(new->device, new->object);
-
-                if (new->type == MYST_FDTABLE_TYPE_FILE)
-                {
-                    myst_remove_fd_link(newfd);
-                }
-            }
+            ERAISE(-EBADF);
         }
 
+        /* this may copy the chunk of oldfd too, so look it up again */
+        ECHECK(_writable_chunk(fdtable, newfd / MYST_FDTABLE_SIZE, &chunk));
+        new = &chunk->entries[newfd % MYST_FDTABLE_SIZE];
+        old = _entry(fdtable, oldfd);
+        old_fdops = old->device;
+        prev = *new;
+
         /* dup the old object */
-        if ((r = (old_fdops->fd_dup)(old->device, old->object, &newobj)) != 0)
-            ERAISE(r);
+        ECHECK((old_fdops->fd_dup)(old->device, old->object, &newobj));
 
         if (set_cloexec && flags == O_CLOEXEC)
             (*old_fdops->fd_fcntl)(old_fdops, newobj, F_SETFD, FD_CLOEXEC);
 
+        myst_seqcount_write_begin(&fdtable->seq);
         new->type = old->type;
         new->device = old->device;
         new->object = newobj;
+        myst_seqcount_write_end(&fdtable->seq);
+        _mark(fdtable, newfd, true);
+        _mark_cloexec(fdtable, newfd, set_cloexec && flags == O_CLOEXEC);
 
         ret = newfd;
     }
@@ -355,29 +651,391 @@ int myst_fdtable_dup(
 done:
 
     if (locked)
-        myst_spin_unlock(&fdtable->lock);
+        myst_ticket_unlock(&fdtable->lock);
+
+    /* if new entry was not empty, close the descriptor */
+    if (ret >= 0 && prev.type != MYST_FDTABLE_TYPE_NONE)
+    {
+        if (prev.type == MYST_FDTABLE_TYPE_FILE)
+        {
+            myst_remove_fd_link(newfd);
+        }
+
+        myst_fdtable_retire(fdtable, prev.device, prev.object);
+    }
+
+    return ret;
+}
+
+/* Make the chunk of fd writable; closes the copy of the object behind fd if
+ * that made one (the caller handles the object it looked up before) */
+static int _own_entry(
+    myst_fdtable_t* fdtable,
+    int fd,
+    myst_fdtable_entry_t** entry_out)
+{
+    int ret = 0;
+    myst_fdtable_entry_t* entry = _entry(fdtable, fd);
+    const myst_fdtable_entry_t prev = *entry;
+    myst_fdtable_chunk_t* chunk;
+
+    ECHECK(_writable_chunk(fdtable, fd / MYST_FDTABLE_SIZE, &chunk));
+    entry = &chunk->entries[fd % MYST_FDTABLE_SIZE];
 
+    if (entry->object != prev.object)
+    {
+        myst_fdops_t* fdops = entry->device;
+        (*fdops->fd_close)(fdops, entry->object);
+    }
+
+    *entry_out = entry;
+
+done:
     return ret;
 }
 
 int myst_fdtable_remove(myst_fdtable_t* fdtable, int fd)
 {
     int ret = 0;
+    bool locked = false;
+    myst_fdtable_entry_t* entry;
+
+    if (!fdtable)
+        ERAISE(-EINVAL);
+
+    if (!myst_valid_fd(fd))
+        ERAISE(-EINVAL);
+
+    myst_ticket_lock(&fdtable->lock);
+    locked = true;
+
+    /* already removed (such as by a concurrent close) */
+    if (!(entry = _entry(fdtable, fd)) || entry->type == MYST_FDTABLE_TYPE_NONE)
+        ERAISE_QUIET(-EBADF);
+
+    ECHECK(_own_entry(fdtable, fd, &entry));
+    _clear(fdtable, fd);
+
+done:
+
+    if (locked)
+        myst_ticket_unlock(&fdtable->lock);
+
+    return ret;
+}
+
+int myst_fdtable_replace(
+    myst_fdtable_t* fdtable,
+    int fd,
+    void* old_object,
+    myst_fdtable_type_t type,
+    void* device,
+    void* object)
+{
+    int ret = 0;
+    bool locked = false;
+    myst_fdtable_entry_t* entry;
+
+    if (!fdtable || !object)
+        ERAISE(-EINVAL);
+
+    if (!myst_valid_fd(fd))
+        ERAISE(-EBADF);
+
+    myst_ticket_lock(&fdtable->lock);
+    locked = true;
+
+    /* closed or reassigned in the meantime */
+    if (!(entry = _entry(fdtable, fd)) || entry->object != old_object)
+        ERAISE(-EBADF);
+
+    ECHECK(_own_entry(fdtable, fd, &entry));
+
+    myst_seqcount_write_begin(&fdtable->seq);
+    entry->type = type;
+    entry->device = device;
+    entry->object = object;
+    myst_seqcount_write_end(&fdtable->seq);
+    _mark_cloexec(fdtable, fd, _object_cloexec(device, object));
+
+done:
+
+    if (locked)
+        myst_ticket_unlock(&fdtable->lock);
+
+    return ret;
+}
+
+int myst_fdtable_unshare(myst_fdtable_t* fdtable, int fd)
+{
+    int ret = 0;
+    myst_fdtable_chunk_t* chunk;
 
     if (!fdtable)
         ERAISE(-EINVAL);
 
-    if (fd < 0 || fd >= MYST_FDTABLE_SIZE)
+    if (!myst_valid_fd(fd))
+        ERAISE(-EBADF);
+
+    myst_ticket_lock(&fdtable->lock);
+
+    if (fdtable->chunks[fd / MYST_FDTABLE_SIZE])
+        ret = _writable_chunk(fdtable, fd / MYST_FDTABLE_SIZE, &chunk);
+
+    myst_ticket_unlock(&fdtable->lock);
+
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+int myst_fdtable_set_cloexec(myst_fdtable_t* fdtable, int fd, bool cloexec)
+{
+    int ret = 0;
+    bool locked = false;
+    myst_fdtable_entry_t* entry;
+    myst_fdtable_chunk_t* chunk;
+
+    if (!fdtable)
         ERAISE(-EINVAL);
 
-    myst_spin_lock(&fdtable->lock);
-    memset(&fdtable->entries[fd], 0, sizeof(myst_fdtable_entry_t));
-    myst_spin_unlock(&fdtable->lock);
+    if (!myst_valid_fd(fd))
+        ERAISE(-EBADF);
+
+    myst_ticket_lock(&fdtable->lock);
+    locked = true;
+
+    if (!(entry = _entry(fdtable, fd)) || entry->type == MYST_FDTABLE_TYPE_NONE)
+        ERAISE(-EBADF);
+
+    ECHECK(_writable_chunk(fdtable, fd / MYST_FDTABLE_SIZE, &chunk));
+    _mark_cloexec(fdtable, fd, cloexec);
 
 done:
+
+    if (locked)
+        myst_ticket_unlock(&fdtable->lock);
+
     return ret;
 }
 
+int myst_fdtable_rlimit(
+    myst_fdtable_t* fdtable,
+    const struct rlimit* new_rlim,
+    struct rlimit* old_rlim)
+{
+    int ret = 0;
+    bool locked = false;
+    struct rlimit rlim;
+
+    if (!fdtable)
+        ERAISE(-EINVAL);
+
+    /* new_rlim and old_rlim may be the same */
+    if (new_rlim)
+        rlim = *new_rlim;
+
+    myst_ticket_lock(&fdtable->lock);
+    locked = true;
+
+    if (old_rlim)
+    {
+        old_rlim->rlim_cur = fdtable->nofile_cur;
+        old_rlim->rlim_max = fdtable->nofile_max;
+    }
+
+    if (new_rlim)
+    {
+        if (rlim.rlim_cur > rlim.rlim_max)
+            ERAISE(-EINVAL);
+
+        /* like Linux, never above nr_open (RLIM_INFINITY included) */
+        if (rlim.rlim_max > MYST_FDTABLE_MAX)
+            ERAISE(-EPERM);
+
+        fdtable->nofile_cur = rlim.rlim_cur;
+        fdtable->nofile_max = rlim.rlim_max;
+    }
+
+done:
+
+    if (locked)
+        myst_ticket_unlock(&fdtable->lock);
+
+    return ret;
+}
+
+/* Take a consistent snapshot of an entry without acquiring fdtable->lock */
+static myst_fdtable_entry_t _read_entry(myst_fdtable_t* fdtable, int fd)
+{
+    myst_fdtable_chunk_t* const* pp = &fdtable->chunks[fd / MYST_FDTABLE_SIZE];
+    const size_t i = fd % MYST_FDTABLE_SIZE;
+    myst_fdtable_entry_t entry;
+    uint32_t seq;
+
+    /* a chunk replaced by its copy stays valid for the other tables sharing
+     * it, and readers that raced with the swap retry */
+    do
+    {
+        const myst_fdtable_chunk_t* chunk;
+
+        seq = myst_seqcount_read_begin(&fdtable->seq);
+
+        if ((chunk = __atomic_load_n(pp, __ATOMIC_ACQUIRE)))
+        {
+            const volatile myst_fdtable_entry_t* p = &chunk->entries[i];
+            entry.type = p->type;
+            entry.device = p->device;
+            entry.object = p->object;
+        }
+        else
+        {
+            memset(&entry, 0, sizeof(entry));
+        }
+    } while (myst_seqcount_read_retry(&fdtable->seq, seq));
+
+    return entry;
+}
+
+/* Read an entry and publish its object as in use by this thread, retrying
+ * if it was removed meanwhile: either myst_fdtable_retire() then sees the
+ * hold, or this sees the removal */
+static myst_fdtable_entry_t _lookup(myst_fdtable_t* fdtable, int fd)
+{
+    myst_thread_t* thread = myst_thread_self();
+    const size_t slot = thread->fd_nholds % MYST_FDTABLE_HOLDS;
+    myst_fdtable_entry_t entry = _read_entry(fdtable, fd);
+
+    while (entry.object)
+    {
+        myst_fdtable_entry_t again;
+
+        thread->fd_holds[slot] = entry.object;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        again = _read_entry(fdtable, fd);
+
+        if (again.object == entry.object && again.type == entry.type)
+        {
+            thread->fd_nholds++;
+            break;
+        }
+
+        entry = again;
+    }
+
+    return entry;
+}
+
+/* Whether a thread other than self that shares the table holds object */
+static bool _held(myst_fdtable_t* fdtable, void* object, myst_thread_t* self)
+{
+    myst_thread_t* process = myst_find_process_thread(self);
+    bool found = false;
+
+    myst_spin_lock(self->thread_lock);
+
+    for (myst_thread_t* t = process; t && !found; t = t->group_next)
+    {
+        if (t == self || t->fdtable != fdtable)
+            continue;
+
+        for (size_t i = 0; i < MYST_FDTABLE_HOLDS; i++)
+        {
+            if (t->fd_holds[i] == object)
+            {
+                found = true;
+                break;
+            }
+        }
+    }
+
+    myst_spin_unlock(self->thread_lock);
+
+    return found;
+}
+
+/* Close the retired objects that no thread holds any more */
+static void _reap(myst_fdtable_t* fdtable, myst_thread_t* self)
+{
+    myst_fdtable_retired_t* list;
+
+    myst_spin_lock(&fdtable->retired_lock);
+    list = fdtable->retired;
+    fdtable->retired = NULL;
+    myst_spin_unlock(&fdtable->retired_lock);
+
+    while (list)
+    {
+        myst_fdtable_retired_t* p = list;
+        list = p->next;
+
+        if (_held(fdtable, p->object, self))
+        {
+            myst_spin_lock(&fdtable->retired_lock);
+            p->next = fdtable->retired;
+            fdtable->retired = p;
+            myst_spin_unlock(&fdtable->retired_lock);
+        }
+        else
+        {
+            (*p->fdops->fd_close)(p->fdops, p->object);
+            free(p);
+        }
+    }
+}
+
+int myst_fdtable_retire(
+    myst_fdtable_t* fdtable,
+    myst_fdops_t* fdops,
+    void* object)
+{
+    myst_thread_t* self = myst_thread_self();
+    myst_fdtable_retired_t* p;
+
+    /* order the removal from the table before looking for holds */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (!_held(fdtable, object, self))
+        return (*fdops->fd_close)(fdops, object);
+
+    /* without memory, closing at once is the lesser evil */
+    if (!(p = malloc(sizeof(myst_fdtable_retired_t))))
+        return (*fdops->fd_close)(fdops, object);
+
+    p->fdops = fdops;
+    p->object = object;
+
+    myst_spin_lock(&fdtable->retired_lock);
+    p->next = fdtable->retired;
+    fdtable->retired = p;
+    myst_spin_unlock(&fdtable->retired_lock);
+
+    /* the holder may have returned before seeing the retired object */
+    _reap(fdtable, self);
+
+    return 0;
+}
+
+void myst_fdtable_drop_holds(myst_thread_t* thread)
+{
+    myst_fdtable_t* fdtable = thread->fdtable;
+
+    if (!thread->fd_nholds)
+        return;
+
+    for (size_t i = 0; i < MYST_FDTABLE_HOLDS; i++)
+        thread->fd_holds[i] = NULL;
+
+    thread->fd_nholds = 0;
+
+    /* order dropping the holds before looking at the retired objects */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (fdtable && __atomic_load_n(&fdtable->retired, __ATOMIC_ACQUIRE))
+        _reap(fdtable, thread);
+}
+
 int myst_fdtable_get(
     myst_fdtable_t* fdtable,
     int fd,
@@ -390,26 +1048,21 @@ int myst_fdtable_get(
     if (!fdtable || !device || !object)
         ERAISE(-EINVAL);
 
-    if (!(fd >= 0 && fd < MYST_FDTABLE_SIZE))
+    if (!myst_valid_fd(fd))
         ERAISE(-EINVAL);
 
     if (type == MYST_FDTABLE_TYPE_NONE)
         ERAISE(-EINVAL);
 
-    myst_spin_lock(&fdtable->lock);
     {
-        myst_fdtable_entry_t* entry = &fdtable->entries[fd];
+        const myst_fdtable_entry_t entry = _lookup(fdtable, fd);
 
-        if (entry->type != type || !(entry->object && entry->device))
-        {
-            myst_spin_unlock(&fdtable->lock);
+        if (entry.type != type || !(entry.object && entry.device))
             ERAISE(-EBADF);
-        }
 
-        *device = entry->device;
-        *object = entry->object;
+        *device = entry.device;
+        *object = entry.object;
     }
-    myst_spin_unlock(&fdtable->lock);
 
 done:
 
@@ -431,24 +1084,19 @@ int myst_fdtable_get_any(
     if (!fdtable || !type || !device || !object)
         ERAISE(-EINVAL);
 
-    if (!(fd >= 0 && fd < MYST_FDTABLE_SIZE))
+    if (!myst_valid_fd(fd))
         ERAISE(-EBADF);
 
-    myst_spin_lock(&fdtable->lock);
     {
-        myst_fdtable_entry_t* entry = &fdtable->entries[fd];
+        const myst_fdtable_entry_t entry = _lookup(fdtable, fd);
 
-        if (entry->type == MYST_FDTABLE_TYPE_NONE)
-        {
-            myst_spin_unlock(&fdtable->lock);
+        if (entry.type == MYST_FDTABLE_TYPE_NONE)
             ERAISE(-ENOENT);
-        }
 
-        *type = entry->type;
-        *device = entry->device;
-        *object = entry->object;
+        *type = entry.type;
+        *device = entry.device;
+        *object = entry.object;
     }
-    myst_spin_unlock(&fdtable->lock);
 
 done:
 
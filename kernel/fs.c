@@ -2,15 +2,21 @@
 // Licensed under the MIT License.
 
 #include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include <myst/attest.h>
 #include <myst/blkdev.h>
+#include <myst/blockdevice.h>
 #include <myst/eraise.h>
 #include <myst/ext2.h>
 #include <myst/fs.h>
 #include <myst/fssig.h>
+#include <myst/gcm.h>
 #include <myst/hex.h>
 #include <myst/kernel.h>
 #include <myst/mount.h>
+#include <myst/printf.h>
 #include <myst/process.h>
 #include <myst/pubkey.h>
 #include <myst/roothash.h>
@@ -52,6 +58,242 @@ done:
 }
 
 #ifdef MYST_ENABLE_EXT2FS
+/*
+** The hash nodes that the verity device of the rootfs has verified outlive
+** the enclave when --verity-node-cache <file> is given: on exit, they are
+** sealed to the enclave (OE_SEAL_POLICY_UNIQUE) and written to the file,
+** and the next boot takes them as verified rather than reading and hashing
+** them again. The file is laid out as:
+**
+**     [header][key info][image of the nodes (encrypted)][tag]
+**
+** padded to whole blocks. The tag covers the image and (as AAD) the root
+** hash, so the file of another image or another enclave is ignored, as is
+** any file that cannot be read or opened.
+*/
+
+#define VERITY_NODES_FILE_MAGIC 0x454843414359524cUL
+
+/* the largest key info and image of nodes taken */
+#define VERITY_NODES_MAX_KEY_INFO_SIZE 4096
+#define VERITY_NODES_MAX_IMAGE_SIZE (16 * 1024 * 1024)
+
+/* the blocks moved by one read or write of the file */
+#define VERITY_NODES_CHUNK_BLOCKS 2048
+
+/* OE_SEAL_POLICY_UNIQUE */
+#define VERITY_NODES_SEAL_POLICY 1
+
+typedef struct verity_nodes_file_header
+{
+    uint64_t magic;
+    uint64_t image_size;
+    uint64_t key_info_size;
+    uint8_t iv[MYST_GCM_IV_SIZE];
+    uint8_t reserved[4];
+} verity_nodes_file_header_t;
+
+/* the verity device of the rootfs (if its nodes are to be saved) */
+static myst_blkdev_t* _verity;
+static myst_sha256_t _verity_roothash;
+
+static int _transfer_verity_nodes(
+    int fd,
+    myst_block_t* blocks,
+    size_t nblocks,
+    bool write)
+{
+    int ret = 0;
+
+    for (size_t i = 0; i < nblocks; i += VERITY_NODES_CHUNK_BLOCKS)
+    {
+        size_t n = nblocks - i;
+
+        if (n > VERITY_NODES_CHUNK_BLOCKS)
+            n = VERITY_NODES_CHUNK_BLOCKS;
+
+        if (write)
+            ECHECK_QUIET(myst_write_block_device(fd, i, blocks + i, n));
+        else
+            ECHECK_QUIET(myst_read_block_device(fd, i, blocks + i, n));
+    }
+
+done:
+    return ret;
+}
+
+static void _init_verity_nodes_auth(
+    myst_gcm_auth_t* auth,
+    const verity_nodes_file_header_t* header,
+    const myst_sha256_t* roothash)
+{
+    memset(auth, 0, sizeof(myst_gcm_auth_t));
+    memcpy(auth->iv, header->iv, sizeof(auth->iv));
+    memcpy(auth->aad, roothash->data, sizeof(auth->aad));
+    auth->aad_size = sizeof(auth->aad);
+}
+
+static size_t _verity_nodes_file_blocks(const verity_nodes_file_header_t* h)
+{
+    const size_t size = sizeof(verity_nodes_file_header_t) + h->key_info_size +
+                        h->image_size + MYST_GCM_TAG_SIZE;
+
+    return (size + sizeof(myst_block_t) - 1) / sizeof(myst_block_t);
+}
+
+/* Take the nodes of the --verity-node-cache file as verified */
+static int _load_verity_nodes(
+    myst_blkdev_t* verity,
+    const myst_sha256_t* roothash)
+{
+    int ret = 0;
+    const char* path = __myst_kernel_args.verity_node_cache;
+    int fd = -1;
+    myst_block_t first;
+    verity_nodes_file_header_t header;
+    myst_block_t* blocks = NULL;
+    size_t nblocks;
+    uint8_t* key = NULL;
+    size_t key_size;
+    myst_gcm_t* gcm = NULL;
+    myst_gcm_auth_t auth;
+    uint8_t* image;
+
+    ECHECK_QUIET((fd = myst_open_block_device(path, true)));
+
+    /* an empty file (such as the one the host creates) fails here */
+    ECHECK_QUIET(myst_read_block_device(fd, 0, &first, 1));
+    memcpy(&header, first.data, sizeof(header));
+
+    if (header.magic != VERITY_NODES_FILE_MAGIC ||
+        header.key_info_size > VERITY_NODES_MAX_KEY_INFO_SIZE ||
+        header.image_size > VERITY_NODES_MAX_IMAGE_SIZE)
+    {
+        ERAISE_QUIET(-EINVAL);
+    }
+
+    nblocks = _verity_nodes_file_blocks(&header);
+
+    if (!(blocks = malloc(nblocks * sizeof(myst_block_t))))
+        ERAISE_QUIET(-ENOMEM);
+
+    ECHECK_QUIET(_transfer_verity_nodes(fd, blocks, nblocks, false));
+
+    /* get the key that sealed the file (which fails in another enclave) */
+    ECHECK_QUIET(myst_attest_get_seal_key(
+        (uint8_t*)blocks + sizeof(header),
+        header.key_info_size,
+        &key,
+        &key_size));
+
+    ECHECK_QUIET(myst_gcm_new(key, key_size, &gcm));
+
+    image = (uint8_t*)blocks + sizeof(header) + header.key_info_size;
+    _init_verity_nodes_auth(&auth, &header, roothash);
+    ECHECK_QUIET(myst_gcm_open(gcm, &auth, image, image, header.image_size));
+
+    ECHECK_QUIET(
+        myst_verityblkdev_import_nodes(verity, image, header.image_size));
+
+done:
+
+    if (fd >= 0)
+        myst_close_block_device(fd);
+
+    if (gcm)
+        myst_gcm_free(gcm);
+
+    if (key)
+        myst_attest_free_seal_key(key, NULL);
+
+    free(blocks);
+
+    return ret;
+}
+
+static int _save_verity_nodes(void)
+{
+    int ret = 0;
+    const char* path = __myst_kernel_args.verity_node_cache;
+    void* data = NULL;
+    size_t size;
+    uint8_t* key = NULL;
+    size_t key_size;
+    uint8_t* key_info = NULL;
+    size_t key_info_size;
+    verity_nodes_file_header_t header;
+    myst_block_t* blocks = NULL;
+    size_t nblocks;
+    myst_gcm_t* gcm = NULL;
+    myst_gcm_auth_t auth;
+    struct iovec iov;
+    uint8_t* image;
+    int fd = -1;
+
+    ECHECK_QUIET(myst_verityblkdev_export_nodes(_verity, &data, &size));
+
+    ECHECK_QUIET(myst_attest_get_seal_key_by_policy(
+        VERITY_NODES_SEAL_POLICY,
+        &key,
+        &key_size,
+        &key_info,
+        &key_info_size));
+
+    if (key_info_size > VERITY_NODES_MAX_KEY_INFO_SIZE ||
+        size > VERITY_NODES_MAX_IMAGE_SIZE)
+    {
+        ERAISE_QUIET(-EFBIG);
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = VERITY_NODES_FILE_MAGIC;
+    header.image_size = size;
+    header.key_info_size = key_info_size;
+    ECHECK_QUIET(myst_tcall_random(header.iv, sizeof(header.iv)));
+
+    nblocks = _verity_nodes_file_blocks(&header);
+
+    if (!(blocks = calloc(nblocks, sizeof(myst_block_t))))
+        ERAISE_QUIET(-ENOMEM);
+
+    memcpy(blocks, &header, sizeof(header));
+    memcpy((uint8_t*)blocks + sizeof(header), key_info, key_info_size);
+    image = (uint8_t*)blocks + sizeof(header) + key_info_size;
+
+    ECHECK_QUIET(myst_gcm_new(key, key_size, &gcm));
+    _init_verity_nodes_auth(&auth, &header, &_verity_roothash);
+    iov.iov_base = data;
+    iov.iov_len = size;
+    ECHECK_QUIET(myst_gcm_seal(gcm, &auth, &iov, 1, image));
+
+    ECHECK_QUIET((fd = myst_open_block_device(path, false)));
+    ECHECK_QUIET(_transfer_verity_nodes(fd, blocks, nblocks, true));
+
+done:
+
+    if (fd >= 0)
+        myst_close_block_device(fd);
+
+    if (gcm)
+        myst_gcm_free(gcm);
+
+    if (key)
+        myst_attest_free_seal_key(key, key_info);
+
+    free(blocks);
+    free(data);
+
+    return ret;
+}
+
+void myst_save_verity_nodes(void)
+{
+    if (_verity && _save_verity_nodes() != 0)
+        myst_eprintf("kernel: failed to save the verity node cache\n");
+
+    _verity = NULL;
+}
+
 int myst_load_fs(
     myst_mount_resolve_callback_t resolve_cb,
     const char* source,
@@ -62,6 +304,7 @@ int myst_load_fs(
     myst_blkdev_t* blkdev = NULL;
     myst_fs_t* fs = NULL;
     myst_fssig_t fssig;
+    myst_blkdev_t* verity = NULL;
     int r;
 
     if (fs_out)
@@ -104,12 +347,33 @@ int myst_load_fs(
             fssig.hash_offset,
             fssig.root_hash,
             sizeof(myst_sha256_t),
+            __myst_kernel_args.verity_cache_blocks,
+            __myst_kernel_args.verity_prefetch_blocks,
             &blkdev));
+
+        /* warm the hash nodes of the rootfs (see --verity-node-cache) */
+        if (!_verity && *__myst_kernel_args.verity_node_cache &&
+            strcmp(source, __myst_kernel_args.rootfs) == 0)
+        {
+            memcpy(&_verity_roothash, fssig.root_hash, sizeof(myst_sha256_t));
+            _load_verity_nodes(blkdev, &_verity_roothash);
+            verity = blkdev;
+        }
     }
     else
     {
-        const bool ephemeral = true;
-        ECHECK(myst_rawblkdev_open(source, ephemeral, 0, &blkdev));
+        const bool read_only = true;
+        ECHECK(myst_rawblkdev_open(source, read_only, 0, &blkdev));
+    }
+
+    /* decompress on demand if the image is compressed (the bottom device
+     * verifies the compressed bytes) */
+    if (myst_zblkdev_check_header(blkdev) == 0)
+    {
+        myst_blkdev_t* tmp;
+
+        ECHECK(myst_zblkdev_open(blkdev, 0, &tmp));
+        blkdev = tmp;
     }
 
     if (key)
@@ -125,9 +389,21 @@ int myst_load_fs(
         blkdev = tmp;
     }
 
+    /* the image is never written: keep the blocks written in memory */
+    {
+        myst_blkdev_t* tmp;
+
+        ECHECK(myst_cowblkdev_open(blkdev, &tmp));
+        blkdev = tmp;
+    }
+
     ECHECK(ext2_create(blkdev, &fs, resolve_cb));
     blkdev = NULL;
 
+    /* the file system owns the device stack, which lives until exit */
+    if (verity)
+        _verity = verity;
+
     *fs_out = fs;
     fs = NULL;
 
@@ -10,6 +10,19 @@
 #include <myst/syscall.h>
 #include <myst/tcall.h>
 
+#if defined(MYST_KERNEL_TARGET_SGX)
+
+void myst_set_gsbase(void* p)
+{
+    (void)p;
+
+    /* unsupported but not needed */
+    myst_panic("wrgsbase emulation is unsupported");
+}
+
+#elif !defined(MYST_KERNEL_TARGET_LINUX)
+
+/* the generic kernel (the kernels built for one target inline these) */
 void myst_set_fsbase(void* p)
 {
     if (__options.have_syscall_instruction)
@@ -74,3 +87,5 @@ void* myst_get_gsbase(void)
         return p;
     }
 }
+
+#endif
@@ -6,9 +6,15 @@
 
 #include <myst/atexit.h>
 #include <myst/cond.h>
+#include <myst/counters.h>
 #include <myst/eraise.h>
+#include <myst/eventtrace.h>
 #include <myst/futex.h>
+#include <myst/kernel.h>
+#include <myst/once.h>
+#include <myst/slab.h>
 #include <myst/strings.h>
+#include <myst/syscall.h>
 #include <myst/thread.h>
 
 /*
@@ -19,7 +25,10 @@
 **==============================================================================
 */
 
-#define NUM_CHAINS 64
+/* The bucket count scales with the maximum number of threads */
+#define MIN_BUCKETS 64
+#define MAX_BUCKETS 8192
+#define BUCKETS_PER_THREAD 4
 
 #if 0
 #define DEBUG_TRACE
@@ -36,61 +45,79 @@ struct futex
     myst_mutex_t mutex;
 };
 
-static futex_t* _chains[NUM_CHAINS];
-static bool _installed_free_futexes;
+static myst_slab_cache_t _futex_cache =
+    MYST_SLAB_CACHE_INIT("futex_t", futex_t);
 
-#if 1
-static myst_spinlock_t _spin = MYST_SPINLOCK_INITIALIZER;
-static void _lock(void)
+typedef struct bucket
 {
-    myst_spin_lock(&_spin);
-}
-static void _unlock(void)
-{
-    myst_spin_unlock(&_spin);
-}
-#else
-static myst_mutex_t _mutex;
-static void _lock(void)
-{
-    myst_mutex_lock(&_mutex);
-}
-static void _unlock(void)
-{
-    myst_mutex_unlock(&_mutex);
-}
-#endif
+    myst_spinlock_t lock;
+    futex_t* chain;
+} bucket_t;
+
+static bucket_t* _buckets;
+static size_t _num_buckets; /* a power of two */
+static myst_once_t _buckets_once;
 
 static void _free_futexes(void* arg)
 {
     (void)arg;
 
-    for (size_t i = 0; i < NUM_CHAINS; i++)
+    for (size_t i = 0; i < _num_buckets; i++)
     {
-        for (futex_t* p = _chains[i]; p;)
+        for (futex_t* p = _buckets[i].chain; p;)
         {
             futex_t* next = p->next;
-            free(p);
+            myst_slab_free(p);
             p = next;
         }
     }
+
+    free(_buckets);
+    _buckets = NULL;
+    _num_buckets = 0;
+}
+
+static void _init_buckets(void)
+{
+    size_t n = MIN_BUCKETS;
+
+    while (n < MAX_BUCKETS &&
+           n < __myst_kernel_args.max_threads * BUCKETS_PER_THREAD)
+    {
+        n *= 2;
+    }
+
+    if (!(_buckets = calloc(n, sizeof(bucket_t))))
+        return;
+
+    _num_buckets = n;
+    myst_atexit(_free_futexes, NULL);
+}
+
+static bucket_t* _get_bucket(volatile int* uaddr)
+{
+    uint64_t h = ((uint64_t)uaddr >> 2) * 0x9e3779b97f4a7c15;
+
+    myst_once(&_buckets_once, _init_buckets);
+
+    if (!_buckets)
+        return NULL;
+
+    return &_buckets[(h >> 32) & (_num_buckets - 1)];
 }
 
 static futex_t* _get_futex(volatile int* uaddr)
 {
     futex_t* ret = NULL;
-    uint64_t index = ((uint64_t)uaddr >> 4) % NUM_CHAINS;
+    bucket_t* bucket;
     futex_t* f;
 
-    _lock();
+    if (!(bucket = _get_bucket(uaddr)))
+        return NULL;
 
-    if (!_installed_free_futexes)
-    {
-        myst_atexit(_free_futexes, NULL);
-        _installed_free_futexes = true;
-    }
+    myst_spin_lock(&bucket->lock);
 
-    for (futex_t* p = _chains[index]; p; p = p->next)
+    for (futex_t* p = bucket->chain; p; p = p->next)
     {
         if (p->uaddr == uaddr)
         {
@@ -100,66 +127,56 @@ static futex_t* _get_futex(volatile int* uaddr)
         }
     }
 
-    if (!(f = calloc(1, sizeof(futex_t))))
+    if (!(f = myst_slab_alloc(&_futex_cache)))
         goto done;
 
     f->refs = 1;
     f->uaddr = uaddr;
-    f->next = _chains[index];
-    _chains[index] = f;
+    f->next = bucket->chain;
+    bucket->chain = f;
 
     ret = f;
 
 done:
 
-    _unlock();
+    myst_spin_unlock(&bucket->lock);
 
     return ret;
 }
 
-static int _put_futex(int* uaddr)
+static void _put_futex(futex_t* f)
 {
-#if 0
-    int ret = -1;
-    uint64_t index = ((uint64_t)uaddr >> 2) % NUM_CHAINS;
-    futex_t* prev = NULL;
+    bucket_t* bucket = _get_bucket(f->uaddr);
+    bool release = false;
 
-    myst_spin_lock(&_lock);
+    myst_spin_lock(&bucket->lock);
 
-    for (futex_t* p = _chains[index]; p; p = p->next)
+    /* Threads may linger on the queue after a timeout or a requeue, so only
+     * release the futex once no thread references it or waits on it */
+    if (--f->refs == 0 && myst_thread_queue_empty(&f->cond.queue))
     {
-        if (p->uaddr == uaddr)
+        for (futex_t** p = &bucket->chain; *p; p = &(*p)->next)
         {
-            p->refs--;
-
-            if (p->refs == 0)
+            if (*p == f)
             {
-                if (prev)
-                    prev->next = p->next;
-                else
-                    _chains[index] = p->next;
-
-                free(p);
+                *p = f->next;
+                release = true;
+                break;
             }
-
-            ret = 0;
-            goto done;
         }
-
-        prev = p;
     }
 
-done:
-    myst_spin_unlock(&_lock);
+    myst_spin_unlock(&bucket->lock);
 
-    return ret;
-#else
-    (void)uaddr;
-    return 0;
-#endif
+    if (release)
+        myst_slab_free(f);
 }
 
-int myst_futex_wait(int* uaddr, int val, const struct timespec* to)
+static int _futex_wait(
+    int* uaddr,
+    int val,
+    const struct timespec* to,
+    uint32_t bitset)
 {
     int ret = 0;
     futex_t* f = NULL;
@@ -169,7 +186,7 @@ int myst_futex_wait(int* uaddr, int val, const struct timespec* to)
     printf("%s(): uaddr=%p\n", __FUNCTION__, uaddr);
 #endif
 
-    if (!uaddr)
+    if (!uaddr || !bitset)
     {
         ret = -EINVAL;
         goto done;
@@ -192,8 +209,16 @@ int myst_futex_wait(int* uaddr, int val, const struct timespec* to)
             goto done;
         }
 
+        myst_counter_inc(MYST_COUNTER_FUTEX_WAITS);
+        myst_event(
+            MYST_EVENT_FUTEX,
+            MYST_EVENT_FUTEX_WAIT,
+            (uint64_t)uaddr,
+            (uint64_t)val);
+
         // Give termination signal handler a chance to wake up the thread.
         me->signal.cond_wait = &f->cond;
+        me->signal.futex_bitset = bitset;
 
         retval = myst_cond_timedwait(&f->cond, &f->mutex, to);
 
@@ -201,18 +226,25 @@ int myst_futex_wait(int* uaddr, int val, const struct timespec* to)
 
         if (retval != 0)
             ret = -retval;
+
+        myst_event(
+            MYST_EVENT_FUTEX,
+            MYST_EVENT_FUTEX_WOKE,
+            (uint64_t)uaddr,
+            (uint64_t)ret);
     }
     myst_mutex_unlock(&f->mutex);
 
 done:
 
     if (f)
-        _put_futex(uaddr);
+        _put_futex(f);
 
     return ret;
 }
 
-int myst_futex_wake(int* uaddr, int val)
+/* Returns the number of woken waiters */
+static int _futex_wake(int* uaddr, int val, uint32_t bitset)
 {
     int ret = 0;
     futex_t* f = NULL;
@@ -222,12 +254,18 @@ int myst_futex_wake(int* uaddr, int val)
     printf("%s(): uaddr=%p\n", __FUNCTION__, uaddr);
 #endif
 
-    if (!uaddr)
+    if (!uaddr || !bitset)
     {
         ret = -EINVAL;
         goto done;
     }
 
+    if (val <= 0)
+    {
+        ret = -ENOSYS;
+        goto done;
+    }
+
     if (!(f = _get_futex(uaddr)))
     {
         ret = -ENOMEM;
@@ -238,37 +276,196 @@ int myst_futex_wake(int* uaddr, int val)
     locked = true;
     myst_assume(f->mutex.owner == myst_thread_self());
 
-    if (val == 1)
+    /* Wake only the waiters whose bitset intersects BITSET */
     {
-        if (myst_cond_signal(&f->cond) != 0)
+        size_t n = (val == INT_MAX) ? SIZE_MAX : (size_t)val;
+        ret = (int)myst_cond_wake_bitset(&f->cond, n, bitset);
+    }
+
+    myst_counter_inc(MYST_COUNTER_FUTEX_WAKES);
+    myst_counter_add(MYST_COUNTER_FUTEX_WOKEN, (uint64_t)ret);
+    myst_event(
+        MYST_EVENT_FUTEX,
+        MYST_EVENT_FUTEX_WAKE,
+        (uint64_t)uaddr,
+        (uint64_t)ret);
+
+done:
+
+    if (locked)
+        myst_mutex_unlock(&f->mutex);
+
+    if (f)
+        _put_futex(f);
+
+    return ret;
+}
+
+int myst_futex_wait(int* uaddr, int val, const struct timespec* to)
+{
+    return _futex_wait(uaddr, val, to, FUTEX_BITSET_MATCH_ANY);
+}
+
+int myst_futex_wake(int* uaddr, int val)
+{
+    return _futex_wake(uaddr, val, FUTEX_BITSET_MATCH_ANY);
+}
+
+/* Convert the absolute FUTEX_WAIT_BITSET timeout to a relative timeout */
+static int _relative_timeout(
+    int op,
+    const struct timespec* abs,
+    struct timespec* rel)
+{
+    clockid_t clk = (op & FUTEX_CLOCK_REALTIME) ? CLOCK_REALTIME
+                                                 : CLOCK_MONOTONIC;
+    struct timespec now;
+    long sec;
+    long nsec;
+
+    if (abs->tv_nsec < 0 || abs->tv_nsec >= 1000000000)
+        return -EINVAL;
+
+    if (myst_syscall_clock_gettime(clk, &now) != 0)
+        return -EINVAL;
+
+    sec = abs->tv_sec - now.tv_sec;
+    nsec = abs->tv_nsec - now.tv_nsec;
+
+    if (nsec < 0)
+    {
+        sec--;
+        nsec += 1000000000;
+    }
+
+    if (sec < 0)
+        return -ETIMEDOUT;
+
+    rel->tv_sec = sec;
+    rel->tv_nsec = nsec;
+    return 0;
+}
+
+/* Apply the FUTEX_WAKE_OP operation to *uaddr and return the old value */
+static int _futex_atomic_op(int* uaddr, int encoded, int* old_out)
+{
+    int op = (encoded >> 28) & 0xf;
+    int oparg = (int)((uint32_t)encoded << 8) >> 20;
+    int old = __atomic_load_n(uaddr, __ATOMIC_RELAXED);
+    int new;
+
+    if (op & FUTEX_OP_OPARG_SHIFT)
+    {
+        if (oparg < 0 || oparg > 31)
+            return -EINVAL;
+
+        op &= ~FUTEX_OP_OPARG_SHIFT;
+        oparg = 1 << oparg;
+    }
+
+    do
+    {
+        switch (op)
         {
-            ret = -ENOSYS;
-            goto done;
+            case FUTEX_OP_SET:
+                new = oparg;
+                break;
+            case FUTEX_OP_ADD:
+                new = (int)((uint32_t)old + (uint32_t)oparg);
+                break;
+            case FUTEX_OP_OR:
+                new = old | oparg;
+                break;
+            case FUTEX_OP_ANDN:
+                new = old & ~oparg;
+                break;
+            case FUTEX_OP_XOR:
+                new = old ^ oparg;
+                break;
+            default:
+                return -ENOSYS;
         }
+    } while (!__atomic_compare_exchange_n(
+        uaddr, &old, new, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    *old_out = old;
+    return 0;
+}
+
+static int _futex_cmp(int encoded, int old, bool* result)
+{
+    int cmp = (encoded >> 24) & 0xf;
+    int cmparg = (int)((uint32_t)encoded << 20) >> 20;
+
+    switch (cmp)
+    {
+        case FUTEX_OP_CMP_EQ:
+            *result = (old == cmparg);
+            return 0;
+        case FUTEX_OP_CMP_NE:
+            *result = (old != cmparg);
+            return 0;
+        case FUTEX_OP_CMP_LT:
+            *result = (old < cmparg);
+            return 0;
+        case FUTEX_OP_CMP_LE:
+            *result = (old <= cmparg);
+            return 0;
+        case FUTEX_OP_CMP_GT:
+            *result = (old > cmparg);
+            return 0;
+        case FUTEX_OP_CMP_GE:
+            *result = (old >= cmparg);
+            return 0;
+        default:
+            return -ENOSYS;
     }
-    else if (val > 1)
+}
+
+static int _futex_wake_op(int* uaddr, int val, int val2, int* uaddr2, int val3)
+{
+    int ret = 0;
+    futex_t* f2 = NULL;
+    int old;
+    bool wake2 = false;
+    int n;
+
+    if (!uaddr || !uaddr2 || val < 0 || val2 < 0)
+        ERAISE(-EINVAL);
+
+    if (!(f2 = _get_futex(uaddr2)))
+        ERAISE(-ENOMEM);
+
+    /* Serialize with waiters checking *uaddr2 before they queue up */
+    myst_mutex_lock(&f2->mutex);
     {
-        size_t n = (val == INT_MAX) ? SIZE_MAX : (size_t)val;
+        int r;
 
-        if (myst_cond_broadcast(&f->cond, n) != 0)
+        if ((r = _futex_atomic_op(uaddr2, val3, &old)) == 0)
         {
-            ret = -ENOSYS;
-            goto done;
+            if ((r = _futex_cmp(val3, old, &wake2)) == 0 && wake2 && val2)
+                ret += (int)myst_cond_wake_bitset(
+                    &f2->cond, (size_t)val2, FUTEX_BITSET_MATCH_ANY);
+        }
+
+        if (r != 0)
+        {
+            myst_mutex_unlock(&f2->mutex);
+            ERAISE(r);
         }
     }
-    else
+    myst_mutex_unlock(&f2->mutex);
+
+    if (val)
     {
-        ret = -ENOSYS;
-        goto done;
+        ECHECK(n = _futex_wake(uaddr, val, FUTEX_BITSET_MATCH_ANY));
+        ret += n;
     }
 
 done:
 
-    if (locked)
-        myst_mutex_unlock(&f->mutex);
-
-    if (f)
-        _put_futex(uaddr);
+    if (f2)
+        _put_futex(f2);
 
     return ret;
 }
@@ -337,10 +534,10 @@ done:
         myst_mutex_unlock(&f2->mutex);
 
     if (f)
-        _put_futex(uaddr);
+        _put_futex(f);
 
     if (f2)
-        _put_futex(uaddr2);
+        _put_futex(f2);
 
     return ret;
 }
@@ -362,8 +559,7 @@ long myst_syscall_futex(
     int val3)
 {
     long ret = 0;
-
-    (void)val3;
+    const int clock_op = op & ~(FUTEX_PRIVATE | FUTEX_CLOCK_REALTIME);
 
     if (op == FUTEX_WAIT || op == (FUTEX_WAIT | FUTEX_PRIVATE))
     {
@@ -371,7 +567,25 @@ long myst_syscall_futex(
     }
     else if (op == FUTEX_WAKE || op == (FUTEX_WAKE | FUTEX_PRIVATE))
     {
-        ECHECK(myst_futex_wake(uaddr, val));
+        ECHECK(ret = myst_futex_wake(uaddr, val));
+    }
+    else if (clock_op == FUTEX_WAIT_BITSET)
+    {
+        const struct timespec* abs = (const struct timespec*)arg;
+        struct timespec rel;
+
+        if (abs)
+            ECHECK(_relative_timeout(op, abs, &rel));
+
+        ECHECK(_futex_wait(uaddr, val, abs ? &rel : NULL, (uint32_t)val3));
+    }
+    else if ((op & ~FUTEX_PRIVATE) == FUTEX_WAKE_BITSET)
+    {
+        ECHECK(ret = _futex_wake(uaddr, val, (uint32_t)val3));
+    }
+    else if ((op & ~FUTEX_PRIVATE) == FUTEX_WAKE_OP)
+    {
+        ECHECK(ret = _futex_wake_op(uaddr, val, (int)arg, uaddr2, val3));
     }
     else if (op == FUTEX_REQUEUE || op == (FUTEX_REQUEUE | FUTEX_PRIVATE))
     {
@@ -0,0 +1,140 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdint.h>
+#include <syscall.h>
+
+#include <myst/cond.h>
+#include <myst/eraise.h>
+#include <myst/hostclose.h>
+#include <myst/kernel.h>
+#include <myst/mutex.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+#include <myst/time.h>
+
+/*
+**==============================================================================
+**
+** Deferred close of host fds (started by the --async-close option).
+**
+**     Closing a host socket or a hostfs file costs the caller an OCALL,
+**     which short-lived connections pay once per request. With the option,
+**     myst_host_close() queues the fd for the closer thread and returns at
+**     once. The host fd stays open (so the host cannot reuse its number)
+**     until the closer thread closes it; nothing in the enclave refers to
+**     it by then, since its socket or file was already released.
+**
+**     A full queue, like a stopped closer, falls back to closing on the
+**     caller. Errors of a deferred close are dropped, as for close() on
+**     Linux the fd is released whatever close() returns.
+**
+**==============================================================================
+*/
+
+static myst_mutex_t _lock;
+static myst_cond_t _cond; /* signaled when an fd is queued */
+static int _fds[MYST_HOST_CLOSE_QUEUE_SIZE];
+static size_t _head; /* the index of the oldest queued fd */
+static size_t _count;
+static bool _running;
+static bool _stopping;
+static _Atomic(bool) _exited;
+
+static long _close(int fd)
+{
+    long params[6] = {fd};
+    return myst_tcall(SYS_close, params);
+}
+
+static int _closer(void* arg)
+{
+    (void)arg;
+
+    myst_mutex_lock(&_lock);
+
+    for (;;)
+    {
+        int fd;
+
+        while (!_count && !_stopping)
+            myst_cond_wait(&_cond, &_lock);
+
+        /* the queue is drained before the closer stops */
+        if (!_count)
+            break;
+
+        fd = _fds[_head];
+        _head = (_head + 1) % MYST_HOST_CLOSE_QUEUE_SIZE;
+        _count--;
+
+        myst_mutex_unlock(&_lock);
+        _close(fd);
+        myst_mutex_lock(&_lock);
+    }
+
+    _running = false;
+    myst_mutex_unlock(&_lock);
+    _exited = true;
+
+    return 0;
+}
+
+int myst_start_host_closer(void)
+{
+    int ret = 0;
+
+    if (!__myst_kernel_args.async_close)
+        goto done;
+
+    _running = true;
+
+    if (myst_create_kernel_thread(_closer, NULL, "kcloser") != 0)
+    {
+        _running = false;
+        ERAISE(-EAGAIN);
+    }
+
+done:
+    return ret;
+}
+
+void myst_stop_host_closer(void)
+{
+    bool running;
+
+    myst_mutex_lock(&_lock);
+    running = _running;
+    _stopping = true;
+    myst_cond_signal(&_cond);
+    myst_mutex_unlock(&_lock);
+
+    /* Wait ~1 second for the closer to drain the queue and exit */
+    for (size_t i = 0; running && i < 1000 && !_exited; i++)
+        myst_sleep_msec(1);
+}
+
+long myst_host_close(int fd)
+{
+    bool queued = false;
+
+    if (fd < 0)
+        return -EBADF;
+
+    if (__myst_kernel_args.async_close)
+    {
+        myst_mutex_lock(&_lock);
+
+        if (_running && !_stopping && _count < MYST_HOST_CLOSE_QUEUE_SIZE)
+        {
+            _fds[(_head + _count) % MYST_HOST_CLOSE_QUEUE_SIZE] = fd;
+            _count++;
+            queued = true;
+            myst_cond_signal(&_cond);
+        }
+
+        myst_mutex_unlock(&_lock);
+    }
+
+    return queued ? 0 : _close(fd);
+}
@@ -1,22 +1,44 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 
 #include <myst/bits.h>
+#include <myst/cond.h>
 #include <myst/defs.h>
 #include <myst/eraise.h>
 #include <myst/fdtable.h>
 #include <myst/inotifydev.h>
 #include <myst/list.h>
-#include <myst/paths.h>
+#include <myst/mutex.h>
+#include <myst/pollq.h>
+#include <myst/realpath.h>
 #include <myst/spinlock.h>
 #include <myst/strings.h>
+#include <myst/syscall.h>
 
 #define MAGIC 0x223b6b68
 
+/* as /proc/sys/fs/inotify/max_queued_events */
+#define MAX_QUEUED_EVENTS 16384
+
+/*
+** Events are posted by the syscall layer after it changes a file (see
+** myst_inotify_notify() and friends in inotifydev.h), so they come from
+** every file system alike (ramfs, ext2 and hostfs). A watch names a path
+** rather than an inode: the event goes to the watches on the path itself
+** and on its directory, and a rename moves the watches on the old path
+** (and below it) to the new one. Watches are kept under one mutex; each
+** instance queues its events under its own mutex and notifies its poll
+** queue, so that poll() and epoll_wait() see them. An event identical to
+** the last unread one is dropped, as Linux does.
+*/
 typedef struct watch
 {
     struct watch* prev;
@@ -26,14 +48,39 @@ typedef struct watch
     uint32_t mask;
 } watch_t;
 
+typedef struct event
+{
+    struct event* prev;
+    struct event* next;
+    int wd;
+    uint32_t mask;
+    uint32_t cookie;
+    uint32_t len; /* the size of name, padded with zeros */
+    char name[];
+} event_t;
+
 struct myst_inotify
 {
+    struct myst_inotify* prev;
+    struct myst_inotify* next;
     uint32_t magic;
-    int flags;
-    myst_list_t watches;
-    myst_spinlock_t lock;
+    int flags;           /* IN_NONBLOCK */
+    int fdflags;         /* FD_CLOEXEC */
+    myst_list_t watches; /* guarded by _mutex */
+    myst_mutex_t mutex;  /* guards the events */
+    myst_cond_t cond;    /* broadcast when an event is queued */
+    myst_list_t events;
+    size_t nbytes; /* the size of the events as read() returns them */
+    myst_pollq_t pollq;
 };
 
+/* the watches of every instance, checked on each change */
+size_t __myst_inotify_watches;
+
+static myst_list_t _instances;
+static myst_mutex_t _mutex;
+static uint32_t _cookie;
+
 MYST_INLINE bool _valid_inotify(const myst_inotify_t* obj)
 {
     return obj && obj->magic == MAGIC;
@@ -102,6 +149,235 @@ done:
     return ret;
 }
 
+/* Queue an event (with the caller holding _mutex) */
+static void _queue(
+    myst_inotify_t* obj,
+    int wd,
+    uint32_t mask,
+    uint32_t cookie,
+    const char* name)
+{
+    const size_t n = name ? strlen(name) : 0;
+    uint32_t len = 0;
+    event_t* tail;
+    event_t* e;
+    bool queued = false;
+
+    /* the name ends with at least one zero, padded to the next event */
+    if (n)
+    {
+        const size_t align = sizeof(struct inotify_event);
+        len = (uint32_t)((n + align) & ~(align - 1));
+    }
+
+    myst_mutex_lock(&obj->mutex);
+
+    tail = (event_t*)obj->events.tail;
+
+    /* drop an event that repeats the last unread one */
+    if (tail && tail->wd == wd && tail->mask == mask &&
+        tail->cookie == cookie && tail->len == len &&
+        (!len || strcmp(tail->name, name) == 0))
+    {
+        goto unlock;
+    }
+
+    if (obj->events.size >= MAX_QUEUED_EVENTS)
+    {
+        if (tail->mask == IN_Q_OVERFLOW)
+            goto unlock;
+
+        wd = -1;
+        mask = IN_Q_OVERFLOW;
+        cookie = 0;
+        len = 0;
+    }
+
+    if (!(e = calloc(1, sizeof(event_t) + len)))
+        goto unlock;
+
+    e->wd = wd;
+    e->mask = mask;
+    e->cookie = cookie;
+    e->len = len;
+
+    if (len)
+        memcpy(e->name, name, n);
+
+    myst_list_append(&obj->events, (myst_list_node_t*)e);
+    obj->nbytes += sizeof(struct inotify_event) + len;
+    myst_cond_broadcast(&obj->cond, SIZE_MAX);
+    queued = true;
+
+unlock:
+    myst_mutex_unlock(&obj->mutex);
+
+    if (queued)
+        myst_pollq_notify(&obj->pollq);
+}
+
+/* Remove a watch, telling the reader with IN_IGNORED */
+static void _remove_watch(myst_inotify_t* obj, watch_t* watch, bool ignored)
+{
+    if (ignored)
+        _queue(obj, watch->wd, IN_IGNORED, 0, NULL);
+
+    myst_list_remove(&obj->watches, (myst_list_node_t*)watch);
+    _put_wd(watch->wd);
+    free(watch);
+    __atomic_sub_fetch(&__myst_inotify_watches, 1, __ATOMIC_RELAXED);
+}
+
+/* Form the absolute path without "." and ".." components */
+static int _abspath(const char* path, myst_path_t* buf)
+{
+    int ret = 0;
+    size_t len;
+
+    ECHECK(myst_realpath(path, buf));
+
+    /* drop the "." that stands for a trailing slash */
+    if ((len = strlen(buf->buf)) > 2 && strcmp(buf->buf + len - 2, "/.") == 0)
+        buf->buf[len - 2] = '\0';
+
+done:
+    return ret;
+}
+
+/* The event that a watch on the path itself gets (or zero for none) */
+static uint32_t _self_mask(uint32_t mask)
+{
+    switch (mask & ~IN_ISDIR)
+    {
+        case IN_CREATE:
+        case IN_MOVED_TO:
+            return 0;
+        case IN_DELETE:
+            return IN_DELETE_SELF;
+        case IN_MOVED_FROM:
+            return IN_MOVE_SELF;
+        default:
+            return mask & ~IN_ISDIR;
+    }
+}
+
+/* Post the event to the watches on the path and on its directory; a move
+ * (with newpath) also moves the watches on the path and below it */
+static void _post(
+    const char* path,
+    uint32_t mask,
+    uint32_t cookie,
+    const char* newpath)
+{
+    const char* slash = strrchr(path, '/');
+    const char* name = slash + 1;
+    const size_t dirlen = (slash == path) ? 1 : (size_t)(slash - path);
+    const size_t pathlen = strlen(path);
+    const uint32_t self_mask = _self_mask(mask);
+
+    myst_mutex_lock(&_mutex);
+
+    for (myst_inotify_t* obj = (myst_inotify_t*)_instances.head; obj;
+         obj = obj->next)
+    {
+        watch_t* next;
+
+        for (watch_t* w = (watch_t*)obj->watches.head; w; w = next)
+        {
+            bool fired = false;
+
+            next = w->next;
+
+            /* the watch on the directory gets the name */
+            if (*name && strlen(w->path) == dirlen &&
+                strncmp(w->path, path, dirlen) == 0 && (w->mask & mask))
+            {
+                _queue(obj, w->wd, mask, cookie, name);
+                fired = true;
+            }
+            else if (self_mask && strcmp(w->path, path) == 0)
+            {
+                if (w->mask & self_mask)
+                {
+                    _queue(obj, w->wd, self_mask, 0, NULL);
+                    fired = true;
+                }
+
+                /* the file is gone, and its watch with it */
+                if (self_mask == IN_DELETE_SELF)
+                {
+                    _remove_watch(obj, w, true);
+                    continue;
+                }
+            }
+
+            if (newpath && strncmp(w->path, path, pathlen) == 0 &&
+                (w->path[pathlen] == '\0' || w->path[pathlen] == '/'))
+            {
+                char buf[PATH_MAX];
+                const int r = snprintf(
+                    buf, sizeof(buf), "%s%s", newpath, w->path + pathlen);
+
+                if (r > 0 && (size_t)r < sizeof(buf))
+                    myst_strlcpy(w->path, buf, sizeof(w->path));
+            }
+
+            if (fired && (w->mask & IN_ONESHOT))
+                _remove_watch(obj, w, true);
+        }
+    }
+
+    myst_mutex_unlock(&_mutex);
+}
+
+void myst_inotify_post(const char* path, uint32_t mask)
+{
+    myst_path_t buf;
+
+    if (path && _abspath(path, &buf) == 0)
+        _post(buf.buf, mask, 0, NULL);
+}
+
+void myst_inotify_post_file(myst_fs_t* fs, myst_file_t* file, uint32_t mask)
+{
+    char buf[PATH_MAX];
+
+    if ((*fs->fs_realpath)(fs, file, buf, sizeof(buf)) == 0 && *buf == '/')
+        _post(buf, mask, 0, NULL);
+}
+
+void myst_inotify_post_close(myst_fs_t* fs, myst_file_t* file)
+{
+    const int flags = (*fs->fs_fcntl)(fs, file, F_GETFL, 0);
+
+    if (flags >= 0 && (flags & O_ACCMODE) != O_RDONLY)
+        myst_inotify_post_file(fs, file, IN_CLOSE_WRITE);
+    else
+        myst_inotify_post_file(fs, file, IN_CLOSE_NOWRITE);
+}
+
+void myst_inotify_post_rename(const char* oldpath, const char* newpath)
+{
+    myst_path_t from;
+    myst_path_t to;
+    struct stat st;
+    uint32_t isdir = 0;
+    uint32_t cookie;
+
+    if (_abspath(oldpath, &from) != 0 || _abspath(newpath, &to) != 0)
+        return;
+
+    if (myst_syscall_lstat(to.buf, &st) == 0 && S_ISDIR(st.st_mode))
+        isdir = IN_ISDIR;
+
+    /* the cookie pairs the two events (and is never zero) */
+    while (!(cookie = __atomic_add_fetch(&_cookie, 1, __ATOMIC_RELAXED)))
+        ;
+
+    _post(from.buf, IN_MOVED_FROM | isdir, cookie, to.buf);
+    _post(to.buf, IN_MOVED_TO | isdir, cookie, NULL);
+}
+
 static int _id_inotify_init1(
     myst_inotifydev_t* dev,
     int flags,
@@ -121,7 +397,14 @@ static int _id_inotify_init1(
         ERAISE(-ENOMEM);
 
     obj->magic = MAGIC;
-    obj->flags = flags;
+    obj->flags = flags & IN_NONBLOCK;
+
+    if (flags & IN_CLOEXEC)
+        obj->fdflags = FD_CLOEXEC;
+
+    myst_mutex_lock(&_mutex);
+    myst_list_append(&_instances, (myst_list_node_t*)obj);
+    myst_mutex_unlock(&_mutex);
 
     *obj_out = obj;
     obj = NULL;
@@ -141,11 +424,59 @@ static ssize_t _id_read(
     size_t count)
 {
     ssize_t ret = 0;
+    size_t n = 0;
 
-    if (!dev || !_valid_inotify(obj) || (!buf && count))
+    if (!dev || !_valid_inotify(obj))
+        ERAISE(-EBADF);
+
+    if (!buf && count)
         ERAISE(-EINVAL);
 
-    /* notification not supported yet so return zero bytes */
+    myst_mutex_lock(&obj->mutex);
+
+    while (!obj->events.head)
+    {
+        if (obj->flags & IN_NONBLOCK)
+        {
+            ret = -EAGAIN;
+            break;
+        }
+
+        if (myst_cond_wait(&obj->cond, &obj->mutex) != 0)
+        {
+            ret = -EINTR;
+            break;
+        }
+    }
+
+    /* return the whole events that fit */
+    while (ret == 0 && obj->events.head)
+    {
+        event_t* e = (event_t*)obj->events.head;
+        const struct inotify_event header = {
+            .wd = e->wd, .mask = e->mask, .cookie = e->cookie, .len = e->len};
+        const size_t size = sizeof(header) + e->len;
+
+        if (n + size > count)
+            break;
+
+        memcpy((uint8_t*)buf + n, &header, sizeof(header));
+        memcpy((uint8_t*)buf + n + sizeof(header), e->name, e->len);
+        n += size;
+
+        myst_list_remove(&obj->events, (myst_list_node_t*)e);
+        obj->nbytes -= size;
+        free(e);
+    }
+
+    myst_mutex_unlock(&obj->mutex);
+    ECHECK(ret);
+
+    /* the buffer is too small for the first event */
+    if (n == 0)
+        ERAISE(-EINVAL);
+
+    ret = (ssize_t)n;
 
 done:
     return ret;
@@ -207,11 +538,44 @@ static int _id_fcntl(
     int cmd,
     long arg)
 {
-    (void)dev;
-    (void)obj;
-    (void)cmd;
-    (void)arg;
-    return -EINVAL;
+    int ret = 0;
+
+    if (!dev || !_valid_inotify(obj))
+        ERAISE(-EBADF);
+
+    switch (cmd)
+    {
+        case F_GETFL:
+        {
+            ret = O_RDONLY | obj->flags;
+            break;
+        }
+        case F_SETFL:
+        {
+            obj->flags = (int)(arg & O_NONBLOCK);
+            break;
+        }
+        case F_GETFD:
+        {
+            ret = obj->fdflags;
+            break;
+        }
+        case F_SETFD:
+        {
+            if (arg != FD_CLOEXEC && arg != 0)
+                ERAISE(-EINVAL);
+
+            obj->fdflags = (int)arg;
+            break;
+        }
+        default:
+        {
+            ERAISE(-EINVAL);
+        }
+    }
+
+done:
+    return ret;
 }
 
 static int _id_ioctl(
@@ -222,14 +586,24 @@ static int _id_ioctl(
 {
     int ret = 0;
 
-    (void)arg;
-
     if (!dev || !_valid_inotify(obj))
         ERAISE(-EBADF);
 
     if (request == TIOCGWINSZ)
         ERAISE(-EINVAL);
 
+    /* the size of the queued events, for sizing the read buffer */
+    if (request == FIONREAD)
+    {
+        if (!arg)
+            ERAISE(-EFAULT);
+
+        myst_mutex_lock(&obj->mutex);
+        *(int*)arg = (int)obj->nbytes;
+        myst_mutex_unlock(&obj->mutex);
+        goto done;
+    }
+
     ERAISE(-ENOTSUP);
 
 done:
@@ -255,6 +629,18 @@ static int _id_close(myst_inotifydev_t* dev, myst_inotify_t* obj)
     if (!dev || !_valid_inotify(obj))
         ERAISE(-EINVAL);
 
+    myst_mutex_lock(&_mutex);
+    {
+        myst_list_remove(&_instances, (myst_list_node_t*)obj);
+
+        while (obj->watches.head)
+            _remove_watch(obj, (watch_t*)obj->watches.head, false);
+    }
+    myst_mutex_unlock(&_mutex);
+
+    myst_pollq_destroy(&obj->pollq);
+    myst_list_free(&obj->events);
+
     memset(obj, 0, sizeof(myst_inotify_t));
     free(obj);
 
@@ -277,9 +663,18 @@ done:
 
 static int _id_get_events(myst_inotifydev_t* dev, myst_inotify_t* obj)
 {
-    (void)dev;
-    (void)obj;
-    return -EINVAL;
+    if (!dev || !_valid_inotify(obj))
+        return -EINVAL;
+
+    return __atomic_load_n(&obj->events.size, __ATOMIC_RELAXED) ? POLLIN : 0;
+}
+
+static myst_pollq_t* _id_pollq(myst_inotifydev_t* dev, myst_inotify_t* obj)
+{
+    if (!dev || !_valid_inotify(obj))
+        return NULL;
+
+    return &obj->pollq;
 }
 
 static int _id_inotify_add_watch(
@@ -289,31 +684,48 @@ static int _id_inotify_add_watch(
     uint32_t mask)
 {
     int ret = 0;
-    char path[PATH_MAX];
+    myst_path_t path;
     watch_t* watch = NULL;
     bool found = false;
+    struct stat st;
 
     if (!dev || !_valid_inotify(obj) || !pathname)
         ERAISE(-EINVAL);
 
-    /* normalize the path */
-    ECHECK(myst_normalize(pathname, path, sizeof(path)));
+    if (!(mask & IN_ALL_EVENTS))
+        ERAISE(-EINVAL);
+
+    ECHECK(_abspath(pathname, &path));
+
+    /* the file must exist (as a directory for IN_ONLYDIR) */
+    if (mask & IN_DONT_FOLLOW)
+        ECHECK(myst_syscall_lstat(path.buf, &st));
+    else
+        ECHECK(myst_syscall_stat(path.buf, &st));
+
+    if ((mask & IN_ONLYDIR) && !S_ISDIR(st.st_mode))
+        ERAISE(-ENOTDIR);
 
     /* see if there's already a watch for this path */
     {
-        myst_spin_lock(&obj->lock);
+        myst_mutex_lock(&_mutex);
 
         for (watch_t* p = (watch_t*)obj->watches.head; p; p = p->next)
         {
-            if (strcmp(p->path, pathname) == 0)
+            if (strcmp(p->path, path.buf) == 0)
             {
+                if (mask & IN_MASK_ADD)
+                    p->mask |= mask;
+                else
+                    p->mask = mask;
+
                 ret = p->wd;
                 found = true;
                 break;
             }
         }
 
-        myst_spin_unlock(&obj->lock);
+        myst_mutex_unlock(&_mutex);
     }
 
     /* if not found, then add a new watch object for this path */
@@ -324,14 +736,15 @@ static int _id_inotify_add_watch(
         if (!(watch = calloc(1, sizeof(watch_t))))
             ERAISE(-ENOMEM);
 
-        myst_strlcpy(watch->path, path, sizeof(watch->path));
+        myst_strlcpy(watch->path, path.buf, sizeof(watch->path));
         ECHECK((wd = _get_wd()));
         watch->wd = wd;
         watch->mask = mask;
 
-        myst_spin_lock(&obj->lock);
+        myst_mutex_lock(&_mutex);
         myst_list_append(&obj->watches, (myst_list_node_t*)watch);
-        myst_spin_unlock(&obj->lock);
+        __atomic_add_fetch(&__myst_inotify_watches, 1, __ATOMIC_RELAXED);
+        myst_mutex_unlock(&_mutex);
 
         ret = wd;
         watch = NULL;
@@ -359,29 +772,26 @@ static int _id_inotify_rm_watch(
     if (wd < 0)
         ERAISE(-EBADF);
 
-    /* see if there's already a watch for this path */
+    /* find the watch and remove it */
     {
-        myst_spin_lock(&obj->lock);
+        myst_mutex_lock(&_mutex);
 
         for (watch_t* p = (watch_t*)obj->watches.head; p; p = p->next)
         {
             if (p->wd == wd)
             {
-                myst_list_remove(&obj->watches, (myst_list_node_t*)p);
-                free(p);
+                _remove_watch(obj, p, true);
                 found = true;
                 break;
             }
         }
 
-        myst_spin_unlock(&obj->lock);
+        myst_mutex_unlock(&_mutex);
     }
 
     if (!found)
         ERAISE(-EINVAL);
 
-    ECHECK(_put_wd(wd));
-
 done:
     return ret;
 }
@@ -403,6 +813,7 @@ myst_inotifydev_t* myst_inotifydev_get(void)
             .fd_close = (void*)_id_close,
             .fd_target_fd = (void*)_id_target_fd,
             .fd_get_events = (void*)_id_get_events,
+            .fd_pollq = (void*)_id_pollq,
         },
         .id_inotify_init1 = _id_inotify_init1,
         .id_read = _id_read,
@@ -1,122 +1,181 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
-#include <assert.h>
+#include <errno.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <myst/clock.h>
-#include <myst/cond.h>
 #include <myst/eraise.h>
 #include <myst/mutex.h>
 #include <myst/process.h>
+#include <myst/signal.h>
 #include <myst/syscall.h>
-#include <myst/time.h>
+#include <myst/thread.h>
+#include <myst/timer.h>
 #include <myst/timeval.h>
 
+/*
+**==============================================================================
+**
+** Interval timers (setitimer) and POSIX timers (timer_create).
+**
+**     Both run on kernel timers (see kernel/timer.c): an armed timer costs
+**     nothing until it expires, when the timer thread queues its signal and
+**     rearms it if it is periodic. Expirations are tracked on the monotonic
+**     clock; an absolute CLOCK_REALTIME expiration is converted when it is
+**     set.
+**
+**     A timer function may race with a concurrent setitimer() or
+**     timer_settime(), so it rechecks the expiration under the lock and
+**     ignores stale wakeups.
+**
+**==============================================================================
+*/
+
+#ifndef SIGEV_THREAD_ID
+#define SIGEV_THREAD_ID 4
+#endif
+
+#define MAX_POSIX_TIMERS 256
+
+/* the sigevent structure as the kernel sees it (as passed by the C library) */
+typedef struct ksigevent
+{
+    union sigval sigev_value;
+    int sigev_signo;
+    int sigev_notify;
+    int sigev_tid;
+} ksigevent_t;
+
 /* ATTN: currently the itimer is only for the single process case */
 typedef struct itimer
 {
-    myst_cond_t cond;
-    uint64_t real_interval; /* ITIMER_REAL interval */
-    uint64_t real_value;    /* ITIMER_REAL value */
+    myst_timer_t timer;
     myst_mutex_t mutex;
-    _Atomic(int) initialized;
+    uint64_t expiry;   /* the next expiration in nanoseconds (0: disarmed) */
+    uint64_t interval; /* nanoseconds between expirations (0: once) */
+    pid_t pid;         /* the process that receives SIGALRM */
 } itimer_t;
 
+typedef struct posix_timer
+{
+    myst_timer_t timer;
+    int id;
+    pid_t pid;  /* the owning process */
+    pid_t tid;  /* the thread that receives the signal (SIGEV_THREAD_ID) */
+    clockid_t clockid;
+    int notify; /* SIGEV_SIGNAL, SIGEV_NONE or SIGEV_THREAD_ID */
+    int signo;
+    union sigval value;
+    uint64_t expiry;   /* the next expiration in nanoseconds (0: disarmed) */
+    uint64_t interval; /* nanoseconds between expirations (0: once) */
+    int overrun;       /* the overrun of the last queued signal */
+} posix_timer_t;
+
 static itimer_t _it;
 
-/* get time as microseconds since epoch: return 0 on failure */
-static uint64_t _get_current_time(void)
+/* guards the POSIX timers and the table */
+static myst_mutex_t _timers_lock;
+static posix_timer_t* _timers[MAX_POSIX_TIMERS];
+
+/* Queue a signal for a thread (or return false if one is still pending) */
+static bool _queue_signal(pid_t tid, bool process, siginfo_t* siginfo)
 {
-    uint64_t ret;
-    struct timespec ts;
-    struct timeval tv;
+    myst_thread_t* thread = myst_tid_map_find(tid);
+    const uint64_t mask = (uint64_t)1 << (siginfo->si_signo - 1);
+    bool ret = true;
 
-    if (myst_syscall_clock_gettime(CLOCK_REALTIME, &ts) != 0)
-        return 0;
+    if (!thread || (process && !myst_is_process_thread(thread)))
+        goto done;
 
-    /* downgrade from nanosecond to microsecond granularity */
-    tv.tv_sec = ts.tv_sec;
-    tv.tv_usec = ts.tv_nsec / 1000;
+    /* a pending signal is not queued again (the expiration overruns) */
+    if (thread->signal.pending & mask)
+    {
+        ret = false;
+        goto done;
+    }
 
-    /* convert timeval to uint64 */
-    if (myst_timeval_to_uint64(&tv, &ret) != 0)
-        return 0;
+    myst_signal_deliver(thread, (unsigned)siginfo->si_signo, siginfo);
 
+done:
+    myst_put_thread(thread);
     return ret;
 }
 
-static void _update_and_check_expiration(uint64_t start, uint64_t end)
+/* Count the expirations up to now and compute the next one */
+static uint64_t _expire(uint64_t* expiry, uint64_t interval, uint64_t now)
 {
-    uint64_t elapsed = end - start;
+    uint64_t n = 1;
 
-    /* update the timer */
-    if (elapsed < _it.real_value)
-        _it.real_value -= elapsed;
+    if (interval)
+    {
+        n = (now - *expiry) / interval + 1;
+        *expiry += n * interval;
+    }
     else
-        _it.real_value = 0;
-
-    /* if timer expired */
-    if (_it.real_value == 0)
     {
-        myst_syscall_kill(myst_getpid(), SIGALRM);
-        _it.real_value = _it.real_interval;
+        *expiry = 0;
     }
+
+    return n;
 }
 
-long myst_syscall_run_itimer(void)
+static void _itimer_expired(myst_timer_t* timer)
 {
+    const uint64_t now = myst_timer_now();
+    pid_t pid;
+
+    (void)timer;
+
     myst_mutex_lock(&_it.mutex);
+
+    /* ignore a wakeup for a disarmed or rearmed timer */
+    if (!_it.expiry || now < _it.expiry)
     {
-        _it.initialized = 1;
+        myst_mutex_unlock(&_it.mutex);
+        return;
+    }
 
-        for (;;)
-        {
-            struct timespec buf;
-            struct timespec* to;
+    pid = _it.pid;
+    _expire(&_it.expiry, _it.interval, now);
 
-            /* if ITIMER_REAL is non-zero */
-            if (_it.real_value == 0)
-            {
-                to = NULL;
-            }
-            else
-            {
-                size_t PULSE = MICRO_IN_SECOND / 1000; /* one millisecond */
-                size_t min = PULSE;
+    if (_it.expiry)
+        myst_timer_arm(&_it.timer, _it.expiry);
 
-                if (_it.real_value < min)
-                    min = _it.real_value;
+    myst_mutex_unlock(&_it.mutex);
 
-                to = &buf;
-                to->tv_sec = min / 1000000;
-                to->tv_nsec = (min * 1000) % NANO_IN_SECOND;
-            }
+    {
+        siginfo_t siginfo;
+
+        memset(&siginfo, 0, sizeof(siginfo));
+        siginfo.si_signo = SIGALRM;
+        siginfo.si_code = SI_KERNEL;
+        _queue_signal(pid, true, &siginfo);
+    }
+}
 
-            uint64_t start = _get_current_time();
-            int r = myst_cond_timedwait(&_it.cond, &_it.mutex, to);
-            uint64_t end = _get_current_time();
+/* Get the time left in microseconds (call with the mutex held) */
+static void _get_itimer(uint64_t now, struct itimerval* value)
+{
+    uint64_t left = 0;
 
-            assert(start != 0);
-            assert(end != 0);
-            assert(end >= start);
+    /* round up so that an armed timer never reads as disarmed */
+    if (_it.expiry)
+        left = _it.expiry > now ? (_it.expiry - now + 999) / 1000 : 1;
 
-            /* if recieved a signal on condition */
-            if (r == 0)
-            {
-                /* no-op */
-            }
-            else if (r == ETIMEDOUT)
-            {
-                _update_and_check_expiration(start, end);
-            }
-        }
-    }
-    myst_mutex_unlock(&_it.mutex);
+    myst_uint64_to_timeval(left, &value->it_value);
+    myst_uint64_to_timeval(_it.interval / 1000, &value->it_interval);
+}
 
+/* Retained for C runtimes that still create an itimer thread, which now
+ * returns at once (the kernel timer thread runs the itimer) */
+long myst_syscall_run_itimer(void)
+{
     return 0;
 }
 
@@ -128,6 +187,7 @@ long myst_syscall_setitimer(
     long ret = 0;
     uint64_t interval;
     uint64_t value;
+    uint64_t now;
 
     /* ATTN: only ITIMER_REAL is supported so far */
     if (which != ITIMER_REAL || !new_value)
@@ -137,32 +197,28 @@ long myst_syscall_setitimer(
     ECHECK(myst_timeval_to_uint64(&new_value->it_interval, &interval));
     ECHECK(myst_timeval_to_uint64(&new_value->it_value, &value));
 
-    /* wait for itimer thread to obtain the mutex for the first time */
-    while (_it.initialized == 0)
-    {
-        __asm__ __volatile__("pause" : : : "memory");
-    }
+    if (interval > UINT64_MAX / 1000 || value > UINT64_MAX / 2000)
+        ERAISE(-EINVAL);
 
     myst_mutex_lock(&_it.mutex);
     {
+        now = myst_timer_now();
+
         if (old_value)
-        {
-            myst_uint64_to_timeval(_it.real_interval, &old_value->it_interval);
-            myst_uint64_to_timeval(_it.real_value, &old_value->it_value);
-        }
+            _get_itimer(now, old_value);
 
-        /* set the new value for the itimer */
-        _it.real_interval = interval;
-        _it.real_value = value;
+        /* set the new value for the itimer (a disarmed timer may still wake
+         * once, and be ignored) */
+        _it.timer.fn = _itimer_expired;
+        _it.pid = myst_getpid();
+        _it.interval = value ? interval * 1000 : 0;
+        _it.expiry = value ? now + value * 1000 : 0;
 
-        /* signal the itimer thread */
-        if (myst_cond_signal(&_it.cond) != 0)
-        {
-            myst_mutex_unlock(&_it.mutex);
-            ERAISE(-ENOSYS);
-        }
+        if (_it.expiry)
+            ret = myst_timer_arm(&_it.timer, _it.expiry);
     }
     myst_mutex_unlock(&_it.mutex);
+    ECHECK(ret);
 
 done:
     return ret;
@@ -180,10 +236,389 @@ int myst_syscall_getitimer(int which, struct itimerval* curr_value)
         ERAISE(-EINVAL);
 
     myst_mutex_lock(&_it.mutex);
-    myst_uint64_to_timeval(_it.real_value, &curr_value->it_value);
-    myst_uint64_to_timeval(_it.real_interval, &curr_value->it_interval);
+    _get_itimer(myst_timer_now(), curr_value);
     myst_mutex_unlock(&_it.mutex);
 
 done:
     return ret;
 }
+
+static void _posix_timer_expired(myst_timer_t* timer)
+{
+    posix_timer_t* t = (posix_timer_t*)timer;
+    const uint64_t now = myst_timer_now();
+    siginfo_t siginfo;
+    uint64_t n;
+    pid_t tid;
+
+    myst_mutex_lock(&_timers_lock);
+
+    /* ignore a wakeup for a disarmed or rearmed timer */
+    if (!t->expiry || now < t->expiry)
+    {
+        myst_mutex_unlock(&_timers_lock);
+        return;
+    }
+
+    n = _expire(&t->expiry, t->interval, now);
+
+    if (t->expiry)
+        myst_timer_arm(&t->timer, t->expiry);
+
+    if (t->notify == SIGEV_NONE)
+    {
+        myst_mutex_unlock(&_timers_lock);
+        return;
+    }
+
+    memset(&siginfo, 0, sizeof(siginfo));
+    siginfo.si_signo = t->signo;
+    siginfo.si_code = SI_TIMER;
+    siginfo.si_timerid = t->id;
+    siginfo.si_overrun = n - 1 > INT_MAX ? INT_MAX : (int)(n - 1);
+    siginfo.si_value = t->value;
+    tid = t->notify == SIGEV_THREAD_ID ? t->tid : t->pid;
+
+    if (_queue_signal(tid, t->notify != SIGEV_THREAD_ID, &siginfo))
+        t->overrun = siginfo.si_overrun;
+    else if (t->overrun > INT_MAX - (int64_t)n)
+        t->overrun = INT_MAX;
+    else
+        t->overrun += (int)n;
+
+    myst_mutex_unlock(&_timers_lock);
+}
+
+/* Find a timer of the calling process (call with the lock held) */
+static posix_timer_t* _find_timer(int timerid)
+{
+    posix_timer_t* t;
+
+    if (timerid < 0 || timerid >= MAX_POSIX_TIMERS)
+        return NULL;
+
+    if (!(t = _timers[timerid]) || t->pid != myst_getpid())
+        return NULL;
+
+    return t;
+}
+
+static int _timespec_to_ns(const struct timespec* ts, uint64_t* ns)
+{
+    if (ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= NANO_IN_SECOND)
+        return -EINVAL;
+
+    /* leave room to add the current time */
+    if ((uint64_t)ts->tv_sec > UINT64_MAX / NANO_IN_SECOND / 2)
+        return -EINVAL;
+
+    *ns = (uint64_t)ts->tv_sec * NANO_IN_SECOND + (uint64_t)ts->tv_nsec;
+    return 0;
+}
+
+static void _ns_to_timespec(uint64_t ns, struct timespec* ts)
+{
+    ts->tv_sec = (time_t)(ns / NANO_IN_SECOND);
+    ts->tv_nsec = (long)(ns % NANO_IN_SECOND);
+}
+
+static uint64_t _realtime_now(void)
+{
+    struct timespec ts;
+
+    if (myst_syscall_clock_gettime(CLOCK_REALTIME, &ts) != 0)
+        return 0;
+
+    return (uint64_t)ts.tv_sec * NANO_IN_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+/* Get the time left and the interval (call with the lock held) */
+static void _get_value(const posix_timer_t* t, struct itimerspec* value)
+{
+    const uint64_t now = myst_timer_now();
+    uint64_t left = 0;
+
+    /* an expiration that is due reads as armed until it is processed */
+    if (t->expiry)
+        left = t->expiry > now ? t->expiry - now : 1;
+
+    _ns_to_timespec(left, &value->it_value);
+
+    _ns_to_timespec(t->interval, &value->it_interval);
+}
+
+long myst_syscall_timer_create(
+    clockid_t clockid,
+    const void* sevp,
+    int* timerid)
+{
+    long ret = 0;
+    ksigevent_t sev;
+    posix_timer_t* t = NULL;
+    const pid_t pid = myst_getpid();
+
+    if (!timerid)
+        ERAISE(-EFAULT);
+
+    if (clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC &&
+        clockid != CLOCK_BOOTTIME)
+    {
+        ERAISE(-EINVAL);
+    }
+
+    /* the default is SIGALRM to the process with the timer id as value */
+    if (sevp)
+    {
+        memcpy(&sev, sevp, sizeof(sev));
+    }
+    else
+    {
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_SIGNAL;
+        sev.sigev_signo = SIGALRM;
+    }
+
+    switch (sev.sigev_notify)
+    {
+        case SIGEV_NONE:
+            break;
+        case SIGEV_THREAD_ID:
+        {
+            myst_thread_t* thread;
+
+            if (!(thread = myst_find_thread(sev.sigev_tid)))
+                ERAISE(-EINVAL);
+
+            myst_put_thread(thread);
+        }
+        /* fallthrough */
+        case SIGEV_SIGNAL:
+        {
+            if (sev.sigev_signo <= 0 || sev.sigev_signo >= NSIG)
+                ERAISE(-EINVAL);
+            break;
+        }
+        default:
+            ERAISE(-EINVAL);
+    }
+
+    if (!(t = calloc(1, sizeof(posix_timer_t))))
+        ERAISE(-ENOMEM);
+
+    t->timer.fn = _posix_timer_expired;
+    t->pid = pid;
+    t->clockid = clockid;
+    t->tid = sev.sigev_tid;
+    t->notify = sev.sigev_notify;
+    t->signo = sev.sigev_signo;
+    t->value = sev.sigev_value;
+
+    myst_mutex_lock(&_timers_lock);
+    {
+        int id = -1;
+
+        for (int i = 0; i < MAX_POSIX_TIMERS; i++)
+        {
+            if (!_timers[i])
+            {
+                id = i;
+                break;
+            }
+        }
+
+        if (id >= 0)
+        {
+            t->id = id;
+
+            if (!sevp)
+                t->value.sival_int = id;
+
+            _timers[id] = t;
+        }
+
+        ret = id < 0 ? -EAGAIN : 0;
+    }
+    myst_mutex_unlock(&_timers_lock);
+    ECHECK(ret);
+
+    *timerid = t->id;
+    t = NULL;
+
+done:
+
+    if (t)
+        free(t);
+
+    return ret;
+}
+
+long myst_syscall_timer_settime(
+    int timerid,
+    int flags,
+    const struct itimerspec* new_value,
+    struct itimerspec* old_value)
+{
+    long ret = 0;
+    posix_timer_t* t;
+    uint64_t value;
+    uint64_t interval;
+    bool locked = false;
+
+    if (!new_value)
+        ERAISE(-EFAULT);
+
+    if (flags & ~TIMER_ABSTIME)
+        ERAISE(-EINVAL);
+
+    ECHECK(_timespec_to_ns(&new_value->it_value, &value));
+    ECHECK(_timespec_to_ns(&new_value->it_interval, &interval));
+
+    myst_mutex_lock(&_timers_lock);
+    locked = true;
+
+    if (!(t = _find_timer(timerid)))
+        ERAISE(-EINVAL);
+
+    {
+        const uint64_t now = myst_timer_now();
+
+        if (old_value)
+            _get_value(t, old_value);
+
+        /* a disarmed timer may still wake once (and be ignored) */
+        if (value == 0)
+        {
+            t->expiry = 0;
+        }
+        else if (flags & TIMER_ABSTIME)
+        {
+            uint64_t clock_now = now;
+
+            /* convert an absolute real time to monotonic */
+            if (t->clockid == CLOCK_REALTIME)
+                clock_now = _realtime_now();
+
+            t->expiry = value > clock_now ? now + (value - clock_now) : now;
+        }
+        else
+        {
+            t->expiry = now + value;
+        }
+
+        t->interval = t->expiry ? interval : 0;
+        t->overrun = 0;
+
+        if (t->expiry)
+            ret = myst_timer_arm(&t->timer, t->expiry);
+    }
+
+done:
+
+    if (locked)
+        myst_mutex_unlock(&_timers_lock);
+
+    return ret;
+}
+
+long myst_syscall_timer_gettime(int timerid, struct itimerspec* curr_value)
+{
+    long ret = 0;
+    posix_timer_t* t;
+
+    if (!curr_value)
+        ERAISE(-EFAULT);
+
+    myst_mutex_lock(&_timers_lock);
+
+    if ((t = _find_timer(timerid)))
+        _get_value(t, curr_value);
+
+    myst_mutex_unlock(&_timers_lock);
+
+    if (!t)
+        ERAISE(-EINVAL);
+
+done:
+    return ret;
+}
+
+long myst_syscall_timer_getoverrun(int timerid)
+{
+    long ret = 0;
+    posix_timer_t* t;
+
+    myst_mutex_lock(&_timers_lock);
+
+    if ((t = _find_timer(timerid)))
+        ret = t->overrun;
+
+    myst_mutex_unlock(&_timers_lock);
+
+    if (!t)
+        ERAISE(-EINVAL);
+
+done:
+    return ret;
+}
+
+/* Remove the timer from the table (call with the lock held) */
+static void _remove_timer(posix_timer_t* t)
+{
+    t->expiry = 0;
+    _timers[t->id] = NULL;
+}
+
+/* Release a removed timer (without the lock, which its function takes) */
+static void _release_timer(posix_timer_t* t)
+{
+    myst_timer_cancel(&t->timer);
+    free(t);
+}
+
+long myst_syscall_timer_delete(int timerid)
+{
+    long ret = 0;
+    posix_timer_t* t;
+
+    myst_mutex_lock(&_timers_lock);
+
+    if ((t = _find_timer(timerid)))
+        _remove_timer(t);
+
+    myst_mutex_unlock(&_timers_lock);
+
+    if (!t)
+        ERAISE(-EINVAL);
+
+    _release_timer(t);
+
+done:
+    return ret;
+}
+
+void myst_release_process_timers(pid_t pid)
+{
+    myst_mutex_lock(&_it.mutex);
+
+    if (_it.pid == pid)
+        _it.expiry = 0;
+
+    myst_mutex_unlock(&_it.mutex);
+
+    for (int i = 0; i < MAX_POSIX_TIMERS; i++)
+    {
+        posix_timer_t* t;
+
+        myst_mutex_lock(&_timers_lock);
+
+        if ((t = _timers[i]) && t->pid == pid)
+            _remove_timer(t);
+        else
+            t = NULL;
+
+        myst_mutex_unlock(&_timers_lock);
+
+        if (t)
+            _release_timer(t);
+    }
+}
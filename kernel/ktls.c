@@ -0,0 +1,328 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <string.h>
+
+#include <myst/defs.h>
+#include <myst/eraise.h>
+#include <myst/ktls.h>
+
+/* The offsets of the fields of a tls12_crypto_info_aes_gcm_128/256 (which
+ * have the same layout apart from the size of the key) */
+#define INFO_IV 4
+#define INFO_KEY 12
+#define INFO_SIZE(KEY_SIZE) (INFO_KEY + (KEY_SIZE) + 4 + 8)
+
+/* The record version (TLS 1.3 records claim to be TLS 1.2 records too) */
+#define RECORD_VERSION 0x0303
+
+#define EXPLICIT_NONCE_SIZE 8
+
+MYST_INLINE uint16_t _get_be16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+MYST_INLINE void _put_be16(uint8_t* p, size_t x)
+{
+    p[0] = (uint8_t)(x >> 8);
+    p[1] = (uint8_t)x;
+}
+
+static void _put_be64(uint8_t* p, uint64_t x)
+{
+    for (size_t i = 0; i < 8; i++)
+        p[i] = (uint8_t)(x >> (56 - 8 * i));
+}
+
+static uint64_t _get_be64(const uint8_t* p)
+{
+    uint64_t x = 0;
+
+    for (size_t i = 0; i < 8; i++)
+        x = (x << 8) | p[i];
+
+    return x;
+}
+
+/* The TLS 1.2 explicit nonce counts records like the sequence number */
+static void _increment_iv(uint8_t iv[8])
+{
+    for (size_t i = 8; i-- > 0;)
+    {
+        if (++iv[i] != 0)
+            break;
+    }
+}
+
+int myst_ktls_init(myst_ktls_t* tls, const void* info_, socklen_t size)
+{
+    int ret = 0;
+    const uint8_t* info = info_;
+    uint16_t version;
+    uint16_t cipher;
+    size_t key_size;
+
+    if (!tls || !info)
+        ERAISE(-EFAULT);
+
+    if (size < INFO_IV)
+        ERAISE(-EINVAL);
+
+    memcpy(&version, info, sizeof(version));
+    memcpy(&cipher, info + 2, sizeof(cipher));
+
+    if (version != TLS_1_2_VERSION && version != TLS_1_3_VERSION)
+        ERAISE(-EINVAL);
+
+    if (cipher == TLS_CIPHER_AES_GCM_128)
+        key_size = 16;
+    else if (cipher == TLS_CIPHER_AES_GCM_256)
+        key_size = 32;
+    else
+        ERAISE(-EINVAL);
+
+    if (size < INFO_SIZE(key_size))
+        ERAISE(-EINVAL);
+
+    memset(tls, 0, sizeof(myst_ktls_t));
+    ECHECK(myst_gcm_new(info + INFO_KEY, key_size, &tls->gcm));
+
+    tls->version = version;
+    memcpy(tls->iv, info + INFO_IV, sizeof(tls->iv));
+    memcpy(tls->salt, info + INFO_KEY + key_size, sizeof(tls->salt));
+    tls->seq = _get_be64(info + INFO_KEY + key_size + sizeof(tls->salt));
+    tls->info_size = (socklen_t)INFO_SIZE(key_size);
+    memcpy(tls->info, info, tls->info_size);
+
+done:
+    return ret;
+}
+
+void myst_ktls_release(myst_ktls_t* tls)
+{
+    if (tls && tls->gcm)
+        myst_gcm_free(tls->gcm);
+
+    /* do not leave the keys behind */
+    if (tls)
+        memset(tls, 0, sizeof(myst_ktls_t));
+}
+
+int myst_ktls_get_info(const myst_ktls_t* tls, void* info, socklen_t* size)
+{
+    int ret = 0;
+    uint8_t buf[MYST_TLS_MAX_CRYPTO_INFO];
+
+    if (!tls || !info || !size)
+        ERAISE(-EFAULT);
+
+    if (!tls->gcm)
+        ERAISE(-EBUSY);
+
+    if (*size < tls->info_size)
+        ERAISE(-EINVAL);
+
+    /* the nonce and the sequence number of the next record */
+    memcpy(buf, tls->info, tls->info_size);
+    memcpy(buf + INFO_IV, tls->iv, sizeof(tls->iv));
+    _put_be64(buf + tls->info_size - 8, tls->seq);
+
+    memcpy(info, buf, tls->info_size);
+    *size = tls->info_size;
+
+done:
+    return ret;
+}
+
+/* Get the nonce and additional data of the next record */
+static void _get_auth(
+    const myst_ktls_t* tls,
+    uint8_t type,
+    const uint8_t* header,
+    const uint8_t* explicit_nonce,
+    size_t plaintext_size,
+    myst_gcm_auth_t* auth)
+{
+    memcpy(auth->iv, tls->salt, sizeof(tls->salt));
+
+    if (tls->version == TLS_1_3_VERSION)
+    {
+        uint8_t seq[8];
+
+        /* the nonce is the iv XOR the sequence number */
+        _put_be64(seq, tls->seq);
+        memcpy(auth->iv + sizeof(tls->salt), tls->iv, sizeof(tls->iv));
+
+        for (size_t i = 0; i < sizeof(seq); i++)
+            auth->iv[sizeof(tls->salt) + i] ^= seq[i];
+
+        /* the additional data is the record header */
+        memcpy(auth->aad, header, MYST_TLS_HEADER_SIZE);
+        auth->aad_size = MYST_TLS_HEADER_SIZE;
+    }
+    else
+    {
+        memcpy(auth->iv + sizeof(tls->salt), explicit_nonce, 8);
+
+        _put_be64(auth->aad, tls->seq);
+        auth->aad[8] = type;
+        _put_be16(auth->aad + 9, RECORD_VERSION);
+        _put_be16(auth->aad + 11, plaintext_size);
+        auth->aad_size = 13;
+    }
+}
+
+ssize_t myst_ktls_seal(
+    myst_ktls_t* tls,
+    uint8_t type,
+    const void* in,
+    size_t size,
+    uint8_t* out)
+{
+    ssize_t ret = 0;
+    myst_gcm_auth_t auth;
+    uint8_t header[MYST_TLS_HEADER_SIZE];
+    uint8_t* p = out + MYST_TLS_HEADER_SIZE;
+    size_t len;
+
+    if (!tls || !tls->gcm || (!in && size) || !out)
+        ERAISE(-EINVAL);
+
+    if (size > MYST_TLS_MAX_PLAINTEXT)
+        ERAISE(-EMSGSIZE);
+
+    /* out may be host memory, so the header is built here and nothing
+     * written to out is read back */
+    if (tls->version == TLS_1_3_VERSION)
+    {
+        /* the real type follows the plaintext (which has no padding) */
+        const struct iovec iov[] = {{(void*)in, size}, {&type, 1}};
+
+        len = size + 1 + MYST_GCM_TAG_SIZE;
+        header[0] = MYST_TLS_APPLICATION_DATA;
+        _put_be16(header + 1, RECORD_VERSION);
+        _put_be16(header + 3, len);
+        memcpy(out, header, sizeof(header));
+
+        _get_auth(tls, type, header, NULL, size, &auth);
+        ECHECK(myst_gcm_seal(tls->gcm, &auth, iov, 2, p));
+    }
+    else
+    {
+        const struct iovec iov = {(void*)in, size};
+
+        len = EXPLICIT_NONCE_SIZE + size + MYST_GCM_TAG_SIZE;
+        header[0] = type;
+        _put_be16(header + 1, RECORD_VERSION);
+        _put_be16(header + 3, len);
+        memcpy(out, header, sizeof(header));
+        memcpy(p, tls->iv, EXPLICIT_NONCE_SIZE);
+
+        _get_auth(tls, type, header, tls->iv, size, &auth);
+        ECHECK(myst_gcm_seal(
+            tls->gcm, &auth, &iov, 1, p + EXPLICIT_NONCE_SIZE));
+        _increment_iv(tls->iv);
+    }
+
+    tls->seq++;
+    ret = (ssize_t)(MYST_TLS_HEADER_SIZE + len);
+
+done:
+    return ret;
+}
+
+ssize_t myst_ktls_record_size(
+    const myst_ktls_t* tls,
+    const uint8_t header[MYST_TLS_HEADER_SIZE])
+{
+    ssize_t ret = 0;
+    const size_t len = _get_be16(header + 3);
+    size_t min;
+
+    if (!tls || !tls->gcm)
+        ERAISE(-EINVAL);
+
+    if (tls->version == TLS_1_3_VERSION)
+    {
+        /* the content type is encrypted with the content */
+        if (header[0] != MYST_TLS_APPLICATION_DATA)
+            ERAISE(-EBADMSG);
+
+        min = 1 + MYST_GCM_TAG_SIZE;
+    }
+    else
+    {
+        min = EXPLICIT_NONCE_SIZE + MYST_GCM_TAG_SIZE;
+    }
+
+    if (_get_be16(header + 1) != RECORD_VERSION || len < min)
+        ERAISE(-EBADMSG);
+
+    if (MYST_TLS_HEADER_SIZE + len > MYST_TLS_MAX_RECORD)
+        ERAISE(-EMSGSIZE);
+
+    ret = (ssize_t)(MYST_TLS_HEADER_SIZE + len);
+
+done:
+    return ret;
+}
+
+ssize_t myst_ktls_open(
+    myst_ktls_t* tls,
+    uint8_t* record,
+    size_t size,
+    uint8_t* type,
+    uint8_t** data)
+{
+    ssize_t ret = 0;
+    myst_gcm_auth_t auth;
+    uint8_t* p = record + MYST_TLS_HEADER_SIZE;
+    ssize_t n;
+
+    if (!tls || !record || !type || !data)
+        ERAISE(-EINVAL);
+
+    ECHECK((n = myst_ktls_record_size(tls, record)));
+
+    if ((size_t)n != size)
+        ERAISE(-EINVAL);
+
+    if (tls->version == TLS_1_3_VERSION)
+    {
+        size_t len = size - MYST_TLS_HEADER_SIZE - MYST_GCM_TAG_SIZE;
+
+        _get_auth(tls, 0, record, NULL, 0, &auth);
+        ECHECK(myst_gcm_open(tls->gcm, &auth, p, p, len));
+
+        /* strip the padding: the type is the last byte that is not zero */
+        while (len && p[len - 1] == 0)
+            len--;
+
+        if (len == 0)
+            ERAISE(-EBADMSG);
+
+        *type = p[--len];
+        *data = p;
+        ret = (ssize_t)len;
+    }
+    else
+    {
+        const size_t len = size - MYST_TLS_HEADER_SIZE - EXPLICIT_NONCE_SIZE -
+                           MYST_GCM_TAG_SIZE;
+        uint8_t* q = p + EXPLICIT_NONCE_SIZE;
+
+        _get_auth(tls, record[0], record, p, len, &auth);
+        ECHECK(myst_gcm_open(tls->gcm, &auth, q, q, len));
+
+        *type = record[0];
+        *data = q;
+        ret = (ssize_t)len;
+    }
+
+    tls->seq++;
+
+done:
+    return ret;
+}
@@ -0,0 +1,150 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <myst/atexit.h>
+#include <myst/eraise.h>
+#include <myst/fs.h>
+#include <myst/kernel.h>
+#include <myst/layoutprofile.h>
+#include <myst/printf.h>
+#include <myst/spinlock.h>
+
+/* the hashes of the paths recorded so far (open addressing, zero is free) */
+#define MAX_PATHS 65536
+#define NUM_SLOTS (2 * MAX_PATHS)
+
+static myst_fs_t* _fs;
+static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
+static uint64_t* _slots;
+static size_t _num_paths;
+
+/* the kernel's own counts (the host may change those of the profile) */
+static size_t _size;
+static size_t _dropped;
+
+static void _free_slots(void* arg)
+{
+    (void)arg;
+    free(_slots);
+    _slots = NULL;
+}
+
+int myst_layout_profile_set_fs(myst_fs_t* fs)
+{
+    int ret = 0;
+
+    if (!__myst_kernel_args.layout_profile)
+        goto done;
+
+    if (!fs)
+        ERAISE(-EINVAL);
+
+    if (!_slots)
+    {
+        if (!(_slots = calloc(NUM_SLOTS, sizeof(uint64_t))))
+            ERAISE(-ENOMEM);
+
+        myst_atexit(_free_slots, NULL);
+    }
+
+    _fs = fs;
+
+done:
+    return ret;
+}
+
+/* FNV-1a (never zero) */
+static uint64_t _hash(const char* s, size_t n)
+{
+    uint64_t h = 14695981039346656037UL;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211UL;
+    }
+
+    return h ? h : 1;
+}
+
+/* Add the hash: 1 if added, 0 if there already, -1 if the set is full */
+static int _insert(uint64_t h)
+{
+    size_t i = h % NUM_SLOTS;
+
+    while (_slots[i])
+    {
+        if (_slots[i] == h)
+            return 0;
+
+        i = (i + 1) % NUM_SLOTS;
+    }
+
+    if (_num_paths == MAX_PATHS)
+        return -1;
+
+    _slots[i] = h;
+    _num_paths++;
+    return 1;
+}
+
+void myst_layout_profile_record(myst_fs_t* fs, myst_file_t* file)
+{
+    myst_layout_profile_t* profile = __myst_kernel_args.layout_profile;
+    char path[PATH_MAX];
+    struct stat st;
+    size_t len;
+    uint64_t h;
+
+    if (!profile || !_fs || fs != _fs || !file)
+        return;
+
+    if ((*fs->fs_fstat)(fs, file, &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+
+    /* the path after symbolic links (the rootfs is mounted on "/") */
+    if ((*fs->fs_realpath)(fs, file, path, sizeof(path)) != 0)
+        return;
+
+    /* a newline would split the line in the profile */
+    if (strchr(path, '\n'))
+        return;
+
+    len = strlen(path);
+    h = _hash(path, len);
+
+    myst_spin_lock(&_lock);
+
+    switch (_insert(h))
+    {
+        case 0:
+            break;
+        case 1:
+        {
+            /* the profile is in host memory, so only write it */
+            if (_size + len + 1 <= sizeof(profile->data))
+            {
+                memcpy(&profile->data[_size], path, len);
+                profile->data[_size + len] = '\n';
+                _size += len + 1;
+                profile->size = _size;
+                break;
+            }
+
+            /* fall through */
+        }
+        default:
+        {
+            profile->dropped = ++_dropped;
+            break;
+        }
+    }
+
+    myst_spin_unlock(&_lock);
+}
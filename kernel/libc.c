@@ -12,6 +12,7 @@
 #include <myst/eraise.h>
 #include <myst/kernel.h>
 #include <myst/list.h>
+#include <myst/memops.h>
 #include <myst/panic.h>
 #include <myst/printf.h>
 #include <myst/spinlock.h>
@@ -29,6 +30,25 @@
 
 #define USE_LOOP_UNROLLING
 
+/* the CPU features for the versions below (none until myst_init_memops()) */
+static uint32_t _memops;
+
+void myst_init_memops(void)
+{
+    _memops = myst_memops_detect();
+}
+
+uint32_t myst_get_memops(void)
+{
+    return _memops;
+}
+
+/* Whether rep movsb or rep stosb is the fastest for n bytes */
+static bool _use_erms(size_t n)
+{
+    return n >= MYST_MEMOPS_ERMS_THRESHOLD && (_memops & MYST_MEMOPS_ERMS);
+}
+
 char* strdup(const char* s)
 {
     char* p;
@@ -71,6 +91,20 @@ void* memset(void* s, int c, size_t n)
 {
     uint8_t* p = (uint8_t*)s;
 
+    if (n >= 16)
+    {
+        if (_use_erms(n))
+            myst_memset_erms(s, c, n);
+        else if (n >= 64 && (_memops & MYST_MEMOPS_AVX512))
+            myst_memset_avx512(s, c, n);
+        else if (n >= 32 && (_memops & MYST_MEMOPS_AVX2))
+            myst_memset_avx2(s, c, n);
+        else
+            myst_memset_sse2(s, c, n);
+
+        return s;
+    }
+
     /* if s is 8-byte aligned */
     if (((uint64_t)p & 0x0000000000000007) == 0)
     {
@@ -119,6 +153,21 @@ void* memcpy(void* dest, const void* src, size_t n)
     uint8_t* p = (uint8_t*)dest;
     const uint8_t* q = (const uint8_t*)src;
 
+    /* these copy forward, as memmove() expects */
+    if (n >= 16)
+    {
+        if (_use_erms(n))
+            myst_memcpy_erms(dest, src, n);
+        else if (n >= 64 && (_memops & MYST_MEMOPS_AVX512))
+            myst_memcpy_avx512(dest, src, n);
+        else if (n >= 32 && (_memops & MYST_MEMOPS_AVX2))
+            myst_memcpy_avx2(dest, src, n);
+        else
+            myst_memcpy_sse2(dest, src, n);
+
+        return dest;
+    }
+
     /* if dest and src are 8-byte aligned */
     if (((uint64_t)p & 0x0000000000000007) == 0 &&
         ((uint64_t)q & 0x0000000000000007) == 0)
@@ -165,6 +214,21 @@ int memcmp(const void* s1, const void* s2, size_t n)
     unsigned char* p = (unsigned char*)s1;
     unsigned char* q = (unsigned char*)s2;
 
+    if (n >= 16)
+    {
+        size_t i;
+
+        if (n >= 32 && (_memops & MYST_MEMOPS_AVX2))
+            i = myst_mismatch_avx2(s1, s2, n);
+        else
+            i = myst_mismatch_sse2(s1, s2, n);
+
+        if (i == n)
+            return 0;
+
+        return p[i] < q[i] ? -1 : 1;
+    }
+
     while (n--)
     {
         if (*p < *q)
@@ -202,39 +266,11 @@ void* memmove(void* dest_, const void* src_, size_t n)
 
 size_t strlen(const char* s)
 {
-#ifdef USE_LOOP_UNROLLING
+    /* SSE2 is part of x86-64, so there is always a vector version */
+    if (_memops & MYST_MEMOPS_AVX2)
+        return myst_strlen_avx2(s);
 
-    const char* p = s;
-
-    while (p[0] && p[1] && p[2] && p[3] && p[4] && p[5])
-        p += 6;
-
-    if (!p[0])
-        return (size_t)(p - s);
-    if (!p[1])
-        return (size_t)(p - s + 1);
-    if (!p[2])
-        return (size_t)(p - s + 2);
-    if (!p[3])
-        return (size_t)(p - s + 3);
-    if (!p[4])
-        return (size_t)(p - s + 4);
-    if (!p[5])
-        return (size_t)(p - s + 5);
-
-    /* Unreachable */
-    return 0;
-
-#else /* USE_LOOP_UNROLLING */
-
-    size_t n = 0;
-
-    while (*s++)
-        n++;
-
-    return n;
-
-#endif /* USE_LOOP_UNROLLING */
+    return myst_strlen_sse2(s);
 }
 
 int strcmp(const char* s1, const char* s2)
@@ -0,0 +1,692 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <elf.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <myst/cond.h>
+#include <myst/eraise.h>
+#include <myst/fs.h>
+#include <myst/kernel.h>
+#include <myst/libprefetch.h>
+#include <myst/mount.h>
+#include <myst/mutex.h>
+#include <myst/thread.h>
+#include <myst/time.h>
+
+/*
+**==============================================================================
+**
+** Shared library prefetch (started by the --prefetch-libs option).
+**
+**     After an exec, the dynamic loader of the CRT opens, reads and maps
+**     the DT_NEEDED libraries of the program one after the other, and each
+**     one pays for its path search (the failed opens along the library
+**     path) and for reading its blocks from ext2 (and the verity or LUKS
+**     device under it). Programs like Python and .NET need dozens of them.
+**
+**     With the option, myst_exec() queues the program for the prefetch
+**     thread, which parses the dynamic sections of the program and of its
+**     libraries (breadth first, as the loader loads them), finds each
+**     library along the same paths as the loader (LD_LIBRARY_PATH, the
+**     DT_RUNPATH or DT_RPATH of the objects that need it, then the system
+**     path), and then reads the libraries through the file system. The
+**     loader, which meanwhile relocates and starts the program, later finds
+**     the directory entries, the inodes and the blocks in the caches. Files
+**     of file systems that keep their bytes in memory (ramfs) are not read,
+**     since there is nothing to page in.
+**
+**     The prefetch is only a hint: errors are dropped, and a full queue
+**     drops the exec.
+**
+**==============================================================================
+*/
+
+/* the library path of the musl dynamic loader unless SYS_PATH_FILE exists */
+#define DEFAULT_SYS_PATH "/lib:/usr/local/lib:/usr/lib"
+#define SYS_PATH_FILE "/etc/ld-musl-x86_64.path"
+#define SYS_PATH_MAX 4096
+
+/* the separators of library paths (as for the loader) */
+#define PATH_SEPARATORS ":\n"
+
+/* the most program headers and dynamic entries read from one object */
+#define MAX_PHDRS 64
+#define MAX_DYNS 1024
+
+typedef struct request
+{
+    struct request* next;
+    char* ld_library_path; /* null if the environment has none */
+    char path[];
+} request_t;
+
+typedef struct object
+{
+    char* path;
+    char* rpath; /* with $ORIGIN expanded (or null) */
+    ssize_t parent; /* the object that needs this one (-1 for the program) */
+} object_t;
+
+/* the program and the libraries of one request */
+typedef struct objects
+{
+    object_t objects[MYST_LIB_PREFETCH_MAX_LIBS + 1];
+    size_t count;
+} objects_t;
+
+/* the buffers of _scan() (too large for the stack) */
+typedef struct scan_buf
+{
+    char name[PATH_MAX];
+    char path[PATH_MAX];
+    char origin[PATH_MAX];
+} scan_buf_t;
+
+static myst_mutex_t _lock;
+static myst_cond_t _cond; /* signaled when a request is queued */
+static request_t* _head;
+static request_t* _tail;
+static size_t _count;
+static bool _running;
+static _Atomic(bool) _stopping;
+static _Atomic(bool) _exited;
+
+static int _open(const char* path, myst_fs_t** fs_out, myst_file_t** file_out)
+{
+    int ret = 0;
+    char suffix[PATH_MAX];
+    myst_fs_t* fs;
+
+    ECHECK_QUIET(myst_mount_resolve(path, suffix, &fs));
+    ECHECK_QUIET((*fs->fs_open)(fs, suffix, O_RDONLY, 0, fs_out, file_out));
+
+done:
+    return ret;
+}
+
+static bool _is_file(const char* path)
+{
+    char suffix[PATH_MAX];
+    myst_fs_t* fs;
+    struct stat st;
+
+    if (myst_mount_resolve(path, suffix, &fs) != 0 ||
+        (*fs->fs_stat)(fs, suffix, &st) != 0)
+    {
+        return false;
+    }
+
+    return S_ISREG(st.st_mode);
+}
+
+/* Read exactly n bytes at off */
+static int _pread(
+    myst_fs_t* fs,
+    myst_file_t* file,
+    void* buf,
+    size_t n,
+    off_t off)
+{
+    ssize_t r = (*fs->fs_pread)(fs, file, buf, n, off);
+    return (r >= 0 && (size_t)r == n) ? 0 : -ENOEXEC;
+}
+
+/* Read the null-terminated string at off (which must fit in size bytes) */
+static int _pread_string(
+    myst_fs_t* fs,
+    myst_file_t* file,
+    char* buf,
+    size_t size,
+    off_t off)
+{
+    ssize_t r = (*fs->fs_pread)(fs, file, buf, size, off);
+
+    if (r <= 0 || !memchr(buf, '\0', (size_t)r))
+        return -ENOEXEC;
+
+    return 0;
+}
+
+/* The file offset of a virtual address of the object */
+static int _offset(
+    const Elf64_Phdr* phdrs,
+    size_t phnum,
+    uint64_t vaddr,
+    off_t* off)
+{
+    for (size_t i = 0; i < phnum; i++)
+    {
+        const Elf64_Phdr* ph = &phdrs[i];
+
+        if (ph->p_type == PT_LOAD && vaddr >= ph->p_vaddr &&
+            vaddr - ph->p_vaddr < ph->p_filesz)
+        {
+            *off = (off_t)(ph->p_offset + (vaddr - ph->p_vaddr));
+            return 0;
+        }
+    }
+
+    return -ENOEXEC;
+}
+
+/* Whether the loader maps the name to the CRT itself rather than loading a
+ * file (see load_library() in musl's ldso/dynlink.c) */
+static bool _is_builtin(const char* name)
+{
+    static const char* _names[] = {
+        "c", "pthread", "rt", "m", "dl", "util", "xnet"};
+
+    if (strncmp(name, "ld-musl-", 8) == 0 ||
+        strncmp(name, "libc.musl-", 10) == 0)
+    {
+        return true;
+    }
+
+    if (strncmp(name, "lib", 3) != 0)
+        return false;
+
+    for (size_t i = 0; i < sizeof(_names) / sizeof(_names[0]); i++)
+    {
+        const size_t len = strlen(_names[i]);
+        const char* rest = name + 3 + len;
+
+        if (strncmp(name + 3, _names[i], len) == 0 &&
+            (*rest == '\0' || strncmp(rest, ".so", 3) == 0))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Expand $ORIGIN and ${ORIGIN} in an rpath (into a new string) */
+static char* _expand_origin(const char* rpath, const char* origin)
+{
+    const size_t olen = strlen(origin);
+    size_t size = strlen(rpath) + 1;
+    char* s;
+    char* p;
+
+    /* each expansion grows the string by at most the origin */
+    for (const char* q = rpath; (q = strstr(q, "$ORIGIN")); q++)
+        size += olen;
+
+    for (const char* q = rpath; (q = strstr(q, "${ORIGIN}")); q++)
+        size += olen;
+
+    if (!(p = s = malloc(size)))
+        return NULL;
+
+    while (*rpath)
+    {
+        if (strncmp(rpath, "${ORIGIN}", 9) == 0)
+        {
+            memcpy(p, origin, olen);
+            p += olen;
+            rpath += 9;
+        }
+        else if (strncmp(rpath, "$ORIGIN", 7) == 0)
+        {
+            memcpy(p, origin, olen);
+            p += olen;
+            rpath += 7;
+        }
+        else
+        {
+            *p++ = *rpath++;
+        }
+    }
+
+    *p = '\0';
+    return s;
+}
+
+/* Find the name in the directories of a library path (skipping relative
+ * directories, which depend on the cwd of the loader) */
+static int _search(const char* dirs, const char* name, char path[PATH_MAX])
+{
+    const size_t nlen = strlen(name);
+
+    for (const char* p = dirs; p && *p;)
+    {
+        size_t len;
+
+        p += strspn(p, PATH_SEPARATORS);
+        len = strcspn(p, PATH_SEPARATORS);
+
+        if (len && p[0] == '/' && len + 1 + nlen < PATH_MAX)
+        {
+            memcpy(path, p, len);
+            path[len] = '/';
+            memcpy(path + len + 1, name, nlen + 1);
+
+            if (_is_file(path))
+                return 0;
+        }
+
+        p += len;
+    }
+
+    return -ENOENT;
+}
+
+/* Find a library needed by the object at index (in the loader's order) */
+static int _find(
+    const objects_t* objs,
+    size_t index,
+    const char* ld_library_path,
+    const char* sys_path,
+    const char* name,
+    char path[PATH_MAX])
+{
+    if (strchr(name, '/'))
+    {
+        if (name[0] != '/' || strlen(name) >= PATH_MAX)
+            return -ENOENT;
+
+        strcpy(path, name);
+        return 0;
+    }
+
+    if (_search(ld_library_path, name, path) == 0)
+        return 0;
+
+    for (ssize_t i = (ssize_t)index; i >= 0; i = objs->objects[i].parent)
+    {
+        if (_search(objs->objects[i].rpath, name, path) == 0)
+            return 0;
+    }
+
+    return _search(sys_path, name, path);
+}
+
+static bool _contains(const objects_t* objs, const char* path)
+{
+    for (size_t i = 0; i < objs->count; i++)
+    {
+        if (strcmp(objs->objects[i].path, path) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/* Append the libraries that the object at index needs (and that are not
+ * there yet) to the objects */
+static int _scan(
+    objects_t* objs,
+    size_t index,
+    const char* ld_library_path,
+    const char* sys_path)
+{
+    int ret = 0;
+    object_t* obj = &objs->objects[index];
+    myst_fs_t* fs = NULL;
+    myst_file_t* file = NULL;
+    scan_buf_t* buf = NULL;
+    Elf64_Ehdr eh;
+    Elf64_Phdr phdrs[MAX_PHDRS];
+    const Elf64_Phdr* dynamic = NULL;
+    Elf64_Dyn* dyns = NULL;
+    size_t ndyns;
+    uint64_t strtab = 0;
+    off_t strtab_off;
+    const Elf64_Dyn* rpath = NULL;
+
+    if (!(buf = malloc(sizeof(scan_buf_t))))
+        ERAISE(-ENOMEM);
+
+    ECHECK_QUIET(_open(obj->path, &fs, &file));
+
+    /* read the ELF header and the program headers */
+    ECHECK_QUIET(_pread(fs, file, &eh, sizeof(eh), 0));
+
+    if (memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh.e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh.e_phentsize != sizeof(Elf64_Phdr) || eh.e_phnum > MAX_PHDRS)
+    {
+        ERAISE_QUIET(-ENOEXEC);
+    }
+
+    ECHECK_QUIET(_pread(
+        fs, file, phdrs, eh.e_phnum * sizeof(Elf64_Phdr), (off_t)eh.e_phoff));
+
+    for (size_t i = 0; i < eh.e_phnum; i++)
+    {
+        if (phdrs[i].p_type == PT_DYNAMIC)
+            dynamic = &phdrs[i];
+    }
+
+    /* a static program needs nothing */
+    if (!dynamic)
+        goto done;
+
+    /* read the dynamic section */
+    if ((ndyns = dynamic->p_filesz / sizeof(Elf64_Dyn)) > MAX_DYNS)
+        ndyns = MAX_DYNS;
+
+    if (!(dyns = malloc(ndyns * sizeof(Elf64_Dyn))))
+        ERAISE(-ENOMEM);
+
+    ECHECK_QUIET(_pread(
+        fs,
+        file,
+        dyns,
+        ndyns * sizeof(Elf64_Dyn),
+        (off_t)dynamic->p_offset));
+
+    /* DT_RUNPATH takes precedence over DT_RPATH (as for musl) */
+    for (size_t i = 0; i < ndyns && dyns[i].d_tag != DT_NULL; i++)
+    {
+        if (dyns[i].d_tag == DT_STRTAB)
+            strtab = dyns[i].d_un.d_ptr;
+        else if (dyns[i].d_tag == DT_RUNPATH)
+            rpath = &dyns[i];
+        else if (dyns[i].d_tag == DT_RPATH && !rpath)
+            rpath = &dyns[i];
+    }
+
+    ECHECK_QUIET(_offset(phdrs, eh.e_phnum, strtab, &strtab_off));
+
+    /* the rpath is searched for the libraries of this object's needs too */
+    if (rpath)
+    {
+        const off_t off = strtab_off + (off_t)rpath->d_un.d_val;
+        char* slash;
+
+        ECHECK_QUIET(_pread_string(fs, file, buf->name, PATH_MAX, off));
+
+        strcpy(buf->origin, obj->path);
+
+        if ((slash = strrchr(buf->origin, '/')))
+            *slash = '\0';
+
+        if (!(obj->rpath = _expand_origin(buf->name, buf->origin)))
+            ERAISE(-ENOMEM);
+    }
+
+    for (size_t i = 0; i < ndyns && dyns[i].d_tag != DT_NULL; i++)
+    {
+        const off_t off = strtab_off + (off_t)dyns[i].d_un.d_val;
+        object_t* lib;
+
+        if (dyns[i].d_tag != DT_NEEDED)
+            continue;
+
+        if (_pread_string(fs, file, buf->name, PATH_MAX, off) != 0 ||
+            _is_builtin(buf->name))
+        {
+            continue;
+        }
+
+        if (_find(
+                objs, index, ld_library_path, sys_path, buf->name, buf->path) ||
+            _contains(objs, buf->path))
+        {
+            continue;
+        }
+
+        if (objs->count == MYST_LIB_PREFETCH_MAX_LIBS + 1)
+            break;
+
+        lib = &objs->objects[objs->count];
+
+        if (!(lib->path = strdup(buf->path)))
+            ERAISE(-ENOMEM);
+
+        lib->rpath = NULL;
+        lib->parent = (ssize_t)index;
+        objs->count++;
+    }
+
+done:
+
+    if (file)
+        (*fs->fs_close)(fs, file);
+
+    free(dyns);
+    free(buf);
+
+    return ret;
+}
+
+/* Read the system library path of the loader (or null for the default) */
+static char* _load_sys_path(void)
+{
+    myst_fs_t* fs;
+    myst_file_t* file;
+    char* path;
+    ssize_t n;
+
+    if (_open(SYS_PATH_FILE, &fs, &file) != 0)
+        return NULL;
+
+    if ((path = malloc(SYS_PATH_MAX)))
+    {
+        if ((n = (*fs->fs_pread)(fs, file, path, SYS_PATH_MAX - 1, 0)) < 0)
+            n = 0;
+
+        path[n] = '\0';
+    }
+
+    (*fs->fs_close)(fs, file);
+    return path;
+}
+
+/* Read the library through its file system, which keeps the blocks in its
+ * caches for the loader */
+static void _read(const char* path, void* buf)
+{
+    myst_fs_t* fs;
+    myst_file_t* file;
+    off_t off = 0;
+    ssize_t n;
+
+    if (_open(path, &fs, &file) != 0)
+        return;
+
+    /* in-memory file systems have nothing to page in */
+    if (!fs->fs_pread_direct)
+    {
+        while (!_stopping &&
+               (n = (*fs->fs_pread)(
+                    fs, file, buf, MYST_LIB_PREFETCH_CHUNK_SIZE, off)) > 0)
+        {
+            off += n;
+        }
+    }
+
+    (*fs->fs_close)(fs, file);
+}
+
+static void _prefetch(const request_t* req)
+{
+    objects_t* objs;
+    char* sys_path = NULL;
+    void* buf = NULL;
+
+    if (!(objs = calloc(1, sizeof(objects_t))))
+        return;
+
+    if (!(objs->objects[0].path = strdup(req->path)))
+        goto done;
+
+    objs->objects[0].parent = -1;
+    objs->count = 1;
+    sys_path = _load_sys_path();
+
+    /* find all the libraries first: those are small reads, after which the
+     * reads of the libraries stay ahead of the loader */
+    for (size_t i = 0; i < objs->count && !_stopping; i++)
+    {
+        _scan(
+            objs,
+            i,
+            req->ld_library_path,
+            sys_path ? sys_path : DEFAULT_SYS_PATH);
+    }
+
+    /* the loader maps the program itself right away */
+    if (!(buf = malloc(MYST_LIB_PREFETCH_CHUNK_SIZE)))
+        goto done;
+
+    for (size_t i = 1; i < objs->count && !_stopping; i++)
+        _read(objs->objects[i].path, buf);
+
+done:
+
+    for (size_t i = 0; i < objs->count; i++)
+    {
+        free(objs->objects[i].path);
+        free(objs->objects[i].rpath);
+    }
+
+    free(objs);
+    free(sys_path);
+    free(buf);
+}
+
+static void _free_request(request_t* req)
+{
+    free(req->ld_library_path);
+    free(req);
+}
+
+static int _prefetcher(void* arg)
+{
+    (void)arg;
+
+    myst_mutex_lock(&_lock);
+
+    for (;;)
+    {
+        request_t* req;
+
+        while (!_head && !_stopping)
+            myst_cond_wait(&_cond, &_lock);
+
+        if (_stopping)
+            break;
+
+        req = _head;
+
+        if (!(_head = req->next))
+            _tail = NULL;
+
+        _count--;
+
+        myst_mutex_unlock(&_lock);
+        _prefetch(req);
+        _free_request(req);
+        myst_mutex_lock(&_lock);
+    }
+
+    /* drop the requests not reached */
+    while (_head)
+    {
+        request_t* next = _head->next;
+        _free_request(_head);
+        _head = next;
+    }
+
+    _tail = NULL;
+    _count = 0;
+    _running = false;
+    myst_mutex_unlock(&_lock);
+    _exited = true;
+
+    return 0;
+}
+
+int myst_start_lib_prefetcher(void)
+{
+    int ret = 0;
+
+    if (!__myst_kernel_args.prefetch_libs)
+        goto done;
+
+    _running = true;
+
+    if (myst_create_kernel_thread(_prefetcher, NULL, "kprefetch") != 0)
+    {
+        _running = false;
+        ERAISE(-EAGAIN);
+    }
+
+done:
+    return ret;
+}
+
+void myst_stop_lib_prefetcher(void)
+{
+    bool running;
+
+    myst_mutex_lock(&_lock);
+    running = _running;
+    _stopping = true;
+    myst_cond_signal(&_cond);
+    myst_mutex_unlock(&_lock);
+
+    /* Wait ~1 second for the prefetcher to finish its reads and exit */
+    for (size_t i = 0; running && i < 1000 && !_exited; i++)
+        myst_sleep_msec(1);
+}
+
+void myst_prefetch_libs(const char* path, size_t envc, const char* envp[])
+{
+    const char* ld_library_path = NULL;
+    request_t* req;
+    size_t len;
+    bool queued = false;
+
+    if (!__myst_kernel_args.prefetch_libs || !path || path[0] != '/')
+        return;
+
+    for (size_t i = 0; envp && i < envc && envp[i]; i++)
+    {
+        if (strncmp(envp[i], "LD_LIBRARY_PATH=", 16) == 0)
+            ld_library_path = envp[i] + 16;
+    }
+
+    if ((len = strlen(path)) >= PATH_MAX)
+        return;
+
+    if (!(req = malloc(sizeof(request_t) + len + 1)))
+        return;
+
+    req->next = NULL;
+    memcpy(req->path, path, len + 1);
+    req->ld_library_path = NULL;
+
+    if (ld_library_path && !(req->ld_library_path = strdup(ld_library_path)))
+    {
+        free(req);
+        return;
+    }
+
+    myst_mutex_lock(&_lock);
+
+    if (_running && !_stopping && _count < MYST_LIB_PREFETCH_QUEUE_SIZE)
+    {
+        if (_tail)
+            _tail->next = req;
+        else
+            _head = req;
+
+        _tail = req;
+        _count++;
+        queued = true;
+        myst_cond_signal(&_cond);
+    }
+
+    myst_mutex_unlock(&_lock);
+
+    if (!queued)
+        _free_request(req);
+}
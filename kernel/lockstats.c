@@ -0,0 +1,398 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+/* this implements the counted locks, so call them directly */
+#define MYST_NO_LOCK_STATS
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <myst/console.h>
+#include <myst/eraise.h>
+#include <myst/lockstats.h>
+#include <myst/mutex.h>
+#include <myst/syscallstats.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+
+/* the locks being held, by address (for their hold times) */
+#define HELD_SLOTS 4096
+#define HELD_PROBES 8
+
+typedef struct held
+{
+    uintptr_t lock; /* zero if the slot is free */
+    myst_lock_site_t* site;
+    uint64_t start;
+} held_t;
+
+static held_t _held[HELD_SLOTS];
+
+static myst_lock_site_t* _sites;
+
+static const char* _kind_names[] = {"spin", "ticket", "mutex"};
+
+static void _register(myst_lock_site_t* site)
+{
+    uint32_t expected = 0;
+
+    if (__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE))
+        return;
+
+    if (!__atomic_compare_exchange_n(
+            &site->registered,
+            &expected,
+            1,
+            false,
+            __ATOMIC_ACQ_REL,
+            __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    /* sites are never removed, so a plain push is enough */
+    site->next = __atomic_load_n(&_sites, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(
+        &_sites, &site->next, site, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+static size_t _hash(const void* lock)
+{
+    const uintptr_t x = (uintptr_t)lock;
+    return (size_t)((x >> 3) ^ (x >> 15)) % HELD_SLOTS;
+}
+
+/* Note that the lock was just acquired at this site */
+static void _acquired(const void* lock, myst_lock_site_t* site)
+{
+    const size_t h = _hash(lock);
+
+    for (size_t i = 0; i < HELD_PROBES; i++)
+    {
+        held_t* p = &_held[(h + i) % HELD_SLOTS];
+        uintptr_t expected = 0;
+
+        if (__atomic_compare_exchange_n(
+                &p->lock,
+                &expected,
+                (uintptr_t)lock,
+                false,
+                __ATOMIC_ACQUIRE,
+                __ATOMIC_RELAXED))
+        {
+            p->site = site;
+            p->start = myst_syscall_stats_now();
+            return;
+        }
+    }
+
+    /* the slots are full here: the hold time goes unmeasured */
+}
+
+/* Note that the lock is about to be released */
+static void _releasing(const void* lock)
+{
+    const size_t h = _hash(lock);
+
+    for (size_t i = 0; i < HELD_PROBES; i++)
+    {
+        held_t* p = &_held[(h + i) % HELD_SLOTS];
+
+        if (__atomic_load_n(&p->lock, __ATOMIC_RELAXED) == (uintptr_t)lock)
+        {
+            myst_lock_site_t* site = p->site;
+            const uint64_t hold = myst_syscall_stats_now() - p->start;
+            uint64_t max = __atomic_load_n(&site->max_hold_nsec, 0);
+
+            __atomic_store_n(&p->lock, 0, __ATOMIC_RELEASE);
+
+            while (hold > max &&
+                   !__atomic_compare_exchange_n(
+                       &site->max_hold_nsec,
+                       &max,
+                       hold,
+                       true,
+                       __ATOMIC_RELAXED,
+                       __ATOMIC_RELAXED))
+                ;
+
+            return;
+        }
+    }
+}
+
+/* Count an acquisition (that waited since start if contended) */
+static void _count(myst_lock_site_t* site, bool contended, uint64_t start)
+{
+    _register(site);
+    __atomic_fetch_add(&site->acquisitions, 1, __ATOMIC_RELAXED);
+
+    if (contended)
+    {
+        const uint64_t wait = myst_syscall_stats_now() - start;
+
+        __atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&site->wait_nsec, wait, __ATOMIC_RELAXED);
+    }
+}
+
+void myst_lockstats_spin_lock(myst_spinlock_t* s, myst_lock_site_t* site)
+{
+    if (__atomic_exchange_n(s, 1, __ATOMIC_ACQUIRE) == 0)
+    {
+        _count(site, false, 0);
+    }
+    else
+    {
+        const uint64_t start = myst_syscall_stats_now();
+        myst_spin_lock(s);
+        _count(site, true, start);
+    }
+
+    _acquired((const void*)s, site);
+}
+
+void myst_lockstats_spin_unlock(myst_spinlock_t* s)
+{
+    _releasing((const void*)s);
+    myst_spin_unlock(s);
+}
+
+void myst_lockstats_ticket_lock(myst_ticketlock_t* t, myst_lock_site_t* site)
+{
+    if (myst_ticket_trylock(t))
+    {
+        _count(site, false, 0);
+    }
+    else
+    {
+        const uint64_t start = myst_syscall_stats_now();
+        myst_ticket_lock(t);
+        _count(site, true, start);
+    }
+
+    _acquired(t, site);
+}
+
+bool myst_lockstats_ticket_trylock(myst_ticketlock_t* t, myst_lock_site_t* site)
+{
+    if (!myst_ticket_trylock(t))
+        return false;
+
+    _count(site, false, 0);
+    _acquired(t, site);
+    return true;
+}
+
+void myst_lockstats_ticket_unlock(myst_ticketlock_t* t)
+{
+    _releasing(t);
+    myst_ticket_unlock(t);
+}
+
+/* Whether the caller holds the mutex once (not recursively) */
+static bool _held_once(myst_mutex_t* m)
+{
+    return m->owner == myst_thread_self() && m->refs == 1;
+}
+
+int myst_lockstats_mutex_lock(myst_mutex_t* m, myst_lock_site_t* site)
+{
+    int ret;
+
+    if (!m)
+        return EINVAL;
+
+    if (myst_mutex_trylock(m) == 0)
+    {
+        _count(site, false, 0);
+    }
+    else
+    {
+        const uint64_t start = myst_syscall_stats_now();
+
+        if ((ret = myst_mutex_lock(m)) != 0)
+            return ret;
+
+        _count(site, true, start);
+    }
+
+    if (_held_once(m))
+        _acquired(m, site);
+
+    return 0;
+}
+
+int myst_lockstats_mutex_trylock(myst_mutex_t* m, myst_lock_site_t* site)
+{
+    int ret;
+
+    if ((ret = myst_mutex_trylock(m)) != 0)
+        return ret;
+
+    _count(site, false, 0);
+
+    if (_held_once(m))
+        _acquired(m, site);
+
+    return 0;
+}
+
+int myst_lockstats_mutex_unlock(myst_mutex_t* m)
+{
+    if (m && _held_once(m))
+        _releasing(m);
+
+    return myst_mutex_unlock(m);
+}
+
+/*
+**==============================================================================
+**
+** Formatting the statistics
+**
+**==============================================================================
+*/
+
+static int _appendf(myst_buf_t* buf, const char* fmt, ...)
+{
+    char tmp[256];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return -EINVAL;
+
+    if ((size_t)n >= sizeof(tmp))
+        n = sizeof(tmp) - 1;
+
+    return myst_buf_append(buf, tmp, (size_t)n);
+}
+
+static int _compare_sites(const void* p1, const void* p2)
+{
+    const myst_lock_site_t* s1 = (const myst_lock_site_t*)p1;
+    const myst_lock_site_t* s2 = (const myst_lock_site_t*)p2;
+
+    if (s1->wait_nsec != s2->wait_nsec)
+        return s1->wait_nsec > s2->wait_nsec ? -1 : 1;
+
+    if (s1->contended != s2->contended)
+        return s1->contended > s2->contended ? -1 : 1;
+
+    if (s1->acquisitions != s2->acquisitions)
+        return s1->acquisitions > s2->acquisitions ? -1 : 1;
+
+    return 0;
+}
+
+/* Copy the counts, which other threads keep updating */
+static void _snapshot(myst_lock_site_t* copy, const myst_lock_site_t* site)
+{
+    *copy = *site;
+    copy->acquisitions = __atomic_load_n(&site->acquisitions, 0);
+    copy->contended = __atomic_load_n(&site->contended, 0);
+    copy->wait_nsec = __atomic_load_n(&site->wait_nsec, 0);
+    copy->max_hold_nsec = __atomic_load_n(&site->max_hold_nsec, 0);
+}
+
+static const char* _basename(const char* path)
+{
+    const char* p = strrchr(path, '/');
+    return p ? p + 1 : path;
+}
+
+int myst_format_lock_stats(myst_buf_t* buf)
+{
+    int ret = 0;
+    myst_lock_site_t* sites = NULL;
+    size_t n = 0;
+    size_t i = 0;
+
+    if (!buf)
+        ERAISE(-EINVAL);
+
+#ifndef MYST_ENABLE_LOCK_STATS
+    ECHECK(_appendf(
+        buf,
+        "lock statistics are disabled "
+        "(build with MYST_ENABLE_LOCK_STATS=1)\n"));
+    goto done;
+#endif
+
+    for (myst_lock_site_t* p = __atomic_load_n(&_sites, __ATOMIC_ACQUIRE); p;
+         p = p->next)
+    {
+        n++;
+    }
+
+    if (!(sites = calloc(n ? n : 1, sizeof(myst_lock_site_t))))
+        ERAISE(-ENOMEM);
+
+    /* sites registered since counting are left for the next time */
+    for (myst_lock_site_t* p = __atomic_load_n(&_sites, __ATOMIC_ACQUIRE);
+         p && i < n;
+         p = p->next)
+    {
+        _snapshot(&sites[i++], p);
+    }
+
+    qsort(sites, i, sizeof(myst_lock_site_t), _compare_sites);
+
+    ECHECK(_appendf(
+        buf,
+        "%-6s %12s %10s %12s %12s  %s\n",
+        "kind",
+        "acquired",
+        "contended",
+        "wait-usecs",
+        "max-hold-us",
+        "site"));
+
+    for (size_t j = 0; j < i; j++)
+    {
+        const myst_lock_site_t* s = &sites[j];
+
+        ECHECK(_appendf(
+            buf,
+            "%-6s %12lu %10lu %12lu %12lu  %s:%u (%s)\n",
+            s->kind < MYST_COUNTOF(_kind_names) ? _kind_names[s->kind] : "?",
+            s->acquisitions,
+            s->contended,
+            s->wait_nsec / 1000,
+            s->max_hold_nsec / 1000,
+            _basename(s->file),
+            s->line,
+            s->func));
+    }
+
+done:
+
+    if (sites)
+        free(sites);
+
+    return ret;
+}
+
+void myst_dump_lock_stats(void)
+{
+    myst_buf_t buf = MYST_BUF_INITIALIZER;
+
+    /* write directly since myst_eprintf() truncates long output */
+    if (myst_format_lock_stats(&buf) == 0)
+    {
+        myst_console_flush();
+        myst_tcall_write_console(STDERR_FILENO, buf.data, buf.size);
+    }
+
+    myst_buf_release(&buf);
+}
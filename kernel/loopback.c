@@ -0,0 +1,247 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+
+#include <myst/eraise.h>
+#include <myst/fdtable.h>
+#include <myst/kernel.h>
+#include <myst/loopback.h>
+#include <myst/sockdev.h>
+#include <myst/unixdev.h>
+
+bool myst_loopback_address(const struct sockaddr* addr, socklen_t addrlen)
+{
+    if (!addr)
+        return false;
+
+    if (addr->sa_family == AF_INET && addrlen >= sizeof(struct sockaddr_in))
+    {
+        const struct sockaddr_in* sin = (const struct sockaddr_in*)addr;
+        return (ntohl(sin->sin_addr.s_addr) >> 24) == IN_LOOPBACKNET;
+    }
+
+    if (addr->sa_family == AF_INET6 && addrlen >= sizeof(struct sockaddr_in6))
+    {
+        const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*)addr;
+        const struct in6_addr* a = &sin6->sin6_addr;
+
+        if (IN6_IS_ADDR_LOOPBACK(a))
+            return true;
+
+        /* ::ffff:127.x.x.x */
+        return IN6_IS_ADDR_V4MAPPED(a) && a->s6_addr[12] == IN_LOOPBACKNET;
+    }
+
+    return false;
+}
+
+/* Get the host socket behind sockfd if it may move for this address */
+static int _get_host_sock(
+    int sockfd,
+    const struct sockaddr* addr,
+    socklen_t addrlen,
+    myst_sockdev_t** sd,
+    myst_sock_t** sock)
+{
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+
+    if (!__myst_kernel_args.enclave_loopback)
+        return -ENOTSUP;
+
+    if (!myst_loopback_address(addr, addrlen))
+        return -ENOTSUP;
+
+    /* let the regular path report a bad descriptor (the host socket is
+     * closed once moved, so it must not be shared with a cloned table) */
+    if (myst_fdtable_unshare(fdtable, sockfd) != 0 ||
+        myst_fdtable_get_sock(fdtable, sockfd, sd, sock) != 0)
+        return -ENOTSUP;
+
+    /* unix and already moved sockets have nothing to move */
+    if (*sd != myst_sockdev_get())
+        return -ENOTSUP;
+
+    return 0;
+}
+
+/* Replace the host socket with an in-kernel socket of the same kind; moves
+ * only sockets of the family of addr and of the given type (zero for stream
+ * or datagram) */
+static int _move(
+    int sockfd,
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    const struct sockaddr* addr,
+    int want_type,
+    int (*prepare)(myst_sockdev_t*, myst_sock_t*, const void*),
+    const void* arg,
+    myst_sock_t** new_sock_out)
+{
+    int ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    myst_sockdev_t* ud = myst_unixdev_get();
+    myst_sock_t* new_sock = NULL;
+    int domain;
+    int type;
+    socklen_t len = sizeof(int);
+    int flags;
+    int fdflags;
+
+    ECHECK((*sd->sd_getsockopt)(
+        sd, sock, SOL_SOCKET, SO_DOMAIN, &domain, &len));
+    ECHECK((*sd->sd_getsockopt)(sd, sock, SOL_SOCKET, SO_TYPE, &type, &len));
+
+    if (domain != addr->sa_family || (want_type && type != want_type) ||
+        (type != SOCK_STREAM && type != SOCK_DGRAM))
+    {
+        ERAISE_QUIET(-ENOTSUP);
+    }
+
+    ECHECK(flags = (*sd->sd_fcntl)(sd, sock, F_GETFL, 0));
+    ECHECK(fdflags = (*sd->sd_fcntl)(sd, sock, F_GETFD, 0));
+
+    if (flags & O_NONBLOCK)
+        type |= SOCK_NONBLOCK;
+
+    if (fdflags & FD_CLOEXEC)
+        type |= SOCK_CLOEXEC;
+
+    ECHECK((*ud->sd_socket)(ud, domain, type, 0, &new_sock));
+
+    /* bind or connect before the move so that a failure leaves fd alone */
+    if (prepare)
+        ECHECK((*prepare)(ud, new_sock, arg));
+
+    ECHECK(myst_fdtable_replace(
+        fdtable, sockfd, sock, MYST_FDTABLE_TYPE_SOCK, ud, new_sock));
+
+    myst_fdtable_retire(fdtable, &sd->fdops, sock);
+
+    if (new_sock_out)
+        *new_sock_out = new_sock;
+
+    new_sock = NULL;
+
+done:
+
+    if (new_sock)
+        (*ud->sd_close)(ud, new_sock);
+
+    return ret;
+}
+
+typedef struct address
+{
+    const struct sockaddr* addr;
+    socklen_t addrlen;
+} address_t;
+
+static int _bind(myst_sockdev_t* ud, myst_sock_t* sock, const void* arg)
+{
+    const address_t* a = arg;
+    return (*ud->sd_bind)(ud, sock, a->addr, a->addrlen);
+}
+
+static int _connect(myst_sockdev_t* ud, myst_sock_t* sock, const void* arg)
+{
+    const address_t* a = arg;
+    return (*ud->sd_connect)(ud, sock, a->addr, a->addrlen);
+}
+
+long myst_loopback_bind(
+    int sockfd,
+    const struct sockaddr* addr,
+    socklen_t addrlen)
+{
+    long ret = 0;
+    myst_sockdev_t* sd;
+    myst_sock_t* sock;
+    const address_t a = {addr, addrlen};
+
+    ECHECK_QUIET(ret = _get_host_sock(sockfd, addr, addrlen, &sd, &sock));
+    ECHECK(_move(sockfd, sd, sock, addr, 0, _bind, &a, NULL));
+
+done:
+    return ret;
+}
+
+long myst_loopback_connect(
+    int sockfd,
+    const struct sockaddr* addr,
+    socklen_t addrlen)
+{
+    long ret = 0;
+    myst_sockdev_t* sd;
+    myst_sock_t* sock;
+    const address_t a = {addr, addrlen};
+    int type;
+
+    ECHECK_QUIET(ret = _get_host_sock(sockfd, addr, addrlen, &sd, &sock));
+
+    /* only connect in the enclave to what is bound in the enclave */
+    if ((type = myst_unixdev_bound_type(addr, addrlen)) < 0)
+        ERAISE_QUIET(-ENOTSUP);
+
+    ECHECK(_move(sockfd, sd, sock, addr, type, _connect, &a, NULL));
+
+done:
+    return ret;
+}
+
+long myst_loopback_sendto(
+    int sockfd,
+    const void* buf,
+    size_t len,
+    int flags,
+    const struct sockaddr* dest_addr,
+    socklen_t addrlen)
+{
+    long ret = 0;
+    myst_sockdev_t* sd;
+    myst_sock_t* sock;
+    myst_sockdev_t* ud = myst_unixdev_get();
+    myst_sock_t* new_sock;
+    const struct sockaddr* name = dest_addr;
+
+    ECHECK_QUIET(ret = _get_host_sock(sockfd, name, addrlen, &sd, &sock));
+
+    if (myst_unixdev_bound_type(name, addrlen) != SOCK_DGRAM)
+        ERAISE_QUIET(-ENOTSUP);
+
+    ECHECK(_move(sockfd, sd, sock, name, SOCK_DGRAM, NULL, NULL, &new_sock));
+    ret = (*ud->sd_sendto)(ud, new_sock, buf, len, flags, dest_addr, addrlen);
+
+done:
+    return ret;
+}
+
+long myst_loopback_sendmsg(int sockfd, const struct msghdr* msg, int flags)
+{
+    long ret = 0;
+    myst_sockdev_t* sd;
+    myst_sock_t* sock;
+    myst_sockdev_t* ud = myst_unixdev_get();
+    myst_sock_t* new_sock;
+    const struct sockaddr* name;
+    socklen_t namelen;
+
+    if (!msg)
+        ERAISE_QUIET(-ENOTSUP);
+
+    name = msg->msg_name;
+    namelen = msg->msg_namelen;
+
+    ECHECK_QUIET(ret = _get_host_sock(sockfd, name, namelen, &sd, &sock));
+
+    if (myst_unixdev_bound_type(name, namelen) != SOCK_DGRAM)
+        ERAISE_QUIET(-ENOTSUP);
+
+    ECHECK(_move(sockfd, sd, sock, name, SOCK_DGRAM, NULL, NULL, &new_sock));
+    ret = (*ud->sd_sendmsg)(ud, new_sock, msg, flags);
+
+done:
+    return ret;
+}
@@ -22,10 +22,11 @@
 #include <myst/backtrace.h>
 #include <myst/crash.h>
 #include <myst/kernel.h>
-#include <myst/list.h>
 #include <myst/mmanutils.h>
 #include <myst/panic.h>
 #include <myst/printf.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
 
 static void _dlmalloc_abort(void)
 {
@@ -103,101 +104,497 @@ static int _dlmalloc_munmap(void* addr, size_t length)
 
 #include "../third_party/dlmalloc/malloc.c"
 
+/*
+**==============================================================================
+**
+** Per-thread caches:
+**
+**     Small blocks are cached per thread in size classes (multiples of
+**     MALLOC_CACHE_GRANULE bytes) so that most allocations and releases avoid
+**     the global dlmalloc lock. An empty class is refilled with
+**     MALLOC_CACHE_BATCH blocks at once (dlindependent_comalloc) and a full
+**     class returns half of its blocks at once (dlbulk_free). Cached blocks
+**     are linked through their first word. A thread's cache is flushed when
+**     the thread becomes a zombie (see myst_zombify_thread()).
+**
+**==============================================================================
+*/
+
+#define MALLOC_CACHE_GRANULE 16
+#define MALLOC_CACHE_CLASSES 32
+#define MALLOC_CACHE_BATCH 8
+#define MALLOC_CACHE_MAX 32
+
+struct myst_malloc_cache
+{
+    myst_malloc_cache_t* prev;
+    myst_malloc_cache_t* next;
+    void* bins[MALLOC_CACHE_CLASSES + 1];
+    size_t counts[MALLOC_CACHE_CLASSES + 1];
+    size_t hits;
+    size_t misses;
+};
+
+/* Installed in threads whose cache has been released */
+static myst_malloc_cache_t _released_cache;
+
+/* List of live caches (for gathering statistics) */
+static myst_malloc_cache_t* _caches;
+static myst_spinlock_t _caches_lock = MYST_SPINLOCK_INITIALIZER;
+
+/* Statistics of caches that have been released */
+static size_t _cache_hits;
+static size_t _cache_misses;
+
+static myst_malloc_cache_t* _get_cache(void)
+{
+    myst_thread_t* thread = (myst_thread_t*)myst_get_tsd();
+    myst_malloc_cache_t* cache;
+
+    /* Bypass the caches during startup before the first thread exists */
+    if (!myst_valid_thread(thread))
+        return NULL;
+
+    if ((cache = thread->malloc_cache))
+        return (cache == &_released_cache) ? NULL : cache;
+
+    if (!(cache = dlcalloc(1, sizeof(myst_malloc_cache_t))))
+        return NULL;
+
+    myst_spin_lock(&_caches_lock);
+    {
+        if ((cache->next = _caches))
+            _caches->prev = cache;
+
+        _caches = cache;
+    }
+    myst_spin_unlock(&_caches_lock);
+
+    thread->malloc_cache = cache;
+
+    return cache;
+}
+
+static void _cache_flush(myst_malloc_cache_t* cache, size_t c, size_t n)
+{
+    void* ptrs[MALLOC_CACHE_MAX];
+    size_t m = 0;
+
+    while (m < n && m < MALLOC_CACHE_MAX && cache->bins[c])
+    {
+        ptrs[m++] = cache->bins[c];
+        cache->bins[c] = *(void**)cache->bins[c];
+    }
+
+    cache->counts[c] -= m;
+    dlbulk_free(ptrs, m);
+}
+
+static void* _cache_alloc(myst_malloc_cache_t* cache, size_t size)
+{
+    const size_t g = MALLOC_CACHE_GRANULE;
+    size_t c = size ? (size + g - 1) / g : 1;
+    void* p;
+
+    if (c > MALLOC_CACHE_CLASSES)
+        return dlmalloc(size);
+
+    if (!(p = cache->bins[c]))
+    {
+        size_t sizes[MALLOC_CACHE_BATCH];
+        void* chunks[MALLOC_CACHE_BATCH];
+
+        cache->misses++;
+
+        for (size_t i = 0; i < MALLOC_CACHE_BATCH; i++)
+            sizes[i] = c * g;
+
+        if (!dlindependent_comalloc(MALLOC_CACHE_BATCH, sizes, chunks))
+            return NULL;
+
+        /* Return the first block and cache the others */
+        for (size_t i = MALLOC_CACHE_BATCH - 1; i > 0; i--)
+        {
+            *(void**)chunks[i] = cache->bins[c];
+            cache->bins[c] = chunks[i];
+        }
+
+        cache->counts[c] += MALLOC_CACHE_BATCH - 1;
+        return chunks[0];
+    }
+
+    cache->hits++;
+    cache->bins[c] = *(void**)p;
+    cache->counts[c]--;
+
+    return p;
+}
+
+static void _cache_free(myst_malloc_cache_t* cache, void* ptr)
+{
+    /* A block serves any class whose size does not exceed its own */
+    size_t c = dlmalloc_usable_size(ptr) / MALLOC_CACHE_GRANULE;
+
+    if (c == 0 || c > MALLOC_CACHE_CLASSES)
+    {
+        dlfree(ptr);
+        return;
+    }
+
+    *(void**)ptr = cache->bins[c];
+    cache->bins[c] = ptr;
+
+    if (++cache->counts[c] > MALLOC_CACHE_MAX)
+        _cache_flush(cache, c, MALLOC_CACHE_MAX / 2);
+}
+
+static void* _malloc(size_t size)
+{
+    myst_malloc_cache_t* cache;
+
+    if ((cache = _get_cache()))
+        return _cache_alloc(cache, size);
+
+    return dlmalloc(size);
+}
+
+static void _free(void* ptr)
+{
+    myst_malloc_cache_t* cache;
+
+    if (ptr && (cache = _get_cache()))
+        _cache_free(cache, ptr);
+    else
+        dlfree(ptr);
+}
+
+void myst_release_malloc_cache(myst_malloc_cache_t** cache_ptr)
+{
+    myst_malloc_cache_t* cache;
+
+    if (!cache_ptr)
+        return;
+
+    /* Later allocations by this thread bypass the caches */
+    cache = *cache_ptr;
+    *cache_ptr = &_released_cache;
+
+    if (!cache || cache == &_released_cache)
+        return;
+
+    for (size_t c = 1; c <= MALLOC_CACHE_CLASSES; c++)
+    {
+        while (cache->bins[c])
+            _cache_flush(cache, c, MALLOC_CACHE_MAX);
+    }
+
+    myst_spin_lock(&_caches_lock);
+    {
+        if (cache->prev)
+            cache->prev->next = cache->next;
+        else
+            _caches = cache->next;
+
+        if (cache->next)
+            cache->next->prev = cache->prev;
+
+        _cache_hits += cache->hits;
+        _cache_misses += cache->misses;
+    }
+    myst_spin_unlock(&_caches_lock);
+
+    dlfree(cache);
+}
+
+/*
+**==============================================================================
+**
+** Leak checker (MYST_ENABLE_LEAK_CHECKER):
+**
+**     Live allocations are recorded in a hash table keyed by address. The
+**     table is split into LEAK_SHARDS shards (each with its own lock) so that
+**     threads rarely contend. When MYST_LEAK_CHECKER_SAMPLE_BYTES is
+**     non-zero, only about one allocation per that many bytes is recorded
+**     (larger allocations are proportionally more likely to be recorded) and
+**     each record is weighted by the number of bytes it represents. Usage
+**     statistics are exact in either case.
+**
+**==============================================================================
+*/
+
 #define MAX_BACKTRACE_ADDRS 16
 
+static myst_malloc_stats_t _malloc_stats;
+
 #ifdef MYST_ENABLE_LEAK_CHECKER
-static myst_list_t _list;
-static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
+
+#ifndef MYST_LEAK_CHECKER_SAMPLE_BYTES
+#define MYST_LEAK_CHECKER_SAMPLE_BYTES 0
 #endif
 
-static myst_malloc_stats_t _malloc_stats;
+#define LEAK_SHARDS 64
+#define LEAK_CHAINS 256
 
-#ifdef MYST_ENABLE_LEAK_CHECKER
 typedef struct node
 {
-    myst_list_node_t base;
+    struct node* next;
     void* ptr;
     size_t size;
+    size_t weight;
+    uint64_t stack;
     void* addrs[MAX_BACKTRACE_ADDRS];
     size_t num_addrs;
 } node_t;
+
+typedef struct shard
+{
+    myst_spinlock_t lock;
+    node_t* chains[LEAK_CHAINS];
+} __attribute__((aligned(64))) shard_t;
+
+static shard_t _shards[LEAK_SHARDS];
+static _Atomic(size_t) _num_nodes;
+#if MYST_LEAK_CHECKER_SAMPLE_BYTES
+static _Atomic(size_t) _sample_bytes;
 #endif
 
-#ifdef MYST_ENABLE_LEAK_CHECKER
-static node_t* _new_node(void* ptr, size_t size)
+static uint64_t _hash_ptr(const void* ptr)
+{
+    return ((uint64_t)ptr >> 4) * 0x9e3779b97f4a7c15;
+}
+
+static shard_t* _get_shard(const void* ptr, node_t*** chain)
 {
-    node_t* p;
+    uint64_t h = _hash_ptr(ptr);
+    shard_t* shard = &_shards[(h >> 32) % LEAK_SHARDS];
 
-    if (!(p = dlmalloc(sizeof(node_t))))
-        return NULL;
+    *chain = &shard->chains[(h >> 48) % LEAK_CHAINS];
+    return shard;
+}
 
-    p->ptr = ptr;
-    p->size = size;
-    p->num_addrs = myst_backtrace(p->addrs, MYST_COUNTOF(p->addrs));
+static void _update_usage(void* ptr, bool add)
+{
+    size_t n = dlmalloc_usable_size(ptr);
 
-    return p;
+    if (add)
+    {
+        size_t usage = __atomic_add_fetch(
+            &_malloc_stats.usage, n, __ATOMIC_RELAXED);
+        size_t peak = __atomic_load_n(
+            &_malloc_stats.peak_usage, __ATOMIC_RELAXED);
+
+        while (usage > peak && !__atomic_compare_exchange_n(
+                                   &_malloc_stats.peak_usage,
+                                   &peak,
+                                   usage,
+                                   true,
+                                   __ATOMIC_RELAXED,
+                                   __ATOMIC_RELAXED))
+            ;
+    }
+    else
+    {
+        __atomic_sub_fetch(&_malloc_stats.usage, n, __ATOMIC_RELAXED);
+    }
 }
+
+/* Decide whether to record an allocation and how many bytes it represents */
+static size_t _sample(size_t size)
+{
+#if MYST_LEAK_CHECKER_SAMPLE_BYTES
+    const size_t rate = MYST_LEAK_CHECKER_SAMPLE_BYTES;
+    size_t before;
+
+    before = __atomic_fetch_add(&_sample_bytes, size, __ATOMIC_RELAXED);
+
+    /* Record allocations that cross a multiple of the sampling rate */
+    if (before / rate == (before + size) / rate)
+        return 0;
+
+    return size > rate ? size : rate;
+#else
+    return size ? size : 1;
 #endif
+}
 
-#ifdef MYST_ENABLE_LEAK_CHECKER
 static int _add_node(void* ptr, size_t size)
 {
     node_t* node;
+    node_t** chain;
+    shard_t* shard;
+    size_t weight;
+
+    _update_usage(ptr, true);
+
+    if (!(weight = _sample(size)))
+        return 0;
 
-    if (!(node = _new_node(ptr, size)))
+    if (!(node = dlmalloc(sizeof(node_t))))
         return -1;
 
-    myst_spin_lock(&_lock);
-    {
-        myst_list_append(&_list, (myst_list_node_t*)node);
-        _malloc_stats.usage += size;
+    node->ptr = ptr;
+    node->size = size;
+    node->weight = weight;
+    node->num_addrs = myst_backtrace(node->addrs, MYST_COUNTOF(node->addrs));
+    node->stack = 0;
+
+    for (size_t i = 0; i < node->num_addrs; i++)
+        node->stack = (node->stack ^ (uint64_t)node->addrs[i]) * 0x100000001b3;
+
+    shard = _get_shard(ptr, &chain);
 
-        if (_malloc_stats.usage > _malloc_stats.peak_usage)
-            _malloc_stats.peak_usage = _malloc_stats.usage;
+    myst_spin_lock(&shard->lock);
+    {
+        node->next = *chain;
+        *chain = node;
     }
-    myst_spin_unlock(&_lock);
+    myst_spin_unlock(&shard->lock);
+
+    _num_nodes++;
 
     return 0;
 }
-#endif
 
-#ifdef MYST_ENABLE_LEAK_CHECKER
 static int _remove_node(void* ptr)
 {
     node_t* node = NULL;
+    node_t** chain;
+    shard_t* shard = _get_shard(ptr, &chain);
+
+    _update_usage(ptr, false);
 
-    myst_spin_lock(&_lock);
+    myst_spin_lock(&shard->lock);
     {
-        for (myst_list_node_t* p = _list.head; p; p = p->next)
+        for (node_t** p = chain; *p; p = &(*p)->next)
         {
-            node_t* tmp = (node_t*)p;
-
-            if (tmp->ptr == ptr)
+            if ((*p)->ptr == ptr)
             {
-                node = tmp;
-                _malloc_stats.usage -= node->size;
-                myst_list_remove(&_list, p);
+                node = *p;
+                *p = node->next;
                 break;
             }
         }
     }
-    myst_spin_unlock(&_lock);
+    myst_spin_unlock(&shard->lock);
 
     if (node)
     {
+        _num_nodes--;
         dlfree(node);
         return 0;
     }
 
-    return -1;
+    /* Unsampled allocations have no node */
+    return MYST_LEAK_CHECKER_SAMPLE_BYTES ? 0 : -1;
 }
+
+typedef struct site
+{
+    uint64_t stack;
+    size_t count;
+    size_t bytes;
+    void* addrs[MAX_BACKTRACE_ADDRS];
+    size_t num_addrs;
+} site_t;
+
+/* Aggregate the recorded allocations by backtrace into SITES */
+static size_t _gather_sites(site_t* sites, size_t capacity)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < LEAK_SHARDS; i++)
+    {
+        shard_t* shard = &_shards[i];
+
+        myst_spin_lock(&shard->lock);
+
+        for (size_t j = 0; j < LEAK_CHAINS; j++)
+        {
+            for (const node_t* p = shard->chains[j]; p; p = p->next)
+            {
+                /* Open addressing (CAPACITY is a power of two) */
+                size_t k = p->stack & (capacity - 1);
+
+                while (sites[k].count && sites[k].stack != p->stack)
+                    k = (k + 1) & (capacity - 1);
+
+                if (sites[k].count == 0)
+                {
+                    /* Keep the table at most half full */
+                    if (2 * (n + 1) > capacity)
+                        continue;
+
+                    sites[k].stack = p->stack;
+                    memcpy(sites[k].addrs, p->addrs, sizeof(p->addrs));
+                    sites[k].num_addrs = p->num_addrs;
+                    n++;
+                }
+
+                sites[k].count++;
+                sites[k].bytes += p->weight;
+            }
+        }
+
+        myst_spin_unlock(&shard->lock);
+    }
+
+    return n;
+}
+
+#endif /* MYST_ENABLE_LEAK_CHECKER */
+
+int myst_dump_malloc_top(size_t max)
+{
+#ifdef MYST_ENABLE_LEAK_CHECKER
+    size_t capacity = 64;
+    site_t* sites;
+
+    /* Allow for allocations made while the table is being filled */
+    while (capacity < 4 * _num_nodes)
+        capacity *= 2;
+
+    if (!(sites = dlcalloc(capacity, sizeof(site_t))))
+        return -ENOMEM;
+
+    _gather_sites(sites, capacity);
+
+    /* Select the heaviest sites one at a time */
+    for (size_t i = 0; i < max; i++)
+    {
+        site_t* top = NULL;
+
+        for (size_t j = 0; j < capacity; j++)
+        {
+            if (sites[j].count && (!top || sites[j].bytes > top->bytes))
+                top = &sites[j];
+        }
+
+        if (!top)
+            break;
+
+        myst_eprintf(
+            "*** kernel allocation site %zu: bytes=%zu count=%zu\n",
+            i,
+            top->bytes,
+            top->count);
+        myst_dump_backtrace(top->addrs, top->num_addrs);
+        myst_eprintf("\n");
+        top->count = 0;
+    }
+
+    dlfree(sites);
+    return 0;
+#else
+    (void)max;
+    return -ENOTSUP;
 #endif
+}
 
 void* malloc(size_t size)
 {
     void* p = NULL;
 
-    if (!(p = dlmalloc(size)))
+    if (!(p = _malloc(size)))
         return NULL;
 
 #ifdef MYST_ENABLE_LEAK_CHECKER
@@ -212,11 +609,23 @@ void* calloc(size_t nmemb, size_t size)
 {
     void* p = NULL;
 
-    if (!(p = dlcalloc(nmemb, size)))
+    size_t n;
+
+    if (__builtin_mul_overflow(nmemb, size, &n))
+        return NULL;
+
+    /* Small blocks come from the caches and must be cleared here */
+    if (n <= MALLOC_CACHE_CLASSES * MALLOC_CACHE_GRANULE)
+    {
+        if (!(p = _malloc(n)))
+            return NULL;
+
+        memset(p, 0, n);
+    }
+    else if (!(p = dlcalloc(nmemb, size)))
         return NULL;
 
 #ifdef MYST_ENABLE_LEAK_CHECKER
-    size_t n = nmemb * size;
     if (_add_node(p, n) != 0)
         myst_panic("unexpected");
 #endif
@@ -234,7 +643,14 @@ void* realloc(void* ptr, size_t size)
 #endif
 
     if (!(p = dlrealloc(ptr, size)))
+    {
+#ifdef MYST_ENABLE_LEAK_CHECKER
+        /* PTR is still allocated */
+        if (ptr && size && _add_node(ptr, dlmalloc_usable_size(ptr)) != 0)
+            myst_panic("unexpected");
+#endif
         return NULL;
+    }
 
 #ifdef MYST_ENABLE_LEAK_CHECKER
     if (_add_node(p, size) != 0)
@@ -261,12 +677,13 @@ void* memalign(size_t alignment, size_t size)
 
 void free(void* ptr)
 {
-    dlfree(ptr);
-
 #ifdef MYST_ENABLE_LEAK_CHECKER
+    /* Remove first since the block may be reused as soon as it is freed */
     if (ptr && _remove_node(ptr) != 0)
         myst_panic("unexpected");
 #endif
+
+    _free(ptr);
 }
 
 int myst_find_leaks(void)
@@ -274,15 +691,19 @@ int myst_find_leaks(void)
 #ifdef MYST_ENABLE_LEAK_CHECKER
     int ret = 0;
 
-    for (myst_list_node_t* p = _list.head; p; p = p->next)
+    for (size_t i = 0; i < LEAK_SHARDS; i++)
     {
-        node_t* node = (node_t*)p;
-
-        myst_eprintf(
-            "*** kernel leak: ptr=%p size=%zu\n", node->ptr, node->size);
-        myst_dump_backtrace(node->addrs, node->num_addrs);
-        myst_eprintf("\n");
-        ret = -1;
+        for (size_t j = 0; j < LEAK_CHAINS; j++)
+        {
+            for (node_t* p = _shards[i].chains[j]; p; p = p->next)
+            {
+                myst_eprintf(
+                    "*** kernel leak: ptr=%p size=%zu\n", p->ptr, p->size);
+                myst_dump_backtrace(p->addrs, p->num_addrs);
+                myst_eprintf("\n");
+                ret = -1;
+            }
+        }
     }
 
     if (_malloc_stats.usage != 0)
@@ -300,20 +721,25 @@ int myst_find_leaks(void)
 
 int myst_get_malloc_stats(myst_malloc_stats_t* stats)
 {
-#ifdef MYST_ENABLE_LEAK_CHECKER
-    {
-        if (!stats)
-            return -EINVAL;
+    if (!stats)
+        return -EINVAL;
 
-        myst_spin_lock(&_lock);
-        *stats = _malloc_stats;
-        myst_spin_unlock(&_lock);
+    stats->usage = __atomic_load_n(&_malloc_stats.usage, __ATOMIC_RELAXED);
+    stats->peak_usage =
+        __atomic_load_n(&_malloc_stats.peak_usage, __ATOMIC_RELAXED);
 
-        return 0;
+    myst_spin_lock(&_caches_lock);
+    {
+        stats->cache_hits = _cache_hits;
+        stats->cache_misses = _cache_misses;
+
+        for (myst_malloc_cache_t* p = _caches; p; p = p->next)
+        {
+            stats->cache_hits += p->hits;
+            stats->cache_misses += p->misses;
+        }
     }
-#else
-    (void)stats;
-    (void)_malloc_stats;
-    return -ENOTSUP;
-#endif
+    myst_spin_unlock(&_caches_lock);
+
+    return 0;
 }
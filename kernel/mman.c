@@ -59,54 +59,70 @@
 ** list, sorted by starting address. When VADs are freed (by the UNMAP
 ** operation), they are inserted to the singly-linked VAD free list.
 **
+** VADs are also organized into an AVL tree keyed by starting address. The
+** tree is augmented so that each node records the maximum gap size (the free
+** space to the right of a VAD) of the subtree for which it is the root. The
+** linked list is retained for O(1) access to neighboring VADs.
+**
+** COMMIT:
+** =======
+**
+** By default the entire memory space is committed when the enclave is
+** created. On hardware that supports dynamic memory management (SGX2 EDMM),
+** a commit callback (see myst_mman_set_commit()) lets the mman commit pages
+** only as the BREAK and MAPPED sections grow toward one another, and give
+** them back when those sections shrink. Memory is committed in chunks of
+** MYST_MMAN_COMMIT_CHUNK bytes, and one chunk of slack is kept on each side
+** to avoid thrashing. Gaps between VADs are left committed.
+**
+** ARENAS:
+** =======
+**
+** When arenas are enabled (see myst_mman_set_arenas()), small anonymous
+** mappings are carved out of per-key arenas rather than from the VAD tree.
+** Each arena reserves a chunk of MYST_MMAN_ARENA_PAGES pages with a single
+** MMAP and hands out pages from it under its own lock, so threads that map
+** keys to different arenas do not serialize on the mman lock. The VAD tree
+** treats the whole chunk as mapped; a bitmap in the arena tracks which pages
+** have been handed out.
+**
+** An arena is retired when it cannot satisfy a request, when a REMAP
+** overlaps it, or when MMAP runs out of memory. Retiring an arena unmaps its
+** free pages, after which the pages still handed out are ordinary mappings
+** owned by the VAD tree. An UNMAP gives the pages it covers in any arena
+** back to that arena (and unmaps the rest from the VAD tree), and a fixed
+** MMAP over arena pages marks them as handed out, so they are not handed
+** out a second time.
+**
+** FRAGMENTATION:
+** ==============
+**
+** Free memory is either the UNASSIGNED section or a gap between VADs, and
+** a gap merges with its neighbors (or the UNASSIGNED section) as soon as
+** the VADs between them are unmapped. Long-running programs still leave
+** many small gaps, which is why small mappings prefer the gaps that are not
+** large (see _mman_find_gap()). myst_mman_stats() reports the gaps by size
+** along with the largest free range, for /proc/myst/stats.
+**
 ** PERFORMANCE:
 ** ============
 **
-** The current implementation organizes VADs onto a simple linear linked list.
-** The time complexities of the related operations (MAP, REMAP, and UNMAP) are
-** all O(N), where N is the number of VADs in the linked list.
-**
-** In the worst case, N is the maximum number of pages, where a memory region
-** is assigned for every available page. For a 128 MB memory space, N is less
-** than 32,768.
-**
-** The MUSL memory allocator (malloc, realloc, calloc, free) uses both
-**
-**     - BREAK memory -- for allocations less than 56 pages
-**     - MAPPED memory -- for allocates greater or equal to 57 pages
-**
-** In this context, the time complexities of the mapping operations fall to
-** O(M), where M is:
-**
-**     NUM_PAGES = 32,768 pages
-**     SMALLEST_ALLOCATION = 57 pages
-**     M = NUM_PAGES / SMALLEST_ALLOCATION
-**     M = 574
-**
-** M will even be smaller when the VADs and BREAK regions are subtracted from
-** NUM_PAGES. A rough estimates puts the time complexity for the mapping
-** operations at about O(M), where M == 400.
-**
-** OPTIMIZATION:
-** =============
-**
-** To optimize performance, one might consider organizing the active VADs into
-** a balanced binary tree variant (AVL or red-black). Two operations must be
-** accounted for.
+** The tree supports the two lookups required by the mapping operations.
 **
 **     - Address lookup -- lookup the VAD that contains the given address
-**     - Gap lookup -- find a gap greater than a given size
+**     - Gap lookup -- find the lowest gap greater than a given size
 **
-** For address lookup a simple AVL tree will suffice such that the key is the
-** starting address of the VAD. The lookup function should check to see if the
-** address falls within the address range given by the VAD. Address lookup will
-** be O(log 2 N).
+** Address lookup descends the tree by starting address, checking whether the
+** address falls within the range given by each VAD. Gap lookup descends into
+** the leftmost subtree whose maximum gap is large enough, which preserves the
+** first-fit behavior of the original linear search. Both lookups are
+** O(log 2 N), where N is the number of VADs.
 **
-** Gap lookup is more complicated. The AVL tree could be extended so that each
-** node in the tree (that is each VAD) contains the maximum gap size of the
-** subtree for which it is a root. The lookup function simply looks for any
-** gap that is large enough. An alternative is to look for the best fit, but
-** this is not strictly necessary. Gap lookup will be O(log 2 N).
+** Updates that change the size or address of a VAD also change the gap of
+** its list predecessor, so the cached gaps are refreshed along the paths to
+** both nodes. Insertion, removal, and refresh are all O(log 2 N), making
+** MAP, REMAP, and UNMAP O(log 2 N) overall (excluding zero-filling and
+** scrubbing of memory).
 **
 **==============================================================================
 */
@@ -115,8 +131,10 @@
 #include <string.h>
 
 #include <errno.h>
+#include <myst/bits.h>
 #include <myst/defs.h>
 #include <myst/fsgs.h>
+#include <myst/memops.h>
 #include <myst/mman.h>
 #include <myst/round.h>
 #include <myst/spinlock.h>
@@ -191,6 +209,10 @@ static void _free_list_put(myst_mman_t* mman, myst_vad_t* vad)
     vad->size = 0;
     vad->prot = 0;
     vad->flags = 0;
+    vad->left = NULL;
+    vad->right = NULL;
+    vad->max_gap = 0;
+    vad->height = 0;
 
     /* Insert into singly-linked free list as first element */
     vad->next = mman->free_vads;
@@ -254,21 +276,336 @@ static void _list_remove(myst_mman_t* mman, myst_vad_t* vad)
     }
 }
 
+/*
+**==============================================================================
+**
+** _Tree functions
+**
+**     These functions maintain the AVL tree of active VADs. The right gap of
+**     a VAD is derived from its successor on the linked list, so the list
+**     must be updated before the tree.
+**
+**==============================================================================
+*/
+
+/* Get the height of a subtree (zero for the empty tree) */
+MYST_INLINE uint32_t _tree_height(const myst_vad_t* vad)
+{
+    return vad ? vad->height : 0;
+}
+
+/* Get the maximum gap (in pages) of a subtree (zero for the empty tree) */
+MYST_INLINE uint32_t _tree_max_gap(const myst_vad_t* vad)
+{
+    return vad ? vad->max_gap : 0;
+}
+
+/* Calculate the height and maximum gap of VAD from its children */
+static void _tree_calc(
+    myst_mman_t* mman,
+    myst_vad_t* vad,
+    uint32_t* height,
+    uint32_t* max_gap)
+{
+    uint32_t lheight = _tree_height(vad->left);
+    uint32_t rheight = _tree_height(vad->right);
+    uint32_t gap = (uint32_t)(_get_right_gap(mman, vad) / PAGE_SIZE);
+
+    if (_tree_max_gap(vad->left) > gap)
+        gap = _tree_max_gap(vad->left);
+
+    if (_tree_max_gap(vad->right) > gap)
+        gap = _tree_max_gap(vad->right);
+
+    *height = (lheight > rheight ? lheight : rheight) + 1;
+    *max_gap = gap;
+}
+
+/* Recalculate the height and maximum gap of VAD from its children */
+static void _tree_fix(myst_mman_t* mman, myst_vad_t* vad)
+{
+    _tree_calc(mman, vad, &vad->height, &vad->max_gap);
+}
+
+/* Rotate the subtree left and return the new subtree root */
+static myst_vad_t* _tree_rotate_left(myst_mman_t* mman, myst_vad_t* vad)
+{
+    myst_vad_t* right = vad->right;
+
+    vad->right = right->left;
+    right->left = vad;
+
+    _tree_fix(mman, vad);
+    _tree_fix(mman, right);
+
+    return right;
+}
+
+/* Rotate the subtree right and return the new subtree root */
+static myst_vad_t* _tree_rotate_right(myst_mman_t* mman, myst_vad_t* vad)
+{
+    myst_vad_t* left = vad->left;
+
+    vad->left = left->right;
+    left->right = vad;
+
+    _tree_fix(mman, vad);
+    _tree_fix(mman, left);
+
+    return left;
+}
+
+/* Fix VAD and restore the AVL property; return the new subtree root */
+static myst_vad_t* _tree_balance(myst_mman_t* mman, myst_vad_t* vad)
+{
+    uint32_t lheight = _tree_height(vad->left);
+    uint32_t rheight = _tree_height(vad->right);
+
+    if (lheight > rheight + 1)
+    {
+        myst_vad_t* left = vad->left;
+
+        if (_tree_height(left->right) > _tree_height(left->left))
+            vad->left = _tree_rotate_left(mman, left);
+
+        return _tree_rotate_right(mman, vad);
+    }
+
+    if (rheight > lheight + 1)
+    {
+        myst_vad_t* right = vad->right;
+
+        if (_tree_height(right->left) > _tree_height(right->right))
+            vad->right = _tree_rotate_right(mman, right);
+
+        return _tree_rotate_left(mman, vad);
+    }
+
+    _tree_fix(mman, vad);
+    return vad;
+}
+
+/* Insert VAD into the subtree rooted at NODE; return the new subtree root */
+static myst_vad_t* _tree_insert(
+    myst_mman_t* mman,
+    myst_vad_t* node,
+    myst_vad_t* vad)
+{
+    if (!node)
+    {
+        vad->left = NULL;
+        vad->right = NULL;
+        _tree_fix(mman, vad);
+        return vad;
+    }
+
+    if (vad->addr < node->addr)
+        node->left = _tree_insert(mman, node->left, vad);
+    else
+        node->right = _tree_insert(mman, node->right, vad);
+
+    return _tree_balance(mman, node);
+}
+
+/* Detach the leftmost node of a subtree into MIN; return the new root */
+static myst_vad_t* _tree_remove_min(
+    myst_mman_t* mman,
+    myst_vad_t* node,
+    myst_vad_t** min)
+{
+    if (!node->left)
+    {
+        *min = node;
+        return node->right;
+    }
+
+    node->left = _tree_remove_min(mman, node->left, min);
+    return _tree_balance(mman, node);
+}
+
+/* Remove VAD from the subtree rooted at NODE; return the new subtree root */
+static myst_vad_t* _tree_remove(
+    myst_mman_t* mman,
+    myst_vad_t* node,
+    myst_vad_t* vad)
+{
+    if (!node)
+        return NULL;
+
+    if (vad->addr < node->addr)
+    {
+        node->left = _tree_remove(mman, node->left, vad);
+    }
+    else if (vad->addr > node->addr)
+    {
+        node->right = _tree_remove(mman, node->right, vad);
+    }
+    else
+    {
+        myst_vad_t* left = node->left;
+        myst_vad_t* right = node->right;
+        myst_vad_t* min;
+
+        node->left = NULL;
+        node->right = NULL;
+
+        if (!right)
+            return left;
+
+        /* Replace the removed node with its in-order successor */
+        right = _tree_remove_min(mman, right, &min);
+        min->left = left;
+        min->right = right;
+        node = min;
+    }
+
+    return _tree_balance(mman, node);
+}
+
+/* Recalculate the maximum gaps along the path from NODE down to VAD */
+static void _tree_update(myst_mman_t* mman, myst_vad_t* node, myst_vad_t* vad)
+{
+    if (!node)
+        return;
+
+    if (vad->addr < node->addr)
+        _tree_update(mman, node->left, vad);
+    else if (vad->addr > node->addr)
+        _tree_update(mman, node->right, vad);
+
+    _tree_fix(mman, node);
+}
+
 /* Find a VAD that contains the given address */
-static myst_vad_t* _list_find(myst_mman_t* mman, uintptr_t addr)
+static myst_vad_t* _tree_find(myst_mman_t* mman, uintptr_t addr)
+{
+    myst_vad_t* p = mman->vad_tree;
+
+    while (p)
+    {
+        if (addr < p->addr)
+            p = p->left;
+        else if (addr >= _end(p))
+            p = p->right;
+        else
+            return p;
+    }
+
+    /* Not found */
+    return NULL;
+}
+
+/* Find the lowest VAD that ends above the given address */
+static myst_vad_t* _tree_find_next(myst_mman_t* mman, uintptr_t addr)
+{
+    myst_vad_t* p = mman->vad_tree;
+    myst_vad_t* next = NULL;
+
+    while (p)
+    {
+        if (addr < _end(p))
+        {
+            next = p;
+            p = p->left;
+        }
+        else
+        {
+            p = p->right;
+        }
+    }
+
+    return next;
+}
+
+/* Find the lowest VAD whose right gap is greater than or equal to SIZE */
+static myst_vad_t* _tree_find_gap(myst_mman_t* mman, size_t size)
 {
-    myst_vad_t* p;
+    myst_vad_t* p = mman->vad_tree;
+    size_t npages = size / PAGE_SIZE;
 
-    for (p = mman->vad_list; p; p = p->next)
+    if (!p || p->max_gap < npages)
+        return NULL;
+
+    while (p)
     {
-        if (addr >= p->addr && addr < _end(p))
+        if (_tree_max_gap(p->left) >= npages)
+            p = p->left;
+        else if (_get_right_gap(mman, p) >= size)
             return p;
+        else
+            p = p->right;
     }
 
     /* Not found */
     return NULL;
 }
 
+/* Find the lowest VAD in the subtree whose right gap is at least SIZE and
+ * less than LIMIT. Gaps of LIMIT or more do not prune the search, so it
+ * gives up after visiting *BUDGET VADs */
+static myst_vad_t* _tree_find_small_gap(
+    myst_mman_t* mman,
+    myst_vad_t* p,
+    size_t size,
+    size_t limit,
+    size_t* budget)
+{
+    myst_vad_t* q;
+    size_t gap;
+
+    if (!p || p->max_gap < size / PAGE_SIZE || *budget == 0)
+        return NULL;
+
+    (*budget)--;
+
+    if ((q = _tree_find_small_gap(mman, p->left, size, limit, budget)))
+        return q;
+
+    gap = _get_right_gap(mman, p);
+
+    if (gap >= size && gap < limit)
+        return p;
+
+    return _tree_find_small_gap(mman, p->right, size, limit, budget);
+}
+
+/* Check the tree rooted at NODE against the linked list (see is_sane) */
+static bool _tree_is_sane(
+    myst_mman_t* mman,
+    myst_vad_t* node,
+    myst_vad_t** last)
+{
+    uint32_t lheight;
+    uint32_t rheight;
+    uint32_t height;
+    uint32_t max_gap;
+
+    if (!node)
+        return true;
+
+    if (!_tree_is_sane(mman, node->left, last))
+        return false;
+
+    /* The in-order traversal must visit the VADs in list order */
+    if (node->prev != *last)
+        return false;
+
+    *last = node;
+
+    if (!_tree_is_sane(mman, node->right, last))
+        return false;
+
+    lheight = _tree_height(node->left);
+    rheight = _tree_height(node->right);
+
+    if (lheight > rheight + 1 || rheight > lheight + 1)
+        return false;
+
+    _tree_calc(mman, node, &height, &max_gap);
+
+    return node->height == height && node->max_gap == max_gap;
+}
+
 /*
 **==============================================================================
 **
@@ -280,7 +617,7 @@ static myst_vad_t* _list_find(myst_mman_t* mman, uintptr_t addr)
 /* Lock the mman and set the 'locked' parameter to true */
 MYST_INLINE void _mman_lock(myst_mman_t* mman, bool* locked)
 {
-    myst_spin_lock(&mman->lock);
+    myst_ticket_lock(&mman->lock);
     *locked = true;
 }
 
@@ -289,7 +626,7 @@ MYST_INLINE void _mman_unlock(myst_mman_t* mman, bool* locked)
 {
     if (*locked)
     {
-        myst_spin_unlock(&mman->lock);
+        myst_ticket_unlock(&mman->lock);
         *locked = false;
     }
 }
@@ -339,6 +676,152 @@ done:
     return vad;
 }
 
+/* Insert VAD after PREV into both the linked list and the tree */
+static void _mman_insert_vad(
+    myst_mman_t* mman,
+    myst_vad_t* prev,
+    myst_vad_t* vad)
+{
+    _list_insert_after(mman, prev, vad);
+    mman->vad_tree = _tree_insert(mman, mman->vad_tree, vad);
+
+    /* The gap to the right of PREV has shrunk */
+    if (prev)
+        _tree_update(mman, mman->vad_tree, prev);
+}
+
+/* Remove VAD from both the linked list and the tree */
+static void _mman_remove_vad(myst_mman_t* mman, myst_vad_t* vad)
+{
+    myst_vad_t* prev = vad->prev;
+
+    _list_remove(mman, vad);
+    mman->vad_tree = _tree_remove(mman, mman->vad_tree, vad);
+
+    /* The gap to the right of PREV has grown */
+    if (prev)
+        _tree_update(mman, mman->vad_tree, prev);
+}
+
+/* Refresh the tree after the address or size of VAD has changed */
+static void _mman_update_vad(myst_mman_t* mman, myst_vad_t* vad)
+{
+    _tree_update(mman, mman->vad_tree, vad);
+
+    /* The gap to the right of the previous VAD may have changed too */
+    if (vad->prev)
+        _tree_update(mman, mman->vad_tree, vad->prev);
+}
+
+/*
+**==============================================================================
+**
+** Commit functions:
+**
+**==============================================================================
+*/
+
+/* Commit the break memory below BRK if not already committed */
+static int _mman_commit_brk(myst_mman_t* mman, uintptr_t brk)
+{
+    uintptr_t end;
+
+    if (!mman->commit || brk <= mman->brk_commit)
+        return 0;
+
+    if (myst_round_up(brk - mman->start, MYST_MMAN_COMMIT_CHUNK, &end) != 0)
+        return -ENOMEM;
+
+    end += mman->start;
+
+    /* Do not overlap memory already committed for the MAPPED section */
+    if (end > mman->map_commit)
+        end = mman->map_commit;
+
+    if (end > mman->brk_commit)
+    {
+        void* addr = (void*)mman->brk_commit;
+        size_t size = end - mman->brk_commit;
+
+        if ((*mman->commit)(addr, size, true, mman->commit_arg) != 0)
+            return -ENOMEM;
+
+        mman->brk_commit = end;
+    }
+
+    return 0;
+}
+
+/* Commit the mapped memory above MAP if not already committed */
+static int _mman_commit_map(myst_mman_t* mman, uintptr_t map)
+{
+    uintptr_t size;
+    uintptr_t start;
+
+    if (!mman->commit || map >= mman->map_commit)
+        return 0;
+
+    if (myst_round_up(mman->end - map, MYST_MMAN_COMMIT_CHUNK, &size) != 0)
+        return -ENOMEM;
+
+    start = mman->end - size;
+
+    /* Do not overlap memory already committed for the BREAK section */
+    if (size > mman->end - mman->brk_commit)
+        start = mman->brk_commit;
+
+    if (start < mman->map_commit)
+    {
+        void* addr = (void*)start;
+        size_t size = mman->map_commit - start;
+
+        if ((*mman->commit)(addr, size, true, mman->commit_arg) != 0)
+            return -ENOMEM;
+
+        mman->map_commit = start;
+    }
+
+    return 0;
+}
+
+/* Decommit memory more than one chunk beyond the BRK and MAP values */
+static void _mman_decommit(myst_mman_t* mman)
+{
+    const size_t chunk = MYST_MMAN_COMMIT_CHUNK;
+    uintptr_t n;
+
+    if (!mman->commit)
+        return;
+
+    if (myst_round_up(mman->brk - mman->start, chunk, &n) == 0)
+    {
+        uintptr_t keep = mman->start + n;
+
+        if (mman->brk_commit > keep + chunk)
+        {
+            void* addr = (void*)keep;
+            size_t size = mman->brk_commit - keep;
+
+            if ((*mman->commit)(addr, size, false, mman->commit_arg) == 0)
+                mman->brk_commit = keep;
+        }
+    }
+
+    if (myst_round_up(mman->end - mman->map, chunk, &n) == 0)
+    {
+        uintptr_t keep = mman->end - n;
+
+        if (keep > mman->map_commit + chunk)
+        {
+            void* addr = (void*)mman->map_commit;
+            size_t size = keep - mman->map_commit;
+
+            if ((*mman->commit)(addr, size, false, mman->commit_arg) == 0)
+                mman->map_commit = keep;
+        }
+    }
+}
+
 /* Synchronize the MAP value to the address of the first list element */
 static void _mman_sync_top(myst_mman_t* mman)
 {
@@ -346,10 +829,144 @@ static void _mman_sync_top(myst_mman_t* mman)
         mman->map = mman->vad_list->addr;
     else
         mman->map = mman->end;
+
+    _mman_decommit(mman);
 }
 
 /*
-** Search for a gap (greater than or equal to SIZE) in the VAD list. Set
+**==============================================================================
+**
+** Scrub functions:
+**
+**     When scrubbing is deferred, unmapped ranges are queued on the dirty
+**     list rather than filled inline. Each mapping operation then scrubs up
+**     to MYST_MMAN_SCRUB_STEP bytes of queued ranges. A queued range that is
+**     handed out again is simply dropped from the list, since MMAP zero-fills
+**     memory before returning it. This also makes reuse of dirty gaps as
+**     cheap as reuse of clean ones, so the gap search need not prefer either.
+**
+**==============================================================================
+*/
+
+/* Scrub an unmapped range now or queue it for a later scrub step */
+static void _mman_scrub(myst_mman_t* mman, uintptr_t addr, size_t size)
+{
+    if (!mman->scrub || !size)
+        return;
+
+    if (mman->defer_scrub)
+    {
+        /* Extend the most recently queued range if contiguous */
+        if (mman->num_dirty)
+        {
+            myst_mman_range_t* r = &mman->dirty[mman->num_dirty - 1];
+
+            if (r->addr + r->size == addr)
+            {
+                r->size += size;
+                return;
+            }
+
+            if (addr + size == r->addr)
+            {
+                r->addr = addr;
+                r->size += size;
+                return;
+            }
+        }
+
+        if (mman->num_dirty < MYST_MMAN_MAX_DIRTY)
+        {
+            mman->dirty[mman->num_dirty].addr = addr;
+            mman->dirty[mman->num_dirty].size = size;
+            mman->num_dirty++;
+            return;
+        }
+    }
+
+    /* Scrub inline if not deferred or if the dirty list is full */
+    myst_memset_nt((void*)addr, 0xDD, size);
+}
+
+/* Scrub up to MAX_BYTES of queued ranges and return the number scrubbed */
+static size_t _mman_scrub_dirty(myst_mman_t* mman, size_t max_bytes)
+{
+    size_t nbytes = 0;
+
+    while (mman->num_dirty && nbytes < max_bytes)
+    {
+        myst_mman_range_t* r = &mman->dirty[mman->num_dirty - 1];
+        size_t n = r->size;
+
+        if (n > max_bytes - nbytes)
+            n = max_bytes - nbytes;
+
+        /* Scrub from the end so the range shrinks in place */
+        myst_memset_nt((void*)(r->addr + r->size - n), 0xDD, n);
+        r->size -= n;
+        nbytes += n;
+
+        if (r->size == 0)
+            mman->num_dirty--;
+    }
+
+    return nbytes;
+}
+
+/*
+** Remove [addr:addr+size) from the dirty list because it is being handed
+** out again. If SCRUB is true, scrub the overlapping portions first (for
+** memory that is handed out without being zero-filled).
+*/
+static void _mman_claim(
+    myst_mman_t* mman,
+    uintptr_t addr,
+    size_t size,
+    bool scrub)
+{
+    const uintptr_t start = addr;
+    const uintptr_t end = addr + size;
+
+    for (size_t i = mman->num_dirty; i > 0; i--)
+    {
+        myst_mman_range_t* r = &mman->dirty[i - 1];
+        uintptr_t rstart = r->addr;
+        uintptr_t rend = r->addr + r->size;
+        uintptr_t lo = rstart > start ? rstart : start;
+        uintptr_t hi = rend < end ? rend : end;
+
+        /* Skip ranges that do not overlap */
+        if (lo >= hi)
+            continue;
+
+        if (scrub)
+            memset((void*)lo, 0xDD, hi - lo);
+
+        if (rstart < lo && hi < rend)
+        {
+            /* Keep the left portion and queue (or scrub) the right one */
+            r->size = lo - rstart;
+            _mman_scrub(mman, hi, rend - hi);
+        }
+        else if (rstart < lo)
+        {
+            r->size = lo - rstart;
+        }
+        else if (hi < rend)
+        {
+            r->addr = hi;
+            r->size = rend - hi;
+        }
+        else
+        {
+            /* Remove this range by moving the last one into its slot */
+            *r = mman->dirty[--mman->num_dirty];
+        }
+    }
+}
+
+/*
+** Search for a gap (greater than or equal to SIZE) in the VAD tree. Set
 ** LEFT to the leftward neighboring VAD (if any). Set RIGHT to the rightward
 ** neighboring VAD (if any). Return a pointer to the start of that gap.
 **
@@ -366,6 +983,10 @@ static void _mman_sync_top(myst_mman_t* mman)
 **     (1) Between HEAD and TAIL
 **     (2) Between TAIL and END
 **
+** A small mapping (see MYST_MMAN_SMALL_MAP) takes the lowest gap that fits
+** it among the small gaps if there is one, since carving it out of a large
+** gap ends up with many holes too small for the large mappings.
+**
 ** Note: one of the following conditions always holds:
 **     (1) MAP == HEAD
 **     (2) MAP == END
@@ -385,27 +1006,29 @@ static uintptr_t _mman_find_gap(
     if (!_mman_is_sane(mman))
         goto done;
 
-    /* Look for a gap in the VAD list */
+    /* Look for a gap in the VAD tree */
     {
-        myst_vad_t* p;
+        myst_vad_t* p = NULL;
 
-        /* Search for gaps between HEAD and TAIL */
-        for (p = mman->vad_list; p; p = p->next)
+        if (size <= MYST_MMAN_SMALL_MAP)
         {
-            size_t gap = _get_right_gap(mman, p);
+            size_t budget = MYST_MMAN_SMALL_GAP_SEARCH;
+            p = _tree_find_small_gap(
+                mman, mman->vad_tree, size, MYST_MMAN_LARGE_GAP, &budget);
+        }
 
-            if (gap >= size)
-            {
-                *left = p;
-                *right = p->next;
+        /* Search for the lowest gap between HEAD and TAIL */
+        if (p || (p = _tree_find_gap(mman, size)))
+        {
+            *left = p;
+            *right = p->next;
 
-                addr = _end(p);
-                goto done;
-            }
+            addr = _end(p);
+            goto done;
         }
     }
 
-    /* No gaps in linked list so obtain memory from mapped memory area */
+    /* No gaps in VAD tree so obtain memory from mapped memory area */
     {
         uintptr_t start = mman->map - size;
 
@@ -472,7 +1095,7 @@ static int _munmap(myst_mman_t* mman, void* addr, size_t length)
     uintptr_t end = (uintptr_t)addr + length;
 
     /* Find the VAD that contains this address */
-    if (!(vad = _list_find(mman, start)))
+    if (!(vad = _tree_find(mman, start)))
     {
         _mman_set_err(mman, "address not found");
         ret = -EINVAL;
@@ -500,7 +1123,7 @@ static int _munmap(myst_mman_t* mman, void* addr, size_t length)
     {
         /* Case1: [uuuuuuuuuuuuuuuu] */
 
-        _list_remove(mman, vad);
+        _mman_remove_vad(mman, vad);
         _mman_sync_top(mman);
         _free_list_put(mman, vad);
     }
@@ -510,6 +1133,7 @@ static int _munmap(myst_mman_t* mman, void* addr, size_t length)
 
         vad->addr += length;
         vad->size -= (uint32_t)length;
+        _mman_update_vad(mman, vad);
         _mman_sync_top(mman);
     }
     else if (_end(vad) == end)
@@ -517,6 +1141,7 @@ static int _munmap(myst_mman_t* mman, void* addr, size_t length)
         /* Case3: [............uuuu] */
 
         vad->size -= (uint32_t)length;
+        _mman_update_vad(mman, vad);
     }
     else
     {
@@ -538,13 +1163,12 @@ static int _munmap(myst_mman_t* mman, void* addr, size_t length)
             goto done;
         }
 
-        _list_insert_after(mman, vad, right);
+        _mman_insert_vad(mman, vad, right);
         _mman_sync_top(mman);
     }
 
     /* If scrubbing is enabled, then scrub the unmapped memory */
-    if (mman->scrub)
-        memset(addr, 0xDD, length);
+    _mman_scrub(mman, (uintptr_t)addr, length);
 
     if (!_mman_is_sane(mman))
     {
@@ -558,10 +1182,14 @@ done:
     return ret;
 }
 
+/* Map LENGTH bytes, leaving SLACK bytes free after them if there is room,
+ * and zero-fill all but the first KEEP bytes (which the caller fills) */
 static int _mmap(
     myst_mman_t* mman,
     void* addr,
     size_t length,
+    size_t slack,
+    size_t keep,
     int prot,
     int flags,
     void** ptr_out)
@@ -673,7 +1301,7 @@ static int _mmap(
         uintptr_t end = (uintptr_t)addr + length;
 
         /* Fail if [addr:length] is not already mapped */
-        if (!(vad = _list_find(mman, start)) || end > _end(vad))
+        if (!(vad = _tree_find(mman, start)) || end > _end(vad))
         {
             _mman_set_err(
                 mman,
@@ -691,10 +1319,28 @@ static int _mmap(
         myst_vad_t* left;
         myst_vad_t* right;
 
-        /* Find a gap that is big enough */
-        if (!(start = _mman_find_gap(mman, length, &left, &right)))
+        /* Find a gap that is big enough (with the slack if possible) */
+        if (!slack || !(start = _mman_find_gap(
+                            mman, length + slack, &left, &right)))
         {
-            _mman_set_err(mman, "out of memory");
+            slack = 0;
+
+            if (!(start = _mman_find_gap(mman, length, &left, &right)))
+            {
+                _mman_set_err(mman, "out of memory");
+                ret = -ENOMEM;
+                goto done;
+            }
+        }
+
+        /* Fill the gap after a growing mapping from the top down, which
+         * leaves that mapping room to grow in place */
+        if (left && (left->flags & MYST_MAP_GROWING))
+            start = (right ? right->addr : mman->end) - length - slack;
+
+        if (_mman_commit_map(mman, start) != 0)
+        {
+            _mman_set_err(mman, "failed to commit memory");
             ret = -ENOMEM;
             goto done;
         }
@@ -705,51 +1351,336 @@ static int _mmap(
 
             left->size += (uint32_t)length;
 
-            /* Coalesce with RIGHT neighbor (and release right neighbor) */
-            if (right && (start + length == right->addr))
-            {
-                _list_remove(mman, right);
-                left->size += right->size;
-                _free_list_put(mman, right);
-            }
-        }
-        else if (right && (start + length == right->addr))
-        {
-            /* Coalesce with RIGHT neighbor */
+            /* Coalesce with RIGHT neighbor (and release right neighbor) */
+            if (right && (start + length == right->addr))
+            {
+                _mman_remove_vad(mman, right);
+                left->size += right->size;
+                _free_list_put(mman, right);
+            }
+
+            _mman_update_vad(mman, left);
+        }
+        else if (right && (start + length == right->addr))
+        {
+            /* Coalesce with RIGHT neighbor */
+
+            right->addr = start;
+            right->size += (uint32_t)length;
+            _mman_update_vad(mman, right);
+            _mman_sync_top(mman);
+        }
+        else
+        {
+            myst_vad_t* vad;
+
+            /* Create a new VAD and insert it into the list */
+
+            if (!(vad = _mman_new_vad(mman, start, length, prot, flags)))
+            {
+                _mman_set_err(mman, "unexpected: list insert failed");
+                ret = -EINVAL;
+                goto done;
+            }
+
+            _mman_insert_vad(mman, left, vad);
+            _mman_sync_top(mman);
+        }
+    }
+
+    if (!_mman_is_sane(mman))
+        goto done;
+
+    /* Memory is zero-filled below, so there is no need to scrub it */
+    _mman_claim(mman, start, length, false);
+
+    *ptr_out = (void*)start;
+
+done:
+
+    /* Zero-fill mapped memory (bypassing the caches when large) */
+    if (ptr_out && *ptr_out && keep < length)
+        myst_memzero_nt((uint8_t*)*ptr_out + keep, length - keep);
+
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** Arena functions:
+**
+**     Lock ordering: the arena lock is always acquired before the mman lock.
+**
+**==============================================================================
+*/
+
+#define ARENA_SIZE (MYST_MMAN_ARENA_PAGES * PAGE_SIZE)
+
+/* Find NPAGES consecutive free pages; return the first index or -1 */
+static ssize_t _arena_find_pages(myst_mman_arena_t* arena, size_t npages)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < MYST_MMAN_ARENA_PAGES; i++)
+    {
+        if (myst_test_bit(arena->bits, i))
+            n = 0;
+        else if (++n == npages)
+            return (ssize_t)(i + 1 - npages);
+    }
+
+    /* Not found */
+    return -1;
+}
+
+/* Unmap the free pages of an arena (the caller holds the arena lock) */
+static void _arena_retire(myst_mman_t* mman, myst_mman_arena_t* arena)
+{
+    bool locked = false;
+    size_t i = 0;
+
+    if (!arena->base)
+        return;
+
+    _mman_lock(mman, &locked);
+    {
+        /* Free pages were already scrubbed when released to the arena */
+        bool scrub = mman->scrub;
+        mman->scrub = false;
+
+        while (i < MYST_MMAN_ARENA_PAGES)
+        {
+            size_t n = 0;
+
+            while (i + n < MYST_MMAN_ARENA_PAGES &&
+                   !myst_test_bit(arena->bits, i + n))
+            {
+                n++;
+            }
+
+            if (n)
+            {
+                void* addr = (void*)(arena->base + i * PAGE_SIZE);
+                _munmap(mman, addr, n * PAGE_SIZE);
+                i += n;
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        mman->scrub = scrub;
+    }
+    _mman_unlock(mman, &locked);
+
+    memset(arena->bits, 0, sizeof(arena->bits));
+    arena->nfree = 0;
+    __atomic_store_n(&arena->base, 0, __ATOMIC_RELEASE);
+}
+
+/* Hand out NPAGES from an arena (the caller holds the arena lock) */
+static int _arena_mmap(
+    myst_mman_t* mman,
+    myst_mman_arena_t* arena,
+    size_t npages,
+    int prot,
+    int flags,
+    void** ptr_out)
+{
+    int ret = 0;
+    ssize_t index = -1;
+
+    if (arena->base)
+        index = _arena_find_pages(arena, npages);
+
+    /* If the arena is exhausted, replace it with a fresh chunk */
+    if (index < 0)
+    {
+        bool locked = false;
+        void* base = NULL;
+
+        _arena_retire(mman, arena);
+
+        _mman_lock(mman, &locked);
+        ret = _mmap(mman, NULL, ARENA_SIZE, 0, 0, prot, flags, &base);
+        _mman_unlock(mman, &locked);
+
+        if (ret != 0)
+            goto done;
+
+        arena->nfree = MYST_MMAN_ARENA_PAGES;
+        __atomic_store_n(&arena->base, (uintptr_t)base, __ATOMIC_RELEASE);
+        index = 0;
+    }
+
+    for (size_t i = 0; i < npages; i++)
+        myst_set_bit(arena->bits, (size_t)index + i);
+
+    arena->nfree -= npages;
+
+    *ptr_out = (void*)(arena->base + (size_t)index * PAGE_SIZE);
+    memset(*ptr_out, 0, npages * PAGE_SIZE);
+
+done:
+    return ret;
+}
+
+/* Release [start:end) back to an arena (the caller holds the arena lock) */
+static void _arena_munmap(
+    myst_mman_t* mman,
+    myst_mman_arena_t* arena,
+    uintptr_t start,
+    uintptr_t end)
+{
+    size_t first = (start - arena->base) / PAGE_SIZE;
+    size_t last = (end - arena->base) / PAGE_SIZE;
+
+    for (size_t i = first; i < last; i++)
+    {
+        if (myst_test_bit(arena->bits, i))
+        {
+            myst_clear_bit(arena->bits, i);
+            arena->nfree++;
+        }
+    }
+
+    /* If scrubbing is enabled, then scrub the unmapped memory */
+    if (mman->scrub)
+        myst_memset_nt((void*)start, 0xDD, end - start);
+}
+
+/* Mark [start:end) of an arena as handed out (the caller holds the lock) */
+static void _arena_mark(
+    myst_mman_arena_t* arena,
+    uintptr_t start,
+    uintptr_t end)
+{
+    size_t first = (start - arena->base) / PAGE_SIZE;
+    size_t last = (end - arena->base) / PAGE_SIZE;
+
+    for (size_t i = first; i < last; i++)
+    {
+        if (!myst_test_bit(arena->bits, i))
+        {
+            myst_set_bit(arena->bits, i);
+            arena->nfree--;
+        }
+    }
+}
+
+typedef enum arena_op
+{
+    ARENA_OP_RELEASE, /* give the pages back to the arena (UNMAP) */
+    ARENA_OP_RETIRE,  /* retire the arena (REMAP) */
+} arena_op_t;
+
+/*
+** Apply OP to the part of [start:end) within each arena that overlaps it.
+** Return the bases of those arenas in ascending order (at most
+** MYST_MMAN_NUM_ARENAS of them), so that the caller can find the parts of
+** the range that lie outside of every arena.
+*/
+static size_t _arenas_range(
+    myst_mman_t* mman,
+    uintptr_t start,
+    uintptr_t end,
+    arena_op_t op,
+    uintptr_t bases[MYST_MMAN_NUM_ARENAS])
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < MYST_MMAN_NUM_ARENAS; i++)
+    {
+        myst_mman_arena_t* arena = &mman->arenas[i];
+        uintptr_t base = __atomic_load_n(&arena->base, __ATOMIC_ACQUIRE);
+
+        /* Skip arenas that do not overlap without taking the lock */
+        if (!base || end <= base || start >= base + ARENA_SIZE)
+            continue;
+
+        myst_spin_lock(&arena->lock);
+        {
+            base = arena->base;
+
+            if (base && end > base && start < base + ARENA_SIZE)
+            {
+                uintptr_t top = base + ARENA_SIZE;
+                uintptr_t lo = (start > base) ? start : base;
+                uintptr_t hi = (end < top) ? end : top;
+                size_t j;
+
+                if (op == ARENA_OP_RELEASE)
+                    _arena_munmap(mman, arena, lo, hi);
+                else
+                    _arena_retire(mman, arena);
+
+                /* insert BASE in order */
+                for (j = n++; j > 0 && bases[j - 1] > base; j--)
+                    bases[j] = bases[j - 1];
+
+                bases[j] = base;
+            }
+        }
+        myst_spin_unlock(&arena->lock);
+    }
+
+    return n;
+}
+
+/*
+** Map ADDR (if not null) over the arenas and mark the arena pages it covers
+** as handed out. The arena locks are held (in index order) across both steps
+** so that no arena can hand out those pages in between.
+*/
+static int _mmap_over_arenas(
+    myst_mman_t* mman,
+    void* addr,
+    size_t length,
+    int prot,
+    int flags,
+    void** ptr_out)
+{
+    bool locked = false;
+    bool arenas = addr && mman->arenas_enabled;
+    int ret;
+
+    if (arenas)
+    {
+        for (size_t i = 0; i < MYST_MMAN_NUM_ARENAS; i++)
+            myst_spin_lock(&mman->arenas[i].lock);
+    }
+
+    _mman_lock(mman, &locked);
+    ret = _mmap(mman, addr, length, 0, 0, prot, flags, ptr_out);
+    _mman_scrub_dirty(mman, MYST_MMAN_SCRUB_STEP);
+    _mman_unlock(mman, &locked);
+
+    /* Arena pages mapped over are no longer free to hand out */
+    if (arenas)
+    {
+        uintptr_t start = (uintptr_t)addr;
+        size_t n;
 
-            right->addr = start;
-            right->size += (uint32_t)length;
-            _mman_sync_top(mman);
-        }
-        else
+        for (size_t i = MYST_MMAN_NUM_ARENAS; i > 0; i--)
         {
-            myst_vad_t* vad;
-
-            /* Create a new VAD and insert it into the list */
+            myst_mman_arena_t* arena = &mman->arenas[i - 1];
+            uintptr_t base = arena->base;
 
-            if (!(vad = _mman_new_vad(mman, start, length, prot, flags)))
+            if (ret == 0 && base && myst_round_up(length, PAGE_SIZE, &n) == 0 &&
+                start + n > base && start < base + ARENA_SIZE)
             {
-                _mman_set_err(mman, "unexpected: list insert failed");
-                ret = -EINVAL;
-                goto done;
+                uintptr_t top = base + ARENA_SIZE;
+                uintptr_t lo = (start > base) ? start : base;
+                uintptr_t hi = (start + n < top) ? start + n : top;
+                _arena_mark(arena, lo, hi);
             }
 
-            _list_insert_after(mman, left, vad);
-            _mman_sync_top(mman);
+            myst_spin_unlock(&arena->lock);
         }
     }
 
-    if (!_mman_is_sane(mman))
-        goto done;
-
-    *ptr_out = (void*)start;
-
-done:
-
-    /* Zero-fill mapped memory */
-    if (ptr_out && *ptr_out)
-        memset(*ptr_out, 0, length);
-
     return ret;
 }
 
@@ -852,6 +1783,9 @@ int myst_mman_init(myst_mman_t* mman, uintptr_t base, size_t size)
     /* Set the myst_vad_t linked list to null */
     mman->vad_list = NULL;
 
+    /* Set the myst_vad_t tree to null */
+    mman->vad_tree = NULL;
+
     /* Sanity checks are disabled by default */
     mman->sanity = false;
 
@@ -920,7 +1854,15 @@ int myst_mman_sbrk(myst_mman_t* mman, ptrdiff_t increment, void** ptr_out)
     else if ((uintptr_t)increment <= mman->map - mman->brk)
     {
         /* Increment the break value and return the old break value */
+        if (_mman_commit_brk(mman, mman->brk + (uintptr_t)increment) != 0)
+        {
+            _mman_set_err(mman, "failed to commit memory");
+            ret = -ENOMEM;
+            goto done;
+        }
+
         ptr = (void*)mman->brk;
+        _mman_claim(mman, mman->brk, (size_t)increment, true);
         mman->brk += (uintptr_t)increment;
     }
     else
@@ -989,9 +1931,22 @@ int myst_mman_brk(myst_mman_t* mman, void* addr, void** ptr)
         goto done;
     }
 
+    if (_mman_commit_brk(mman, (uintptr_t)addr) != 0)
+    {
+        _mman_set_err(mman, "failed to commit memory");
+        ret = -ENOMEM;
+        goto done;
+    }
+
+    /* Break memory is not zero-filled, so finish any pending scrubs */
+    if ((uintptr_t)addr > mman->brk)
+        _mman_claim(mman, mman->brk, (uintptr_t)addr - mman->brk, true);
+
     /* Set the break value */
     mman->brk = (uintptr_t)addr;
 
+    _mman_decommit(mman);
+
     if (!_mman_is_sane(mman))
     {
         _mman_set_err(mman, "bad mman parameter");
@@ -1043,11 +1998,75 @@ int myst_mman_mmap(
     int flags,
     void** ptr_out)
 {
-    bool locked = false;
+    int ret = _mmap_over_arenas(mman, addr, length, prot, flags, ptr_out);
 
-    _mman_lock(mman, &locked);
-    int ret = _mmap(mman, addr, length, prot, flags, ptr_out);
-    _mman_unlock(mman, &locked);
+    /* If out of memory, reclaim the free pages held by arenas and retry */
+    if (ret == -ENOMEM && mman->arenas_enabled)
+    {
+        myst_mman_release_arenas(mman);
+        ret = _mmap_over_arenas(mman, addr, length, prot, flags, ptr_out);
+    }
+
+    return ret;
+}
+
+/*
+**
+** myst_mman_arena_mmap()
+**
+**     Allocate 'length' bytes from the arena selected by 'key' (usually the
+**     caller's thread id). Only the arena lock is taken unless the arena must
+**     be replenished. Requests that are not small anonymous private mappings,
+**     or that arrive while arenas are disabled, are passed to
+**     myst_mman_mmap().
+**
+** Parameters:
+**     [IN] mman - mman structure
+**     [IN] key - selects the arena (key modulo MYST_MMAN_NUM_ARENAS)
+**     [IN] length - length in bytes of the new allocation
+**     [IN] prot - arena pages are (MYST_PROT_READ | MYST_PROT_WRITE)
+**     [IN] flags - arena pages are (MYST_MAP_ANONYMOUS | MYST_MAP_PRIVATE)
+**
+** Returns:
+**     0 if successful.
+**
+*/
+int myst_mman_arena_mmap(
+    myst_mman_t* mman,
+    uint64_t key,
+    size_t length,
+    int prot,
+    int flags,
+    void** ptr_out)
+{
+    const int arena_prot = MYST_PROT_READ | MYST_PROT_WRITE;
+    const int arena_flags = MYST_MAP_ANONYMOUS | MYST_MAP_PRIVATE;
+    const size_t max_length = MYST_MMAN_ARENA_MAX_PAGES * PAGE_SIZE;
+    myst_mman_arena_t* arena;
+    int ret;
+
+    /* the arena chunks are all read-write, so other mappings go elsewhere */
+    if (!mman || !mman->arenas_enabled || !ptr_out || prot != arena_prot ||
+        flags != arena_flags || length == 0 || length > max_length)
+    {
+        return myst_mman_mmap(mman, NULL, length, prot, flags, ptr_out);
+    }
+
+    *ptr_out = NULL;
+
+    /* Round LENGTH to multiple of page size */
+    if (myst_round_up(length, PAGE_SIZE, &length) != 0)
+        return -EINVAL;
+
+    arena = &mman->arenas[key % MYST_MMAN_NUM_ARENAS];
+
+    myst_spin_lock(&arena->lock);
+    ret = _arena_mmap(mman, arena, length / PAGE_SIZE, prot, flags, ptr_out);
+    myst_spin_unlock(&arena->lock);
+
+    /* Fall back on the VAD tree (which reclaims arenas if necessary) */
+    if (ret != 0)
+        ret = myst_mman_mmap(mman, NULL, length, prot, flags, ptr_out);
 
     return ret;
 }
@@ -1085,9 +2104,42 @@ int myst_mman_mmap(
 int myst_mman_munmap(myst_mman_t* mman, void* addr, size_t length)
 {
     bool locked = false;
+    int ret = 0;
+
+    /* Release the parts of the range within arenas to those arenas, and
+     * unmap the parts between them from the VAD tree */
+    if (mman && mman->arenas_enabled && addr && length &&
+        (uintptr_t)addr % PAGE_SIZE == 0 &&
+        myst_round_up(length, PAGE_SIZE, &length) == 0)
+    {
+        uintptr_t bases[MYST_MMAN_NUM_ARENAS];
+        uintptr_t start = (uintptr_t)addr;
+        uintptr_t end = start + length;
+        size_t n = _arenas_range(mman, start, end, ARENA_OP_RELEASE, bases);
+
+        if (n > 0)
+        {
+            _mman_lock(mman, &locked);
+
+            for (size_t i = 0; i <= n && ret == 0; i++)
+            {
+                uintptr_t lo = (i == 0) ? start : bases[i - 1] + ARENA_SIZE;
+                uintptr_t hi = (i == n) ? end : bases[i];
+
+                if (lo < hi)
+                    ret = _munmap(mman, (void*)lo, hi - lo);
+            }
+
+            _mman_scrub_dirty(mman, MYST_MMAN_SCRUB_STEP);
+            _mman_unlock(mman, &locked);
+
+            return ret;
+        }
+    }
 
     _mman_lock(mman, &locked);
-    int ret = _munmap(mman, addr, length);
+    ret = _munmap(mman, addr, length);
+    _mman_scrub_dirty(mman, MYST_MMAN_SCRUB_STEP);
     _mman_unlock(mman, &locked);
 
     return ret;
@@ -1133,6 +2185,14 @@ int myst_mman_mremap(
     if (ptr_out)
         *ptr_out = NULL;
 
+    /* Hand any arenas overlapping the old range over to the VAD tree */
+    if (mman && mman->arenas_enabled && addr && old_size)
+    {
+        uintptr_t bases[MYST_MMAN_NUM_ARENAS];
+        uintptr_t start = (uintptr_t)addr;
+        _arenas_range(mman, start, start + old_size, ARENA_OP_RETIRE, bases);
+    }
+
     _mman_lock(mman, &locked);
 
     _mman_clear_err(mman);
@@ -1204,7 +2264,7 @@ int myst_mman_mremap(
     uintptr_t new_end = (uintptr_t)addr + new_size;
 
     /* Find the VAD containing START */
-    if (!(vad = _list_find(mman, start)))
+    if (!(vad = _tree_find(mman, start)))
     {
         _mman_set_err(mman, "invalid addr parameter: mapping not found");
         ret = -ENOMEM;
@@ -1240,16 +2300,16 @@ int myst_mman_mremap(
                 goto done;
             }
 
-            _list_insert_after(mman, vad, right);
+            _mman_insert_vad(mman, vad, right);
             _mman_sync_top(mman);
         }
 
         vad->size = (uint32_t)(new_end - vad->addr);
+        _mman_update_vad(mman, vad);
         new_addr = addr;
 
         /* If scrubbing is enabled, scrub the unmapped portion */
-        if (mman->scrub)
-            memset((void*)new_end, 0xDD, old_size - new_size);
+        _mman_scrub(mman, new_end, old_size - new_size);
     }
     else if (new_size > old_size)
     {
@@ -1259,7 +2319,10 @@ int myst_mman_mremap(
         /* If there is room for this area to grow without moving it */
         if (_end(vad) == old_end && _get_right_gap(mman, vad) >= delta)
         {
+            vad->flags |= MYST_MAP_GROWING;
             vad->size += (uint32_t)delta;
+            _mman_update_vad(mman, vad);
+            _mman_claim(mman, start + old_size, delta, false);
             memset((void*)(start + old_size), 0, delta);
             new_addr = addr;
 
@@ -1267,22 +2330,35 @@ int myst_mman_mremap(
             if (vad->next && _end(vad) == vad->next->addr)
             {
                 myst_vad_t* next = vad->next;
+                _mman_remove_vad(mman, next);
                 vad->size += next->size;
-                _list_remove(mman, next);
+                _mman_update_vad(mman, vad);
                 _mman_sync_top(mman);
                 _free_list_put(mman, next);
             }
         }
         else
         {
-            if (_mmap(mman, NULL, new_size, vad->prot, vad->flags, &addr) != 0)
+            /* Move to a mapping with room to grow again after it (half as
+             * much again), of which only the part beyond the old contents is
+             * zero-filled */
+            if (_mmap(
+                    mman,
+                    NULL,
+                    new_size,
+                    myst_round_down_to_page_size(new_size / 2),
+                    old_size,
+                    vad->prot,
+                    vad->flags | MYST_MAP_GROWING,
+                    &addr) != 0)
             {
                 _mman_set_err(mman, "mapping failed");
                 ret = -ENOMEM;
+                goto done;
             }
 
             /* Copy over data from old area */
-            memcpy(addr, (void*)start, old_size);
+            myst_memcpy_nt(addr, (void*)start, old_size);
 
             /* Ummap the old area */
             if (_munmap(mman, (void*)start, old_size) != 0)
@@ -1324,8 +2400,9 @@ done:
 **     true if mman is sane
 **
 ** Implementation:
-**     Checks various contraints such as ranges being correct and VAD list
-**     being sorted.
+**     Checks various contraints such as ranges being correct, VAD list
+**     being sorted, and the VAD tree being balanced and consistent with the
+**     VAD list.
 **
 */
 bool myst_mman_is_sane(myst_mman_t* mman)
@@ -1430,6 +2507,29 @@ bool myst_mman_is_sane(myst_mman_t* mman)
         }
     }
 
+    /* Verify that the tree is balanced and agrees with the list */
+    {
+        myst_vad_t* last = NULL;
+
+        if (!_tree_is_sane(mman, mman->vad_tree, &last))
+        {
+            _mman_set_err(mman, "invalid VAD tree");
+            goto done;
+        }
+
+        if (mman->vad_list && !last)
+        {
+            _mman_set_err(mman, "VAD tree is missing elements");
+            goto done;
+        }
+
+        if (last && last->next)
+        {
+            _mman_set_err(mman, "VAD tree is missing elements");
+            goto done;
+        }
+    }
+
     result = true;
 
 done:
@@ -1456,6 +2556,138 @@ void myst_mman_set_sanity(myst_mman_t* mman, bool sanity)
         mman->sanity = sanity;
 }
 
+/*
+**
+** myst_mman_set_commit()
+**
+**     Install a callback that commits memory on demand (see the COMMIT
+**     section above). This must be called before any memory is allocated.
+**     The VAD array (between BASE and START) must already be committed.
+**
+** Parameters:
+**     [IN] mman - mman structure
+**     [IN] commit - callback that commits or decommits a range of pages
+**     [IN] commit_arg - argument passed to the callback
+**
+** Returns:
+**     0 if successful.
+**
+*/
+int myst_mman_set_commit(
+    myst_mman_t* mman,
+    myst_mman_commit_t commit,
+    void* commit_arg)
+{
+    int ret = 0;
+    bool locked = false;
+
+    if (!mman || !commit)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    _mman_lock(mman, &locked);
+
+    if (mman->brk != mman->start || mman->map != mman->end)
+    {
+        _mman_set_err(mman, "memory has already been allocated");
+        ret = -EBUSY;
+        goto done;
+    }
+
+    mman->commit = commit;
+    mman->commit_arg = commit_arg;
+    mman->brk_commit = mman->start;
+    mman->map_commit = mman->end;
+
+done:
+    _mman_unlock(mman, &locked);
+    return ret;
+}
+
+/*
+**
+** myst_mman_set_arenas()
+**
+**     Enable or disable serving small mappings from arenas (see the ARENAS
+**     section above). Disabling arenas retires all of them.
+**
+** Parameters:
+**     [IN] mman - mman structure
+**     [IN] enable - true to enable arenas; false otherwise.
+**
+*/
+void myst_mman_set_arenas(myst_mman_t* mman, bool enable)
+{
+    if (!mman)
+        return;
+
+    if (!enable)
+        myst_mman_release_arenas(mman);
+
+    mman->arenas_enabled = enable;
+}
+
+/*
+**
+** myst_mman_set_defer_scrub()
+**
+**     Defer scrubbing of unmapped memory (see the scrub functions above).
+**     Memory is still zero-filled before it is handed out again. Disabling
+**     deferral scrubs all queued ranges.
+**
+** Parameters:
+**     [IN] mman - mman structure
+**     [IN] defer - true to defer scrubbing; false otherwise.
+**
+*/
+void myst_mman_set_defer_scrub(myst_mman_t* mman, bool defer)
+{
+    if (!mman)
+        return;
+
+    myst_ticket_lock(&mman->lock);
+    {
+        if (!defer)
+            _mman_scrub_dirty(mman, SIZE_MAX);
+
+        mman->defer_scrub = defer;
+    }
+    myst_ticket_unlock(&mman->lock);
+}
+
+/* scrub up to max_bytes of deferred ranges and return the number scrubbed */
+size_t myst_mman_scrub(myst_mman_t* mman, size_t max_bytes)
+{
+    size_t nbytes;
+
+    if (!mman)
+        return 0;
+
+    myst_ticket_lock(&mman->lock);
+    nbytes = _mman_scrub_dirty(mman, max_bytes);
+    myst_ticket_unlock(&mman->lock);
+
+    return nbytes;
+}
+
+/* retire all arenas, returning their free pages to the VAD tree */
+void myst_mman_release_arenas(myst_mman_t* mman)
+{
+    if (!mman)
+        return;
+
+    for (size_t i = 0; i < MYST_MMAN_NUM_ARENAS; i++)
+    {
+        myst_mman_arena_t* arena = &mman->arenas[i];
+
+        myst_spin_lock(&arena->lock);
+        _arena_retire(mman, arena);
+        myst_spin_unlock(&arena->lock);
+    }
+}
+
 /* return the total size of the mman region */
 int myst_mman_total_size(myst_mman_t* mman, size_t* size)
 {
@@ -1470,9 +2702,9 @@ int myst_mman_total_size(myst_mman_t* mman, size_t* size)
         goto done;
     }
 
-    myst_spin_lock(&mman->lock);
+    myst_ticket_lock(&mman->lock);
     *size = mman->size;
-    myst_spin_unlock(&mman->lock);
+    myst_ticket_unlock(&mman->lock);
 
 done:
     return ret;
@@ -1493,7 +2725,7 @@ int myst_mman_free_size(myst_mman_t* mman, size_t* size_out)
         goto done;
     }
 
-    myst_spin_lock(&mman->lock);
+    myst_ticket_lock(&mman->lock);
     {
         /* determine the bytes between the BRK value and MAP value */
         size = mman->map - mman->brk;
@@ -1502,7 +2734,12 @@ int myst_mman_free_size(myst_mman_t* mman, size_t* size_out)
         for (myst_vad_t* p = mman->vad_list; p; p = p->next)
             size += _get_right_gap(mman, p);
     }
-    myst_spin_unlock(&mman->lock);
+    myst_ticket_unlock(&mman->lock);
+
+    /* include pages held by arenas that have not been handed out */
+    for (size_t i = 0; i < MYST_MMAN_NUM_ARENAS; i++)
+        size += __atomic_load_n(&mman->arenas[i].nfree, __ATOMIC_RELAXED) *
+                PAGE_SIZE;
 
     *size_out = size;
 
@@ -1510,6 +2747,123 @@ done:
     return ret;
 }
 
+int myst_mman_stats(myst_mman_t* mman, myst_mman_stats_t* stats)
+{
+    if (!mman || !stats)
+        return -EINVAL;
+
+    memset(stats, 0, sizeof(myst_mman_stats_t));
+
+    myst_ticket_lock(&mman->lock);
+    {
+        stats->start = mman->start;
+        stats->brk = mman->brk;
+        stats->unassigned = mman->map - mman->brk;
+
+        for (myst_vad_t* p = mman->vad_list; p; p = p->next)
+        {
+            size_t gap = _get_right_gap(mman, p);
+
+            stats->mapped += p->size;
+            stats->count++;
+
+            if (gap)
+            {
+                size_t i = 0;
+
+                while (i + 1 < MYST_MMAN_GAP_BUCKETS &&
+                       gap > ((size_t)PAGE_SIZE << (2 * i)))
+                {
+                    i++;
+                }
+
+                stats->gap_histogram[i]++;
+                stats->gaps++;
+            }
+        }
+
+        /* the larger of the free range below the mappings and the
+         * largest gap between them */
+        size_t max_gap = _tree_max_gap(mman->vad_tree);
+
+        stats->largest_free = mman->map - mman->brk;
+
+        if (max_gap * PAGE_SIZE > stats->largest_free)
+            stats->largest_free = max_gap * PAGE_SIZE;
+
+        if (mman->commit)
+        {
+            stats->committed = (mman->brk_commit - mman->start) +
+                               (mman->end - mman->map_commit);
+        }
+        else
+        {
+            stats->committed = (mman->brk - mman->start) + stats->mapped;
+        }
+    }
+    myst_ticket_unlock(&mman->lock);
+
+    return 0;
+}
+
+bool myst_mman_is_mapped(myst_mman_t* mman, const void* addr, size_t length)
+{
+    uintptr_t lo = (uintptr_t)addr;
+    uintptr_t hi;
+    bool mapped = false;
+
+    if (!mman || __builtin_add_overflow(lo, length, &hi))
+        return false;
+
+    myst_ticket_lock(&mman->lock);
+    {
+        /* the part in the break memory */
+        if (lo >= mman->start && lo < mman->brk)
+            lo = hi < mman->brk ? hi : mman->brk;
+
+        /* the rest must be covered by adjacent VADs */
+        for (myst_vad_t* p = _tree_find(mman, lo); p && lo < hi; p = p->next)
+        {
+            if (p->addr > lo)
+                break;
+
+            lo = _end(p);
+        }
+
+        mapped = lo >= hi;
+    }
+    myst_ticket_unlock(&mman->lock);
+
+    return mapped;
+}
+
+size_t myst_mman_get_vads(
+    myst_mman_t* mman,
+    uintptr_t addr,
+    myst_vad_t* vads,
+    size_t count)
+{
+    size_t n = 0;
+
+    if (!mman || !vads)
+        return 0;
+
+    myst_ticket_lock(&mman->lock);
+    {
+        for (myst_vad_t* p = _tree_find_next(mman, addr); p && n < count;
+             p = p->next)
+        {
+            vads[n] = *p;
+            vads[n].next = vads[n].prev = NULL;
+            vads[n].left = vads[n].right = NULL;
+            n++;
+        }
+    }
+    myst_ticket_unlock(&mman->lock);
+
+    return n;
+}
+
 void myst_mman_dump_vads(myst_mman_t* mman)
 {
     if (!mman)
@@ -1517,7 +2871,7 @@ void myst_mman_dump_vads(myst_mman_t* mman)
 
     printf("=== myst_mman_dump_vads()\n");
 
-    myst_spin_lock(&mman->lock);
+    myst_ticket_lock(&mman->lock);
     {
         /* determine the total size of all gaps */
         for (myst_vad_t* p = mman->vad_list; p; p = p->next)
@@ -1528,5 +2882,5 @@ void myst_mman_dump_vads(myst_mman_t* mman)
             printf("VAD(range[%lx:%lx] size=%lu)\n", start, end, end - start);
         }
     }
-    myst_spin_unlock(&mman->lock);
+    myst_ticket_unlock(&mman->lock);
 }
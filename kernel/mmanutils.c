@@ -9,34 +9,67 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <myst/counters.h>
 #include <myst/eraise.h>
+#include <myst/fdtable.h>
 #include <myst/file.h>
+#include <myst/hostfs.h>
+#include <myst/memops.h>
 #include <myst/mmanutils.h>
+#include <myst/mutex.h>
 #include <myst/panic.h>
 #include <myst/process.h>
 #include <myst/round.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
 
 #define SCRUB
+#define DEFER_SCRUB
+#define ARENAS
 
 static myst_mman_t _mman;
 static void* _mman_start;
 static size_t _mman_size;
 static void* _mman_end;
 
+/* a handle of a mapped file, shared by the pieces of a split mapping (the
+ * process may close or replace its descriptor once it has mapped the file) */
+typedef struct msync_file
+{
+    struct msync_file* next; /* on a list of files to be closed */
+    size_t refs;
+    myst_fs_t* fs;
+    myst_file_t* file;
+} msync_file_t;
+
 /* msync mappings are created by mmap() and released with munmap() */
 typedef struct msync_mapping
 {
-    struct msync_mapping* next;
-    int fd;
+    msync_file_t* file;
+    pid_t pid; /* the process that made the mapping */
     off_t offset;
     void* addr;
     size_t length;
+
+    /* hash of each page as of the last sync (to detect dirty pages) */
+    uint64_t* hashes;
 } msync_mapping_t;
 
-/* linked list of msync mappings */
+/* a run of dirty pages to be written back after the lock is released */
+typedef struct msync_run
+{
+    msync_file_t* file;
+    off_t offset;
+    uint8_t* addr;
+    size_t length;
+} msync_run_t;
+
+/* array of non-overlapping msync mappings sorted by address */
 static msync_mapping_t* _msync_mappings;
+static size_t _msync_mappings_size;
+static size_t _msync_mappings_capacity;
 static myst_spinlock_t _msync_mappings_lock = MYST_SPINLOCK_INITIALIZER;
 
 static uint8_t* _min_ptr(uint8_t* x, uint8_t* y)
@@ -49,6 +82,14 @@ static uint8_t* _max_ptr(uint8_t* x, uint8_t* y)
     return (x > y) ? x : y;
 }
 
+/* select an arena for the caller (mappings may precede the first thread) */
+static uint64_t _arena_key(void)
+{
+    myst_thread_t* thread = (myst_thread_t*)myst_get_tsd();
+
+    return myst_valid_thread(thread) ? (uint64_t)thread->tid : 0;
+}
+
 int myst_setup_mman(void* data, size_t size)
 {
     int ret = -1;
@@ -70,6 +111,16 @@ int myst_setup_mman(void* data, size_t size)
     _mman.scrub = true;
 #endif
 
+#ifdef DEFER_SCRUB
+    /* Amortize scrubbing over later operations rather than stall munmap */
+    myst_mman_set_defer_scrub(&_mman, true);
+#endif
+
+#ifdef ARENAS
+    /* Serve small mappings from per-thread arenas to relieve the mman lock */
+    myst_mman_set_arenas(&_mman, true);
+#endif
+
 #ifdef SANITY
     myst_mman_set_sanity(&_mman, true);
 #endif
@@ -86,23 +137,714 @@ int myst_teardown_mman(void)
     return 0;
 }
 
-static msync_mapping_t* _new_msync_mapping(
-    int fd,
-    off_t offset,
-    void* addr,
-    size_t length)
+static size_t _num_pages(size_t length)
+{
+    return (length + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+/* hash a page (or partial last page) for dirty page detection */
+static uint64_t _hash_page(const void* data, size_t size)
+{
+    const uint64_t* p = (const uint64_t*)data;
+    const uint8_t* q;
+    uint64_t h = 0xcbf29ce484222325;
+
+    /* mix one 64-bit word at a time (order dependent) */
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++)
+    {
+        h = (h ^ p[i]) * 0x100000001b3;
+        h ^= h >> 29;
+    }
+
+    q = (const uint8_t*)data + (size & ~(sizeof(uint64_t) - 1));
+
+    for (size_t i = 0; i < size % sizeof(uint64_t); i++)
+        h = (h ^ q[i]) * 0x100000001b3;
+
+    return h;
+}
+
+/* hash every page of the range [addr:addr+length] */
+static uint64_t* _hash_pages(const void* addr, size_t length)
+{
+    size_t npages = _num_pages(length);
+    uint64_t* hashes;
+
+    if (!(hashes = malloc(npages * sizeof(uint64_t))))
+        return NULL;
+
+    for (size_t i = 0; i < npages; i++)
+    {
+        const uint8_t* page = (const uint8_t*)addr + (i * PAGE_SIZE);
+        size_t size = length - (i * PAGE_SIZE);
+
+        if (size > PAGE_SIZE)
+            size = PAGE_SIZE;
+
+        hashes[i] = _hash_page(page, size);
+    }
+
+    return hashes;
+}
+
+/* find the first msync mapping that ends after addr (binary search) */
+static size_t _find_msync_mapping(const void* addr)
+{
+    size_t lo = 0;
+    size_t hi = _msync_mappings_size;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        const msync_mapping_t* m = &_msync_mappings[mid];
+
+        if ((const uint8_t*)m->addr + m->length <= (const uint8_t*)addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* insert an msync mapping into the sorted array (caller holds the lock) */
+static int _insert_msync_mapping(const msync_mapping_t* m)
+{
+    int ret = 0;
+    size_t index;
+
+    if (_msync_mappings_size == _msync_mappings_capacity)
+    {
+        size_t capacity = _msync_mappings_capacity * 2;
+        msync_mapping_t* data;
+
+        if (capacity == 0)
+            capacity = 16;
+
+        if (!(data = realloc(
+                  _msync_mappings, capacity * sizeof(msync_mapping_t))))
+        {
+            ERAISE(-ENOMEM);
+        }
+
+        _msync_mappings = data;
+        _msync_mappings_capacity = capacity;
+    }
+
+    index = _find_msync_mapping(m->addr);
+
+    memmove(
+        &_msync_mappings[index + 1],
+        &_msync_mappings[index],
+        (_msync_mappings_size - index) * sizeof(msync_mapping_t));
+
+    _msync_mappings[index] = *m;
+    _msync_mappings_size++;
+
+done:
+    return ret;
+}
+
+/* drop a reference to an msync file, closing it with the last one (the
+ * caller must not hold the lock) */
+static void _put_msync_file(msync_file_t* f)
+{
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        (*f->fs->fs_close)(f->fs, f->file);
+        free(f);
+    }
+}
+
+/* close the files whose last reference was dropped under the lock */
+static void _close_msync_files(msync_file_t* closing)
+{
+    while (closing)
+    {
+        msync_file_t* next = closing->next;
+        (*closing->fs->fs_close)(closing->fs, closing->file);
+        free(closing);
+        closing = next;
+    }
+}
+
+/* remove the msync mapping at the given index (caller holds the lock); its
+ * file goes on the closing list if this was the last reference */
+static void _remove_msync_mapping(size_t index, msync_file_t** closing)
+{
+    msync_file_t* f = _msync_mappings[index].file;
+
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        f->next = *closing;
+        *closing = f;
+    }
+
+    free(_msync_mappings[index].hashes);
+
+    memmove(
+        &_msync_mappings[index],
+        &_msync_mappings[index + 1],
+        (_msync_mappings_size - index - 1) * sizeof(msync_mapping_t));
+
+    _msync_mappings_size--;
+}
+
+/* find the first run of pages within [*pos:hi] that changed since the last
+ * sync, updating their hashes and taking a reference to the file (caller
+ * holds the lock); on return *pos is past the run */
+static bool _find_dirty_run(uint8_t** pos, uint8_t* hi, msync_run_t* run)
+{
+    for (size_t i = _find_msync_mapping(*pos); i < _msync_mappings_size; i++)
+    {
+        msync_mapping_t* m = &_msync_mappings[i];
+        uint8_t* base = m->addr;
+        uint8_t* lo = _max_ptr(*pos, base);
+        size_t j = (size_t)(lo - base) / PAGE_SIZE;
+        size_t last;
+
+        /* mappings are sorted, so stop at the first one past the range */
+        if (base >= hi)
+            break;
+
+        last = _num_pages((size_t)(_min_ptr(hi, base + m->length) - base));
+
+        for (; j < last; j++)
+        {
+            size_t k = j;
+
+            /* take the run of dirty pages starting here */
+            while (k < last)
+            {
+                size_t size = m->length - (k * PAGE_SIZE);
+                uint64_t hash;
+
+                if (size > PAGE_SIZE)
+                    size = PAGE_SIZE;
+
+                hash = _hash_page(base + (k * PAGE_SIZE), size);
+
+                if (hash == m->hashes[k])
+                    break;
+
+                m->hashes[k++] = hash;
+            }
+
+            if (k > j)
+            {
+                uint8_t* start = base + (j * PAGE_SIZE);
+                uint8_t* end = base + (k * PAGE_SIZE);
+
+                if (end > base + m->length)
+                    end = base + m->length;
+
+                __atomic_add_fetch(&m->file->refs, 1, __ATOMIC_RELAXED);
+                run->file = m->file;
+                run->offset = m->offset + (start - base);
+                run->addr = start;
+                run->length = (size_t)(end - start);
+                *pos = end;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/* mark a run that was not written back as dirty again so that a later sync
+ * retries it (caller holds the lock) */
+static void _redirty_run(const msync_run_t* run)
+{
+    uint8_t* lo = run->addr;
+    uint8_t* hi = run->addr + run->length;
+
+    for (size_t i = _find_msync_mapping(lo); i < _msync_mappings_size; i++)
+    {
+        msync_mapping_t* m = &_msync_mappings[i];
+        uint8_t* base = m->addr;
+
+        if (base >= hi)
+            break;
+
+        if (m->file != run->file)
+            continue;
+
+        for (size_t j = (size_t)(_max_ptr(lo, base) - base) / PAGE_SIZE;
+             j < _num_pages((size_t)(_min_ptr(hi, base + m->length) - base));
+             j++)
+        {
+            m->hashes[j] = ~m->hashes[j];
+        }
+    }
+}
+
+static int _sync_file(msync_run_t* run)
+{
+    int ret = 0;
+    const uint8_t* p = run->addr;
+    size_t r = run->length;
+    off_t o = run->offset;
+    myst_fs_t* fs = run->file->fs;
+
+    while (r > 0)
+    {
+        ssize_t n;
+
+        ECHECK(n = (*fs->fs_pwrite)(fs, run->file->file, p, r, o));
+
+        if (n == 0)
+            break;
+
+        p += n;
+        o += n;
+        r -= (size_t)n;
+    }
+
+done:
+    return ret;
+}
+
+/* write back the pages of the msync mappings within [lo:hi] that changed
+ * since the last sync. The dirty runs are found under the lock but written
+ * after releasing it, since file I/O may block. Returns the first error. */
+static int _sync_msync_mappings(uint8_t* lo, uint8_t* hi)
+{
+    int ret = 0;
+    uint8_t* pos = lo;
+
+    for (;;)
+    {
+        msync_run_t run;
+        bool found;
+        int r;
+
+        myst_spin_lock(&_msync_mappings_lock);
+        found = _find_dirty_run(&pos, hi, &run);
+        myst_spin_unlock(&_msync_mappings_lock);
+
+        if (!found)
+            break;
+
+        if ((r = _sync_file(&run)) != 0)
+        {
+            myst_spin_lock(&_msync_mappings_lock);
+            _redirty_run(&run);
+            myst_spin_unlock(&_msync_mappings_lock);
+
+            if (ret == 0)
+                ret = r;
+        }
+
+        _put_msync_file(run.file);
+    }
+
+    return ret;
+}
+
+static int _release_msync_mappings(void* addr, size_t length, bool sync);
+
+/*
+**==============================================================================
+**
+** POSIX shared memory objects (the files that shm_open() creates in
+** /dev/shm).
+**
+**     All processes share the address space, so the MAP_SHARED mappings of
+**     the same range of an object share one copy of its pages (rather than
+**     each reading its own copy as other file mappings do). The pages are
+**     written back to the object by msync() and when the last mapping of
+**     them is unmapped. The mapping holds its own handle of the file, since
+**     a process may close its descriptor once it has mapped the object.
+**
+**     Only whole mappings of an object may be unmapped.
+**
+**==============================================================================
+*/
+
+#define SHM_DIR "/dev/shm/"
+
+typedef struct shm_mapping
+{
+    struct shm_mapping* next;
+    dev_t dev;
+    ino_t ino;
+    off_t offset;
+    size_t length; /* in whole pages */
+    void* addr;
+    size_t refs;
+    myst_fs_t* fs;
+    myst_file_t* file;
+} shm_mapping_t;
+
+static shm_mapping_t* _shm_mappings;
+static myst_mutex_t _shm_mappings_lock;
+
+/* Get the file of fd if it is a shared memory object */
+static bool _get_shm_object(int fd, myst_fs_t** fs, myst_file_t** file)
+{
+    char path[PATH_MAX];
+
+    if (myst_fdtable_get_file(myst_fdtable_current(), fd, fs, file) != 0)
+        return false;
+
+    if ((*(*fs)->fs_realpath)(*fs, *file, path, sizeof(path)) != 0)
+        return false;
+
+    return strncmp(path, SHM_DIR, sizeof(SHM_DIR) - 1) == 0;
+}
+
+/* Write [addr:addr+length] of the mapping back to the object (the part of
+ * the last page past the end of the object is dropped) */
+static int _shm_sync(shm_mapping_t* m, uint8_t* addr, size_t length)
+{
+    int ret = 0;
+    struct stat buf;
+    off_t offset = m->offset + ((uint8_t*)addr - (uint8_t*)m->addr);
+
+    ECHECK((*m->fs->fs_fstat)(m->fs, m->file, &buf));
+
+    if (offset >= buf.st_size)
+        goto done;
+
+    if ((size_t)(buf.st_size - offset) < length)
+        length = (size_t)(buf.st_size - offset);
+
+    while (length)
+    {
+        ssize_t n;
+
+        ECHECK(n = (*m->fs->fs_pwrite)(m->fs, m->file, addr, length, offset));
+
+        if (n == 0)
+            ERAISE(-EIO);
+
+        addr += n;
+        offset += n;
+        length -= (size_t)n;
+    }
+
+done:
+    return ret;
+}
+
+static void* _shm_mmap(
+    myst_fs_t* fs,
+    myst_file_t* file,
+    size_t length,
+    off_t offset)
+{
+    void* ret = (void*)-1;
+    struct stat buf;
+    shm_mapping_t* m = NULL;
+    void* ptr = NULL;
+
+    if ((*fs->fs_fstat)(fs, file, &buf) != 0 ||
+        myst_round_up(length, PAGE_SIZE, &length) != 0)
+    {
+        return ret;
+    }
+
+    myst_mutex_lock(&_shm_mappings_lock);
+
+    for (shm_mapping_t* p = _shm_mappings; p; p = p->next)
+    {
+        if (p->dev == buf.st_dev && p->ino == buf.st_ino &&
+            p->offset == offset && p->length == length)
+        {
+            p->refs++;
+            ret = p->addr;
+            goto done;
+        }
+    }
+
+    if (!(m = calloc(1, sizeof(shm_mapping_t))))
+        goto done;
+
+    if ((*fs->fs_dup)(fs, file, &m->file) != 0)
+        goto done;
+
+    m->fs = fs;
+
+    /* the pages are writable whatever the first mapping asked for, since
+     * later mappings share them */
+    if (myst_mman_arena_mmap(
+            &_mman,
+            _arena_key(),
+            length,
+            PROT_READ | PROT_WRITE,
+            MYST_MAP_ANONYMOUS | MYST_MAP_PRIVATE,
+            &ptr) < 0)
+    {
+        goto done;
+    }
+
+    /* read the object onto the pages (bytes past its end stay zero) */
+    {
+        ssize_t n;
+        uint8_t* p = ptr;
+        size_t r = length;
+        off_t o = offset;
+
+        while (r > 0 && (n = (*fs->fs_pread)(fs, m->file, p, r, o)) > 0)
+        {
+            p += n;
+            o += n;
+            r -= (size_t)n;
+        }
+    }
+
+    m->dev = buf.st_dev;
+    m->ino = buf.st_ino;
+    m->offset = offset;
+    m->length = length;
+    m->addr = ptr;
+    m->refs = 1;
+    m->next = _shm_mappings;
+    __atomic_store_n(&_shm_mappings, m, __ATOMIC_RELEASE);
+    ret = ptr;
+    m = NULL;
+
+done:
+    myst_mutex_unlock(&_shm_mappings_lock);
+
+    if (m)
+    {
+        if (m->file)
+            (*fs->fs_close)(fs, m->file);
+
+        free(m);
+    }
+
+    return ret;
+}
+
+/* Drop a mapping of a shared memory object: returns 1 while other
+ * mappings still use the pages, 0 when the caller is to unmap them (or
+ * they are not such a mapping) */
+static int _shm_munmap(void* addr, size_t length)
+{
+    int ret = 0;
+    shm_mapping_t* m = NULL;
+    uint8_t* lo = addr;
+    uint8_t* hi = (uint8_t*)addr + length;
+
+    /* most processes never map an object */
+    if (!__atomic_load_n(&_shm_mappings, __ATOMIC_ACQUIRE))
+        return 0;
+
+    myst_mutex_lock(&_shm_mappings_lock);
+
+    for (shm_mapping_t** p = &_shm_mappings; *p; p = &(*p)->next)
+    {
+        uint8_t* plo = (*p)->addr;
+        uint8_t* phi = plo + (*p)->length;
+
+        if (plo >= hi || phi <= lo)
+            continue;
+
+        if (plo != lo || phi != hi)
+            ERAISE(-EINVAL);
+
+        if (--(*p)->refs)
+        {
+            ret = 1;
+            goto done;
+        }
+
+        m = *p;
+        *p = m->next;
+        break;
+    }
+
+done:
+    myst_mutex_unlock(&_shm_mappings_lock);
+
+    if (m)
+    {
+        if (_shm_sync(m, m->addr, m->length) != 0)
+            ret = -EIO;
+
+        (*m->fs->fs_close)(m->fs, m->file);
+        free(m);
+    }
+
+    return ret;
+}
+
+static int _shm_msync(void* addr, size_t length)
+{
+    int ret = 0;
+    uint8_t* lo = addr;
+    uint8_t* hi = (uint8_t*)addr + length;
+
+    if (!__atomic_load_n(&_shm_mappings, __ATOMIC_ACQUIRE))
+        return 0;
+
+    myst_mutex_lock(&_shm_mappings_lock);
+
+    for (shm_mapping_t* p = _shm_mappings; p; p = p->next)
+    {
+        uint8_t* maxlo = _max_ptr(lo, p->addr);
+        uint8_t* minhi = _min_ptr(hi, (uint8_t*)p->addr + p->length);
+
+        if (maxlo < minhi)
+            ECHECK(_shm_sync(p, maxlo, (size_t)(minhi - maxlo)));
+    }
+
+done:
+    myst_mutex_unlock(&_shm_mappings_lock);
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** Host mappings of the files of public hostfs mounts (see myst_hostfs_map()).
+**
+**     The pages are host memory outside the mman region, so they are given
+**     back to the host by munmap(), and madvise(), mincore() and msync()
+**     accept them (there is nothing to write back, since they are read-only).
+**     Only whole host mappings may be unmapped, and they cannot be mapped
+**     over with MAP_FIXED.
+**
+**==============================================================================
+*/
+
+typedef struct host_mapping
+{
+    struct host_mapping* next;
+    void* addr;
+    size_t length; /* in whole pages */
+} host_mapping_t;
+
+static host_mapping_t* _host_mappings;
+static myst_mutex_t _host_mappings_lock;
+
+/* Map fd from host memory: returns null if it is to be copied instead */
+static void* _host_mmap(int fd, size_t length, off_t offset)
+{
+    void* ret = NULL;
+#ifdef MYST_ENABLE_HOSTFS
+    myst_fs_t* fs;
+    myst_file_t* file;
+    host_mapping_t* m;
+    void* addr;
+    int r;
+
+    if (myst_fdtable_get_file(myst_fdtable_current(), fd, &fs, &file) != 0 ||
+        myst_round_up(length, PAGE_SIZE, &length) != 0)
+    {
+        return NULL;
+    }
+
+    if ((r = myst_hostfs_map(fs, file, offset, length, &addr)) == -ENOTSUP)
+        return NULL;
+
+    if (r != 0)
+        return (void*)-1;
+
+    if (!(m = calloc(1, sizeof(host_mapping_t))))
+    {
+        myst_tcall_unmap_host_file(addr, length);
+        return (void*)-1;
+    }
+
+    m->addr = addr;
+    m->length = length;
+
+    myst_mutex_lock(&_host_mappings_lock);
+    m->next = _host_mappings;
+    __atomic_store_n(&_host_mappings, m, __ATOMIC_RELEASE);
+    myst_mutex_unlock(&_host_mappings_lock);
+
+    ret = addr;
+#else
+    (void)fd;
+    (void)length;
+    (void)offset;
+#endif
+    return ret;
+}
+
+/* Find the host mapping that overlaps [addr:addr+length] (or null) */
+static host_mapping_t** _find_host_mapping(void* addr, size_t length)
+{
+    uint8_t* lo = addr;
+    uint8_t* hi = (uint8_t*)addr + length;
+
+    for (host_mapping_t** p = &_host_mappings; *p; p = &(*p)->next)
+    {
+        uint8_t* plo = (*p)->addr;
+        uint8_t* phi = plo + (*p)->length;
+
+        if (plo < hi && phi > lo)
+            return p;
+    }
+
+    return NULL;
+}
+
+/* Unmap a host mapping: returns 1 if [addr:addr+length] was one, 0 if it
+ * overlaps none */
+static int _host_munmap(void* addr, size_t length)
+{
+    int ret = 0;
+    host_mapping_t** p;
+    host_mapping_t* m = NULL;
+
+    /* most processes never map from the host */
+    if (!__atomic_load_n(&_host_mappings, __ATOMIC_ACQUIRE))
+        return 0;
+
+    myst_mutex_lock(&_host_mappings_lock);
+
+    if ((p = _find_host_mapping(addr, length)))
+    {
+        if ((*p)->addr != addr || (*p)->length != length)
+            ERAISE(-EINVAL);
+
+        m = *p;
+        *p = m->next;
+        ret = 1;
+    }
+
+done:
+    myst_mutex_unlock(&_host_mappings_lock);
+
+    if (m)
+    {
+        myst_tcall_unmap_host_file(m->addr, m->length);
+        free(m);
+    }
+
+    return ret;
+}
+
+/* Whether [addr:addr+length] overlaps a host mapping (or, if whole is set,
+ * lies within one) */
+static bool _host_mapped(void* addr, size_t length, bool whole)
 {
-    msync_mapping_t* m;
+    bool ret = false;
+    host_mapping_t** p;
 
-    if (!(m = calloc(1, sizeof(msync_mapping_t))))
-        return NULL;
+    if (!__atomic_load_n(&_host_mappings, __ATOMIC_ACQUIRE))
+        return false;
 
-    m->fd = fd;
-    m->offset = offset;
-    m->addr = addr;
-    m->length = length;
+    myst_mutex_lock(&_host_mappings_lock);
 
-    return m;
+    if ((p = _find_host_mapping(addr, length)))
+    {
+        uint8_t* plo = (*p)->addr;
+        uint8_t* phi = plo + (*p)->length;
+
+        ret = !whole ||
+              ((uint8_t*)addr >= plo && (uint8_t*)addr + length <= phi);
+    }
+
+    myst_mutex_unlock(&_host_mappings_lock);
+
+    return ret;
 }
 
 static ssize_t _map_file_onto_memory(
@@ -122,24 +864,15 @@ static ssize_t _map_file_onto_memory(
     // ATTN: generate EACCES error if non-regular file or file not opened
     // for write when mmap_flags has MMAP_WRITE.
 
-    /* read file onto memory */
+    /* read file directly onto memory (bytes past end-of-file stay zero) */
     {
-        char buf[BUFSIZ];
         ssize_t n;
         uint8_t* p = addr;
         size_t r = length;
         size_t o = offset;
 
-        while ((n = pread(fd, buf, sizeof buf, o)) > 0)
+        while (r > 0 && (n = pread(fd, p, r, o)) > 0)
         {
-            /* if copy would write past end of buffer */
-            if (r < (size_t)n)
-            {
-                memcpy(p, buf, r);
-                break;
-            }
-
-            memcpy(p, buf, (size_t)n);
             p += n;
             o += n;
             r -= (size_t)n;
@@ -153,30 +886,246 @@ static ssize_t _map_file_onto_memory(
     /* if file is writable, then create msync mappings for msync() */
     if ((mmap_flags & MAP_SHARED) && flags & (O_RDWR | O_WRONLY))
     {
-        myst_spin_lock(&_msync_mappings_lock);
+        msync_mapping_t m = {NULL, myst_getpid(), offset, addr, length, NULL};
+        myst_fs_t* fs;
+        myst_file_t* file;
+
+        /* only files can be written back */
+        if (myst_fdtable_get_file(myst_fdtable_current(), fd, &fs, &file))
+            goto skip;
+
+        if (!(m.file = calloc(1, sizeof(msync_file_t))))
+            ERAISE(-ENOMEM);
+
+        /* the mapping holds its own handle of the file */
+        if ((*fs->fs_dup)(fs, file, &m.file->file) != 0)
+        {
+            free(m.file);
+            ERAISE(-ENOMEM);
+        }
+
+        m.file->fs = fs;
+        m.file->refs = 1;
+
+        /* record the page hashes so msync() can find dirty pages */
+        if (!(m.hashes = _hash_pages(addr, length)))
+        {
+            _put_msync_file(m.file);
+            ERAISE(-ENOMEM);
+        }
+
+        /* a fixed mapping replaces any mappings it overlaps */
+        if (_release_msync_mappings(addr, length, false) != 0)
         {
-            msync_mapping_t* m;
+            _put_msync_file(m.file);
+            free(m.hashes);
+            ERAISE(-ENOMEM);
+        }
 
-            /* create a new msync mapping */
-            if (!(m = _new_msync_mapping(fd, offset, addr, length)))
+        myst_spin_lock(&_msync_mappings_lock);
+        {
+            if (_insert_msync_mapping(&m) != 0)
             {
                 myst_spin_unlock(&_msync_mappings_lock);
+                _put_msync_file(m.file);
+                free(m.hashes);
                 ERAISE(-ENOMEM);
             }
-
-            /* add the new mysnc mapping to the list */
-            m->next = _msync_mappings;
-            _msync_mappings = m;
         }
         myst_spin_unlock(&_msync_mappings_lock);
     }
 
+skip:
+
     ret = bytes_read;
 
 done:
     return ret;
 }
 
+/*
+**==============================================================================
+**
+** The thread stack cache.
+**
+**     musl maps a stack (with its guard page and TLS area) for each thread
+**     and unmaps it when the thread is joined or exits. Releasing it to the
+**     VAD tree scrubs the whole range, and mapping the next stack takes the
+**     mman lock and zero-fills it again. Instead, munmap() keeps a few
+**     stack-sized ranges (which stay mapped in the VAD tree) and mmap()
+**     hands them out again for anonymous mappings of the same length. A
+**     cached range is zero-filled only when it is reused. It is scrubbed as
+**     usual if it is released for good, which happens when the cache is
+**     full or memory runs out.
+**
+**==============================================================================
+*/
+
+/* Sizes of the ranges that are cached: larger than arena mappings */
+#define STACK_CACHE_MIN_LENGTH (MYST_MMAN_ARENA_MAX_PAGES * PAGE_SIZE)
+#define STACK_CACHE_MAX_LENGTH (8 * 1024 * 1024)
+
+/* Bounds of the cache */
+#define STACK_CACHE_SIZE 16
+#define STACK_CACHE_MAX_BYTES (16 * 1024 * 1024)
+
+typedef struct stack_range
+{
+    void* addr;
+    size_t length;
+} stack_range_t;
+
+/* the most recently cached range is last (and the first to be reused) */
+static stack_range_t _stack_cache[STACK_CACHE_SIZE];
+static size_t _stack_cache_count;
+static size_t _stack_cache_bytes;
+static myst_spinlock_t _stack_cache_lock = MYST_SPINLOCK_INITIALIZER;
+
+static bool _stack_sized(size_t length)
+{
+    return length > STACK_CACHE_MIN_LENGTH && length <= STACK_CACHE_MAX_LENGTH;
+}
+
+/* Remove the cached range at INDEX (the caller holds the lock) */
+static void _stack_cache_remove(size_t index)
+{
+    stack_range_t* r = &_stack_cache[index];
+    const size_t n = _stack_cache_count - index - 1;
+
+    _stack_cache_bytes -= r->length;
+    memmove(r, r + 1, n * sizeof(stack_range_t));
+    _stack_cache_count--;
+}
+
+/* Take a cached range of LENGTH bytes (a page multiple) or return NULL */
+static void* _stack_cache_get(size_t length)
+{
+    void* addr = NULL;
+
+    if (!_stack_sized(length) ||
+        !__atomic_load_n(&_stack_cache_count, __ATOMIC_RELAXED))
+    {
+        return NULL;
+    }
+
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        for (size_t i = _stack_cache_count; i > 0; i--)
+        {
+            if (_stack_cache[i - 1].length == length)
+            {
+                addr = _stack_cache[i - 1].addr;
+                _stack_cache_remove(i - 1);
+                break;
+            }
+        }
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+
+    /* the new mapping is zero-filled (the deferred scrub of the old one) */
+    if (addr)
+    {
+        myst_memzero_nt(addr, length);
+        myst_counter_inc(MYST_COUNTER_STACK_CACHE_HITS);
+    }
+
+    return addr;
+}
+
+/* Drop the cached ranges that overlap [addr:addr+length] (page aligned),
+ * which the caller is about to unmap or map over. The parts outside of it
+ * are released for good and the parts inside are left to the caller, so
+ * the cache never hands out memory that is in use again */
+static void _stack_cache_evict(void* addr, size_t length)
+{
+    uint8_t* lo = addr;
+    uint8_t* hi = lo + length;
+    stack_range_t stale[2 * STACK_CACHE_SIZE];
+    size_t nstale = 0;
+
+    if (!__atomic_load_n(&_stack_cache_count, __ATOMIC_RELAXED))
+        return;
+
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        for (size_t i = _stack_cache_count; i > 0; i--)
+        {
+            const stack_range_t* r = &_stack_cache[i - 1];
+            uint8_t* rlo = r->addr;
+            uint8_t* rhi = rlo + r->length;
+
+            if (rhi <= lo || rlo >= hi)
+                continue;
+
+            if (rlo < lo)
+                stale[nstale++] = (stack_range_t){rlo, (size_t)(lo - rlo)};
+
+            if (rhi > hi)
+                stale[nstale++] = (stack_range_t){hi, (size_t)(rhi - hi)};
+
+            _stack_cache_remove(i - 1);
+        }
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+
+    for (size_t i = 0; i < nstale; i++)
+        myst_mman_munmap(&_mman, stale[i].addr, stale[i].length);
+}
+
+/* Keep [addr:addr+length] for reuse; return true if it was cached (call
+ * _stack_cache_evict() first, so that no cached range overlaps it) */
+static bool _stack_cache_put(void* addr, size_t length)
+{
+    bool cached = false;
+
+    if (!_stack_sized(length))
+        return false;
+
+    /* the whole range must be mapped (and not part of the break memory) */
+    if ((uintptr_t)addr < __atomic_load_n(&_mman.brk, __ATOMIC_RELAXED) ||
+        !myst_mman_is_mapped(&_mman, addr, length))
+    {
+        return false;
+    }
+
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        if (_stack_cache_count < STACK_CACHE_SIZE &&
+            _stack_cache_bytes + length <= STACK_CACHE_MAX_BYTES)
+        {
+            _stack_cache[_stack_cache_count].addr = addr;
+            _stack_cache[_stack_cache_count].length = length;
+            _stack_cache_count++;
+            _stack_cache_bytes += length;
+            cached = true;
+        }
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+
+    return cached;
+}
+
+/* Release the cached ranges for good and return how many there were */
+static size_t _stack_cache_drain(void)
+{
+    stack_range_t ranges[STACK_CACHE_SIZE];
+    size_t n;
+
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        n = _stack_cache_count;
+        memcpy(ranges, _stack_cache, n * sizeof(*_stack_cache));
+        _stack_cache_count = 0;
+        _stack_cache_bytes = 0;
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+
+    for (size_t i = 0; i < n; i++)
+        myst_mman_munmap(&_mman, ranges[i].addr, ranges[i].length);
+
+    return n;
+}
+
 /* ATTN-A: fix return types for this function */
 void* myst_mmap(
     void* addr,
@@ -191,6 +1140,8 @@ void* myst_mmap(
 
     (void)flags;
 
+    myst_counter_inc(MYST_COUNTER_MMAPS);
+
     // Linux ignores fd when the MAP_ANONYMOUS flag is present
     if (flags & MAP_ANONYMOUS)
         fd = -1;
@@ -218,6 +1169,41 @@ void* myst_mmap(
             return (void*)-1;
     }
 
+    /* read-only shared mappings of public hostfs files use host memory */
+    if (fd >= 0 && !addr && (flags & MAP_SHARED) &&
+        !(prot & (PROT_WRITE | PROT_EXEC)))
+    {
+        if ((ptr = _host_mmap(fd, length, offset)))
+            return ptr;
+
+        ptr = (void*)-1;
+    }
+
+    /* the mappings of a shared memory object share its pages */
+    if (fd >= 0 && !addr && (flags & MAP_SHARED))
+    {
+        myst_fs_t* fs;
+        myst_file_t* file;
+
+        if (_get_shm_object(fd, &fs, &file))
+            return _shm_mmap(fs, file, length, offset);
+    }
+
+    if (addr && length)
+    {
+        size_t n;
+
+        /* host memory cannot be mapped over */
+        if (_host_mapped(addr, length, false))
+            return (void*)-1;
+
+        /* a cached stack that this maps over is no longer free */
+        if (myst_round_up(length, PAGE_SIZE, &n) != 0)
+            return (void*)-1;
+
+        _stack_cache_evict(addr, n);
+    }
+
     if (fd >= 0 && addr)
     {
         ssize_t n;
@@ -236,7 +1222,33 @@ void* myst_mmap(
 
     int tflags = MYST_MAP_ANONYMOUS | MYST_MAP_PRIVATE;
 
-    if ((r = myst_mman_mmap(&_mman, addr, length, prot, tflags, &ptr)) < 0)
+    /* reuse a recently unmapped stack (see the stack cache above) */
+    if (!addr && fd < 0 && length <= STACK_CACHE_MAX_LENGTH)
+    {
+        size_t n;
+        void* stack;
+
+        if (myst_round_up(length, PAGE_SIZE, &n) == 0 &&
+            (stack = _stack_cache_get(n)))
+        {
+            return stack;
+        }
+    }
+
+    if (addr)
+        r = myst_mman_mmap(&_mman, addr, length, prot, tflags, &ptr);
+    else
+        r = myst_mman_arena_mmap(
+            &_mman, _arena_key(), length, prot, tflags, &ptr);
+
+    /* the cached stacks are the first memory to give back */
+    if (r == -ENOMEM && !addr && _stack_cache_drain())
+    {
+        r = myst_mman_arena_mmap(
+            &_mman, _arena_key(), length, prot, tflags, &ptr);
+    }
+
+    if (r < 0)
         return (void*)(long)r;
 
     if (fd >= 0 && !addr)
@@ -267,6 +1279,16 @@ void* myst_mremap(
     if (new_address)
         return (void*)-EINVAL;
 
+    /* the range (or its growth in place) may take in a cached stack */
+    if (!((uintptr_t)old_address % PAGE_SIZE))
+    {
+        size_t size = (new_size > old_size) ? new_size : old_size;
+        size_t n;
+
+        if (myst_round_up(size, PAGE_SIZE, &n) == 0)
+            _stack_cache_evict(old_address, n);
+    }
+
     r = myst_mman_mremap(&_mman, old_address, old_size, new_size, flags, &p);
 
     if (r != 0)
@@ -278,130 +1300,148 @@ void* myst_mremap(
 MYST_UNUSED
 static void _dump_msync_mappings(void)
 {
-    for (msync_mapping_t* p = _msync_mappings; p; p = p->next)
+    for (size_t i = 0; i < _msync_mappings_size; i++)
     {
+        const msync_mapping_t* p = &_msync_mappings[i];
         printf("[%p][%zu][%zu]\n", p->addr, p->length, p->length / 4096);
     }
 
     printf("\n");
 }
 
-/* release msync mappings that are contained in the range [addr:addr+length] */
-static int _release_msync_mappings(void* addr, size_t length)
+/* release msync mappings that are contained in the range [addr:addr+length]
+ * (first writing back any dirty pages in that range if sync is true) */
+static int _release_msync_mappings(void* addr, size_t length, bool sync)
 {
     int ret = 0;
+    uint8_t* lo = addr;
+    uint8_t* hi = (uint8_t*)addr + (_num_pages(length) * PAGE_SIZE);
+    msync_file_t* closing = NULL;
+
+    if (sync && _sync_msync_mappings(lo, hi) != 0)
+        ret = -EIO;
 
     myst_spin_lock(&_msync_mappings_lock);
     {
-        msync_mapping_t* p = _msync_mappings;
-        msync_mapping_t* prev = NULL;
+        size_t i = _find_msync_mapping(lo);
 
-        while (p)
+        while (i < _msync_mappings_size)
         {
-            msync_mapping_t* next = p->next;
-            uint8_t* lo = addr;
-            uint8_t* hi = (uint8_t*)addr + length;
+            msync_mapping_t* p = &_msync_mappings[i];
             uint8_t* plo = p->addr;
             uint8_t* phi = (uint8_t*)p->addr + p->length;
             uint8_t* maxlo = _max_ptr(lo, plo);
             uint8_t* minhi = _min_ptr(hi, phi);
+            size_t llength = maxlo - plo;
+            size_t rlength = phi - minhi;
+            size_t roffset = p->offset + (minhi - plo);
+            size_t rindex = (size_t)(minhi - plo) / PAGE_SIZE;
 
-            /* if there is an overlap */
-            if (maxlo < minhi)
-            {
-                size_t llength = maxlo - plo;
-                size_t rlength = phi - minhi;
-                size_t roffset = p->offset + (minhi - plo);
+            /* mappings are sorted, so stop at the first one past the range */
+            if (plo >= hi)
+                break;
 
-                //     .........
-                // ..........
-                //
-                // .........
-                //     ..........
+            // left range:  [plo:llength]
+            // right range: [minhi:rlength]
 
-                // left range:  [plo:llength]
-                // right range: [maxhi:rlength]
+            if (llength && rlength)
+            {
+                msync_mapping_t rm = {
+                    p->file, p->pid, roffset, minhi, rlength, NULL};
+                size_t rsize = _num_pages(rlength) * sizeof(uint64_t);
 
-                if (llength && rlength)
+                /* create the right mapping */
+                if (!(rm.hashes = malloc(rsize)))
                 {
-                    // printf("case1: split\n");
-                    msync_mapping_t* rm;
-
-                    /* create the right mapping */
-                    if (!(rm = _new_msync_mapping(
-                              p->fd,
-                              roffset,   /* offset */
-                              minhi,     /* addr */
-                              rlength))) /* length */
-                    {
-                        ERAISE(-ENOMEM);
-                    }
-
-                    /* insert right mapping into list */
-                    rm->next = p->next;
-                    p->next = rm;
-
-                    /* update the left mapping length */
-                    p->length = llength;
-                    prev = rm;
+                    ret = -ENOMEM;
+                    break;
                 }
-                else if (llength)
-                {
-                    // printf("case2: left\n");
 
-                    /* update the left mapping length */
-                    p->length = llength;
-                    prev = p;
-                }
-                else if (rlength)
+                memcpy(rm.hashes, p->hashes + rindex, rsize);
+
+                /* update the left mapping length */
+                p->length = llength;
+
+                /* insert the right mapping after the left one */
+                if (_insert_msync_mapping(&rm) != 0)
                 {
-                    // printf("case3: right\n");
-                    p->offset = roffset;
-                    p->addr = minhi;
-                    p->length = rlength;
-                    prev = p;
+                    p->length = llength + (size_t)(minhi - maxlo) + rlength;
+                    free(rm.hashes);
+                    ret = -ENOMEM;
+                    break;
                 }
-                else
-                {
-                    // printf("case4: remove\n");
-                    if (prev)
-                        prev->next = p->next;
-                    else
-                        _msync_mappings = p->next;
 
-                    free(p);
-                }
+                /* both halves refer to the file */
+                __atomic_add_fetch(&rm.file->refs, 1, __ATOMIC_RELAXED);
+                i += 2;
+            }
+            else if (llength)
+            {
+                /* update the left mapping length */
+                p->length = llength;
+                i++;
+            }
+            else if (rlength)
+            {
+                memmove(
+                    p->hashes,
+                    p->hashes + rindex,
+                    _num_pages(rlength) * sizeof(uint64_t));
+                p->offset = roffset;
+                p->addr = minhi;
+                p->length = rlength;
+                i++;
             }
             else
             {
-                prev = p;
+                _remove_msync_mapping(i, &closing);
             }
-
-            p = next;
         }
     }
     myst_spin_unlock(&_msync_mappings_lock);
 
-    goto done;
+    _close_msync_files(closing);
 
-done:
     return ret;
 }
 
 int myst_munmap(void* addr, size_t length)
 {
     int ret = 0;
+    int r;
 
     /* address cannot be null and must be aligned on a page boundary */
     if (!addr || ((uint64_t)addr % PAGE_SIZE) || !length)
         ERAISE(-EINVAL);
 
+    myst_counter_inc(MYST_COUNTER_MUNMAPS);
+
     /* align length to a page boundary */
     ECHECK(myst_round_up(length, PAGE_SIZE, &length));
 
-    ECHECK(myst_mman_munmap(&_mman, addr, length));
+    /* host mappings go back to the host */
+    ECHECK(r = _host_munmap(addr, length));
+
+    if (r == 1)
+        goto done;
+
+    /* other mappings of a shared memory object may still use the pages */
+    ECHECK(r = _shm_munmap(addr, length));
+
+    if (r == 1)
+        goto done;
+
+    /* write back dirty shared pages before the memory is released */
+    _release_msync_mappings(addr, length, true);
 
-    ECHECK(_release_msync_mappings(addr, length));
+    /* keep a stack for the next thread rather than scrub it now (but not
+     * one that overlaps this range, which may only unmap part of it) */
+    _stack_cache_evict(addr, length);
+
+    if (_stack_cache_put(addr, length))
+        goto done;
+
+    ECHECK(myst_mman_munmap(&_mman, addr, length));
 
 #if 0
     // ATTN-2AA04DD0: fails during process cleanup for unknown reasons. When
@@ -455,6 +1495,16 @@ struct myst_process_mapping
 static myst_process_mapping_t* _mappings;
 static myst_spinlock_t _mappings_lock;
 
+int myst_get_mman_stats(myst_mman_stats_t* stats)
+{
+    return myst_mman_stats(&_mman, stats);
+}
+
+size_t myst_get_vads(uintptr_t addr, myst_vad_t* vads, size_t count)
+{
+    return myst_mman_get_vads(&_mman, addr, vads, count);
+}
+
 /* keep track of mappings made by this process */
 int myst_register_process_mapping(pid_t pid, void* addr, size_t size)
 {
@@ -525,31 +1575,6 @@ done:
     return ret;
 }
 
-static int _sync_file(int fd, off_t offset, const void* addr, size_t length)
-{
-    int ret = 0;
-    const uint8_t* p = (const uint8_t*)addr;
-    size_t r = length;
-    off_t o = offset;
-
-    while (r > 0)
-    {
-        ssize_t n = pwrite(fd, p, r, o);
-
-        if (n == 0)
-            break;
-        else if (n < 0)
-            ERAISE(n);
-
-        p += n;
-        o += n;
-        r -= (size_t)n;
-    }
-
-done:
-    return ret;
-}
-
 int myst_msync(void* addr, size_t length, int flags)
 {
     int ret = 0;
@@ -572,92 +1597,165 @@ int myst_msync(void* addr, size_t length, int flags)
     // that they too are updated to reflect the contents of the file with
     // or without the MS_INVALIDATE flag).
 
+    /* flush the dirty pages of msync mappings in this address range */
+    ECHECK(_sync_msync_mappings(addr, (uint8_t*)addr + length));
+
+    // ATTN: currently msync() does not update other mappings of the same
+    // file. This would involve refreshing those mappings from the file
+    // blocks. This case may be rare since it would require mapping the
+    // same file to different memory regions.
+
+    ECHECK(_shm_msync(addr, length));
+
+done:
+    return ret;
+}
+
+/* zero [lo:hi] except where shared file mappings overlap it, whose memory
+ * stands for the file (as the page cache would on Linux) */
+static void _zero_private_pages(uint8_t* lo, uint8_t* hi)
+{
     myst_spin_lock(&_msync_mappings_lock);
     {
-        /* flush any msync mappings contained by this address range */
-        for (msync_mapping_t* p = _msync_mappings; p; p = p->next)
+        for (size_t i = _find_msync_mapping(lo); i < _msync_mappings_size; i++)
         {
-            uint8_t* lo = addr;
-            uint8_t* hi = (uint8_t*)addr + length;
+            const msync_mapping_t* p = &_msync_mappings[i];
             uint8_t* plo = p->addr;
             uint8_t* phi = (uint8_t*)p->addr + p->length;
-            uint8_t* maxlo = _max_ptr(lo, plo);
-            uint8_t* minhi = _min_ptr(hi, phi);
 
-            // [AAAAAAAAAAAAAAAAA]
-            //       [MMMMMMMMMMMMMMMMMMMMM]
-            //       ^           ^
-            //      maxlo      minhi
-            //
-            //       [AAAAAAAAAAAAAAAAA]
-            // [MMMMMMMMMMMMMMM]
-            //       ^         ^
-            //      maxlo     minhi
-
-            if (maxlo < minhi)
-            {
-                ECHECK(_sync_file(
-                    p->fd,                     /* fd */
-                    p->offset + (maxlo - plo), /* offset */
-                    maxlo,                     /* addr */
-                    minhi - maxlo));           /* length */
-            }
+            /* mappings are sorted, so stop at the first one past the range */
+            if (plo >= hi)
+                break;
+
+            if (plo > lo)
+                myst_memzero_nt(lo, (size_t)(plo - lo));
+
+            lo = _max_ptr(lo, phi);
         }
 
-        // ATTN: currently msync() does not update other mappings of the same
-        // file. This would involve refreshing those mappings from the file
-        // blocks. This case may be rare since it would require mapping the
-        // same file to different memory regions.
+        if (lo < hi)
+            myst_memzero_nt(lo, (size_t)(hi - lo));
     }
     myst_spin_unlock(&_msync_mappings_lock);
+}
+
+/*
+** Mappings are always committed and file mappings are read in full by
+** mmap(), so the advice that Linux applies to its page tables and page cache
+** comes down to this:
+**
+**     MADV_DONTNEED - the pages read as zero afterwards, which allocators
+**                     that return memory this way rely on (the pages of
+**                     shared file mappings keep the file contents instead)
+**     MADV_FREE     - the pages may keep their contents until written,
+**                     which is what they do
+**     MADV_WILLNEED - the pages of file mappings are already present
+**
+** The other known advice only tunes paging and is accepted as is.
+*/
+int myst_madvise(void* addr, size_t length, int advice)
+{
+    int ret = 0;
+
+    if ((uint64_t)addr % PAGE_SIZE)
+        ERAISE(-EINVAL);
+
+    switch (advice)
+    {
+        case MADV_NORMAL:
+        case MADV_RANDOM:
+        case MADV_SEQUENTIAL:
+        case MADV_WILLNEED:
+        case MADV_DONTNEED:
+        case MADV_FREE:
+        case MADV_DONTFORK:
+        case MADV_DOFORK:
+        case MADV_MERGEABLE:
+        case MADV_UNMERGEABLE:
+        case MADV_HUGEPAGE:
+        case MADV_NOHUGEPAGE:
+        case MADV_DONTDUMP:
+        case MADV_DODUMP:
+        case MADV_WIPEONFORK:
+        case MADV_KEEPONFORK:
+            break;
+        default:
+            ERAISE(-EINVAL);
+    }
+
+    if (length == 0)
+        goto done;
+
+    ECHECK(myst_round_up(length, PAGE_SIZE, &length));
+
+    /* host pages are left to the host */
+    if (_host_mapped(addr, length, true))
+        goto done;
+
+    if (!myst_mman_is_mapped(&_mman, addr, length))
+        ERAISE(-ENOMEM);
+
+    if (advice == MADV_DONTNEED)
+        _zero_private_pages(addr, (uint8_t*)addr + length);
 
 done:
     return ret;
 }
 
-/* notified on close to remove msync mappings involving fd */
-void myst_mman_close_notify(int fd)
+/* every mapped page is resident (see myst_madvise()) */
+int myst_mincore(void* addr, size_t length, unsigned char* vec)
 {
-    int flags;
-    struct stat buf;
+    int ret = 0;
 
-    /* get the file open flags */
-    if (fd < 0 || (flags = myst_syscall_fcntl(fd, F_GETFL, 0)) < 0)
-        return;
+    if ((uint64_t)addr % PAGE_SIZE)
+        ERAISE(-EINVAL);
 
-    /* only do this for regular files */
-    if (myst_syscall_fstat(fd, &buf) != 0 || !S_ISREG(buf.st_mode))
-        return;
+    if (length == 0)
+        goto done;
+
+    if (!vec)
+        ERAISE(-EFAULT);
+
+    ECHECK(myst_round_up(length, PAGE_SIZE, &length));
 
-    /* if file is open for write */
-    if (flags & (O_RDWR | O_WRONLY))
+    if (!_host_mapped(addr, length, true) &&
+        !myst_mman_is_mapped(&_mman, addr, length))
     {
-        myst_spin_lock(&_msync_mappings_lock);
-        {
-            msync_mapping_t* p = _msync_mappings;
-            msync_mapping_t* prev = NULL;
+        ERAISE(-ENOMEM);
+    }
 
-            while (p)
-            {
-                msync_mapping_t* next = p->next;
+    memset(vec, 1, length / PAGE_SIZE);
 
-                if (p->fd == fd)
-                {
-                    if (prev)
-                        prev->next = p->next;
-                    else
-                        _msync_mappings = p->next;
+done:
+    return ret;
+}
 
-                    free(p);
-                }
-                else
-                {
-                    prev = p;
-                }
+/* write back and release the msync mappings made by an exiting process */
+void myst_msync_release_process(pid_t pid)
+{
+    for (;;)
+    {
+        void* addr = NULL;
+        size_t length = 0;
+
+        myst_spin_lock(&_msync_mappings_lock);
 
-                p = next;
+        for (size_t i = 0; i < _msync_mappings_size; i++)
+        {
+            if (_msync_mappings[i].pid == pid)
+            {
+                addr = _msync_mappings[i].addr;
+                length = _msync_mappings[i].length;
+                break;
             }
         }
+
         myst_spin_unlock(&_msync_mappings_lock);
+
+        if (!addr)
+            break;
+
+        /* the whole mapping is released, so this cannot fail to split it */
+        _release_msync_mappings(addr, length, true);
     }
 }
@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mount.h>
 
 #include <myst/atexit.h>
 #include <myst/blkdev.h>
@@ -18,34 +19,250 @@
 #include <myst/ramfs.h>
 #include <myst/realpath.h>
 #include <myst/roothash.h>
+#include <myst/rwlock.h>
 #include <myst/sha256.h>
-#include <myst/spinlock.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
 #include <myst/verity.h>
 
-#define MOUNT_TABLE_SIZE 8
-
-typedef struct mount_table_entry
+/* the most file systems that may be mounted at once */
+#define MAX_MOUNTS 64
+
+/*
+**==============================================================================
+**
+** The mount points form a trie with one node per path component, rooted at
+** the node for "/". A node has a file system when something is mounted on
+** it. Resolving a path walks the trie one component at a time, remembering
+** the deepest mounted node on the way, so the longest matching mount point
+** is found in a single pass over the path. Nodes that are neither mounted
+** nor on the way to a mount point are pruned by umount.
+**
+**==============================================================================
+*/
+
+typedef struct mount_node mount_node_t;
+
+struct mount_node
 {
-    char* path;
-    size_t path_size;
-    myst_fs_t* fs;
-    uint32_t flags;
-} mount_table_entry_t;
-
-static mount_table_entry_t _mount_table[MOUNT_TABLE_SIZE];
-static size_t _mount_table_size = 0;
-static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
+    char* name; /* the path component (empty for the root) */
+    size_t name_len;
+    mount_node_t* parent;
+    mount_node_t* children;
+    mount_node_t* next; /* the next sibling */
+    myst_fs_t* fs;      /* null unless a file system is mounted here */
+};
+
+static char _root_name[] = "";
+static mount_node_t _root = {.name = _root_name};
+static size_t _num_mounts = 0;
+/* resolve takes this for reading; mount and umount take it for writing */
+static myst_rwlock_t _lock = MYST_RWLOCK_INITIALIZER;
 
 static bool _installed_free_mount_table = false;
 
+static void _free_nodes(mount_node_t* node)
+{
+    while (node)
+    {
+        mount_node_t* next = node->next;
+
+        _free_nodes(node->children);
+        free(node->name);
+        free(node);
+        node = next;
+    }
+}
+
 static void _free_mount_table(void* arg)
 {
     (void)arg;
 
-    for (size_t i = 0; i < _mount_table_size; i++)
-        free(_mount_table[i].path);
+    _free_nodes(_root.children);
+    _root.children = NULL;
+}
+
+/* Get the length of the path component that p points to */
+/* The name of the type of a file system (from its statfs() f_type) */
+static const char* _fs_type_name(myst_fs_t* fs)
+{
+    struct statfs buf;
+
+    if (!fs->fs_statfs || (*fs->fs_statfs)(fs, "/", &buf) != 0)
+        return "none";
+
+    switch (buf.f_type)
+    {
+        case MYST_RAMFS_TYPE:
+            return "ramfs";
+        case MYST_PROC_TYPE:
+            return "proc";
+        case MYST_SYSFS_TYPE:
+            return "sysfs";
+        case MYST_CGROUP2_TYPE:
+            return "cgroup2";
+        case 0xef53:
+            return "ext2";
+        default:
+            return "none";
+    }
+}
+
+/* Append the mountinfo lines of the mounts at or below node (whose path is
+ * path[0:len]) given the id of the mount that contains node */
+static int _format_mounts(
+    myst_buf_t* buf,
+    const mount_node_t* node,
+    char path[PATH_MAX],
+    size_t len,
+    int parent_id,
+    int* next_id)
+{
+    int ret = 0;
+    int id = parent_id;
+
+    if (node->fs)
+    {
+        const char* type = _fs_type_name(node->fs);
+        char tmp[64];
+        int n;
+
+        id = (*next_id)++;
+
+        n = snprintf(tmp, sizeof(tmp), "%d %d 0:%d / ", id, parent_id, id);
+        ECHECK(myst_buf_append(buf, tmp, (size_t)n));
+        ECHECK(myst_buf_append(buf, len ? path : "/", len ? len : 1));
+
+        n = snprintf(tmp, sizeof(tmp), " rw,relatime - %s %s rw\n", type, type);
+        ECHECK(myst_buf_append(buf, tmp, (size_t)n));
+    }
+
+    for (const mount_node_t* p = node->children; p; p = p->next)
+    {
+        if (len + 1 + p->name_len >= PATH_MAX)
+            ERAISE(-ENAMETOOLONG);
+
+        path[len] = '/';
+        memcpy(path + len + 1, p->name, p->name_len);
+        ECHECK(_format_mounts(
+            buf, p, path, len + 1 + p->name_len, id, next_id));
+    }
+
+done:
+    return ret;
+}
+
+int myst_format_mountinfo(myst_buf_t* buf)
+{
+    int ret = 0;
+    char path[PATH_MAX];
+    int next_id = 1;
+
+    if (!buf)
+        ERAISE(-EINVAL);
+
+    myst_rwlock_rdlock(&_lock);
+    ret = _format_mounts(buf, &_root, path, 0, 0, &next_id);
+    myst_rwlock_rdunlock(&_lock);
+
+done:
+    return ret;
+}
+
+static size_t _component_len(const char* p)
+{
+    const char* start = p;
+
+    while (*p && *p != '/')
+        p++;
+
+    return p - start;
+}
+
+static mount_node_t* _find_child(
+    const mount_node_t* node,
+    const char* name,
+    size_t len)
+{
+    for (mount_node_t* p = node->children; p; p = p->next)
+    {
+        if (p->name_len == len && memcmp(p->name, name, len) == 0)
+            return p;
+    }
+
+    return NULL;
+}
+
+/* Find the node for the normalized path (creating it if create is true) */
+static int _find_node(const char* path, bool create, mount_node_t** node_out)
+{
+    int ret = 0;
+    mount_node_t* node = &_root;
+    const char* p = path;
+
+    *node_out = NULL;
+
+    for (;;)
+    {
+        mount_node_t* child;
+        size_t len;
+
+        while (*p == '/')
+            p++;
+
+        if (*p == '\0')
+            break;
+
+        len = _component_len(p);
+
+        if (!(child = _find_child(node, p, len)))
+        {
+            if (!create)
+                ERAISE(-ENOENT);
+
+            if (!(child = calloc(1, sizeof(mount_node_t))))
+                ERAISE(-ENOMEM);
+
+            if (!(child->name = malloc(len + 1)))
+            {
+                free(child);
+                ERAISE(-ENOMEM);
+            }
+
+            memcpy(child->name, p, len);
+            child->name[len] = '\0';
+            child->name_len = len;
+            child->parent = node;
+            child->next = node->children;
+            node->children = child;
+        }
+
+        node = child;
+        p += len;
+    }
+
+    *node_out = node;
+
+done:
+    return ret;
+}
+
+/* Remove the nodes that lead to no mount point, from node upward */
+static void _prune(mount_node_t* node)
+{
+    while (node != &_root && !node->fs && !node->children)
+    {
+        mount_node_t* parent = node->parent;
+        mount_node_t** pp = &parent->children;
+
+        while (*pp != node)
+            pp = &(*pp)->next;
+
+        *pp = node->next;
+        free(node->name);
+        free(node);
+        node = parent;
+    }
 }
 
 int myst_mount_resolve(
@@ -54,10 +271,10 @@ int myst_mount_resolve(
     myst_fs_t** fs_out)
 {
     int ret = 0;
-    size_t match_len = 0;
     myst_path_t realpath;
     bool locked = false;
     myst_fs_t* fs = NULL;
+    const char* rest = NULL;
 
     if (fs_out)
         *fs_out = NULL;
@@ -68,44 +285,54 @@ int myst_mount_resolve(
     /* Find the real path (the absolute non-relative path). */
     ECHECK(myst_realpath(path, &realpath));
 
-    myst_spin_lock(&_lock);
+    /* the TLS credentials appear once they are generated */
+    myst_wait_tls_credentials(realpath.buf);
+
+    myst_rwlock_rdlock(&_lock);
     locked = true;
 
-    /* Find the longest binding point that contains this path. */
-    for (size_t i = 0; i < _mount_table_size; i++)
+    /* Find the deepest mount point on the way down the path */
     {
-        size_t len = strlen(_mount_table[i].path);
-        const char* mpath = _mount_table[i].path;
+        const mount_node_t* node = &_root;
+        const char* p = realpath.buf;
 
-        if (mpath[0] == '/' && mpath[1] == '\0')
+        if (_root.fs)
         {
-            if (len > match_len)
-            {
-                myst_strlcpy(suffix, realpath.buf, PATH_MAX);
-                match_len = len;
-                fs = _mount_table[i].fs;
-            }
+            fs = _root.fs;
+            rest = p;
         }
-        else if (
-            strncmp(mpath, realpath.buf, len) == 0 &&
-            (realpath.buf[len] == '/' || realpath.buf[len] == '\0'))
+
+        for (;;)
         {
-            if (len > match_len)
-            {
-                myst_strlcpy(suffix, realpath.buf + len, PATH_MAX);
+            size_t len;
+
+            while (*p == '/')
+                p++;
+
+            if (*p == '\0')
+                break;
+
+            len = _component_len(p);
 
-                if (*suffix == '\0')
-                    myst_strlcpy(suffix, "/", PATH_MAX);
+            if (!(node = _find_child(node, p, len)))
+                break;
 
-                match_len = len;
-                fs = _mount_table[i].fs;
+            p += len;
+
+            if (node->fs)
+            {
+                fs = node->fs;
+                rest = p;
             }
         }
     }
 
+    if (fs)
+        myst_strlcpy(suffix, *rest ? rest : "/", PATH_MAX);
+
     if (locked)
     {
-        myst_spin_unlock(&_lock);
+        myst_rwlock_rdunlock(&_lock);
         locked = false;
     }
 
@@ -117,7 +344,7 @@ int myst_mount_resolve(
 done:
 
     if (locked)
-        myst_spin_unlock(&_lock);
+        myst_rwlock_rdunlock(&_lock);
 
     return ret;
 }
@@ -127,7 +354,7 @@ int myst_mount(myst_fs_t* fs, const char* source, const char* target)
     int ret = -1;
     bool locked = false;
     myst_path_t target_buf;
-    mount_table_entry_t mount_table_entry = {0};
+    mount_node_t* node = NULL;
 
     if (!fs || !source || !target)
         ERAISE(-EINVAL);
@@ -155,7 +382,7 @@ int myst_mount(myst_fs_t* fs, const char* source, const char* target)
     }
 
     /* Lock the mount table. */
-    myst_spin_lock(&_lock);
+    myst_rwlock_wrlock(&_lock);
     locked = true;
 
     /* Install _free_mount_table() if not already installed. */
@@ -166,41 +393,35 @@ int myst_mount(myst_fs_t* fs, const char* source, const char* target)
     }
 
     /* Fail if mount table exhausted. */
-    if (_mount_table_size == MOUNT_TABLE_SIZE)
+    if (_num_mounts == MAX_MOUNTS)
         ERAISE(-ENOMEM);
 
+    ECHECK(_find_node(target, true, &node));
+
     /* Reject duplicate mount paths. */
-    for (size_t i = 0; i < _mount_table_size; i++)
+    if (node->fs)
     {
-        if (strcmp(_mount_table[i].path, target) == 0)
-            ERAISE(-EEXIST);
+        node = NULL;
+        ERAISE(-EEXIST);
     }
 
     /* Tell the file system that it has been mounted */
     ECHECK((*fs->fs_mount)(fs, source, target));
 
-    /* Assign and initialize new mount point. */
-    {
-        if (!(mount_table_entry.path = strdup(target)))
-            ERAISE(-ENOMEM);
-
-        mount_table_entry.path_size = strlen(target) + 1;
-        mount_table_entry.fs = fs;
-        mount_table_entry.flags = 0;
-    }
-
-    _mount_table[_mount_table_size++] = mount_table_entry;
-    mount_table_entry.path = NULL;
+    node->fs = fs;
+    node = NULL;
+    _num_mounts++;
 
     ret = 0;
 
 done:
 
-    if (mount_table_entry.path)
-        free(mount_table_entry.path);
+    /* remove any nodes created for a failed mount */
+    if (node)
+        _prune(node);
 
     if (locked)
-        myst_spin_unlock(&_lock);
+        myst_rwlock_wrunlock(&_lock);
 
     return ret;
 }
@@ -209,46 +430,38 @@ int myst_umount(const char* target)
 {
     int ret = 0;
     myst_path_t realpath;
-    bool found = false;
-
-    myst_spin_lock(&_lock);
+    bool locked = false;
+    mount_node_t* node;
 
     /* Find the real path (the absolute non-relative path) */
     ECHECK(myst_realpath(target, &realpath));
 
-    /* search the mount table for an entry with this name */
-    for (size_t i = 0; i < _mount_table_size; i++)
-    {
-        mount_table_entry_t* entry = &_mount_table[i];
+    myst_rwlock_wrlock(&_lock);
+    locked = true;
 
-        if (strcmp(entry->path, realpath.buf) == 0)
-        {
-            /* release the path */
-            free(entry->path);
+    /* find the node of this mount point */
+    ECHECK(_find_node(realpath.buf, false, &node));
 
-            /* release the file system */
-            ECHECK((*entry->fs->fs_release)(entry->fs));
+    if (!node->fs)
+        ERAISE(-ENOENT);
 
-            /* remove this entry from the mount table */
-            _mount_table[i] = _mount_table[_mount_table_size - 1];
-            _mount_table_size--;
+    /* release the file system */
+    ECHECK((*node->fs->fs_release)(node->fs));
 
-            found = true;
-            break;
-        }
-    }
-
-    if (!found)
-        ERAISE(-ENOENT);
+    /* remove this mount point and the nodes that only led to it */
+    node->fs = NULL;
+    _num_mounts--;
+    _prune(node);
 
 done:
 
-    myst_spin_unlock(&_lock);
+    if (locked)
+        myst_rwlock_wrunlock(&_lock);
 
     return ret;
 }
 
-#ifdef MYST_ENABLE_EXT2FS
+#if defined(MYST_ENABLE_EXT2FS) || defined(MYST_ENABLE_HOSTFS)
 static const char* _find_arg(const char* args[], const char* name)
 {
     if (!args)
@@ -266,7 +479,121 @@ static const char* _find_arg(const char* args[], const char* name)
     /* not found */
     return NULL;
 }
-#endif /* MYST_ENABLE_EXT2FS */
+#endif /* MYST_ENABLE_EXT2FS || MYST_ENABLE_HOSTFS */
+
+#ifdef MYST_ENABLE_HOSTFS
+/* Parse a decimal number (of at most nine digits) */
+static int _parse_number(const char* s, uint64_t* out)
+{
+    int ret = 0;
+    uint64_t x = 0;
+
+    if (!*s || strlen(s) > 9)
+        ERAISE(-EINVAL);
+
+    for (const char* p = s; *p; p++)
+    {
+        if (*p < '0' || *p > '9')
+            ERAISE(-EINVAL);
+
+        x = x * 10 + (uint64_t)(*p - '0');
+    }
+
+    *out = x;
+
+done:
+    return ret;
+}
+
+/* Apply the "cache", "cache-ttl" (milliseconds), "io-buffer" (bytes),
+ * "flush-interval" (milliseconds), "mmap" and "mmap-manifest" (a path)
+ * arguments */
+static int _set_hostfs_options(myst_fs_t* fs, const char* args[])
+{
+    int ret = 0;
+    const char* cache = _find_arg(args, "cache");
+    const char* ttl = _find_arg(args, "cache-ttl");
+    const char* buffer = _find_arg(args, "io-buffer");
+    const char* interval = _find_arg(args, "flush-interval");
+    const char* map = _find_arg(args, "mmap");
+    const char* manifest = _find_arg(args, "mmap-manifest");
+    myst_hostfs_cache_t mode = MYST_HOSTFS_CACHE_NONE;
+    myst_hostfs_mmap_t mmap_mode = MYST_HOSTFS_MMAP_COPY;
+    uint64_t ttl_msec = 0;
+    uint64_t buffer_size = 0;
+    uint64_t flush_msec = MYST_HOSTFS_DEFAULT_FLUSH_MSEC;
+
+    if (!cache || strcmp(cache, "none") == 0)
+        mode = MYST_HOSTFS_CACHE_NONE;
+    else if (strcmp(cache, "ttl") == 0)
+        mode = MYST_HOSTFS_CACHE_TTL;
+    else if (strcmp(cache, "exclusive") == 0)
+        mode = MYST_HOSTFS_CACHE_EXCLUSIVE;
+    else
+        ERAISE(-EINVAL);
+
+    if (ttl)
+    {
+        if (mode != MYST_HOSTFS_CACHE_TTL)
+            ERAISE(-EINVAL);
+
+        ECHECK(_parse_number(ttl, &ttl_msec));
+    }
+
+    if (buffer)
+        ECHECK(_parse_number(buffer, &buffer_size));
+
+    if (interval)
+    {
+        if (!buffer)
+            ERAISE(-EINVAL);
+
+        ECHECK(_parse_number(interval, &flush_msec));
+    }
+
+    if (!map || strcmp(map, "copy") == 0)
+        mmap_mode = MYST_HOSTFS_MMAP_COPY;
+    else if (strcmp(map, "host") == 0)
+        mmap_mode = MYST_HOSTFS_MMAP_HOST;
+    else
+        ERAISE(-EINVAL);
+
+    if (cache)
+        ECHECK(myst_hostfs_set_cache(fs, mode, ttl_msec));
+
+    if (buffer)
+        ECHECK(myst_hostfs_set_buffering(fs, buffer_size, flush_msec));
+
+    if (map || manifest)
+        ECHECK(myst_hostfs_set_mmap(fs, mmap_mode, manifest));
+
+done:
+    return ret;
+}
+#endif /* MYST_ENABLE_HOSTFS */
+
+#ifndef MS_LAZYTIME
+#define MS_LAZYTIME (1 << 25)
+#endif
+
+/* The mount flags that ramfs and ext2 mounts take (MS_LAZYTIME is what
+ * their inode caches do anyway) */
+#define ATIME_MOUNT_FLAGS                                        \
+    (MS_NOATIME | MS_NODIRATIME | MS_RELATIME | MS_STRICTATIME | \
+     MS_LAZYTIME)
+
+/* Apply the access time flags (ext2 keeps its default without any) */
+static void _set_atime(myst_fs_t* fs, unsigned long mountflags)
+{
+    if (mountflags & MS_NOATIME)
+        fs->atime = MYST_ATIME_NONE;
+    else if (mountflags & MS_STRICTATIME)
+        fs->atime = MYST_ATIME_STRICT;
+    else if (mountflags & MS_RELATIME)
+        fs->atime = MYST_ATIME_RELATIME;
+
+    fs->nodiratime = (mountflags & MS_NODIRATIME) != 0;
+}
 
 long myst_syscall_mount(
     const char* source,
@@ -284,12 +611,13 @@ long myst_syscall_mount(
 
     if (strcmp(filesystemtype, "ramfs") == 0)
     {
-        /* these arguments should be zero and null */
-        if (mountflags || data)
+        /* only the access time flags are taken (and no data) */
+        if ((mountflags & ~ATIME_MOUNT_FLAGS) || data)
             ERAISE(-EINVAL);
 
         /* create a new ramfs instance */
         ECHECK(myst_init_ramfs(myst_mount_resolve, &fs));
+        _set_atime(fs, mountflags);
 
         /* perform the mount */
         ECHECK(myst_mount(fs, source, target));
@@ -301,12 +629,13 @@ long myst_syscall_mount(
 #ifdef MYST_ENABLE_HOSTFS
     else if (strcmp(filesystemtype, "hostfs") == 0)
     {
-        /* these arguments should be zero and null */
-        if (mountflags || data)
+        /* data (if any) holds the cache and buffering arguments */
+        if (mountflags)
             ERAISE(-EINVAL);
 
-        /* create a new ramfs instance */
+        /* create a new hostfs instance */
         ECHECK(myst_init_hostfs(&fs));
+        ECHECK(_set_hostfs_options(fs, (const char**)data));
 
         /* perform the mount */
         ECHECK(myst_mount(fs, source, target));
@@ -319,12 +648,13 @@ long myst_syscall_mount(
         const char** args = (const char**)data;
         const char* key;
 
-        if (mountflags || !source)
+        if ((mountflags & ~ATIME_MOUNT_FLAGS) || !source)
             ERAISE(-EINVAL);
 
         key = _find_arg(args, "key");
 
         ECHECK(myst_load_fs(myst_mount_resolve, source, key, &fs));
+        _set_atime(fs, mountflags);
 
         /* perform the mount */
         ECHECK(myst_mount(fs, source, target));
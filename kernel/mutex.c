@@ -4,6 +4,9 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+/* this implements the locks that lockstats.c counts */
+#define MYST_NO_LOCK_STATS
+
 #include <errno.h>
 #include <stdbool.h>
 #include <string.h>
@@ -15,6 +18,8 @@
 #include <myst/tcall.h>
 #include <myst/thread.h>
 
+static myst_mutex_stats_t _stats;
+
 int myst_mutex_init(myst_mutex_t* m)
 {
     int ret = -1;
@@ -69,6 +74,34 @@ int __myst_mutex_trylock(myst_mutex_t* m, myst_thread_t* self)
     return -1;
 }
 
+/* Spin while the mutex is held, in case the owner releases it soon */
+static bool _spin_trylock(myst_mutex_t* m, myst_thread_t* self)
+{
+    const uint32_t spin = m->spin ? m->spin : MYST_MUTEX_SPIN;
+
+    for (uint32_t i = 0; i < spin; i++)
+    {
+        __asm__ __volatile__("pause" : : : "memory");
+
+        /* Peek without the spinlock; waiters queued earlier go first */
+        if (__atomic_load_n(&m->owner, __ATOMIC_RELAXED) || m->queue.front)
+            continue;
+
+        myst_spin_lock(&m->lock);
+
+        if (__myst_mutex_trylock(m, self) == 0)
+        {
+            myst_spin_unlock(&m->lock);
+            __atomic_fetch_add(&_stats.spins, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+
+        myst_spin_unlock(&m->lock);
+    }
+
+    return false;
+}
+
 int myst_mutex_lock(myst_mutex_t* mutex)
 {
     myst_mutex_t* m = (myst_mutex_t*)mutex;
@@ -77,6 +110,21 @@ int myst_mutex_lock(myst_mutex_t* mutex)
     if (!m)
         return EINVAL;
 
+    myst_spin_lock(&m->lock);
+    {
+        /* Attempt to acquire lock */
+        if (__myst_mutex_trylock(m, self) == 0)
+        {
+            myst_spin_unlock(&m->lock);
+            return 0;
+        }
+    }
+    myst_spin_unlock(&m->lock);
+
+    /* Parking costs an enclave exit, so spin first */
+    if (_spin_trylock(m, self))
+        return 0;
+
     /* Loop until SELF obtains mutex */
     for (;;)
     {
@@ -101,6 +149,8 @@ int myst_mutex_lock(myst_mutex_t* mutex)
         myst_spin_unlock(&m->lock);
 
         /* Ask host to wait for an event on this thread */
+        __atomic_fetch_add(&_stats.parks, 1, __ATOMIC_RELAXED);
+
         if ((r = myst_tcall_wait(self->event, NULL)) != 0)
             myst_panic("myst_tcall_wait(): %ld: %d", r, *(int*)self->event);
     }
@@ -200,6 +250,21 @@ int myst_mutex_destroy(myst_mutex_t* mutex)
     return ret;
 }
 
+void myst_mutex_set_spin(myst_mutex_t* m, uint32_t spin)
+{
+    if (m)
+        m->spin = spin;
+}
+
+void myst_mutex_get_stats(myst_mutex_stats_t* stats)
+{
+    if (stats)
+    {
+        stats->spins = __atomic_load_n(&_stats.spins, __ATOMIC_RELAXED);
+        stats->parks = __atomic_load_n(&_stats.parks, __ATOMIC_RELAXED);
+    }
+}
+
 myst_thread_t* myst_mutex_owner(myst_mutex_t* m)
 {
     myst_thread_t* owner;
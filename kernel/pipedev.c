@@ -14,8 +14,10 @@
 #include <myst/defs.h>
 #include <myst/eraise.h>
 #include <myst/id.h>
+#include <myst/kernel.h>
 #include <myst/panic.h>
 #include <myst/pipedev.h>
+#include <myst/pollq.h>
 #include <myst/process.h>
 #include <myst/round.h>
 #include <myst/syscall.h>
@@ -24,17 +26,40 @@
 
 #define SCRATCH_BUF_SIZE 256
 
+/*
+** The pipe buffer is circular: nbytes bytes start at data[head] and wrap at
+** datasz. A pipe may hold up to pipesz bytes (its capacity), but the buffer
+** starts out as the embedded buf[] and only grows (by doubling) once a
+** writer needs the space, so idle or lightly used pipes stay small.
+**
+** Each reader or writer copies its bytes without holding the mutex. This is
+** safe since only one reader copies at a time (rdcopy), touching the used
+** part of the buffer, and only one writer (wrcopy), touching the free part.
+** The mutex is held just long enough to update head and nbytes, and every
+** wait (for bytes, for space or for another copy to finish) releases it, so
+** a non-blocking reader or writer never waits behind a blocked one.
+**
+** Several readers (or writers) may wait at once, so waiters are woken with
+** broadcasts and each checks its condition again.
+*/
 typedef struct pipe_impl
 {
-    myst_cond_t cond;
-    myst_mutex_t mutex;
-    char* data; /* points to buf or heap-allocated memory */
-    size_t pipesz;
-    char buf[PIPE_BUF];
+    myst_mutex_t mutex;  /* protects the fields below */
+    myst_cond_t rdcond;  /* signaled when bytes are added or writers go away */
+    myst_cond_t wrcond;  /* signaled when space is freed or readers go away */
+    myst_cond_t idlecond; /* signaled when a copy finishes */
+    char* data;          /* points to buf or heap-allocated memory */
+    size_t datasz;       /* size of data[] (at most pipesz once grown) */
+    size_t pipesz;       /* capacity (F_GETPIPE_SZ) */
+    size_t head; /* offset of the first byte in data[] */
     size_t nbytes;
+    bool rdcopy; /* a reader is copying out of data[] */
+    bool wrcopy; /* a writer is copying into data[] */
+    char buf[PIPE_BUF];
     size_t nreaders;
     size_t nwriters;
     size_t wrsize; /* set by write(), decremented by read() */
+    myst_pollq_t pollq; /* poll waiters on either end */
 } pipe_impl_t;
 
 struct myst_pipe
@@ -84,7 +109,8 @@ static int _pd_pipe2(myst_pipedev_t* pipedev, myst_pipe_t* pipe[2], int flags)
 
         /* setup the default pipe buffer */
         impl->data = impl->buf;
-        impl->pipesz = PIPE_BUF;
+        impl->datasz = sizeof(impl->buf);
+        impl->pipesz = MYST_PIPE_DEFAULT_SIZE;
     }
 
     /* Create the read pipe */
@@ -135,122 +161,361 @@ done:
     return ret;
 }
 
-static ssize_t _pd_read(
-    myst_pipedev_t* pipedev,
-    myst_pipe_t* pipe,
-    void* buf,
-    size_t count)
+/* Copy n bytes out of the circular buffer starting at offset */
+static void _ring_read(
+    const char* data,
+    size_t size,
+    size_t offset,
+    void* dest,
+    size_t n)
 {
-    ssize_t ret = 0;
-    pipe_impl_t* p;
-    uint8_t* ptr = buf;
-    size_t rem = count;
+    size_t n1 = size - offset;
 
-    if (!pipedev || !_valid_pipe(pipe))
-        ERAISE(-EBADF);
+    if (n1 > n)
+        n1 = n;
 
-    if (!buf && count)
-        ERAISE(-EINVAL);
+    memcpy(dest, data + offset, n1);
+    memcpy((char*)dest + n1, data, n - n1);
+}
 
-    if (pipe->mode == O_WRONLY)
-        ERAISE(-EBADF);
+/* Wait until no reader or writer is copying so data[] may be replaced */
+static void _wait_idle(pipe_impl_t* p)
+{
+    while (p->rdcopy || p->wrcopy)
+        myst_cond_wait(&p->idlecond, &p->mutex);
+}
 
-    if (count == 0)
-        goto done;
+/* Move the buffered bytes into a buffer of the given size (call when idle) */
+static int _resize_buffer(pipe_impl_t* p, size_t size)
+{
+    int ret = 0;
+    char* data = p->buf;
+
+    if (size > sizeof(p->buf) && !(data = malloc(size)))
+        ERAISE(-ENOMEM);
+
+    _ring_read(p->data, p->datasz, p->head, data, p->nbytes);
+
+    if (p->data != p->buf)
+        free(p->data);
+
+    p->data = data;
+    p->datasz = (data == p->buf) ? sizeof(p->buf) : size;
+    p->head = 0;
+
+done:
+    return ret;
+}
+
+/* Grow the buffer so it has room for n more bytes (within the capacity) */
+static void _reserve(pipe_impl_t* p, size_t n)
+{
+    size_t size;
+
+    if (p->datasz - p->nbytes >= n || p->datasz >= p->pipesz)
+        return;
+
+    _wait_idle(p);
+
+    /* check again since the mutex was released while waiting */
+    if (p->datasz - p->nbytes >= n || p->datasz >= p->pipesz)
+        return;
+
+    for (size = p->datasz; size - p->nbytes < n && size < p->pipesz;)
+        size *= 2;
+
+    if (size > p->pipesz)
+        size = p->pipesz;
+
+    /* on failure keep the smaller buffer, which just means more waits */
+    _resize_buffer(p, size);
+}
+
+/*
+** Move up to count bytes from the pipe to consume(), which reads straight out
+** of the circular buffer (one or two segments per pass). A read() keeps going
+** while the current write is in progress; a splice returns after one pass and
+** reports end-of-file as zero rather than EPIPE.
+*/
+static ssize_t _transfer_out(
+    myst_pipe_t* pipe,
+    myst_pipe_consume_t consume,
+    void* arg,
+    size_t count,
+    int flags,
+    bool splice)
+{
+    pipe_impl_t* p = pipe->impl;
+    const bool nonblock =
+        (pipe->flags & O_NONBLOCK) || (flags & MYST_PIPE_NONBLOCK);
+    const bool peek = (flags & MYST_PIPE_PEEK);
+    size_t rem = count;
+    ssize_t err = 0;
 
     _lock(pipe);
-    p = pipe->impl;
 
-    if (!_valid_pipe(pipe))
+    while (rem)
     {
-        /* cannot unlock since mutex is no longer valid */
-        ERAISE(-EBADF);
+        const char* data;
+        size_t size;
+        size_t head;
+        size_t n;
+        size_t n1;
+        size_t done = 0;
+        ssize_t r;
+
+        /* block here while the pipe is empty or another reader is copying */
+        while (p->nbytes == 0 || p->rdcopy)
+        {
+            if (p->rdcopy)
+            {
+                if (myst_cond_wait(&p->idlecond, &p->mutex) == 0)
+                    continue;
+
+                err = -EPIPE; /* unexpected */
+            }
+            else if (nonblock)
+                err = -EAGAIN; /* non-blocking read */
+            else if (p->nwriters == 0)
+                err = splice ? 0 : -EPIPE; /* no writers: end of file */
+            else if (p->wrsize == 0 && rem < count)
+                err = -EAGAIN; /* the write operation is finished */
+            else if (myst_cond_wait(&p->rdcond, &p->mutex) != 0)
+                err = -EPIPE; /* unexpected */
+            else
+                continue;
+
+            goto finish;
+        }
+
+        n = (p->nbytes < rem) ? p->nbytes : rem;
+        data = p->data;
+        size = p->datasz;
+        head = p->head;
+        p->rdcopy = true;
+        _unlock(pipe);
+
+        /* the bytes wrap at the end of the buffer */
+        n1 = (size - head < n) ? size - head : n;
+
+        if ((r = consume(arg, data + head, n1)) > 0)
+        {
+            done = (size_t)r;
+
+            if (done == n1 && n1 < n && (r = consume(arg, data, n - n1)) > 0)
+                done += (size_t)r;
+        }
+
+        _lock(pipe);
+        p->rdcopy = false;
+        myst_cond_broadcast(&p->idlecond, SIZE_MAX);
+
+        if (!peek && done)
+        {
+            p->head = (head + done) % size;
+            p->nbytes -= done;
+            p->wrsize -= done;
+            myst_cond_broadcast(&p->wrcond, SIZE_MAX);
+        }
+
+        rem -= done;
+
+        if (done < n)
+        {
+            err = (r < 0) ? r : 0;
+            break;
+        }
+
+        if (splice)
+            break;
     }
 
+finish:
+    _unlock(pipe);
+
+    /* return short count */
+    if (rem < count)
+        return (ssize_t)(count - rem);
+
+    return err;
+}
+
+/*
+** Move up to count bytes from produce() into the pipe, which writes straight
+** into the free space of the circular buffer. A write() of up to PIPE_BUF
+** bytes is atomic, so it waits for room for all of them; larger writes and
+** splices may be split, and a splice returns after one pass.
+*/
+static ssize_t _transfer_in(
+    myst_pipe_t* pipe,
+    myst_pipe_produce_t produce,
+    void* arg,
+    size_t count,
+    int flags,
+    bool splice)
+{
+    pipe_impl_t* p = pipe->impl;
+    const bool nonblock =
+        (pipe->flags & O_NONBLOCK) || (flags & MYST_PIPE_NONBLOCK);
+    const bool atomic = !splice && count <= PIPE_BUF;
+    size_t rem = count;
+    ssize_t err = 0;
+
+    _lock(pipe);
+
+    p->wrsize += count;
+
     while (rem)
     {
-        /* block here while the pipe is empty */
-        while (p->nbytes == 0)
+        char* data;
+        size_t size;
+        size_t tail;
+        size_t n;
+        size_t n1;
+        size_t done = 0;
+        ssize_t r;
+
+        for (;;)
         {
-            /* Handle non-blocking write */
-            if (pipe->flags & O_NONBLOCK)
-            {
-                _unlock(pipe);
+            const size_t nspace = p->pipesz - p->nbytes;
 
-                if (rem < count)
-                {
-                    /* return short count */
-                    ret = count - rem;
-                    goto done;
-                }
+            /* wait for another writer to finish copying */
+            if (p->wrcopy)
+            {
+                if (myst_cond_wait(&p->idlecond, &p->mutex) == 0)
+                    continue;
 
-                ERAISE(-EAGAIN);
+                err = -EPIPE; /* unexpected */
+                goto finish;
             }
 
-            /* if there are no writers, then fail */
-            if (p->nwriters == 0)
+            if (nspace && (!atomic || nspace >= rem))
             {
-                _unlock(pipe);
+                _reserve(p, (rem < nspace) ? rem : nspace);
+
+                /* another writer may have started while _reserve() waited */
+                if (p->wrcopy)
+                    continue;
 
-                if (rem < count)
+                if (p->datasz > p->nbytes &&
+                    (!atomic || p->datasz - p->nbytes >= rem))
                 {
-                    /* return short count */
-                    ret = count - rem;
-                    goto done;
+                    break;
                 }
-
-                /* broken pipe */
-                ERAISE(-EPIPE);
             }
 
-            /* If write operation is finished */
-            if (p->wrsize == 0 && rem < count)
-            {
-                _unlock(pipe);
-                /* return short count */
-                ret = count - rem;
-                goto done;
-            }
+            if (nonblock)
+                err = -EAGAIN; /* non-blocking write */
+            else if (p->nreaders == 0)
+                err = -EPIPE; /* no readers: broken pipe */
+            else if (myst_cond_wait(&p->wrcond, &p->mutex) != 0)
+                err = -EPIPE; /* unexpected */
+            else
+                continue;
 
-            /* wait here for another thread to write */
-            if (myst_cond_wait(&p->cond, &p->mutex) != 0)
-            {
-                /* unexpected */
-                _unlock(pipe);
-                ERAISE(-EPIPE);
-            }
+            goto finish;
         }
 
-        /* copy bytes from pipe to the caller buffer */
-        if (p->nbytes <= rem)
+        n = p->datasz - p->nbytes;
+
+        if (n > rem)
+            n = rem;
+
+        data = p->data;
+        size = p->datasz;
+        tail = (p->head + p->nbytes) % size;
+        p->wrcopy = true;
+        _unlock(pipe);
+
+        /* the free space wraps at the end of the buffer */
+        n1 = (size - tail < n) ? size - tail : n;
+
+        if ((r = produce(arg, data + tail, n1)) > 0)
         {
-            const size_t n = p->nbytes;
-            memcpy(ptr, p->data, n);
-            p->nbytes = 0;
-            myst_cond_signal(&p->cond);
-            rem -= n;
-            ptr += n;
-            p->wrsize -= n;
+            done = (size_t)r;
+
+            if (done == n1 && n1 < n && (r = produce(arg, data, n - n1)) > 0)
+                done += (size_t)r;
         }
-        else /* p->nbytes > count */
+
+        _lock(pipe);
+        p->wrcopy = false;
+        myst_cond_broadcast(&p->idlecond, SIZE_MAX);
+
+        if (done)
+        {
+            p->nbytes += done;
+            myst_cond_broadcast(&p->rdcond, SIZE_MAX);
+        }
+
+        rem -= done;
+
+        if (done < n)
         {
-            const size_t n = rem;
-            memcpy(ptr, p->data, n);
-            memmove(p->data, p->data + n, p->nbytes - rem);
-            p->nbytes -= n;
-            p->wrsize -= n;
-            myst_cond_signal(&p->cond);
+            err = (r < 0) ? r : 0;
             break;
         }
+
+        if (splice)
+            break;
     }
 
+finish:
+    /* unwritten bytes will never be read */
+    p->wrsize -= rem;
     _unlock(pipe);
-    ret = count;
+
+    /* return short count */
+    if (rem < count)
+        return (ssize_t)(count - rem);
+
+    return err;
+}
+
+/* consume() and produce() for read() and write(), which copy to user memory */
+static ssize_t _copy_out(void* arg, const void* data, size_t n)
+{
+    uint8_t** ptr = arg;
+    memcpy(*ptr, data, n);
+    *ptr += n;
+    return (ssize_t)n;
+}
+
+static ssize_t _copy_in(void* arg, void* space, size_t n)
+{
+    const uint8_t** ptr = arg;
+    memcpy(space, *ptr, n);
+    *ptr += n;
+    return (ssize_t)n;
+}
+
+static ssize_t _pd_read(
+    myst_pipedev_t* pipedev,
+    myst_pipe_t* pipe,
+    void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+    uint8_t* ptr = buf;
+
+    if (!pipedev || !_valid_pipe(pipe))
+        ERAISE(-EBADF);
+
+    if (!buf && count)
+        ERAISE(-EINVAL);
+
+    if (pipe->mode == O_WRONLY)
+        ERAISE(-EBADF);
+
+    if (count == 0)
+        goto done;
+
+    ECHECK(ret = _transfer_out(pipe, _copy_out, &ptr, count, 0, false));
 
 done:
 
     if (ret > 0)
-        myst_tcall_poll_wake();
+        myst_pollq_notify(&pipe->impl->pollq);
 
     return ret;
 }
@@ -262,10 +527,7 @@ static ssize_t _pd_write(
     size_t count)
 {
     ssize_t ret = 0;
-    pipe_impl_t* p;
-    size_t nspace;
     const uint8_t* ptr = buf;
-    size_t rem = count;
 
     if (!pipedev || !_valid_pipe(pipe))
         ERAISE(-EBADF);
@@ -286,92 +548,76 @@ static ssize_t _pd_write(
     if (count == 0)
         goto done;
 
-    _lock(pipe);
-    p = pipe->impl;
+    ECHECK(ret = _transfer_in(pipe, _copy_in, &ptr, count, 0, false));
 
-    p->wrsize += count;
+done:
 
-    if (!_valid_pipe(pipe))
-    {
-        /* cannot unlock since mutex is no longer valid */
+    if (ret > 0)
+        myst_pollq_notify(&pipe->impl->pollq);
+
+    return ret;
+}
+
+static ssize_t _pd_splice_read(
+    myst_pipedev_t* pipedev,
+    myst_pipe_t* pipe,
+    myst_pipe_consume_t consume,
+    void* arg,
+    size_t count,
+    int flags)
+{
+    ssize_t ret = 0;
+
+    if (!pipedev || !_valid_pipe(pipe) || pipe->mode == O_WRONLY)
         ERAISE(-EBADF);
-    }
 
-    while (rem)
-    {
-        /* Block here while the pipe is full */
-        while (p->nbytes == p->pipesz)
-        {
-            /* Handle non-blocking read */
-            if (pipe->flags & O_NONBLOCK)
-            {
-                _unlock(pipe);
+    if (!consume || (flags & ~(MYST_PIPE_PEEK | MYST_PIPE_NONBLOCK)))
+        ERAISE(-EINVAL);
 
-                if (rem < count)
-                {
-                    /* return short count */
-                    ret = count - rem;
-                    goto done;
-                }
+    if (count == 0)
+        goto done;
 
-                ERAISE(-EAGAIN);
-            }
+    ECHECK(ret = _transfer_out(pipe, consume, arg, count, flags, true));
 
-            /* if there are no readers, then fail */
-            if (p->nreaders == 0)
-            {
-                _unlock(pipe);
+done:
 
-                if (rem < count)
-                {
-                    /* return short count */
-                    ret = count - rem;
-                    goto done;
-                }
+    if (ret > 0 && !(flags & MYST_PIPE_PEEK))
+        myst_pollq_notify(&pipe->impl->pollq);
 
-                /* broken pipe */
-                ERAISE(-EPIPE);
-            }
+    return ret;
+}
 
-            /* wait here for another thread to read */
-            if (myst_cond_wait(&p->cond, &p->mutex) != 0)
-            {
-                /* unexpected */
-                _unlock(pipe);
-                ERAISE(-EPIPE);
-            }
-        }
+static ssize_t _pd_splice_write(
+    myst_pipedev_t* pipedev,
+    myst_pipe_t* pipe,
+    myst_pipe_produce_t produce,
+    void* arg,
+    size_t count,
+    int flags)
+{
+    ssize_t ret = 0;
 
-        /* calculate the space in the pipe buffer */
-        nspace = p->pipesz - p->nbytes;
+    if (!pipedev || !_valid_pipe(pipe) || pipe->mode == O_RDONLY)
+        ERAISE(-EBADF);
 
-        /* copy bytes from caller buffer to pipe */
-        if (nspace <= rem)
-        {
-            const size_t n = nspace;
-            memcpy(p->data + p->nbytes, ptr, n);
-            p->nbytes += n;
-            myst_cond_signal(&p->cond);
-            rem -= n;
-            ptr += n;
-        }
-        else /* nspace > r */
-        {
-            const size_t n = rem;
-            memcpy(p->data + p->nbytes, ptr, n);
-            p->nbytes += n;
-            myst_cond_signal(&p->cond);
-            break;
-        }
+    if (!produce || (flags & ~MYST_PIPE_NONBLOCK))
+        ERAISE(-EINVAL);
+
+    if (pipe->impl->nreaders == 0)
+    {
+        myst_syscall_kill(myst_getpid(), SIGPIPE);
+        ERAISE(-EPIPE);
     }
 
-    _unlock(pipe);
-    ret = count;
+    if (count == 0)
+        goto done;
+
+    ECHECK(ret = _transfer_in(pipe, produce, arg, count, flags, true));
 
 done:
 
     if (ret > 0)
-        myst_tcall_poll_wake();
+        myst_pollq_notify(&pipe->impl->pollq);
 
     return ret;
 }
@@ -480,23 +726,41 @@ static int _pd_fcntl(
         }
         case F_SETPIPE_SZ:
         {
-            void* data;
+            size_t max = __myst_kernel_args.max_pipe_size;
             size_t pipesz;
 
+            if (max == 0)
+                max = MYST_PIPE_MAX_SIZE;
+
             if (arg <= 0)
                 arg = PIPE_BUF;
 
             ECHECK(myst_round_up(arg, PIPE_BUF, &pipesz));
 
-            if (!(data = calloc(pipesz, 1)))
-                ERAISE(-ENOMEM);
+            if (pipesz > max)
+                ERAISE(-EPERM);
+
+            /* the buffered bytes must still fit */
+            if (pipesz < p->nbytes)
+                ERAISE(-EBUSY);
+
+            /* a larger buffer is allocated once a writer needs it */
+            if (p->datasz > pipesz)
+            {
+                _wait_idle(p);
+
+                if (pipesz < p->nbytes)
+                    ERAISE(-EBUSY);
 
-            if (p->data != p->buf)
-                free(p->data);
+                ECHECK(_resize_buffer(p, pipesz));
+            }
 
-            p->data = data;
             p->pipesz = pipesz;
 
+            /* blocked writers and pollers may now fit */
+            myst_cond_broadcast(&p->wrcond, SIZE_MAX);
+            myst_pollq_notify(&p->pollq);
+
             ret = (long)pipesz;
             goto done;
         }
@@ -610,12 +874,14 @@ static int _pd_close(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
         pipe->impl->nwriters--;
 
     /* signal any threads blocked on read or write */
-    myst_cond_signal(&pipe->impl->cond);
+    myst_cond_broadcast(&pipe->impl->rdcond, SIZE_MAX);
+    myst_cond_broadcast(&pipe->impl->wrcond, SIZE_MAX);
 
     /* Release the pipe if no more readers or writers */
     if (pipe->impl->nreaders == 0 && pipe->impl->nwriters == 0)
     {
         _unlock(pipe);
+        myst_pollq_destroy(&pipe->impl->pollq);
 
         if (pipe->impl->data != pipe->impl->buf)
             free(pipe->impl->data);
@@ -625,6 +891,8 @@ static int _pd_close(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
     }
     else
     {
+        /* the other end may be polling (notify while impl cannot be freed) */
+        myst_pollq_notify(&pipe->impl->pollq);
         _unlock(pipe);
     }
 
@@ -649,6 +917,14 @@ done:
     return ret;
 }
 
+static myst_pollq_t* _pd_pollq(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
+{
+    if (!pipedev || !_valid_pipe(pipe))
+        return NULL;
+
+    return &pipe->impl->pollq;
+}
+
 static int _pd_get_events(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
 {
     int ret = 0;
@@ -666,7 +942,7 @@ static int _pd_get_events(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
         }
         else if (pipe->mode == O_WRONLY)
         {
-            if (pipe->impl->nbytes)
+            if (pipe->impl->nbytes < pipe->impl->pipesz)
                 events |= POLLOUT;
         }
     }
@@ -678,6 +954,12 @@ done:
     return ret;
 }
 
+bool myst_pipe_same(const myst_pipe_t* pipe1, const myst_pipe_t* pipe2)
+{
+    return _valid_pipe(pipe1) && _valid_pipe(pipe2) &&
+           pipe1->impl == pipe2->impl;
+}
+
 extern myst_pipedev_t* myst_pipedev_get(void)
 {
     // clang-format-off
@@ -694,6 +976,7 @@ extern myst_pipedev_t* myst_pipedev_get(void)
             .fd_close = (void*)_pd_close,
             .fd_target_fd = (void*)_pd_target_fd,
             .fd_get_events = (void*)_pd_get_events,
+            .fd_pollq = (void*)_pd_pollq,
         },
         .pd_pipe2 = _pd_pipe2,
         .pd_read = _pd_read,
@@ -707,6 +990,8 @@ extern myst_pipedev_t* myst_pipedev_get(void)
         .pd_close = _pd_close,
         .pd_target_fd = _pd_target_fd,
         .pd_get_events = _pd_get_events,
+        .pd_splice_read = _pd_splice_read,
+        .pd_splice_write = _pd_splice_write,
     };
     // clang-format-on
 
@@ -6,39 +6,102 @@
 #include <stddef.h>
 #include <stdlib.h>
 
+#include <myst/counters.h>
 #include <myst/defs.h>
 #include <myst/eraise.h>
 #include <myst/fdops.h>
 #include <myst/fdtable.h>
+#include <myst/pollq.h>
 #include <myst/sockdev.h>
 #include <myst/syscall.h>
 #include <myst/tcall.h>
+#include <myst/thread.h>
 
-long _poll_kernel(struct pollfd* fds, nfds_t nfds)
+/* the fds of this many pollfds are split on the stack */
+#define POLL_STACK_FDS 16
+
+/* a kernel object found while splitting fds[] */
+typedef struct kernel_fd
 {
-    long ret = 0;
-    myst_fdtable_t* fdtable;
-    long total = 0;
+    myst_fdops_t* fdops;
+    void* object;
+    size_t index;          /* index into fds[] */
+    myst_pollq_t* pollq;   /* the object's poll queue (or null) */
+    myst_pollq_link_t link; /* subscription to pollq */
+    bool target; /* also polled on the target (a prefetching socket) */
+} kernel_fd_t;
+
+/* the per-fd scratch space: target pollfd, target index and kernel object */
+#define POLL_SCRATCH_SIZE \
+    (sizeof(struct pollfd) + sizeof(size_t) + sizeof(kernel_fd_t))
+
+/* Get scratch space for nfds fds from the thread or the heap */
+static void* _get_scratch(nfds_t nfds, bool* from_thread)
+{
+    myst_thread_t* thread = myst_thread_self();
+    size_t size;
+    void* ptr;
 
-    if (!(fdtable = myst_fdtable_current()))
-        ERAISE(-ENOSYS);
+    *from_thread = false;
 
-    for (nfds_t i = 0; i < nfds; i++)
+    if (__builtin_mul_overflow(nfds, POLL_SCRATCH_SIZE, &size))
+        return NULL;
+
+    /* the thread's buffer is busy during a nested (signal handler) poll */
+    if (!thread || thread->poll_scratch_busy)
+        return malloc(size);
+
+    if (size > thread->poll_scratch_size)
     {
-        myst_fdtable_type_t type;
-        myst_fdops_t* fdops;
-        void* object;
-        int events;
+        if (!(ptr = malloc(size)))
+            return NULL;
 
-        fds[i].revents = 0;
+        free(thread->poll_scratch);
+        thread->poll_scratch = ptr;
+        thread->poll_scratch_size = size;
+    }
 
-        /* get the device for this file descriptor */
-        ECHECK(myst_fdtable_get_any(
-            fdtable, fds[i].fd, &type, (void**)&fdops, (void**)&object));
+    thread->poll_scratch_busy = true;
+    *from_thread = true;
+    return thread->poll_scratch;
+}
+
+static void _put_scratch(void* ptr, bool from_thread)
+{
+    if (from_thread)
+        myst_thread_self()->poll_scratch_busy = false;
+    else
+        free(ptr);
+}
+
+void myst_release_poll_scratch(myst_thread_t* thread)
+{
+    free(thread->poll_scratch);
+    thread->poll_scratch = NULL;
+    thread->poll_scratch_size = 0;
+}
 
-        if ((events = (*fdops->fd_get_events)(fdops, object)) >= 0)
+static long _poll_kernel(
+    struct pollfd* fds,
+    const kernel_fd_t* kfds,
+    nfds_t knfds)
+{
+    long ret = 0;
+    long total = 0;
+
+    for (nfds_t i = 0; i < knfds; i++)
+    {
+        const kernel_fd_t* kfd = &kfds[i];
+        int events;
+
+        if ((events = (*kfd->fdops->fd_get_events)(kfd->fdops, kfd->object)) >=
+            0)
         {
-            fds[i].revents = events;
+            /* the target reports the other events of a target fd */
+            if (kfd->target)
+                events &= fds[kfd->index].events;
+
+            fds[kfd->index].revents = events;
 
             if (events)
                 total++;
@@ -55,18 +118,56 @@ done:
     return ret;
 }
 
+/* Probe the target and kernel fds without blocking until an event arrives
+ * or the busy-poll budget is spent (see myst/pollq.h) */
+static long _busy_poll(
+    struct pollfd* fds,
+    const kernel_fd_t* kfds,
+    nfds_t knfds,
+    struct pollfd* tfds,
+    nfds_t tnfds,
+    unsigned int usec,
+    long* kevents)
+{
+    long ret = 0;
+    const long deadline = myst_busy_poll_deadline(usec);
+
+    do
+    {
+        ECHECK((ret = myst_tcall_poll(tfds, tnfds, 0)));
+
+        if (ret)
+            break;
+
+        ECHECK((*kevents = _poll_kernel(fds, kfds, knfds)));
+
+        if (*kevents)
+            break;
+    } while (myst_busy_poll_again(deadline));
+
+done:
+    return ret;
+}
+
 long myst_syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
 {
     long ret = 0;
     myst_fdtable_t* fdtable;
+    uint64_t buf[POLL_STACK_FDS * POLL_SCRATCH_SIZE / sizeof(uint64_t)];
+    void* scratch = NULL;
+    bool from_thread = false;
     struct pollfd* tfds = NULL; /* target file descriptors */
-    struct pollfd* kfds = NULL; /* kernel file descriptors */
+    size_t* tindices = NULL;    /* target indices */
+    kernel_fd_t* kfds = NULL;   /* kernel file descriptors */
     nfds_t tnfds = 0;           /* number of target file descriptors */
     nfds_t knfds = 0;           /* number of kernel file descriptors */
-    size_t* tindices = NULL;    /* target indices */
-    size_t* kindices = NULL;    /* kernel indices */
     long tevents = 0;           /* the number of target events */
     long kevents = 0;           /* the number of kernel events */
+    myst_poller_t poller;
+    bool kernel_wait = true; /* every fd is a kernel fd with a poll queue */
+    bool subscribed = false;
+    const long deadline = myst_poll_deadline(timeout);
+    unsigned int busy_poll_usec = 0; /* the largest budget of the sockets */
 
     /* special case: if nfds is zero */
     if (nfds == 0)
@@ -84,17 +185,16 @@ long myst_syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
     if (!(fdtable = myst_fdtable_current()))
         ERAISE(-ENOSYS);
 
-    if (!(tfds = calloc(nfds, sizeof(struct pollfd))))
-        ERAISE(-ENOMEM);
-
-    if (!(kfds = calloc(nfds, sizeof(struct pollfd))))
+    /* small sets use the stack, larger ones a per-thread scratch buffer */
+    if (nfds <= POLL_STACK_FDS)
+        scratch = buf;
+    else if (!(scratch = _get_scratch(nfds, &from_thread)))
         ERAISE(-ENOMEM);
 
-    if (!(tindices = calloc(nfds, sizeof(size_t))))
-        ERAISE(-ENOMEM);
-
-    if (!(kindices = calloc(nfds, sizeof(size_t))))
-        ERAISE(-ENOMEM);
+    /* the kernel_fd_t array comes first to keep it aligned */
+    kfds = (kernel_fd_t*)scratch;
+    tindices = (size_t*)(kfds + nfds);
+    tfds = (struct pollfd*)(tindices + nfds);
 
     /* Split fds[] into two arrays: tfds[] (target) and kfds[] (kernel) */
     for (nfds_t i = 0; i < nfds; i++)
@@ -103,6 +203,9 @@ long myst_syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
         myst_fdtable_type_t type;
         myst_fdops_t* fdops;
         void* object;
+        myst_pollq_t* pollq;
+
+        fds[i].revents = 0;
 
         /* get the device for this file descriptor */
         ECHECK(myst_fdtable_get_any(
@@ -112,15 +215,46 @@ long myst_syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
         if ((tfd = (*fdops->fd_target_fd)(fdops, object)) >= 0)
         {
             tfds[tnfds].events = fds[i].events;
+            tfds[tnfds].revents = 0;
             tfds[tnfds].fd = tfd;
             tindices[tnfds] = i;
             tnfds++;
+
+            if (type == MYST_FDTABLE_TYPE_SOCK &&
+                fdops == (myst_fdops_t*)myst_sockdev_get())
+            {
+                const unsigned int usec = myst_sockdev_busy_poll(object);
+
+                if (usec > busy_poll_usec)
+                    busy_poll_usec = usec;
+            }
+
+            /* objects that buffer target data are polled in the kernel too */
+            if (fdops->fd_pollq &&
+                (pollq = (*fdops->fd_pollq)(fdops, object)))
+            {
+                kfds[knfds].fdops = fdops;
+                kfds[knfds].object = object;
+                kfds[knfds].index = i;
+                kfds[knfds].pollq = pollq;
+                kfds[knfds].target = true;
+                knfds++;
+            }
         }
         else if (tfd == -ENOTSUP)
         {
-            kfds[knfds].events = fds[i].events;
-            kfds[knfds].fd = fds[i].fd;
-            kindices[knfds] = i;
+            kfds[knfds].fdops = fdops;
+            kfds[knfds].object = object;
+            kfds[knfds].index = i;
+            kfds[knfds].pollq = NULL;
+            kfds[knfds].target = false;
+
+            if (fdops->fd_pollq)
+                kfds[knfds].pollq = (*fdops->fd_pollq)(fdops, object);
+
+            if (!kfds[knfds].pollq)
+                kernel_wait = false;
+
             knfds++;
         }
         else
@@ -129,54 +263,125 @@ long myst_syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
         }
     }
 
-    /* pre-poll for kernel events */
-    {
-        ECHECK((kevents = _poll_kernel(kfds, knfds)));
+    if (tnfds)
+        kernel_wait = false;
 
-        /* if any kernel events were found, change timeout to zero */
-        if (kevents)
-            timeout = 0;
-    }
+    /* subscribe before polling so that no state change is missed */
+    myst_poller_init(&poller, !kernel_wait);
 
-    /* poll for target events */
-    if (tnfds && tfds)
+    for (nfds_t i = 0; i < knfds; i++)
     {
-        ECHECK((tevents = myst_tcall_poll(tfds, tnfds, timeout)));
+        if (kfds[i].pollq)
+            myst_pollq_subscribe(kfds[i].pollq, &kfds[i].link, &poller);
     }
-    else
+
+    subscribed = true;
+
+    /* kernel objects only: sleep in the kernel until one is notified */
+    while (kernel_wait)
     {
-        ECHECK((tevents = myst_tcall_poll(NULL, tnfds, timeout)));
+        int r;
+
+        __atomic_store_n(&poller.woken, 0, __ATOMIC_RELEASE);
+
+        if ((kevents = _poll_kernel(fds, kfds, knfds)) != 0)
+            break;
+
+        myst_counter_inc(MYST_COUNTER_POLL_WAITS);
+        r = myst_poller_wait(&poller, myst_poll_remaining(timeout, deadline));
+
+        if (r == -ETIMEDOUT)
+        {
+            kevents = _poll_kernel(fds, kfds, knfds);
+            break;
+        }
+
+        myst_counter_inc(MYST_COUNTER_POLL_WAKEUPS);
     }
 
-    /* post-poll for kernel events (avoid if already polled above) */
-    if (kevents == 0)
+    if (kevents < 0)
+        ERAISE(kevents);
+
+    if (!kernel_wait)
     {
-        ECHECK((kevents = _poll_kernel(kfds, knfds)));
+        /* pre-poll for kernel events */
+        ECHECK((kevents = _poll_kernel(fds, kfds, knfds)));
+
+        /* if any kernel events were found, change timeout to zero */
+        if (kevents)
+            timeout = 0;
+
+        /* busy poll before blocking; an event found needs no wait */
+        if (timeout != 0 && tnfds && busy_poll_usec)
+        {
+            ECHECK((tevents = _busy_poll(
+                        fds,
+                        kfds,
+                        knfds,
+                        tfds,
+                        tnfds,
+                        busy_poll_usec,
+                        &kevents)));
+
+            if (tevents || kevents)
+                timeout = 0;
+            else
+                timeout = myst_poll_remaining(timeout, deadline);
+        }
+
+        if (timeout != 0)
+            myst_counter_inc(MYST_COUNTER_POLL_WAITS);
+
+        /* poll for target events (a notified poll queue wakes this) */
+        if (tnfds)
+        {
+            ECHECK((tevents = myst_tcall_poll(tfds, tnfds, timeout)));
+        }
+        else if (kevents == 0)
+        {
+            ECHECK((tevents = myst_tcall_poll(NULL, tnfds, timeout)));
+        }
+
+        /* post-poll for kernel events (avoid if already polled above) */
+        if (kevents == 0)
+        {
+            ECHECK((kevents = _poll_kernel(fds, kfds, knfds)));
+        }
+
+        if (timeout != 0 && (tevents || kevents))
+            myst_counter_inc(MYST_COUNTER_POLL_WAKEUPS);
     }
 
     /* update fds[] with the target events */
     for (nfds_t i = 0; i < tnfds; i++)
-        fds[tindices[i]].revents = tfds[i].revents;
+        fds[tindices[i]].revents |= tfds[i].revents;
 
-    /* update fds[] with the kernel events */
-    for (nfds_t i = 0; i < knfds; i++)
-        fds[kindices[i]].revents = kfds[i].revents;
+    /* an fd may have both target and kernel events, so count it once */
+    if (tevents && kevents)
+    {
+        ret = 0;
 
-    ret = tevents + kevents;
+        for (nfds_t i = 0; i < nfds; i++)
+        {
+            if (fds[i].revents)
+                ret++;
+        }
+    }
+    else
+    {
+        ret = tevents + kevents;
+    }
 
 done:
 
-    if (tfds)
-        free(tfds);
-
-    if (kfds)
-        free(kfds);
-
-    if (tindices)
-        free(tindices);
+    for (nfds_t i = 0; subscribed && i < knfds; i++)
+    {
+        if (kfds[i].pollq)
+            myst_pollq_unsubscribe(&kfds[i].link);
+    }
 
-    if (kindices)
-        free(kindices);
+    if (scratch && scratch != buf)
+        _put_scratch(scratch, from_thread);
 
     return ret;
 }
@@ -0,0 +1,237 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <time.h>
+
+#include <myst/pollq.h>
+#include <myst/spinlock.h>
+#include <myst/syscall.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+
+/* one lock for all queues, so a link can be unsubscribed after its queue is
+ * destroyed; it is only taken when a queue has subscribers */
+static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
+
+static long _now_msec(void)
+{
+    struct timespec ts;
+
+    if (myst_syscall_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long _now_usec(void)
+{
+    struct timespec ts;
+
+    if (myst_syscall_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+long myst_busy_poll_deadline(unsigned int usec)
+{
+    return _now_usec() + (long)usec;
+}
+
+bool myst_busy_poll_again(long deadline)
+{
+    __asm__ __volatile__("pause" : : : "memory");
+    return _now_usec() < deadline;
+}
+
+long myst_poll_deadline(int timeout)
+{
+    return (timeout > 0) ? _now_msec() + timeout : 0;
+}
+
+int myst_poll_remaining(int timeout, long deadline)
+{
+    long remaining;
+
+    if (timeout <= 0)
+        return timeout;
+
+    remaining = deadline - _now_msec();
+    return (remaining > 0) ? (int)remaining : 0;
+}
+
+void myst_poller_init(myst_poller_t* poller, bool host)
+{
+    poller->thread = myst_thread_self();
+    poller->woken = 0;
+    poller->host = host;
+}
+
+int myst_poller_wait(myst_poller_t* poller, int timeout)
+{
+    struct timespec ts;
+    long r;
+
+    if (__atomic_load_n(&poller->woken, __ATOMIC_ACQUIRE))
+        return 0;
+
+    if (timeout == 0)
+        return -ETIMEDOUT;
+
+    if (timeout > 0)
+    {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+    }
+
+    r = myst_tcall_wait(poller->thread->event, (timeout > 0) ? &ts : NULL);
+
+    if (__atomic_load_n(&poller->woken, __ATOMIC_ACQUIRE))
+        return 0;
+
+    return (r == 0) ? 0 : -ETIMEDOUT;
+}
+
+static void _subscribe(
+    myst_pollq_t* pollq,
+    myst_pollq_link_t* link,
+    myst_poller_t* poller,
+    bool exclusive)
+{
+    link->prev = NULL;
+    link->pollq = pollq;
+    link->poller = poller;
+    link->exclusive = exclusive;
+
+    myst_spin_lock(&_lock);
+    {
+        if ((link->next = pollq->head))
+            pollq->head->prev = link;
+
+        __atomic_store_n(&pollq->head, link, __ATOMIC_RELEASE);
+    }
+    myst_spin_unlock(&_lock);
+
+    /* pairs with the fence in myst_pollq_notify() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void myst_pollq_subscribe(
+    myst_pollq_t* pollq,
+    myst_pollq_link_t* link,
+    myst_poller_t* poller)
+{
+    _subscribe(pollq, link, poller, false);
+}
+
+void myst_pollq_subscribe_exclusive(
+    myst_pollq_t* pollq,
+    myst_pollq_link_t* link,
+    myst_poller_t* poller)
+{
+    _subscribe(pollq, link, poller, true);
+}
+
+void myst_pollq_unsubscribe(myst_pollq_link_t* link)
+{
+    myst_spin_lock(&_lock);
+
+    if (link->pollq)
+    {
+        if (link->prev)
+            link->prev->next = link->next;
+        else
+            link->pollq->head = link->next;
+
+        if (link->next)
+            link->next->prev = link->prev;
+
+        link->pollq = NULL;
+    }
+
+    myst_spin_unlock(&_lock);
+}
+
+/* Wake the waiters on this queue (all of them if DETACH is true, and else
+ * only the first exclusive waiter that is asleep); returns true if a host
+ * poll must wake */
+static bool _wake_locked(myst_pollq_t* pollq, bool detach)
+{
+    bool host = false;
+    bool exclusive = false;
+
+    for (myst_pollq_link_t* p = pollq->head; p;)
+    {
+        myst_pollq_link_t* next = p->next;
+        myst_poller_t* poller = p->poller;
+        int expected = 0;
+
+        /* one exclusive waiter has been woken for this notification */
+        if (p->exclusive && exclusive && !detach)
+        {
+            p = next;
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(
+                &poller->woken,
+                &expected,
+                1,
+                false,
+                __ATOMIC_RELEASE,
+                __ATOMIC_RELAXED))
+        {
+            if (poller->host)
+                host = true;
+            else
+                myst_tcall_wake(poller->thread->event);
+
+            if (p->exclusive)
+                exclusive = true;
+        }
+
+        if (detach)
+            p->pollq = NULL;
+
+        p = next;
+    }
+
+    if (detach)
+        pollq->head = NULL;
+
+    return host;
+}
+
+void myst_pollq_notify(myst_pollq_t* pollq)
+{
+    bool host;
+
+    __atomic_fetch_add(&pollq->generation, 1, __ATOMIC_RELEASE);
+
+    /* pairs with the fence in myst_pollq_subscribe(), so that either the
+     * subscriber sees the new state or this sees the subscriber */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (!__atomic_load_n(&pollq->head, __ATOMIC_ACQUIRE))
+        return;
+
+    myst_spin_lock(&_lock);
+    host = _wake_locked(pollq, false);
+    myst_spin_unlock(&_lock);
+
+    if (host)
+        myst_tcall_poll_wake();
+}
+
+void myst_pollq_destroy(myst_pollq_t* pollq)
+{
+    bool host;
+
+    myst_spin_lock(&_lock);
+    host = _wake_locked(pollq, true);
+    myst_spin_unlock(&_lock);
+
+    if (host)
+        myst_tcall_poll_wake();
+}
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <myst/console.h>
 #include <myst/crash.h>
 #include <myst/eraise.h>
 #include <myst/panic.h>
@@ -24,6 +25,9 @@ int myst_console_printf(int fd, const char* format, ...)
     if (count < 0 || (size_t)count >= sizeof(buf))
         return -EINVAL;
 
+    /* keep kernel messages after the application output before them */
+    myst_console_flush();
+
     return (int)myst_tcall_write_console(fd, buf, (size_t)count);
 }
 
@@ -37,6 +41,8 @@ int myst_console_vprintf(int fd, const char* format, va_list ap)
     if (count < 0 || (size_t)count >= sizeof(buf))
         return -EINVAL;
 
+    myst_console_flush();
+
     return (int)myst_tcall_write_console(fd, buf, (size_t)count);
 }
 
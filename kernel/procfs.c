@@ -1,17 +1,31 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 
+#include <myst/affinity.h>
+#include <myst/counters.h>
 #include <myst/eraise.h>
+#include <myst/eventtrace.h>
 #include <myst/file.h>
 #include <myst/fs.h>
 #include <myst/kernel.h>
+#include <myst/lockstats.h>
 #include <myst/mmanutils.h>
 #include <myst/mount.h>
 #include <myst/printf.h>
 #include <myst/process.h>
 #include <myst/procfs.h>
+#include <myst/signal.h>
+#include <myst/sockdev.h>
+#include <myst/syscallstats.h>
+#include <myst/tcallstats.h>
+#include <myst/verity.h>
 
 static myst_fs_t* _procfs;
 
@@ -25,6 +39,8 @@ int procfs_setup()
         ERAISE(-EINVAL);
     }
 
+    myst_ramfs_set_type(_procfs, MYST_PROC_TYPE);
+
     if (myst_mkdirhier("/proc", 777) != 0)
     {
         myst_eprintf("cannot create mount point for procfs\n");
@@ -77,47 +93,541 @@ done:
     return ret;
 }
 
-static int _meminfo_vcallback(myst_buf_t* vbuf)
+static int _meminfo_vcallback(myst_buf_t* vbuf, void* arg)
 {
     int ret = 0;
     size_t totalram;
     size_t freeram;
-    
+
+    (void)arg;
+
     ECHECK(myst_get_total_ram(&totalram));
     ECHECK(myst_get_free_ram(&freeram));
 
+    /* in kB as on Linux; all free memory is available (nothing is cached) */
     myst_buf_clear(vbuf);
     char tmp[128];
     const size_t n = sizeof(tmp);
-    snprintf(tmp, n, "MemTotal:       %lu\n", totalram);
+    snprintf(tmp, n, "MemTotal:       %lu kB\n", totalram / 1024);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "MemFree:        %lu kB\n", freeram / 1024);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "MemAvailable:   %lu kB\n", freeram / 1024);
     myst_buf_append(vbuf, tmp, strlen(tmp));
-    snprintf(tmp, n, "MemFree:        %lu\n", freeram);
+    snprintf(tmp, n, "Buffers:        0 kB\nCached:         0 kB\n");
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "SwapTotal:      0 kB\nSwapFree:       0 kB\n");
     myst_buf_append(vbuf, tmp, strlen(tmp));
 
 done:
     return ret;
 }
 
-static int _self_vcallback(myst_buf_t* vbuf)
+static int _cpuinfo_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_format_cpuinfo(vbuf);
+}
+
+static int _self_vcallback(myst_buf_t* vbuf, void* arg)
 {
     char linkpath[PATH_MAX];
     const size_t n = sizeof(linkpath);
+
+    (void)arg;
     snprintf(linkpath, n, "/proc/%d", myst_getpid());
     myst_buf_clear(vbuf);
     myst_buf_append(vbuf, linkpath, sizeof(linkpath));
     return 0;
 }
 
+static int _syscalls_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_format_syscall_stats(vbuf);
+}
+
+static int _stats_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_format_stats(vbuf);
+}
+
+static int _stats_bin_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_format_stats_binary(vbuf);
+}
+
+static int _locks_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_format_lock_stats(vbuf);
+}
+
+static int _events_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_format_event_trace(vbuf);
+}
+
+static int _events_vwrite(const void* data, size_t size, void* arg)
+{
+    (void)arg;
+    return myst_control_event_trace(data, size);
+}
+
+static int _tcalls_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_format_tcall_stats(vbuf);
+}
+
+static int _sockbufs_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    myst_sockbuf_stats_t stats;
+    char tmp[128];
+    const size_t n = sizeof(tmp);
+
+    (void)arg;
+
+    myst_sockdev_get_sockbuf_stats(&stats);
+
+    myst_buf_clear(vbuf);
+    snprintf(tmp, n, "BufferSize:     %d\n", MYST_SOCKBUF_SIZE);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "MaxBuffers:     %d\n", MYST_SOCKBUF_COUNT);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "Buffers:        %zu\n", stats.count);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "InUse:          %zu\n", stats.in_use);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "Hits:           %zu\n", stats.hits);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "Misses:         %zu\n", stats.misses);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "BytesSent:      %zu\n", stats.bytes_sent);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "BytesReceived:  %zu\n", stats.bytes_received);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+
+    return 0;
+}
+
+static int _verity_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    myst_verity_stats_t stats;
+    char tmp[128];
+    const size_t n = sizeof(tmp);
+
+    (void)arg;
+
+    myst_verityblkdev_get_stats(&stats);
+
+    myst_buf_clear(vbuf);
+    snprintf(tmp, n, "Hits:           %zu\n", stats.hits);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "Misses:         %zu\n", stats.misses);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "Evictions:      %zu\n", stats.evictions);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "Prefetched:     %zu\n", stats.prefetched);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "PrefetchHits:   %zu\n", stats.prefetch_hits);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "NodesHashed:    %zu\n", stats.nodes_hashed);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+    snprintf(tmp, n, "NodesImported:  %zu\n", stats.nodes_imported);
+    myst_buf_append(vbuf, tmp, strlen(tmp));
+
+    return 0;
+}
+
 int create_proc_root_entries()
 {
     int ret;
 
+    /* Create /proc/cpuinfo */
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/cpuinfo", S_IFREG, _cpuinfo_vcallback, NULL));
+
     /* Create /proc/meminfo */
-    ECHECK(myst_create_virtual_file(_procfs, "/meminfo", S_IFREG, _meminfo_vcallback));
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/meminfo", S_IFREG, _meminfo_vcallback, NULL));
 
     /* Create /proc/self */
-    ECHECK(myst_create_virtual_file(_procfs, "/self", S_IFLNK, _self_vcallback));
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/self", S_IFLNK, _self_vcallback, NULL));
+
+    /* Create /proc/myst/syscalls */
+    ECHECK(myst_mkdirhier("/proc/myst", 777));
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/myst/syscalls", S_IFREG, _syscalls_vcallback, NULL));
+
+    /* Create /proc/myst/stats (and the same as a binary snapshot) */
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/myst/stats", S_IFREG, _stats_vcallback, NULL));
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/myst/stats.bin", S_IFREG, _stats_bin_vcallback, NULL));
+
+    /* Create /proc/myst/tcalls (see tcallstats.h) */
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/myst/tcalls", S_IFREG, _tcalls_vcallback, NULL));
+
+    /* Create /proc/myst/locks (see lockstats.h) */
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/myst/locks", S_IFREG, _locks_vcallback, NULL));
+
+    /* Create /proc/myst/events (write the categories to record) */
+    ECHECK(myst_create_writable_virtual_file(
+        _procfs, "/myst/events", _events_vcallback, _events_vwrite, NULL));
+
+    /* Create /proc/myst/sockbufs */
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/myst/sockbufs", S_IFREG, _sockbufs_vcallback, NULL));
+
+    /* Create /proc/myst/verity */
+    ECHECK(myst_create_virtual_file(
+        _procfs, "/myst/verity", S_IFREG, _verity_vcallback, NULL));
 
 done:
     return ret;
-}
\ No newline at end of file
+}
+/*
+**==============================================================================
+**
+** /proc/[pid] files:
+**
+**     These are created with the /proc/[pid] directory when the process execs
+**     (see procfs_pid_setup()) and generate their contents on each open from
+**     the thread and mman structures. The threads are inspected while the tid
+**     map is locked, so the process may exit at any time.
+**
+**==============================================================================
+*/
+
+/* Linux reports times in clock ticks of this rate (USER_HZ) */
+#define CLOCK_TICKS 100
+
+/* The VADs are formatted in batches of this many */
+#define MAPS_BATCH 64
+
+typedef struct proc_info
+{
+    pid_t pid;
+    bool found;
+    char name[16];
+    pid_t ppid;
+    pid_t sid;
+    char state;
+    mode_t umask;
+    size_t num_threads;
+    long utime;
+    long stime;
+    struct timespec start_ts;
+    uint64_t pending;      /* pending for the process thread */
+    uint64_t shd_pending;  /* pending for any thread of the process */
+    uint64_t blocked;
+    uint64_t ignored;
+    uint64_t caught;
+    size_t queued;
+} proc_info_t;
+
+static void _get_proc_info_callback(myst_thread_t* thread, void* arg)
+{
+    proc_info_t* info = (proc_info_t*)arg;
+
+    if (thread->pid != info->pid)
+        return;
+
+    info->num_threads++;
+    info->utime += __atomic_load_n(&thread->utime, __ATOMIC_RELAXED);
+    info->stime += __atomic_load_n(&thread->stime, __ATOMIC_RELAXED);
+    info->shd_pending |= thread->signal.pending;
+    if (thread->signal.infos)
+        info->queued += thread->signal.infos->queue_size;
+
+    if (myst_is_process_thread(thread))
+    {
+        const posix_sigaction_t* actions = thread->signal.sigactions;
+
+        info->found = true;
+        memcpy(info->name, thread->name, sizeof(info->name));
+        info->name[sizeof(info->name) - 1] = '\0';
+        info->ppid = thread->ppid;
+        info->sid = thread->sid;
+        info->state = thread->signal.cond_wait ? 'S' : 'R';
+        info->umask = thread->main.umask;
+        info->start_ts = thread->start_ts;
+        info->pending = thread->signal.pending;
+        info->blocked = thread->signal.mask;
+
+        for (size_t i = 0; actions && i < NSIG - 1; i++)
+        {
+            if (actions[i].handler == (uint64_t)SIG_IGN)
+                info->ignored |= (uint64_t)1 << i;
+            else if (actions[i].handler != (uint64_t)SIG_DFL)
+                info->caught |= (uint64_t)1 << i;
+        }
+    }
+}
+
+static int _get_proc_info(pid_t pid, proc_info_t* info)
+{
+    memset(info, 0, sizeof(proc_info_t));
+    info->pid = pid;
+
+    myst_tid_map_foreach(_get_proc_info_callback, info);
+
+    return info->found ? 0 : -ESRCH;
+}
+
+MYST_PRINTF_FORMAT(2, 3)
+static int _bprintf(myst_buf_t* vbuf, const char* format, ...)
+{
+    char tmp[256];
+    va_list ap;
+    int n;
+
+    va_start(ap, format);
+    n = vsnprintf(tmp, sizeof(tmp), format, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= sizeof(tmp))
+        return -EINVAL;
+
+    return myst_buf_append(vbuf, tmp, (size_t)n) == 0 ? 0 : -ENOMEM;
+}
+
+static unsigned long _ticks(long nsec)
+{
+    return (unsigned long)nsec / (1000000000UL / CLOCK_TICKS);
+}
+
+static int _stat_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    int ret = 0;
+    proc_info_t info;
+    myst_mman_stats_t mman;
+    long start_nsec;
+    size_t vsize;
+
+    ECHECK(_get_proc_info((pid_t)(long)arg, &info));
+    ECHECK(myst_get_mman_stats(&mman));
+
+    start_nsec = info.start_ts.tv_sec * 1000000000L + info.start_ts.tv_nsec;
+    vsize = mman.mapped + (mman.brk - mman.start);
+
+    myst_buf_clear(vbuf);
+    ECHECK(myst_buf_reserve(vbuf, 512));
+
+    /* pid (comm) state ppid pgrp session tty_nr tpgid flags */
+    ECHECK(_bprintf(
+        vbuf,
+        "%d (%s) %c %d %d %d 0 -1 0 ",
+        info.pid,
+        info.name,
+        info.state,
+        info.ppid,
+        info.pid,
+        info.sid));
+
+    /* minflt cminflt majflt cmajflt utime stime cutime cstime priority nice
+     * num_threads itrealvalue starttime vsize rss rsslim */
+    ECHECK(_bprintf(
+        vbuf,
+        "0 0 0 0 %lu %lu 0 0 20 0 %zu 0 %lu %zu %zu %lu ",
+        _ticks(info.utime),
+        _ticks(info.stime),
+        info.num_threads,
+        _ticks(start_nsec),
+        vsize,
+        mman.committed / PAGE_SIZE,
+        (unsigned long)RLIM_INFINITY));
+
+    /* startcode endcode startstack kstkesp kstkeip signal blocked sigignore
+     * sigcatch wchan nswap cnswap exit_signal processor rt_priority policy
+     * delayacct_blkio_ticks guest_time cguest_time start_data end_data
+     * start_brk arg_start arg_end env_start env_end exit_code */
+    ECHECK(_bprintf(
+        vbuf,
+        "0 0 0 0 0 %lu %lu %lu %lu 0 0 0 %d 0 0 0 0 0 0 0 0 %lu 0 0 0 0 0\n",
+        info.pending & 0x7fffffff,
+        info.blocked & 0x7fffffff,
+        info.ignored & 0x7fffffff,
+        info.caught & 0x7fffffff,
+        SIGCHLD,
+        (unsigned long)mman.start));
+
+done:
+    return ret;
+}
+
+static int _statm_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    int ret = 0;
+    proc_info_t info;
+    myst_mman_stats_t mman;
+    size_t size;
+
+    ECHECK(_get_proc_info((pid_t)(long)arg, &info));
+    ECHECK(myst_get_mman_stats(&mman));
+
+    size = mman.mapped + (mman.brk - mman.start);
+
+    /* size resident shared text lib data dt (in pages) */
+    myst_buf_clear(vbuf);
+    ECHECK(_bprintf(
+        vbuf,
+        "%zu %zu 0 0 0 %zu 0\n",
+        size / PAGE_SIZE,
+        mman.committed / PAGE_SIZE,
+        (mman.brk - mman.start) / PAGE_SIZE));
+
+done:
+    return ret;
+}
+
+static int _status_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    int ret = 0;
+    proc_info_t info;
+    myst_mman_stats_t mman;
+    size_t size;
+    const char* state;
+
+    ECHECK(_get_proc_info((pid_t)(long)arg, &info));
+    ECHECK(myst_get_mman_stats(&mman));
+
+    size = mman.mapped + (mman.brk - mman.start);
+    state = (info.state == 'S') ? "S (sleeping)" : "R (running)";
+
+    myst_buf_clear(vbuf);
+    ECHECK(myst_buf_reserve(vbuf, 1024));
+    ECHECK(_bprintf(vbuf, "Name:\t%s\n", info.name));
+    ECHECK(_bprintf(vbuf, "Umask:\t%04o\n", info.umask));
+    ECHECK(_bprintf(vbuf, "State:\t%s\n", state));
+    ECHECK(_bprintf(vbuf, "Tgid:\t%d\n", info.pid));
+    ECHECK(_bprintf(vbuf, "Ngid:\t0\n"));
+    ECHECK(_bprintf(vbuf, "Pid:\t%d\n", info.pid));
+    ECHECK(_bprintf(vbuf, "PPid:\t%d\n", info.ppid));
+    ECHECK(_bprintf(vbuf, "TracerPid:\t0\n"));
+    ECHECK(_bprintf(vbuf, "Uid:\t%u\t%u\t%u\t%u\n", 0, 0, 0, 0));
+    ECHECK(_bprintf(vbuf, "Gid:\t%u\t%u\t%u\t%u\n", 0, 0, 0, 0));
+    ECHECK(_bprintf(vbuf, "VmSize:\t%8zu kB\n", size / 1024));
+    ECHECK(_bprintf(vbuf, "VmRSS:\t%8zu kB\n", mman.committed / 1024));
+    ECHECK(_bprintf(
+        vbuf, "VmData:\t%8zu kB\n", (mman.brk - mman.start) / 1024));
+    ECHECK(_bprintf(vbuf, "Threads:\t%zu\n", info.num_threads));
+    ECHECK(_bprintf(
+        vbuf, "SigQ:\t%zu/%d\n", info.queued, MYST_SIGNAL_QUEUE_SIZE));
+    ECHECK(_bprintf(vbuf, "SigPnd:\t%016lx\n", info.pending));
+    ECHECK(_bprintf(vbuf, "ShdPnd:\t%016lx\n", info.shd_pending));
+    ECHECK(_bprintf(vbuf, "SigBlk:\t%016lx\n", info.blocked));
+    ECHECK(_bprintf(vbuf, "SigIgn:\t%016lx\n", info.ignored));
+    ECHECK(_bprintf(vbuf, "SigCgt:\t%016lx\n", info.caught));
+
+done:
+    return ret;
+}
+
+static int _maps_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    int ret = 0;
+    proc_info_t info;
+    myst_mman_stats_t mman;
+    myst_vad_t vads[MAPS_BATCH];
+    uintptr_t addr = 0;
+    size_t n;
+
+    ECHECK(_get_proc_info((pid_t)(long)arg, &info));
+    ECHECK(myst_get_mman_stats(&mman));
+
+    /* processes share one address space, so all of it is listed */
+    myst_buf_clear(vbuf);
+    ECHECK(myst_buf_reserve(vbuf, (mman.count + 1) * 64));
+
+    if (mman.brk > mman.start)
+    {
+        ECHECK(_bprintf(
+            vbuf,
+            "%08lx-%08lx rw-p 00000000 00:00 0 [heap]\n",
+            mman.start,
+            mman.brk));
+    }
+
+    while ((n = myst_get_vads(addr, vads, MAPS_BATCH)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            const myst_vad_t* v = &vads[i];
+
+            ECHECK(_bprintf(
+                vbuf,
+                "%08lx-%08lx %c%c%c%c 00000000 00:00 0\n",
+                v->addr,
+                v->addr + v->size,
+                (v->prot & MYST_PROT_READ) ? 'r' : '-',
+                (v->prot & MYST_PROT_WRITE) ? 'w' : '-',
+                (v->prot & MYST_PROT_EXEC) ? 'x' : '-',
+                (v->flags & MYST_MAP_SHARED) ? 's' : 'p'));
+        }
+
+        addr = vads[n - 1].addr + vads[n - 1].size;
+    }
+
+done:
+    return ret;
+}
+
+/* every process is in the root of the cgroup v2 hierarchy (/sys/fs/cgroup) */
+static int _cgroup_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_buf_append(vbuf, "0::/\n", 5);
+}
+
+static int _mountinfo_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_format_mountinfo(vbuf);
+}
+
+int procfs_pid_setup(pid_t pid)
+{
+    int ret = 0;
+    static const struct
+    {
+        const char* name;
+        myst_vcallback_t vcallback;
+    } _files[] = {
+        {"stat", _stat_vcallback},
+        {"statm", _statm_vcallback},
+        {"status", _status_vcallback},
+        {"maps", _maps_vcallback},
+        {"cgroup", _cgroup_vcallback},
+        {"mountinfo", _mountinfo_vcallback},
+    };
+
+    for (size_t i = 0; i < MYST_COUNTOF(_files); i++)
+    {
+        char path[PATH_MAX];
+        void* arg = (void*)(long)pid;
+
+        snprintf(path, sizeof(path), "/%d/%s", pid, _files[i].name);
+        ECHECK(myst_create_virtual_file(
+            _procfs, path, S_IFREG, _files[i].vcallback, arg));
+    }
+
+done:
+    return ret;
+}
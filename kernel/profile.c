@@ -0,0 +1,228 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/defs.h>
+#include <myst/eraise.h>
+#include <myst/kernel.h>
+#include <myst/profile.h>
+#include <myst/spinlock.h>
+#include <myst/strings.h>
+#include <myst/thread.h>
+#include <myst/timer.h>
+
+/* the samples a thread holds before copying them to the profile */
+#define RING_SIZE 16
+
+/* the largest frame that the backtrace steps over */
+#define MAX_FRAME_SIZE (1024 * 1024)
+
+struct myst_profile_ring
+{
+    size_t count;
+    myst_profile_sample_t samples[RING_SIZE];
+};
+
+static myst_profile_t* _profile;
+static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
+static myst_timer_t _timer;
+static uint64_t _deadline;
+static _Atomic(uint64_t) _ticks;
+
+/* the kernel's own counts (the host may change those of the profile) */
+static size_t _nsamples;
+static size_t _dropped;
+
+static void _tick(myst_timer_t* timer)
+{
+    const uint64_t now = myst_timer_now();
+    uint64_t n = 1;
+
+    /* count the ticks missed by a late timer thread */
+    if (now > _deadline)
+        n += (now - _deadline) / MYST_PROFILE_INTERVAL_NSEC;
+
+    _ticks += n;
+    _deadline += n * MYST_PROFILE_INTERVAL_NSEC;
+    myst_timer_arm(timer, _deadline);
+}
+
+int myst_profile_start_sampling(void)
+{
+    int ret = 0;
+    myst_profile_t* profile = __myst_kernel_args.profile;
+
+    /* the samples expose enclave addresses */
+    if (!profile || !__myst_kernel_args.tee_debug_mode)
+        goto done;
+
+    /* the profile is in host memory, so only write it */
+    profile->kernel_base = (uint64_t)__myst_kernel_args.kernel_data;
+    profile->kernel_size = __myst_kernel_args.kernel_size;
+
+    _profile = profile;
+    _timer.fn = _tick;
+    _deadline = myst_timer_now() + MYST_PROFILE_INTERVAL_NSEC;
+    ECHECK(myst_timer_arm(&_timer, _deadline));
+
+done:
+    return ret;
+}
+
+void myst_profile_stop_sampling(void)
+{
+    if (_profile)
+        myst_timer_cancel(&_timer);
+}
+
+static bool _within(const void* p, const void* base, size_t size)
+{
+    const uintptr_t x = (uintptr_t)p;
+    const uintptr_t start = (uintptr_t)base;
+
+    return x >= start && x - start < size;
+}
+
+/* Whether the frame can be read (it is on a kernel or a user stack) */
+static bool _valid_frame(void** frame)
+{
+    const myst_kernel_args_t* args = &__myst_kernel_args;
+
+    if (((uintptr_t)frame % sizeof(void*)) != 0)
+        return false;
+
+    if (_within(frame, args->image_data, args->image_size - sizeof(void*)))
+        return true;
+
+    if (_within(frame, args->mman_data, args->mman_size - sizeof(void*)))
+        return true;
+
+    return false;
+}
+
+static bool _in_kernel(uint64_t addr)
+{
+    const myst_kernel_args_t* args = &__myst_kernel_args;
+    return _within((void*)addr, args->kernel_data, args->kernel_size);
+}
+
+/* Follow the frame pointers from the caller of myst_profile_sample(),
+ * skipping the kernel frames for time in user code */
+MYST_NOINLINE
+static size_t _backtrace(uint64_t* frames, bool user)
+{
+    void** frame = __builtin_frame_address(0);
+    size_t n = 0;
+    size_t skip = 1; /* the return into myst_profile_sample() */
+
+    while (n < MYST_PROFILE_MAX_FRAMES && _valid_frame(frame))
+    {
+        void** next = (void**)frame[0];
+        const uint64_t addr = (uint64_t)frame[1];
+
+        if (!addr)
+            break;
+
+        if (skip)
+            skip--;
+        else if (!user || !_in_kernel(addr))
+            frames[n++] = addr;
+
+        /* callers are higher on the same stack */
+        if (next <= frame ||
+            (uintptr_t)next - (uintptr_t)frame > MAX_FRAME_SIZE)
+        {
+            break;
+        }
+
+        frame = next;
+    }
+
+    return n;
+}
+
+/* Copy the samples to the profile (dropping those that do not fit) */
+static void _flush(struct myst_profile_ring* ring)
+{
+    myst_spin_lock(&_lock);
+    {
+        size_t n = ring->count;
+
+        if (n > MYST_PROFILE_MAX_SAMPLES - _nsamples)
+            n = MYST_PROFILE_MAX_SAMPLES - _nsamples;
+
+        memcpy(
+            &_profile->samples[_nsamples],
+            ring->samples,
+            n * sizeof(myst_profile_sample_t));
+
+        _nsamples += n;
+        _profile->nsamples = _nsamples;
+
+        if (n < ring->count)
+        {
+            _dropped += ring->count - n;
+            _profile->dropped = _dropped;
+        }
+    }
+    myst_spin_unlock(&_lock);
+
+    ring->count = 0;
+}
+
+void myst_profile_sample(myst_thread_t* thread, const char* syscall)
+{
+    struct myst_profile_ring* ring;
+    myst_profile_sample_t* sample;
+    uint64_t ticks;
+    uint64_t weight;
+
+    if (!_profile)
+        return;
+
+    ticks = _ticks;
+    weight = ticks - thread->profile_ticks;
+    thread->profile_ticks = ticks;
+
+    /* no tick since the last sample (or the first sample of the thread) */
+    if (weight == 0 || weight == ticks)
+        return;
+
+    if (!(ring = thread->profile_ring))
+    {
+        if (!(ring = calloc(1, sizeof(struct myst_profile_ring))))
+            return;
+
+        thread->profile_ring = ring;
+    }
+
+    sample = &ring->samples[ring->count];
+    sample->tid = (uint32_t)thread->tid;
+    sample->weight = weight > UINT32_MAX ? UINT32_MAX : (uint32_t)weight;
+    sample->syscall[0] = '\0';
+
+    if (syscall)
+        myst_strlcpy(sample->syscall, syscall, sizeof(sample->syscall));
+
+    sample->nframes = _backtrace(sample->frames, !syscall);
+
+    if (++ring->count == RING_SIZE)
+        _flush(ring);
+}
+
+void myst_profile_release(myst_thread_t* thread)
+{
+    struct myst_profile_ring* ring = thread->profile_ring;
+
+    if (ring)
+    {
+        if (_profile && ring->count)
+            _flush(ring);
+
+        free(ring);
+        thread->profile_ring = NULL;
+    }
+}
@@ -5,6 +5,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -14,6 +15,7 @@
 #include <myst/buf.h>
 #include <myst/bufu64.h>
 #include <myst/clock.h>
+#include <myst/cpio.h>
 #include <myst/eraise.h>
 #include <myst/fs.h>
 #include <myst/id.h>
@@ -23,6 +25,9 @@
 #include <myst/ramfs.h>
 #include <myst/realpath.h>
 #include <myst/round.h>
+#include <myst/rwlock.h>
+#include <myst/slab.h>
+#include <myst/spinlock.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
 #include <myst/trace.h>
@@ -30,7 +35,30 @@
 #define BLKSIZE 512
 
 /* ATTN: check access for all read operations */
-/* ATTN: add whole-file-system locking */
+
+/*
+**==============================================================================
+**
+** Locking:
+**
+**     The namespace lock of a file system (ramfs_t.lock) covers its
+**     directories, symbolic links and link counts: path walks and lookups
+**     hold it for reading and changes to a directory hold it for writing.
+**     It is never held while an operation is delegated to another file
+**     system (which may be this one again).
+**
+**     The data of each regular file has a lock of its own (inode_t.lock),
+**     so I/O on different files never contends and never takes the
+**     namespace lock. Reads and writes hold it for reading: a write only
+**     fills and publishes pages (serialized by inode_t.write_lock), so the
+**     reads of a file proceed alongside its writes. Only a truncation,
+**     which frees pages, holds it for writing.
+**
+**     An open file keeps its inode (inode_t.nopens), so its I/O needs no
+**     namespace lock. Locks are taken in order: namespace, then inode.
+**
+**==============================================================================
+*/
 
 /*
 **==============================================================================
@@ -53,6 +81,8 @@ typedef struct ramfs
     char target[PATH_MAX]; /* target argument to myst_mount() */
     myst_mount_resolve_callback_t resolve;
     size_t ninodes;
+    myst_rwlock_t lock; /* the namespace lock (see Locking above) */
+    long f_type;        /* reported by statfs() (see myst_ramfs_set_type()) */
 } ramfs_t;
 
 static bool _ramfs_valid(const ramfs_t* ramfs)
@@ -60,6 +90,31 @@ static bool _ramfs_valid(const ramfs_t* ramfs)
     return ramfs && ramfs->magic == RAMFS_MAGIC;
 }
 
+/* How an operation holds the namespace lock */
+#define NS_UNLOCKED 0
+#define NS_READ 1
+#define NS_WRITE 2
+
+static void _ns_lock(ramfs_t* ramfs, int* locked, int how)
+{
+    if (how == NS_WRITE)
+        myst_rwlock_wrlock(&ramfs->lock);
+    else
+        myst_rwlock_rdlock(&ramfs->lock);
+
+    *locked = how;
+}
+
+static void _ns_unlock(ramfs_t* ramfs, int* locked)
+{
+    if (*locked == NS_WRITE)
+        myst_rwlock_wrunlock(&ramfs->lock);
+    else if (*locked == NS_READ)
+        myst_rwlock_rdunlock(&ramfs->lock);
+
+    *locked = NS_UNLOCKED;
+}
+
 /*
 **==============================================================================
 **
@@ -70,6 +125,18 @@ static bool _ramfs_valid(const ramfs_t* ramfs)
 
 #define INODE_MAGIC 0xcdfbdd61258a4c9d
 
+/* Directories with at least this many entries get a hash index */
+#define DIR_INDEX_MIN 32
+
+/* Open-addressing table from entry names to their byte offsets in the dirent
+ * buffer; slots hold offsets plus one (zero marks a free slot) */
+typedef struct dir_index
+{
+    size_t capacity; /* a power of two, at least twice the count */
+    size_t count;
+    uint32_t slots[];
+} dir_index_t;
+
 struct inode
 {
     uint64_t magic;
@@ -81,9 +148,21 @@ struct inode
     size_t nopens;         /* number of times file is currently opened */
     myst_buf_t buf;        /* file or directory data */
     const void* data;      /* set by myst_ramfs_set_buf() */
-    int (*vcallback)(myst_buf_t* buf);
+    myst_vcallback_t vcallback;
+    myst_vwrite_callback_t vwrite; /* null unless the file takes writes */
+    void* vcallback_arg;   /* passed to vcallback and vwrite */
+    dir_index_t* index;    /* null for files and small directories */
+    size_t nents;          /* the number of directory entries */
+    uint64_t dir_version;  /* bumped whenever directory entries move */
+    struct file_pages* pages; /* regular file data (see file pages below) */
+    size_t size;              /* regular file size */
+    myst_rwlock_t lock;       /* regular file data (see Locking above) */
+    myst_spinlock_t write_lock; /* orders writers of the file data */
 };
 
+static myst_slab_cache_t _inode_cache =
+    MYST_SLAB_CACHE_INIT("ramfs inode_t", inode_t);
+
 #define ACCESS 1
 #define CHANGE 2
 #define MODIFY 4
@@ -99,7 +178,8 @@ static void _update_timestamps(inode_t* inode, int flags)
 
     assert(_inode_valid(inode));
 
-    if (myst_syscall_clock_gettime(CLOCK_REALTIME, &ts) != 0)
+    /* timestamps come from the coarse clock, as they do on Linux */
+    if (myst_syscall_clock_gettime(CLOCK_REALTIME_COARSE, &ts) != 0)
         myst_panic("clock_gettime() failed");
 
     if (flags & ACCESS)
@@ -112,16 +192,339 @@ static void _update_timestamps(inode_t* inode, int flags)
         inode->mtime = ts;
 }
 
+/* Update the access time of a file that is read (per the mount flags) */
+static void _touch_atime(ramfs_t* ramfs, inode_t* inode)
+{
+    struct timespec now;
+    const myst_atime_t how = ramfs->base.atime;
+
+    assert(_inode_valid(inode));
+
+    if (how == MYST_ATIME_NONE ||
+        (S_ISDIR(inode->mode) && ramfs->base.nodiratime))
+    {
+        return;
+    }
+
+    if (myst_syscall_clock_gettime(CLOCK_REALTIME_COARSE, &now) != 0)
+        myst_panic("clock_gettime() failed");
+
+    if (myst_atime_due(how, &inode->atime, &inode->mtime, &inode->ctime, &now))
+        inode->atime = now;
+}
+
+/*
+**==============================================================================
+**
+** file pages: the data of a regular file.
+**
+**     A regular file keeps its data in fixed-size pages found through a
+**     table indexed by page number, so a write allocates only the pages it
+**     touches and growing a file never moves what is already there. A null
+**     page is a hole and reads as zeros. A file given by myst_ramfs_set_buf()
+**     reads that buffer until it is first changed. Directories, symbolic
+**     links and virtual files keep their contiguous buffer.
+**
+**     Reads run alongside writes (see Locking): writers publish a page only
+**     once it is filled and replace a full table by a larger copy, keeping
+**     the old one for readers that still look at it until the pages are
+**     next freed (when no reader can be inside).
+**
+**==============================================================================
+*/
+
+#define FILE_PAGE_SIZE 4096
+
+typedef struct file_pages
+{
+    struct file_pages* retired; /* the smaller table this one replaced */
+    size_t count;
+    uint8_t* slots[];
+} file_pages_t;
+
+static const uint8_t _zero_page[FILE_PAGE_SIZE];
+
+static bool _inode_paged(const inode_t* inode)
+{
+    return S_ISREG(inode->mode) && !inode->vcallback;
+}
+
+static size_t _inode_size(const inode_t* inode)
+{
+    if (_inode_paged(inode))
+        return __atomic_load_n(&inode->size, __ATOMIC_ACQUIRE);
+
+    return inode->buf.size;
+}
+
+/* The page (or null) at the given page number of a table */
+static const uint8_t* _pages_get(file_pages_t* table, size_t i)
+{
+    if (!table || i >= table->count)
+        return NULL;
+
+    return __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+}
+
+/* Free the tables replaced by this one (with the inode locked for writing) */
+static void _pages_free_retired(file_pages_t* table)
+{
+    file_pages_t* p = table->retired;
+
+    while (p)
+    {
+        file_pages_t* next = p->retired;
+        free(p);
+        p = next;
+    }
+
+    table->retired = NULL;
+}
+
+/* Free the pages at and above the given page number (with the inode locked
+ * for writing) */
+static void _pages_free_from(inode_t* inode, size_t first)
+{
+    file_pages_t* table = inode->pages;
+
+    if (table)
+    {
+        for (size_t i = first; i < table->count; i++)
+        {
+            free(table->slots[i]);
+            table->slots[i] = NULL;
+        }
+
+        _pages_free_retired(table);
+    }
+}
+
+static void _pages_release(inode_t* inode)
+{
+    _pages_free_from(inode, 0);
+    free(inode->pages);
+    inode->pages = NULL;
+}
+
+/* Make the page table cover at least count pages (with the write lock) */
+static int _pages_reserve(inode_t* inode, size_t count)
+{
+    file_pages_t* old = inode->pages;
+    size_t n = (old && old->count) ? old->count : 1;
+    file_pages_t* table;
+
+    if (old && count <= old->count)
+        return 0;
+
+    while (n < count)
+        n *= 2;
+
+    if (!(table = calloc(1, sizeof(file_pages_t) + n * sizeof(uint8_t*))))
+        return -ENOMEM;
+
+    if (old)
+        memcpy(table->slots, old->slots, old->count * sizeof(uint8_t*));
+
+    table->retired = old;
+    table->count = n;
+    __atomic_store_n(&inode->pages, table, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Copy count bytes at offset into the pages (allocating them) with the
+ * write lock; does not change the file size */
+static int _pages_store(
+    inode_t* inode,
+    size_t offset,
+    const void* buf,
+    size_t count)
+{
+    const uint8_t* p = buf;
+
+    if (!count)
+        return 0;
+
+    if (_pages_reserve(inode, (offset + count - 1) / FILE_PAGE_SIZE + 1) != 0)
+        return -ENOMEM;
+
+    while (count)
+    {
+        const size_t off = offset % FILE_PAGE_SIZE;
+        const size_t room = FILE_PAGE_SIZE - off;
+        const size_t n = (count < room) ? count : room;
+        uint8_t** slot = &inode->pages->slots[offset / FILE_PAGE_SIZE];
+
+        if (*slot)
+        {
+            memcpy(*slot + off, p, n);
+        }
+        else
+        {
+            uint8_t* page;
+
+            if (!(page = malloc(FILE_PAGE_SIZE)))
+                return -ENOMEM;
+
+            /* fill the whole page before readers can see it */
+            memset(page, 0, off);
+            memcpy(page + off, p, n);
+            memset(page + off + n, 0, FILE_PAGE_SIZE - off - n);
+            __atomic_store_n(slot, page, __ATOMIC_RELEASE);
+        }
+
+        offset += n;
+        p += n;
+        count -= n;
+    }
+
+    return 0;
+}
+
+/* Move the myst_ramfs_set_buf() buffer (if any) into pages before a change
+ * (with the write lock); readers keep reading the buffer meanwhile */
+static int _pages_own(inode_t* inode)
+{
+    const void* data = inode->data;
+
+    if (data)
+    {
+        if (_pages_store(inode, 0, data, inode->size) != 0)
+            return -ENOMEM;
+
+        __atomic_store_n(&inode->data, NULL, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+/* Copy up to count bytes at offset with the inode locked for reading;
+ * returns the bytes copied (none at or beyond the end of file) */
+static size_t _pages_read(
+    const inode_t* inode,
+    size_t offset,
+    void* buf,
+    size_t count)
+{
+    const size_t size = __atomic_load_n(&inode->size, __ATOMIC_ACQUIRE);
+    const void* data = __atomic_load_n(&inode->data, __ATOMIC_ACQUIRE);
+    file_pages_t* table = __atomic_load_n(&inode->pages, __ATOMIC_ACQUIRE);
+    uint8_t* p = buf;
+    size_t total;
+
+    if (offset >= size)
+        return 0;
+
+    if (count > size - offset)
+        count = size - offset;
+
+    total = count;
+
+    if (data)
+    {
+        memcpy(buf, (const uint8_t*)data + offset, count);
+        return count;
+    }
+
+    while (count)
+    {
+        const size_t off = offset % FILE_PAGE_SIZE;
+        const size_t room = FILE_PAGE_SIZE - off;
+        const size_t n = (count < room) ? count : room;
+        const uint8_t* page = _pages_get(table, offset / FILE_PAGE_SIZE);
+
+        memcpy(p, page ? page + off : _zero_page, n);
+        offset += n;
+        p += n;
+        count -= n;
+    }
+
+    return total;
+}
+
+/* Write with the inode locked for reading (writers take the write lock) */
+static int _pages_write(
+    inode_t* inode,
+    size_t offset,
+    const void* buf,
+    size_t count)
+{
+    int ret = 0;
+
+    myst_spin_lock(&inode->write_lock);
+
+    if (_pages_own(inode) != 0 || _pages_store(inode, offset, buf, count) != 0)
+    {
+        ret = -ENOMEM;
+    }
+    else if (offset + count > inode->size)
+    {
+        /* publish the new size after the pages that it covers */
+        __atomic_store_n(&inode->size, offset + count, __ATOMIC_RELEASE);
+    }
+
+    myst_spin_unlock(&inode->write_lock);
+
+    return ret;
+}
+
+/* Change the size with the inode locked for writing */
+static int _pages_truncate(inode_t* inode, size_t length)
+{
+    if (length == 0)
+    {
+        _pages_release(inode);
+        __atomic_store_n(&inode->data, NULL, __ATOMIC_RELEASE);
+        __atomic_store_n(&inode->size, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    if (length == inode->size)
+        return 0;
+
+    if (_pages_own(inode) != 0)
+        return -ENOMEM;
+
+    if (length < inode->size)
+    {
+        const size_t off = length % FILE_PAGE_SIZE;
+        const size_t first = (length + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE;
+        uint8_t* page = (uint8_t*)_pages_get(inode->pages, first - 1);
+
+        /* zero the cut tail of the last page (a later extension reads it) */
+        if (off && page)
+            memset(page + off, 0, FILE_PAGE_SIZE - off);
+
+        _pages_free_from(inode, first);
+    }
+
+    /* growing only moves the end of file: the new range is a hole */
+    __atomic_store_n(&inode->size, length, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Lock the file data for writing; waits for the readers to leave without
+ * keeping new ones out, so a reader may nest into another file's reads or
+ * writes (as with copy_file_range()) without deadlock */
+static void _inode_wrlock(inode_t* inode)
+{
+    while (!myst_rwlock_trywrlock(&inode->lock))
+        __asm__ __volatile__("pause" : : : "memory");
+}
+
 static void _inode_free(ramfs_t* ramfs, inode_t* inode)
 {
     if (inode)
     {
         if (inode->buf.data != inode->data)
             myst_buf_release(&inode->buf);
+        _pages_release(inode);
+        free(inode->index);
         memset(inode, 0xdd, sizeof(inode_t));
-        free(inode);
+        myst_slab_free(inode);
 
-        ramfs->ninodes--;
+        __atomic_sub_fetch(&ramfs->ninodes, 1, __ATOMIC_RELAXED);
     }
 }
 
@@ -133,6 +536,300 @@ static int _split_path(
     return myst_split_path(path, dirname, PATH_MAX, basename, PATH_MAX);
 }
 
+/*
+**==============================================================================
+**
+** directory entries.
+**
+**     The buffer of a directory packs its entries in the order they were
+**     added. Each is a struct dirent cut down to its name and padded to
+**     eight bytes, which is the record getdents64() returns, so a short name
+**     takes 24 bytes rather than sizeof(struct dirent). Removing an entry
+**     moves the entries after it down.
+**
+**==============================================================================
+*/
+
+/* The record size of an entry whose name has the given length */
+static size_t _dirent_size(size_t namelen)
+{
+    return (offsetof(struct dirent, d_name) + namelen + 1 + 7) & ~(size_t)7;
+}
+
+static struct dirent* _dirent_at(const inode_t* dir, size_t pos)
+{
+    return (struct dirent*)(dir->buf.data + pos);
+}
+
+/* The offset of the entry after the one at pos */
+static size_t _dirent_next(const inode_t* dir, size_t pos)
+{
+    return pos + _dirent_at(dir, pos)->d_reclen;
+}
+
+/*
+**==============================================================================
+**
+** dir_index_t: the hash index of a large directory.
+**
+**     The dirent buffer stays the directory itself (getdents64() reads it
+**     in order); the index only finds a name without scanning it. A
+**     directory that cannot get (or grow) its index just goes without.
+**
+**==============================================================================
+*/
+
+static uint32_t _name_hash(const char* name)
+{
+    uint32_t h = 2166136261u; /* FNV-1a */
+
+    while (*name)
+    {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static void _index_insert(dir_index_t* index, const inode_t* dir, size_t pos)
+{
+    const size_t mask = index->capacity - 1;
+    size_t i = _name_hash(_dirent_at(dir, pos)->d_name) & mask;
+
+    while (index->slots[i])
+        i = (i + 1) & mask;
+
+    index->slots[i] = (uint32_t)pos + 1;
+    index->count++;
+}
+
+/* Build an index with room for twice as many entries as dir has */
+static void _index_build(inode_t* dir)
+{
+    size_t capacity = 64;
+    dir_index_t* index;
+
+    free(dir->index);
+    dir->index = NULL;
+
+    /* the slots hold 32-bit offsets */
+    if (dir->buf.size >= UINT32_MAX)
+        return;
+
+    while (capacity < 4 * dir->nents)
+        capacity *= 2;
+
+    if (!(index = calloc(1, sizeof(dir_index_t) + capacity * sizeof(uint32_t))))
+        return;
+
+    index->capacity = capacity;
+
+    for (size_t pos = 0; pos < dir->buf.size; pos = _dirent_next(dir, pos))
+        _index_insert(index, dir, pos);
+
+    dir->index = index;
+}
+
+/* The slot of the entry called name (or -1 if there is none) */
+static ssize_t _index_find(
+    const dir_index_t* index,
+    const inode_t* dir,
+    const char* name)
+{
+    const size_t mask = index->capacity - 1;
+
+    for (size_t i = _name_hash(name) & mask; index->slots[i];
+         i = (i + 1) & mask)
+    {
+        if (strcmp(_dirent_at(dir, index->slots[i] - 1)->d_name, name) == 0)
+            return (ssize_t)i;
+    }
+
+    return -1;
+}
+
+/* Remove the entry of a slot whose dirent (of the given size) is then
+ * removed from the buffer, which moves the entries after it down */
+static void _index_remove(
+    dir_index_t* index,
+    const inode_t* dir,
+    size_t slot,
+    size_t size)
+{
+    const size_t mask = index->capacity - 1;
+    const uint32_t pos = index->slots[slot];
+    size_t hole = slot;
+
+    /* backward-shift deletion keeps every probe sequence unbroken */
+    for (size_t i = (slot + 1) & mask; index->slots[i]; i = (i + 1) & mask)
+    {
+        const size_t home =
+            _name_hash(_dirent_at(dir, index->slots[i] - 1)->d_name) & mask;
+
+        /* move the entry into the hole unless its home lies after it */
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            index->slots[hole] = index->slots[i];
+            hole = i;
+        }
+    }
+
+    index->slots[hole] = 0;
+    index->count--;
+
+    for (size_t i = 0; i < index->capacity; i++)
+    {
+        if (index->slots[i] > pos)
+            index->slots[i] -= (uint32_t)size;
+    }
+}
+
+/*
+**==============================================================================
+**
+** path cache: the results of recent path walks.
+**
+**     One table serves all ramfs instances and keeps hits as well as walks
+**     that failed with ENOENT, so a hit neither splits the path nor visits
+**     its directories. Every change to any directory bumps one generation,
+**     which drops all entries at once. Walks through virtual or absolute
+**     symbolic links (whose results may vary or lie in another file system)
+**     are never cached.
+**
+**==============================================================================
+*/
+
+#define PATH_CACHE_SIZE 512 /* a power of two */
+
+/* Longer paths are walked without the cache */
+#define PATH_CACHE_MAX_PATH 256
+
+typedef struct path_cache_entry
+{
+    uint64_t generation;
+    const ramfs_t* ramfs;
+    char* path;
+    bool follow;
+    int err; /* zero or -ENOENT */
+    inode_t* parent;
+    inode_t* inode;
+} path_cache_entry_t;
+
+static path_cache_entry_t _path_cache[PATH_CACHE_SIZE];
+static myst_spinlock_t _path_cache_lock = MYST_SPINLOCK_INITIALIZER;
+
+/* never zero, so unused entries never match */
+static uint64_t _path_cache_generation = 1;
+
+/* Call after any change to a directory (or to a symbolic link target) */
+static void _path_cache_invalidate(void)
+{
+    __atomic_add_fetch(&_path_cache_generation, 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t _path_cache_current(void)
+{
+    return __atomic_load_n(&_path_cache_generation, __ATOMIC_ACQUIRE);
+}
+
+static path_cache_entry_t* _path_cache_slot(
+    const ramfs_t* ramfs,
+    const char* path,
+    bool follow)
+{
+    uint32_t h = _name_hash(path) ^ (uint32_t)((uintptr_t)ramfs >> 4);
+    return &_path_cache[(h ^ follow) & (PATH_CACHE_SIZE - 1)];
+}
+
+/* Returns true on a hit, setting the outputs and err */
+static bool _path_cache_find(
+    const ramfs_t* ramfs,
+    const char* path,
+    bool follow,
+    inode_t** parent,
+    inode_t** inode,
+    int* err)
+{
+    path_cache_entry_t* e = _path_cache_slot(ramfs, path, follow);
+    bool hit = false;
+
+    myst_spin_lock(&_path_cache_lock);
+
+    if (e->generation == _path_cache_current() && e->ramfs == ramfs &&
+        e->follow == follow && strcmp(e->path, path) == 0)
+    {
+        *parent = e->parent;
+        *inode = e->inode;
+        *err = e->err;
+        hit = true;
+    }
+
+    myst_spin_unlock(&_path_cache_lock);
+
+    return hit;
+}
+
+/* Record a walk that began at the given generation */
+static void _path_cache_insert(
+    const ramfs_t* ramfs,
+    const char* path,
+    bool follow,
+    uint64_t generation,
+    int err,
+    inode_t* parent,
+    inode_t* inode)
+{
+    path_cache_entry_t* e = _path_cache_slot(ramfs, path, follow);
+    char* copy;
+    char* old;
+
+    if (strlen(path) >= PATH_CACHE_MAX_PATH || !(copy = strdup(path)))
+        return;
+
+    myst_spin_lock(&_path_cache_lock);
+
+    if (e->path && strcmp(e->path, path) == 0)
+    {
+        old = copy;
+    }
+    else
+    {
+        old = e->path;
+        e->path = copy;
+    }
+
+    e->generation = generation;
+    e->ramfs = ramfs;
+    e->follow = follow;
+    e->err = err;
+    e->parent = parent;
+    e->inode = inode;
+
+    myst_spin_unlock(&_path_cache_lock);
+
+    free(old);
+}
+
+/* Drop the entries of a file system that is going away */
+static void _path_cache_release(const ramfs_t* ramfs)
+{
+    myst_spin_lock(&_path_cache_lock);
+
+    for (size_t i = 0; i < PATH_CACHE_SIZE; i++)
+    {
+        path_cache_entry_t* e = &_path_cache[i];
+
+        if (e->ramfs == ramfs)
+        {
+            free(e->path);
+            memset(e, 0, sizeof(path_cache_entry_t));
+        }
+    }
+
+    myst_spin_unlock(&_path_cache_lock);
+}
+
 /* Note: does not update nlink */
 static int _inode_add_dirent(
     inode_t* dir,
@@ -141,6 +838,7 @@ static int _inode_add_dirent(
     const char* name)
 {
     int ret = 0;
+    size_t pos;
 
     if (!_inode_valid(dir) || !_inode_valid(inode) || !name)
         ERAISE(-EINVAL);
@@ -148,23 +846,42 @@ static int _inode_add_dirent(
     if (type != DT_REG && type != DT_DIR && type != DT_LNK)
         ERAISE(-EINVAL);
 
-    /* Append the new directory entry */
+    pos = dir->buf.size;
+
+    /* Append the new directory entry (which the initializer zero-pads) */
     {
+        const size_t len = strlen(name);
         struct dirent ent = {
             .d_ino = (ino_t)inode,
-            .d_off = (off_t)dir->buf.size,
-            .d_reclen = sizeof(struct dirent),
+            .d_off = (off_t)pos,
+            .d_reclen = (unsigned short)_dirent_size(len),
             .d_type = type,
         };
 
-        if (MYST_STRLCPY(ent.d_name, name) >= sizeof(ent.d_name))
+        if (len >= sizeof(ent.d_name))
             ERAISE(-ENAMETOOLONG);
 
-        if (myst_buf_append(&dir->buf, &ent, sizeof(ent)) != 0)
+        memcpy(ent.d_name, name, len + 1);
+
+        if (myst_buf_append(&dir->buf, &ent, ent.d_reclen) != 0)
             ERAISE(-ENOMEM);
+
+        dir->nents++;
+    }
+
+    /* index the new entry (or index the directory once it gets large) */
+    {
+        dir_index_t* index = dir->index;
+
+        if (index && 2 * (index->count + 1) <= index->capacity &&
+            dir->buf.size < UINT32_MAX)
+            _index_insert(index, dir, pos);
+        else if (index || dir->nents >= DIR_INDEX_MIN)
+            _index_build(dir);
     }
 
     _update_timestamps(dir, CHANGE | MODIFY);
+    _path_cache_invalidate();
 
 done:
     return ret;
@@ -173,7 +890,7 @@ done:
 static bool _inode_is_empty_dir(const inode_t* inode)
 {
     /* empty directories have two entries: "." and ".." */
-    const size_t empty_size = (2 * sizeof(struct dirent));
+    const size_t empty_size = _dirent_size(1) + _dirent_size(2);
     return inode && S_ISDIR(inode->mode) && inode->buf.size == empty_size;
 }
 
@@ -186,17 +903,11 @@ static void _dump_dirents(const inode_t* inode)
 
     printf("=== _dump_dirents()\n");
 
-    struct dirent* p = (struct dirent*)inode->buf.data;
-    struct dirent* end = (struct dirent*)(inode->buf.data + inode->buf.size);
-
     printf("inode=%p\n", inode);
-    printf("nentries=%zu\n", (end - p));
+    printf("nentries=%zu\n", inode->nents);
 
-    while (p != end)
-    {
-        printf("name{%s}\n", p->d_name);
-        p++;
-    }
+    for (size_t pos = 0; pos < inode->buf.size; pos = _dirent_next(inode, pos))
+        printf("name{%s}\n", _dirent_at(inode, pos)->d_name);
 
     printf("\n");
 }
@@ -218,7 +929,7 @@ static int _inode_new(
     if (!name)
         ERAISE(-EINVAL);
 
-    if (!(inode = calloc(1, sizeof(inode_t))))
+    if (!(inode = myst_slab_alloc(&_inode_cache)))
         ERAISE(-ENOMEM);
 
     inode->magic = INODE_MAGIC;
@@ -270,7 +981,7 @@ static int _inode_new(
     if (inode_out)
         *inode_out = inode;
 
-    ramfs->ninodes++;
+    __atomic_add_fetch(&ramfs->ninodes, 1, __ATOMIC_RELAXED);
     inode = NULL;
 
 done:
@@ -283,13 +994,23 @@ done:
 
 static inode_t* _inode_find_child(const inode_t* inode, const char* name)
 {
-    struct dirent* ents = (struct dirent*)inode->buf.data;
-    size_t nents = inode->buf.size / sizeof(struct dirent);
+    if (inode->index)
+    {
+        const ssize_t slot = _index_find(inode->index, inode, name);
 
-    for (size_t i = 0; i < nents; i++)
+        if (slot < 0)
+            return NULL;
+
+        return (inode_t*)_dirent_at(inode, inode->index->slots[slot] - 1)
+            ->d_ino;
+    }
+
+    for (size_t pos = 0; pos < inode->buf.size; pos = _dirent_next(inode, pos))
     {
-        if (strcmp(ents[i].d_name, name) == 0)
-            return (inode_t*)ents[i].d_ino;
+        const struct dirent* ent = _dirent_at(inode, pos);
+
+        if (strcmp(ent->d_name, name) == 0)
+            return (inode_t*)ent->d_ino;
     }
 
     /* Not found */
@@ -303,15 +1024,13 @@ static void _inode_release_all(
     inode_t* inode,
     uint8_t d_type)
 {
-    struct dirent* ents = (struct dirent*)inode->buf.data;
-    size_t nents = inode->buf.size / sizeof(struct dirent);
-
     /* Free the children first */
     if (d_type == DT_DIR)
     {
-        for (size_t i = 0; i < nents; i++)
+        for (size_t pos = 0; pos < inode->buf.size;
+             pos = _dirent_next(inode, pos))
         {
-            const struct dirent* ent = &ents[i];
+            const struct dirent* ent = _dirent_at(inode, pos);
             inode_t* child;
 
             if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
@@ -349,39 +1068,51 @@ static void _inode_release_all(
 static int _inode_remove_dirent(inode_t* inode, const char* name)
 {
     int ret = 0;
-    struct dirent* ents = (struct dirent*)inode->buf.data;
-    size_t nents = inode->buf.size / sizeof(struct dirent);
-    size_t index = (size_t)-1;
+    size_t pos = (size_t)-1;
+    size_t size;
 
     if (!S_ISDIR(inode->mode))
         ERAISE(-ENOTDIR);
 
-    for (size_t i = 0; i < nents; i++)
+    if (inode->index)
     {
-        if (strcmp(ents[i].d_name, name) == 0)
-        {
-            const size_t pos = i * sizeof(struct dirent);
-            const size_t size = sizeof(struct dirent);
-
-            /* clear the entry */
-            memset(&ents[i], 0, sizeof(struct dirent));
-
-            if (myst_buf_remove(&inode->buf, pos, size) != 0)
-                ERAISE(-ENOMEM);
+        const ssize_t slot = _index_find(inode->index, inode, name);
 
-            index = i;
-            break;
+        if (slot >= 0)
+        {
+            pos = inode->index->slots[slot] - 1;
+            _index_remove(
+                inode->index, inode, slot, _dirent_at(inode, pos)->d_reclen);
+        }
+    }
+    else
+    {
+        for (size_t p = 0; p < inode->buf.size; p = _dirent_next(inode, p))
+        {
+            if (strcmp(_dirent_at(inode, p)->d_name, name) == 0)
+            {
+                pos = p;
+                break;
+            }
         }
     }
 
-    if (index == (size_t)-1)
+    if (pos == (size_t)-1)
         ERAISE(-ENOENT);
 
+    _path_cache_invalidate();
+
+    size = _dirent_at(inode, pos)->d_reclen;
+
+    if (myst_buf_remove(&inode->buf, pos, size) != 0)
+        ERAISE(-ENOMEM);
+
+    inode->nents--;
+    inode->dir_version++;
+
     /* Adjust d_off for entries following the deleted entry */
-    for (size_t i = index + 1; i < nents - 1; i++)
-    {
-        ents[i].d_off -= (off_t)sizeof(struct dirent);
-    }
+    for (size_t p = pos; p < inode->buf.size; p = _dirent_next(inode, p))
+        _dirent_at(inode, p)->d_off -= (off_t)size;
 
     /* update the time fields */
     _update_timestamps(inode, CHANGE | MODIFY);
@@ -390,10 +1121,19 @@ done:
     return ret;
 }
 
-static const char* _inode_target(inode_t* inode)
+/* The target of a symbolic link; a virtual link builds its target in vbuf
+ * (concurrent walks may evaluate it at once) */
+static const char* _inode_target(inode_t* inode, myst_buf_t* vbuf)
 {
     if (inode->vcallback)
-        inode->vcallback(&inode->buf);
+    {
+        if ((*inode->vcallback)(vbuf, inode->vcallback_arg) != 0 ||
+            !vbuf->data)
+            return "";
+
+        return (const char*)vbuf->data;
+    }
+
     return (const char*)inode->buf.data;
 }
 
@@ -407,14 +1147,19 @@ static const char* _inode_target(inode_t* inode)
 
 #define FILE_MAGIC 0xdfe1d5c160064f8e
 
+/* The stack storage for the short-lived contents of virtual files and links
+ * (most of which fit) */
+#define VBUF_STORAGE_SIZE 256
+
 struct myst_file
 {
     uint64_t magic;
     inode_t* inode;
-    size_t offset;      /* the current file offset (files) */
-    uint32_t access;    /* (O_RDONLY | O_RDWR | O_WRONLY) */
-    uint32_t operating; /* (O_RDONLY | O_RDWR | O_WRONLY) */
-    int fdflags;        /* file descriptor flags: FD_CLOEXEC */
+    size_t offset;        /* the current file offset (files) */
+    uint64_t dir_version; /* of the directory as of the offset */
+    uint32_t access;      /* (O_RDONLY | O_RDWR | O_WRONLY) */
+    uint32_t operating;   /* (O_RDONLY | O_RDWR | O_WRONLY) */
+    int fdflags;          /* file descriptor flags: FD_CLOEXEC */
     char realpath[PATH_MAX];
     myst_buf_t vbuf; /* virtual file buffer */
 };
@@ -426,12 +1171,21 @@ static bool _file_valid(const myst_file_t* file)
 
 static void* _file_data(const myst_file_t* file)
 {
-    return (file->inode->vcallback) ? file->vbuf.data : file->inode->buf.data;
+    const inode_t* inode = file->inode;
+
+    if (inode->vcallback)
+        return file->vbuf.data;
+
+    if (_inode_paged(inode))
+        return (void*)__atomic_load_n(&inode->data, __ATOMIC_ACQUIRE);
+
+    return inode->buf.data;
 }
 
 static size_t _file_size(const myst_file_t* file)
 {
-    return (file->inode->vcallback) ? file->vbuf.size : file->inode->buf.size;
+    return (file->inode->vcallback) ? file->vbuf.size
+                                    : _inode_size(file->inode);
 }
 
 static void* _file_current(myst_file_t* file)
@@ -460,9 +1214,12 @@ static void* _file_at(myst_file_t* file, size_t offset)
 /* Assume that d_ino is 8 bytes (big enough to hold a pointer) */
 _Static_assert(sizeof(((struct dirent*)0)->d_ino) == 8, "d_ino");
 
-/* Assume struct dirent is eight-byte aligned */
+/* Assume struct dirent is eight-byte aligned (as are the packed entries) */
 _Static_assert(sizeof(struct dirent) % 8 == 0, "dirent");
 
+/* Assume the packed entries are the records of getdents64() */
+_Static_assert(offsetof(struct dirent, d_name) == 19, "d_name");
+
 static int _path_to_inode_recursive(
     ramfs_t* ramfs,
     const char* path,
@@ -471,12 +1228,15 @@ static int _path_to_inode_recursive(
     inode_t** parent_out,
     inode_t** inode_out,
     char realpath[PATH_MAX],
-    char target_out[PATH_MAX])
+    char target_out[PATH_MAX],
+    bool* nocache)
 {
     int ret = 0;
-    char** toks = NULL;
-    size_t ntoks = 0;
+    myst_path_iter_t it;
+    char name[NAME_MAX + 1];
     inode_t* inode = NULL;
+    uint8_t vstorage[VBUF_STORAGE_SIZE];
+    myst_buf_t vtarget;
 
     if (inode_out)
         *inode_out = NULL;
@@ -484,6 +1244,8 @@ static int _path_to_inode_recursive(
     if (parent_out)
         *parent_out = NULL;
 
+    myst_buf_init_storage(&vtarget, vstorage, sizeof(vstorage));
+
     if (!path || !inode_out)
         ERAISE(-EINVAL);
 
@@ -504,16 +1266,17 @@ static int _path_to_inode_recursive(
         goto done;
     }
 
-    /* Split the path into tokens */
-    ECHECK(myst_strsplit(path, "/", &toks, &ntoks));
-
-    /* search for the inode */
+    /* search for the inode, one component of the path at a time */
+    myst_path_iter_init(&it, path);
     {
-        for (size_t i = 0; i < ntoks; i++)
+        while (myst_path_next(&it))
         {
+            const bool last = myst_path_last(&it);
             inode_t* p;
 
-            if (!(p = _inode_find_child(parent, toks[i])))
+            ECHECK_QUIET(myst_path_copy_name(&it, name, sizeof(name)));
+
+            if (!(p = _inode_find_child(parent, name)))
                 ERAISE_QUIET(-ENOENT);
 
             if (!S_ISLNK(p->mode))
@@ -523,34 +1286,37 @@ static int _path_to_inode_recursive(
                     if (myst_strlcat(realpath, "/", PATH_MAX) >= PATH_MAX)
                         ERAISE_QUIET(-ENAMETOOLONG);
 
-                    if (myst_strlcat(realpath, toks[i], PATH_MAX) >= PATH_MAX)
+                    if (myst_strlcat(realpath, name, PATH_MAX) >= PATH_MAX)
                         ERAISE_QUIET(-ENAMETOOLONG);
                 }
             }
 
-            if (S_ISLNK(p->mode) && (follow || i + 1 != ntoks))
+            if (S_ISLNK(p->mode) && (follow || !last))
             {
-                const char* target = _inode_target(p);
+                const char* target = _inode_target(p, &vtarget);
+
+                if (nocache && (p->vcallback || *target == '/'))
+                    *nocache = true;
 
                 if (*target == '/')
                 {
                     if (target_out)
                     {
                         myst_strlcpy(target_out, target, PATH_MAX);
-                        // Copy over rest of unresolved tokens
-                        if (i + 1 != ntoks)
+
+                        // Copy over rest of unresolved components
+                        while (myst_path_next(&it))
                         {
-                            for (size_t j = i + 1; j < ntoks; j++)
-                            {
-                                if (myst_strlcat(target_out, "/", PATH_MAX) >=
-                                    PATH_MAX)
-                                    ERAISE_QUIET(-ENAMETOOLONG);
-
-                                if (myst_strlcat(
-                                        target_out, toks[j], PATH_MAX) >=
-                                    PATH_MAX)
-                                    ERAISE_QUIET(-ENAMETOOLONG);
-                            }
+                            if (myst_strlcat(target_out, "/", PATH_MAX) >=
+                                PATH_MAX)
+                                ERAISE_QUIET(-ENAMETOOLONG);
+
+                            ECHECK_QUIET(myst_path_copy_name(
+                                &it, name, sizeof(name)));
+
+                            if (myst_strlcat(target_out, name, PATH_MAX) >=
+                                PATH_MAX)
+                                ERAISE_QUIET(-ENAMETOOLONG);
                         }
                         goto done;
                     }
@@ -571,13 +1337,14 @@ static int _path_to_inode_recursive(
                     &parent,
                     &p,
                     realpath,
-                    target_out));
+                    target_out,
+                    nocache));
 
                 assert(target != NULL);
             }
 
-            /* If final token */
-            if (i + 1 == ntoks)
+            /* If final component */
+            if (last)
             {
                 inode = p;
                 break;
@@ -597,8 +1364,7 @@ static int _path_to_inode_recursive(
 
 done:
 
-    if (toks)
-        free(toks);
+    myst_buf_release(&vtarget);
 
     return ret;
 }
@@ -623,7 +1389,8 @@ static int _path_to_inode_realpath(
         parent_out,
         inode_out,
         realpath_out ? realpath : NULL,
-        target));
+        target,
+        NULL));
 
     if (realpath_out)
         ECHECK(myst_normalize(realpath, realpath_out, PATH_MAX));
@@ -643,6 +1410,14 @@ static int _path_to_inode(
 {
     int ret = 0;
     char target[PATH_MAX];
+    const uint64_t generation = _path_cache_current();
+    inode_t* parent = NULL;
+    inode_t* inode = NULL;
+    bool nocache = false;
+    int err;
+
+    if (!path)
+        ERAISE(-EINVAL);
 
     if (suffix)
     {
@@ -651,8 +1426,33 @@ static int _path_to_inode(
         *target = '\0';
     }
 
-    ECHECK(_path_to_inode_realpath(
-        ramfs, path, follow, parent_out, inode_out, NULL, target));
+    if (!_path_cache_find(ramfs, path, follow, &parent, &inode, &err))
+    {
+        err = _path_to_inode_recursive(
+            ramfs,
+            path,
+            ramfs->root,
+            follow,
+            &parent,
+            &inode,
+            NULL,
+            target,
+            &nocache);
+
+        if (!nocache && (err == 0 || err == -ENOENT))
+        {
+            _path_cache_insert(
+                ramfs, path, follow, generation, err, parent, inode);
+        }
+    }
+
+    if (parent_out)
+        *parent_out = parent;
+
+    if (inode_out)
+        *inode_out = inode;
+
+    ECHECK_QUIET(ret = err);
 
     if (suffix && *target != '\0' && ramfs->resolve)
     {
@@ -679,6 +1479,7 @@ static int _fs_release(myst_fs_t* fs)
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
 
+    _path_cache_release(ramfs);
     _inode_release_all(ramfs, NULL, ramfs->root, DT_DIR);
 
     if (ramfs->ninodes != 0)
@@ -743,8 +1544,10 @@ static int _fs_open(
     int ret = 0;
     int errnum;
     bool is_i_new = false;
+    bool truncate = false;
     char suffix[PATH_MAX];
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (file_out)
         *file_out = NULL;
@@ -762,10 +1565,14 @@ static int _fs_open(
     if (!(file = calloc(1, sizeof(myst_file_t))))
         ERAISE(-ENOMEM);
 
+    _ns_lock(ramfs, &locked, (flags & O_CREAT) ? NS_WRITE : NS_READ);
+
     errnum = _path_to_inode(ramfs, pathname, true, NULL, &inode, suffix, &tfs);
 
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         /* delegate open operation to target filesystem */
         ECHECK(
             (ret = tfs->fs_open(tfs, suffix, flags, mode, fs_out, file_out)));
@@ -805,13 +1612,15 @@ static int _fs_open(
             ERAISE(-ENOTDIR);
 
         if ((flags & O_TRUNC))
-            myst_buf_clear(&inode->buf);
-
-        if ((flags & O_APPEND))
-            file->offset = inode->buf.size;
+        {
+            if (_inode_paged(inode))
+                truncate = true;
+            else
+                myst_buf_clear(&inode->buf);
+        }
 
         if (inode->vcallback)
-            ECHECK((*inode->vcallback)(&file->vbuf));
+            ECHECK((*inode->vcallback)(&file->vbuf, inode->vcallback_arg));
     }
     else if (errnum == -ENOENT)
     {
@@ -843,12 +1652,25 @@ static int _fs_open(
     file->inode = inode;
     file->access = (flags & (O_RDONLY | O_RDWR | O_WRONLY));
     file->operating = (flags & O_APPEND);
-    inode->nopens++;
+    __atomic_add_fetch(&inode->nopens, 1, __ATOMIC_RELAXED);
 
     /* Get the realpath of this file */
     ECHECK(_path_to_inode_realpath(
         ramfs, pathname, true, NULL, &inode, file->realpath, NULL));
 
+    _ns_unlock(ramfs, &locked);
+
+    /* the file keeps the inode, so this needs no namespace lock */
+    if (truncate)
+    {
+        _inode_wrlock(inode);
+        _pages_truncate(inode, 0);
+        myst_rwlock_wrunlock(&inode->lock);
+    }
+
+    if ((flags & O_APPEND))
+        file->offset = _inode_size(inode);
+
     assert(_file_valid(file));
 
     *file_out = file;
@@ -860,6 +1682,8 @@ done:
     if (inode && is_i_new)
         _inode_free(ramfs, inode);
 
+    _ns_unlock(ramfs, &locked);
+
     if (file)
         free(file);
 
@@ -902,15 +1726,19 @@ static off_t _fs_lseek(
         }
     }
 
-    /* ATTN: support seeking beyond the end of file */
+    /* Check whether new offset if out of range (a regular file may seek
+     * beyond its end, where a later write leaves a hole) */
+    if (new_offset < 0)
+        ERAISE(-EINVAL);
 
-    /* Check whether new offset if out of range */
-    if (new_offset < 0 || new_offset > (off_t)_file_size(file))
+    if (new_offset > (off_t)_file_size(file) && !_inode_paged(file->inode))
         ERAISE(-EINVAL);
 
     file->offset = (size_t)new_offset;
 
-    _update_timestamps(file->inode, ACCESS);
+    /* getdents64() finds the entry at this offset again */
+    if (S_ISDIR(file->inode->mode))
+        file->dir_version = file->inode->dir_version - 1;
 
     ret = new_offset;
 
@@ -927,6 +1755,7 @@ static ssize_t _fs_read(
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t ret = 0;
     size_t n;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -945,6 +1774,22 @@ static ssize_t _fs_read(
     if (!count)
         goto done;
 
+    if (_inode_paged(file->inode))
+    {
+        myst_rwlock_rdlock(&file->inode->lock);
+        n = _pages_read(file->inode, file->offset, buf, count);
+        myst_rwlock_rdunlock(&file->inode->lock);
+        file->offset += n;
+        _touch_atime(ramfs, file->inode);
+        ret = (ssize_t)n;
+        goto done;
+    }
+
+    /* a directory is part of the namespace (a virtual file reads its own
+     * copy of the data) */
+    if (!file->inode->vcallback)
+        _ns_lock(ramfs, &locked, NS_READ);
+
     /* Verify that the offset is in bounds */
     if (file->offset > _file_size(file))
         ERAISE(-EINVAL);
@@ -964,11 +1809,12 @@ static ssize_t _fs_read(
         file->offset += n;
     }
 
-    _update_timestamps(file->inode, ACCESS);
+    _touch_atime(ramfs, file->inode);
 
     ret = (ssize_t)n;
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -980,6 +1826,7 @@ static ssize_t _fs_write(
 {
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t ret = 0;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -998,6 +1845,28 @@ static ssize_t _fs_write(
     if (file->access == O_RDONLY)
         ERAISE(-EBADF);
 
+    /* a writable virtual file takes each write whole */
+    if (file->inode->vwrite)
+    {
+        ECHECK((*file->inode->vwrite)(buf, count, file->inode->vcallback_arg));
+        ret = (ssize_t)count;
+        goto done;
+    }
+
+    if (_inode_paged(file->inode))
+    {
+        myst_rwlock_rdlock(&file->inode->lock);
+        ret = _pages_write(file->inode, file->offset, buf, count);
+        myst_rwlock_rdunlock(&file->inode->lock);
+        ECHECK(ret);
+        file->offset += count;
+        _update_timestamps(file->inode, MODIFY | CHANGE);
+        ret = (ssize_t)count;
+        goto done;
+    }
+
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     /* Verify that the offset is in bounds */
     if (file->offset > _file_size(file))
         ERAISE(-EINVAL);
@@ -1021,6 +1890,7 @@ static ssize_t _fs_write(
     ret = (ssize_t)count;
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1034,6 +1904,7 @@ static ssize_t _fs_pread(
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t ret = 0;
     size_t n;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -1051,6 +1922,19 @@ static ssize_t _fs_pread(
     if (!count)
         goto done;
 
+    if (_inode_paged(file->inode))
+    {
+        myst_rwlock_rdlock(&file->inode->lock);
+        n = _pages_read(file->inode, (size_t)offset, buf, count);
+        myst_rwlock_rdunlock(&file->inode->lock);
+        _touch_atime(ramfs, file->inode);
+        ret = (ssize_t)n;
+        goto done;
+    }
+
+    if (!file->inode->vcallback)
+        _ns_lock(ramfs, &locked, NS_READ);
+
     /* Verify that the offset is in bounds */
     if ((size_t)offset > _file_size(file))
         ERAISE(-EINVAL);
@@ -1069,11 +1953,109 @@ static ssize_t _fs_pread(
         memcpy(buf, _file_at(file, (size_t)offset), n);
     }
 
-    _update_timestamps(file->inode, ACCESS);
+    _touch_atime(ramfs, file->inode);
 
     ret = (ssize_t)n;
 
 done:
+    _ns_unlock(ramfs, &locked);
+    return ret;
+}
+
+static ssize_t _fs_pread_direct(
+    myst_fs_t* fs,
+    myst_file_t* file,
+    myst_fs_consume_t consume,
+    void* arg,
+    size_t count,
+    off_t offset)
+{
+    ramfs_t* ramfs = (ramfs_t*)fs;
+    ssize_t ret = 0;
+    inode_t* inode;
+    bool rdlocked = false;
+    int locked = NS_UNLOCKED;
+    const uint8_t* data;
+    size_t size;
+
+    if (!_ramfs_valid(ramfs))
+        ERAISE(-EINVAL);
+
+    if (!_file_valid(file) || !consume)
+        ERAISE(-EINVAL);
+
+    if (offset < 0)
+        ERAISE(-EINVAL);
+
+    inode = file->inode;
+
+    /* the data stays in place while it is locked */
+    if (_inode_paged(inode))
+    {
+        myst_rwlock_rdlock(&inode->lock);
+        rdlocked = true;
+    }
+    else if (!inode->vcallback)
+    {
+        _ns_lock(ramfs, &locked, NS_READ);
+    }
+
+    size = _file_size(file);
+
+    /* nothing to pass at or beyond the end of file */
+    if (!count || (size_t)offset >= size)
+        goto done;
+
+    if (count > size - (size_t)offset)
+        count = size - (size_t)offset;
+
+    if ((data = _file_data(file)))
+    {
+        /* contiguous data goes over in one piece */
+        ECHECK(ret = consume(arg, data + offset, count));
+    }
+    else
+    {
+        file_pages_t* table = __atomic_load_n(&inode->pages, __ATOMIC_ACQUIRE);
+        size_t pos = (size_t)offset;
+        size_t moved = 0;
+
+        /* hand over one page (or hole) at a time */
+        while (moved < count)
+        {
+            const size_t off = pos % FILE_PAGE_SIZE;
+            const size_t left = count - moved;
+            const size_t n =
+                (left < FILE_PAGE_SIZE - off) ? left : FILE_PAGE_SIZE - off;
+            const uint8_t* page = _pages_get(table, pos / FILE_PAGE_SIZE);
+            ssize_t r = consume(arg, page ? page + off : _zero_page, n);
+
+            /* report what was moved and drop any later error */
+            if (r < 0 && !moved)
+                ERAISE(r);
+
+            if (r <= 0)
+                break;
+
+            moved += (size_t)r;
+            pos += (size_t)r;
+
+            if ((size_t)r < n)
+                break;
+        }
+
+        ret = (ssize_t)moved;
+    }
+
+    _touch_atime(ramfs, inode);
+
+done:
+
+    if (rdlocked)
+        myst_rwlock_rdunlock(&inode->lock);
+
+    _ns_unlock(ramfs, &locked);
+
     return ret;
 }
 
@@ -1086,6 +2068,7 @@ static ssize_t _fs_pwrite(
 {
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t ret = 0;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -1103,6 +2086,19 @@ static ssize_t _fs_pwrite(
     if (!count)
         goto done;
 
+    if (_inode_paged(file->inode))
+    {
+        myst_rwlock_rdlock(&file->inode->lock);
+        ret = _pages_write(file->inode, (size_t)offset, buf, count);
+        myst_rwlock_rdunlock(&file->inode->lock);
+        ECHECK(ret);
+        _update_timestamps(file->inode, CHANGE | MODIFY);
+        ret = (ssize_t)count;
+        goto done;
+    }
+
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     /* Verify that the offset is in bounds */
     if ((size_t)offset > _file_size(file))
         ERAISE(-EINVAL);
@@ -1125,6 +2121,7 @@ static ssize_t _fs_pwrite(
     ret = (ssize_t)count;
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1194,10 +2191,24 @@ done:
     return ret;
 }
 
+/* Drop an open of the inode with the namespace lock held; unlink() holds
+ * it for writing, so only one caller can see the last open of an unlinked
+ * inode go */
+static void _inode_put(ramfs_t* ramfs, inode_t* inode)
+{
+    /* handle case where file was deleted while open */
+    if (__atomic_sub_fetch(&inode->nopens, 1, __ATOMIC_ACQ_REL) == 0 &&
+        inode->nlink == 0)
+    {
+        _inode_free(ramfs, inode);
+    }
+}
+
 static int _fs_close(myst_fs_t* fs, myst_file_t* file)
 {
     int ret = 0;
     ramfs_t* ramfs = (ramfs_t*)fs;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !_file_valid(file))
         ERAISE(-EINVAL);
@@ -1210,17 +2221,9 @@ static int _fs_close(myst_fs_t* fs, myst_file_t* file)
     if (file->inode->vcallback)
         myst_buf_release(&file->vbuf);
 
-    file->inode->nopens--;
-
-    /* handle case where file was deleted while open */
-    if (file->inode->nopens == 0 && file->inode->nlink == 0)
-    {
-        _inode_free(ramfs, file->inode);
-    }
-    else
-    {
-        _update_timestamps(file->inode, ACCESS);
-    }
+    _ns_lock(ramfs, &locked, NS_READ);
+    _inode_put(ramfs, file->inode);
+    _ns_unlock(ramfs, &locked);
 
     memset(file, 0xdd, sizeof(myst_file_t));
     free(file);
@@ -1236,6 +2239,7 @@ static int _fs_access(myst_fs_t* fs, const char* pathname, int mode)
     inode_t* inode;
     char suffix[PATH_MAX];
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
@@ -1243,11 +2247,15 @@ static int _fs_access(myst_fs_t* fs, const char* pathname, int mode)
     if (mode != F_OK && !(mode & (R_OK | W_OK | X_OK)))
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_READ);
+
     /* Get the inode for pathname */
     ECHECK(_path_to_inode(ramfs, pathname, true, NULL, &inode, suffix, &tfs));
 
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_access(tfs, suffix, mode)));
         goto done;
@@ -1265,10 +2273,10 @@ static int _fs_access(myst_fs_t* fs, const char* pathname, int mode)
     if ((mode & X_OK) && !(inode->mode & S_IXUSR))
         ERAISE(-EACCES);
 
-    _update_timestamps(inode, ACCESS);
-
 done:
 
+    _ns_unlock(ramfs, &locked);
+
     return ret;
 }
 
@@ -1277,21 +2285,24 @@ static int _stat(inode_t* inode, struct stat* statbuf)
     int ret = 0;
     struct stat buf;
     off_t rounded;
-    myst_buf_t vbuf = MYST_BUF_INITIALIZER;
+    uint8_t vstorage[VBUF_STORAGE_SIZE];
+    myst_buf_t vbuf;
     size_t size;
 
+    myst_buf_init_storage(&vbuf, vstorage, sizeof(vstorage));
+
     if (!_inode_valid(inode) || !statbuf)
         ERAISE(-EINVAL);
 
     if (inode->vcallback)
     {
-        ECHECK((*inode->vcallback)(&vbuf));
+        ECHECK((*inode->vcallback)(&vbuf, inode->vcallback_arg));
         size = vbuf.size;
         ECHECK(myst_round_up_signed(size, BLKSIZE, &rounded));
     }
     else
     {
-        size = inode->buf.size;
+        size = _inode_size(inode);
         ECHECK(myst_round_up_signed(size, BLKSIZE, &rounded));
     }
 
@@ -1324,13 +2335,18 @@ static int _fs_stat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     inode_t* inode;
     char suffix[PATH_MAX];
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !pathname || !statbuf)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_READ);
+
     ECHECK(_path_to_inode(ramfs, pathname, true, NULL, &inode, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_stat(tfs, suffix, statbuf)));
         goto done;
@@ -1338,6 +2354,7 @@ static int _fs_stat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     ERAISE(_stat(inode, statbuf));
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1348,13 +2365,18 @@ static int _fs_lstat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     inode_t* inode;
     char suffix[PATH_MAX];
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !pathname || !statbuf)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_READ);
+
     ECHECK(_path_to_inode(ramfs, pathname, false, NULL, &inode, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_lstat(tfs, suffix, statbuf));
         goto done;
@@ -1362,6 +2384,7 @@ static int _fs_lstat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     ERAISE(_stat(inode, statbuf));
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1390,15 +2413,20 @@ static int _fs_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
     char new_basename[PATH_MAX];
     char suffix[PATH_MAX];
     myst_fs_t* tfs;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !oldpath || !newpath)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     /* Find the inode for oldpath */
     ECHECK(
         _path_to_inode(ramfs, oldpath, true, NULL, &old_inode, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         /* delegate operation to target filesystem */
         ECHECK((ret = tfs->fs_link(tfs, suffix, newpath)));
         goto done;
@@ -1426,6 +2454,7 @@ static int _fs_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
     _update_timestamps(old_inode, CHANGE);
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1439,14 +2468,19 @@ static int _fs_unlink(myst_fs_t* fs, const char* pathname)
     inode_t* parent;
     inode_t* inode;
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     /* Get the inode for pathname */
     ECHECK(_path_to_inode(ramfs, pathname, false, NULL, &inode, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         /* delegate operation to target filesystem */
         ECHECK((*tfs->fs_unlink)(tfs, suffix));
         goto done;
@@ -1487,6 +2521,7 @@ static int _fs_unlink(myst_fs_t* fs, const char* pathname)
     }
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1504,6 +2539,7 @@ static int _fs_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
     inode_t* new_parent = NULL;
     inode_t* new_inode = NULL;
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     /* ATTN: check attempt to make subdirectory a directory of itself */
     /* ATTN: check where newpath contains a prefix of oldpath */
@@ -1511,6 +2547,8 @@ static int _fs_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
     if (!_ramfs_valid(ramfs) || !oldpath || !newpath)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     /* Split oldpath */
     ECHECK(_split_path(oldpath, old_dirname, old_basename));
 
@@ -1519,6 +2557,8 @@ static int _fs_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
         ramfs, oldpath, true, &old_parent, &old_inode, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         /* append old_basename and delegate operation to target filesystem */
         if (myst_strlcat(suffix, "/", PATH_MAX) >= PATH_MAX)
             ERAISE_QUIET(-ENAMETOOLONG);
@@ -1581,11 +2621,12 @@ static int _fs_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
             new_parent->nlink++;
     }
 
-    /* Dereference the new inode (if any) */
-    if (new_inode && new_inode->nlink == 0)
+    /* Dereference the new inode (if any); the last close frees it if open */
+    if (new_inode && new_inode->nlink == 0 && new_inode->nopens == 0)
         _inode_free(ramfs, new_inode);
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1596,13 +2637,18 @@ static int _fs_truncate(myst_fs_t* fs, const char* pathname, off_t length)
     inode_t* inode;
     char suffix[PATH_MAX];
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !pathname || length < 0)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_READ);
+
     ECHECK(_path_to_inode(ramfs, pathname, true, NULL, &inode, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_truncate(tfs, suffix, length)));
         goto done;
@@ -1611,12 +2657,30 @@ static int _fs_truncate(myst_fs_t* fs, const char* pathname, off_t length)
     if (S_ISDIR(inode->mode))
         ERAISE(-EISDIR);
 
-    if (myst_buf_resize(&inode->buf, (size_t)length) != 0)
-        ERAISE(-ENOMEM);
+    /* hold the inode like an open while waiting for its readers to leave */
+    __atomic_add_fetch(&inode->nopens, 1, __ATOMIC_RELAXED);
+    _ns_unlock(ramfs, &locked);
 
-    _update_timestamps(inode, CHANGE | MODIFY);
+    _inode_wrlock(inode);
+
+    if (_inode_paged(inode))
+        ret = _pages_truncate(inode, (size_t)length);
+    else if (myst_buf_resize(&inode->buf, (size_t)length) != 0)
+        ret = -ENOMEM;
+
+    if (ret == 0)
+        _update_timestamps(inode, CHANGE | MODIFY);
+
+    myst_rwlock_wrunlock(&inode->lock);
+
+    _ns_lock(ramfs, &locked, NS_READ);
+    _inode_put(ramfs, inode);
+
+    if (ret != 0)
+        ERAISE(ret);
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1631,10 +2695,20 @@ static int _fs_ftruncate(myst_fs_t* fs, myst_file_t* file, off_t length)
     if (S_ISDIR(file->inode->mode))
         ERAISE(-EISDIR);
 
-    if (myst_buf_resize(&file->inode->buf, (size_t)length) != 0)
-        ERAISE(-ENOMEM);
+    _inode_wrlock(file->inode);
 
-    _update_timestamps(file->inode, CHANGE | MODIFY);
+    if (_inode_paged(file->inode))
+        ret = _pages_truncate(file->inode, (size_t)length);
+    else if (myst_buf_resize(&file->inode->buf, (size_t)length) != 0)
+        ret = -ENOMEM;
+
+    if (ret == 0)
+        _update_timestamps(file->inode, CHANGE | MODIFY);
+
+    myst_rwlock_wrunlock(&file->inode->lock);
+
+    if (ret != 0)
+        ERAISE(ret);
 
 done:
     return ret;
@@ -1649,14 +2723,19 @@ static int _fs_mkdir(myst_fs_t* fs, const char* pathname, mode_t mode)
     char suffix[PATH_MAX];
     inode_t* parent;
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     ECHECK(_split_path(pathname, dirname, basename));
     ECHECK(_path_to_inode(ramfs, dirname, true, NULL, &parent, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         /* append basename and delegate operation to target filesystem */
         if (myst_strlcat(suffix, "/", PATH_MAX) >= PATH_MAX)
             ERAISE_QUIET(-ENAMETOOLONG);
@@ -1680,6 +2759,7 @@ static int _fs_mkdir(myst_fs_t* fs, const char* pathname, mode_t mode)
     ERAISE(_inode_new(ramfs, parent, basename, (S_IFDIR | mode), NULL));
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1693,14 +2773,19 @@ static int _fs_rmdir(myst_fs_t* fs, const char* pathname)
     inode_t* parent;
     inode_t* child;
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     /* Get the child inode */
     ECHECK(_path_to_inode(ramfs, pathname, true, NULL, &child, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_rmdir(tfs, suffix));
         goto done;
@@ -1711,7 +2796,7 @@ static int _fs_rmdir(myst_fs_t* fs, const char* pathname)
         ERAISE(-ENOTDIR);
 
     /* Make sure the directory has no children */
-    if (child->buf.size > (2 * sizeof(struct dirent)))
+    if (!_inode_is_empty_dir(child))
         ERAISE(-ENOTEMPTY);
 
     /* Get the parent inode */
@@ -1730,11 +2815,13 @@ static int _fs_rmdir(myst_fs_t* fs, const char* pathname)
     assert(child->nlink > 0);
     child->nlink--;
 
-    /* If no more links to this inode, then free it */
-    if (child->nlink == 0)
+    /* If no more links to this inode, then free it (the last close frees
+     * an open directory) */
+    if (child->nlink == 0 && child->nopens == 0)
         _inode_free(ramfs, child);
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1746,8 +2833,9 @@ static int _fs_getdents64(
 {
     int ret = 0;
     ramfs_t* ramfs = (ramfs_t*)fs;
-    size_t n = count / sizeof(struct dirent);
     size_t bytes = 0;
+    int locked = NS_UNLOCKED;
+    inode_t* inode;
 
     if (!_ramfs_valid(ramfs) || !_file_valid(file) || !dirp)
         ERAISE(-EINVAL);
@@ -1755,31 +2843,46 @@ static int _fs_getdents64(
     if (count == 0)
         goto done;
 
-    /* in case an entry was deleted (by unlink) during this iteration */
-    if (file->offset >= file->inode->buf.size)
-        file->offset = file->inode->buf.size;
+    /* the entries change under the namespace lock */
+    _ns_lock(ramfs, &locked, NS_READ);
+    inode = file->inode;
 
-    for (size_t i = 0; i < n; i++)
+    /* an entry removed (by unlink) during this iteration, or an lseek(),
+     * may leave the offset inside an entry: resume at the next one */
+    if (file->dir_version != inode->dir_version)
     {
-        struct dirent ent;
-        ssize_t r;
+        size_t pos = 0;
 
-        /* Read next entry and break on end-of-file */
-        if ((r = _fs_read(fs, file, &ent, sizeof(ent))) == 0)
-            break;
+        while (pos < inode->buf.size && pos < file->offset)
+            pos = _dirent_next(inode, pos);
+
+        file->offset = pos;
+        file->dir_version = inode->dir_version;
+    }
+
+    /* copy as many whole entries as fit */
+    while (file->offset < inode->buf.size)
+    {
+        const struct dirent* ent = _dirent_at(inode, file->offset);
 
-        /* Fail if exactly one entry was not read */
-        if (r != sizeof(ent))
-            myst_panic("unexpected");
+        if (count - bytes < ent->d_reclen)
+            break;
 
-        *dirp = ent;
-        bytes += sizeof(struct dirent);
-        dirp++;
+        memcpy((uint8_t*)dirp + bytes, ent, ent->d_reclen);
+        file->offset += ent->d_reclen;
+        bytes += ent->d_reclen;
     }
 
+    /* the buffer is too small for the next entry */
+    if (bytes == 0 && file->offset < inode->buf.size)
+        ERAISE(-EINVAL);
+
+    _touch_atime(ramfs, inode);
+
     ret = (int)bytes;
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -1794,14 +2897,24 @@ static ssize_t _fs_readlink(
     inode_t* inode;
     char suffix[PATH_MAX];
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
+    uint8_t vstorage[VBUF_STORAGE_SIZE];
+    myst_buf_t vtarget;
+    const char* target;
+
+    myst_buf_init_storage(&vtarget, vstorage, sizeof(vstorage));
 
     if (!_ramfs_valid(ramfs) || !pathname || !buf || !bufsiz)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_READ);
+
     /* Get the inode for pathname */
     ECHECK(_path_to_inode(ramfs, pathname, false, NULL, &inode, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         /* delegate operation to target filesystem */
         ECHECK((ret = tfs->fs_readlink(tfs, suffix, buf, bufsiz)));
         goto done;
@@ -1810,25 +2923,30 @@ static ssize_t _fs_readlink(
     if (!S_ISLNK(inode->mode))
         ERAISE(-EINVAL);
 
-    if (inode->vcallback)
-    {
-        inode->vcallback(&inode->buf);
-    }
-    else
+    if (!inode->vcallback)
     {
         assert(inode->buf.data);
         assert(inode->buf.size);
+
+        if (!inode->buf.data || !inode->buf.size)
+            ERAISE(-EINVAL);
     }
 
-    if (!inode->buf.data || !inode->buf.size)
+    /* a virtual link builds its target in a buffer of its own */
+    target = _inode_target(inode, &vtarget);
+
+    if (inode->vcallback && *target == '\0')
         ERAISE(-EINVAL);
 
-    _update_timestamps(inode, ACCESS);
+    _touch_atime(ramfs, inode);
 
-    ret = (ssize_t)myst_strlcpy(buf, (char*)inode->buf.data, bufsiz);
+    ret = (ssize_t)myst_strlcpy(buf, target, bufsiz);
 
 done:
 
+    _ns_unlock(ramfs, &locked);
+    myst_buf_release(&vtarget);
+
     return ret;
 }
 
@@ -1842,6 +2960,7 @@ static int _fs_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
     char basename[PATH_MAX];
     char suffix[PATH_MAX];
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -1849,6 +2968,8 @@ static int _fs_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
     if (!target || !linkpath)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     /* Split linkpath into directory and filename */
     ECHECK(_split_path(linkpath, dirname, basename));
 
@@ -1856,6 +2977,8 @@ static int _fs_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
     ECHECK(_path_to_inode(ramfs, dirname, true, NULL, &parent, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         /* append basename and delegate operation to target filesystem */
         if (myst_strlcat(suffix, "/", PATH_MAX) >= PATH_MAX)
             ERAISE_QUIET(-ENAMETOOLONG);
@@ -1875,6 +2998,8 @@ static int _fs_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
 
 done:
 
+    _ns_unlock(ramfs, &locked);
+
     return ret;
 }
 
@@ -1923,7 +3048,7 @@ static int _fs_fcntl(myst_fs_t* fs, myst_file_t* file, int cmd, long arg)
             if (arg != FD_CLOEXEC && arg != 0)
                 ERAISE(-EINVAL);
 
-            file->fdflags = FD_CLOEXEC;
+            file->fdflags = arg;
             _update_timestamps(file->inode, CHANGE);
             goto done;
         }
@@ -1994,7 +3119,7 @@ static int _fs_dup(
             ERAISE(-ENOMEM);
 
         *new_file = *file;
-        new_file->inode->nopens++;
+        __atomic_add_fetch(&new_file->inode->nopens, 1, __ATOMIC_RELAXED);
 
         /* file descriptor flags FD_CLOEXEC are not propagaged */
         new_file->fdflags = 0;
@@ -2042,7 +3167,7 @@ done:
     return ret;
 }
 
-static int _statfs(struct statfs* buf)
+static int _statfs(const ramfs_t* ramfs, struct statfs* buf)
 {
     int ret = 0;
 
@@ -2050,7 +3175,7 @@ static int _statfs(struct statfs* buf)
         ERAISE(-EINVAL);
 
     memset(buf, 0, sizeof(struct statfs));
-    buf->f_type = 0x858458f6; // RAMFS_MAGIC from man(2) statfs
+    buf->f_type = ramfs->f_type;
     buf->f_bsize = BLKSIZE;
 
 done:
@@ -2064,21 +3189,27 @@ static int _fs_statfs(myst_fs_t* fs, const char* pathname, struct statfs* buf)
     inode_t* inode;
     char suffix[PATH_MAX];
     myst_fs_t* tfs = NULL;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs) || !pathname || !buf)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_READ);
+
     /* Check if path exists */
     ECHECK(_path_to_inode(ramfs, pathname, true, NULL, &inode, suffix, &tfs));
     if (tfs)
     {
+        _ns_unlock(ramfs, &locked);
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_statfs(tfs, suffix, buf)));
         goto done;
     }
-    ECHECK(_statfs(buf));
+    ECHECK(_statfs(ramfs, buf));
 
 done:
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
@@ -2090,7 +3221,7 @@ static int _fs_fstatfs(myst_fs_t* fs, myst_file_t* file, struct statfs* buf)
     if (!_ramfs_valid(ramfs) || !_file_valid(file) || !buf)
         ERAISE(-EINVAL);
 
-    ECHECK(_statfs(buf));
+    ECHECK(_statfs(ramfs, buf));
 
 done:
     return ret;
@@ -2200,6 +3331,7 @@ int myst_init_ramfs(
         .fs_statfs = _fs_statfs,
         .fs_fstatfs = _fs_fstatfs,
         .fs_futimens = _fs_futimens,
+        .fs_pread_direct = _fs_pread_direct,
     };
     // clang-format on
     inode_t* root_inode = NULL;
@@ -2219,6 +3351,7 @@ int myst_init_ramfs(
     ramfs->base = _base;
     ramfs->root = root_inode;
     ramfs->resolve = resolve_cb;
+    ramfs->f_type = MYST_RAMFS_TYPE;
     myst_strlcpy(ramfs->target, "/", sizeof(ramfs->target));
     root_inode = NULL;
 
@@ -2231,11 +3364,44 @@ done:
         free(ramfs);
 
     if (root_inode)
-        free(root_inode);
+        myst_slab_free(root_inode);
 
     return ret;
 }
 
+int myst_ramfs_set_type(myst_fs_t* fs, long f_type)
+{
+    ramfs_t* ramfs = (ramfs_t*)fs;
+
+    if (!_ramfs_valid(ramfs))
+        return -EINVAL;
+
+    ramfs->f_type = f_type;
+    return 0;
+}
+
+/* Read the file data from buf in place until the file is first changed */
+static void _inode_set_buf(inode_t* inode, const void* buf, size_t buf_size)
+{
+    if (_inode_paged(inode))
+    {
+        _pages_release(inode);
+        inode->data = buf;
+        inode->size = buf_size;
+    }
+    else
+    {
+        if (inode->buf.data != inode->data)
+            myst_buf_clear(&inode->buf);
+
+        inode->data = buf;
+        inode->buf.data = (void*)buf;
+        inode->buf.size = buf_size;
+    }
+
+    _path_cache_invalidate();
+}
+
 int myst_ramfs_set_buf(
     myst_fs_t* fs,
     const char* pathname,
@@ -2245,6 +3411,7 @@ int myst_ramfs_set_buf(
     ramfs_t* ramfs = (ramfs_t*)fs;
     inode_t* inode = NULL;
     int ret = 0;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -2255,28 +3422,158 @@ int myst_ramfs_set_buf(
     if (!buf && buf_size)
         ERAISE(-EINVAL);
 
+    /* only called while the file system is set up, before any I/O */
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     ECHECK(_path_to_inode(ramfs, pathname, true, NULL, &inode, NULL, NULL));
+    _inode_set_buf(inode, buf, buf_size);
+
+done:
+
+    _ns_unlock(ramfs, &locked);
+    return ret;
+}
+
+/* Add an entry of a CPIO archive to the directory parent as name */
+static int _load_cpio_entry(
+    ramfs_t* ramfs,
+    inode_t* parent,
+    const char* name,
+    const myst_cpio_entry_t* ent,
+    const void* data)
+{
+    int ret = 0;
+    inode_t* inode = _inode_find_child(parent, name);
+
+    if (S_ISDIR(ent->mode))
+    {
+        if (inode && !S_ISDIR(inode->mode))
+            ERAISE(-EEXIST);
+
+        if (!inode)
+            ECHECK(_inode_new(ramfs, parent, name, S_IFDIR | ent->mode, NULL));
+    }
+    else if (S_ISREG(ent->mode))
+    {
+        if (!inode)
+            ECHECK(_inode_new(ramfs, parent, name, S_IFREG | 0444, &inode));
+        else if (!_inode_paged(inode))
+            ERAISE(-EEXIST);
+
+        _inode_set_buf(inode, data, ent->size);
+    }
+    else if (S_ISLNK(ent->mode))
+    {
+        if (ent->size < 1 || ent->size >= PATH_MAX)
+            ERAISE(-EINVAL);
+
+        if (inode)
+            ERAISE(-EEXIST);
+
+        ECHECK(_inode_new(ramfs, parent, name, S_IFLNK | 0777, &inode));
+
+        /* the target is not null-terminated in the archive */
+        if (myst_buf_append(&inode->buf, data, ent->size) != 0 ||
+            myst_buf_append(&inode->buf, "", 1) != 0)
+        {
+            ERAISE(-ENOMEM);
+        }
+    }
+    else
+    {
+        ERAISE(-EINVAL);
+    }
+
+done:
+    return ret;
+}
+
+int myst_ramfs_load_cpio(myst_fs_t* fs, const void* cpio_data, size_t size)
+{
+    int ret = 0;
+    ramfs_t* ramfs = (ramfs_t*)fs;
+    int locked = NS_UNLOCKED;
+    size_t pos = 0;
+    char path[MYST_CPIO_PATH_MAX + 1];
+    char dirname[PATH_MAX];
+    char basename[PATH_MAX];
+    char last_dirname[PATH_MAX] = "";
+    inode_t* parent = NULL;
+    myst_cpio_files_t files = MYST_CPIO_FILES_INITIALIZER;
+
+    if (!_ramfs_valid(ramfs) || !cpio_data)
+        ERAISE(-EINVAL);
+
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
+    for (;;)
+    {
+        myst_cpio_entry_t ent;
+        const void* data;
+        int r;
+
+        if ((r = myst_cpio_next_entry(cpio_data, size, &pos, &ent, &data)) < 0)
+            ERAISE(-EINVAL);
+
+        if (r == 0)
+            break;
+
+        if (strcmp(ent.name, ".") == 0)
+            continue;
+
+        /* identical files share the data, which is copied on change */
+        if (S_ISREG(ent.mode))
+        {
+            const uint8_t* base = (const uint8_t*)cpio_data;
+            const size_t offset = (const uint8_t*)data - base;
+            const myst_cpio_file_t* link;
+
+            ECHECK(myst_cpio_files_add(&files, &ent, offset));
+
+            if ((link = myst_cpio_files_find(&files, &ent)))
+            {
+                data = base + link->offset;
+                ent.size = link->size;
+            }
+        }
+
+        path[0] = '/';
+        myst_strlcpy(path + 1, ent.name, sizeof(path) - 1);
+        ECHECK(_split_path(path, dirname, basename));
 
-    if (inode->buf.data != inode->data)
-        myst_buf_clear(&inode->buf);
+        /* archives list the entries of a directory together */
+        if (!parent || strcmp(dirname, last_dirname) != 0)
+        {
+            ECHECK(_path_to_inode(
+                ramfs, dirname, true, NULL, &parent, NULL, NULL));
+
+            if (!S_ISDIR(parent->mode))
+                ERAISE(-ENOTDIR);
+
+            myst_strlcpy(last_dirname, dirname, sizeof(last_dirname));
+        }
 
-    inode->data = buf;
-    inode->buf.data = (void*)buf;
-    inode->buf.size = buf_size;
+        ECHECK(_load_cpio_entry(ramfs, parent, basename, &ent, data));
+    }
 
 done:
 
+    _ns_unlock(ramfs, &locked);
+    myst_cpio_files_release(&files);
     return ret;
 }
 
-int myst_create_virtual_file(
+static int _create_virtual_file(
     myst_fs_t* fs,
     const char* pathname,
     mode_t mode,
-    int (*vcallback)(myst_buf_t* buf))
+    myst_vcallback_t vcallback,
+    myst_vwrite_callback_t vwrite,
+    void* arg)
 {
     int ret = 0;
     ramfs_t* ramfs = (ramfs_t*)fs;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -2287,9 +3584,10 @@ int myst_create_virtual_file(
     /* create an empty file */
     if (S_ISREG(mode))
     {
+        const mode_t perms = vwrite ? S_IRUSR | S_IWUSR : S_IRUSR;
         myst_file_t* file = NULL;
         ECHECK(fs->fs_open(
-            fs, pathname, O_RDONLY | O_CREAT, S_IFREG | S_IRUSR, NULL, &file));
+            fs, pathname, O_RDONLY | O_CREAT, S_IFREG | perms, NULL, &file));
         ECHECK(fs->fs_close(fs, file));
     }
     else if (S_ISLNK(mode))
@@ -2306,23 +3604,52 @@ int myst_create_virtual_file(
     /* inject vcallback into the inode */
     {
         inode_t* inode = NULL;
+        _ns_lock(ramfs, &locked, NS_WRITE);
         ECHECK(
             _path_to_inode(ramfs, pathname, false, NULL, &inode, NULL, NULL));
         inode->vcallback = vcallback;
+        inode->vwrite = vwrite;
+        inode->vcallback_arg = arg;
+        _path_cache_invalidate();
     }
 
     ret = 0;
 
 done:
 
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
 
+int myst_create_virtual_file(
+    myst_fs_t* fs,
+    const char* pathname,
+    mode_t mode,
+    myst_vcallback_t vcallback,
+    void* arg)
+{
+    return _create_virtual_file(fs, pathname, mode, vcallback, NULL, arg);
+}
+
+int myst_create_writable_virtual_file(
+    myst_fs_t* fs,
+    const char* pathname,
+    myst_vcallback_t vcallback,
+    myst_vwrite_callback_t vwrite,
+    void* arg)
+{
+    if (!vwrite)
+        return -EINVAL;
+
+    return _create_virtual_file(fs, pathname, S_IFREG, vcallback, vwrite, arg);
+}
+
 int myst_release_tree(myst_fs_t* fs, const char* pathname)
 {
     int ret = 0;
     ramfs_t* ramfs = (ramfs_t*)fs;
     inode_t *parent, *self;
+    int locked = NS_UNLOCKED;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -2330,6 +3657,8 @@ int myst_release_tree(myst_fs_t* fs, const char* pathname)
     if (!pathname)
         ERAISE(-EINVAL);
 
+    _ns_lock(ramfs, &locked, NS_WRITE);
+
     ECHECK(_path_to_inode(ramfs, pathname, true, &parent, &self, NULL, NULL));
 
     if (!_inode_valid(parent) || !_inode_valid(self))
@@ -2366,5 +3695,6 @@ int myst_release_tree(myst_fs_t* fs, const char* pathname)
 
 done:
 
+    _ns_unlock(ramfs, &locked);
     return ret;
 }
@@ -4,120 +4,136 @@
 #include <myst/cwd.h>
 #include <myst/eraise.h>
 #include <myst/realpath.h>
+#include <myst/spinlock.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
+#include <myst/thread.h>
 #include <myst/types.h>
 #include <stdlib.h>
 #include <string.h>
 
-int myst_realpath(const char* path, myst_path_t* resolved_path)
+/* Copy the process cwd (whose length chdir keeps) to buf */
+static int _copy_cwd(char buf[PATH_MAX], size_t* len_out)
 {
     int ret = 0;
-    typedef struct _variables
+    myst_thread_t* thread = myst_thread_self();
+    myst_thread_t* process_thread = myst_find_process_thread(thread);
+    size_t len;
+
+    myst_spin_lock(&process_thread->main.cwd_lock);
     {
-        char buf[PATH_MAX];
-        const char* in[PATH_MAX];
-        const char* out[PATH_MAX];
-    } variables_t;
-    variables_t* v = NULL;
-    size_t nin = 0;
-    size_t nout = 0;
+        len = process_thread->main.cwd_len;
 
-    if (resolved_path)
-        *resolved_path->buf = '\0';
+        if (len < PATH_MAX)
+            memcpy(buf, process_thread->main.cwd, len + 1);
+    }
+    myst_spin_unlock(&process_thread->main.cwd_lock);
 
-    if (!path || !resolved_path)
-        ERAISE(-EINVAL);
+    if (len >= PATH_MAX)
+        ERAISE(-ENAMETOOLONG);
 
-    /* Allocate variables on the heap since too big for the stack. */
-    if (!(v = calloc(1, sizeof(variables_t))))
-        ERAISE(-ENOMEM);
+    *len_out = len;
 
-    if (path[0] == '/')
-    {
-        if (myst_strlcpy(v->buf, path, sizeof(v->buf)) >= sizeof(v->buf))
-            ERAISE(-ENAMETOOLONG);
-    }
-    else
+done:
+    return ret;
+}
+
+/*
+** Normalize the absolute path in buf in place: collapse repeated slashes,
+** drop "." components (except a final one) and remove ".." along with the
+** component before it. A trailing slash becomes a final ".", so that the
+** file systems still see that the path must name a directory.
+*/
+static int _normalize(char buf[PATH_MAX], bool trailing_slash)
+{
+    int ret = 0;
+    myst_path_iter_t it;
+    size_t w = 0; /* the length of the output (which is empty for root) */
+
+    myst_path_iter_init(&it, buf);
+
+    while (myst_path_next(&it))
     {
-        char cwd[PATH_MAX];
-        long r;
+        const size_t n = it.len;
+        const bool last = myst_path_last(&it) && !trailing_slash;
 
-        if ((r = myst_syscall_getcwd(cwd, sizeof(cwd))) < 0)
-            ERAISE((int)r);
+        if (n == 1 && it.name[0] == '.' && !last)
+            continue;
 
-        if (myst_strlcpy(v->buf, cwd, sizeof(v->buf)) >= sizeof(v->buf))
-            ERAISE(-ENAMETOOLONG);
+        if (n == 2 && it.name[0] == '.' && it.name[1] == '.')
+        {
+            /* back up to the slash before the previous component */
+            while (w > 0 && buf[--w] != '/')
+                ;
+            continue;
+        }
 
-        if (myst_strlcat(v->buf, "/", sizeof(v->buf)) >= sizeof(v->buf))
-            ERAISE(-ENAMETOOLONG);
+        /* the output never gets ahead of the input */
+        buf[w++] = '/';
+        memmove(buf + w, it.name, n);
+        w += n;
+    }
 
-        if (myst_strlcat(v->buf, path, sizeof(v->buf)) >= sizeof(v->buf))
+    if (trailing_slash)
+    {
+        if (w + 2 >= PATH_MAX)
             ERAISE(-ENAMETOOLONG);
+
+        buf[w++] = '/';
+        buf[w++] = '.';
     }
 
-    /* Split the path into elements. */
-    {
-        char* p;
-        char* save;
+    if (w == 0)
+        buf[w++] = '/';
 
-        v->in[nin++] = "/";
+    buf[w] = '\0';
 
-        for (p = strtok_r(v->buf, "/", &save); p;
-             p = strtok_r(NULL, "/", &save))
-        {
-            v->in[nin++] = p;
-        }
+done:
+    return ret;
+}
 
-        /* if the path ends in '/' and not root then add '.' */
-        {
-            size_t len = strlen(path);
+int myst_realpath(const char* path, myst_path_t* resolved_path)
+{
+    int ret = 0;
+    char* buf;
+    size_t len;
 
-            if (len > 1 && path[len - 1] == '/')
-                v->in[nin++] = ".";
-        }
-    }
+    if (resolved_path)
+        *resolved_path->buf = '\0';
 
-    /* Normalize the path. */
-    for (size_t i = 0; i < nin; i++)
-    {
-        /* Skip "." elements. */
-        if (i + 1 != nin && strcmp(v->in[i], ".") == 0)
-            continue;
+    if (!path || !resolved_path)
+        ERAISE(-EINVAL);
 
-        /* If "..", remove previous element. */
-        if (strcmp(v->in[i], "..") == 0)
-        {
-            if (nout > 1)
-                nout--;
-            continue;
-        }
+    buf = resolved_path->buf;
+    len = strlen(path);
 
-        v->out[nout++] = v->in[i];
-    }
+    /* Form the absolute path in the output buffer itself */
+    if (path[0] == '/')
+    {
+        if (len >= PATH_MAX)
+            ERAISE(-ENAMETOOLONG);
 
-    /* Build the resolved path. */
+        memcpy(buf, path, len + 1);
+    }
+    else
     {
-        const size_t n = sizeof(myst_path_t);
-        *resolved_path->buf = '\0';
+        size_t cwd_len;
 
-        for (size_t i = 0; i < nout; i++)
-        {
-            if (myst_strlcat(resolved_path->buf, v->out[i], n) >= n)
-                ERAISE(-ENAMETOOLONG);
-
-            if (i != 0 && i + 1 != nout)
-            {
-                if (myst_strlcat(resolved_path->buf, "/", n) >= n)
-                    ERAISE(-ENAMETOOLONG);
-            }
-        }
+        ECHECK(_copy_cwd(buf, &cwd_len));
+
+        if (cwd_len + 1 + len >= PATH_MAX)
+            ERAISE(-ENAMETOOLONG);
+
+        buf[cwd_len] = '/';
+        memcpy(buf + cwd_len + 1, path, len + 1);
     }
 
+    ECHECK(_normalize(buf, len > 1 && path[len - 1] == '/'));
+
 done:
 
-    if (v)
-        free(v);
+    if (ret != 0 && resolved_path)
+        *resolved_path->buf = '\0';
 
     return ret;
 }
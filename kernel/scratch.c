@@ -0,0 +1,189 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/defs.h>
+#include <myst/round.h>
+#include <myst/scratch.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+
+/* Precedes every block (a multiple of 16 bytes to keep blocks aligned) */
+typedef struct block
+{
+    struct block* next; /* heap blocks: the next older heap block */
+    size_t prev;        /* arena blocks: the bytes used before the block */
+    size_t end;         /* arena blocks: the bytes used after the block */
+    bool listed;        /* heap blocks: on the list of the thread */
+} block_t;
+
+MYST_STATIC_ASSERT(sizeof(block_t) % 16 == 0);
+
+typedef struct myst_scratch
+{
+    size_t used;
+    block_t* overflow; /* the heap blocks, latest first */
+    uint8_t data[MYST_SCRATCH_SIZE];
+} myst_scratch_t;
+
+MYST_STATIC_ASSERT(offsetof(myst_scratch_t, data) % 16 == 0);
+
+/* The calling thread (or null before the first thread is created) */
+static myst_thread_t* _self(void)
+{
+    myst_thread_t* thread = (myst_thread_t*)myst_get_tsd();
+
+    return myst_valid_thread(thread) ? thread : NULL;
+}
+
+static myst_scratch_t* _get_scratch(myst_thread_t* thread)
+{
+    myst_scratch_t* s;
+
+    if (!thread)
+        return NULL;
+
+    if ((s = thread->scratch))
+        return s;
+
+    if (!(s = malloc(sizeof(myst_scratch_t))))
+        return NULL;
+
+    s->used = 0;
+    s->overflow = NULL;
+    thread->scratch = s;
+
+    return s;
+}
+
+static bool _in_arena(const myst_scratch_t* s, const void* ptr)
+{
+    const uint8_t* p = ptr;
+    return s && p >= s->data && p < s->data + sizeof(s->data);
+}
+
+void* myst_scratch_alloc(size_t size)
+{
+    myst_scratch_t* s = _get_scratch(_self());
+    block_t* b;
+    size_t n;
+
+    if (myst_round_up(size, 16, &n) != 0 ||
+        __builtin_add_overflow(n, sizeof(block_t), &n))
+    {
+        return NULL;
+    }
+
+    /* carve the block from the arena if it fits */
+    if (s && n <= sizeof(s->data) - s->used)
+    {
+        b = (block_t*)(s->data + s->used);
+        b->prev = s->used;
+        s->used += n;
+        b->end = s->used;
+        return b + 1;
+    }
+
+    /* otherwise take it from the heap (and free it with the arena) */
+    if (!(b = malloc(n)))
+        return NULL;
+
+    b->listed = s != NULL;
+
+    if (s)
+    {
+        b->next = s->overflow;
+        s->overflow = b;
+    }
+
+    return b + 1;
+}
+
+void* myst_scratch_calloc(size_t size)
+{
+    void* ptr;
+
+    if ((ptr = myst_scratch_alloc(size)))
+        memset(ptr, 0, size);
+
+    return ptr;
+}
+
+void myst_scratch_free(void* ptr)
+{
+    myst_thread_t* thread;
+    myst_scratch_t* s;
+    block_t* b;
+
+    if (!ptr)
+        return;
+
+    thread = _self();
+    s = thread ? thread->scratch : NULL;
+    b = (block_t*)ptr - 1;
+
+    if (_in_arena(s, b))
+    {
+        /* only the latest block can be given back before the syscall ends */
+        if (b->end == s->used)
+            s->used = b->prev;
+    }
+    else if (!b->listed)
+    {
+        free(b);
+    }
+    else if (s && s->overflow == b)
+    {
+        s->overflow = b->next;
+        free(b);
+    }
+}
+
+void myst_scratch_enter(myst_thread_t* thread, myst_scratch_mark_t* mark)
+{
+    myst_scratch_t* s = thread->scratch;
+
+    mark->used = s ? s->used : 0;
+    mark->overflow = s ? s->overflow : NULL;
+}
+
+void myst_scratch_leave(myst_thread_t* thread, const myst_scratch_mark_t* mark)
+{
+    myst_scratch_t* s = thread->scratch;
+
+    if (!s)
+        return;
+
+    while (s->overflow && s->overflow != mark->overflow)
+    {
+        block_t* next = s->overflow->next;
+        free(s->overflow);
+        s->overflow = next;
+    }
+
+    if (mark->used < s->used)
+        s->used = mark->used;
+}
+
+void myst_release_scratch(myst_thread_t* thread)
+{
+    myst_scratch_t* s = thread->scratch;
+
+    if (!s)
+        return;
+
+    while (s->overflow)
+    {
+        block_t* next = s->overflow->next;
+        free(s->overflow);
+        s->overflow = next;
+    }
+
+    free(s);
+    thread->scratch = NULL;
+}
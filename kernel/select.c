@@ -5,9 +5,12 @@
 // Licensed under the MIT License.
 
 #include <errno.h>
+#include <limits.h>
 #include <poll.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <myst/defs.h>
 #include <myst/eraise.h>
@@ -17,74 +20,90 @@
 #include <myst/syscall.h>
 #include <myst/tcall.h>
 
-typedef struct _poll_fds
+/* the events of each set, as Linux maps them onto poll() */
+#define SELECT_IN (POLLIN | POLLRDNORM | POLLRDBAND | POLLHUP | POLLERR)
+#define SELECT_OUT (POLLOUT | POLLWRNORM | POLLWRBAND | POLLERR)
+#define SELECT_EX (POLLPRI)
+
+/* longer timeouts are cut to this (about 24 days, the most poll() takes) */
+#define MAX_TIMEOUT_USEC ((long)INT_MAX * 1000)
+
+#define BITS_PER_WORD (sizeof(unsigned long) * 8)
+#define NUM_WORDS (FD_SETSIZE / BITS_PER_WORD)
+
+MYST_STATIC_ASSERT(sizeof(fd_set) == NUM_WORDS * sizeof(unsigned long));
+
+/* Get the words of a set (which need not be aligned) */
+MYST_INLINE unsigned long _get_word(const fd_set* set, size_t i)
 {
-    nfds_t size;
-    struct pollfd data[FD_SETSIZE];
-} poll_fds_t;
+    unsigned long word = 0;
+
+    if (set)
+        memcpy(&word, (const unsigned long*)set + i, sizeof(word));
 
-int _update_fds(poll_fds_t* fds, int fd, short events)
+    return word;
+}
+
+MYST_INLINE void _set_word(fd_set* set, size_t i, unsigned long word)
 {
-    int ret = 0;
-    nfds_t i;
+    if (set)
+        memcpy((unsigned long*)set + i, &word, sizeof(word));
+}
 
-    /* if the fd is already in the array, update it */
-    for (i = 0; i < fds->size; i++)
-    {
-        if (fds->data[i].fd == fd)
-        {
-            fds->data[i].events = events;
-            /* success */
-            goto done;
-        }
-    }
+/* the mask of the bits of word i that lie below nfds */
+MYST_INLINE unsigned long _mask(size_t i, int nfds)
+{
+    const size_t bits = (size_t)nfds - i * BITS_PER_WORD;
+    return (bits >= BITS_PER_WORD) ? ~0UL : (1UL << bits) - 1;
+}
 
-    /* if the array is exhausted */
-    if (fds->size == MYST_COUNTOF(fds->data))
-        ERAISE(-EINVAL);
+static long _now_usec(void)
+{
+    struct timespec ts;
 
-    /* append the new element */
-    fds->data[fds->size].fd = fd;
-    fds->data[fds->size].events = events;
-    fds->data[fds->size].revents = 0;
-    fds->size++;
+    if (myst_syscall_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
 
-done:
-    return ret;
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-int _fdset_to_fds(poll_fds_t* fds, short events, fd_set* set, int nfds)
+/* Write the time left before the deadline back, as Linux does */
+static void _update_timeout(struct timeval* timeout, long deadline)
 {
-    int ret = 0;
-    int fd;
+    long remaining = deadline - _now_usec();
 
-    for (fd = 0; fd < nfds; fd++)
-    {
-        if (FD_ISSET(fd, set))
-            ECHECK(_update_fds(fds, fd, events));
-    }
+    if (remaining < 0)
+        remaining = 0;
 
-done:
-    return ret;
+    timeout->tv_sec = remaining / 1000000;
+    timeout->tv_usec = remaining % 1000000;
 }
 
-int _fds_to_fdset(poll_fds_t* fds, short revents, fd_set* set)
+/* select() without any descriptors sleeps for the exact timeout */
+static long _select_sleep(struct timeval* timeout, long usec, long deadline)
 {
-    int num_ready = 0;
-    nfds_t i;
+    long ret = 0;
+    struct timespec req;
 
-    for (i = 0; i < fds->size; i++)
+    if (!timeout)
     {
-        const struct pollfd* p = &fds->data[i];
-
-        if ((p->revents & revents))
-        {
-            FD_SET(p->fd, set);
-            num_ready++;
-        }
+        /* wait until a signal arrives */
+        ECHECK(myst_syscall_poll(NULL, 0, -1));
+        goto done;
     }
 
-    return num_ready;
+    req.tv_sec = usec / 1000000;
+    req.tv_nsec = (usec % 1000000) * 1000;
+
+    ret = myst_syscall_nanosleep(&req, NULL);
+    _update_timeout(timeout, deadline);
+
+    /* only an interrupted sleep is an error */
+    if (ret != -EINTR)
+        ret = 0;
+
+done:
+    return ret;
 }
 
 long myst_syscall_select(
@@ -95,72 +114,126 @@ long myst_syscall_select(
     struct timeval* timeout)
 {
     long ret = 0;
-    int num_ready = 0;
-    poll_fds_t fds = {0};
+    size_t nwords;
+    struct pollfd fds[FD_SETSIZE];
+    nfds_t size = 0;
     int poll_timeout = -1;
+    long usec = 0;
+    long deadline = 0;
+    unsigned long rbits[NUM_WORDS];
+    unsigned long wbits[NUM_WORDS];
+    unsigned long ebits[NUM_WORDS];
+    long num_ready = 0;
+
+    if (nfds < 0)
+        ERAISE(-EINVAL);
+
+    if (nfds > FD_SETSIZE)
+        nfds = FD_SETSIZE;
 
     if (timeout)
     {
-        poll_timeout = (int)timeout->tv_sec * 1000;
-        poll_timeout += (int)(timeout->tv_usec / 1000);
-    }
+        /* Linux takes microseconds beyond a second */
+        const long sec = timeout->tv_sec + timeout->tv_usec / 1000000;
 
-    if (readfds)
-    {
-        const short events = POLLIN | POLLRDNORM | POLLRDBAND;
-        ECHECK(_fdset_to_fds(&fds, events, readfds, nfds));
-    }
+        usec = timeout->tv_usec % 1000000;
 
-    if (writefds)
-    {
-        const short events = POLLOUT | POLLWRNORM | POLLWRBAND;
-        ECHECK(_fdset_to_fds(&fds, events, writefds, nfds));
+        if (sec < 0 || usec < 0)
+            ERAISE(-EINVAL);
+
+        if (sec >= MAX_TIMEOUT_USEC / 1000000)
+            usec = MAX_TIMEOUT_USEC;
+        else
+            usec += sec * 1000000;
+
+        deadline = _now_usec() + usec;
+
+        /* round up, so that a short timeout still waits */
+        poll_timeout = (int)((usec + 999) / 1000);
     }
 
-    if (exceptfds)
+    nwords = ((size_t)nfds + BITS_PER_WORD - 1) / BITS_PER_WORD;
+
+    /* build the poll set in one pass over the set bits, in fd order */
+    for (size_t i = 0; i < nwords; i++)
     {
-        const short events = POLLERR | POLLHUP | POLLRDHUP;
-        ECHECK(_fdset_to_fds(&fds, events, exceptfds, nfds));
-    }
+        const unsigned long mask = _mask(i, nfds);
+        const unsigned long r = _get_word(readfds, i) & mask;
+        const unsigned long w = _get_word(writefds, i) & mask;
+        const unsigned long e = _get_word(exceptfds, i) & mask;
 
-    ECHECK(myst_syscall_poll(fds.data, fds.size, poll_timeout));
+        for (unsigned long bits = r | w | e; bits; bits &= bits - 1)
+        {
+            const unsigned long bit = bits & -bits;
+            struct pollfd* p = &fds[size++];
 
-    if (readfds)
-        FD_ZERO(readfds);
+            p->fd = (int)(i * BITS_PER_WORD + __builtin_ctzl(bits));
+            p->events = 0;
+            p->revents = 0;
 
-    if (writefds)
-        FD_ZERO(writefds);
+            if (r & bit)
+                p->events |= SELECT_IN;
 
-    if (exceptfds)
-        FD_ZERO(exceptfds);
+            if (w & bit)
+                p->events |= SELECT_OUT;
 
-    if (readfds)
-    {
-        short events = POLLIN | POLLRDNORM | POLLRDBAND;
-        int n;
+            if (e & bit)
+                p->events |= SELECT_EX;
+        }
+    }
 
-        if ((n = _fds_to_fdset(&fds, events, readfds)) > num_ready)
-            num_ready += n;
+    if (size == 0)
+    {
+        ret = _select_sleep(timeout, usec, deadline);
+        goto done;
     }
 
-    if (writefds)
+    ECHECK(myst_syscall_poll(fds, size, poll_timeout));
+
+    memset(rbits, 0, nwords * sizeof(unsigned long));
+    memset(wbits, 0, nwords * sizeof(unsigned long));
+    memset(ebits, 0, nwords * sizeof(unsigned long));
+
+    /* report each set that asked for an event that happened */
+    for (nfds_t i = 0; i < size; i++)
     {
-        short events = POLLOUT | POLLWRNORM | POLLWRBAND;
-        int n;
+        const struct pollfd* p = &fds[i];
+        const size_t word = (size_t)p->fd / BITS_PER_WORD;
+        const unsigned long bit = 1UL << (p->fd % BITS_PER_WORD);
+        const short revents = p->revents & p->events;
+
+        if (p->revents & POLLNVAL)
+            ERAISE(-EBADF);
+
+        if (revents & SELECT_IN && p->events & POLLIN)
+        {
+            rbits[word] |= bit;
+            num_ready++;
+        }
+
+        if (revents & SELECT_OUT && p->events & POLLOUT)
+        {
+            wbits[word] |= bit;
+            num_ready++;
+        }
 
-        if ((n = _fds_to_fdset(&fds, events, writefds)) > num_ready)
-            num_ready += n;
+        if (revents & SELECT_EX)
+        {
+            ebits[word] |= bit;
+            num_ready++;
+        }
     }
 
-    if (exceptfds)
+    for (size_t i = 0; i < nwords; i++)
     {
-        short events = POLLERR | POLLHUP | POLLRDHUP;
-        int n;
-
-        if ((n = _fds_to_fdset(&fds, events, exceptfds)) > num_ready)
-            num_ready += n;
+        _set_word(readfds, i, rbits[i]);
+        _set_word(writefds, i, wbits[i]);
+        _set_word(exceptfds, i, ebits[i]);
     }
 
+    if (timeout)
+        _update_timeout(timeout, deadline);
+
     ret = num_ready;
 
 done:
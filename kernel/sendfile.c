@@ -1,64 +1,373 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <sys/sendfile.h>
 
 #include <myst/eraise.h>
+#include <myst/fdtable.h>
+#include <myst/fs.h>
+#include <myst/kernel.h>
+#include <myst/sockdev.h>
 #include <myst/syscall.h>
 
-long myst_syscall_sendfile(int out_fd, int in_fd, off_t* offset, size_t count)
+/* Bounce buffer size for file systems without fs_pread_direct() (ext2 and
+ * hostfs): large enough to read many blocks per call into the host */
+#define TRANSFER_CHUNK_SIZE (64 * 1024)
+
+/* Linux never moves more than this in a single call (MAX_RW_COUNT) */
+#define MAX_TRANSFER_SIZE 0x7ffff000
+
+/* Where bytes are read from: a file (at an offset) or any other descriptor */
+typedef struct source
 {
-    long ret = 0;
-    ssize_t nwritten = 0;
-    off_t original_offset;
+    int fd;
+    myst_fs_t* fs;     /* null if fd is not a file */
+    myst_file_t* file; /* null if fd is not a file */
+} source_t;
 
-    if (out_fd < 0 || in_fd < 0)
+/* Where sendfile() bytes go: any descriptor, at its current offset */
+static ssize_t _write_fd(void* arg, const void* data, size_t n)
+{
+    return myst_syscall_write(*(int*)arg, data, n);
+}
+
+/* Where copy_file_range() bytes go: a file at an optional offset */
+typedef struct sink
+{
+    myst_fs_t* fs;
+    myst_file_t* file;
+    off_t* offset; /* null to use (and update) the file offset */
+} sink_t;
+
+static ssize_t _write_file(void* arg, const void* data, size_t n)
+{
+    sink_t* s = arg;
+    ssize_t r;
+
+    if (!s->offset)
+        return (*s->fs->fs_write)(s->fs, s->file, data, n);
+
+    if ((r = (*s->fs->fs_pwrite)(s->fs, s->file, data, n, *s->offset)) > 0)
+        *s->offset += r;
+
+    return r;
+}
+
+/* Move bytes through a bounce buffer; returns bytes moved or an error if
+ * nothing moved at all */
+static ssize_t _transfer_buffered(
+    source_t* src,
+    off_t offset,
+    myst_fs_consume_t consume,
+    void* arg,
+    size_t count)
+{
+    ssize_t ret = 0;
+    size_t chunk = (count < TRANSFER_CHUNK_SIZE) ? count : TRANSFER_CHUNK_SIZE;
+    void* buf = NULL;
+    size_t done = 0;
+
+    if (!(buf = malloc(chunk)))
+        ERAISE(-ENOMEM);
+
+    while (done < count)
+    {
+        const size_t n = (count - done < chunk) ? count - done : chunk;
+        ssize_t r;
+        ssize_t w;
+
+        if (src->fs)
+        {
+            r = (*src->fs->fs_pread)(
+                src->fs, src->file, buf, n, offset + (off_t)done);
+        }
+        else
+        {
+            r = myst_syscall_read(src->fd, buf, n);
+        }
+
+        if (r <= 0)
+        {
+            ret = r;
+            break;
+        }
+
+        if ((w = consume(arg, buf, (size_t)r)) <= 0)
+        {
+            ret = w;
+            break;
+        }
+
+        done += (size_t)w;
+
+        /* stop on a short read or a short write */
+        if (w < r || (size_t)r < n)
+            break;
+    }
+
+    /* report what was moved and drop any later error */
+    if (done)
+        ret = (ssize_t)done;
+
+done:
+
+    if (buf)
+        free(buf);
+
+    return ret;
+}
+
+/* Move up to count bytes from src (at *offset if not null, else at the file
+ * offset) to consume(), updating whichever offset was used; direct allows
+ * fs_pread_direct() */
+static ssize_t _transfer(
+    source_t* src,
+    off_t* offset,
+    myst_fs_consume_t consume,
+    void* arg,
+    size_t count,
+    bool direct)
+{
+    ssize_t ret = 0;
+    myst_fs_t* fs = src->fs;
+    off_t off = 0;
+    ssize_t n;
+
+    if (count > MAX_TRANSFER_SIZE)
+        count = MAX_TRANSFER_SIZE;
+
+    if (!fs)
+    {
+        /* other descriptors have no offset, so just read them */
+        if (offset)
+            ERAISE(-ESPIPE);
+
+        ECHECK(ret = _transfer_buffered(src, 0, consume, arg, count));
+        goto done;
+    }
+
+    if (offset)
+        off = *offset;
+    else
+        ECHECK(off = (*fs->fs_lseek)(fs, src->file, 0, SEEK_CUR));
+
+    if (off < 0)
         ERAISE(-EINVAL);
 
-    /* if offset is not null, set file offset to this value */
+    /* in-memory file systems pass their storage straight to the sink */
+    if (direct && fs->fs_pread_direct)
+    {
+        n = (*fs->fs_pread_direct)(fs, src->file, consume, arg, count, off);
+    }
+    else
+    {
+        n = _transfer_buffered(src, off, consume, arg, count);
+    }
+
+    ECHECK(n);
+
     if (offset)
+        *offset = off + n;
+    else if (n)
+        ECHECK((*fs->fs_lseek)(fs, src->file, off + n, SEEK_SET));
+
+    ret = n;
+
+done:
+    return ret;
+}
+
+static int _get_source(int fd, source_t* src)
+{
+    int ret = 0;
+    myst_fdtable_t* fdtable;
+    myst_fdtable_type_t type;
+    void* device;
+    void* object;
+
+    if (!(fdtable = myst_fdtable_current()))
+        ERAISE(-ENOSYS);
+
+    ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
+
+    src->fd = fd;
+    src->fs = NULL;
+    src->file = NULL;
+
+    if (type == MYST_FDTABLE_TYPE_FILE)
     {
-        /* get the current offset */
-        original_offset = lseek(in_fd, 0, SEEK_CUR);
-        ECHECK(original_offset);
+        src->fs = device;
+        src->file = object;
+    }
 
-        /* seek the new offset */
-        ECHECK(lseek(in_fd, *offset, SEEK_SET));
+done:
+    return ret;
+}
+
+/* With --host-sendfile, the host sends a hostfs file to a host socket by
+ * itself: the bytes never enter the enclave, which is why this is opt-in
+ * (only for files that need not be confidential). Returns -ENOTSUP where the
+ * bytes must go through the kernel. */
+static long _host_sendfile(
+    source_t* src,
+    int out_fd,
+    off_t* offset,
+    size_t count)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable;
+    myst_fdtable_type_t type;
+    void* device;
+    void* object;
+    myst_fdops_t* fdops;
+    int target_fd;
+
+    if (!__myst_kernel_args.host_sendfile || !src->fs ||
+        !src->fs->fs_host_sendfile)
+    {
+        return -ENOTSUP;
     }
 
-    /* copy from in_fd to out_fd */
+    if (!(fdtable = myst_fdtable_current()))
+        ERAISE(-ENOSYS);
+
+    ECHECK(myst_fdtable_get_any(fdtable, out_fd, &type, &device, &object));
+
+    /* only host sockets (not unix or in-enclave loopback sockets) */
+    if (type != MYST_FDTABLE_TYPE_SOCK || device != myst_sockdev_get())
+        return -ENOTSUP;
+
+    /* the kernel seals the records of a TLS socket */
+    if (myst_sockdev_kernel_tls(object))
+        return -ENOTSUP;
+
+    fdops = device;
+
+    if ((target_fd = (*fdops->fd_target_fd)(fdops, object)) < 0)
+        return -ENOTSUP;
+
+    if (offset && *offset < 0)
+        ERAISE(-EINVAL);
+
+    if (count > MAX_TRANSFER_SIZE)
+        count = MAX_TRANSFER_SIZE;
+
+    ret = (*src->fs->fs_host_sendfile)(
+        src->fs, src->file, target_fd, offset, count);
+
+    /* a host that cannot sendfile() this pair leaves it to the kernel */
+    if (ret == -EINVAL || ret == -ENOSYS)
+        ret = -ENOTSUP;
+
+done:
+    return ret;
+}
+
+long myst_syscall_sendfile(int out_fd, int in_fd, off_t* offset, size_t count)
+{
+    long ret = 0;
+    source_t src;
+
+    if (out_fd < 0 || in_fd < 0)
+        ERAISE(-EBADF);
+
+    ECHECK(_get_source(in_fd, &src));
+
+    if ((ret = _host_sendfile(&src, out_fd, offset, count)) != -ENOTSUP)
     {
-        ssize_t n;
-        char buf[BUFSIZ];
-        size_t r = count;
+        ECHECK(ret);
+        goto done;
+    }
 
-        while (r > 0 && (n = read(in_fd, buf, sizeof(buf))) > 0)
-        {
-            ssize_t m = write(out_fd, buf, n);
-            ECHECK(m);
+    /* bytes go straight from the input to the output descriptor's write path
+     * (for a ramfs file, with no copy before that) */
+    ECHECK(ret = _transfer(&src, offset, _write_fd, &out_fd, count, true));
+
+done:
+    return ret;
+}
 
-            if (m != n)
-                ERAISE(EIO);
+long myst_syscall_copy_file_range(
+    int fd_in,
+    off_t* off_in,
+    int fd_out,
+    off_t* off_out,
+    size_t len,
+    unsigned int flags)
+{
+    long ret = 0;
+    source_t src;
+    source_t dest;
+    sink_t sink;
+    struct stat st_in;
+    struct stat st_out;
+    off_t out = 0;
+    bool direct = true;
 
-            nwritten += m;
-            r -= m;
-        }
+    if (flags != 0)
+        ERAISE(-EINVAL);
+
+    if (len > MAX_TRANSFER_SIZE)
+        len = MAX_TRANSFER_SIZE;
+
+    ECHECK(_get_source(fd_in, &src));
+    ECHECK(_get_source(fd_out, &dest));
+
+    /* both descriptors must be files */
+    if (!src.fs || !dest.fs)
+        ERAISE(-EINVAL);
+
+    ECHECK((*src.fs->fs_fstat)(src.fs, src.file, &st_in));
+    ECHECK((*dest.fs->fs_fstat)(dest.fs, dest.file, &st_out));
+
+    if (!S_ISREG(st_in.st_mode) || !S_ISREG(st_out.st_mode))
+        ERAISE(S_ISDIR(st_in.st_mode) || S_ISDIR(st_out.st_mode) ? -EISDIR
+                                                                  : -EINVAL);
+
+    if (off_out)
+    {
+        if (*off_out < 0)
+            ERAISE(-EINVAL);
+
+        out = *off_out;
     }
 
-    /* if offset is null, restore the original offset */
-    if (offset)
+    sink.fs = dest.fs;
+    sink.file = dest.file;
+    sink.offset = off_out ? &out : NULL;
+
+    /* st_dev is not unique across mounts, so compare file systems */
+    if (src.fs == dest.fs && st_in.st_dev == st_out.st_dev &&
+        st_in.st_ino == st_out.st_ino)
     {
-        /* get the final offset */
-        off_t final_offset = lseek(in_fd, 0, SEEK_CUR);
-        ECHECK(final_offset);
+        off_t in;
+        off_t to;
 
-        if (*offset + nwritten != final_offset)
-            ERAISE(-EIO);
+        if (off_in)
+            in = *off_in;
+        else
+            ECHECK(in = (*src.fs->fs_lseek)(src.fs, src.file, 0, SEEK_CUR));
 
-        /* restore the original offset */
-        ECHECK(lseek(in_fd, original_offset, SEEK_SET));
-        *offset = final_offset;
+        if (off_out)
+            to = out;
+        else
+            ECHECK(to = (*dest.fs->fs_lseek)(dest.fs, dest.file, 0, SEEK_CUR));
+
+        /* a range may not be copied onto itself */
+        if (in < to + (off_t)len && to < in + (off_t)len)
+            ERAISE(-EINVAL);
+
+        /* writing may move the file's storage, so never read it directly */
+        direct = false;
     }
 
-    /* return the number of bytes written to out_fd */
-    ret = nwritten;
+    ECHECK(ret = _transfer(&src, off_in, _write_file, &sink, len, direct));
+
+    if (off_out)
+        *off_out = out;
 
 done:
     return ret;
@@ -10,6 +10,9 @@
 /* The lock for installing signal dispositions */
 static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
 
+/* The number of myst_signal_infos_t allocated (see _new_infos()) */
+static size_t _ninfos;
+
 static int _check_signum(unsigned signum)
 {
     return (signum <= 0 || signum >= NSIG) ? -EINVAL : 0;
@@ -47,6 +50,39 @@ void myst_signal_free(myst_thread_t* thread)
     thread->signal.sigactions = NULL;
 }
 
+/* Most threads never get a signal, so the storage of the siginfo_t of
+ * pending signals (about 10K) comes with the first one that needs it */
+static myst_signal_infos_t* _new_infos(void)
+{
+    myst_signal_infos_t* infos;
+
+    if ((infos = calloc(1, sizeof(myst_signal_infos_t))))
+        __atomic_add_fetch(&_ninfos, 1, __ATOMIC_RELAXED);
+
+    return infos;
+}
+
+static void _free_infos(myst_signal_infos_t* infos)
+{
+    if (infos)
+    {
+        __atomic_sub_fetch(&_ninfos, 1, __ATOMIC_RELAXED);
+        free(infos);
+    }
+}
+
+void myst_signal_release_infos(myst_thread_t* thread)
+{
+    _free_infos(thread->signal.infos);
+    thread->signal.infos = NULL;
+}
+
+size_t myst_signal_infos_bytes(void)
+{
+    return __atomic_load_n(&_ninfos, __ATOMIC_RELAXED) *
+           sizeof(myst_signal_infos_t);
+}
+
 long myst_signal_sigaction(
     unsigned signum,
     const posix_sigaction_t* new_action,
@@ -128,7 +164,12 @@ static long _default_signal_handler(unsigned signum)
     return 0;
 }
 
-static long _handle_one_signal(unsigned signum, siginfo_t* siginfo)
+/* Run a signal handler. The user-space fsbase is installed by the first
+ * handler of a batch and *fsbase saves the original one for the caller */
+static long _handle_one_signal(
+    unsigned signum,
+    siginfo_t* siginfo,
+    void** fsbase)
 {
     long ret = 0;
     ECHECK(_check_signum(signum));
@@ -143,6 +184,13 @@ static long _handle_one_signal(unsigned signum, siginfo_t* siginfo)
     posix_sigaction_t* action = &thread->signal.sigactions[signum - 1];
     if (action->handler == (uint64_t)SIG_DFL)
     {
+        /* the default action runs with the original fsbase */
+        if (*fsbase)
+        {
+            myst_set_fsbase(*fsbase);
+            *fsbase = NULL;
+        }
+
         ret = _default_signal_handler(signum);
     }
     else if (action->handler == (uint64_t)SIG_IGN)
@@ -161,11 +209,13 @@ static long _handle_one_signal(unsigned signum, siginfo_t* siginfo)
         // ATTN: handle other signal flags, e.g., SA_NOCLDSTOP, SA_NOCLDWAIT,
         // SA_ONSTACK, SA_RESETHAND, SA_RESTART, etc.
 
-        /* save the original fsbase */
-        void* original_fsbase = myst_get_fsbase();
-
-        /* restore the user-space fsbase, which is pthread_self() */
-        myst_set_fsbase(thread->crt_td);
+        /* save the original fsbase and restore the user-space fsbase, which
+         * is pthread_self() (once for all the signals being processed) */
+        if (!*fsbase)
+        {
+            *fsbase = myst_get_fsbase();
+            myst_set_fsbase(thread->crt_td);
+        }
 
         if ((action->flags & SA_SIGINFO) != 0)
         {
@@ -180,9 +230,6 @@ static long _handle_one_signal(unsigned signum, siginfo_t* siginfo)
             ((sigaction_handler_t)(action->handler))(signum);
         }
 
-        /* restore the original fsbase */
-        myst_set_fsbase(original_fsbase);
-
         thread->signal.mask = orig_mask; /* Restore to original mask */
     }
 
@@ -190,37 +237,81 @@ done:
     return ret;
 }
 
-long myst_signal_process(myst_thread_t* thread)
+/* Take the lowest pending signal (and its siginfo if any) for the thread */
+static unsigned _take_signal(myst_thread_t* thread, siginfo_t* siginfo)
 {
-    while (thread->signal.pending != 0)
+    unsigned bitnum;
+    uint64_t mask;
+    unsigned signum = 0;
+    myst_signal_infos_t* infos;
+
+    myst_spin_lock(&thread->signal.lock);
+    infos = thread->signal.infos;
+
+    if (thread->signal.pending == 0)
+        goto done;
+
+    bitnum = (unsigned)__builtin_ctzl(thread->signal.pending);
+    mask = (uint64_t)1 << bitnum;
+
+    // Signal numbers are 1 based.
+    signum = bitnum + 1;
+
+    if (infos && (infos->info & mask))
+        *siginfo = infos->siginfos[bitnum];
+    else
+        siginfo->si_signo = 0;
+
+    /* make the next queued instance of the signal (if any) pending */
+    for (size_t i = 0; infos && i < infos->queue_size; i++)
     {
-        unsigned bitnum = __builtin_ctzl(thread->signal.pending);
+        siginfo_t* queue = infos->queue;
 
-        // Create a local copy and free the global one.
-        siginfo_t local_siginfo = {0};
-        siginfo_t* siginfo = NULL;
-        if (thread->signal.siginfos[bitnum])
+        if (queue[i].si_signo == (int)signum)
         {
-            local_siginfo = *thread->signal.siginfos[bitnum];
-            free(thread->signal.siginfos[bitnum]);
-            thread->signal.siginfos[bitnum] = NULL;
-            siginfo = &local_siginfo;
+            size_t n = --infos->queue_size - i;
+            infos->siginfos[bitnum] = queue[i];
+            infos->info |= mask;
+            memmove(&queue[i], &queue[i + 1], n * sizeof(siginfo_t));
+            goto done;
         }
+    }
 
-        // Clear the pending bit. We are ready for the next signal.
-        thread->signal.pending &= ~((uint64_t)1 << bitnum);
+    // Clear the pending bit. We are ready for the next signal.
+    thread->signal.pending &= ~mask;
+
+    if (infos)
+        infos->info &= ~mask;
+
+done:
+    myst_spin_unlock(&thread->signal.lock);
+    return signum;
+}
 
-        // Signal numbers are 1 based.
-        unsigned signum = bitnum + 1;
-        _handle_one_signal(signum, siginfo);
+long myst_signal_process(myst_thread_t* thread)
+{
+    void* fsbase = NULL;
+    unsigned signum;
+    siginfo_t siginfo;
+
+    while (thread->signal.pending != 0 &&
+           (signum = _take_signal(thread, &siginfo)))
+    {
+        siginfo_t* info = siginfo.si_signo ? &siginfo : NULL;
+        _handle_one_signal(signum, info, &fsbase);
     }
+
+    /* restore the original fsbase */
+    if (fsbase)
+        myst_set_fsbase(fsbase);
+
     return 0;
 }
 
 long myst_signal_deliver(
     myst_thread_t* thread,
     unsigned signum,
-    siginfo_t* siginfo)
+    const siginfo_t* siginfo)
 {
     long ret = 0;
     ECHECK(_check_signum(signum));
@@ -229,22 +320,63 @@ long myst_signal_deliver(
 
     if (!(thread->signal.mask & mask) || signum == SIGKILL || signum == SIGSTOP)
     {
+        myst_signal_infos_t* spare = NULL;
+        myst_signal_infos_t* infos;
+
+        /* allocate the siginfo_t storage (if needed) outside the lock */
+        if (!__atomic_load_n(&thread->signal.infos, __ATOMIC_ACQUIRE) &&
+            (siginfo || signum >= MYST_SIGRTMIN))
+        {
+            if (!(spare = _new_infos()))
+                ERAISE(-EAGAIN);
+        }
+
         // Multiple threads could be trying to deliver a signal
         // to this thread simultaneously. Protect with a lock.
         myst_spin_lock(&thread->signal.lock);
 
-        // If the signal is not blocked, wait for the same signal from a
-        // previous delivery to be handled.
-        while (thread->signal.pending & mask)
-            ;
-        thread->signal.siginfos[signum - 1] = siginfo;
-        thread->signal.pending |= mask;
+        if (!thread->signal.infos && spare)
+        {
+            __atomic_store_n(&thread->signal.infos, spare, __ATOMIC_RELEASE);
+            spare = NULL;
+        }
+
+        infos = thread->signal.infos;
+
+        if (!(thread->signal.pending & mask))
+        {
+            if (siginfo)
+            {
+                infos->siginfos[signum - 1] = *siginfo;
+                infos->siginfos[signum - 1].si_signo = (int)signum;
+                infos->info |= mask;
+            }
+
+            thread->signal.pending |= mask;
+        }
+        else if (signum >= MYST_SIGRTMIN)
+        {
+            /* realtime signals are queued (standard ones are merged) */
+            size_t n = infos->queue_size;
+
+            if (n == MYST_SIGNAL_QUEUE_SIZE)
+            {
+                myst_spin_unlock(&thread->signal.lock);
+                _free_infos(spare);
+                ERAISE(-EAGAIN);
+            }
+
+            if (siginfo)
+                infos->queue[n] = *siginfo;
+            else
+                memset(&infos->queue[n], 0, sizeof(siginfo_t));
+
+            infos->queue[n].si_signo = (int)signum;
+            infos->queue_size++;
+        }
 
         myst_spin_unlock(&thread->signal.lock);
-    }
-    else
-    {
-        free(siginfo); // Free the siginfo object if not delivered.
+        _free_infos(spare);
     }
 
 done:
@@ -1,13 +1,27 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
 
 #include <myst/eraise.h>
+#include <myst/hostclose.h>
+#include <myst/iov.h>
+#include <myst/kernel.h>
+#include <myst/ktls.h>
+#include <myst/mutex.h>
 #include <myst/panic.h>
+#include <myst/pollq.h>
+#include <myst/scratch.h>
+#include <myst/slab.h>
 #include <myst/sockdev.h>
 #include <myst/spinlock.h>
 #include <myst/syscall.h>
@@ -15,11 +29,1407 @@
 
 #define MAGIC 0xc436d7e6
 
+typedef struct tcp tcp_t;
+typedef struct shadow shadow_t;
+typedef struct tls tls_t;
+
 struct myst_sock
 {
-    uint32_t magic; /* MAGIC */
-    int fd;         /* the target-relative file descriptor */
-};
+    uint32_t magic; /* MAGIC */
+    int fd;         /* the target-relative file descriptor */
+    tcp_t* tcp;     /* TCP sockets only (shared by dups) */
+    unsigned int busy_poll_usec; /* SO_BUSY_POLL (see myst/pollq.h) */
+    shadow_t* shadow;            /* the cached host state (shared by dups) */
+    int fd_flags;                /* FD_CLOEXEC of the target fd (F_GETFD) */
+};
+
+static myst_slab_cache_t _sock_cache =
+    MYST_SLAB_CACHE_INIT("myst_sock_t", myst_sock_t);
+
+/*
+**==============================================================================
+**
+** The socket buffer pool:
+**
+**     Passing an enclave buffer to a send or receive OCALL makes Open Enclave
+**     allocate (and later free) host memory for every call. Instead, data is
+**     staged in buffers that were allocated once in host memory: the host
+**     sends from or receives into them directly and the kernel makes the
+**     single copy to or from the caller's buffer. The pool grows on demand up
+**     to MYST_SOCKBUF_COUNT buffers; when all are busy, the operation falls
+**     back to the regular path.
+**
+**==============================================================================
+*/
+
+static void* _sockbufs[MYST_SOCKBUF_COUNT];
+static size_t _sockbufs_free[MYST_SOCKBUF_COUNT];
+static size_t _sockbufs_nfree;
+static myst_sockbuf_stats_t _sockbuf_stats;
+static myst_spinlock_t _sockbufs_lock = MYST_SPINLOCK_INITIALIZER;
+
+/* Get the index of a free buffer or -1 if none is available */
+static ssize_t _get_sockbuf(void)
+{
+    ssize_t index = -1;
+    bool grow = false;
+
+    myst_spin_lock(&_sockbufs_lock);
+    {
+        if (_sockbufs_nfree)
+            index = (ssize_t)_sockbufs_free[--_sockbufs_nfree];
+        else if (_sockbuf_stats.count < MYST_SOCKBUF_COUNT)
+        {
+            /* reserve the slot and allocate it without holding the lock */
+            index = (ssize_t)_sockbuf_stats.count++;
+            grow = true;
+        }
+
+        if (index >= 0)
+        {
+            _sockbuf_stats.in_use++;
+            _sockbuf_stats.hits++;
+        }
+        else
+            _sockbuf_stats.misses++;
+    }
+    myst_spin_unlock(&_sockbufs_lock);
+
+    if (grow)
+    {
+        long params[6] = {MYST_SOCKBUF_SIZE, (long)&_sockbufs[index]};
+
+        if (myst_tcall(MYST_TCALL_HOSTBUF_ALLOC, params) != 0)
+        {
+            myst_spin_lock(&_sockbufs_lock);
+            _sockbuf_stats.count--;
+            _sockbuf_stats.in_use--;
+            _sockbuf_stats.hits--;
+            _sockbuf_stats.misses++;
+            myst_spin_unlock(&_sockbufs_lock);
+            return -1;
+        }
+    }
+
+    return index;
+}
+
+static void _put_sockbuf(ssize_t index, size_t sent, size_t received)
+{
+    myst_spin_lock(&_sockbufs_lock);
+    _sockbufs_free[_sockbufs_nfree++] = (size_t)index;
+    _sockbuf_stats.in_use--;
+    _sockbuf_stats.bytes_sent += sent;
+    _sockbuf_stats.bytes_received += received;
+    myst_spin_unlock(&_sockbufs_lock);
+}
+
+void myst_sockdev_get_sockbuf_stats(myst_sockbuf_stats_t* stats)
+{
+    if (stats)
+    {
+        myst_spin_lock(&_sockbufs_lock);
+        *stats = _sockbuf_stats;
+        myst_spin_unlock(&_sockbufs_lock);
+    }
+}
+
+/* Send through the given pool buffer (and release it) */
+static ssize_t _send_sockbuf(
+    ssize_t index,
+    int fd,
+    const void* buf,
+    size_t len,
+    int flags)
+{
+    ssize_t ret = 0;
+    const uint8_t* p = buf;
+    size_t total = 0;
+
+    /* send in chunks, stopping at the first short send */
+    while (total < len)
+    {
+        size_t n = len - total;
+        long params[6] = {fd, (long)_sockbufs[index], 0, flags};
+        long r;
+
+        if (n > MYST_SOCKBUF_SIZE)
+            n = MYST_SOCKBUF_SIZE;
+
+        memcpy(_sockbufs[index], p + total, n);
+        params[2] = (long)n;
+
+        if ((r = myst_tcall(MYST_TCALL_HOSTBUF_SEND, params)) < 0)
+        {
+            /* report the bytes already sent rather than the error */
+            ret = total ? (ssize_t)total : r;
+            goto done;
+        }
+
+        total += (size_t)r;
+
+        if ((size_t)r < n)
+            break;
+    }
+
+    ret = (ssize_t)total;
+
+done:
+    _put_sockbuf(index, total, 0);
+    return ret;
+}
+
+/* Receive through the given pool buffer (and release it) */
+static ssize_t _recv_sockbuf(
+    ssize_t index,
+    int fd,
+    void* buf,
+    size_t len,
+    int flags)
+{
+    ssize_t ret;
+    size_t n = (len < MYST_SOCKBUF_SIZE) ? len : MYST_SOCKBUF_SIZE;
+
+    {
+        long params[6] = {fd, (long)_sockbufs[index], (long)n, flags};
+
+        if ((ret = myst_tcall(MYST_TCALL_HOSTBUF_RECV, params)) > 0)
+            memcpy(buf, _sockbufs[index], (size_t)ret);
+    }
+
+    _put_sockbuf(index, 0, (ret > 0) ? (size_t)ret : 0);
+    return ret;
+}
+
+/* Whether a send or receive may use the buffer pool */
+static bool _use_sockbuf(size_t len, int flags)
+{
+    /* MSG_TRUNC may report more than was copied */
+    if (flags & MSG_TRUNC)
+        return false;
+
+    /* MSG_WAITALL must not be cut short at the size of a pool buffer */
+    if ((flags & MSG_WAITALL) && len > MYST_SOCKBUF_SIZE)
+        return false;
+
+    return len != 0;
+}
+
+/*
+**==============================================================================
+**
+** The kernel side of TCP sockets:
+**
+**     A TCP socket may keep host data in the kernel to save OCALLs: the
+**     bytes a connection received ahead of the reader (the prefetch buffer)
+**     or the connections a listener accepted ahead of the caller (the accept
+**     queue). The host no longer reports either, so poll(), epoll and
+**     FIONREAD also count them: the socket has a poll queue, notified
+**     whenever more is queued, besides its host file descriptor.
+**
+**     The receive prefetch buffer: protocols that parse their input a few
+**     bytes at a time (a length prefix, then a header, then the body) make
+**     one OCALL per read. With --socket-prefetch-size, a read that is smaller
+**     than the prefetch size receives up to that many bytes from the host
+**     instead and keeps the rest, from where the following reads are served
+**     without leaving the enclave. Larger reads go straight to the host once
+**     the buffer is empty.
+**
+**     The accept queue: with --accept-batch, an accept() that finds the
+**     queue empty accepts the pending connections of the listener with a
+**     single OCALL (see myst_tcall_accept_batch()) and queues all but the
+**     first for the following calls.
+**
+**==============================================================================
+*/
+
+struct tcp
+{
+    size_t refs;        /* the socket and its dups */
+    myst_pollq_t pollq; /* notified when bytes or connections are queued */
+
+    /* the receive prefetch buffer */
+    myst_mutex_t mutex; /* held across the host receive to keep byte order */
+    uint8_t* data;      /* allocated by the first refill */
+    size_t off;
+    size_t len; /* the number of buffered bytes */
+
+    /* the accept queue */
+    myst_spinlock_t lock;
+    myst_tcall_accepted_t* conns; /* allocated by listen() */
+    size_t capacity;
+    size_t head;
+    size_t count;  /* the number of queued connections */
+    bool filling;  /* a batch is being accepted into conns[] */
+    int flags;     /* the accept4() flags of the queued connections */
+
+    /* kernel TLS (set by setsockopt(TCP_ULP), see below) */
+    tls_t* tls;
+};
+
+/* Allocate the kernel side of a new socket if it should have one */
+static int _new_tcp(int domain, int type, tcp_t** tcp_out)
+{
+    int ret = 0;
+    tcp_t* tcp;
+
+    *tcp_out = NULL;
+
+    /* kernel TLS may be set up on any TCP socket */
+    if (!__myst_kernel_args.socket_prefetch_size &&
+        __myst_kernel_args.accept_batch <= 1 && !__myst_kernel_args.kernel_tls)
+    {
+        goto done;
+    }
+
+    if (domain != AF_INET && domain != AF_INET6)
+        goto done;
+
+    if ((type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) != SOCK_STREAM)
+        goto done;
+
+    if (!(tcp = calloc(1, sizeof(tcp_t))))
+        ERAISE(-ENOMEM);
+
+    tcp->refs = 1;
+    myst_mutex_init(&tcp->mutex);
+    *tcp_out = tcp;
+
+done:
+    return ret;
+}
+
+static void _free_tls(tls_t* tls);
+
+static void _release_tcp(tcp_t* tcp)
+{
+    if (tcp && __atomic_sub_fetch(&tcp->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        /* close the connections that were never accepted by the caller */
+        for (size_t i = 0; i < tcp->count; i++)
+        {
+            size_t index = (tcp->head + i) % tcp->capacity;
+            long params[6] = {tcp->conns[index].fd};
+            myst_tcall(SYS_close, params);
+        }
+
+        _free_tls(tcp->tls);
+        myst_pollq_destroy(&tcp->pollq);
+        myst_mutex_destroy(&tcp->mutex);
+        free(tcp->data);
+        free(tcp->conns);
+        free(tcp);
+    }
+}
+
+/* The number of bytes buffered (read without the lock, so a hint) */
+static size_t _prefetched(const myst_sock_t* sock)
+{
+    const tcp_t* tcp = sock->tcp;
+    return tcp ? __atomic_load_n(&tcp->len, __ATOMIC_ACQUIRE) : 0;
+}
+
+/* The number of connections queued (a hint like _prefetched()) */
+static size_t _queued(const myst_sock_t* sock)
+{
+    const tcp_t* tcp = sock->tcp;
+    return tcp ? __atomic_load_n(&tcp->count, __ATOMIC_ACQUIRE) : 0;
+}
+
+/* Receive from the host socket into an enclave buffer */
+static ssize_t _recv_host(int fd, void* buf, size_t len, int flags)
+{
+    ssize_t index;
+
+    if (_use_sockbuf(len, flags) && (index = _get_sockbuf()) >= 0)
+        return _recv_sockbuf(index, fd, buf, len, flags);
+
+    {
+        long params[6] = {fd, (long)buf, len, flags};
+        return myst_tcall(SYS_recvfrom, params);
+    }
+}
+
+/* Receive through the prefetch buffer; returns -ENOTSUP if the caller should
+ * receive from the host (no buffer, an empty buffer and a large read, or an
+ * empty buffer and refill false) */
+static ssize_t _prefetch_recv(
+    myst_sock_t* sock,
+    void* buf,
+    size_t len,
+    int flags,
+    bool refill)
+{
+    ssize_t ret = 0;
+    tcp_t* p = sock->tcp;
+    const size_t size = __myst_kernel_args.socket_prefetch_size;
+    bool refilled = false;
+    bool notify = false;
+    size_t n;
+
+    /* out-of-band and error queue data bypass the byte stream */
+    if (!p || !size || !len || (flags & (MSG_OOB | MSG_ERRQUEUE)))
+        return -ENOTSUP;
+
+    myst_mutex_lock(&p->mutex);
+
+    if (p->len == 0)
+    {
+        ssize_t r;
+
+        if (!refill || len >= size)
+        {
+            ret = -ENOTSUP;
+            goto done;
+        }
+
+        /* without memory, fall back to the regular path */
+        if (!p->data && !(p->data = malloc(size)))
+        {
+            ret = -ENOTSUP;
+            goto done;
+        }
+
+        /* blocks like the caller's own receive would (unless nonblocking) */
+        if ((r = _recv_host(sock->fd, p->data, size, flags & MSG_DONTWAIT)) <=
+            0)
+        {
+            ret = r;
+            goto done;
+        }
+
+        p->off = 0;
+        __atomic_store_n(&p->len, (size_t)r, __ATOMIC_RELEASE);
+        refilled = true;
+    }
+
+    n = (len < p->len) ? len : p->len;
+
+    /* TCP discards the bytes for MSG_TRUNC */
+    if (!(flags & MSG_TRUNC))
+        memcpy(buf, p->data + p->off, n);
+
+    if (!(flags & MSG_PEEK))
+    {
+        p->off += n;
+        __atomic_store_n(&p->len, p->len - n, __ATOMIC_RELEASE);
+    }
+
+    ret = (ssize_t)n;
+
+    /* the buffer is empty now, so the host has the rest */
+    if ((flags & MSG_WAITALL) && !(flags & MSG_PEEK) && n < len)
+    {
+        ssize_t r = _recv_host(sock->fd, (uint8_t*)buf + n, len - n, flags);
+
+        if (r > 0)
+            ret += r;
+    }
+
+    notify = refilled && p->len;
+
+done:
+    myst_mutex_unlock(&p->mutex);
+
+    /* the host no longer reports these bytes to pollers */
+    if (notify)
+        myst_pollq_notify(&p->pollq);
+
+    return ret;
+}
+
+/* The recvmsg() of the prefetch buffer (which has no ancillary data) */
+static ssize_t _prefetch_recvmsg(
+    myst_sock_t* sock,
+    struct msghdr* msg,
+    int flags)
+{
+    ssize_t ret = 0;
+    ssize_t len;
+    void* buf = NULL;
+    const bool gather = msg->msg_iovlen != 1;
+    const bool refill = msg->msg_controllen == 0;
+
+    if (!sock->tcp || (!refill && !_prefetched(sock)))
+        return -ENOTSUP;
+
+    if ((len = myst_iov_len(msg->msg_iov, (int)msg->msg_iovlen)) <= 0)
+        return -ENOTSUP;
+
+    if (!gather)
+        buf = msg->msg_iov[0].iov_base;
+    else if (!(buf = myst_scratch_alloc((size_t)len)))
+        return -ENOTSUP;
+
+    ret = _prefetch_recv(sock, buf, (size_t)len, flags, refill);
+
+    if (ret > 0 && gather)
+        myst_iov_scatter(msg->msg_iov, (int)msg->msg_iovlen, buf, (size_t)ret);
+
+    if (ret >= 0)
+    {
+        msg->msg_namelen = 0;
+        msg->msg_controllen = 0;
+        msg->msg_flags = 0;
+    }
+
+    if (gather)
+        myst_scratch_free(buf);
+
+    return ret;
+}
+
+/* Set the accept4() flags of a queued connection accepted with others */
+static int _set_accept_flags(int fd, int have, int want)
+{
+    int ret = 0;
+
+    if ((have ^ want) & SOCK_NONBLOCK)
+    {
+        long params[6] = {fd, F_GETFL};
+        long fl;
+
+        ECHECK((fl = myst_tcall(SYS_fcntl, params)));
+        params[1] = F_SETFL;
+        params[2] = (want & SOCK_NONBLOCK) ? (fl | O_NONBLOCK)
+                                           : (fl & ~O_NONBLOCK);
+        ECHECK(myst_tcall(SYS_fcntl, params));
+    }
+
+    if ((have ^ want) & SOCK_CLOEXEC)
+    {
+        long params[6] = {fd, F_SETFD, (want & SOCK_CLOEXEC) ? FD_CLOEXEC : 0};
+        ECHECK(myst_tcall(SYS_fcntl, params));
+    }
+
+done:
+    return ret;
+}
+
+/* Accept from the accept queue, refilling it if it is empty; returns the new
+ * host fd or -ENOTSUP if the caller should accept from the host (there is no
+ * queue or another thread is accepting a batch) */
+static int _accept_queued(
+    myst_sock_t* sock,
+    struct sockaddr* addr,
+    socklen_t* addrlen,
+    int flags)
+{
+    int ret = 0;
+    tcp_t* tcp = sock->tcp;
+    myst_tcall_accepted_t conn;
+    int have; /* the flags conn was accepted with */
+    bool notify = false;
+    long n = 1;
+
+    if (!tcp || !tcp->conns)
+        return -ENOTSUP;
+
+    myst_spin_lock(&tcp->lock);
+
+    if (tcp->count)
+    {
+        conn = tcp->conns[tcp->head];
+        tcp->head = (tcp->head + 1) % tcp->capacity;
+        __atomic_store_n(&tcp->count, tcp->count - 1, __ATOMIC_RELEASE);
+        have = tcp->flags;
+        myst_spin_unlock(&tcp->lock);
+    }
+    else if (tcp->filling)
+    {
+        myst_spin_unlock(&tcp->lock);
+        return -ENOTSUP;
+    }
+    else
+    {
+        /* the queue is empty, so the batch may start at conns[0] */
+        tcp->filling = true;
+        tcp->head = 0;
+        myst_spin_unlock(&tcp->lock);
+
+        {
+            long params[6] = {
+                sock->fd, (long)tcp->conns, (long)tcp->capacity, flags};
+            n = myst_tcall(MYST_TCALL_ACCEPT_BATCH, params);
+        }
+
+        myst_spin_lock(&tcp->lock);
+        tcp->filling = false;
+
+        if (n > 0)
+        {
+            conn = tcp->conns[0];
+            tcp->head = 1;
+            tcp->flags = flags;
+            __atomic_store_n(&tcp->count, (size_t)n - 1, __ATOMIC_RELEASE);
+            notify = n > 1;
+        }
+
+        myst_spin_unlock(&tcp->lock);
+
+        if (n <= 0)
+            return (n == 0) ? -EINVAL : (int)n;
+
+        have = flags;
+    }
+
+    /* the host no longer reports the queued connections to pollers */
+    if (notify)
+        myst_pollq_notify(&tcp->pollq);
+
+    if ((ret = _set_accept_flags(conn.fd, have, flags)) != 0)
+    {
+        long params[6] = {conn.fd};
+        myst_tcall(SYS_close, params);
+        return ret;
+    }
+
+    if (addr && addrlen)
+    {
+        size_t len = conn.addrlen;
+
+        if (len > sizeof(conn.addr))
+            len = sizeof(conn.addr);
+
+        if (len > *addrlen)
+            len = *addrlen;
+
+        memcpy(addr, conn.addr, len);
+        *addrlen = conn.addrlen;
+    }
+
+    return conn.fd;
+}
+
+/*
+**==============================================================================
+**
+** The shadow of the host socket state:
+**
+**     Event loops call fcntl(F_GETFL), fcntl(F_SETFL, O_NONBLOCK) and
+**     setsockopt() around nearly every connect() and accept(), which would be
+**     an OCALL each. The kernel keeps a copy of the state that only changes
+**     through these calls: the file status flags, the descriptor flags and
+**     the value of a few options once they were set. Reads are answered from
+**     the copy and writes reach the host only when they change something.
+**     The file status flags and options belong to the host socket, so the
+**     copy is shared by its dups; the descriptor flags are kept per fd.
+**
+**==============================================================================
+*/
+
+/* the flags that F_SETFL changes (the others are ignored) */
+#define SETFL_FLAGS (O_APPEND | O_NONBLOCK | O_ASYNC | O_DIRECT | O_NOATIME)
+
+/* the options that read back as set, forwarded until the first set */
+static const struct
+{
+    int level;
+    int optname;
+    bool boolean; /* read back as 0 or 1 */
+} _shadow_opts[] = {
+    {SOL_SOCKET, SO_REUSEADDR, true},
+    {SOL_SOCKET, SO_REUSEPORT, true},
+    {SOL_SOCKET, SO_KEEPALIVE, true},
+    {SOL_SOCKET, SO_BROADCAST, true},
+    {SOL_SOCKET, SO_OOBINLINE, true},
+    {IPPROTO_TCP, TCP_NODELAY, true},
+    {IPPROTO_TCP, TCP_KEEPIDLE, false},
+    {IPPROTO_TCP, TCP_KEEPINTVL, false},
+    {IPPROTO_TCP, TCP_KEEPCNT, false},
+    {IPPROTO_IPV6, IPV6_V6ONLY, true},
+};
+
+#define NUM_SHADOW_OPTS MYST_COUNTOF(_shadow_opts)
+
+struct shadow
+{
+    size_t refs;        /* the socket and its dups */
+    myst_mutex_t mutex; /* held across OCALLs that change the host state */
+    int fl;             /* the file status flags (F_GETFL) or -1 if unknown */
+    uint32_t known;     /* a bit for each of _shadow_opts[] that was set */
+    int opts[NUM_SHADOW_OPTS];
+};
+
+MYST_STATIC_ASSERT(NUM_SHADOW_OPTS <= 32);
+
+static myst_slab_cache_t _shadow_cache =
+    MYST_SLAB_CACHE_INIT("sockdev shadow_t", shadow_t);
+
+/* Allocate the shadow of a new host socket of the given socket() type */
+static shadow_t* _new_shadow(int type)
+{
+    shadow_t* shadow;
+
+    if (!(shadow = myst_slab_alloc(&_shadow_cache)))
+        return NULL;
+
+    shadow->refs = 1;
+    myst_mutex_init(&shadow->mutex);
+    shadow->fl = O_RDWR | ((type & SOCK_NONBLOCK) ? O_NONBLOCK : 0);
+    shadow->known = 0;
+
+    return shadow;
+}
+
+static void _release_shadow(shadow_t* shadow)
+{
+    if (shadow && __atomic_sub_fetch(&shadow->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        myst_mutex_destroy(&shadow->mutex);
+        myst_slab_free(shadow);
+    }
+}
+
+/* Get the index into _shadow_opts[] of an option (or -1) */
+static ssize_t _shadow_opt(int level, int optname)
+{
+    for (size_t i = 0; i < NUM_SHADOW_OPTS; i++)
+    {
+        if (_shadow_opts[i].level == level &&
+            _shadow_opts[i].optname == optname)
+        {
+            return (ssize_t)i;
+        }
+    }
+
+    return -1;
+}
+
+/* Get the file status flags of the socket (from the host if unknown) */
+static long _get_fl(myst_sock_t* sock)
+{
+    long ret = 0;
+    shadow_t* shadow = sock->shadow;
+
+    myst_mutex_lock(&shadow->mutex);
+
+    if ((ret = shadow->fl) < 0)
+    {
+        long params[6] = {sock->fd, F_GETFL};
+
+        if ((ret = myst_tcall(SYS_fcntl, params)) >= 0)
+            shadow->fl = (int)ret;
+    }
+
+    myst_mutex_unlock(&shadow->mutex);
+
+    return ret;
+}
+
+static long _set_fl(myst_sock_t* sock, long arg)
+{
+    long ret = 0;
+    shadow_t* shadow = sock->shadow;
+    int fl;
+
+    myst_mutex_lock(&shadow->mutex);
+    fl = shadow->fl;
+
+    if (fl >= 0 && ((fl ^ arg) & SETFL_FLAGS) == 0)
+        goto done;
+
+    {
+        long params[6] = {sock->fd, F_SETFL, arg};
+        ECHECK(myst_tcall(SYS_fcntl, params));
+    }
+
+    /* a flag the host may refuse quietly leaves the flags unknown */
+    if (fl >= 0 && ((fl ^ arg) & SETFL_FLAGS & ~O_NONBLOCK) == 0)
+        shadow->fl = (fl & ~O_NONBLOCK) | (int)(arg & O_NONBLOCK);
+    else
+        shadow->fl = -1;
+
+done:
+    myst_mutex_unlock(&shadow->mutex);
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** Kernel TLS (--kernel-tls, see myst/ktls.h):
+**
+**     setsockopt(TCP_ULP, "tls") gives a TCP socket its TLS state, which the
+**     host never sees, and TLS_TX and TLS_RX set the keys of a direction.
+**     A send seals its records straight into a pool buffer, from which the
+**     host sends them, so the plaintext never leaves the enclave and is not
+**     copied on the way. A receive reads host bytes (first those the
+**     prefetch buffer still has) into the record buffer, opens each record
+**     there in place and copies its plaintext out. Like the prefetch buffer,
+**     a record that was opened but not read yet makes the socket readable.
+**
+**     Records that were sealed must reach the host whole, so a send that
+**     the host takes part of waits for room for the rest of its buffer, even
+**     on a nonblocking socket (which only seals when the host is writable).
+**
+**==============================================================================
+*/
+
+/* the record buffer holds at least a whole record and what the host sent
+ * after it */
+#define TLS_BUF_SIZE MYST_SOCKBUF_SIZE
+
+MYST_STATIC_ASSERT(TLS_BUF_SIZE >= 2 * MYST_TLS_MAX_RECORD);
+
+/* the size of the names of TCP_ULP (TCP_ULP_NAME_MAX) */
+#define TLS_ULP_NAME_SIZE 16
+
+/* the send flags that mean something to a TLS socket */
+#define TLS_SEND_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL | MSG_MORE | MSG_EOR)
+
+struct tls
+{
+    /* sending (the mutex keeps the records in order) */
+    myst_mutex_t tx_mutex;
+    myst_ktls_t tx;
+    bool tx_ready;  /* the keys are set */
+    uint8_t* tx_buf; /* for sends without a pool buffer */
+
+    /* receiving (under the mutex of the prefetch buffer) */
+    myst_ktls_t rx;
+    bool rx_ready;
+    uint8_t* buf;  /* the record buffer (TLS_BUF_SIZE bytes) */
+    size_t head;   /* the first byte of the records not opened yet */
+    size_t len;    /* the end of the bytes in buf */
+    uint8_t* data; /* the plaintext of the opened record not read yet */
+    size_t size;
+    uint8_t type;  /* the type of the opened record */
+    int error;     /* a bad record fails all later receives, as on Linux */
+    bool readable; /* plaintext, a whole record or the error (a hint) */
+};
+
+static void _free_tls(tls_t* tls)
+{
+    if (tls)
+    {
+        myst_ktls_release(&tls->tx);
+        myst_ktls_release(&tls->rx);
+        myst_mutex_destroy(&tls->tx_mutex);
+
+        /* the plaintext of the last records should not linger either */
+        if (tls->buf)
+            memset(tls->buf, 0, TLS_BUF_SIZE);
+
+        free(tls->buf);
+        free(tls->tx_buf);
+        free(tls);
+    }
+}
+
+static tls_t* _get_tls(const myst_sock_t* sock)
+{
+    const tcp_t* tcp = sock->tcp;
+    return tcp ? __atomic_load_n(&tcp->tls, __ATOMIC_ACQUIRE) : NULL;
+}
+
+/* The TLS state of a socket whose sends (or receives) are sealed */
+static tls_t* _get_tls_tx(const myst_sock_t* sock)
+{
+    tls_t* tls = _get_tls(sock);
+    return (tls && __atomic_load_n(&tls->tx_ready, __ATOMIC_ACQUIRE)) ? tls
+                                                                      : NULL;
+}
+
+static tls_t* _get_tls_rx(const myst_sock_t* sock)
+{
+    tls_t* tls = _get_tls(sock);
+    return (tls && __atomic_load_n(&tls->rx_ready, __ATOMIC_ACQUIRE)) ? tls
+                                                                      : NULL;
+}
+
+/* Whether a receive would not wait for the host (a hint like _prefetched) */
+static bool _tls_readable(const myst_sock_t* sock)
+{
+    const tls_t* tls = _get_tls(sock);
+    return tls && __atomic_load_n(&tls->readable, __ATOMIC_ACQUIRE);
+}
+
+/* setsockopt(TCP_ULP, "tls"); returns -ENOTSUP for the host's protocols */
+static int _tls_set_ulp(myst_sock_t* sock, const void* optval, socklen_t len)
+{
+    int ret = 0;
+    tcp_t* tcp = sock->tcp;
+    char name[TLS_ULP_NAME_SIZE] = {0};
+    tls_t* tls = NULL;
+
+    if (!optval)
+        ERAISE(-EFAULT);
+
+    memcpy(name, optval, (len < sizeof(name)) ? len : sizeof(name) - 1);
+
+    if (!tcp || strcmp(name, "tls") != 0)
+    {
+        ret = -ENOTSUP;
+        goto done;
+    }
+
+    /* as on Linux, only a connected socket takes it */
+    {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        long params[6] = {sock->fd, (long)&addr, (long)&addrlen};
+
+        if (myst_tcall(SYS_getpeername, params) != 0)
+            ERAISE(-ENOTCONN);
+    }
+
+    if (!(tls = calloc(1, sizeof(tls_t))))
+        ERAISE(-ENOMEM);
+
+    myst_mutex_init(&tls->tx_mutex);
+
+    myst_mutex_lock(&tcp->mutex);
+
+    if (!tcp->tls)
+    {
+        __atomic_store_n(&tcp->tls, tls, __ATOMIC_RELEASE);
+        tls = NULL;
+    }
+    else
+        ret = -EEXIST;
+
+    myst_mutex_unlock(&tcp->mutex);
+    ECHECK(ret);
+
+done:
+    _free_tls(tls);
+    return ret;
+}
+
+static int _tls_setsockopt(
+    myst_sock_t* sock,
+    int optname,
+    const void* optval,
+    socklen_t optlen)
+{
+    int ret = 0;
+    tls_t* tls;
+
+    if (!(tls = _get_tls(sock)))
+        ERAISE(-ENOPROTOOPT);
+
+    if (!optval)
+        ERAISE(-EFAULT);
+
+    if (optname == TLS_TX)
+    {
+        myst_mutex_lock(&tls->tx_mutex);
+
+        if (tls->tx_ready)
+            ret = -EBUSY;
+        else if ((ret = myst_ktls_init(&tls->tx, optval, optlen)) == 0)
+            __atomic_store_n(&tls->tx_ready, true, __ATOMIC_RELEASE);
+
+        myst_mutex_unlock(&tls->tx_mutex);
+        ECHECK(ret);
+    }
+    else if (optname == TLS_RX)
+    {
+        myst_mutex_lock(&sock->tcp->mutex);
+
+        if (tls->rx_ready)
+            ret = -EBUSY;
+        else if (!tls->buf && !(tls->buf = malloc(TLS_BUF_SIZE)))
+            ret = -ENOMEM;
+        else if ((ret = myst_ktls_init(&tls->rx, optval, optlen)) == 0)
+            __atomic_store_n(&tls->rx_ready, true, __ATOMIC_RELEASE);
+
+        myst_mutex_unlock(&sock->tcp->mutex);
+        ECHECK(ret);
+    }
+    else
+    {
+        ERAISE(-ENOPROTOOPT);
+    }
+
+done:
+    return ret;
+}
+
+static int _tls_getsockopt(
+    myst_sock_t* sock,
+    int optname,
+    void* optval,
+    socklen_t* optlen)
+{
+    int ret = 0;
+    tls_t* tls;
+
+    if (!(tls = _get_tls(sock)))
+        ERAISE(-ENOPROTOOPT);
+
+    if (!optval || !optlen)
+        ERAISE(-EFAULT);
+
+    if (optname == TLS_TX)
+    {
+        myst_mutex_lock(&tls->tx_mutex);
+        ret = myst_ktls_get_info(&tls->tx, optval, optlen);
+        myst_mutex_unlock(&tls->tx_mutex);
+        ECHECK(ret);
+    }
+    else if (optname == TLS_RX)
+    {
+        myst_mutex_lock(&sock->tcp->mutex);
+        ret = myst_ktls_get_info(&tls->rx, optval, optlen);
+        myst_mutex_unlock(&sock->tcp->mutex);
+        ECHECK(ret);
+    }
+    else
+    {
+        ERAISE(-ENOPROTOOPT);
+    }
+
+done:
+    return ret;
+}
+
+/* Send the sealed records in buf (a pool buffer if index >= 0) */
+static ssize_t _tls_send_records(
+    int fd,
+    ssize_t index,
+    const uint8_t* buf,
+    size_t len,
+    int flags)
+{
+    const long num = (index >= 0) ? MYST_TCALL_HOSTBUF_SEND : SYS_sendto;
+    size_t total = 0;
+
+    while (total < len)
+    {
+        long params[6] = {fd, (long)(buf + total), (long)(len - total), flags};
+        long r = myst_tcall(num, params);
+
+        if (r > 0)
+            total += (size_t)r;
+        else if (r != -EAGAIN && r != -EINTR && r != 0)
+            return r;
+
+        /* wait for room for the rest */
+        if (total < len && r != -EINTR)
+        {
+            struct pollfd fds = {.fd = fd, .events = POLLOUT};
+            myst_tcall_poll(&fds, 1, -1);
+        }
+    }
+
+    return (ssize_t)total;
+}
+
+/* Whether a send on the socket should not wait for the host */
+static bool _tls_nonblocking(myst_sock_t* sock, int flags)
+{
+    long fl;
+    return (flags & MSG_DONTWAIT) || ((fl = _get_fl(sock)) >= 0 &&
+                                      (fl & O_NONBLOCK));
+}
+
+/* Whether the host socket has room for more (without waiting) */
+static bool _tls_writable(myst_sock_t* sock)
+{
+    struct pollfd fds = {.fd = sock->fd, .events = POLLOUT};
+    return myst_tcall_poll(&fds, 1, 0) != 0;
+}
+
+/* Send len bytes as records of the given type */
+static ssize_t _tls_send(
+    myst_sock_t* sock,
+    tls_t* tls,
+    const void* buf,
+    size_t len,
+    int flags,
+    uint8_t type)
+{
+    ssize_t ret = 0;
+    const uint8_t* p = buf;
+    size_t total = 0;
+    bool nonblocking;
+
+    if (flags & ~TLS_SEND_FLAGS)
+        ERAISE(-EOPNOTSUPP);
+
+    if (len && !buf)
+        ERAISE(-EFAULT);
+
+    /* the host sends the records as they are */
+    flags &= MSG_DONTWAIT | MSG_NOSIGNAL;
+    nonblocking = _tls_nonblocking(sock, flags);
+
+    myst_mutex_lock(&tls->tx_mutex);
+
+    while (total < len)
+    {
+        ssize_t index;
+        uint8_t* out;
+        size_t used = 0;
+        size_t sealed = 0;
+        ssize_t r = 0;
+
+        /* a nonblocking send seals nothing that would wait */
+        if (nonblocking && !_tls_writable(sock))
+        {
+            ret = -EAGAIN;
+            break;
+        }
+
+        if ((index = _get_sockbuf()) >= 0)
+            out = _sockbufs[index];
+        else if (tls->tx_buf || (tls->tx_buf = malloc(MYST_SOCKBUF_SIZE)))
+            out = tls->tx_buf;
+        else
+        {
+            ret = -ENOMEM;
+            break;
+        }
+
+        /* fill the buffer with records */
+        while (total + sealed < len &&
+               used + MYST_TLS_OVERHEAD < MYST_SOCKBUF_SIZE)
+        {
+            const size_t room = MYST_SOCKBUF_SIZE - used - MYST_TLS_OVERHEAD;
+            size_t n = len - total - sealed;
+
+            if (n > MYST_TLS_MAX_PLAINTEXT)
+                n = MYST_TLS_MAX_PLAINTEXT;
+
+            if (n > room)
+                n = room;
+
+            if ((r = myst_ktls_seal(
+                     &tls->tx, type, p + total + sealed, n, out + used)) < 0)
+                break;
+
+            used += (size_t)r;
+            sealed += n;
+        }
+
+        if (sealed)
+            r = _tls_send_records(sock->fd, index, out, used, flags);
+
+        if (index >= 0)
+            _put_sockbuf(index, (r > 0) ? (size_t)r : 0, 0);
+
+        if (r < 0)
+        {
+            ret = r;
+            break;
+        }
+
+        total += sealed;
+    }
+
+    myst_mutex_unlock(&tls->tx_mutex);
+
+    /* report the bytes already sent rather than the error */
+    if (total)
+        ret = (ssize_t)total;
+
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+/* The sendmsg() of a TLS socket, which may set the record type */
+static ssize_t _tls_sendmsg(
+    myst_sock_t* sock,
+    tls_t* tls,
+    const struct msghdr* msg,
+    int flags)
+{
+    ssize_t ret = 0;
+    uint8_t type = MYST_TLS_APPLICATION_DATA;
+    void* buf = NULL;
+    ssize_t len;
+
+    if (!msg)
+        ERAISE(-EFAULT);
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg;
+         cmsg = CMSG_NXTHDR((struct msghdr*)msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_TLS)
+            continue;
+
+        if (cmsg->cmsg_type != TLS_SET_RECORD_TYPE ||
+            cmsg->cmsg_len < CMSG_LEN(sizeof(type)))
+        {
+            ERAISE(-EINVAL);
+        }
+
+        type = *CMSG_DATA(cmsg);
+    }
+
+    if (msg->msg_iovlen == 1)
+    {
+        ECHECK((ret = _tls_send(
+                    sock,
+                    tls,
+                    msg->msg_iov[0].iov_base,
+                    msg->msg_iov[0].iov_len,
+                    flags,
+                    type)));
+        goto done;
+    }
+
+    ECHECK((len = myst_iov_len(msg->msg_iov, (int)msg->msg_iovlen)));
+
+    if (len && !(buf = myst_scratch_alloc((size_t)len)))
+        ERAISE(-ENOMEM);
+
+    myst_iov_copy(msg->msg_iov, (int)msg->msg_iovlen, buf);
+    ECHECK((ret = _tls_send(sock, tls, buf, (size_t)len, flags, type)));
+
+done:
+
+    if (buf)
+        myst_scratch_free(buf);
+
+    return ret;
+}
+
+/* Open the next record if all of it is in the record buffer; returns 1 if
+ * it was opened and 0 if more bytes are needed */
+static int _tls_open_next(tls_t* tls)
+{
+    int ret = 0;
+    uint8_t* record = tls->buf + tls->head;
+    const size_t len = tls->len - tls->head;
+    ssize_t size;
+    ssize_t n;
+
+    if (len < MYST_TLS_HEADER_SIZE)
+        goto done;
+
+    ECHECK((size = myst_ktls_record_size(&tls->rx, record)));
+
+    if (len < (size_t)size)
+        goto done;
+
+    ECHECK((n = myst_ktls_open(
+                &tls->rx, record, (size_t)size, &tls->type, &tls->data)));
+
+    tls->head += (size_t)size;
+    tls->size = (size_t)n;
+    ret = 1;
+
+done:
+    return ret;
+}
+
+/* Whether the record buffer has a whole record (or a bad header) */
+static bool _tls_whole_record(const tls_t* tls)
+{
+    const size_t len = tls->len - tls->head;
+    ssize_t size;
+
+    if (len < MYST_TLS_HEADER_SIZE)
+        return false;
+
+    size = myst_ktls_record_size(&tls->rx, tls->buf + tls->head);
+    return size < 0 || len >= (size_t)size;
+}
+
+/* Receive more of the records into the record buffer */
+static ssize_t _tls_fill(myst_sock_t* sock, tls_t* tls, int flags)
+{
+    tcp_t* p = sock->tcp;
+    size_t room;
+    size_t n;
+
+    /* move the partial record to the front (the plaintext was all read) */
+    if (tls->head)
+    {
+        memmove(tls->buf, tls->buf + tls->head, tls->len - tls->head);
+        tls->len -= tls->head;
+        tls->head = 0;
+    }
+
+    room = TLS_BUF_SIZE - tls->len;
+
+    /* the prefetch buffer has the bytes received before the keys were set */
+    if ((n = (p->len < room) ? p->len : room))
+    {
+        memcpy(tls->buf + tls->len, p->data + p->off, n);
+        p->off += n;
+        __atomic_store_n(&p->len, p->len - n, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        ssize_t r;
+
+        if ((r = _recv_host(sock->fd, tls->buf + tls->len, room, flags)) <= 0)
+            return r;
+
+        n = (size_t)r;
+    }
+
+    tls->len += n;
+    return (ssize_t)n;
+}
+
+/* Receive the plaintext of the records; a control record (an alert or a
+ * handshake message) comes alone and only to callers that pass type (which
+ * is set to the type of the records), while others get -EIO as on Linux;
+ * returns -ENOTSUP if the host should receive (no receive keys) */
+static ssize_t _tls_recv(
+    myst_sock_t* sock,
+    void* buf,
+    size_t len,
+    int flags,
+    uint8_t* type)
+{
+    ssize_t ret = 0;
+    tls_t* tls;
+    tcp_t* p = sock->tcp;
+    uint8_t* out = buf;
+    size_t total = 0;
+    bool received = false;
+    bool readable;
+
+    if (!(tls = _get_tls_rx(sock)) || (flags & MSG_ERRQUEUE))
+        return -ENOTSUP;
+
+    if (flags & MSG_OOB)
+        ERAISE(-EOPNOTSUPP);
+
+    myst_mutex_lock(&p->mutex);
+
+    while (total < len && !tls->error)
+    {
+        ssize_t r;
+
+        if (tls->size)
+        {
+            const bool data = tls->type == MYST_TLS_APPLICATION_DATA;
+            const size_t left = len - total;
+            const size_t n = (left < tls->size) ? left : tls->size;
+
+            if (total && !data)
+                break;
+
+            if (!data && !type)
+            {
+                ret = -EIO;
+                break;
+            }
+
+            /* TCP discards the bytes for MSG_TRUNC */
+            if (!(flags & MSG_TRUNC))
+                memcpy(out + total, tls->data, n);
+
+            if (!(flags & MSG_PEEK))
+            {
+                tls->data += n;
+                tls->size -= n;
+            }
+
+            total += n;
+
+            if (type)
+                *type = tls->type;
+
+            if (!data || (flags & MSG_PEEK))
+                break;
+
+            continue;
+        }
+
+        /* empty records are skipped (a zero return would mean the end) */
+        if ((r = _tls_open_next(tls)) < 0)
+            tls->error = (int)r;
+
+        if (r != 0)
+            continue;
+
+        /* return what was received rather than wait for more */
+        if (total && !(flags & MSG_WAITALL))
+            break;
+
+        if ((r = _tls_fill(sock, tls, flags & MSG_DONTWAIT)) <= 0)
+        {
+            /* the end of the connection ends a partial record too */
+            ret = r;
+            break;
+        }
+
+        received = true;
+    }
+
+    if (total)
+        ret = (ssize_t)total;
+    else if (tls->error && ret == 0)
+        ret = tls->error;
+
+    /* a bad record leaves the socket readable, so pollers see the error */
+    readable = tls->size || tls->error || _tls_whole_record(tls);
+    __atomic_store_n(&tls->readable, readable, __ATOMIC_RELEASE);
+
+    myst_mutex_unlock(&p->mutex);
+
+    /* the host no longer reports these records to pollers */
+    if (received && readable)
+        myst_pollq_notify(&p->pollq);
+
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+/* The recvmsg() of a TLS socket, which reports the record type */
+static ssize_t _tls_recvmsg(myst_sock_t* sock, struct msghdr* msg, int flags)
+{
+    ssize_t ret = 0;
+    ssize_t len;
+    void* buf = NULL;
+    const bool gather = msg->msg_iovlen != 1;
+    const bool control = msg->msg_control &&
+                         msg->msg_controllen >= CMSG_SPACE(sizeof(uint8_t));
+    uint8_t type = MYST_TLS_APPLICATION_DATA;
+
+    if (!_get_tls_rx(sock) || (flags & MSG_ERRQUEUE))
+        return -ENOTSUP;
+
+    ECHECK((len = myst_iov_len(msg->msg_iov, (int)msg->msg_iovlen)));
+
+    if (!gather)
+        buf = msg->msg_iov[0].iov_base;
+    else if (len && !(buf = myst_scratch_alloc((size_t)len)))
+        ERAISE(-ENOMEM);
+
+    ECHECK((ret = _tls_recv(
+                sock, buf, (size_t)len, flags, control ? &type : NULL)));
+
+    if (ret > 0 && gather)
+        myst_iov_scatter(msg->msg_iov, (int)msg->msg_iovlen, buf, (size_t)ret);
+
+    msg->msg_namelen = 0;
+    msg->msg_flags = 0;
+
+    if (control)
+    {
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg);
+
+        cmsg->cmsg_level = SOL_TLS;
+        cmsg->cmsg_type = TLS_GET_RECORD_TYPE;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(type));
+        *CMSG_DATA(cmsg) = type;
+        msg->msg_controllen = CMSG_SPACE(sizeof(type));
+    }
+    else
+    {
+        msg->msg_controllen = 0;
+    }
+
+done:
+
+    if (gather && buf)
+        myst_scratch_free(buf);
+
+    return ret;
+}
 
 MYST_INLINE bool _valid_sock(const myst_sock_t* sock)
 {
@@ -30,8 +1440,10 @@ static void _free_sock(myst_sock_t* sock)
 {
     if (sock)
     {
+        _release_tcp(sock->tcp);
+        _release_shadow(sock->shadow);
         memset(sock, 0, sizeof(myst_sock_t));
-        free(sock);
+        myst_slab_free(sock);
     }
 }
 
@@ -43,10 +1455,14 @@ static int _new_sock(myst_sock_t** sock_out)
     if (!sock_out)
         ERAISE(-EINVAL);
 
-    if (!(sock = calloc(1, sizeof(myst_sock_t))))
+    if (!(sock = myst_slab_alloc(&_sock_cache)))
         ERAISE(-ENOMEM);
 
     sock->magic = MAGIC;
+    sock->tcp = NULL;
+    sock->busy_poll_usec = __myst_kernel_args.busy_poll_usec;
+    sock->shadow = NULL;
+    sock->fd_flags = 0;
 
     *sock_out = sock;
     sock = NULL;
@@ -80,6 +1496,10 @@ static int _sd_socket(
         ERAISE(-EINVAL);
 
     ECHECK(_new_sock(&sock));
+    ECHECK(_new_tcp(domain, type, &sock->tcp));
+
+    if (!(sock->shadow = _new_shadow(type)))
+        ERAISE(-ENOMEM);
 
     /* perform syscall */
     {
@@ -88,6 +1508,7 @@ static int _sd_socket(
     }
 
     sock->fd = (int)fd;
+    sock->fd_flags = (type & SOCK_CLOEXEC) ? FD_CLOEXEC : 0;
     *sock_out = sock;
     sock = NULL;
 
@@ -114,10 +1535,13 @@ static int _sd_socketpair(
     if (!sd || !pair)
         ERAISE(-EINVAL);
 
-    if (!(sock0 = calloc(1, sizeof(myst_sock_t))))
+    ECHECK(_new_sock(&sock0));
+    ECHECK(_new_sock(&sock1));
+
+    if (!(sock0->shadow = _new_shadow(type)))
         ERAISE(-ENOMEM);
 
-    if (!(sock1 = calloc(1, sizeof(myst_sock_t))))
+    if (!(sock1->shadow = _new_shadow(type)))
         ERAISE(-ENOMEM);
 
     /* perform syscall */
@@ -126,23 +1550,23 @@ static int _sd_socketpair(
         ECHECK(myst_tcall(SYS_socketpair, params));
     }
 
-    sock0->magic = MAGIC;
     sock0->fd = sv[0];
+    sock0->fd_flags = (type & SOCK_CLOEXEC) ? FD_CLOEXEC : 0;
     pair[0] = sock0;
     sock0 = NULL;
 
-    sock1->magic = MAGIC;
     sock1->fd = sv[1];
+    sock1->fd_flags = pair[0]->fd_flags;
     pair[1] = sock1;
     sock1 = NULL;
 
 done:
 
     if (sock0)
-        free(sock0);
+        _free_sock(sock0);
 
     if (sock1)
-        free(sock1);
+        _free_sock(sock1);
 
     return ret;
 }
@@ -185,13 +1609,30 @@ static int _sd_accept4(
 
     ECHECK(_new_sock(&new_sock));
 
-    /* perform syscall */
+    if (!(new_sock->shadow = _new_shadow(flags)))
+        ERAISE(-ENOMEM);
+
+    /* a connection accepted by a TCP listener is a TCP socket too */
+    if (sock->tcp && (__myst_kernel_args.socket_prefetch_size ||
+                      __myst_kernel_args.kernel_tls))
+    {
+        ECHECK(_new_tcp(AF_INET, SOCK_STREAM, &new_sock->tcp));
+    }
+
+    /* connections accepted by an earlier batch come first */
+    if ((fd = _accept_queued(sock, addr, addrlen, flags)) == -ENOTSUP)
     {
+        /* perform syscall */
         long params[6] = {sock->fd, (long)addr, (long)addrlen, flags};
-        ECHECK((fd = myst_tcall(SYS_accept4, params)));
+        fd = (int)myst_tcall(SYS_accept4, params);
     }
 
+    ECHECK(fd);
+
+    /* as on Linux, connections inherit the listener's SO_BUSY_POLL */
     new_sock->fd = fd;
+    new_sock->fd_flags = (flags & SOCK_CLOEXEC) ? FD_CLOEXEC : 0;
+    new_sock->busy_poll_usec = sock->busy_poll_usec;
     *new_sock_out = new_sock;
     new_sock = NULL;
 
@@ -238,6 +1679,19 @@ static int _sd_listen(myst_sockdev_t* sd, myst_sock_t* sock, int backlog)
         ECHECK(myst_tcall(SYS_listen, params));
     }
 
+    /* a TCP listener gets its accept queue (or accepts one at a time) */
+    if (sock->tcp && !sock->tcp->conns && __myst_kernel_args.accept_batch > 1)
+    {
+        tcp_t* tcp = sock->tcp;
+        size_t capacity = __myst_kernel_args.accept_batch;
+
+        if (capacity > MYST_ACCEPT_BATCH_MAX)
+            capacity = MYST_ACCEPT_BATCH_MAX;
+
+        if ((tcp->conns = calloc(capacity, sizeof(myst_tcall_accepted_t))))
+            tcp->capacity = capacity;
+    }
+
 done:
 
     return ret;
@@ -253,10 +1707,26 @@ static ssize_t _sd_sendto(
     socklen_t addrlen)
 {
     ssize_t ret = 0;
+    ssize_t index;
+    tls_t* tls;
 
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    /* a connected TCP socket ignores the address */
+    if ((tls = _get_tls_tx(sock)))
+    {
+        ECHECK((ret = _tls_send(
+                    sock, tls, buf, len, flags, MYST_TLS_APPLICATION_DATA)));
+        goto done;
+    }
+
+    if (!dest_addr && _use_sockbuf(len, flags) && (index = _get_sockbuf()) >= 0)
+    {
+        ECHECK((ret = _send_sockbuf(index, sock->fd, buf, len, flags)));
+        goto done;
+    }
+
     /* perform syscall */
     {
         long params[6] = {
@@ -269,6 +1739,40 @@ done:
     return ret;
 }
 
+/* Busy poll before a receive that would block (see myst/pollq.h): spin on the
+ * host socket until it is readable or the budget is spent, after which the
+ * caller receives as usual (and blocks if nothing came) */
+static void _busy_poll_recv(myst_sock_t* sock, int flags)
+{
+    struct pollfd fds;
+    long deadline;
+    long fl;
+
+    if (!sock->busy_poll_usec || (flags & MSG_DONTWAIT) || _prefetched(sock) ||
+        _tls_readable(sock))
+    {
+        return;
+    }
+
+    deadline = myst_busy_poll_deadline(sock->busy_poll_usec);
+    fds.fd = sock->fd;
+    fds.events = POLLIN;
+    fds.revents = 0;
+
+    if (myst_tcall_poll(&fds, 1, 0) != 0)
+        return;
+
+    /* a non-blocking receive fails at once anyway, so do not delay it */
+    if ((fl = _get_fl(sock)) < 0 || (fl & O_NONBLOCK))
+        return;
+
+    while (myst_busy_poll_again(deadline))
+    {
+        if (myst_tcall_poll(&fds, 1, 0) != 0)
+            return;
+    }
+}
+
 static ssize_t _sd_recvfrom(
     myst_sockdev_t* sd,
     myst_sock_t* sock,
@@ -279,10 +1783,33 @@ static ssize_t _sd_recvfrom(
     socklen_t* addrlen)
 {
     ssize_t ret = 0;
+    ssize_t index;
 
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    _busy_poll_recv(sock, flags);
+
+    /* small receives are served from the prefetch buffer (and TLS records
+     * are opened first) */
+    if ((ret = _tls_recv(sock, buf, len, flags, NULL)) != -ENOTSUP ||
+        (ret = _prefetch_recv(sock, buf, len, flags, true)) != -ENOTSUP)
+    {
+        ECHECK(ret);
+
+        /* as for any connected TCP socket, there is no source address */
+        if (addrlen)
+            *addrlen = 0;
+
+        goto done;
+    }
+
+    if (!src_addr && _use_sockbuf(len, flags) && (index = _get_sockbuf()) >= 0)
+    {
+        ECHECK((ret = _recv_sockbuf(index, sock->fd, buf, len, flags)));
+        goto done;
+    }
+
     /* perform syscall */
     {
         long params[6] = {
@@ -302,10 +1829,17 @@ static int _sd_sendmsg(
     int flags)
 {
     ssize_t ret = 0;
+    tls_t* tls;
 
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if ((tls = _get_tls_tx(sock)))
+    {
+        ECHECK((ret = _tls_sendmsg(sock, tls, msg, flags)));
+        goto done;
+    }
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, (long)msg, flags};
@@ -327,6 +1861,15 @@ static int _sd_recvmsg(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    _busy_poll_recv(sock, flags);
+
+    if (msg && ((ret = _tls_recvmsg(sock, msg, flags)) != -ENOTSUP ||
+                (ret = _prefetch_recvmsg(sock, msg, flags)) != -ENOTSUP))
+    {
+        ECHECK(ret);
+        goto done;
+    }
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, (long)msg, flags};
@@ -337,6 +1880,99 @@ done:
     return ret;
 }
 
+/* The host sends the whole batch in a single OCALL (see myst_sendmmsg_ocall) */
+static int _sd_sendmmsg(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags)
+{
+    int ret = 0;
+    tls_t* tls;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EINVAL);
+
+    /* each message is sealed in turn, stopping at the first error */
+    if ((tls = _get_tls_tx(sock)))
+    {
+        ssize_t r = 0;
+
+        if (!msgvec && vlen)
+            ERAISE(-EFAULT);
+
+        for (; (unsigned int)ret < vlen; ret++)
+        {
+            if ((r = _tls_sendmsg(sock, tls, &msgvec[ret].msg_hdr, flags)) < 0)
+                break;
+
+            msgvec[ret].msg_len = (unsigned int)r;
+        }
+
+        if (ret == 0 && r < 0)
+            ERAISE((int)r);
+
+        goto done;
+    }
+
+    /* perform syscall */
+    {
+        long params[6] = {sock->fd, (long)msgvec, vlen, flags};
+        ECHECK((ret = (int)myst_tcall(SYS_sendmmsg, params)));
+    }
+
+done:
+    return ret;
+}
+
+static int _sd_recvmmsg(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    struct timespec* timeout)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EINVAL);
+
+    /* the plaintext of TLS records comes as one message */
+    if (msgvec && vlen && _get_tls_rx(sock) && !(flags & MSG_ERRQUEUE))
+    {
+        struct msghdr* msg = &msgvec[0].msg_hdr;
+        ssize_t r;
+
+        ECHECK((r = _tls_recvmsg(sock, msg, flags & ~MSG_WAITFORONE)));
+        msgvec[0].msg_len = (unsigned int)r;
+        ret = 1;
+        goto done;
+    }
+
+    /* prefetched bytes come first (as a single message) */
+    if (msgvec && vlen && _prefetched(sock))
+    {
+        struct msghdr* msg = &msgvec[0].msg_hdr;
+        ssize_t r;
+
+        ECHECK((r = _prefetch_recvmsg(sock, msg, flags & ~MSG_WAITFORONE)));
+        msgvec[0].msg_len = (unsigned int)r;
+        ret = 1;
+        goto done;
+    }
+
+    /* perform syscall */
+    {
+        long params[6] = {sock->fd, (long)msgvec, vlen, flags, (long)timeout};
+        ECHECK((ret = (int)myst_tcall(SYS_recvmmsg, params)));
+    }
+
+done:
+    return ret;
+}
+
 static int _sd_shutdown(myst_sockdev_t* sd, myst_sock_t* sock, int how)
 {
     ssize_t ret = 0;
@@ -363,10 +1999,68 @@ static int _sd_getsockopt(
     socklen_t* optlen)
 {
     ssize_t ret = 0;
+    ssize_t i;
 
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    /* the kernel does the busy polling, so the host never sees the option */
+    if (level == SOL_SOCKET && optname == SO_BUSY_POLL)
+    {
+        const int val = (int)sock->busy_poll_usec;
+
+        if (!optval || !optlen)
+            ERAISE(-EFAULT);
+
+        if (*optlen > sizeof(val))
+            *optlen = sizeof(val);
+
+        memcpy(optval, &val, *optlen);
+        goto done;
+    }
+
+    /* the host knows nothing of kernel TLS */
+    if (__myst_kernel_args.kernel_tls && level == SOL_TLS)
+    {
+        ECHECK(_tls_getsockopt(sock, optname, optval, optlen));
+        goto done;
+    }
+
+    if (level == IPPROTO_TCP && optname == TCP_ULP && _get_tls(sock))
+    {
+        const char name[TLS_ULP_NAME_SIZE] = "tls";
+
+        if (!optval || !optlen)
+            ERAISE(-EFAULT);
+
+        if (*optlen > sizeof(name))
+            *optlen = sizeof(name);
+
+        memcpy(optval, name, *optlen);
+        goto done;
+    }
+
+    /* answer from the shadow if the option was set */
+    if ((i = _shadow_opt(level, optname)) >= 0 && optval && optlen &&
+        *optlen >= sizeof(int))
+    {
+        shadow_t* shadow = sock->shadow;
+        bool known;
+        int val;
+
+        myst_mutex_lock(&shadow->mutex);
+        known = shadow->known & (1U << i);
+        val = shadow->opts[i];
+        myst_mutex_unlock(&shadow->mutex);
+
+        if (known)
+        {
+            memcpy(optval, &val, sizeof(val));
+            *optlen = sizeof(val);
+            goto done;
+        }
+    }
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, level, optname, (long)optval, (long)optlen};
@@ -386,10 +2080,76 @@ static int _sd_setsockopt(
     socklen_t optlen)
 {
     ssize_t ret = 0;
+    ssize_t i;
 
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if (level == SOL_SOCKET && optname == SO_BUSY_POLL)
+    {
+        int val;
+
+        if (!optval)
+            ERAISE(-EFAULT);
+
+        if (optlen < sizeof(val))
+            ERAISE(-EINVAL);
+
+        memcpy(&val, optval, sizeof(val));
+
+        if (val < 0)
+            ERAISE(-EINVAL);
+
+        sock->busy_poll_usec = (unsigned int)val;
+        goto done;
+    }
+
+    /* the kernel is the TLS upper layer (and the keys stay here) */
+    if (__myst_kernel_args.kernel_tls && level == IPPROTO_TCP &&
+        optname == TCP_ULP &&
+        (ret = _tls_set_ulp(sock, optval, optlen)) != -ENOTSUP)
+    {
+        ECHECK(ret);
+        goto done;
+    }
+
+    if (__myst_kernel_args.kernel_tls && level == SOL_TLS)
+    {
+        ECHECK(_tls_setsockopt(sock, optname, optval, optlen));
+        goto done;
+    }
+
+    /* only send a shadowed option that changes */
+    if ((i = _shadow_opt(level, optname)) >= 0 && optval &&
+        optlen >= sizeof(int))
+    {
+        shadow_t* shadow = sock->shadow;
+        int val;
+
+        memcpy(&val, optval, sizeof(val));
+
+        if (_shadow_opts[i].boolean)
+            val = !!val;
+
+        myst_mutex_lock(&shadow->mutex);
+
+        if (!(shadow->known & (1U << i)) || shadow->opts[i] != val)
+        {
+            long params[6] = {
+                sock->fd, level, optname, (long)optval, (long)optlen};
+
+            if ((ret = myst_tcall(SYS_setsockopt, params)) == 0)
+            {
+                shadow->known |= (1U << i);
+                shadow->opts[i] = val;
+            }
+        }
+
+        myst_mutex_unlock(&shadow->mutex);
+        ECHECK(ret);
+        goto done;
+    }
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, level, optname, (long)optval, (long)optlen};
@@ -449,10 +2209,27 @@ static ssize_t _sd_read(
     size_t count)
 {
     ssize_t ret = 0;
+    ssize_t index;
 
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    _busy_poll_recv(sock, 0);
+
+    /* small reads are served from the prefetch buffer (after TLS records) */
+    if ((ret = _tls_recv(sock, buf, count, 0, NULL)) != -ENOTSUP ||
+        (ret = _prefetch_recv(sock, buf, count, 0, true)) != -ENOTSUP)
+    {
+        ECHECK(ret);
+        goto done;
+    }
+
+    if (_use_sockbuf(count, 0) && (index = _get_sockbuf()) >= 0)
+    {
+        ECHECK((ret = _recv_sockbuf(index, sock->fd, buf, count, 0)));
+        goto done;
+    }
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, (long)buf, count};
@@ -470,10 +2247,25 @@ static ssize_t _sd_write(
     size_t count)
 {
     ssize_t ret = 0;
+    ssize_t index;
+    tls_t* tls;
 
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if ((tls = _get_tls_tx(sock)))
+    {
+        ECHECK((ret = _tls_send(
+                    sock, tls, buf, count, 0, MYST_TLS_APPLICATION_DATA)));
+        goto done;
+    }
+
+    if (_use_sockbuf(count, 0) && (index = _get_sockbuf()) >= 0)
+    {
+        ECHECK((ret = _send_sockbuf(index, sock->fd, buf, count, 0)));
+        goto done;
+    }
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, (long)buf, count};
@@ -551,12 +2343,39 @@ static int _sd_ioctl(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    /* FIONBIO sets O_NONBLOCK (through the shadow) */
+    if (request == FIONBIO)
+    {
+        long fl;
+        int on;
+
+        if (!arg)
+            ERAISE(-EFAULT);
+
+        memcpy(&on, (const void*)arg, sizeof(on));
+        ECHECK((fl = _get_fl(sock)));
+        ECHECK(_set_fl(sock, on ? (fl | O_NONBLOCK) : (fl & ~O_NONBLOCK)));
+        goto done;
+    }
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, request, arg};
         ECHECK(myst_tcall(SYS_ioctl, params));
     }
 
+    /* the host does not know about the prefetched bytes (or the plaintext
+     * of the opened TLS records) */
+    if (request == FIONREAD && arg)
+    {
+        const tls_t* tls = _get_tls(sock);
+
+        *(int*)arg += (int)_prefetched(sock);
+
+        if (tls)
+            *(int*)arg += (int)__atomic_load_n(&tls->size, __ATOMIC_RELAXED);
+    }
+
 done:
     return ret;
 }
@@ -568,6 +2387,39 @@ static int _sd_fcntl(myst_sockdev_t* sd, myst_sock_t* sock, int cmd, long arg)
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    /* the flags come from the shadow (see above) */
+    switch (cmd)
+    {
+        case F_GETFL:
+        {
+            ECHECK((ret = _get_fl(sock)));
+            goto done;
+        }
+        case F_SETFL:
+        {
+            ECHECK(_set_fl(sock, arg));
+            goto done;
+        }
+        case F_GETFD:
+        {
+            ret = sock->fd_flags;
+            goto done;
+        }
+        case F_SETFD:
+        {
+            const int fd_flags = (arg & FD_CLOEXEC) ? FD_CLOEXEC : 0;
+
+            if (fd_flags != sock->fd_flags)
+            {
+                long params[6] = {sock->fd, F_SETFD, fd_flags};
+                ECHECK(myst_tcall(SYS_fcntl, params));
+                sock->fd_flags = fd_flags;
+            }
+
+            goto done;
+        }
+    }
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, cmd, arg};
@@ -593,7 +2445,7 @@ static int _sd_dup(
     if (!sd || !_valid_sock(sock) || !sock_out)
         ERAISE(-EINVAL);
 
-    if (!(new_sock = calloc(1, sizeof(myst_sock_t))))
+    if (!(new_sock = myst_slab_alloc(&_sock_cache)))
         ERAISE(-ENOMEM);
 
     /* perform syscall */
@@ -604,13 +2456,24 @@ static int _sd_dup(
 
     new_sock->magic = MAGIC;
     new_sock->fd = (int)fd;
+    new_sock->busy_poll_usec = sock->busy_poll_usec;
+
+    /* both descriptors read the same byte stream */
+    if ((new_sock->tcp = sock->tcp))
+        __atomic_add_fetch(&new_sock->tcp->refs, 1, __ATOMIC_RELAXED);
+
+    /* and share the file status flags and options (but not FD_CLOEXEC) */
+    new_sock->shadow = sock->shadow;
+    __atomic_add_fetch(&new_sock->shadow->refs, 1, __ATOMIC_RELAXED);
+    new_sock->fd_flags = 0;
+
     *sock_out = new_sock;
     new_sock = NULL;
 
 done:
 
     if (new_sock)
-        free(new_sock);
+        myst_slab_free(new_sock);
 
     return ret;
 }
@@ -622,14 +2485,10 @@ static int _sd_close(myst_sockdev_t* sd, myst_sock_t* sock)
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
-    /* perform syscall */
-    {
-        long params[6] = {sock->fd};
-        ECHECK((ret = myst_tcall(SYS_close, params)));
-    }
+    /* the host close may be deferred (see --async-close) */
+    ECHECK((ret = myst_host_close(sock->fd)));
 
-    memset(sock, 0, sizeof(myst_sock_t));
-    free(sock);
+    _free_sock(sock);
 
 done:
     return ret;
@@ -648,6 +2507,7 @@ done:
     return ret;
 }
 
+/* The events of the kernel side of TCP sockets (the host reports all others) */
 static int _sd_get_events(myst_sockdev_t* sd, myst_sock_t* sock)
 {
     int ret = 0;
@@ -655,13 +2515,33 @@ static int _sd_get_events(myst_sockdev_t* sd, myst_sock_t* sock)
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
-    ret = sock->fd;
+    if (_prefetched(sock) || _queued(sock) || _tls_readable(sock))
+        ret = POLLIN | POLLRDNORM;
 
 done:
     return ret;
 }
 
-extern myst_sockdev_t* myst_sockdev_get(void)
+/* Only TCP sockets with a kernel side are polled in the kernel as well */
+static myst_pollq_t* _sd_pollq(myst_sockdev_t* sd, myst_sock_t* sock)
+{
+    if (!sd || !_valid_sock(sock) || !sock->tcp)
+        return NULL;
+
+    return &sock->tcp->pollq;
+}
+
+extern unsigned int myst_sockdev_busy_poll(myst_sock_t* sock)
+{
+    return _valid_sock(sock) ? sock->busy_poll_usec : 0;
+}
+
+bool myst_sockdev_kernel_tls(myst_sock_t* sock)
+{
+    return _valid_sock(sock) && _get_tls_tx(sock);
+}
+
+myst_sockdev_t* myst_sockdev_get(void)
 {
     // clang-format-off
     static myst_sockdev_t _sockdev = {
@@ -677,6 +2557,7 @@ extern myst_sockdev_t* myst_sockdev_get(void)
             .fd_close = (void*)_sd_close,
             .fd_target_fd = (void*)_sd_target_fd,
             .fd_get_events = (void*)_sd_get_events,
+            .fd_pollq = (void*)_sd_pollq,
         },
         .sd_socket = _sd_socket,
         .sd_socketpair = _sd_socketpair,
@@ -688,6 +2569,8 @@ extern myst_sockdev_t* myst_sockdev_get(void)
         .sd_recvfrom = _sd_recvfrom,
         .sd_sendmsg = _sd_sendmsg,
         .sd_recvmsg = _sd_recvmsg,
+        .sd_sendmmsg = _sd_sendmmsg,
+        .sd_recvmmsg = _sd_recvmmsg,
         .sd_shutdown = _sd_shutdown,
         .sd_getsockopt = _sd_getsockopt,
         .sd_setsockopt = _sd_setsockopt,
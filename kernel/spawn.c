@@ -0,0 +1,316 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <myst/cond.h>
+#include <myst/eraise.h>
+#include <myst/exec.h>
+#include <myst/kernel.h>
+#include <myst/mutex.h>
+#include <myst/realpath.h>
+#include <myst/setjmp.h>
+#include <myst/signal.h>
+#include <myst/spawn.h>
+#include <myst/syscall.h>
+#include <myst/thread.h>
+
+/*
+**==============================================================================
+**
+** posix_spawn() without vfork().
+**
+**     The parent creates the child process and waits. The child applies the
+**     attributes and file actions directly to its own signal state and
+**     descriptor table (which it shares copy-on-write with the parent), then
+**     execs the program. The parent learns the outcome from the exec
+**     callback (which runs just before the new C runtime is entered) or
+**     from the failure, so errors reach posix_spawn() without a pipe.
+**
+**==============================================================================
+*/
+
+typedef struct spawn
+{
+    _Atomic(size_t) refs; /* held by the parent and by the child */
+    const myst_spawn_args_t* args;
+    const char** argv; /* args->argv with the resolved path as argv[0] */
+    myst_path_t path;
+    myst_mutex_t mutex;
+    myst_cond_t cond;
+    bool done;
+    long error;
+} spawn_t;
+
+static void _release(spawn_t* s)
+{
+    if (--s->refs == 0)
+    {
+        free(s->argv);
+        free(s);
+    }
+}
+
+/* Tell the parent how the spawn went (the child drops its reference) */
+static void _finish(spawn_t* s, long error)
+{
+    myst_mutex_lock(&s->mutex);
+    s->error = error;
+    s->done = true;
+    myst_cond_signal(&s->cond);
+    myst_mutex_unlock(&s->mutex);
+
+    _release(s);
+}
+
+/* Called by myst_exec() once the program is about to run */
+static void _exec_callback(void* arg)
+{
+    _finish((spawn_t*)arg, 0);
+}
+
+static long _set_signals(const myst_spawn_args_t* args)
+{
+    long ret = 0;
+
+    if (args->flags & MYST_SPAWN_SETSIGDEF)
+    {
+        uint64_t mask;
+        posix_sigaction_t act;
+
+        memcpy(&mask, &args->sigdefault, sizeof(mask));
+        memset(&act, 0, sizeof(act));
+        act.handler = (uint64_t)SIG_DFL;
+
+        for (unsigned sig = 1; sig <= 64; sig++)
+        {
+            if (!(mask & (1UL << (sig - 1))))
+                continue;
+
+            if (sig == SIGKILL || sig == SIGSTOP)
+                continue;
+
+            ECHECK(myst_signal_sigaction(sig, &act, NULL));
+        }
+    }
+
+    if (args->flags & MYST_SPAWN_SETSIGMASK)
+        ECHECK(myst_signal_sigprocmask(SIG_SETMASK, &args->sigmask, NULL));
+
+    /* ATTN: sessions are not supported (nor is setsid()) */
+    if (args->flags & MYST_SPAWN_SETSID)
+        ERAISE(-ENOSYS);
+
+done:
+    return ret;
+}
+
+static long _apply_action(const myst_spawn_action_t* a)
+{
+    long ret = 0;
+
+    switch (a->cmd)
+    {
+        case MYST_SPAWN_CLOSE:
+        {
+            /* as with musl, closing a closed descriptor is not an error */
+            myst_syscall_close(a->fd);
+            break;
+        }
+        case MYST_SPAWN_DUP2:
+        {
+            if (a->srcfd == a->fd)
+            {
+                /* the descriptor stays, but without FD_CLOEXEC */
+                long flags;
+                ECHECK(flags = myst_syscall_fcntl(a->fd, F_GETFD, 0));
+                ECHECK(myst_syscall_fcntl(a->fd, F_SETFD, flags & ~FD_CLOEXEC));
+            }
+            else
+            {
+                ECHECK(myst_syscall_dup2(a->srcfd, a->fd));
+            }
+            break;
+        }
+        case MYST_SPAWN_OPEN:
+        {
+            long fd;
+
+            ECHECK(fd = myst_syscall_open(a->path, a->oflag, a->mode));
+
+            if (fd != a->fd)
+            {
+                long r = myst_syscall_dup2((int)fd, a->fd);
+                myst_syscall_close((int)fd);
+                ECHECK(r);
+            }
+            break;
+        }
+        case MYST_SPAWN_CHDIR:
+        {
+            ECHECK(myst_syscall_chdir(a->path));
+            break;
+        }
+        case MYST_SPAWN_FCHDIR:
+        {
+            /* ATTN: fchdir() is not supported */
+            ERAISE(-ENOSYS);
+        }
+        default:
+        {
+            ERAISE(-EINVAL);
+        }
+    }
+
+done:
+    return ret;
+}
+
+/* Resolve the program path (now that the actions may have changed the
+ * working directory) and check that it names a file */
+static long _resolve_path(spawn_t* s)
+{
+    long ret = 0;
+    struct stat st;
+
+    ECHECK(myst_realpath(s->args->path, &s->path));
+    ECHECK(myst_syscall_stat(s->path.buf, &st));
+
+    if (S_ISDIR(st.st_mode))
+        ERAISE(-EACCES);
+
+    s->argv[0] = s->path.buf;
+
+done:
+    return ret;
+}
+
+static size_t _count(char* const* v)
+{
+    size_t n = 0;
+
+    if (v)
+    {
+        while (v[n])
+            n++;
+    }
+
+    return n;
+}
+
+/* The main function of the child process */
+static int _child(void* arg)
+{
+    spawn_t* s = (spawn_t*)arg;
+    const myst_spawn_args_t* args = s->args;
+    myst_thread_t* thread = myst_thread_self();
+    long ret = 0;
+
+    ECHECK(_set_signals(args));
+
+    for (size_t i = 0; i < args->num_actions; i++)
+        ECHECK(_apply_action(&args->actions[i]));
+
+    ECHECK(_resolve_path(s));
+
+    /* only returns on failure (the callback signals the parent first) */
+    ret = myst_exec(
+        thread,
+        __myst_kernel_args.crt_data,
+        __myst_kernel_args.crt_size,
+        __myst_kernel_args.crt_reloc_data,
+        __myst_kernel_args.crt_reloc_size,
+        _count((char* const*)s->argv),
+        s->argv,
+        _count(args->envp),
+        (const char**)args->envp,
+        _exec_callback,
+        s);
+
+    if (ret == 0)
+        ret = -ENOEXEC;
+
+done:
+    _finish(s, ret);
+
+    /* exit as the child of a failed posix_spawn() does */
+    thread->exit_status = 127;
+    myst_longjmp(&thread->jmpbuf, 1);
+
+    /* unreachable */
+    return 0;
+}
+
+long myst_syscall_spawn(const myst_spawn_args_t* args)
+{
+    long ret = 0;
+    spawn_t* s = NULL;
+    size_t argc;
+    long pid;
+    long error;
+
+    if (!args || !args->path || !args->argv)
+        ERAISE(-EINVAL);
+
+    if (args->num_actions && !args->actions)
+        ERAISE(-EINVAL);
+
+    if (!(s = calloc(1, sizeof(spawn_t))))
+        ERAISE(-ENOMEM);
+
+    /* room for argv[0] (even if argv is empty) and the terminator */
+    argc = _count(args->argv);
+
+    if (!(s->argv = calloc((argc ? argc : 1) + 1, sizeof(char*))))
+        ERAISE(-ENOMEM);
+
+    for (size_t i = 1; i < argc; i++)
+        s->argv[i] = args->argv[i];
+
+    s->args = args;
+    s->refs = 2;
+
+    if ((pid = myst_syscall_clone(
+             _child, NULL, CLONE_VFORK, s, NULL, NULL, NULL)) < 0)
+    {
+        ERAISE(pid);
+    }
+
+    /* wait until the child enters the program or fails */
+    myst_mutex_lock(&s->mutex);
+
+    while (!s->done)
+        myst_cond_wait(&s->cond, &s->mutex);
+
+    error = s->error;
+    myst_mutex_unlock(&s->mutex);
+
+    _release(s);
+    s = NULL;
+
+    if (error)
+    {
+        /* reap the child, which exits right away */
+        int wstatus;
+        myst_syscall_wait4((pid_t)pid, &wstatus, 0, NULL);
+        ERAISE(error);
+    }
+
+    ret = pid;
+
+done:
+
+    if (s)
+    {
+        free(s->argv);
+        free(s);
+    }
+
+    return ret;
+}
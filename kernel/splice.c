@@ -0,0 +1,233 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include <myst/eraise.h>
+#include <myst/fdtable.h>
+#include <myst/pipedev.h>
+#include <myst/syscall.h>
+
+/*
+**==============================================================================
+**
+** splice(), tee() and vmsplice()
+**
+**     Bytes move straight between the pipe's circular buffer and the other
+**     file descriptor (a file, a socket or another pipe), so they are copied
+**     once rather than bouncing through a user buffer as read() followed by
+**     write() would.
+**
+**==============================================================================
+*/
+
+#define SPLICE_FLAGS \
+    (SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT)
+
+typedef struct splice_fd
+{
+    int fd;
+    off_t* offset; /* null to use (and update) the file offset */
+} splice_fd_t;
+
+typedef struct splice_pipe
+{
+    myst_pipedev_t* pipedev;
+    myst_pipe_t* pipe;
+    int flags; /* MYST_PIPE_NONBLOCK */
+} splice_pipe_t;
+
+/* Get the pipe for fd; returns -EINVAL if fd is not a pipe */
+static int _get_pipe(int fd, myst_pipedev_t** pipedev, myst_pipe_t** pipe)
+{
+    int ret = 0;
+    myst_fdtable_t* fdtable;
+    myst_fdtable_type_t type;
+
+    if (!(fdtable = myst_fdtable_current()))
+        ERAISE(-ENOSYS);
+
+    ECHECK(myst_fdtable_get_any(
+        fdtable, fd, &type, (void**)pipedev, (void**)pipe));
+
+    if (type != MYST_FDTABLE_TYPE_PIPE)
+        ret = -EINVAL;
+
+done:
+    return ret;
+}
+
+static ssize_t _write_fd(void* arg, const void* data, size_t n)
+{
+    splice_fd_t* f = arg;
+    long r;
+
+    if (!f->offset)
+        return myst_syscall_write(f->fd, data, n);
+
+    if ((r = myst_syscall_pwrite(f->fd, data, n, *f->offset)) > 0)
+        *f->offset += r;
+
+    return r;
+}
+
+static ssize_t _read_fd(void* arg, void* space, size_t n)
+{
+    splice_fd_t* f = arg;
+    long r;
+
+    if (!f->offset)
+        return myst_syscall_read(f->fd, space, n);
+
+    if ((r = myst_syscall_pread(f->fd, space, n, *f->offset)) > 0)
+        *f->offset += r;
+
+    return r;
+}
+
+static ssize_t _copy_in(void* arg, void* space, size_t n)
+{
+    const void** data = arg;
+    memcpy(space, *data, n);
+    *data = (const uint8_t*)*data + n;
+    return (ssize_t)n;
+}
+
+/* Move bytes from one pipe's buffer into another's */
+static ssize_t _write_pipe(void* arg, const void* data, size_t n)
+{
+    splice_pipe_t* out = arg;
+
+    return (*out->pipedev->pd_splice_write)(
+        out->pipedev, out->pipe, _copy_in, &data, n, out->flags);
+}
+
+long myst_syscall_splice(
+    int fd_in,
+    off_t* off_in,
+    int fd_out,
+    off_t* off_out,
+    size_t len,
+    unsigned int flags)
+{
+    long ret = 0;
+    splice_pipe_t in;
+    splice_pipe_t out;
+    int rin;
+    int rout;
+    const int pflags = (flags & SPLICE_F_NONBLOCK) ? MYST_PIPE_NONBLOCK : 0;
+
+    if (flags & ~SPLICE_FLAGS)
+        ERAISE(-EINVAL);
+
+    /* at least one side must be a pipe */
+    if ((rin = _get_pipe(fd_in, &in.pipedev, &in.pipe)) != 0 && rin != -EINVAL)
+        ERAISE(rin);
+
+    rout = _get_pipe(fd_out, &out.pipedev, &out.pipe);
+
+    if (rout != 0 && rout != -EINVAL)
+        ERAISE(rout);
+
+    if (rin != 0 && rout != 0)
+        ERAISE(-EINVAL);
+
+    /* pipes have no file offset */
+    if ((rin == 0 && off_in) || (rout == 0 && off_out))
+        ERAISE(-ESPIPE);
+
+    if (rin == 0 && rout == 0)
+    {
+        /* a pipe cannot be spliced into itself */
+        if (myst_pipe_same(in.pipe, out.pipe))
+            ERAISE(-EINVAL);
+
+        out.flags = pflags;
+        ECHECK(
+            ret = (*in.pipedev->pd_splice_read)(
+                in.pipedev, in.pipe, _write_pipe, &out, len, pflags));
+    }
+    else if (rin == 0)
+    {
+        splice_fd_t f = {fd_out, off_out};
+        ECHECK(
+            ret = (*in.pipedev->pd_splice_read)(
+                in.pipedev, in.pipe, _write_fd, &f, len, pflags));
+    }
+    else
+    {
+        splice_fd_t f = {fd_in, off_in};
+        ECHECK(
+            ret = (*out.pipedev->pd_splice_write)(
+                out.pipedev, out.pipe, _read_fd, &f, len, pflags));
+    }
+
+done:
+    return ret;
+}
+
+long myst_syscall_tee(int fd_in, int fd_out, size_t len, unsigned int flags)
+{
+    long ret = 0;
+    splice_pipe_t in;
+    splice_pipe_t out;
+    const int pflags = (flags & SPLICE_F_NONBLOCK) ? MYST_PIPE_NONBLOCK : 0;
+
+    if (flags & ~SPLICE_FLAGS)
+        ERAISE(-EINVAL);
+
+    /* both sides must be pipes */
+    ECHECK(_get_pipe(fd_in, &in.pipedev, &in.pipe));
+    ECHECK(_get_pipe(fd_out, &out.pipedev, &out.pipe));
+
+    if (myst_pipe_same(in.pipe, out.pipe))
+        ERAISE(-EINVAL);
+
+    out.flags = pflags;
+    ECHECK(
+        ret = (*in.pipedev->pd_splice_read)(
+            in.pipedev,
+            in.pipe,
+            _write_pipe,
+            &out,
+            len,
+            pflags | MYST_PIPE_PEEK));
+
+done:
+    return ret;
+}
+
+long myst_syscall_vmsplice(
+    int fd,
+    const struct iovec* iov,
+    size_t nr_segs,
+    unsigned int flags)
+{
+    long ret = 0;
+    myst_pipedev_t* pipedev;
+    myst_pipe_t* pipe;
+    long fl;
+
+    if (flags & ~SPLICE_FLAGS)
+        ERAISE(-EINVAL);
+
+    if (nr_segs > IOV_MAX)
+        ERAISE(-EINVAL);
+
+    if (_get_pipe(fd, &pipedev, &pipe) != 0)
+        ERAISE(-EBADF);
+
+    /* user pages cannot be shared with the pipe, so copy them as writev() */
+    ECHECK(fl = (*pipedev->pd_fcntl)(pipedev, pipe, F_GETFL, 0));
+
+    if ((fl & O_ACCMODE) == O_WRONLY)
+        ECHECK(ret = myst_syscall_writev(fd, iov, (int)nr_segs));
+    else
+        ECHECK(ret = myst_syscall_readv(fd, iov, (int)nr_segs));
+
+done:
+    return ret;
+}
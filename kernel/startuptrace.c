@@ -0,0 +1,68 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <string.h>
+#include <time.h>
+
+#include <myst/clock.h>
+#include <myst/kernel.h>
+#include <myst/startuptrace.h>
+#include <myst/strings.h>
+#include <myst/syscall.h>
+
+uint64_t myst_startup_trace_now(void)
+{
+    struct timespec ts;
+
+    if (!__myst_kernel_args.startup_trace)
+        return 0;
+
+    if (myst_syscall_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+
+    return (uint64_t)ts.tv_sec * NANO_IN_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+void myst_startup_trace_event(const char* name, uint64_t start)
+{
+    myst_startup_trace_t* trace = __myst_kernel_args.startup_trace;
+    myst_startup_event_t* event;
+    uint64_t index;
+
+    if (!trace || !start)
+        return;
+
+    /* the trace is in host memory, so only write (and index) it */
+    index = __atomic_fetch_add(&trace->num_events, 1, __ATOMIC_SEQ_CST);
+
+    if (index >= MYST_STARTUP_TRACE_MAX_EVENTS)
+        return;
+
+    event = &trace->events[index];
+    event->end = myst_startup_trace_now();
+    event->start = start;
+    event->side = MYST_STARTUP_TRACE_ENCLAVE;
+    myst_strlcpy(event->name, name, sizeof(event->name));
+}
+
+/* When the first program entered the C runtime (zero once recorded) */
+static _Atomic(uint64_t) _crt_entry_time;
+
+void myst_startup_trace_enter_crt(void)
+{
+    static _Atomic(bool) _entered;
+
+    if (!_entered && !__atomic_exchange_n(&_entered, true, __ATOMIC_SEQ_CST))
+        _crt_entry_time = myst_startup_trace_now();
+}
+
+long myst_syscall_startup_trace(void)
+{
+    uint64_t start;
+
+    /* every program calls this, but only the first is traced */
+    if ((start = __atomic_exchange_n(&_crt_entry_time, 0, __ATOMIC_SEQ_CST)))
+        myst_startup_trace_event("dynamic_loader", start);
+
+    return 0;
+}
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/inotify.h>
 #include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/resource.h>
@@ -26,15 +27,19 @@
 #include <sys/vfs.h>
 #include <unistd.h>
 
+#include <myst/affinity.h>
+#include <myst/attest.h>
 #include <myst/backtrace.h>
 #include <myst/barrier.h>
 #include <myst/blkdev.h>
 #include <myst/buf.h>
 #include <myst/clock.h>
+#include <myst/console.h>
 #include <myst/cpio.h>
 #include <myst/cwd.h>
 #include <myst/epolldev.h>
 #include <myst/eraise.h>
+#include <myst/eventtrace.h>
 #include <myst/errno.h>
 #include <myst/exec.h>
 #include <myst/ext2.h>
@@ -48,8 +53,11 @@
 #include <myst/hostfs.h>
 #include <myst/id.h>
 #include <myst/initfini.h>
+#include <myst/eventfddev.h>
 #include <myst/inotifydev.h>
 #include <myst/kernel.h>
+#include <myst/layoutprofile.h>
+#include <myst/loopback.h>
 #include <myst/libc.h>
 #include <myst/lsr.h>
 #include <myst/mmanutils.h>
@@ -60,19 +68,26 @@
 #include <myst/pipedev.h>
 #include <myst/printf.h>
 #include <myst/process.h>
+#include <myst/profile.h>
 #include <myst/pubkey.h>
 #include <myst/ramfs.h>
+#include <myst/scratch.h>
 #include <myst/setjmp.h>
 #include <myst/signal.h>
 #include <myst/spinlock.h>
+#include <myst/startuptrace.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
+#include <myst/syscallstats.h>
+#include <myst/sysvshm.h>
 #include <myst/tcall.h>
 #include <myst/thread.h>
 #include <myst/times.h>
 #include <myst/trace.h>
+#include <myst/unixdev.h>
+#include <myst/vdso.h>
 
-#define DEV_URANDOM_FD MYST_FDTABLE_SIZE
+#define DEV_URANDOM_FD MYST_FDTABLE_MAX
 
 #define COLOR_RED "\e[31m"
 #define COLOR_BLUE "\e[34m"
@@ -462,6 +477,10 @@ static pair_t _pairs[] = {
     {SYS_myst_oe_verify_attestation_certificate,
      "SYS_myst_oe_verify_attestation_certificate"},
     {SYS_myst_oe_result_str, "SYS_myst_oe_result_str"},
+    {SYS_myst_dump_malloc_top, "SYS_myst_dump_malloc_top"},
+    {SYS_myst_get_vdso, "SYS_myst_get_vdso"},
+    {SYS_myst_spawn, "SYS_myst_spawn"},
+    {SYS_myst_startup_trace, "SYS_myst_startup_trace"},
 };
 
 // The kernel should eventually use _bad_addr() to check all incoming addresses
@@ -509,7 +528,7 @@ __attribute__((format(printf, 2, 3))) static void _strace(
     const char* fmt,
     ...)
 {
-    if (__options.trace_syscalls)
+    if (MYST_TRACE_SYSCALLS)
     {
         const bool isatty = myst_syscall_isatty(STDERR_FILENO) == 1;
         const char* blue = isatty ? COLOR_GREEN : "";
@@ -540,7 +559,7 @@ __attribute__((format(printf, 2, 3))) static void _strace(
 
 static long _forward_syscall(long n, long params[6])
 {
-    if (__options.trace_syscalls)
+    if (MYST_TRACE_SYSCALLS)
         myst_eprintf("    [forward syscall]\n");
 
     return myst_tcall(n, params);
@@ -554,7 +573,7 @@ typedef struct fd_entry
 
 static long _return(long n, long ret)
 {
-    if (__options.trace_syscalls)
+    if (MYST_TRACE_SYSCALLS)
     {
         const char* red = "";
         const char* reset = "";
@@ -615,12 +634,41 @@ static int _add_fd_link(myst_fs_t* fs, myst_file_t* file, int fd)
     if (snprintf(linkpath, n, "/proc/%d/fd/%d", myst_getpid(), fd) >= (int)n)
         ERAISE(-ENAMETOOLONG);
 
-    ECHECK(symlink(realpath, linkpath));
+    /* a new process creates its /proc/[pid]/fd directory on first use */
+    if ((ret = myst_syscall_symlink(realpath, linkpath)) == -ENOENT)
+    {
+        char fdpath[PATH_MAX];
+
+        snprintf(fdpath, sizeof(fdpath), "/proc/%d/fd", myst_getpid());
+        ECHECK(myst_mkdirhier(fdpath, 0777));
+        ret = myst_syscall_symlink(realpath, linkpath);
+    }
+
+    ECHECK(ret);
 
 done:
     return ret;
 }
 
+/* Whether open() is about to create the file (only asked when watched) */
+static bool _inotify_creating(const char* pathname, int flags)
+{
+    struct stat st;
+
+    if (!(flags & O_CREAT) || !myst_inotify_watching())
+        return false;
+
+    return myst_syscall_lstat(pathname, &st) == -ENOENT;
+}
+
+static void _inotify_opened(const char* pathname, int flags, bool created)
+{
+    if (created)
+        myst_inotify_notify(pathname, IN_CREATE);
+    else if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY)
+        myst_inotify_notify(pathname, IN_MODIFY);
+}
+
 long myst_syscall_creat(const char* pathname, mode_t mode)
 {
     long ret = 0;
@@ -631,9 +679,11 @@ long myst_syscall_creat(const char* pathname, mode_t mode)
     myst_fdtable_t* fdtable = myst_fdtable_current();
     const myst_fdtable_type_t fdtype = MYST_FDTABLE_TYPE_FILE;
     long r;
+    const bool created = _inotify_creating(pathname, O_CREAT);
 
     ECHECK(myst_mount_resolve(pathname, suffix, &fs));
     ECHECK((*fs->fs_creat)(fs, suffix, mode, &fs_out, &file));
+    _inotify_opened(pathname, O_WRONLY | O_TRUNC, created);
 
     if ((fd = myst_fdtable_assign(fdtable, fdtype, fs_out, file)) < 0)
     {
@@ -665,6 +715,7 @@ long myst_syscall_open(const char* pathname, int flags, mode_t mode)
     const myst_fdtable_type_t fdtype = MYST_FDTABLE_TYPE_FILE;
     int fd;
     int r;
+    bool created;
 
     /* Handle /dev/urandom as a special case */
     if (strcmp(pathname, "/dev/urandom") == 0)
@@ -673,10 +724,21 @@ long myst_syscall_open(const char* pathname, int flags, mode_t mode)
         return DEV_URANDOM_FD;
     }
 
+    created = _inotify_creating(pathname, flags);
+
     ECHECK(myst_mount_resolve(pathname, suffix, &fs));
     ECHECK((*fs->fs_open)(fs, suffix, flags, mode, &fs_out, &file));
+    _inotify_opened(pathname, flags, created);
 
-    if ((fd = myst_fdtable_assign(fdtable, fdtype, fs_out, file)) < 0)
+    /* add the file to the rootfs layout profile (with --layout-profile) */
+    myst_layout_profile_record(fs_out, file);
+
+    /* file systems ignore O_CLOEXEC */
+    if ((flags & O_CLOEXEC))
+        (*fs_out->fs_fcntl)(fs_out, file, F_SETFD, FD_CLOEXEC);
+
+    if ((fd = myst_fdtable_assign_cloexec(
+             fdtable, fdtype, fs_out, file, flags & O_CLOEXEC)) < 0)
     {
         (*fs_out->fs_close)(fs_out, file);
         ERAISE(fd);
@@ -693,6 +755,8 @@ long myst_syscall_open(const char* pathname, int flags, mode_t mode)
 
 done:
 
+    myst_event(
+        MYST_EVENT_FS, MYST_EVENT_FS_OPEN, (uint64_t)ret, (uint64_t)flags);
     return ret;
 }
 
@@ -845,6 +909,8 @@ long myst_syscall_close(int fd)
     void* object = NULL;
     myst_fdops_t* fdops;
 
+    /* never close an object that a cloned table shares */
+    ECHECK(myst_fdtable_unshare(fdtable, fd));
     ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
     fdops = device;
 
@@ -852,12 +918,20 @@ long myst_syscall_close(int fd)
     {
         /* why does this sometimes fail? */
         myst_remove_fd_link(fd);
+
+        /* while the file still has its path */
+        if (myst_inotify_watching())
+            myst_inotify_post_close(device, object);
     }
 
-    myst_mman_close_notify(fd);
-    ECHECK((*fdops->fd_close)(device, object));
     ECHECK(myst_fdtable_remove(fdtable, fd));
 
+    /* another thread may still be reading or writing the object */
+    ECHECK(myst_fdtable_retire(fdtable, fdops, object));
+
+    if (type == MYST_FDTABLE_TYPE_FILE)
+        myst_event(MYST_EVENT_FS, MYST_EVENT_FS_CLOSE, (uint64_t)fd, 0);
+
 done:
     return ret;
 }
@@ -876,6 +950,12 @@ long myst_syscall_read(int fd, void* buf, size_t count)
 
     ret = (*fdops->fd_read)(device, object, buf, count);
 
+    if (type == MYST_FDTABLE_TYPE_FILE)
+    {
+        const uint64_t arg0 = (uint64_t)fd;
+        myst_event(MYST_EVENT_FS, MYST_EVENT_FS_READ, arg0, (uint64_t)ret);
+    }
+
 done:
     return ret;
 }
@@ -897,6 +977,15 @@ long myst_syscall_write(int fd, const void* buf, size_t count)
 
     ret = (*fdops->fd_write)(device, object, buf, count);
 
+    if (type == MYST_FDTABLE_TYPE_FILE)
+    {
+        const uint64_t arg0 = (uint64_t)fd;
+        myst_event(MYST_EVENT_FS, MYST_EVENT_FS_WRITE, arg0, (uint64_t)ret);
+
+        if (ret > 0)
+            myst_inotify_notify_file(device, object, IN_MODIFY);
+    }
+
 done:
     return ret;
 }
@@ -965,6 +1054,10 @@ long myst_syscall_pwrite(int fd, const void* buf, size_t count, off_t offset)
             myst_fs_t* fs = device;
             myst_file_t* file = object;
             ret = (*fs->fs_pwrite)(fs, file, buf, count, offset);
+
+            if (ret > 0)
+                myst_inotify_notify_file(fs, file, IN_MODIFY);
+
             break;
         }
         case MYST_FDTABLE_TYPE_PIPE:
@@ -1021,6 +1114,9 @@ long myst_syscall_writev(int fd, const struct iovec* iov, int iovcnt)
 
     ret = (*fdops->fd_writev)(device, object, iov, iovcnt);
 
+    if (type == MYST_FDTABLE_TYPE_FILE && ret > 0)
+        myst_inotify_notify_file(device, object, IN_MODIFY);
+
 done:
     return ret;
 }
@@ -1185,6 +1281,7 @@ long myst_syscall_mkdir(const char* pathname, mode_t mode)
 
     ECHECK(myst_mount_resolve(pathname, suffix, &fs));
     ECHECK((*fs->fs_mkdir)(fs, suffix, mode));
+    myst_inotify_notify(pathname, IN_CREATE | IN_ISDIR);
 
 done:
     return ret;
@@ -1198,6 +1295,7 @@ long myst_syscall_rmdir(const char* pathname)
 
     ECHECK(myst_mount_resolve(pathname, suffix, &fs));
     ECHECK((*fs->fs_rmdir)(fs, suffix));
+    myst_inotify_notify(pathname, IN_DELETE | IN_ISDIR);
 
 done:
     return ret;
@@ -1237,6 +1335,7 @@ long myst_syscall_link(const char* oldpath, const char* newpath)
     }
 
     ECHECK((*old_fs->fs_link)(old_fs, old_suffix, new_suffix));
+    myst_inotify_notify(newpath, IN_CREATE);
 
 done:
     return ret;
@@ -1250,6 +1349,7 @@ long myst_syscall_unlink(const char* pathname)
 
     ECHECK(myst_mount_resolve(pathname, suffix, &fs));
     ECHECK((*fs->fs_unlink)(fs, suffix));
+    myst_inotify_notify(pathname, IN_DELETE);
 
 done:
     return ret;
@@ -1287,6 +1387,9 @@ long myst_syscall_rename(const char* oldpath, const char* newpath)
 
     ECHECK((*old_fs->fs_rename)(old_fs, old_suffix, new_suffix));
 
+    if (myst_inotify_watching())
+        myst_inotify_post_rename(oldpath, newpath);
+
 done:
     return ret;
 }
@@ -1299,6 +1402,7 @@ long myst_syscall_truncate(const char* path, off_t length)
 
     ECHECK(myst_mount_resolve(path, suffix, &fs));
     ERAISE((*fs->fs_truncate)(fs, suffix, length));
+    myst_inotify_notify(path, IN_MODIFY);
 
 done:
     return ret;
@@ -1314,6 +1418,7 @@ long myst_syscall_ftruncate(int fd, off_t length)
 
     ECHECK(myst_fdtable_get(fdtable, fd, type, (void**)&fs, (void**)&file));
     ERAISE((*fs->fs_ftruncate)(fs, file, length));
+    myst_inotify_notify_file(fs, file, IN_MODIFY);
 
 done:
     return ret;
@@ -1340,6 +1445,7 @@ long myst_syscall_symlink(const char* target, const char* linkpath)
 
     ECHECK(myst_mount_resolve(linkpath, suffix, &fs));
     ERAISE((*fs->fs_symlink)(fs, target, suffix));
+    myst_inotify_notify(linkpath, IN_CREATE);
 
 done:
     return ret;
@@ -1382,6 +1488,7 @@ long myst_syscall_chdir(const char* path)
         ERAISE(-ENOMEM);
     free(process_thread->main.cwd);
     process_thread->main.cwd = tmp;
+    process_thread->main.cwd_len = strlen(tmp);
 
 done:
 
@@ -1515,9 +1622,17 @@ long myst_syscall_fcntl(int fd, int cmd, long arg)
         myst_fdtable_type_t type;
         myst_fdops_t* fdops;
 
+        /* FD_CLOEXEC is kept by the object, which a clone may share */
+        if (cmd == F_SETFD)
+            ECHECK(myst_fdtable_unshare(fdtable, fd));
+
         ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
         fdops = device;
-        ret = (*fdops->fd_fcntl)(device, object, cmd, arg);
+        ECHECK(ret = (*fdops->fd_fcntl)(device, object, cmd, arg));
+
+        /* exec closes what the fdtable has flagged */
+        if (cmd == F_SETFD)
+            ECHECK(myst_fdtable_set_cloexec(fdtable, fd, arg & FD_CLOEXEC));
     }
 
 done:
@@ -1544,9 +1659,15 @@ long myst_syscall_fchmod(int fd, mode_t mode)
     if (type == MYST_FDTABLE_TYPE_SOCK)
     {
         myst_fdops_t* fdops = device;
-        int target_fd = (*fdops->fd_target_fd)(fdops, object);
+        int target_fd;
+
+        if (device == myst_unixdev_get())
+        {
+            ret = myst_unixdev_fchmod(device, object, mode);
+            goto done;
+        }
 
-        if (target_fd < 0)
+        if ((target_fd = (*fdops->fd_target_fd)(fdops, object)) < 0)
             ERAISE(-EBADF);
 
         long params[] = {target_fd, mode};
@@ -1598,7 +1719,7 @@ long myst_syscall_pipe2(int pipefd[2], int flags)
     pipefd[0] = fd0;
     pipefd[1] = fd1;
 
-    if (__options.trace_syscalls)
+    if (MYST_TRACE_SYSCALLS)
         myst_eprintf("pipe2(): [%d:%d]\n", fd0, fd1);
 
 done:
@@ -1628,6 +1749,90 @@ done:
     return ret;
 }
 
+long myst_syscall_eventfd2(unsigned int initval, int flags)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    const myst_fdtable_type_t type = MYST_FDTABLE_TYPE_EVENTFD;
+    myst_eventfddev_t* dev = myst_eventfddev_get();
+    myst_eventfd_t* obj = NULL;
+    int fd;
+
+    ECHECK((*dev->ev_eventfd)(dev, initval, flags, &obj));
+
+    if ((fd = myst_fdtable_assign(fdtable, type, dev, obj)) < 0)
+    {
+        (*dev->ev_close)(dev, obj);
+        ERAISE(fd);
+    }
+
+    ret = fd;
+
+done:
+    return ret;
+}
+
+long myst_syscall_timerfd_create(int clockid, int flags)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    const myst_fdtable_type_t type = MYST_FDTABLE_TYPE_TIMERFD;
+    myst_timerfddev_t* dev = myst_timerfddev_get();
+    myst_timerfd_t* obj = NULL;
+    int fd;
+
+    ECHECK((*dev->td_timerfd_create)(dev, clockid, flags, &obj));
+
+    if ((fd = myst_fdtable_assign(fdtable, type, dev, obj)) < 0)
+    {
+        (*dev->td_close)(dev, obj);
+        ERAISE(fd);
+    }
+
+    ret = fd;
+
+done:
+    return ret;
+}
+
+long myst_syscall_timerfd_settime(
+    int fd,
+    int flags,
+    const struct itimerspec* new_value,
+    struct itimerspec* old_value)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    myst_timerfddev_t* dev;
+    myst_timerfd_t* obj;
+
+    if (_bad_addr(new_value) || _bad_addr(old_value))
+        ERAISE(-EFAULT);
+
+    ECHECK(myst_fdtable_get_timerfd(fdtable, fd, &dev, &obj));
+    ECHECK((*dev->td_timerfd_settime)(dev, obj, flags, new_value, old_value));
+
+done:
+    return ret;
+}
+
+long myst_syscall_timerfd_gettime(int fd, struct itimerspec* curr_value)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    myst_timerfddev_t* dev;
+    myst_timerfd_t* obj;
+
+    if (_bad_addr(curr_value))
+        ERAISE(-EFAULT);
+
+    ECHECK(myst_fdtable_get_timerfd(fdtable, fd, &dev, &obj));
+    ECHECK((*dev->td_timerfd_gettime)(dev, obj, curr_value));
+
+done:
+    return ret;
+}
+
 long myst_syscall_inotify_add_watch(int fd, const char* pathname, uint32_t mask)
 {
     long ret = 0;
@@ -1728,6 +1933,13 @@ long myst_syscall_ioctl(int fd, unsigned long request, long arg)
     myst_fdtable_t* fdtable = myst_fdtable_current();
     myst_fdops_t* fdops;
 
+    /* the same as F_SETFD, whatever the device */
+    if (request == FIOCLEX)
+        return myst_syscall_fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (request == FIONCLEX)
+        return myst_syscall_fcntl(fd, F_SETFD, 0);
+
     ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
     fdops = device;
 
@@ -1747,6 +1959,10 @@ int myst_syscall_bind(
     myst_sockdev_t* sd;
     myst_sock_t* sock;
 
+    /* loopback sockets may move into the kernel first */
+    if ((ret = myst_loopback_bind(sockfd, addr, addrlen)) != -ENOTSUP)
+        goto done;
+
     ECHECK(myst_fdtable_get_sock(fdtable, sockfd, &sd, &sock));
     ret = (*sd->sd_bind)(sd, sock, addr, addrlen);
 
@@ -1764,6 +1980,10 @@ long myst_syscall_connect(
     myst_sockdev_t* sd;
     myst_sock_t* sock;
 
+    /* loopback sockets may move into the kernel first */
+    if ((ret = myst_loopback_connect(sockfd, addr, addrlen)) != -ENOTSUP)
+        goto done;
+
     ECHECK(myst_fdtable_get_sock(fdtable, sockfd, &sd, &sock));
     ret = (*sd->sd_connect)(sd, sock, addr, addrlen);
 
@@ -1804,6 +2024,11 @@ long myst_syscall_sendto(
     myst_sockdev_t* sd;
     myst_sock_t* sock;
 
+    /* loopback sockets may move into the kernel first */
+    if ((ret = myst_loopback_sendto(
+             sockfd, buf, len, flags, dest_addr, addrlen)) != -ENOTSUP)
+        goto done;
+
     ECHECK(myst_fdtable_get_sock(fdtable, sockfd, &sd, &sock));
     ret = (*sd->sd_sendto)(sd, sock, buf, len, flags, dest_addr, addrlen);
 
@@ -1811,10 +2036,16 @@ done:
     return ret;
 }
 
+/* Unix domain sockets are kernel objects; all others go to the host */
+static myst_sockdev_t* _get_sockdev(int domain)
+{
+    return (domain == AF_UNIX) ? myst_unixdev_get() : myst_sockdev_get();
+}
+
 long myst_syscall_socket(int domain, int type, int protocol)
 {
     long ret = 0;
-    myst_sockdev_t* sd = myst_sockdev_get();
+    myst_sockdev_t* sd = _get_sockdev(domain);
     myst_fdtable_t* fdtable = myst_fdtable_current();
     myst_sock_t* sock = NULL;
     int sockfd;
@@ -1822,7 +2053,8 @@ long myst_syscall_socket(int domain, int type, int protocol)
 
     ECHECK((*sd->sd_socket)(sd, domain, type, protocol, &sock));
 
-    if ((sockfd = myst_fdtable_assign(fdtable, fdtype, sd, sock)) < 0)
+    if ((sockfd = myst_fdtable_assign_cloexec(
+             fdtable, fdtype, sd, sock, type & SOCK_CLOEXEC)) < 0)
     {
         (*sd->sd_close)(sd, sock);
         ERAISE(sockfd);
@@ -1851,7 +2083,8 @@ long myst_syscall_accept4(
     ECHECK(myst_fdtable_get_sock(fdtable, sockfd, &sd, &sock));
     ECHECK((*sd->sd_accept4)(sd, sock, addr, addrlen, flags, &new_sock));
 
-    if ((sockfd = myst_fdtable_assign(fdtable, fdtype, sd, new_sock)) < 0)
+    if ((sockfd = myst_fdtable_assign_cloexec(
+             fdtable, fdtype, sd, new_sock, flags & SOCK_CLOEXEC)) < 0)
     {
         (*sd->sd_close)(sd, new_sock);
         ERAISE(sockfd);
@@ -1871,6 +2104,10 @@ long myst_syscall_sendmsg(int sockfd, const struct msghdr* msg, int flags)
     myst_sockdev_t* sd;
     myst_sock_t* sock;
 
+    /* loopback sockets may move into the kernel first */
+    if ((ret = myst_loopback_sendmsg(sockfd, msg, flags)) != -ENOTSUP)
+        goto done;
+
     ECHECK(myst_fdtable_get_sock(fdtable, sockfd, &sd, &sock));
     ret = (*sd->sd_sendmsg)(sd, sock, msg, flags);
 
@@ -1892,6 +2129,83 @@ done:
     return ret;
 }
 
+/* Linux silently sends or receives at most this many messages per call */
+#define MMSG_MAX 1024
+
+long myst_syscall_sendmmsg(
+    int sockfd,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    myst_sockdev_t* sd;
+    myst_sock_t* sock;
+    unsigned int sent = 0;
+    int r;
+
+    if (vlen > MMSG_MAX)
+        vlen = MMSG_MAX;
+
+    if (!msgvec && vlen)
+        ERAISE(-EFAULT);
+
+    /* loopback sockets may move into the kernel with the first message */
+    if (vlen)
+    {
+        const struct msghdr* msg = &msgvec->msg_hdr;
+
+        if ((r = myst_loopback_sendmsg(sockfd, msg, flags)) != -ENOTSUP)
+        {
+            ECHECK(r);
+            msgvec->msg_len = (unsigned int)r;
+            sent = 1;
+        }
+    }
+
+    ECHECK(myst_fdtable_get_sock(fdtable, sockfd, &sd, &sock));
+
+    if (sent < vlen)
+    {
+        r = (*sd->sd_sendmmsg)(sd, sock, msgvec + sent, vlen - sent, flags);
+
+        /* report an error only if nothing was sent */
+        if (r < 0 && !sent)
+            ERAISE(r);
+
+        if (r > 0)
+            sent += (unsigned int)r;
+    }
+
+    ret = sent;
+
+done:
+    return ret;
+}
+
+long myst_syscall_recvmmsg(
+    int sockfd,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    struct timespec* timeout)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    myst_sockdev_t* sd;
+    myst_sock_t* sock;
+
+    if (vlen > MMSG_MAX)
+        vlen = MMSG_MAX;
+
+    ECHECK(myst_fdtable_get_sock(fdtable, sockfd, &sd, &sock));
+    ret = (*sd->sd_recvmmsg)(sd, sock, msgvec, vlen, flags, timeout);
+
+done:
+    return ret;
+}
+
 long myst_syscall_shutdown(int sockfd, int how)
 {
     long ret = 0;
@@ -1944,19 +2258,22 @@ long myst_syscall_socketpair(int domain, int type, int protocol, int sv[2])
     int fd1;
     myst_sock_t* pair[2];
     myst_fdtable_t* fdtable = myst_fdtable_current();
-    myst_sockdev_t* sd = myst_sockdev_get();
+    myst_sockdev_t* sd = _get_sockdev(domain);
     const myst_fdtable_type_t fdtype = MYST_FDTABLE_TYPE_SOCK;
+    const bool cloexec = type & SOCK_CLOEXEC;
 
     ECHECK((*sd->sd_socketpair)(sd, domain, type, protocol, pair));
 
-    if ((fd0 = myst_fdtable_assign(fdtable, fdtype, sd, pair[0])) < 0)
+    if ((fd0 = myst_fdtable_assign_cloexec(
+             fdtable, fdtype, sd, pair[0], cloexec)) < 0)
     {
         (*sd->sd_close)(sd, pair[0]);
         (*sd->sd_close)(sd, pair[1]);
         ERAISE(fd0);
     }
 
-    if ((fd1 = myst_fdtable_assign(fdtable, fdtype, sd, pair[1])) < 0)
+    if ((fd1 = myst_fdtable_assign_cloexec(
+             fdtable, fdtype, sd, pair[1], cloexec)) < 0)
     {
         myst_fdtable_remove(fdtable, fd0);
         (*sd->sd_close)(sd, pair[0]);
@@ -2065,15 +2382,88 @@ done:
     return ret;
 }
 
+/* With no more threads than CPUs, only every this many yields reach the
+ * host: the others would find no thread to yield to */
+#define YIELD_HOST_INTERVAL 16
+
+/* The pause instructions that a yield served in the enclave spends */
+#define YIELD_PAUSES 64
+
 long myst_syscall_sched_yield(void)
 {
     long params[] = {0};
+    myst_thread_t* thread = myst_thread_self();
+
+    myst_event(MYST_EVENT_SCHED, MYST_EVENT_SCHED_YIELD, 0, 0);
+
+    /* spin-wait loops yield constantly, and each host yield is an OCALL */
+    if ((size_t)myst_get_num_threads() <= myst_get_num_cpus() &&
+        ++thread->yields % YIELD_HOST_INTERVAL != 0)
+    {
+        for (size_t i = 0; i < YIELD_PAUSES; i++)
+            __asm__ __volatile__("pause" : : : "memory");
+
+        return 0;
+    }
+
     return myst_tcall(SYS_sched_yield, params);
 }
 
+/* Sleeps up to this long spin on the host clock page rather than make the
+ * host sleep, which costs an OCALL and at least as much timer slack */
+#define SPIN_SLEEP_NSEC 100000
+
+/* Sleep on the host after this many pauses (the clock page may stall) */
+#define SPIN_SLEEP_MAX_PAUSES (1 << 16)
+
+/* Spin until the clock page passes the deadline; otherwise return the
+ * time left (or all of it if the sleep is too long to spin) */
+static long _spin_sleep(long nsec)
+{
+    const myst_vdso_t* vdso = __myst_kernel_args.vdso;
+    long deadline;
+    long now;
+
+    if (!vdso || nsec > SPIN_SLEEP_NSEC)
+        return nsec;
+
+    /* read the clock page directly: myst_vdso_monotime() advances the
+     * clock of every reader when the page has not changed */
+    deadline = *vdso->monotime_now + nsec;
+
+    for (size_t i = 0; i < SPIN_SLEEP_MAX_PAUSES; i++)
+    {
+        if ((now = *vdso->monotime_now) >= deadline)
+            return 0;
+
+        __asm__ __volatile__("pause" : : : "memory");
+    }
+
+    return (now < deadline - nsec) ? nsec : deadline - now;
+}
+
 long myst_syscall_nanosleep(const struct timespec* req, struct timespec* rem)
 {
     long params[6] = {(long)req, (long)rem};
+    struct timespec left;
+    long nsec;
+
+    if (!req)
+        return -EFAULT;
+
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= NANO_IN_SECOND)
+        return -EINVAL;
+
+    if (req->tv_sec != 0 || (nsec = _spin_sleep(req->tv_nsec)) == req->tv_nsec)
+        return _forward_syscall(SYS_nanosleep, params);
+
+    if (nsec == 0)
+        return 0;
+
+    /* the clock page stalled: sleep on the host for what is left */
+    left.tv_sec = 0;
+    left.tv_nsec = nsec;
+    params[0] = (long)&left;
     return _forward_syscall(SYS_nanosleep, params);
 }
 #define NANO_IN_SECOND 1000000000
@@ -2175,19 +2565,7 @@ long myst_syscall_prlimit64(
     if (resource != RLIMIT_NOFILE)
         return -EINVAL;
 
-    if (old_rlim)
-    {
-        // ATTN: return currently effective RLIMIT_NOFILE settings
-        old_rlim->rlim_cur = 65536;
-        old_rlim->rlim_max = 65536;
-    }
-
-    if (new_rlim)
-    {
-        // ATTN: make RLIMIT_NOFILE settings effective ;
-    }
-
-    return 0;
+    return myst_fdtable_rlimit(myst_fdtable_current(), new_rlim, old_rlim);
 }
 
 long myst_syscall_fsync(int fd)
@@ -2203,9 +2581,23 @@ long myst_syscall_fsync(int fd)
 
     ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
 
+    /* write out the console buffer (but fail as Linux does for a TTY) */
+    if (type == MYST_FDTABLE_TYPE_TTY)
+    {
+        myst_console_flush();
+        ERAISE(-EINVAL);
+    }
+
     if (type != MYST_FDTABLE_TYPE_FILE)
         ERAISE(-EROFS);
 
+    {
+        myst_fs_t* fs = device;
+
+        if (fs->fs_fsync)
+            ECHECK((*fs->fs_fsync)(fs, object));
+    }
+
 done:
     return ret;
 }
@@ -2340,12 +2732,13 @@ static const char* _fcntl_cmdstr(int cmd)
 #define FUTEX_UNLOCK_PI 7
 #define FUTEX_TRYLOCK_PI 8
 #define FUTEX_WAIT_BITSET 9
+#define FUTEX_WAKE_BITSET 10
 #define FUTEX_PRIVATE 128
 #define FUTEX_CLOCK_REALTIME 256
 
 static const char* _futex_op_str(int op)
 {
-    switch (op & ~FUTEX_PRIVATE)
+    switch (op & ~(FUTEX_PRIVATE | FUTEX_CLOCK_REALTIME))
     {
         case FUTEX_WAIT:
             return "FUTEX_WAIT";
@@ -2367,6 +2760,8 @@ static const char* _futex_op_str(int op)
             return "FUTEX_TRYLOCK_PI";
         case FUTEX_WAIT_BITSET:
             return "FUTEX_WAIT_BITSET";
+        case FUTEX_WAKE_BITSET:
+            return "FUTEX_WAKE_BITSET";
         default:
             return "UNKNOWN";
     }
@@ -2434,57 +2829,418 @@ void myst_dump_ramfs(void)
     myst_strarr_release(&paths);
 }
 
-int myst_export_ramfs(void)
+/*
+**==============================================================================
+**
+** myst_export_ramfs():
+**
+**     The files go to the host as one CPIO stream, in a few large tcalls:
+**     each file is read straight into the stream buffer, which is sent
+**     whenever it fills. With --export-ramfs-changed, only the files that
+**     were modified after the program started are exported. The coverage
+**     runs of gcov builds export only the *.gcda files (which gcov wrote on
+**     exit), so the rest of the file system does not cross with them.
+**
+**==============================================================================
+*/
+
+#define EXPORT_BUFFER_SIZE (1024 * 1024)
+
+MYST_STATIC_ASSERT(EXPORT_BUFFER_SIZE >= MYST_CPIO_ENTRY_MAX_SIZE);
+
+typedef struct export_stream
 {
-    int ret = -1;
-    myst_strarr_t paths = MYST_STRARR_INITIALIZER;
-    void* data = NULL;
-    size_t size = 0;
+    uint8_t* buf;
+    size_t len;
+    int error; /* the host failed to take part of the stream */
+} export_stream_t;
 
-    if (myst_lsr("/", &paths, false) != 0)
-        goto done;
+/* Files modified before this are not exported (see myst_export_ramfs_start) */
+static struct timespec _export_since;
 
-    for (size_t i = 0; i < paths.size; i++)
-    {
-        const char* path = paths.data[i];
+void myst_export_ramfs_start(void)
+{
+    myst_syscall_clock_gettime(CLOCK_REALTIME, &_export_since);
+}
 
-        /* Skip over entries in the /proc file system */
-        if (strncmp(path, "/proc", 5) == 0)
-            continue;
+/* Only the files with this suffix are exported (see myst_export_ramfs_gcov) */
+static const char* _export_suffix;
 
-        if (myst_load_file(path, &data, &size) != 0)
-        {
-            myst_eprintf("Warning! failed to load %s from ramfs\n", path);
-            continue;
-        }
+void myst_export_ramfs_gcov(void)
+{
+    _export_suffix = ".gcda";
+}
+
+static bool _has_suffix(const char* path, const char* suffix)
+{
+    const size_t n = strlen(path);
+    const size_t m = strlen(suffix);
+
+    return n >= m && strcmp(path + n - m, suffix) == 0;
+}
+
+static int _export_flush(export_stream_t* s)
+{
+    int ret = 0;
+
+    if (s->error)
+        ERAISE(s->error);
 
-        if (myst_tcall_export_file(path, data, size) != 0)
+    if (s->len)
+    {
+        if ((ret = myst_tcall_export_cpio(s->buf, s->len)) != 0)
         {
-            myst_eprintf("Warning! failed to export %s from ramfs\n", path);
-            continue;
+            s->error = ret;
+            ERAISE(ret);
         }
 
-        free(data);
-        data = NULL;
-        size = 0;
+        s->len = 0;
     }
 
-    ret = 0;
-
 done:
-    myst_strarr_release(&paths);
-
-    if (data)
-        free(data);
-
     return ret;
 }
 
-#define BREAK(RET)           \
-    do                       \
-    {                        \
-        syscall_ret = (RET); \
-        goto done;           \
+/* Append zeros (for padding and for files that shrank while read) */
+static int _export_zeros(export_stream_t* s, size_t size)
+{
+    int ret = 0;
+
+    while (size)
+    {
+        size_t n = EXPORT_BUFFER_SIZE - s->len;
+
+        if (n > size)
+            n = size;
+
+        memset(s->buf + s->len, 0, n);
+        s->len += n;
+        size -= n;
+
+        if (s->len == EXPORT_BUFFER_SIZE)
+            ECHECK(_export_flush(s));
+    }
+
+done:
+    return ret;
+}
+
+static int _export_entry(export_stream_t* s, const myst_cpio_entry_t* entry)
+{
+    int ret = 0;
+    ssize_t n;
+
+    if (EXPORT_BUFFER_SIZE - s->len < MYST_CPIO_ENTRY_MAX_SIZE)
+        ECHECK(_export_flush(s));
+
+    n = myst_cpio_format_entry(
+        entry, s->buf + s->len, EXPORT_BUFFER_SIZE - s->len);
+
+    if (n < 0)
+        ERAISE(-EINVAL);
+
+    s->len += (size_t)n;
+
+done:
+    return ret;
+}
+
+/* Export a file by itself (for names too long for CPIO) */
+static int _export_file_by_path(const char* path)
+{
+    int ret = 0;
+    void* data = NULL;
+    size_t size = 0;
+
+    ECHECK(myst_load_file(path, &data, &size));
+    ECHECK(myst_tcall_export_file(path, data, size));
+
+done:
+    if (data)
+        free(data);
+
+    return ret;
+}
+
+static int _export_file(export_stream_t* s, const char* path)
+{
+    int ret = 0;
+    int fd = -1;
+    struct stat st;
+    myst_cpio_entry_t entry;
+    size_t rem;
+
+    if (_export_suffix && !_has_suffix(path, _export_suffix))
+        goto done;
+
+    if ((fd = open(path, O_RDONLY, 0)) < 0)
+        ERAISE(-ENOENT);
+
+    if (fstat(fd, &st) != 0)
+        ERAISE(-EINVAL);
+
+    if (!S_ISREG(st.st_mode))
+        goto done;
+
+    if (st.st_mtim.tv_sec < _export_since.tv_sec ||
+        (st.st_mtim.tv_sec == _export_since.tv_sec &&
+         st.st_mtim.tv_nsec < _export_since.tv_nsec))
+    {
+        goto done;
+    }
+
+    if ((uint64_t)st.st_size > UINT32_MAX)
+        ERAISE(-EFBIG);
+
+    /* the names are relative to the export directory */
+    if (myst_strlcpy(entry.name, path + 1, sizeof(entry.name)) >=
+        sizeof(entry.name))
+    {
+        close(fd);
+        fd = -1;
+        ECHECK(_export_file_by_path(path));
+        goto done;
+    }
+
+    entry.size = (size_t)st.st_size;
+    entry.mode = MYST_CPIO_MODE_IFREG | (st.st_mode & 07777);
+    entry.ino = 0;
+    entry.nlink = 1;
+    ECHECK(_export_entry(s, &entry));
+
+    /* read the data straight into the stream buffer */
+    for (rem = entry.size; rem;)
+    {
+        size_t n = EXPORT_BUFFER_SIZE - s->len;
+        ssize_t r;
+
+        if (n > rem)
+            n = rem;
+
+        if ((r = read(fd, s->buf + s->len, n)) <= 0)
+            break;
+
+        s->len += (size_t)r;
+        rem -= (size_t)r;
+
+        if (s->len == EXPORT_BUFFER_SIZE)
+            ECHECK(_export_flush(s));
+    }
+
+    /* the data is padded to a multiple of four */
+    ECHECK(_export_zeros(s, rem + (4 - entry.size % 4) % 4));
+
+done:
+    if (fd >= 0)
+        close(fd);
+
+    return ret;
+}
+
+int myst_export_ramfs(void)
+{
+    int ret = -1;
+    myst_strarr_t paths = MYST_STRARR_INITIALIZER;
+    export_stream_t s = {NULL, 0, 0};
+    myst_cpio_entry_t trailer = {0, 0, 0, 1, MYST_CPIO_TRAILER};
+
+    if (myst_lsr("/", &paths, false) != 0)
+        goto done;
+
+    if (!(s.buf = malloc(EXPORT_BUFFER_SIZE)))
+        goto done;
+
+    for (size_t i = 0; i < paths.size; i++)
+    {
+        const char* path = paths.data[i];
+
+        /* Skip over entries in the /proc file system */
+        if (strncmp(path, "/proc", 5) == 0)
+            continue;
+
+        if (_export_file(&s, path) != 0)
+            myst_eprintf("Warning! failed to export %s from ramfs\n", path);
+
+        /* the stream cannot go on once the host refused part of it */
+        if (s.error)
+            goto done;
+    }
+
+    if (_export_entry(&s, &trailer) != 0 || _export_flush(&s) != 0)
+    {
+        myst_eprintf("Warning! failed to export the ramfs\n");
+        goto done;
+    }
+
+    ret = 0;
+
+done:
+    myst_strarr_release(&paths);
+
+    if (s.buf)
+        free(s.buf);
+
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** syscall descriptors:
+**
+**     Trivial syscalls are dispatched through this table before reaching the
+**     switch statement in myst_syscall(). The flags say which parts of the
+**     full syscall entry and exit work each handler needs. Syscalls without
+**     a descriptor always take the full path, as do all syscalls while
+**     syscall tracing is enabled (so the trace output is unchanged).
+**
+**==============================================================================
+*/
+
+/* run on the target thread descriptor (required to perform tcalls) */
+#define SYSCALL_FSBASE 0x1
+
+/* process pending signals on entry and exit */
+#define SYSCALL_SIGNALS 0x2
+
+/* account the time spent in the kernel as system time */
+#define SYSCALL_TIMES 0x4
+
+typedef struct syscall_desc
+{
+    long (*handler)(myst_thread_t* thread, long params[6]);
+    uint32_t flags;
+} syscall_desc_t;
+
+static long _fast_getpid(myst_thread_t* thread, long params[6])
+{
+    (void)params;
+    return thread->pid;
+}
+
+static long _fast_getppid(myst_thread_t* thread, long params[6])
+{
+    (void)params;
+    return thread->ppid;
+}
+
+static long _fast_gettid(myst_thread_t* thread, long params[6])
+{
+    (void)params;
+    return thread->tid;
+}
+
+static long _fast_getuid(myst_thread_t* thread, long params[6])
+{
+    (void)thread;
+    (void)params;
+    return MYST_DEFAULT_UID;
+}
+
+static long _fast_getgid(myst_thread_t* thread, long params[6])
+{
+    (void)thread;
+    (void)params;
+    return MYST_DEFAULT_GID;
+}
+
+static long _fast_clock_gettime(myst_thread_t* thread, long params[6])
+{
+    clockid_t clk_id = (clockid_t)params[0];
+    struct timespec* tp = (struct timespec*)params[1];
+    long ret;
+
+    (void)thread;
+
+    /* CPU-time clocks read the times updated on kernel entry */
+    if (clk_id < 0 || clk_id == CLOCK_PROCESS_CPUTIME_ID ||
+        clk_id == CLOCK_THREAD_CPUTIME_ID)
+    {
+        myst_times_enter_kernel();
+        ret = myst_syscall_clock_gettime(clk_id, tp);
+        myst_times_leave_kernel();
+        return ret;
+    }
+
+    return myst_syscall_clock_gettime(clk_id, tp);
+}
+
+static long _fast_sched_yield(myst_thread_t* thread, long params[6])
+{
+    (void)thread;
+    (void)params;
+    return myst_syscall_sched_yield();
+}
+
+static const syscall_desc_t _syscall_descs[] = {
+    [SYS_getpid] = {_fast_getpid, 0},
+    [SYS_getppid] = {_fast_getppid, 0},
+    [SYS_gettid] = {_fast_gettid, 0},
+    [SYS_getuid] = {_fast_getuid, 0},
+    [SYS_geteuid] = {_fast_getuid, 0},
+    [SYS_getgid] = {_fast_getgid, 0},
+    [SYS_getegid] = {_fast_getgid, 0},
+    [SYS_clock_gettime] = {_fast_clock_gettime, SYSCALL_FSBASE},
+    [SYS_sched_yield] = {_fast_sched_yield, SYSCALL_FSBASE | SYSCALL_SIGNALS},
+};
+
+static long _fast_syscall(
+    long n,
+    const syscall_desc_t* desc,
+    long params[6],
+    bool set_thread_area_called)
+{
+    long ret;
+    myst_thread_t* thread = NULL;
+    myst_td_t* crt_td = NULL;
+
+    if ((desc->flags & SYSCALL_TIMES))
+        myst_times_enter_kernel();
+
+    thread = myst_thread_self();
+
+    /* switch to the target thread descriptor if running on the CRT one */
+    if ((desc->flags & SYSCALL_FSBASE) && set_thread_area_called)
+    {
+        crt_td = myst_get_fsbase();
+        myst_assume(myst_valid_td(crt_td));
+        myst_assume(myst_valid_td(thread->target_td));
+        myst_set_fsbase(thread->target_td);
+    }
+
+    if ((desc->flags & SYSCALL_SIGNALS))
+        myst_signal_process_pending(thread);
+
+    myst_event(MYST_EVENT_SYSCALL, MYST_EVENT_SYSCALL_ENTER, (uint64_t)n, 0);
+    myst_event_syscall_args(params);
+    ret = (*desc->handler)(thread, params);
+    myst_event(
+        MYST_EVENT_SYSCALL,
+        MYST_EVENT_SYSCALL_EXIT,
+        (uint64_t)n,
+        (uint64_t)ret);
+    myst_fdtable_drop_holds(thread);
+
+    if (crt_td)
+        myst_set_fsbase(crt_td);
+
+    if ((desc->flags & SYSCALL_TIMES))
+        myst_times_leave_kernel();
+
+    if ((desc->flags & SYSCALL_SIGNALS))
+        myst_signal_process_pending(thread);
+
+    if (__atomic_load_n(&thread->affinity_pending, __ATOMIC_RELAXED))
+        myst_affinity_apply_pending(thread);
+
+    return ret;
+}
+
+#define BREAK(RET)           \
+    do                       \
+    {                        \
+        syscall_ret = (RET); \
+        goto done;           \
     } while (0)
 
 long myst_syscall(long n, long params[6])
@@ -2501,6 +3257,22 @@ long myst_syscall(long n, long params[6])
     myst_td_t* crt_td = NULL;
     myst_thread_t* thread = NULL;
 
+    uint64_t stats_start = 0;
+    uint64_t stats_tcall_nsec = 0;
+    myst_scratch_mark_t scratch_mark;
+
+    /* take the fast path for syscalls that have a descriptor */
+    if (n >= 0 && n < (long)MYST_COUNTOF(_syscall_descs) &&
+        _syscall_descs[n].handler && !MYST_TRACE_SYSCALLS &&
+        !__options.syscall_stats && !__options.profile)
+    {
+        const syscall_desc_t* desc = &_syscall_descs[n];
+        return _fast_syscall(n, desc, params, _set_thread_area_called);
+    }
+
+    if (__options.syscall_stats)
+        stats_start = myst_syscall_stats_now();
+
     myst_times_enter_kernel();
 
     /* resolve the target-thread-descriptor and the crt-thread-descriptor */
@@ -2513,8 +3285,7 @@ long myst_syscall(long n, long params[6])
         myst_assume(myst_valid_td(crt_td));
 
         /* get thread */
-        myst_assume(myst_tcall_get_tsd((uint64_t*)&thread) == 0);
-        myst_assume(myst_valid_thread(thread));
+        thread = myst_thread_self();
 
         /* get target_td */
         target_td = thread->target_td;
@@ -2532,14 +3303,26 @@ long myst_syscall(long n, long params[6])
         myst_assume(myst_valid_td(target_td));
 
         /* get thread */
-        myst_assume(myst_tcall_get_tsd((uint64_t*)&thread) == 0);
-        myst_assume(myst_valid_thread(thread));
+        thread = myst_thread_self();
 
         /* crt_td is null */
     }
 
+    if (__options.syscall_stats)
+        stats_tcall_nsec = thread->tcall_nsec;
+
+    /* charge the time since the last syscall to the user stack */
+    if (__options.profile)
+        myst_profile_sample(thread, NULL);
+
+    myst_event(MYST_EVENT_SYSCALL, MYST_EVENT_SYSCALL_ENTER, (uint64_t)n, 0);
+    myst_event_syscall_args(params);
+
+    /* the scratch blocks allocated from here on are freed on exit */
+    myst_scratch_enter(thread, &scratch_mark);
+
     // Process signals pending for this thread, if there is any.
-    myst_signal_process(thread);
+    myst_signal_process_pending(thread);
 
     /* ---------- running target thread descriptor ---------- */
 
@@ -2645,12 +3428,15 @@ long myst_syscall(long n, long params[6])
         case SYS_myst_gen_creds:
         {
             _strace(n, NULL);
-            BREAK(_forward_syscall(MYST_TCALL_GEN_CREDS, params));
+            BREAK(myst_attest_gen_creds(
+                (uint8_t**)x1, (size_t*)x2, (uint8_t**)x3, (size_t*)x4));
         }
         case SYS_myst_free_creds:
         {
             _strace(n, NULL);
-            BREAK(_forward_syscall(MYST_TCALL_FREE_CREDS, params));
+            myst_attest_free_creds(
+                (uint8_t*)x1, (size_t)x2, (uint8_t*)x3, (size_t)x4);
+            BREAK(0);
         }
         case SYS_myst_verify_cert:
         {
@@ -2667,6 +3453,34 @@ long myst_syscall(long n, long params[6])
             _strace(n, NULL);
             BREAK(_return(n, myst_tcall_poll_wake()));
         }
+        case SYS_myst_dump_malloc_top:
+        {
+            size_t max = (size_t)x1;
+
+            _strace(n, "max=%zu", max);
+            BREAK(_return(n, myst_dump_malloc_top(max)));
+        }
+        case SYS_myst_get_vdso:
+        {
+            _strace(n, NULL);
+            BREAK(_return(n, (long)__myst_kernel_args.vdso));
+        }
+        case SYS_myst_spawn:
+        {
+            const myst_spawn_args_t* args = (const myst_spawn_args_t*)x1;
+
+            _strace(n, "args=%p", args);
+
+            if (_bad_addr(args))
+                BREAK(_return(n, -EFAULT));
+
+            BREAK(_return(n, myst_syscall_spawn(args)));
+        }
+        case SYS_myst_startup_trace:
+        {
+            _strace(n, NULL);
+            BREAK(_return(n, myst_syscall_startup_trace()));
+        }
         case SYS_read:
         {
             int fd = (int)x1;
@@ -3045,8 +3859,15 @@ long myst_syscall(long n, long params[6])
             BREAK(_return(n, myst_msync(addr, length, flags)));
         }
         case SYS_mincore:
-            /* ATTN: hook up implementation */
-            break;
+        {
+            void* addr = (void*)x1;
+            size_t length = (size_t)x2;
+            unsigned char* vec = (unsigned char*)x3;
+
+            _strace(n, "addr=%p length=%zu vec=%p", addr, length, vec);
+
+            BREAK(_return(n, myst_mincore(addr, length, vec)));
+        }
         case SYS_madvise:
         {
             void* addr = (void*)x1;
@@ -3055,14 +3876,38 @@ long myst_syscall(long n, long params[6])
 
             _strace(n, "addr=%p length=%zu advice=%d", addr, length, advice);
 
-            BREAK(_return(n, 0));
+            BREAK(_return(n, myst_madvise(addr, length, advice)));
         }
         case SYS_shmget:
-            break;
+        {
+            key_t key = (key_t)x1;
+            size_t size = (size_t)x2;
+            int shmflg = (int)x3;
+
+            _strace(n, "key=%d size=%zu shmflg=%o", key, size, shmflg);
+
+            BREAK(_return(n, myst_syscall_shmget(key, size, shmflg)));
+        }
         case SYS_shmat:
-            break;
+        {
+            int shmid = (int)x1;
+            const void* shmaddr = (const void*)x2;
+            int shmflg = (int)x3;
+
+            _strace(n, "shmid=%d shmaddr=%p shmflg=%o", shmid, shmaddr, shmflg);
+
+            BREAK(_return(n, myst_syscall_shmat(shmid, shmaddr, shmflg)));
+        }
         case SYS_shmctl:
-            break;
+        {
+            int shmid = (int)x1;
+            int cmd = (int)x2;
+            void* buf = (void*)x3;
+
+            _strace(n, "shmid=%d cmd=%d buf=%p", shmid, cmd, buf);
+
+            BREAK(_return(n, myst_syscall_shmctl(shmid, cmd, buf)));
+        }
         case SYS_dup:
         {
             int oldfd = (int)x1;
@@ -3183,7 +4028,13 @@ long myst_syscall(long n, long params[6])
                     fn, child_stack, flags, arg, ptid, newtls, ctid)));
         }
         case SYS_fork:
-            break;
+        {
+            _strace(n, NULL);
+
+            /* processes share the address space, so a child cannot have its
+             * own copy of the parent's memory (use vfork() or posix_spawn()) */
+            BREAK(_return(n, -ENOSYS));
+        }
         case SYS_vfork:
             break;
         case SYS_execve:
@@ -3259,7 +4110,13 @@ long myst_syscall(long n, long params[6])
         case SYS_semctl:
             break;
         case SYS_shmdt:
-            break;
+        {
+            const void* shmaddr = (const void*)x1;
+
+            _strace(n, "shmaddr=%p", shmaddr);
+
+            BREAK(_return(n, myst_syscall_shmdt(shmaddr)));
+        }
         case SYS_msgget:
             break;
         case SYS_msgsnd:
@@ -3299,7 +4156,14 @@ long myst_syscall(long n, long params[6])
             BREAK(_return(n, myst_syscall_fsync(fd)));
         }
         case SYS_fdatasync:
-            break;
+        {
+            int fd = (int)x1;
+
+            _strace(n, "fd=%d", fd);
+
+            /* the buffered data is all there is to write back */
+            BREAK(_return(n, myst_syscall_fsync(fd)));
+        }
         case SYS_truncate:
         {
             const char* path = (const char*)x1;
@@ -3616,7 +4480,17 @@ long myst_syscall(long n, long params[6])
         case SYS_rt_sigtimedwait:
             break;
         case SYS_rt_sigqueueinfo:
-            break;
+        {
+            pid_t tgid = (pid_t)x1;
+            int sig = (int)x2;
+            const siginfo_t* uinfo = (const siginfo_t*)x3;
+            long ret;
+
+            _strace(n, "tgid=%d sig=%d uinfo=%p", tgid, sig, uinfo);
+
+            ret = myst_syscall_rt_tgsigqueueinfo(tgid, 0, sig, uinfo);
+            BREAK(_return(n, ret));
+        }
         case SYS_rt_sigsuspend:
             break;
         case SYS_sigaltstack:
@@ -3935,7 +4809,7 @@ long myst_syscall(long n, long params[6])
             int val = (int)x3;
             long arg = (long)x4;
             int* uaddr2 = (int*)x5;
-            int val3 = (int)val3;
+            int val3 = (int)x6;
 
             _strace(
                 n,
@@ -3953,34 +4827,24 @@ long myst_syscall(long n, long params[6])
         case SYS_sched_setaffinity:
         {
             pid_t pid = (pid_t)x1;
-            size_t cpusetsize = (pid_t)x2;
-            cpu_set_t* mask = (cpu_set_t*)x3;
-
-            _strace(
-                n, "pid=%d cpusetsize=%zu mask=%p\n", pid, cpusetsize, mask);
+            size_t cpusetsize = (size_t)x2;
+            const cpu_set_t* mask = (const cpu_set_t*)x3;
 
-            /* ATTN: support set affinity requests */
+            _strace(n, "pid=%d cpusetsize=%zu mask=%p", pid, cpusetsize, mask);
 
-            BREAK(_return(n, 0));
+            BREAK(_return(
+                n, myst_syscall_sched_setaffinity(pid, cpusetsize, mask)));
         }
         case SYS_sched_getaffinity:
         {
             pid_t pid = (pid_t)x1;
-            size_t cpusetsize = (pid_t)x2;
+            size_t cpusetsize = (size_t)x2;
             cpu_set_t* mask = (cpu_set_t*)x3;
 
-            _strace(
-                n, "pid=%d cpusetsize=%zu mask=%p\n", pid, cpusetsize, mask);
-
-            // ATTN: return the cpu id from sched_setaffinity.
-            // for now, make all threads fixed to cpu 0.
-            if (mask != NULL)
-            {
-                CPU_ZERO(mask);
-                CPU_SET(0, mask);
-            }
+            _strace(n, "pid=%d cpusetsize=%zu mask=%p", pid, cpusetsize, mask);
 
-            BREAK(_return(n, cpusetsize));
+            BREAK(_return(
+                n, myst_syscall_sched_getaffinity(pid, cpusetsize, mask)));
         }
         case SYS_set_thread_area:
         {
@@ -4083,15 +4947,70 @@ long myst_syscall(long n, long params[6])
             BREAK(_return(n, 0));
         }
         case SYS_timer_create:
-            break;
+        {
+            clockid_t clockid = (clockid_t)x1;
+            const void* sevp = (const void*)x2;
+            int* timerid = (int*)x3;
+
+            _strace(n, "clockid=%d sevp=%p timerid=%p", clockid, sevp, timerid);
+
+            if (_bad_addr(sevp) || _bad_addr(timerid))
+                BREAK(_return(n, -EFAULT));
+
+            BREAK(_return(
+                n, myst_syscall_timer_create(clockid, sevp, timerid)));
+        }
         case SYS_timer_settime:
-            break;
+        {
+            int timerid = (int)x1;
+            int flags = (int)x2;
+            const struct itimerspec* new_value = (const struct itimerspec*)x3;
+            struct itimerspec* old_value = (struct itimerspec*)x4;
+
+            _strace(
+                n,
+                "timerid=%d flags=%d new_value=%p old_value=%p",
+                timerid,
+                flags,
+                new_value,
+                old_value);
+
+            if (_bad_addr(new_value) || _bad_addr(old_value))
+                BREAK(_return(n, -EFAULT));
+
+            BREAK(_return(
+                n,
+                myst_syscall_timer_settime(
+                    timerid, flags, new_value, old_value)));
+        }
         case SYS_timer_gettime:
-            break;
+        {
+            int timerid = (int)x1;
+            struct itimerspec* curr_value = (struct itimerspec*)x2;
+
+            _strace(n, "timerid=%d curr_value=%p", timerid, curr_value);
+
+            if (_bad_addr(curr_value))
+                BREAK(_return(n, -EFAULT));
+
+            BREAK(_return(n, myst_syscall_timer_gettime(timerid, curr_value)));
+        }
         case SYS_timer_getoverrun:
-            break;
+        {
+            int timerid = (int)x1;
+
+            _strace(n, "timerid=%d", timerid);
+
+            BREAK(_return(n, myst_syscall_timer_getoverrun(timerid)));
+        }
         case SYS_timer_delete:
-            break;
+        {
+            int timerid = (int)x1;
+
+            _strace(n, "timerid=%d", timerid);
+
+            BREAK(_return(n, myst_syscall_timer_delete(timerid)));
+        }
         case SYS_clock_settime:
         {
             clockid_t clk_id = (clockid_t)x1;
@@ -4177,11 +5096,63 @@ long myst_syscall(long n, long params[6])
         case SYS_vserver:
             break;
         case SYS_mbind:
-            break;
+        {
+            void* addr = (void*)x1;
+            unsigned long len = (unsigned long)x2;
+            int mode = (int)x3;
+            const unsigned long* nodemask = (const unsigned long*)x4;
+            unsigned long maxnode = (unsigned long)x5;
+            unsigned int flags = (unsigned int)x6;
+
+            _strace(
+                n,
+                "addr=%p len=%lu mode=%d nodemask=%p maxnode=%lu flags=%u",
+                addr,
+                len,
+                mode,
+                nodemask,
+                maxnode,
+                flags);
+
+            BREAK(_return(
+                n,
+                myst_syscall_mbind(
+                    addr, len, mode, nodemask, maxnode, flags)));
+        }
         case SYS_set_mempolicy:
-            break;
+        {
+            int mode = (int)x1;
+            const unsigned long* nodemask = (const unsigned long*)x2;
+            unsigned long maxnode = (unsigned long)x3;
+
+            _strace(
+                n, "mode=%d nodemask=%p maxnode=%lu", mode, nodemask, maxnode);
+
+            BREAK(_return(
+                n, myst_syscall_set_mempolicy(mode, nodemask, maxnode)));
+        }
         case SYS_get_mempolicy:
-            break;
+        {
+            int* mode = (int*)x1;
+            unsigned long* nodemask = (unsigned long*)x2;
+            unsigned long maxnode = (unsigned long)x3;
+            void* addr = (void*)x4;
+            unsigned long flags = (unsigned long)x5;
+
+            _strace(
+                n,
+                "mode=%p nodemask=%p maxnode=%lu addr=%p flags=%lu",
+                mode,
+                nodemask,
+                maxnode,
+                addr,
+                flags);
+
+            BREAK(_return(
+                n,
+                myst_syscall_get_mempolicy(
+                    mode, nodemask, maxnode, addr, flags)));
+        }
         case SYS_mq_open:
             break;
         case SYS_mq_unlink:
@@ -4323,13 +5294,66 @@ long myst_syscall(long n, long params[6])
         case SYS_get_robust_list:
             break;
         case SYS_splice:
-            break;
+        {
+            int fd_in = (int)x1;
+            off_t* off_in = (off_t*)x2;
+            int fd_out = (int)x3;
+            off_t* off_out = (off_t*)x4;
+            size_t len = (size_t)x5;
+            unsigned int flags = (unsigned int)x6;
+
+            _strace(
+                n,
+                "fd_in=%d off_in=%p fd_out=%d off_out=%p len=%zu flags=0x%x",
+                fd_in,
+                off_in,
+                fd_out,
+                off_out,
+                len,
+                flags);
+
+            long ret = myst_syscall_splice(
+                fd_in, off_in, fd_out, off_out, len, flags);
+            BREAK(_return(n, ret));
+        }
         case SYS_tee:
-            break;
+        {
+            int fd_in = (int)x1;
+            int fd_out = (int)x2;
+            size_t len = (size_t)x3;
+            unsigned int flags = (unsigned int)x4;
+
+            _strace(
+                n,
+                "fd_in=%d fd_out=%d len=%zu flags=0x%x",
+                fd_in,
+                fd_out,
+                len,
+                flags);
+
+            long ret = myst_syscall_tee(fd_in, fd_out, len, flags);
+            BREAK(_return(n, ret));
+        }
         case SYS_sync_file_range:
             break;
         case SYS_vmsplice:
-            break;
+        {
+            int fd = (int)x1;
+            const struct iovec* iov = (const struct iovec*)x2;
+            size_t nr_segs = (size_t)x3;
+            unsigned int flags = (unsigned int)x4;
+
+            _strace(
+                n,
+                "fd=%d iov=%p nr_segs=%zu flags=0x%x",
+                fd,
+                iov,
+                nr_segs,
+                flags);
+
+            long ret = myst_syscall_vmsplice(fd, iov, nr_segs, flags);
+            BREAK(_return(n, ret));
+        }
         case SYS_move_pages:
             break;
         case SYS_utimensat:
@@ -4376,9 +5400,24 @@ long myst_syscall(long n, long params[6])
         case SYS_signalfd:
             break;
         case SYS_timerfd_create:
-            break;
+        {
+            int clockid = (int)x1;
+            int flags = (int)x2;
+
+            _strace(n, "clockid=%d flags=%o", clockid, flags);
+
+            long ret = myst_syscall_timerfd_create(clockid, flags);
+            BREAK(_return(n, ret));
+        }
         case SYS_eventfd:
-            break;
+        {
+            unsigned int initval = (unsigned int)x1;
+
+            _strace(n, "initval=%u", initval);
+
+            long ret = myst_syscall_eventfd2(initval, 0);
+            BREAK(_return(n, ret));
+        }
         case SYS_fallocate:
         {
             int fd = (int)x1;
@@ -4393,9 +5432,34 @@ long myst_syscall(long n, long params[6])
             BREAK(_return(n, 0));
         }
         case SYS_timerfd_settime:
-            break;
+        {
+            int fd = (int)x1;
+            int flags = (int)x2;
+            const struct itimerspec* new_value = (const struct itimerspec*)x3;
+            struct itimerspec* old_value = (struct itimerspec*)x4;
+            long ret;
+
+            _strace(
+                n,
+                "fd=%d flags=%d new_value=%p old_value=%p",
+                fd,
+                flags,
+                new_value,
+                old_value);
+
+            ret = myst_syscall_timerfd_settime(fd, flags, new_value, old_value);
+            BREAK(_return(n, ret));
+        }
         case SYS_timerfd_gettime:
-            break;
+        {
+            int fd = (int)x1;
+            struct itimerspec* curr_value = (struct itimerspec*)x2;
+
+            _strace(n, "fd=%d curr_value=%p", fd, curr_value);
+
+            long ret = myst_syscall_timerfd_gettime(fd, curr_value);
+            BREAK(_return(n, ret));
+        }
         case SYS_accept4:
         {
             int sockfd = (int)x1;
@@ -4418,7 +5482,15 @@ long myst_syscall(long n, long params[6])
         case SYS_signalfd4:
             break;
         case SYS_eventfd2:
-            break;
+        {
+            unsigned int initval = (unsigned int)x1;
+            int flags = (int)x2;
+
+            _strace(n, "initval=%u flags=%o", initval, flags);
+
+            long ret = myst_syscall_eventfd2(initval, flags);
+            BREAK(_return(n, ret));
+        }
         case SYS_epoll_create1:
         {
             int flags = (int)x1;
@@ -4435,7 +5507,7 @@ long myst_syscall(long n, long params[6])
             _strace(n, "pipefd=%p flags=%0o", pipefd, flags);
             ret = myst_syscall_pipe2(pipefd, flags);
 
-            if (__options.trace_syscalls)
+            if (MYST_TRACE_SYSCALLS)
                 myst_eprintf("    pipefd[]=[%d:%d]\n", pipefd[0], pipefd[1]);
 
             BREAK(_return(n, ret));
@@ -4454,11 +5526,45 @@ long myst_syscall(long n, long params[6])
         case SYS_pwritev:
             break;
         case SYS_rt_tgsigqueueinfo:
-            break;
+        {
+            pid_t tgid = (pid_t)x1;
+            pid_t tid = (pid_t)x2;
+            int sig = (int)x3;
+            const siginfo_t* uinfo = (const siginfo_t*)x4;
+            long ret;
+
+            _strace(
+                n, "tgid=%d tid=%d sig=%d uinfo=%p", tgid, tid, sig, uinfo);
+
+            if (tid <= 0)
+                ret = -EINVAL;
+            else
+                ret = myst_syscall_rt_tgsigqueueinfo(tgid, tid, sig, uinfo);
+            BREAK(_return(n, ret));
+        }
         case SYS_perf_event_open:
             break;
         case SYS_recvmmsg:
-            break;
+        {
+            int sockfd = (int)x1;
+            struct mmsghdr* msgvec = (struct mmsghdr*)x2;
+            unsigned int vlen = (unsigned int)x3;
+            int flags = (int)x4;
+            struct timespec* timeout = (struct timespec*)x5;
+            long ret;
+
+            _strace(
+                n,
+                "sockfd=%d msgvec=%p vlen=%u flags=%d timeout=%p",
+                sockfd,
+                msgvec,
+                vlen,
+                flags,
+                timeout);
+
+            ret = myst_syscall_recvmmsg(sockfd, msgvec, vlen, flags, timeout);
+            BREAK(_return(n, ret));
+        }
         case SYS_fanotify_init:
             break;
         case SYS_fanotify_mark:
@@ -4490,7 +5596,24 @@ long myst_syscall(long n, long params[6])
         case SYS_syncfs:
             break;
         case SYS_sendmmsg:
-            break;
+        {
+            int sockfd = (int)x1;
+            struct mmsghdr* msgvec = (struct mmsghdr*)x2;
+            unsigned int vlen = (unsigned int)x3;
+            int flags = (int)x4;
+            long ret;
+
+            _strace(
+                n,
+                "sockfd=%d msgvec=%p vlen=%u flags=%d",
+                sockfd,
+                msgvec,
+                vlen,
+                flags);
+
+            ret = myst_syscall_sendmmsg(sockfd, msgvec, vlen, flags);
+            BREAK(_return(n, ret));
+        }
         case SYS_setns:
             break;
         case SYS_getcpu:
@@ -4502,9 +5625,9 @@ long myst_syscall(long n, long params[6])
             _strace(n, "cpu=%p node=%p, tcache=%p", cpu, node, tcache);
 
             // ATTN: report the real NUMA node id and cpu id.
-            // For now, always report id 0 for them.
+            // For now, report the first CPU the thread may run on.
             if (cpu)
-                *cpu = 0;
+                *cpu = myst_affinity_first_cpu(thread);
 
             if (node)
                 *node = 0;
@@ -4561,7 +5684,28 @@ long myst_syscall(long n, long params[6])
         case SYS_mlock2:
             break;
         case SYS_copy_file_range:
-            break;
+        {
+            int fd_in = (int)x1;
+            off_t* off_in = (off_t*)x2;
+            int fd_out = (int)x3;
+            off_t* off_out = (off_t*)x4;
+            size_t len = (size_t)x5;
+            unsigned int flags = (unsigned int)x6;
+
+            _strace(
+                n,
+                "fd_in=%d off_in=%p fd_out=%d off_out=%p len=%zu flags=0x%x",
+                fd_in,
+                off_in,
+                fd_out,
+                off_out,
+                len,
+                flags);
+
+            long ret = myst_syscall_copy_file_range(
+                fd_in, off_in, fd_out, off_out, len, flags);
+            BREAK(_return(n, ret));
+        }
         case SYS_preadv2:
             break;
         case SYS_pwritev2:
@@ -4872,23 +6016,111 @@ long myst_syscall(long n, long params[6])
             BREAK(_return(n, ret));
             break;
         }
-        /* forward Open Enclave extensions to the target */
+        /* the evidence may come from the attestation cache */
         case SYS_myst_oe_get_report_v2:
+        {
+            const uint64_t* args = (const uint64_t*)x1;
+            myst_oe_report_args_t a = {
+                (uint32_t)args[0],
+                (const uint8_t*)args[1],
+                (size_t)args[2],
+                (const void*)args[3],
+                (size_t)args[4],
+                (uint8_t**)args[5],
+                (size_t*)args[6],
+            };
+
+            _strace(n, "cached");
+            BREAK(_return(n, myst_attest_get_report(&a)));
+        }
         case SYS_myst_oe_free_report:
+        {
+            const uint64_t* args = (const uint64_t*)x1;
+
+            _strace(n, "cached");
+            myst_attest_free_report((uint8_t*)args[0]);
+            BREAK(_return(n, 0));
+        }
+        case SYS_myst_oe_generate_attestation_certificate:
+        {
+            const uint64_t* args = (const uint64_t*)x1;
+            myst_oe_cert_args_t a = {
+                (const unsigned char*)args[0],
+                (const uint8_t*)args[1],
+                (size_t)args[2],
+                (const uint8_t*)args[3],
+                (size_t)args[4],
+                (uint8_t**)args[5],
+                (size_t*)args[6],
+            };
+
+            _strace(n, "cached");
+            BREAK(_return(n, myst_attest_generate_certificate(&a)));
+        }
+        case SYS_myst_oe_free_attestation_certificate:
+        {
+            const uint64_t* args = (const uint64_t*)x1;
+
+            _strace(n, "cached");
+            myst_attest_free_certificate((uint8_t*)args[0]);
+            BREAK(_return(n, 0));
+        }
+        case SYS_myst_oe_free_key:
+        {
+            const uint64_t* args = (const uint64_t*)x1;
+
+            _strace(n, "cached");
+            myst_attest_free_key(
+                (uint8_t*)args[0],
+                (size_t)args[1],
+                (uint8_t*)args[2],
+                (size_t)args[3]);
+            BREAK(_return(n, 0));
+        }
+        case SYS_myst_oe_get_seal_key_by_policy_v2:
+        {
+            const uint64_t* args = (const uint64_t*)x1;
+
+            _strace(n, "cached");
+            BREAK(_return(
+                n,
+                myst_attest_get_seal_key_by_policy(
+                    args[0],
+                    (uint8_t**)args[1],
+                    (size_t*)args[2],
+                    (uint8_t**)args[3],
+                    (size_t*)args[4])));
+        }
+        case SYS_myst_oe_get_seal_key_v2:
+        {
+            const uint64_t* args = (const uint64_t*)x1;
+
+            _strace(n, "cached");
+            BREAK(_return(
+                n,
+                myst_attest_get_seal_key(
+                    (const uint8_t*)args[0],
+                    (size_t)args[1],
+                    (uint8_t**)args[2],
+                    (size_t*)args[3])));
+        }
+        case SYS_myst_oe_free_seal_key:
+        {
+            const uint64_t* args = (const uint64_t*)x1;
+
+            _strace(n, "cached");
+            myst_attest_free_seal_key((uint8_t*)args[0], (uint8_t*)args[1]);
+            BREAK(_return(n, 0));
+        }
+        /* forward Open Enclave extensions to the target */
         case SYS_myst_oe_get_target_info_v2:
         case SYS_myst_oe_free_target_info:
         case SYS_myst_oe_parse_report:
         case SYS_myst_oe_verify_report:
-        case SYS_myst_oe_get_seal_key_by_policy_v2:
         case SYS_myst_oe_get_public_key_by_policy:
         case SYS_myst_oe_get_public_key:
         case SYS_myst_oe_get_private_key_by_policy:
         case SYS_myst_oe_get_private_key:
-        case SYS_myst_oe_free_key:
-        case SYS_myst_oe_get_seal_key_v2:
-        case SYS_myst_oe_free_seal_key:
-        case SYS_myst_oe_generate_attestation_certificate:
-        case SYS_myst_oe_free_attestation_certificate:
         case SYS_myst_oe_verify_attestation_certificate:
         case SYS_myst_oe_result_str:
         {
@@ -4905,6 +6137,9 @@ long myst_syscall(long n, long params[6])
 
 done:
 
+    myst_fdtable_drop_holds(thread);
+    myst_scratch_leave(thread, &scratch_mark);
+
     /* ---------- running target thread descriptor ---------- */
 
     /* the C-runtime must execute on its own thread descriptor */
@@ -4913,8 +6148,29 @@ done:
 
     myst_times_leave_kernel();
 
+    if (__options.syscall_stats)
+    {
+        const uint64_t nsec = myst_syscall_stats_now() - stats_start;
+        const uint64_t tcall_nsec = thread->tcall_nsec - stats_tcall_nsec;
+        myst_syscall_stats_record(thread, n, syscall_ret, nsec, tcall_nsec);
+    }
+
+    /* charge the time in the syscall to it */
+    if (__options.profile)
+        myst_profile_sample(thread, syscall_str(n));
+
+    myst_event(
+        MYST_EVENT_SYSCALL,
+        MYST_EVENT_SYSCALL_EXIT,
+        (uint64_t)n,
+        (uint64_t)syscall_ret);
+
+    /* apply a CPU affinity that another thread set for this one */
+    if (__atomic_load_n(&thread->affinity_pending, __ATOMIC_RELAXED))
+        myst_affinity_apply_pending(thread);
+
     // Process signals pending for this thread, if there is any.
-    myst_signal_process(thread);
+    myst_signal_process_pending(thread);
 
     return syscall_ret;
 }
@@ -4959,6 +6215,14 @@ long myst_syscall_clock_gettime(clockid_t clk_id, struct timespec* tp)
         return 0;
     }
 
+    /* the coarse clocks are read from the clock page (without the lock and
+     * the tcall), which is what file timestamps and time() use */
+    if ((clk_id == CLOCK_REALTIME_COARSE || clk_id == CLOCK_MONOTONIC_COARSE) &&
+        __myst_kernel_args.vdso)
+    {
+        return myst_vdso_clock_gettime(__myst_kernel_args.vdso, clk_id, tp);
+    }
+
     myst_spin_lock(&_get_time_lock);
     long params[6] = {(long)clk_id, (long)tp};
     long ret = myst_tcall(MYST_TCALL_CLOCK_GETTIME, params);
@@ -4994,7 +6258,7 @@ long myst_syscall_gettimeofday(struct timeval* tv, struct timezone* tz)
 long myst_syscall_time(time_t* tloc)
 {
     struct timespec tp = {0};
-    long ret = myst_syscall_clock_gettime(CLOCK_REALTIME, &tp);
+    long ret = myst_syscall_clock_gettime(CLOCK_REALTIME_COARSE, &tp);
     if (ret == 0)
     {
         if (tloc != NULL)
@@ -5024,12 +6288,58 @@ long myst_syscall_tgkill(int tgid, int tid, int sig)
     if (tgid != thread->pid)
         ERAISE(-EINVAL);
 
-    siginfo_t* siginfo = calloc(1, sizeof(siginfo_t));
-    siginfo->si_code = SI_TKILL;
-    siginfo->si_signo = sig;
-    myst_signal_deliver(target, sig, siginfo);
+    siginfo_t siginfo = {0};
+    siginfo.si_code = SI_TKILL;
+    siginfo.si_signo = sig;
+    myst_signal_deliver(target, (unsigned)sig, &siginfo);
+
+done:
+    myst_put_thread(target);
+    return ret;
+}
+
+long myst_syscall_rt_tgsigqueueinfo(
+    int tgid,
+    int tid,
+    int sig,
+    const siginfo_t* uinfo)
+{
+    long ret = 0;
+    myst_thread_t* thread = myst_thread_self();
+    myst_thread_t* target = NULL;
+    siginfo_t siginfo;
+
+    if (!uinfo)
+        ERAISE(-EFAULT);
+
+    /* tid is the process thread for rt_sigqueueinfo() (tid == 0) */
+    if (tid == 0)
+    {
+        if (!(target = myst_tid_map_find(tgid)) ||
+            !myst_is_process_thread(target))
+            ERAISE(-ESRCH);
+    }
+    else if (!(target = myst_find_thread(tid)) || target->pid != tgid)
+    {
+        ERAISE(-ESRCH);
+    }
+
+    /* as with Linux, only the kernel may send kill() and tgkill() codes */
+    if ((uinfo->si_code >= 0 || uinfo->si_code == SI_TKILL) &&
+        thread->pid != tgid)
+    {
+        ERAISE(-EPERM);
+    }
+
+    if (sig == 0)
+        goto done;
+
+    siginfo = *uinfo;
+    siginfo.si_signo = sig;
+    ERAISE(myst_signal_deliver(target, (unsigned)sig, &siginfo));
 
 done:
+    myst_put_thread(target);
     return ret;
 }
 
@@ -5037,7 +6347,16 @@ long myst_syscall_kill(int pid, int sig)
 {
     long ret = 0;
     myst_thread_t* thread = myst_thread_self();
-    myst_thread_t* process_thread = myst_find_process_thread(thread);
+    myst_thread_t* process_thread = myst_tid_map_find(pid);
+
+    /* fast path: a running process */
+    if (process_thread && myst_is_process_thread(process_thread))
+        goto found;
+
+    myst_put_thread(process_thread);
+
+    /* otherwise search the process list (which also retains zombies) */
+    process_thread = myst_find_process_thread(thread);
 
     myst_spin_lock(&myst_process_list_lock);
 
@@ -5060,24 +6379,30 @@ long myst_syscall_kill(int pid, int sig)
         }
     }
 
+    /* keep a zombie from being reaped and recycled under the caller */
+    myst_get_thread(process_thread);
+
     myst_spin_unlock(&myst_process_list_lock);
 
+found:
+
     // Did we finally find it?
     if (process_thread->pid == pid)
     {
         // Deliver signal
-        siginfo_t* siginfo = calloc(1, sizeof(siginfo_t));
-        siginfo->si_code = SI_USER;
-        siginfo->si_signo = sig;
-        siginfo->si_pid = thread->pid;
-        siginfo->si_uid = MYST_DEFAULT_UID;
+        siginfo_t siginfo = {0};
+        siginfo.si_code = SI_USER;
+        siginfo.si_signo = sig;
+        siginfo.si_pid = thread->pid;
+        siginfo.si_uid = MYST_DEFAULT_UID;
 
-        ret = myst_signal_deliver(process_thread, sig, siginfo);
+        ret = myst_signal_deliver(process_thread, (unsigned)sig, &siginfo);
     }
     else
         ERAISE(-ESRCH);
 
 done:
+    myst_put_thread(process_thread);
     return ret;
 }
 
@@ -5087,41 +6412,3 @@ long myst_syscall_isatty(int fd)
     return myst_tcall(MYST_TCALL_ISATTY, params);
 }
 
-long myst_syscall_add_symbol_file(
-    const char* path,
-    const void* text,
-    size_t text_size)
-{
-    long ret = 0;
-    void* file_data = NULL;
-    size_t file_size;
-    long params[6] = {0};
-
-    ECHECK(myst_load_file(path, &file_data, &file_size));
-
-    params[0] = (long)file_data;
-    params[1] = (long)file_size;
-    params[2] = (long)text;
-    params[3] = (long)text_size;
-
-    ECHECK(myst_tcall(MYST_TCALL_ADD_SYMBOL_FILE, params));
-
-done:
-
-    if (file_data)
-        free(file_data);
-
-    return ret;
-}
-
-long myst_syscall_load_symbols(void)
-{
-    long params[6] = {0};
-    return myst_tcall(MYST_TCALL_LOAD_SYMBOLS, params);
-}
-
-long myst_syscall_unload_symbols(void)
-{
-    long params[6] = {0};
-    return myst_tcall(MYST_TCALL_UNLOAD_SYMBOLS, params);
-}
@@ -0,0 +1,298 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <myst/atexit.h>
+#include <myst/console.h>
+#include <myst/defs.h>
+#include <myst/eraise.h>
+#include <myst/once.h>
+#include <myst/options.h>
+#include <myst/syscall.h>
+#include <myst/syscallext.h>
+#include <myst/syscallstats.h>
+#include <myst/tcall.h>
+
+/*
+**==============================================================================
+**
+** Syscall statistics (enabled by the --syscall-stats option).
+**
+**     Counters are updated with relaxed atomics in one of SHARDS copies of
+**     the table, chosen by tid, so that threads rarely share cache lines.
+**     The copies are summed whenever the statistics are read.
+**
+**     Linux syscall numbers map directly to table slots; the myst-specific
+**     syscalls (starting at SYS_myst_trace) follow them.
+**
+**==============================================================================
+*/
+
+#define SHARDS 4
+#define NUM_LINUX_SYSCALLS 512
+#define NUM_MYST_SYSCALLS 64
+#define NUM_SLOTS (NUM_LINUX_SYSCALLS + NUM_MYST_SYSCALLS)
+
+typedef struct slot
+{
+    size_t calls;
+    size_t errors;
+    uint64_t nsec;
+    uint64_t tcall_nsec;
+    size_t hist[MYST_SYSCALL_STATS_BUCKETS];
+} slot_t;
+
+static slot_t* _shards[SHARDS];
+static myst_once_t _init_once;
+
+static void _free_shards(void* arg)
+{
+    (void)arg;
+
+    for (size_t i = 0; i < SHARDS; i++)
+    {
+        free(_shards[i]);
+        _shards[i] = NULL;
+    }
+}
+
+static void _init_shards(void)
+{
+    for (size_t i = 0; i < SHARDS; i++)
+    {
+        if (!(_shards[i] = calloc(NUM_SLOTS, sizeof(slot_t))))
+            break;
+    }
+
+    myst_atexit(_free_shards, NULL);
+}
+
+static long _slot_to_syscall(size_t slot)
+{
+    if (slot < NUM_LINUX_SYSCALLS)
+        return (long)slot;
+
+    return SYS_myst_trace + (long)(slot - NUM_LINUX_SYSCALLS);
+}
+
+static ssize_t _syscall_to_slot(long n)
+{
+    if (n >= 0 && n < NUM_LINUX_SYSCALLS)
+        return n;
+
+    if (n >= SYS_myst_trace && n < SYS_myst_trace + NUM_MYST_SYSCALLS)
+        return NUM_LINUX_SYSCALLS + (n - SYS_myst_trace);
+
+    return -1;
+}
+
+static size_t _bucket(uint64_t nsec)
+{
+    size_t i = 63 - (size_t)__builtin_clzl(nsec | 1);
+    return i < MYST_SYSCALL_STATS_BUCKETS ? i : MYST_SYSCALL_STATS_BUCKETS - 1;
+}
+
+uint64_t myst_syscall_stats_now(void)
+{
+    struct timespec ts;
+    long params[6] = {CLOCK_MONOTONIC, (long)&ts};
+
+    if (myst_tcall(MYST_TCALL_CLOCK_GETTIME, params) != 0)
+        return 0;
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void myst_syscall_stats_record(
+    myst_thread_t* thread,
+    long n,
+    long ret,
+    uint64_t nsec,
+    uint64_t tcall_nsec)
+{
+    ssize_t index = _syscall_to_slot(n);
+    slot_t* shard;
+    slot_t* slot;
+
+    if (index < 0)
+        return;
+
+    myst_once(&_init_once, _init_shards);
+
+    if (!(shard = _shards[(size_t)thread->tid % SHARDS]))
+        return;
+
+    slot = &shard[index];
+    __atomic_fetch_add(&slot->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot->nsec, nsec, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot->tcall_nsec, tcall_nsec, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot->hist[_bucket(nsec)], 1, __ATOMIC_RELAXED);
+
+    if (ret < 0 && ret >= -4095)
+        __atomic_fetch_add(&slot->errors, 1, __ATOMIC_RELAXED);
+}
+
+size_t myst_get_syscall_stats(myst_syscall_stat_t* stats, size_t count)
+{
+    size_t num = 0;
+
+    for (size_t i = 0; i < NUM_SLOTS; i++)
+    {
+        myst_syscall_stat_t s;
+
+        memset(&s, 0, sizeof(s));
+        s.n = _slot_to_syscall(i);
+
+        for (size_t j = 0; j < SHARDS; j++)
+        {
+            const slot_t* p;
+
+            if (!_shards[j])
+                continue;
+
+            p = &_shards[j][i];
+            s.calls += __atomic_load_n(&p->calls, __ATOMIC_RELAXED);
+            s.errors += __atomic_load_n(&p->errors, __ATOMIC_RELAXED);
+            s.nsec += __atomic_load_n(&p->nsec, __ATOMIC_RELAXED);
+            s.tcall_nsec += __atomic_load_n(&p->tcall_nsec, __ATOMIC_RELAXED);
+
+            for (size_t k = 0; k < MYST_SYSCALL_STATS_BUCKETS; k++)
+                s.hist[k] += __atomic_load_n(&p->hist[k], __ATOMIC_RELAXED);
+        }
+
+        if (s.calls == 0)
+            continue;
+
+        /* insert in order of decreasing total time */
+        if (stats)
+        {
+            size_t pos = num < count ? num : count;
+
+            while (pos > 0 && stats[pos - 1].nsec < s.nsec)
+            {
+                if (pos < count)
+                    stats[pos] = stats[pos - 1];
+                pos--;
+            }
+
+            if (pos < count)
+                stats[pos] = s;
+        }
+
+        num++;
+    }
+
+    return num;
+}
+
+static int _appendf(myst_buf_t* buf, const char* fmt, ...)
+{
+    char tmp[256];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return -EINVAL;
+
+    if ((size_t)n >= sizeof(tmp))
+        n = sizeof(tmp) - 1;
+
+    return myst_buf_append(buf, tmp, (size_t)n);
+}
+
+int myst_format_syscall_stats(myst_buf_t* buf)
+{
+    int ret = 0;
+    myst_syscall_stat_t* stats = NULL;
+    size_t n;
+
+    if (!buf)
+        ERAISE(-EINVAL);
+
+    if (!__options.syscall_stats)
+    {
+        ECHECK(_appendf(buf, "syscall statistics are disabled\n"));
+        goto done;
+    }
+
+    if (!(stats = calloc(NUM_SLOTS, sizeof(myst_syscall_stat_t))))
+        ERAISE(-ENOMEM);
+
+    n = myst_get_syscall_stats(stats, NUM_SLOTS);
+
+    ECHECK(_appendf(
+        buf,
+        "%-24s %10s %8s %12s %12s %10s\n",
+        "syscall",
+        "calls",
+        "errors",
+        "kernel-usecs",
+        "tcall-usecs",
+        "usecs/call"));
+
+    for (size_t i = 0; i < n && i < NUM_SLOTS; i++)
+    {
+        const myst_syscall_stat_t* s = &stats[i];
+        const uint64_t kernel_nsec =
+            s->nsec > s->tcall_nsec ? s->nsec - s->tcall_nsec : 0;
+
+        ECHECK(_appendf(
+            buf,
+            "%-24s %10zu %8zu %12lu %12lu %10lu\n",
+            syscall_str(s->n),
+            s->calls,
+            s->errors,
+            kernel_nsec / 1000,
+            s->tcall_nsec / 1000,
+            s->nsec / s->calls / 1000));
+    }
+
+    /* latency histograms: "2^k:count" means count calls took [2^k,2^k+1) ns */
+    ECHECK(_appendf(buf, "\nlatency histograms (log2 nanoseconds):\n"));
+
+    for (size_t i = 0; i < n && i < NUM_SLOTS; i++)
+    {
+        const myst_syscall_stat_t* s = &stats[i];
+
+        ECHECK(_appendf(buf, "%-24s", syscall_str(s->n)));
+
+        for (size_t k = 0; k < MYST_SYSCALL_STATS_BUCKETS; k++)
+        {
+            if (s->hist[k])
+                ECHECK(_appendf(buf, " 2^%zu:%zu", k, s->hist[k]));
+        }
+
+        ECHECK(_appendf(buf, "\n"));
+    }
+
+done:
+
+    if (stats)
+        free(stats);
+
+    return ret;
+}
+
+void myst_dump_syscall_stats(void)
+{
+    myst_buf_t buf = MYST_BUF_INITIALIZER;
+
+    /* write directly since myst_eprintf() truncates long output */
+    if (myst_format_syscall_stats(&buf) == 0)
+    {
+        myst_console_flush();
+        myst_tcall_write_console(STDERR_FILENO, buf.data, buf.size);
+    }
+
+    myst_buf_release(&buf);
+}
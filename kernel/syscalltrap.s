@@ -0,0 +1,88 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//==============================================================================
+//
+// void myst_syscall_trampoline(void)
+//
+//     Runs a syscall instruction that trapped in the target (SGX cannot run
+//     it). The exception handler resumes the interrupted code here with:
+//
+//     (%rsp) := the address after the syscall instruction
+//     %rsp + 136 := the interrupted stack pointer (with its red zone between)
+//     %rax := the syscall number
+//     %rdi, %rsi, %rdx, %r10, %r8, %r9 := the syscall arguments
+//
+//     As with the syscall instruction, every register but %rax (the result),
+//     %rcx and %r11 is preserved, including the vector state: the kernel's
+//     memcpy() and friends use the ymm and zmm registers, so the trampoline
+//     saves every state component enabled in XCR0 with xsave64, in an area
+//     of myst_syscall_xsave_size bytes (aligned on 64 bytes, as required).
+//
+//==============================================================================
+
+.globl myst_syscall_trampoline
+.type myst_syscall_trampoline,@function
+myst_syscall_trampoline:
+.cfi_startproc
+    pushfq
+    push %rdi
+    push %rsi
+    push %rdx
+    push %r10
+    push %r8
+    push %r9
+    push %rbp
+    mov  %rsp, %rbp
+
+    // long params[6] (params[0] at the lowest address)
+    push %r9
+    push %r8
+    push %r10
+    push %rdx
+    push %rsi
+    push %rdi
+    mov  %rsp, %rsi
+    mov  %rax, %rdi
+
+    // the kernel may use the vector registers
+    mov  myst_syscall_xsave_size@GOTPCREL(%rip), %rcx
+    sub  (%rcx), %rsp
+    and  $-64, %rsp
+
+    // xsave64 leaves the rest of the header alone and xrstor64 rejects it
+    // unless it is zero (past the saved components bitmap)
+    movq $0, 512(%rsp)
+    movq $0, 520(%rsp)
+    movq $0, 528(%rsp)
+    movq $0, 536(%rsp)
+    movq $0, 544(%rsp)
+    movq $0, 552(%rsp)
+    movq $0, 560(%rsp)
+    movq $0, 568(%rsp)
+
+    // every component enabled in XCR0 (%rdx is saved in params)
+    mov  $-1, %eax
+    mov  $-1, %edx
+    xsave64 (%rsp)
+
+    call myst_syscall@PLT
+
+    mov  %rax, %r11
+    mov  $-1, %eax
+    mov  $-1, %edx
+    xrstor64 (%rsp)
+    mov  %r11, %rax
+    mov  %rbp, %rsp
+    pop  %rbp
+    pop  %r9
+    pop  %r8
+    pop  %r10
+    pop  %rdx
+    pop  %rsi
+    pop  %rdi
+    popfq
+
+    // return and release the red zone
+    ret  $128
+.cfi_endproc
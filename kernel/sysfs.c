@@ -0,0 +1,234 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <myst/affinity.h>
+#include <myst/eraise.h>
+#include <myst/file.h>
+#include <myst/mmanutils.h>
+#include <myst/mount.h>
+#include <myst/printf.h>
+#include <myst/ramfs.h>
+#include <myst/sysfs.h>
+
+/*
+**==============================================================================
+**
+** /sys/fs/cgroup: the enclave as a single cgroup v2 root.
+**
+**     Managed runtimes (the .NET GC, the JVM and Go) size their heaps and
+**     thread pools from the limits of their cgroup rather than from the
+**     host. The memory limit is the kernel memory region and the CPU limit
+**     is the online CPUs. The kernel never reclaims memory (a mapping that
+**     does not fit fails at once), so no task ever stalls on memory and
+**     memory.pressure stays zero.
+**
+**==============================================================================
+*/
+
+/* The period of cpu.max in microseconds (the Linux default) */
+#define CPU_PERIOD 100000
+
+static myst_fs_t* _sysfs;
+static myst_fs_t* _cgroupfs;
+
+static int _append(myst_buf_t* vbuf, const char* format, size_t value)
+{
+    char tmp[64];
+    int n = snprintf(tmp, sizeof(tmp), format, value);
+
+    if (n < 0 || (size_t)n >= sizeof(tmp))
+        return -EINVAL;
+
+    return myst_buf_append(vbuf, tmp, (size_t)n) == 0 ? 0 : -ENOMEM;
+}
+
+static int _used_ram(size_t* used)
+{
+    int ret = 0;
+    size_t total;
+    size_t free;
+
+    ECHECK(myst_get_total_ram(&total));
+    ECHECK(myst_get_free_ram(&free));
+    *used = total > free ? total - free : 0;
+
+done:
+    return ret;
+}
+
+static int _text_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    const char* text = arg;
+
+    myst_buf_clear(vbuf);
+    return myst_buf_append(vbuf, text, strlen(text));
+}
+
+static int _cpu_list_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    (void)arg;
+    myst_buf_clear(vbuf);
+    return myst_format_cpu_list(vbuf);
+}
+
+static int _cpu_max_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    int ret = 0;
+
+    (void)arg;
+    myst_buf_clear(vbuf);
+    ECHECK(_append(vbuf, "%zu", myst_get_num_cpus() * CPU_PERIOD));
+    ECHECK(_append(vbuf, " %zu\n", CPU_PERIOD));
+
+done:
+    return ret;
+}
+
+static int _memory_max_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    int ret = 0;
+    size_t total;
+
+    (void)arg;
+    ECHECK(myst_get_total_ram(&total));
+    myst_buf_clear(vbuf);
+    ECHECK(_append(vbuf, "%zu\n", total));
+
+done:
+    return ret;
+}
+
+static int _memory_current_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    int ret = 0;
+    size_t used;
+
+    (void)arg;
+    ECHECK(_used_ram(&used));
+    myst_buf_clear(vbuf);
+    ECHECK(_append(vbuf, "%zu\n", used));
+
+done:
+    return ret;
+}
+
+/* all of the memory in use is anonymous (the page caches are kernel heap) */
+static int _memory_stat_vcallback(myst_buf_t* vbuf, void* arg)
+{
+    int ret = 0;
+    size_t used;
+
+    (void)arg;
+    ECHECK(_used_ram(&used));
+    myst_buf_clear(vbuf);
+    ECHECK(_append(vbuf, "anon %zu\n", used));
+    ECHECK(_append(vbuf, "file %zu\n", 0));
+    ECHECK(_append(vbuf, "kernel %zu\n", 0));
+    ECHECK(_append(vbuf, "shmem %zu\n", 0));
+    ECHECK(_append(vbuf, "active_file %zu\n", 0));
+    ECHECK(_append(vbuf, "inactive_file %zu\n", 0));
+
+done:
+    return ret;
+}
+
+static const char _pressure[] =
+    "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+    "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+
+static int _setup_cgroupfs(void)
+{
+    int ret = 0;
+    static const struct
+    {
+        const char* name;
+        myst_vcallback_t vcallback;
+        const char* text;
+    } _files[] = {
+        {"/cgroup.controllers", _text_vcallback, "cpuset cpu memory\n"},
+        {"/cgroup.subtree_control", _text_vcallback, ""},
+        {"/cpu.max", _cpu_max_vcallback, NULL},
+        {"/cpu.weight", _text_vcallback, "100\n"},
+        {"/cpu.pressure", _text_vcallback, _pressure},
+        {"/cpuset.cpus.effective", _cpu_list_vcallback, NULL},
+        {"/cpuset.mems.effective", _text_vcallback, "0\n"},
+        {"/memory.max", _memory_max_vcallback, NULL},
+        {"/memory.high", _text_vcallback, "max\n"},
+        {"/memory.low", _text_vcallback, "0\n"},
+        {"/memory.current", _memory_current_vcallback, NULL},
+        {"/memory.stat", _memory_stat_vcallback, NULL},
+        {"/memory.pressure", _text_vcallback, _pressure},
+        {"/memory.swap.max", _text_vcallback, "0\n"},
+        {"/memory.swap.current", _text_vcallback, "0\n"},
+    };
+
+    ECHECK(myst_init_ramfs(myst_mount_resolve, &_cgroupfs));
+    ECHECK(myst_ramfs_set_type(_cgroupfs, MYST_CGROUP2_TYPE));
+    ECHECK(myst_mkdirhier("/sys/fs/cgroup", 0755));
+    ECHECK(myst_mount(_cgroupfs, "cgroup2", "/sys/fs/cgroup"));
+
+    for (size_t i = 0; i < MYST_COUNTOF(_files); i++)
+    {
+        ECHECK(myst_create_virtual_file(
+            _cgroupfs,
+            _files[i].name,
+            S_IFREG,
+            _files[i].vcallback,
+            (void*)_files[i].text));
+    }
+
+done:
+    return ret;
+}
+
+int sysfs_setup(void)
+{
+    int ret = 0;
+
+    ECHECK(myst_init_ramfs(myst_mount_resolve, &_sysfs));
+    ECHECK(myst_ramfs_set_type(_sysfs, MYST_SYSFS_TYPE));
+    ECHECK(myst_mkdirhier("/sys", 0755));
+    ECHECK(myst_mount(_sysfs, "sysfs", "/sys"));
+
+    /* the CPUs (as glibc and the runtimes count them) */
+    ECHECK(myst_mkdirhier("/sys/devices/system/cpu", 0755));
+    ECHECK(myst_create_virtual_file(
+        _sysfs,
+        "/devices/system/cpu/online",
+        S_IFREG,
+        _cpu_list_vcallback,
+        NULL));
+    ECHECK(myst_create_virtual_file(
+        _sysfs,
+        "/devices/system/cpu/possible",
+        S_IFREG,
+        _cpu_list_vcallback,
+        NULL));
+
+    ECHECK(_setup_cgroupfs());
+
+done:
+
+    if (ret != 0)
+        myst_eprintf("kernel: failed to set up /sys: %d\n", ret);
+
+    return ret;
+}
+
+int sysfs_teardown(void)
+{
+    if (_cgroupfs)
+        (*_cgroupfs->fs_release)(_cgroupfs);
+
+    if (_sysfs)
+        (*_sysfs->fs_release)(_sysfs);
+
+    _cgroupfs = NULL;
+    _sysfs = NULL;
+
+    return 0;
+}
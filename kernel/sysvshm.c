@@ -0,0 +1,475 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+
+#include <myst/defs.h>
+#include <myst/eraise.h>
+#include <myst/id.h>
+#include <myst/mmanutils.h>
+#include <myst/mutex.h>
+#include <myst/process.h>
+#include <myst/round.h>
+#include <myst/syscall.h>
+#include <myst/sysvshm.h>
+
+/*
+**==============================================================================
+**
+** System V shared memory (shmget, shmat, shmdt and shmctl).
+**
+**     All processes run in one address space, so a segment is mapped once
+**     when it is created and every shmat() returns that address: processes
+**     attached to the same segment share its pages without copying. For the
+**     same reason a segment cannot be attached anywhere else (shmaddr must
+**     be null or the segment's own address) and SHM_RDONLY cannot make the
+**     pages read-only for one process only.
+**
+**     A segment is freed once it is removed (IPC_RMID) and no process has
+**     it attached; an exiting process detaches whatever it left attached.
+**
+**==============================================================================
+*/
+
+/* musl passes the commands of SYS_shmctl with this flag */
+#define IPC_64_FLAG 0x100
+
+/* the Linux commands that the headers may leave out */
+#ifndef IPC_INFO
+#define IPC_INFO 3
+#endif
+#ifndef SHM_LOCK
+#define SHM_LOCK 11
+#define SHM_UNLOCK 12
+#endif
+#ifndef SHM_STAT
+#define SHM_STAT 13
+#define SHM_INFO 14
+#endif
+#ifndef SHM_STAT_ANY
+#define SHM_STAT_ANY 15
+#endif
+
+/* shmctl(IPC_STAT) sets this mode bit for a removed segment */
+#define MODE_DEST 01000
+
+#define MAX_SEGMENTS 4096
+#define MAX_SEGMENT_SIZE ((size_t)1 << 40)
+
+typedef struct attachment
+{
+    struct attachment* next;
+    pid_t pid;
+} attachment_t;
+
+typedef struct segment
+{
+    int id;
+    void* addr;
+    size_t mapped; /* the size rounded up to whole pages */
+    bool removed;
+    attachment_t* attachments;
+    struct myst_shmid_ds ds;
+} segment_t;
+
+static segment_t* _segments[MAX_SEGMENTS];
+
+/* bumped whenever a slot is reused, so that stale ids fail */
+static uint16_t _seqs[MAX_SEGMENTS];
+
+static myst_mutex_t _lock;
+
+static int64_t _now(void)
+{
+    return myst_syscall_time(NULL);
+}
+
+/* Find a segment by id (the caller holds the lock) */
+static segment_t* _find(int shmid)
+{
+    segment_t* seg;
+
+    if (shmid < 0 || !(seg = _segments[shmid % MAX_SEGMENTS]))
+        return NULL;
+
+    return seg->id == shmid ? seg : NULL;
+}
+
+static segment_t* _find_key(key_t key)
+{
+    for (size_t i = 0; i < MAX_SEGMENTS; i++)
+    {
+        segment_t* seg = _segments[i];
+
+        if (seg && !seg->removed && seg->ds.shm_perm.key == key)
+            return seg;
+    }
+
+    return NULL;
+}
+
+static segment_t* _find_addr(const void* addr)
+{
+    for (size_t i = 0; i < MAX_SEGMENTS; i++)
+    {
+        segment_t* seg = _segments[i];
+
+        if (seg && seg->addr == addr)
+            return seg;
+    }
+
+    return NULL;
+}
+
+static long _new_segment(key_t key, size_t size, int mode)
+{
+    long ret = 0;
+    size_t slot;
+    segment_t* seg = NULL;
+    void* addr;
+
+    for (slot = 0; slot < MAX_SEGMENTS && _segments[slot]; slot++)
+        ;
+
+    if (slot == MAX_SEGMENTS)
+        ERAISE(-ENOSPC);
+
+    if (!(seg = calloc(1, sizeof(segment_t))))
+        ERAISE(-ENOMEM);
+
+    ECHECK(myst_round_up(size, PAGE_SIZE, &seg->mapped));
+
+    /* the anonymous mapping is zero-filled */
+    addr = myst_mmap(
+        NULL,
+        seg->mapped,
+        PROT_READ | PROT_WRITE,
+        MAP_ANONYMOUS | MAP_PRIVATE,
+        -1,
+        0);
+
+    if ((uintptr_t)addr >= (uintptr_t)-4095 || !addr)
+        ERAISE(-ENOMEM);
+
+    _seqs[slot] = (uint16_t)((_seqs[slot] + 1) % 0x8000);
+    seg->id = (int)(_seqs[slot] * MAX_SEGMENTS + slot);
+    seg->addr = addr;
+    seg->ds.shm_perm.key = key;
+    seg->ds.shm_perm.uid = MYST_DEFAULT_UID;
+    seg->ds.shm_perm.gid = MYST_DEFAULT_GID;
+    seg->ds.shm_perm.cuid = MYST_DEFAULT_UID;
+    seg->ds.shm_perm.cgid = MYST_DEFAULT_GID;
+    seg->ds.shm_perm.mode = (uint32_t)mode & 0777;
+    seg->ds.shm_perm.seq = _seqs[slot];
+    seg->ds.shm_segsz = size;
+    seg->ds.shm_ctime = _now();
+    seg->ds.shm_cpid = myst_getpid();
+
+    _segments[slot] = seg;
+    ret = seg->id;
+    seg = NULL;
+
+done:
+
+    if (seg)
+        free(seg);
+
+    return ret;
+}
+
+/* Free a removed segment once nothing has it attached */
+static void _put_segment(segment_t* seg)
+{
+    if (!seg->removed || seg->ds.shm_nattch)
+        return;
+
+    _segments[seg->id % MAX_SEGMENTS] = NULL;
+    myst_munmap(seg->addr, seg->mapped);
+    free(seg);
+}
+
+long myst_syscall_shmget(key_t key, size_t size, int shmflg)
+{
+    long ret = 0;
+    segment_t* seg;
+
+    myst_mutex_lock(&_lock);
+
+    if (key != IPC_PRIVATE && (seg = _find_key(key)))
+    {
+        if ((shmflg & IPC_CREAT) && (shmflg & IPC_EXCL))
+            ERAISE(-EEXIST);
+
+        if (size > seg->ds.shm_segsz)
+            ERAISE(-EINVAL);
+
+        ret = seg->id;
+        goto done;
+    }
+
+    if (key != IPC_PRIVATE && !(shmflg & IPC_CREAT))
+        ERAISE(-ENOENT);
+
+    if (size == 0 || size > MAX_SEGMENT_SIZE)
+        ERAISE(-EINVAL);
+
+    ECHECK(ret = _new_segment(key, size, shmflg));
+
+done:
+    myst_mutex_unlock(&_lock);
+    return ret;
+}
+
+long myst_syscall_shmat(int shmid, const void* shmaddr, int shmflg)
+{
+    long ret = 0;
+    segment_t* seg;
+    attachment_t* a;
+
+    myst_mutex_lock(&_lock);
+
+    if (!(seg = _find(shmid)))
+        ERAISE(-EINVAL);
+
+    if (shmaddr)
+    {
+        uintptr_t addr = (uintptr_t)shmaddr;
+
+        if (shmflg & SHM_RND)
+            addr &= ~((uintptr_t)PAGE_SIZE - 1);
+
+        if ((void*)addr != seg->addr)
+            ERAISE(-EINVAL);
+    }
+
+    if (!(a = calloc(1, sizeof(attachment_t))))
+        ERAISE(-ENOMEM);
+
+    a->pid = myst_getpid();
+    a->next = seg->attachments;
+    seg->attachments = a;
+    seg->ds.shm_nattch++;
+    seg->ds.shm_atime = _now();
+    seg->ds.shm_lpid = a->pid;
+
+    ret = (long)seg->addr;
+
+done:
+    myst_mutex_unlock(&_lock);
+    return ret;
+}
+
+/* Remove an attachment of the process (if nwant is one) or all of them */
+static size_t _detach(segment_t* seg, pid_t pid, size_t nwant)
+{
+    size_t n = 0;
+
+    for (attachment_t** p = &seg->attachments; *p && n < nwant;)
+    {
+        attachment_t* a = *p;
+
+        if (a->pid == pid)
+        {
+            *p = a->next;
+            free(a);
+            n++;
+        }
+        else
+        {
+            p = &a->next;
+        }
+    }
+
+    if (n)
+    {
+        seg->ds.shm_nattch -= n;
+        seg->ds.shm_dtime = _now();
+        seg->ds.shm_lpid = pid;
+    }
+
+    return n;
+}
+
+long myst_syscall_shmdt(const void* shmaddr)
+{
+    long ret = 0;
+    segment_t* seg;
+
+    myst_mutex_lock(&_lock);
+
+    if (!(seg = _find_addr(shmaddr)) || !_detach(seg, myst_getpid(), 1))
+        ERAISE(-EINVAL);
+
+    _put_segment(seg);
+
+done:
+    myst_mutex_unlock(&_lock);
+    return ret;
+}
+
+static void _get_stat(const segment_t* seg, struct myst_shmid_ds* buf)
+{
+    *buf = seg->ds;
+
+    if (seg->removed)
+        buf->shm_perm.mode |= MODE_DEST;
+}
+
+/* The highest slot in use (as IPC_INFO and SHM_INFO return) */
+static long _max_index(void)
+{
+    long max = 0;
+
+    for (size_t i = 0; i < MAX_SEGMENTS; i++)
+    {
+        if (_segments[i])
+            max = (long)i;
+    }
+
+    return max;
+}
+
+long myst_syscall_shmctl(int shmid, int cmd, void* buf)
+{
+    long ret = 0;
+    segment_t* seg = NULL;
+
+    myst_mutex_lock(&_lock);
+
+    switch (cmd & ~IPC_64_FLAG)
+    {
+        case IPC_INFO:
+        {
+            struct myst_shminfo info = {0};
+
+            if (!buf)
+                ERAISE(-EFAULT);
+
+            info.shmmax = MAX_SEGMENT_SIZE;
+            info.shmmin = 1;
+            info.shmmni = MAX_SEGMENTS;
+            info.shmseg = MAX_SEGMENTS;
+            info.shmall = MAX_SEGMENT_SIZE / PAGE_SIZE;
+            memcpy(buf, &info, sizeof(info));
+            ret = _max_index();
+            break;
+        }
+        case SHM_INFO:
+        {
+            struct myst_shm_info info = {0};
+
+            if (!buf)
+                ERAISE(-EFAULT);
+
+            for (size_t i = 0; i < MAX_SEGMENTS; i++)
+            {
+                if ((seg = _segments[i]))
+                {
+                    info.used_ids++;
+                    info.shm_tot += seg->mapped / PAGE_SIZE;
+                }
+            }
+
+            /* the pages are always resident */
+            info.shm_rss = info.shm_tot;
+            memcpy(buf, &info, sizeof(info));
+            ret = _max_index();
+            break;
+        }
+        case SHM_STAT:
+        case SHM_STAT_ANY:
+        {
+            struct myst_shmid_ds ds;
+
+            /* these take the index of the slot rather than an id */
+            if (shmid < 0 || shmid >= MAX_SEGMENTS || !(seg = _segments[shmid]))
+                ERAISE(-EINVAL);
+
+            if (!buf)
+                ERAISE(-EFAULT);
+
+            _get_stat(seg, &ds);
+            memcpy(buf, &ds, sizeof(ds));
+            ret = seg->id;
+            break;
+        }
+        case IPC_STAT:
+        {
+            struct myst_shmid_ds ds;
+
+            if (!(seg = _find(shmid)))
+                ERAISE(-EINVAL);
+
+            if (!buf)
+                ERAISE(-EFAULT);
+
+            _get_stat(seg, &ds);
+            memcpy(buf, &ds, sizeof(ds));
+            break;
+        }
+        case IPC_SET:
+        {
+            struct myst_shmid_ds ds;
+
+            if (!(seg = _find(shmid)))
+                ERAISE(-EINVAL);
+
+            if (!buf)
+                ERAISE(-EFAULT);
+
+            memcpy(&ds, buf, sizeof(ds));
+            seg->ds.shm_perm.uid = ds.shm_perm.uid;
+            seg->ds.shm_perm.gid = ds.shm_perm.gid;
+            seg->ds.shm_perm.mode = ds.shm_perm.mode & 0777;
+            seg->ds.shm_ctime = _now();
+            break;
+        }
+        case IPC_RMID:
+        {
+            if (!(seg = _find(shmid)))
+                ERAISE(-EINVAL);
+
+            /* the key is free for a new segment from here on */
+            seg->removed = true;
+            seg->ds.shm_ctime = _now();
+            _put_segment(seg);
+            break;
+        }
+        case SHM_LOCK:
+        case SHM_UNLOCK:
+        {
+            /* the pages are never swapped out */
+            if (!_find(shmid))
+                ERAISE(-EINVAL);
+            break;
+        }
+        default:
+        {
+            ERAISE(-EINVAL);
+        }
+    }
+
+done:
+    myst_mutex_unlock(&_lock);
+    return ret;
+}
+
+void myst_shm_release_process(pid_t pid)
+{
+    myst_mutex_lock(&_lock);
+
+    for (size_t i = 0; i < MAX_SEGMENTS; i++)
+    {
+        segment_t* seg = _segments[i];
+
+        if (seg && _detach(seg, pid, SIZE_MAX))
+            _put_segment(seg);
+    }
+
+    myst_mutex_unlock(&_lock);
+}
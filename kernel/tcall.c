@@ -7,6 +7,7 @@
 
 #include <myst/blockdevice.h>
 #include <myst/fsgs.h>
+#include <myst/gcm.h>
 #include <myst/luks.h>
 #include <myst/sha256.h>
 #include <myst/signal.h>
@@ -66,7 +67,7 @@ long myst_tcall_wait(uint64_t event, const struct timespec* timeout)
     params[1] = (long)timeout;
     long ret = myst_tcall(MYST_TCALL_WAIT, params);
     // check for signals
-    myst_signal_process(myst_thread_self());
+    myst_signal_process_pending(myst_thread_self());
     return ret;
 }
 
@@ -77,12 +78,46 @@ long myst_tcall_wake(uint64_t event)
     return myst_tcall(MYST_TCALL_WAKE, params);
 }
 
+long myst_tcall_wake_many(const uint64_t* events, size_t count)
+{
+    long params[6] = {(long)events, (long)count};
+    return myst_tcall(MYST_TCALL_WAKE_MANY, params);
+}
+
 long myst_tcall_export_file(const char* path, const void* data, size_t size)
 {
     long params[6] = {(long)path, (long)data, (long)size};
     return myst_tcall(MYST_TCALL_EXPORT_FILE, params);
 }
 
+long myst_tcall_export_cpio(const void* data, size_t size)
+{
+    long params[6] = {(long)data, (long)size};
+    return myst_tcall(MYST_TCALL_EXPORT_CPIO, params);
+}
+
+long myst_tcall_debugger_attached(void)
+{
+    long params[6] = {0};
+    return myst_tcall(MYST_TCALL_DEBUGGER_ATTACHED, params);
+}
+
+long myst_tcall_map_host_file(
+    int fd,
+    off_t offset,
+    size_t length,
+    void** addr_out)
+{
+    long params[6] = {fd, offset, (long)length, (long)addr_out};
+    return myst_tcall(MYST_TCALL_MAP_HOST_FILE, params);
+}
+
+long myst_tcall_unmap_host_file(void* addr, size_t length)
+{
+    long params[6] = {(long)addr, (long)length};
+    return myst_tcall(MYST_TCALL_UNMAP_HOST_FILE, params);
+}
+
 long myst_tcall_wake_wait(
     uint64_t waiter_event,
     uint64_t self_event,
@@ -101,6 +136,12 @@ long myst_tcall_set_run_thread_function(myst_run_thread_t function)
     return myst_tcall(MYST_TCALL_SET_RUN_THREAD_FUNCTION, params);
 }
 
+long myst_tcall_set_syscall_trampoline(void (*trampoline)(void))
+{
+    long params[6] = {(long)trampoline};
+    return myst_tcall(MYST_TCALL_SET_SYSCALL_TRAMPOLINE, params);
+}
+
 long myst_tcall_target_stat(myst_target_stat_t* target_stat)
 {
     long params[6] = {(long)target_stat};
@@ -125,9 +166,17 @@ long myst_tcall_get_errno_location(int** ptr)
     return myst_tcall(MYST_TCALL_GET_ERRNO_LOCATION, params);
 }
 
+static uint64_t _poll_wake_count;
+
+uint64_t myst_get_poll_wake_count(void)
+{
+    return __atomic_load_n(&_poll_wake_count, __ATOMIC_ACQUIRE);
+}
+
 long myst_tcall_poll_wake(void)
 {
     long params[6] = {0};
+    __atomic_fetch_add(&_poll_wake_count, 1, __ATOMIC_RELEASE);
     return myst_tcall(MYST_TCALL_POLL_WAKE, params);
 }
 
@@ -137,6 +186,28 @@ long myst_tcall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
     return myst_tcall(SYS_poll, params);
 }
 
+long myst_tcall_epoll_create1(int flags)
+{
+    long params[6] = {flags};
+    return myst_tcall(SYS_epoll_create1, params);
+}
+
+long myst_tcall_epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    long params[6] = {epfd, op, fd, (long)event};
+    return myst_tcall(SYS_epoll_ctl, params);
+}
+
+long myst_tcall_epoll_wait(
+    int epfd,
+    struct epoll_event* events,
+    int maxevents,
+    int timeout)
+{
+    long params[6] = {epfd, (long)events, maxevents, timeout};
+    return myst_tcall(SYS_epoll_wait, params);
+}
+
 int myst_open_block_device(const char* path, bool read_only)
 {
     long params[6] = {(long)path, read_only};
@@ -193,6 +264,40 @@ int myst_luks_decrypt(
     return myst_tcall(MYST_TCALL_LUKS_DECRYPT, params);
 }
 
+int myst_gcm_new(const void* key, size_t key_size, myst_gcm_t** gcm)
+{
+    long params[6] = {(long)key, key_size, (long)gcm};
+    return (int)myst_tcall(MYST_TCALL_GCM_NEW, params);
+}
+
+int myst_gcm_free(myst_gcm_t* gcm)
+{
+    long params[6] = {(long)gcm};
+    return (int)myst_tcall(MYST_TCALL_GCM_FREE, params);
+}
+
+int myst_gcm_seal(
+    myst_gcm_t* gcm,
+    const myst_gcm_auth_t* auth,
+    const struct iovec* iov,
+    int iovcnt,
+    void* out)
+{
+    long params[6] = {(long)gcm, (long)auth, (long)iov, iovcnt, (long)out};
+    return (int)myst_tcall(MYST_TCALL_GCM_SEAL, params);
+}
+
+int myst_gcm_open(
+    myst_gcm_t* gcm,
+    const myst_gcm_auth_t* auth,
+    const void* in,
+    void* out,
+    size_t size)
+{
+    long params[6] = {(long)gcm, (long)auth, (long)in, (long)out, size};
+    return (int)myst_tcall(MYST_TCALL_GCM_OPEN, params);
+}
+
 int myst_sha256_start(myst_sha256_ctx_t* ctx)
 {
     long params[6] = {(long)ctx};
@@ -211,6 +316,19 @@ int myst_sha256_finish(myst_sha256_ctx_t* ctx, myst_sha256_t* sha256)
     return myst_tcall(MYST_TCALL_SHA256_FINISH, params);
 }
 
+int myst_sha256_n(
+    myst_sha256_t* hashes,
+    const void* prefix,
+    size_t prefix_size,
+    const void* data,
+    size_t size,
+    size_t count)
+{
+    long params[6] = {
+        (long)hashes, (long)prefix, prefix_size, (long)data, size, count};
+    return myst_tcall(MYST_TCALL_SHA256_N, params);
+}
+
 int myst_tcall_verify_signature(
     const char* pem_public_key,
     const uint8_t* hash,
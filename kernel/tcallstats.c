@@ -0,0 +1,292 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <myst/backtrace.h>
+#include <myst/console.h>
+#include <myst/eraise.h>
+#include <myst/eventtrace.h>
+#include <myst/options.h>
+#include <myst/strings.h>
+#include <myst/syscall.h>
+#include <myst/tcall.h>
+#include <myst/tcallstats.h>
+
+#define SITES MYST_TCALL_STATS_SITES
+#define PROBES 16
+
+#define SITE_FREE 0
+#define SITE_FILLING 1
+#define SITE_READY 2
+
+typedef struct site
+{
+    uint32_t state;
+    long n;
+    void* caller[2]; /* the return addresses of myst_tcall() and above */
+    uint64_t calls;
+    uint64_t nsec;
+    uint64_t max_nsec;
+} site_t;
+
+static site_t _sites[SITES];
+static uint64_t _dropped;
+
+static size_t _hash(long n, void* caller[2])
+{
+    uint64_t x = (uint64_t)n * 0x9e3779b97f4a7c15;
+
+    x ^= (uint64_t)caller[0] + (x << 6) + (x >> 2);
+    x ^= (uint64_t)caller[1] + (x << 6) + (x >> 2);
+    return (size_t)(x % SITES);
+}
+
+/* Find the slot of the site, adding it if new (or null if full) */
+static site_t* _find(long n, void* caller[2])
+{
+    const size_t h = _hash(n, caller);
+
+    for (size_t i = 0; i < PROBES; i++)
+    {
+        site_t* p = &_sites[(h + i) % SITES];
+        uint32_t state = __atomic_load_n(&p->state, __ATOMIC_ACQUIRE);
+
+        if (state == SITE_FREE &&
+            __atomic_compare_exchange_n(
+                &p->state,
+                &state,
+                SITE_FILLING,
+                false,
+                __ATOMIC_ACQUIRE,
+                __ATOMIC_ACQUIRE))
+        {
+            p->n = n;
+            p->caller[0] = caller[0];
+            p->caller[1] = caller[1];
+            __atomic_store_n(&p->state, SITE_READY, __ATOMIC_RELEASE);
+            return p;
+        }
+
+        /* another thread is filling this slot in (briefly) */
+        while (state == SITE_FILLING)
+            state = __atomic_load_n(&p->state, __ATOMIC_ACQUIRE);
+
+        if (p->n == n && p->caller[0] == caller[0] &&
+            p->caller[1] == caller[1])
+        {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+void myst_tcall_stats_record(long n, void* frame, uint64_t nsec)
+{
+    void* caller[2] = {NULL, NULL};
+    site_t* site;
+    uint64_t max;
+
+    myst_backtrace_impl(frame, caller, MYST_COUNTOF(caller));
+
+    if (!(site = _find(n, caller)))
+    {
+        __atomic_fetch_add(&_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_fetch_add(&site->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->nsec, nsec, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&site->max_nsec, __ATOMIC_RELAXED);
+
+    while (nsec > max && !__atomic_compare_exchange_n(
+                             &site->max_nsec,
+                             &max,
+                             nsec,
+                             true,
+                             __ATOMIC_RELAXED,
+                             __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+**==============================================================================
+**
+** Formatting the statistics
+**
+**==============================================================================
+*/
+
+static int _appendf(myst_buf_t* buf, const char* fmt, ...)
+{
+    char tmp[256];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return -EINVAL;
+
+    if ((size_t)n >= sizeof(tmp))
+        n = sizeof(tmp) - 1;
+
+    return myst_buf_append(buf, tmp, (size_t)n);
+}
+
+static int _compare_sites(const void* p1, const void* p2)
+{
+    const site_t* s1 = (const site_t*)p1;
+    const site_t* s2 = (const site_t*)p2;
+
+    if (s1->nsec != s2->nsec)
+        return s1->nsec > s2->nsec ? -1 : 1;
+
+    if (s1->calls != s2->calls)
+        return s1->calls > s2->calls ? -1 : 1;
+
+    return 0;
+}
+
+static const char* _tcall_name(long n)
+{
+    const char* name = myst_event_tcall_name(n);
+    return name ? name : syscall_str(n);
+}
+
+/* Name a return address as function+offset */
+static void _format_caller(char* buf, size_t size, const void* addr)
+{
+    const char* name;
+    size_t offset;
+
+    if (myst_backtrace_symbol(addr, &name, &offset) == 0)
+        snprintf(buf, size, "%s+0x%zx", name, offset);
+    else
+        snprintf(buf, size, "%p", addr);
+}
+
+/* The site, as the caller of any myst_tcall_*() wrapper */
+static void _format_site(char* buf, size_t size, const site_t* s)
+{
+    char first[96];
+    char second[96];
+    const char wrapper[] = "myst_tcall_";
+    char* p;
+
+    _format_caller(first, sizeof(first), s->caller[0]);
+
+    if (strncmp(first, wrapper, sizeof(wrapper) - 1) != 0 || !s->caller[1])
+    {
+        myst_strlcpy(buf, first, size);
+        return;
+    }
+
+    _format_caller(second, sizeof(second), s->caller[1]);
+
+    /* drop the offset of the wrapper */
+    if ((p = strchr(first, '+')))
+        *p = '\0';
+    snprintf(buf, size, "%s (%s)", second, first);
+}
+
+int myst_format_tcall_stats(myst_buf_t* buf)
+{
+    int ret = 0;
+    site_t* sites = NULL;
+    size_t n = 0;
+    char site[192];
+
+    if (!buf)
+        ERAISE(-EINVAL);
+
+    if (!__options.syscall_stats)
+    {
+        ECHECK(_appendf(
+            buf, "tcall statistics are disabled (use --syscall-stats)\n"));
+        goto done;
+    }
+
+    if (!(sites = calloc(SITES, sizeof(site_t))))
+        ERAISE(-ENOMEM);
+
+    /* copy the counts, which other threads keep updating */
+    for (size_t i = 0; i < SITES; i++)
+    {
+        const site_t* p = &_sites[i];
+
+        if (__atomic_load_n(&p->state, __ATOMIC_ACQUIRE) != SITE_READY)
+            continue;
+
+        sites[n] = *p;
+        sites[n].calls = __atomic_load_n(&p->calls, __ATOMIC_RELAXED);
+        sites[n].nsec = __atomic_load_n(&p->nsec, __ATOMIC_RELAXED);
+        sites[n].max_nsec = __atomic_load_n(&p->max_nsec, __ATOMIC_RELAXED);
+        n++;
+    }
+
+    qsort(sites, n, sizeof(site_t), _compare_sites);
+
+    ECHECK(_appendf(
+        buf,
+        "%-20s %10s %12s %10s %10s  %s\n",
+        "tcall",
+        "calls",
+        "usecs",
+        "nsecs/call",
+        "max-usecs",
+        "site"));
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const site_t* s = &sites[i];
+
+        _format_site(site, sizeof(site), s);
+        ECHECK(_appendf(
+            buf,
+            "%-20s %10lu %12lu %10lu %10lu  %s\n",
+            _tcall_name(s->n),
+            s->calls,
+            s->nsec / 1000,
+            s->calls ? s->nsec / s->calls : 0,
+            s->max_nsec / 1000,
+            site));
+    }
+
+    if (_dropped)
+    {
+        ECHECK(_appendf(
+            buf,
+            "(%lu tcalls from sites beyond the first %u are not shown)\n",
+            __atomic_load_n(&_dropped, __ATOMIC_RELAXED),
+            SITES));
+    }
+
+done:
+
+    if (sites)
+        free(sites);
+
+    return ret;
+}
+
+void myst_dump_tcall_stats(void)
+{
+    myst_buf_t buf = MYST_BUF_INITIALIZER;
+
+    /* write directly since myst_eprintf() truncates long output */
+    if (myst_format_tcall_stats(&buf) == 0)
+    {
+        myst_console_flush();
+        myst_tcall_write_console(STDERR_FILENO, buf.data, buf.size);
+    }
+
+    myst_buf_release(&buf);
+}
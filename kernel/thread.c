@@ -8,11 +8,13 @@
 #include <string.h>
 #include <sys/wait.h>
 
+#include <myst/affinity.h>
 #include <myst/assume.h>
 #include <myst/atexit.h>
 #include <myst/atomic.h>
 #include <myst/cond.h>
 #include <myst/eraise.h>
+#include <myst/eventtrace.h>
 #include <myst/fdtable.h>
 #include <myst/file.h>
 #include <myst/fsgs.h>
@@ -24,14 +26,19 @@
 #include <myst/panic.h>
 #include <myst/printf.h>
 #include <myst/procfs.h>
+#include <myst/profile.h>
+#include <myst/rwlock.h>
+#include <myst/scratch.h>
 #include <myst/setjmp.h>
 #include <myst/signal.h>
 #include <myst/spinlock.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
+#include <myst/sysvshm.h>
 #include <myst/tcall.h>
 #include <myst/thread.h>
 #include <myst/time.h>
+#include <myst/timer.h>
 #include <myst/times.h>
 #include <myst/trace.h>
 
@@ -42,6 +49,22 @@ myst_spinlock_t myst_process_list_lock = MYST_SPINLOCK_INITIALIZER;
 /* The total number of threads running (including the main thread) */
 static _Atomic(size_t) _num_threads = 1;
 
+/* Count a new thread unless there is already one per TCS (max_threads):
+ * checking and incrementing separately let racing clones exceed it */
+static bool _reserve_thread(void)
+{
+    size_t n = __atomic_load_n(&_num_threads, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (n >= __myst_kernel_args.max_threads)
+            return false;
+    } while (!__atomic_compare_exchange_n(
+        &_num_threads, &n, n + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    return true;
+}
+
 /*
 **==============================================================================
 **
@@ -73,6 +96,90 @@ pid_t myst_generate_tid(void)
     return tid;
 }
 
+/*
+**==============================================================================
+**
+** tid map:
+**
+**     A hash table of running threads keyed by tid. Since tids are handed out
+**     sequentially, the low bits of the tid index the table directly. Threads
+**     are inserted once their tid is known and removed when they become
+**     zombies; lookups take the table lock for reading only. A lookup takes
+**     a reference, keeping the struct from being recycled or freed after the
+**     thread exits, until myst_put_thread() releases it.
+**
+**==============================================================================
+*/
+
+#define TID_MAP_SIZE 1024
+
+static myst_thread_t* _tid_map[TID_MAP_SIZE];
+static myst_rwlock_t _tid_map_lock = MYST_RWLOCK_INITIALIZER;
+
+void myst_tid_map_insert(myst_thread_t* thread)
+{
+    myst_thread_t** head = &_tid_map[thread->tid & (TID_MAP_SIZE - 1)];
+
+    myst_rwlock_wrlock(&_tid_map_lock);
+    thread->tid_next = *head;
+    *head = thread;
+    myst_rwlock_wrunlock(&_tid_map_lock);
+}
+
+void myst_tid_map_remove(myst_thread_t* thread)
+{
+    myst_thread_t** p = &_tid_map[thread->tid & (TID_MAP_SIZE - 1)];
+
+    myst_rwlock_wrlock(&_tid_map_lock);
+
+    for (; *p; p = &(*p)->tid_next)
+    {
+        if (*p == thread)
+        {
+            *p = thread->tid_next;
+            thread->tid_next = NULL;
+            break;
+        }
+    }
+
+    myst_rwlock_wrunlock(&_tid_map_lock);
+}
+
+myst_thread_t* myst_tid_map_find(pid_t tid)
+{
+    myst_thread_t* t;
+
+    myst_rwlock_rdlock(&_tid_map_lock);
+
+    for (t = _tid_map[tid & (TID_MAP_SIZE - 1)]; t; t = t->tid_next)
+    {
+        if (t->tid == tid)
+        {
+            myst_get_thread(t);
+            break;
+        }
+    }
+
+    myst_rwlock_rdunlock(&_tid_map_lock);
+
+    return t;
+}
+
+void myst_tid_map_foreach(
+    void (*callback)(myst_thread_t* thread, void* arg),
+    void* arg)
+{
+    myst_rwlock_rdlock(&_tid_map_lock);
+
+    for (size_t i = 0; i < TID_MAP_SIZE; i++)
+    {
+        for (myst_thread_t* t = _tid_map[i]; t; t = t->tid_next)
+            (*callback)(t, arg);
+    }
+
+    myst_rwlock_rdunlock(&_tid_map_lock);
+}
+
 /*
 **==============================================================================
 **
@@ -201,16 +308,51 @@ static myst_thread_t* _put_cookie(uint64_t cookie)
 **
 ** zombie list implementation:
 **
-**     Threads are moved onto the zombie list after exiting.
+**     Threads are moved onto the zombie list after exiting. A thread leaves
+**     it once it has left the kernel (see myst_release_thread()), except for
+**     a process thread, which also waits for wait4() to collect its exit
+**     status (or for its parent to exit) and for its other threads to exit
+**     (their thread_lock is in its struct).
+**
+**     Threads that leave the zombie list are reaped: they are kept, oldest
+**     first, for new threads to recycle (and freed beyond MAX_REAPED). A
+**     reaped thread is only reused or freed once it has no references: the
+**     ones taken by myst_tid_map_find() and the process list search of
+**     kill() before it left the tid map and the process list. No new ones
+**     can be taken after that, so the count only drops once it is reaped.
 **
-**     ATTN: consider separate process-zombies list (for performance).
+**     wait4() waits on the queue of the caller's process (hashed by pid), so
+**     that an exit only wakes the threads that may be waiting for it.
 **
 **==============================================================================
 */
 
+#define WAIT_QUEUES 64
+#define MAX_REAPED 64
+
 static myst_thread_t* _zombies;
 static myst_mutex_t _zombies_mutex;
-static myst_cond_t _zombies_cond;
+static myst_cond_t _wait_queues[WAIT_QUEUES];
+
+/* the reaped threads, oldest first (guarded by _zombies_mutex) */
+static myst_thread_t* _reaped;
+static myst_thread_t* _reaped_back;
+static size_t _nreaped;
+
+static myst_cond_t* _wait_queue(pid_t pid)
+{
+    return &_wait_queues[(uint32_t)pid % WAIT_QUEUES];
+}
+
+static void _free_thread(myst_thread_t* thread)
+{
+    assert(thread->main.cwd == NULL);
+
+    myst_signal_release_infos(thread);
+    myst_release_scratch(thread);
+    memset(thread, 0xdd, sizeof(myst_thread_t));
+    free(thread);
+}
 
 static void _free_zombies(void* arg)
 {
@@ -219,20 +361,196 @@ static void _free_zombies(void* arg)
     for (myst_thread_t* p = _zombies; p;)
     {
         myst_thread_t* next = p->next;
+        _free_thread(p);
+        p = next;
+    }
 
-        assert(p->main.cwd == NULL);
-
-        memset(p, 0xdd, sizeof(myst_thread_t));
-        free(p);
-
+    for (myst_thread_t* p = _reaped; p;)
+    {
+        myst_thread_t* next = p->next;
+        _free_thread(p);
         p = next;
     }
 
     _zombies = NULL;
+    _reaped = NULL;
+    _reaped_back = NULL;
+    _nreaped = 0;
+}
+
+void myst_get_thread(myst_thread_t* thread)
+{
+    __atomic_add_fetch(&thread->refs, 1, __ATOMIC_RELAXED);
+}
+
+void myst_put_thread(myst_thread_t* thread)
+{
+    if (thread)
+        __atomic_sub_fetch(&thread->refs, 1, __ATOMIC_RELEASE);
+}
+
+/* Take the oldest reaped thread that no one holds a reference to */
+static myst_thread_t* _pop_reaped(void)
+{
+    myst_thread_t* prev = NULL;
+    myst_thread_t* thread;
+
+    for (thread = _reaped; thread; prev = thread, thread = thread->next)
+    {
+        if (__atomic_load_n(&thread->refs, __ATOMIC_ACQUIRE) == 0)
+            break;
+    }
+
+    if (!thread)
+        return NULL;
+
+    if (prev)
+        prev->next = thread->next;
+    else
+        _reaped = thread->next;
+
+    if (_reaped_back == thread)
+        _reaped_back = prev;
+
+    _nreaped--;
+    thread->next = NULL;
+
+    return thread;
+}
+
+/* Whether only pointers found before the thread exited may still use it */
+static bool _reapable(myst_thread_t* thread)
+{
+    bool ret;
+
+    if (!thread->released)
+        return false;
+
+    if (!myst_is_process_thread(thread))
+        return true;
+
+    myst_spin_lock(thread->thread_lock);
+    ret = thread->reaped && !thread->group_next;
+    myst_spin_unlock(thread->thread_lock);
+
+    return ret;
+}
+
+/* Move a zombie onto the reaped list (called with _zombies_mutex held) */
+static void _reap(myst_thread_t* thread)
+{
+    myst_thread_t** p;
+    myst_thread_t* old;
+
+    for (p = &_zombies; *p && *p != thread; p = &(*p)->next)
+        ;
+
+    /* already reaped */
+    if (!*p)
+        return;
+
+    *p = thread->next;
+
+    /* kill() and wait4() no longer find the process */
+    if (myst_is_process_thread(thread))
+    {
+        myst_thread_t* prev = thread->main.prev_process_thread;
+        myst_thread_t* next = thread->main.next_process_thread;
+
+        myst_spin_lock(&myst_process_list_lock);
+
+        if (prev)
+            prev->main.next_process_thread = next;
+
+        if (next)
+            next->main.prev_process_thread = prev;
+
+        thread->main.prev_process_thread = NULL;
+        thread->main.next_process_thread = NULL;
+
+        myst_spin_unlock(&myst_process_list_lock);
+    }
+
+    thread->next = NULL;
+
+    if (_reaped_back)
+        _reaped_back->next = thread;
+    else
+        _reaped = thread;
+
+    _reaped_back = thread;
+    _nreaped++;
+
+    /* free the oldest threads beyond the ones kept for recycling */
+    while (_nreaped > MAX_REAPED && (old = _pop_reaped()))
+        _free_thread(old);
+}
+
+/* A zeroed thread struct, recycled from the reaped threads if possible */
+static myst_thread_t* _new_thread(void)
+{
+    myst_thread_t* thread = NULL;
+    bool locked = false;
+
+    if (__atomic_load_n(&_nreaped, __ATOMIC_RELAXED))
+    {
+        myst_mutex_lock(&_zombies_mutex);
+        locked = true;
+        thread = _pop_reaped();
+    }
+
+    if (locked)
+        myst_mutex_unlock(&_zombies_mutex);
+
+    if (!thread)
+        return calloc(1, sizeof(myst_thread_t));
+
+    myst_signal_release_infos(thread);
+    myst_release_scratch(thread);
+    memset(thread, 0, sizeof(myst_thread_t));
+    return thread;
+}
+
+/* Leave the thread group, still finding the process thread afterwards */
+static void _leave_thread_group(myst_thread_t* thread)
+{
+    myst_thread_t* process = myst_find_process_thread(thread);
+
+    myst_spin_lock(thread->thread_lock);
+
+    thread->group_prev->group_next = thread->group_next;
+
+    if (thread->group_next)
+        thread->group_next->group_prev = thread->group_prev;
+
+    thread->group_prev = process;
+    thread->group_next = NULL;
+
+    myst_spin_unlock(thread->thread_lock);
 }
 
 void myst_zombify_thread(myst_thread_t* thread)
 {
+    /* Return cached heap blocks (called by the exiting thread itself) */
+    myst_release_malloc_cache(&thread->malloc_cache);
+    myst_release_poll_scratch(thread);
+    myst_release_scratch(thread);
+    myst_profile_release(thread);
+
+    myst_event(
+        MYST_EVENT_SCHED,
+        MYST_EVENT_SCHED_EXIT,
+        (uint64_t)thread->exit_status,
+        0);
+    myst_event_trace_release(thread);
+
+    /* Remove from the map before folding to avoid counting twice */
+    myst_tid_map_remove(thread);
+    myst_times_exit_thread(thread);
+
+    if (!myst_is_process_thread(thread) && thread->group_prev)
+        _leave_thread_group(thread);
+
     myst_mutex_lock(&_zombies_mutex);
     {
         static bool _initialized;
@@ -248,8 +566,49 @@ void myst_zombify_thread(myst_thread_t* thread)
 
         thread->status = MYST_ZOMBIE;
 
-        /* signal waiting threads */
-        myst_cond_signal(&_zombies_cond);
+        if (myst_is_process_thread(thread))
+        {
+            /* no one is left to wait for the zombie children */
+            for (myst_thread_t* p = _zombies; p;)
+            {
+                myst_thread_t* next = p->next;
+
+                if (myst_is_process_thread(p) && p->ppid == thread->pid)
+                {
+                    p->reaped = true;
+
+                    if (_reapable(p))
+                        _reap(p);
+                }
+
+                p = next;
+            }
+
+            /* signal the threads waiting for this child */
+            myst_cond_broadcast(_wait_queue(thread->ppid), SIZE_MAX);
+        }
+    }
+    myst_mutex_unlock(&_zombies_mutex);
+}
+
+void myst_release_thread(myst_thread_t* thread)
+{
+    myst_thread_t* process = NULL;
+
+    /* see _leave_thread_group() */
+    if (!myst_is_process_thread(thread))
+        process = thread->group_prev;
+
+    myst_mutex_lock(&_zombies_mutex);
+    {
+        thread->released = true;
+
+        if (_reapable(thread))
+            _reap(thread);
+
+        /* the last thread of a collected process releases the process */
+        if (process && process->status == MYST_ZOMBIE && _reapable(process))
+            _reap(process);
     }
     myst_mutex_unlock(&_zombies_mutex);
 }
@@ -293,13 +652,16 @@ long myst_syscall_wait4(
 
     for (;;)
     {
-        /* search the zombie list for a process thread */
+        /* search the zombie list for a child process thread */
         for (myst_thread_t* p = _zombies; p; p = p->next)
         {
             bool match = false;
 
-            if (!myst_is_process_thread(p))
+            if (!myst_is_process_thread(p) || p->reaped ||
+                p->ppid != process->pid)
+            {
                 continue;
+            }
 
             if (pid > 0) /* wait for a specific child process */
             {
@@ -316,6 +678,13 @@ long myst_syscall_wait4(
                     *wstatus = (p->exit_status << 8);
 
                 ret = p->pid;
+
+                /* the exit status is only collected once */
+                p->reaped = true;
+
+                if (_reapable(p))
+                    _reap(p);
+
                 goto done;
             }
         }
@@ -327,7 +696,7 @@ long myst_syscall_wait4(
         }
 
         /* wait for signal from myst_zombify_thread() */
-        myst_cond_wait(&_zombies_cond, &_zombies_mutex);
+        myst_cond_wait(_wait_queue(process->pid), &_zombies_mutex);
     }
 
 done:
@@ -341,32 +710,13 @@ done:
 myst_thread_t* myst_find_thread(int tid)
 {
     myst_thread_t* thread = myst_thread_self();
-    myst_thread_t* target = NULL;
-    myst_thread_t* t = NULL;
-
-    // Search forward in the doubly linked list for a match
-    for (t = thread; t != NULL; t = t->group_next)
-    {
-        if (t->tid == tid)
-        {
-            target = t;
-            break;
-        }
-    }
+    myst_thread_t* target = myst_tid_map_find(tid);
 
-    if (target == NULL)
+    /* only threads in the caller's thread group are visible */
+    if (target && target->pid != thread->pid)
     {
-        // Search backward in the doubly linked list for a match
-        myst_spin_lock(thread->thread_lock);
-        for (t = thread->group_prev; t != NULL; t = t->group_prev)
-        {
-            if (t->tid == tid)
-            {
-                target = t;
-                break;
-            }
-        }
-        myst_spin_unlock(thread->thread_lock);
+        myst_put_thread(target);
+        return NULL;
     }
 
     return target;
@@ -387,15 +737,35 @@ bool myst_valid_td(const void* td)
 
 myst_thread_t* myst_thread_self(void)
 {
-    uint64_t value;
-    myst_assume(myst_tcall_get_tsd(&value) == 0);
+    myst_thread_t* thread = (myst_thread_t*)myst_get_tsd();
 
-    myst_thread_t* thread = (myst_thread_t*)value;
+#ifdef MYST_DEBUG
     myst_assume(myst_valid_thread(thread));
+#endif
 
     return thread;
 }
 
+void myst_init_gs(myst_td_t* gs_td, myst_td_t* target_td)
+{
+    if (MYST_HAVE_SYSCALL_INSTRUCTION)
+    {
+        memset(gs_td, 0, sizeof(myst_td_t));
+
+        /* myst_tcall() restores the target descriptor from here */
+        gs_td->self = target_td;
+        myst_set_gsbase(gs_td);
+    }
+}
+
+void myst_bind_thread(myst_thread_t* thread, myst_td_t* gs_td)
+{
+    myst_assume(myst_tcall_set_tsd((uint64_t)thread) == 0);
+
+    if (MYST_HAVE_SYSCALL_INSTRUCTION)
+        gs_td->tsd = (uint64_t)thread;
+}
+
 /* Force the caller stack to be aligned */
 __attribute__((force_align_arg_pointer)) static void _call_thread_fn(void)
 {
@@ -406,15 +776,16 @@ __attribute__((force_align_arg_pointer)) static void _call_thread_fn(void)
 /* The target calls this from the new thread */
 long myst_run_thread(uint64_t cookie, uint64_t event)
 {
-    myst_thread_t* thread = (myst_thread_t*)_put_cookie(cookie);
+    myst_thread_t* thread;
     myst_td_t* target_td = myst_get_fsbase();
     myst_td_t* crt_td = NULL;
     bool is_child_thread;
+    myst_td_t gs_td; /* gsbase until this returns (see myst_init_gs()) */
 
     assert(myst_valid_td(target_td));
 
-    if (__options.have_syscall_instruction)
-        myst_set_gsbase(target_td);
+    myst_init_gs(&gs_td, target_td);
+    thread = (myst_thread_t*)_put_cookie(cookie);
 
     myst_assume(myst_valid_thread(thread));
 
@@ -432,6 +803,8 @@ long myst_run_thread(uint64_t cookie, uint64_t event)
         thread->tid = myst_generate_tid();
     }
 
+    myst_tid_map_insert(thread);
+
     /* set the target into the thread */
     thread->target_td = target_td;
 
@@ -440,7 +813,27 @@ long myst_run_thread(uint64_t cookie, uint64_t event)
     thread->event = event;
 
     /* bind this thread to the target thread-descriptor */
-    myst_assume(myst_tcall_set_tsd((uint64_t)thread) == 0);
+    myst_bind_thread(thread, &gs_td);
+
+    myst_event(
+        MYST_EVENT_SCHED,
+        MYST_EVENT_SCHED_START,
+        (uint64_t)thread->pid,
+        thread->kernel);
+
+    /* kernel threads just run their function on the target stack */
+    if (thread->kernel)
+    {
+        myst_times_start();
+
+        (*thread->clone.fn)(thread->clone.arg);
+
+        myst_zombify_thread(thread);
+        myst_assume(_num_threads > 1);
+        _num_threads--;
+        myst_release_thread(thread);
+        return 0;
+    }
 
     /* bind thread to the C-runtime thread-descriptor */
     if (is_child_thread)
@@ -476,15 +869,27 @@ long myst_run_thread(uint64_t cookie, uint64_t event)
             myst_syscall_futex(thread->clone.ctid, futex_op, 1, 0, NULL, 0);
         }
 
+        /* an exiting thread no longer uses what it looked up */
+        myst_fdtable_drop_holds(thread);
+
         /* Release memory objects owned by the main/process thread */
         if (!is_child_thread)
         {
+            /* write back its shared file mappings */
+            myst_msync_release_process(thread->pid);
+
             if (thread->fdtable)
             {
                 myst_fdtable_free(thread->fdtable);
                 thread->fdtable = NULL;
             }
 
+            /* stop the timers that signal this process */
+            myst_release_process_timers(thread->pid);
+
+            /* detach the System V shared memory it left attached */
+            myst_shm_release_process(thread->pid);
+
             myst_signal_free(thread);
 
             if (thread->main.exec_stack)
@@ -534,6 +939,8 @@ long myst_run_thread(uint64_t cookie, uint64_t event)
             _num_threads--;
         }
 
+        myst_release_thread(thread);
+
         /* Return to target, which will exit this thread */
     }
     else
@@ -588,18 +995,16 @@ static long _syscall_clone(
         ERAISE(-EINVAL);
 
     /* Check whether the maximum number of threads has been reached */
-    {
-        /* if too many threads already running */
-        if (_num_threads == __myst_kernel_args.max_threads)
-            ERAISE(-EAGAIN);
-
-        _num_threads++;
-    }
+    if (!_reserve_thread())
+        ERAISE(-EAGAIN);
 
     /* Create and initialize the child thread struct */
     {
-        if (!(child = calloc(1, sizeof(myst_thread_t))))
+        if (!(child = _new_thread()))
+        {
+            _num_threads--;
             ERAISE(-ENOMEM);
+        }
 
         child->magic = MYST_THREAD_MAGIC;
         child->fdtable = parent->fdtable;
@@ -609,6 +1014,7 @@ static long _syscall_clone(
         child->crt_td = newtls;
         child->run_thread = myst_run_thread;
         child->thread_lock = parent->thread_lock;
+        myst_affinity_inherit(child, parent);
         /* ATTN: we don't take a lock on _num_threads,
             thread names could be duplicates */
         snprintf(
@@ -653,6 +1059,49 @@ done:
     return ret;
 }
 
+long myst_create_kernel_thread(int (*fn)(void*), void* arg, const char* name)
+{
+    long ret = 0;
+    uint64_t cookie;
+    myst_thread_t* thread = NULL;
+
+    if (!fn || !name)
+        ERAISE(-EINVAL);
+
+    /* Check whether the maximum number of threads has been reached */
+    if (!_reserve_thread())
+        ERAISE(-EAGAIN);
+
+    if (!(thread = _new_thread()))
+    {
+        _num_threads--;
+        ERAISE(-ENOMEM);
+    }
+
+    thread->magic = MYST_THREAD_MAGIC;
+    thread->kernel = true;
+    thread->tid = myst_generate_tid();
+    thread->run_thread = myst_run_thread;
+    thread->main.thread_group_lock = MYST_SPINLOCK_INITIALIZER;
+    thread->thread_lock = &thread->main.thread_group_lock;
+    myst_set_thread_name(thread, name);
+    thread->clone.fn = fn;
+    thread->clone.arg = arg;
+
+    cookie = _get_cookie(thread);
+
+    if (myst_tcall_create_thread(cookie) != 0)
+    {
+        _put_cookie(cookie);
+        free(thread);
+        _num_threads--;
+        ERAISE(-EINVAL);
+    }
+
+done:
+    return ret;
+}
+
 /* create a new process (main) thread */
 static long _syscall_clone_vfork(
     int (*fn)(void*),
@@ -669,18 +1118,16 @@ static long _syscall_clone_vfork(
         ERAISE(-EINVAL);
 
     /* Check whether the maximum number of threads has been reached */
-    {
-        /* if too many threads already running */
-        if (_num_threads == __myst_kernel_args.max_threads)
-            ERAISE(-EAGAIN);
-
-        _num_threads++;
-    }
+    if (!_reserve_thread())
+        ERAISE(-EAGAIN);
 
     /* Create and initialize the thread struct */
     {
-        if (!(child = calloc(1, sizeof(myst_thread_t))))
+        if (!(child = _new_thread()))
+        {
+            _num_threads--;
             ERAISE(-ENOMEM);
+        }
 
         child->magic = MYST_THREAD_MAGIC;
         child->fdtable = parent->fdtable;
@@ -691,6 +1138,7 @@ static long _syscall_clone_vfork(
         child->run_thread = myst_run_thread;
         child->main.thread_group_lock = MYST_SPINLOCK_INITIALIZER;
         child->thread_lock = &child->main.thread_group_lock;
+        myst_affinity_inherit(child, parent);
         /* ATTN: we don't take a lock on _num_threads,
             thread names could be duplicates */
         snprintf(
@@ -704,6 +1152,7 @@ static long _syscall_clone_vfork(
         child->main.cwd = strdup(parent->main.cwd);
         if (child->main.cwd == NULL)
             ERAISE(-ENOMEM);
+        child->main.cwd_len = parent->main.cwd_len;
 
         /* inherit the umask from the parent process */
         child->main.umask = parent->main.umask;
@@ -737,17 +1186,7 @@ static long _syscall_clone_vfork(
         parent_main_thread->main.next_process_thread = child;
         myst_spin_unlock(&myst_process_list_lock);
 
-        /* Create /proc/[pid]/fd directory for new process thread */
-        {
-            char fdpath[PATH_MAX];
-            const size_t n = sizeof(fdpath);
-            snprintf(fdpath, n, "/proc/%d/fd", child->pid);
-            if (myst_mkdirhier(fdpath, 777) != 0)
-            {
-                myst_eprintf("cannot create the /proc/[pid]/fd directory\n");
-                ERAISE(-EINVAL);
-            }
-        }
+        /* /proc/[pid]/fd is created with the first link (see syscall.c) */
     }
 
     cookie = _get_cookie(child);
@@ -0,0 +1,419 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <myst/clock.h>
+#include <myst/cond.h>
+#include <myst/eraise.h>
+#include <myst/mutex.h>
+#include <myst/syscall.h>
+#include <myst/thread.h>
+#include <myst/time.h>
+#include <myst/timer.h>
+
+/*
+**==============================================================================
+**
+** Kernel timers.
+**
+**     The armed timers sit in a hierarchical timing wheel of millisecond
+**     ticks. Each of the LEVELS levels has SLOTS slots; a slot of level L
+**     spans SLOTS^L ticks, so arming or cancelling a timer is a list
+**     insertion or removal whatever the number of timers. When the wheel
+**     reaches a slot of a higher level, it moves (cascades) the slot's
+**     timers down to the levels below. Deadlines beyond the top level are
+**     kept in its last slot and cascaded until they come within range.
+**
+**     A single thread (started when the first timer is armed) turns the
+**     wheel. It sleeps exactly until the earliest deadline, which is always
+**     in the first occupied slot of some level, and skips the ticks at which
+**     nothing is to be done, so an idle timer costs no wakeups.
+**
+**     Timers whose tick has passed wait on the due list until their deadline
+**     (in nanoseconds) passes too. The thread calls their functions one at a
+**     time without the lock.
+**
+**==============================================================================
+*/
+
+#define TICK_NSEC 1000000UL /* one millisecond */
+#define BITS 6
+#define SLOTS (1UL << BITS)
+#define MASK (SLOTS - 1)
+#define LEVELS 6 /* 2^36 ticks (about two years) */
+#define RANGE (1UL << (BITS * LEVELS))
+
+static myst_mutex_t _lock;
+static myst_cond_t _cond;      /* signaled to wake the thread early */
+static myst_cond_t _done_cond; /* broadcast when a timer function returns */
+static myst_timer_t* _wheel[LEVELS][SLOTS];
+static myst_timer_t* _due;
+static size_t _num_wheel;  /* the timers in the wheel (not on _due) */
+static uint64_t _next;     /* the next tick to process */
+static uint64_t _sleeping; /* when the thread wakes (0: it is awake) */
+static myst_timer_t* _running;
+static myst_thread_t* _thread;
+static size_t _num_cancelling;
+static bool _started;
+static bool _stopping;
+static _Atomic(size_t) _num_running;
+
+uint64_t myst_timer_now(void)
+{
+    struct timespec ts;
+
+    if (myst_syscall_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+
+    return (uint64_t)ts.tv_sec * NANO_IN_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+static void _push(myst_timer_t** list, myst_timer_t* timer)
+{
+    timer->prev = NULL;
+    timer->next = *list;
+
+    if (*list)
+        (*list)->prev = timer;
+
+    *list = timer;
+    timer->list = list;
+}
+
+static void _unlink(myst_timer_t* timer)
+{
+    myst_timer_t** list = timer->list;
+
+    if (!list)
+        return;
+
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else
+        *list = timer->next;
+
+    if (timer->next)
+        timer->next->prev = timer->prev;
+
+    if (list != &_due)
+        _num_wheel--;
+
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->list = NULL;
+}
+
+/* Put the timer in the slot for its tick (or on _due if the tick passed) */
+static void _insert(myst_timer_t* timer)
+{
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    size_t level = 0;
+
+    if (expires < _next)
+    {
+        _push(&_due, timer);
+        return;
+    }
+
+    delta = expires - _next;
+
+    if (delta >= RANGE)
+    {
+        delta = RANGE - 1;
+        expires = _next + delta;
+    }
+
+    while (delta >= (SLOTS << (BITS * level)))
+        level++;
+
+    _push(&_wheel[level][(expires >> (BITS * level)) & MASK], timer);
+    _num_wheel++;
+}
+
+/* Find the first tick at or after _next for which a level has work
+ * (firing for level 0, cascading for the others) and the earliest deadline
+ * of the timers in that slot */
+static void _first_slot(size_t level, uint64_t* tick, uint64_t* deadline)
+{
+    const size_t shift = BITS * level;
+    const uint64_t span = 1UL << shift;
+    uint64_t t = (_next + span - 1) & ~(span - 1);
+
+    *tick = UINT64_MAX;
+    *deadline = UINT64_MAX;
+
+    for (size_t i = 0; i < SLOTS; i++, t += span)
+    {
+        myst_timer_t* p = _wheel[level][(t >> shift) & MASK];
+
+        if (p)
+        {
+            *tick = t;
+
+            for (; p; p = p->next)
+            {
+                if (p->deadline < *deadline)
+                    *deadline = p->deadline;
+            }
+
+            break;
+        }
+    }
+}
+
+/* Process the tick _next (which is the next tick with work) */
+static void _process(void)
+{
+    const uint64_t tick = _next;
+    myst_timer_t** slot;
+
+    /* cascade the higher levels as the lower ones wrap around */
+    for (size_t level = 1; level < LEVELS; level++)
+    {
+        const size_t shift = BITS * level;
+
+        if (tick & ((1UL << shift) - 1))
+            break;
+
+        slot = &_wheel[level][(tick >> shift) & MASK];
+
+        while (*slot)
+        {
+            myst_timer_t* p = *slot;
+            _unlink(p);
+            _insert(p);
+        }
+    }
+
+    slot = &_wheel[0][tick & MASK];
+
+    while (*slot)
+    {
+        myst_timer_t* p = *slot;
+        _unlink(p);
+        _push(&_due, p);
+    }
+
+    _next = tick + 1;
+}
+
+/* Process the ticks up to and including the given one */
+static void _advance(uint64_t now_tick)
+{
+    while (_next <= now_tick)
+    {
+        uint64_t first = UINT64_MAX;
+
+        for (size_t level = 0; _num_wheel && level < LEVELS; level++)
+        {
+            uint64_t tick;
+            uint64_t deadline;
+
+            _first_slot(level, &tick, &deadline);
+
+            if (tick < first)
+                first = tick;
+        }
+
+        /* nothing happens before the given tick */
+        if (first > now_tick)
+        {
+            _next = now_tick + 1;
+            break;
+        }
+
+        _next = first;
+        _process();
+    }
+}
+
+/* Get the earliest deadline of all armed timers (UINT64_MAX if none) */
+static uint64_t _earliest(void)
+{
+    uint64_t earliest = UINT64_MAX;
+
+    for (myst_timer_t* p = _due; p; p = p->next)
+    {
+        if (p->deadline < earliest)
+            earliest = p->deadline;
+    }
+
+    for (size_t level = 0; _num_wheel && level < LEVELS; level++)
+    {
+        uint64_t tick;
+        uint64_t deadline;
+
+        _first_slot(level, &tick, &deadline);
+
+        if (deadline < earliest)
+            earliest = deadline;
+    }
+
+    return earliest;
+}
+
+static int _timer_thread(void* arg)
+{
+    (void)arg;
+
+    myst_mutex_lock(&_lock);
+    _thread = myst_thread_self();
+
+    while (!_stopping)
+    {
+        const uint64_t now = myst_timer_now();
+        myst_timer_t* timer = NULL;
+        uint64_t earliest;
+
+        _advance(now / TICK_NSEC);
+
+        for (myst_timer_t* p = _due; p; p = p->next)
+        {
+            if (p->deadline <= now)
+            {
+                timer = p;
+                break;
+            }
+        }
+
+        if (timer)
+        {
+            _unlink(timer);
+            _running = timer;
+            myst_mutex_unlock(&_lock);
+
+            (*timer->fn)(timer);
+
+            myst_mutex_lock(&_lock);
+            _running = NULL;
+
+            if (_num_cancelling)
+                myst_cond_broadcast(&_done_cond, SIZE_MAX);
+
+            continue;
+        }
+
+        /* sleep until the earliest deadline (or an earlier timer is armed) */
+        if ((earliest = _earliest()) == UINT64_MAX)
+        {
+            _sleeping = UINT64_MAX;
+            myst_cond_wait(&_cond, &_lock);
+        }
+        else
+        {
+            struct timespec ts;
+            const uint64_t wait = earliest - now;
+
+            ts.tv_sec = (time_t)(wait / NANO_IN_SECOND);
+            ts.tv_nsec = (long)(wait % NANO_IN_SECOND);
+            _sleeping = earliest;
+            myst_cond_timedwait(&_cond, &_lock, &ts);
+        }
+
+        _sleeping = 0;
+    }
+
+    myst_mutex_unlock(&_lock);
+    _num_running--;
+
+    return 0;
+}
+
+/* Start the thread when the first timer is armed (call with the lock) */
+static int _start_thread(void)
+{
+    int ret = 0;
+
+    if (_started)
+        goto done;
+
+    if (_stopping)
+        ERAISE(-ECANCELED);
+
+    _num_running++;
+
+    if (myst_create_kernel_thread(_timer_thread, NULL, "timer") != 0)
+    {
+        _num_running--;
+        ERAISE(-EAGAIN);
+    }
+
+    _started = true;
+
+done:
+    return ret;
+}
+
+int myst_timer_arm(myst_timer_t* timer, uint64_t deadline)
+{
+    int ret = 0;
+
+    if (!timer || !timer->fn)
+        ERAISE(-EINVAL);
+
+    myst_mutex_lock(&_lock);
+
+    if ((ret = _start_thread()) != 0)
+    {
+        myst_mutex_unlock(&_lock);
+        ERAISE(ret);
+    }
+
+    _unlink(timer);
+
+    /* an empty wheel starts from the current tick */
+    if (_num_wheel == 0)
+        _next = myst_timer_now() / TICK_NSEC + 1;
+
+    timer->deadline = deadline;
+    timer->expires = deadline / TICK_NSEC;
+    _insert(timer);
+
+    /* wake the thread if it would sleep past the new deadline */
+    if (_sleeping > deadline)
+        myst_cond_signal(&_cond);
+
+    myst_mutex_unlock(&_lock);
+
+done:
+    return ret;
+}
+
+void myst_timer_cancel(myst_timer_t* timer)
+{
+    if (!timer)
+        return;
+
+    myst_mutex_lock(&_lock);
+
+    /* wait for the function to return (unless it is the caller) */
+    if (_running == timer && _thread != myst_thread_self())
+    {
+        _num_cancelling++;
+
+        while (_running == timer)
+            myst_cond_wait(&_done_cond, &_lock);
+
+        _num_cancelling--;
+    }
+
+    _unlink(timer);
+    myst_mutex_unlock(&_lock);
+}
+
+void myst_stop_timers(void)
+{
+    myst_mutex_lock(&_lock);
+    _stopping = true;
+    myst_cond_signal(&_cond);
+    myst_mutex_unlock(&_lock);
+
+    /* Wait ~1 second for the thread to exit */
+    for (size_t i = 0; i < 1000 && _num_running; i++)
+        myst_sleep_msec(1);
+}
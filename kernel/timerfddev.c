@@ -0,0 +1,689 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+
+#include <myst/cond.h>
+#include <myst/defs.h>
+#include <myst/eraise.h>
+#include <myst/id.h>
+#include <myst/mutex.h>
+#include <myst/pollq.h>
+#include <myst/syscall.h>
+#include <myst/time.h>
+#include <myst/timer.h>
+#include <myst/timerfddev.h>
+
+#define MAGIC 0x3a1c94d2
+
+#define NSEC_PER_SEC 1000000000UL
+
+typedef struct timerfd_impl timerfd_impl_t;
+
+/*
+** A timer keeps its next expiration and counts the expirations that have
+** passed whenever it is looked at (by read(), poll() or timerfd_gettime()),
+** so it needs no work while nobody looks. Blocked readers sleep until the
+** next expiration. Pollers subscribe to the poll queue, which a kernel timer
+** (see kernel/timer.c) notifies at every expiration of an armed timer.
+*/
+struct timerfd_impl
+{
+    myst_timer_t timer; /* armed for the next expiration */
+    myst_mutex_t mutex; /* guards the fields below */
+    myst_cond_t cond;     /* broadcast by timerfd_settime() */
+    clockid_t clockid;    /* CLOCK_REALTIME or CLOCK_MONOTONIC */
+    uint64_t expiry;      /* the next expiration in nanoseconds (0: none) */
+    uint64_t interval;    /* nanoseconds between expirations (0: once) */
+    uint64_t expirations; /* the expirations that read() has not returned */
+    size_t nrefs;         /* the timerfds sharing this (see dup) */
+    myst_pollq_t pollq;
+};
+
+struct myst_timerfd
+{
+    uint32_t magic;
+    int flags;   /* O_NONBLOCK */
+    int fdflags; /* FD_CLOEXEC */
+    timerfd_impl_t* impl;
+};
+
+MYST_INLINE bool _valid_timerfd(const myst_timerfd_t* obj)
+{
+    return obj && obj->magic == MAGIC && obj->impl;
+}
+
+static uint64_t _now(clockid_t clockid)
+{
+    struct timespec ts;
+
+    if (myst_syscall_clock_gettime(clockid, &ts) != 0)
+        return 0;
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static void _ns_to_timespec(uint64_t ns, struct timespec* ts)
+{
+    ts->tv_sec = (time_t)(ns / NSEC_PER_SEC);
+    ts->tv_nsec = (long)(ns % NSEC_PER_SEC);
+}
+
+static int _timespec_to_ns(const struct timespec* ts, uint64_t* ns)
+{
+    if (ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= (long)NSEC_PER_SEC)
+        return -EINVAL;
+
+    /* about 584 years */
+    if ((uint64_t)ts->tv_sec > UINT64_MAX / NSEC_PER_SEC - 1)
+        return -EINVAL;
+
+    *ns = (uint64_t)ts->tv_sec * NSEC_PER_SEC + (uint64_t)ts->tv_nsec;
+    return 0;
+}
+
+/* Count the expirations up to now (call with the mutex held) */
+static void _update(timerfd_impl_t* p, uint64_t now)
+{
+    if (p->expiry && now >= p->expiry)
+    {
+        if (p->interval)
+        {
+            const uint64_t n = (now - p->expiry) / p->interval + 1;
+
+            p->expirations += n;
+            p->expiry += n * p->interval;
+        }
+        else
+        {
+            p->expirations++;
+            p->expiry = 0;
+        }
+    }
+}
+
+/* Arm the kernel timer for the next expiration (call with the mutex held) */
+static int _arm(timerfd_impl_t* p, uint64_t now)
+{
+    uint64_t deadline = p->expiry;
+
+    /* kernel timers run on the monotonic clock */
+    if (p->clockid != CLOCK_MONOTONIC)
+    {
+        const uint64_t left = p->expiry > now ? p->expiry - now : 0;
+        deadline = myst_timer_now() + left;
+    }
+
+    return myst_timer_arm(&p->timer, deadline);
+}
+
+/* Notify the poll queue at every expiration (and rearm a periodic timer) */
+static void _expired(myst_timer_t* timer)
+{
+    timerfd_impl_t* p = (timerfd_impl_t*)timer;
+    bool expired;
+
+    myst_mutex_lock(&p->mutex);
+    {
+        const uint64_t now = _now(p->clockid);
+
+        _update(p, now);
+        expired = p->expirations != 0;
+
+        /* a wakeup for an earlier setting just rearms the timer */
+        if (p->expiry)
+            _arm(p, now);
+    }
+    myst_mutex_unlock(&p->mutex);
+
+    if (expired)
+        myst_pollq_notify(&p->pollq);
+}
+
+static int _td_timerfd_create(
+    myst_timerfddev_t* dev,
+    clockid_t clockid,
+    int flags,
+    myst_timerfd_t** obj_out)
+{
+    int ret = 0;
+    const int mask = TFD_NONBLOCK | TFD_CLOEXEC;
+    myst_timerfd_t* obj = NULL;
+    timerfd_impl_t* impl = NULL;
+
+    if (obj_out)
+        *obj_out = NULL;
+
+    if (!dev || (flags & ~mask) || !obj_out)
+        ERAISE(-EINVAL);
+
+    /* the boot time of an enclave is its monotonic time */
+    if (clockid == CLOCK_BOOTTIME)
+        clockid = CLOCK_MONOTONIC;
+
+    if (clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC)
+        ERAISE(-EINVAL);
+
+    if (!(impl = calloc(1, sizeof(timerfd_impl_t))))
+        ERAISE(-ENOMEM);
+
+    impl->timer.fn = _expired;
+    impl->clockid = clockid;
+    impl->nrefs = 1;
+
+    if (!(obj = calloc(1, sizeof(myst_timerfd_t))))
+        ERAISE(-ENOMEM);
+
+    obj->magic = MAGIC;
+    obj->flags = flags & O_NONBLOCK;
+    obj->impl = impl;
+    impl = NULL;
+
+    if (flags & TFD_CLOEXEC)
+        obj->fdflags = FD_CLOEXEC;
+
+    *obj_out = obj;
+    obj = NULL;
+
+done:
+
+    if (impl)
+        free(impl);
+
+    if (obj)
+        free(obj);
+
+    return ret;
+}
+
+/* Get the time left and the interval (call with the mutex held) */
+static void _get_value(
+    const timerfd_impl_t* p,
+    uint64_t now,
+    struct itimerspec* value)
+{
+    const uint64_t left = p->expiry ? p->expiry - now : 0;
+
+    _ns_to_timespec(left, &value->it_value);
+    _ns_to_timespec(p->interval, &value->it_interval);
+}
+
+static int _td_timerfd_settime(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* obj,
+    int flags,
+    const struct itimerspec* new_value,
+    struct itimerspec* old_value)
+{
+    int ret = 0;
+    const int mask = TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET;
+    timerfd_impl_t* p;
+    uint64_t value;
+    uint64_t interval;
+    uint64_t now;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EBADF);
+
+    if (!new_value)
+        ERAISE(-EFAULT);
+
+    if (flags & ~mask)
+        ERAISE(-EINVAL);
+
+    ECHECK(_timespec_to_ns(&new_value->it_value, &value));
+    ECHECK(_timespec_to_ns(&new_value->it_interval, &interval));
+
+    p = obj->impl;
+    myst_mutex_lock(&p->mutex);
+    now = _now(p->clockid);
+    _update(p, now);
+
+    if (old_value)
+        _get_value(p, now, old_value);
+
+    /* a zero value disarms the timer (and the unread expirations go) */
+    if (value == 0)
+        p->expiry = 0;
+    else if (flags & TFD_TIMER_ABSTIME)
+        p->expiry = value;
+    else
+        p->expiry = now + value;
+
+    p->interval = p->expiry ? interval : 0;
+    p->expirations = 0;
+
+    /* a disarmed timer may still wake once (and find nothing to do) */
+    if (p->expiry)
+        ret = _arm(p, now);
+
+    /* blocked readers wait for the new expiration */
+    myst_cond_broadcast(&p->cond, SIZE_MAX);
+    myst_mutex_unlock(&p->mutex);
+
+    myst_pollq_notify(&p->pollq);
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static int _td_timerfd_gettime(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* obj,
+    struct itimerspec* curr_value)
+{
+    int ret = 0;
+    timerfd_impl_t* p;
+    uint64_t now;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EBADF);
+
+    if (!curr_value)
+        ERAISE(-EFAULT);
+
+    p = obj->impl;
+    myst_mutex_lock(&p->mutex);
+    now = _now(p->clockid);
+    _update(p, now);
+    _get_value(p, now, curr_value);
+    myst_mutex_unlock(&p->mutex);
+
+done:
+    return ret;
+}
+
+static ssize_t _td_read(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* obj,
+    void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+    timerfd_impl_t* p;
+    uint64_t value = 0;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EBADF);
+
+    if (!buf && count)
+        ERAISE(-EINVAL);
+
+    if (count < sizeof(uint64_t))
+        ERAISE(-EINVAL);
+
+    p = obj->impl;
+    myst_mutex_lock(&p->mutex);
+
+    for (;;)
+    {
+        const uint64_t now = _now(p->clockid);
+        int r;
+
+        _update(p, now);
+
+        if (p->expirations)
+        {
+            value = p->expirations;
+            p->expirations = 0;
+            break;
+        }
+
+        if (obj->flags & O_NONBLOCK)
+        {
+            ret = -EAGAIN;
+            break;
+        }
+
+        /* sleep until the next expiration (or a timerfd_settime()) */
+        if (p->expiry)
+        {
+            struct timespec ts;
+
+            _ns_to_timespec(p->expiry - now, &ts);
+            r = myst_cond_timedwait(&p->cond, &p->mutex, &ts);
+        }
+        else
+        {
+            r = myst_cond_wait(&p->cond, &p->mutex);
+        }
+
+        if (r != 0 && r != ETIMEDOUT)
+        {
+            ret = -EINTR;
+            break;
+        }
+    }
+
+    myst_mutex_unlock(&p->mutex);
+    ECHECK(ret);
+
+    memcpy(buf, &value, sizeof(value));
+    ret = sizeof(value);
+
+done:
+    return ret;
+}
+
+static ssize_t _td_write(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* obj,
+    const void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EBADF);
+
+    if (!buf && count)
+        ERAISE(-EINVAL);
+
+    ERAISE(-EINVAL);
+
+done:
+    return ret;
+}
+
+static ssize_t _td_readv(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* obj,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EINVAL);
+
+    ret = myst_fdops_readv(&dev->fdops, obj, iov, iovcnt);
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static ssize_t _td_writev(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* obj,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+
+    (void)iov;
+    (void)iovcnt;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EINVAL);
+
+    ERAISE(-EINVAL);
+
+done:
+    return ret;
+}
+
+static int _td_fstat(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* obj,
+    struct stat* statbuf)
+{
+    int ret = 0;
+    struct stat buf;
+
+    if (!dev || !_valid_timerfd(obj) || !statbuf)
+        ERAISE(-EINVAL);
+
+    memset(&buf, 0, sizeof(buf));
+    buf.st_dev = 15; /* magic number for timerfd device */
+    buf.st_ino = (ino_t)obj->impl;
+    buf.st_mode = S_IRUSR | S_IWUSR;
+    buf.st_nlink = 1;
+    buf.st_uid = MYST_DEFAULT_UID;
+    buf.st_gid = MYST_DEFAULT_GID;
+    buf.st_blksize = 4096;
+
+    *statbuf = buf;
+
+done:
+    return ret;
+}
+
+static int _td_fcntl(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* obj,
+    int cmd,
+    long arg)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EBADF);
+
+    switch (cmd)
+    {
+        case F_GETFL:
+        {
+            ret = O_RDWR | obj->flags;
+            break;
+        }
+        case F_SETFL:
+        {
+            obj->flags = (int)(arg & O_NONBLOCK);
+            break;
+        }
+        case F_GETFD:
+        {
+            ret = obj->fdflags;
+            break;
+        }
+        case F_SETFD:
+        {
+            if (arg != FD_CLOEXEC && arg != 0)
+                ERAISE(-EINVAL);
+
+            obj->fdflags = (int)arg;
+            break;
+        }
+        default:
+        {
+            ERAISE(-ENOTSUP);
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _td_ioctl(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* obj,
+    unsigned long request,
+    long arg)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EBADF);
+
+    switch (request)
+    {
+        case FIONBIO:
+        {
+            if (!arg)
+                ERAISE(-EFAULT);
+
+            if (*(const int*)arg)
+                obj->flags |= O_NONBLOCK;
+            else
+                obj->flags &= ~O_NONBLOCK;
+
+            break;
+        }
+        case TIOCGWINSZ:
+        {
+            ERAISE(-EINVAL);
+        }
+        default:
+        {
+            ERAISE(-ENOTSUP);
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _td_dup(
+    myst_timerfddev_t* dev,
+    const myst_timerfd_t* obj,
+    myst_timerfd_t** obj_out)
+{
+    int ret = 0;
+    myst_timerfd_t* new_obj = NULL;
+
+    if (obj_out)
+        *obj_out = NULL;
+
+    if (!dev || !_valid_timerfd(obj) || !obj_out)
+        ERAISE(-EINVAL);
+
+    if (!(new_obj = calloc(1, sizeof(myst_timerfd_t))))
+        ERAISE(-ENOMEM);
+
+    *new_obj = *obj;
+
+    /* file descriptor flags are not propagated */
+    new_obj->fdflags = 0;
+
+    myst_mutex_lock(&obj->impl->mutex);
+    obj->impl->nrefs++;
+    myst_mutex_unlock(&obj->impl->mutex);
+
+    *obj_out = new_obj;
+
+done:
+    return ret;
+}
+
+static int _td_close(myst_timerfddev_t* dev, myst_timerfd_t* obj)
+{
+    int ret = 0;
+    timerfd_impl_t* p;
+    size_t nrefs;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EBADF);
+
+    p = obj->impl;
+
+    myst_mutex_lock(&p->mutex);
+    nrefs = --p->nrefs;
+    myst_mutex_unlock(&p->mutex);
+
+    /* release the timer once no descriptor refers to it */
+    if (nrefs == 0)
+    {
+        /* wait for a running _expired() (which takes the mutex) */
+        myst_timer_cancel(&p->timer);
+
+        myst_pollq_destroy(&p->pollq);
+        memset(p, 0, sizeof(timerfd_impl_t));
+        free(p);
+    }
+
+    memset(obj, 0, sizeof(myst_timerfd_t));
+    free(obj);
+
+done:
+    return ret;
+}
+
+static int _td_target_fd(myst_timerfddev_t* dev, myst_timerfd_t* obj)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EINVAL);
+
+    ret = -ENOTSUP;
+
+done:
+    return ret;
+}
+
+static int _td_get_events(myst_timerfddev_t* dev, myst_timerfd_t* obj)
+{
+    int ret = 0;
+    timerfd_impl_t* p;
+
+    if (!dev || !_valid_timerfd(obj))
+        ERAISE(-EINVAL);
+
+    p = obj->impl;
+    myst_mutex_lock(&p->mutex);
+    _update(p, _now(p->clockid));
+
+    if (p->expirations)
+        ret = POLLIN;
+
+    myst_mutex_unlock(&p->mutex);
+
+done:
+    return ret;
+}
+
+static myst_pollq_t* _td_pollq(myst_timerfddev_t* dev, myst_timerfd_t* obj)
+{
+    if (!dev || !_valid_timerfd(obj))
+        return NULL;
+
+    return &obj->impl->pollq;
+}
+
+extern myst_timerfddev_t* myst_timerfddev_get(void)
+{
+    // clang-format-off
+    static myst_timerfddev_t _dev = {
+        {
+            .fd_read = (void*)_td_read,
+            .fd_write = (void*)_td_write,
+            .fd_readv = (void*)_td_readv,
+            .fd_writev = (void*)_td_writev,
+            .fd_fstat = (void*)_td_fstat,
+            .fd_fcntl = (void*)_td_fcntl,
+            .fd_ioctl = (void*)_td_ioctl,
+            .fd_dup = (void*)_td_dup,
+            .fd_close = (void*)_td_close,
+            .fd_target_fd = (void*)_td_target_fd,
+            .fd_get_events = (void*)_td_get_events,
+            .fd_pollq = (void*)_td_pollq,
+        },
+        .td_timerfd_create = _td_timerfd_create,
+        .td_timerfd_settime = _td_timerfd_settime,
+        .td_timerfd_gettime = _td_timerfd_gettime,
+        .td_read = _td_read,
+        .td_write = _td_write,
+        .td_readv = _td_readv,
+        .td_writev = _td_writev,
+        .td_fstat = _td_fstat,
+        .td_fcntl = _td_fcntl,
+        .td_ioctl = _td_ioctl,
+        .td_dup = _td_dup,
+        .td_close = _td_close,
+        .td_target_fd = _td_target_fd,
+        .td_get_events = _td_get_events,
+    };
+    // clang-format on
+
+    return &_dev;
+}
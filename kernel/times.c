@@ -6,10 +6,23 @@
 #include <myst/clock.h>
 #include <myst/eraise.h>
 #include <myst/syscall.h>
+#include <myst/tcall.h>
 #include <myst/thread.h>
 #include <myst/times.h>
 
-/* Time spent by the main thread and its children */
+/*
+**==============================================================================
+**
+** Each thread accumulates its own user and system time, written only by that
+** thread, so entering and leaving the kernel touches no shared cache lines.
+** The process totals are computed on demand (times(), getrusage(), etc.) by
+** adding the time of the running threads to that of the exited threads,
+** which is folded into process_times by myst_times_exit_thread().
+**
+**==============================================================================
+*/
+
+/* Time spent by threads that have exited */
 struct tms process_times;
 
 MYST_INLINE long lapsed_nsecs(struct timespec t0, struct timespec t1)
@@ -34,11 +47,20 @@ void myst_times_start()
     myst_syscall_clock_gettime(CLOCK_MONOTONIC, &thread->start_ts);
 }
 
+/* Read CLOCK_MONOTONIC directly from the target, which serves it from the
+ * shared clock page; this avoids the lock taken by clock_gettime().
+ */
+static void _get_monotime(struct timespec* tp)
+{
+    long params[6] = {CLOCK_MONOTONIC, (long)tp};
+    myst_assume(myst_tcall(MYST_TCALL_CLOCK_GETTIME, params) == 0);
+}
+
 void myst_times_enter_kernel()
 {
     myst_thread_t* current = myst_thread_self();
 
-    myst_syscall_clock_gettime(CLOCK_MONOTONIC, &current->enter_kernel_ts);
+    _get_monotime(&current->enter_kernel_ts);
 
     // Thread might be entering the kernel for the first time
     if (is_zero_tp(&current->leave_kernel_ts))
@@ -47,34 +69,78 @@ void myst_times_enter_kernel()
     long lapsed =
         lapsed_nsecs(current->leave_kernel_ts, current->enter_kernel_ts);
     myst_assume(lapsed >= 0);
-    __atomic_fetch_add(&process_times.tms_utime, lapsed, __ATOMIC_SEQ_CST);
+    /* only this thread writes the field (others read it with _get_times) */
+    __atomic_store_n(
+        &current->utime, current->utime + lapsed, __ATOMIC_RELAXED);
 }
 
 void myst_times_leave_kernel()
 {
     myst_thread_t* current = myst_thread_self();
-    myst_syscall_clock_gettime(CLOCK_MONOTONIC, &current->leave_kernel_ts);
+    _get_monotime(&current->leave_kernel_ts);
 
     long lapsed =
         lapsed_nsecs(current->enter_kernel_ts, current->leave_kernel_ts);
-    myst_assume(lapsed > 0);
-    __atomic_fetch_add(&process_times.tms_stime, lapsed, __ATOMIC_SEQ_CST);
+    myst_assume(lapsed >= 0);
+    __atomic_store_n(
+        &current->stime, current->stime + lapsed, __ATOMIC_RELAXED);
+}
+
+void myst_times_exit_thread(myst_thread_t* thread)
+{
+    long utime = __atomic_load_n(&thread->utime, __ATOMIC_RELAXED);
+    long stime = __atomic_load_n(&thread->stime, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&process_times.tms_utime, utime, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&process_times.tms_stime, stime, __ATOMIC_RELAXED);
+}
+
+static void _sum_times(myst_thread_t* thread, void* arg)
+{
+    long* sums = (long*)arg;
+
+    sums[0] += __atomic_load_n(&thread->utime, __ATOMIC_RELAXED);
+    sums[1] += __atomic_load_n(&thread->stime, __ATOMIC_RELAXED);
+}
+
+/* Fold the time of the running threads into the exited-thread totals */
+static void _get_times(long* utime, long* stime)
+{
+    long sums[2] = {0, 0};
+
+    myst_tid_map_foreach(_sum_times, sums);
+
+    *utime = __atomic_load_n(&process_times.tms_utime, __ATOMIC_RELAXED);
+    *utime += sums[0];
+    *stime = __atomic_load_n(&process_times.tms_stime, __ATOMIC_RELAXED);
+    *stime += sums[1];
 }
 
 long myst_times_system_time()
 {
-    return process_times.tms_stime;
+    long utime;
+    long stime;
+
+    _get_times(&utime, &stime);
+    return stime;
 }
 
 long myst_times_user_time()
 {
-    return process_times.tms_utime;
+    long utime;
+    long stime;
+
+    _get_times(&utime, &stime);
+    return utime;
 }
 
 long myst_times_process_time()
 {
-    return process_times.tms_stime + process_times.tms_utime +
-           process_times.tms_cstime + process_times.tms_cutime;
+    long utime;
+    long stime;
+
+    _get_times(&utime, &stime);
+    return stime + utime + process_times.tms_cstime + process_times.tms_cutime;
 }
 
 long myst_times_thread_time()
@@ -86,7 +152,11 @@ long myst_times_thread_time()
 
 long myst_times_uptime()
 {
-    return process_times.tms_stime + process_times.tms_utime;
+    long utime;
+    long stime;
+
+    _get_times(&utime, &stime);
+    return stime + utime;
 }
 
 long myst_times_get_cpu_clock_time(clockid_t clk_id, struct timespec* tp)
@@ -110,6 +180,7 @@ long myst_times_get_cpu_clock_time(clockid_t clk_id, struct timespec* tp)
 
             long nanoseconds = lapsed_nsecs(t->start_ts, t->enter_kernel_ts);
             set_timespec_from_nanos(tp, nanoseconds);
+            myst_put_thread(t);
         }
     }
     else
@@ -10,6 +10,7 @@
 #include <unistd.h>
 
 #include <myst/assume.h>
+#include <myst/console.h>
 #include <myst/eraise.h>
 #include <myst/id.h>
 #include <myst/tcall.h>
@@ -78,6 +79,9 @@ static ssize_t _td_read(
     if (count == 0)
         goto done;
 
+    /* show any prompt before waiting for input */
+    myst_console_flush();
+
     ERAISE(myst_tcall_read_console(tty->fd, buf, count));
 
 done:
@@ -101,7 +105,7 @@ static ssize_t _td_write(
     if (count == 0)
         goto done;
 
-    ERAISE(myst_tcall_write_console(tty->fd, buf, count));
+    ERAISE(myst_console_write(tty->fd, buf, count));
 
 done:
     return ret;
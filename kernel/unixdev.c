@@ -0,0 +1,2968 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+
+#include <myst/cond.h>
+#include <myst/eraise.h>
+#include <myst/fdtable.h>
+#include <myst/id.h>
+#include <myst/loopback.h>
+#include <myst/mutex.h>
+#include <myst/panic.h>
+#include <myst/pollq.h>
+#include <myst/process.h>
+#include <myst/realpath.h>
+#include <myst/scratch.h>
+#include <myst/slab.h>
+#include <myst/spinlock.h>
+#include <myst/syscall.h>
+#include <myst/unixdev.h>
+
+#define MAGIC 0x75d1c0de
+
+/* Small stream writes are coalesced into chunks of at least this size */
+#define STREAM_CHUNK_SIZE 1024
+
+/* Most descriptors one SCM_RIGHTS message may carry (SCM_MAX_FD) */
+#define MAX_RIGHTS 253
+
+/* Smallest receive queue limit SO_RCVBUF may set (SOCK_MIN_RCVBUF) */
+#define MIN_RCVBUF 2304
+
+/* Largest receive queue limit SO_RCVBUF may set (net.core.rmem_max) */
+#define MAX_RCVBUF (4 * 1024 * 1024)
+
+/* Ports that bind() picks for port zero (net.ipv4.ip_local_port_range) */
+#define EPHEMERAL_PORT_MIN 32768
+#define EPHEMERAL_PORT_MAX 60999
+
+#define SUN_PATH_OFFSET offsetof(struct sockaddr_un, sun_path)
+
+/* A socket name: AF_UNIX, or AF_INET and AF_INET6 for loopback sockets */
+typedef union address
+{
+    struct sockaddr sa;
+    struct sockaddr_un sun;
+    struct sockaddr_in sin;
+    struct sockaddr_in6 sin6;
+} address_t;
+
+/*
+**==============================================================================
+**
+** Messages: the receive queue of a socket is a list of messages. Datagram
+** and seqpacket sends append one message each. Stream sends append to the
+** last message when they can, and a stream receive may span messages but
+** stops in front of one that carries file descriptors (as on Linux).
+**
+**==============================================================================
+*/
+
+/* File descriptors in flight (SCM_RIGHTS) */
+typedef struct rights
+{
+    size_t count;
+    struct
+    {
+        myst_fdtable_type_t type;
+        void* device;
+        void* object;
+    } files[];
+} rights_t;
+
+typedef struct message
+{
+    struct message* next;
+    size_t size;     /* bytes in data[] */
+    size_t capacity; /* size of data[] */
+    size_t offset;   /* bytes already received (streams) */
+    rights_t* rights;
+    address_t addr; /* the name of the sender (if bound) */
+    socklen_t addrlen;
+    uint8_t data[];
+} message_t;
+
+static void _free_rights(rights_t* rights)
+{
+    if (rights)
+    {
+        for (size_t i = 0; i < rights->count; i++)
+        {
+            myst_fdops_t* fdops = rights->files[i].device;
+            (*fdops->fd_close)(fdops, rights->files[i].object);
+        }
+
+        free(rights);
+    }
+}
+
+static void _free_messages(message_t* head)
+{
+    while (head)
+    {
+        message_t* next = head->next;
+        _free_rights(head->rights);
+        free(head);
+        head = next;
+    }
+}
+
+/*
+**==============================================================================
+**
+** Endpoints: the state of a socket, shared by all its handles (one handle per
+** file descriptor). An endpoint is referenced by its handles (jointly, by a
+** single reference), by the peer connected to it, by the listener it waits
+** on for accept() and by whoever is operating on it at the moment.
+**
+**==============================================================================
+*/
+
+typedef enum state
+{
+    STATE_UNCONNECTED,
+    STATE_LISTENING,
+    STATE_CONNECTED,
+    STATE_CLOSED,
+} state_t;
+
+typedef struct endpoint endpoint_t;
+
+struct endpoint
+{
+    size_t refs;        /* updated atomically */
+    myst_mutex_t mutex; /* protects the fields below */
+    myst_cond_t cond;   /* broadcast whenever the fields below change */
+    int domain;         /* AF_UNIX, or AF_INET or AF_INET6 (loopback) */
+    int type;           /* SOCK_STREAM, SOCK_SEQPACKET or SOCK_DGRAM */
+    state_t state;
+    size_t nhandles; /* open handles */
+
+    /* the receive queue */
+    message_t* head;
+    message_t* tail;
+    size_t nbytes;
+    size_t rcvbuf;
+    size_t sndbuf; /* only reported (queues are bounded by rcvbuf) */
+
+    bool rdshut;      /* nothing more will be received */
+    bool wrshut;      /* nothing more may be sent */
+    bool peer_closed; /* the connected peer went away */
+
+    /* the connected peer (referenced) and its credentials */
+    endpoint_t* peer;
+    struct ucred peercred;
+
+    /* connections waiting for accept() (listening sockets) */
+    endpoint_t* pending_head;
+    endpoint_t* pending_tail;
+    endpoint_t* pending_next;
+    size_t npending;
+    size_t backlog;
+
+    /* the name given to bind() (addrlen is zero if unbound) */
+    address_t addr;
+    socklen_t addrlen;
+
+    mode_t mode; /* reported by fstat() and changed by fchmod() */
+    bool passcred;
+    struct timeval rcvtimeo;
+    struct timeval sndtimeo;
+
+    myst_pollq_t pollq;
+};
+
+struct myst_sock
+{
+    uint32_t magic; /* MAGIC */
+    int flags;      /* O_NONBLOCK */
+    int fdflags;    /* FD_CLOEXEC */
+    endpoint_t* ep;
+};
+
+static myst_slab_cache_t _sock_cache =
+    MYST_SLAB_CACHE_INIT("unix myst_sock_t", myst_sock_t);
+
+MYST_INLINE bool _valid_sock(const myst_sock_t* sock)
+{
+    return sock && sock->magic == MAGIC && sock->ep;
+}
+
+static bool _connection_oriented(const endpoint_t* ep)
+{
+    return ep->type == SOCK_STREAM || ep->type == SOCK_SEQPACKET;
+}
+
+static struct ucred _self_cred(void)
+{
+    struct ucred cred = {myst_getpid(), MYST_DEFAULT_UID, MYST_DEFAULT_GID};
+    return cred;
+}
+
+static endpoint_t* _new_endpoint(int domain, int type)
+{
+    endpoint_t* ep;
+
+    if (!(ep = calloc(1, sizeof(endpoint_t))))
+        return NULL;
+
+    ep->refs = 1;
+    ep->domain = domain;
+    ep->type = type;
+    ep->rcvbuf = MYST_UNIX_RCVBUF;
+    ep->sndbuf = MYST_UNIX_RCVBUF;
+    ep->mode = 0777;
+    ep->addr.sa.sa_family = domain;
+
+    return ep;
+}
+
+static void _ref(endpoint_t* ep)
+{
+    __atomic_add_fetch(&ep->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void _unref(endpoint_t* ep)
+{
+    if (ep && __atomic_sub_fetch(&ep->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        myst_pollq_destroy(&ep->pollq);
+        _free_messages(ep->head);
+        free(ep);
+    }
+}
+
+static void _changed(endpoint_t* ep)
+{
+    myst_cond_broadcast(&ep->cond, SIZE_MAX);
+}
+
+/* Wait for the endpoint to change; returns -EAGAIN once timeout expires */
+static int _wait(endpoint_t* ep, const struct timeval* timeout)
+{
+    struct timespec ts;
+
+    if (!timeout->tv_sec && !timeout->tv_usec)
+    {
+        myst_cond_wait(&ep->cond, &ep->mutex);
+        return 0;
+    }
+
+    ts.tv_sec = timeout->tv_sec;
+    ts.tv_nsec = timeout->tv_usec * 1000;
+
+    if (myst_cond_timedwait(&ep->cond, &ep->mutex, &ts) != 0)
+        return -EAGAIN;
+
+    return 0;
+}
+
+/*
+**==============================================================================
+**
+** The name space: bound names are registered here. A pathname is resolved
+** to an absolute path and, as on Linux, bind() creates a file there (which
+** must not exist yet). Once that file is removed the name cannot be reached
+** any more. If the file cannot be created (because its directory does not
+** exist in the enclave) the name is still registered. Loopback sockets are
+** named by their address and port, and like abstract names have no file.
+**
+**==============================================================================
+*/
+
+typedef struct name
+{
+    struct name* next;
+    endpoint_t* ep;
+    bool abstract;
+    bool has_node; /* bind() created a file for this name */
+    size_t keylen;
+    char key[]; /* the absolute path, abstract name or inet address */
+} name_t;
+
+static name_t* _names;
+static myst_spinlock_t _names_lock = MYST_SPINLOCK_INITIALIZER;
+
+/* Get the key of a unix address: an absolute path or the abstract name */
+static int _get_unix_key(
+    const struct sockaddr* addr,
+    socklen_t addrlen,
+    bool* abstract,
+    char* key,
+    size_t* keylen)
+{
+    int ret = 0;
+    const struct sockaddr_un* sun = (const struct sockaddr_un*)addr;
+    size_t len;
+
+    if (!addr || addrlen < SUN_PATH_OFFSET || addrlen > sizeof(*sun))
+        ERAISE(-EINVAL);
+
+    len = addrlen - SUN_PATH_OFFSET;
+
+    if (len == 0)
+        ERAISE(-EINVAL);
+
+    if (sun->sun_path[0] == '\0')
+    {
+        /* the abstract name is every byte after the leading zero */
+        *abstract = true;
+        memcpy(key, sun->sun_path, len);
+        *keylen = len;
+    }
+    else
+    {
+        char path[sizeof(sun->sun_path) + 1];
+        myst_path_t* resolved;
+
+        *abstract = false;
+        memcpy(path, sun->sun_path, len);
+        path[len] = '\0';
+
+        if (!(resolved = myst_scratch_alloc(sizeof(myst_path_t))))
+            ERAISE(-ENOMEM);
+
+        if ((ret = myst_realpath(path, resolved)) == 0)
+        {
+            *keylen = strlen(resolved->buf);
+            memcpy(key, resolved->buf, *keylen + 1);
+        }
+
+        myst_scratch_free(resolved);
+        ECHECK(ret);
+    }
+
+done:
+    return ret;
+}
+
+/* Get the key of a loopback address: the family, port and address */
+static int _get_inet_key(
+    const struct sockaddr* addr,
+    socklen_t addrlen,
+    char* key,
+    size_t* keylen)
+{
+    int ret = 0;
+    const sa_family_t family = addr->sa_family;
+    const void* port;
+    const void* host;
+    size_t hostlen;
+
+    if (family == AF_INET)
+    {
+        const struct sockaddr_in* sin = (const struct sockaddr_in*)addr;
+
+        if (addrlen < sizeof(*sin))
+            ERAISE(-EINVAL);
+
+        port = &sin->sin_port;
+        host = &sin->sin_addr;
+        hostlen = sizeof(sin->sin_addr);
+    }
+    else
+    {
+        const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*)addr;
+
+        if (addrlen < sizeof(*sin6))
+            ERAISE(-EINVAL);
+
+        port = &sin6->sin6_port;
+        host = &sin6->sin6_addr;
+        hostlen = sizeof(sin6->sin6_addr);
+    }
+
+    /* (never starts with '/' or a zero byte, unlike the unix keys) */
+    memcpy(key, &family, sizeof(family));
+    memcpy(key + sizeof(family), port, sizeof(in_port_t));
+    memcpy(key + sizeof(family) + sizeof(in_port_t), host, hostlen);
+    *keylen = sizeof(family) + sizeof(in_port_t) + hostlen;
+
+done:
+    return ret;
+}
+
+/* Get the key of an address, which must belong to the given domain */
+static int _get_key(
+    int domain,
+    const struct sockaddr* addr,
+    socklen_t addrlen,
+    bool* abstract,
+    char* key,
+    size_t* keylen)
+{
+    if (!addr || addrlen < sizeof(sa_family_t))
+        return -EINVAL;
+
+    if (addr->sa_family != domain)
+        return (domain == AF_UNIX) ? -EINVAL : -EAFNOSUPPORT;
+
+    if (domain == AF_UNIX)
+        return _get_unix_key(addr, addrlen, abstract, key, keylen);
+
+    *abstract = true;
+    return _get_inet_key(addr, addrlen, key, keylen);
+}
+
+static bool _node_exists(const char* path)
+{
+    struct stat st;
+    return myst_syscall_stat(path, &st) == 0;
+}
+
+static bool _name_match(
+    const name_t* name,
+    bool abstract,
+    const char* key,
+    size_t keylen)
+{
+    return name->abstract == abstract && name->keylen == keylen &&
+           memcmp(name->key, key, keylen) == 0;
+}
+
+static int _bind_name(endpoint_t* ep, bool abstract, const char* key, size_t n)
+{
+    int ret = 0;
+    name_t* name = NULL;
+    name_t* stale = NULL;
+
+    if (!(name = calloc(1, sizeof(name_t) + n + 1)))
+        ERAISE(-ENOMEM);
+
+    name->ep = ep;
+    name->abstract = abstract;
+    name->keylen = n;
+    memcpy(name->key, key, n);
+
+    if (!abstract)
+    {
+        mode_t mode = ep->mode;
+        long fd;
+
+        fd = myst_syscall_open(key, O_CREAT | O_EXCL | O_WRONLY, mode);
+
+        if (fd == -EEXIST)
+            ERAISE(-EADDRINUSE);
+
+        if (fd >= 0)
+        {
+            myst_syscall_close(fd);
+            name->has_node = true;
+        }
+    }
+
+    myst_spin_lock(&_names_lock);
+    {
+        name_t* prev = NULL;
+
+        for (name_t* p = _names; p; prev = p, p = p->next)
+        {
+            if (!_name_match(p, abstract, key, n))
+                continue;
+
+            /* a name whose file was removed (and can be created) is free */
+            if (!name->has_node || !p->has_node)
+            {
+                myst_spin_unlock(&_names_lock);
+
+                if (name->has_node)
+                    myst_syscall_unlink(key);
+
+                ERAISE(-EADDRINUSE);
+            }
+
+            if (prev)
+                prev->next = p->next;
+            else
+                _names = p->next;
+
+            stale = p;
+            break;
+        }
+
+        name->next = _names;
+        _names = name;
+        name = NULL;
+    }
+    myst_spin_unlock(&_names_lock);
+
+done:
+
+    if (name)
+        free(name);
+
+    if (stale)
+        free(stale);
+
+    return ret;
+}
+
+static void _unbind_name(endpoint_t* ep)
+{
+    name_t* names = NULL;
+
+    /* (racing autobinds may have registered more than one name) */
+    myst_spin_lock(&_names_lock);
+    {
+        name_t** link = &_names;
+
+        while (*link)
+        {
+            name_t* p = *link;
+
+            if (p->ep == ep)
+            {
+                *link = p->next;
+                p->next = names;
+                names = p;
+            }
+            else
+            {
+                link = &p->next;
+            }
+        }
+    }
+    myst_spin_unlock(&_names_lock);
+
+    while (names)
+    {
+        name_t* next = names->next;
+        free(names);
+        names = next;
+    }
+}
+
+/* Find the endpoint bound to an address and take a reference to it */
+static int _lookup(
+    int domain,
+    const struct sockaddr* addr,
+    socklen_t addrlen,
+    endpoint_t** ep_out)
+{
+    int ret = 0;
+    bool abstract;
+    char key[PATH_MAX];
+    size_t keylen;
+    bool has_node = false;
+    endpoint_t* ep = NULL;
+
+    *ep_out = NULL;
+
+    ECHECK(_get_key(domain, addr, addrlen, &abstract, key, &keylen));
+
+    myst_spin_lock(&_names_lock);
+    {
+        for (name_t* p = _names; p; p = p->next)
+        {
+            if (_name_match(p, abstract, key, keylen))
+            {
+                ep = p->ep;
+                has_node = p->has_node;
+                _ref(ep);
+                break;
+            }
+        }
+    }
+    myst_spin_unlock(&_names_lock);
+
+    if (abstract)
+    {
+        if (!ep)
+            ERAISE(-ECONNREFUSED);
+    }
+    else if (!ep || has_node)
+    {
+        /* the file must still be there */
+        if (!_node_exists(key))
+            ERAISE(-ENOENT);
+
+        if (!ep)
+            ERAISE(-ECONNREFUSED);
+    }
+
+    *ep_out = ep;
+    ep = NULL;
+
+done:
+
+    _unref(ep);
+
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** Closing
+**
+**==============================================================================
+*/
+
+/* Tell the peer that this endpoint went away */
+static void _hangup(endpoint_t* peer)
+{
+    myst_mutex_lock(&peer->mutex);
+    {
+        peer->peer_closed = true;
+
+        if (_connection_oriented(peer))
+            peer->rdshut = true;
+
+        _changed(peer);
+    }
+    myst_mutex_unlock(&peer->mutex);
+
+    myst_pollq_notify(&peer->pollq);
+}
+
+/* Shut the endpoint down once it has no handles left */
+static void _disconnect(endpoint_t* ep)
+{
+    endpoint_t* peer;
+    endpoint_t* pending;
+    message_t* messages;
+
+    myst_mutex_lock(&ep->mutex);
+    {
+        ep->state = STATE_CLOSED;
+        ep->rdshut = true;
+        ep->wrshut = true;
+
+        peer = ep->peer;
+        ep->peer = NULL;
+
+        messages = ep->head;
+        ep->head = NULL;
+        ep->tail = NULL;
+        ep->nbytes = 0;
+
+        pending = ep->pending_head;
+        ep->pending_head = NULL;
+        ep->pending_tail = NULL;
+        ep->npending = 0;
+
+        _changed(ep);
+    }
+    myst_mutex_unlock(&ep->mutex);
+
+    myst_pollq_notify(&ep->pollq);
+
+    if (ep->addrlen)
+        _unbind_name(ep);
+
+    /* closing passed descriptors may close other sockets, so unlocked */
+    _free_messages(messages);
+
+    /* refuse connections that were never accepted */
+    while (pending)
+    {
+        endpoint_t* next = pending->pending_next;
+        _disconnect(pending);
+        _unref(pending);
+        pending = next;
+    }
+
+    if (peer)
+    {
+        _hangup(peer);
+        _unref(peer);
+    }
+}
+
+/*
+**==============================================================================
+**
+** Sending
+**
+**==============================================================================
+*/
+
+typedef struct iov_cursor
+{
+    const struct iovec* iov;
+    int iovcnt;
+    int index;
+    size_t offset; /* into iov[index] */
+} iov_cursor_t;
+
+static void _cursor_init(iov_cursor_t* c, const struct iovec* iov, int iovcnt)
+{
+    c->iov = iov;
+    c->iovcnt = iovcnt;
+    c->index = 0;
+    c->offset = 0;
+}
+
+/* Copy n bytes out of the iovec array */
+static void _gather(iov_cursor_t* c, uint8_t* dest, size_t n)
+{
+    while (n && c->index < c->iovcnt)
+    {
+        const struct iovec* v = &c->iov[c->index];
+        size_t m = v->iov_len - c->offset;
+
+        if (m > n)
+            m = n;
+
+        memcpy(dest, (const uint8_t*)v->iov_base + c->offset, m);
+        dest += m;
+        n -= m;
+
+        if ((c->offset += m) == v->iov_len)
+        {
+            c->index++;
+            c->offset = 0;
+        }
+    }
+}
+
+/* Copy n bytes into the iovec array */
+static void _scatter(iov_cursor_t* c, const uint8_t* src, size_t n)
+{
+    while (n && c->index < c->iovcnt)
+    {
+        const struct iovec* v = &c->iov[c->index];
+        size_t m = v->iov_len - c->offset;
+
+        if (m > n)
+            m = n;
+
+        memcpy((uint8_t*)v->iov_base + c->offset, src, m);
+        src += m;
+        n -= m;
+
+        if ((c->offset += m) == v->iov_len)
+        {
+            c->index++;
+            c->offset = 0;
+        }
+    }
+}
+
+static int _iov_length(const struct iovec* iov, int iovcnt, size_t* len)
+{
+    size_t total = 0;
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX || (!iov && iovcnt))
+        return -EINVAL;
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (!iov[i].iov_base && iov[i].iov_len)
+            return -EFAULT;
+
+        if (iov[i].iov_len > SSIZE_MAX - total)
+            return -EINVAL;
+
+        total += iov[i].iov_len;
+    }
+
+    *len = total;
+    return 0;
+}
+
+static message_t* _new_message(
+    const endpoint_t* sender,
+    size_t capacity,
+    rights_t* rights)
+{
+    message_t* msg;
+
+    if (!(msg = malloc(sizeof(message_t) + capacity)))
+        return NULL;
+
+    msg->next = NULL;
+    msg->size = 0;
+    msg->capacity = capacity;
+    msg->offset = 0;
+    msg->rights = rights;
+    msg->addr = sender->addr;
+    msg->addrlen = sender->addrlen; /* (no name for an unbound sender) */
+
+    return msg;
+}
+
+static void _enqueue(endpoint_t* ep, message_t* msg)
+{
+    if (ep->tail)
+        ep->tail->next = msg;
+    else
+        ep->head = msg;
+
+    ep->tail = msg;
+    ep->nbytes += msg->size;
+}
+
+/* Get the endpoint to send to and take a reference to it */
+static int _get_target(
+    endpoint_t* ep,
+    const struct sockaddr* addr,
+    socklen_t addrlen,
+    endpoint_t** target)
+{
+    int ret = 0;
+
+    *target = NULL;
+
+    if (addr && ep->type == SOCK_DGRAM)
+    {
+        ECHECK(_lookup(ep->domain, addr, addrlen, target));
+
+        if ((*target)->type != SOCK_DGRAM)
+        {
+            _unref(*target);
+            *target = NULL;
+            ERAISE(-EPROTOTYPE);
+        }
+
+        goto done;
+    }
+
+    myst_mutex_lock(&ep->mutex);
+    {
+        if (ep->wrshut)
+            ret = -EPIPE;
+        else if (addr && _connection_oriented(ep))
+            ret = (ep->state == STATE_CONNECTED) ? -EISCONN : -EOPNOTSUPP;
+        else if (ep->peer)
+            _ref(*target = ep->peer);
+        else if (ep->peer_closed)
+            ret = (ep->type == SOCK_DGRAM) ? -ECONNREFUSED : -EPIPE;
+        else
+            ret = -ENOTCONN;
+    }
+    myst_mutex_unlock(&ep->mutex);
+
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+/* Append a stream write to the target; returns the bytes queued */
+static ssize_t _send_stream(
+    endpoint_t* ep,
+    endpoint_t* target,
+    iov_cursor_t* cursor,
+    size_t len,
+    rights_t** rights,
+    bool nonblock)
+{
+    ssize_t ret = 0;
+    size_t rem = len;
+
+    myst_mutex_lock(&target->mutex);
+
+    /* a write of nothing may still pass descriptors */
+    while (rem || *rights)
+    {
+        message_t* tail = target->tail;
+        size_t space;
+        size_t n;
+
+        if (target->state == STATE_CLOSED || target->rdshut)
+        {
+            ret = -EPIPE;
+            break;
+        }
+
+        if (target->nbytes >= target->rcvbuf)
+        {
+            if (nonblock)
+            {
+                ret = -EAGAIN;
+                break;
+            }
+
+            if ((ret = _wait(target, &ep->sndtimeo)) != 0)
+                break;
+
+            continue;
+        }
+
+        space = target->rcvbuf - target->nbytes;
+        n = (rem < space) ? rem : space;
+
+        if (!*rights && tail && !tail->rights &&
+            tail->capacity - tail->size >= n)
+        {
+            /* append to the last message */
+            _gather(cursor, tail->data + tail->size, n);
+            tail->size += n;
+            target->nbytes += n;
+        }
+        else
+        {
+            size_t capacity = (n < STREAM_CHUNK_SIZE) ? STREAM_CHUNK_SIZE : n;
+            message_t* msg;
+
+            if (!(msg = _new_message(ep, capacity, *rights)))
+            {
+                ret = -ENOMEM;
+                break;
+            }
+
+            *rights = NULL;
+            _gather(cursor, msg->data, n);
+            msg->size = n;
+            _enqueue(target, msg);
+        }
+
+        rem -= n;
+        _changed(target);
+    }
+
+    myst_mutex_unlock(&target->mutex);
+
+    if (rem < len)
+        myst_pollq_notify(&target->pollq);
+
+    /* report a short count rather than an error after a partial write */
+    if (rem < len)
+        return (ssize_t)(len - rem);
+
+    return ret;
+}
+
+/* Append one datagram or seqpacket message to the target */
+static ssize_t _send_message(
+    endpoint_t* ep,
+    endpoint_t* target,
+    iov_cursor_t* cursor,
+    size_t len,
+    rights_t** rights,
+    bool nonblock)
+{
+    ssize_t ret = 0;
+    message_t* msg;
+
+    if (len > target->rcvbuf)
+        return -EMSGSIZE;
+
+    if (!(msg = _new_message(ep, len, NULL)))
+        return -ENOMEM;
+
+    _gather(cursor, msg->data, len);
+    msg->size = len;
+
+    myst_mutex_lock(&target->mutex);
+
+    for (;;)
+    {
+        if (target->state == STATE_CLOSED || target->rdshut)
+        {
+            ret = (ep->type == SOCK_DGRAM) ? -ECONNREFUSED : -EPIPE;
+            break;
+        }
+
+        /* a message always fits into an empty queue */
+        if (!target->head || target->nbytes + len <= target->rcvbuf)
+        {
+            msg->rights = *rights;
+            *rights = NULL;
+            _enqueue(target, msg);
+            msg = NULL;
+            _changed(target);
+            ret = (ssize_t)len;
+            break;
+        }
+
+        if (nonblock)
+        {
+            ret = -EAGAIN;
+            break;
+        }
+
+        if ((ret = _wait(target, &ep->sndtimeo)) != 0)
+            break;
+    }
+
+    myst_mutex_unlock(&target->mutex);
+
+    if (msg)
+        free(msg);
+    else
+        myst_pollq_notify(&target->pollq);
+
+    return ret;
+}
+
+/* Take references to the descriptors of an SCM_RIGHTS message */
+static int _get_rights(const struct msghdr* msg, rights_t** rights_out)
+{
+    int ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    rights_t* rights = NULL;
+    size_t count = 0;
+    size_t size;
+
+    *rights_out = NULL;
+
+    if (!msg->msg_control || msg->msg_controllen < sizeof(struct cmsghdr))
+        goto done;
+
+    /* count the descriptors */
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR((struct msghdr*)msg); cmsg;
+         cmsg = CMSG_NXTHDR((struct msghdr*)msg, cmsg))
+    {
+        if (cmsg->cmsg_len < CMSG_LEN(0))
+            ERAISE(-EINVAL);
+
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            count += (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    }
+
+    if (count == 0)
+        goto done;
+
+    if (count > MAX_RIGHTS)
+        ERAISE(-EINVAL);
+
+    size = sizeof(rights_t) + count * sizeof(*rights->files);
+
+    if (!(rights = calloc(1, size)))
+        ERAISE(-ENOMEM);
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR((struct msghdr*)msg); cmsg;
+         cmsg = CMSG_NXTHDR((struct msghdr*)msg, cmsg))
+    {
+        const int* fds = (const int*)CMSG_DATA(cmsg);
+        size_t n;
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            myst_fdtable_type_t type;
+            void* device;
+            void* object;
+            void* dup;
+            myst_fdops_t* fdops;
+
+            if (myst_fdtable_get_any(
+                    fdtable, fds[i], &type, &device, &object) != 0)
+            {
+                ERAISE(-EBADF);
+            }
+
+            fdops = device;
+            ECHECK((*fdops->fd_dup)(device, object, &dup));
+
+            rights->files[rights->count].type = type;
+            rights->files[rights->count].device = device;
+            rights->files[rights->count].object = dup;
+            rights->count++;
+        }
+    }
+
+    *rights_out = rights;
+    rights = NULL;
+
+done:
+
+    _free_rights(rights);
+
+    return ret;
+}
+
+static socklen_t _address_size(int domain)
+{
+    switch (domain)
+    {
+        case AF_INET:
+            return sizeof(struct sockaddr_in);
+        case AF_INET6:
+            return sizeof(struct sockaddr_in6);
+        default:
+            return sizeof(struct sockaddr_un);
+    }
+}
+
+static in_port_t* _address_port(address_t* a)
+{
+    return (a->sa.sa_family == AF_INET) ? &a->sin.sin_port : &a->sin6.sin6_port;
+}
+
+/* Register the name and make it the name of the endpoint */
+static int _bind_address(endpoint_t* ep, const address_t* a, socklen_t len)
+{
+    int ret = 0;
+    bool abstract;
+    char key[PATH_MAX];
+    size_t keylen;
+
+    ECHECK(_get_key(ep->domain, &a->sa, len, &abstract, key, &keylen));
+    ECHECK(_bind_name(ep, abstract, key, keylen));
+
+    myst_mutex_lock(&ep->mutex);
+    ep->addr = *a;
+    ep->addrlen = len;
+    myst_mutex_unlock(&ep->mutex);
+
+done:
+    return ret;
+}
+
+/* Bind to a free name: a unique abstract name (unix sockets) or a free
+ * ephemeral port of host (loopback sockets; null for the loopback address) */
+static int _autobind(endpoint_t* ep, const address_t* host)
+{
+    int ret = 0;
+    address_t a;
+    const size_t nports = EPHEMERAL_PORT_MAX - EPHEMERAL_PORT_MIN + 1;
+    static uint32_t _counter;
+    static uint32_t _port;
+
+    memset(&a, 0, sizeof(a));
+
+    if (ep->domain == AF_UNIX)
+    {
+        uint32_t n = __atomic_add_fetch(&_counter, 1, __ATOMIC_RELAXED);
+
+        a.sun.sun_family = AF_UNIX;
+        snprintf(a.sun.sun_path + 1, 6, "%05x", n & 0xfffff);
+        ECHECK(_bind_address(ep, &a, SUN_PATH_OFFSET + 6));
+        goto done;
+    }
+
+    if (host)
+        a = *host;
+    else if ((a.sa.sa_family = ep->domain) == AF_INET)
+        a.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    else
+        a.sin6.sin6_addr = in6addr_loopback;
+
+    ret = -EADDRINUSE;
+
+    for (size_t i = 0; i < nports && ret == -EADDRINUSE; i++)
+    {
+        uint32_t n = __atomic_fetch_add(&_port, 1, __ATOMIC_RELAXED);
+
+        *_address_port(&a) = htons(EPHEMERAL_PORT_MIN + n % nports);
+        ret = _bind_address(ep, &a, _address_size(ep->domain));
+    }
+
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static ssize_t _send(
+    myst_sock_t* sock,
+    const struct iovec* iov,
+    int iovcnt,
+    rights_t* rights,
+    int flags,
+    const struct sockaddr* addr,
+    socklen_t addrlen)
+{
+    ssize_t ret = 0;
+    endpoint_t* ep = sock->ep;
+    endpoint_t* target = NULL;
+    const bool nonblock = (sock->flags & O_NONBLOCK) || (flags & MSG_DONTWAIT);
+    iov_cursor_t cursor;
+    size_t len;
+
+    ECHECK(_iov_length(iov, iovcnt, &len));
+    _cursor_init(&cursor, iov, iovcnt);
+
+    /* sendmsg() callers often pass a name buffer of length zero */
+    if (!addrlen)
+        addr = NULL;
+
+    /* a loopback datagram carries the port to reply to */
+    if (ep->domain != AF_UNIX && ep->type == SOCK_DGRAM && !ep->addrlen)
+        ECHECK(_autobind(ep, NULL));
+
+    ECHECK(_get_target(ep, addr, addrlen, &target));
+
+    if (ep->type == SOCK_STREAM)
+        ret = _send_stream(ep, target, &cursor, len, &rights, nonblock);
+    else
+        ret = _send_message(ep, target, &cursor, len, &rights, nonblock);
+
+done:
+
+    if (ret == -EPIPE && !(flags & MSG_NOSIGNAL))
+        myst_syscall_kill(myst_getpid(), SIGPIPE);
+
+    _unref(target);
+    _free_rights(rights);
+
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** Receiving
+**
+**==============================================================================
+*/
+
+/* Install passed descriptors and describe them in the control buffer */
+static void _put_rights(struct msghdr* msg, rights_t* rights, int flags)
+{
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    struct cmsghdr* cmsg = NULL;
+    size_t max = 0;
+    size_t n = 0;
+
+    if (msg && msg->msg_control &&
+        msg->msg_controllen >= CMSG_LEN(sizeof(int)))
+    {
+        cmsg = (struct cmsghdr*)msg->msg_control;
+        max = (msg->msg_controllen - CMSG_LEN(0)) / sizeof(int);
+    }
+
+    for (size_t i = 0; i < rights->count; i++)
+    {
+        myst_fdops_t* fdops = rights->files[i].device;
+        void* object = rights->files[i].object;
+        int fd = -1;
+
+        /* before the assignment, which records FD_CLOEXEC */
+        if (flags & MSG_CMSG_CLOEXEC)
+            (*fdops->fd_fcntl)(fdops, object, F_SETFD, FD_CLOEXEC);
+
+        if (n < max)
+        {
+            fd = myst_fdtable_assign(
+                fdtable, rights->files[i].type, fdops, object);
+        }
+
+        if (fd < 0)
+        {
+            /* the descriptors that do not fit are closed */
+            (*fdops->fd_close)(fdops, object);
+
+            if (msg)
+                msg->msg_flags |= MSG_CTRUNC;
+
+            continue;
+        }
+
+        memcpy(CMSG_DATA(cmsg) + n * sizeof(int), &fd, sizeof(int));
+        n++;
+    }
+
+    /* the objects now belong to the descriptor table */
+    rights->count = 0;
+    free(rights);
+
+    if (!msg)
+        return;
+
+    if (n)
+    {
+        size_t used = CMSG_SPACE(n * sizeof(int));
+
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+
+        if (used > msg->msg_controllen)
+            used = msg->msg_controllen;
+
+        msg->msg_controllen = used;
+    }
+    else
+    {
+        msg->msg_controllen = 0;
+    }
+}
+
+static void _put_name(struct msghdr* msg, const message_t* m)
+{
+    if (msg && msg->msg_name)
+    {
+        socklen_t n = m->addrlen;
+
+        if (n > msg->msg_namelen)
+            n = msg->msg_namelen;
+
+        memcpy(msg->msg_name, &m->addr, n);
+        msg->msg_namelen = m->addrlen;
+    }
+}
+
+/* Free a received message (called with the mutex held) */
+static void _pop(endpoint_t* ep)
+{
+    message_t* msg = ep->head;
+
+    if (!(ep->head = msg->next))
+        ep->tail = NULL;
+
+    free(msg);
+}
+
+static ssize_t _recv(
+    myst_sock_t* sock,
+    const struct iovec* iov,
+    int iovcnt,
+    struct msghdr* msg,
+    int flags)
+{
+    ssize_t ret = 0;
+    endpoint_t* ep = sock->ep;
+    const bool nonblock = (sock->flags & O_NONBLOCK) || (flags & MSG_DONTWAIT);
+    const bool peek = (flags & MSG_PEEK);
+    iov_cursor_t cursor;
+    size_t len;
+    size_t copied = 0;
+    size_t consumed = 0;
+    rights_t* rights = NULL;
+    bool named = false;
+    endpoint_t* peer = NULL;
+
+    ECHECK(_iov_length(iov, iovcnt, &len));
+    _cursor_init(&cursor, iov, iovcnt);
+
+    if (msg)
+    {
+        msg->msg_flags = 0;
+
+        if (!msg->msg_name)
+            msg->msg_namelen = 0;
+    }
+
+    myst_mutex_lock(&ep->mutex);
+
+    for (;;)
+    {
+        /* block here while the queue is empty */
+        while (!ep->head)
+        {
+            /* (what MSG_WAITALL already received is returned at unlock) */
+            if (ep->rdshut)
+                ret = 0; /* end of file */
+            else if (_connection_oriented(ep) && ep->peer_closed)
+                ret = 0; /* the peer went away */
+            else if (_connection_oriented(ep) && ep->state != STATE_CONNECTED)
+                ret = -ENOTCONN;
+            else if (nonblock)
+                ret = -EAGAIN;
+            else if ((ret = _wait(ep, &ep->rcvtimeo)) == 0)
+                continue;
+
+            goto unlock;
+        }
+
+        if (ep->type != SOCK_STREAM)
+        {
+            message_t* m = ep->head;
+            size_t n = (m->size < len) ? m->size : len;
+
+            _scatter(&cursor, m->data, n);
+            _put_name(msg, m);
+
+            if (n < m->size && msg)
+                msg->msg_flags |= MSG_TRUNC;
+
+            ret = (flags & MSG_TRUNC) ? (ssize_t)m->size : (ssize_t)n;
+
+            if (!peek)
+            {
+                rights = m->rights;
+                m->rights = NULL;
+                ep->nbytes -= m->size;
+                consumed = m->size;
+                _pop(ep);
+            }
+
+            goto unlock;
+        }
+
+        /* streams receive across messages */
+        {
+            for (message_t* m = ep->head; m && copied < len; m = m->next)
+            {
+                size_t avail = m->size - m->offset;
+                size_t n;
+
+                /* descriptors mark the start of a new read */
+                if (m->rights && (copied || rights))
+                    break;
+
+                if (!named)
+                {
+                    _put_name(msg, m);
+                    named = true;
+                }
+
+                n = (avail < len - copied) ? avail : len - copied;
+                _scatter(&cursor, m->data + m->offset, n);
+                copied += n;
+
+                if (peek)
+                    continue;
+
+                if (m->rights)
+                {
+                    rights = m->rights;
+                    m->rights = NULL;
+                }
+
+                m->offset += n;
+                ep->nbytes -= n;
+                consumed += n;
+            }
+
+            /* free the messages that were fully received */
+            while (!peek && ep->head && ep->head->offset == ep->head->size &&
+                   !ep->head->rights)
+            {
+                _pop(ep);
+            }
+
+            /* MSG_WAITALL waits for the rest unless a boundary was hit */
+            if ((flags & MSG_WAITALL) && !peek && !rights && copied < len &&
+                !nonblock && !ep->head)
+            {
+                continue;
+            }
+
+            ret = (ssize_t)copied;
+            goto unlock;
+        }
+    }
+
+unlock:
+
+    if (consumed)
+    {
+        /* senders may be waiting for space */
+        _changed(ep);
+
+        if ((peer = ep->peer))
+            _ref(peer);
+    }
+
+    myst_mutex_unlock(&ep->mutex);
+
+    if (peer)
+    {
+        myst_pollq_notify(&peer->pollq);
+        _unref(peer);
+    }
+
+    /* a stream read that got some bytes reports them, not a later error */
+    if (copied && ret <= 0)
+        ret = (ssize_t)copied;
+
+    /* (descriptors that cannot be passed on are closed) */
+    if (rights)
+        _put_rights(msg, rights, flags);
+    else if (msg)
+        msg->msg_controllen = 0;
+
+done:
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** The socket device
+**
+**==============================================================================
+*/
+
+static int _new_sock(endpoint_t* ep, int flags, myst_sock_t** sock_out)
+{
+    myst_sock_t* sock;
+
+    if (!(sock = myst_slab_alloc(&_sock_cache)))
+        return -ENOMEM;
+
+    sock->magic = MAGIC;
+    sock->ep = ep;
+
+    if (flags & SOCK_NONBLOCK)
+        sock->flags |= O_NONBLOCK;
+
+    if (flags & SOCK_CLOEXEC)
+        sock->fdflags = FD_CLOEXEC;
+
+    *sock_out = sock;
+    return 0;
+}
+
+static int _check_type(int domain, int type, int protocol)
+{
+    const int base = type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (domain == AF_INET || domain == AF_INET6)
+    {
+        /* loopback TCP and UDP */
+        if (base == SOCK_STREAM && (!protocol || protocol == IPPROTO_TCP))
+            return base;
+
+        if (base == SOCK_DGRAM && (!protocol || protocol == IPPROTO_UDP))
+            return base;
+
+        if (base == SOCK_STREAM || base == SOCK_DGRAM)
+            return -EPROTONOSUPPORT;
+
+        return -ESOCKTNOSUPPORT;
+    }
+
+    if (domain != AF_UNIX)
+        return -EAFNOSUPPORT;
+
+    if (base != SOCK_STREAM && base != SOCK_DGRAM && base != SOCK_SEQPACKET)
+        return -ESOCKTNOSUPPORT;
+
+    if (protocol != 0 && protocol != PF_UNIX)
+        return -EPROTONOSUPPORT;
+
+    return base;
+}
+
+static int _ud_socket(
+    myst_sockdev_t* sd,
+    int domain,
+    int type,
+    int protocol,
+    myst_sock_t** sock_out)
+{
+    int ret = 0;
+    endpoint_t* ep = NULL;
+    int base;
+
+    if (sock_out)
+        *sock_out = NULL;
+
+    if (!sd || !sock_out)
+        ERAISE(-EINVAL);
+
+    ECHECK(base = _check_type(domain, type, protocol));
+
+    if (!(ep = _new_endpoint(domain, base)))
+        ERAISE(-ENOMEM);
+
+    ep->nhandles = 1;
+    ECHECK(_new_sock(ep, type, sock_out));
+    ep = NULL;
+
+done:
+
+    if (ep)
+        free(ep);
+
+    return ret;
+}
+
+static int _ud_socketpair(
+    myst_sockdev_t* sd,
+    int domain,
+    int type,
+    int protocol,
+    myst_sock_t* pair[2])
+{
+    int ret = 0;
+    endpoint_t* ep0 = NULL;
+    endpoint_t* ep1 = NULL;
+    int base;
+
+    if (!sd || !pair)
+        ERAISE(-EINVAL);
+
+    pair[0] = NULL;
+    pair[1] = NULL;
+
+    ECHECK(base = _check_type(domain, type, protocol));
+
+    if (domain != AF_UNIX)
+        ERAISE(-EOPNOTSUPP);
+
+    if (!(ep0 = _new_endpoint(domain, base)) ||
+        !(ep1 = _new_endpoint(domain, base)))
+    {
+        ERAISE(-ENOMEM);
+    }
+
+    ECHECK(_new_sock(ep0, type, &pair[0]));
+    ECHECK(_new_sock(ep1, type, &pair[1]));
+
+    /* each endpoint references the other as its peer */
+    _ref(ep0->peer = ep1);
+    _ref(ep1->peer = ep0);
+    ep0->state = STATE_CONNECTED;
+    ep1->state = STATE_CONNECTED;
+    ep0->peercred = _self_cred();
+    ep1->peercred = _self_cred();
+    ep0->nhandles = 1;
+    ep1->nhandles = 1;
+    ep0 = NULL;
+    ep1 = NULL;
+
+done:
+
+    if (ep0 || ep1)
+    {
+        if (pair && pair[0])
+            myst_slab_free(pair[0]);
+
+        if (pair && pair[1])
+            myst_slab_free(pair[1]);
+
+        free(ep0);
+        free(ep1);
+    }
+
+    return ret;
+}
+
+static int _ud_bind(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    const struct sockaddr* addr,
+    socklen_t addrlen)
+{
+    int ret = 0;
+    endpoint_t* ep;
+    address_t a;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    ep = sock->ep;
+
+    if (ep->addrlen)
+        ERAISE(-EINVAL);
+
+    if (!addr || addrlen < sizeof(sa_family_t))
+        ERAISE(-EINVAL);
+
+    if (addrlen > sizeof(a))
+        addrlen = sizeof(a);
+
+    memset(&a, 0, sizeof(a));
+    memcpy(&a, addr, addrlen);
+
+    if (ep->domain == AF_UNIX)
+    {
+        if (a.sa.sa_family != AF_UNIX)
+            ERAISE(-EINVAL);
+
+        if (addrlen > sizeof(struct sockaddr_un))
+            ERAISE(-EINVAL);
+
+        /* without a name, bind to a unique abstract name (autobind) */
+        if (addrlen == sizeof(sa_family_t))
+            ECHECK(_autobind(ep, NULL));
+        else
+            ECHECK(_bind_address(ep, &a, addrlen));
+
+        goto done;
+    }
+
+    if (a.sa.sa_family != ep->domain)
+        ERAISE(-EAFNOSUPPORT);
+
+    if (addrlen < _address_size(ep->domain))
+        ERAISE(-EINVAL);
+
+    addrlen = _address_size(ep->domain);
+
+    /* only loopback addresses are served in the enclave */
+    if (!myst_loopback_address(&a.sa, addrlen))
+        ERAISE(-EADDRNOTAVAIL);
+
+    if (*_address_port(&a) == 0)
+        ECHECK(_autobind(ep, &a));
+    else
+        ECHECK(_bind_address(ep, &a, addrlen));
+
+done:
+    return ret;
+}
+
+static int _ud_listen(myst_sockdev_t* sd, myst_sock_t* sock, int backlog)
+{
+    int ret = 0;
+    endpoint_t* ep;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    ep = sock->ep;
+
+    if (!_connection_oriented(ep))
+        ERAISE(-EOPNOTSUPP);
+
+    if (backlog < 0 || backlog > SOMAXCONN)
+        backlog = SOMAXCONN;
+
+    myst_mutex_lock(&ep->mutex);
+    {
+        if (!ep->addrlen || ep->state == STATE_CONNECTED)
+            ret = -EINVAL;
+        else
+        {
+            ep->state = STATE_LISTENING;
+            ep->backlog = (size_t)backlog;
+            ep->peercred = _self_cred();
+            _changed(ep);
+        }
+    }
+    myst_mutex_unlock(&ep->mutex);
+
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static int _ud_connect(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    const struct sockaddr* addr,
+    socklen_t addrlen)
+{
+    int ret = 0;
+    endpoint_t* ep;
+    endpoint_t* target = NULL;
+    endpoint_t* server = NULL;
+    struct ucred cred = {0};
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    ep = sock->ep;
+
+    if (ep->type == SOCK_DGRAM)
+    {
+        endpoint_t* old;
+
+        /* AF_UNSPEC dissolves the association */
+        if (addr && addrlen >= sizeof(sa_family_t) &&
+            addr->sa_family == AF_UNSPEC)
+        {
+            target = NULL;
+        }
+        else
+        {
+            ECHECK(_lookup(ep->domain, addr, addrlen, &target));
+
+            if (target->type != SOCK_DGRAM)
+                ERAISE(-EPROTOTYPE);
+
+            /* replies need an address to go to */
+            if (ep->domain != AF_UNIX && !ep->addrlen)
+                ECHECK(_autobind(ep, NULL));
+        }
+
+        myst_mutex_lock(&ep->mutex);
+        {
+            old = ep->peer;
+            ep->peer = target;
+            ep->peer_closed = false;
+            ep->state = target ? STATE_CONNECTED : STATE_UNCONNECTED;
+            _changed(ep);
+        }
+        myst_mutex_unlock(&ep->mutex);
+
+        target = NULL;
+        _unref(old);
+        goto done;
+    }
+
+    ECHECK(_lookup(ep->domain, addr, addrlen, &target));
+
+    if (target->type != ep->type)
+        ERAISE(-EPROTOTYPE);
+
+    /* a loopback client gets an ephemeral port, as with TCP */
+    if (ep->domain != AF_UNIX && !ep->addrlen)
+        ECHECK(_autobind(ep, NULL));
+
+    /* the endpoint that accept() will return */
+    if (!(server = _new_endpoint(ep->domain, ep->type)))
+        ERAISE(-ENOMEM);
+
+    server->state = STATE_CONNECTED;
+    server->peercred = _self_cred();
+    server->addr = target->addr; /* (never registered in the name space) */
+    server->addrlen = target->addrlen;
+    _ref(server->peer = ep);
+
+    /* claim the endpoint first: no two endpoint locks are ever held */
+    myst_mutex_lock(&ep->mutex);
+    {
+        if (ep->state == STATE_CONNECTED || ep->peer_closed)
+            ret = -EISCONN;
+        else if (ep->state != STATE_UNCONNECTED)
+            ret = -EINVAL;
+        else
+        {
+            _ref(ep->peer = server);
+            ep->state = STATE_CONNECTED;
+        }
+    }
+    myst_mutex_unlock(&ep->mutex);
+
+    ECHECK(ret);
+
+    myst_mutex_lock(&target->mutex);
+    {
+        for (;;)
+        {
+            if (target->state != STATE_LISTENING)
+            {
+                ret = -ECONNREFUSED;
+                break;
+            }
+
+            if (target->npending < target->backlog + 1)
+            {
+                if (target->pending_tail)
+                    target->pending_tail->pending_next = server;
+                else
+                    target->pending_head = server;
+
+                target->pending_tail = server;
+                target->npending++;
+                cred = target->peercred;
+                _changed(target);
+                break;
+            }
+
+            if (sock->flags & O_NONBLOCK)
+            {
+                ret = -EAGAIN;
+                break;
+            }
+
+            if ((ret = _wait(target, &ep->sndtimeo)) != 0)
+                break;
+        }
+    }
+    myst_mutex_unlock(&target->mutex);
+
+    myst_mutex_lock(&ep->mutex);
+    {
+        if (ret == 0)
+        {
+            ep->peercred = cred;
+        }
+        else
+        {
+            /* give the claim back */
+            ep->peer = NULL;
+            ep->state = STATE_UNCONNECTED;
+            _unref(server);
+        }
+
+        _changed(ep);
+    }
+    myst_mutex_unlock(&ep->mutex);
+
+    ECHECK(ret);
+
+    /* the pending list now owns the initial reference */
+    server = NULL;
+    myst_pollq_notify(&target->pollq);
+    myst_pollq_notify(&ep->pollq);
+
+done:
+
+    if (server)
+    {
+        _unref(server->peer);
+        server->peer = NULL;
+        _unref(server);
+    }
+
+    _unref(target);
+
+    return ret;
+}
+
+static int _ud_accept4(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    struct sockaddr* addr,
+    socklen_t* addrlen,
+    int flags,
+    myst_sock_t** new_sock)
+{
+    int ret = 0;
+    endpoint_t* ep;
+    endpoint_t* server = NULL;
+
+    if (new_sock)
+        *new_sock = NULL;
+
+    if (!sd || !_valid_sock(sock) || !new_sock)
+        ERAISE(-EBADF);
+
+    if (flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC))
+        ERAISE(-EINVAL);
+
+    if (addr && !addrlen)
+        ERAISE(-EFAULT);
+
+    ep = sock->ep;
+
+    if (!_connection_oriented(ep))
+        ERAISE(-EOPNOTSUPP);
+
+    myst_mutex_lock(&ep->mutex);
+    {
+        for (;;)
+        {
+            if (ep->state != STATE_LISTENING)
+            {
+                ret = -EINVAL;
+                break;
+            }
+
+            if ((server = ep->pending_head))
+            {
+                if (!(ep->pending_head = server->pending_next))
+                    ep->pending_tail = NULL;
+
+                server->pending_next = NULL;
+                ep->npending--;
+
+                /* connectors may be waiting for room in the backlog */
+                _changed(ep);
+                break;
+            }
+
+            if (sock->flags & O_NONBLOCK)
+            {
+                ret = -EAGAIN;
+                break;
+            }
+
+            if ((ret = _wait(ep, &ep->rcvtimeo)) != 0)
+                break;
+        }
+    }
+    myst_mutex_unlock(&ep->mutex);
+
+    ECHECK(ret);
+
+    if ((ret = _new_sock(server, flags, new_sock)) != 0)
+    {
+        _disconnect(server);
+        _unref(server);
+        ERAISE(ret);
+    }
+
+    server->nhandles = 1;
+
+    if (addr)
+    {
+        address_t peer_addr;
+        socklen_t n = sizeof(sa_family_t);
+
+        memset(&peer_addr, 0, sizeof(peer_addr));
+        peer_addr.sa.sa_family = ep->domain;
+
+        myst_mutex_lock(&server->mutex);
+        {
+            if (server->peer && server->peer->addrlen)
+            {
+                peer_addr = server->peer->addr;
+                n = server->peer->addrlen;
+            }
+        }
+        myst_mutex_unlock(&server->mutex);
+
+        memcpy(addr, &peer_addr, (*addrlen < n) ? *addrlen : n);
+        *addrlen = n;
+    }
+
+done:
+    return ret;
+}
+
+static ssize_t _ud_sendto(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    const void* buf,
+    size_t len,
+    int flags,
+    const struct sockaddr* dest_addr,
+    socklen_t addrlen)
+{
+    struct iovec iov = {(void*)buf, len};
+
+    if (!sd || !_valid_sock(sock))
+        return -EBADF;
+
+    return _send(sock, &iov, 1, NULL, flags, dest_addr, addrlen);
+}
+
+static ssize_t _ud_recvfrom(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    void* buf,
+    size_t len,
+    int flags,
+    struct sockaddr* src_addr,
+    socklen_t* addrlen)
+{
+    ssize_t ret = 0;
+    struct iovec iov = {buf, len};
+    struct msghdr msg;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    if (src_addr && !addrlen)
+        ERAISE(-EFAULT);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = src_addr;
+    msg.msg_namelen = src_addr ? *addrlen : 0;
+
+    ECHECK(ret = _recv(sock, &iov, 1, &msg, flags));
+
+    if (src_addr)
+        *addrlen = msg.msg_namelen;
+
+done:
+    return ret;
+}
+
+static int _ud_sendmsg(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    const struct msghdr* msg,
+    int flags)
+{
+    ssize_t ret = 0;
+    rights_t* rights = NULL;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    if (!msg)
+        ERAISE(-EFAULT);
+
+    ECHECK(_get_rights(msg, &rights));
+
+    /* _send() takes the rights */
+    ret = _send(
+        sock,
+        msg->msg_iov,
+        (int)msg->msg_iovlen,
+        rights,
+        flags,
+        msg->msg_name,
+        msg->msg_namelen);
+
+done:
+    return (int)ret;
+}
+
+static int _ud_recvmsg(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    struct msghdr* msg,
+    int flags)
+{
+    ssize_t ret = 0;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    if (!msg)
+        ERAISE(-EFAULT);
+
+    ret = _recv(sock, msg->msg_iov, (int)msg->msg_iovlen, msg, flags);
+
+done:
+    return (int)ret;
+}
+
+static int _ud_sendmmsg(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags)
+{
+    int ret = 0;
+    unsigned int i;
+
+    if (!msgvec && vlen)
+        ERAISE(-EFAULT);
+
+    for (i = 0; i < vlen; i++)
+    {
+        int r = _ud_sendmsg(sd, sock, &msgvec[i].msg_hdr, flags);
+
+        /* report an error only if nothing was sent */
+        if (r < 0)
+        {
+            if (i == 0)
+                ERAISE(r);
+
+            break;
+        }
+
+        msgvec[i].msg_len = (unsigned int)r;
+    }
+
+    ret = (int)i;
+
+done:
+    return ret;
+}
+
+static int _ud_recvmmsg(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    struct timespec* timeout)
+{
+    int ret = 0;
+    unsigned int i;
+    int msec = -1;
+    long deadline = 0;
+
+    if (!msgvec && vlen)
+        ERAISE(-EFAULT);
+
+    if (timeout)
+    {
+        if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 ||
+            timeout->tv_nsec >= 1000000000)
+        {
+            ERAISE(-EINVAL);
+        }
+
+        msec = (timeout->tv_sec > INT_MAX / 1000)
+                   ? INT_MAX
+                   : (int)(timeout->tv_sec * 1000 +
+                           (timeout->tv_nsec + 999999) / 1000000);
+        deadline = myst_poll_deadline(msec);
+    }
+
+    for (i = 0; i < vlen; i++)
+    {
+        int r = _ud_recvmsg(sd, sock, &msgvec[i].msg_hdr, flags);
+
+        /* report an error only if nothing was received */
+        if (r < 0)
+        {
+            if (i == 0)
+                ERAISE(r);
+
+            break;
+        }
+
+        msgvec[i].msg_len = (unsigned int)r;
+
+        /* after the first message, take only what is already queued */
+        if (flags & MSG_WAITFORONE)
+            flags |= MSG_DONTWAIT;
+
+        /* like Linux, check the timeout only after each message */
+        if (timeout && myst_poll_remaining(msec, deadline) == 0)
+        {
+            i++;
+            break;
+        }
+    }
+
+    if (timeout)
+    {
+        int remaining = myst_poll_remaining(msec, deadline);
+
+        timeout->tv_sec = (remaining > 0) ? remaining / 1000 : 0;
+        timeout->tv_nsec = (remaining > 0) ? (remaining % 1000) * 1000000 : 0;
+    }
+
+    ret = (int)i;
+
+done:
+    return ret;
+}
+
+static int _ud_shutdown(myst_sockdev_t* sd, myst_sock_t* sock, int how)
+{
+    int ret = 0;
+    endpoint_t* ep;
+    endpoint_t* peer = NULL;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    if (how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR)
+        ERAISE(-EINVAL);
+
+    ep = sock->ep;
+
+    myst_mutex_lock(&ep->mutex);
+    {
+        if (_connection_oriented(ep) && ep->state != STATE_CONNECTED)
+        {
+            ret = -ENOTCONN;
+        }
+        else
+        {
+            if (how == SHUT_RD || how == SHUT_RDWR)
+                ep->rdshut = true;
+
+            if (how == SHUT_WR || how == SHUT_RDWR)
+                ep->wrshut = true;
+
+            if ((peer = ep->peer))
+                _ref(peer);
+
+            _changed(ep);
+        }
+    }
+    myst_mutex_unlock(&ep->mutex);
+
+    ECHECK(ret);
+    myst_pollq_notify(&ep->pollq);
+
+    /* the peer of a connection sees end of file */
+    if (peer && _connection_oriented(ep) && how != SHUT_RD)
+    {
+        myst_mutex_lock(&peer->mutex);
+        peer->rdshut = true;
+        _changed(peer);
+        myst_mutex_unlock(&peer->mutex);
+        myst_pollq_notify(&peer->pollq);
+    }
+
+done:
+
+    _unref(peer);
+
+    return ret;
+}
+
+static int _get_timeval(
+    const void* optval,
+    socklen_t optlen,
+    struct timeval* tv)
+{
+    if (!optval || optlen < sizeof(struct timeval))
+        return -EINVAL;
+
+    memcpy(tv, optval, sizeof(struct timeval));
+
+    if (tv->tv_sec < 0 || tv->tv_usec < 0 || tv->tv_usec >= 1000000)
+        return -EDOM;
+
+    return 0;
+}
+
+static int _get_int(const void* optval, socklen_t optlen, int* value)
+{
+    if (!optval || optlen < sizeof(int))
+        return -EINVAL;
+
+    memcpy(value, optval, sizeof(int));
+    return 0;
+}
+
+static int _ud_setsockopt(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    int level,
+    int optname,
+    const void* optval,
+    socklen_t optlen)
+{
+    int ret = 0;
+    endpoint_t* ep;
+    int value = 0;
+    struct timeval tv;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    ep = sock->ep;
+
+    if (level != SOL_SOCKET)
+    {
+        /* TCP and IP options (TCP_NODELAY, ...) mean nothing in memory */
+        if (ep->domain == AF_UNIX)
+            ERAISE(-EOPNOTSUPP);
+
+        goto done;
+    }
+
+    switch (optname)
+    {
+        case SO_RCVBUF:
+        case SO_SNDBUF:
+        {
+            size_t size;
+
+            ECHECK(_get_int(optval, optlen, &value));
+
+            /* Linux doubles the value to allow for bookkeeping */
+            size = (value < 0) ? MIN_RCVBUF : (size_t)value * 2;
+
+            if (size < MIN_RCVBUF)
+                size = MIN_RCVBUF;
+
+            if (size > MAX_RCVBUF)
+                size = MAX_RCVBUF;
+
+            myst_mutex_lock(&ep->mutex);
+            {
+                if (optname == SO_RCVBUF)
+                    ep->rcvbuf = size;
+                else
+                    ep->sndbuf = size;
+
+                _changed(ep);
+            }
+            myst_mutex_unlock(&ep->mutex);
+            break;
+        }
+        case SO_PASSCRED:
+        {
+            ECHECK(_get_int(optval, optlen, &value));
+            ep->passcred = (value != 0);
+            break;
+        }
+        case SO_RCVTIMEO:
+        {
+            ECHECK(_get_timeval(optval, optlen, &tv));
+            ep->rcvtimeo = tv;
+            break;
+        }
+        case SO_SNDTIMEO:
+        {
+            ECHECK(_get_timeval(optval, optlen, &tv));
+            ep->sndtimeo = tv;
+            break;
+        }
+        default:
+        {
+            /* other options (SO_REUSEADDR, SO_KEEPALIVE, ...) do not apply */
+            break;
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _ud_getsockopt(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    int level,
+    int optname,
+    void* optval,
+    socklen_t* optlen)
+{
+    int ret = 0;
+    endpoint_t* ep;
+    int value;
+    const void* data = &value;
+    size_t size = sizeof(value);
+    struct ucred cred = {0};
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    if (!optval || !optlen)
+        ERAISE(-EFAULT);
+
+    ep = sock->ep;
+
+    if (level != SOL_SOCKET)
+    {
+        /* TCP and IP options read as zero (see _ud_setsockopt()) */
+        if (ep->domain == AF_UNIX)
+            ERAISE(-EOPNOTSUPP);
+
+        value = 0;
+        goto copy;
+    }
+
+    switch (optname)
+    {
+        case SO_TYPE:
+            value = ep->type;
+            break;
+        case SO_DOMAIN:
+            value = ep->domain;
+            break;
+        case SO_PROTOCOL:
+        {
+            if (ep->domain == AF_UNIX)
+                value = 0;
+            else if (ep->type == SOCK_STREAM)
+                value = IPPROTO_TCP;
+            else
+                value = IPPROTO_UDP;
+            break;
+        }
+        case SO_ERROR:
+            value = 0;
+            break;
+        case SO_ACCEPTCONN:
+            value = (ep->state == STATE_LISTENING);
+            break;
+        case SO_RCVBUF:
+            value = (int)ep->rcvbuf;
+            break;
+        case SO_SNDBUF:
+            value = (int)ep->sndbuf;
+            break;
+        case SO_PASSCRED:
+            value = ep->passcred;
+            break;
+        case SO_RCVTIMEO:
+            data = &ep->rcvtimeo;
+            size = sizeof(ep->rcvtimeo);
+            break;
+        case SO_SNDTIMEO:
+            data = &ep->sndtimeo;
+            size = sizeof(ep->sndtimeo);
+            break;
+        case SO_PEERCRED:
+        {
+            myst_mutex_lock(&ep->mutex);
+            {
+                if (ep->state == STATE_CONNECTED ||
+                    ep->state == STATE_LISTENING)
+                {
+                    cred = ep->peercred;
+                }
+                else
+                {
+                    cred.pid = 0;
+                    cred.uid = (uid_t)-1;
+                    cred.gid = (gid_t)-1;
+                }
+            }
+            myst_mutex_unlock(&ep->mutex);
+
+            data = &cred;
+            size = sizeof(cred);
+            break;
+        }
+        default:
+        {
+            ERAISE(-ENOPROTOOPT);
+        }
+    }
+
+copy:
+
+    if (*optlen < size)
+        size = *optlen;
+
+    memcpy(optval, data, size);
+    *optlen = (socklen_t)size;
+
+done:
+    return ret;
+}
+
+static int _get_name(
+    endpoint_t* ep,
+    bool peer,
+    struct sockaddr* addr,
+    socklen_t* addrlen)
+{
+    int ret = 0;
+    address_t a;
+    socklen_t n;
+
+    if (!addr || !addrlen)
+        ERAISE(-EFAULT);
+
+    /* unbound: just the family (unix) or the zero address (loopback) */
+    memset(&a, 0, sizeof(a));
+    a.sa.sa_family = ep->domain;
+    n = (ep->domain == AF_UNIX) ? sizeof(sa_family_t)
+                                : _address_size(ep->domain);
+
+    myst_mutex_lock(&ep->mutex);
+    {
+        endpoint_t* p = peer ? ep->peer : ep;
+
+        if (!p)
+            ret = -ENOTCONN;
+        else if (p->addrlen)
+        {
+            a = p->addr;
+            n = p->addrlen;
+        }
+    }
+    myst_mutex_unlock(&ep->mutex);
+
+    ECHECK(ret);
+
+    memcpy(addr, &a, (*addrlen < n) ? *addrlen : n);
+    *addrlen = n;
+
+done:
+    return ret;
+}
+
+static int _ud_getpeername(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    struct sockaddr* addr,
+    socklen_t* addrlen)
+{
+    if (!sd || !_valid_sock(sock))
+        return -EBADF;
+
+    return _get_name(sock->ep, true, addr, addrlen);
+}
+
+static int _ud_getsockname(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    struct sockaddr* addr,
+    socklen_t* addrlen)
+{
+    if (!sd || !_valid_sock(sock))
+        return -EBADF;
+
+    return _get_name(sock->ep, false, addr, addrlen);
+}
+
+static ssize_t _ud_read(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    void* buf,
+    size_t count)
+{
+    struct iovec iov = {buf, count};
+
+    if (!sd || !_valid_sock(sock))
+        return -EBADF;
+
+    return _recv(sock, &iov, 1, NULL, 0);
+}
+
+static ssize_t _ud_write(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    const void* buf,
+    size_t count)
+{
+    struct iovec iov = {(void*)buf, count};
+
+    if (!sd || !_valid_sock(sock))
+        return -EBADF;
+
+    return _send(sock, &iov, 1, NULL, 0, NULL, 0);
+}
+
+static ssize_t _ud_readv(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    if (!sd || !_valid_sock(sock))
+        return -EBADF;
+
+    return _recv(sock, iov, iovcnt, NULL, 0);
+}
+
+static ssize_t _ud_writev(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    if (!sd || !_valid_sock(sock))
+        return -EBADF;
+
+    return _send(sock, iov, iovcnt, NULL, 0, NULL, 0);
+}
+
+static int _ud_fstat(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    struct stat* statbuf)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    if (!statbuf)
+        ERAISE(-EFAULT);
+
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_mode = S_IFSOCK | sock->ep->mode;
+    statbuf->st_ino = (ino_t)sock->ep;
+    statbuf->st_nlink = 1;
+    statbuf->st_uid = MYST_DEFAULT_UID;
+    statbuf->st_gid = MYST_DEFAULT_GID;
+    statbuf->st_blksize = 4096;
+
+done:
+    return ret;
+}
+
+static int _ud_ioctl(
+    myst_sockdev_t* sd,
+    myst_sock_t* sock,
+    unsigned long request,
+    long arg)
+{
+    int ret = 0;
+    endpoint_t* ep;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    ep = sock->ep;
+
+    switch (request)
+    {
+        case FIONBIO:
+        {
+            if (!arg)
+                ERAISE(-EFAULT);
+
+            if (*(const int*)arg)
+                sock->flags |= O_NONBLOCK;
+            else
+                sock->flags &= ~O_NONBLOCK;
+
+            break;
+        }
+        case FIONREAD:
+        {
+            int n = 0;
+
+            if (!arg)
+                ERAISE(-EFAULT);
+
+            myst_mutex_lock(&ep->mutex);
+            {
+                if (ep->type == SOCK_STREAM)
+                    n = (int)ep->nbytes;
+                else if (ep->head)
+                    n = (int)ep->head->size;
+            }
+            myst_mutex_unlock(&ep->mutex);
+
+            *(int*)arg = n;
+            break;
+        }
+        case TIOCOUTQ:
+        {
+            if (!arg)
+                ERAISE(-EFAULT);
+
+            *(int*)arg = 0;
+            break;
+        }
+        default:
+        {
+            ERAISE(-ENOTTY);
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _ud_fcntl(myst_sockdev_t* sd, myst_sock_t* sock, int cmd, long arg)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    switch (cmd)
+    {
+        case F_GETFL:
+        {
+            ret = O_RDWR | sock->flags;
+            break;
+        }
+        case F_SETFL:
+        {
+            sock->flags = (int)(arg & O_NONBLOCK);
+            break;
+        }
+        case F_GETFD:
+        {
+            ret = sock->fdflags;
+            break;
+        }
+        case F_SETFD:
+        {
+            if (arg != FD_CLOEXEC && arg != 0)
+                ERAISE(-EINVAL);
+
+            sock->fdflags = (int)arg;
+            break;
+        }
+        default:
+        {
+            ERAISE(-ENOTSUP);
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _ud_dup(
+    myst_sockdev_t* sd,
+    const myst_sock_t* sock,
+    myst_sock_t** sock_out)
+{
+    int ret = 0;
+    myst_sock_t* new_sock;
+    endpoint_t* ep;
+
+    if (sock_out)
+        *sock_out = NULL;
+
+    if (!sd || !_valid_sock(sock) || !sock_out)
+        ERAISE(-EBADF);
+
+    ep = sock->ep;
+
+    if (!(new_sock = myst_slab_alloc(&_sock_cache)))
+        ERAISE(-ENOMEM);
+
+    /* the duplicate is not close-on-exec */
+    new_sock->magic = MAGIC;
+    new_sock->flags = sock->flags;
+    new_sock->ep = ep;
+
+    myst_mutex_lock(&ep->mutex);
+    ep->nhandles++;
+    myst_mutex_unlock(&ep->mutex);
+
+    *sock_out = new_sock;
+
+done:
+    return ret;
+}
+
+static int _ud_close(myst_sockdev_t* sd, myst_sock_t* sock)
+{
+    int ret = 0;
+    endpoint_t* ep;
+    bool last;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    ep = sock->ep;
+
+    myst_mutex_lock(&ep->mutex);
+    last = (--ep->nhandles == 0);
+    myst_mutex_unlock(&ep->mutex);
+
+    memset(sock, 0, sizeof(myst_sock_t));
+    myst_slab_free(sock);
+
+    if (last)
+    {
+        _disconnect(ep);
+        _unref(ep);
+    }
+
+done:
+    return ret;
+}
+
+static int _ud_target_fd(myst_sockdev_t* sd, myst_sock_t* sock)
+{
+    if (!sd || !_valid_sock(sock))
+        return -EBADF;
+
+    /* these sockets never leave the kernel */
+    return -ENOTSUP;
+}
+
+static myst_pollq_t* _ud_pollq(myst_sockdev_t* sd, myst_sock_t* sock)
+{
+    if (!sd || !_valid_sock(sock))
+        return NULL;
+
+    return &sock->ep->pollq;
+}
+
+static int _ud_get_events(myst_sockdev_t* sd, myst_sock_t* sock)
+{
+    int ret = 0;
+    int events = 0;
+    endpoint_t* ep;
+    endpoint_t* peer = NULL;
+    bool writable = false;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EBADF);
+
+    ep = sock->ep;
+
+    myst_mutex_lock(&ep->mutex);
+    {
+        if (ep->head || ep->pending_head || ep->rdshut)
+            events |= POLLIN | POLLRDNORM;
+
+        if (ep->rdshut)
+            events |= POLLRDHUP;
+
+        if (_connection_oriented(ep))
+        {
+            /* a connection is hung up by the peer or both shutdowns */
+            if ((ep->rdshut && ep->wrshut) || ep->peer_closed ||
+                ep->state == STATE_UNCONNECTED)
+            {
+                events |= POLLHUP;
+            }
+
+            if (ep->state == STATE_CONNECTED && !ep->wrshut &&
+                (peer = ep->peer))
+            {
+                _ref(peer);
+            }
+        }
+        else if (!ep->wrshut)
+        {
+            /* datagrams can always be sent unless the peer is full */
+            if ((peer = ep->peer))
+                _ref(peer);
+            else
+                writable = true;
+        }
+    }
+    myst_mutex_unlock(&ep->mutex);
+
+    if (peer)
+    {
+        myst_mutex_lock(&peer->mutex);
+        {
+            if (peer->state == STATE_CLOSED || peer->rdshut)
+                writable = _connection_oriented(ep) ? false : true;
+            else if (peer->nbytes < peer->rcvbuf)
+                writable = true;
+        }
+        myst_mutex_unlock(&peer->mutex);
+
+        _unref(peer);
+    }
+
+    if (writable)
+        events |= POLLOUT | POLLWRNORM;
+
+    ret = events;
+
+done:
+    return ret;
+}
+
+int myst_unixdev_bound_type(const struct sockaddr* addr, socklen_t addrlen)
+{
+    int ret = 0;
+    endpoint_t* ep;
+
+    if (!addr || addrlen < sizeof(sa_family_t))
+        ERAISE(-EINVAL);
+
+    ECHECK(_lookup(addr->sa_family, addr, addrlen, &ep));
+    ret = ep->type;
+    _unref(ep);
+
+done:
+    return ret;
+}
+
+int myst_unixdev_fchmod(myst_sockdev_t* sd, myst_sock_t* sock, mode_t mode)
+{
+    if (!sd || !_valid_sock(sock))
+        return -EBADF;
+
+    sock->ep->mode = mode & 07777;
+    return 0;
+}
+
+myst_sockdev_t* myst_unixdev_get(void)
+{
+    // clang-format off
+    static myst_sockdev_t _unixdev =
+    {
+        {
+            .fd_read = (void*)_ud_read,
+            .fd_write = (void*)_ud_write,
+            .fd_readv = (void*)_ud_readv,
+            .fd_writev = (void*)_ud_writev,
+            .fd_fstat = (void*)_ud_fstat,
+            .fd_fcntl = (void*)_ud_fcntl,
+            .fd_ioctl = (void*)_ud_ioctl,
+            .fd_dup = (void*)_ud_dup,
+            .fd_close = (void*)_ud_close,
+            .fd_target_fd = (void*)_ud_target_fd,
+            .fd_get_events = (void*)_ud_get_events,
+            .fd_pollq = (void*)_ud_pollq,
+        },
+        .sd_socket = _ud_socket,
+        .sd_socketpair = _ud_socketpair,
+        .sd_connect = _ud_connect,
+        .sd_accept4 = _ud_accept4,
+        .sd_bind = _ud_bind,
+        .sd_listen = _ud_listen,
+        .sd_sendto = _ud_sendto,
+        .sd_recvfrom = _ud_recvfrom,
+        .sd_sendmsg = _ud_sendmsg,
+        .sd_recvmsg = _ud_recvmsg,
+        .sd_sendmmsg = _ud_sendmmsg,
+        .sd_recvmmsg = _ud_recvmmsg,
+        .sd_shutdown = _ud_shutdown,
+        .sd_getsockopt = _ud_getsockopt,
+        .sd_setsockopt = _ud_setsockopt,
+        .sd_getpeername = _ud_getpeername,
+        .sd_getsockname = _ud_getsockname,
+        .sd_read = _ud_read,
+        .sd_write = _ud_write,
+        .sd_readv = _ud_readv,
+        .sd_writev = _ud_writev,
+        .sd_fstat = _ud_fstat,
+        .sd_ioctl = _ud_ioctl,
+        .sd_fcntl = _ud_fcntl,
+        .sd_dup = _ud_dup,
+        .sd_close = _ud_close,
+        .sd_target_fd = _ud_target_fd,
+        .sd_get_events = _ud_get_events,
+    };
+    // clang-format on
+
+    return &_unixdev;
+}
@@ -0,0 +1,205 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdint.h>
+
+#include <myst/cond.h>
+#include <myst/eraise.h>
+#include <myst/mutex.h>
+#include <myst/thread.h>
+#include <myst/time.h>
+#include <myst/workers.h>
+
+/*
+**==============================================================================
+**
+** Kernel worker threads (started by the --crypto-threads option).
+**
+**     Block devices that decrypt or verify what they read (see
+**     utils/luksblkdev.c and utils/verityblkdev.c) split large requests into
+**     works that these threads run in parallel, as does hostfs for large
+**     reads and writes (see hostfs/hostfs.c). A caller waiting for its
+**     group runs the group's works that no worker has taken yet, so the
+**     works always make progress, even with every worker busy.
+**
+**     The works form one FIFO queue guarded by a single mutex. Each work is
+**     many sectors long, so the queue is never hot.
+**
+**==============================================================================
+*/
+
+static myst_mutex_t _lock;
+static myst_cond_t _work_cond; /* signaled when a work is queued */
+static myst_cond_t _done_cond; /* broadcast when a group completes */
+static myst_work_t* _head;
+static myst_work_t* _tail;
+static size_t _num_workers;
+static _Atomic(size_t) _num_running;
+static bool _stopping;
+
+/* Remove the first queued work (of the given group unless it is null) */
+static myst_work_t* _pop(myst_workgroup_t* group)
+{
+    myst_work_t* prev = NULL;
+
+    for (myst_work_t* p = _head; p; prev = p, p = p->next)
+    {
+        if (!group || p->group == group)
+        {
+            if (prev)
+                prev->next = p->next;
+            else
+                _head = p->next;
+
+            if (_tail == p)
+                _tail = prev;
+
+            p->next = NULL;
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+/* Run the work without the lock (caution: the work may be released by its
+ * caller as soon as the group completes) */
+static void _run(myst_work_t* work)
+{
+    myst_workgroup_t* group = work->group;
+    int r;
+
+    myst_mutex_unlock(&_lock);
+    r = (*work->fn)(work);
+    myst_mutex_lock(&_lock);
+
+    if (r != 0 && group->ret == 0)
+        group->ret = r;
+
+    if (--group->pending == 0)
+        myst_cond_broadcast(&_done_cond, SIZE_MAX);
+}
+
+static int _worker(void* arg)
+{
+    (void)arg;
+
+    myst_mutex_lock(&_lock);
+
+    for (;;)
+    {
+        myst_work_t* work;
+
+        while (!_head && !_stopping)
+            myst_cond_wait(&_work_cond, &_lock);
+
+        /* the queue is drained before the workers stop */
+        if (!(work = _pop(NULL)))
+            break;
+
+        _run(work);
+    }
+
+    myst_mutex_unlock(&_lock);
+    _num_running--;
+
+    return 0;
+}
+
+int myst_start_workers(size_t count)
+{
+    int ret = 0;
+
+    if (count > MYST_MAX_WORKERS)
+        ERAISE(-EINVAL);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        _num_running++;
+
+        if (myst_create_kernel_thread(_worker, NULL, "kworker") != 0)
+        {
+            _num_running--;
+            ERAISE(-EAGAIN);
+        }
+
+        _num_workers++;
+    }
+
+done:
+    return ret;
+}
+
+void myst_stop_workers(void)
+{
+    myst_mutex_lock(&_lock);
+    _stopping = true;
+    _num_workers = 0;
+    myst_cond_broadcast(&_work_cond, SIZE_MAX);
+    myst_mutex_unlock(&_lock);
+
+    /* Wait ~1 second for the workers to exit */
+    for (size_t i = 0; i < 1000 && _num_running; i++)
+        myst_sleep_msec(1);
+}
+
+size_t myst_num_workers(void)
+{
+    return _num_workers;
+}
+
+void myst_submit_work(myst_workgroup_t* group, myst_work_t* work)
+{
+    work->group = group;
+    work->next = NULL;
+
+    /* without workers, run the work now */
+    if (_num_workers == 0)
+    {
+        int r = (*work->fn)(work);
+
+        if (r != 0 && group->ret == 0)
+            group->ret = r;
+
+        return;
+    }
+
+    myst_mutex_lock(&_lock);
+    {
+        group->pending++;
+
+        if (_tail)
+            _tail->next = work;
+        else
+            _head = work;
+
+        _tail = work;
+
+        myst_cond_signal(&_work_cond);
+    }
+    myst_mutex_unlock(&_lock);
+}
+
+int myst_wait_workgroup(myst_workgroup_t* group)
+{
+    int ret;
+
+    myst_mutex_lock(&_lock);
+
+    while (group->pending)
+    {
+        myst_work_t* work;
+
+        if ((work = _pop(group)))
+            _run(work);
+        else
+            myst_cond_wait(&_done_cond, &_lock);
+    }
+
+    ret = group->ret;
+    group->ret = 0;
+
+    myst_mutex_unlock(&_lock);
+
+    return ret;
+}
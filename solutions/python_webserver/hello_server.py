@@ -1,18 +1,30 @@
 from http.server import HTTPServer, BaseHTTPRequestHandler
+from socketserver import ThreadingMixIn
 
 class MyWebServer(BaseHTTPRequestHandler):
+    # keep connections open between requests (see tests/netbench)
+    protocol_version = "HTTP/1.1"
+    disable_nagle_algorithm = True
+
     def do_GET(self):
+        body = "".join([
+            "<html><head><title>Mystikos Python Web Server</title></head>",
+            "<p>Request: %s</p>" % self.path,
+            "<body>",
+            "<p>Hello world from Python Web Server.</p>",
+            "</body></html>",
+            "\n"])
+        data = bytes(body, "utf-8")
         self.send_response(200)
         self.send_header("Content-type", "text/html")
+        self.send_header("Content-Length", str(len(data)))
         self.end_headers()
-        self.wfile.write(bytes("<html><head><title>Mystikos Python Web Server</title></head>", "utf-8"))
-        self.wfile.write(bytes("<p>Request: %s</p>" % self.path, "utf-8"))
-        self.wfile.write(bytes("<body>", "utf-8"))
-        self.wfile.write(bytes("<p>Hello world from Python Web Server.</p>", "utf-8"))
-        self.wfile.write(bytes("</body></html>", "utf-8"))
-        self.wfile.write(bytes("\n", "utf-8"))
+        self.wfile.write(data)
+
+class ThreadingServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
 
-def run(server_class=HTTPServer, handler_class=MyWebServer):
+def run(server_class=ThreadingServer, handler_class=MyWebServer):
     server_address = ("0.0.0.0", 8000)
     httpd = server_class(server_address, handler_class)
     print("launching server...")
@@ -0,0 +1,35 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <myst/tcall.h>
+
+/* Return 1 if a debugger (any tracer) is attached to this process, else 0 */
+long myst_tcall_debugger_attached(void)
+{
+    char buf[4096];
+    const char tag[] = "\nTracerPid:";
+    ssize_t n;
+    const char* p;
+    int fd;
+
+    if ((fd = open("/proc/self/status", O_RDONLY)) < 0)
+        return 0;
+
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if (n <= 0)
+        return 0;
+
+    buf[n] = '\0';
+
+    if (!(p = strstr(buf, tag)))
+        return 0;
+
+    return strtol(p + sizeof(tag) - 1, NULL, 10) != 0;
+}
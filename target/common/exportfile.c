@@ -1,27 +1,27 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#include <fcntl.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <myst/cpio.h>
 #include <myst/eraise.h>
 #include <myst/file.h>
 #include <myst/strings.h>
 #include <myst/tcall.h>
 
-long myst_tcall_export_file(const char* path, const void* data, size_t size)
+/* Get the host path of an exported file and create its directory */
+static long _get_export_path(const char* path, char file[PATH_MAX])
 {
     long ret = 0;
     const char* env;
     char root[PATH_MAX];
-    char file[PATH_MAX];
     char dir[PATH_MAX];
     char* p;
 
-    if (!path || (!data && size))
-        ERAISE(-EINVAL);
-
     if ((env = getenv("MYST_EXPORT_RAMFS")))
     {
         struct stat buf;
@@ -38,7 +38,7 @@ long myst_tcall_export_file(const char* path, const void* data, size_t size)
             ERAISE(-errno);
     }
 
-    if (snprintf(file, sizeof(file), "%s/ramfs/%s", root, path) >= sizeof(file))
+    if (snprintf(file, PATH_MAX, "%s/ramfs/%s", root, path) >= PATH_MAX)
         ERAISE(-ENAMETOOLONG);
 
     if (myst_strlcpy(dir, file, sizeof(dir)) >= sizeof(dir))
@@ -51,8 +51,305 @@ long myst_tcall_export_file(const char* path, const void* data, size_t size)
         ERAISE(-EINVAL);
 
     ECHECK(myst_mkdirhier(dir, 0777));
+
+done:
+    return ret;
+}
+
+long myst_tcall_export_file(const char* path, const void* data, size_t size)
+{
+    long ret = 0;
+    char file[PATH_MAX];
+
+    if (!path || (!data && size))
+        ERAISE(-EINVAL);
+
+    ECHECK(_get_export_path(path, file));
     ECHECK(myst_write_file(file, data, size));
 
 done:
     return ret;
 }
+
+/*
+**==============================================================================
+**
+** The CPIO stream of myst_tcall_export_cpio().
+**
+**     The kernel sends the exported files as one newc archive in parts of
+**     any size, so a header, a name or the data of a file may span several
+**     calls. The state below says which of these the next byte belongs to.
+**     Only regular files are written; the stream ends with its trailer.
+**
+**==============================================================================
+*/
+
+#define HEADER_SIZE 110
+#define MODE_OFFSET 14
+#define FILESIZE_OFFSET 54
+#define NAMESIZE_OFFSET 94
+
+enum
+{
+    STAGE_HEADER,
+    STAGE_NAME,
+    STAGE_DATA,
+    STAGE_DONE,
+};
+
+static struct
+{
+    int stage;
+    uint8_t header[HEADER_SIZE];
+    char name[MYST_CPIO_PATH_MAX];
+    size_t len;       /* the bytes of the header or the name so far */
+    size_t namesize;  /* including the null terminator */
+    size_t filesize;
+    size_t remaining; /* the data bytes still to come */
+    size_t padding;   /* the zeros still to skip */
+    int fd;           /* the file being written (or -1) */
+    long error;       /* the first error (which ends the stream) */
+} _stream = {.fd = -1};
+
+static ssize_t _get_hex(const uint8_t* p)
+{
+    size_t x = 0;
+
+    for (size_t i = 0; i < 8; i++)
+    {
+        const uint8_t c = p[i];
+
+        if (c >= '0' && c <= '9')
+            x = (x << 4) | (size_t)(c - '0');
+        else if (c >= 'A' && c <= 'F')
+            x = (x << 4) | (size_t)(c - 'A' + 10);
+        else if (c >= 'a' && c <= 'f')
+            x = (x << 4) | (size_t)(c - 'a' + 10);
+        else
+            return -1;
+    }
+
+    return (ssize_t)x;
+}
+
+/* Refuse names that would leave the export directory */
+static bool _valid_name(const char* name)
+{
+    const char* p = name;
+
+    while (*p)
+    {
+        const char* end = strchr(p, '/');
+        const size_t n = end ? (size_t)(end - p) : strlen(p);
+
+        if (n == 2 && p[0] == '.' && p[1] == '.')
+            return false;
+
+        p += n;
+
+        if (*p == '/')
+            p++;
+    }
+
+    return true;
+}
+
+static long _parse_header(void)
+{
+    long ret = 0;
+    ssize_t filesize;
+    ssize_t namesize;
+
+    if (memcmp(_stream.header, "070701", 6) != 0)
+        ERAISE(-EINVAL);
+
+    if ((filesize = _get_hex(_stream.header + FILESIZE_OFFSET)) < 0 ||
+        (namesize = _get_hex(_stream.header + NAMESIZE_OFFSET)) < 0)
+    {
+        ERAISE(-EINVAL);
+    }
+
+    if (namesize == 0 || namesize > MYST_CPIO_PATH_MAX)
+        ERAISE(-ENAMETOOLONG);
+
+    _stream.namesize = (size_t)namesize;
+    _stream.filesize = (size_t)filesize;
+    _stream.remaining = (size_t)filesize;
+
+done:
+    return ret;
+}
+
+/* Open the file of the entry once its name has arrived */
+static long _start_file(void)
+{
+    long ret = 0;
+    char file[PATH_MAX];
+    ssize_t mode;
+
+    if (_stream.name[_stream.namesize - 1] != '\0')
+        ERAISE(-EINVAL);
+
+    if (strcmp(_stream.name, MYST_CPIO_TRAILER) == 0)
+    {
+        _stream.stage = STAGE_DONE;
+        goto done;
+    }
+
+    if ((mode = _get_hex(_stream.header + MODE_OFFSET)) < 0)
+        ERAISE(-EINVAL);
+
+    _stream.stage = STAGE_DATA;
+
+    if (((size_t)mode & MYST_CPIO_MODE_IFMT) != MYST_CPIO_MODE_IFREG)
+        goto done;
+
+    if (!_valid_name(_stream.name))
+        ERAISE(-EPERM);
+
+    ECHECK(_get_export_path(_stream.name, file));
+
+    if ((_stream.fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+        ERAISE(-errno);
+
+done:
+    return ret;
+}
+
+static long _write_data(const uint8_t* p, size_t n)
+{
+    long ret = 0;
+
+    while (n && _stream.fd >= 0)
+    {
+        ssize_t r = write(_stream.fd, p, n);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r <= 0)
+            ERAISE(-errno);
+
+        p += r;
+        n -= (size_t)r;
+    }
+
+done:
+    return ret;
+}
+
+static void _end_file(void)
+{
+    if (_stream.fd >= 0)
+    {
+        close(_stream.fd);
+        _stream.fd = -1;
+    }
+}
+
+static long _export_cpio(const uint8_t* p, size_t size)
+{
+    long ret = 0;
+
+    for (;;)
+    {
+        size_t n;
+
+        /* skip the zeros after the name or the data */
+        if (_stream.padding)
+        {
+            if (size == 0)
+                break;
+
+            n = size < _stream.padding ? size : _stream.padding;
+            _stream.padding -= n;
+            p += n;
+            size -= n;
+            continue;
+        }
+
+        /* the file ends with its data (which is padded too) */
+        if (_stream.stage == STAGE_DATA && _stream.remaining == 0)
+        {
+            _end_file();
+            _stream.padding = (4 - _stream.filesize % 4) % 4;
+            _stream.stage = STAGE_HEADER;
+            continue;
+        }
+
+        if (size == 0)
+            break;
+
+        switch (_stream.stage)
+        {
+            case STAGE_HEADER:
+            {
+                n = HEADER_SIZE - _stream.len;
+                n = size < n ? size : n;
+                memcpy(_stream.header + _stream.len, p, n);
+
+                if ((_stream.len += n) == HEADER_SIZE)
+                {
+                    ECHECK(_parse_header());
+                    _stream.len = 0;
+                    _stream.stage = STAGE_NAME;
+                }
+                break;
+            }
+            case STAGE_NAME:
+            {
+                n = _stream.namesize - _stream.len;
+                n = size < n ? size : n;
+                memcpy(_stream.name + _stream.len, p, n);
+
+                if ((_stream.len += n) == _stream.namesize)
+                {
+                    _stream.len = 0;
+                    _stream.padding =
+                        (4 - (HEADER_SIZE + _stream.namesize) % 4) % 4;
+                    ECHECK(_start_file());
+                }
+                break;
+            }
+            case STAGE_DATA:
+            {
+                n = size < _stream.remaining ? size : _stream.remaining;
+                ECHECK(_write_data(p, n));
+                _stream.remaining -= n;
+                break;
+            }
+            default:
+            {
+                /* nothing may follow the trailer */
+                ERAISE(-EINVAL);
+            }
+        }
+
+        p += n;
+        size -= n;
+    }
+
+done:
+    return ret;
+}
+
+long myst_tcall_export_cpio(const void* data, size_t size)
+{
+    long ret = 0;
+
+    if (!data && size)
+        ERAISE(-EINVAL);
+
+    if (_stream.error)
+        ERAISE(_stream.error);
+
+    if ((ret = _export_cpio(data, size)) != 0)
+    {
+        _end_file();
+        _stream.error = ret;
+        ERAISE(ret);
+    }
+
+done:
+    return ret;
+}
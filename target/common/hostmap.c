@@ -0,0 +1,36 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <myst/tcall.h>
+
+/* Map part of a host file read-only (for the public hostfs mounts) */
+long myst_tcall_map_host_file(
+    int fd,
+    off_t offset,
+    size_t length,
+    void** addr_out)
+{
+    void* addr;
+
+    if (fd < 0 || offset < 0 || !length || !addr_out)
+        return -EINVAL;
+
+    addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+
+    if (addr == MAP_FAILED)
+        return -errno;
+
+    *addr_out = addr;
+    return 0;
+}
+
+long myst_tcall_unmap_host_file(void* addr, size_t length)
+{
+    if (munmap(addr, length) != 0)
+        return -errno;
+
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,8 +14,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <myst/drbg.h>
 #include <myst/eraise.h>
 #include <myst/fssig.h>
+#include <myst/gcm.h>
 #include <myst/luks.h>
 #include <myst/sha256.h>
 #include <myst/syscall.h>
@@ -30,18 +33,12 @@ enum _oe_result
 
 myst_run_thread_t __myst_run_thread;
 
-static long _tcall_random(void* data, size_t size)
+/* Seed the thread's DRBG from the host kernel */
+static int _get_entropy(void* data, size_t size)
 {
-    long ret = 0;
     uint8_t* p = data;
     size_t r = size;
 
-    if (!data)
-        ERAISE(-EINVAL);
-
-    if (size == 0)
-        goto done;
-
     while (r)
     {
         long n = syscall(SYS_getrandom, p, r, 0);
@@ -50,10 +47,7 @@ static long _tcall_random(void* data, size_t size)
             continue;
 
         if (n < 0)
-        {
-            ret = r;
-            break;
-        }
+            return -1;
 
         assert(n <= r);
 
@@ -61,6 +55,19 @@ static long _tcall_random(void* data, size_t size)
         p += (size_t)n;
     }
 
+    return 0;
+}
+
+static long _tcall_random(void* data, size_t size)
+{
+    long ret = 0;
+
+    if (!data)
+        ERAISE(-EINVAL);
+
+    if (myst_drbg_generate(data, size, _get_entropy) != 0)
+        ERAISE(-EINVAL);
+
 done:
     return ret;
 }
@@ -155,6 +162,46 @@ long myst_tcall_export_file(const char* path, const void* data, size_t size)
     return -ENOTSUP;
 }
 
+MYST_WEAK
+long myst_tcall_export_cpio(const void* data, size_t size)
+{
+    (void)data;
+    (void)size;
+    assert("linux: unimplemented: implement in enclave" == NULL);
+    return -ENOTSUP;
+}
+
+MYST_WEAK
+long myst_tcall_debugger_attached(void)
+{
+    assert("linux: unimplemented: implement in enclave" == NULL);
+    return -ENOTSUP;
+}
+
+MYST_WEAK
+long myst_tcall_map_host_file(
+    int fd,
+    off_t offset,
+    size_t length,
+    void** addr_out)
+{
+    (void)fd;
+    (void)offset;
+    (void)length;
+    (void)addr_out;
+    assert("linux: unimplemented: implement in enclave" == NULL);
+    return -ENOTSUP;
+}
+
+MYST_WEAK
+long myst_tcall_unmap_host_file(void* addr, size_t length)
+{
+    (void)addr;
+    (void)length;
+    assert("linux: unimplemented: implement in enclave" == NULL);
+    return -ENOTSUP;
+}
+
 /* forward system call to Linux */
 static long
 _forward_syscall(long n, long x1, long x2, long x3, long x4, long x5, long x6)
@@ -162,6 +209,54 @@ _forward_syscall(long n, long x1, long x2, long x3, long x4, long x5, long x6)
     return myst_syscall6(n, x1, x2, x3, x4, x5, x6);
 }
 
+/* See myst_tcall_accept_batch() (the SGX host does the same) */
+static long _tcall_accept_batch(
+    int sockfd,
+    myst_tcall_accepted_t* conns,
+    size_t count,
+    int flags)
+{
+    size_t n = 0;
+
+    while (n < count)
+    {
+        myst_tcall_accepted_t* c = &conns[n];
+        socklen_t addrlen = sizeof(c->addr);
+        long fd;
+
+        /* only the first accept may block */
+        if (n > 0)
+        {
+            struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+
+            if (_forward_syscall(SYS_poll, (long)&pfd, 1, 0, 0, 0, 0) != 1)
+                break;
+        }
+
+        if ((fd = _forward_syscall(
+                 SYS_accept4,
+                 sockfd,
+                 (long)c->addr,
+                 (long)&addrlen,
+                 flags,
+                 0,
+                 0)) < 0)
+        {
+            /* report the connections accepted so far rather than the error */
+            if (n == 0)
+                return fd;
+
+            break;
+        }
+
+        c->fd = (int)fd;
+        c->addrlen = addrlen;
+        n++;
+    }
+
+    return (long)n;
+}
+
 static long _tcall_target_stat(myst_target_stat_t* buf)
 {
     long ret = 0;
@@ -316,6 +411,12 @@ long myst_tcall(long n, long params[6])
             uint64_t event = (uint64_t)x1;
             return myst_tcall_wake(event);
         }
+        case MYST_TCALL_WAKE_MANY:
+        {
+            const uint64_t* events = (const uint64_t*)x1;
+            size_t count = (size_t)x2;
+            return myst_tcall_wake_many(events, count);
+        }
         case MYST_TCALL_WAKE_WAIT:
         {
             uint64_t waiter_event = (uint64_t)x1;
@@ -330,6 +431,25 @@ long myst_tcall(long n, long params[6])
             size_t size = (size_t)x3;
             return myst_tcall_export_file(path, data, size);
         }
+        case MYST_TCALL_EXPORT_CPIO:
+        {
+            const void* data = (const void*)x1;
+            size_t size = (size_t)x2;
+            return myst_tcall_export_cpio(data, size);
+        }
+        case MYST_TCALL_DEBUGGER_ATTACHED:
+        {
+            return myst_tcall_debugger_attached();
+        }
+        case MYST_TCALL_MAP_HOST_FILE:
+        {
+            return myst_tcall_map_host_file(
+                (int)x1, (off_t)x2, (size_t)x3, (void**)x4);
+        }
+        case MYST_TCALL_UNMAP_HOST_FILE:
+        {
+            return myst_tcall_unmap_host_file((void*)x1, (size_t)x2);
+        }
         case MYST_TCALL_SET_RUN_THREAD_FUNCTION:
         {
             myst_run_thread_t function = (myst_run_thread_t)x1;
@@ -340,6 +460,11 @@ long myst_tcall(long n, long params[6])
             __myst_run_thread = function;
             return 0;
         }
+        case MYST_TCALL_SET_SYSCALL_TRAMPOLINE:
+        {
+            /* syscall instructions work here (have_syscall_instruction) */
+            return -ENOTSUP;
+        }
         case MYST_TCALL_TARGET_STAT:
         {
             myst_target_stat_t* buf = (myst_target_stat_t*)x1;
@@ -425,6 +550,43 @@ long myst_tcall(long n, long params[6])
             return myst_sha256_finish(
                 (myst_sha256_ctx_t*)x1, (myst_sha256_t*)x2);
         }
+        case MYST_TCALL_GCM_NEW:
+        {
+            return myst_gcm_new(
+                (const void*)x1, (size_t)x2, (myst_gcm_t**)x3);
+        }
+        case MYST_TCALL_GCM_FREE:
+        {
+            return myst_gcm_free((myst_gcm_t*)x1);
+        }
+        case MYST_TCALL_GCM_SEAL:
+        {
+            return myst_gcm_seal(
+                (myst_gcm_t*)x1,
+                (const myst_gcm_auth_t*)x2,
+                (const struct iovec*)x3,
+                (int)x4,
+                (void*)x5);
+        }
+        case MYST_TCALL_GCM_OPEN:
+        {
+            return myst_gcm_open(
+                (myst_gcm_t*)x1,
+                (const myst_gcm_auth_t*)x2,
+                (const void*)x3,
+                (void*)x4,
+                (size_t)x5);
+        }
+        case MYST_TCALL_SHA256_N:
+        {
+            return myst_sha256_n(
+                (myst_sha256_t*)x1,
+                (const void*)x2,
+                (size_t)x3,
+                (const void*)x4,
+                (size_t)x5,
+                (size_t)x6);
+        }
         case MYST_TCALL_VERIFY_SIGNATURE:
         {
             long* args = (long*)x1;
@@ -441,6 +603,32 @@ long myst_tcall(long n, long params[6])
         {
             return myst_load_fssig((const char*)x1, (myst_fssig_t*)x2);
         }
+        case MYST_TCALL_HOSTBUF_ALLOC:
+        {
+            void** ptr_out = (void**)x2;
+
+            if (!ptr_out)
+                return -EINVAL;
+
+            /* all memory is host memory on this target */
+            if (!(*ptr_out = malloc((size_t)x1)))
+                return -ENOMEM;
+
+            return 0;
+        }
+        case MYST_TCALL_HOSTBUF_SEND:
+        {
+            return _forward_syscall(SYS_sendto, x1, x2, x3, x4, 0, 0);
+        }
+        case MYST_TCALL_HOSTBUF_RECV:
+        {
+            return _forward_syscall(SYS_recvfrom, x1, x2, x3, x4, 0, 0);
+        }
+        case MYST_TCALL_ACCEPT_BATCH:
+        {
+            return _tcall_accept_batch(
+                (int)x1, (myst_tcall_accepted_t*)x2, (size_t)x3, (int)x4);
+        }
         case SYS_ioctl:
         {
             int fd = (int)x1;
@@ -476,7 +664,22 @@ long myst_tcall(long n, long params[6])
             int timeout = (int)x3;
             return myst_tcall_poll(fds, nfds, timeout);
         }
+        case SYS_epoll_create1:
+        {
+            return myst_tcall_epoll_create1((int)x1);
+        }
+        case SYS_epoll_ctl:
+        {
+            return _forward_syscall(n, x1, x2, x3, x4, 0, 0);
+        }
+        case SYS_epoll_wait:
+        {
+            struct epoll_event* events = (struct epoll_event*)x2;
+            return myst_tcall_epoll_wait((int)x1, events, (int)x3, (int)x4);
+        }
         case SYS_sched_yield:
+        case SYS_sched_getaffinity:
+        case SYS_sched_setaffinity:
         case SYS_fstat:
         case SYS_read:
         case SYS_write:
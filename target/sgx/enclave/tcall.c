@@ -14,8 +14,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <myst/drbg.h>
 #include <myst/eraise.h>
 #include <myst/fssig.h>
+#include <myst/gcm.h>
 #include <myst/luks.h>
 #include <myst/regions.h>
 #include <myst/sha256.h>
@@ -34,6 +36,15 @@ long oe_syscall(long n, long x1, long x2, long x3, long x4, long x5, long x6);
 
 myst_run_thread_t __myst_run_thread;
 
+/* the kernel entry for trapped syscall instructions (see enc.c) */
+void (*__myst_syscall_trampoline)(void);
+
+/* Seed the thread's DRBG from RDRAND (without leaving the enclave) */
+static int _get_entropy(void* data, size_t size)
+{
+    return oe_random(data, size) == OE_OK ? 0 : -1;
+}
+
 static long _tcall_random(void* data, size_t size)
 {
     long ret = 0;
@@ -41,7 +52,7 @@ static long _tcall_random(void* data, size_t size)
     if (!data)
         ERAISE(-EINVAL);
 
-    if (oe_random(data, size) != OE_OK)
+    if (myst_drbg_generate(data, size, _get_entropy) != 0)
         ERAISE(-EINVAL);
 
 done:
@@ -185,6 +196,16 @@ long myst_tcall_wake(uint64_t event)
     return -ENOTSUP;
 }
 
+/* Must be overriden by enclave application */
+MYST_WEAK
+long myst_tcall_wake_many(const uint64_t* events, size_t count)
+{
+    (void)events;
+    (void)count;
+    assert("sgx: unimplemented: implement in enclave" == NULL);
+    return -ENOTSUP;
+}
+
 /* Must be overriden by enclave application */
 MYST_WEAK
 long myst_tcall_wake_wait(
@@ -209,6 +230,46 @@ long myst_tcall_export_file(const char* path, const void* data, size_t size)
     return -ENOTSUP;
 }
 
+MYST_WEAK
+long myst_tcall_export_cpio(const void* data, size_t size)
+{
+    (void)data;
+    (void)size;
+    assert("sgx: unimplemented: implement in enclave" == NULL);
+    return -ENOTSUP;
+}
+
+MYST_WEAK
+long myst_tcall_debugger_attached(void)
+{
+    assert("sgx: unimplemented: implement in enclave" == NULL);
+    return -ENOTSUP;
+}
+
+MYST_WEAK
+long myst_tcall_map_host_file(
+    int fd,
+    off_t offset,
+    size_t length,
+    void** addr_out)
+{
+    (void)fd;
+    (void)offset;
+    (void)length;
+    (void)addr_out;
+    assert("sgx: unimplemented: implement in enclave" == NULL);
+    return -ENOTSUP;
+}
+
+MYST_WEAK
+long myst_tcall_unmap_host_file(void* addr, size_t length)
+{
+    (void)addr;
+    (void)length;
+    assert("sgx: unimplemented: implement in enclave" == NULL);
+    return -ENOTSUP;
+}
+
 MYST_STATIC_ASSERT((sizeof(struct stat) % 8) == 0);
 MYST_STATIC_ASSERT(sizeof(struct stat) >= 120);
 MYST_STATIC_ASSERT(OE_OFFSETOF(struct stat, st_dev) == 0);
@@ -432,6 +493,12 @@ long myst_tcall(long n, long params[6])
             uint64_t event = (uint64_t)x1;
             return myst_tcall_wake(event);
         }
+        case MYST_TCALL_WAKE_MANY:
+        {
+            const uint64_t* events = (const uint64_t*)x1;
+            size_t count = (size_t)x2;
+            return myst_tcall_wake_many(events, count);
+        }
         case MYST_TCALL_WAKE_WAIT:
         {
             uint64_t waiter_event = (uint64_t)x1;
@@ -446,6 +513,25 @@ long myst_tcall(long n, long params[6])
             size_t size = (size_t)x3;
             return myst_tcall_export_file(path, data, size);
         }
+        case MYST_TCALL_EXPORT_CPIO:
+        {
+            const void* data = (const void*)x1;
+            size_t size = (size_t)x2;
+            return myst_tcall_export_cpio(data, size);
+        }
+        case MYST_TCALL_DEBUGGER_ATTACHED:
+        {
+            return myst_tcall_debugger_attached();
+        }
+        case MYST_TCALL_MAP_HOST_FILE:
+        {
+            return myst_tcall_map_host_file(
+                (int)x1, (off_t)x2, (size_t)x3, (void**)x4);
+        }
+        case MYST_TCALL_UNMAP_HOST_FILE:
+        {
+            return myst_tcall_unmap_host_file((void*)x1, (size_t)x2);
+        }
         case MYST_TCALL_SET_RUN_THREAD_FUNCTION:
         {
             myst_run_thread_t function = (myst_run_thread_t)x1;
@@ -456,6 +542,17 @@ long myst_tcall(long n, long params[6])
             __myst_run_thread = function;
             return 0;
         }
+        case MYST_TCALL_SET_SYSCALL_TRAMPOLINE:
+        {
+            void (*trampoline)(void) = (void (*)(void))x1;
+
+            if (!trampoline)
+                return -EINVAL;
+
+            __atomic_store_n(
+                &__myst_syscall_trampoline, trampoline, __ATOMIC_RELEASE);
+            return 0;
+        }
         case MYST_TCALL_TARGET_STAT:
         {
             myst_target_stat_t* buf = (myst_target_stat_t*)x1;
@@ -544,6 +641,43 @@ long myst_tcall(long n, long params[6])
             return myst_sha256_finish(
                 (myst_sha256_ctx_t*)x1, (myst_sha256_t*)x2);
         }
+        case MYST_TCALL_GCM_NEW:
+        {
+            return myst_gcm_new(
+                (const void*)x1, (size_t)x2, (myst_gcm_t**)x3);
+        }
+        case MYST_TCALL_GCM_FREE:
+        {
+            return myst_gcm_free((myst_gcm_t*)x1);
+        }
+        case MYST_TCALL_GCM_SEAL:
+        {
+            return myst_gcm_seal(
+                (myst_gcm_t*)x1,
+                (const myst_gcm_auth_t*)x2,
+                (const struct iovec*)x3,
+                (int)x4,
+                (void*)x5);
+        }
+        case MYST_TCALL_GCM_OPEN:
+        {
+            return myst_gcm_open(
+                (myst_gcm_t*)x1,
+                (const myst_gcm_auth_t*)x2,
+                (const void*)x3,
+                (void*)x4,
+                (size_t)x5);
+        }
+        case MYST_TCALL_SHA256_N:
+        {
+            return myst_sha256_n(
+                (myst_sha256_t*)x1,
+                (const void*)x2,
+                (size_t)x3,
+                (const void*)x4,
+                (size_t)x5,
+                (size_t)x6);
+        }
         case MYST_TCALL_VERIFY_SIGNATURE:
         {
             long* args = (long*)x1;
@@ -560,6 +694,25 @@ long myst_tcall(long n, long params[6])
         {
             return myst_load_fssig((const char*)x1, (myst_fssig_t*)x2);
         }
+        case MYST_TCALL_HOSTBUF_ALLOC:
+        {
+            return myst_tcall_hostbuf_alloc((size_t)x1, (void**)x2);
+        }
+        case MYST_TCALL_HOSTBUF_SEND:
+        {
+            return myst_tcall_hostbuf_send(
+                (int)x1, (const void*)x2, (size_t)x3, (int)x4);
+        }
+        case MYST_TCALL_HOSTBUF_RECV:
+        {
+            return myst_tcall_hostbuf_recv(
+                (int)x1, (void*)x2, (size_t)x3, (int)x4);
+        }
+        case MYST_TCALL_ACCEPT_BATCH:
+        {
+            return myst_tcall_accept_batch(
+                (int)x1, (myst_tcall_accepted_t*)x2, (size_t)x3, (int)x4);
+        }
         case SYS_read:
         case SYS_write:
         case SYS_close:
@@ -584,14 +737,20 @@ long myst_tcall(long n, long params[6])
         case SYS_ioctl:
         case SYS_fstat:
         case SYS_sched_yield:
+        case SYS_sched_getaffinity:
+        case SYS_sched_setaffinity:
         case SYS_fchmod:
         case SYS_poll:
+        case SYS_epoll_create1:
+        case SYS_epoll_ctl:
+        case SYS_epoll_wait:
         case SYS_open:
         case SYS_stat:
         case SYS_access:
         case SYS_dup:
         case SYS_pread64:
         case SYS_pwrite64:
+        case SYS_sendfile:
         case SYS_link:
         case SYS_unlink:
         case SYS_mkdir:
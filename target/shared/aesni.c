@@ -0,0 +1,968 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <string.h>
+
+#include <myst/aesni.h>
+
+/*
+**==============================================================================
+**
+** AES with the AES-NI instructions (and with VAES on AVX-512 registers):
+**
+**     The AES instructions take several cycles but can start every cycle, so
+**     the modes that allow it (ECB, CBC decryption and XTS) keep eight blocks
+**     in flight (and with VAES, four registers of four blocks each). This
+**     code uses inline assembly rather than the intrinsics headers, which the
+**     enclave build (-nostdinc) does not have.
+**
+**==============================================================================
+*/
+
+/* Number of blocks kept in flight by the AES-NI code */
+#define LANES 8
+
+/* Number of blocks in flight with VAES (four 512-bit registers) */
+#define VAES_LANES 16
+
+#define BLOCK_SIZE MYST_AESNI_BLOCK_SIZE
+
+#define VAES_TARGET __attribute__((target("avx512f")))
+
+typedef long long block_t __attribute__((vector_size(16)));
+typedef long long zblock_t __attribute__((vector_size(64)));
+
+/*
+**==============================================================================
+**
+** CPU features
+**
+**==============================================================================
+*/
+
+#define CPUID_1_ECX_PCLMULQDQ (1U << 1)
+#define CPUID_1_ECX_SSSE3 (1U << 9)
+#define CPUID_1_ECX_AES (1U << 25)
+#define CPUID_1_ECX_OSXSAVE (1U << 27)
+#define CPUID_7_EBX_AVX512F (1U << 16)
+#define CPUID_7_ECX_VAES (1U << 9)
+
+/* SSE, AVX, opmask and both halves of the upper ZMM state */
+#define XCR0_AVX512 0xe6
+
+static void _cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+    __asm__ volatile("cpuid"
+                     : "=a"(regs[0]),
+                       "=b"(regs[1]),
+                       "=c"(regs[2]),
+                       "=d"(regs[3])
+                     : "a"(leaf), "c"(subleaf));
+}
+
+static uint64_t _xgetbv(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+enum
+{
+    FEATURE_AES = 1,
+    FEATURE_VAES = 2,
+    FEATURE_CLMUL = 4, /* PCLMULQDQ and PSHUFB (for GCM) */
+};
+
+/* Detected once (racing threads detect the same features) */
+static int _features = -1;
+
+static int _get_features(void)
+{
+    if (_features == -1)
+    {
+        uint32_t regs[4];
+        int features = 0;
+
+        _cpuid(0, 0, regs);
+        const uint32_t max_leaf = regs[0];
+
+        _cpuid(1, 0, regs);
+
+        if ((regs[2] & CPUID_1_ECX_AES))
+            features |= FEATURE_AES;
+
+        if ((features & FEATURE_AES) && (regs[2] & CPUID_1_ECX_PCLMULQDQ) &&
+            (regs[2] & CPUID_1_ECX_SSSE3))
+        {
+            features |= FEATURE_CLMUL;
+        }
+
+        /* VAES needs the OS (or enclave) to keep the AVX-512 state */
+        if ((features & FEATURE_AES) && max_leaf >= 7 &&
+            (regs[2] & CPUID_1_ECX_OSXSAVE) &&
+            (_xgetbv() & XCR0_AVX512) == XCR0_AVX512)
+        {
+            _cpuid(7, 0, regs);
+
+            if ((regs[1] & CPUID_7_EBX_AVX512F) && (regs[2] & CPUID_7_ECX_VAES))
+                features |= FEATURE_VAES;
+        }
+
+        _features = features;
+    }
+
+    return _features;
+}
+
+bool myst_aesni_supported(void)
+{
+    return (_get_features() & FEATURE_AES) != 0;
+}
+
+bool myst_aesni_vaes_supported(void)
+{
+    return (_get_features() & FEATURE_VAES) != 0;
+}
+
+bool myst_aesni_gcm_supported(void)
+{
+    return (_get_features() & FEATURE_CLMUL) != 0;
+}
+
+/*
+**==============================================================================
+**
+** Blocks of 128 bits
+**
+**==============================================================================
+*/
+
+static inline block_t _load(const void* p)
+{
+    block_t b;
+    memcpy(&b, p, sizeof(b));
+    return b;
+}
+
+static inline void _store(void* p, block_t b)
+{
+    memcpy(p, &b, sizeof(b));
+}
+
+#define AES_OP(OP, B, K) __asm__(OP " %1, %0" : "+x"(B) : "x"(K))
+
+static inline void _encrypt_n(const myst_aesni_key_t* key, block_t* b, size_t n)
+{
+    block_t k = _load(key->enc[0]);
+
+    for (size_t j = 0; j < n; j++)
+        b[j] ^= k;
+
+    for (uint32_t r = 1; r < key->rounds; r++)
+    {
+        k = _load(key->enc[r]);
+
+        for (size_t j = 0; j < n; j++)
+            AES_OP("aesenc", b[j], k);
+    }
+
+    k = _load(key->enc[key->rounds]);
+
+    for (size_t j = 0; j < n; j++)
+        AES_OP("aesenclast", b[j], k);
+}
+
+static inline void _decrypt_n(const myst_aesni_key_t* key, block_t* b, size_t n)
+{
+    block_t k = _load(key->dec[0]);
+
+    for (size_t j = 0; j < n; j++)
+        b[j] ^= k;
+
+    for (uint32_t r = 1; r < key->rounds; r++)
+    {
+        k = _load(key->dec[r]);
+
+        for (size_t j = 0; j < n; j++)
+            AES_OP("aesdec", b[j], k);
+    }
+
+    k = _load(key->dec[key->rounds]);
+
+    for (size_t j = 0; j < n; j++)
+        AES_OP("aesdeclast", b[j], k);
+}
+
+/*
+**==============================================================================
+**
+** Key expansion (as in Intel's AES-NI white paper)
+**
+**==============================================================================
+*/
+
+#define KEYGEN(OUT, IN, RCON) \
+    __asm__("aeskeygenassist %2, %1, %0" : "=x"(OUT) : "x"(IN), "i"(RCON))
+
+#define SHUFFLE(OUT, IN, IMM) \
+    __asm__("pshufd %2, %1, %0" : "=x"(OUT) : "x"(IN), "i"(IMM))
+
+/* XOR each word of x with all the words below it */
+static inline block_t _xor_prefix(block_t x)
+{
+    block_t t = x;
+
+    for (int i = 0; i < 3; i++)
+    {
+        __asm__("pslldq $4, %0" : "+x"(t));
+        x ^= t;
+    }
+
+    return x;
+}
+
+#define EXPAND_128(RK, I, RCON)                 \
+    do                                          \
+    {                                           \
+        block_t gen;                            \
+        KEYGEN(gen, RK[(I)-1], RCON);           \
+        SHUFFLE(gen, gen, 0xff);                \
+        RK[I] = _xor_prefix(RK[(I)-1]) ^ gen;   \
+    } while (0)
+
+/* Even round keys of AES-256 (words from the previous even one) */
+#define EXPAND_256_EVEN(RK, I, RCON)            \
+    do                                          \
+    {                                           \
+        block_t gen;                            \
+        KEYGEN(gen, RK[(I)-1], RCON);           \
+        SHUFFLE(gen, gen, 0xff);                \
+        RK[I] = _xor_prefix(RK[(I)-2]) ^ gen;   \
+    } while (0)
+
+/* Odd round keys of AES-256 (SubWord without rotation or rcon) */
+#define EXPAND_256_ODD(RK, I)                   \
+    do                                          \
+    {                                           \
+        block_t gen;                            \
+        KEYGEN(gen, RK[(I)-1], 0);              \
+        SHUFFLE(gen, gen, 0xaa);                \
+        RK[I] = _xor_prefix(RK[(I)-2]) ^ gen;   \
+    } while (0)
+
+int myst_aesni_setkey(myst_aesni_key_t* key, const void* data, size_t size)
+{
+    block_t rk[15];
+    uint32_t rounds;
+
+    if (!key || !data || !myst_aesni_supported())
+        return -1;
+
+    if (size == 16)
+    {
+        rounds = 10;
+        rk[0] = _load(data);
+        EXPAND_128(rk, 1, 0x01);
+        EXPAND_128(rk, 2, 0x02);
+        EXPAND_128(rk, 3, 0x04);
+        EXPAND_128(rk, 4, 0x08);
+        EXPAND_128(rk, 5, 0x10);
+        EXPAND_128(rk, 6, 0x20);
+        EXPAND_128(rk, 7, 0x40);
+        EXPAND_128(rk, 8, 0x80);
+        EXPAND_128(rk, 9, 0x1b);
+        EXPAND_128(rk, 10, 0x36);
+    }
+    else if (size == 32)
+    {
+        rounds = 14;
+        rk[0] = _load(data);
+        rk[1] = _load((const uint8_t*)data + BLOCK_SIZE);
+        EXPAND_256_EVEN(rk, 2, 0x01);
+        EXPAND_256_ODD(rk, 3);
+        EXPAND_256_EVEN(rk, 4, 0x02);
+        EXPAND_256_ODD(rk, 5);
+        EXPAND_256_EVEN(rk, 6, 0x04);
+        EXPAND_256_ODD(rk, 7);
+        EXPAND_256_EVEN(rk, 8, 0x08);
+        EXPAND_256_ODD(rk, 9);
+        EXPAND_256_EVEN(rk, 10, 0x10);
+        EXPAND_256_ODD(rk, 11);
+        EXPAND_256_EVEN(rk, 12, 0x20);
+        EXPAND_256_ODD(rk, 13);
+        EXPAND_256_EVEN(rk, 14, 0x40);
+    }
+    else
+    {
+        return -1;
+    }
+
+    key->rounds = rounds;
+
+    for (uint32_t r = 0; r <= rounds; r++)
+    {
+        _store(key->enc[r], rk[r]);
+
+        /* the decryption keys (of the equivalent inverse cipher) */
+        if (r == 0 || r == rounds)
+        {
+            _store(key->dec[r], rk[rounds - r]);
+        }
+        else
+        {
+            block_t k;
+            __asm__("aesimc %1, %0" : "=x"(k) : "x"(rk[rounds - r]));
+            _store(key->dec[r], k);
+        }
+    }
+
+    memset(rk, 0, sizeof(rk));
+    return 0;
+}
+
+/*
+**==============================================================================
+**
+** Blocks of 512 bits (VAES)
+**
+**==============================================================================
+*/
+
+#define ZAES_OP(OP, B, K) __asm__(OP " %1, %0, %0" : "+v"(B) : "v"(K))
+
+static inline VAES_TARGET zblock_t _zload(const void* p)
+{
+    zblock_t z;
+    memcpy(&z, p, sizeof(z));
+    return z;
+}
+
+static inline VAES_TARGET void _zstore(void* p, zblock_t z)
+{
+    memcpy(p, &z, sizeof(z));
+}
+
+/* Copy each round key into all four lanes */
+static inline VAES_TARGET void _zkeys(
+    const uint8_t keys[15][BLOCK_SIZE],
+    uint32_t rounds,
+    zblock_t zk[15])
+{
+    for (uint32_t r = 0; r <= rounds; r++)
+    {
+        __asm__("vbroadcasti32x4 %1, %0"
+                : "=v"(zk[r])
+                : "m"(*(const uint8_t(*)[BLOCK_SIZE])keys[r]));
+    }
+}
+
+/* Encrypt or decrypt four registers (sixteen blocks) */
+static inline VAES_TARGET void _zcrypt(
+    const zblock_t zk[15],
+    uint32_t rounds,
+    bool encrypt,
+    zblock_t z[4])
+{
+    for (size_t j = 0; j < 4; j++)
+        z[j] ^= zk[0];
+
+    for (uint32_t r = 1; r < rounds; r++)
+    {
+        if (encrypt)
+        {
+            for (size_t j = 0; j < 4; j++)
+                ZAES_OP("vaesenc", z[j], zk[r]);
+        }
+        else
+        {
+            for (size_t j = 0; j < 4; j++)
+                ZAES_OP("vaesdec", z[j], zk[r]);
+        }
+    }
+
+    if (encrypt)
+    {
+        for (size_t j = 0; j < 4; j++)
+            ZAES_OP("vaesenclast", z[j], zk[rounds]);
+    }
+    else
+    {
+        for (size_t j = 0; j < 4; j++)
+            ZAES_OP("vaesdeclast", z[j], zk[rounds]);
+    }
+}
+
+/* ECB over the whole runs of VAES_LANES blocks (returns blocks done) */
+static VAES_TARGET size_t _ecb_vaes(
+    const myst_aesni_key_t* key,
+    bool encrypt,
+    const uint8_t* in,
+    uint8_t* out,
+    size_t nblocks)
+{
+    zblock_t zk[15];
+    size_t i;
+
+    _zkeys(encrypt ? key->enc : key->dec, key->rounds, zk);
+
+    for (i = 0; i + VAES_LANES <= nblocks; i += VAES_LANES)
+    {
+        zblock_t z[4];
+
+        for (size_t j = 0; j < 4; j++)
+            z[j] = _zload(in + (i + 4 * j) * BLOCK_SIZE);
+
+        _zcrypt(zk, key->rounds, encrypt, z);
+
+        for (size_t j = 0; j < 4; j++)
+            _zstore(out + (i + 4 * j) * BLOCK_SIZE, z[j]);
+    }
+
+    return i;
+}
+
+/* CBC decryption over whole runs of VAES_LANES blocks (updating prev) */
+static VAES_TARGET size_t _cbc_decrypt_vaes(
+    const myst_aesni_key_t* key,
+    uint8_t prev[BLOCK_SIZE],
+    const uint8_t* in,
+    uint8_t* out,
+    size_t nblocks)
+{
+    zblock_t zk[15];
+    size_t i;
+
+    _zkeys(key->dec, key->rounds, zk);
+
+    for (i = 0; i + VAES_LANES <= nblocks; i += VAES_LANES)
+    {
+        /* the ciphertext blocks each output block is XORed with */
+        uint8_t chain[VAES_LANES * BLOCK_SIZE];
+        zblock_t z[4];
+
+        memcpy(chain, prev, BLOCK_SIZE);
+        memcpy(
+            chain + BLOCK_SIZE,
+            in + i * BLOCK_SIZE,
+            (VAES_LANES - 1) * BLOCK_SIZE);
+        memcpy(prev, in + (i + VAES_LANES - 1) * BLOCK_SIZE, BLOCK_SIZE);
+
+        for (size_t j = 0; j < 4; j++)
+            z[j] = _zload(in + (i + 4 * j) * BLOCK_SIZE);
+
+        _zcrypt(zk, key->rounds, false, z);
+
+        for (size_t j = 0; j < 4; j++)
+        {
+            z[j] ^= _zload(chain + 4 * j * BLOCK_SIZE);
+            _zstore(out + (i + 4 * j) * BLOCK_SIZE, z[j]);
+        }
+    }
+
+    return i;
+}
+
+/*
+**==============================================================================
+**
+** Modes
+**
+**==============================================================================
+*/
+
+void myst_aesni_ecb(
+    const myst_aesni_key_t* key,
+    bool encrypt,
+    const void* in_,
+    void* out_,
+    size_t nblocks)
+{
+    const uint8_t* in = in_;
+    uint8_t* out = out_;
+    size_t i = 0;
+
+    if (myst_aesni_vaes_supported())
+        i = _ecb_vaes(key, encrypt, in, out, nblocks);
+
+    for (; i < nblocks; i += LANES)
+    {
+        const size_t n = (nblocks - i < LANES) ? nblocks - i : LANES;
+        block_t b[LANES];
+
+        for (size_t j = 0; j < n; j++)
+            b[j] = _load(in + (i + j) * BLOCK_SIZE);
+
+        if (encrypt)
+            _encrypt_n(key, b, n);
+        else
+            _decrypt_n(key, b, n);
+
+        for (size_t j = 0; j < n; j++)
+            _store(out + (i + j) * BLOCK_SIZE, b[j]);
+    }
+}
+
+void myst_aesni_cbc(
+    const myst_aesni_key_t* key,
+    bool encrypt,
+    const uint8_t iv[BLOCK_SIZE],
+    const void* in_,
+    void* out_,
+    size_t nblocks)
+{
+    const uint8_t* in = in_;
+    uint8_t* out = out_;
+    uint8_t prev[BLOCK_SIZE];
+    size_t i = 0;
+
+    memcpy(prev, iv, BLOCK_SIZE);
+
+    /* each encryption needs the one before (so one block at a time) */
+    if (encrypt)
+    {
+        block_t b = _load(prev);
+
+        for (; i < nblocks; i++)
+        {
+            b ^= _load(in + i * BLOCK_SIZE);
+            _encrypt_n(key, &b, 1);
+            _store(out + i * BLOCK_SIZE, b);
+        }
+
+        return;
+    }
+
+    if (myst_aesni_vaes_supported())
+        i = _cbc_decrypt_vaes(key, prev, in, out, nblocks);
+
+    for (; i < nblocks; i += LANES)
+    {
+        const size_t n = (nblocks - i < LANES) ? nblocks - i : LANES;
+        block_t c[LANES];
+        block_t b[LANES];
+
+        for (size_t j = 0; j < n; j++)
+            b[j] = c[j] = _load(in + (i + j) * BLOCK_SIZE);
+
+        _decrypt_n(key, b, n);
+
+        for (size_t j = 0; j < n; j++)
+        {
+            const block_t chain = (j == 0) ? _load(prev) : c[j - 1];
+            _store(out + (i + j) * BLOCK_SIZE, b[j] ^ chain);
+        }
+
+        _store(prev, c[n - 1]);
+    }
+}
+
+/* Multiply the tweak by the primitive element of GF(2^128) */
+static inline void _mul_alpha(uint64_t t[2])
+{
+    const uint64_t carry = t[1] >> 63;
+
+    t[1] = (t[1] << 1) | (t[0] >> 63);
+    t[0] = (t[0] << 1) ^ (carry * 0x87);
+}
+
+/* XTS over whole runs of VAES_LANES blocks (updating the tweak) */
+static VAES_TARGET size_t _xts_vaes(
+    const myst_aesni_key_t* key,
+    bool encrypt,
+    uint64_t t[2],
+    const uint8_t* in,
+    uint8_t* out,
+    size_t nblocks)
+{
+    zblock_t zk[15];
+    size_t i;
+
+    _zkeys(encrypt ? key->enc : key->dec, key->rounds, zk);
+
+    for (i = 0; i + VAES_LANES <= nblocks; i += VAES_LANES)
+    {
+        uint64_t tweaks[VAES_LANES][2];
+        zblock_t z[4];
+        zblock_t zt[4];
+
+        for (size_t j = 0; j < VAES_LANES; j++)
+        {
+            tweaks[j][0] = t[0];
+            tweaks[j][1] = t[1];
+            _mul_alpha(t);
+        }
+
+        for (size_t j = 0; j < 4; j++)
+        {
+            zt[j] = _zload(tweaks[4 * j]);
+            z[j] = _zload(in + (i + 4 * j) * BLOCK_SIZE) ^ zt[j];
+        }
+
+        _zcrypt(zk, key->rounds, encrypt, z);
+
+        for (size_t j = 0; j < 4; j++)
+            _zstore(out + (i + 4 * j) * BLOCK_SIZE, z[j] ^ zt[j]);
+    }
+
+    return i;
+}
+
+void myst_aesni_xts(
+    const myst_aesni_key_t* key,
+    const myst_aesni_key_t* tweak_key,
+    bool encrypt,
+    const uint8_t iv[BLOCK_SIZE],
+    const void* in_,
+    void* out_,
+    size_t nblocks)
+{
+    const uint8_t* in = in_;
+    uint8_t* out = out_;
+    uint64_t t[2];
+    size_t i = 0;
+
+    /* the first tweak is the iv encrypted with the tweak key */
+    {
+        block_t b = _load(iv);
+        _encrypt_n(tweak_key, &b, 1);
+        memcpy(t, &b, sizeof(t));
+    }
+
+    if (myst_aesni_vaes_supported())
+        i = _xts_vaes(key, encrypt, t, in, out, nblocks);
+
+    for (; i < nblocks; i += LANES)
+    {
+        const size_t n = (nblocks - i < LANES) ? nblocks - i : LANES;
+        block_t tweaks[LANES];
+        block_t b[LANES];
+
+        for (size_t j = 0; j < n; j++)
+        {
+            memcpy(&tweaks[j], t, sizeof(t));
+            _mul_alpha(t);
+            b[j] = _load(in + (i + j) * BLOCK_SIZE) ^ tweaks[j];
+        }
+
+        if (encrypt)
+            _encrypt_n(key, b, n);
+        else
+            _decrypt_n(key, b, n);
+
+        for (size_t j = 0; j < n; j++)
+            _store(out + (i + j) * BLOCK_SIZE, b[j] ^ tweaks[j]);
+    }
+}
+
+/*
+**==============================================================================
+**
+** GCM (as in Intel's carry-less multiplication white paper):
+**
+**     The counter blocks are encrypted eight at a time like ECB, and GHASH
+**     multiplies with PCLMULQDQ on byte-reflected blocks. Four blocks are
+**     hashed at once with the powers H^4..H of the hash key, so that the
+**     four products are reduced together.
+**
+**==============================================================================
+*/
+
+typedef uint32_t u32x4_t __attribute__((vector_size(16)));
+
+#define CLMUL(A, B, IMM) \
+    __asm__("pclmulqdq %2, %1, %0" : "+x"(A) : "x"(B), "i"(IMM))
+
+#define SHIFT_LEFT_BYTES(X, N) __asm__("pslldq %1, %0" : "+x"(X) : "i"(N))
+
+#define SHIFT_RIGHT_BYTES(X, N) __asm__("psrldq %1, %0" : "+x"(X) : "i"(N))
+
+/* Reverse the bytes of a block (GHASH takes them most significant first) */
+static inline block_t _reflect(block_t b)
+{
+    const block_t mask = {0x08090a0b0c0d0e0f, 0x0001020304050607};
+
+    __asm__("pshufb %1, %0" : "+x"(b) : "x"(mask));
+    return b;
+}
+
+/* Add the 256-bit carry-less product of a and b to lo and hi */
+static inline void _clmul(block_t a, block_t b, block_t* lo, block_t* hi)
+{
+    block_t t0 = a;
+    block_t t1 = a;
+    block_t t2 = a;
+    block_t t3 = a;
+    block_t mid_lo;
+    block_t mid_hi;
+
+    CLMUL(t0, b, 0x00);
+    CLMUL(t1, b, 0x10);
+    CLMUL(t2, b, 0x01);
+    CLMUL(t3, b, 0x11);
+
+    mid_lo = mid_hi = t1 ^ t2;
+    SHIFT_LEFT_BYTES(mid_lo, 8);
+    SHIFT_RIGHT_BYTES(mid_hi, 8);
+
+    *lo ^= t0 ^ mid_lo;
+    *hi ^= t3 ^ mid_hi;
+}
+
+/* Reduce a 256-bit product modulo the GCM polynomial */
+static inline block_t _reduce(block_t lo_, block_t hi_)
+{
+    u32x4_t lo = (u32x4_t)lo_;
+    u32x4_t hi = (u32x4_t)hi_;
+    u32x4_t carry_lo = lo >> 31;
+    u32x4_t carry_hi = hi >> 31;
+    u32x4_t carry_out = carry_lo;
+    u32x4_t a;
+    u32x4_t b;
+
+    /* shift the product left by one bit (for the reflected operands) */
+    SHIFT_RIGHT_BYTES(carry_out, 12);
+    SHIFT_LEFT_BYTES(carry_hi, 4);
+    SHIFT_LEFT_BYTES(carry_lo, 4);
+    lo = (lo << 1) | carry_lo;
+    hi = (hi << 1) | carry_hi | carry_out;
+
+    /* the first phase of the reduction */
+    a = (lo << 31) ^ (lo << 30) ^ (lo << 25);
+    b = a;
+    SHIFT_RIGHT_BYTES(b, 4);
+    SHIFT_LEFT_BYTES(a, 12);
+    lo ^= a;
+
+    /* the second phase */
+    a = (lo >> 1) ^ (lo >> 2) ^ (lo >> 7) ^ b;
+    lo ^= a;
+
+    return (block_t)(hi ^ lo);
+}
+
+static inline block_t _gfmul(block_t a, block_t b)
+{
+    block_t lo = {0, 0};
+    block_t hi = {0, 0};
+
+    _clmul(a, b, &lo, &hi);
+    return _reduce(lo, hi);
+}
+
+int myst_aesni_gcm_setkey(
+    myst_aesni_gcm_key_t* key,
+    const void* data,
+    size_t size)
+{
+    block_t h = {0, 0};
+    block_t p;
+
+    if (!key || !myst_aesni_gcm_supported())
+        return -1;
+
+    if (myst_aesni_setkey(&key->aes, data, size) != 0)
+        return -1;
+
+    /* the hash key is the encrypted zero block */
+    _encrypt_n(&key->aes, &h, 1);
+    p = h = _reflect(h);
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        _store(key->h[i], p);
+        p = _gfmul(p, h);
+    }
+
+    return 0;
+}
+
+/* Hash n reflected blocks into x */
+static inline block_t _ghash(
+    const myst_aesni_gcm_key_t* key,
+    block_t x,
+    const block_t* b,
+    size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        block_t lo = {0, 0};
+        block_t hi = {0, 0};
+
+        _clmul(x ^ b[i], _load(key->h[3]), &lo, &hi);
+        _clmul(b[i + 1], _load(key->h[2]), &lo, &hi);
+        _clmul(b[i + 2], _load(key->h[1]), &lo, &hi);
+        _clmul(b[i + 3], _load(key->h[0]), &lo, &hi);
+        x = _reduce(lo, hi);
+    }
+
+    for (; i < n; i++)
+        x = _gfmul(x ^ b[i], _load(key->h[0]));
+
+    return x;
+}
+
+/* Hash bytes (the last block padded with zeros) */
+static block_t _ghash_bytes(
+    const myst_aesni_gcm_key_t* key,
+    block_t x,
+    const uint8_t* p,
+    size_t size)
+{
+    block_t b[LANES];
+
+    while (size)
+    {
+        size_t n = 0;
+
+        for (; n < LANES && size; n++)
+        {
+            if (size >= BLOCK_SIZE)
+            {
+                b[n] = _reflect(_load(p));
+                p += BLOCK_SIZE;
+                size -= BLOCK_SIZE;
+            }
+            else
+            {
+                uint8_t last[BLOCK_SIZE] = {0};
+
+                memcpy(last, p, size);
+                b[n] = _reflect(_load(last));
+                size = 0;
+            }
+        }
+
+        x = _ghash(key, x, b, n);
+    }
+
+    return x;
+}
+
+/* Copy the next n bytes of the vector (at iov[*i], offset *off) to data */
+static void _gather(
+    const struct iovec* iov,
+    int* i,
+    size_t* off,
+    uint8_t* data,
+    size_t n)
+{
+    while (n)
+    {
+        const size_t left = iov[*i].iov_len - *off;
+        const size_t m = (n < left) ? n : left;
+
+        memcpy(data, (const uint8_t*)iov[*i].iov_base + *off, m);
+        data += m;
+        n -= m;
+
+        if ((*off += m) == iov[*i].iov_len)
+        {
+            (*i)++;
+            *off = 0;
+        }
+    }
+}
+
+void myst_aesni_gcm(
+    const myst_aesni_gcm_key_t* key,
+    bool encrypt,
+    const uint8_t iv[MYST_AESNI_GCM_IV_SIZE],
+    const void* aad,
+    size_t aad_size,
+    const struct iovec* in,
+    int iovcnt,
+    void* out_,
+    uint8_t tag[MYST_AESNI_BLOCK_SIZE])
+{
+    uint8_t* out = out_;
+    size_t size = 0;
+    int iov_index = 0;
+    size_t iov_off = 0;
+    uint8_t counter[BLOCK_SIZE];
+    uint32_t ctr = 1;
+    block_t x = {0, 0};
+    block_t first;
+    size_t i = 0;
+
+    for (int j = 0; j < iovcnt; j++)
+        size += in[j].iov_len;
+
+    memcpy(counter, iv, MYST_AESNI_GCM_IV_SIZE);
+
+    /* the first counter block encrypts the tag */
+    counter[12] = 0;
+    counter[13] = 0;
+    counter[14] = 0;
+    counter[15] = 1;
+    first = _load(counter);
+    _encrypt_n(&key->aes, &first, 1);
+
+    x = _ghash_bytes(key, x, aad, aad_size);
+
+    for (; i < size; i += LANES * BLOCK_SIZE)
+    {
+        const size_t left = size - i;
+        const size_t bytes =
+            (left < LANES * BLOCK_SIZE) ? left : LANES * BLOCK_SIZE;
+        const size_t n = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        uint8_t data[LANES * BLOCK_SIZE];
+        block_t ks[LANES];
+        block_t c[LANES];
+
+        for (size_t j = 0; j < n; j++)
+        {
+            ctr++;
+            counter[12] = (uint8_t)(ctr >> 24);
+            counter[13] = (uint8_t)(ctr >> 16);
+            counter[14] = (uint8_t)(ctr >> 8);
+            counter[15] = (uint8_t)ctr;
+            ks[j] = _load(counter);
+        }
+
+        _encrypt_n(&key->aes, ks, n);
+
+        /* read the input once (and pad the last block with zeros) */
+        _gather(in, &iov_index, &iov_off, data, bytes);
+        memset(data + bytes, 0, n * BLOCK_SIZE - bytes);
+
+        for (size_t j = 0; j < n; j++)
+        {
+            const block_t d = _load(data + j * BLOCK_SIZE);
+            block_t r = d ^ ks[j];
+
+            /* the output past the end of a partial block is not ciphertext */
+            if (j == n - 1 && bytes % BLOCK_SIZE)
+            {
+                const size_t used = bytes % BLOCK_SIZE;
+                memset((uint8_t*)&r + used, 0, BLOCK_SIZE - used);
+            }
+
+            c[j] = _reflect(encrypt ? r : d);
+            _store(data + j * BLOCK_SIZE, r);
+        }
+
+        memcpy(out + i, data, bytes);
+        x = _ghash(key, x, c, n);
+    }
+
+    /* the lengths in bits */
+    {
+        uint64_t bits[2] = {(uint64_t)aad_size * 8, (uint64_t)size * 8};
+        uint8_t block[BLOCK_SIZE];
+
+        for (size_t j = 0; j < 8; j++)
+        {
+            block[j] = (uint8_t)(bits[0] >> (56 - 8 * j));
+            block[8 + j] = (uint8_t)(bits[1] >> (56 - 8 * j));
+        }
+
+        x = _ghash(key, x, (block_t[]){_reflect(_load(block))}, 1);
+    }
+
+    _store(tag, _reflect(x) ^ first);
+}
@@ -0,0 +1,268 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <mbedtls/aes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <myst/aesni.h>
+#include <myst/drbg.h>
+
+/*
+**==============================================================================
+**
+** CTR_DRBG with AES-256 (NIST SP 800-90A, without a derivation function).
+**
+**     Every thread has its own generator, so generating takes no lock and
+**     never leaves the target: the entropy function (RDRAND in the enclave,
+**     getrandom() on the host) runs only to seed and reseed the generator.
+**     The key is erased from the state with each request, so the output of
+**     earlier requests cannot be recovered from it.
+**
+**     With AES-NI, the counter blocks are encrypted eight at a time in the
+**     caller's buffer.
+**
+**==============================================================================
+*/
+
+#define BLOCK_SIZE 16
+#define KEY_SIZE 32
+#define SEED_SIZE (KEY_SIZE + BLOCK_SIZE)
+
+/* The most bytes a single request may produce (2^19 bits) */
+#define MAX_REQUEST 65536
+
+/* Requests between reseeds (SP 800-90A allows up to 2^48) */
+#define RESEED_INTERVAL 16384
+
+/* The counter blocks encrypted together */
+#define CHUNK_BLOCKS 64
+
+typedef struct drbg
+{
+    bool seeded;
+    uint64_t requests; /* since the last reseed */
+    uint8_t key[KEY_SIZE];
+    uint64_t v_hi; /* the 128-bit counter V (big-endian in the blocks) */
+    uint64_t v_lo;
+} drbg_t;
+
+/* A cipher keyed with the current key (for one request) */
+typedef struct cipher
+{
+    bool aesni;
+    myst_aesni_key_t aes_key;
+    mbedtls_aes_context ctx;
+} cipher_t;
+
+static __thread drbg_t _drbg;
+
+static void _put_be64(uint8_t* p, uint64_t x)
+{
+    for (size_t i = 0; i < 8; i++)
+        p[i] = (uint8_t)(x >> (56 - 8 * i));
+}
+
+/* Write the next n counter blocks (incrementing V before each one) */
+static void _counter_blocks(drbg_t* d, uint8_t* out, size_t n)
+{
+    for (size_t i = 0; i < n; i++, out += BLOCK_SIZE)
+    {
+        if (++d->v_lo == 0)
+            d->v_hi++;
+
+        _put_be64(out, d->v_hi);
+        _put_be64(out + 8, d->v_lo);
+    }
+}
+
+static int _cipher_init(cipher_t* c, const uint8_t key[KEY_SIZE])
+{
+    c->aesni = myst_aesni_supported();
+
+    if (c->aesni)
+        return myst_aesni_setkey(&c->aes_key, key, KEY_SIZE);
+
+    mbedtls_aes_init(&c->ctx);
+
+    if (mbedtls_aes_setkey_enc(&c->ctx, key, KEY_SIZE * 8) != 0)
+    {
+        mbedtls_aes_free(&c->ctx);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void _cipher_free(cipher_t* c)
+{
+    if (!c->aesni)
+        mbedtls_aes_free(&c->ctx);
+
+    memset(c, 0, sizeof(cipher_t));
+}
+
+/* Encrypt n blocks in place */
+static int _encrypt(cipher_t* c, uint8_t* data, size_t n)
+{
+    if (c->aesni)
+    {
+        myst_aesni_ecb(&c->aes_key, true, data, data, n);
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++, data += BLOCK_SIZE)
+    {
+        if (mbedtls_aes_crypt_ecb(&c->ctx, MBEDTLS_AES_ENCRYPT, data, data))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* CTR_DRBG_Update(): derive the next key and V from the provided data */
+static int _update(drbg_t* d, cipher_t* c, const uint8_t data[SEED_SIZE])
+{
+    int ret = -1;
+    uint8_t temp[SEED_SIZE];
+
+    _counter_blocks(d, temp, SEED_SIZE / BLOCK_SIZE);
+
+    if (_encrypt(c, temp, SEED_SIZE / BLOCK_SIZE) != 0)
+        goto done;
+
+    for (size_t i = 0; i < SEED_SIZE; i++)
+        temp[i] ^= data[i];
+
+    memcpy(d->key, temp, KEY_SIZE);
+    d->v_hi = 0;
+    d->v_lo = 0;
+
+    for (size_t i = 0; i < 8; i++)
+    {
+        d->v_hi = (d->v_hi << 8) | temp[KEY_SIZE + i];
+        d->v_lo = (d->v_lo << 8) | temp[KEY_SIZE + 8 + i];
+    }
+
+    ret = 0;
+
+done:
+    memset(temp, 0, sizeof(temp));
+    return ret;
+}
+
+/* Seed (or reseed) the generator with fresh entropy */
+static int _seed(drbg_t* d, myst_drbg_entropy_t entropy)
+{
+    int ret = -1;
+    uint8_t seed[SEED_SIZE];
+    cipher_t c;
+
+    if ((*entropy)(seed, sizeof(seed)) != 0)
+        goto done;
+
+    /* instantiation starts from a zero key and V */
+    if (!d->seeded)
+        memset(d, 0, sizeof(drbg_t));
+
+    if (_cipher_init(&c, d->key) != 0)
+        goto done;
+
+    ret = _update(d, &c, seed);
+    _cipher_free(&c);
+
+    if (ret == 0)
+    {
+        d->seeded = true;
+        d->requests = 0;
+    }
+
+done:
+    memset(seed, 0, sizeof(seed));
+    return ret;
+}
+
+/* CTR_DRBG_Generate() for at most MAX_REQUEST bytes */
+static int _generate(drbg_t* d, uint8_t* out, size_t size)
+{
+    int ret = -1;
+    static const uint8_t zeros[SEED_SIZE];
+    cipher_t c;
+
+    if (_cipher_init(&c, d->key) != 0)
+        return -1;
+
+    /* whole blocks are encrypted in place in the caller's buffer */
+    while (size >= BLOCK_SIZE)
+    {
+        size_t n = size / BLOCK_SIZE;
+
+        if (n > CHUNK_BLOCKS)
+            n = CHUNK_BLOCKS;
+
+        _counter_blocks(d, out, n);
+
+        if (_encrypt(&c, out, n) != 0)
+            goto done;
+
+        out += n * BLOCK_SIZE;
+        size -= n * BLOCK_SIZE;
+    }
+
+    if (size)
+    {
+        uint8_t block[BLOCK_SIZE];
+
+        _counter_blocks(d, block, 1);
+
+        if (_encrypt(&c, block, 1) != 0)
+            goto done;
+
+        memcpy(out, block, size);
+        memset(block, 0, sizeof(block));
+    }
+
+    /* replace the key so that this output cannot be recomputed */
+    if (_update(d, &c, zeros) != 0)
+        goto done;
+
+    d->requests++;
+    ret = 0;
+
+done:
+    _cipher_free(&c);
+    return ret;
+}
+
+int myst_drbg_generate(void* data, size_t size, myst_drbg_entropy_t entropy)
+{
+    drbg_t* d = &_drbg;
+    uint8_t* p = data;
+
+    if ((!data && size) || !entropy)
+        return -1;
+
+    while (size)
+    {
+        const size_t n = size < MAX_REQUEST ? size : MAX_REQUEST;
+
+        if (!d->seeded || d->requests >= RESEED_INTERVAL)
+        {
+            if (_seed(d, entropy) != 0)
+                return -1;
+        }
+
+        if (_generate(d, p, n) != 0)
+        {
+            /* start over from fresh entropy next time */
+            memset(d, 0, sizeof(drbg_t));
+            return -1;
+        }
+
+        p += n;
+        size -= n;
+    }
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <mbedtls/gcm.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/aesni.h>
+#include <myst/gcm.h>
+
+/* a multiple of the block size (as mbedtls_gcm_update() wants) */
+#define SEAL_CHUNK_SIZE 256
+
+struct myst_gcm
+{
+    bool aesni;
+    union {
+        myst_aesni_gcm_key_t key;
+        mbedtls_gcm_context ctx;
+    } u;
+};
+
+int myst_gcm_new(const void* key, size_t key_size, myst_gcm_t** gcm_out)
+{
+    myst_gcm_t* gcm;
+
+    if (gcm_out)
+        *gcm_out = NULL;
+
+    if (!key || (key_size != 16 && key_size != 32) || !gcm_out)
+        return -EINVAL;
+
+    if (!(gcm = calloc(1, sizeof(myst_gcm_t))))
+        return -ENOMEM;
+
+    if (myst_aesni_gcm_setkey(&gcm->u.key, key, key_size) == 0)
+    {
+        gcm->aesni = true;
+    }
+    else
+    {
+        mbedtls_gcm_init(&gcm->u.ctx);
+
+        if (mbedtls_gcm_setkey(
+                &gcm->u.ctx,
+                MBEDTLS_CIPHER_ID_AES,
+                key,
+                (unsigned int)key_size * 8) != 0)
+        {
+            mbedtls_gcm_free(&gcm->u.ctx);
+            free(gcm);
+            return -EINVAL;
+        }
+    }
+
+    *gcm_out = gcm;
+    return 0;
+}
+
+int myst_gcm_free(myst_gcm_t* gcm)
+{
+    if (!gcm)
+        return -EINVAL;
+
+    if (!gcm->aesni)
+        mbedtls_gcm_free(&gcm->u.ctx);
+
+    /* do not leave the round keys behind */
+    memset(gcm, 0, sizeof(myst_gcm_t));
+    free(gcm);
+    return 0;
+}
+
+/* Copy the next n bytes of the vector (at iov[*i], offset *off) to data */
+static void _gather(
+    const struct iovec* iov,
+    int* i,
+    size_t* off,
+    uint8_t* data,
+    size_t n)
+{
+    while (n)
+    {
+        const size_t left = iov[*i].iov_len - *off;
+        const size_t m = (n < left) ? n : left;
+
+        memcpy(data, (const uint8_t*)iov[*i].iov_base + *off, m);
+        data += m;
+        n -= m;
+
+        if ((*off += m) == iov[*i].iov_len)
+        {
+            (*i)++;
+            *off = 0;
+        }
+    }
+}
+
+int myst_gcm_seal(
+    myst_gcm_t* gcm,
+    const myst_gcm_auth_t* auth,
+    const struct iovec* iov,
+    int iovcnt,
+    void* out)
+{
+    size_t size = 0;
+    uint8_t* tag;
+    int index = 0;
+    size_t off = 0;
+
+    if (!gcm || !auth || auth->aad_size > MYST_GCM_MAX_AAD_SIZE || !out ||
+        (iovcnt && !iov) || iovcnt < 0)
+    {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (!iov[i].iov_base && iov[i].iov_len)
+            return -EINVAL;
+
+        size += iov[i].iov_len;
+    }
+
+    tag = (uint8_t*)out + size;
+
+    if (gcm->aesni)
+    {
+        myst_aesni_gcm(
+            &gcm->u.key,
+            true,
+            auth->iv,
+            auth->aad,
+            auth->aad_size,
+            iov,
+            iovcnt,
+            out,
+            tag);
+        return 0;
+    }
+
+    if (mbedtls_gcm_starts(
+            &gcm->u.ctx,
+            MBEDTLS_GCM_ENCRYPT,
+            auth->iv,
+            MYST_GCM_IV_SIZE,
+            auth->aad,
+            auth->aad_size) != 0)
+    {
+        return -EINVAL;
+    }
+
+    /* mbedtls reads the ciphertext back, so it never sees out itself */
+    for (size_t i = 0; i < size; i += SEAL_CHUNK_SIZE)
+    {
+        uint8_t plain[SEAL_CHUNK_SIZE];
+        uint8_t chunk[SEAL_CHUNK_SIZE];
+        const size_t n = (size - i < sizeof(chunk)) ? size - i : sizeof(chunk);
+
+        _gather(iov, &index, &off, plain, n);
+
+        if (mbedtls_gcm_update(&gcm->u.ctx, n, plain, chunk) != 0)
+            return -EINVAL;
+
+        memcpy((uint8_t*)out + i, chunk, n);
+    }
+
+    {
+        uint8_t computed[MYST_GCM_TAG_SIZE];
+
+        if (mbedtls_gcm_finish(&gcm->u.ctx, computed, sizeof(computed)) != 0)
+            return -EINVAL;
+
+        memcpy(tag, computed, sizeof(computed));
+    }
+
+    return 0;
+}
+
+int myst_gcm_open(
+    myst_gcm_t* gcm,
+    const myst_gcm_auth_t* auth,
+    const void* in,
+    void* out,
+    size_t size)
+{
+    uint8_t tag[MYST_GCM_TAG_SIZE];
+    uint8_t diff = 0;
+
+    if (!gcm || !auth || auth->aad_size > MYST_GCM_MAX_AAD_SIZE || !in ||
+        (size && !out))
+    {
+        return -EINVAL;
+    }
+
+    /* copy the received tag first, since out may overlap it */
+    memcpy(tag, (const uint8_t*)in + size, MYST_GCM_TAG_SIZE);
+
+    if (!gcm->aesni)
+    {
+        int r = mbedtls_gcm_auth_decrypt(
+            &gcm->u.ctx,
+            size,
+            auth->iv,
+            MYST_GCM_IV_SIZE,
+            auth->aad,
+            auth->aad_size,
+            tag,
+            MYST_GCM_TAG_SIZE,
+            in,
+            out);
+
+        return (r == 0) ? 0 : -EBADMSG;
+    }
+
+    {
+        const struct iovec iov = {(void*)in, size};
+        uint8_t computed[MYST_GCM_TAG_SIZE];
+
+        myst_aesni_gcm(
+            &gcm->u.key,
+            false,
+            auth->iv,
+            auth->aad,
+            auth->aad_size,
+            &iov,
+            1,
+            out,
+            computed);
+
+        /* in constant time */
+        for (size_t i = 0; i < MYST_GCM_TAG_SIZE; i++)
+            diff |= computed[i] ^ tag[i];
+    }
+
+    return diff ? -EBADMSG : 0;
+}
@@ -1,9 +1,11 @@
 #include <mbedtls/aes.h>
 #include <mbedtls/cipher.h>
 #include <mbedtls/sha256.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <myst/aesni.h>
 #include <myst/luks.h>
 
 #define LUKS_IV_SIZE 16
@@ -15,6 +17,28 @@
 
 #define SHA256_SIZE 32
 
+/* The longest key the keyed contexts hold (AES-256-XTS) */
+#define MAX_KEY_BYTES 64
+
+/* A cipher context set up with one key for one direction. Setting up a
+ * context expands the key, which costs more than encrypting a sector, so
+ * the context is kept for the next call with the same key. With AES-NI,
+ * the key is expanded for aesni.c instead of for mbedtls */
+typedef struct keyed_ctx
+{
+    bool valid;
+    bool aesni;
+    mbedtls_cipher_context_t ctx;
+    myst_aesni_key_t aes_key;
+    myst_aesni_key_t tweak_key; /* second half of XTS keys */
+    const mbedtls_cipher_info_t* ci;
+    uint32_t key_bytes;
+    uint8_t key[MAX_KEY_BYTES];
+} keyed_ctx_t;
+
+/* One context per direction and thread (contexts are not thread safe) */
+static __thread keyed_ctx_t _keyed_ctxs[2];
+
 static int _hash(const void* data, size_t size, uint8_t hash[SHA256_SIZE])
 {
     int ret = -1;
@@ -178,6 +202,145 @@ done:
     return ret;
 }
 
+/* Get the thread's context for the key and direction (setting it up anew if
+ * the key or cipher changed since the last call) */
+static keyed_ctx_t* _get_keyed_ctx(
+    const luks_phdr_t* phdr,
+    const mbedtls_cipher_info_t* ci,
+    mbedtls_operation_t op,
+    const void* key)
+{
+    keyed_ctx_t* kc = &_keyed_ctxs[op == MBEDTLS_ENCRYPT ? 0 : 1];
+    const size_t key_bits = phdr->key_bytes * 8;
+
+    if (phdr->key_bytes > MAX_KEY_BYTES)
+        return NULL;
+
+    if (kc->valid && kc->ci == ci && kc->key_bytes == phdr->key_bytes &&
+        memcmp(kc->key, key, phdr->key_bytes) == 0)
+    {
+        return kc;
+    }
+
+    if (kc->valid)
+    {
+        if (!kc->aesni)
+            mbedtls_cipher_free(&kc->ctx);
+
+        memset(kc, 0, sizeof(keyed_ctx_t));
+    }
+
+    /* expand the key for aesni.c (which handles all the supported modes) */
+    if (myst_aesni_supported())
+    {
+        const bool xts =
+            strcmp(phdr->cipher_mode, LUKS_CIPHER_MODE_XTS_PLAIN64) == 0;
+        const size_t size = xts ? phdr->key_bytes / 2 : phdr->key_bytes;
+
+        if (myst_aesni_setkey(&kc->aes_key, key, size) != 0)
+            goto failed;
+
+        if (xts && myst_aesni_setkey(
+                       &kc->tweak_key, (const uint8_t*)key + size, size) != 0)
+        {
+            goto failed;
+        }
+
+        kc->aesni = true;
+        goto keyed;
+    }
+
+    mbedtls_cipher_init(&kc->ctx);
+
+    if (mbedtls_cipher_setup(&kc->ctx, ci) != 0)
+        goto failed;
+
+    if (mbedtls_cipher_setkey(&kc->ctx, key, (int)key_bits, op) != 0)
+        goto failed;
+
+    if (strcmp(phdr->cipher_mode, LUKS_CIPHER_MODE_CBC_PLAIN) == 0 &&
+        mbedtls_cipher_set_padding_mode(&kc->ctx, MBEDTLS_PADDING_NONE) != 0)
+    {
+        goto failed;
+    }
+
+keyed:
+    kc->ci = ci;
+    kc->key_bytes = phdr->key_bytes;
+    memcpy(kc->key, key, phdr->key_bytes);
+    kc->valid = true;
+
+    return kc;
+
+failed:
+
+    if (!kc->aesni)
+        mbedtls_cipher_free(&kc->ctx);
+
+    memset(kc, 0, sizeof(keyed_ctx_t));
+    return NULL;
+}
+
+static size_t _sector_size(const luks_phdr_t* phdr)
+{
+    return phdr->sector_size ? phdr->sector_size : LUKS_SECTOR_SIZE;
+}
+
+/* Encrypt or decrypt with aesni.c (one sector at a time, except for ECB) */
+static int _crypt_aesni(
+    const luks_phdr_t* phdr,
+    const keyed_ctx_t* kc,
+    bool encrypt,
+    const void* key,
+    const uint8_t* data_in,
+    uint8_t* data_out,
+    size_t data_size,
+    uint64_t sector)
+{
+    const size_t sector_size = _sector_size(phdr);
+    const size_t sector_blocks = sector_size / MYST_AESNI_BLOCK_SIZE;
+    uint8_t iv[LUKS_IV_SIZE];
+
+    if (strcmp(phdr->cipher_mode, LUKS_CIPHER_MODE_ECB) == 0)
+    {
+        const size_t nblocks = data_size / MYST_AESNI_BLOCK_SIZE;
+        myst_aesni_ecb(&kc->aes_key, encrypt, data_in, data_out, nblocks);
+        return 0;
+    }
+
+    for (size_t i = 0; i < data_size / sector_size; i++)
+    {
+        const size_t pos = i * sector_size;
+
+        if (_gen_iv(phdr, sector + i, iv, key) == -1)
+            return -1;
+
+        if (strcmp(phdr->cipher_mode, LUKS_CIPHER_MODE_XTS_PLAIN64) == 0)
+        {
+            myst_aesni_xts(
+                &kc->aes_key,
+                &kc->tweak_key,
+                encrypt,
+                iv,
+                data_in + pos,
+                data_out + pos,
+                sector_blocks);
+        }
+        else
+        {
+            myst_aesni_cbc(
+                &kc->aes_key,
+                encrypt,
+                iv,
+                data_in + pos,
+                data_out + pos,
+                sector_blocks);
+        }
+    }
+
+    return 0;
+}
+
 static int _crypt(
     const luks_phdr_t* phdr,
     mbedtls_operation_t op, /* MBEDTLS_ENCRYPT or MBEDTLS_DECRYPT */
@@ -189,13 +352,19 @@ static int _crypt(
 {
     int ret = -1;
     const mbedtls_cipher_info_t* ci;
-    mbedtls_cipher_context_t ctx;
+    keyed_ctx_t* kc;
+    mbedtls_cipher_context_t* ctx;
     uint8_t iv[LUKS_IV_SIZE];
     uint64_t i;
     uint64_t iters;
     uint64_t block_size;
 
-    mbedtls_cipher_init(&ctx);
+    /* only whole sectors are encrypted */
+    if (!phdr || _sector_size(phdr) > LUKS_MAX_SECTOR_SIZE ||
+        data_size % _sector_size(phdr) != 0)
+    {
+        goto done;
+    }
 
     if (!(ci = _get_cipher_info(phdr)))
     {
@@ -203,29 +372,28 @@ static int _crypt(
         goto done;
     }
 
-    if (mbedtls_cipher_setup(&ctx, ci) != 0)
+    if (!(kc = _get_keyed_ctx(phdr, ci, op, key)))
         goto done;
 
-    const size_t key_bits = phdr->key_bytes * 8;
-
-    if (mbedtls_cipher_setkey(&ctx, key, (int)key_bits, op) != 0)
-        goto done;
-
-    if (strcmp(phdr->cipher_mode, LUKS_CIPHER_MODE_CBC_PLAIN) == 0 &&
-        mbedtls_cipher_set_padding_mode(&ctx, MBEDTLS_PADDING_NONE) != 0)
+    if (kc->aesni)
     {
+        const bool encrypt = (op == MBEDTLS_ENCRYPT);
+        ret = _crypt_aesni(
+            phdr, kc, encrypt, key, data_in, data_out, data_size, sector);
         goto done;
     }
 
+    ctx = &kc->ctx;
+
     /* Determine the block size */
     if (strcmp(phdr->cipher_mode, LUKS_CIPHER_MODE_ECB) == 0)
     {
         iters = 1;
-        block_size = mbedtls_cipher_get_block_size(&ctx);
+        block_size = mbedtls_cipher_get_block_size(ctx);
     }
     else
     {
-        block_size = LUKS_SECTOR_SIZE;
+        block_size = _sector_size(phdr);
     }
 
     iters = data_size / block_size;
@@ -242,7 +410,7 @@ static int _crypt(
         pos = i * block_size;
 
         if ((r = mbedtls_cipher_crypt(
-                 &ctx,
+                 ctx,
                  iv,             /* iv */
                  LUKS_IV_SIZE,   /* iv_size */
                  data_in + pos,  /* input */
@@ -260,8 +428,6 @@ static int _crypt(
     ret = 0;
 
 done:
-    mbedtls_cipher_free(&ctx);
-
     return ret;
 }
 
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/poll.h>
 #include <unistd.h>
 
@@ -43,6 +44,24 @@ static void _create_wakefds(void)
         abort();
 }
 
+/* Consume all words written to the wake pipe */
+static long _drain_wakefds(void)
+{
+    uint64_t x;
+    ssize_t n;
+
+    while ((n = read(_wakefds[0], &x, sizeof(x))) == sizeof(x))
+    {
+        if (x != WAKE_MAGIC)
+            return -EINVAL;
+    }
+
+    if (n == -1 && errno != EWOULDBLOCK)
+        return -EINVAL;
+
+    return 0;
+}
+
 long myst_tcall_poll_wake(void)
 {
     uint64_t x = WAKE_MAGIC;
@@ -50,7 +69,7 @@ long myst_tcall_poll_wake(void)
     /* Create the wake pipe */
     pthread_once(&_create_wakefds_once, _create_wakefds);
 
-    if (write(_wakefds[1], &x, sizeof(x)) != x)
+    if (write(_wakefds[1], &x, sizeof(x)) != sizeof(x))
         return -EINVAL;
 
     return 0;
@@ -88,24 +107,8 @@ long myst_tcall_poll(struct pollfd* lfds, unsigned long nfds, int timeout)
     /* Check whether there were any writes to the wake pipe */
     if (fds[nfds].revents & POLLIN)
     {
-        uint64_t x;
-        ssize_t n;
-
-        /* consume all words written to the pipe */
-        while ((n = read(_wakefds[0], &x, sizeof(x))) == sizeof(x))
-        {
-            if (x != WAKE_MAGIC)
-            {
-                ret = -EINVAL;
-                goto done;
-            }
-        }
-
-        if (n == -1 && errno != EWOULDBLOCK)
-        {
-            ret = -EINVAL;
+        if ((ret = _drain_wakefds()) != 0)
             goto done;
-        }
 
         /* don't return a value that includes this wake descriptor */
         r--;
@@ -124,3 +127,63 @@ done:
 
     return ret;
 }
+
+long myst_tcall_epoll_create1(int flags)
+{
+    int epfd;
+    struct epoll_event ev;
+
+    /* Create the wake pipe */
+    pthread_once(&_create_wakefds_once, _create_wakefds);
+
+    if ((epfd = epoll_create1(flags)) < 0)
+        return -errno;
+
+    /* watch the wake pipe so myst_tcall_poll_wake() also wakes epoll */
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = WAKE_MAGIC;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, _wakefds[0], &ev) != 0)
+    {
+        long ret = -errno;
+        close(epfd);
+        return ret;
+    }
+
+    return epfd;
+}
+
+long myst_tcall_epoll_wait(
+    int epfd,
+    struct epoll_event* events,
+    int maxevents,
+    int timeout)
+{
+    int n;
+    int m = 0;
+
+    if (!events || maxevents <= 0)
+        return -EINVAL;
+
+    if ((n = epoll_wait(epfd, events, maxevents, timeout)) < 0)
+        return -errno;
+
+    /* remove the wake pipe event from the results */
+    for (int i = 0; i < n; i++)
+    {
+        if (events[i].data.u64 == WAKE_MAGIC)
+        {
+            long r;
+
+            if ((r = _drain_wakefds()) != 0)
+                return r;
+
+            continue;
+        }
+
+        events[m++] = events[i];
+    }
+
+    return m;
+}
@@ -1,13 +1,203 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#include <string.h>
+
 #include <mbedtls/sha256.h>
 
 #include <myst/defs.h>
 #include <myst/eraise.h>
 #include <myst/sha256.h>
+#include <myst/sha256x86.h>
+
+#define BLOCK_SIZE MYST_SHA256_X86_BLOCK_SIZE
+#define LANES MYST_SHA256_X86_LANES
+
+/* The fewest messages that myst_sha256_n() hashes in lanes */
+#define MIN_LANES_MESSAGES 4
+
+/* The context of the SHA-NI implementation */
+typedef struct sha256_x86_ctx
+{
+    uint32_t state[8];
+    uint64_t size;
+    uint8_t buf[BLOCK_SIZE];
+} sha256_x86_ctx_t;
 
 MYST_STATIC_ASSERT(sizeof(mbedtls_sha256_context) <= sizeof(myst_sha256_ctx_t));
+MYST_STATIC_ASSERT(sizeof(sha256_x86_ctx_t) <= sizeof(myst_sha256_ctx_t));
+
+static const uint32_t _initial_state[8] = {
+    0x6a09e667,
+    0xbb67ae85,
+    0x3c6ef372,
+    0xa54ff53a,
+    0x510e527f,
+    0x9b05688c,
+    0x1f83d9ab,
+    0x5be0cd19,
+};
+
+static void _state_to_hash(const uint32_t state[8], myst_sha256_t* sha256)
+{
+    for (size_t i = 0; i < 8; i++)
+    {
+        const uint32_t x = __builtin_bswap32(state[i]);
+        memcpy(&sha256->data[i * 4], &x, sizeof(x));
+    }
+}
+
+/* The number of blocks of a padded message of the given size */
+static size_t _num_blocks(size_t size)
+{
+    return (size + sizeof(uint64_t)) / BLOCK_SIZE + 1;
+}
+
+/* Get block b of the padded message (prefix || data), which is staged in buf
+ * unless it lies entirely in data */
+static const uint8_t* _get_block(
+    const uint8_t* prefix,
+    size_t prefix_size,
+    const uint8_t* data,
+    size_t size,
+    size_t b,
+    uint8_t buf[BLOCK_SIZE])
+{
+    const size_t total = prefix_size + size;
+    const size_t start = b * BLOCK_SIZE;
+    size_t n = 0;
+
+    if (start >= prefix_size && start + BLOCK_SIZE <= total)
+        return data + (start - prefix_size);
+
+    memset(buf, 0, BLOCK_SIZE);
+
+    if (start < prefix_size)
+    {
+        n = prefix_size - start;
+
+        if (n > BLOCK_SIZE)
+            n = BLOCK_SIZE;
+
+        memcpy(buf, prefix + start, n);
+    }
+
+    if (n < BLOCK_SIZE && start + n < total)
+    {
+        size_t m = total - (start + n);
+
+        if (m > BLOCK_SIZE - n)
+            m = BLOCK_SIZE - n;
+
+        memcpy(buf + n, data + (start + n - prefix_size), m);
+    }
+
+    /* the padding starts with a one bit and ends with the size in bits */
+    if (total >= start && total < start + BLOCK_SIZE)
+        buf[total - start] = 0x80;
+
+    if (b + 1 == _num_blocks(total))
+    {
+        const uint64_t bits = __builtin_bswap64((uint64_t)total * 8);
+        memcpy(buf + BLOCK_SIZE - sizeof(bits), &bits, sizeof(bits));
+    }
+
+    return buf;
+}
+
+/* Hash one message (prefix || data) with the SHA extensions */
+static void _hash_x86(
+    myst_sha256_t* sha256,
+    const uint8_t* prefix,
+    size_t prefix_size,
+    const uint8_t* data,
+    size_t size)
+{
+    const size_t total = prefix_size + size;
+    const size_t nblocks = _num_blocks(total);
+    uint32_t state[8];
+    uint8_t buf[BLOCK_SIZE];
+
+    memcpy(state, _initial_state, sizeof(state));
+
+    for (size_t b = 0; b < nblocks;)
+    {
+        const uint8_t* p = _get_block(prefix, prefix_size, data, size, b, buf);
+
+        /* the blocks that lie in data are consecutive */
+        if (p == buf)
+        {
+            myst_sha256_x86_compress(state, p, 1);
+            b++;
+        }
+        else
+        {
+            const size_t n = total / BLOCK_SIZE - b;
+            myst_sha256_x86_compress(state, p, n);
+            b += n;
+        }
+    }
+
+    _state_to_hash(state, sha256);
+}
+
+/* Hash up to LANES messages (prefix || data + i * size) at once */
+static void _hash_lanes(
+    myst_sha256_t* hashes,
+    const uint8_t* prefix,
+    size_t prefix_size,
+    const uint8_t* data,
+    size_t size,
+    size_t count)
+{
+    const size_t nblocks = _num_blocks(prefix_size + size);
+    uint32_t state[LANES][8];
+    uint8_t bufs[LANES][BLOCK_SIZE];
+    const void* blocks[LANES];
+
+    for (size_t l = 0; l < LANES; l++)
+        memcpy(state[l], _initial_state, sizeof(_initial_state));
+
+    for (size_t b = 0; b < nblocks; b++)
+    {
+        /* the lanes past count repeat the last message */
+        for (size_t l = 0; l < LANES; l++)
+        {
+            const uint8_t* msg = data + (l < count ? l : count - 1) * size;
+            blocks[l] = _get_block(prefix, prefix_size, msg, size, b, bufs[l]);
+        }
+
+        myst_sha256_x86_compress_lanes(state, blocks);
+    }
+
+    for (size_t l = 0; l < count; l++)
+        _state_to_hash(state[l], &hashes[l]);
+}
+
+static int _hash_mbedtls(
+    myst_sha256_t* sha256,
+    const void* prefix,
+    size_t prefix_size,
+    const void* data,
+    size_t size)
+{
+    int ret = 0;
+    mbedtls_sha256_context ctx;
+
+    mbedtls_sha256_init(&ctx);
+
+    if (mbedtls_sha256_starts_ret(&ctx, 0) != 0 ||
+        mbedtls_sha256_update_ret(&ctx, prefix, prefix_size) != 0 ||
+        mbedtls_sha256_update_ret(&ctx, data, size) != 0 ||
+        mbedtls_sha256_finish_ret(&ctx, sha256->data) != 0)
+    {
+        ERAISE(-EINVAL);
+    }
+
+done:
+    mbedtls_sha256_free(&ctx);
+    return ret;
+}
 
 int myst_sha256_start(myst_sha256_ctx_t* ctx)
 {
@@ -17,6 +207,15 @@ int myst_sha256_start(myst_sha256_ctx_t* ctx)
     if (!mctx)
         ERAISE(-EINVAL);
 
+    if (myst_sha256_x86_supported())
+    {
+        sha256_x86_ctx_t* xctx = (sha256_x86_ctx_t*)ctx;
+
+        memcpy(xctx->state, _initial_state, sizeof(xctx->state));
+        xctx->size = 0;
+        goto done;
+    }
+
     mbedtls_sha256_init(mctx);
 
     if (mbedtls_sha256_starts_ret(mctx, 0) != 0)
@@ -34,6 +233,45 @@ int myst_sha256_update(myst_sha256_ctx_t* ctx, const void* data, size_t size)
     if (!mctx)
         ERAISE(-EINVAL);
 
+    if (myst_sha256_x86_supported())
+    {
+        sha256_x86_ctx_t* xctx = (sha256_x86_ctx_t*)ctx;
+        const uint8_t* p = data;
+        size_t used = xctx->size % BLOCK_SIZE;
+
+        xctx->size += size;
+
+        /* complete the partial block first */
+        if (used)
+        {
+            size_t n = BLOCK_SIZE - used;
+
+            if (n > size)
+                n = size;
+
+            memcpy(xctx->buf + used, p, n);
+            p += n;
+            size -= n;
+
+            if (used + n < BLOCK_SIZE)
+                goto done;
+
+            myst_sha256_x86_compress(xctx->state, xctx->buf, 1);
+        }
+
+        if (size >= BLOCK_SIZE)
+        {
+            const size_t nblocks = size / BLOCK_SIZE;
+
+            myst_sha256_x86_compress(xctx->state, p, nblocks);
+            p += nblocks * BLOCK_SIZE;
+            size -= nblocks * BLOCK_SIZE;
+        }
+
+        memcpy(xctx->buf, p, size);
+        goto done;
+    }
+
     if (mbedtls_sha256_update_ret(mctx, data, size) != 0)
         ERAISE(-EINVAL);
 
@@ -49,6 +287,27 @@ int myst_sha256_finish(myst_sha256_ctx_t* ctx, myst_sha256_t* sha256)
     if (!mctx)
         ERAISE(-EINVAL);
 
+    if (myst_sha256_x86_supported())
+    {
+        sha256_x86_ctx_t* xctx = (sha256_x86_ctx_t*)ctx;
+        const size_t used = xctx->size % BLOCK_SIZE;
+        const uint64_t bits = __builtin_bswap64(xctx->size * 8);
+
+        xctx->buf[used] = 0x80;
+        memset(xctx->buf + used + 1, 0, BLOCK_SIZE - used - 1);
+
+        if (used + 1 > BLOCK_SIZE - sizeof(bits))
+        {
+            myst_sha256_x86_compress(xctx->state, xctx->buf, 1);
+            memset(xctx->buf, 0, BLOCK_SIZE);
+        }
+
+        memcpy(xctx->buf + BLOCK_SIZE - sizeof(bits), &bits, sizeof(bits));
+        myst_sha256_x86_compress(xctx->state, xctx->buf, 1);
+        _state_to_hash(xctx->state, sha256);
+        goto done;
+    }
+
     if (mbedtls_sha256_finish_ret(mctx, sha256->data) != 0)
         ERAISE(-EINVAL);
 
@@ -73,3 +332,42 @@ int myst_sha256(myst_sha256_t* sha256, const void* data, size_t size)
 done:
     return ret;
 }
+
+int myst_sha256_n(
+    myst_sha256_t* hashes,
+    const void* prefix,
+    size_t prefix_size,
+    const void* data,
+    size_t size,
+    size_t count)
+{
+    int ret = 0;
+    const uint8_t* p = data;
+    size_t i = 0;
+
+    if (!hashes || (!prefix && prefix_size) || (!data && size && count))
+        ERAISE(-EINVAL);
+
+    /* prefer SHA-NI on one message at a time to the multi-buffer code */
+    if (!myst_sha256_x86_supported() && myst_sha256_x86_lanes_supported())
+    {
+        while (count - i >= MIN_LANES_MESSAGES)
+        {
+            const size_t n = (count - i < LANES) ? count - i : LANES;
+            _hash_lanes(&hashes[i], prefix, prefix_size, p + i * size, size, n);
+            i += n;
+        }
+    }
+
+    for (; i < count; i++)
+    {
+        if (myst_sha256_x86_supported())
+            _hash_x86(&hashes[i], prefix, prefix_size, p + i * size, size);
+        else
+            ECHECK(_hash_mbedtls(
+                &hashes[i], prefix, prefix_size, p + i * size, size));
+    }
+
+done:
+    return ret;
+}
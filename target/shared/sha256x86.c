@@ -0,0 +1,362 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <string.h>
+
+#include <myst/sha256x86.h>
+
+/*
+**==============================================================================
+**
+** SHA-256 with the x86 SHA extensions (and for many messages with AVX2):
+**
+**     The SHA-NI code keeps the state in the ABEF/CDGH register pair that
+**     SHA256RNDS2 works on and does four rounds per message word group, as
+**     in Intel's reference code.
+**
+**     The multi-buffer code hashes sixteen independent messages at once,
+**     each vector lane holding the same word of a different message. With
+**     AVX-512 each vector is a single zmm register, with AVX2 a pair of ymm
+**     registers (both paths are compiled from the same generic code).
+**
+**     Like aesni.c, this code uses inline asm and GCC vector types rather
+**     than the intrinsics headers, which the enclave build (-nostdinc) does
+**     not have.
+**
+**==============================================================================
+*/
+
+#define BLOCK_SIZE MYST_SHA256_X86_BLOCK_SIZE
+#define LANES MYST_SHA256_X86_LANES
+
+typedef uint32_t v4_t __attribute__((vector_size(16)));
+
+static const uint32_t _k[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/*
+**==============================================================================
+**
+** CPU features
+**
+**==============================================================================
+*/
+
+#define CPUID_1_ECX_OSXSAVE (1U << 27)
+#define CPUID_7_EBX_AVX2 (1U << 5)
+#define CPUID_7_EBX_AVX512F (1U << 16)
+#define CPUID_7_EBX_SHA (1U << 29)
+
+/* SSE and AVX state (and for AVX-512 also opmask and the upper ZMM state) */
+#define XCR0_AVX 0x06
+#define XCR0_AVX512 0xe6
+
+static void _cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+    __asm__ volatile("cpuid"
+                     : "=a"(regs[0]),
+                       "=b"(regs[1]),
+                       "=c"(regs[2]),
+                       "=d"(regs[3])
+                     : "a"(leaf), "c"(subleaf));
+}
+
+static uint64_t _xgetbv(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+enum
+{
+    FEATURE_SHA = 1,
+    FEATURE_AVX2 = 2,
+    FEATURE_AVX512 = 4,
+};
+
+/* Detected once (racing threads detect the same features) */
+static int _features = -1;
+
+static int _get_features(void)
+{
+    if (_features == -1)
+    {
+        uint32_t regs[4];
+        int features = 0;
+        uint64_t xcr0 = 0;
+
+        _cpuid(0, 0, regs);
+
+        if (regs[0] >= 7)
+        {
+            _cpuid(1, 0, regs);
+
+            /* AVX needs the OS (or enclave) to keep the AVX state */
+            if ((regs[2] & CPUID_1_ECX_OSXSAVE))
+                xcr0 = _xgetbv();
+
+            _cpuid(7, 0, regs);
+
+            if ((regs[1] & CPUID_7_EBX_SHA))
+                features |= FEATURE_SHA;
+
+            if ((regs[1] & CPUID_7_EBX_AVX2) && (xcr0 & XCR0_AVX) == XCR0_AVX)
+            {
+                features |= FEATURE_AVX2;
+
+                if ((regs[1] & CPUID_7_EBX_AVX512F) &&
+                    (xcr0 & XCR0_AVX512) == XCR0_AVX512)
+                {
+                    features |= FEATURE_AVX512;
+                }
+            }
+        }
+
+        _features = features;
+    }
+
+    return _features;
+}
+
+bool myst_sha256_x86_supported(void)
+{
+    return (_get_features() & FEATURE_SHA) != 0;
+}
+
+bool myst_sha256_x86_lanes_supported(void)
+{
+    return (_get_features() & FEATURE_AVX2) != 0;
+}
+
+bool myst_sha256_x86_avx512_supported(void)
+{
+    return (_get_features() & FEATURE_AVX512) != 0;
+}
+
+/*
+**==============================================================================
+**
+** SHA-NI
+**
+**==============================================================================
+*/
+
+static inline v4_t _load(const void* p)
+{
+    v4_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void _store(void* p, v4_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+/* Two rounds on the state (the round inputs are implicitly in xmm0) */
+#define ROUNDS2(STATE, OTHER, MSG)        \
+    __asm__("sha256rnds2 %2, %1, %0"      \
+            : "+x"(STATE)                 \
+            : "x"(OTHER), "Yz"(MSG))
+
+#define SHA_OP(OP, A, B) __asm__(OP " %1, %0" : "+x"(A) : "x"(B))
+
+#define SHUFFLE(OUT, IN, IMM) \
+    __asm__("pshufd %2, %1, %0" : "=x"(OUT) : "x"(IN), "i"(IMM))
+
+#define ALIGNR(A, B, IMM) \
+    __asm__("palignr %2, %1, %0" : "+x"(A) : "x"(B), "i"(IMM))
+
+#define BLEND(A, B, IMM) \
+    __asm__("pblendw %2, %1, %0" : "+x"(A) : "x"(B), "i"(IMM))
+
+#define BSWAP(A, MASK) __asm__("pshufb %1, %0" : "+x"(A) : "x"(MASK))
+
+void myst_sha256_x86_compress(
+    uint32_t state[8],
+    const void* blocks,
+    size_t nblocks)
+{
+    /* byte-swaps each 32-bit word (for pshufb) */
+    const v4_t mask = {0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f};
+    const uint8_t* p = blocks;
+    v4_t tmp = _load(&state[0]);    /* DCBA */
+    v4_t state1 = _load(&state[4]); /* HGFE */
+    v4_t state0;
+
+    SHUFFLE(tmp, tmp, 0xb1);       /* CDAB */
+    SHUFFLE(state1, state1, 0x1b); /* EFGH */
+    state0 = tmp;
+    ALIGNR(state0, state1, 8);  /* ABEF */
+    BLEND(state1, tmp, 0xf0);   /* CDGH */
+
+    for (; nblocks; nblocks--, p += BLOCK_SIZE)
+    {
+        const v4_t abef = state0;
+        const v4_t cdgh = state1;
+        v4_t w[4];
+
+        for (size_t i = 0; i < 4; i++)
+        {
+            w[i] = _load(p + i * sizeof(v4_t));
+            BSWAP(w[i], mask);
+        }
+
+        /* each group of four words replaces the one four groups back */
+#pragma GCC unroll 16
+        for (size_t g = 0; g < 16; g++)
+        {
+            v4_t msg;
+
+            if (g >= 4)
+            {
+                v4_t w7 = w[(g + 3) % 4];
+
+                ALIGNR(w7, w[(g + 2) % 4], 4);
+                SHA_OP("sha256msg1", w[g % 4], w[(g + 1) % 4]);
+                w[g % 4] += w7;
+                SHA_OP("sha256msg2", w[g % 4], w[(g + 3) % 4]);
+            }
+
+            msg = w[g % 4] + _load(&_k[g * 4]);
+            ROUNDS2(state1, state0, msg);
+            SHUFFLE(msg, msg, 0x0e);
+            ROUNDS2(state0, state1, msg);
+        }
+
+        state0 += abef;
+        state1 += cdgh;
+    }
+
+    SHUFFLE(tmp, state0, 0x1b);    /* FEBA */
+    SHUFFLE(state1, state1, 0xb1); /* DCHG */
+    state0 = tmp;
+    BLEND(state0, state1, 0xf0); /* DCBA */
+    ALIGNR(state1, tmp, 8);      /* HGFE */
+
+    _store(&state[0], state0);
+    _store(&state[4], state1);
+}
+
+/*
+**==============================================================================
+**
+** Multi-buffer
+**
+**==============================================================================
+*/
+
+#define ROTR(X, N) (((X) >> (N)) | ((X) << (32 - (N))))
+
+static inline uint32_t _load_be32(const uint8_t* p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return __builtin_bswap32(x);
+}
+
+/* Define a function that compresses one block of each of N lanes, with the
+ * vector type V (of N words) for the given target. AVX2 has only sixteen
+ * ymm registers, which just hold the state of eight lanes, so it runs two
+ * passes of eight lanes rather than one of sixteen */
+#define DEFINE_COMPRESS_LANES(NAME, TARGET, V, N)                            \
+    __attribute__((target(TARGET))) static void NAME(                        \
+        uint32_t state[][8], const void* const blocks[])                     \
+    {                                                                        \
+        V s[8];                                                              \
+        V w[16];                                                             \
+        uint32_t words[N];                                                   \
+                                                                             \
+        for (size_t i = 0; i < 8; i++)                                       \
+        {                                                                    \
+            for (size_t l = 0; l < N; l++)                                   \
+                words[l] = state[l][i];                                      \
+            memcpy(&s[i], words, sizeof(words));                             \
+        }                                                                    \
+                                                                             \
+        for (size_t i = 0; i < 16; i++)                                      \
+        {                                                                    \
+            for (size_t l = 0; l < N; l++)                                   \
+                words[l] = _load_be32((const uint8_t*)blocks[l] + i * 4);    \
+            memcpy(&w[i], words, sizeof(words));                             \
+        }                                                                    \
+                                                                             \
+        V a = s[0], b = s[1], c = s[2], d = s[3];                            \
+        V e = s[4], f = s[5], g = s[6], h = s[7];                            \
+                                                                             \
+        for (size_t t = 0; t < 64; t++)                                      \
+        {                                                                    \
+            if (t >= 16)                                                     \
+            {                                                                \
+                const V w15 = w[(t - 15) % 16];                              \
+                const V w2 = w[(t - 2) % 16];                                \
+                const V s0 = ROTR(w15, 7) ^ ROTR(w15, 18) ^ (w15 >> 3);      \
+                const V s1 = ROTR(w2, 17) ^ ROTR(w2, 19) ^ (w2 >> 10);       \
+                w[t % 16] += s0 + w[(t - 7) % 16] + s1;                      \
+            }                                                                \
+                                                                             \
+            const V t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +      \
+                         (g ^ (e & (f ^ g))) + _k[t] + w[t % 16];            \
+            const V t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +          \
+                         ((a & b) | (c & (a | b)));                          \
+            h = g;                                                           \
+            g = f;                                                           \
+            f = e;                                                           \
+            e = d + t1;                                                      \
+            d = c;                                                           \
+            c = b;                                                           \
+            b = a;                                                           \
+            a = t1 + t2;                                                     \
+        }                                                                    \
+                                                                             \
+        s[0] += a;                                                           \
+        s[1] += b;                                                           \
+        s[2] += c;                                                           \
+        s[3] += d;                                                           \
+        s[4] += e;                                                           \
+        s[5] += f;                                                           \
+        s[6] += g;                                                           \
+        s[7] += h;                                                           \
+                                                                             \
+        for (size_t i = 0; i < 8; i++)                                       \
+        {                                                                    \
+            memcpy(words, &s[i], sizeof(words));                             \
+            for (size_t l = 0; l < N; l++)                                   \
+                state[l][i] = words[l];                                      \
+        }                                                                    \
+    }
+
+typedef uint32_t v8_t __attribute__((vector_size(32)));
+typedef uint32_t v16_t __attribute__((vector_size(64)));
+
+DEFINE_COMPRESS_LANES(_compress_lanes_avx2, "avx2", v8_t, 8)
+DEFINE_COMPRESS_LANES(_compress_lanes_avx512, "avx512f", v16_t, 16)
+
+void myst_sha256_x86_compress_lanes(
+    uint32_t state[LANES][8],
+    const void* const blocks[LANES])
+{
+    if (myst_sha256_x86_avx512_supported())
+    {
+        _compress_lanes_avx512(state, blocks);
+    }
+    else
+    {
+        _compress_lanes_avx2(state, blocks);
+        _compress_lanes_avx2(state + LANES / 2, blocks + LANES / 2);
+    }
+}
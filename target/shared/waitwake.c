@@ -5,6 +5,7 @@
 #include <linux/futex.h>
 #include <myst/eraise.h>
 #include <myst/thread.h>
+#include <myst/waitwake.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/syscall.h>
@@ -41,12 +42,39 @@ long myst_tcall_wake(uint64_t event)
     long ret = 0;
     volatile int* uaddr = (volatile int*)event;
 
-    if (__sync_fetch_and_add(uaddr, 1) != 0)
+    /* a waiter that is still spinning needs no futex wake */
+    for (;;)
     {
-        ret = syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        int v = -1;
 
-        if (ret != 0)
-            ret = -errno;
+        if (!myst_event_post(uaddr))
+            return 0;
+
+        /* change -1 to 0 unless the sleeper timed out meanwhile */
+        if (__atomic_compare_exchange_n(
+                uaddr, &v, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+
+    /* FUTEX_WAKE returns the number of waiters woken */
+    if (syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0) < 0)
+        ret = -errno;
+
+    return ret;
+}
+
+long myst_tcall_wake_many(const uint64_t* events, size_t count)
+{
+    long ret = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        long r = myst_tcall_wake(events[i]);
+
+        if (r != 0 && ret == 0)
+            ret = r;
     }
 
     return ret;
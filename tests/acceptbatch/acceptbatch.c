@@ -0,0 +1,133 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define PORT 12347
+#define NCLIENTS 8
+
+int main(int argc, const char* argv[])
+{
+    struct sockaddr_in addr;
+    int clients[NCLIENTS];
+    int lsock;
+    int epfd;
+    struct epoll_event ev = {.events = EPOLLIN};
+    struct epoll_event out;
+    size_t naccepted = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert((lsock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) >= 0);
+    assert(bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert(listen(lsock, NCLIENTS) == 0);
+
+    /* nothing is pending yet */
+    {
+        struct sockaddr_in peer;
+        socklen_t peerlen = sizeof(peer);
+
+        assert(accept(lsock, (struct sockaddr*)&peer, &peerlen) == -1);
+        assert(errno == EAGAIN);
+    }
+
+    /* loopback connects complete in the listen backlog */
+    for (size_t i = 0; i < NCLIENTS; i++)
+    {
+        assert((clients[i] = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+        assert(connect(clients[i], (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    }
+
+    assert((epfd = epoll_create1(0)) >= 0);
+    ev.data.fd = lsock;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, lsock, &ev) == 0);
+
+    /* drain the listener as an event loop would; the first accept takes all
+     * pending connections from the host and the others are queued */
+    while (naccepted < NCLIENTS)
+    {
+        struct sockaddr_in peer;
+        socklen_t peerlen = sizeof(peer);
+        struct pollfd pfd = {.fd = lsock, .events = POLLIN};
+        int sock;
+        int flags;
+
+        assert(epoll_wait(epfd, &out, 1, 1000) == 1);
+        assert(out.data.fd == lsock);
+        assert(poll(&pfd, 1, 0) == 1 && pfd.revents == POLLIN);
+
+        sock = accept4(
+            lsock, (struct sockaddr*)&peer, &peerlen, SOCK_NONBLOCK);
+        assert(sock >= 0);
+        assert(peerlen == sizeof(peer));
+        assert(peer.sin_family == AF_INET);
+        assert(peer.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+
+        /* the flags of this call apply even to a queued connection */
+        assert((flags = fcntl(sock, F_GETFL)) >= 0);
+        assert(flags & O_NONBLOCK);
+
+        /* the connection works */
+        assert(write(clients[naccepted], "x", 1) == 1);
+        {
+            char c;
+            struct pollfd spfd = {.fd = sock, .events = POLLIN};
+
+            assert(poll(&spfd, 1, 1000) == 1);
+            assert(read(sock, &c, 1) == 1 && c == 'x');
+        }
+
+        assert(close(sock) == 0);
+        naccepted++;
+    }
+
+    /* all connections were accepted */
+    assert(accept(lsock, NULL, NULL) == -1);
+    assert(errno == EAGAIN);
+    assert(epoll_wait(epfd, &out, 1, 0) == 0);
+
+    /* connections still queued when the listener closes are closed too */
+    {
+        int sock;
+        char c;
+
+        assert((sock = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+        assert(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        assert((clients[0] = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+        assert(connect(clients[0], (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        assert(epoll_wait(epfd, &out, 1, 1000) == 1);
+        assert(close(accept(lsock, NULL, NULL)) == 0);
+        assert(close(lsock) == 0);
+        assert(read(sock, &c, 1) == 0);
+
+        {
+            struct pollfd pfd = {.fd = clients[0], .events = POLLIN};
+            assert(poll(&pfd, 1, 1000) == 1);
+        }
+
+        assert(close(sock) == 0);
+    }
+
+    for (size_t i = 0; i < NCLIENTS; i++)
+        assert(close(clients[i]) == 0);
+
+    assert(close(epfd) == 0);
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
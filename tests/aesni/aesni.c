@@ -0,0 +1,279 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <mbedtls/cipher.h>
+#include <mbedtls/gcm.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <myst/aesni.h>
+#include <myst/gcm.h>
+#include <myst/luks.h>
+
+#define SECTORS 256
+#define DATA_SIZE (SECTORS * LUKS_SECTOR_SIZE)
+
+typedef struct cipher_mode
+{
+    const char* name;
+    uint32_t key_bytes;
+    mbedtls_cipher_type_t type;
+    size_t unit;     /* bytes encrypted with each iv */
+    size_t iv_bytes; /* bytes of the sector number in the iv */
+} cipher_mode_t;
+
+static const cipher_mode_t _modes[] = {
+    {"xts-plain64", 32, MBEDTLS_CIPHER_AES_128_XTS, LUKS_SECTOR_SIZE, 8},
+    {"xts-plain64", 64, MBEDTLS_CIPHER_AES_256_XTS, LUKS_SECTOR_SIZE, 8},
+    {"cbc-plain", 16, MBEDTLS_CIPHER_AES_128_CBC, LUKS_SECTOR_SIZE, 4},
+    {"cbc-plain", 32, MBEDTLS_CIPHER_AES_256_CBC, LUKS_SECTOR_SIZE, 4},
+    {"xts-plain64", 64, MBEDTLS_CIPHER_AES_256_XTS, LUKS_MAX_SECTOR_SIZE, 8},
+    {"cbc-plain", 32, MBEDTLS_CIPHER_AES_256_CBC, LUKS_MAX_SECTOR_SIZE, 4},
+    {"ecb", 16, MBEDTLS_CIPHER_AES_128_ECB, 16, 0},
+    {"ecb", 32, MBEDTLS_CIPHER_AES_256_ECB, 16, 0},
+};
+
+static uint8_t _plain[DATA_SIZE];
+static uint8_t _cipher[DATA_SIZE];
+static uint8_t _out[DATA_SIZE];
+
+/* Encrypt or decrypt with mbedtls alone (as luks.c does without AES-NI) */
+static void _mbedtls_crypt(
+    const cipher_mode_t* mode,
+    const uint8_t* key,
+    mbedtls_operation_t op,
+    const uint8_t* in,
+    uint8_t* out)
+{
+    mbedtls_cipher_context_t ctx;
+    const mbedtls_cipher_info_t* info;
+    const size_t unit = mode->unit;
+    const int key_bits = (int)mode->key_bytes * 8;
+    int r;
+
+    mbedtls_cipher_init(&ctx);
+    info = mbedtls_cipher_info_from_type(mode->type);
+    assert(mbedtls_cipher_setup(&ctx, info) == 0);
+    assert(mbedtls_cipher_setkey(&ctx, key, key_bits, op) == 0);
+
+    if (mode->iv_bytes == 4)
+    {
+        r = mbedtls_cipher_set_padding_mode(&ctx, MBEDTLS_PADDING_NONE);
+        assert(r == 0);
+    }
+
+    for (size_t i = 0; i < DATA_SIZE / unit; i++)
+    {
+        uint8_t iv[16] = {0};
+        const uint64_t sector = i;
+        size_t olen;
+
+        memcpy(iv, &sector, mode->iv_bytes);
+
+        r = mbedtls_cipher_crypt(
+            &ctx, iv, sizeof(iv), in + i * unit, unit, out + i * unit, &olen);
+        assert(r == 0 && olen == unit);
+    }
+
+    mbedtls_cipher_free(&ctx);
+}
+
+static void _init_phdr(luks_phdr_t* phdr, const cipher_mode_t* mode)
+{
+    memset(phdr, 0, sizeof(luks_phdr_t));
+    strcpy(phdr->cipher_name, "aes");
+    strcpy(phdr->cipher_mode, mode->name);
+    phdr->key_bytes = mode->key_bytes;
+
+    /* the sectors are larger than the unit of ECB */
+    if (mode->unit >= LUKS_SECTOR_SIZE)
+        phdr->sector_size = (uint32_t)mode->unit;
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void test_mode(const cipher_mode_t* mode)
+{
+    luks_phdr_t phdr;
+    uint8_t key[64];
+    size_t sector_size = mode->unit;
+
+    if (sector_size < LUKS_SECTOR_SIZE)
+        sector_size = LUKS_SECTOR_SIZE;
+
+    _init_phdr(&phdr, mode);
+
+    for (size_t i = 0; i < sizeof(key); i++)
+        key[i] = (uint8_t)rand();
+
+    for (size_t i = 0; i < DATA_SIZE; i++)
+        _plain[i] = (uint8_t)rand();
+
+    /* luks.c must agree with mbedtls in both directions */
+    _mbedtls_crypt(mode, key, MBEDTLS_ENCRYPT, _plain, _cipher);
+
+    assert(myst_luks_encrypt(&phdr, key, _plain, _out, DATA_SIZE, 0) == 0);
+    assert(memcmp(_out, _cipher, DATA_SIZE) == 0);
+
+    assert(myst_luks_decrypt(&phdr, key, _cipher, _out, DATA_SIZE, 0) == 0);
+    assert(memcmp(_out, _plain, DATA_SIZE) == 0);
+
+    /* short runs with a later first sector */
+    assert(
+        myst_luks_decrypt(
+            &phdr,
+            key,
+            _cipher + 3 * sector_size,
+            _out,
+            sector_size,
+            3) == 0);
+    assert(memcmp(_out, _plain + 3 * sector_size, sector_size) == 0);
+
+    /* part of a sector is not decrypted */
+    if (sector_size > LUKS_SECTOR_SIZE)
+    {
+        assert(
+            myst_luks_decrypt(
+                &phdr, key, _cipher, _out, LUKS_SECTOR_SIZE, 0) != 0);
+    }
+}
+
+/* gcm.c must agree with mbedtls for any size and any split of the input */
+void test_gcm(size_t key_size)
+{
+    uint8_t key[32];
+    myst_gcm_t* gcm;
+    mbedtls_gcm_context ctx;
+
+    for (size_t i = 0; i < sizeof(key); i++)
+        key[i] = (uint8_t)rand();
+
+    assert(myst_gcm_new(key, key_size, &gcm) == 0);
+    mbedtls_gcm_init(&ctx);
+    assert(
+        mbedtls_gcm_setkey(
+            &ctx, MBEDTLS_CIPHER_ID_AES, key, (unsigned int)key_size * 8) ==
+        0);
+
+    for (size_t round = 0; round < 200; round++)
+    {
+        const size_t size = (size_t)rand() % 5000;
+        const size_t split = size ? (size_t)rand() % size : 0;
+        const struct iovec iov[] = {
+            {_plain, split}, {NULL, 0}, {_plain + split, size - split}};
+        myst_gcm_auth_t auth;
+        uint8_t tag[MYST_GCM_TAG_SIZE];
+
+        for (size_t i = 0; i < size; i++)
+            _plain[i] = (uint8_t)rand();
+
+        for (size_t i = 0; i < sizeof(auth.iv); i++)
+            auth.iv[i] = (uint8_t)rand();
+
+        for (size_t i = 0; i < sizeof(auth.aad); i++)
+            auth.aad[i] = (uint8_t)rand();
+
+        auth.aad_size = (size_t)rand() % (MYST_GCM_MAX_AAD_SIZE + 1);
+
+        assert(
+            mbedtls_gcm_crypt_and_tag(
+                &ctx,
+                MBEDTLS_GCM_ENCRYPT,
+                size,
+                auth.iv,
+                sizeof(auth.iv),
+                auth.aad,
+                auth.aad_size,
+                _plain,
+                _cipher,
+                sizeof(tag),
+                tag) == 0);
+
+        assert(myst_gcm_seal(gcm, &auth, iov, 3, _out) == 0);
+        assert(memcmp(_out, _cipher, size) == 0);
+        assert(memcmp(_out + size, tag, sizeof(tag)) == 0);
+
+        /* in place */
+        assert(myst_gcm_open(gcm, &auth, _out, _out, size) == 0);
+        assert(memcmp(_out, _plain, size) == 0);
+
+        /* a changed byte fails */
+        _cipher[size] = tag[0] ^ 1;
+        memcpy(_cipher + size + 1, tag + 1, sizeof(tag) - 1);
+        assert(myst_gcm_open(gcm, &auth, _cipher, _out, size) == -EBADMSG);
+    }
+
+    mbedtls_gcm_free(&ctx);
+    assert(myst_gcm_free(gcm) == 0);
+}
+
+void bench_mode(const cipher_mode_t* mode)
+{
+    const size_t passes = 64;
+    luks_phdr_t phdr;
+    uint8_t key[64] = {1};
+    double t;
+    double mbedtls_mbs;
+    double luks_mbs;
+
+    _init_phdr(&phdr, mode);
+
+    t = _now();
+
+    for (size_t i = 0; i < passes; i++)
+        _mbedtls_crypt(mode, key, MBEDTLS_DECRYPT, _cipher, _out);
+
+    mbedtls_mbs = (double)(passes * DATA_SIZE) / (_now() - t) / 1e6;
+
+    t = _now();
+
+    for (size_t i = 0; i < passes; i++)
+        myst_luks_decrypt(&phdr, key, _cipher, _out, DATA_SIZE, 0);
+
+    luks_mbs = (double)(passes * DATA_SIZE) / (_now() - t) / 1e6;
+
+    printf(
+        "%-12s %3u-bit decrypt: mbedtls %8.1f MB/s, luks %8.1f MB/s\n",
+        mode->name,
+        mode->key_bytes * 8,
+        mbedtls_mbs,
+        luks_mbs);
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t n = sizeof(_modes) / sizeof(_modes[0]);
+
+    printf(
+        "AES-NI: %s, VAES: %s\n",
+        myst_aesni_supported() ? "yes" : "no",
+        myst_aesni_vaes_supported() ? "yes" : "no");
+
+    for (size_t i = 0; i < n; i++)
+        test_mode(&_modes[i]);
+
+    printf("GCM: %s\n", myst_aesni_gcm_supported() ? "AES-NI" : "mbedtls");
+    test_gcm(16);
+    test_gcm(32);
+
+    if (argc == 2 && strcmp(argv[1], "--bench") == 0)
+    {
+        for (size_t i = 0; i < n; i++)
+            bench_mode(&_modes[i]);
+    }
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
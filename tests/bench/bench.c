@@ -0,0 +1,727 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+**==============================================================================
+**
+** Microbenchmarks of the paths that Mystikos adds cost to: syscalls, host
+** wakes, pipes, epoll, memory mapping, the file systems, loopback sockets
+** and threads. The same binary runs natively, under "myst exec-linux" and
+** under "myst exec-sgx" (see "make bench"). The results go to stdout as one
+** JSON object:
+**
+**     {
+**         "target": "sgx",
+**         "fs": "ramfs",
+**         "results": [
+**             { "name": "getpid", "ops": 1000000, "ns_per_op": 12.3 },
+**             { "name": "pipe_write", ..., "mb_per_sec": 812.0 },
+**             ...
+**         ]
+**     }
+**
+** Options:
+**
+**     --target=NAME -- the label of the "target" field
+**     --fs=NAME -- the label of the "fs" field
+**     --dir=PATH -- where the file system benchmarks create files (/tmp)
+**     --only=fs -- run only the file system benchmarks
+**     --quick -- run 1/100 of the iterations (a functional check)
+**
+**==============================================================================
+*/
+
+#define MB (1024 * 1024)
+
+static size_t _scale = 100;
+static const char* _target = "native";
+static const char* _fs = "ramfs";
+static const char* _dir = "/tmp";
+static size_t _nresults;
+
+static uint64_t _nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+/* the iterations for a benchmark whose full run does N */
+static size_t _iters(size_t n)
+{
+    size_t r = n * _scale / 100;
+    return r ? r : 1;
+}
+
+/* Print one result; BYTES is the data moved, if any */
+static void _report(const char* name, size_t ops, uint64_t nsec, size_t bytes)
+{
+    printf(
+        "%s\n        { \"name\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.1f",
+        _nresults++ ? "," : "",
+        name,
+        ops,
+        (double)nsec / (double)ops);
+
+    if (bytes)
+    {
+        double secs = (double)nsec / 1e9;
+        printf(", \"mb_per_sec\": %.1f", (double)bytes / MB / secs);
+    }
+
+    printf(" }");
+    fflush(stdout);
+}
+
+/*
+**==============================================================================
+**
+** syscalls
+**
+**==============================================================================
+*/
+
+static void _bench_syscalls(void)
+{
+    struct timespec ts;
+    size_t n = _iters(1000000);
+    uint64_t start;
+
+    /* a syscall with no fast path: the full dispatch and nothing more */
+    start = _nsec();
+    for (size_t i = 0; i < n; i++)
+        syscall(SYS_umask, 022);
+    _report("null_syscall", n, _nsec() - start, 0);
+
+    start = _nsec();
+    for (size_t i = 0; i < n; i++)
+        syscall(SYS_getpid);
+    _report("getpid", n, _nsec() - start, 0);
+
+    start = _nsec();
+    for (size_t i = 0; i < n; i++)
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    _report("clock_gettime", n, _nsec() - start, 0);
+}
+
+/*
+**==============================================================================
+**
+** futex ping-pong and mutex contention
+**
+**==============================================================================
+*/
+
+static int _futex(volatile int* uaddr, int op, int val)
+{
+    return (int)syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static volatile int _turn;
+static size_t _rounds;
+
+/* wait for the turn to become WHO and then pass it to the other thread */
+static void _ping_pong(int who)
+{
+    for (size_t i = 0; i < _rounds; i++)
+    {
+        while (__atomic_load_n(&_turn, __ATOMIC_ACQUIRE) != who)
+            _futex(&_turn, FUTEX_WAIT_PRIVATE, !who);
+
+        __atomic_store_n(&_turn, !who, __ATOMIC_RELEASE);
+        _futex(&_turn, FUTEX_WAKE_PRIVATE, 1);
+    }
+}
+
+static void* _pong_thread(void* arg)
+{
+    (void)arg;
+    _ping_pong(1);
+    return NULL;
+}
+
+static void _bench_futex(void)
+{
+    pthread_t t;
+    uint64_t start;
+
+    _turn = 0;
+    _rounds = _iters(20000);
+
+    start = _nsec();
+    assert(pthread_create(&t, NULL, _pong_thread, NULL) == 0);
+    _ping_pong(0);
+    assert(pthread_join(t, NULL) == 0);
+    _report("futex_ping_pong", _rounds, _nsec() - start, 0);
+}
+
+#define MUTEX_THREADS 4
+
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t _counter;
+
+static void* _mutex_thread(void* arg)
+{
+    size_t n = (size_t)arg;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        pthread_mutex_lock(&_mutex);
+        _counter++;
+        pthread_mutex_unlock(&_mutex);
+    }
+
+    return NULL;
+}
+
+static void _bench_mutex(void)
+{
+    pthread_t t[MUTEX_THREADS];
+    size_t n = _iters(200000);
+    uint64_t start;
+
+    _counter = 0;
+    start = _nsec();
+
+    for (size_t i = 0; i < MUTEX_THREADS; i++)
+        assert(pthread_create(&t[i], NULL, _mutex_thread, (void*)n) == 0);
+
+    for (size_t i = 0; i < MUTEX_THREADS; i++)
+        assert(pthread_join(t[i], NULL) == 0);
+
+    assert(_counter == n * MUTEX_THREADS);
+    _report("mutex_contention", n * MUTEX_THREADS, _nsec() - start, 0);
+}
+
+/*
+**==============================================================================
+**
+** pipes and epoll
+**
+**==============================================================================
+*/
+
+#define PIPE_CHUNK 65536
+
+typedef struct stream
+{
+    int fd;
+    size_t bytes;
+} stream_t;
+
+/* read BYTES from FD until the writer is done */
+static void* _drain_thread(void* arg)
+{
+    stream_t* s = (stream_t*)arg;
+    static char buf[PIPE_CHUNK];
+    size_t total = 0;
+
+    while (total < s->bytes)
+    {
+        ssize_t n = read(s->fd, buf, sizeof(buf));
+        assert(n > 0);
+        total += (size_t)n;
+    }
+
+    return NULL;
+}
+
+/* write BYTES to FD while another thread drains it */
+static uint64_t _stream(int wfd, int rfd, size_t bytes)
+{
+    static char buf[PIPE_CHUNK];
+    stream_t s = {rfd, bytes};
+    pthread_t t;
+    uint64_t start = _nsec();
+
+    assert(pthread_create(&t, NULL, _drain_thread, &s) == 0);
+
+    for (size_t total = 0; total < bytes;)
+    {
+        size_t r = bytes - total;
+        ssize_t n = write(wfd, buf, r < sizeof(buf) ? r : sizeof(buf));
+        assert(n > 0);
+        total += (size_t)n;
+    }
+
+    assert(pthread_join(t, NULL) == 0);
+    return _nsec() - start;
+}
+
+/* echo a byte from RFD to WFD ROUNDS times */
+typedef struct echo
+{
+    int rfd;
+    int wfd;
+    size_t rounds;
+} echo_t;
+
+static void* _echo_thread(void* arg)
+{
+    echo_t* e = (echo_t*)arg;
+    char c;
+
+    for (size_t i = 0; i < e->rounds; i++)
+    {
+        assert(read(e->rfd, &c, 1) == 1);
+        assert(write(e->wfd, &c, 1) == 1);
+    }
+
+    return NULL;
+}
+
+/* send a byte on WFD and wait for it on RFD, ROUNDS times */
+static uint64_t _round_trips(int wfd, int rfd, echo_t* e)
+{
+    pthread_t t;
+    char c = 'x';
+    uint64_t start = _nsec();
+
+    assert(pthread_create(&t, NULL, _echo_thread, e) == 0);
+
+    for (size_t i = 0; i < e->rounds; i++)
+    {
+        assert(write(wfd, &c, 1) == 1);
+        assert(read(rfd, &c, 1) == 1);
+    }
+
+    assert(pthread_join(t, NULL) == 0);
+    return _nsec() - start;
+}
+
+static void _bench_pipes(void)
+{
+    int p[2];
+    int q[2];
+    size_t bytes = _iters(256) * MB;
+    echo_t e;
+
+    assert(pipe(p) == 0);
+    _report(
+        "pipe_throughput",
+        bytes / PIPE_CHUNK,
+        _stream(p[1], p[0], bytes),
+        bytes);
+
+    assert(pipe(q) == 0);
+    e.rfd = p[0];
+    e.wfd = q[1];
+    e.rounds = _iters(20000);
+    _report("pipe_latency", e.rounds, _round_trips(p[1], q[0], &e), 0);
+
+    close(p[0]);
+    close(p[1]);
+    close(q[0]);
+    close(q[1]);
+}
+
+#define EPOLL_FDS 64
+
+static void _bench_epoll(void)
+{
+    int pipes[EPOLL_FDS][2];
+    struct epoll_event ev;
+    size_t n = _iters(100000);
+    uint64_t start;
+    int epfd;
+
+    assert((epfd = epoll_create1(0)) >= 0);
+
+    for (int i = 0; i < EPOLL_FDS; i++)
+    {
+        assert(pipe(pipes[i]) == 0);
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)i;
+        assert(epoll_ctl(epfd, EPOLL_CTL_ADD, pipes[i][0], &ev) == 0);
+    }
+
+    /* make one fd ready at a time, find it and drain it */
+    start = _nsec();
+    for (size_t i = 0; i < n; i++)
+    {
+        const int k = (int)(i % EPOLL_FDS);
+        char c = 'x';
+
+        assert(write(pipes[k][1], &c, 1) == 1);
+        assert(epoll_wait(epfd, &ev, 1, -1) == 1);
+        assert(ev.data.u32 == (uint32_t)k);
+        assert(read(pipes[k][0], &c, 1) == 1);
+    }
+    _report("epoll_64_fds", n, _nsec() - start, 0);
+
+    for (int i = 0; i < EPOLL_FDS; i++)
+    {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+
+    close(epfd);
+}
+
+/*
+**==============================================================================
+**
+** memory
+**
+**==============================================================================
+*/
+
+static void _bench_mmap(void)
+{
+    const size_t length = 16 * 4096;
+    size_t n = _iters(100000);
+    uint64_t start = _nsec();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const int prot = PROT_READ | PROT_WRITE;
+        const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        char* p = mmap(NULL, length, prot, flags, -1, 0);
+
+        assert(p != MAP_FAILED);
+        p[0] = 1;
+        p[length - 1] = 1;
+        assert(munmap(p, length) == 0);
+    }
+
+    _report("mmap_munmap_64k", n, _nsec() - start, 0);
+}
+
+#define MALLOC_BATCH 64
+
+static void _bench_malloc(void)
+{
+    static const size_t sizes[] = {16, 256, 4096, 65536, MB};
+
+    for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+    {
+        void* ptrs[MALLOC_BATCH];
+        size_t n = _iters(sizes[j] >= 65536 ? 2000 : 20000);
+        char name[32];
+        uint64_t start = _nsec();
+
+        /* keep a batch live so that free() does not just undo malloc() */
+        for (size_t i = 0; i < n; i++)
+        {
+            for (size_t k = 0; k < MALLOC_BATCH; k++)
+            {
+                assert((ptrs[k] = malloc(sizes[j])));
+                *(char*)ptrs[k] = 1;
+            }
+
+            for (size_t k = 0; k < MALLOC_BATCH; k++)
+                free(ptrs[k]);
+        }
+
+        snprintf(name, sizeof(name), "malloc_free_%zu", sizes[j]);
+        _report(name, n * MALLOC_BATCH, _nsec() - start, 0);
+    }
+}
+
+/*
+**==============================================================================
+**
+** file systems
+**
+**==============================================================================
+*/
+
+#define FILE_CHUNK 4096
+
+static void _bench_fs(void)
+{
+    static char buf[FILE_CHUNK];
+    char path[PATH_MAX];
+    char name[64];
+    size_t bytes = _iters(64) * MB;
+    size_t n = bytes / FILE_CHUNK;
+    size_t nstat = _iters(100000);
+    struct stat st;
+    uint64_t start;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/bench.%d", _dir, getpid());
+    memset(buf, 'x', sizeof(buf));
+
+    start = _nsec();
+    assert((fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0666)) >= 0);
+    for (size_t i = 0; i < n; i++)
+        assert(write(fd, buf, sizeof(buf)) == sizeof(buf));
+    assert(close(fd) == 0);
+    snprintf(name, sizeof(name), "%s_write_4k", _fs);
+    _report(name, n, _nsec() - start, bytes);
+
+    start = _nsec();
+    assert((fd = open(path, O_RDONLY)) >= 0);
+    for (size_t i = 0; i < n; i++)
+        assert(read(fd, buf, sizeof(buf)) == sizeof(buf));
+    assert(close(fd) == 0);
+    snprintf(name, sizeof(name), "%s_read_4k", _fs);
+    _report(name, n, _nsec() - start, bytes);
+
+    start = _nsec();
+    for (size_t i = 0; i < nstat; i++)
+        assert(stat(path, &st) == 0);
+    snprintf(name, sizeof(name), "%s_stat", _fs);
+    _report(name, nstat, _nsec() - start, 0);
+
+    assert(unlink(path) == 0);
+}
+
+/*
+**==============================================================================
+**
+** loopback sockets
+**
+**==============================================================================
+*/
+
+/* connect a pair of TCP sockets over 127.0.0.1 */
+static void _tcp_pair(int fds[2])
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    const int one = 1;
+    int lfd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert((lfd = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert(listen(lfd, 1) == 0);
+    assert(getsockname(lfd, (struct sockaddr*)&addr, &len) == 0);
+
+    assert((fds[0] = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(connect(fds[0], (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert((fds[1] = accept(lfd, NULL, NULL)) >= 0);
+    close(lfd);
+
+    for (int i = 0; i < 2; i++)
+    {
+        int r = setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        assert(r == 0);
+    }
+}
+
+static void _bench_sockets(void)
+{
+    int fds[2];
+    size_t bytes = _iters(256) * MB;
+    echo_t e;
+
+    _tcp_pair(fds);
+
+    _report(
+        "tcp_loopback_throughput",
+        bytes / PIPE_CHUNK,
+        _stream(fds[0], fds[1], bytes),
+        bytes);
+
+    e.rfd = fds[1];
+    e.wfd = fds[1];
+    e.rounds = _iters(20000);
+    _report(
+        "tcp_loopback_latency",
+        e.rounds,
+        _round_trips(fds[0], fds[0], &e),
+        0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/*
+**==============================================================================
+**
+** threads
+**
+**==============================================================================
+*/
+
+static void* _null_thread(void* arg)
+{
+    return arg;
+}
+
+static void _bench_threads(void)
+{
+    size_t n = _iters(2000);
+    uint64_t start = _nsec();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        pthread_t t;
+        assert(pthread_create(&t, NULL, _null_thread, NULL) == 0);
+        assert(pthread_join(t, NULL) == 0);
+    }
+
+    _report("thread_create_join", n, _nsec() - start, 0);
+}
+
+/* The MemFree of /proc/meminfo in bytes (or zero) */
+static size_t _mem_free(void)
+{
+    FILE* is;
+    char line[256];
+    size_t kb = 0;
+
+    if (!(is = fopen("/proc/meminfo", "r")))
+        return 0;
+
+    while (fgets(line, sizeof(line), is))
+    {
+        if (sscanf(line, "MemFree: %zu kB", &kb) == 1)
+            break;
+    }
+
+    fclose(is);
+    return kb * 1024;
+}
+
+static pthread_barrier_t _barrier;
+
+static void* _blocked_thread(void* arg)
+{
+    (void)arg;
+    pthread_barrier_wait(&_barrier);
+    return NULL;
+}
+
+/* The memory each of many live (blocked) threads takes, stack included */
+static void _bench_thread_memory(void)
+{
+    const size_t n = _iters(2000);
+    pthread_t* threads = calloc(n, sizeof(pthread_t));
+    pthread_attr_t attr;
+    size_t before;
+    size_t after;
+    uint64_t start;
+
+    assert(threads);
+    assert(pthread_attr_init(&attr) == 0);
+    assert(pthread_attr_setstacksize(&attr, 64 * 1024) == 0);
+    assert(pthread_barrier_init(&_barrier, NULL, (unsigned)n + 1) == 0);
+
+    before = _mem_free();
+    start = _nsec();
+
+    for (size_t i = 0; i < n; i++)
+        assert(pthread_create(&threads[i], &attr, _blocked_thread, NULL) == 0);
+
+    _report("thread_create_live", n, _nsec() - start, 0);
+    after = _mem_free();
+
+    if (before > after)
+    {
+        printf(
+            ",\n        { \"name\": \"thread_memory\", \"threads\": %zu, "
+            "\"bytes_per_thread\": %zu }",
+            n,
+            (before - after) / n);
+        _nresults++;
+    }
+
+    pthread_barrier_wait(&_barrier);
+
+    for (size_t i = 0; i < n; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    pthread_barrier_destroy(&_barrier);
+    pthread_attr_destroy(&attr);
+    free(threads);
+}
+
+/*
+**==============================================================================
+**
+** main
+**
+**==============================================================================
+*/
+
+static const char* _option(const char* arg, const char* name)
+{
+    size_t len = strlen(name);
+
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=')
+        return arg + len + 1;
+
+    return NULL;
+}
+
+int main(int argc, const char* argv[])
+{
+    bool only_fs = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* v;
+
+        if (strcmp(argv[i], "--quick") == 0)
+            _scale = 1;
+        else if ((v = _option(argv[i], "--target")))
+            _target = v;
+        else if ((v = _option(argv[i], "--fs")))
+            _fs = v;
+        else if ((v = _option(argv[i], "--dir")))
+            _dir = v;
+        else if ((v = _option(argv[i], "--only")) && strcmp(v, "fs") == 0)
+            only_fs = true;
+        else
+        {
+            fprintf(stderr, "%s: unknown option: %s\n", argv[0], argv[i]);
+            return 1;
+        }
+    }
+
+    printf("{\n    \"target\": \"%s\",\n", _target);
+    printf("    \"fs\": \"%s\",\n", _fs);
+    printf("    \"results\": [");
+
+    if (!only_fs)
+    {
+        _bench_syscalls();
+        _bench_futex();
+        _bench_mutex();
+        _bench_pipes();
+        _bench_epoll();
+        _bench_mmap();
+        _bench_malloc();
+    }
+
+    _bench_fs();
+
+    if (!only_fs)
+    {
+        _bench_sockets();
+        _bench_threads();
+        _bench_thread_memory();
+    }
+
+    printf("\n    ]\n}\n");
+
+    return 0;
+}
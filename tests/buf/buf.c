@@ -83,10 +83,64 @@ void test_basic_operations()
     free(buf.data);
 }
 
+void test_storage()
+{
+    uint8_t storage[16];
+    myst_buf_t buf;
+
+    myst_buf_init_storage(&buf, storage, sizeof(storage));
+
+    /* small contents stay in the caller's storage */
+    assert(myst_buf_append(&buf, "red ", 4) == 0);
+    assert(myst_buf_append(&buf, "green", 6) == 0);
+    assert(buf.data == storage);
+    assert(strcmp((char*)buf.data, "red green") == 0);
+
+    assert(myst_buf_resize(&buf, 0) == 0);
+    assert(buf.data == storage);
+
+    /* and move to the heap once they outgrow it */
+    assert(myst_buf_append(&buf, "red green ", 10) == 0);
+    assert(myst_buf_append(&buf, "blue", 5) == 0);
+    assert(myst_buf_append(&buf, "yellow", 7) == 0);
+    assert(buf.data != storage);
+    assert(buf.size == 22);
+    assert(strcmp((char*)buf.data, "red green blue") == 0);
+
+    myst_buf_release(&buf);
+}
+
+void test_growth()
+{
+    myst_buf_t buf = MYST_BUF_INITIALIZER;
+    size_t reallocs = 0;
+    uint8_t chunk[100];
+
+    memset(chunk, 0xab, sizeof(chunk));
+
+    /* appending a little at a time grows the capacity geometrically */
+    for (size_t i = 0; i < 4 * MYST_BUF_LARGE_SIZE; i += sizeof(chunk))
+    {
+        const size_t cap = buf.cap;
+
+        assert(myst_buf_append(&buf, chunk, sizeof(chunk)) == 0);
+
+        if (buf.cap != cap)
+            reallocs++;
+    }
+
+    assert(reallocs < 20);
+    assert(buf.cap % 4096 == 0);
+
+    myst_buf_release(&buf);
+}
+
 int main(int argc, const char* argv[])
 {
     test_basic_operations();
     test_packing();
+    test_storage();
+    test_growth();
 
     printf("=== passed test (%s)\n", argv[0]);
 
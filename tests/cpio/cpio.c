@@ -1,10 +1,12 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <myst/atexit.h>
 #include <myst/cpio.h>
@@ -199,6 +201,80 @@ void test(const void* cpio_data, size_t cpio_size, bool load_from_memory)
     myst_strarr_release(&sorted);
 }
 
+static void _check_file(const char* dir, const char* name, const char* data)
+{
+    char path[PATH_MAX];
+    void* p;
+    size_t size;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    assert(myst_load_file(path, &p, &size) == 0);
+    assert(size == strlen(data));
+    assert(memcmp(p, data, size) == 0);
+    free(p);
+}
+
+/* identical files are stored once, and unpacking gives every file back */
+void test_shared_data(bool load_from_memory)
+{
+    char template[] = "/tmp/mystXXXXXX";
+    char* tmpdir;
+    char src[PATH_MAX];
+    char dst[PATH_MAX];
+    char path[PATH_MAX];
+    const char alpha[] = "abcdefghijklmnopqrstuvwxyz";
+    const char other[] = "abcdefghijklmnopqrstuvwxyZ";
+    void* data;
+    size_t size;
+    size_t count = 0;
+
+    assert((tmpdir = mkdtemp(template)) != NULL);
+    snprintf(src, sizeof(src), "%s/src", tmpdir);
+    snprintf(dst, sizeof(dst), "%s/dst", tmpdir);
+    assert(mkdir(src, 0777) == 0);
+    assert(mkdir(dst, 0777) == 0);
+
+    const char* names[] = {"a", "b", "c"};
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", src, names[i]);
+        assert(_create_cpio_file(path, alpha, strlen(alpha)) == 0);
+    }
+
+    /* same size (and mostly the same bytes) but not identical */
+    snprintf(path, sizeof(path), "%s/d", src);
+    assert(_create_cpio_file(path, other, strlen(other)) == 0);
+
+    snprintf(path, sizeof(path), "%s/archive", tmpdir);
+    assert(myst_cpio_pack(src, path) == 0);
+    assert(myst_load_file(path, &data, &size) == 0);
+
+    /* alpha is stored once and other once */
+    for (const uint8_t* p = data; (p = memmem(
+             p, size - (p - (const uint8_t*)data), "abcdefghij", 10));
+         p++)
+    {
+        count++;
+    }
+
+    assert(count == 2);
+
+    if (load_from_memory)
+        assert(myst_cpio_mem_unpack(data, size, dst, NULL) == 0);
+    else
+        assert(myst_cpio_unpack(path, dst) == 0);
+
+    for (size_t i = 0; i < 3; i++)
+        _check_file(dst, names[i], alpha);
+
+    _check_file(dst, "d", other);
+
+    free(data);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 int main(int argc, const char* argv[])
 {
     void* data;
@@ -231,6 +307,7 @@ int main(int argc, const char* argv[])
     assert(data != NULL);
     assert(size != 0);
     test(data, size, load_from_memory);
+    test_shared_data(load_from_memory);
 
     free(data);
 
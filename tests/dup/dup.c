@@ -3,10 +3,13 @@
 
 #define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 static const char alpha[] = "abcdefghijklmnopqrstuvwxyz";
@@ -97,6 +100,66 @@ void test_dup(int version, int arg)
     fprintf(_out, "=== passed test (dup: version=%d arg=%o)\n", version, arg);
 }
 
+void test_cloexec(void)
+{
+    int fd;
+
+    fprintf(_out, "=== start test (cloexec)\n");
+
+    assert((fd = open("/tmp/file", O_RDONLY | O_CLOEXEC)) >= 0);
+    assert(fcntl(fd, F_GETFD) == FD_CLOEXEC);
+    assert(fcntl(fd, F_SETFD, 0) == 0);
+    assert(fcntl(fd, F_GETFD) == 0);
+    assert(ioctl(fd, FIOCLEX) == 0);
+    assert(fcntl(fd, F_GETFD) == FD_CLOEXEC);
+    assert(ioctl(fd, FIONCLEX) == 0);
+    assert(fcntl(fd, F_GETFD) == 0);
+    close(fd);
+
+    fprintf(_out, "=== passed test (cloexec)\n");
+}
+
+/* descriptors beyond the first 1024 and RLIMIT_NOFILE */
+void test_many_fds(void)
+{
+    const int n = 3000;
+    struct rlimit rlim = {.rlim_cur = 4096, .rlim_max = 4096};
+    int fd;
+
+    fprintf(_out, "=== start test (many fds)\n");
+
+    assert(setrlimit(RLIMIT_NOFILE, &rlim) == 0);
+
+    for (int i = 0; i < n; i++)
+        assert((fd = dup(STDERR_FILENO)) > STDERR_FILENO);
+
+    /* the lowest free descriptor is reused */
+    assert(fd >= n);
+    assert(close(2000) == 0);
+    assert(dup(STDERR_FILENO) == 2000);
+    assert(fcntl(STDERR_FILENO, F_DUPFD, 1024) == fd + 1);
+
+    /* no descriptor may reach the limit */
+    assert(dup2(STDERR_FILENO, 4096) == -1 && errno == EBADF);
+    assert(fcntl(STDERR_FILENO, F_DUPFD, 4096) == -1 && errno == EINVAL);
+    assert(dup2(STDERR_FILENO, 4095) == 4095);
+    assert(fcntl(STDERR_FILENO, F_DUPFD, 4000) == 4000);
+    assert(write(4000, "", 0) == 0);
+
+    for (int i = STDERR_FILENO + 1; i < 4096; i++)
+    {
+        if (i != fileno(_out))
+            close(i);
+    }
+
+    rlim.rlim_max = RLIM_INFINITY;
+    assert(setrlimit(RLIMIT_NOFILE, &rlim) == -1 && errno == EPERM);
+    assert(getrlimit(RLIMIT_NOFILE, &rlim) == 0);
+    assert(rlim.rlim_cur == 4096 && rlim.rlim_max == 4096);
+
+    fprintf(_out, "=== passed test (many fds)\n");
+}
+
 int main(int argc, const char* argv[])
 {
     int fd;
@@ -110,6 +173,8 @@ int main(int argc, const char* argv[])
     test_dup(3, O_CLOEXEC);
     test_dup(4, F_DUPFD);
     test_dup(4, F_DUPFD_CLOEXEC);
+    test_cloexec();
+    test_many_fds();
     close(fd);
 
     fprintf(_out, "=== passed test (%s)\n", argv[0]);
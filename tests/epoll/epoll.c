@@ -7,9 +7,11 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/epoll.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <time.h>
@@ -38,12 +40,144 @@ static void* _client_thread_func(void* arg)
     run_client(port);
 }
 
+/* kernel-backed fds: level/edge-triggered, one-shot and close-then-reuse */
+static void _test_pipe(void)
+{
+    int epfd;
+    int fds[2];
+    struct epoll_event ev;
+    struct epoll_event out[4];
+    char c = 'x';
+
+    assert((epfd = epoll_create1(0)) >= 0);
+    assert(pipe(fds) == 0);
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0x1234;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev) == -1);
+    assert(errno == EEXIST);
+
+    assert(epoll_wait(epfd, out, 4, 0) == 0);
+    assert(write(fds[1], &c, 1) == 1);
+
+    /* level-triggered: reported until drained */
+    assert(epoll_wait(epfd, out, 4, 0) == 1);
+    assert(out[0].events == EPOLLIN);
+    assert(out[0].data.u64 == 0x1234);
+    assert(epoll_wait(epfd, out, 4, 0) == 1);
+
+    /* one-shot: reported once until rearmed with EPOLL_CTL_MOD */
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &ev) == 0);
+    assert(epoll_wait(epfd, out, 4, 0) == 1);
+    assert(epoll_wait(epfd, out, 4, 0) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &ev) == 0);
+    assert(epoll_wait(epfd, out, 4, 0) == 1);
+
+    /* edge-triggered: reported once per new write */
+    ev.events = EPOLLIN | EPOLLET;
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &ev) == 0);
+    assert(epoll_wait(epfd, out, 4, 0) == 1);
+    assert(epoll_wait(epfd, out, 4, 0) == 0);
+    assert(write(fds[1], &c, 1) == 1);
+    assert(epoll_wait(epfd, out, 4, 0) == 1);
+    assert(epoll_wait(epfd, out, 4, 0) == 0);
+
+    /* EPOLLEXCLUSIVE is only allowed with EPOLL_CTL_ADD */
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &ev) == -1);
+    assert(errno == EINVAL);
+
+    /* closing the fd removes it, so the reused fd can be added again */
+    assert(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], NULL) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], NULL) == -1);
+    assert(errno == ENOENT);
+    ev.events = EPOLLIN;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev) == 0);
+    close(fds[0]);
+    close(fds[1]);
+    assert(epoll_wait(epfd, out, 4, 0) == 0);
+    assert(pipe(fds) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev) == 0);
+
+    close(fds[0]);
+    close(fds[1]);
+    close(epfd);
+}
+
+#define NUM_EXCLUSIVE 3
+
+static int _exclusive_fd;
+static int _exclusive_woken;
+
+/* wait in an epoll instance of its own until a byte can be read */
+static void* _exclusive_thread_func(void* arg)
+{
+    int epfd;
+    struct epoll_event ev;
+    char c;
+
+    assert((epfd = epoll_create1(0)) >= 0);
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.u64 = 0;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, _exclusive_fd, &ev) == 0);
+
+    for (;;)
+    {
+        assert(epoll_wait(epfd, &ev, 1, -1) == 1);
+        __atomic_fetch_add(&_exclusive_woken, 1, __ATOMIC_SEQ_CST);
+
+        if (read(_exclusive_fd, &c, 1) == 1)
+            break;
+    }
+
+    close(epfd);
+    return arg;
+}
+
+/* each write to a pipe that several epoll instances hold exclusively wakes
+ * only one of their waiters */
+static void _test_exclusive(void)
+{
+    pthread_t threads[NUM_EXCLUSIVE];
+    int fds[2];
+    char c = 'x';
+
+    assert(pipe2(fds, O_NONBLOCK) == 0);
+    _exclusive_fd = fds[0];
+
+    for (size_t i = 0; i < NUM_EXCLUSIVE; i++)
+    {
+        void* (*func)(void*) = _exclusive_thread_func;
+        assert(pthread_create(&threads[i], NULL, func, NULL) == 0);
+    }
+
+    _sleep_msec(200);
+
+    for (int i = 1; i <= NUM_EXCLUSIVE; i++)
+    {
+        assert(write(fds[1], &c, 1) == 1);
+        _sleep_msec(200);
+        assert(__atomic_load_n(&_exclusive_woken, __ATOMIC_SEQ_CST) == i);
+    }
+
+    for (size_t i = 0; i < NUM_EXCLUSIVE; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
 int main(int argc, const char* argv[])
 {
     pthread_t sthread;
     pthread_t cthread1;
     pthread_t cthread2;
 
+    _test_pipe();
+    _test_exclusive();
+
     assert(pthread_create(&sthread, NULL, _server_thread_func, NULL) == 0);
     _sleep_msec(250);
     assert(pthread_create(&cthread1, NULL, _client_thread_func, NULL) == 0);
@@ -0,0 +1,247 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ITERATIONS 10000
+
+static uint64_t _now_msec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Set the timer to expire after msec and then every interval msec */
+static void _settime(int fd, uint64_t msec, uint64_t interval)
+{
+    struct itimerspec its;
+
+    its.it_value.tv_sec = msec / 1000;
+    its.it_value.tv_nsec = (msec % 1000) * 1000000;
+    its.it_interval.tv_sec = interval / 1000;
+    its.it_interval.tv_nsec = (interval % 1000) * 1000000;
+    assert(timerfd_settime(fd, 0, &its, NULL) == 0);
+}
+
+void test_eventfd(void)
+{
+    int fd;
+    uint64_t x;
+    struct pollfd pfd;
+
+    assert((fd = eventfd(5, EFD_NONBLOCK)) >= 0);
+    assert(fcntl(fd, F_GETFL) & O_NONBLOCK);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN | POLLOUT;
+    assert(poll(&pfd, 1, 0) == 1 && pfd.revents == (POLLIN | POLLOUT));
+
+    /* reads take the whole count */
+    assert(read(fd, &x, sizeof(x)) == sizeof(x) && x == 5);
+    assert(read(fd, &x, sizeof(x)) == -1 && errno == EAGAIN);
+    assert(poll(&pfd, 1, 0) == 1 && pfd.revents == POLLOUT);
+
+    /* short buffers and the maximum value are rejected */
+    assert(read(fd, &x, 4) == -1 && errno == EINVAL);
+    x = UINT64_MAX;
+    assert(write(fd, &x, sizeof(x)) == -1 && errno == EINVAL);
+
+    /* the count may not pass UINT64_MAX - 1 */
+    x = UINT64_MAX - 1;
+    assert(write(fd, &x, sizeof(x)) == sizeof(x));
+    x = 1;
+    assert(write(fd, &x, sizeof(x)) == -1 && errno == EAGAIN);
+    assert(poll(&pfd, 1, 0) == 1 && pfd.revents == POLLIN);
+    assert(read(fd, &x, sizeof(x)) == sizeof(x) && x == UINT64_MAX - 1);
+    assert(close(fd) == 0);
+
+    /* a semaphore hands out one at a time */
+    assert((fd = eventfd(2, EFD_SEMAPHORE | EFD_NONBLOCK)) >= 0);
+    assert(read(fd, &x, sizeof(x)) == sizeof(x) && x == 1);
+    assert(read(fd, &x, sizeof(x)) == sizeof(x) && x == 1);
+    assert(read(fd, &x, sizeof(x)) == -1 && errno == EAGAIN);
+    assert(close(fd) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void* _signaler(void* arg)
+{
+    const int fd = *(int*)arg;
+    const uint64_t one = 1;
+
+    for (size_t i = 0; i < ITERATIONS; i++)
+        assert(write(fd, &one, sizeof(one)) == sizeof(one));
+
+    return NULL;
+}
+
+/* Wake an epoll loop from another thread (as event loops do) */
+void test_eventfd_epoll(void)
+{
+    int fd;
+    int epfd;
+    pthread_t thread;
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = 42};
+    uint64_t total = 0;
+    const uint64_t t0 = _now_msec();
+
+    assert((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) >= 0);
+    assert(fcntl(fd, F_GETFD) == FD_CLOEXEC);
+    assert((epfd = epoll_create1(0)) >= 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+
+    assert(epoll_wait(epfd, &ev, 1, 0) == 0);
+    assert(pthread_create(&thread, NULL, _signaler, &fd) == 0);
+
+    while (total < ITERATIONS)
+    {
+        uint64_t x;
+
+        memset(&ev, 0, sizeof(ev));
+        assert(epoll_wait(epfd, &ev, 1, 5000) == 1);
+        assert(ev.events == EPOLLIN && ev.data.u32 == 42);
+
+        if (read(fd, &x, sizeof(x)) == sizeof(x))
+            total += x;
+        else
+            assert(errno == EAGAIN);
+    }
+
+    assert(pthread_join(thread, NULL) == 0);
+    assert(total == ITERATIONS);
+    printf("eventfd: %d signals in %lu msec\n", ITERATIONS, _now_msec() - t0);
+
+    assert(close(epfd) == 0);
+    assert(close(fd) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* A blocked read() returns once another thread signals */
+void test_eventfd_blocking(void)
+{
+    int fd;
+    pthread_t thread;
+    uint64_t total = 0;
+
+    assert((fd = eventfd(0, 0)) >= 0);
+    assert(pthread_create(&thread, NULL, _signaler, &fd) == 0);
+
+    while (total < ITERATIONS)
+    {
+        uint64_t x;
+        assert(read(fd, &x, sizeof(x)) == sizeof(x) && x > 0);
+        total += x;
+    }
+
+    assert(pthread_join(thread, NULL) == 0);
+    assert(total == ITERATIONS);
+    assert(close(fd) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+void test_timerfd(void)
+{
+    int fd;
+    uint64_t x;
+    uint64_t start;
+    struct itimerspec its;
+
+    assert((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) >= 0);
+    assert(read(fd, &x, sizeof(x)) == -1 && errno == EAGAIN);
+
+    /* a disarmed timer has a zero value */
+    assert(timerfd_gettime(fd, &its) == 0);
+    assert(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0);
+
+    /* a periodic timer counts its expirations */
+    _settime(fd, 20, 10);
+    assert(timerfd_gettime(fd, &its) == 0);
+    assert(its.it_value.tv_sec == 0 && its.it_value.tv_nsec > 0);
+    assert(its.it_interval.tv_nsec == 10000000);
+    usleep(100000);
+    assert(read(fd, &x, sizeof(x)) == sizeof(x) && x >= 5);
+
+    /* disarming drops the unread expirations */
+    _settime(fd, 0, 0);
+    usleep(30000);
+    assert(read(fd, &x, sizeof(x)) == -1 && errno == EAGAIN);
+    assert(close(fd) == 0);
+
+    /* a blocking read waits for the expiration */
+    assert((fd = timerfd_create(CLOCK_REALTIME, 0)) >= 0);
+    start = _now_msec();
+    _settime(fd, 50, 0);
+    assert(read(fd, &x, sizeof(x)) == sizeof(x) && x == 1);
+    assert(_now_msec() - start >= 45);
+    assert(close(fd) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+void test_timerfd_epoll(void)
+{
+    int fd;
+    int epfd;
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.u32 = 7};
+    uint64_t start;
+    uint64_t x;
+
+    assert((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) >= 0);
+    assert((epfd = epoll_create1(0)) >= 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+
+    /* an armed timer wakes the waiter when it expires */
+    start = _now_msec();
+    _settime(fd, 50, 0);
+    assert(epoll_wait(epfd, &ev, 1, 0) == 0);
+    assert(epoll_wait(epfd, &ev, 1, 5000) == 1);
+    assert(ev.events == EPOLLIN && ev.data.u32 == 7);
+    assert(_now_msec() - start >= 45);
+    assert(read(fd, &x, sizeof(x)) == sizeof(x) && x == 1);
+
+    /* a periodic timer fires again after each read */
+    _settime(fd, 10, 10);
+
+    for (size_t i = 0; i < 5; i++)
+    {
+        assert(epoll_wait(epfd, &ev, 1, 5000) == 1);
+        assert(ev.events == EPOLLIN);
+        assert(read(fd, &x, sizeof(x)) == sizeof(x) && x >= 1);
+    }
+
+    assert(close(epfd) == 0);
+    assert(close(fd) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    (void)argc;
+
+    test_eventfd();
+    test_eventfd_epoll();
+    test_eventfd_blocking();
+    test_timerfd();
+    test_timerfd_epoll();
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
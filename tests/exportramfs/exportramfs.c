@@ -0,0 +1,65 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Larger than the kernel's export buffer and not a multiple of four */
+#define BIG_SIZE (3 * 1024 * 1024 + 3)
+
+static void _write_file(const char* path, const void* data, size_t size)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    const char* p = data;
+
+    assert(fd >= 0);
+
+    while (size)
+    {
+        ssize_t n = write(fd, p, size);
+        assert(n > 0);
+        p += n;
+        size -= (size_t)n;
+    }
+
+    assert(close(fd) == 0);
+}
+
+int main(int argc, const char* argv[])
+{
+    char* big;
+    char path[512];
+
+    assert(argc == 1);
+
+    assert(mkdir("/out", 0777) == 0);
+    assert(mkdir("/out/sub", 0777) == 0);
+    assert(mkdir("/out/sub/dir", 0777) == 0);
+
+    _write_file("/out/small", "small file", 10);
+    _write_file("/out/empty", "", 0);
+    _write_file("/out/odd", "12345", 5);
+
+    assert((big = malloc(BIG_SIZE)));
+
+    for (size_t i = 0; i < BIG_SIZE; i++)
+        big[i] = (char)(i * 7 + i / 4096);
+
+    _write_file("/out/sub/dir/big", big, BIG_SIZE);
+    free(big);
+
+    /* a path too long for a CPIO name */
+    strcpy(path, "/out/");
+    memset(path + 5, 'x', 300);
+    path[305] = '\0';
+    _write_file(path, "long name", 9);
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <myst/blkdev.h>
+#include <myst/ext2.h>
+
+/*
+**==============================================================================
+**
+** The image is made by mke2fs -t ext4 -d from a tree this program writes
+** (see --mktree). /sparse holds runs of data separated by holes, more runs
+** than the four extents that fit in the inode, so its extent tree has an
+** index level. /hole has no blocks at all. The Makefile clears the extent
+** header of /bad in a copy of the image.
+**
+**==============================================================================
+*/
+
+#define NUM_RUNS 8
+#define RUN_SIZE 8192
+#define RUN_STRIDE 65536
+#define SPARSE_SIZE (NUM_RUNS * RUN_STRIDE + 4096)
+#define HOLE_SIZE (1024 * 1024)
+
+ext2_t* __ext2;
+
+int mock_mount_resolve(
+    const char* path,
+    char suffix[PATH_MAX],
+    myst_fs_t** fs_out)
+{
+    strcpy(suffix, path);
+    *fs_out = (myst_fs_t*)__ext2;
+    return 0;
+}
+
+/* The byte of /sparse at this offset (zero in the holes) */
+static uint8_t _sparse_byte(size_t offset)
+{
+    const size_t run = offset / RUN_STRIDE;
+    const size_t i = offset % RUN_STRIDE;
+
+    if (run >= NUM_RUNS || i >= RUN_SIZE)
+        return 0;
+
+    return (uint8_t)(run * 7 + i);
+}
+
+static void _write_file(const char* dir, const char* name, size_t size)
+{
+    char path[PATH_MAX];
+    FILE* os;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    assert((os = fopen(path, "w")) != NULL);
+
+    if (strcmp(name, "sparse") == 0)
+    {
+        for (size_t run = 0; run < NUM_RUNS; run++)
+        {
+            assert(fseek(os, (long)(run * RUN_STRIDE), SEEK_SET) == 0);
+
+            for (size_t i = 0; i < RUN_SIZE; i++)
+                assert(fputc(_sparse_byte(run * RUN_STRIDE + i), os) != EOF);
+        }
+    }
+    else if (strcmp(name, "bad") == 0)
+    {
+        for (size_t i = 0; i < size; i++)
+            assert(fputc('b', os) != EOF);
+    }
+
+    assert(fflush(os) == 0);
+    assert(ftruncate(fileno(os), (off_t)size) == 0);
+    assert(fclose(os) == 0);
+}
+
+static void _mktree(const char* dir)
+{
+    char path[PATH_MAX];
+
+    _write_file(dir, "sparse", SPARSE_SIZE);
+    _write_file(dir, "hole", HOLE_SIZE);
+    _write_file(dir, "bad", 4096);
+
+    snprintf(path, sizeof(path), "%s/dir", dir);
+    assert(mkdir(path, 0755) == 0 || errno == EEXIST);
+}
+
+static myst_fs_t* _mount(const char* image)
+{
+    myst_blkdev_t* dev;
+    myst_fs_t* fs;
+
+    if (myst_rawblkdev_open(image, true, 0, &dev) != 0)
+    {
+        fprintf(stderr, "failed to open %s\n", image);
+        exit(1);
+    }
+
+    if (ext2_create(dev, &fs, mock_mount_resolve) != 0)
+    {
+        fprintf(stderr, "ext2_create() failed: %s\n", image);
+        exit(1);
+    }
+
+    __ext2 = (ext2_t*)fs;
+    return fs;
+}
+
+/* Read FILE from OFFSET in chunks of COUNT bytes and check each byte */
+static void _check_read(
+    myst_fs_t* fs,
+    const char* path,
+    size_t size,
+    off_t offset,
+    size_t count)
+{
+    myst_file_t* file;
+    uint8_t* buf;
+    size_t total = (size_t)offset;
+    int64_t n;
+
+    assert((buf = malloc(count)) != NULL);
+    assert(ext2_open(fs, path, O_RDONLY, 0, NULL, &file) == 0);
+    assert(ext2_lseek(fs, file, offset, SEEK_SET) == offset);
+
+    while ((n = ext2_read(fs, file, buf, count)) > 0)
+    {
+        for (int64_t i = 0; i < n; i++)
+        {
+            const uint8_t c = strcmp(path, "/sparse") ? 0 : _sparse_byte(total);
+            assert(buf[i] == c);
+            total++;
+        }
+    }
+
+    assert(n == 0);
+    assert(total == size);
+    assert(ext2_close(fs, file) == 0);
+    free(buf);
+}
+
+static void test_extents(myst_fs_t* fs)
+{
+    struct stat st;
+
+    assert(ext2_stat(fs, "/sparse", &st) == 0);
+    assert(st.st_size == SPARSE_SIZE);
+
+    /* only the runs take blocks */
+    assert(st.st_blocks * 512 < SPARSE_SIZE);
+
+    /* whole file, in chunks that do not line up with the extents */
+    _check_read(fs, "/sparse", SPARSE_SIZE, 0, 5000);
+    _check_read(fs, "/sparse", SPARSE_SIZE, 0, SPARSE_SIZE);
+
+    /* from inside a hole and from inside the last run */
+    _check_read(fs, "/sparse", SPARSE_SIZE, RUN_STRIDE + RUN_SIZE + 100, 4096);
+    _check_read(fs, "/sparse", SPARSE_SIZE, 7 * RUN_STRIDE + 1, 4096);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_hole(myst_fs_t* fs)
+{
+    struct stat st;
+
+    assert(ext2_stat(fs, "/hole", &st) == 0);
+    assert(st.st_size == HOLE_SIZE);
+    assert(st.st_blocks == 0);
+
+    _check_read(fs, "/hole", HOLE_SIZE, 0, 65536);
+    _check_read(fs, "/hole", HOLE_SIZE, HOLE_SIZE / 2 + 3, 4096);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_read_only(myst_fs_t* fs)
+{
+    myst_file_t* file;
+
+    assert(ext2_open(fs, "/sparse", O_WRONLY, 0, NULL, &file) == -EROFS);
+    assert(ext2_open(fs, "/sparse", O_RDWR, 0, NULL, &file) == -EROFS);
+    assert(ext2_open(fs, "/new", O_CREAT | O_WRONLY, 0644, NULL, &file) ==
+           -EROFS);
+    assert(ext2_truncate(fs, "/sparse", 0) == -EROFS);
+    assert(ext2_mkdir(fs, "/newdir", 0755) == -EROFS);
+    assert(ext2_rmdir(fs, "/dir") == -EROFS);
+    assert(ext2_unlink(fs, "/hole") == -EROFS);
+    assert(ext2_rename(fs, "/hole", "/hole2") == -EROFS);
+    assert(ext2_link(fs, "/hole", "/hole2") == -EROFS);
+    assert(ext2_symlink(fs, "/hole", "/link") == -EROFS);
+
+    /* nothing changed */
+    assert(ext2_access(fs, "/new", F_OK) == -ENOENT);
+    assert(ext2_access(fs, "/dir", F_OK) == 0);
+    _check_read(fs, "/sparse", SPARSE_SIZE, 0, SPARSE_SIZE);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_bad_extent_header(myst_fs_t* fs)
+{
+    myst_file_t* file;
+    char buf[4096];
+
+    /* the file opens, but its blocks cannot be mapped */
+    assert(ext2_open(fs, "/bad", O_RDONLY, 0, NULL, &file) == 0);
+    assert(ext2_read(fs, file, buf, sizeof(buf)) == -EIO);
+    assert(ext2_close(fs, file) == 0);
+
+    /* the other files are still readable */
+    _check_read(fs, "/sparse", SPARSE_SIZE, 0, SPARSE_SIZE);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    myst_fs_t* fs;
+
+    if (argc == 3 && strcmp(argv[1], "--mktree") == 0)
+    {
+        _mktree(argv[2]);
+        return 0;
+    }
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <image> <corrupt-image>\n", argv[0]);
+        fprintf(stderr, "       %s --mktree <dir>\n", argv[0]);
+        exit(1);
+    }
+
+    fs = _mount(argv[1]);
+    test_extents(fs);
+    test_hole(fs);
+    test_read_only(fs);
+    ext2_release(fs);
+
+    fs = _mount(argv[2]);
+    test_bad_extent_header(fs);
+    ext2_release(fs);
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
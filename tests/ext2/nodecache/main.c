@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+**==============================================================================
+**
+** Runs with a verity rootfs and --verity-node-cache (see the Makefile):
+**
+**     cold -- no nodes were taken from the file, so reading /data/file hashes
+**             the nodes that cover it
+**     warm -- the nodes saved by the last run were taken as verified, so
+**             reading the same file hashes none
+**
+**==============================================================================
+*/
+
+typedef struct stats
+{
+    size_t hashed;
+    size_t imported;
+} stats_t;
+
+static size_t _get_field(const char* text, const char* name)
+{
+    const char* p;
+    size_t value;
+
+    assert((p = strstr(text, name)) != NULL);
+    assert(sscanf(p + strlen(name), " %zu", &value) == 1);
+    return value;
+}
+
+static void _get_stats(stats_t* stats)
+{
+    char buf[1024];
+    ssize_t n;
+    int fd;
+
+    assert((fd = open("/proc/myst/verity", O_RDONLY)) >= 0);
+    assert((n = read(fd, buf, sizeof(buf) - 1)) > 0);
+    assert(close(fd) == 0);
+    buf[n] = '\0';
+
+    stats->hashed = _get_field(buf, "NodesHashed:");
+    stats->imported = _get_field(buf, "NodesImported:");
+}
+
+/* Read the file (which spans several leaf nodes of the hash tree) */
+static void _read_file(const char* path)
+{
+    static char buf[65536];
+    size_t total = 0;
+    ssize_t n;
+    int fd;
+
+    assert((fd = open(path, O_RDONLY)) >= 0);
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        total += (size_t)n;
+
+    assert(n == 0);
+    assert(total > 0);
+    assert(close(fd) == 0);
+}
+
+int main(int argc, const char* argv[])
+{
+    stats_t before;
+    stats_t after;
+
+    if (argc != 2 || (strcmp(argv[1], "cold") && strcmp(argv[1], "warm")))
+    {
+        fprintf(stderr, "Usage: %s cold|warm\n", argv[0]);
+        exit(1);
+    }
+
+    _get_stats(&before);
+    _read_file("/data/file");
+    _get_stats(&after);
+
+    if (strcmp(argv[1], "cold") == 0)
+    {
+        assert(before.imported == 0);
+        assert(after.hashed > before.hashed);
+    }
+    else
+    {
+        assert(before.imported > 0);
+        assert(after.hashed == before.hashed);
+    }
+
+    printf("=== passed test (%s %s)\n", argv[0], argv[1]);
+
+    return 0;
+}
@@ -122,6 +122,14 @@ static int _touch_mode(myst_fs_t* fs, const char* path, mode_t mode)
     return 0;
 }
 
+static void _check_progress(uint32_t checked, uint32_t count, void* arg)
+{
+    uint32_t* last = (uint32_t*)arg;
+
+    assert(checked == *last + 1 && checked <= count);
+    *last = checked;
+}
+
 //#define DUMP
 //#define TRACE
 ext2_t* __ext2;
@@ -138,6 +146,7 @@ int mock_mount_resolve(
 
 int main(int argc, const char* argv[])
 {
+    myst_blkdev_t* rawdev;
     myst_blkdev_t* dev;
     myst_fs_t* fs;
     const char alpha[] = "abcdefghijklmnopqrstuvwxyz";
@@ -155,12 +164,20 @@ int main(int argc, const char* argv[])
     myst_set_trace(true);
 #endif
 
-    if (myst_rawblkdev_open(argv[1], true, 0, &dev) != 0)
+    /* the image is read-only, so the writes go to the overlay */
+    if (myst_rawblkdev_open(argv[1], true, 0, &rawdev) != 0 ||
+        myst_cowblkdev_open(rawdev, &dev) != 0)
     {
         fprintf(stderr, "%s: failed to open %s\n", argv[0], argv[1]);
         exit(1);
     }
 
+    /* the raw device rejects writes */
+    {
+        uint8_t block[MYST_BLKSIZE] = {0};
+        assert((rawdev->put)(rawdev, 0, block) == -EROFS);
+    }
+
     if (ext2_create(dev, &fs, mock_mount_resolve) != 0)
     {
         fprintf(stderr, "%s: ext2_create() failed\n", argv[0]);
@@ -543,6 +560,61 @@ int main(int argc, const char* argv[])
         assert(ext2_closedir(fs, dir) == 0);
     }
 
+    /* list a directory of several blocks a few entries per getdents64 */
+    {
+        const size_t nfiles = 400;
+        static uint8_t seen[400];
+        myst_file_t* file;
+        struct dirent ents[3];
+        struct stat buf;
+        size_t n = 0;
+        int r;
+
+        assert(ext2_mkdir(fs, "/bigdir", 0755) == 0);
+
+        for (size_t i = 0; i < nfiles; i++)
+        {
+            char path[EXT2_PATH_MAX];
+            snprintf(path, sizeof(path), "/bigdir/file-with-long-name-%zu", i);
+            _touch(fs, path);
+        }
+
+        assert(ext2_stat(fs, "/bigdir", &buf) == 0);
+        assert(buf.st_size > 2 * __ext2->block_size);
+        assert(ext2_open(fs, "/bigdir", O_DIRECTORY, 0, NULL, &file) == 0);
+
+        while ((r = (fs->fs_getdents64)(fs, file, ents, sizeof(ents))) > 0)
+        {
+            for (size_t i = 0; i < r / sizeof(struct dirent); i++)
+            {
+                const char* s = ents[i].d_name;
+                size_t k;
+
+                n++;
+
+                if (strcmp(s, ".") == 0 || strcmp(s, "..") == 0)
+                    continue;
+
+                assert(sscanf(s, "file-with-long-name-%zu", &k) == 1);
+                assert(k < nfiles && !seen[k]);
+                seen[k] = 1;
+            }
+        }
+
+        assert(r == 0);
+        assert(n == nfiles + 2);
+        assert(ext2_close(fs, file) == 0);
+
+        for (size_t i = 0; i < nfiles; i++)
+        {
+            char path[EXT2_PATH_MAX];
+            snprintf(path, sizeof(path), "/bigdir/file-with-long-name-%zu", i);
+            assert(ext2_unlink(fs, path) == 0);
+        }
+
+        assert(ext2_rmdir(fs, "/bigdir") == 0);
+    }
+
     /* create a big file with lots of pages */
     {
         const char path[] = "/bigfile";
@@ -587,6 +659,37 @@ int main(int argc, const char* argv[])
         free(data);
 
         assert(ext2_close(fs, file) == 0);
+
+        /* truncate within each level of indirection, checking the blocks
+         * released and the data kept each time */
+        {
+            const size_t n = block_size / sizeof(uint32_t);
+            const size_t lengths[] = {num_blocks - 4, 12 + n + 5, 12 + 9, 2};
+            uint32_t free_blocks = __ext2->sb.s_free_blocks_count;
+
+            for (size_t k = 0; k < sizeof(lengths) / sizeof(lengths[0]); k++)
+            {
+                const size_t length = lengths[k] * block_size + 17;
+                char buf[17];
+                char tmp[17];
+
+                assert(ext2_truncate(fs, path, length) == 0);
+                assert(_filesize(fs, path) == length);
+                assert(__ext2->sb.s_free_blocks_count > free_blocks);
+                free_blocks = __ext2->sb.s_free_blocks_count;
+                assert(ext2_check(__ext2) == 0);
+
+                assert(ext2_open(fs, path, O_RDONLY, 0000, NULL, &file) == 0);
+                assert(
+                    ext2_lseek(fs, file, length - 17, SEEK_SET) ==
+                    (off_t)(length - 17));
+                assert(ext2_read(fs, file, buf, sizeof(buf)) == sizeof(buf));
+                memset(tmp, (uint8_t)lengths[k], sizeof(tmp));
+                assert(memcmp(buf, tmp, sizeof(buf)) == 0);
+                assert(ext2_close(fs, file) == 0);
+            }
+        }
+
         assert(ext2_unlink(fs, "/bigfile") == 0);
     }
 
@@ -789,11 +892,28 @@ int main(int argc, const char* argv[])
             assert(ext2_closedir(fs, dir) == 0);
         }
 
+        /* look up every name (and some missing ones) */
+        for (size_t i = 0; i < N + 10; i++)
+        {
+            char path[PATH_MAX];
+            struct stat buf;
+            snprintf(path, sizeof(path), "%s/filename%zu", dirname, i);
+            assert(ext2_stat(fs, path, &buf) == (i < N ? 0 : -ENOENT));
+        }
+
         for (size_t i = 0; i < N; i++)
         {
             char path[PATH_MAX];
+            struct stat buf;
             snprintf(path, sizeof(path), "%s/filename%zu", dirname, i);
             assert(ext2_unlink(fs, path) == 0);
+            assert(ext2_stat(fs, path, &buf) == -ENOENT);
+
+            if (i + 1 < N)
+            {
+                snprintf(path, sizeof(path), "%s/filename%zu", dirname, i + 1);
+                assert(ext2_stat(fs, path, &buf) == 0);
+            }
         }
 
         assert(ext2_rmdir(fs, dirname) == 0);
@@ -996,6 +1116,38 @@ int main(int argc, const char* argv[])
         assert(ext2_rmdir(fs, "/lnkdir3") == 0);
     }
 
+    /* test that opens of the same file share its inode */
+    {
+        const char path[] = "/shared";
+        myst_file_t* file1;
+        myst_file_t* file2;
+        struct stat buf;
+        char data[4096];
+
+        memset(data, 'x', sizeof(data));
+        assert(ext2_open(fs, path, O_CREAT | O_RDWR, 0644, NULL, &file1) == 0);
+        assert(ext2_open(fs, path, O_RDONLY, 0, NULL, &file2) == 0);
+
+        /* the other open sees the new size and data */
+        assert(ext2_write(fs, file1, data, sizeof(data)) == sizeof(data));
+        assert(ext2_fstat(fs, file2, &buf) == 0);
+        assert(buf.st_size == sizeof(data));
+        memset(data, 0, sizeof(data));
+        assert(ext2_read(fs, file2, data, sizeof(data)) == sizeof(data));
+        assert(data[0] == 'x' && data[sizeof(data) - 1] == 'x');
+
+        /* and the truncation of the file by path */
+        assert(ext2_truncate(fs, path, 1) == 0);
+        assert(ext2_fstat(fs, file1, &buf) == 0);
+        assert(buf.st_size == 1);
+        assert(ext2_lseek(fs, file2, 0, SEEK_SET) == 0);
+        assert(ext2_read(fs, file2, data, sizeof(data)) == 1);
+
+        assert(ext2_close(fs, file1) == 0);
+        assert(ext2_close(fs, file2) == 0);
+        assert(ext2_unlink(fs, path) == 0);
+    }
+
     assert(ext2_check(__ext2) == 0);
 
     /* -- the file system is back to its original state here -- */
@@ -1008,6 +1160,57 @@ int main(int argc, const char* argv[])
     /* check superblock against original superblock */
     assert(memcmp(&sb, &__ext2->sb, sizeof(sb)) == 0);
 
+    /* test checking with progress and checking by ranges of groups */
+    {
+        uint32_t checked = 0;
+        const uint32_t half = __ext2->group_count / 2;
+        ext2_check_counts_t counts = {0};
+
+        assert(ext2_check_ex(__ext2, _check_progress, &checked) == 0);
+        assert(checked == __ext2->group_count);
+
+        assert(ext2_check_groups(__ext2, 0, half, &counts) == 0);
+        assert(
+            ext2_check_groups(
+                __ext2, half, __ext2->group_count - half, &counts) == 0);
+        assert(ext2_check_counts(__ext2, &counts) == 0);
+        assert(ext2_check_groups(__ext2, 1, __ext2->group_count, &counts) != 0);
+    }
+
+    /* test the buffer cache */
+    {
+        ext2_cache_stats_t stats;
+        struct stat buf;
+
+        /* the metadata read above is still cached */
+        assert(ext2_get_cache_stats(fs, &stats) == 0);
+        assert(stats.hits > stats.misses);
+        assert(ext2_stat(fs, "/", &buf) == 0);
+
+        /* writes stay in the cache until synced */
+        assert(stats.dirty > 0);
+        assert(ext2_sync(fs) == 0);
+        assert(ext2_get_cache_stats(fs, &stats) == 0);
+        assert(stats.dirty == 0 && stats.writebacks > 0);
+
+        /* the sync also wrote back the superblock kept in memory */
+        {
+            const uint64_t blkno = EXT2_BASE_OFFSET / MYST_BLKSIZE;
+            uint8_t data[sizeof(ext2_super_block_t) + MYST_BLKSIZE];
+
+            for (size_t i = 0; i * MYST_BLKSIZE < sizeof(__ext2->sb); i++)
+                assert(dev->get(dev, blkno + i, data + i * MYST_BLKSIZE) == 0);
+
+            assert(memcmp(data, &__ext2->sb, sizeof(__ext2->sb)) == 0);
+        }
+
+        /* shrinking evicts down to the new size */
+        assert(ext2_set_cache_size(fs, 8) == 0);
+        assert(ext2_get_cache_stats(fs, &stats) == 0);
+        assert(stats.blocks <= 8);
+        assert(ext2_check(__ext2) == 0);
+    }
+
     ext2_release(fs);
     // dev->close(dev);
 
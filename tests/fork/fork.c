@@ -0,0 +1,19 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+int main(int argc, const char* argv[])
+{
+    /* processes share the address space, so fork() fails rather than
+     * leave the parent waiting on a child that shares its memory */
+    assert(fork() == -1);
+    assert(errno == ENOSYS);
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
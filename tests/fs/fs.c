@@ -4,8 +4,11 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,6 +17,7 @@
 #include <sys/random.h>
 #include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/vfs.h>
@@ -287,6 +291,254 @@ void test_readdir()
     _passed(__FUNCTION__);
 }
 
+/* a directory large enough for ramfs to index its entries */
+void test_large_dir(void)
+{
+    const size_t n = 2000;
+    char path[PATH_MAX];
+    char path2[PATH_MAX];
+    struct stat st;
+    DIR* dir;
+    struct dirent* ent;
+    size_t i = 1;
+    int fd;
+
+    assert(mkdir("/largedir", 0777) == 0);
+
+    for (size_t k = 0; k < n; k++)
+    {
+        snprintf(path, sizeof(path), "/largedir/file%zu", k);
+        assert((fd = creat(path, 0666)) >= 0);
+        assert(close(fd) == 0);
+    }
+
+    /* remove the even files and find each name (or not) */
+    for (size_t k = 0; k < n; k += 2)
+    {
+        snprintf(path, sizeof(path), "/largedir/file%zu", k);
+        assert(unlink(path) == 0);
+    }
+
+    for (size_t k = 0; k < n; k++)
+    {
+        snprintf(path, sizeof(path), "/largedir/file%zu", k);
+        assert((stat(path, &st) == 0) == (k % 2 == 1));
+    }
+
+    /* the remaining entries are listed (by ramfs in creation order) */
+    assert((dir = opendir("/largedir")));
+
+    while ((ent = readdir(dir)))
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        snprintf(path, sizeof(path), "file%zu", i);
+        assert(strcmp(fstype, "ramfs") != 0 || strcmp(ent->d_name, path) == 0);
+        i += 2;
+    }
+
+    assert(i == n + 1);
+    assert(closedir(dir) == 0);
+
+    /* rename over an existing entry */
+    assert(rename("/largedir/file1", "/largedir/file3") == 0);
+    assert(stat("/largedir/file1", &st) != 0);
+    assert(stat("/largedir/file3", &st) == 0);
+
+    for (size_t k = 3; k < n; k += 2)
+    {
+        snprintf(path, sizeof(path), "/largedir/file%zu", k);
+        snprintf(path2, sizeof(path2), "/largedir/renamed%zu", k);
+        assert(rename(path, path2) == 0);
+        assert(stat(path2, &st) == 0);
+        assert(unlink(path2) == 0);
+    }
+
+    assert(rmdir("/largedir") == 0);
+
+    _passed(__FUNCTION__);
+}
+
+/* getdents64() packs records sized to their names into the buffer */
+void test_getdents64(void)
+{
+    const size_t n = 100;
+    char path[PATH_MAX];
+    char name[NAME_MAX + 1];
+    char buf[4096];
+    size_t count = 0;
+    ssize_t k;
+    int dirfd;
+    int fd;
+
+    assert(mkdir("/getdents", 0777) == 0);
+
+    /* names of every length from 1 to NAME_MAX (in steps) */
+    for (size_t i = 0; i < n; i++)
+    {
+        const size_t len = 1 + (i * 37) % NAME_MAX;
+
+        memset(name, 'a' + (char)(i % 26), len);
+        name[len] = '\0';
+        name[0] = '0' + (char)(i % 10);
+        snprintf(path, sizeof(path), "/getdents/%s", name);
+        assert((fd = creat(path, 0666)) >= 0);
+        assert(close(fd) == 0);
+    }
+
+    assert((dirfd = open("/getdents", O_RDONLY | O_DIRECTORY)) >= 0);
+
+    /* a buffer too small for any entry */
+    assert(syscall(SYS_getdents64, dirfd, buf, 8) == -1 && errno == EINVAL);
+
+    while ((k = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t pos = 0; pos < k;)
+        {
+            const struct dirent* ent = (const struct dirent*)(buf + pos);
+            const size_t len = strlen(ent->d_name);
+
+            assert(ent->d_reclen % 8 == 0);
+            assert(len + 1 + offsetof(struct dirent, d_name) <= ent->d_reclen);
+
+            if (strcmp(fstype, "ramfs") == 0)
+                assert(ent->d_reclen <= len + 1 + 26);
+
+            pos += ent->d_reclen;
+            count++;
+        }
+    }
+
+    assert(k == 0);
+    assert(count == n + 2);
+
+    /* remove the entries while listing them (which moves the rest) */
+    for (size_t removed = 0; removed < n;)
+    {
+        assert(lseek(dirfd, 0, SEEK_SET) == 0);
+        count = removed;
+
+        while ((k = syscall(SYS_getdents64, dirfd, buf, 512)) > 0)
+        {
+            for (ssize_t pos = 0; pos < k;)
+            {
+                const struct dirent* ent = (const struct dirent*)(buf + pos);
+
+                if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+                {
+                    snprintf(path, sizeof(path), "/getdents/%s", ent->d_name);
+                    assert(unlink(path) == 0);
+                    removed++;
+                }
+
+                pos += ent->d_reclen;
+            }
+        }
+
+        assert(k == 0);
+        assert(removed > count);
+    }
+
+    assert(close(dirfd) == 0);
+    assert(rmdir("/getdents") == 0);
+
+    _passed(__FUNCTION__);
+}
+
+/* lookups (and failed lookups) must see every later change of the tree */
+void test_lookup_cache(void)
+{
+    struct stat st;
+    int fd;
+
+    assert(stat("/lookup/dir/file", &st) != 0 && errno == ENOENT);
+    assert(mkdir("/lookup", 0777) == 0);
+    assert(mkdir("/lookup/dir", 0777) == 0);
+    assert(stat("/lookup/dir/file", &st) != 0 && errno == ENOENT);
+    assert((fd = creat("/lookup/dir/file", 0666)) >= 0);
+    assert(close(fd) == 0);
+    assert(stat("/lookup/dir/file", &st) == 0 && S_ISREG(st.st_mode));
+
+    /* moving a directory moves every path below it */
+    assert(rename("/lookup/dir", "/lookup/moved") == 0);
+    assert(stat("/lookup/dir/file", &st) != 0 && errno == ENOENT);
+    assert(stat("/lookup/moved/file", &st) == 0);
+
+    /* a replaced symbolic link resolves to its new target */
+    assert(mkdir("/lookup/other", 0777) == 0);
+    assert(symlink("moved", "/lookup/link") == 0);
+    assert(stat("/lookup/link/file", &st) == 0);
+    assert(unlink("/lookup/link") == 0);
+    assert(symlink("other", "/lookup/link") == 0);
+    assert(stat("/lookup/link/file", &st) != 0 && errno == ENOENT);
+    assert(stat("/lookup/link", &st) == 0 && S_ISDIR(st.st_mode));
+
+    assert(unlink("/lookup/link") == 0);
+    assert(unlink("/lookup/moved/file") == 0);
+    assert(rmdir("/lookup/moved") == 0);
+    assert(rmdir("/lookup/other") == 0);
+    assert(rmdir("/lookup") == 0);
+    assert(stat("/lookup", &st) != 0 && errno == ENOENT);
+
+    _passed(__FUNCTION__);
+}
+
+static double _now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+/* Resolve paths relative to the cwd (and time the resolution) */
+void test_relative_paths(void)
+{
+    const size_t n = 100000;
+    char cwd[PATH_MAX];
+    struct stat st;
+    double t;
+    int fd;
+
+    assert(mkdir("/rel", 0777) == 0);
+    assert(mkdir("/rel/sub", 0777) == 0);
+    assert((fd = creat("/rel/sub/file", 0666)) >= 0);
+    assert(close(fd) == 0);
+
+    assert(chdir("/rel/sub") == 0);
+    assert(getcwd(cwd, sizeof(cwd)) && strcmp(cwd, "/rel/sub") == 0);
+    assert(stat("file", &st) == 0 && S_ISREG(st.st_mode));
+    assert(stat("./file", &st) == 0 && S_ISREG(st.st_mode));
+    assert(stat(".//file", &st) == 0 && S_ISREG(st.st_mode));
+    assert(stat("../sub/file", &st) == 0 && S_ISREG(st.st_mode));
+    assert(stat("../../../rel/sub/file", &st) == 0);
+    assert(stat(".", &st) == 0 && S_ISDIR(st.st_mode));
+    assert(stat("..", &st) == 0 && S_ISDIR(st.st_mode));
+    assert(stat("../sub/", &st) == 0 && S_ISDIR(st.st_mode));
+    assert(stat("missing", &st) != 0 && errno == ENOENT);
+
+    /* the cwd follows chdir */
+    assert(chdir("..") == 0);
+    assert(getcwd(cwd, sizeof(cwd)) && strcmp(cwd, "/rel") == 0);
+    assert(stat("sub/file", &st) == 0 && S_ISREG(st.st_mode));
+    assert(stat("file", &st) != 0 && errno == ENOENT);
+
+    t = _now_usec();
+
+    for (size_t i = 0; i < n; i++)
+        assert(stat("sub/../sub/file", &st) == 0);
+
+    printf(
+        "relative stat: %.2f usec per call\n", (_now_usec() - t) / (double)n);
+
+    assert(chdir("/") == 0);
+    assert(unlink("/rel/sub/file") == 0);
+    assert(rmdir("/rel/sub") == 0);
+    assert(rmdir("/rel") == 0);
+
+    _passed(__FUNCTION__);
+}
+
 void dump_dirents(const char* path)
 {
     DIR* dir;
@@ -436,6 +688,35 @@ void test_truncate(void)
         assert(close(fd) == 0);
     }
 
+    /* a write beyond the end of file leaves a hole that reads as zeros */
+    {
+        const off_t hole = 3 * 4096 + 100;
+        char buf[sizeof(alpha)];
+
+        assert((fd = open("/truncate/alpha", O_RDWR, 0)) >= 0);
+        assert(write(fd, alpha, sizeof(alpha)) == sizeof(alpha));
+        assert(lseek(fd, hole, SEEK_SET) == hole);
+        assert(write(fd, alpha, sizeof(alpha)) == sizeof(alpha));
+        assert(_fdsize(fd) == (size_t)hole + sizeof(alpha));
+
+        assert(pread(fd, buf, sizeof(buf), 4096) == sizeof(buf));
+        for (size_t i = 0; i < sizeof(buf); i++)
+            assert(buf[i] == 0);
+
+        assert(pread(fd, buf, sizeof(buf), hole) == sizeof(buf));
+        assert(memcmp(buf, alpha, sizeof(alpha)) == 0);
+
+        /* shrinking and growing again does not bring back the old bytes */
+        assert(ftruncate(fd, 1) == 0);
+        assert(ftruncate(fd, sizeof(alpha)) == 0);
+        assert(pread(fd, buf, sizeof(buf), 0) == sizeof(buf));
+        assert(buf[0] == alpha[0]);
+        for (size_t i = 1; i < sizeof(buf); i++)
+            assert(buf[i] == 0);
+
+        assert(close(fd) == 0);
+    }
+
     _passed(__FUNCTION__);
 }
 
@@ -526,6 +807,73 @@ void test_pread_pwrite(void)
     _passed(__FUNCTION__);
 }
 
+#define CONCURRENT_FILE_SIZE (16 * 4096)
+#define CONCURRENT_ITERATIONS 200
+
+static int _concurrent_fd;
+
+/* Keep rewriting the file with one byte value after another */
+static void* _concurrent_writer(void* arg)
+{
+    uint8_t buf[CONCURRENT_FILE_SIZE];
+
+    for (int i = 0; i < CONCURRENT_ITERATIONS; i++)
+    {
+        memset(buf, 'a' + (i % 26), sizeof(buf));
+        assert(pwrite(_concurrent_fd, buf, sizeof(buf), 0) == sizeof(buf));
+    }
+
+    return arg;
+}
+
+/* Keep creating and removing files next to the one being written */
+static void* _concurrent_creator(void* arg)
+{
+    for (int i = 0; i < CONCURRENT_ITERATIONS; i++)
+    {
+        assert(_touch("/concurrent/other", 0600) == 0);
+        assert(unlink("/concurrent/other") == 0);
+    }
+
+    return arg;
+}
+
+void test_concurrent_io(void)
+{
+    uint8_t buf[CONCURRENT_FILE_SIZE];
+    pthread_t writer;
+    pthread_t creator;
+    struct stat st;
+
+    assert(mkdir("/concurrent", 0777) == 0);
+    assert(_touch("/concurrent/file", 0600) == 0);
+    assert((_concurrent_fd = open("/concurrent/file", O_RDWR, 0)) >= 0);
+
+    assert(pthread_create(&writer, NULL, _concurrent_writer, NULL) == 0);
+    assert(pthread_create(&creator, NULL, _concurrent_creator, NULL) == 0);
+
+    /* reads run alongside the writes: each byte is one of the values */
+    for (int i = 0; i < CONCURRENT_ITERATIONS; i++)
+    {
+        ssize_t n = pread(_concurrent_fd, buf, sizeof(buf), 0);
+        assert(n >= 0);
+
+        for (ssize_t j = 0; j < n; j++)
+            assert(buf[j] >= 'a' && buf[j] <= 'z');
+
+        assert(stat("/concurrent/file", &st) == 0);
+    }
+
+    assert(pthread_join(writer, NULL) == 0);
+    assert(pthread_join(creator, NULL) == 0);
+
+    assert(fstat(_concurrent_fd, &st) == 0);
+    assert(st.st_size == CONCURRENT_FILE_SIZE);
+    assert(close(_concurrent_fd) == 0);
+
+    _passed(__FUNCTION__);
+}
+
 void test_fstatat(void)
 {
     int dirfd;
@@ -692,6 +1040,53 @@ void test_sendfile(bool test_offset)
     _passed(__FUNCTION__);
 }
 
+void test_copy_file_range(void)
+{
+    const char in_path[] = "/copy_file_range_in";
+    const char out_path[] = "/copy_file_range_out";
+    int in_fd;
+    int out_fd;
+    off_t off_in = 2;
+    off_t off_out = 0;
+    char buf[sizeof(alpha)];
+
+    assert((in_fd = open(in_path, O_CREAT | O_RDWR, 0666)) >= 0);
+    assert(write(in_fd, alpha, sizeof(alpha)) == sizeof(alpha));
+    assert((out_fd = open(out_path, O_CREAT | O_RDWR, 0666)) >= 0);
+
+    /* explicit offsets are updated but the file offsets are left alone */
+    assert(copy_file_range(in_fd, &off_in, out_fd, &off_out, 10, 0) == 10);
+    assert(off_in == 12 && off_out == 10);
+    assert(lseek(in_fd, 0, SEEK_CUR) == sizeof(alpha));
+    assert(lseek(out_fd, 0, SEEK_CUR) == 0);
+
+    /* otherwise the file offsets are used and updated */
+    assert(lseek(in_fd, 12, SEEK_SET) == 12);
+    assert(lseek(out_fd, 10, SEEK_SET) == 10);
+    assert(copy_file_range(in_fd, NULL, out_fd, NULL, 100, 0) == 15);
+    assert(lseek(in_fd, 0, SEEK_CUR) == sizeof(alpha));
+    assert(lseek(out_fd, 0, SEEK_CUR) == 25);
+
+    /* nothing is left to copy */
+    assert(copy_file_range(in_fd, NULL, out_fd, NULL, 100, 0) == 0);
+
+    assert(pread(out_fd, buf, sizeof(buf), 0) == 25);
+    assert(memcmp(buf, alpha + 2, 25) == 0);
+
+    /* overlapping ranges of the same file are refused */
+    off_in = 0;
+    off_out = 5;
+    assert(copy_file_range(in_fd, &off_in, in_fd, &off_out, 10, 0) == -1);
+    assert(errno == EINVAL);
+
+    assert(close(in_fd) == 0);
+    assert(close(out_fd) == 0);
+    assert(unlink(in_path) == 0);
+    assert(unlink(out_path) == 0);
+
+    _passed(__FUNCTION__);
+}
+
 void test_statfs(const char* program_name)
 {
     int result;
@@ -803,6 +1198,34 @@ void test_timestamps(void)
 
         assert(close(fd) == 0);
     }
+
+    /* test read() on the ramfs (whose default is relatime): the first read
+     * after a change updates the access time and the next one does not */
+    if (strcmp(fstype, "ramfs") == 0)
+    {
+        char buf[10];
+
+        assert((fd = open("/timestamps/write", O_RDONLY)) >= 0);
+
+        assert(fstat(fd, &st1) == 0);
+        sleep_msec(_timestamp_sleep_msec);
+        assert(read(fd, buf, sizeof(buf)) == sizeof(buf));
+        assert(fstat(fd, &st2) == 0);
+
+        diff_timestamps(&st1, &st2, &atim, &ctim, &mtim);
+        assert(atim != 0);
+        assert(ctim == 0);
+        assert(mtim == 0);
+
+        sleep_msec(_timestamp_sleep_msec);
+        assert(pread(fd, buf, sizeof(buf), 0) == sizeof(buf));
+        assert(fstat(fd, &st1) == 0);
+
+        diff_timestamps(&st2, &st1, &atim, &ctim, &mtim);
+        assert(atim == 0);
+
+        assert(close(fd) == 0);
+    }
 }
 
 int main(int argc, const char* argv[])
@@ -834,6 +1257,10 @@ int main(int argc, const char* argv[])
     test_mkdir();
     test_rmdir();
     test_readdir();
+    test_large_dir();
+    test_getdents64();
+    test_lookup_cache();
+    test_relative_paths();
     test_link();
     test_access();
     test_rename();
@@ -841,8 +1268,10 @@ int main(int argc, const char* argv[])
     test_symlink();
     test_tmpfile();
     test_pread_pwrite();
+    test_concurrent_io();
     test_sendfile(true);
     test_sendfile(false);
+    test_copy_file_range();
     test_statfs(argv[0]);
     test_fstatfs(argv[0]);
     test_openat();
@@ -0,0 +1,536 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+**==============================================================================
+**
+** A fixed matrix of file system workloads, run on one layer of the storage
+** stack at a time (see "make bench"):
+**
+**     ramfs   -- /tmp
+**     hostfs  -- a host directory mounted on /mnt
+**     ext2    -- an ext2 image mounted on /mnt
+**     luks    -- an encrypted ext2 image (mounted with its key)
+**     verity  -- a signed ext2 image (only read)
+**     native  -- a directory used directly (for a run outside Mystikos)
+**
+** Every image that mkext2 makes has a hash tree, so the ext2 and luks runs
+** also go through verity (trusted by root hash rather than by signature).
+**
+** The workloads are sequential and random reads and writes at 4K, 64K and
+** 1M, creating, stating and unlinking files, and listing a directory of
+** 10K entries. The images come with the file to read (data/file) and the
+** directory to list (data/dir) so that the read-only layer has them too;
+** the other layers create them when missing.
+**
+** Each result gives MB/s (for transfers), IOPS and the p50 and p99 latency
+** of one operation. Inside Mystikos, each also gives the block device
+** requests of the ext2 layer, the block device tcalls and all the tcalls
+** that the workload made (from /proc/myst/stats).
+**
+** Usage: fsbench [--quick] [--target=NAME] <layer> [<source> [<key>]]
+**
+**==============================================================================
+*/
+
+#define KB 1024
+#define MB (1024 * 1024)
+
+#define FILE_SIZE (64 * MB)
+#define QUICK_FILE_SIZE (4 * MB)
+#define DIR_ENTRIES 10000
+#define QUICK_DIR_ENTRIES 100
+#define META_FILES 10000
+#define QUICK_META_FILES 100
+
+#define STATS_PATH "/proc/myst/stats"
+
+static bool _quick;
+static bool _read_only;
+static const char* _target = "native";
+static const char* _layer;
+static char _root[PATH_MAX];
+static size_t _nresults;
+static uint8_t* _buf;
+
+static uint64_t _nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+static void _path(char* buf, const char* name)
+{
+    int n = snprintf(buf, PATH_MAX, "%s/%s", _root, name);
+    assert(n > 0 && n < PATH_MAX);
+}
+
+/*
+**==============================================================================
+**
+** counters (from /proc/myst/stats)
+**
+**==============================================================================
+*/
+
+typedef struct counters
+{
+    uint64_t blkdev_gets;
+    uint64_t blkdev_puts;
+    uint64_t blkdev_tcalls;
+    uint64_t tcalls;
+} counters_t;
+
+/* Returns false outside Mystikos */
+static bool _read_counters(counters_t* c)
+{
+    FILE* is;
+    char line[256];
+
+    memset(c, 0, sizeof(counters_t));
+
+    if (!(is = fopen(STATS_PATH, "r")))
+        return false;
+
+    while (fgets(line, sizeof(line), is))
+    {
+        char* sp = strrchr(line, ' ');
+        uint64_t value;
+
+        if (!sp)
+            continue;
+
+        *sp = '\0';
+        value = strtoull(sp + 1, NULL, 10);
+
+        if (strcmp(line, "myst_ext2_blkdev_gets") == 0)
+            c->blkdev_gets = value;
+        else if (strcmp(line, "myst_ext2_blkdev_puts") == 0)
+            c->blkdev_puts = value;
+
+        if (strncmp(line, "myst_tcalls{", 12) == 0)
+        {
+            c->tcalls += value;
+
+            if (strstr(line, "_block_device"))
+                c->blkdev_tcalls += value;
+        }
+    }
+
+    fclose(is);
+    return true;
+}
+
+/*
+**==============================================================================
+**
+** results
+**
+**==============================================================================
+*/
+
+typedef struct run
+{
+    const char* name;
+    size_t ops;
+    size_t bytes;
+    uint64_t* lat; /* the nanoseconds of each operation */
+    uint64_t start;
+    bool have_counters;
+    counters_t counters;
+} run_t;
+
+static void _begin(run_t* r, const char* name, size_t ops, size_t bytes)
+{
+    r->name = name;
+    r->ops = ops;
+    r->bytes = bytes;
+    assert((r->lat = calloc(ops ? ops : 1, sizeof(uint64_t))));
+    r->have_counters = _read_counters(&r->counters);
+    r->start = _nsec();
+}
+
+static int _compare(const void* a, const void* b)
+{
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double _percentile(const run_t* r, size_t p)
+{
+    size_t i = (r->ops * p) / 100;
+
+    if (i >= r->ops)
+        i = r->ops - 1;
+
+    return (double)r->lat[i] / 1000.0;
+}
+
+static void _end(run_t* r)
+{
+    const double secs = (double)(_nsec() - r->start) / 1e9;
+    counters_t now;
+
+    qsort(r->lat, r->ops, sizeof(uint64_t), _compare);
+
+    printf(
+        "%s\n        { \"name\": \"%s\", \"ops\": %zu, \"iops\": %.0f",
+        _nresults++ ? "," : "",
+        r->name,
+        r->ops,
+        (double)r->ops / secs);
+
+    if (r->bytes)
+        printf(", \"mb_per_sec\": %.1f", (double)r->bytes / MB / secs);
+
+    printf(
+        ", \"p50_usec\": %.1f, \"p99_usec\": %.1f",
+        _percentile(r, 50),
+        _percentile(r, 99));
+
+    if (r->have_counters && _read_counters(&now))
+    {
+        printf(
+            ", \"blkdev_gets\": %lu, \"blkdev_puts\": %lu"
+            ", \"blkdev_tcalls\": %lu, \"tcalls\": %lu",
+            now.blkdev_gets - r->counters.blkdev_gets,
+            now.blkdev_puts - r->counters.blkdev_puts,
+            now.blkdev_tcalls - r->counters.blkdev_tcalls,
+            now.tcalls - r->counters.tcalls);
+    }
+
+    printf(" }");
+    fflush(stdout);
+    free(r->lat);
+}
+
+/*
+**==============================================================================
+**
+** reads and writes
+**
+**==============================================================================
+*/
+
+static size_t _file_size(void)
+{
+    return _quick ? QUICK_FILE_SIZE : FILE_SIZE;
+}
+
+/* a repeatable sequence of offsets (xorshift) */
+static uint64_t _next(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void _transfer(const char* path, size_t bsize, bool random, bool write)
+{
+    const size_t n = _file_size() / bsize;
+    const char* kind = random ? "rand" : "seq";
+    const char* op = write ? "write" : "read";
+    const char* unit = bsize >= MB ? "m" : "k";
+    const size_t size = bsize >= MB ? bsize / MB : bsize / KB;
+    const int flags = write ? O_WRONLY | O_CREAT : O_RDONLY;
+    uint64_t state = 0x9e3779b97f4a7c15;
+    char name[64];
+    run_t r;
+    int fd;
+
+    snprintf(name, sizeof(name), "%s_%s_%zu%s", kind, op, size, unit);
+    assert((fd = open(path, flags, 0666)) >= 0);
+
+    _begin(&r, name, n, n * bsize);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const off_t off = (off_t)((random ? _next(&state) % n : i) * bsize);
+        uint64_t t = _nsec();
+        ssize_t m;
+
+        if (write)
+            m = pwrite(fd, _buf, bsize, off);
+        else
+            m = pread(fd, _buf, bsize, off);
+
+        assert(m == (ssize_t)bsize);
+        r.lat[i] = _nsec() - t;
+    }
+
+    /* the writes are done once they reach the layer below */
+    if (write)
+        assert(fsync(fd) == 0);
+
+    _end(&r);
+    assert(close(fd) == 0);
+}
+
+/* the file to read: the one in the image or one written here */
+static void _prepare_file(const char* path)
+{
+    struct stat st;
+    int fd;
+
+    if (stat(path, &st) == 0 && (size_t)st.st_size >= _file_size())
+        return;
+
+    assert(!_read_only);
+    assert((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) >= 0);
+
+    for (size_t i = 0; i < _file_size() / MB; i++)
+        assert(write(fd, _buf, MB) == MB);
+
+    assert(close(fd) == 0);
+}
+
+static void _bench_io(void)
+{
+    static const size_t sizes[] = {4 * KB, 64 * KB, MB};
+    char data[PATH_MAX];
+    char scratch[PATH_MAX];
+
+    _path(data, "data/file");
+    _path(scratch, "scratch");
+    _prepare_file(data);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        _transfer(data, sizes[i], false, false);
+        _transfer(data, sizes[i], true, false);
+
+        if (!_read_only)
+        {
+            _transfer(scratch, sizes[i], false, true);
+            _transfer(scratch, sizes[i], true, true);
+        }
+    }
+
+    if (!_read_only)
+        assert(unlink(scratch) == 0);
+}
+
+/*
+**==============================================================================
+**
+** metadata and directories
+**
+**==============================================================================
+*/
+
+static void _bench_meta(void)
+{
+    const size_t n = _quick ? QUICK_META_FILES : META_FILES;
+    char dir[PATH_MAX];
+    char path[PATH_MAX + 16];
+    struct stat st;
+    run_t r;
+
+    _path(dir, "meta");
+    assert(mkdir(dir, 0777) == 0);
+
+    _begin(&r, "create", n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t t = _nsec();
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/f%zu", dir, i);
+        assert((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666)) >= 0);
+        assert(close(fd) == 0);
+        r.lat[i] = _nsec() - t;
+    }
+    _end(&r);
+
+    _begin(&r, "stat", n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t t = _nsec();
+
+        snprintf(path, sizeof(path), "%s/f%zu", dir, i);
+        assert(stat(path, &st) == 0);
+        r.lat[i] = _nsec() - t;
+    }
+    _end(&r);
+
+    _begin(&r, "unlink", n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t t = _nsec();
+
+        snprintf(path, sizeof(path), "%s/f%zu", dir, i);
+        assert(unlink(path) == 0);
+        r.lat[i] = _nsec() - t;
+    }
+    _end(&r);
+
+    assert(rmdir(dir) == 0);
+}
+
+static void _prepare_dir(const char* dir)
+{
+    const size_t n = _quick ? QUICK_DIR_ENTRIES : DIR_ENTRIES;
+    char path[PATH_MAX + 16];
+
+    if (access(dir, F_OK) == 0)
+        return;
+
+    assert(!_read_only);
+    assert(mkdir(dir, 0777) == 0);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/e%zu", dir, i);
+        assert((fd = open(path, O_WRONLY | O_CREAT, 0666)) >= 0);
+        assert(close(fd) == 0);
+    }
+}
+
+static void _bench_readdir(void)
+{
+    char dir[PATH_MAX];
+    size_t n = 0;
+    DIR* d;
+    run_t r;
+
+    _path(dir, "data/dir");
+    _prepare_dir(dir);
+
+    /* count the entries first (the latency is of each readdir call) */
+    assert((d = opendir(dir)));
+    while (readdir(d))
+        n++;
+    closedir(d);
+
+    _begin(&r, "readdir", n, 0);
+    assert((d = opendir(dir)));
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t t = _nsec();
+        assert(readdir(d));
+        r.lat[i] = _nsec() - t;
+    }
+    closedir(d);
+    _end(&r);
+}
+
+/*
+**==============================================================================
+**
+** main
+**
+**==============================================================================
+*/
+
+static void _mount(const char* source, const char* key)
+{
+    const char* args[] = {"key", key, NULL};
+    const char* type = strcmp(_layer, "hostfs") == 0 ? "hostfs" : "ext2";
+
+    assert(source);
+    assert(mkdir("/mnt", 0777) == 0 || errno == EEXIST);
+    assert(mount(source, "/mnt", type, 0, key ? args : NULL) == 0);
+    strcpy(_root, "/mnt");
+}
+
+int main(int argc, const char* argv[])
+{
+    const char* source = NULL;
+    const char* key = NULL;
+    char data[PATH_MAX];
+    int i = 1;
+
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+            _quick = true;
+        else if (strncmp(argv[i], "--target=", 9) == 0)
+            _target = argv[i] + 9;
+        else
+        {
+            fprintf(stderr, "%s: unknown option: %s\n", argv[0], argv[i]);
+            return 1;
+        }
+    }
+
+    if (i == argc || argc - i > 3)
+    {
+        fprintf(
+            stderr,
+            "Usage: %s [--quick] [--target=NAME] <layer> [<source> [<key>]]\n",
+            argv[0]);
+        return 1;
+    }
+
+    _layer = argv[i++];
+    source = i < argc ? argv[i++] : NULL;
+    key = i < argc ? argv[i++] : NULL;
+
+    if (strcmp(_layer, "ramfs") == 0)
+        strcpy(_root, "/tmp");
+    else if (strcmp(_layer, "native") == 0)
+    {
+        assert(source);
+        snprintf(_root, sizeof(_root), "%s", source);
+    }
+    else if (
+        strcmp(_layer, "hostfs") == 0 || strcmp(_layer, "ext2") == 0 ||
+        strcmp(_layer, "luks") == 0 || strcmp(_layer, "verity") == 0)
+    {
+        _mount(source, key);
+    }
+    else
+    {
+        fprintf(stderr, "%s: unknown layer: %s\n", argv[0], _layer);
+        return 1;
+    }
+
+    _read_only = strcmp(_layer, "verity") == 0;
+
+    _path(data, "data");
+    assert(access(data, F_OK) == 0 || mkdir(data, 0777) == 0);
+
+    assert((_buf = malloc(MB)));
+    memset(_buf, 0xab, MB);
+
+    printf("{\n    \"target\": \"%s\",\n", _target);
+    printf("    \"layer\": \"%s\",\n", _layer);
+    printf("    \"results\": [");
+
+    _bench_io();
+
+    if (!_read_only)
+        _bench_meta();
+
+    _bench_readdir();
+
+    printf("\n    ]\n}\n");
+
+    if (strcmp(_root, "/mnt") == 0)
+        assert(umount("/mnt") == 0);
+
+    free(_buf);
+
+    return 0;
+}
@@ -2,6 +2,8 @@
 // Licensed under the MIT License.
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/time.h>
@@ -10,6 +12,17 @@
 #include <unistd.h>
 
 #define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_WAKE_OP 5
+#define FUTEX_WAIT_BITSET 9
+#define FUTEX_WAKE_BITSET 10
+#define FUTEX_PRIVATE 128
+#define FUTEX_OP_ADD 1
+#define FUTEX_OP_CMP_EQ 0
+
+#define FUTEX_OP(OP, OPARG, CMP, CMPARG) \
+    (((OP & 0xf) << 28) | ((CMP & 0xf) << 24) | ((OPARG & 0xfff) << 12) | \
+     (CMPARG & 0xfff))
 
 /* get the timestamp in nanoseconds */
 uint64_t timestamp_nsec(void)
@@ -52,9 +65,82 @@ void test_double_wait(void)
     printf("=== passed test (%s)\n", __FUNCTION__);
 }
 
+static int _word;
+static volatile int _woken[2];
+
+static void* _bitset_waiter(void* arg)
+{
+    long i = (long)arg;
+    unsigned int bitset = 1U << i;
+
+    /* Wait until woken by a FUTEX_WAKE_BITSET that matches BITSET */
+    while (syscall(SYS_futex, &_word, FUTEX_WAIT_BITSET, 0, NULL, 0, bitset))
+        assert(errno == EINTR);
+
+    _woken[i] = 1;
+    return NULL;
+}
+
+/* Wake waiter I (retrying until it has queued up) */
+static void _wake_bitset(long i)
+{
+    /* Ask for two wakeups: only the waiter with a matching bitset wakes */
+    while (syscall(SYS_futex, &_word, FUTEX_WAKE_BITSET, 2, 0, 0, 1U << i) != 1)
+        usleep(1000);
+}
+
+void test_bitset(void)
+{
+    pthread_t threads[2];
+
+    for (long i = 0; i < 2; i++)
+    {
+        void* arg = (void*)i;
+        assert(pthread_create(&threads[i], NULL, _bitset_waiter, arg) == 0);
+    }
+
+    /* Waking the second waiter must not disturb the first one */
+    _wake_bitset(1);
+    assert(pthread_join(threads[1], NULL) == 0);
+    assert(_woken[1] == 1);
+    usleep(10000);
+    assert(_woken[0] == 0);
+
+    _wake_bitset(0);
+    assert(pthread_join(threads[0], NULL) == 0);
+    assert(_woken[0] == 1);
+
+    /* A zero bitset is invalid */
+    assert(syscall(SYS_futex, &_word, FUTEX_WAIT_BITSET, 0, NULL, 0, 0) == -1);
+    assert(errno == EINVAL);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+void test_wake_op(void)
+{
+    int word1 = 0;
+    int word2 = 5;
+    int op = FUTEX_OP(FUTEX_OP_ADD, 3, FUTEX_OP_CMP_EQ, 5);
+
+    /* No waiters: nothing is woken, but the operation is applied */
+    assert(syscall(SYS_futex, &word1, FUTEX_WAKE_OP, 1, 1, &word2, op) == 0);
+    assert(word2 == 8);
+
+    assert(syscall(SYS_futex, &word1, FUTEX_WAKE_OP, 1, 1, &word2, op) == 0);
+    assert(word2 == 11);
+
+    /* FUTEX_WAKE reports the number of woken waiters */
+    assert(syscall(SYS_futex, &word1, FUTEX_WAKE | FUTEX_PRIVATE, 1) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 int main(int argc, const char* argv[])
 {
     test_double_wait();
+    test_bitset();
+    test_wake_op();
 
     printf("=== passed test (%s)\n", argv[0]);
 
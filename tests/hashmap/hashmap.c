@@ -0,0 +1,119 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/hashmap.h>
+
+#define NKEYS 10000
+
+static void _count(uint64_t key, void* value, void* arg)
+{
+    assert((uint64_t)(uintptr_t)value == key + 1);
+    (*(size_t*)arg)++;
+}
+
+static void test_basic(void)
+{
+    myst_hashmap_t map = MYST_HASHMAP_INITIALIZER;
+    size_t n = 0;
+    int x;
+
+    assert(myst_hashmap_get(&map, 1) == NULL);
+    assert(myst_hashmap_remove(&map, 1) == NULL);
+    assert(myst_hashmap_put(&map, 1, NULL) == -EINVAL);
+
+    assert(myst_hashmap_put(&map, 1, &x) == 0);
+    assert(myst_hashmap_get(&map, 1) == &x);
+    assert(myst_hashmap_size(&map) == 1);
+
+    /* a put replaces the value */
+    assert(myst_hashmap_put(&map, 1, &n) == 0);
+    assert(myst_hashmap_get(&map, 1) == &n);
+    assert(myst_hashmap_size(&map) == 1);
+
+    assert(myst_hashmap_remove(&map, 1) == &n);
+    assert(myst_hashmap_get(&map, 1) == NULL);
+    assert(myst_hashmap_size(&map) == 0);
+
+    myst_hashmap_release(&map);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* Check the map against an array through resizes and removes */
+static void test_random(void)
+{
+    myst_hashmap_t map = MYST_HASHMAP_INITIALIZER;
+    static uint8_t present[NKEYS];
+    size_t size = 0;
+    size_t n = 0;
+
+    srand(1);
+
+    for (size_t i = 0; i < 50 * NKEYS; i++)
+    {
+        /* keys that are far apart as well as sequential */
+        const uint64_t key = (uint64_t)(rand() % NKEYS) * 4096;
+        const size_t k = key / 4096;
+        void* value = (void*)(uintptr_t)(key + 1);
+
+        switch (rand() % 3)
+        {
+            case 0:
+            case 1:
+            {
+                assert(myst_hashmap_put(&map, key, value) == 0);
+                size += !present[k];
+                present[k] = 1;
+                break;
+            }
+            case 2:
+            {
+                void* v = myst_hashmap_remove(&map, key);
+                assert(v == (present[k] ? value : NULL));
+                size -= present[k];
+                present[k] = 0;
+                break;
+            }
+        }
+
+        assert(myst_hashmap_size(&map) == size);
+    }
+
+    for (size_t k = 0; k < NKEYS; k++)
+    {
+        void* v = myst_hashmap_get(&map, k * 4096);
+        assert(v == (present[k] ? (void*)(uintptr_t)(k * 4096 + 1) : NULL));
+    }
+
+    myst_hashmap_foreach(&map, _count, &n);
+    assert(n == size);
+
+    /* removing everything leaves a table without values */
+    for (size_t k = 0; k < NKEYS; k++)
+        myst_hashmap_remove(&map, k * 4096);
+
+    assert(myst_hashmap_size(&map) == 0);
+    n = 0;
+    myst_hashmap_foreach(&map, _count, &n);
+    assert(n == 0);
+
+    myst_hashmap_release(&map);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    test_basic();
+    test_random();
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -6,10 +6,15 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
 #include <sys/uio.h>
@@ -18,6 +23,268 @@
 const char alpha[] = "abcdefghijklmnopqrstuvwxyz";
 const char ALPHA[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
+static bool _has_entry(const char* dirname, const char* name)
+{
+    DIR* dir;
+    struct dirent* ent;
+    bool found = false;
+
+    assert((dir = opendir(dirname)));
+
+    while ((ent = readdir(dir)))
+    {
+        if (strcmp(ent->d_name, name) == 0)
+            found = true;
+    }
+
+    assert(closedir(dir) == 0);
+
+    return found;
+}
+
+/* mount the host directory again with a cache and change it both ways */
+static void _test_cache(const char* hostdir)
+{
+    const char* exclusive_args[] = {"cache", "exclusive", NULL};
+    const char* ttl_args[] = {"cache", "ttl", "cache-ttl", "100", NULL};
+    const char* bad_args[] = {"cache", "sometimes", NULL};
+    const char filename[] = "/mnt/host/cached";
+    const char cached[] = "/mnt/exclusive/cached";
+    const char expiring[] = "/mnt/ttl/cached";
+    const char linkname[] = "/mnt/exclusive/cached-link";
+    struct stat buf;
+    int fd;
+
+    assert(mkdir("/mnt/exclusive", 0777) == 0);
+    assert(mkdir("/mnt/ttl", 0777) == 0);
+    assert(mount(hostdir, "/mnt/exclusive", "hostfs", 0, bad_args) != 0);
+    assert(mount(hostdir, "/mnt/exclusive", "hostfs", 0, exclusive_args) == 0);
+    assert(mount(hostdir, "/mnt/ttl", "hostfs", 0, ttl_args) == 0);
+
+    /* the exclusive mount keeps results that others made stale */
+    assert(stat(cached, &buf) != 0 && errno == ENOENT);
+    assert(stat(expiring, &buf) != 0 && errno == ENOENT);
+    assert((fd = creat(filename, 0666)) >= 0);
+    assert(close(fd) == 0);
+    assert(stat(cached, &buf) != 0 && errno == ENOENT);
+    assert(access(cached, F_OK) != 0);
+    assert(!_has_entry("/mnt/exclusive", "cached"));
+
+    /* but not the ones that it made stale itself */
+    assert((fd = open(cached, O_WRONLY | O_CREAT, 0666)) >= 0);
+    assert(stat(cached, &buf) == 0 && buf.st_size == 0);
+    assert(_has_entry("/mnt/exclusive", "cached"));
+    assert(write(fd, alpha, sizeof(alpha)) == sizeof(alpha));
+    assert(stat(cached, &buf) == 0 && buf.st_size == sizeof(alpha));
+    assert(close(fd) == 0);
+
+    /* nor the ones of other names of the same file */
+    assert(symlink("cached", linkname) == 0);
+    assert(lstat(linkname, &buf) == 0 && S_ISLNK(buf.st_mode));
+    assert(stat(linkname, &buf) == 0 && buf.st_size == sizeof(alpha));
+    assert(truncate(cached, 1) == 0);
+    assert(stat(cached, &buf) == 0 && buf.st_size == 1);
+    assert(stat(linkname, &buf) == 0 && buf.st_size == 1);
+    assert(unlink(linkname) == 0);
+    assert(lstat(linkname, &buf) != 0 && errno == ENOENT);
+
+    /* the TTL mount sees changes made elsewhere once its results expire */
+    assert(truncate(filename, 2) == 0);
+    assert(stat(cached, &buf) == 0 && buf.st_size == 1);
+    usleep(200 * 1000);
+    assert(stat(expiring, &buf) == 0 && buf.st_size == 2);
+
+    assert(unlink(cached) == 0);
+    assert(stat(cached, &buf) != 0 && errno == ENOENT);
+    assert(!_has_entry("/mnt/exclusive", "cached"));
+
+    assert(umount("/mnt/ttl") == 0);
+    assert(umount("/mnt/exclusive") == 0);
+}
+
+/* mount the host directory again with buffers and check what the host sees
+ * through the unbuffered mount */
+static void _test_buffering(const char* hostdir)
+{
+    const char* args[] = {"io-buffer", "4096", "flush-interval", "50", NULL};
+    const char filename[] = "/mnt/host/buffered";
+    const char buffered[] = "/mnt/buffered/buffered";
+    char buf[2 * sizeof(alpha)];
+    struct stat st;
+    int fd;
+    int rfd;
+
+    assert(mkdir("/mnt/buffered", 0777) == 0);
+    assert(mount(hostdir, "/mnt/buffered", "hostfs", 0, args) == 0);
+
+    /* small writes wait in the buffer, but the mount itself sees them */
+    assert((fd = creat(buffered, 0666)) >= 0);
+
+    for (size_t i = 0; i < sizeof(alpha); i++)
+        assert(write(fd, &alpha[i], 1) == 1);
+
+    assert(stat(buffered, &st) == 0 && st.st_size == sizeof(alpha));
+    assert((rfd = open(buffered, O_RDONLY)) >= 0);
+    assert(read(rfd, buf, sizeof(buf)) == sizeof(alpha));
+    assert(memcmp(buf, alpha, sizeof(alpha)) == 0);
+
+    /* and the host sees them after fsync() or the flush interval */
+    assert(write(fd, "A", 1) == 1);
+    assert(fsync(fd) == 0);
+    assert(stat(filename, &st) == 0 && st.st_size == sizeof(alpha) + 1);
+    assert(write(fd, "B", 1) == 1);
+    usleep(200 * 1000);
+    assert(stat(filename, &st) == 0 && st.st_size == sizeof(alpha) + 2);
+
+    /* sequential reads come from the read-ahead, which sees later writes */
+    assert(read(rfd, buf, 1) == 1 && buf[0] == 'A');
+    assert(pwrite(fd, "C", 1, sizeof(alpha) + 1) == 1);
+    assert(read(rfd, buf, 1) == 1 && buf[0] == 'C');
+    assert(lseek(rfd, 0, SEEK_CUR) == sizeof(alpha) + 2);
+    assert(close(rfd) == 0);
+
+    assert(close(fd) == 0);
+    assert(unlink(buffered) == 0);
+    assert(umount("/mnt/buffered") == 0);
+}
+
+static void _write_file(const char* path, const void* data, size_t size)
+{
+    int fd;
+
+    assert((fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0666)) >= 0);
+    assert(write(fd, data, size) == (ssize_t)size);
+    assert(close(fd) == 0);
+}
+
+/* Read-only shared mappings of an mmap=host mount are host memory, unless
+ * the file fails its manifest entry, and the other mappings are copies */
+static void _test_host_mmap(const char* hostdir)
+{
+    const char* args[] = {
+        "mmap", "host", "mmap-manifest", "/mmap-manifest", NULL};
+    const char* bad_args[] = {"mmap", "shared", NULL};
+    char manifest[2 * 32 + sizeof("  ./listed\n")];
+    void* addr;
+    int fd;
+
+    /* the hash of listed is wrong */
+    memset(manifest, '0', 2 * 32);
+    strcpy(manifest + 2 * 32, "  ./listed\n");
+    _write_file("/mmap-manifest", manifest, strlen(manifest));
+    _write_file("/mnt/host/listed", alpha, sizeof(alpha));
+    _write_file("/mnt/host/unlisted", alpha, sizeof(alpha));
+
+    assert(mkdir("/mnt/mapped", 0777) == 0);
+    assert(mount(hostdir, "/mnt/mapped", "hostfs", 0, bad_args) != 0);
+    assert(mount(hostdir, "/mnt/mapped", "hostfs", 0, args) == 0);
+
+    /* a file that the manifest does not list is mapped as is */
+    assert((fd = open("/mnt/mapped/unlisted", O_RDONLY)) >= 0);
+    addr = mmap(NULL, sizeof(alpha), PROT_READ, MAP_SHARED, fd, 0);
+    assert(addr != MAP_FAILED);
+    assert(close(fd) == 0);
+    assert(memcmp(addr, alpha, sizeof(alpha)) == 0);
+    assert(madvise(addr, sizeof(alpha), MADV_WILLNEED) == 0);
+    assert(munmap(addr, sizeof(alpha)) == 0);
+
+    /* a file that fails its entry is not mapped from the host */
+    assert((fd = open("/mnt/mapped/listed", O_RDONLY)) >= 0);
+    addr = mmap(NULL, sizeof(alpha), PROT_READ, MAP_SHARED, fd, 0);
+    assert(addr == MAP_FAILED);
+
+    /* but a private mapping reads a copy, as on any other mount */
+    addr = mmap(NULL, sizeof(alpha), PROT_READ, MAP_PRIVATE, fd, 0);
+    assert(addr != MAP_FAILED);
+    assert(memcmp(addr, alpha, sizeof(alpha)) == 0);
+    assert(munmap(addr, sizeof(alpha)) == 0);
+    assert(close(fd) == 0);
+
+    assert(umount("/mnt/mapped") == 0);
+    assert(unlink("/mnt/host/listed") == 0);
+    assert(unlink("/mnt/host/unlisted") == 0);
+    assert(unlink("/mmap-manifest") == 0);
+}
+
+/* Connect a pair of TCP sockets over the loopback interface */
+static void _tcp_pair(int fds[2])
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int listener;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert((listener = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert(listen(listener, 1) == 0);
+    assert(getsockname(listener, (struct sockaddr*)&addr, &len) == 0);
+
+    assert((fds[0] = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(connect(fds[0], (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert((fds[1] = accept(listener, NULL, NULL)) >= 0);
+    assert(close(listener) == 0);
+}
+
+static void _recv_all(int fd, void* buf, size_t count)
+{
+    for (size_t n = 0; n < count;)
+    {
+        ssize_t r = recv(fd, (char*)buf + n, count - n, 0);
+        assert(r > 0);
+        n += (size_t)r;
+    }
+}
+
+/* sendfile() from a buffered hostfs file to a TCP socket (which the host
+ * does by itself with --host-sendfile) sees the writes still buffered and
+ * keeps the file offset right */
+static void _test_sendfile(const char* hostdir)
+{
+    const char* args[] = {"io-buffer", "4096", "flush-interval", "0", NULL};
+    const char filename[] = "/mnt/sendfile/file";
+    char buf[sizeof(alpha) + sizeof(ALPHA)];
+    int socks[2];
+    off_t offset;
+    int fd;
+
+    assert(mkdir("/mnt/sendfile", 0777) == 0);
+    assert(mount(hostdir, "/mnt/sendfile", "hostfs", 0, args) == 0);
+    _tcp_pair(socks);
+
+    assert((fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0666)) >= 0);
+    assert(write(fd, alpha, sizeof(alpha)) == sizeof(alpha));
+    assert(write(fd, ALPHA, sizeof(ALPHA)) == sizeof(ALPHA));
+
+    /* at an offset, which leaves the file offset alone */
+    offset = 3;
+    assert(sendfile(socks[0], fd, &offset, 10) == 10);
+    assert(offset == 13);
+    _recv_all(socks[1], buf, 10);
+    assert(memcmp(buf, alpha + 3, 10) == 0);
+    assert(lseek(fd, 0, SEEK_CUR) == sizeof(buf));
+
+    /* at the file offset, after a read that filled the read-ahead */
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+    assert(read(fd, buf, 1) == 1 && buf[0] == 'a');
+    assert(sendfile(socks[0], fd, NULL, sizeof(buf)) == sizeof(buf) - 1);
+    assert(lseek(fd, 0, SEEK_CUR) == sizeof(buf));
+    _recv_all(socks[1], buf, sizeof(buf) - 1);
+    assert(memcmp(buf, alpha + 1, sizeof(alpha) - 1) == 0);
+    assert(memcmp(buf + sizeof(alpha) - 1, ALPHA, sizeof(ALPHA)) == 0);
+
+    /* nothing is left at the end of the file */
+    assert(sendfile(socks[0], fd, NULL, 1) == 0);
+
+    assert(close(fd) == 0);
+    assert(close(socks[0]) == 0);
+    assert(close(socks[1]) == 0);
+    assert(unlink(filename) == 0);
+    assert(umount("/mnt/sendfile") == 0);
+}
+
 int main(int argc, const char* argv[])
 {
     int fd;
@@ -334,6 +601,11 @@ int main(int argc, const char* argv[])
         assert(unlink(filename) == 0);
     }
 
+    _test_cache(argv[1]);
+    _test_buffering(argv[1]);
+    _test_sendfile(argv[1]);
+    _test_host_mmap(argv[1]);
+
     assert(umount("/mnt/host") == 0);
 
     printf("=== passed test (%s)\n", argv[0]);
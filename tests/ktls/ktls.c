@@ -0,0 +1,435 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* the definitions of linux/tls.h */
+#define SOL_TLS 282
+#define TCP_ULP 31
+#define TLS_TX 1
+#define TLS_RX 2
+#define TLS_SET_RECORD_TYPE 1
+#define TLS_GET_RECORD_TYPE 2
+#define TLS_1_2_VERSION 0x0303
+#define TLS_1_3_VERSION 0x0304
+#define TLS_CIPHER_AES_GCM_128 51
+#define TLS_CIPHER_AES_GCM_256 52
+
+/* tls12_crypto_info_aes_gcm_128 and tls12_crypto_info_aes_gcm_256 */
+typedef struct crypto_info
+{
+    uint16_t version;
+    uint16_t cipher_type;
+    uint8_t iv[8];
+    uint8_t key[32]; /* 16 bytes of it for AES-128 (the rest moves up) */
+    uint8_t salt[4];
+    uint8_t rec_seq[8];
+} crypto_info_t;
+
+#define INFO_128_SIZE 40
+#define INFO_256_SIZE 56
+
+#define PORT 12347
+#define DATA_SIZE (100 * 1024)
+
+static uint8_t _data[DATA_SIZE];
+static uint8_t _buf[DATA_SIZE];
+
+/* Fill in the crypto info (AES-128 moves the salt and rec_seq up) */
+static socklen_t _get_info(
+    uint16_t version,
+    uint16_t cipher,
+    uint8_t seed,
+    crypto_info_t* info)
+{
+    const size_t key_size = (cipher == TLS_CIPHER_AES_GCM_128) ? 16 : 32;
+    uint8_t* p = (uint8_t*)info;
+
+    memset(info, 0, sizeof(crypto_info_t));
+    info->version = version;
+    info->cipher_type = cipher;
+
+    for (size_t i = 0; i < 8 + key_size + 4; i++)
+        p[4 + i] = (uint8_t)(seed + i * 7);
+
+    /* rec_seq (zero) follows the salt */
+    return (key_size == 16) ? INFO_128_SIZE : INFO_256_SIZE;
+}
+
+/* Connect a client to a server over loopback TCP */
+static void _connect(int* client, int* server)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    static int lsock = -1;
+    const int one = 1;
+
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (lsock < 0)
+    {
+        assert((lsock = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+        assert(
+            setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ==
+            0);
+        assert(bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        assert(listen(lsock, 4) == 0);
+    }
+
+    assert((*client = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(connect(*client, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert((*server = accept(lsock, NULL, NULL)) >= 0);
+}
+
+static void _set_ulp(int sock)
+{
+    assert(setsockopt(sock, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0);
+}
+
+/* Set up a client that sends records to a server that opens them */
+static void _connect_tls(
+    uint16_t version,
+    uint16_t cipher,
+    int* client,
+    int* server)
+{
+    crypto_info_t info;
+    socklen_t size =
+        _get_info(version, cipher, 1, &info);
+
+    _connect(client, server);
+    _set_ulp(*client);
+    _set_ulp(*server);
+    assert(setsockopt(*client, SOL_TLS, TLS_TX, &info, size) == 0);
+    assert(setsockopt(*server, SOL_TLS, TLS_RX, &info, size) == 0);
+}
+
+static void _recv_all(int sock, uint8_t* buf, size_t len)
+{
+    for (size_t n = 0; n < len;)
+    {
+        ssize_t r = recv(sock, buf + n, len - n, 0);
+        assert(r > 0);
+        n += (size_t)r;
+    }
+}
+
+static void test_options(void)
+{
+    int client;
+    int server;
+    crypto_info_t info;
+    socklen_t size =
+        _get_info(TLS_1_3_VERSION, TLS_CIPHER_AES_GCM_128, 1, &info);
+    char name[16];
+    socklen_t len = sizeof(name);
+
+    _connect(&client, &server);
+
+    /* the keys need the upper layer protocol first */
+    assert(setsockopt(client, SOL_TLS, TLS_TX, &info, size) == -1);
+    assert(errno == ENOPROTOOPT);
+
+    _set_ulp(client);
+    assert(setsockopt(client, IPPROTO_TCP, TCP_ULP, "tls", 4) == -1);
+    assert(errno == EEXIST);
+
+    assert(getsockopt(client, IPPROTO_TCP, TCP_ULP, name, &len) == 0);
+    assert(strcmp(name, "tls") == 0);
+
+    /* the keys are not set yet */
+    len = sizeof(info);
+    assert(getsockopt(client, SOL_TLS, TLS_TX, &info, &len) == -1);
+    assert(errno == EBUSY);
+
+    /* unknown versions and ciphers */
+    info.version = 0x0302;
+    assert(setsockopt(client, SOL_TLS, TLS_TX, &info, size) == -1);
+    assert(errno == EINVAL);
+
+    size = _get_info(TLS_1_3_VERSION, 53, 1, &info);
+    assert(setsockopt(client, SOL_TLS, TLS_TX, &info, size) == -1);
+    assert(errno == EINVAL);
+
+    size = _get_info(TLS_1_3_VERSION, TLS_CIPHER_AES_GCM_128, 1, &info);
+    assert(setsockopt(client, SOL_TLS, TLS_TX, &info, size - 1) == -1);
+    assert(errno == EINVAL);
+
+    /* the keys are set once */
+    assert(setsockopt(client, SOL_TLS, TLS_TX, &info, size) == 0);
+    assert(setsockopt(client, SOL_TLS, TLS_TX, &info, size) == -1);
+    assert(errno == EBUSY);
+
+    /* and read back with the sequence number of the next record */
+    assert(send(client, "x", 1, 0) == 1);
+    memset(&info, 0, sizeof(info));
+    len = sizeof(info);
+    assert(getsockopt(client, SOL_TLS, TLS_TX, &info, &len) == 0);
+    assert(len == INFO_128_SIZE);
+    assert(info.version == TLS_1_3_VERSION);
+    assert(((uint8_t*)&info)[INFO_128_SIZE - 1] == 1);
+
+    assert(close(client) == 0);
+    assert(close(server) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* The plaintext arrives whole through any send and receive call */
+static void test_round_trip(uint16_t version, uint16_t cipher)
+{
+    int client;
+    int server;
+    const size_t sizes[] = {1, 100, 16384, 16385, 70000, DATA_SIZE};
+
+    _connect_tls(version, cipher, &client, &server);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        const size_t n = sizes[i];
+
+        for (size_t j = 0; j < n; j++)
+            _data[j] = (uint8_t)(i + j * 13);
+
+        assert(write(client, _data, n) == (ssize_t)n);
+        memset(_buf, 0, n);
+        _recv_all(server, _buf, n);
+        assert(memcmp(_buf, _data, n) == 0);
+    }
+
+    /* gathered and scattered */
+    {
+        struct iovec iov[3] = {
+            {_data, 10}, {_data + 10, 20000}, {_data + 20010, 5}};
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 3};
+        struct iovec riov[2] = {{_buf, 7}, {_buf + 7, 20008}};
+
+        assert(sendmsg(client, &msg, 0) == 20015);
+        assert(writev(client, iov, 3) == 20015);
+
+        memset(_buf, 0, 20015);
+        assert(recv(server, _buf, 20015, MSG_WAITALL) == 20015);
+        assert(memcmp(_buf, _data, 20015) == 0);
+
+        msg.msg_iov = riov;
+        msg.msg_iovlen = 2;
+        memset(_buf, 0, 20015);
+        assert(recvmsg(server, &msg, MSG_WAITALL) == 20015);
+        assert(memcmp(_buf, _data, 20015) == 0);
+    }
+
+    /* MSG_PEEK leaves the plaintext */
+    assert(send(client, "hello", 5, 0) == 5);
+    assert(recv(server, _buf, 5, MSG_PEEK) == 5);
+    assert(recv(server, _buf, 5, 0) == 5);
+    assert(memcmp(_buf, "hello", 5) == 0);
+
+    /* the end of the connection */
+    assert(close(client) == 0);
+    assert(recv(server, _buf, 1, 0) == 0);
+    assert(close(server) == 0);
+
+    printf(
+        "=== passed test (%s: %04x %u)\n", __FUNCTION__, version, cipher);
+}
+
+/* An opened record that was not read yet makes the socket readable */
+static void test_poll(void)
+{
+    int client;
+    int server;
+    struct pollfd pfd;
+    int avail = 0;
+
+    _connect_tls(TLS_1_3_VERSION, TLS_CIPHER_AES_GCM_128, &client, &server);
+
+    assert(send(client, "abc", 3, 0) == 3);
+    assert(send(client, "def", 3, 0) == 3);
+    _recv_all(server, _buf, 2);
+
+    pfd.fd = server;
+    pfd.events = POLLIN;
+    assert(poll(&pfd, 1, 1000) == 1);
+    assert(pfd.revents & POLLIN);
+
+    _recv_all(server, _buf + 2, 4);
+    assert(memcmp(_buf, "abcdef", 6) == 0);
+
+    /* nothing is left, so a nonblocking receive fails */
+    assert(fcntl(server, F_SETFL, O_NONBLOCK) == 0);
+    assert(recv(server, _buf, 1, 0) == -1);
+    assert(errno == EAGAIN);
+    assert(ioctl(server, FIONREAD, &avail) == 0 && avail == 0);
+
+    assert(close(client) == 0);
+    assert(close(server) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* Records of other types need recvmsg() and come one at a time */
+static void test_record_type(void)
+{
+    int client;
+    int server;
+    uint8_t alert[2] = {1, 0};
+    char control[CMSG_SPACE(1)];
+    struct iovec iov = {alert, sizeof(alert)};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    struct cmsghdr* cmsg;
+
+    _connect_tls(TLS_1_2_VERSION, TLS_CIPHER_AES_GCM_256, &client, &server);
+
+    assert(send(client, "data", 4, 0) == 4);
+
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(1);
+    *CMSG_DATA(cmsg) = 21;
+    assert(sendmsg(client, &msg, 0) == sizeof(alert));
+
+    /* the data stops at the alert */
+    assert(recv(server, _buf, sizeof(_buf), MSG_WAITALL) == 4);
+
+    /* which a plain receive does not return */
+    assert(recv(server, _buf, sizeof(_buf), 0) == -1);
+    assert(errno == EIO);
+
+    iov.iov_base = _buf;
+    iov.iov_len = sizeof(_buf);
+    msg.msg_controllen = sizeof(control);
+    assert(recvmsg(server, &msg, 0) == sizeof(alert));
+    assert(memcmp(_buf, alert, sizeof(alert)) == 0);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    assert(cmsg && cmsg->cmsg_level == SOL_TLS);
+    assert(cmsg->cmsg_type == TLS_GET_RECORD_TYPE);
+    assert(*CMSG_DATA(cmsg) == 21);
+
+    assert(close(client) == 0);
+    assert(close(server) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* The host only sees TLS records */
+static void test_wire_format(void)
+{
+    int client;
+    int server;
+    crypto_info_t info;
+    socklen_t size =
+        _get_info(TLS_1_2_VERSION, TLS_CIPHER_AES_GCM_128, 5, &info);
+    uint8_t record[5 + 8 + 6 + 16];
+
+    _connect(&client, &server);
+    _set_ulp(client);
+    assert(setsockopt(client, SOL_TLS, TLS_TX, &info, size) == 0);
+    assert(send(client, "secret", 6, 0) == 6);
+
+    /* the header, the explicit nonce (the iv) and the sealed bytes */
+    _recv_all(server, record, sizeof(record));
+    assert(record[0] == 23 && record[1] == 3 && record[2] == 3);
+    assert(record[3] == 0 && record[4] == 8 + 6 + 16);
+    assert(memcmp(record + 5, info.iv, 8) == 0);
+    assert(memmem(record, sizeof(record), "secret", 6) == NULL);
+
+    assert(close(client) == 0);
+    assert(close(server) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* A record that does not open fails all later receives */
+static void test_bad_record(void)
+{
+    int client;
+    int server;
+    crypto_info_t info;
+    socklen_t size =
+        _get_info(TLS_1_3_VERSION, TLS_CIPHER_AES_GCM_128, 1, &info);
+    uint8_t record[5 + 32] = {23, 3, 3, 0, 32};
+
+    _connect(&client, &server);
+    _set_ulp(server);
+    assert(setsockopt(server, SOL_TLS, TLS_RX, &info, size) == 0);
+
+    /* the tag does not match */
+    assert(send(client, record, sizeof(record), 0) == sizeof(record));
+    assert(recv(server, _buf, sizeof(_buf), 0) == -1);
+    assert(errno == EBADMSG);
+    assert(recv(server, _buf, sizeof(_buf), 0) == -1);
+    assert(errno == EBADMSG);
+
+    assert(close(client) == 0);
+    assert(close(server) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* sendfile() from a file in the enclave goes through the records too */
+static void test_sendfile(void)
+{
+    int client;
+    int server;
+    int fd;
+    off_t off = 0;
+
+    for (size_t i = 0; i < DATA_SIZE; i++)
+        _data[i] = (uint8_t)(i * 31);
+
+    assert((fd = open("/tmp/ktls", O_CREAT | O_TRUNC | O_RDWR, 0600)) >= 0);
+    assert(write(fd, _data, DATA_SIZE) == DATA_SIZE);
+
+    _connect_tls(TLS_1_3_VERSION, TLS_CIPHER_AES_GCM_256, &client, &server);
+
+    assert(sendfile(client, fd, &off, DATA_SIZE) == DATA_SIZE);
+    assert(off == DATA_SIZE);
+
+    memset(_buf, 0, DATA_SIZE);
+    _recv_all(server, _buf, DATA_SIZE);
+    assert(memcmp(_buf, _data, DATA_SIZE) == 0);
+
+    assert(close(fd) == 0);
+    assert(unlink("/tmp/ktls") == 0);
+    assert(close(client) == 0);
+    assert(close(server) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    test_options();
+    test_round_trip(TLS_1_2_VERSION, TLS_CIPHER_AES_GCM_128);
+    test_round_trip(TLS_1_2_VERSION, TLS_CIPHER_AES_GCM_256);
+    test_round_trip(TLS_1_3_VERSION, TLS_CIPHER_AES_GCM_128);
+    test_round_trip(TLS_1_3_VERSION, TLS_CIPHER_AES_GCM_256);
+    test_poll();
+    test_record_type();
+    test_wire_format();
+    test_bad_record();
+    test_sendfile();
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define PORT 12345
+
+static void _make_addr(struct sockaddr_in* addr, in_port_t port)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static void* _tcp_server(void* arg)
+{
+    int lsock = *(int*)arg;
+    struct sockaddr_in peer;
+    socklen_t peerlen = sizeof(peer);
+    char buf[64];
+    int sock;
+
+    assert((sock = accept(lsock, (struct sockaddr*)&peer, &peerlen)) >= 0);
+    assert(peerlen == sizeof(peer));
+    assert(peer.sin_family == AF_INET);
+    assert(peer.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+
+    assert(read(sock, buf, sizeof(buf)) == 5);
+    assert(memcmp(buf, "hello", 5) == 0);
+    assert(write(sock, "world", 5) == 5);
+
+    assert(close(sock) == 0);
+    return NULL;
+}
+
+static void _test_tcp(void)
+{
+    struct sockaddr_in addr;
+    struct sockaddr_in name;
+    socklen_t namelen = sizeof(name);
+    pthread_t thread;
+    char buf[64];
+    int lsock;
+    int sock;
+    int val;
+    socklen_t len = sizeof(val);
+
+    _make_addr(&addr, PORT);
+
+    assert((lsock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0);
+    assert(bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert(listen(lsock, 4) == 0);
+
+    /* the socket keeps its kind and flags when it moves into the kernel */
+    assert(fcntl(lsock, F_GETFD) == FD_CLOEXEC);
+    assert(getsockopt(lsock, SOL_SOCKET, SO_DOMAIN, &val, &len) == 0);
+    assert(val == AF_INET);
+    assert(getsockopt(lsock, SOL_SOCKET, SO_TYPE, &val, &len) == 0);
+    assert(val == SOCK_STREAM);
+
+    assert(pthread_create(&thread, NULL, _tcp_server, &lsock) == 0);
+
+    assert((sock = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+    /* the client got an ephemeral port */
+    assert(getsockname(sock, (struct sockaddr*)&name, &namelen) == 0);
+    assert(namelen == sizeof(name));
+    assert(ntohs(name.sin_port) != 0);
+
+    assert(write(sock, "hello", 5) == 5);
+    assert(read(sock, buf, sizeof(buf)) == 5);
+    assert(memcmp(buf, "world", 5) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+
+    /* the server closed its end */
+    assert(read(sock, buf, sizeof(buf)) == 0);
+
+    assert(close(sock) == 0);
+    assert(close(lsock) == 0);
+
+    /* the port went away with the listener */
+    assert((sock = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1);
+    assert(errno == ECONNREFUSED);
+    assert(close(sock) == 0);
+}
+
+static void _test_udp(void)
+{
+    struct sockaddr_in6 addr;
+    struct sockaddr_in6 from;
+    socklen_t fromlen = sizeof(from);
+    struct pollfd fds;
+    char buf[64];
+    int server;
+    int client;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(PORT);
+    addr.sin6_addr = in6addr_loopback;
+
+    assert((server = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0)) >= 0);
+    assert(bind(server, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert(recv(server, buf, sizeof(buf), 0) == -1);
+    assert(errno == EAGAIN);
+
+    /* an unbound sender moves on its first datagram to the enclave */
+    assert((client = socket(AF_INET6, SOCK_DGRAM, 0)) >= 0);
+    assert(
+        sendto(client, "ping", 4, 0, (struct sockaddr*)&addr, sizeof(addr)) ==
+        4);
+
+    fds.fd = server;
+    fds.events = POLLIN;
+    assert(poll(&fds, 1, 1000) == 1);
+    assert(fds.revents == POLLIN);
+
+    assert(
+        recvfrom(
+            server,
+            buf,
+            sizeof(buf),
+            0,
+            (struct sockaddr*)&from,
+            &fromlen) == 4);
+    assert(memcmp(buf, "ping", 4) == 0);
+    assert(fromlen == sizeof(from));
+    assert(memcmp(&from.sin6_addr, &in6addr_loopback, 16) == 0);
+
+    /* reply to the sender's ephemeral port */
+    assert(
+        sendto(server, "pong", 4, 0, (struct sockaddr*)&from, fromlen) == 4);
+    assert(recv(client, buf, sizeof(buf), 0) == 4);
+    assert(memcmp(buf, "pong", 4) == 0);
+
+    assert(close(client) == 0);
+    assert(close(server) == 0);
+}
+
+int main(int argc, const char* argv[])
+{
+    _test_tcp();
+    _test_udp();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,263 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <myst/memops.h>
+
+#define BUF_SIZE (2 * 1024 * 1024)
+
+typedef struct variant
+{
+    const char* name;
+    uint32_t feature; /* zero if always supported */
+    size_t min;       /* the smallest size it handles */
+    void (*memcpy)(void* dest, const void* src, size_t n);
+    void (*memset)(void* s, int c, size_t n);
+} variant_t;
+
+static const variant_t _variants[] = {
+    {"erms", MYST_MEMOPS_ERMS, 0, myst_memcpy_erms, myst_memset_erms},
+    {"sse2", 0, 16, myst_memcpy_sse2, myst_memset_sse2},
+    {"avx2", MYST_MEMOPS_AVX2, 32, myst_memcpy_avx2, myst_memset_avx2},
+    {"avx512", MYST_MEMOPS_AVX512, 64, myst_memcpy_avx512, myst_memset_avx512},
+};
+
+static const size_t _nvariants = sizeof(_variants) / sizeof(_variants[0]);
+
+static uint32_t _features;
+
+static uint8_t _src[BUF_SIZE];
+static uint8_t _dest[BUF_SIZE];
+static uint8_t _expect[BUF_SIZE];
+
+static bool _supported(const variant_t* v)
+{
+    /* rep movsb always works: ERMS only makes it fast */
+    return v->feature == 0 || v->feature == MYST_MEMOPS_ERMS ||
+           (_features & v->feature);
+}
+
+static void _fill_random(uint8_t* p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        p[i] = (uint8_t)rand();
+}
+
+void test_copy_and_fill(const variant_t* v)
+{
+    const size_t guard = 64;
+
+    for (size_t n = v->min; n < 4096; n += (n < 512 ? 1 : 61))
+    {
+        for (size_t align = 0; align < 8; align++)
+        {
+            uint8_t* d = _dest + guard + align;
+            const uint8_t* s = _src + guard + (align * 3) % 8;
+
+            _fill_random(_src, n + 2 * guard);
+            _fill_random(_dest, n + 2 * guard);
+            memcpy(_expect, _dest, n + 2 * guard);
+
+            /* the bytes around the copy must not change */
+            memcpy(_expect + guard + align, s, n);
+            v->memcpy(d, s, n);
+            assert(memcmp(_dest, _expect, n + 2 * guard) == 0);
+
+            memset(_expect + guard + align, 0xA5, n);
+            v->memset(d, 0xA5, n);
+            assert(memcmp(_dest, _expect, n + 2 * guard) == 0);
+
+            /* memmove() copies forward to a lower address with memcpy() */
+            memmove(_expect + guard, _expect + guard + align + 1, n);
+            v->memcpy(_dest + guard, _dest + guard + align + 1, n);
+            assert(memcmp(_dest, _expect, n + 2 * guard) == 0);
+        }
+    }
+}
+
+void test_non_temporal(void)
+{
+    static const size_t sizes[] = {
+        4096,
+        MYST_MEMOPS_NT_THRESHOLD - 1,
+        MYST_MEMOPS_NT_THRESHOLD,
+        MYST_MEMOPS_NT_THRESHOLD + 63,
+        BUF_SIZE - 128};
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        for (size_t align = 0; align < 64; align += 13)
+        {
+            const size_t n = sizes[i];
+
+            _fill_random(_src, BUF_SIZE);
+            _fill_random(_dest, BUF_SIZE);
+            memcpy(_expect, _dest, BUF_SIZE);
+
+            memcpy(_expect + align, _src + 5, n);
+            myst_memcpy_nt(_dest + align, _src + 5, n);
+            assert(memcmp(_dest, _expect, BUF_SIZE) == 0);
+
+            memset(_expect + align, 0, n);
+            myst_memzero_nt(_dest + align, n);
+            assert(memcmp(_dest, _expect, BUF_SIZE) == 0);
+        }
+    }
+}
+
+void test_mismatch(void)
+{
+    for (size_t n = 16; n < 600; n++)
+    {
+        for (size_t k = 0; k <= n; k++)
+        {
+            memset(_src, 1, n);
+            memset(_dest, 1, n);
+
+            if (k < n)
+                _dest[k] = 2;
+
+            assert(myst_mismatch_sse2(_src, _dest, n) == k);
+
+            if (n >= 32 && (_features & MYST_MEMOPS_AVX2))
+                assert(myst_mismatch_avx2(_src, _dest, n) == k);
+        }
+    }
+}
+
+void test_strlen(void)
+{
+    for (size_t offset = 0; offset < 64; offset++)
+    {
+        for (size_t n = 0; n < 300; n++)
+        {
+            const char* s = (const char*)_src + offset;
+
+            memset(_src, 'x', offset + n + 64);
+            _src[offset + n] = '\0';
+
+            assert(myst_strlen_sse2(s) == n);
+
+            if (_features & MYST_MEMOPS_AVX2)
+                assert(myst_strlen_avx2(s) == n);
+        }
+    }
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Copy about 256 MB in copies of n bytes and return the GB/s */
+static double _bench(const variant_t* v, size_t n, size_t align, bool fill)
+{
+    const size_t passes = (256 * 1024 * 1024) / n;
+    uint8_t* d = _dest + align;
+    const uint8_t* s = _src + (align ? 64 - align : 0);
+    double t = _now();
+
+    for (size_t i = 0; i < passes; i++)
+    {
+        if (!v)
+            fill ? memset(d, (int)i, n) : memcpy(d, s, n);
+        else if (fill)
+            v->memset(d, (int)i, n);
+        else
+            v->memcpy(d, s, n);
+
+        /* keep the compiler from dropping the calls */
+        __asm__ __volatile__("" : : "r"(d) : "memory");
+    }
+
+    return (double)(passes * n) / (_now() - t) / 1e9;
+}
+
+void bench(bool fill)
+{
+    static const size_t sizes[] = {
+        16, 64, 256, 1024, 4096, 16384, 65536, 1024 * 1024};
+    static const size_t aligns[] = {0, 1, 7, 31};
+
+    printf(
+        "\n%s (GB/s)\n%8s %5s %8s",
+        fill ? "memset" : "memcpy",
+        "size",
+        "align",
+        "libc");
+
+    for (size_t i = 0; i < _nvariants; i++)
+    {
+        if (_supported(&_variants[i]))
+            printf(" %8s", _variants[i].name);
+    }
+
+    printf("\n");
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        for (size_t j = 0; j < sizeof(aligns) / sizeof(aligns[0]); j++)
+        {
+            printf(
+                "%8zu %5zu %8.2f",
+                sizes[i],
+                aligns[j],
+                _bench(NULL, sizes[i], aligns[j], fill));
+
+            for (size_t k = 0; k < _nvariants; k++)
+            {
+                const variant_t* v = &_variants[k];
+
+                if (!_supported(v))
+                    continue;
+
+                if (sizes[i] < v->min)
+                    printf(" %8s", "-");
+                else
+                    printf(" %8.2f", _bench(v, sizes[i], aligns[j], fill));
+            }
+
+            printf("\n");
+        }
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    _features = myst_memops_detect();
+
+    printf(
+        "ERMS: %s, FSRM: %s, AVX2: %s, AVX-512: %s\n",
+        (_features & MYST_MEMOPS_ERMS) ? "yes" : "no",
+        (_features & MYST_MEMOPS_FSRM) ? "yes" : "no",
+        (_features & MYST_MEMOPS_AVX2) ? "yes" : "no",
+        (_features & MYST_MEMOPS_AVX512) ? "yes" : "no");
+
+    for (size_t i = 0; i < _nvariants; i++)
+    {
+        if (_supported(&_variants[i]))
+            test_copy_and_fill(&_variants[i]);
+    }
+
+    test_non_temporal();
+    test_mismatch();
+    test_strlen();
+
+    if (argc == 2 && strcmp(argv[1], "--bench") == 0)
+    {
+        bench(false);
+        bench(true);
+    }
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <myst/mman.h>
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096
+#endif
+
+#define PROT (MYST_PROT_READ | MYST_PROT_WRITE)
+#define FLAGS (MYST_MAP_ANONYMOUS | MYST_MAP_PRIVATE)
+
+static uint64_t _nanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+** bench_mman_fragmented()
+**
+**     Create NVADS live mappings separated by one-page holes, then repeatedly
+**     map and unmap a two-page region. No hole is big enough, so every mmap
+**     must search past all of the existing gaps, and every munmap must look
+**     up the mapping by address. This is the access pattern that made the
+**     original linear VAD list O(N).
+*/
+static void bench_mman_fragmented(size_t nvads, size_t iterations)
+{
+    myst_mman_t h;
+    const size_t heap_size = (nvads * 2 + 1024) * PAGE_SIZE;
+    void* base;
+    void** addrs;
+
+    assert((base = memalign(PAGE_SIZE, heap_size)));
+    assert(myst_mman_init(&h, (uintptr_t)base, heap_size) == 0);
+    assert((addrs = calloc(nvads, sizeof(void*))));
+
+    /* Map single pages back to back */
+    for (size_t i = 0; i < nvads * 2; i++)
+    {
+        void* addr;
+        assert(myst_mman_mmap(&h, NULL, PAGE_SIZE, PROT, FLAGS, &addr) == 0);
+
+        if (i % 2 == 0)
+            addrs[i / 2] = addr;
+    }
+
+    /* Punch one-page holes between the mappings */
+    for (size_t i = 0; i < nvads; i++)
+        assert(myst_mman_munmap(&h, addrs[i], PAGE_SIZE) == 0);
+
+    uint64_t start = _nanoseconds();
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        const size_t length = 2 * PAGE_SIZE;
+        void* addr;
+
+        assert(myst_mman_mmap(&h, NULL, length, PROT, FLAGS, &addr) == 0);
+        assert(myst_mman_munmap(&h, addr, length) == 0);
+    }
+
+    uint64_t elapsed = _nanoseconds() - start;
+
+    printf(
+        "=== bench_mman_fragmented: vads=%zu iterations=%zu "
+        "ns/(mmap+munmap)=%lu\n",
+        nvads,
+        iterations,
+        elapsed / iterations);
+
+    assert(myst_mman_is_sane(&h));
+
+    free(addrs);
+    free(base);
+}
+
+void bench_mman(void)
+{
+    bench_mman_fragmented(1000, 10000);
+    bench_mman_fragmented(10000, 10000);
+    bench_mman_fragmented(30000, 10000);
+}
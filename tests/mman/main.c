@@ -2,10 +2,18 @@
 // Licensed under the MIT License.
 
 #include <stdio.h>
+#include <string.h>
 
 int main(int argc, const char* argv[])
 {
     extern void test_mman(void);
+    extern void bench_mman(void);
+
+    if (argc == 2 && strcmp(argv[1], "--bench") == 0)
+    {
+        bench_mman();
+        return 0;
+    }
 
     test_mman();
     printf("passed test (%s)\n", argv[0]);
@@ -883,6 +883,411 @@ void test_out_of_memory()
     printf("=== passed test (%s)\n", __FUNCTION__);
 }
 
+/* Helper for calling myst_mman_arena_mmap() */
+static void* _mman_arena_mmap(myst_mman_t* heap, uint64_t key, size_t length)
+{
+    int prot = MYST_PROT_READ | MYST_PROT_WRITE;
+    int flags = MYST_MAP_ANONYMOUS | MYST_MAP_PRIVATE;
+    void* result = NULL;
+
+    if (myst_mman_arena_mmap(heap, key, length, prot, flags, &result) != 0)
+    {
+        printf("ERROR: myst_mman_arena_mmap(): %s\n", heap->err);
+        assert("myst_mman_arena_mmap(): failed" == NULL);
+    }
+
+    return result;
+}
+
+/*
+** test_mman_arenas()
+**
+**     Randomly map, unmap, and remap memory through several arenas while
+**     checking that no two live mappings overlap. Then release the arenas
+**     and check that everything has been returned to the heap.
+*/
+void test_mman_arenas()
+{
+    myst_mman_t h;
+    const size_t heap_size = 128 * 1024 * 1024;
+    size_t free_size;
+    static elem_t elem[1024];
+    const size_t N = sizeof(elem) / sizeof(elem[0]);
+    const size_t M = 10000;
+
+    assert(_init_mman(&h, heap_size) == 0);
+    myst_mman_set_arenas(&h, true);
+
+    for (size_t i = 0; i < M; i++)
+    {
+        size_t r = (size_t)_rand() % N;
+
+        if (elem[r].addr)
+        {
+            uint8_t* p = elem[r].addr;
+
+            for (size_t j = 0; j < elem[r].size; j++)
+                assert(p[j] == (uint8_t)r);
+
+            if (_rand() % 4)
+            {
+                assert(_mman_unmap(&h, elem[r].addr, elem[r].size) == 0);
+                elem[r].addr = NULL;
+                elem[r].size = 0;
+                continue;
+            }
+
+            size_t new_size = (size_t)(_rand() % 32 + 1) * PAGE_SIZE;
+            elem[r].addr =
+                _mman_remap(&h, elem[r].addr, elem[r].size, new_size);
+            elem[r].size = new_size;
+        }
+        else
+        {
+            size_t size = (size_t)(_rand() % 24 + 1) * PAGE_SIZE;
+            uint64_t key = (uint64_t)_rand() % (MYST_MMAN_NUM_ARENAS * 2);
+
+            elem[r].addr = _mman_arena_mmap(&h, key, size);
+            elem[r].size = size;
+        }
+
+        memset(elem[r].addr, (uint8_t)r, elem[r].size);
+    }
+
+    /* Unmap all remaining memory */
+    for (size_t i = 0; i < N; i++)
+    {
+        if (elem[i].addr)
+            assert(_mman_unmap(&h, elem[i].addr, elem[i].size) == 0);
+    }
+
+    /* Pages held by arenas still count as free */
+    assert(myst_mman_free_size(&h, &free_size) == 0);
+    assert(free_size == h.end - h.start);
+
+    myst_mman_release_arenas(&h);
+    assert(h.vad_list == NULL);
+    assert(myst_mman_is_sane(&h));
+
+    _free_mman(&h);
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/*
+** test_mman_arena_overlap()
+**
+**     Check that mappings other than read-write ones bypass the arenas, that
+**     a fixed mapping over free arena pages takes them out of the arena, and
+**     that an unmap across an arena's boundary gives the pages inside it
+**     back to the arena and unmaps the rest.
+*/
+void test_mman_arena_overlap()
+{
+    myst_mman_t h;
+    const int prot = MYST_PROT_READ;
+    const int flags = MYST_MAP_ANONYMOUS | MYST_MAP_PRIVATE;
+    const size_t arena_size = MYST_MMAN_ARENA_PAGES * PAGE_SIZE;
+    uint8_t* base;
+    uint8_t* v;
+    void* p;
+
+    assert(_init_mman(&h, 16 * 1024 * 1024) == 0);
+    myst_mman_set_arenas(&h, true);
+
+    base = _mman_arena_mmap(&h, 0, PAGE_SIZE);
+    assert(base == (uint8_t*)h.arenas[0].base);
+
+    /* a read-only mapping does not come from the read-write arena */
+    assert(myst_mman_arena_mmap(&h, 0, PAGE_SIZE, prot, flags, &p) == 0);
+    assert((uint8_t*)p + PAGE_SIZE <= base || (uint8_t*)p >= base + arena_size);
+    assert(_mman_unmap(&h, p, PAGE_SIZE) == 0);
+
+    /* the arena does not hand out the pages of a fixed mapping again */
+    assert(_mman_mmap(&h, base + PAGE_SIZE, PAGE_SIZE) == base + PAGE_SIZE);
+    assert(_mman_arena_mmap(&h, 0, PAGE_SIZE) == base + 2 * PAGE_SIZE);
+
+    /* unmap a VAD mapping below the arena along with the arena pages */
+    v = _mman_mmap(&h, NULL, 2 * PAGE_SIZE);
+    assert(v + 2 * PAGE_SIZE == base);
+    assert(_mman_unmap(&h, v, 5 * PAGE_SIZE) == 0);
+    assert(!myst_mman_is_mapped(&h, v, 2 * PAGE_SIZE));
+    assert(h.arenas[0].nfree == MYST_MMAN_ARENA_PAGES);
+    assert(_mman_arena_mmap(&h, 0, 3 * PAGE_SIZE) == base);
+
+    myst_mman_release_arenas(&h);
+    assert(myst_mman_is_sane(&h));
+
+    _free_mman(&h);
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/*
+** test_mman_defer_scrub()
+**
+**     Check that deferred scrubbing queues unmapped ranges, scrubs them in
+**     bounded steps, and never hands out memory that is not zero-filled or
+**     scrubbed.
+*/
+void test_mman_defer_scrub()
+{
+    myst_mman_t h;
+    const size_t heap_size = 16 * 1024 * 1024;
+    const size_t length = 1024 * 1024;
+    uint8_t* p;
+    uint8_t* q;
+    void* brk;
+
+    assert(_init_mman(&h, heap_size) == 0);
+    myst_mman_set_defer_scrub(&h, true);
+
+    /* Unmapping queues the range and scrubs only one step of it */
+    p = _mman_mmap(&h, NULL, length);
+    memset(p, 0xAB, length);
+    assert(_mman_unmap(&h, p, length) == 0);
+    assert(h.num_dirty == 1);
+    assert(p[0] == 0xAB);
+    assert(p[length - 1] == 0xDD);
+
+    /* Mapping the range again drops the pending scrub and zero-fills it */
+    q = _mman_mmap(&h, NULL, length);
+    assert(q == p);
+    assert(h.num_dirty == 0);
+
+    for (size_t i = 0; i < length; i++)
+        assert(q[i] == 0);
+
+    /* An explicit scrub finishes all queued ranges */
+    memset(q, 0xAB, length);
+    assert(_mman_unmap(&h, q, length) == 0);
+    assert(myst_mman_scrub(&h, SIZE_MAX) == length - MYST_MMAN_SCRUB_STEP);
+    assert(h.num_dirty == 0);
+
+    for (size_t i = 0; i < length; i++)
+        assert(q[i] == 0xDD);
+
+    /* Break memory that overlaps a queued range is scrubbed first */
+    p = _mman_mmap(&h, NULL, length);
+    memset(p, 0xAB, length);
+    assert(_mman_unmap(&h, p, length) == 0);
+    assert(h.map == h.end);
+    assert(myst_mman_sbrk(&h, 0, &brk) == 0);
+    assert(myst_mman_brk(&h, (void*)(h.end - PAGE_SIZE), &brk) == 0);
+    assert(h.num_dirty == 0);
+
+    for (size_t i = 0; i < length; i++)
+        assert(p[i] == 0xDD);
+
+    assert(myst_mman_is_sane(&h));
+
+    _free_mman(&h);
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static size_t _committed;
+static size_t _commit_limit;
+
+static int _commit(void* addr, size_t size, bool commit, void* arg)
+{
+    assert(arg == &_committed);
+    assert((uintptr_t)addr % PAGE_SIZE == 0);
+    assert(size % PAGE_SIZE == 0);
+
+    if (commit)
+    {
+        if (_committed + size > _commit_limit)
+            return -ENOMEM;
+
+        _committed += size;
+    }
+    else
+    {
+        assert(size <= _committed);
+        _committed -= size;
+    }
+
+    return 0;
+}
+
+/*
+** test_mman_commit()
+**
+**     Check that the commit callback is only asked for memory as the BREAK
+**     and MAPPED sections grow, that memory is given back as they shrink,
+**     and that a failed commit causes the allocation to fail.
+*/
+void test_mman_commit()
+{
+    myst_mman_t h;
+    const size_t heap_size = 64 * 1024 * 1024;
+    const size_t chunk = MYST_MMAN_COMMIT_CHUNK;
+    void* p;
+    void* q;
+    void* brk;
+
+    assert(_init_mman(&h, heap_size) == 0);
+    _committed = 0;
+    _commit_limit = SIZE_MAX;
+    assert(myst_mman_set_commit(&h, _commit, &_committed) == 0);
+    assert(_committed == 0);
+
+    /* A small mapping commits one chunk at the top */
+    p = _mman_mmap(&h, NULL, PAGE_SIZE);
+    assert(_committed == chunk);
+    assert(h.map_commit == h.end - chunk);
+
+    /* A larger mapping commits only the chunks it needs */
+    q = _mman_mmap(&h, NULL, 3 * chunk);
+    assert(_committed == 4 * chunk);
+
+    /* Unmapping keeps one chunk of slack before decommitting */
+    assert(_mman_unmap(&h, q, 3 * chunk) == 0);
+    assert(_committed == chunk);
+    assert(_mman_unmap(&h, p, PAGE_SIZE) == 0);
+    assert(_committed == chunk);
+
+    /* Growing the break commits from the bottom up */
+    assert(myst_mman_sbrk(&h, (ptrdiff_t)PAGE_SIZE, &brk) == 0);
+    assert(brk == (void*)h.start);
+    assert(_committed == 2 * chunk);
+    assert(h.brk_commit == h.start + chunk);
+
+    assert(myst_mman_brk(&h, (void*)(h.start + 4 * chunk), &brk) == 0);
+    assert(_committed == 5 * chunk);
+
+    assert(myst_mman_brk(&h, (void*)(h.start + PAGE_SIZE), &brk) == 0);
+    assert(_committed == 2 * chunk);
+
+    /* Allocations fail when memory cannot be committed */
+    _commit_limit = _committed;
+    assert(myst_mman_sbrk(&h, (ptrdiff_t)(2 * chunk), &brk) == -ENOMEM);
+    {
+        int prot = MYST_PROT_READ | MYST_PROT_WRITE;
+        int flags = MYST_MAP_ANONYMOUS | MYST_MAP_PRIVATE;
+        int r = myst_mman_mmap(&h, NULL, 2 * chunk, prot, flags, &p);
+        assert(r == -ENOMEM);
+    }
+    assert(_committed == 2 * chunk);
+
+    /* Memory inside the committed chunks is still available */
+    p = _mman_mmap(&h, NULL, PAGE_SIZE);
+    assert(p != NULL);
+    assert(_mman_unmap(&h, p, PAGE_SIZE) == 0);
+
+    assert(myst_mman_is_sane(&h));
+
+    _free_mman(&h);
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+void test_mman_is_mapped()
+{
+    myst_mman_t h;
+    const size_t heap_size = 16 * 1024 * 1024;
+    uint8_t* p;
+    uint8_t* q;
+    void* brk;
+
+    assert(_init_mman(&h, heap_size) == 0);
+
+    /* Adjacent mappings count as one range */
+    p = _mman_mmap(&h, NULL, 2 * PAGE_SIZE);
+    q = _mman_mmap(&h, NULL, 2 * PAGE_SIZE);
+    assert(q + 2 * PAGE_SIZE == p);
+    assert(myst_mman_is_mapped(&h, q, 4 * PAGE_SIZE));
+    assert(myst_mman_is_mapped(&h, q + PAGE_SIZE, 2 * PAGE_SIZE));
+    assert(!myst_mman_is_mapped(&h, q - PAGE_SIZE, 2 * PAGE_SIZE));
+    assert(!myst_mman_is_mapped(&h, p, 3 * PAGE_SIZE));
+
+    /* A hole splits them */
+    assert(_mman_unmap(&h, q + PAGE_SIZE, PAGE_SIZE) == 0);
+    assert(myst_mman_is_mapped(&h, q, PAGE_SIZE));
+    assert(!myst_mman_is_mapped(&h, q, 4 * PAGE_SIZE));
+
+    /* The break memory is mapped too */
+    assert(myst_mman_sbrk(&h, 2 * PAGE_SIZE, &brk) == 0);
+    assert(myst_mman_is_mapped(&h, brk, 2 * PAGE_SIZE));
+    assert(!myst_mman_is_mapped(&h, brk, 3 * PAGE_SIZE));
+
+    _free_mman(&h);
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+void test_mman_remap_growth()
+{
+    myst_mman_t h;
+    const size_t heap_size = 16 * 1024 * 1024;
+    uint8_t* p;
+    uint8_t* q;
+    uint8_t* r;
+    uint8_t* s;
+
+    assert(_init_mman(&h, heap_size) == 0);
+
+    p = _mman_mmap(&h, NULL, 2 * PAGE_SIZE);
+    q = _mman_mmap(&h, NULL, 2 * PAGE_SIZE);
+    assert(q + 2 * PAGE_SIZE == p);
+    memset(q, 0xab, 2 * PAGE_SIZE);
+
+    /* Q cannot grow in place: it moves, keeping its contents */
+    r = _mman_remap(&h, q, 2 * PAGE_SIZE, 4 * PAGE_SIZE);
+    assert(r != q);
+    assert(r[0] == 0xab && r[2 * PAGE_SIZE - 1] == 0xab);
+    assert(r[2 * PAGE_SIZE] == 0 && r[4 * PAGE_SIZE - 1] == 0);
+
+    /* ... to where it has room to grow again */
+    assert(_mman_remap(&h, r, 4 * PAGE_SIZE, 6 * PAGE_SIZE) == r);
+    assert(r[0] == 0xab && r[6 * PAGE_SIZE - 1] == 0);
+
+    /* A new mapping after it leaves it room to grow */
+    s = _mman_mmap(&h, NULL, PAGE_SIZE);
+    assert(s == p - PAGE_SIZE);
+    assert(_mman_remap(&h, r, 6 * PAGE_SIZE, 7 * PAGE_SIZE) == r);
+    assert(r + 7 * PAGE_SIZE == s);
+
+    _free_mman(&h);
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+void test_mman_small_gaps()
+{
+    myst_mman_t h;
+    const size_t heap_size = 16 * 1024 * 1024;
+    const size_t big = 2 * 1024 * 1024;
+    myst_mman_stats_t stats;
+    uint8_t* p[5];
+
+    assert(_init_mman(&h, heap_size) == 0);
+
+    /* leave a small gap above a large one (at the lower address) */
+    p[0] = _mman_mmap(&h, NULL, PAGE_SIZE);
+    p[1] = _mman_mmap(&h, NULL, 4 * PAGE_SIZE);
+    p[2] = _mman_mmap(&h, NULL, PAGE_SIZE);
+    p[3] = _mman_mmap(&h, NULL, big);
+    p[4] = _mman_mmap(&h, NULL, PAGE_SIZE);
+    assert(_mman_unmap(&h, p[1], 4 * PAGE_SIZE) == 0);
+    assert(_mman_unmap(&h, p[3], big) == 0);
+
+    assert(myst_mman_stats(&h, &stats) == 0);
+    assert(stats.gaps == 2);
+    assert(stats.gap_histogram[1] == 1); /* up to 16K */
+    assert(stats.gap_histogram[5] == 1); /* up to 4M */
+    assert(stats.largest_free == stats.unassigned);
+    assert(stats.unassigned == (uintptr_t)p[4] - stats.brk);
+
+    /* a small mapping takes the small gap rather than the lowest one */
+    assert(_mman_mmap(&h, NULL, 2 * PAGE_SIZE) == p[1]);
+
+    /* so the large gap is left whole */
+    assert(_mman_mmap(&h, NULL, big) == p[3]);
+
+    assert(myst_mman_stats(&h, &stats) == 0);
+    assert(stats.gaps == 1);
+    assert(stats.gap_histogram[1] == 1);
+
+    _free_mman(&h);
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 void test_mman(void)
 {
     test_mman_1();
@@ -897,4 +1302,11 @@ void test_mman(void)
     test_remap_4();
     test_out_of_memory();
     test_mman_randomly();
+    test_mman_arenas();
+    test_mman_arena_overlap();
+    test_mman_defer_scrub();
+    test_mman_commit();
+    test_mman_is_mapped();
+    test_mman_remap_growth();
+    test_mman_small_gaps();
 }
@@ -0,0 +1,141 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BATCH 64
+#define PORT 12346
+
+static struct mmsghdr _msgs[BATCH];
+static struct iovec _iovs[BATCH][2];
+static char _bufs[BATCH][16];
+static struct sockaddr_in _names[BATCH];
+
+/* Each message is "msgNN" split over two buffers */
+static void _init_send(struct sockaddr_in* to)
+{
+    memset(_msgs, 0, sizeof(_msgs));
+
+    for (int i = 0; i < BATCH; i++)
+    {
+        snprintf(_bufs[i], sizeof(_bufs[i]), "msg%02d", i);
+        _iovs[i][0].iov_base = _bufs[i];
+        _iovs[i][0].iov_len = 3;
+        _iovs[i][1].iov_base = _bufs[i] + 3;
+        _iovs[i][1].iov_len = 2;
+        _msgs[i].msg_hdr.msg_iov = _iovs[i];
+        _msgs[i].msg_hdr.msg_iovlen = 2;
+        _msgs[i].msg_hdr.msg_name = to;
+        _msgs[i].msg_hdr.msg_namelen = to ? sizeof(*to) : 0;
+    }
+}
+
+static void _init_recv(void)
+{
+    memset(_msgs, 0, sizeof(_msgs));
+    memset(_bufs, 0, sizeof(_bufs));
+
+    for (int i = 0; i < BATCH; i++)
+    {
+        _iovs[i][0].iov_base = _bufs[i];
+        _iovs[i][0].iov_len = sizeof(_bufs[i]);
+        _msgs[i].msg_hdr.msg_iov = _iovs[i];
+        _msgs[i].msg_hdr.msg_iovlen = 1;
+        _msgs[i].msg_hdr.msg_name = &_names[i];
+        _msgs[i].msg_hdr.msg_namelen = sizeof(_names[i]);
+    }
+}
+
+static void _check_recv(int n, bool named)
+{
+    for (int i = 0; i < n; i++)
+    {
+        char expect[16];
+
+        snprintf(expect, sizeof(expect), "msg%02d", i);
+        assert(_msgs[i].msg_len == 5);
+        assert(memcmp(_bufs[i], expect, 5) == 0);
+
+        if (named)
+        {
+            assert(_msgs[i].msg_hdr.msg_namelen == sizeof(struct sockaddr_in));
+            assert(_names[i].sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+        }
+    }
+}
+
+static void _test_udp(void)
+{
+    struct sockaddr_in addr;
+    struct timespec timeout = {1, 0};
+    int server;
+    int client;
+    int rcvbuf = 1024 * 1024;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert((server = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    assert(
+        setsockopt(server, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) ==
+        0);
+    assert(bind(server, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert((client = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+
+    _init_send(&addr);
+    assert(sendmmsg(client, _msgs, BATCH, 0) == BATCH);
+
+    for (int i = 0; i < BATCH; i++)
+        assert(_msgs[i].msg_len == 5);
+
+    /* the whole batch arrives in order, each with its sender's name */
+    _init_recv();
+    assert(recvmmsg(server, _msgs, BATCH, MSG_WAITFORONE, &timeout) == BATCH);
+    _check_recv(BATCH, true);
+
+    /* nothing is left */
+    assert(recvmmsg(server, _msgs, BATCH, MSG_DONTWAIT, NULL) == -1);
+    assert(errno == EAGAIN);
+
+    assert(close(client) == 0);
+    assert(close(server) == 0);
+}
+
+static void _test_unix(void)
+{
+    int sv[2];
+
+    assert(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == 0);
+
+    _init_send(NULL);
+    assert(sendmmsg(sv[0], _msgs, 8, 0) == 8);
+
+    /* MSG_WAITFORONE returns what is queued once one message arrived */
+    _init_recv();
+    assert(recvmmsg(sv[1], _msgs, BATCH, MSG_WAITFORONE, NULL) == 8);
+    _check_recv(8, false);
+
+    assert(close(sv[0]) == 0);
+    assert(close(sv[1]) == 0);
+}
+
+int main(int argc, const char* argv[])
+{
+    _test_udp();
+    _test_unix();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
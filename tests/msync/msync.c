@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,6 +12,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #ifndef PAGE_SIZE
@@ -78,6 +80,51 @@ static bool _check_page(uint8_t page[PAGE_SIZE], uint8_t byte)
     return true;
 }
 
+extern char** environ;
+
+/* Map the first page of the file, change it, reuse the descriptor for
+ * another file and exit without unmapping the page */
+static int _exit_child(void)
+{
+    int fd;
+    uint8_t* addr;
+
+    assert((fd = open("/msync", O_RDWR)) >= 0);
+
+    addr = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(addr != MAP_FAILED);
+    memset(addr, 0xab, PAGE_SIZE);
+
+    /* the mapping does not depend on the descriptor */
+    assert(close(fd) == 0);
+    assert(dup2(STDERR_FILENO, fd) == fd);
+
+    return 0;
+}
+
+/* Check that the pages a process changed are written back when it exits */
+static void _test_exit_without_munmap(const char* path)
+{
+    char* const argv[] = {(char*)path, "exit-child", NULL};
+    uint8_t page[PAGE_SIZE];
+    pid_t pid;
+    int wstatus;
+    int fd;
+
+    assert(posix_spawn(&pid, path, NULL, NULL, argv, environ) == 0);
+    assert(waitpid(pid, &wstatus, 0) == pid);
+    assert(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0);
+
+    assert((fd = open("/msync", O_RDONLY)) >= 0);
+    assert(_readn(fd, page, PAGE_SIZE) == 0);
+    assert(_check_page(page, 0xab) == true);
+
+    /* the rest of the file is unchanged */
+    assert(_readn(fd, page, PAGE_SIZE) == 0);
+    assert(_check_page(page, 2) == true);
+    assert(close(fd) == 0);
+}
+
 int main(int argc, const char* argv[])
 {
     const size_t num_pages = 8;
@@ -85,6 +132,9 @@ int main(int argc, const char* argv[])
     int fd;
     struct stat st;
 
+    if (argc == 2 && strcmp(argv[1], "exit-child") == 0)
+        return _exit_child();
+
     /* create a new file */
     assert((fd = open("/msync", O_CREAT | O_TRUNC | O_RDWR, 0666)) >= 0);
 
@@ -176,6 +226,8 @@ int main(int argc, const char* argv[])
         assert(close(fd) == 0);
     }
 
+    _test_exit_without_munmap(argv[0]);
+
     printf("=== passed test (%s)\n", argv[0]);
 
     return 0;
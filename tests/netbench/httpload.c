@@ -0,0 +1,341 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+**==============================================================================
+**
+** A keep-alive HTTP load generator. It runs on the host, against a server
+** running natively or in Mystikos. Several connections each send GET
+** requests one after another for a fixed time. A connection that the
+** server closes is reopened. One JSON object goes to stdout:
+**
+**     { "name": ..., "requests": ..., "errors": ..., "requests_per_sec": ...,
+**       "p50_usec": ..., "p90_usec": ..., "p99_usec": ..., "p999_usec": ... }
+**
+** Usage: httpload [--connections=N] [--seconds=N] [--name=NAME] host port
+**        [path]
+**
+**==============================================================================
+*/
+
+#define MAX_SAMPLES (1024 * 1024)
+#define RESPONSE_SIZE 65536
+
+/* a response that takes longer than this counts as an error */
+#define TIMEOUT_SECONDS 5
+
+static const char* _host;
+static const char* _port;
+static const char* _path = "/";
+static const char* _name = "http";
+static size_t _connections = 8;
+static size_t _seconds = 10;
+static uint64_t _deadline;
+
+typedef struct worker
+{
+    pthread_t thread;
+    uint64_t* lat; /* the nanoseconds of each request */
+    size_t count;
+    size_t errors;
+} worker_t;
+
+static uint64_t _nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+static int _connect(void)
+{
+    struct addrinfo hints;
+    struct addrinfo* ai = NULL;
+    const int one = 1;
+    const struct timeval tv = {TIMEOUT_SECONDS, 0};
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(_host, _port, &hints, &ai) != 0)
+        return -1;
+
+    if ((fd = socket(ai->ai_family, ai->ai_socktype, 0)) < 0)
+        goto done;
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+    {
+        close(fd);
+        fd = -1;
+        goto done;
+    }
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+done:
+    freeaddrinfo(ai);
+    return fd;
+}
+
+/* Find the end of the headers and the Content-Length (-1 if none) */
+static char* _parse_headers(char* buf, long* length, bool* close)
+{
+    char* end;
+
+    if (!(end = strstr(buf, "\r\n\r\n")))
+        return NULL;
+
+    *length = -1;
+    *close = strncmp(buf, "HTTP/1.0", 8) == 0;
+
+    for (char* p = strstr(buf, "\r\n"); p && p < end; p = strstr(p, "\r\n"))
+    {
+        p += 2;
+
+        if (strncasecmp(p, "Content-Length:", 15) == 0)
+            *length = strtol(p + 15, NULL, 10);
+        else if (strncasecmp(p, "Connection: close", 17) == 0)
+            *close = true;
+        else if (strncasecmp(p, "Connection: keep-alive", 22) == 0)
+            *close = false;
+    }
+
+    return end + 4;
+}
+
+/* Send one request and read its response; returns false on failure */
+static bool _request(int fd, const char* req, size_t len, bool* close)
+{
+    static __thread char buf[RESPONSE_SIZE];
+    size_t n = 0;
+    char* body = NULL;
+    long length = -1;
+
+    if (send(fd, req, len, MSG_NOSIGNAL) != (ssize_t)len)
+        return false;
+
+    for (;;)
+    {
+        ssize_t r;
+
+        if (n + 1 >= sizeof(buf))
+            return false;
+
+        if ((r = recv(fd, buf + n, sizeof(buf) - n - 1, 0)) < 0)
+            return false;
+
+        /* without a length, the response ends when the server closes */
+        if (r == 0)
+        {
+            *close = true;
+            return body && length < 0;
+        }
+
+        n += (size_t)r;
+        buf[n] = '\0';
+
+        if (!body && !(body = _parse_headers(buf, &length, close)))
+            continue;
+
+        if (length >= 0 && (size_t)(buf + n - body) >= (size_t)length)
+            return true;
+    }
+}
+
+static void* _worker(void* arg)
+{
+    worker_t* w = (worker_t*)arg;
+    char req[1024];
+    int fd = -1;
+    int len;
+
+    len = snprintf(
+        req,
+        sizeof(req),
+        "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n",
+        _path,
+        _host);
+
+    while (_nsec() < _deadline && w->count < MAX_SAMPLES)
+    {
+        bool close_after = false;
+        uint64_t start;
+
+        if (fd < 0 && (fd = _connect()) < 0)
+        {
+            w->errors++;
+            usleep(1000);
+            continue;
+        }
+
+        start = _nsec();
+
+        if (!_request(fd, req, (size_t)len, &close_after))
+        {
+            w->errors++;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        w->lat[w->count++] = _nsec() - start;
+
+        if (close_after)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+
+    return NULL;
+}
+
+static int _compare(const void* a, const void* b)
+{
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double _percentile(const uint64_t* lat, size_t n, double p)
+{
+    size_t i = (size_t)((double)n * p / 100.0);
+
+    if (n == 0)
+        return 0;
+
+    if (i >= n)
+        i = n - 1;
+
+    return (double)lat[i] / 1000.0;
+}
+
+static const char* _option(const char* arg, const char* name)
+{
+    size_t len = strlen(name);
+
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=')
+        return arg + len + 1;
+
+    return NULL;
+}
+
+int main(int argc, const char* argv[])
+{
+    worker_t* workers;
+    uint64_t* all;
+    size_t total = 0;
+    size_t errors = 0;
+    uint64_t start;
+    double secs;
+    int i = 1;
+
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++)
+    {
+        const char* v;
+
+        if ((v = _option(argv[i], "--connections")))
+            _connections = strtoul(v, NULL, 10);
+        else if ((v = _option(argv[i], "--seconds")))
+            _seconds = strtoul(v, NULL, 10);
+        else if ((v = _option(argv[i], "--name")))
+            _name = v;
+        else
+            break;
+    }
+
+    if (argc - i < 2 || argc - i > 3 || _connections == 0)
+    {
+        fprintf(
+            stderr,
+            "Usage: %s [--connections=N] [--seconds=N] [--name=NAME] "
+            "host port [path]\n",
+            argv[0]);
+        return 1;
+    }
+
+    _host = argv[i];
+    _port = argv[i + 1];
+
+    if (argc - i == 3)
+        _path = argv[i + 2];
+
+    if (!(workers = calloc(_connections, sizeof(worker_t))))
+        return 1;
+
+    start = _nsec();
+    _deadline = start + _seconds * 1000000000UL;
+
+    for (size_t j = 0; j < _connections; j++)
+    {
+        worker_t* w = &workers[j];
+
+        if (!(w->lat = malloc(MAX_SAMPLES * sizeof(uint64_t))) ||
+            pthread_create(&w->thread, NULL, _worker, w) != 0)
+        {
+            fprintf(stderr, "%s: cannot start worker\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t j = 0; j < _connections; j++)
+    {
+        pthread_join(workers[j].thread, NULL);
+        total += workers[j].count;
+        errors += workers[j].errors;
+    }
+
+    secs = (double)(_nsec() - start) / 1e9;
+
+    if (!(all = malloc((total ? total : 1) * sizeof(uint64_t))))
+        return 1;
+
+    for (size_t j = 0, k = 0; j < _connections; j++)
+    {
+        memcpy(&all[k], workers[j].lat, workers[j].count * sizeof(uint64_t));
+        k += workers[j].count;
+        free(workers[j].lat);
+    }
+
+    qsort(all, total, sizeof(uint64_t), _compare);
+
+    printf(
+        "{ \"name\": \"%s\", \"requests\": %zu, \"errors\": %zu, "
+        "\"requests_per_sec\": %.1f, \"p50_usec\": %.1f, \"p90_usec\": %.1f, "
+        "\"p99_usec\": %.1f, \"p999_usec\": %.1f }\n",
+        _name,
+        total,
+        errors,
+        (double)total / secs,
+        _percentile(all, total, 50),
+        _percentile(all, total, 90),
+        _percentile(all, total, 99),
+        _percentile(all, total, 99.9));
+
+    free(all);
+    free(workers);
+
+    /* a run without a single response is a failure */
+    return total ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+#
+# The result files of "make bench" in tests/netbench:
+#
+#     netbench.py sockperf NAME < output -- turn the output of a sockperf
+#         client into one JSON result
+#     netbench.py merge OUT FILE... -- merge results (one JSON object per
+#         line) into a results file, keyed by name
+#     netbench.py compare BASELINE CURRENT [THRESHOLD] -- print both and fail
+#         if a metric is worse in CURRENT by more than THRESHOLD percent (10)
+#
+# Each result has a name, where it ran (as part of the name) and metrics.
+# Latencies (*_usec) are better when lower, rates (*_per_sec) when higher.
+
+import json
+import re
+import sys
+
+SOCKPERF_PATTERNS = [
+    # ping-pong and under-load
+    ("avg_usec", r"avg-latency=([0-9.]+)"),
+    ("avg_usec", r"Summary: Latency is ([0-9.]+) usec"),
+    ("p50_usec", r"percentile 50\.000 =\s*([0-9.]+)"),
+    ("p90_usec", r"percentile 90\.000 =\s*([0-9.]+)"),
+    ("p99_usec", r"percentile 99\.000 =\s*([0-9.]+)"),
+    ("p999_usec", r"percentile 99\.900 =\s*([0-9.]+)"),
+    # throughput
+    ("messages_per_sec", r"Summary: Message Rate is ([0-9.]+) \[msg/sec\]"),
+    ("mb_per_sec", r"Summary: BandWidth is ([0-9.]+) MBps"),
+]
+
+
+def sockperf(name):
+    result = {"name": name}
+
+    for line in sys.stdin:
+        for key, pattern in SOCKPERF_PATTERNS:
+            m = re.search(pattern, line)
+            if m and key not in result:
+                result[key] = float(m.group(1))
+
+    if len(result) == 1:
+        sys.exit("netbench: no sockperf results for " + name)
+
+    print(json.dumps(result))
+
+
+def merge(out, files):
+    results = {}
+
+    for path in files:
+        with open(path) as f:
+            for line in f:
+                line = line.strip()
+                if line.startswith("{"):
+                    r = json.loads(line)
+                    results[r.pop("name")] = r
+
+    with open(out, "w") as f:
+        json.dump({"results": results}, f, indent=4, sort_keys=True)
+        f.write("\n")
+
+
+def _worse(key, base, cur):
+    """Returns by how many percent CUR is worse than BASE (or None)"""
+    if not base:
+        return None
+    if key.endswith("_usec"):
+        return (cur - base) * 100.0 / base
+    if key.endswith("_per_sec"):
+        return (base - cur) * 100.0 / base
+    return None
+
+
+def compare(baseline, current, threshold):
+    with open(baseline) as f:
+        base = json.load(f)["results"]
+    with open(current) as f:
+        cur = json.load(f)["results"]
+
+    failed = []
+
+    for name in sorted(cur):
+        for key in sorted(cur[name]):
+            b = base.get(name, {}).get(key)
+            c = cur[name][key]
+            w = _worse(key, b, c) if b is not None else None
+            mark = ""
+            if w is not None and w > threshold:
+                mark = "  <-- worse by %.1f%%" % w
+                failed.append("%s.%s" % (name, key))
+            print(
+                "%-40s %12s %12s%s"
+                % (
+                    name + "." + key,
+                    "-" if b is None else "%.1f" % b,
+                    "%.1f" % c,
+                    mark,
+                )
+            )
+
+    if failed:
+        sys.exit("netbench: %d metrics regressed" % len(failed))
+
+
+def main(argv):
+    if len(argv) == 3 and argv[1] == "sockperf":
+        sockperf(argv[2])
+    elif len(argv) >= 3 and argv[1] == "merge":
+        merge(argv[2], argv[3:])
+    elif len(argv) in (4, 5) and argv[1] == "compare":
+        threshold = float(argv[4]) if len(argv) == 5 else 10.0
+        compare(argv[2], argv[3], threshold)
+    else:
+        sys.exit(
+            "Usage: %s sockperf NAME | merge OUT FILE... | "
+            "compare BASELINE CURRENT [THRESHOLD]" % argv[0]
+        )
+
+
+if __name__ == "__main__":
+    main(sys.argv)
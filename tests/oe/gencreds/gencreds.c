@@ -300,6 +300,18 @@ int main(int argc, const char* argv[])
         printf("private_key_size: %zu\n", private_key_size);
 
         _free_creds(cert, cert_size, private_key, private_key_size);
+
+        /* again (from the attestation cache with --attestation-cache-ttl) */
+        for (size_t i = 0; i < 2; i++)
+        {
+            assert(
+                test_gen_creds(
+                    &cert, &cert_size, &private_key, &private_key_size) == 0);
+
+            assert(test_verify_cert(cert, cert_size, _verifier, NULL) == 0);
+
+            _free_creds(cert, cert_size, private_key, private_key_size);
+        }
     }
 
     printf("=== passed test (%s)\n", argv[0]);
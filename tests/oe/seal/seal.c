@@ -102,12 +102,64 @@ void test_sealing(void)
     printf("=== passed test (%s)\n", __FUNCTION__);
 }
 
+/* The kernel derives each key once, so the keys must agree */
+void test_seal_keys(void)
+{
+    uint8_t* key1 = NULL;
+    size_t key1_size = 0;
+    uint8_t* key2 = NULL;
+    size_t key2_size = 0;
+    uint8_t* key3 = NULL;
+    size_t key3_size = 0;
+    uint8_t* info1 = NULL;
+    size_t info1_size = 0;
+    uint8_t* info2 = NULL;
+    size_t info2_size = 0;
+
+    assert(
+        oe_get_seal_key_by_policy_v2(
+            OE_SEAL_POLICY_UNIQUE,
+            &key1,
+            &key1_size,
+            &info1,
+            &info1_size) == OE_OK);
+
+    assert(
+        oe_get_seal_key_by_policy_v2(
+            OE_SEAL_POLICY_UNIQUE,
+            &key2,
+            &key2_size,
+            &info2,
+            &info2_size) == OE_OK);
+
+    assert(key1 != key2 && info1 != info2);
+    assert(key1_size == key2_size);
+    assert(memcmp(key1, key2, key1_size) == 0);
+    assert(info1_size == info2_size);
+    assert(memcmp(info1, info2, info1_size) == 0);
+
+    /* the key of the key info is the key of the policy */
+    assert(
+        oe_get_seal_key_v2(info1, info1_size, &key3, &key3_size) == OE_OK);
+    assert(key3_size == key1_size);
+    assert(memcmp(key1, key3, key1_size) == 0);
+
+    oe_free_seal_key(key1, info1);
+    oe_free_seal_key(key2, info2);
+    oe_free_seal_key(key3, NULL);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 int main(int argc, const char* argv[])
 {
     const char* target = getenv("MYST_TARGET");
 
     if (strcmp(target, "sgx") == 0)
+    {
         test_sealing();
+        test_seal_keys();
+    }
 
     printf("=== passed test (%s)\n", argv[0]);
 
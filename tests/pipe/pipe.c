@@ -4,6 +4,7 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
 #include <stdint.h>
@@ -197,6 +198,45 @@ void test_pipes(long slow_write, long slow_read)
     printf("=== passed test (%s: %s/%s)\n", __FUNCTION__, msg1, msg2);
 }
 
+static void* _blocked_read_thread(void* arg)
+{
+    char c;
+
+    (void)arg;
+    assert(read(pipefd[0], &c, 1) == 1);
+    assert(c == 'a');
+
+    return NULL;
+}
+
+/* a non-blocking read must not wait behind a blocked reader */
+void test_nonblocking_reader(void)
+{
+    pthread_t thread;
+    char c;
+
+    printf("=== start test (%s)\n", __FUNCTION__);
+
+    assert(pipe2(pipefd, 0) == 0);
+    assert(pthread_create(&thread, NULL, _blocked_read_thread, NULL) == 0);
+
+    /* give the reader time to block on the empty pipe */
+    sleep_msec(100);
+
+    assert(fcntl(pipefd[0], F_SETFL, O_NONBLOCK) == 0);
+    assert(read(pipefd[0], &c, 1) == -1);
+    assert(errno == EAGAIN);
+
+    /* wake the blocked reader */
+    assert(write(pipefd[1], "a", 1) == 1);
+    assert(pthread_join(thread, NULL) == 0);
+
+    assert(close(pipefd[0]) == 0);
+    assert(close(pipefd[1]) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 int main(int argc, const char* argv[])
 {
     /* test fast-writer/fast-reader */
@@ -211,6 +251,8 @@ int main(int argc, const char* argv[])
     /* test slow-writer/slow-reader */
     test_pipes(1, 1);
 
+    test_nonblocking_reader();
+
     printf("=== passed test (%s)\n", argv[0]);
 
     return 0;
@@ -3,6 +3,7 @@
 
 #define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
@@ -35,8 +36,16 @@ int main(int argc, const char* argv[])
 
     assert(pipe(pipefds) == 0);
 
+    /* new pipes have the Linux default capacity */
+    assert(fcntl(pipefds[0], F_GETPIPE_SZ) == 16 * PIPE_BUF);
+
+    /* capacities above the system maximum are refused */
+    assert(fcntl(pipefds[0], F_SETPIPE_SZ, 64 * 1024 * 1024) == -1);
+    assert(errno == EPERM);
+
     r = fcntl(pipefds[0], F_SETPIPE_SZ, 12345);
     printf("set.r=%d\n", r);
+    assert(r == 4 * PIPE_BUF);
 
     r = fcntl(pipefds[1], F_SETPIPE_SZ, 12345);
     printf("set.r=%d\n", r);
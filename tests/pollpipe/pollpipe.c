@@ -79,6 +79,43 @@ static void* _writer(void* arg)
     return NULL;
 }
 
+static void* _delayed_writer(void* arg)
+{
+    int* pipefd = (int*)arg;
+
+    _sleep_msec(100);
+    assert(write(pipefd[1], "x", 1) == 1);
+    return NULL;
+}
+
+/* a write to one pipe must wake a poller blocked on it without a timeout,
+ * while an idle pipe in the same set stays quiet */
+static void _test_blocking_wake(void)
+{
+    int pipefd[2];
+    int idlefd[2];
+    pthread_t writer;
+    struct pollfd fds[2];
+
+    assert(pipe(pipefd) == 0);
+    assert(pipe(idlefd) == 0);
+    assert(pthread_create(&writer, NULL, _delayed_writer, pipefd) == 0);
+
+    fds[0].fd = idlefd[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = pipefd[0];
+    fds[1].events = POLLIN;
+    assert(poll(fds, 2, -1) == 1);
+    assert(fds[0].revents == 0);
+    assert(fds[1].revents == POLLIN);
+
+    assert(pthread_join(writer, NULL) == 0);
+    assert(close(pipefd[0]) == 0);
+    assert(close(pipefd[1]) == 0);
+    assert(close(idlefd[0]) == 0);
+    assert(close(idlefd[1]) == 0);
+}
+
 int main(int argc, const char* argv[])
 {
     int pipefd[2];
@@ -97,6 +134,8 @@ int main(int argc, const char* argv[])
     assert(close(pipefd[0]) == 0);
     assert(close(pipefd[1]) == 0);
 
+    _test_blocking_wake();
+
     printf("=== passed test (%s)\n", argv[0]);
 
     return 0;
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
@@ -66,6 +67,87 @@ int test_self_links(const char* pn)
     test_self_fd();
 }
 
+static void _read_file(const char* path, char* buf, size_t size)
+{
+    int fd;
+    ssize_t n;
+
+    fd = open(path, O_RDONLY);
+    assert(fd > 0);
+    n = read(fd, buf, size - 1);
+    assert(n > 0);
+    buf[n] = '\0';
+    close(fd);
+}
+
+int test_self_stat()
+{
+    char buf[4096];
+    char line[64];
+    int pid;
+    char state;
+
+    _read_file("/proc/self/stat", buf, sizeof(buf));
+    assert(sscanf(buf, "%d (%*[^)]) %c", &pid, &state) == 2);
+    assert(pid == getpid());
+    assert(state == 'R');
+
+    _read_file("/proc/self/status", buf, sizeof(buf));
+    snprintf(line, sizeof(line), "\nPid:\t%d\n", getpid());
+    assert(strstr(buf, line));
+    assert(strstr(buf, "\nVmRSS:"));
+
+    _read_file("/proc/self/maps", buf, sizeof(buf));
+    assert(strchr(buf, '-'));
+
+    _read_file("/proc/self/statm", buf, sizeof(buf));
+}
+
+int test_cgroup()
+{
+    char buf[4096];
+    unsigned long total = 0;
+    unsigned long max = 0;
+    unsigned long current = 0;
+    unsigned long quota = 0;
+    unsigned long period = 0;
+    struct statfs st;
+
+    /* the process is in the root of the cgroup v2 hierarchy */
+    _read_file("/proc/self/cgroup", buf, sizeof(buf));
+    assert(strcmp(buf, "0::/\n") == 0);
+
+    _read_file("/proc/self/mountinfo", buf, sizeof(buf));
+    assert(strstr(buf, " /sys/fs/cgroup rw,relatime - cgroup2 cgroup2 rw\n"));
+    assert(strstr(buf, " /proc rw,relatime - proc proc rw\n"));
+
+    assert(statfs("/sys/fs/cgroup", &st) == 0);
+    assert(st.f_type == 0x63677270);
+
+    /* the memory limit is the memory of the kernel */
+    _read_file("/proc/meminfo", buf, sizeof(buf));
+    assert(sscanf(buf, "MemTotal: %lu kB", &total) == 1);
+
+    _read_file("/sys/fs/cgroup/memory.max", buf, sizeof(buf));
+    assert(sscanf(buf, "%lu", &max) == 1);
+    assert(max / 1024 == total);
+
+    _read_file("/sys/fs/cgroup/memory.current", buf, sizeof(buf));
+    assert(sscanf(buf, "%lu", &current) == 1);
+    assert(current > 0 && current < max);
+
+    /* the CPU limit is the online CPUs */
+    _read_file("/sys/fs/cgroup/cpu.max", buf, sizeof(buf));
+    assert(sscanf(buf, "%lu %lu", &quota, &period) == 2);
+    assert(quota / period == sysconf(_SC_NPROCESSORS_ONLN));
+
+    _read_file("/sys/fs/cgroup/memory.pressure", buf, sizeof(buf));
+    assert(strncmp(buf, "some avg10=", 11) == 0);
+
+    _read_file("/sys/devices/system/cpu/online", buf, sizeof(buf));
+    assert(buf[0] >= '0' && buf[0] <= '9');
+}
+
 int test_readonly()
 {
     int fd;
@@ -78,6 +160,8 @@ int main(int argc, const char* argv[])
 {
     test_meminfo();
     test_self_links(argv[0]);
+    test_self_stat();
+    test_cgroup();
     test_readonly();
 
     printf("\n=== passed test (%s)\n", argv[0]);
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/times.h>
 #include <unistd.h>
@@ -459,6 +460,118 @@ void test_exhaust_threads(void)
     printf("=== passed test (%s)\n", __FUNCTION__);
 }
 
+/*
+**==============================================================================
+**
+** test_reused_stacks()
+**
+**==============================================================================
+*/
+
+static __thread uint64_t _tls_value;
+
+static void* _reused_stack_thread(void* arg)
+{
+    /* the stack (and the TLS area on it) of a new thread is zero-filled */
+    assert(_tls_value == 0);
+    _tls_value = 0xdeadbeef;
+
+    return arg;
+}
+
+void test_reused_stacks(void)
+{
+    const size_t length = 256 * 1024;
+
+    printf("=== start test (%s)\n", __FUNCTION__);
+
+    /* each thread may get the stack of the one before it */
+    for (size_t i = 0; i < 32; i++)
+    {
+        pthread_t t;
+        void* retval;
+
+        assert(pthread_create(&t, NULL, _reused_stack_thread, (void*)i) == 0);
+        assert(pthread_join(t, &retval) == 0);
+        assert((uint64_t)retval == i);
+    }
+
+    /* an unmapped range that is mapped again is zero-filled too */
+    for (size_t i = 0; i < 4; i++)
+    {
+        uint8_t* p = mmap(
+            NULL,
+            length,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+            -1,
+            0);
+        assert(p != MAP_FAILED);
+
+        for (size_t j = 0; j < length; j++)
+            assert(p[j] == 0);
+
+        memset(p, 0xab, length);
+        assert(munmap(p, length) == 0);
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static uint8_t* _map_stack_sized(size_t length)
+{
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK;
+    uint8_t* p = mmap(NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+    assert(p != MAP_FAILED);
+    return p;
+}
+
+/* A range that was unmapped (and may be cached for the next stack) is not
+ * handed out again once part of it is unmapped or mapped over */
+void test_reused_stacks_overlap(void)
+{
+    const size_t length = 256 * 1024;
+    const size_t page = 4096;
+    uint8_t* p;
+    uint8_t* q;
+    uint8_t* r;
+
+    printf("=== start test (%s)\n", __FUNCTION__);
+
+    /* unmapping a page of it unmaps the rest too */
+    p = _map_stack_sized(length);
+    assert(munmap(p, length) == 0);
+    assert(munmap(p + page, page) == 0);
+    r = _map_stack_sized(length);
+    assert(madvise(r, length, MADV_WILLNEED) == 0);
+    assert(munmap(r, length) == 0);
+
+    /* a fixed mapping over a page of it keeps its contents */
+    p = _map_stack_sized(length);
+    assert(munmap(p, length) == 0);
+    q = mmap(
+        p,
+        page,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+        -1,
+        0);
+    assert(q == p);
+    memset(q, 0xcd, page);
+
+    r = _map_stack_sized(length);
+    assert(r + length <= q || r >= q + page);
+
+    for (size_t i = 0; i < page; i++)
+        assert(q[i] == 0xcd);
+
+    assert(munmap(r, length) == 0);
+    assert(munmap(q, page) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 /*
 **==============================================================================
 **
@@ -499,6 +612,8 @@ int main(int argc, const char* argv[])
         test_timedlock();
         test_cond_signal();
         test_cond_broadcast();
+        test_reused_stacks();
+        test_reused_stacks_overlap();
         if (_get_max_threads() != LONG_MAX)
             test_exhaust_threads();
     }
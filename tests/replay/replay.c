@@ -0,0 +1,560 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <myst/replay.h>
+
+/*
+**==============================================================================
+**
+** replay: run the syscalls of a replay trace (see myst/replay.h) again.
+**
+**     replay --workload <dir>    -- make the syscalls to record
+**     replay <trace> [<dir>]     -- replay a trace in <dir> (default /tmp)
+**
+**     The calls run one at a time, in the order they were entered, with
+**     buffers of the recorded sizes. The files they open are files of the
+**     replayer, filled with FILE_SIZE bytes, so that reads find data; the
+**     descriptors of each recorded process map to those of the replayer.
+**     The calls that need what the trace does not hold (paths, the memory
+**     of the program, other threads) are counted as skipped. At the end,
+**     the time of each syscall is compared with the recorded time.
+**
+**==============================================================================
+*/
+
+#define MAX_FDS 1024
+#define MAX_PROCS 64
+#define MAX_MAPS 256
+#define MAX_SYSCALLS 512
+#define MAX_BUF (1024 * 1024)
+#define FILE_SIZE (256 * 1024)
+
+typedef struct proc
+{
+    uint32_t pid;
+    int fds[MAX_FDS]; /* the replayer's descriptor for each recorded one */
+} proc_t;
+
+typedef struct map
+{
+    uint64_t recorded;
+    void* addr;
+    size_t length;
+} map_t;
+
+typedef struct stats
+{
+    uint64_t count;
+    uint64_t recorded_nsec;
+    uint64_t replayed_nsec;
+} stats_t;
+
+static proc_t _procs[MAX_PROCS];
+static size_t _nprocs;
+static map_t _maps[MAX_MAPS];
+static stats_t _stats[MAX_SYSCALLS];
+static uint64_t _skipped;
+static uint8_t* _buf;
+static const char* _dir = "/tmp";
+static char _path[256]; /* the file that the next open call opens */
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static proc_t* _get_proc(uint32_t pid)
+{
+    for (size_t i = 0; i < _nprocs; i++)
+    {
+        if (_procs[i].pid == pid)
+            return &_procs[i];
+    }
+
+    if (_nprocs == MAX_PROCS)
+        return NULL;
+
+    proc_t* p = &_procs[_nprocs++];
+    p->pid = pid;
+
+    for (size_t i = 0; i < MAX_FDS; i++)
+        p->fds[i] = -1;
+
+    /* the standard descriptors are not replayed onto the console */
+    for (int i = 0; i < 3; i++)
+        p->fds[i] = open("/dev/null", O_RDWR);
+
+    return p;
+}
+
+/* The replayer's descriptor for a recorded one (or -1) */
+static int _fd(proc_t* p, uint64_t fd)
+{
+    return fd < MAX_FDS ? p->fds[fd] : -1;
+}
+
+static void _set_fd(proc_t* p, int64_t recorded, int fd)
+{
+    if (recorded < 0 || recorded >= MAX_FDS)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    if (p->fds[recorded] >= 0)
+        close(p->fds[recorded]);
+
+    p->fds[recorded] = fd;
+}
+
+/* Get a file of FILE_SIZE bytes to stand for a file that the trace opened
+ * (one for each recorded descriptor, which later opens use again) */
+static bool _get_file(uint32_t pid, int64_t recorded)
+{
+    struct stat st;
+    int fd;
+
+    snprintf(_path, sizeof(_path), "%s/replay.%u.%ld", _dir, pid, recorded);
+
+    if (stat(_path, &st) == 0 && st.st_size == FILE_SIZE)
+        return true;
+
+    if ((fd = open(_path, O_CREAT | O_RDWR | O_TRUNC, 0666)) < 0)
+        return false;
+
+    if (write(fd, _buf, FILE_SIZE) != FILE_SIZE)
+    {
+        close(fd);
+        return false;
+    }
+
+    close(fd);
+    return true;
+}
+
+static size_t _size(uint64_t n)
+{
+    return n < MAX_BUF ? (size_t)n : MAX_BUF;
+}
+
+/* Prepare the arguments of a call (outside of the timing), returning false
+ * if the call cannot be replayed */
+static bool _prepare(const myst_replay_call_t* c, proc_t* p, long a[6])
+{
+    static struct iovec iov;
+    static struct stat st;
+    static struct timespec ts;
+
+    for (size_t i = 0; i < 6; i++)
+        a[i] = (long)c->args[i];
+
+    switch (c->n)
+    {
+        case SYS_read:
+        case SYS_write:
+        case SYS_pread64:
+        case SYS_pwrite64:
+        {
+            if ((a[0] = _fd(p, c->args[0])) < 0)
+                return false;
+
+            a[1] = (long)_buf;
+            a[2] = (long)_size(c->args[2]);
+            return true;
+        }
+        case SYS_readv:
+        case SYS_writev:
+        case SYS_preadv:
+        case SYS_pwritev:
+        {
+            if ((a[0] = _fd(p, c->args[0])) < 0)
+                return false;
+
+            /* the trace has the bytes moved, not how they were split */
+            iov.iov_base = _buf;
+            iov.iov_len = _size(c->ret > 0 ? (uint64_t)c->ret : 0);
+            a[1] = (long)&iov;
+            a[2] = 1;
+            return true;
+        }
+        case SYS_lseek:
+        case SYS_fsync:
+        case SYS_fdatasync:
+        case SYS_ftruncate:
+        case SYS_dup:
+        case SYS_close:
+        {
+            return (a[0] = _fd(p, c->args[0])) >= 0;
+        }
+        case SYS_dup2:
+        case SYS_dup3:
+        {
+            if ((a[0] = _fd(p, c->args[0])) < 0 || c->args[1] >= MAX_FDS)
+                return false;
+
+            /* the new descriptor must be one of the replayer's */
+            if ((a[1] = _fd(p, c->args[1])) < 0)
+            {
+                a[1] = open("/dev/null", O_RDONLY);
+                p->fds[c->args[1]] = (int)a[1];
+            }
+
+            return a[1] >= 0;
+        }
+        case SYS_fstat:
+        {
+            if ((a[0] = _fd(p, c->args[0])) < 0)
+                return false;
+
+            a[1] = (long)&st;
+            return true;
+        }
+        case SYS_clock_gettime:
+        {
+            a[1] = (long)&ts;
+            return true;
+        }
+        case SYS_mmap:
+        {
+            /* only the anonymous mappings */
+            if (!(c->args[3] & MAP_ANONYMOUS) || c->ret < 0)
+                return false;
+
+            a[0] = 0;
+            a[3] &= ~MAP_FIXED;
+            a[4] = -1;
+            return true;
+        }
+        case SYS_munmap:
+        {
+            for (size_t i = 0; i < MAX_MAPS; i++)
+            {
+                map_t* m = &_maps[i];
+
+                if (m->addr && m->recorded == c->args[0] &&
+                    m->length == c->args[1])
+                {
+                    a[0] = (long)m->addr;
+                    m->addr = NULL;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+        case SYS_getpid:
+        case SYS_getppid:
+        case SYS_gettid:
+        case SYS_getuid:
+        case SYS_geteuid:
+        case SYS_getgid:
+        case SYS_getegid:
+        case SYS_sched_yield:
+        {
+            return true;
+        }
+        case SYS_open:
+        case SYS_openat:
+        case SYS_creat:
+        {
+            /* a file of the replayer stands for the path */
+            return c->ret >= 0 && c->ret < MAX_FDS && _get_file(p->pid, c->ret);
+        }
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+static long _run(const myst_replay_call_t* c, const long a[6])
+{
+    const int keep = O_APPEND | O_TRUNC;
+
+    switch (c->n)
+    {
+        case SYS_open:
+            return open(_path, O_RDWR | ((int)c->args[1] & keep));
+        case SYS_openat:
+            return open(_path, O_RDWR | ((int)c->args[2] & keep));
+        case SYS_creat:
+            return open(_path, O_RDWR | O_TRUNC);
+        default:
+            return syscall(c->n, a[0], a[1], a[2], a[3], a[4], a[5]);
+    }
+}
+
+/* Remember what the call created or released */
+static void _finish(const myst_replay_call_t* c, proc_t* p, long ret)
+{
+    switch (c->n)
+    {
+        case SYS_close:
+        {
+            p->fds[c->args[0]] = -1;
+            break;
+        }
+        case SYS_dup:
+        {
+            _set_fd(p, ret >= 0 ? c->ret : -1, (int)ret);
+            break;
+        }
+        case SYS_open:
+        case SYS_openat:
+        case SYS_creat:
+        {
+            _set_fd(p, ret >= 0 ? c->ret : -1, (int)ret);
+            break;
+        }
+        case SYS_mmap:
+        {
+            if (ret == -1)
+                break;
+
+            for (size_t i = 0; i < MAX_MAPS; i++)
+            {
+                if (!_maps[i].addr)
+                {
+                    _maps[i].recorded = (uint64_t)c->ret;
+                    _maps[i].addr = (void*)ret;
+                    _maps[i].length = c->args[1];
+                    break;
+                }
+            }
+            break;
+        }
+    }
+}
+
+static void _replay(const myst_replay_call_t* c)
+{
+    long a[6];
+    proc_t* p;
+    uint64_t start;
+    long ret;
+
+    if (c->n >= MAX_SYSCALLS || !(p = _get_proc(c->pid)) ||
+        !_prepare(c, p, a))
+    {
+        _skipped++;
+        return;
+    }
+
+    start = _now();
+    ret = _run(c, a);
+    _stats[c->n].replayed_nsec += _now() - start;
+    _stats[c->n].recorded_nsec += c->nsec;
+    _stats[c->n].count++;
+
+    _finish(c, p, ret);
+}
+
+static int _load(const char* path, myst_replay_call_t** calls, size_t* ncalls)
+{
+    myst_replay_header_t header;
+    FILE* is;
+    int ret = -1;
+
+    if (!(is = fopen(path, "r")))
+        return -1;
+
+    if (fread(&header, sizeof(header), 1, is) != 1 ||
+        header.magic != MYST_REPLAY_MAGIC ||
+        header.version != MYST_REPLAY_VERSION)
+    {
+        goto done;
+    }
+
+    if (!(*calls = calloc(header.ncalls + 1, sizeof(myst_replay_call_t))))
+        goto done;
+
+    if (fread(*calls, sizeof(myst_replay_call_t), header.ncalls, is) !=
+        header.ncalls)
+    {
+        free(*calls);
+        goto done;
+    }
+
+    *ncalls = header.ncalls;
+    ret = 0;
+
+done:
+    fclose(is);
+    return ret;
+}
+
+/* The names of the syscalls that _prepare() knows */
+static const struct
+{
+    long n;
+    const char* name;
+} _names[] = {
+    {SYS_read, "read"},
+    {SYS_write, "write"},
+    {SYS_pread64, "pread64"},
+    {SYS_pwrite64, "pwrite64"},
+    {SYS_readv, "readv"},
+    {SYS_writev, "writev"},
+    {SYS_preadv, "preadv"},
+    {SYS_pwritev, "pwritev"},
+    {SYS_lseek, "lseek"},
+    {SYS_fsync, "fsync"},
+    {SYS_fdatasync, "fdatasync"},
+    {SYS_ftruncate, "ftruncate"},
+    {SYS_dup, "dup"},
+    {SYS_dup2, "dup2"},
+    {SYS_dup3, "dup3"},
+    {SYS_close, "close"},
+    {SYS_fstat, "fstat"},
+    {SYS_clock_gettime, "clock_gettime"},
+    {SYS_mmap, "mmap"},
+    {SYS_munmap, "munmap"},
+    {SYS_getpid, "getpid"},
+    {SYS_getppid, "getppid"},
+    {SYS_gettid, "gettid"},
+    {SYS_getuid, "getuid"},
+    {SYS_geteuid, "geteuid"},
+    {SYS_getgid, "getgid"},
+    {SYS_getegid, "getegid"},
+    {SYS_sched_yield, "sched_yield"},
+    {SYS_open, "open"},
+    {SYS_openat, "openat"},
+    {SYS_creat, "creat"},
+};
+
+static const char* _name(size_t n, char buf[16])
+{
+    for (size_t i = 0; i < sizeof(_names) / sizeof(_names[0]); i++)
+    {
+        if (_names[i].n == (long)n)
+            return _names[i].name;
+    }
+
+    snprintf(buf, 16, "%zu", n);
+    return buf;
+}
+
+static void _report(size_t ncalls)
+{
+    char buf[16];
+
+    printf(
+        "%-14s %8s %12s %12s %8s\n",
+        "syscall",
+        "calls",
+        "recorded-ns",
+        "replayed-ns",
+        "delta");
+
+    for (size_t n = 0; n < MAX_SYSCALLS; n++)
+    {
+        const stats_t* s = &_stats[n];
+        const double recorded = s->count ? (double)s->recorded_nsec : 0;
+        const double replayed = s->count ? (double)s->replayed_nsec : 0;
+
+        if (!s->count)
+            continue;
+
+        printf(
+            "%-14s %8lu %12.0f %12.0f %+7.1f%%\n",
+            _name(n, buf),
+            s->count,
+            recorded / (double)s->count,
+            replayed / (double)s->count,
+            recorded ? (replayed - recorded) * 100.0 / recorded : 0.0);
+    }
+
+    printf("%zu calls, %lu skipped\n", ncalls, _skipped);
+}
+
+/* The syscalls for the test to record (and then replay) */
+static int _workload(const char* dir)
+{
+    char path[256];
+    struct stat st;
+    struct timespec ts;
+    void* addr;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/workload", dir);
+
+    for (int i = 0; i < 100; i++)
+    {
+        assert((fd = open(path, O_CREAT | O_RDWR, 0666)) >= 0);
+        assert(write(fd, _buf, 4096) == 4096);
+        assert(lseek(fd, 0, SEEK_SET) == 0);
+        assert(read(fd, _buf, 4096) == 4096);
+        assert(pread(fd, _buf, 512, 1024) == 512);
+        assert(fstat(fd, &st) == 0);
+        assert(fsync(fd) == 0);
+        assert(close(fd) == 0);
+
+        assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+        assert(syscall(SYS_getpid) > 0);
+
+        addr = mmap(
+            NULL,
+            65536,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+        assert(addr != MAP_FAILED);
+        assert(munmap(addr, 65536) == 0);
+    }
+
+    unlink(path);
+    return 0;
+}
+
+int main(int argc, const char* argv[])
+{
+    myst_replay_call_t* calls;
+    size_t ncalls;
+
+    assert((_buf = calloc(1, MAX_BUF)));
+
+    if (argc == 3 && strcmp(argv[1], "--workload") == 0)
+        return _workload(argv[2]);
+
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(
+            stderr, "Usage: %s --workload <dir> | <trace> [<dir>]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc == 3)
+        _dir = argv[2];
+
+    if (_load(argv[1], &calls, &ncalls) != 0)
+    {
+        fprintf(stderr, "%s: not a replay trace: %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < ncalls; i++)
+        _replay(&calls[i]);
+
+    _report(ncalls);
+    free(calls);
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_PIPES 200
+
+static int _pipes[NUM_PIPES][2];
+
+static long _now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* select() without the C library, which would pass a copy of the timeout */
+static long _select(
+    int nfds,
+    fd_set* r,
+    fd_set* w,
+    fd_set* e,
+    struct timeval* t)
+{
+    long ret = syscall(SYS_select, nfds, r, w, e, t);
+    return (ret < 0) ? -errno : ret;
+}
+
+static void test_many_fds(void)
+{
+    fd_set rfds;
+    fd_set wfds;
+    fd_set efds;
+    struct timeval tv = {0, 0};
+    int nfds = 0;
+    long expected = 0;
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_ZERO(&efds);
+
+    /* every third pipe is readable; every write end is writable */
+    for (int i = 0; i < NUM_PIPES; i++)
+    {
+        FD_SET(_pipes[i][0], &rfds);
+        FD_SET(_pipes[i][1], &wfds);
+        FD_SET(_pipes[i][0], &efds);
+
+        if (i % 3 == 0)
+            expected++;
+
+        expected++;
+
+        if (_pipes[i][1] >= nfds)
+            nfds = _pipes[i][1] + 1;
+    }
+
+    assert(_select(nfds, &rfds, &wfds, &efds, &tv) == expected);
+
+    for (int i = 0; i < NUM_PIPES; i++)
+    {
+        assert(!!FD_ISSET(_pipes[i][0], &rfds) == (i % 3 == 0));
+        assert(FD_ISSET(_pipes[i][1], &wfds));
+        assert(!FD_ISSET(_pipes[i][0], &efds));
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_same_fd_in_two_sets(void)
+{
+    int fds[2];
+    fd_set rfds;
+    fd_set wfds;
+    struct timeval tv = {0, 0};
+
+    /* the read end of a pipe with data is readable */
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], "x", 1) == 1);
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_SET(fds[0], &rfds);
+    FD_SET(fds[1], &rfds);
+    FD_SET(fds[1], &wfds);
+
+    /* the write end is in both sets but only writable */
+    assert(_select(fds[1] + 1, &rfds, &wfds, NULL, &tv) == 2);
+    assert(FD_ISSET(fds[0], &rfds));
+    assert(!FD_ISSET(fds[1], &rfds));
+    assert(FD_ISSET(fds[1], &wfds));
+
+    close(fds[0]);
+    close(fds[1]);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_short_timeouts(void)
+{
+    for (long usec = 100; usec < 1000; usec += 400)
+    {
+        fd_set rfds;
+        struct timeval tv = {0, usec};
+        long start;
+
+        /* a sub-millisecond timeout still waits */
+        FD_ZERO(&rfds);
+        FD_SET(_pipes[1][0], &rfds);
+        start = _now_usec();
+        assert(_select(_pipes[1][0] + 1, &rfds, NULL, NULL, &tv) == 0);
+        assert(_now_usec() - start >= usec);
+        assert(!FD_ISSET(_pipes[1][0], &rfds));
+        assert(tv.tv_sec == 0 && tv.tv_usec == 0);
+
+        /* a select() without descriptors sleeps */
+        tv.tv_usec = usec;
+        start = _now_usec();
+        assert(_select(0, NULL, NULL, NULL, &tv) == 0);
+        assert(_now_usec() - start >= usec);
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_remaining_timeout(void)
+{
+    fd_set rfds;
+    struct timeval tv = {5, 0};
+
+    /* the time left is written back */
+    FD_ZERO(&rfds);
+    FD_SET(_pipes[0][0], &rfds);
+    assert(_select(_pipes[0][0] + 1, &rfds, NULL, NULL, &tv) == 1);
+    assert(tv.tv_sec <= 5 && tv.tv_sec >= 4);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_errors(void)
+{
+    int fds[2];
+    fd_set rfds;
+    struct timeval tv = {0, -1};
+
+    assert(_select(-1, NULL, NULL, NULL, NULL) == -EINVAL);
+    assert(_select(0, NULL, NULL, NULL, &tv) == -EINVAL);
+
+    assert(pipe(fds) == 0);
+    close(fds[0]);
+    close(fds[1]);
+
+    FD_ZERO(&rfds);
+    FD_SET(fds[0], &rfds);
+    tv.tv_usec = 0;
+    assert(_select(fds[0] + 1, &rfds, NULL, NULL, &tv) == -EBADF);
+
+    /* descriptors at or beyond nfds are ignored */
+    assert(_select(fds[0], &rfds, NULL, NULL, &tv) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    for (int i = 0; i < NUM_PIPES; i++)
+    {
+        assert(pipe(_pipes[i]) == 0);
+
+        if (i % 3 == 0)
+            assert(write(_pipes[i][1], "x", 1) == 1);
+    }
+
+    test_many_fds();
+    test_same_fd_in_two_sets();
+    test_short_timeouts();
+    test_remaining_timeout();
+    test_errors();
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -199,6 +200,43 @@ static void* _cli_thread_func(void* arg)
         }
     }
 
+    /* writev() many small buffers and readv() the echo into larger ones */
+    {
+        static const size_t count = 64;
+        uint8_t out[count];
+        uint8_t in[2 * count];
+        struct iovec out_iov[count];
+        struct iovec in_iov[count];
+        size_t total = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            out[i] = (uint8_t)alpha[i % (sizeof(alpha) - 1)];
+            out_iov[i].iov_base = &out[i];
+            out_iov[i].iov_len = 1;
+            in_iov[i].iov_base = &in[2 * i];
+            in_iov[i].iov_len = 2;
+        }
+
+        assert(writev(sock, out_iov, (int)count) == (ssize_t)count);
+
+        /* bytes past a partial read must be left untouched */
+        while (total < count)
+        {
+            ssize_t n;
+
+            memset(in, 0xff, sizeof(in));
+            assert((n = readv(sock, in_iov, (int)count)) > 0);
+            assert(total + (size_t)n <= count);
+            assert(memcmp(in, out + total, (size_t)n) == 0);
+
+            for (size_t i = (size_t)n; i < sizeof(in); i++)
+                assert(in[i] == 0xff);
+
+            total += (size_t)n;
+        }
+    }
+
     /* send "done" message the server */
     {
         static const uint8_t iov0[] = {'q', 'u', 'i', 't', '\0'};
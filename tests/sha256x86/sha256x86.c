@@ -0,0 +1,221 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <mbedtls/sha256.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <myst/eraise.h>
+#include <myst/sha256.h>
+#include <myst/sha256x86.h>
+
+#define BLOCK_SIZE 4096
+#define COUNT 40
+
+static uint8_t _prefix[256];
+static uint8_t _data[COUNT * BLOCK_SIZE];
+
+void myst_eraise(const char* file, uint32_t line, const char* func, int errnum)
+{
+    (void)file;
+    (void)line;
+    (void)func;
+    (void)errnum;
+}
+
+/* Hash prefix || data with mbedtls alone (as sha256.c does without x86) */
+static void _mbedtls_hash(
+    myst_sha256_t* hash,
+    const void* prefix,
+    size_t prefix_size,
+    const void* data,
+    size_t size)
+{
+    mbedtls_sha256_context ctx;
+
+    mbedtls_sha256_init(&ctx);
+    assert(mbedtls_sha256_starts_ret(&ctx, 0) == 0);
+    assert(mbedtls_sha256_update_ret(&ctx, prefix, prefix_size) == 0);
+    assert(mbedtls_sha256_update_ret(&ctx, data, size) == 0);
+    assert(mbedtls_sha256_finish_ret(&ctx, hash->data) == 0);
+    mbedtls_sha256_free(&ctx);
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Messages of every size around the block and padding boundaries */
+void test_sizes(void)
+{
+    for (size_t size = 0; size <= 300; size++)
+    {
+        myst_sha256_t expected;
+        myst_sha256_t hash;
+        myst_sha256_ctx_t ctx;
+        const size_t half = size / 2;
+
+        _mbedtls_hash(&expected, NULL, 0, _data, size);
+
+        assert(myst_sha256(&hash, _data, size) == 0);
+        assert(memcmp(&hash, &expected, sizeof(hash)) == 0);
+
+        /* in two updates of which the first leaves a partial block */
+        assert(myst_sha256_start(&ctx) == 0);
+        assert(myst_sha256_update(&ctx, _data, half) == 0);
+        assert(myst_sha256_update(&ctx, _data + half, size - half) == 0);
+        assert(myst_sha256_finish(&ctx, &hash) == 0);
+        assert(memcmp(&hash, &expected, sizeof(hash)) == 0);
+    }
+}
+
+/* Several messages with a common prefix (as the verity salted blocks are) */
+void test_n(void)
+{
+    const size_t prefix_sizes[] = {0, 1, 32, 55, 64, 100, 128, 256};
+    const size_t sizes[] = {0, 1, 55, 64, 65, 512, BLOCK_SIZE};
+    const size_t counts[] = {1, 3, 4, 16, 17, COUNT};
+    myst_sha256_t hashes[COUNT];
+    myst_sha256_t expected;
+
+    for (size_t i = 0; i < sizeof(prefix_sizes) / sizeof(size_t); i++)
+    {
+        for (size_t j = 0; j < sizeof(sizes) / sizeof(size_t); j++)
+        {
+            for (size_t k = 0; k < sizeof(counts) / sizeof(size_t); k++)
+            {
+                const size_t prefix_size = prefix_sizes[i];
+                const size_t size = sizes[j];
+                const size_t count = counts[k];
+                int r;
+
+                r = myst_sha256_n(
+                    hashes, _prefix, prefix_size, _data, size, count);
+                assert(r == 0);
+
+                for (size_t m = 0; m < count; m++)
+                {
+                    const uint8_t* p = _data + m * size;
+
+                    _mbedtls_hash(&expected, _prefix, prefix_size, p, size);
+                    r = memcmp(&hashes[m], &expected, sizeof(expected));
+                    assert(r == 0);
+                }
+            }
+        }
+    }
+}
+
+/* The multi-buffer code directly (myst_sha256_n() prefers SHA-NI to it) */
+void test_lanes(void)
+{
+    static const uint32_t initial_state[8] = {
+        0x6a09e667,
+        0xbb67ae85,
+        0x3c6ef372,
+        0xa54ff53a,
+        0x510e527f,
+        0x9b05688c,
+        0x1f83d9ab,
+        0x5be0cd19,
+    };
+    uint32_t state[MYST_SHA256_X86_LANES][8];
+    const void* blocks[MYST_SHA256_X86_LANES];
+    mbedtls_sha256_context ctx;
+
+    if (!myst_sha256_x86_lanes_supported())
+        return;
+
+    for (size_t l = 0; l < MYST_SHA256_X86_LANES; l++)
+        memcpy(state[l], initial_state, sizeof(initial_state));
+
+    for (size_t b = 0; b < BLOCK_SIZE / MYST_SHA256_X86_BLOCK_SIZE; b++)
+    {
+        for (size_t l = 0; l < MYST_SHA256_X86_LANES; l++)
+        {
+            const size_t offset = l * BLOCK_SIZE;
+            blocks[l] = _data + offset + b * MYST_SHA256_X86_BLOCK_SIZE;
+        }
+
+        myst_sha256_x86_compress_lanes(state, blocks);
+    }
+
+    /* mbedtls exposes its state after the blocks */
+    for (size_t l = 0; l < MYST_SHA256_X86_LANES; l++)
+    {
+        mbedtls_sha256_init(&ctx);
+        assert(mbedtls_sha256_starts_ret(&ctx, 0) == 0);
+        assert(
+            mbedtls_sha256_update_ret(
+                &ctx, _data + l * BLOCK_SIZE, BLOCK_SIZE) == 0);
+        assert(memcmp(ctx.state, state[l], sizeof(state[l])) == 0);
+        mbedtls_sha256_free(&ctx);
+    }
+}
+
+void bench(void)
+{
+    const size_t passes = 256;
+    myst_sha256_t hashes[COUNT];
+    double t;
+    double mbedtls_mbs;
+    double n_mbs;
+
+    t = _now();
+
+    for (size_t i = 0; i < passes; i++)
+    {
+        for (size_t j = 0; j < COUNT; j++)
+        {
+            const uint8_t* p = _data + j * BLOCK_SIZE;
+            _mbedtls_hash(&hashes[j], _prefix, 32, p, BLOCK_SIZE);
+        }
+    }
+
+    mbedtls_mbs = (double)(passes * sizeof(_data)) / (_now() - t) / 1e6;
+
+    t = _now();
+
+    for (size_t i = 0; i < passes; i++)
+        myst_sha256_n(hashes, _prefix, 32, _data, BLOCK_SIZE, COUNT);
+
+    n_mbs = (double)(passes * sizeof(_data)) / (_now() - t) / 1e6;
+
+    printf(
+        "salted 4K blocks: mbedtls %8.1f MB/s, myst_sha256_n %8.1f MB/s\n",
+        mbedtls_mbs,
+        n_mbs);
+}
+
+int main(int argc, const char* argv[])
+{
+    printf(
+        "SHA-NI: %s, AVX2: %s, AVX-512: %s\n",
+        myst_sha256_x86_supported() ? "yes" : "no",
+        myst_sha256_x86_lanes_supported() ? "yes" : "no",
+        myst_sha256_x86_avx512_supported() ? "yes" : "no");
+
+    for (size_t i = 0; i < sizeof(_prefix); i++)
+        _prefix[i] = (uint8_t)rand();
+
+    for (size_t i = 0; i < sizeof(_data); i++)
+        _data[i] = (uint8_t)rand();
+
+    test_sizes();
+    test_n();
+    test_lanes();
+
+    if (argc == 2 && strcmp(argv[1], "--bench") == 0)
+        bench();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SIZE (3 * 4096 + 100)
+#define NAME "/myst-shm-test"
+
+extern char** environ;
+
+static void _fill(unsigned char* p, size_t n, unsigned char seed)
+{
+    for (size_t i = 0; i < n; i++)
+        p[i] = (unsigned char)(seed + i * 7);
+}
+
+static int _check(const unsigned char* p, size_t n, unsigned char seed)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (p[i] != (unsigned char)(seed + i * 7))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Run this program again as a child process and return its exit status */
+static int _run_child(const char* mode, const char* arg)
+{
+    char* const argv[] = {"/bin/shm", (char*)mode, (char*)arg, NULL};
+    pid_t pid;
+    int wstatus;
+
+    assert(posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) == 0);
+    assert(waitpid(pid, &wstatus, 0) == pid);
+    assert(WIFEXITED(wstatus));
+
+    return WEXITSTATUS(wstatus);
+}
+
+/* The child checks what the parent wrote and answers in the same pages */
+static int _sysv_child(int shmid)
+{
+    unsigned char* p;
+
+    if ((p = shmat(shmid, NULL, 0)) == (void*)-1)
+        return 1;
+
+    if (_check(p, SIZE, 1) != 0)
+        return 2;
+
+    _fill(p, SIZE, 2);
+
+    if (shmdt(p) != 0)
+        return 3;
+
+    return 0;
+}
+
+static void test_sysv(void)
+{
+    struct shmid_ds ds;
+    unsigned char* p;
+    char arg[32];
+    int shmid;
+    key_t key = 0x4d595354;
+
+    assert((shmid = shmget(IPC_PRIVATE, SIZE, IPC_CREAT | 0600)) >= 0);
+    assert((p = shmat(shmid, NULL, 0)) != (void*)-1);
+
+    /* the segment starts out zero-filled */
+    for (size_t i = 0; i < SIZE; i++)
+        assert(p[i] == 0);
+
+    _fill(p, SIZE, 1);
+
+    assert(shmctl(shmid, IPC_STAT, &ds) == 0);
+    assert(ds.shm_segsz == SIZE);
+    assert(ds.shm_nattch == 1);
+    assert(ds.shm_cpid == getpid());
+
+    /* the child sees the pages the parent wrote, and vice versa */
+    snprintf(arg, sizeof(arg), "%d", shmid);
+    assert(_run_child("sysv", arg) == 0);
+    assert(_check(p, SIZE, 2) == 0);
+
+    assert(shmctl(shmid, IPC_STAT, &ds) == 0);
+    assert(ds.shm_nattch == 1);
+
+    /* a removed segment stays attached until it is detached */
+    assert(shmctl(shmid, IPC_RMID, NULL) == 0);
+    assert(_check(p, SIZE, 2) == 0);
+    assert(shmdt(p) == 0);
+    assert(shmat(shmid, NULL, 0) == (void*)-1 && errno == EINVAL);
+    assert(shmdt(p) == -1 && errno == EINVAL);
+
+    /* keys */
+    assert(shmget(key, SIZE, 0600) == -1 && errno == ENOENT);
+    assert((shmid = shmget(key, SIZE, IPC_CREAT | 0600)) >= 0);
+    assert(shmget(key, SIZE, IPC_CREAT | 0600) == shmid);
+    assert(shmget(key, SIZE, 0) == shmid);
+    assert(shmget(key, SIZE, IPC_CREAT | IPC_EXCL | 0600) == -1);
+    assert(errno == EEXIST);
+    assert(shmget(key, SIZE * 2, 0) == -1 && errno == EINVAL);
+    assert(shmctl(shmid, IPC_RMID, NULL) == 0);
+    assert(shmget(key, SIZE, 0) == -1 && errno == ENOENT);
+
+    /* an exiting process detaches what it left attached */
+    assert((shmid = shmget(IPC_PRIVATE, SIZE, 0600)) >= 0);
+    assert((p = shmat(shmid, NULL, 0)) != (void*)-1);
+    _fill(p, SIZE, 1);
+    snprintf(arg, sizeof(arg), "%d", shmid);
+    assert(_run_child("sysv-exit", arg) == 0);
+    assert(shmctl(shmid, IPC_STAT, &ds) == 0);
+    assert(ds.shm_nattch == 1);
+    assert(shmdt(p) == 0);
+    assert(shmctl(shmid, IPC_RMID, NULL) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static unsigned char* _map_object(int* fd_out)
+{
+    unsigned char* p;
+    int fd;
+
+    if ((fd = shm_open(NAME, O_RDWR, 0)) < 0)
+        return NULL;
+
+    p = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (fd_out)
+        *fd_out = fd;
+    else
+        close(fd);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static int _posix_child(void)
+{
+    unsigned char* p;
+
+    if (!(p = _map_object(NULL)))
+        return 1;
+
+    if (_check(p, SIZE, 3) != 0)
+        return 2;
+
+    _fill(p, SIZE, 4);
+
+    if (munmap(p, SIZE) != 0)
+        return 3;
+
+    return 0;
+}
+
+static void test_posix(void)
+{
+    unsigned char* p;
+    unsigned char* buf;
+    int fd;
+
+    assert((fd = shm_open(NAME, O_CREAT | O_EXCL | O_RDWR, 0600)) >= 0);
+    assert(ftruncate(fd, SIZE) == 0);
+    assert(close(fd) == 0);
+
+    /* the descriptor is not needed once the object is mapped */
+    assert((p = _map_object(NULL)));
+    _fill(p, SIZE, 3);
+
+    /* the child sees the live pages, not what was last written back */
+    assert(_run_child("posix", NULL) == 0);
+    assert(_check(p, SIZE, 4) == 0);
+
+    /* the last unmap writes the pages back to the object */
+    assert(munmap(p, SIZE) == 0);
+    assert(!!(buf = malloc(SIZE)));
+    assert((fd = shm_open(NAME, O_RDONLY, 0)) >= 0);
+    assert(read(fd, buf, SIZE) == SIZE);
+    assert(_check(buf, SIZE, 4) == 0);
+    assert(close(fd) == 0);
+
+    /* msync() writes them back too */
+    assert((p = _map_object(&fd)));
+    _fill(p, SIZE, 5);
+    assert(msync(p, SIZE, MS_SYNC) == 0);
+    assert(pread(fd, buf, SIZE, 0) == SIZE);
+    assert(_check(buf, SIZE, 5) == 0);
+    assert(munmap(p, SIZE) == 0);
+    assert(close(fd) == 0);
+
+    assert(shm_unlink(NAME) == 0);
+    assert(shm_open(NAME, O_RDWR, 0) == -1 && errno == ENOENT);
+    free(buf);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "sysv") == 0)
+        return _sysv_child(atoi(argv[2]));
+
+    if (argc == 3 && strcmp(argv[1], "sysv-exit") == 0)
+        return shmat(atoi(argv[2]), NULL, 0) == (void*)-1;
+
+    if (argc == 2 && strcmp(argv[1], "posix") == 0)
+        return _posix_child();
+
+    test_sysv();
+    test_posix();
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
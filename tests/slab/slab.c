@@ -0,0 +1,81 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/slab.h>
+
+typedef struct object
+{
+    uint64_t key;
+    char data[40];
+} object_t;
+
+static myst_slab_cache_t _cache = MYST_SLAB_CACHE_INIT("object", object_t);
+
+#define N 10000
+
+void test_slab(void)
+{
+    static object_t* objects[N];
+    myst_slab_stats_t stats[4];
+
+    for (size_t i = 0; i < N; i++)
+    {
+        object_t* p = myst_slab_alloc(&_cache);
+        assert(p != NULL);
+        assert(((uintptr_t)p % 16) == 0);
+
+        /* Objects are zero-filled */
+        for (size_t j = 0; j < sizeof(object_t); j++)
+            assert(((uint8_t*)p)[j] == 0);
+
+        p->key = i;
+        memset(p->data, 0xAB, sizeof(p->data));
+        objects[i] = p;
+    }
+
+    assert(_cache.in_use == N);
+    assert(myst_slab_get_stats(stats, 4) == 1);
+    assert(strcmp(stats[0].name, "object") == 0);
+    assert(stats[0].object_size == sizeof(object_t));
+    assert(stats[0].in_use == N);
+    assert(stats[0].num_allocs == N);
+
+    /* Free every other object, then the rest */
+    for (size_t i = 0; i < N; i += 2)
+    {
+        assert(objects[i]->key == i);
+        myst_slab_free(objects[i]);
+    }
+
+    for (size_t i = 1; i < N; i += 2)
+    {
+        assert(objects[i]->key == i);
+        myst_slab_free(objects[i]);
+    }
+
+    /* Only one empty slab is retained */
+    assert(_cache.in_use == 0);
+    assert(_cache.num_slabs == 1);
+    assert(_cache.num_frees == N);
+
+    myst_slab_shrink(&_cache);
+    assert(_cache.num_slabs == 0);
+
+    /* Null objects are ignored */
+    myst_slab_free(NULL);
+}
+
+int main(int argc, const char* argv[])
+{
+    test_slab();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
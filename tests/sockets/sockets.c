@@ -5,12 +5,15 @@
 // Licensed under the MIT License.
 
 #include <assert.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
@@ -193,6 +196,51 @@ void test_sockets(args_t* args)
     printf("=== passed test (test_sockets: domain=%d)\n", args->domain);
 }
 
+/* The flags and options kept by the kernel read back like the host's */
+void test_flags_and_options(void)
+{
+    int sock;
+    int dup_sock;
+    int val;
+    socklen_t len = sizeof(val);
+
+    assert((sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0);
+    assert(fcntl(sock, F_GETFL) == O_RDWR);
+    assert(fcntl(sock, F_GETFD) == FD_CLOEXEC);
+
+    /* dups share the file status flags but not FD_CLOEXEC */
+    assert((dup_sock = dup(sock)) >= 0);
+    assert(fcntl(dup_sock, F_GETFD) == 0);
+    assert(fcntl(sock, F_SETFL, O_NONBLOCK) == 0);
+    assert(fcntl(dup_sock, F_GETFL) == (O_RDWR | O_NONBLOCK));
+    val = 0;
+    assert(ioctl(dup_sock, FIONBIO, &val) == 0);
+    assert(fcntl(sock, F_GETFL) == O_RDWR);
+
+    /* boolean options read back as 0 or 1 */
+    val = 5;
+    assert(setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &val, len) == 0);
+    assert(setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &val, len) == 0);
+    assert(getsockopt(dup_sock, IPPROTO_TCP, TCP_NODELAY, &val, &len) == 0);
+    assert(len == sizeof(val) && val == 1);
+
+    val = 42;
+    assert(setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &val, len) == 0);
+    assert(getsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &val, &len) == 0);
+    assert(val == 42);
+
+    /* a value the host refuses is not kept */
+    val = -1;
+    assert(setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &val, len) == -1);
+    assert(getsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &val, &len) == 0);
+    assert(val == 42);
+
+    close(dup_sock);
+    close(sock);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 int main(int argc, const char* argv[])
 {
     if (argc != 2)
@@ -206,6 +254,7 @@ int main(int argc, const char* argv[])
 
     test_sockets(&inet_args);
     test_sockets(&unix_args);
+    test_flags_and_options();
 
     printf("=== passed test (%s)\n", argv[0]);
     return 0;
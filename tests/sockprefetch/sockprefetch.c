@@ -0,0 +1,148 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define PORT 12346
+#define MESSAGE "0123456789abcdefghijklmnopqrstuvwxyz"
+
+static int _lsock;
+
+static void* _server(void* arg)
+{
+    int sock;
+    char c;
+
+    assert((sock = accept(_lsock, NULL, NULL)) >= 0);
+    assert(write(sock, MESSAGE, sizeof(MESSAGE) - 1) == sizeof(MESSAGE) - 1);
+
+    /* wait for the client to read everything before closing */
+    assert(read(sock, &c, 1) == 1);
+    assert(close(sock) == 0);
+    return NULL;
+}
+
+/* Wait until the bytes are readable in the enclave (after a prefetch) */
+static void _test_poll(int sock)
+{
+    struct pollfd pfd = {.fd = sock, .events = POLLIN | POLLOUT};
+    int epfd;
+    struct epoll_event ev = {.events = EPOLLIN};
+    struct epoll_event out[4];
+
+    /* buffered bytes and the writable host socket count as one fd */
+    assert(poll(&pfd, 1, 1000) == 1);
+    assert(pfd.revents & POLLIN);
+    assert(pfd.revents & POLLOUT);
+
+    /* an fd that asks for POLLOUT only does not see POLLIN */
+    pfd.events = POLLOUT;
+    assert(poll(&pfd, 1, 0) == 1);
+    assert(pfd.revents == POLLOUT);
+
+    assert((epfd = epoll_create1(0)) >= 0);
+    ev.data.fd = sock;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) == 0);
+    assert(epoll_wait(epfd, out, 4, 1000) == 1);
+    assert(out[0].data.fd == sock);
+    assert(out[0].events & EPOLLIN);
+
+    /* reported once even though both sides see the socket */
+    ev.events = EPOLLIN | EPOLLOUT;
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, sock, &ev) == 0);
+    assert(epoll_wait(epfd, out, 4, 1000) == 1);
+    assert(out[0].events == (EPOLLIN | EPOLLOUT));
+
+    assert(close(epfd) == 0);
+}
+
+/* SO_BUSY_POLL is kept by the kernel, which does the busy polling */
+static void _test_busy_poll(int sock)
+{
+    int val = 50;
+    socklen_t len = sizeof(val);
+
+    assert(setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &val, len) == 0);
+    val = 0;
+    assert(getsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &val, &len) == 0);
+    assert(len == sizeof(val));
+    assert(val == 50);
+
+    val = -1;
+    assert(setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &val, len) == -1);
+    assert(errno == EINVAL);
+}
+
+int main(int argc, const char* argv[])
+{
+    struct sockaddr_in addr;
+    pthread_t thread;
+    char buf[64];
+    size_t n = 0;
+    int sock;
+    int avail;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert((_lsock = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(bind(_lsock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert(listen(_lsock, 1) == 0);
+    assert(pthread_create(&thread, NULL, _server, NULL) == 0);
+
+    assert((sock = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    _test_busy_poll(sock);
+
+    /* the first small read pulls the whole message into the buffer */
+    assert(recv(sock, buf, 1, MSG_WAITALL) == 1);
+    assert(buf[0] == '0');
+    n = 1;
+
+    _test_poll(sock);
+
+    /* the prefetched bytes are counted by FIONREAD and can be peeked */
+    assert(ioctl(sock, FIONREAD, &avail) == 0);
+    assert(avail == sizeof(MESSAGE) - 2);
+    assert(recv(sock, buf, 3, MSG_PEEK) == 3);
+    assert(memcmp(buf, "123", 3) == 0);
+
+    /* byte-at-a-time reads keep the stream in order */
+    while (n < 10)
+    {
+        assert(read(sock, buf + n, 1) == 1);
+        n++;
+    }
+
+    assert(recv(sock, buf + n, sizeof(MESSAGE) - 1 - n, 0) ==
+           (ssize_t)(sizeof(MESSAGE) - 1 - n));
+    assert(memcmp(buf + 1, MESSAGE + 1, sizeof(MESSAGE) - 2) == 0);
+
+    /* the buffer is empty again */
+    assert(recv(sock, buf, 1, MSG_DONTWAIT) == -1);
+
+    assert(write(sock, "x", 1) == 1);
+    assert(pthread_join(thread, NULL) == 0);
+    assert(read(sock, buf, 1) == 0);
+
+    assert(close(sock) == 0);
+    assert(close(_lsock) == 0);
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
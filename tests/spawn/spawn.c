@@ -2,6 +2,8 @@
 // Licensed under the MIT License.
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <signal.h>
 #include <spawn.h>
@@ -125,10 +127,100 @@ int test_spawn_sig(int argc, const char* argv[])
     return 0;
 }
 
+/* Redirect the child's output with file actions */
+int test_spawn_file_actions(int argc, const char* argv[])
+{
+    pid_t pid = 0;
+    char* const child_argv[] = {"/bin/child", "arg1", "arg2", NULL};
+    char* const child_envp[] = {"X=1", "Y=1", NULL};
+    const char path[] = "/tmp/spawn.out";
+    posix_spawn_file_actions_t fa;
+    int wstatus;
+    char buf[1024];
+    ssize_t n;
+    int fd;
+
+    /* the child inherits fd but closes it before opening the output file */
+    assert((fd = open("/bin/child", O_RDONLY)) >= 0);
+
+    assert(posix_spawn_file_actions_init(&fa) == 0);
+    assert(posix_spawn_file_actions_addclose(&fa, fd) == 0);
+    assert(
+        posix_spawn_file_actions_addopen(
+            &fa, STDOUT_FILENO, path, O_WRONLY | O_CREAT | O_TRUNC, 0644) ==
+        0);
+    assert(posix_spawn_file_actions_adddup2(&fa, STDOUT_FILENO, 2) == 0);
+
+    assert(
+        posix_spawn(&pid, "/bin/child", &fa, NULL, child_argv, child_envp) ==
+        0);
+    assert(posix_spawn_file_actions_destroy(&fa) == 0);
+
+    assert(waitpid(pid, &wstatus, 0) == pid);
+    assert(WIFEXITED(wstatus));
+    assert(WEXITSTATUS(wstatus) == 123);
+
+    /* the parent's descriptors are left alone */
+    assert(fcntl(fd, F_GETFD) == 0);
+    assert(close(fd) == 0);
+
+    assert((fd = open(path, O_RDONLY)) >= 0);
+    assert((n = read(fd, buf, sizeof(buf) - 1)) > 0);
+    buf[n] = '\0';
+    assert(strstr(buf, "child: argv[0]={/bin/child}") != NULL);
+    assert(close(fd) == 0);
+
+    printf("=== passed test (%s-file-actions)\n", argv[0]);
+
+    return 0;
+}
+
+/* Errors reach the caller of posix_spawn() */
+int test_spawn_errors(int argc, const char* argv[])
+{
+    pid_t pid = 0;
+    char* const child_argv[] = {"/bin/child", "arg1", "arg2", NULL};
+    char* const child_envp[] = {"X=1", "Y=1", NULL};
+    posix_spawn_file_actions_t fa;
+    int wstatus;
+
+    assert(
+        posix_spawn(&pid, "/bin/nosuchfile", NULL, NULL, child_argv, NULL) ==
+        ENOENT);
+
+    assert(posix_spawn(&pid, "/bin", NULL, NULL, child_argv, NULL) == EACCES);
+
+    assert(posix_spawn_file_actions_init(&fa) == 0);
+    assert(posix_spawn_file_actions_adddup2(&fa, 1000, 3) == 0);
+    assert(
+        posix_spawn(&pid, "/bin/child", &fa, NULL, child_argv, NULL) == EBADF);
+    assert(posix_spawn_file_actions_destroy(&fa) == 0);
+
+    /* posix_spawnp() searches the PATH */
+    assert(setenv("PATH", "/usr/bin:/bin", 1) == 0);
+    assert(
+        posix_spawnp(&pid, "child", NULL, NULL, child_argv, child_envp) == 0);
+    assert(waitpid(pid, &wstatus, 0) == pid);
+    assert(WIFEXITED(wstatus));
+    assert(WEXITSTATUS(wstatus) == 123);
+
+    assert(
+        posix_spawnp(&pid, "nosuchfile", NULL, NULL, child_argv, NULL) ==
+        ENOENT);
+
+    printf("=== passed test (%s-errors)\n", argv[0]);
+
+    return 0;
+}
+
 int main(int argc, const char* argv[])
 {
     assert(test_spawn1(argc, argv) == 0);
 
+    assert(test_spawn_file_actions(argc, argv) == 0);
+
+    assert(test_spawn_errors(argc, argv) == 0);
+
     assert(test_spawn_sig(argc, argv) == 0);
 
     return 0;
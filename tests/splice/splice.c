@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz";
+
+static void _test_file_to_pipe_to_file(void)
+{
+    const char path_in[] = "/tmp/splice_in";
+    const char path_out[] = "/tmp/splice_out";
+    int pipefd[2];
+    int in;
+    int out;
+    loff_t off = 1;
+    char buf[sizeof(alphabet)];
+
+    assert((in = open(path_in, O_CREAT | O_TRUNC | O_RDWR, 0666)) >= 0);
+    assert(write(in, alphabet, sizeof(alphabet)) == sizeof(alphabet));
+    assert((out = open(path_out, O_CREAT | O_TRUNC | O_RDWR, 0666)) >= 0);
+    assert(pipe(pipefd) == 0);
+
+    /* file -> pipe with an explicit offset leaves the file offset alone */
+    assert(splice(in, &off, pipefd[1], NULL, 10, 0) == 10);
+    assert(off == 11);
+    assert(lseek(in, 0, SEEK_CUR) == sizeof(alphabet));
+
+    /* pipe -> file at the current file offset */
+    assert(splice(pipefd[0], NULL, out, NULL, 100, 0) == 10);
+    assert(lseek(out, 0, SEEK_CUR) == 10);
+    assert(pread(out, buf, sizeof(buf), 0) == 10);
+    assert(memcmp(buf, alphabet + 1, 10) == 0);
+
+    /* offsets are not allowed on the pipe side */
+    off = 0;
+    assert(splice(in, NULL, pipefd[1], &off, 1, 0) == -1);
+    assert(errno == ESPIPE);
+
+    /* one side must be a pipe */
+    assert(splice(in, NULL, out, NULL, 1, 0) == -1);
+    assert(errno == EINVAL);
+
+    /* an empty pipe with no writers is end of file */
+    assert(close(pipefd[1]) == 0);
+    assert(splice(pipefd[0], NULL, out, NULL, 1, 0) == 0);
+
+    assert(close(pipefd[0]) == 0);
+    assert(close(in) == 0);
+    assert(close(out) == 0);
+    assert(unlink(path_in) == 0);
+    assert(unlink(path_out) == 0);
+}
+
+static void _test_tee(void)
+{
+    int p1[2];
+    int p2[2];
+    int p3[2];
+    char buf[sizeof(alphabet)];
+
+    assert(pipe(p1) == 0);
+    assert(pipe2(p2, O_NONBLOCK) == 0);
+    assert(pipe(p3) == 0);
+
+    assert(write(p1[1], alphabet, sizeof(alphabet)) == sizeof(alphabet));
+
+    /* tee() duplicates without consuming */
+    assert(tee(p1[0], p2[1], 5, 0) == 5);
+    assert(read(p2[0], buf, sizeof(buf)) == 5);
+    assert(memcmp(buf, alphabet, 5) == 0);
+
+    /* splice() between pipes consumes */
+    assert(splice(p1[0], NULL, p3[1], NULL, sizeof(alphabet), 0) ==
+           sizeof(alphabet));
+    assert(read(p3[0], buf, sizeof(buf)) == sizeof(alphabet));
+    assert(memcmp(buf, alphabet, sizeof(alphabet)) == 0);
+
+    /* nothing left to tee */
+    assert(tee(p1[0], p2[1], 5, SPLICE_F_NONBLOCK) == -1);
+    assert(errno == EAGAIN);
+
+    /* a pipe cannot be spliced or teed into itself */
+    assert(write(p1[1], alphabet, sizeof(alphabet)) == sizeof(alphabet));
+    assert(splice(p1[0], NULL, p1[1], NULL, 5, 0) == -1);
+    assert(errno == EINVAL);
+    assert(tee(p1[0], p1[1], 5, 0) == -1);
+    assert(errno == EINVAL);
+    assert(read(p1[0], buf, sizeof(buf)) == sizeof(alphabet));
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        assert(close(p1[i]) == 0);
+        assert(close(p2[i]) == 0);
+        assert(close(p3[i]) == 0);
+    }
+}
+
+static void _test_vmsplice(void)
+{
+    int pipefd[2];
+    char buf[sizeof(alphabet)];
+    struct iovec iov[2] = {
+        {(void*)alphabet, 10},
+        {(void*)(alphabet + 10), sizeof(alphabet) - 10},
+    };
+
+    assert(pipe(pipefd) == 0);
+    assert(vmsplice(pipefd[1], iov, 2, 0) == sizeof(alphabet));
+
+    iov[0].iov_base = buf;
+    iov[0].iov_len = sizeof(buf);
+    assert(vmsplice(pipefd[0], iov, 1, 0) == sizeof(alphabet));
+    assert(memcmp(buf, alphabet, sizeof(alphabet)) == 0);
+
+    assert(close(pipefd[0]) == 0);
+    assert(close(pipefd[1]) == 0);
+}
+
+int main(int argc, const char* argv[])
+{
+    _test_file_to_pipe_to_file();
+    _test_tee();
+    _test_vmsplice();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+#
+# The cold-start benchmark of tests/startbench:
+#
+#     startbench.py run NAME RUNS [--port=PORT] -- COMMAND... -- start
+#         COMMAND RUNS times and print one JSON result with the median,
+#         mean, standard deviation, min and max of each metric
+#     startbench.py merge OUT FILE... -- merge results (one JSON object per
+#         line) into a results file, keyed by name
+#
+# COMMAND is a Mystikos command line in which {trace} is replaced with the
+# path of its --startup-trace file. The metrics (in microseconds) are:
+#
+#     create_enclave_usec -- the enclave creation (or the loading of the
+#         regions on linux)
+#     kernel_entry_usec -- from the start of myst to the kernel entry
+#     user_main_usec -- from the start of myst to the end of the dynamic
+#         loader, which is the first system call before the constructors
+#         and main() of the application
+#     first_response_usec -- from the launch of COMMAND to the first HTTP
+#         response on PORT or, without a port, the first byte of output
+#
+# A server (--port) is stopped after its first response; any other command
+# runs until it exits.
+
+import json
+import os
+import signal
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+POLL_SECONDS = 0.005
+TIMEOUT_SECONDS = 300
+REQUEST = b"GET / HTTP/1.0\r\nHost: 127.0.0.1\r\n\r\n"
+
+
+def _http_ready(port):
+    try:
+        with socket.create_connection(("127.0.0.1", port), timeout=1) as s:
+            s.sendall(REQUEST)
+            return s.recv(1) != b""
+    except OSError:
+        return False
+
+
+def _end_of(events, name):
+    """The end of the named event since the start of the timeline"""
+    for e in events:
+        if e.get("ph") == "X" and e["name"] == name:
+            return e["ts"] + e["dur"]
+    return None
+
+
+def _duration_of(events, *names):
+    for name in names:
+        for e in events:
+            if e.get("ph") == "X" and e["name"] == name:
+                return e["dur"]
+    return None
+
+
+def _run_once(command, port):
+    fd, trace = tempfile.mkstemp(prefix="startbench", suffix=".json")
+    os.close(fd)
+    os.unlink(trace)
+
+    args = [a.replace("{trace}", trace) for a in command]
+    first = None
+    start = time.monotonic()
+
+    p = subprocess.Popen(
+        args,
+        stdout=subprocess.PIPE,
+        start_new_session=True,
+    )
+
+    try:
+        if port:
+            while time.monotonic() - start < TIMEOUT_SECONDS:
+                if p.poll() is not None:
+                    sys.exit("startbench: %s exited early" % args[0])
+                if _http_ready(port):
+                    first = time.monotonic()
+                    break
+                time.sleep(POLL_SECONDS)
+            os.killpg(p.pid, signal.SIGTERM)
+            p.stdout.read()
+        else:
+            if p.stdout.read(1):
+                first = time.monotonic()
+            p.stdout.read()
+    finally:
+        p.wait()
+
+    if first is None:
+        sys.exit("startbench: no response from %s" % args[0])
+
+    result = {"first_response_usec": (first - start) * 1e6}
+
+    try:
+        with open(trace) as f:
+            events = json.load(f)["traceEvents"]
+        os.unlink(trace)
+    except (OSError, ValueError, KeyError):
+        sys.exit("startbench: no startup trace from %s" % args[0])
+
+    metrics = {
+        "create_enclave_usec": _duration_of(
+            events, "create_enclave", "load_regions"
+        ),
+        "kernel_entry_usec": _end_of(events, "enclave_entry"),
+        "user_main_usec": _end_of(events, "dynamic_loader"),
+    }
+
+    for key, value in metrics.items():
+        if value is not None:
+            result[key] = value
+
+    return result
+
+
+def run(name, runs, port, command):
+    samples = {}
+
+    for _ in range(runs):
+        for key, value in _run_once(command, port).items():
+            samples.setdefault(key, []).append(value)
+
+    metrics = {}
+
+    for key, values in sorted(samples.items()):
+        stdev = statistics.stdev(values) if len(values) > 1 else 0.0
+        metrics[key] = {
+            "median": round(statistics.median(values), 1),
+            "mean": round(statistics.mean(values), 1),
+            "stdev": round(stdev, 1),
+            "min": round(min(values), 1),
+            "max": round(max(values), 1),
+        }
+
+    print(json.dumps({"name": name, "runs": runs, "metrics": metrics}))
+
+
+def merge(out, files):
+    results = {}
+
+    for path in files:
+        with open(path) as f:
+            for line in f:
+                line = line.strip()
+                if line.startswith("{"):
+                    r = json.loads(line)
+                    results[r.pop("name")] = r
+
+    with open(out, "w") as f:
+        json.dump({"results": results}, f, indent=4, sort_keys=True)
+        f.write("\n")
+
+
+def _usage(argv0):
+    sys.exit(
+        "Usage: %s run NAME RUNS [--port=PORT] -- COMMAND... | "
+        "merge OUT FILE..." % argv0
+    )
+
+
+def main(argv):
+    if len(argv) >= 3 and argv[1] == "merge":
+        merge(argv[2], argv[3:])
+    elif len(argv) >= 6 and argv[1] == "run" and "--" in argv:
+        sep = argv.index("--")
+        options = argv[4:sep]
+        port = None
+
+        for opt in options:
+            if opt.startswith("--port="):
+                port = int(opt[len("--port=") :])
+            else:
+                _usage(argv[0])
+
+        if sep + 1 >= len(argv) or int(argv[3]) < 1:
+            _usage(argv[0])
+
+        run(argv[2], int(argv[3]), port, argv[sep + 1 :])
+    else:
+        _usage(argv[0])
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +40,34 @@ done:
     return ret;
 }
 
+static int test_path_iter(const char* path, const char* toks[], size_t ntoks)
+{
+    myst_path_iter_t it;
+    char name[256];
+    size_t n = 0;
+
+    myst_path_iter_init(&it, path);
+
+    while (myst_path_next(&it))
+    {
+        if (n == ntoks)
+            return -1;
+
+        assert(myst_path_copy_name(&it, name, sizeof(name)) == 0);
+
+        if (strcmp(name, toks[n]) != 0)
+            return -1;
+
+        /* only the final component is the last */
+        if (myst_path_last(&it) != (n + 1 == ntoks))
+            return -1;
+
+        n++;
+    }
+
+    return n == ntoks ? 0 : -1;
+}
+
 static int _test(void)
 {
     {
@@ -78,6 +107,32 @@ static int _test(void)
         printf("=== passed test (strsplit 5)\n");
     }
 
+    {
+        const char* toks[] = {"usr", "lib", "libc.so"};
+        size_t ntoks = sizeof(toks) / sizeof(toks[0]);
+        assert(test_path_iter("/usr/lib/libc.so", toks, ntoks) == 0);
+        assert(test_path_iter("//usr///lib/libc.so//", toks, ntoks) == 0);
+        assert(test_path_iter("usr/lib/libc.so", toks, ntoks) == 0);
+        assert(test_path_iter("/", NULL, 0) == 0);
+        assert(test_path_iter("", NULL, 0) == 0);
+        printf("=== passed test (path iter)\n");
+    }
+
+    {
+        const char path[] = "/a/bcdef";
+        myst_path_iter_t it;
+        char name[4];
+
+        /* a component that does not fit is an error */
+        myst_path_iter_init(&it, path);
+        assert(myst_path_next(&it));
+        assert(myst_path_copy_name(&it, name, sizeof(name)) == 0);
+        assert(myst_path_next(&it));
+        assert(myst_path_copy_name(&it, name, sizeof(name)) == -ENAMETOOLONG);
+        assert(!myst_path_next(&it));
+        printf("=== passed test (path iter name)\n");
+    }
+
     {
         const char* toks[] = {"red", "green", "blue"};
         size_t ntoks = sizeof(toks) / sizeof(toks[0]);
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Measures the average round-trip latency of a few syscalls */
+
+#define DEFAULT_ITERATIONS 100000
+
+static size_t _iterations = DEFAULT_ITERATIONS;
+
+static long _nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void _measure(const char* name, long n, long arg1, long arg2)
+{
+    long start = _nsec();
+
+    for (size_t i = 0; i < _iterations; i++)
+        syscall(n, arg1, arg2);
+
+    long lapsed = _nsec() - start;
+
+    printf("%-16s %8.1f ns/call\n", name, (double)lapsed / _iterations);
+}
+
+int main(int argc, const char* argv[])
+{
+    struct timespec ts;
+
+    if (argc == 2)
+        _iterations = strtoul(argv[1], NULL, 10);
+
+    /* sanity check the syscalls that take the fast path */
+    assert(syscall(SYS_getpid) == getpid());
+    assert(syscall(SYS_gettid) == getpid());
+    assert(syscall(SYS_getppid) != getpid());
+    assert(syscall(SYS_getuid) == getuid());
+    assert(syscall(SYS_geteuid) == geteuid());
+    assert(syscall(SYS_getgid) == getgid());
+    assert(syscall(SYS_getegid) == getegid());
+    assert(syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts) == 0);
+    assert(syscall(SYS_clock_gettime, CLOCK_THREAD_CPUTIME_ID, &ts) == 0);
+    assert(syscall(SYS_sched_yield) == 0);
+
+    _measure("getpid", SYS_getpid, 0, 0);
+    _measure("gettid", SYS_gettid, 0, 0);
+    _measure("getuid", SYS_getuid, 0, 0);
+    _measure("clock_gettime", SYS_clock_gettime, CLOCK_MONOTONIC, (long)&ts);
+    _measure("sched_yield", SYS_sched_yield, 0, 0);
+
+    /* a syscall that takes the full path, for comparison */
+    _measure("umask", SYS_umask, 022, 0);
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#define NUM_YMM 16
+#define YMM_SIZE 32
+
+/* Whether the CPU has AVX and the ymm state is enabled in XCR0 */
+static bool _have_avx(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t lo, hi;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+
+    /* AVX and OSXSAVE */
+    if ((ecx & (1 << 28)) == 0 || (ecx & (1 << 27)) == 0)
+        return false;
+
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (lo & 0x06) == 0x06;
+}
+
+/* A raw syscall instruction (trapped and emulated under SGX) must keep the
+ * ymm registers, although the kernel copies the result with them */
+void test_ymm(void)
+{
+    uint8_t in[NUM_YMM][YMM_SIZE];
+    uint8_t out[NUM_YMM][YMM_SIZE];
+    struct utsname buf;
+    long ret = SYS_uname;
+
+    for (size_t i = 0; i < NUM_YMM; i++)
+    {
+        for (size_t j = 0; j < YMM_SIZE; j++)
+            in[i][j] = (uint8_t)(i * YMM_SIZE + j + 1);
+    }
+
+    memset(out, 0, sizeof(out));
+
+    __asm__ volatile("vmovdqu 0(%1), %%ymm0\n"
+                     "vmovdqu 32(%1), %%ymm1\n"
+                     "vmovdqu 64(%1), %%ymm2\n"
+                     "vmovdqu 96(%1), %%ymm3\n"
+                     "vmovdqu 128(%1), %%ymm4\n"
+                     "vmovdqu 160(%1), %%ymm5\n"
+                     "vmovdqu 192(%1), %%ymm6\n"
+                     "vmovdqu 224(%1), %%ymm7\n"
+                     "vmovdqu 256(%1), %%ymm8\n"
+                     "vmovdqu 288(%1), %%ymm9\n"
+                     "vmovdqu 320(%1), %%ymm10\n"
+                     "vmovdqu 352(%1), %%ymm11\n"
+                     "vmovdqu 384(%1), %%ymm12\n"
+                     "vmovdqu 416(%1), %%ymm13\n"
+                     "vmovdqu 448(%1), %%ymm14\n"
+                     "vmovdqu 480(%1), %%ymm15\n"
+                     "syscall\n"
+                     "vmovdqu %%ymm0, 0(%2)\n"
+                     "vmovdqu %%ymm1, 32(%2)\n"
+                     "vmovdqu %%ymm2, 64(%2)\n"
+                     "vmovdqu %%ymm3, 96(%2)\n"
+                     "vmovdqu %%ymm4, 128(%2)\n"
+                     "vmovdqu %%ymm5, 160(%2)\n"
+                     "vmovdqu %%ymm6, 192(%2)\n"
+                     "vmovdqu %%ymm7, 224(%2)\n"
+                     "vmovdqu %%ymm8, 256(%2)\n"
+                     "vmovdqu %%ymm9, 288(%2)\n"
+                     "vmovdqu %%ymm10, 320(%2)\n"
+                     "vmovdqu %%ymm11, 352(%2)\n"
+                     "vmovdqu %%ymm12, 384(%2)\n"
+                     "vmovdqu %%ymm13, 416(%2)\n"
+                     "vmovdqu %%ymm14, 448(%2)\n"
+                     "vmovdqu %%ymm15, 480(%2)\n"
+                     "vzeroupper\n"
+                     : "+a"(ret)
+                     : "r"(in), "r"(out), "D"(&buf)
+                     : "rcx",
+                       "r11",
+                       "memory",
+                       "xmm0",
+                       "xmm1",
+                       "xmm2",
+                       "xmm3",
+                       "xmm4",
+                       "xmm5",
+                       "xmm6",
+                       "xmm7",
+                       "xmm8",
+                       "xmm9",
+                       "xmm10",
+                       "xmm11",
+                       "xmm12",
+                       "xmm13",
+                       "xmm14",
+                       "xmm15");
+
+    assert(ret == 0);
+    assert(buf.sysname[0] != '\0');
+
+    for (size_t i = 0; i < NUM_YMM; i++)
+    {
+        if (memcmp(in[i], out[i], YMM_SIZE) != 0)
+        {
+            fprintf(stderr, "ymm%zu changed by the syscall\n", i);
+            assert(0);
+        }
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    if (_have_avx())
+        test_ymm();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile int _alarms;
+static volatile int _timer_signals;
+static volatile int _timer_value;
+static volatile int _timer_code;
+
+static uint64_t _now_msec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Sleep in short steps (signals are taken between them) */
+static void _wait_msec(uint64_t msec)
+{
+    const uint64_t end = _now_msec() + msec;
+
+    while (_now_msec() < end)
+        usleep(1000);
+}
+
+static void _alarm_handler(int sig)
+{
+    (void)sig;
+    _alarms++;
+}
+
+static void _timer_handler(int sig, siginfo_t* si, void* context)
+{
+    (void)sig;
+    (void)context;
+    _timer_code = si->si_code;
+    _timer_value = si->si_value.sival_int;
+    _timer_signals++;
+}
+
+void test_setitimer(void)
+{
+    struct itimerval it;
+    struct itimerval old;
+    int n;
+
+    assert(signal(SIGALRM, _alarm_handler) != SIG_ERR);
+
+    /* a disarmed timer reads as zero */
+    assert(getitimer(ITIMER_REAL, &it) == 0);
+    assert(it.it_value.tv_sec == 0 && it.it_value.tv_usec == 0);
+
+    /* a one-shot timer fires once */
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_usec = 20000;
+    assert(setitimer(ITIMER_REAL, &it, NULL) == 0);
+    assert(getitimer(ITIMER_REAL, &it) == 0);
+    assert(it.it_value.tv_usec > 0 && it.it_value.tv_usec <= 20000);
+    _wait_msec(100);
+    assert(_alarms == 1);
+
+    /* a periodic timer fires until it is disarmed */
+    it.it_value.tv_usec = 10000;
+    it.it_interval.tv_usec = 10000;
+    assert(setitimer(ITIMER_REAL, &it, NULL) == 0);
+    _wait_msec(150);
+
+    memset(&it, 0, sizeof(it));
+    assert(setitimer(ITIMER_REAL, &it, &old) == 0);
+    assert(old.it_interval.tv_usec == 10000);
+    n = _alarms;
+    assert(n >= 5);
+
+    _wait_msec(50);
+    assert(_alarms == n);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+void test_timer_signal(void)
+{
+    struct sigaction sa;
+    struct sigevent sev;
+    struct itimerspec its;
+    timer_t timer;
+    int n;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = _timer_handler;
+    sa.sa_flags = SA_SIGINFO;
+    assert(sigaction(SIGUSR1, &sa, NULL) == 0);
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGUSR1;
+    sev.sigev_value.sival_int = 42;
+    assert(timer_create(CLOCK_MONOTONIC, &sev, &timer) == 0);
+
+    /* a periodic timer delivers its value with SI_TIMER */
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = 10000000;
+    its.it_interval.tv_nsec = 10000000;
+    assert(timer_settime(timer, 0, &its, NULL) == 0);
+    assert(timer_gettime(timer, &its) == 0);
+    assert(its.it_interval.tv_nsec == 10000000);
+    _wait_msec(150);
+
+    n = _timer_signals;
+    assert(n >= 5);
+    assert(_timer_code == SI_TIMER && _timer_value == 42);
+    assert(timer_getoverrun(timer) >= 0);
+
+    /* a deleted timer stops */
+    assert(timer_delete(timer) == 0);
+    n = _timer_signals;
+    _wait_msec(50);
+    assert(_timer_signals == n);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+void test_timer_abstime(void)
+{
+    struct sigevent sev;
+    struct itimerspec its;
+    struct timespec now;
+    timer_t timer;
+    uint64_t start;
+    const int n = _timer_signals;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGUSR1;
+    assert(timer_create(CLOCK_REALTIME, &sev, &timer) == 0);
+
+    /* expire 50 milliseconds from now on the real time clock */
+    assert(clock_gettime(CLOCK_REALTIME, &now) == 0);
+    memset(&its, 0, sizeof(its));
+    its.it_value = now;
+    its.it_value.tv_nsec += 50000000;
+
+    if (its.it_value.tv_nsec >= 1000000000)
+    {
+        its.it_value.tv_sec++;
+        its.it_value.tv_nsec -= 1000000000;
+    }
+
+    start = _now_msec();
+    assert(timer_settime(timer, TIMER_ABSTIME, &its, NULL) == 0);
+
+    while (_timer_signals == n && _now_msec() - start < 5000)
+        usleep(1000);
+
+    assert(_timer_signals == n + 1);
+    assert(_now_msec() - start >= 45);
+
+    /* the one-shot timer is now disarmed */
+    assert(timer_gettime(timer, &its) == 0);
+    assert(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0);
+
+    assert(timer_delete(timer) == 0);
+    assert(timer_delete(timer) == -1 && errno == EINVAL);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    (void)argc;
+
+    test_setitimer();
+    test_timer_signal();
+    test_timer_abstime();
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
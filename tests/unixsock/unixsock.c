@@ -0,0 +1,266 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz";
+
+static socklen_t _make_addr(struct sockaddr_un* addr, const char* name)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    /* names that start with '@' are abstract */
+    if (name[0] == '@')
+    {
+        memcpy(addr->sun_path + 1, name + 1, strlen(name + 1));
+        return offsetof(struct sockaddr_un, sun_path) + strlen(name);
+    }
+
+    strcpy(addr->sun_path, name);
+    return sizeof(*addr);
+}
+
+static void _test_socketpair(void)
+{
+    int sv[2];
+    char buf[64];
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+    /* stream writes have no boundaries */
+    assert(write(sv[0], "abc", 3) == 3);
+    assert(write(sv[0], "def", 3) == 3);
+    assert(recv(sv[1], buf, 2, MSG_PEEK) == 2);
+    assert(read(sv[1], buf, sizeof(buf)) == 6);
+    assert(memcmp(buf, "abcdef", 6) == 0);
+
+    /* nothing left to read */
+    assert(recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) == -1);
+    assert(errno == EAGAIN);
+
+    assert(getsockopt(sv[0], SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0);
+    assert(cred.pid == getpid());
+
+    /* shutdown(SHUT_WR) is end of file for the peer */
+    assert(shutdown(sv[0], SHUT_WR) == 0);
+    assert(read(sv[1], buf, sizeof(buf)) == 0);
+    assert(send(sv[0], "x", 1, MSG_NOSIGNAL) == -1);
+    assert(errno == EPIPE);
+
+    /* the other direction still works */
+    assert(write(sv[1], "ghi", 3) == 3);
+    assert(read(sv[0], buf, sizeof(buf)) == 3);
+
+    assert(close(sv[0]) == 0);
+    assert(send(sv[1], "x", 1, MSG_NOSIGNAL) == -1);
+    assert(errno == EPIPE);
+    assert(close(sv[1]) == 0);
+}
+
+static void _test_dgram(void)
+{
+    const char path[] = "/tmp/unixsock_dgram";
+    struct sockaddr_un addr;
+    struct sockaddr_un from;
+    socklen_t addrlen = _make_addr(&addr, path);
+    socklen_t fromlen = sizeof(from);
+    struct stat st;
+    char buf[64];
+    int srv;
+    int cli;
+
+    unlink(path);
+    assert((srv = socket(AF_UNIX, SOCK_DGRAM, 0)) >= 0);
+    assert((cli = socket(AF_UNIX, SOCK_DGRAM, 0)) >= 0);
+    assert(bind(srv, (struct sockaddr*)&addr, addrlen) == 0);
+
+    /* binding creates the file */
+    assert(stat(path, &st) == 0);
+
+    /* each send is one message */
+    assert(sendto(cli, "one", 3, 0, (struct sockaddr*)&addr, addrlen) == 3);
+    assert(sendto(cli, "three", 5, 0, (struct sockaddr*)&addr, addrlen) == 5);
+    assert(recvfrom(srv, buf, 2, 0, (struct sockaddr*)&from, &fromlen) == 2);
+
+    /* the sender is not bound so it has no name */
+    assert(fromlen == 0);
+    assert(recv(srv, buf, sizeof(buf), 0) == 5);
+    assert(memcmp(buf, "three", 5) == 0);
+
+    /* a bound name is in use */
+    assert(bind(cli, (struct sockaddr*)&addr, addrlen) == -1);
+    assert(errno == EADDRINUSE);
+
+    /* once the file is removed the name cannot be reached */
+    assert(unlink(path) == 0);
+    assert(sendto(cli, "x", 1, 0, (struct sockaddr*)&addr, addrlen) == -1);
+    assert(errno == ENOENT);
+
+    assert(close(srv) == 0);
+    assert(close(cli) == 0);
+}
+
+static void* _seqpacket_server(void* arg)
+{
+    int lsock = *(int*)arg;
+    int sock;
+    char buf[64];
+
+    assert((sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC)) >= 0);
+    assert(fcntl(sock, F_GETFD) == FD_CLOEXEC);
+
+    /* message boundaries are kept */
+    assert(read(sock, buf, sizeof(buf)) == 4);
+    assert(memcmp(buf, "abcd", 4) == 0);
+    assert(read(sock, buf, sizeof(buf)) == 2);
+    assert(write(sock, "ack", 3) == 3);
+
+    assert(close(sock) == 0);
+    return NULL;
+}
+
+static void _test_seqpacket(void)
+{
+    struct sockaddr_un addr;
+    socklen_t addrlen = _make_addr(&addr, "@unixsock_seqpacket");
+    pthread_t thread;
+    char buf[64];
+    int lsock;
+    int sock;
+
+    assert((lsock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) >= 0);
+    assert(bind(lsock, (struct sockaddr*)&addr, addrlen) == 0);
+    assert(listen(lsock, 4) == 0);
+    assert(pthread_create(&thread, NULL, _seqpacket_server, &lsock) == 0);
+
+    assert((sock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) >= 0);
+    assert(connect(sock, (struct sockaddr*)&addr, addrlen) == 0);
+    assert(write(sock, "abcd", 4) == 4);
+    assert(write(sock, "ef", 2) == 2);
+    assert(read(sock, buf, sizeof(buf)) == 3);
+    assert(pthread_join(thread, NULL) == 0);
+
+    /* the server closed its end */
+    assert(read(sock, buf, sizeof(buf)) == 0);
+
+    assert(close(sock) == 0);
+    assert(close(lsock) == 0);
+
+    /* the abstract name went away with the listener */
+    assert((sock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) >= 0);
+    assert(connect(sock, (struct sockaddr*)&addr, addrlen) == -1);
+    assert(errno == ECONNREFUSED);
+    assert(close(sock) == 0);
+}
+
+static void _test_scm_rights(void)
+{
+    int sv[2];
+    int pipefd[2];
+    int fd;
+    char buf[64];
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {(void*)"z", 1};
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    assert(pipe(pipefd) == 0);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &pipefd[1], sizeof(int));
+    assert(sendmsg(sv[0], &msg, 0) == 1);
+
+    /* the descriptor in flight keeps the pipe open */
+    assert(close(pipefd[1]) == 0);
+
+    memset(control, 0, sizeof(control));
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+    msg.msg_controllen = sizeof(control);
+    assert(recvmsg(sv[1], &msg, MSG_CMSG_CLOEXEC) == 1);
+    assert(!(msg.msg_flags & MSG_CTRUNC));
+    assert((cmsg = CMSG_FIRSTHDR(&msg)));
+    assert(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS);
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    assert(fcntl(fd, F_GETFD) == FD_CLOEXEC);
+
+    /* the received descriptor is the write end of the pipe */
+    assert(write(fd, alphabet, sizeof(alphabet)) == sizeof(alphabet));
+    assert(close(fd) == 0);
+    assert(read(pipefd[0], buf, sizeof(buf)) == sizeof(alphabet));
+    assert(memcmp(buf, alphabet, sizeof(alphabet)) == 0);
+    assert(read(pipefd[0], buf, sizeof(buf)) == 0);
+
+    assert(close(pipefd[0]) == 0);
+    assert(close(sv[0]) == 0);
+    assert(close(sv[1]) == 0);
+}
+
+static void _test_epoll(void)
+{
+    int sv[2];
+    int epfd;
+    char buf[64];
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = 0};
+    struct pollfd pfd;
+
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+    assert((epfd = epoll_create1(0)) >= 0);
+    ev.data.fd = sv[1];
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, sv[1], &ev) == 0);
+
+    assert(epoll_wait(epfd, &ev, 1, 0) == 0);
+    assert(write(sv[0], "x", 1) == 1);
+    assert(epoll_wait(epfd, &ev, 1, 1000) == 1);
+    assert(ev.data.fd == sv[1] && (ev.events & EPOLLIN));
+    assert(read(sv[1], buf, sizeof(buf)) == 1);
+    assert(epoll_wait(epfd, &ev, 1, 0) == 0);
+
+    /* poll() sees the hangup */
+    assert(close(sv[0]) == 0);
+    pfd.fd = sv[1];
+    pfd.events = POLLIN;
+    assert(poll(&pfd, 1, 1000) == 1);
+    assert((pfd.revents & POLLIN) && (pfd.revents & POLLHUP));
+
+    assert(close(epfd) == 0);
+    assert(close(sv[1]) == 0);
+}
+
+int main(int argc, const char* argv[])
+{
+    _test_socketpair();
+    _test_dgram();
+    _test_seqpacket();
+    _test_scm_rights();
+    _test_epoll();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
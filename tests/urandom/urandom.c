@@ -7,6 +7,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <sys/random.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
@@ -85,10 +87,74 @@ static void _test_readv(void)
     assert(close(fd) == 0);
 }
 
+static uint64_t _now_nsec(void)
+{
+    struct timespec ts;
+    assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Many small requests (as TLS nonces and UUIDs make) never repeat */
+static void _test_small_requests(void)
+{
+    const size_t N = 100000;
+    uint8_t first[16];
+    uint8_t buf[16];
+    uint64_t start;
+    uint64_t elapsed;
+
+    assert(getrandom(first, sizeof(first), 0) == sizeof(first));
+
+    start = _now_nsec();
+
+    for (size_t i = 0; i < N; i++)
+    {
+        assert(getrandom(buf, sizeof(buf), 0) == sizeof(buf));
+        assert(memcmp(buf, first, sizeof(buf)) != 0);
+    }
+
+    elapsed = _now_nsec() - start;
+    printf("getrandom(16): %lu nsec per call\n", elapsed / N);
+}
+
+/* Large reads cross the generator's request limit */
+static void _test_large_read(void)
+{
+    const size_t N = 1024 * 1024;
+    static uint8_t buf[1024 * 1024];
+    uint64_t start;
+    uint64_t elapsed;
+    size_t zeros = 0;
+    int fd;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    assert(fd >= 0);
+
+    start = _now_nsec();
+    assert(read(fd, buf, N) == (ssize_t)N);
+    elapsed = _now_nsec() - start;
+
+    /* the 64K blocks of output differ from one another */
+    for (size_t i = 65536; i < N; i += 65536)
+        assert(memcmp(buf, buf + i, 16) != 0);
+
+    for (size_t i = 0; i < N; i++)
+        zeros += (buf[i] == 0);
+
+    /* about N/256 bytes are zero */
+    assert(zeros > N / 512 && zeros < N / 128);
+
+    printf("read(/dev/urandom, 1M): %lu MB/sec\n", N * 1000 / (elapsed + 1));
+
+    assert(close(fd) == 0);
+}
+
 int main(int argc, const char* argv[])
 {
     _test_read();
     _test_readv();
+    _test_small_requests();
+    _test_large_read();
 
     printf("=== passed test (%s)\n", argv[0]);
 
@@ -0,0 +1,607 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/blkdev.h>
+#include <myst/lz.h>
+#include <myst/zimage.h>
+
+/* the bytes after the output that must stay untouched */
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0xa5
+
+static uint64_t _state = 0x9e3779b97f4a7c15;
+
+static uint8_t _random_byte(void)
+{
+    /* xorshift64 (the same bytes on every run) */
+    _state ^= _state << 13;
+    _state ^= _state >> 7;
+    _state ^= _state << 17;
+    return (uint8_t)_state;
+}
+
+/* Fill data[] with input of the given kind (0: zeros, 1: random, 2: text,
+ * 3: short runs of bytes, 4: a mix of the others) */
+static void _fill(uint8_t* data, size_t size, int kind)
+{
+    static const char text[] = "the quick brown fox jumps over the lazy dog ";
+
+    for (size_t i = 0; i < size; i++)
+    {
+        switch (kind == 4 ? (int)((i / 3000) % 4) : kind)
+        {
+            case 0:
+                data[i] = 0;
+                break;
+            case 1:
+                data[i] = _random_byte();
+                break;
+            case 2:
+                data[i] = (uint8_t)text[i % (sizeof(text) - 1)];
+                break;
+            default:
+                data[i] = (uint8_t)((i / 7) % 5);
+                break;
+        }
+    }
+}
+
+/*
+**==============================================================================
+**
+** myst_lz_compress() and myst_lz_decompress()
+**
+**==============================================================================
+*/
+
+static void _round_trip(const uint8_t* data, size_t size)
+{
+    /* the worst case grows by one length byte per 255 literals */
+    const size_t zcap = size + size / 255 + 16;
+    uint8_t* z = malloc(zcap);
+    uint8_t* out = malloc(size + GUARD_SIZE);
+    ssize_t zn;
+
+    assert(z && out);
+    memset(out, GUARD_BYTE, size + GUARD_SIZE);
+
+    assert((zn = myst_lz_compress(data, size, z, zcap)) > 0);
+    assert(myst_lz_decompress(z, (size_t)zn, out, size) == (ssize_t)size);
+    assert(memcmp(out, data, size) == 0);
+
+    for (size_t i = 0; i < GUARD_SIZE; i++)
+        assert(out[size + i] == GUARD_BYTE);
+
+    /* one byte too few for the output */
+    if (size)
+        assert(myst_lz_decompress(z, (size_t)zn, out, size - 1) == -EINVAL);
+
+    /* one byte too few for the compressed data */
+    assert(myst_lz_compress(data, size, z, (size_t)zn - 1) == -ENOSPC);
+
+    free(out);
+    free(z);
+}
+
+static void test_lz_round_trip(void)
+{
+    static const size_t sizes[] = {
+        0, 1, 3, 4, 5, 15, 16, 19, 20, 254, 255, 270, 271, 4096, 65535, 65536,
+        65537, 300000};
+
+    for (int kind = 0; kind < 5; kind++)
+    {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            uint8_t* data = malloc(sizes[i] + 1);
+
+            assert(data);
+            _fill(data, sizes[i], kind);
+            _round_trip(data, sizes[i]);
+            free(data);
+        }
+    }
+
+    /* repeated data compresses */
+    {
+        uint8_t data[65536];
+        uint8_t z[65536];
+
+        _fill(data, sizeof(data), 2);
+        assert(myst_lz_compress(data, sizeof(data), z, sizeof(z)) < 2048);
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* Decompress malformed input, which must fail without writing past out[] */
+static ssize_t _decompress(const void* z, size_t zsize, size_t out_size)
+{
+    uint8_t out[1024 + GUARD_SIZE];
+    ssize_t n;
+
+    assert(out_size <= 1024);
+    memset(out, GUARD_BYTE, sizeof(out));
+    n = myst_lz_decompress(z, zsize, out, out_size);
+
+    for (size_t i = out_size; i < sizeof(out); i++)
+        assert(out[i] == GUARD_BYTE);
+
+    return n;
+}
+
+static void test_lz_malformed(void)
+{
+    /* a match before any output (offset zero) */
+    {
+        const uint8_t z[] = {0x00, 0x00, 0x00};
+        assert(_decompress(z, sizeof(z), 1024) == -EINVAL);
+    }
+
+    /* a match that starts before the output */
+    {
+        const uint8_t z[] = {0x10, 'a', 0x02, 0x00};
+        assert(_decompress(z, sizeof(z), 1024) == -EINVAL);
+    }
+
+    /* more literals than the input holds */
+    {
+        const uint8_t z[] = {0x50, 'a', 'b'};
+        assert(_decompress(z, sizeof(z), 1024) == -EINVAL);
+    }
+
+    /* a length that never ends */
+    {
+        const uint8_t z[] = {0xf0, 255, 255, 255};
+        assert(_decompress(z, sizeof(z), 1024) == -EINVAL);
+    }
+
+    /* a match without its second offset byte */
+    {
+        const uint8_t z[] = {0x10, 'a', 0x01};
+        assert(_decompress(z, sizeof(z), 1024) == -EINVAL);
+    }
+
+    /* a match longer than the output (535 bytes into 100) */
+    {
+        const uint8_t z[] = {0x1f, 'a', 0x01, 0x00, 255, 255, 6};
+        assert(_decompress(z, sizeof(z), 1024) == 1 + 535);
+        assert(_decompress(z, sizeof(z), 100) == -EINVAL);
+    }
+
+    /* truncated input fails or yields less than it should (but without an
+     * empty last sequence, the input before it is complete) */
+    {
+        uint8_t data[1024];
+        uint8_t z[2048];
+        ssize_t zn;
+
+        _fill(data, sizeof(data), 4);
+        assert((zn = myst_lz_compress(data, sizeof(data), z, sizeof(z))) > 0);
+
+        if (z[zn - 1] == 0)
+            zn--;
+
+        for (ssize_t i = 0; i < zn; i++)
+        {
+            const ssize_t n = _decompress(z, (size_t)i, sizeof(data));
+            assert(n == -EINVAL || (n >= 0 && n < (ssize_t)sizeof(data)));
+        }
+    }
+
+    /* random input and random corruption never write past the output */
+    {
+        uint8_t data[1024];
+        uint8_t z[2048];
+        ssize_t zn;
+
+        for (size_t i = 0; i < 2000; i++)
+        {
+            const size_t size = 1 + _random_byte() % 64;
+
+            for (size_t j = 0; j < size; j++)
+                z[j] = _random_byte();
+
+            _decompress(z, size, 1 + _random_byte() % 512);
+        }
+
+        _fill(data, sizeof(data), 2);
+        assert((zn = myst_lz_compress(data, sizeof(data), z, sizeof(z))) > 0);
+
+        for (size_t i = 0; i < 2000; i++)
+        {
+            uint8_t copy[2048];
+
+            memcpy(copy, z, (size_t)zn);
+            copy[_random_byte() % zn] ^= (uint8_t)(1 + _random_byte() % 255);
+            _decompress(copy, (size_t)zn, sizeof(data));
+        }
+    }
+
+    /* bad arguments */
+    {
+        uint8_t out[16];
+
+        assert(myst_lz_decompress(NULL, 1, out, sizeof(out)) == -EINVAL);
+        assert(myst_lz_decompress(out, 1, NULL, 1) == -EINVAL);
+        assert(myst_lz_compress(NULL, 1, out, sizeof(out)) == -EINVAL);
+        assert(myst_lz_compress(out, 1, NULL, 0) == -EINVAL);
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/*
+**==============================================================================
+**
+** myst_zblkdev_open()
+**
+**==============================================================================
+*/
+
+static uint64_t* _index(uint8_t* image)
+{
+    return (uint64_t*)((myst_zimage_header_t*)image + 1);
+}
+
+/* A read-only device over a buffer (the lower device of zblkdev) */
+typedef struct memdev
+{
+    myst_blkdev_t base;
+    const uint8_t* data;
+    size_t size;
+    size_t* closed;
+} memdev_t;
+
+static int _memdev_close(myst_blkdev_t* dev)
+{
+    memdev_t* m = (memdev_t*)dev;
+
+    (*m->closed)++;
+    free(m);
+    return 0;
+}
+
+static int _memdev_get(myst_blkdev_t* dev, uint64_t blkno, void* data)
+{
+    memdev_t* m = (memdev_t*)dev;
+
+    if (blkno >= m->size / MYST_BLKSIZE)
+        return -EINVAL;
+
+    memcpy(data, m->data + blkno * MYST_BLKSIZE, MYST_BLKSIZE);
+    return 0;
+}
+
+static int _memdev_put(myst_blkdev_t* dev, uint64_t blkno, const void* data)
+{
+    (void)dev;
+    (void)blkno;
+    (void)data;
+    return -EROFS;
+}
+
+static myst_blkdev_t* _memdev(const void* data, size_t size, size_t* closed)
+{
+    memdev_t* m = calloc(1, sizeof(memdev_t));
+
+    assert(m);
+    m->base.close = _memdev_close;
+    m->base.get = _memdev_get;
+    m->base.put = _memdev_put;
+    m->data = data;
+    m->size = size;
+    m->closed = closed;
+    return &m->base;
+}
+
+/* Make a compressed image of data[] as myst mkext2 --compress does */
+static uint8_t* _make_zimage(
+    const uint8_t* data,
+    size_t size,
+    size_t chunk_size,
+    size_t* zsize_out)
+{
+    const size_t num_chunks = (size + chunk_size - 1) / chunk_size;
+    const size_t index_size = (num_chunks + 1) * sizeof(uint64_t);
+    myst_zimage_header_t* header;
+    uint64_t* index;
+    uint8_t* image;
+    size_t offset = sizeof(myst_zimage_header_t) + index_size;
+
+    /* no chunk grows, and the padding is less than 4096 bytes */
+    assert((image = calloc(1, offset + size + 4096)));
+    header = (myst_zimage_header_t*)image;
+    index = (uint64_t*)(header + 1);
+
+    for (size_t i = 0; i < num_chunks; i++)
+    {
+        const size_t rem = size - i * chunk_size;
+        const size_t n = rem < chunk_size ? rem : chunk_size;
+        const uint8_t* chunk = data + i * chunk_size;
+        ssize_t zn;
+
+        /* store the chunk as is unless it gets smaller */
+        if ((zn = myst_lz_compress(chunk, n, image + offset, n - 1)) <= 0)
+        {
+            memcpy(image + offset, chunk, n);
+            zn = (ssize_t)n;
+        }
+
+        index[i] = offset;
+        offset += (size_t)zn;
+    }
+
+    index[num_chunks] = offset;
+
+    header->magic = MYST_ZIMAGE_MAGIC;
+    header->version = MYST_ZIMAGE_VERSION;
+    header->size = size;
+    header->chunk_size = chunk_size;
+    header->num_chunks = num_chunks;
+    header->index_offset = sizeof(myst_zimage_header_t);
+
+    *zsize_out = (offset + 4095) / 4096 * 4096;
+    return image;
+}
+
+#define CHUNK_SIZE 8192
+#define DISK_SIZE (10 * CHUNK_SIZE + 3 * MYST_BLKSIZE)
+#define DISK_BLOCKS (DISK_SIZE / MYST_BLKSIZE)
+
+static void test_zblkdev_read_write(void)
+{
+    uint8_t* disk = malloc(DISK_SIZE);
+    uint8_t* image;
+    size_t zsize;
+    size_t closed = 0;
+    myst_blkdev_t* lower;
+    myst_blkdev_t* dev;
+    uint8_t block[MYST_BLKSIZE];
+
+    /* compressible chunks and one stored as is (chunk 3) */
+    assert(disk);
+    _fill(disk, DISK_SIZE, 4);
+    _fill(disk + 3 * CHUNK_SIZE, CHUNK_SIZE, 1);
+    image = _make_zimage(disk, DISK_SIZE, CHUNK_SIZE, &zsize);
+    assert(zsize < DISK_SIZE);
+    assert(_index(image)[4] - _index(image)[3] == CHUNK_SIZE);
+
+    /* an uncompressed image is not taken for one */
+    lower = _memdev(disk, DISK_SIZE, &closed);
+    assert(myst_zblkdev_check_header(lower) == -ENOTSUP);
+    assert(myst_zblkdev_open(lower, 0, &dev) == -ENOTSUP);
+    assert(closed == 0);
+    lower->close(lower);
+
+    /* keep two chunks, so that the reads below evict chunks */
+    closed = 0;
+    lower = _memdev(image, zsize, &closed);
+    assert(myst_zblkdev_check_header(lower) == 0);
+    assert(myst_zblkdev_open(lower, 2, &dev) == 0);
+
+    /* every block, one at a time, backwards */
+    for (size_t i = DISK_BLOCKS; i-- > 0;)
+    {
+        assert(dev->get(dev, i, block) == 0);
+        assert(memcmp(block, disk + i * MYST_BLKSIZE, MYST_BLKSIZE) == 0);
+    }
+
+    /* runs that cross chunks (and the short last chunk) */
+    {
+        uint8_t* buf = malloc(DISK_SIZE);
+        const size_t firsts[] = {0, 1, 15, 16, 17, 100, DISK_BLOCKS - 20};
+
+        assert(buf);
+
+        for (size_t i = 0; i < sizeof(firsts) / sizeof(firsts[0]); i++)
+        {
+            const size_t n = DISK_BLOCKS - firsts[i];
+            const uint8_t* p = disk + firsts[i] * MYST_BLKSIZE;
+
+            assert(myst_blkdev_get_n(dev, firsts[i], n, buf) == 0);
+            assert(memcmp(buf, p, n * MYST_BLKSIZE) == 0);
+        }
+
+        free(buf);
+    }
+
+    /* past the end */
+    assert(dev->get(dev, DISK_BLOCKS, block) == -EINVAL);
+    assert(myst_blkdev_get_n(dev, DISK_BLOCKS - 1, 2, block) != 0);
+
+    /* writes stay in memory (their chunks are never evicted) */
+    {
+        uint8_t data[MYST_BLKSIZE];
+
+        memset(data, 'w', sizeof(data));
+        assert(dev->put(dev, 5, data) == 0);
+
+        for (size_t i = 16; i < DISK_BLOCKS; i++)
+            assert(dev->get(dev, i, block) == 0);
+
+        assert(dev->get(dev, 5, block) == 0);
+        assert(memcmp(block, data, sizeof(data)) == 0);
+        assert(dev->get(dev, 4, block) == 0);
+        assert(memcmp(block, disk + 4 * MYST_BLKSIZE, MYST_BLKSIZE) == 0);
+    }
+
+    /* the lower device is closed along with the device */
+    assert(dev->close(dev) == 0);
+    assert(closed == 1);
+
+    free(image);
+    free(disk);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* Open a copy of the image changed by the callback */
+static int _open_changed(
+    const uint8_t* image,
+    size_t zsize,
+    void (*change)(uint8_t* image),
+    myst_blkdev_t** dev)
+{
+    uint8_t* copy = malloc(zsize);
+    size_t closed = 0;
+    myst_blkdev_t* lower;
+    int r;
+
+    assert(copy);
+    memcpy(copy, image, zsize);
+    (*change)(copy);
+
+    lower = _memdev(copy, zsize, &closed);
+
+    if ((r = myst_zblkdev_open(lower, 0, dev)) != 0)
+    {
+        /* a failed open leaves the lower device to the caller */
+        assert(closed == 0);
+        lower->close(lower);
+        free(copy);
+    }
+
+    return r;
+}
+
+static myst_zimage_header_t* _header(uint8_t* image)
+{
+    return (myst_zimage_header_t*)image;
+}
+
+static void _bad_magic(uint8_t* image)
+{
+    _header(image)->magic++;
+}
+
+static void _bad_version(uint8_t* image)
+{
+    _header(image)->version = MYST_ZIMAGE_VERSION + 1;
+}
+
+static void _bad_chunk_size(uint8_t* image)
+{
+    _header(image)->chunk_size = CHUNK_SIZE + MYST_BLKSIZE;
+}
+
+static void _huge_chunk_size(uint8_t* image)
+{
+    _header(image)->chunk_size = 2 * MYST_ZIMAGE_MAX_CHUNK_SIZE;
+}
+
+static void _bad_num_chunks(uint8_t* image)
+{
+    _header(image)->num_chunks++;
+}
+
+static void _bad_size(uint8_t* image)
+{
+    _header(image)->size--;
+}
+
+static void _bad_index_offset(uint8_t* image)
+{
+    _header(image)->index_offset = 8;
+}
+
+static void _decreasing_index(uint8_t* image)
+{
+    uint64_t* index = _index(image);
+    index[2] = index[1] - 1;
+}
+
+static void _overlapping_index(uint8_t* image)
+{
+    _index(image)[0] = sizeof(myst_zimage_header_t);
+}
+
+static void _grown_chunk(uint8_t* image)
+{
+    uint64_t* index = _index(image);
+    index[1] = index[0] + CHUNK_SIZE + 1;
+}
+
+static void test_zblkdev_malformed(void)
+{
+    uint8_t* disk = malloc(DISK_SIZE);
+    uint8_t* image;
+    size_t zsize;
+    myst_blkdev_t* dev;
+    uint8_t block[MYST_BLKSIZE];
+
+    assert(disk);
+    _fill(disk, DISK_SIZE, 2);
+    image = _make_zimage(disk, DISK_SIZE, CHUNK_SIZE, &zsize);
+
+    /* the header and the index are checked by the open */
+    assert(_open_changed(image, zsize, _bad_magic, &dev) == -ENOTSUP);
+    assert(_open_changed(image, zsize, _bad_version, &dev) == -ENOTSUP);
+    assert(_open_changed(image, zsize, _bad_chunk_size, &dev) == -ENOTSUP);
+    assert(_open_changed(image, zsize, _huge_chunk_size, &dev) == -ENOTSUP);
+    assert(_open_changed(image, zsize, _bad_num_chunks, &dev) == -EINVAL);
+    assert(_open_changed(image, zsize, _bad_size, &dev) == -EINVAL);
+    assert(_open_changed(image, zsize, _bad_index_offset, &dev) == -EINVAL);
+    assert(_open_changed(image, zsize, _decreasing_index, &dev) == -EINVAL);
+    assert(_open_changed(image, zsize, _overlapping_index, &dev) == -EINVAL);
+    assert(_open_changed(image, zsize, _grown_chunk, &dev) == -EINVAL);
+
+    /* an image cut short fails to read the index */
+    {
+        size_t closed = 0;
+        myst_blkdev_t* lower = _memdev(image, MYST_BLKSIZE, &closed);
+
+        assert(myst_zblkdev_open(lower, 0, &dev) != 0);
+        lower->close(lower);
+    }
+
+    /* a corrupt chunk fails to read, but the others still read */
+    {
+        const uint64_t* index = _index(image);
+        size_t closed = 0;
+        myst_blkdev_t* lower;
+
+        /* a match before any output (see test_lz_malformed()) */
+        assert(index[2] - index[1] < CHUNK_SIZE);
+        memset(image + index[1], 0, index[2] - index[1]);
+
+        lower = _memdev(image, zsize, &closed);
+        assert(myst_zblkdev_open(lower, 0, &dev) == 0);
+
+        assert(dev->get(dev, CHUNK_SIZE / MYST_BLKSIZE, block) == -EINVAL);
+        assert(dev->get(dev, 0, block) == 0);
+        assert(memcmp(block, disk, MYST_BLKSIZE) == 0);
+        assert(dev->get(dev, 2 * CHUNK_SIZE / MYST_BLKSIZE, block) == 0);
+        assert(memcmp(block, disk + 2 * CHUNK_SIZE, MYST_BLKSIZE) == 0);
+
+        /* still not cached after the failure */
+        assert(dev->get(dev, CHUNK_SIZE / MYST_BLKSIZE, block) == -EINVAL);
+
+        assert(dev->close(dev) == 0);
+    }
+
+    free(image);
+    free(disk);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    (void)argc;
+
+    test_lz_round_trip();
+    test_lz_malformed();
+    test_zblkdev_read_write();
+    test_zblkdev_malformed();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -4,6 +4,9 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <myst/console.h>
 
 #include "shared.h"
 
@@ -37,3 +40,23 @@ int myst_expand_size_string_to_ulong(const char* size_string, size_t* size)
 
     return 0;
 }
+
+int myst_get_console_buffering(const char* name)
+{
+    if (!name)
+    {
+        return isatty(STDOUT_FILENO) ? MYST_CONSOLE_LINE_BUFFERED
+                                     : MYST_CONSOLE_FULLY_BUFFERED;
+    }
+
+    if (strcmp(name, "line") == 0)
+        return MYST_CONSOLE_LINE_BUFFERED;
+
+    if (strcmp(name, "full") == 0)
+        return MYST_CONSOLE_FULLY_BUFFERED;
+
+    if (strcmp(name, "none") == 0)
+        return MYST_CONSOLE_UNBUFFERED;
+
+    return -1;
+}
@@ -178,6 +178,16 @@ static json_result_t _json_read_callback(
                 else
                     CONFIG_RAISE(JSON_TYPE_MISMATCH);
             }
+            else if (json_match(parser, "NumHostWorkerThreads") == JSON_OK)
+            {
+                if (type == JSON_TYPE_INTEGER && un->integer >= 0)
+                {
+                    parsed_data->oe_num_host_worker_threads =
+                        (uint64_t)un->integer;
+                }
+                else
+                    CONFIG_RAISE(JSON_TYPE_MISMATCH);
+            }
             else if (json_match(parser, "ProductID") == JSON_OK)
             {
                 if (type == JSON_TYPE_INTEGER)
@@ -273,6 +283,22 @@ static json_result_t _json_read_callback(
                 else
                     CONFIG_RAISE(JSON_TYPE_MISMATCH);
             }
+            else if (json_match(parser, "VerityCacheSize") == JSON_OK)
+            {
+                ret = _extract_mem_size(
+                    type, un, &parsed_data->verity_cache_pages);
+                if (ret != JSON_OK)
+                    CONFIG_RAISE(ret);
+            }
+            else if (json_match(parser, "VerityPrefetchBlocks") == JSON_OK)
+            {
+                if (type == JSON_TYPE_INTEGER && un->integer >= 0)
+                {
+                    parsed_data->verity_prefetch_blocks = (uint64_t)un->integer;
+                }
+                else
+                    CONFIG_RAISE(JSON_TYPE_MISMATCH);
+            }
             else
             {
                 // Ignore everything we dont understand
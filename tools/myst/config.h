@@ -1,6 +1,9 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#ifndef _MYST_MYST_CONFIG_H
+#define _MYST_MYST_CONFIG_H
+
 #include <myst/json.h>
 #include <stdio.h>
 #include <sys/types.h>
@@ -16,6 +19,7 @@ typedef struct _config_parsed_data_t
     unsigned char oe_debug;
     uint64_t oe_num_stack_pages;
     uint64_t oe_num_user_threads;
+    uint64_t oe_num_host_worker_threads;
     unsigned short oe_product_id;
     unsigned short oe_security_version;
 
@@ -31,6 +35,8 @@ typedef struct _config_parsed_data_t
     size_t host_environment_variables_count;
     char* cwd;
     char* hostname;
+    uint64_t verity_cache_pages; // verity_cache_pages*4096=value-in-config
+    uint64_t verity_prefetch_blocks;
 
     // Internal data
     void* buffer;
@@ -49,3 +55,5 @@ int parse_config_from_file(
 int write_oe_config_fd(int fd, config_parsed_data_t* parsed_data);
 
 int free_config(config_parsed_data_t* parsed_data);
+
+#endif /* _MYST_MYST_CONFIG_H */
@@ -0,0 +1,213 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config_blob.h"
+
+/* Add the strings to the blob (when p is non-null) and count their bytes */
+static int _add_strings(
+    uint8_t* p,
+    size_t* size,
+    const char* const* strings,
+    size_t count,
+    config_blob_list_t* list)
+{
+    if (*size > UINT32_MAX || count > UINT32_MAX)
+        return -E2BIG;
+
+    list->offset = count ? (uint32_t)*size : 0;
+    list->count = (uint32_t)count;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const size_t n = strlen(strings[i]) + 1;
+
+        if (p)
+            memcpy(p + *size, strings[i], n);
+
+        *size += n;
+    }
+
+    return 0;
+}
+
+static int _add_string(uint8_t* p, size_t* size, const char* s, uint32_t* off)
+{
+    config_blob_list_t list;
+    int r;
+
+    if ((r = _add_strings(p, size, &s, s ? 1 : 0, &list)) == 0)
+        *off = list.offset;
+
+    return r;
+}
+
+/* Lay out the blob in p (or just size it when p is null) */
+static int _layout(const config_parsed_data_t* pd, uint8_t* p, size_t* size)
+{
+    config_blob_t h;
+    int r;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CONFIG_BLOB_MAGIC, sizeof(h.magic));
+    h.version = CONFIG_BLOB_VERSION;
+    h.heap_pages = pd->heap_pages;
+    h.verity_cache_pages = pd->verity_cache_pages;
+    h.verity_prefetch_blocks = pd->verity_prefetch_blocks;
+    h.allow_host_parameters = pd->allow_host_parameters;
+
+    *size = sizeof(h);
+
+    if ((r = _add_string(p, size, pd->application_path, &h.application_path)))
+        return r;
+
+    if ((r = _add_string(p, size, pd->cwd, &h.cwd)))
+        return r;
+
+    if ((r = _add_string(p, size, pd->hostname, &h.hostname)))
+        return r;
+
+    if ((r = _add_strings(
+             p,
+             size,
+             (const char* const*)pd->application_parameters,
+             pd->application_parameters_count,
+             &h.application_parameters)))
+    {
+        return r;
+    }
+
+    if ((r = _add_strings(
+             p,
+             size,
+             (const char* const*)pd->enclave_environment_variables,
+             pd->enclave_environment_variables_count,
+             &h.enclave_environment_variables)))
+    {
+        return r;
+    }
+
+    if ((r = _add_strings(
+             p,
+             size,
+             (const char* const*)pd->host_environment_variables,
+             pd->host_environment_variables_count,
+             &h.host_environment_variables)))
+    {
+        return r;
+    }
+
+    if (*size > UINT32_MAX)
+        return -E2BIG;
+
+    h.size = (uint32_t)*size;
+
+    if (p)
+        memcpy(p, &h, sizeof(h));
+
+    return 0;
+}
+
+int compile_config_blob(
+    const config_parsed_data_t* parsed_data,
+    config_blob_t** blob,
+    size_t* size)
+{
+    uint8_t* p;
+    size_t n;
+    int r;
+
+    if (!parsed_data || !blob || !size)
+        return -EINVAL;
+
+    if ((r = _layout(parsed_data, NULL, &n)))
+        return r;
+
+    if (!(p = calloc(1, n)))
+        return -ENOMEM;
+
+    if ((r = _layout(parsed_data, p, &n)))
+    {
+        free(p);
+        return r;
+    }
+
+    *blob = (config_blob_t*)p;
+    *size = n;
+    return 0;
+}
+
+/* Check that the list is the given number of strings inside the blob */
+static int _check_list(const char* p, size_t size, uint32_t off, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    if (off < sizeof(config_blob_t))
+        return -1;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const char* end;
+
+        if (off >= size || !(end = memchr(p + off, '\0', size - off)))
+            return -1;
+
+        off += (uint32_t)(end - (p + off)) + 1;
+    }
+
+    return 0;
+}
+
+static int _check_string(const char* p, size_t size, uint32_t off)
+{
+    return _check_list(p, size, off, off ? 1 : 0);
+}
+
+const config_blob_t* get_config_blob(const void* data, size_t size)
+{
+    const config_blob_t* blob = data;
+    const char* p = data;
+
+    if (!data || size < sizeof(config_blob_t))
+        return NULL;
+
+    if (memcmp(blob->magic, CONFIG_BLOB_MAGIC, sizeof(blob->magic)) != 0)
+        return NULL;
+
+    if (blob->version != CONFIG_BLOB_VERSION)
+        return NULL;
+
+    if (blob->size < sizeof(config_blob_t) || blob->size > size)
+        return NULL;
+
+    /* every string must end inside the blob */
+    size = blob->size;
+
+    if (_check_string(p, size, blob->application_path) ||
+        _check_string(p, size, blob->cwd) ||
+        _check_string(p, size, blob->hostname) ||
+        _check_list(
+            p,
+            size,
+            blob->application_parameters.offset,
+            blob->application_parameters.count) ||
+        _check_list(
+            p,
+            size,
+            blob->enclave_environment_variables.offset,
+            blob->enclave_environment_variables.count) ||
+        _check_list(
+            p,
+            size,
+            blob->host_environment_variables.offset,
+            blob->host_environment_variables.count))
+    {
+        return NULL;
+    }
+
+    return blob;
+}
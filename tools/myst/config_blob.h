@@ -0,0 +1,73 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_MYST_CONFIG_BLOB_H
+#define _MYST_MYST_CONFIG_BLOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+**==============================================================================
+**
+** The compiled configuration.
+**
+**     The loader compiles config.json (the .mystconfig section) into this
+**     layout and measures it into the enclave as the config region, which
+**     the enclave then reads in place, without parsing or allocating. The
+**     JSON stays in the image for the tools (dump, exec's host side).
+**
+**     A string is the offset of its first byte from the start of the blob
+**     (zero for none). The strings of a list follow one another, each with
+**     its null terminator. The version changes with the layout.
+**
+**==============================================================================
+*/
+
+#define CONFIG_BLOB_MAGIC "MYSTCFG"
+#define CONFIG_BLOB_VERSION 1
+
+typedef struct _config_blob_list
+{
+    uint32_t offset; /* the first string */
+    uint32_t count;
+} config_blob_list_t;
+
+typedef struct _config_blob
+{
+    char magic[8]; /* CONFIG_BLOB_MAGIC (with its null terminator) */
+    uint32_t version;
+    uint32_t size; /* the bytes of the blob, strings included */
+    uint64_t heap_pages;
+    uint64_t verity_cache_pages;
+    uint64_t verity_prefetch_blocks;
+    uint8_t allow_host_parameters;
+    uint8_t reserved1[3];
+    uint32_t application_path;
+    uint32_t cwd;
+    uint32_t hostname;
+    config_blob_list_t application_parameters;
+    config_blob_list_t enclave_environment_variables;
+    config_blob_list_t host_environment_variables;
+} config_blob_t;
+
+/* Compile the parsed configuration into a blob (to be released by free()) */
+int compile_config_blob(
+    const config_parsed_data_t* parsed_data,
+    config_blob_t** blob,
+    size_t* size);
+
+/* Check the blob in the given memory, returning it or null if invalid */
+const config_blob_t* get_config_blob(const void* data, size_t size);
+
+/* The string at the given offset (or null for a zero offset) */
+static __inline__ const char* config_blob_string(
+    const config_blob_t* blob,
+    uint32_t offset)
+{
+    return offset ? (const char*)blob + offset : NULL;
+}
+
+#endif /* _MYST_MYST_CONFIG_BLOB_H */
@@ -7,12 +7,11 @@
 #include <myst/clock.h>
 #include <myst/syscall.h>
 #include <myst/syscallext.h>
+#include <myst/vdso.h>
 #include <stdio.h>
 
-static long _realtime0 = 0;
-static long _monotime0 = 0;
-static volatile long* _monotime_now = 0;
-static long _realtime_delta = 0;
+/* shared with the C runtime through myst_get_vdso() */
+static myst_vdso_t _vdso;
 static long enc_clock_res = 0;
 
 int myst_setup_clock(struct clock_ctrl* ctrl)
@@ -26,19 +25,26 @@ int myst_setup_clock(struct clock_ctrl* ctrl)
         // Copy the starting values into enclave to isolate them
         // From attacks. Note the starting clocks don't account for
         // the time spent in entering the enclave.
-        _realtime0 = ctrl->realtime0;
-        _monotime0 = ctrl->monotime0;
+        _vdso.realtime0 = ctrl->realtime0;
+        _vdso.monotime0 = ctrl->monotime0;
+        _vdso.monotime_prev = ctrl->monotime0;
 
-        if (_realtime0 <= 0 || _monotime0 <= 0)
+        if (_vdso.realtime0 <= 0 || _vdso.monotime0 <= 0)
             goto done;
 
         // If ctrl is outside of the enclave, ctrl->now
-        // should be outside too. _monotime_now is a host address. The address
+        // should be outside too. monotime_now is a host address. The address
         // is saved in the enclave, but we are still subject to malicious host's
         // manipulating of the value at the address, including but not limited
         // to, decreaing the value over time, i.e., a clock goes backward. Both
-        // _get_monotime and _get_realtime are guarded against such attacks.
-        _monotime_now = &ctrl->now;
+        // myst_vdso_monotime and myst_vdso_realtime are guarded against such
+        // attacks.
+        _vdso.monotime_now = &ctrl->now;
+
+        // The same goes for the host TSC, which stands in for RDTSC (see
+        // _vectored_handler() in enc.c).
+        _vdso.tsc_now = &ctrl->tsc;
+        _vdso.tsc_prev = ctrl->tsc;
 
         enc_clock_res = (long)ctrl->interval;
 
@@ -48,6 +54,11 @@ done:
     return ret;
 }
 
+myst_vdso_t* myst_get_vdso(void)
+{
+    return _vdso.monotime_now ? &_vdso : NULL;
+}
+
 static void _check(bool overflowed)
 {
     if (overflowed)
@@ -57,41 +68,11 @@ static void _check(bool overflowed)
     }
 }
 
-/* Return monotonic clock in nanoseconds since a starting point */
-static long _get_monotime()
-{
-    static long prev = 0;
-    if (prev == 0)
-        prev = _monotime0;
-    long now = *_monotime_now;
-    if (now > prev)
-    {
-        prev = now;
-        return now;
-    }
-    else
-    {
-        // maintain monotonicity.
-        // TODO: issue a warning. Host might be playing tricks.
-        return ++prev;
-    }
-}
-
-static long _get_boottime()
-{
-    /* Boottime clock relies on monotonic clock */
-    return _get_monotime();
-}
-
 /* Return realtime clock in nanoseconds since the epoch */
 static long _get_realtime()
 {
-    // Derive the realtime clock from the monotonic clock.
-    // Any adjustment to the system clock is invisible to the
-    // enclave application once it is launched.
-    long ret = _get_monotime() - _monotime0;
-    _check(__builtin_saddl_overflow(ret, _realtime0, &ret));
-    _check(__builtin_saddl_overflow(ret, _realtime_delta, &ret));
+    long ret = 0;
+    _check(myst_vdso_realtime(&_vdso, &ret) != 0);
     return ret;
 }
 
@@ -106,34 +87,11 @@ long myst_tcall_clock_getres(clockid_t clk_id, struct timespec* res)
 /* This overrides the weak version in libmystkernel.a */
 long myst_tcall_clock_gettime(clockid_t clk_id, struct timespec* tp)
 {
-    long nanoseconds;
-    switch (clk_id)
-    {
-        case CLOCK_MONOTONIC_COARSE:
-        case CLOCK_MONOTONIC:
-        {
-            nanoseconds = _get_monotime();
-            break;
-        }
-        case CLOCK_REALTIME_COARSE:
-        case CLOCK_REALTIME:
-        {
-            nanoseconds = _get_realtime();
-            break;
-        }
-        case CLOCK_BOOTTIME:
-        {
-            nanoseconds = _get_boottime();
-            break;
-        }
-        default:
-            return -EINVAL;
-    }
+    int r = myst_vdso_clock_gettime(&_vdso, clk_id, tp);
 
-    tp->tv_sec = nanoseconds / NANO_IN_SECOND;
-    tp->tv_nsec = nanoseconds % NANO_IN_SECOND;
+    _check(r == -EOVERFLOW);
 
-    return 0;
+    return r;
 }
 
 /* This overrides the weak version in libmystkernel.a */
@@ -143,14 +101,16 @@ long myst_tcall_clock_settime(clockid_t clk_id, struct timespec* tp)
     {
         long new_time = tp->tv_sec * NANO_IN_SECOND + tp->tv_nsec;
         long cur_time = (long)_get_realtime();
+        long delta = _vdso.realtime_delta;
 
         if (new_time <= cur_time)
             return 0; // trying to set clock backward, make it no-op
 
-        if (_realtime_delta > _realtime_delta + (new_time - cur_time))
+        if (delta > delta + (new_time - cur_time))
             return -EINVAL; // possible overflow, make it no-op
 
-        _realtime_delta += (new_time - cur_time);
+        delta += new_time - cur_time;
+        __atomic_store_n(&_vdso.realtime_delta, delta, __ATOMIC_RELAXED);
         return 0;
     }
 
@@ -0,0 +1,175 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <openenclave/enclave.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "myst_t.h"
+
+/*
+**==============================================================================
+**
+** CPUID cache:
+**
+**     CPUID traps inside an SGX enclave, and asking the host for each one
+**     costs an OCALL on top of the exception. Libraries probe CPU features
+**     over and over, so the leaves are read from the host once at startup
+**     and the exception handler answers from this table (see
+**     _vectored_handler() in enc.c). Leaves outside the table still go to
+**     the host.
+**
+**     The snapshot is taken on one CPU, so the fields that identify the CPU
+**     executing CPUID (its APIC ids) are cleared rather than reported for
+**     every CPU.
+**
+**==============================================================================
+*/
+
+#define MAX_BASIC_LEAF 0x20
+#define MAX_EXTENDED_LEAF 0x80000020
+#define MAX_ENTRIES 256
+
+typedef struct entry
+{
+    uint32_t leaf;
+    uint32_t subleaf;
+    uint32_t regs[4]; /* eax, ebx, ecx, edx */
+} entry_t;
+
+/* sorted by leaf and then by subleaf */
+static entry_t _entries[MAX_ENTRIES];
+static size_t _nentries;
+
+/* The subleaves to read for leaves whose output depends on ECX */
+static uint32_t _num_subleaves(uint32_t leaf)
+{
+    switch (leaf)
+    {
+        case 0x4:        /* cache parameters */
+        case 0x7:        /* structured extended features */
+        case 0xb:        /* extended topology */
+        case 0xf:        /* resource director monitoring */
+        case 0x10:       /* resource director allocation */
+        case 0x12:       /* SGX capabilities */
+        case 0x14:       /* processor trace */
+        case 0x17:       /* SoC vendor attributes */
+        case 0x18:       /* address translation */
+        case 0x1f:       /* extended topology v2 */
+        case 0x8000001d: /* cache topology (AMD) */
+            return 8;
+        case 0xd: /* processor extended states */
+            return 32;
+        default:
+            return 1;
+    }
+}
+
+static void _sanitize(entry_t* e)
+{
+    /* the initial APIC id of the CPU that took the snapshot */
+    if (e->leaf == 0x1)
+        e->regs[1] &= 0x00ffffff;
+
+    /* the x2APIC id of that CPU */
+    if (e->leaf == 0xb || e->leaf == 0x1f)
+        e->regs[3] = 0;
+}
+
+static int _add_leaves(uint32_t first, uint32_t max)
+{
+    uint32_t regs[4];
+    uint32_t last;
+
+    if (myst_cpuid_ocall(
+            first, 0, &regs[0], &regs[1], &regs[2], &regs[3]) != OE_OK)
+    {
+        return -1;
+    }
+
+    /* leaf FIRST reports the highest leaf of its range */
+    last = (regs[0] >= first && regs[0] <= max) ? regs[0] : first;
+
+    for (uint32_t leaf = first; leaf <= last; leaf++)
+    {
+        const uint32_t n = _num_subleaves(leaf);
+
+        for (uint32_t subleaf = 0; subleaf < n; subleaf++)
+        {
+            entry_t* e;
+
+            if (_nentries == MAX_ENTRIES)
+                return -1;
+
+            e = &_entries[_nentries];
+            e->leaf = leaf;
+            e->subleaf = subleaf;
+
+            if (myst_cpuid_ocall(
+                    leaf,
+                    subleaf,
+                    &e->regs[0],
+                    &e->regs[1],
+                    &e->regs[2],
+                    &e->regs[3]) != OE_OK)
+            {
+                return -1;
+            }
+
+            _sanitize(e);
+            _nentries++;
+        }
+    }
+
+    return 0;
+}
+
+int myst_setup_cpuid(void)
+{
+    _nentries = 0;
+
+    if (_add_leaves(0, MAX_BASIC_LEAF) != 0 ||
+        _add_leaves(0x80000000, MAX_EXTENDED_LEAF) != 0)
+    {
+        /* answer every CPUID from the host */
+        _nentries = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Answer CPUID from the cache; returns false if the host must answer */
+bool myst_cpuid_lookup(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+    size_t lo = 0;
+    size_t hi = _nentries;
+
+    /* these leaves ignore the subleaf */
+    if (_num_subleaves(leaf) == 1)
+        subleaf = 0;
+
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        const entry_t* e = &_entries[mid];
+
+        if (e->leaf == leaf && e->subleaf == subleaf)
+        {
+            regs[0] = e->regs[0];
+            regs[1] = e->regs[1];
+            regs[2] = e->regs[2];
+            regs[3] = e->regs[3];
+            return true;
+        }
+
+        if (e->leaf < leaf || (e->leaf == leaf && e->subleaf < subleaf))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return false;
+}
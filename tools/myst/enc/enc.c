@@ -15,20 +15,26 @@
 #include <myst/args.h>
 #include <myst/buf.h>
 #include <myst/eraise.h>
+#include <myst/eventtrace.h>
 #include <myst/file.h>
 #include <myst/kernel.h>
+#include <myst/layoutprofile.h>
 #include <myst/mmanutils.h>
 #include <myst/mount.h>
+#include <myst/profile.h>
 #include <myst/ramfs.h>
 #include <myst/reloc.h>
 #include <myst/shm.h>
+#include <myst/startuptrace.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
 #include <myst/tcall.h>
 #include <myst/thread.h>
 #include <myst/trace.h>
+#include <myst/vdso.h>
+#include <myst/waitwake.h>
 
-#include "../config.h"
+#include "../config_blob.h"
 #include "../shared.h"
 #include "myst_t.h"
 
@@ -45,6 +51,13 @@ static size_t _get_num_tcs(void)
 }
 
 int myst_setup_clock(struct clock_ctrl*);
+myst_vdso_t* myst_get_vdso(void);
+
+int myst_setup_cpuid(void);
+bool myst_cpuid_lookup(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]);
+
+/* set by the kernel (see myst_tcall_set_syscall_trampoline()) */
+extern void (*__myst_syscall_trampoline)(void);
 
 /* Handle illegal SGX instructions */
 static uint64_t _vectored_handler(oe_exception_record_t* er)
@@ -52,15 +65,25 @@ static uint64_t _vectored_handler(oe_exception_record_t* er)
     const uint16_t RDTSC_OPCODE = 0x310F;
     const uint16_t CPUID_OPCODE = 0xA20F;
     const uint16_t IRETQ_OPCODE = 0xCF48;
+    const uint16_t SYSCALL_OPCODE = 0x050F;
     const uint16_t opcode = *((uint16_t*)er->context->rip);
 
     if (er->code == OE_EXCEPTION_ILLEGAL_INSTRUCTION && opcode == RDTSC_OPCODE)
     {
         uint32_t rax = 0;
         uint32_t rdx = 0;
+        myst_vdso_t* vdso = myst_get_vdso();
 
+        /* Read the TSC that the host clock thread keeps in the clock page
+         * (current to a clock tick) rather than make an OCALL */
+        if (vdso && vdso->tsc_now && *vdso->tsc_now)
+        {
+            const unsigned long tsc = myst_vdso_rdtsc(vdso);
+            rax = (uint32_t)tsc;
+            rdx = (uint32_t)(tsc >> 32);
+        }
         /* Ask host to execute RDTSC instruction */
-        if (myst_rdtsc_ocall(&rax, &rdx) != OE_OK)
+        else if (myst_rdtsc_ocall(&rax, &rdx) != OE_OK)
         {
             fprintf(stderr, "myst_rdtsc_ocall() failed\n");
             assert(false);
@@ -85,13 +108,22 @@ static uint64_t _vectored_handler(oe_exception_record_t* er)
 
         if (er->context->rax != 0xff)
         {
-            myst_cpuid_ocall(
-                (uint32_t)er->context->rax, /* leaf */
-                (uint32_t)er->context->rcx, /* subleaf */
-                &rax,
-                &rbx,
-                &rcx,
-                &rdx);
+            const uint32_t leaf = (uint32_t)er->context->rax;
+            const uint32_t subleaf = (uint32_t)er->context->rcx;
+            uint32_t regs[4];
+
+            /* answer from the leaves read at startup (see cpuid.c) */
+            if (myst_cpuid_lookup(leaf, subleaf, regs))
+            {
+                rax = regs[0];
+                rbx = regs[1];
+                rcx = regs[2];
+                rdx = regs[3];
+            }
+            else
+            {
+                myst_cpuid_ocall(leaf, subleaf, &rax, &rbx, &rcx, &rdx);
+            }
         }
 
         er->context->rax = rax;
@@ -113,25 +145,68 @@ static uint64_t _vectored_handler(oe_exception_record_t* er)
         return OE_EXCEPTION_CONTINUE_EXECUTION;
     }
 
+    if (er->code == OE_EXCEPTION_ILLEGAL_INSTRUCTION &&
+        opcode == SYSCALL_OPCODE)
+    {
+        void (*trampoline)(void) =
+            __atomic_load_n(&__myst_syscall_trampoline, __ATOMIC_ACQUIRE);
+
+        if (trampoline)
+        {
+            /* Resume in the kernel trampoline, which makes the syscall and
+             * returns after the instruction. Step over the red zone of the
+             * interrupted code and push the return address. */
+            uint64_t rsp = er->context->rsp - 128 - sizeof(uint64_t);
+            *(uint64_t*)rsp = er->context->rip + 2;
+            er->context->rsp = rsp;
+            er->context->rip = (uint64_t)trampoline;
+
+            return OE_EXCEPTION_CONTINUE_EXECUTION;
+        }
+    }
+
     return OE_EXCEPTION_CONTINUE_SEARCH;
 }
 
 static bool _is_allowed_env_variable(
-    const config_parsed_data_t* config,
+    const config_blob_t* config,
     const char* env)
 {
-    for (size_t i = 0; i < config->host_environment_variables_count; i++)
+    const config_blob_list_t* list = &config->host_environment_variables;
+    const char* allowed = config_blob_string(config, list->offset);
+
+    for (size_t i = 0; i < list->count; i++)
     {
-        const char* allowed = config->host_environment_variables[i];
         size_t len = strlen(allowed);
 
         if (strncmp(env, allowed, len) == 0 && env[len] == '=')
             return true;
+
+        allowed += len + 1;
     }
 
     return false;
 }
 
+/* Append the strings of a list of the config blob (which stay in place) */
+static int _append_config_list(
+    myst_args_t* args,
+    const config_blob_t* config,
+    const config_blob_list_t* list)
+{
+    const char* s = config_blob_string(config, list->offset);
+
+    for (size_t i = 0; i < list->count; i++)
+    {
+        if (myst_args_append1(args, s) != 0)
+            return -1;
+
+        s += strlen(s) + 1;
+    }
+
+    return 0;
+}
+
 const void* __oe_get_enclave_base(void);
 size_t __oe_get_enclave_size(void);
 
@@ -199,8 +274,26 @@ int myst_enter_ecall(
     bool trace_errors = false;
     bool trace_syscalls = false;
     bool export_ramfs = false;
+    bool export_ramfs_changed = false;
+    bool export_gcov = false;
+    bool syscall_stats = false;
+    size_t max_pipe_size = 0;
+    bool enclave_loopback = false;
+    bool host_sendfile = false;
+    bool async_close = false;
+    bool prefetch_libs = false;
+    bool kernel_tls = false;
+    size_t socket_prefetch_size = 0;
+    size_t accept_batch = 0;
+    unsigned int busy_poll_usec = 0;
+    size_t crypto_threads = 0;
+    size_t attestation_cache_ttl = 0;
+    int console_buffering = 0;
+    size_t verity_cache_blocks = 0;
+    size_t verity_prefetch_blocks = 0;
     const char* rootfs = NULL;
-    config_parsed_data_t parsed_config = {0};
+    const char* verity_node_cache = NULL;
+    const config_blob_t* config = NULL;
     unsigned char have_config = 0;
     myst_args_t args;
     myst_args_t env;
@@ -240,28 +333,30 @@ int myst_enter_ecall(
         {
             config_data = enclave_base + region.vaddr;
             config_size = region.size;
-            if (parse_config_from_buffer(
-                    config_data, config_size, &parsed_config) != 0)
+
+            /* the loader measured the compiled config (see config_blob.h) */
+            if (!(config = get_config_blob(config_data, config_size)))
             {
-                fprintf(stderr, "failed to parse configuration\n");
+                fprintf(stderr, "failed to read configuration\n");
                 assert(0);
             }
             have_config = 1;
         }
     }
 
-    if (have_config == 1 && !parsed_config.allow_host_parameters)
+    if (have_config == 1 && !config->allow_host_parameters)
     {
+        const char* path =
+            config_blob_string(config, config->application_path);
+
         if (myst_args_init(&args) != 0)
             goto done;
 
-        if (myst_args_append1(&args, parsed_config.application_path) != 0)
+        if (myst_args_append1(&args, path) != 0)
             goto done;
 
-        if (myst_args_append(
-                &args,
-                (const char**)parsed_config.application_parameters,
-                parsed_config.application_parameters_count) != 0)
+        if (_append_config_list(
+                &args, config, &config->application_parameters) != 0)
         {
             goto done;
         }
@@ -279,17 +374,14 @@ int myst_enter_ecall(
         myst_args_init(&env);
 
         // append all enclave-side environment variables first
-        if (myst_args_append(
-                &env,
-                (const char**)parsed_config.enclave_environment_variables,
-                parsed_config.enclave_environment_variables_count) != 0)
+        if (_append_config_list(
+                &env, config, &config->enclave_environment_variables) != 0)
         {
             goto done;
         }
 
         // now include host-side environment variables that are allowed
-        if (parsed_config.host_environment_variables &&
-            parsed_config.host_environment_variables_count)
+        if (config->host_environment_variables.count)
         {
             myst_args_t tmp;
 
@@ -298,7 +390,7 @@ int myst_enter_ecall(
 
             for (size_t i = 0; i < tmp.size; i++)
             {
-                if (_is_allowed_env_variable(&parsed_config, tmp.data[i]))
+                if (_is_allowed_env_variable(config, tmp.data[i]))
                 {
                     if (myst_args_append1(&env, tmp.data[i]) != 0)
                     {
@@ -318,15 +410,22 @@ int myst_enter_ecall(
     }
 
     // Override current working directory if present in config
-    if (have_config && parsed_config.cwd)
+    if (have_config && config->cwd)
     {
-        cwd = parsed_config.cwd;
+        cwd = config_blob_string(config, config->cwd);
     }
 
     // Override current working directory if present in config
-    if (have_config && parsed_config.hostname)
+    if (have_config && config->hostname)
     {
-        hostname = parsed_config.hostname;
+        hostname = config_blob_string(config, config->hostname);
+    }
+
+    // Get the verity cache settings, if present in config
+    if (have_config)
+    {
+        verity_cache_blocks = config->verity_cache_pages;
+        verity_prefetch_blocks = config->verity_prefetch_blocks;
     }
 
     /* Inject the MYST_TARGET environment variable */
@@ -350,6 +449,21 @@ int myst_enter_ecall(
         trace_errors = options->trace_errors;
         trace_syscalls = options->trace_syscalls;
         export_ramfs = options->export_ramfs;
+        export_ramfs_changed = options->export_ramfs_changed;
+        export_gcov = options->export_gcov;
+        syscall_stats = options->syscall_stats;
+        max_pipe_size = options->max_pipe_size;
+        enclave_loopback = options->enclave_loopback;
+        host_sendfile = options->host_sendfile;
+        async_close = options->async_close;
+        prefetch_libs = options->prefetch_libs;
+        kernel_tls = options->kernel_tls;
+        socket_prefetch_size = options->socket_prefetch_size;
+        accept_batch = options->accept_batch;
+        busy_poll_usec = (unsigned int)options->busy_poll_usec;
+        crypto_threads = options->crypto_threads;
+        attestation_cache_ttl = options->attestation_cache_ttl;
+        console_buffering = options->console_buffering;
 
         if (strlen(options->rootfs) >= PATH_MAX)
         {
@@ -358,8 +472,20 @@ int myst_enter_ecall(
         }
 
         rootfs = options->rootfs;
+
+        if (strlen(options->verity_node_cache) >= PATH_MAX)
+        {
+            fprintf(stderr, "verity node cache path too long\n");
+            goto done;
+        }
+
+        verity_node_cache = options->verity_node_cache;
     }
 
+    /* Read the CPUID leaves once rather than on every CPUID (if this fails
+     * then the host answers each one) */
+    myst_setup_cpuid();
+
     /* Setup the vectored exception handler */
     if (oe_add_vectored_exception_handler(true, _vectored_handler) != OE_OK)
     {
@@ -580,6 +706,57 @@ int myst_enter_ecall(
         kargs.trace_errors = trace_errors;
         kargs.trace_syscalls = trace_syscalls;
         kargs.export_ramfs = export_ramfs;
+        kargs.export_ramfs_changed = export_ramfs_changed;
+        kargs.export_gcov = export_gcov;
+        kargs.syscall_stats = syscall_stats;
+        kargs.max_pipe_size = max_pipe_size;
+        kargs.enclave_loopback = enclave_loopback;
+        kargs.host_sendfile = host_sendfile;
+        kargs.async_close = async_close;
+        kargs.prefetch_libs = prefetch_libs;
+        kargs.kernel_tls = kernel_tls;
+        kargs.socket_prefetch_size = socket_prefetch_size;
+        kargs.accept_batch = accept_batch;
+        kargs.busy_poll_usec = busy_poll_usec;
+        kargs.crypto_threads = crypto_threads;
+        kargs.attestation_cache_ttl = attestation_cache_ttl;
+        kargs.console_buffering = console_buffering;
+
+        /* the kernel records the startup timeline in host memory */
+        {
+            myst_startup_trace_t* trace = shared_memory->startup_trace;
+
+            if (trace && oe_is_outside_enclave(trace, sizeof(*trace)))
+                kargs.startup_trace = trace;
+        }
+
+        /* the kernel records the rootfs files it opens in host memory */
+        {
+            myst_layout_profile_t* profile = shared_memory->layout_profile;
+
+            if (profile && oe_is_outside_enclave(profile, sizeof(*profile)))
+                kargs.layout_profile = profile;
+        }
+
+        /* the kernel records the profile samples in host memory */
+        {
+            myst_profile_t* profile = shared_memory->profile;
+
+            if (profile && oe_is_outside_enclave(profile, sizeof(*profile)))
+                kargs.profile = profile;
+        }
+
+        /* the kernel records the events in host memory */
+        {
+            myst_event_trace_t* trace = shared_memory->event_trace;
+
+            if (trace && oe_is_outside_enclave(trace, sizeof(*trace)))
+                kargs.event_trace = trace;
+        }
+
+        kargs.verity_cache_blocks = verity_cache_blocks;
+        kargs.verity_prefetch_blocks = verity_prefetch_blocks;
+        kargs.vdso = myst_get_vdso();
         kargs.tcall = myst_tcall;
         kargs.event = event;
 
@@ -592,6 +769,14 @@ int myst_enter_ecall(
         if (rootfs)
             myst_strlcpy(kargs.rootfs, rootfs, sizeof(kargs.rootfs));
 
+        if (verity_node_cache)
+        {
+            myst_strlcpy(
+                kargs.verity_node_cache,
+                verity_node_cache,
+                sizeof(kargs.verity_node_cache));
+        }
+
         /* Verify that the kernel is an ELF image */
         {
             const uint8_t ident[] = {0x7f, 'E', 'L', 'F'};
@@ -624,7 +809,6 @@ done:
     if (env.data)
         free(env.data);
 
-    free_config(&parsed_config);
     return ret;
 }
 
@@ -704,10 +888,32 @@ long myst_tcall_create_thread(uint64_t cookie)
     return (long)ret;
 }
 
+/* The enclave may only touch event words that lie in host memory */
+static volatile int* _event_word(uint64_t event)
+{
+    volatile int* uaddr = (volatile int*)event;
+
+    if (!uaddr || (event % sizeof(int)) ||
+        !oe_is_outside_enclave((void*)uaddr, sizeof(int)))
+    {
+        return NULL;
+    }
+
+    return uaddr;
+}
+
 long myst_tcall_wait(uint64_t event, const struct timespec* timeout)
 {
     long retval = -EINVAL;
     const struct myst_timespec* to = (const struct myst_timespec*)timeout;
+    volatile int* uaddr;
+
+    /* spin on the event word before paying for an OCALL */
+    if ((uaddr = _event_word(event)) &&
+        myst_event_spin(uaddr, MYST_EVENT_SPIN_COUNT))
+    {
+        return 0;
+    }
 
     if (myst_wait_ocall(&retval, event, to) != OE_OK)
         return -EINVAL;
@@ -718,6 +924,11 @@ long myst_tcall_wait(uint64_t event, const struct timespec* timeout)
 long myst_tcall_wake(uint64_t event)
 {
     long retval = -EINVAL;
+    volatile int* uaddr;
+
+    /* only a waiter sleeping on the host futex needs an OCALL */
+    if ((uaddr = _event_word(event)) && !myst_event_post(uaddr))
+        return 0;
 
     if (myst_wake_ocall(&retval, event) != OE_OK)
         return -EINVAL;
@@ -725,6 +936,45 @@ long myst_tcall_wake(uint64_t event)
     return retval;
 }
 
+long myst_tcall_wake_many(const uint64_t* events, size_t count)
+{
+    long ret = 0;
+
+    while (count)
+    {
+        uint64_t asleep[MYST_TCALL_WAKE_MANY_MAX];
+        size_t n = 0;
+        long retval = -EINVAL;
+
+        /* keep the events whose waiters sleep on the host futex */
+        for (; count && n < MYST_TCALL_WAKE_MANY_MAX; events++, count--)
+        {
+            volatile int* uaddr = _event_word(*events);
+
+            if (!uaddr || myst_event_post(uaddr))
+                asleep[n++] = *events;
+        }
+
+        if (n == 0)
+            continue;
+
+        if (n == 1)
+        {
+            if (myst_wake_ocall(&retval, asleep[0]) != OE_OK)
+                retval = -EINVAL;
+        }
+        else if (myst_wake_many_ocall(&retval, asleep, n) != OE_OK)
+        {
+            retval = -EINVAL;
+        }
+
+        if (retval != 0 && ret == 0)
+            ret = retval;
+    }
+
+    return ret;
+}
+
 long myst_tcall_wake_wait(
     uint64_t waiter_event,
     uint64_t self_event,
@@ -732,6 +982,11 @@ long myst_tcall_wake_wait(
 {
     long retval = -EINVAL;
     const struct myst_timespec* to = (const struct myst_timespec*)timeout;
+    volatile int* uaddr;
+
+    /* if the waiter is not asleep, wake it here and then wait as usual */
+    if ((uaddr = _event_word(waiter_event)) && !myst_event_post(uaddr))
+        return myst_tcall_wait(self_event, timeout);
 
     if (myst_wake_wait_ocall(&retval, waiter_event, self_event, to) != OE_OK)
         return -EINVAL;
@@ -749,6 +1004,65 @@ long myst_tcall_export_file(const char* path, const void* data, size_t size)
     return retval;
 }
 
+long myst_tcall_export_cpio(const void* data, size_t size)
+{
+    long retval = -1;
+
+    if (myst_export_cpio_ocall(&retval, data, size) != OE_OK)
+        return -EINVAL;
+
+    return retval;
+}
+
+long myst_tcall_debugger_attached(void)
+{
+    long retval = 0;
+
+    if (myst_debugger_attached_ocall(&retval) != OE_OK)
+        return -EINVAL;
+
+    return retval;
+}
+
+long myst_tcall_map_host_file(
+    int fd,
+    off_t offset,
+    size_t length,
+    void** addr_out)
+{
+    long retval;
+    uint64_t addr = 0;
+
+    if (!length || !addr_out)
+        return -EINVAL;
+
+    if (myst_map_host_file_ocall(&retval, fd, offset, length, &addr) != OE_OK)
+        return -EINVAL;
+
+    if (retval != 0)
+        return retval;
+
+    /* the enclave reads the mapping, so it must not alias enclave memory */
+    if (!addr || !oe_is_outside_enclave((void*)addr, length))
+        return -EPERM;
+
+    *addr_out = (void*)addr;
+    return 0;
+}
+
+long myst_tcall_unmap_host_file(void* addr, size_t length)
+{
+    long retval;
+
+    if (!addr || !oe_is_outside_enclave(addr, length))
+        return -EINVAL;
+
+    if (myst_unmap_host_file_ocall(&retval, (uint64_t)addr, length) != OE_OK)
+        return -EINVAL;
+
+    return retval;
+}
+
 long myst_tcall_poll_wake(void)
 {
     long r;
@@ -832,6 +1146,90 @@ int myst_load_fssig(const char* path, myst_fssig_t* fssig)
     return retval;
 }
 
+long myst_tcall_hostbuf_alloc(size_t size, void** ptr_out)
+{
+    void* ptr;
+
+    if (!size || !ptr_out)
+        return -EINVAL;
+
+    if (!(ptr = oe_host_malloc(size)))
+        return -ENOMEM;
+
+    *ptr_out = ptr;
+    return 0;
+}
+
+long myst_tcall_hostbuf_send(int sockfd, const void* buf, size_t len, int flags)
+{
+    long retval;
+
+    if (!buf || !oe_is_outside_enclave(buf, len))
+        return -EINVAL;
+
+    if (myst_send_hostbuf_ocall(&retval, sockfd, buf, len, flags) != OE_OK)
+        return -EINVAL;
+
+    if (retval > (long)len)
+        return -EINVAL;
+
+    return retval;
+}
+
+long myst_tcall_hostbuf_recv(int sockfd, void* buf, size_t len, int flags)
+{
+    long retval;
+
+    if (!buf || !oe_is_outside_enclave(buf, len))
+        return -EINVAL;
+
+    if (myst_recv_hostbuf_ocall(&retval, sockfd, buf, len, flags) != OE_OK)
+        return -EINVAL;
+
+    /* guard against the host returning more than the buffer holds */
+    if (retval > (long)len)
+        return -EINVAL;
+
+    return retval;
+}
+
+/* the kernel's array is passed to the OCALL as is */
+MYST_STATIC_ASSERT(
+    sizeof(myst_tcall_accepted_t) == sizeof(struct myst_accepted));
+MYST_STATIC_ASSERT(
+    sizeof(((myst_tcall_accepted_t*)0)->addr) ==
+    sizeof(((struct myst_accepted*)0)->addr));
+
+long myst_tcall_accept_batch(
+    int sockfd,
+    myst_tcall_accepted_t* conns,
+    size_t count,
+    int flags)
+{
+    long retval;
+    struct myst_accepted* accepted = (struct myst_accepted*)conns;
+
+    if (!conns || !count || count > MYST_ACCEPT_BATCH_MAX)
+        return -EINVAL;
+
+    if (myst_accept_batch_ocall(&retval, sockfd, accepted, count, flags) !=
+        OE_OK)
+    {
+        return -EINVAL;
+    }
+
+    if (retval > (long)count)
+        return -EINVAL;
+
+    for (long i = 0; i < retval; i++)
+    {
+        if (conns[i].fd < 0)
+            return -EINVAL;
+    }
+
+    return retval;
+}
+
 OE_SET_ENCLAVE_SGX(
     1,    /* ProductID */
     1,    /* SecurityVersion */
@@ -5,7 +5,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <syscall.h>
 #include <unistd.h>
@@ -14,6 +16,9 @@
 #include <myst/tcall.h>
 #include "myst_t.h"
 
+/* Most messages of one sendmmsg() or recvmmsg() batch (UIO_MAXIOV) */
+#define MMSG_MAX 1024
+
 #define RETURN(EXPR) return ((EXPR) == OE_OK ? ret : -EINVAL)
 
 // Force downsizing of ocall output lengths to prevent reading past the end
@@ -481,12 +486,10 @@ static long _recvmsg(int sockfd, struct msghdr* msg, int flags)
         msg->msg_controllen = msg->msg_control ? controllen : 0;
     }
 
-    /* guard against host returning a size larger than the buffer */
-    if (retval > len)
+    /* guard against host returning a size larger than the buffer, which
+     * is only legal for a datagram truncated under MSG_TRUNC */
+    if (retval > len && !(flags & MSG_TRUNC))
     {
-        // ATTN: this implementation fails if returned length is greater than
-        // buffer length, although this is legal according to the recvmsg()
-        // documentation.
         ret = -EINVAL;
         goto done;
     }
@@ -495,9 +498,10 @@ static long _recvmsg(int sockfd, struct msghdr* msg, int flags)
         long r;
         const struct iovec* iov = msg->msg_iov;
         int iovlen = msg->msg_iovlen;
+        size_t n = (retval < len) ? (size_t)retval : (size_t)len;
 
-        /* scatter the single buffer onto multiple iovec buffers */
-        if ((r = myst_iov_scatter(iov, iovlen, buf, (size_t)len)) < 0)
+        /* scatter only the received bytes onto the iovec buffers */
+        if ((r = myst_iov_scatter(iov, iovlen, buf, n)) < 0)
         {
             ret = r;
             goto done;
@@ -514,6 +518,369 @@ done:
     return ret;
 }
 
+/* The sizes of the name, data and control buffers of each message */
+static long _get_mmsg_sizes(
+    const struct mmsghdr* msgvec,
+    unsigned int vlen,
+    struct myst_mmsg* msgs,
+    size_t* names_size,
+    size_t* data_size,
+    size_t* controls_size)
+{
+    *names_size = 0;
+    *data_size = 0;
+    *controls_size = 0;
+
+    for (unsigned int i = 0; i < vlen; i++)
+    {
+        const struct msghdr* msg = &msgvec[i].msg_hdr;
+        ssize_t len;
+
+        if ((len = myst_iov_len(msg->msg_iov, (int)msg->msg_iovlen)) < 0)
+            return len;
+
+        msgs[i].namelen = msg->msg_name ? msg->msg_namelen : 0;
+        msgs[i].controllen = msg->msg_control ? msg->msg_controllen : 0;
+        msgs[i].len = (size_t)len;
+        msgs[i].flags = 0;
+        msgs[i].msg_len = 0;
+
+        *names_size += msgs[i].namelen;
+        *controls_size += msgs[i].controllen;
+
+        if ((size_t)len > SSIZE_MAX - *data_size)
+            return -EINVAL;
+
+        *data_size += (size_t)len;
+    }
+
+    return 0;
+}
+
+/* Allocate the names, data and controls buffers of a batch */
+static long _alloc_mmsg_buffers(
+    size_t names_size,
+    size_t data_size,
+    size_t controls_size,
+    char** names,
+    char** data,
+    char** controls)
+{
+    *names = NULL;
+    *data = NULL;
+    *controls = NULL;
+
+    if ((names_size && !(*names = malloc(names_size))) ||
+        (data_size && !(*data = malloc(data_size))) ||
+        (controls_size && !(*controls = malloc(controls_size))))
+    {
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/* Send the whole batch in one OCALL (see struct myst_mmsg) */
+static long _sendmmsg(
+    int sockfd,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags)
+{
+    long ret = 0;
+    long retval;
+    struct myst_mmsg* msgs = NULL;
+    char* names = NULL;
+    char* data = NULL;
+    char* controls = NULL;
+    size_t names_size;
+    size_t data_size;
+    size_t controls_size;
+
+    if (sockfd < 0 || !msgvec || vlen > MMSG_MAX)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (vlen == 0)
+        goto done;
+
+    if (!(msgs = calloc(vlen, sizeof(struct myst_mmsg))))
+    {
+        ret = -ENOMEM;
+        goto done;
+    }
+
+    if ((ret = _get_mmsg_sizes(
+             msgvec, vlen, msgs, &names_size, &data_size, &controls_size)) <
+        0)
+    {
+        goto done;
+    }
+
+    if ((ret = _alloc_mmsg_buffers(
+             names_size,
+             data_size,
+             controls_size,
+             &names,
+             &data,
+             &controls)) < 0)
+    {
+        goto done;
+    }
+
+    /* pack the messages back to back */
+    {
+        char* name = names;
+        char* p = data;
+        char* control = controls;
+
+        for (unsigned int i = 0; i < vlen; i++)
+        {
+            const struct msghdr* msg = &msgvec[i].msg_hdr;
+
+            if (msgs[i].namelen)
+                memcpy(name, msg->msg_name, msgs[i].namelen);
+
+            if (msgs[i].controllen)
+                memcpy(control, msg->msg_control, msgs[i].controllen);
+
+            for (size_t j = 0; j < (size_t)msg->msg_iovlen; j++)
+            {
+                const struct iovec* iov = &msg->msg_iov[j];
+
+                if (iov->iov_len)
+                {
+                    memcpy(p, iov->iov_base, iov->iov_len);
+                    p += iov->iov_len;
+                }
+            }
+
+            name += msgs[i].namelen;
+            control += msgs[i].controllen;
+        }
+    }
+
+    if (myst_sendmmsg_ocall(
+            &retval,
+            sockfd,
+            msgs,
+            vlen,
+            names,
+            names_size,
+            data,
+            data_size,
+            controls,
+            controls_size,
+            flags) != OE_OK)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (retval < 0)
+    {
+        ret = retval;
+        goto done;
+    }
+
+    /* guard against the host reporting more than was asked for */
+    if (retval > vlen)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    for (long i = 0; i < retval; i++)
+    {
+        if (msgs[i].msg_len > msgs[i].len)
+        {
+            ret = -EINVAL;
+            goto done;
+        }
+
+        msgvec[i].msg_len = msgs[i].msg_len;
+    }
+
+    ret = retval;
+
+done:
+
+    free(msgs);
+    free(names);
+    free(data);
+    free(controls);
+
+    return ret;
+}
+
+/* Receive the whole batch in one OCALL (see struct myst_mmsg) */
+static long _recvmmsg(
+    int sockfd,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    struct timespec* timeout)
+{
+    long ret = 0;
+    long retval;
+    struct myst_mmsg* msgs = NULL;
+    char* names = NULL;
+    char* data = NULL;
+    char* controls = NULL;
+    size_t names_size;
+    size_t data_size;
+    size_t controls_size;
+
+    if (sockfd < 0 || !msgvec || vlen > MMSG_MAX)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (vlen == 0)
+        goto done;
+
+    if (!(msgs = calloc(vlen, sizeof(struct myst_mmsg))))
+    {
+        ret = -ENOMEM;
+        goto done;
+    }
+
+    if ((ret = _get_mmsg_sizes(
+             msgvec, vlen, msgs, &names_size, &data_size, &controls_size)) <
+        0)
+    {
+        goto done;
+    }
+
+    if ((ret = _alloc_mmsg_buffers(
+             names_size,
+             data_size,
+             controls_size,
+             &names,
+             &data,
+             &controls)) < 0)
+    {
+        goto done;
+    }
+
+    if (myst_recvmmsg_ocall(
+            &retval,
+            sockfd,
+            msgs,
+            vlen,
+            names,
+            names_size,
+            data,
+            data_size,
+            controls,
+            controls_size,
+            flags,
+            timeout) != OE_OK)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (retval < 0)
+    {
+        ret = retval;
+        goto done;
+    }
+
+    /* guard against the host reporting more than was asked for */
+    if (retval > vlen)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    /* unpack each message from its slots (sized as the caller's buffers) */
+    {
+        const char* name = names;
+        const char* p = data;
+        const char* control = controls;
+
+        for (long i = 0; i < retval; i++)
+        {
+            struct msghdr* msg = &msgvec[i].msg_hdr;
+            const socklen_t namecap = msg->msg_name ? msg->msg_namelen : 0;
+            const socklen_t controlcap =
+                msg->msg_control ? msg->msg_controllen : 0;
+            socklen_t namelen = msgs[i].namelen;
+            socklen_t controllen = msgs[i].controllen;
+            size_t n;
+            long r;
+
+            msg->msg_flags = msgs[i].flags;
+
+            /* note: namelen may legitimately be bigger due to truncation */
+            if (namelen > sizeof(struct sockaddr_storage))
+            {
+                ret = -EINVAL;
+                goto done;
+            }
+
+#ifdef DOWNSIZE_OCALL_OUTPUT_LENGTHS
+            if (namelen > namecap)
+                namelen = namecap;
+
+            if (controllen > controlcap)
+            {
+                controllen = controlcap;
+                msg->msg_flags |= MSG_CTRUNC;
+            }
+#endif
+
+            if ((n = (namelen < namecap) ? namelen : namecap))
+                memcpy(msg->msg_name, name, n);
+
+            if ((n = (controllen < controlcap) ? controllen : controlcap))
+                memcpy(msg->msg_control, control, n);
+
+            msg->msg_namelen = msg->msg_name ? namelen : 0;
+            msg->msg_controllen = msg->msg_control ? controllen : 0;
+
+            /* only a datagram truncated under MSG_TRUNC may exceed the
+             * buffer */
+            if (msgs[i].msg_len > msgs[i].len && !(flags & MSG_TRUNC))
+            {
+                ret = -EINVAL;
+                goto done;
+            }
+
+            n = (msgs[i].msg_len < msgs[i].len) ? msgs[i].msg_len
+                                                 : msgs[i].len;
+
+            if ((r = myst_iov_scatter(
+                     msg->msg_iov, (int)msg->msg_iovlen, p, n)) < 0)
+            {
+                ret = r;
+                goto done;
+            }
+
+            msgvec[i].msg_len = msgs[i].msg_len;
+
+            name += namecap;
+            control += controlcap;
+            p += msgs[i].len;
+        }
+    }
+
+    ret = retval;
+
+done:
+
+    free(msgs);
+    free(names);
+    free(data);
+    free(controls);
+
+    return ret;
+}
+
 static long _shutdown(int sockfd, int how)
 {
     long ret;
@@ -758,6 +1125,60 @@ done:
     return ret;
 }
 
+/* Only the calling thread (pid zero) is supported */
+static long _sched_getaffinity(pid_t pid, size_t cpusetsize, void* mask)
+{
+    long ret = 0;
+    long retval;
+
+    if (pid != 0 || !mask)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (myst_sched_getaffinity_ocall(&retval, mask, cpusetsize) != OE_OK)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    /* the host returns the number of bytes it wrote */
+    if (retval > (long)cpusetsize)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    ret = retval;
+
+done:
+    return ret;
+}
+
+static long _sched_setaffinity(pid_t pid, size_t cpusetsize, const void* mask)
+{
+    long ret = 0;
+    long retval;
+
+    if (pid != 0 || !mask)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (myst_sched_setaffinity_ocall(&retval, mask, cpusetsize) != OE_OK)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    ret = retval;
+
+done:
+    return ret;
+}
+
 static long _fchmod(int fd, mode_t mode)
 {
     long ret = 0;
@@ -850,6 +1271,52 @@ done:
     return ret;
 }
 
+static long _epoll_create1(int flags)
+{
+    long ret;
+    RETURN(myst_epoll_create1_ocall(&ret, flags));
+}
+
+static long _epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    long ret;
+    uint32_t events = event ? event->events : 0;
+    uint64_t data = event ? event->data.u64 : 0;
+
+    RETURN(myst_epoll_ctl_ocall(&ret, epfd, op, fd, events, data));
+}
+
+static long _epoll_wait(
+    int epfd,
+    struct epoll_event* events,
+    int maxevents,
+    int timeout)
+{
+    long retval;
+    size_t size;
+
+    if (!events || maxevents <= 0)
+        return -EINVAL;
+
+    if (__builtin_mul_overflow(
+            (size_t)maxevents, sizeof(struct epoll_event), &size))
+    {
+        return -EINVAL;
+    }
+
+    if (myst_epoll_wait_ocall(
+            &retval, epfd, events, size, maxevents, timeout) != OE_OK)
+    {
+        return -EINVAL;
+    }
+
+    /* guard against return value that is bigger than maxevents */
+    if (retval > maxevents)
+        return -EINVAL;
+
+    return retval;
+}
+
 #ifdef MYST_ENABLE_HOSTFS
 static long _open(const char* pathname, int flags, mode_t mode)
 {
@@ -1021,6 +1488,46 @@ done:
 }
 #endif
 
+#ifdef MYST_ENABLE_HOSTFS
+static long _sendfile(int out_fd, int in_fd, off_t* offset, size_t count)
+{
+    long ret = 0;
+    long retval;
+    const off_t start = offset ? *offset : 0;
+
+    if (out_fd < 0 || in_fd < 0 || count > SSIZE_MAX)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (myst_sendfile_ocall(&retval, out_fd, in_fd, offset, count) != OE_OK)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (retval < 0)
+    {
+        ret = retval;
+        goto done;
+    }
+
+    /* guard against host returning more than was asked for (or moving the
+     * offset by something else) */
+    if (retval > (ssize_t)count || (offset && *offset != start + retval))
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    ret = retval;
+
+done:
+    return ret;
+}
+#endif
+
 #ifdef MYST_ENABLE_HOSTFS
 static long _link(const char* oldpath, const char* newpath)
 {
@@ -1458,6 +1965,20 @@ long myst_handle_tcall(long n, long params[6])
         {
             return _recvmsg((int)a, (struct msghdr*)b, (int)c);
         }
+        case SYS_sendmmsg:
+        {
+            return _sendmmsg(
+                (int)a, (struct mmsghdr*)b, (unsigned int)c, (int)d);
+        }
+        case SYS_recvmmsg:
+        {
+            return _recvmmsg(
+                (int)a,
+                (struct mmsghdr*)b,
+                (unsigned int)c,
+                (int)d,
+                (struct timespec*)e);
+        }
         case SYS_shutdown:
         {
             return _shutdown((int)a, (int)b);
@@ -1499,6 +2020,14 @@ long myst_handle_tcall(long n, long params[6])
         {
             return _sched_yield();
         }
+        case SYS_sched_getaffinity:
+        {
+            return _sched_getaffinity((pid_t)a, (size_t)b, (void*)c);
+        }
+        case SYS_sched_setaffinity:
+        {
+            return _sched_setaffinity((pid_t)a, (size_t)b, (const void*)c);
+        }
         case SYS_fchmod:
         {
             return _fchmod((int)a, (mode_t)b);
@@ -1507,6 +2036,18 @@ long myst_handle_tcall(long n, long params[6])
         {
             return _poll((struct pollfd*)a, (nfds_t)b, (int)c);
         }
+        case SYS_epoll_create1:
+        {
+            return _epoll_create1((int)a);
+        }
+        case SYS_epoll_ctl:
+        {
+            return _epoll_ctl((int)a, (int)b, (int)c, (struct epoll_event*)d);
+        }
+        case SYS_epoll_wait:
+        {
+            return _epoll_wait((int)a, (struct epoll_event*)b, (int)c, (int)d);
+        }
 #ifdef MYST_ENABLE_HOSTFS
         case SYS_open:
         {
@@ -1536,6 +2077,10 @@ long myst_handle_tcall(long n, long params[6])
         {
             return _pwrite64((int)a, (const void*)b, (size_t)c, (off_t)d);
         }
+        case SYS_sendfile:
+        {
+            return _sendfile((int)a, (int)b, (off_t*)c, (size_t)d);
+        }
         case SYS_link:
         {
             return _link((const char*)a, (const char*)b);
@@ -0,0 +1,83 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <myst/file.h>
+
+#include "utils.h"
+
+int clone_file(const char* oldpath, const char* newpath)
+{
+    int ret = -1;
+    int oldfd = -1;
+    int newfd = -1;
+    struct stat st;
+    off_t rem;
+
+    if (!oldpath || !newpath)
+        goto done;
+
+    if ((oldfd = open(oldpath, O_RDONLY | O_CLOEXEC)) < 0)
+        goto done;
+
+    if (fstat(oldfd, &st) != 0)
+        goto done;
+
+    newfd = open(
+        newpath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+
+    if (newfd < 0)
+        goto done;
+
+#ifdef FICLONE
+    /* share the blocks of the file (btrfs, XFS, ...) */
+    if (ioctl(newfd, FICLONE, oldfd) == 0)
+    {
+        ret = 0;
+        goto done;
+    }
+#endif
+
+    /* let the kernel copy the data (or the server for NFS and SMB) */
+    for (rem = st.st_size; rem > 0;)
+    {
+        ssize_t n = copy_file_range(oldfd, NULL, newfd, NULL, (size_t)rem, 0);
+
+        if (n <= 0)
+            break;
+
+        rem -= n;
+    }
+
+    if (rem == 0)
+    {
+        ret = 0;
+        goto done;
+    }
+
+    /* copy_file_range() is not supported here, so start over */
+    if (ftruncate(newfd, 0) != 0 || lseek(newfd, 0, SEEK_SET) != 0)
+        goto done;
+
+    if (myst_copy_file_fd((char*)oldpath, newfd) != 0)
+        goto done;
+
+    ret = 0;
+
+done:
+
+    if (oldfd >= 0)
+        close(oldfd);
+
+    if (newfd >= 0 && close(newfd) != 0)
+        ret = -1;
+
+    return ret;
+}
@@ -0,0 +1,617 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/eraise.h>
+#include <myst/eventtrace.h>
+#include <myst/file.h>
+#include <myst/replay.h>
+#include "utils.h"
+
+#define RINGS MYST_EVENT_TRACE_RINGS
+#define RING_SIZE MYST_EVENT_TRACE_RING_SIZE
+#define HEADER_SIZE offsetof(myst_event_trace_t, rings)
+
+static myst_event_trace_t* _trace;
+
+myst_event_trace_t* myst_event_trace_start(uint32_t categories)
+{
+    if (!_trace && (_trace = calloc(1, sizeof(myst_event_trace_t))))
+        _trace->categories = categories;
+
+    return _trace;
+}
+
+myst_event_trace_t* myst_event_trace_get(void)
+{
+    return _trace;
+}
+
+int myst_event_trace_write(const char* path)
+{
+    int ret = 0;
+    FILE* os = NULL;
+    uint32_t nrings = 0;
+
+    if (!_trace || !path)
+        ERAISE(-EINVAL);
+
+    if (_trace->magic != MYST_EVENT_TRACE_MAGIC)
+    {
+        /* the kernel did not record: write a trace without events */
+        fprintf(stderr, "myst: %s: event tracing needs debug mode\n", path);
+        _trace->magic = MYST_EVENT_TRACE_MAGIC;
+        _trace->version = MYST_EVENT_TRACE_VERSION;
+        _trace->ring_size = RING_SIZE;
+    }
+    else
+    {
+        for (size_t i = 0; i < RINGS; i++)
+        {
+            if (_trace->rings[i].state != MYST_EVENT_RING_FREE)
+                nrings++;
+        }
+    }
+
+    /* the kernel has exited, so the trace no longer changes */
+    _trace->nrings = nrings;
+
+    if (!(os = fopen(path, "w")))
+        ERAISE(-errno);
+
+    if (fwrite(_trace, 1, HEADER_SIZE, os) != HEADER_SIZE)
+        ERAISE(-EIO);
+
+    for (size_t i = 0; i < RINGS && nrings; i++)
+    {
+        const myst_event_ring_t* ring = &_trace->rings[i];
+
+        if (ring->state == MYST_EVENT_RING_FREE)
+            continue;
+
+        if (fwrite(ring, 1, sizeof(*ring), os) != sizeof(*ring))
+            ERAISE(-EIO);
+    }
+
+    if (fclose(os) != 0)
+    {
+        os = NULL;
+        ERAISE(-errno);
+    }
+
+    os = NULL;
+
+    if (_trace->dropped)
+    {
+        fprintf(
+            stderr,
+            "myst: %s: %lu events found no ring\n",
+            path,
+            _trace->dropped);
+    }
+
+done:
+
+    if (os)
+        fclose(os);
+
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** decode-trace
+**
+**==============================================================================
+*/
+
+typedef struct entry
+{
+    const myst_event_t* event;
+    uint64_t seq; /* keeps the order of the events of a ring */
+} entry_t;
+
+typedef struct process
+{
+    uint32_t tid;
+    uint32_t pid;
+} process_t;
+
+static int _compare_entries(const void* a, const void* b)
+{
+    const entry_t* x = a;
+    const entry_t* y = b;
+
+    if (x->event->time != y->event->time)
+        return x->event->time < y->event->time ? -1 : 1;
+
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+static int _compare_processes(const void* a, const void* b)
+{
+    const process_t* x = a;
+    const process_t* y = b;
+
+    return x->tid < y->tid ? -1 : (x->tid > y->tid);
+}
+
+/* The name of a syscall or tcall number */
+static const char* _call_name(
+    const myst_event_trace_t* trace,
+    uint64_t n,
+    char buf[32])
+{
+    const char* name;
+
+    if (n < MYST_EVENT_TRACE_MAX_SYSCALLS && trace->syscalls[n][0])
+        return trace->syscalls[n];
+
+    if ((name = myst_event_tcall_name((long)n)))
+        return name;
+
+    snprintf(buf, 32, "syscall_%lu", n);
+    return buf;
+}
+
+/* The arguments of an event as text (without quotes, for the JSON too) */
+static void _format_args(
+    const myst_event_trace_t* trace,
+    const myst_event_t* e,
+    char* buf,
+    size_t size)
+{
+    const long a1 = (long)e->arg1;
+    char tmp[32];
+
+    switch (e->type)
+    {
+        case MYST_EVENT_SYSCALL_ENTER:
+        case MYST_EVENT_TCALL_ENTER:
+            snprintf(buf, size, "%s", _call_name(trace, e->arg0, tmp));
+            break;
+        case MYST_EVENT_SYSCALL_EXIT:
+        case MYST_EVENT_TCALL_EXIT:
+            snprintf(
+                buf, size, "%s = %ld", _call_name(trace, e->arg0, tmp), a1);
+            break;
+        case MYST_EVENT_FUTEX_WAIT:
+            snprintf(buf, size, "addr=0x%lx val=%ld", e->arg0, a1);
+            break;
+        case MYST_EVENT_FUTEX_WOKE:
+            snprintf(buf, size, "addr=0x%lx ret=%ld", e->arg0, a1);
+            break;
+        case MYST_EVENT_FUTEX_WAKE:
+            snprintf(buf, size, "addr=0x%lx woken=%ld", e->arg0, a1);
+            break;
+        case MYST_EVENT_SCHED_START:
+            snprintf(buf, size, "pid=%lu kernel=%ld", e->arg0, a1);
+            break;
+        case MYST_EVENT_SCHED_EXIT:
+            snprintf(buf, size, "status=%ld", (long)e->arg0);
+            break;
+        case MYST_EVENT_SCHED_BLOCK:
+            snprintf(buf, size, "cond=0x%lx", e->arg0);
+            break;
+        case MYST_EVENT_SCHED_UNBLOCK:
+            snprintf(buf, size, "cond=0x%lx ret=%ld", e->arg0, a1);
+            break;
+        case MYST_EVENT_SCHED_WAKEUP:
+            snprintf(buf, size, "tid=%lu", e->arg0);
+            break;
+        case MYST_EVENT_FS_OPEN:
+            snprintf(buf, size, "fd=%ld flags=0x%lx", (long)e->arg0, e->arg1);
+            break;
+        case MYST_EVENT_FS_CLOSE:
+            snprintf(buf, size, "fd=%ld ret=%ld", (long)e->arg0, a1);
+            break;
+        case MYST_EVENT_FS_READ:
+        case MYST_EVENT_FS_WRITE:
+            snprintf(buf, size, "fd=%ld bytes=%ld", (long)e->arg0, a1);
+            break;
+        default:
+            *buf = '\0';
+            break;
+    }
+}
+
+static uint32_t _find_pid(const process_t* procs, size_t nprocs, uint32_t tid)
+{
+    const process_t key = {.tid = tid};
+    const process_t* p;
+
+    p = bsearch(&key, procs, nprocs, sizeof(process_t), _compare_processes);
+    return p ? p->pid : 0;
+}
+
+static void _write_text(
+    FILE* os,
+    const myst_event_trace_t* trace,
+    const entry_t* entries,
+    size_t n)
+{
+    const uint64_t base = n ? entries[0].event->time : 0;
+    char args[128];
+
+    fprintf(
+        os,
+        "# %zu events from %u rings (%lu found no ring)\n",
+        n,
+        trace->nrings,
+        trace->dropped);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const myst_event_t* e = entries[i].event;
+        const char* type = myst_event_type_name(e->type);
+
+        _format_args(trace, e, args, sizeof(args));
+        fprintf(
+            os,
+            "%14.6f %6u %-14s %s\n",
+            (double)(e->time - base) / 1e9,
+            e->tid,
+            type ? type : "unknown",
+            args);
+    }
+}
+
+static void _write_perfetto(
+    FILE* os,
+    const myst_event_trace_t* trace,
+    const entry_t* entries,
+    size_t n,
+    const process_t* procs,
+    size_t nprocs)
+{
+    const uint64_t base = n ? entries[0].event->time : 0;
+    char args[128];
+    char tmp[32];
+
+    fprintf(os, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const myst_event_t* e = entries[i].event;
+        const char* category = myst_event_category_name(e->category);
+        const char* name = myst_event_type_name(e->type);
+        const char* ph = "i";
+
+        /* the calls and the waits are slices, the rest are instants */
+        switch (e->type)
+        {
+            case MYST_EVENT_SYSCALL_ENTER:
+            case MYST_EVENT_TCALL_ENTER:
+                name = _call_name(trace, e->arg0, tmp);
+                ph = "B";
+                break;
+            case MYST_EVENT_SYSCALL_EXIT:
+            case MYST_EVENT_TCALL_EXIT:
+                name = _call_name(trace, e->arg0, tmp);
+                ph = "E";
+                break;
+            case MYST_EVENT_FUTEX_WAIT:
+                ph = "B";
+                break;
+            case MYST_EVENT_FUTEX_WOKE:
+                name = "futex_wait";
+                ph = "E";
+                break;
+            case MYST_EVENT_SCHED_BLOCK:
+                name = "blocked";
+                ph = "B";
+                break;
+            case MYST_EVENT_SCHED_UNBLOCK:
+                name = "blocked";
+                ph = "E";
+                break;
+        }
+
+        _format_args(trace, e, args, sizeof(args));
+        fprintf(
+            os,
+            "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",%s"
+            "\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"args\":{\"detail\":\"%s\"}}",
+            i ? ",\n" : "",
+            name ? name : "unknown",
+            category ? category : "unknown",
+            ph,
+            *ph == 'i' ? "\"s\":\"t\"," : "",
+            _find_pid(procs, nprocs, e->tid),
+            e->tid,
+            (double)(e->time - base) / 1000.0,
+            args);
+    }
+
+    fprintf(os, "\n]}\n");
+}
+
+/* The calls a syscall can be inside of (a signal handler's, for example) */
+#define REPLAY_DEPTH 8
+
+typedef struct replay_frame
+{
+    myst_replay_call_t call;
+    uint32_t have; /* a bit for each of the three argument events */
+} replay_frame_t;
+
+static int _compare_calls(const void* a, const void* b)
+{
+    const myst_replay_call_t* x = a;
+    const myst_replay_call_t* y = b;
+
+    return x->start < y->start ? -1 : (x->start > y->start);
+}
+
+/* Pair the entries, the arguments and the exits of the syscalls of a ring,
+ * appending the complete calls */
+static size_t _find_calls(const myst_event_ring_t* ring, myst_replay_call_t* p)
+{
+    const uint64_t count = ring->head < RING_SIZE ? ring->head : RING_SIZE;
+    replay_frame_t stack[REPLAY_DEPTH];
+    size_t depth = 0;
+    size_t n = 0;
+
+    for (uint64_t j = ring->head - count; j < ring->head; j++)
+    {
+        const myst_event_t* e = &ring->events[j % RING_SIZE];
+        replay_frame_t* top = depth ? &stack[depth - 1] : NULL;
+
+        /* a ring passes to another thread when its owner exits */
+        if (top && top->call.tid != e->tid)
+        {
+            depth = 0;
+            top = NULL;
+        }
+
+        switch (e->type)
+        {
+            case MYST_EVENT_SYSCALL_ENTER:
+            {
+                if (depth == REPLAY_DEPTH)
+                    break;
+
+                top = &stack[depth++];
+                memset(top, 0, sizeof(*top));
+                top->call.start = e->time;
+                top->call.tid = e->tid;
+                top->call.n = (uint32_t)e->arg0;
+                break;
+            }
+            case MYST_EVENT_SYSCALL_ARGS01:
+            case MYST_EVENT_SYSCALL_ARGS23:
+            case MYST_EVENT_SYSCALL_ARGS45:
+            {
+                const size_t i = e->type - MYST_EVENT_SYSCALL_ARGS01;
+
+                if (top)
+                {
+                    top->call.args[2 * i] = e->arg0;
+                    top->call.args[2 * i + 1] = e->arg1;
+                    top->have |= 1U << i;
+                }
+                break;
+            }
+            case MYST_EVENT_SYSCALL_EXIT:
+            {
+                /* an exit without its entry (overwritten) is dropped */
+                if (!top || top->call.n != e->arg0)
+                    break;
+
+                top->call.nsec = e->time - top->call.start;
+                top->call.ret = (int64_t)e->arg1;
+
+                if (top->have == 0x7)
+                    p[n++] = top->call;
+
+                depth--;
+                break;
+            }
+        }
+    }
+
+    return n;
+}
+
+/* Write the syscalls of the trace as a replay trace (see myst/replay.h) */
+static int _write_replay(
+    const char* path,
+    const myst_event_trace_t* trace,
+    const process_t* procs,
+    size_t nprocs)
+{
+    int ret = 0;
+    myst_replay_call_t* calls;
+    myst_replay_header_t header;
+    size_t n = 0;
+    FILE* os = NULL;
+
+    if (!(calls = calloc(trace->nrings * RING_SIZE + 1, sizeof(*calls))))
+        ERAISE(-ENOMEM);
+
+    for (size_t i = 0; i < trace->nrings; i++)
+        n += _find_calls(&trace->rings[i], calls + n);
+
+    qsort(calls, n, sizeof(*calls), _compare_calls);
+
+    for (size_t i = n; i > 0; i--)
+    {
+        calls[i - 1].start -= calls[0].start;
+        calls[i - 1].pid = _find_pid(procs, nprocs, calls[i - 1].tid);
+    }
+
+    header.magic = MYST_REPLAY_MAGIC;
+    header.version = MYST_REPLAY_VERSION;
+    header.ncalls = (uint32_t)n;
+
+    if (!(os = fopen(path, "w")))
+        ERAISE(-errno);
+
+    if (fwrite(&header, sizeof(header), 1, os) != 1 ||
+        (n && fwrite(calls, sizeof(*calls), n, os) != n))
+    {
+        ERAISE(-EIO);
+    }
+
+    if (fclose(os) != 0)
+    {
+        os = NULL;
+        ERAISE(-errno);
+    }
+
+    os = NULL;
+
+    if (n == 0)
+        fprintf(stderr, "myst: %s: no syscalls with arguments\n", path);
+
+done:
+
+    if (os)
+        fclose(os);
+
+    free(calls);
+    return ret;
+}
+
+static int _load_trace(const char* path, myst_event_trace_t** trace_out)
+{
+    int ret = 0;
+    void* data = NULL;
+    size_t size;
+    myst_event_trace_t* trace;
+
+    if (myst_load_file(path, &data, &size) != 0)
+        ERAISE(-ENOENT);
+
+    trace = data;
+
+    if (size < HEADER_SIZE || trace->magic != MYST_EVENT_TRACE_MAGIC ||
+        trace->version != MYST_EVENT_TRACE_VERSION ||
+        trace->ring_size != RING_SIZE || trace->nrings > RINGS ||
+        size != HEADER_SIZE + trace->nrings * sizeof(myst_event_ring_t))
+    {
+        ERAISE(-EINVAL);
+    }
+
+    /* keep the syscall names printable */
+    for (size_t n = 0; n < MYST_EVENT_TRACE_MAX_SYSCALLS; n++)
+    {
+        char* p = trace->syscalls[n];
+
+        p[sizeof(trace->syscalls[n]) - 1] = '\0';
+
+        for (; *p; p++)
+        {
+            if (*p == '"' || *p == '\\' || (unsigned char)*p < ' ')
+                *p = '_';
+        }
+    }
+
+    *trace_out = trace;
+    data = NULL;
+
+done:
+
+    free(data);
+    return ret;
+}
+
+int decode_trace_action(int argc, const char* argv[])
+{
+    myst_event_trace_t* trace = NULL;
+    const char* perfetto = NULL;
+    const char* replay = NULL;
+    entry_t* entries;
+    process_t* procs;
+    size_t n = 0;
+    size_t nprocs = 0;
+
+    /* get the --perfetto and --replay options */
+    cli_getopt(&argc, argv, "--perfetto", &perfetto);
+    cli_getopt(&argc, argv, "--replay", &replay);
+
+    if (argc != 3)
+    {
+        fprintf(
+            stderr,
+            "Usage: %s %s <trace> [--perfetto <json>] [--replay <file>]\n"
+            "\n"
+            "Print the events of a trace written by --event-trace, or\n"
+            "write them as a JSON trace for Perfetto (or chrome://tracing),\n"
+            "or write its syscalls for tests/replay (which needs the\n"
+            "syscall,args categories)\n",
+            argv[0],
+            argv[1]);
+        exit(1);
+    }
+
+    if (_load_trace(argv[2], &trace) != 0)
+        _err("not an event trace: %s", argv[2]);
+
+
+    entries = calloc(trace->nrings * RING_SIZE + 1, sizeof(entry_t));
+    procs = calloc(trace->nrings * RING_SIZE + 1, sizeof(process_t));
+
+    if (!entries || !procs)
+        _err("out of memory");
+
+    /* each ring holds its last events, the oldest at head % size */
+    for (size_t i = 0; i < trace->nrings; i++)
+    {
+        const myst_event_ring_t* ring = &trace->rings[i];
+        const uint64_t count = ring->head < RING_SIZE ? ring->head : RING_SIZE;
+
+        for (uint64_t j = ring->head - count; j < ring->head; j++)
+        {
+            const myst_event_t* e = &ring->events[j % RING_SIZE];
+
+            if (e->type == MYST_EVENT_SCHED_START)
+            {
+                procs[nprocs].tid = e->tid;
+                procs[nprocs].pid = (uint32_t)e->arg0;
+                nprocs++;
+            }
+
+            entries[n].event = e;
+            entries[n].seq = n;
+            n++;
+        }
+    }
+
+    qsort(entries, n, sizeof(entry_t), _compare_entries);
+    qsort(procs, nprocs, sizeof(process_t), _compare_processes);
+
+    if (replay)
+    {
+        if (_write_replay(replay, trace, procs, nprocs) != 0)
+            _err("failed to write %s", replay);
+    }
+    else if (perfetto)
+    {
+        FILE* os;
+
+        if (!(os = fopen(perfetto, "w")))
+            _err("failed to open %s", perfetto);
+
+        _write_perfetto(os, trace, entries, n, procs, nprocs);
+
+        if (fclose(os) != 0)
+            _err("failed to write %s", perfetto);
+    }
+    else
+    {
+        _write_text(stdout, trace, entries, n);
+    }
+
+    free(procs);
+    free(entries);
+    free(trace);
+
+    return 0;
+}
@@ -3,6 +3,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <limits.h>
 #include <linux/futex.h>
@@ -12,6 +13,7 @@
 #include <poll.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/user.h>
@@ -21,21 +23,28 @@
 #include <myst/buf.h>
 #include <myst/cpio.h>
 #include <myst/eraise.h>
+#include <myst/eventtrace.h>
 #include <myst/file.h>
 #include <myst/fssig.h>
 #include <myst/getopt.h>
+#include <myst/layoutprofile.h>
 #include <myst/options.h>
+#include <myst/profile.h>
 #include <myst/round.h>
 #include <myst/shm.h>
+#include <myst/startuptrace.h>
 #include <openenclave/bits/properties.h>
 #include <openenclave/bits/sgx/sgxproperties.h>
 #include <openenclave/host.h>
 
+#include "../config.h"
 #include "../shared.h"
 #include "archive.h"
 #include "exec.h"
 #include "myst_u.h"
+#include "numa.h"
 #include "regions.h"
+#include "threadpool.h"
 #include "utils.h"
 
 // This is a default enclave configuration that we use when overriding the
@@ -63,14 +72,9 @@ static size_t _count_args(const char* args[])
 
 static oe_enclave_t* _enclave;
 
-/* the address of this is eventually passed to futex (uaddr argument) */
-static __thread int _thread_event;
-
-static void* _thread_func(void* arg)
+static void _run_thread(uint64_t cookie, uint64_t event)
 {
     long r = -1;
-    uint64_t cookie = (uint64_t)arg;
-    uint64_t event = (uint64_t)&_thread_event;
 
     if (myst_run_thread_ecall(_enclave, &r, cookie, event) != OE_OK || r != 0)
     {
@@ -78,28 +82,11 @@ static void* _thread_func(void* arg)
         fflush(stdout);
         abort();
     }
-
-    return NULL;
 }
 
 long myst_create_thread_ocall(uint64_t cookie)
 {
-    long ret = 0;
-    pthread_t t;
-    pthread_attr_t attr;
-
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-
-    if (pthread_create(&t, &attr, _thread_func, (void*)cookie) != 0)
-    {
-        ret = -EINVAL;
-        goto done;
-    }
-
-done:
-    pthread_attr_destroy(&attr);
-    return ret;
+    return threadpool_create_thread(_run_thread, cookie);
 }
 
 long myst_wait_ocall(uint64_t event, const struct myst_timespec* timeout)
@@ -113,6 +100,14 @@ long myst_wake_ocall(uint64_t event)
     return myst_tcall_wake(event);
 }
 
+long myst_wake_many_ocall(const uint64_t* events, size_t count)
+{
+    if (count > MYST_TCALL_WAKE_MANY_MAX)
+        return -EINVAL;
+
+    return myst_tcall_wake_many(events, count);
+}
+
 long myst_wake_wait_ocall(
     uint64_t waiter_event,
     uint64_t self_event,
@@ -127,6 +122,52 @@ long myst_export_file_ocall(const char* path, const void* data, size_t size)
     return myst_tcall_export_file(path, data, size);
 }
 
+long myst_export_cpio_ocall(const void* data, size_t size)
+{
+    return myst_tcall_export_cpio(data, size);
+}
+
+long myst_debugger_attached_ocall(void)
+{
+    return myst_tcall_debugger_attached();
+}
+
+long myst_map_host_file_ocall(
+    int fd,
+    off_t offset,
+    size_t length,
+    uint64_t* addr)
+{
+    return myst_tcall_map_host_file(fd, offset, length, (void**)addr);
+}
+
+long myst_unmap_host_file_ocall(uint64_t addr, size_t length)
+{
+    return myst_tcall_unmap_host_file((void*)addr, length);
+}
+
+/* Get the number of switchless host workers from the enclave config */
+static uint64_t _get_num_host_worker_threads(void)
+{
+    const region_details* details = get_region_details();
+    config_parsed_data_t parsed_data = {0};
+    uint64_t n = 0;
+
+    if (!details || !details->config.buffer)
+        return 0;
+
+    if (parse_config_from_buffer(
+            details->config.buffer,
+            details->config.buffer_size,
+            &parsed_data) == 0)
+    {
+        n = parsed_data.oe_num_host_worker_threads;
+        free_config(&parsed_data);
+    }
+
+    return n;
+}
+
 int exec_launch_enclave(
     const char* enc_path,
     oe_enclave_type_t type,
@@ -140,12 +181,32 @@ int exec_launch_enclave(
     static int _event; /* the main-thread event (used by futex: uaddr) */
     myst_buf_t argv_buf = MYST_BUF_INITIALIZER;
     myst_buf_t envp_buf = MYST_BUF_INITIALIZER;
+    oe_enclave_setting_context_switchless_t switchless = {0};
+    oe_enclave_setting_t setting;
+    size_t num_settings = 0;
+
+    /* Route the switchless ocalls through host workers if configured */
+    switchless.max_host_workers = (uint32_t)_get_num_host_worker_threads();
+
+    if (switchless.max_host_workers)
+    {
+        setting.setting_type = OE_ENCLAVE_SETTING_CONTEXT_SWITCHLESS;
+        setting.u.context_switchless_setting = &switchless;
+        num_settings = 1;
+    }
 
     /* Load the enclave: calls oe_region_add_regions() */
-    r = oe_create_myst_enclave(enc_path, type, flags, NULL, 0, &_enclave);
+    {
+        const uint64_t start = myst_startup_trace_now();
 
-    if (r != OE_OK)
-        _err("failed to load enclave: result=%s", oe_result_str(r));
+        r = oe_create_myst_enclave(
+            enc_path, type, flags, &setting, num_settings, &_enclave);
+
+        if (r != OE_OK)
+            _err("failed to load enclave: result=%s", oe_result_str(r));
+
+        myst_startup_trace_event("create_enclave", start);
+    }
 
     /* Serialize the argv[] strings */
     if (myst_buf_pack_strings(&argv_buf, argv, _count_args(argv)) != 0)
@@ -158,6 +219,19 @@ int exec_launch_enclave(
     /* Get clock times right before entering the enclave */
     shm_create_clock(&shared_memory, CLOCK_TICK);
 
+    /* The kernel records the enclave side of the startup timeline */
+    if ((shared_memory.startup_trace = myst_startup_trace_get()))
+        shared_memory.startup_trace->enter_time = myst_startup_trace_now();
+
+    /* The kernel records the rootfs files that the program opens */
+    shared_memory.layout_profile = myst_layout_profile_get();
+
+    /* The kernel records the profile samples (only in debug mode) */
+    shared_memory.profile = myst_profile_get();
+
+    /* The kernel records the events (only in debug mode) */
+    shared_memory.event_trace = myst_event_trace_get();
+
     /* Enter the enclave and run the program */
     r = myst_enter_ecall(
         _enclave,
@@ -205,6 +279,77 @@ Options:\n\
                             and application, where <size> may have a\n\
                             multiplier suffix: k 1024, m 1024*1024, or\n\
                             g 1024*1024*1024\n\
+    --max-pipe-size <size> -- the largest pipe capacity F_SETPIPE_SZ may\n\
+                              set (default 1m), with the same suffixes as\n\
+                              --memory-size\n\
+    --enclave-loopback   -- serve TCP and UDP on loopback addresses inside\n\
+                            the enclave when the listener is bound there\n\
+    --socket-prefetch-size <size> -- receive up to <size> bytes ahead on TCP\n\
+                                     sockets so that small reads are served\n\
+                                     inside the enclave (default 0, off)\n\
+    --accept-batch <count> -- accept up to <count> pending connections per\n\
+                              OCALL on TCP listeners (default 0, off)\n\
+    --busy-poll <usec>   -- before blocking in poll(), select(),\n\
+                            epoll_wait() or a socket receive, probe the\n\
+                            host without blocking for up to <usec>\n\
+                            microseconds (default 0, off; SO_BUSY_POLL\n\
+                            sets it for one socket)\n\
+    --host-sendfile      -- let the host move the bytes of sendfile() from\n\
+                            a hostfs file to a host socket, without the\n\
+                            enclave reading them (only for files that\n\
+                            are not confidential)\n\
+    --async-close        -- close host sockets and hostfs files on a\n\
+                            kernel thread, so close() does not wait for\n\
+                            the host\n\
+    --prefetch-libs      -- read the shared libraries that an exec'd\n\
+                            program needs on a kernel thread, ahead of\n\
+                            the dynamic loader\n\
+    --kernel-tls         -- let programs hand the TLS record layer of a\n\
+                            socket to the kernel (setsockopt(SOL_TLS)),\n\
+                            which keeps the keys inside the enclave\n\
+    --export-ramfs       -- write the files of the file system to ramfs/\n\
+                            under $MYST_EXPORT_RAMFS (or the current\n\
+                            directory) on exit\n\
+    --export-ramfs-changed -- the same, but only for the files modified\n\
+                              after the program started\n\
+    --crypto-threads <count> -- decrypt and verify large reads of LUKS and\n\
+                                verity block devices (and transfer large\n\
+                                hostfs reads and writes) on <count>\n\
+                                kernel threads (default 0, off; at most 64)\n\
+    --attestation-cache-ttl <seconds> -- reuse the reports and attested\n\
+                                         certificates of the same inputs\n\
+                                         for <seconds> (at most a day),\n\
+                                         generating them again before\n\
+                                         they expire (default 0, off)\n\
+    --console-buffering <mode> -- when to write out console output: at\n\
+                                  each newline (line), when 4k is\n\
+                                  buffered (full), or at each write\n\
+                                  (none); the default is line for a\n\
+                                  terminal and full otherwise\n\
+    --startup-trace <file> -- write the startup phases of the host and the\n\
+                              kernel (up to the end of the dynamic loader)\n\
+                              to <file> as a Chrome trace (JSON) on exit\n\
+    --layout-profile <file> -- write the EXT2 rootfs files that the\n\
+                               program opens (in the order of first use)\n\
+                               to <file> on exit, for mkext2 --order\n\
+    --verity-node-cache <file> -- keep the verified hash nodes of a\n\
+                                  dm-verity rootfs in <file> (sealed to\n\
+                                  the enclave) across runs, so that a\n\
+                                  restart need not hash them again\n\
+    --profile <file>     -- sample the stacks of the program and the kernel\n\
+                            at each millisecond (as seen on syscall entry\n\
+                            and exit) and write them to <file> as folded\n\
+                            stacks for flame graphs on exit\n\
+    --event-trace <file> -- record kernel events (syscalls, tcalls, futexes,\n\
+                            scheduling and file I/O) in per-thread rings\n\
+                            and write them to <file> on exit, for\n\
+                            myst decode-trace (debug mode only)\n\
+    --event-trace-categories <list> -- the categories to record, such as\n\
+                                       syscall,futex (default: all); see\n\
+                                       /proc/myst/events\n\
+    --numa               -- pin the enclave threads to the NUMA nodes in\n\
+                            turn (and interleave the kernel memory over\n\
+                            them for exec-linux)\n\
     --app-config-path <json> -- specifies the configuration json file for\n\
                                 running an unsigned binary. The file can be\n\
                                 the same one used for the signing process.\n\
@@ -227,6 +372,11 @@ int exec_action(int argc, const char* argv[], const char* envp[])
     char rootfs_path[] = "/tmp/mystXXXXXX";
     uint64_t heap_size = 0;
     const char* commandline_config = NULL;
+    const char* startup_trace_path = NULL;
+    const char* layout_profile_path = NULL;
+    const char* profile_path = NULL;
+    const char* event_trace_path = NULL;
+    uint64_t start;
 
     assert(strcmp(argv[1], "exec") == 0 || strcmp(argv[1], "exec-sgx") == 0);
 
@@ -252,6 +402,40 @@ int exec_action(int argc, const char* argv[], const char* envp[])
         if (cli_getopt(&argc, argv, "--export-ramfs", NULL) == 0)
             options.export_ramfs = true;
 
+        /* Get --export-ramfs-changed option */
+        if (cli_getopt(&argc, argv, "--export-ramfs-changed", NULL) == 0)
+        {
+            options.export_ramfs = true;
+            options.export_ramfs_changed = true;
+        }
+
+        /* Get --syscall-stats option */
+        if (cli_getopt(&argc, argv, "--syscall-stats", NULL) == 0)
+            options.syscall_stats = true;
+
+        /* Get --enclave-loopback option */
+        if (cli_getopt(&argc, argv, "--enclave-loopback", NULL) == 0)
+            options.enclave_loopback = true;
+
+        /* Get --host-sendfile option */
+        if (cli_getopt(&argc, argv, "--host-sendfile", NULL) == 0)
+            options.host_sendfile = true;
+
+        /* Get --async-close option */
+        if (cli_getopt(&argc, argv, "--async-close", NULL) == 0)
+            options.async_close = true;
+
+        /* Get --prefetch-libs option */
+        if (cli_getopt(&argc, argv, "--prefetch-libs", NULL) == 0)
+            options.prefetch_libs = true;
+
+        /* Get --kernel-tls option */
+        if (cli_getopt(&argc, argv, "--kernel-tls", NULL) == 0)
+            options.kernel_tls = true;
+
+        /* Get --numa option (the pool threads are placed from now on) */
+        numa_init(cli_getopt(&argc, argv, "--numa", NULL) == 0);
+
         /* Get --memory-size or --user-mem-size option */
         {
             const char* opt;
@@ -278,6 +462,161 @@ int exec_action(int argc, const char* argv[], const char* envp[])
             }
         }
 
+        /* Get --max-pipe-size option */
+        {
+            const char* arg = NULL;
+
+            if (cli_getopt(&argc, argv, "--max-pipe-size", &arg) == 0 &&
+                myst_expand_size_string_to_ulong(
+                    arg, &options.max_pipe_size) != 0)
+            {
+                _err("--max-pipe-size <size> -- bad suffix "
+                     "(must be k, m, or g)\n");
+            }
+        }
+
+        /* Get --socket-prefetch-size option */
+        {
+            const char* arg = NULL;
+
+            if (cli_getopt(&argc, argv, "--socket-prefetch-size", &arg) == 0 &&
+                myst_expand_size_string_to_ulong(
+                    arg, &options.socket_prefetch_size) != 0)
+            {
+                _err("--socket-prefetch-size <size> -- bad suffix "
+                     "(must be k, m, or g)\n");
+            }
+        }
+
+        /* Get --accept-batch option */
+        {
+            const char* arg = NULL;
+            char* end = NULL;
+
+            if (cli_getopt(&argc, argv, "--accept-batch", &arg) == 0)
+            {
+                options.accept_batch = strtoul(arg, &end, 10);
+
+                if (end == arg || *end != '\0')
+                    _err("--accept-batch <count> -- must be a number\n");
+            }
+        }
+
+        /* Get --busy-poll option */
+        {
+            const char* arg = NULL;
+            char* end = NULL;
+
+            if (cli_getopt(&argc, argv, "--busy-poll", &arg) == 0)
+            {
+                options.busy_poll_usec = strtoul(arg, &end, 10);
+
+                if (end == arg || *end != '\0' ||
+                    options.busy_poll_usec > UINT_MAX)
+                    _err("--busy-poll <usec> -- must be a number\n");
+            }
+        }
+
+        /* Get --crypto-threads option */
+        {
+            const char* arg = NULL;
+            char* end = NULL;
+
+            if (cli_getopt(&argc, argv, "--crypto-threads", &arg) == 0)
+            {
+                options.crypto_threads = strtoul(arg, &end, 10);
+
+                if (end == arg || *end != '\0')
+                    _err("--crypto-threads <count> -- must be a number\n");
+            }
+        }
+
+        /* Get --attestation-cache-ttl option */
+        {
+            const char* arg = NULL;
+            char* end = NULL;
+            const char* opt = "--attestation-cache-ttl";
+
+            if (cli_getopt(&argc, argv, opt, &arg) == 0)
+            {
+                options.attestation_cache_ttl = strtoul(arg, &end, 10);
+
+                if (end == arg || *end != '\0')
+                    _err("%s <seconds> -- must be a number\n", opt);
+            }
+        }
+
+        /* Get --startup-trace option */
+        cli_getopt(&argc, argv, "--startup-trace", &startup_trace_path);
+
+        if (startup_trace_path && !myst_startup_trace_start())
+            _err("--startup-trace <file> -- out of memory\n");
+
+        /* Get --layout-profile option */
+        cli_getopt(&argc, argv, "--layout-profile", &layout_profile_path);
+
+        if (layout_profile_path && !myst_layout_profile_start())
+            _err("--layout-profile <file> -- out of memory\n");
+
+        /* Get --verity-node-cache option */
+        {
+            const char* path = NULL;
+
+            cli_getopt(&argc, argv, "--verity-node-cache", &path);
+
+            if (path)
+            {
+                const size_t n = sizeof(options.verity_node_cache);
+                int fd;
+
+                if (myst_strlcpy(options.verity_node_cache, path, n) >= n)
+                    _err("--verity-node-cache <file> -- path too long\n");
+
+                /* the kernel opens (but cannot create) the file */
+                if ((fd = open(path, O_CREAT | O_RDWR, 0600)) < 0)
+                    _err("--verity-node-cache: cannot open %s\n", path);
+
+                close(fd);
+            }
+        }
+
+        /* Get --profile option */
+        cli_getopt(&argc, argv, "--profile", &profile_path);
+
+        if (profile_path && !myst_profile_start())
+            _err("--profile <file> -- out of memory\n");
+
+        /* Get --event-trace and --event-trace-categories options */
+        cli_getopt(&argc, argv, "--event-trace", &event_trace_path);
+
+        if (event_trace_path)
+        {
+            const char* list = "all";
+            uint32_t categories;
+
+            cli_getopt(&argc, argv, "--event-trace-categories", &list);
+
+            if (myst_parse_event_categories(list, &categories) != 0)
+                _err("--event-trace-categories: bad category: %s\n", list);
+
+            if (!myst_event_trace_start(categories))
+                _err("--event-trace <file> -- out of memory\n");
+        }
+
+        /* Get --console-buffering option */
+        {
+            const char* arg = NULL;
+
+            cli_getopt(&argc, argv, "--console-buffering", &arg);
+
+            if ((options.console_buffering = myst_get_console_buffering(arg)) <
+                0)
+            {
+                _err("--console-buffering <mode> -- must be line, full or "
+                     "none\n");
+            }
+        }
+
         /* Get --app-config option if it exists, otherwise we use default values
          */
         cli_getopt(&argc, argv, "--app-config-path", &commandline_config);
@@ -290,12 +629,17 @@ int exec_action(int argc, const char* argv[], const char* envp[])
             return 1;
         }
 
-        /* Set export_ramfs option based on MYST_ENABLE_GCOV env variable */
+        /* Export the coverage data if MYST_ENABLE_GCOV=1 (but only that,
+         * unless --export-ramfs asked for all of the files) */
         {
             const char* val;
 
-            if ((val = getenv("MYST_ENABLE_GCOV")) && strcmp(val, "1") == 0)
+            if ((val = getenv("MYST_ENABLE_GCOV")) && strcmp(val, "1") == 0 &&
+                !options.export_ramfs)
+            {
                 options.export_ramfs = true;
+                options.export_gcov = true;
+            }
         }
 
         /* Get --pubkey=filename and --roothash=filename options */
@@ -349,6 +693,8 @@ int exec_action(int argc, const char* argv[], const char* envp[])
     // we may  or may not have config passed in through the commandline.
     // If the enclave is signed that config will take precedence over
     // this version
+    start = myst_startup_trace_now();
+
     if ((details = create_region_details_from_files(
              program, rootfs, archive_path, commandline_config, heap_size)) ==
         NULL)
@@ -356,6 +702,8 @@ int exec_action(int argc, const char* argv[], const char* envp[])
         _err("Creating region data failed.");
     }
 
+    myst_startup_trace_event("load_files", start);
+
     unlink(archive_path);
 
     return_status = exec_launch_enclave(
@@ -366,6 +714,18 @@ int exec_action(int argc, const char* argv[], const char* envp[])
     if (rootfs == rootfs_path)
         unlink(rootfs_path);
 
+    if (startup_trace_path && myst_startup_trace_write(startup_trace_path))
+        fprintf(stderr, "failed to write %s\n", startup_trace_path);
+
+    if (layout_profile_path && myst_layout_profile_write(layout_profile_path))
+        fprintf(stderr, "failed to write %s\n", layout_profile_path);
+
+    if (profile_path && myst_profile_write(profile_path))
+        fprintf(stderr, "failed to write %s\n", profile_path);
+
+    if (event_trace_path && myst_event_trace_write(event_trace_path))
+        fprintf(stderr, "failed to write %s\n", event_trace_path);
+
     return return_status;
 }
 
@@ -401,6 +761,19 @@ long myst_sched_yield_ocall(void)
     return (sched_yield() == 0) ? 0 : -errno;
 }
 
+/* The affinity of the calling thread (which runs the enclave thread) */
+long myst_sched_getaffinity_ocall(void* mask, size_t cpusetsize)
+{
+    long ret = syscall(SYS_sched_getaffinity, 0, cpusetsize, mask);
+    return ret < 0 ? -errno : ret;
+}
+
+long myst_sched_setaffinity_ocall(const void* mask, size_t cpusetsize)
+{
+    long ret = syscall(SYS_sched_setaffinity, 0, cpusetsize, mask);
+    return ret < 0 ? -errno : ret;
+}
+
 long myst_fchmod_ocall(int fd, uint32_t mode)
 {
     if (fchmod(fd, mode) != 0)
@@ -424,6 +797,42 @@ long myst_poll_ocall(struct pollfd* fds, unsigned long nfds, int timeout)
     return myst_tcall_poll(fds, nfds, timeout);
 }
 
+long myst_epoll_create1_ocall(int flags)
+{
+    return myst_tcall_epoll_create1(flags);
+}
+
+long myst_epoll_ctl_ocall(
+    int epfd,
+    int op,
+    int fd,
+    uint32_t events,
+    uint64_t data)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.u64 = data;
+
+    if (epoll_ctl(epfd, op, fd, &ev) != 0)
+        return -errno;
+
+    return 0;
+}
+
+long myst_epoll_wait_ocall(
+    int epfd,
+    void* events,
+    size_t size,
+    int maxevents,
+    int timeout)
+{
+    if (maxevents <= 0 || size / sizeof(struct epoll_event) < (size_t)maxevents)
+        return -EINVAL;
+
+    return myst_tcall_epoll_wait(epfd, events, maxevents, timeout);
+}
+
 int myst_load_fssig_ocall(const char* path, myst_fssig_t* fssig)
 {
     return myst_load_fssig(path, fssig);
@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 #include <assert.h>
+#include <limits.h>
 #include <linux/futex.h>
 #include <pthread.h>
 #include <stdbool.h>
@@ -18,8 +19,12 @@
 #include <myst/eraise.h>
 #include <myst/file.h>
 #include <myst/kernel.h>
+#include <myst/eventtrace.h>
+#include <myst/layoutprofile.h>
+#include <myst/profile.h>
 #include <myst/reloc.h>
 #include <myst/round.h>
+#include <myst/startuptrace.h>
 #include <myst/strings.h>
 #include <myst/tcall.h>
 #include <myst/thread.h>
@@ -28,6 +33,9 @@
 #include "../shared.h"
 #include "archive.h"
 #include "exec_linux.h"
+#include "numa.h"
+#include "tcallsim.h"
+#include "threadpool.h"
 #include "utils.h"
 
 #define USAGE_FORMAT \
@@ -50,6 +58,75 @@ Options:\n\
                             and application, where <size> may have a\n\
                             multiplier suffix: k 1024, m 1024*1024, or\n\
                             g 1024*1024*1024\n\
+    --max-pipe-size <size> -- the largest pipe capacity F_SETPIPE_SZ may\n\
+                              set (default 1m), with the same suffixes as\n\
+                              --memory-size\n\
+    --enclave-loopback   -- serve TCP and UDP on loopback addresses inside\n\
+                            the enclave when the listener is bound there\n\
+    --socket-prefetch-size <size> -- receive up to <size> bytes ahead on TCP\n\
+                                     sockets so that small reads are served\n\
+                                     inside the enclave (default 0, off)\n\
+    --accept-batch <count> -- accept up to <count> pending connections per\n\
+                              OCALL on TCP listeners (default 0, off)\n\
+    --busy-poll <usec>   -- before blocking in poll(), select(),\n\
+                            epoll_wait() or a socket receive, probe the\n\
+                            host without blocking for up to <usec>\n\
+                            microseconds (default 0, off; SO_BUSY_POLL\n\
+                            sets it for one socket)\n\
+    --host-sendfile      -- let the host move the bytes of sendfile() from\n\
+                            a hostfs file to a host socket, without the\n\
+                            enclave reading them (only for files that\n\
+                            are not confidential)\n\
+    --async-close        -- close host sockets and hostfs files on a\n\
+                            kernel thread, so close() does not wait for\n\
+                            the host\n\
+    --prefetch-libs      -- read the shared libraries that an exec'd\n\
+                            program needs on a kernel thread, ahead of\n\
+                            the dynamic loader\n\
+    --kernel-tls         -- let programs hand the TLS record layer of a\n\
+                            socket to the kernel (setsockopt(SOL_TLS)),\n\
+                            which keeps the keys inside the enclave\n\
+    --export-ramfs       -- write the files of the file system to ramfs/\n\
+                            under $MYST_EXPORT_RAMFS (or the current\n\
+                            directory) on exit\n\
+    --export-ramfs-changed -- the same, but only for the files modified\n\
+                              after the program started\n\
+    --crypto-threads <count> -- decrypt and verify large reads of LUKS and\n\
+                                verity block devices on <count> kernel\n\
+                                threads (default 0, off; at most 64)\n\
+    --console-buffering <mode> -- when to write out console output: at\n\
+                                  each newline (line), when 4k is\n\
+                                  buffered (full), or at each write\n\
+                                  (none); the default is line for a\n\
+                                  terminal and full otherwise\n\
+    --startup-trace <file> -- write the startup phases of the host and the\n\
+                              kernel (up to the end of the dynamic loader)\n\
+                              to <file> as a Chrome trace (JSON) on exit\n\
+    --layout-profile <file> -- write the EXT2 rootfs files that the\n\
+                               program opens (in the order of first use)\n\
+                               to <file> on exit, for mkext2 --order\n\
+    --profile <file>     -- sample the stacks of the program and the kernel\n\
+                            at each millisecond (as seen on syscall entry\n\
+                            and exit) and write them to <file> as folded\n\
+                            stacks for flame graphs on exit\n\
+    --event-trace <file> -- record kernel events (syscalls, tcalls, futexes,\n\
+                            scheduling and file I/O) in per-thread rings\n\
+                            and write them to <file> on exit, for\n\
+                            myst decode-trace (debug mode only)\n\
+    --event-trace-categories <list> -- the categories to record, such as\n\
+                                       syscall,futex (default: all); see\n\
+                                       /proc/myst/events\n\
+    --numa               -- pin the enclave threads to the NUMA nodes in\n\
+                            turn (and interleave the kernel memory over\n\
+                            them for exec-linux)\n\
+    --sim-tcall-latency <nsec> -- add <nsec> nanoseconds to each tcall that\n\
+                                  would be an OCALL under SGX, and write the\n\
+                                  counts of these tcalls to stderr on exit\n\
+    --sim-epc-size <size> -- also model the EPC paging of the kernel memory\n\
+                             for an EPC of <size> bytes (same suffixes as\n\
+                             --memory-size)\n\
+    --sim-epc-fault-latency <nsec> -- the cost of one EPC page swap for\n\
+                                      --sim-epc-size (default 12000)\n\
     --app-config-path <json> -- specifies the configuration json file for\n\
                                 running an unsigned binary. The file can be\n\
                                 the same one used for the signing process.\n\
@@ -61,6 +138,26 @@ struct options
     bool trace_errors;
     bool trace_syscalls;
     bool export_ramfs;
+    bool export_ramfs_changed;
+    bool export_gcov;
+    bool syscall_stats;
+    size_t max_pipe_size;
+    bool enclave_loopback;
+    bool host_sendfile;
+    bool async_close;
+    bool prefetch_libs;
+    bool kernel_tls;
+    size_t socket_prefetch_size;
+    size_t accept_batch;
+    size_t busy_poll_usec;
+    size_t crypto_threads;
+    int console_buffering;
+    const char* startup_trace;
+    const char* layout_profile;
+    const char* profile;
+    const char* event_trace;
+    bool tcall_sim;
+    tcallsim_options_t sim;
     char rootfs[PATH_MAX];
 };
 
@@ -103,12 +200,51 @@ static void _get_options(
     if (cli_getopt(argc, argv, "--export-ramfs", NULL) == 0)
         options->export_ramfs = true;
 
-    /* Set export_ramfs option based on MYST_ENABLE_GCOV env variable */
+    /* Get --export-ramfs-changed option */
+    if (cli_getopt(argc, argv, "--export-ramfs-changed", NULL) == 0)
+    {
+        options->export_ramfs = true;
+        options->export_ramfs_changed = true;
+    }
+
+    /* Get --syscall-stats option */
+    if (cli_getopt(argc, argv, "--syscall-stats", NULL) == 0)
+        options->syscall_stats = true;
+
+    /* Get --enclave-loopback option */
+    if (cli_getopt(argc, argv, "--enclave-loopback", NULL) == 0)
+        options->enclave_loopback = true;
+
+    /* Get --host-sendfile option */
+    if (cli_getopt(argc, argv, "--host-sendfile", NULL) == 0)
+        options->host_sendfile = true;
+
+    /* Get --async-close option */
+    if (cli_getopt(argc, argv, "--async-close", NULL) == 0)
+        options->async_close = true;
+
+    /* Get --prefetch-libs option */
+    if (cli_getopt(argc, argv, "--prefetch-libs", NULL) == 0)
+        options->prefetch_libs = true;
+
+    /* Get --kernel-tls option */
+    if (cli_getopt(argc, argv, "--kernel-tls", NULL) == 0)
+        options->kernel_tls = true;
+
+    /* Get --numa option (the pool threads are placed from now on) */
+    numa_init(cli_getopt(argc, argv, "--numa", NULL) == 0);
+
+    /* Export the coverage data if MYST_ENABLE_GCOV=1 (but only that, unless
+     * --export-ramfs asked for all of the files) */
     {
         const char* val;
 
-        if ((val = getenv("MYST_ENABLE_GCOV")) && strcmp(val, "1") == 0)
+        if ((val = getenv("MYST_ENABLE_GCOV")) && strcmp(val, "1") == 0 &&
+            !options->export_ramfs)
+        {
             options->export_ramfs = true;
+            options->export_gcov = true;
+        }
     }
 
     /* Get --memory-size or --memory-size option */
@@ -137,6 +273,152 @@ static void _get_options(
         }
     }
 
+    /* Get --max-pipe-size option */
+    {
+        const char* arg = NULL;
+
+        if (cli_getopt(argc, argv, "--max-pipe-size", &arg) == 0 &&
+            myst_expand_size_string_to_ulong(arg, &options->max_pipe_size) !=
+                0)
+        {
+            _err("--max-pipe-size <size> -- bad suffix (must be k, m, or g)\n");
+        }
+    }
+
+    /* Get --socket-prefetch-size option */
+    {
+        const char* arg = NULL;
+        size_t* size = &options->socket_prefetch_size;
+
+        if (cli_getopt(argc, argv, "--socket-prefetch-size", &arg) == 0 &&
+            myst_expand_size_string_to_ulong(arg, size) != 0)
+        {
+            _err("--socket-prefetch-size <size> -- bad suffix "
+                 "(must be k, m, or g)\n");
+        }
+    }
+
+    /* Get --accept-batch option */
+    {
+        const char* arg = NULL;
+        char* end = NULL;
+
+        if (cli_getopt(argc, argv, "--accept-batch", &arg) == 0)
+        {
+            options->accept_batch = strtoul(arg, &end, 10);
+
+            if (end == arg || *end != '\0')
+                _err("--accept-batch <count> -- must be a number\n");
+        }
+    }
+
+    /* Get --busy-poll option */
+    {
+        const char* arg = NULL;
+        char* end = NULL;
+
+        if (cli_getopt(argc, argv, "--busy-poll", &arg) == 0)
+        {
+            options->busy_poll_usec = strtoul(arg, &end, 10);
+
+            if (end == arg || *end != '\0' ||
+                options->busy_poll_usec > UINT_MAX)
+                _err("--busy-poll <usec> -- must be a number\n");
+        }
+    }
+
+    /* Get --crypto-threads option */
+    {
+        const char* arg = NULL;
+        char* end = NULL;
+
+        if (cli_getopt(argc, argv, "--crypto-threads", &arg) == 0)
+        {
+            options->crypto_threads = strtoul(arg, &end, 10);
+
+            if (end == arg || *end != '\0')
+                _err("--crypto-threads <count> -- must be a number\n");
+        }
+    }
+
+    /* Get --console-buffering option */
+    {
+        const char* arg = NULL;
+
+        cli_getopt(argc, argv, "--console-buffering", &arg);
+
+        if ((options->console_buffering = myst_get_console_buffering(arg)) < 0)
+            _err("--console-buffering <mode> -- must be line, full or none\n");
+    }
+
+    /* Get --startup-trace option */
+    cli_getopt(argc, argv, "--startup-trace", &options->startup_trace);
+
+    if (options->startup_trace && !myst_startup_trace_start())
+        _err("--startup-trace <file> -- out of memory\n");
+
+    /* Get --layout-profile option */
+    cli_getopt(argc, argv, "--layout-profile", &options->layout_profile);
+
+    if (options->layout_profile && !myst_layout_profile_start())
+        _err("--layout-profile <file> -- out of memory\n");
+
+    /* Get --profile option */
+    cli_getopt(argc, argv, "--profile", &options->profile);
+
+    if (options->profile && !myst_profile_start())
+        _err("--profile <file> -- out of memory\n");
+
+    /* Get --event-trace and --event-trace-categories options */
+    cli_getopt(argc, argv, "--event-trace", &options->event_trace);
+
+    if (options->event_trace)
+    {
+        const char* list = "all";
+        uint32_t categories;
+
+        cli_getopt(argc, argv, "--event-trace-categories", &list);
+
+        if (myst_parse_event_categories(list, &categories) != 0)
+            _err("--event-trace-categories: bad category: %s\n", list);
+
+        if (!myst_event_trace_start(categories))
+            _err("--event-trace <file> -- out of memory\n");
+    }
+
+    /* Get --sim-tcall-latency, --sim-epc-size and --sim-epc-fault-latency */
+    {
+        const char* arg = NULL;
+        char* end = NULL;
+
+        if (cli_getopt(argc, argv, "--sim-tcall-latency", &arg) == 0)
+        {
+            options->tcall_sim = true;
+            options->sim.latency_nsec = strtoul(arg, &end, 10);
+
+            if (end == arg || *end != '\0')
+                _err("--sim-tcall-latency <nsec> -- must be a number\n");
+        }
+
+        if (cli_getopt(argc, argv, "--sim-epc-size", &arg) == 0)
+        {
+            if (!options->tcall_sim)
+                _err("--sim-epc-size requires --sim-tcall-latency\n");
+
+            if (myst_expand_size_string_to_ulong(arg, &options->sim.epc_size))
+                _err("--sim-epc-size <size> -- bad suffix "
+                     "(must be k, m, or g)\n");
+        }
+
+        if (cli_getopt(argc, argv, "--sim-epc-fault-latency", &arg) == 0)
+        {
+            options->sim.fault_nsec = strtoul(arg, &end, 10);
+
+            if (end == arg || *end != '\0')
+                _err("--sim-epc-fault-latency <nsec> -- must be a number\n");
+        }
+    }
+
     // get app config if present
     cli_getopt(argc, argv, "--app-config-path", app_config_path);
 }
@@ -208,7 +490,7 @@ static void _load_regions(
 
     /* Load libmystcrt.so */
     {
-        if (format_libmystkernel(path, sizeof(path)) != 0)
+        if (format_libmystkernel(path, sizeof(path), "linux") != 0)
             _err("cannot find libmystkernel.so");
 
         if (elf_image_load(path, &r->libmystkernel) != 0)
@@ -251,6 +533,8 @@ static void _load_regions(
     if (!(r->mman_data = _map_mmap_region(r->mman_size)))
         _err("failed to map mmap region");
 
+    numa_interleave(r->mman_data, r->mman_size);
+
     /* Apply relocations to the libmystkernel.so image */
     if (myst_apply_relocations(
             r->libmystkernel.image_data,
@@ -398,6 +682,26 @@ static int _enter_kernel(
     args.trace_syscalls = options->trace_syscalls;
     args.have_syscall_instruction = true;
     args.export_ramfs = options->export_ramfs;
+    args.export_ramfs_changed = options->export_ramfs_changed;
+    args.export_gcov = options->export_gcov;
+    args.syscall_stats = options->syscall_stats;
+    args.max_pipe_size = options->max_pipe_size;
+    args.enclave_loopback = options->enclave_loopback;
+    args.host_sendfile = options->host_sendfile;
+    args.async_close = options->async_close;
+    args.prefetch_libs = options->prefetch_libs;
+    args.kernel_tls = options->kernel_tls;
+    args.socket_prefetch_size = options->socket_prefetch_size;
+    args.accept_batch = options->accept_batch;
+    args.busy_poll_usec = (unsigned int)options->busy_poll_usec;
+    args.crypto_threads = options->crypto_threads;
+    args.console_buffering = options->console_buffering;
+    args.startup_trace = myst_startup_trace_get();
+    args.layout_profile = myst_layout_profile_get();
+    args.profile = myst_profile_get();
+    args.event_trace = myst_event_trace_get();
+    args.verity_cache_blocks = parsed_data.verity_cache_pages;
+    args.verity_prefetch_blocks = parsed_data.verity_prefetch_blocks;
     args.event = (uint64_t)&_thread_event;
     args.tee_debug_mode = true;
     args.tcall = tcall;
@@ -422,6 +726,9 @@ static int _enter_kernel(
         ERAISE(-EINVAL);
     }
 
+    if (args.startup_trace)
+        args.startup_trace->enter_time = myst_startup_trace_now();
+
     *return_status = (*entry)(&args);
 
 done:
@@ -436,6 +743,7 @@ done:
 
 static long _tcall(long n, long params[6])
 {
+    tcallsim_enter(n);
     return myst_tcall(n, params);
 }
 
@@ -511,8 +819,14 @@ int exec_linux_action(int argc, const char* argv[], const char* envp[])
     }
 
     /* Load the regions into memory */
-    _load_regions(
-        rootfs_arg, archive_path, heap_size, app_config_path, &regions);
+    {
+        const uint64_t start = myst_startup_trace_now();
+
+        _load_regions(
+            rootfs_arg, archive_path, heap_size, app_config_path, &regions);
+
+        myst_startup_trace_event("load_regions", start);
+    }
 
     unlink(archive_path);
 
@@ -527,6 +841,15 @@ int exec_linux_action(int argc, const char* argv[], const char* envp[])
     argc -= 3;
     argv += 3;
 
+    if (options.tcall_sim)
+    {
+        if (tcallsim_start(
+                &options.sim, regions.mman_data, regions.mman_size) != 0)
+        {
+            _err("--sim-tcall-latency: failed to start the simulation\n");
+        }
+    }
+
     /* Enter the kernel image */
     if (_enter_kernel(
             argc,
@@ -543,9 +866,35 @@ int exec_linux_action(int argc, const char* argv[], const char* envp[])
         _err("%s", err);
     }
 
+    tcallsim_stop(stderr);
+
     /* release the regions memory */
     _release_regions(&regions);
 
+    if (options.startup_trace)
+    {
+        if (myst_startup_trace_write(options.startup_trace) != 0)
+            fprintf(stderr, "failed to write %s\n", options.startup_trace);
+    }
+
+    if (options.layout_profile)
+    {
+        if (myst_layout_profile_write(options.layout_profile) != 0)
+            fprintf(stderr, "failed to write %s\n", options.layout_profile);
+    }
+
+    if (options.profile)
+    {
+        if (myst_profile_write(options.profile) != 0)
+            fprintf(stderr, "failed to write %s\n", options.profile);
+    }
+
+    if (options.event_trace)
+    {
+        if (myst_event_trace_write(options.event_trace) != 0)
+            fprintf(stderr, "failed to write %s\n", options.event_trace);
+    }
+
 #if 0
     if (rootfs_arg == rootfs_path)
         unlink(rootfs_path);
@@ -562,36 +911,16 @@ int exec_linux_action(int argc, const char* argv[], const char* envp[])
 **==============================================================================
 */
 
-static void* _thread_func(void* arg)
+static void _run_thread(uint64_t cookie, uint64_t event)
 {
-    uint64_t cookie = (uint64_t)arg;
-    uint64_t event = (uint64_t)&_thread_event;
-
     if (myst_run_thread(cookie, event) != 0)
     {
         fprintf(stderr, "myst_run_thread() failed\n");
         exit(1);
     }
-
-    return NULL;
 }
 
 long myst_tcall_create_thread(uint64_t cookie)
 {
-    long ret = 0;
-    pthread_t t;
-    pthread_attr_t attr;
-
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-
-    if (pthread_create(&t, &attr, _thread_func, (void*)cookie) != 0)
-    {
-        ret = -EINVAL;
-        goto done;
-    }
-
-done:
-    pthread_attr_destroy(&attr);
-    return ret;
+    return threadpool_create_thread(_run_thread, cookie);
 }
@@ -17,8 +17,10 @@
 #include <myst/cpio.h>
 #include <myst/elf.h>
 #include <myst/eraise.h>
+#include <myst/eventtrace.h>
 #include <myst/file.h>
 #include <myst/getopt.h>
+#include <myst/profile.h>
 #include <myst/round.h>
 #include <myst/strings.h>
 #include <myst/tcall.h>
@@ -158,6 +160,9 @@ long myst_tcall_add_symbol_file(
         notify = true;
     }
 
+    /* keep the symbols for --profile (they outlive the file) */
+    myst_profile_add_symbols(file_data, file_size, text_data, text_size);
+
     /* Create a file containing the data */
     {
         if ((fd = mkstemp(tmp)) < 0)
@@ -287,6 +292,8 @@ Where <action> is one of:\n\
                      pieces during in the process\n\
     dump-sgx      -- dump the SGX enclave configuration along with the\n\
                      packaging configuration from an SGX packaged executable\n\
+    decode-trace  -- print a trace written by --event-trace, or convert it\n\
+                     to JSON for Perfetto (or to syscalls to replay)\n\
 \n\
 "
 
@@ -363,6 +370,10 @@ int main(int argc, const char* argv[], const char* envp[])
         extern int fssig_action(int argc, const char* argv[]);
         return fssig_action(argc, argv);
     }
+    else if (strcmp(argv[1], "decode-trace") == 0)
+    {
+        return decode_trace_action(argc, argv);
+    }
     else
     {
         fprintf(stderr, USAGE, argv[0]);
@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/layoutprofile.h>
+
+static myst_layout_profile_t* _profile;
+
+myst_layout_profile_t* myst_layout_profile_start(void)
+{
+    if (!_profile)
+        _profile = calloc(1, sizeof(myst_layout_profile_t));
+
+    return _profile;
+}
+
+myst_layout_profile_t* myst_layout_profile_get(void)
+{
+    return _profile;
+}
+
+int myst_layout_profile_write(const char* path)
+{
+    FILE* os;
+    uint64_t size;
+
+    if (!_profile || !path)
+        return -EINVAL;
+
+    /* the enclave wrote the size, so keep it within the buffer */
+    if ((size = _profile->size) > sizeof(_profile->data))
+        size = sizeof(_profile->data);
+
+    if (!(os = fopen(path, "w")))
+        return -errno;
+
+    fprintf(os, "# the rootfs files in the order of their first use\n");
+
+    if (size && fwrite(_profile->data, 1, size, os) != size)
+    {
+        fclose(os);
+        return -EIO;
+    }
+
+    if (fclose(os) != 0)
+        return -errno;
+
+    if (_profile->dropped)
+    {
+        fprintf(
+            stderr,
+            "myst: %s: %lu files did not fit in the layout profile\n",
+            path,
+            _profile->dropped);
+    }
+
+    return 0;
+}
@@ -0,0 +1,1208 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <myst/ext2.h>
+#include "../utils.h"
+#include "ext2image.h"
+
+/*
+**==============================================================================
+**
+** The ext2 image writer:
+**
+**     The directory tree is scanned into memory and planned before anything
+**     is written: inodes are numbered in depth-first order (of names sorted
+**     by strcmp), the size of the image follows from the exact number of
+**     blocks and inodes needed, and the blocks are allocated one after the
+**     other. The directories come first (so path lookups stay close
+**     together), then the files named by the order file (in that order) and
+**     then the other files in depth-first order. Each file is contiguous
+**     (but for group metadata), with its indirect blocks just ahead of the
+**     blocks that they map. The image is then written in one sequential
+**     pass, which also feeds the blocks to the hash tree.
+**
+**     The layout is that of "mke2fs -t ext2 -b 4096 -I 128" with the
+**     filetype and sparse_super features (and large_file if needed).
+**
+**==============================================================================
+*/
+
+#define BLOCK_SIZE 4096
+#define LOG_BLOCK_SIZE 2 /* the block size is 1024 << LOG_BLOCK_SIZE */
+#define BLOCKS_PER_GROUP (8 * BLOCK_SIZE)
+#define INODE_SIZE 128
+#define INODES_PER_BLOCK (BLOCK_SIZE / INODE_SIZE)
+#define ADDRS_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))
+#define DESCS_PER_BLOCK (BLOCK_SIZE / sizeof(ext2_group_desc_t))
+#define NUM_DIRECT_BLOCKS 12
+#define MAX_GROUPS (UINT32_MAX / BLOCKS_PER_GROUP)
+
+/* Symbolic links shorter than this are kept in the inode's i_block[] */
+#define FAST_SYMLINK_SIZE sizeof(((ext2_inode_t*)0)->i_block)
+
+#define SUPER_MAGIC 0xEF53
+#define STATE_VALID 1
+#define ERRORS_CONTINUE 1
+
+/* The blocks written (and hashed) at once */
+#define WRITE_BLOCKS 256
+
+/* The number of hash chains used to find hard links */
+#define LINK_CHAINS 4096
+
+typedef struct node node_t;
+
+struct node
+{
+    char* path; /* null for the lost+found directory that is added */
+    const char* name;
+    struct stat st;
+    node_t* parent;
+    node_t** children; /* sorted by name */
+    size_t num_children;
+    node_t* link;       /* the node that owns the inode of a hard link */
+    node_t* chain_next; /* the next node in the hard link hash chain */
+    ext2_ino_t ino;
+    uint16_t links;
+    uint64_t nblocks;  /* the data blocks (not counting indirect blocks) */
+    uint8_t* dir_data; /* the blocks of a directory */
+    char* target;      /* the target of a symbolic link */
+    bool placed;       /* whether the blocks have been allocated */
+};
+
+typedef enum run_kind
+{
+    RUN_DIR,
+    RUN_DATA,
+    RUN_SYMLINK,
+    RUN_INDIRECT,
+} run_kind_t;
+
+/* Consecutive blocks of the image that hold consecutive blocks of a node
+ * (or one indirect block) */
+typedef struct run
+{
+    uint64_t blkno;
+    uint64_t count;
+    run_kind_t kind;
+    node_t* node;
+    uint64_t index;  /* the node's first block in this run */
+    uint32_t* addrs; /* the contents of an indirect block */
+} run_t;
+
+typedef struct image
+{
+    node_t* root;
+    node_t** nodes; /* the nodes that own an inode (in inode order) */
+    ext2_ino_t ninodes;
+    node_t* chains[LINK_CHAINS];
+    bool large_file;
+
+    /* the geometry */
+    uint32_t group_count;
+    uint32_t inodes_per_group;
+    uint32_t gdt_blocks;
+    uint32_t itable_blocks;
+    uint64_t blocks_count;
+
+    /* the next block to allocate */
+    uint64_t next_block;
+
+    /* the allocated blocks (in block order) */
+    run_t* runs;
+    size_t num_runs;
+    size_t runs_capacity;
+
+    /* the metadata */
+    uint8_t* itable; /* all inode tables */
+    ext2_group_desc_t* groups;
+    ext2_super_block_t sb;
+} image_t;
+
+static void* _calloc(size_t n, size_t size)
+{
+    void* p;
+
+    if (!(p = calloc(n ? n : 1, size)))
+        _err("out of memory");
+
+    return p;
+}
+
+static uint64_t _div_round_up(uint64_t x, uint64_t m)
+{
+    return (x + m - 1) / m;
+}
+
+static bool _is_power_of(uint32_t x, uint32_t p)
+{
+    uint64_t n = p;
+
+    while (n < x)
+        n *= p;
+
+    return n == x;
+}
+
+/* Whether the group holds a copy of the superblock (with sparse_super) */
+static bool _has_super(uint32_t g)
+{
+    return g <= 1 || _is_power_of(g, 3) || _is_power_of(g, 5) ||
+           _is_power_of(g, 7);
+}
+
+static uint32_t _super_blocks(const image_t* img, uint32_t g)
+{
+    return _has_super(g) ? 1 + img->gdt_blocks : 0;
+}
+
+/* The metadata blocks at the start of the group */
+static uint32_t _overhead(const image_t* img, uint32_t g)
+{
+    return _super_blocks(img, g) + 2 + img->itable_blocks;
+}
+
+static ext2_inode_t* _inode(image_t* img, ext2_ino_t ino)
+{
+    return (ext2_inode_t*)(img->itable + (ino - 1) * INODE_SIZE);
+}
+
+static uint8_t _file_type(mode_t mode)
+{
+    switch (mode & S_IFMT)
+    {
+        case S_IFREG:
+            return EXT2_FT_REG_FILE;
+        case S_IFDIR:
+            return EXT2_FT_DIR;
+        case S_IFCHR:
+            return EXT2_FT_CHRDEV;
+        case S_IFBLK:
+            return EXT2_FT_BLKDEV;
+        case S_IFIFO:
+            return EXT2_FT_FIFO;
+        case S_IFSOCK:
+            return EXT2_FT_SOCK;
+        case S_IFLNK:
+            return EXT2_FT_SYMLINK;
+    }
+
+    return EXT2_FT_UNKNOWN;
+}
+
+/* The indirect blocks that map the first n blocks of a file */
+static uint64_t _indirect_blocks(uint64_t n)
+{
+    const uint64_t a = ADDRS_PER_BLOCK;
+    uint64_t count;
+
+    if (n <= NUM_DIRECT_BLOCKS)
+        return 0;
+
+    /* the single indirect block */
+    n -= NUM_DIRECT_BLOCKS;
+    count = 1;
+
+    if (n <= a)
+        return count;
+
+    /* the double indirect block and the blocks under it */
+    n -= a;
+    count += 1 + _div_round_up(n < a * a ? n : a * a, a);
+
+    if (n <= a * a)
+        return count;
+
+    /* the triple indirect block and the blocks under it */
+    n -= a * a;
+    count += 1 + _div_round_up(n, a * a) + _div_round_up(n, a);
+
+    return count;
+}
+
+/*
+**==============================================================================
+**
+** scanning the directory tree:
+**
+**==============================================================================
+*/
+
+static int _compare_nodes(const void* p1, const void* p2)
+{
+    const node_t* n1 = *(const node_t**)p1;
+    const node_t* n2 = *(const node_t**)p2;
+
+    return strcmp(n1->name, n2->name);
+}
+
+static void _add_child(node_t* dir, node_t* child)
+{
+    const size_t n = dir->num_children;
+
+    /* grow the array at powers of two */
+    if ((n & (n - 1)) == 0)
+    {
+        node_t** p;
+
+        if (!(p = realloc(dir->children, (n ? 2 * n : 1) * sizeof(node_t*))))
+            _err("out of memory");
+
+        dir->children = p;
+    }
+
+    dir->children[dir->num_children++] = child;
+    child->parent = dir;
+}
+
+static size_t _link_chain(const struct stat* st)
+{
+    return (st->st_ino ^ st->st_dev) % LINK_CHAINS;
+}
+
+/* Find the node that owns the inode if the file is another hard link */
+static node_t* _find_link(image_t* img, node_t* node)
+{
+    const size_t slot = _link_chain(&node->st);
+
+    for (node_t* p = img->chains[slot]; p; p = p->chain_next)
+    {
+        if (p->st.st_ino == node->st.st_ino && p->st.st_dev == node->st.st_dev)
+            return p;
+    }
+
+    node->chain_next = img->chains[slot];
+    img->chains[slot] = node;
+
+    return NULL;
+}
+
+static void _scan(image_t* img, node_t* dir)
+{
+    DIR* d;
+    struct dirent* ent;
+
+    if (!(d = opendir(dir->path)))
+        _err("failed to open directory: %s", dir->path);
+
+    while ((ent = readdir(d)))
+    {
+        node_t* node;
+
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        if (strlen(ent->d_name) > 255)
+            _err("file name is too long: %s/%s", dir->path, ent->d_name);
+
+        node = _calloc(1, sizeof(node_t));
+
+        if (asprintf(&node->path, "%s/%s", dir->path, ent->d_name) < 0)
+            _err("out of memory");
+
+        node->name = node->path + strlen(dir->path) + 1;
+
+        if (lstat(node->path, &node->st) != 0)
+            _err("failed to stat file: %s", node->path);
+
+        _add_child(dir, node);
+    }
+
+    closedir(d);
+
+    if (dir->num_children)
+    {
+        qsort(
+            dir->children,
+            dir->num_children,
+            sizeof(node_t*),
+            _compare_nodes);
+    }
+
+    for (size_t i = 0; i < dir->num_children; i++)
+    {
+        node_t* node = dir->children[i];
+        const mode_t type = node->st.st_mode & S_IFMT;
+
+        if (type != S_IFDIR && node->st.st_nlink > 1)
+            node->link = _find_link(img, node);
+
+        if (node->link)
+            continue;
+
+        if (type == S_IFDIR)
+        {
+            _scan(img, node);
+        }
+        else if (type == S_IFREG)
+        {
+            node->nblocks = _div_round_up(node->st.st_size, BLOCK_SIZE);
+
+            if (node->st.st_size > INT32_MAX)
+                img->large_file = true;
+        }
+        else if (type == S_IFLNK)
+        {
+            const size_t size = node->st.st_size;
+
+            if (size >= BLOCK_SIZE)
+                _err("symbolic link is too long: %s", node->path);
+
+            node->target = _calloc(1, size + 1);
+
+            if (readlink(node->path, node->target, size + 1) != (ssize_t)size)
+                _err("failed to read symbolic link: %s", node->path);
+
+            if (size >= FAST_SYMLINK_SIZE)
+                node->nblocks = 1;
+        }
+    }
+}
+
+/* Add the lost+found directory (unless the tree has one) */
+static void _add_lost_found(image_t* img)
+{
+    node_t* root = img->root;
+    node_t* node;
+
+    for (size_t i = 0; i < root->num_children; i++)
+    {
+        if (strcmp(root->children[i]->name, "lost+found") == 0)
+            return;
+    }
+
+    node = _calloc(1, sizeof(node_t));
+    node->name = "lost+found";
+    node->st.st_mode = S_IFDIR | 0700;
+    node->st.st_mtime = time(NULL);
+    _add_child(root, node);
+    qsort(root->children, root->num_children, sizeof(node_t*), _compare_nodes);
+}
+
+/* Number the inodes in depth-first order (the root has its own number and
+ * the others follow the reserved inodes) and count the links */
+static void _number(image_t* img, node_t* node)
+{
+    if (node->link)
+    {
+        node->link->links++;
+        return;
+    }
+
+    node->ino = node->parent ? ++img->ninodes : EXT2_ROOT_INO;
+    node->links = 1;
+    img->nodes[node->ino] = node;
+
+    if (S_ISDIR(node->st.st_mode))
+    {
+        /* counting "." (and the ".." of each subdirectory) */
+        node->links++;
+
+        if (node->parent && node->parent->links)
+            node->parent->links++;
+
+        for (size_t i = 0; i < node->num_children; i++)
+            _number(img, node->children[i]);
+    }
+}
+
+static size_t _count_nodes(const node_t* node)
+{
+    size_t n = 1;
+
+    for (size_t i = 0; i < node->num_children; i++)
+        n += _count_nodes(node->children[i]);
+
+    return n;
+}
+
+/*
+**==============================================================================
+**
+** planning the image:
+**
+**==============================================================================
+*/
+
+typedef struct dir_buf
+{
+    uint8_t* data;
+    size_t size;     /* a multiple of the block size */
+    size_t offset;   /* where the next entry goes */
+    size_t previous; /* the offset of the last entry */
+} dir_buf_t;
+
+static void _put_dirent(
+    dir_buf_t* buf,
+    ext2_ino_t ino,
+    const char* name,
+    uint8_t file_type)
+{
+    const size_t name_len = strlen(name);
+    const size_t rec_len = (8 + name_len + 3) / 4 * 4;
+    ext2_dirent_t* ent;
+
+    /* entries do not cross blocks (the last one of a block fills it) */
+    if (buf->offset + rec_len > buf->size)
+    {
+        if (buf->size)
+        {
+            ent = (ext2_dirent_t*)(buf->data + buf->previous);
+            ent->rec_len = (uint16_t)(buf->size - buf->previous);
+        }
+
+        buf->offset = buf->size;
+        buf->size += BLOCK_SIZE;
+
+        if (!(buf->data = realloc(buf->data, buf->size)))
+            _err("out of memory");
+
+        memset(buf->data + buf->offset, 0, BLOCK_SIZE);
+    }
+
+    ent = (ext2_dirent_t*)(buf->data + buf->offset);
+    ent->inode = ino;
+    ent->rec_len = (uint16_t)rec_len;
+    ent->name_len = (uint8_t)name_len;
+    ent->file_type = file_type;
+    memcpy(ent->name, name, name_len);
+
+    buf->previous = buf->offset;
+    buf->offset += rec_len;
+}
+
+static void _build_dir(node_t* dir)
+{
+    dir_buf_t buf = {NULL, 0, 0, 0};
+    const node_t* parent = dir->parent ? dir->parent : dir;
+    ext2_dirent_t* last;
+
+    _put_dirent(&buf, dir->ino, ".", EXT2_FT_DIR);
+    _put_dirent(&buf, parent->ino, "..", EXT2_FT_DIR);
+
+    for (size_t i = 0; i < dir->num_children; i++)
+    {
+        const node_t* child = dir->children[i];
+        const node_t* owner = child->link ? child->link : child;
+        const uint8_t type = _file_type(owner->st.st_mode);
+
+        _put_dirent(&buf, owner->ino, child->name, type);
+    }
+
+    last = (ext2_dirent_t*)(buf.data + buf.previous);
+    last->rec_len = (uint16_t)(buf.size - buf.previous);
+
+    dir->dir_data = buf.data;
+    dir->nblocks = buf.size / BLOCK_SIZE;
+}
+
+/* Choose the fewest groups that hold the data blocks and the inodes */
+static void _plan_geometry(image_t* img, uint64_t data_blocks, uint64_t min)
+{
+    for (uint32_t n = 1; n <= MAX_GROUPS; n++)
+    {
+        uint64_t ipg = _div_round_up(img->ninodes, n);
+        uint64_t overhead = 0;
+        uint64_t total;
+        uint64_t last;
+
+        ipg = _div_round_up(ipg, INODES_PER_BLOCK) * INODES_PER_BLOCK;
+
+        /* the inode bitmap is one block */
+        if (ipg > 8 * BLOCK_SIZE)
+            continue;
+
+        img->group_count = n;
+        img->inodes_per_group = (uint32_t)ipg;
+        img->gdt_blocks = (uint32_t)_div_round_up(n, DESCS_PER_BLOCK);
+        img->itable_blocks = (uint32_t)(ipg / INODES_PER_BLOCK);
+
+        for (uint32_t g = 0; g < n; g++)
+            overhead += _overhead(img, g);
+
+        if ((total = overhead + data_blocks) < min)
+            total = min;
+
+        if (total > (uint64_t)n * BLOCKS_PER_GROUP)
+            continue;
+
+        /* the last group holds at least its metadata and one block */
+        last = total - (uint64_t)(n - 1) * BLOCKS_PER_GROUP;
+
+        if (last <= _overhead(img, n - 1))
+            total += _overhead(img, n - 1) + 1 - last;
+
+        img->blocks_count = total;
+        return;
+    }
+
+    _err("image is too big");
+}
+
+static uint64_t _alloc_block(image_t* img)
+{
+    const uint32_t g = img->next_block / BLOCKS_PER_GROUP;
+    const uint64_t start = (uint64_t)g * BLOCKS_PER_GROUP;
+
+    /* skip the metadata at the start of the group */
+    if (img->next_block < start + _overhead(img, g))
+        img->next_block = start + _overhead(img, g);
+
+    if (img->next_block >= img->blocks_count)
+        _err("unexpected: image is full");
+
+    return img->next_block++;
+}
+
+static void _add_run(
+    image_t* img,
+    run_kind_t kind,
+    uint64_t blkno,
+    node_t* node,
+    uint64_t index,
+    uint32_t* addrs)
+{
+    run_t* run = img->num_runs ? &img->runs[img->num_runs - 1] : NULL;
+
+    /* extend the last run if this block follows it */
+    if (run && kind != RUN_INDIRECT && run->kind == kind && run->node == node &&
+        run->blkno + run->count == blkno && run->index + run->count == index)
+    {
+        run->count++;
+        return;
+    }
+
+    if (img->num_runs == img->runs_capacity)
+    {
+        const size_t n = img->runs_capacity ? 2 * img->runs_capacity : 1024;
+
+        if (!(img->runs = realloc(img->runs, n * sizeof(run_t))))
+            _err("out of memory");
+
+        img->runs_capacity = n;
+    }
+
+    run = &img->runs[img->num_runs++];
+    run->blkno = blkno;
+    run->count = 1;
+    run->kind = kind;
+    run->node = node;
+    run->index = index;
+    run->addrs = addrs;
+}
+
+static uint32_t* _alloc_indirect(image_t* img, uint32_t* slot)
+{
+    uint32_t* addrs = _calloc(ADDRS_PER_BLOCK, sizeof(uint32_t));
+
+    *slot = (uint32_t)_alloc_block(img);
+    _add_run(img, RUN_INDIRECT, *slot, NULL, 0, addrs);
+
+    return addrs;
+}
+
+/* Allocate the blocks of the node (and the indirect blocks that map them) */
+static void _place(image_t* img, node_t* node, run_kind_t kind)
+{
+    const uint64_t a = ADDRS_PER_BLOCK;
+    ext2_inode_t* inode = _inode(img, node->ino);
+    uint32_t* ind = NULL;  /* the single indirect block being filled */
+    uint32_t* dind = NULL; /* the double indirect block being filled */
+    uint32_t* tind = NULL; /* the triple indirect block */
+
+    node->placed = true;
+
+    for (uint64_t i = 0; i < node->nblocks; i++)
+    {
+        uint64_t j = i - NUM_DIRECT_BLOCKS;
+        uint32_t* slot;
+
+        if (i < NUM_DIRECT_BLOCKS)
+        {
+            slot = &inode->i_block[i];
+        }
+        else if (j < a)
+        {
+            if (j == 0)
+                ind = _alloc_indirect(img, &inode->i_block[12]);
+
+            slot = &ind[j];
+        }
+        else if ((j -= a) < a * a)
+        {
+            if (j == 0)
+                dind = _alloc_indirect(img, &inode->i_block[13]);
+
+            if (j % a == 0)
+                ind = _alloc_indirect(img, &dind[j / a]);
+
+            slot = &ind[j % a];
+        }
+        else
+        {
+            j -= a * a;
+
+            if (j == 0)
+                tind = _alloc_indirect(img, &inode->i_block[14]);
+
+            if (j % (a * a) == 0)
+                dind = _alloc_indirect(img, &tind[j / (a * a)]);
+
+            if (j % a == 0)
+                ind = _alloc_indirect(img, &dind[(j / a) % a]);
+
+            slot = &ind[j % a];
+        }
+
+        *slot = (uint32_t)_alloc_block(img);
+        _add_run(img, kind, *slot, node, i, NULL);
+    }
+
+    inode->i_blocks = (node->nblocks + _indirect_blocks(node->nblocks)) *
+                      (BLOCK_SIZE / 512);
+}
+
+static void _place_dirs(image_t* img, node_t* node)
+{
+    if (!S_ISDIR(node->st.st_mode) || node->link)
+        return;
+
+    _place(img, node, RUN_DIR);
+
+    for (size_t i = 0; i < node->num_children; i++)
+        _place_dirs(img, node->children[i]);
+}
+
+static void _place_file(image_t* img, node_t* node)
+{
+    if (node->link)
+        node = node->link;
+
+    if (node->placed || !node->nblocks)
+        return;
+
+    if (S_ISREG(node->st.st_mode))
+        _place(img, node, RUN_DATA);
+    else if (S_ISLNK(node->st.st_mode))
+        _place(img, node, RUN_SYMLINK);
+}
+
+static void _place_files(image_t* img, node_t* node)
+{
+    _place_file(img, node);
+
+    for (size_t i = 0; i < node->num_children; i++)
+        _place_files(img, node->children[i]);
+}
+
+static node_t* _find_child(node_t* dir, const char* name)
+{
+    node_t key;
+    node_t* p = &key;
+    node_t** found;
+
+    if (!dir->num_children)
+        return NULL;
+
+    key.name = name;
+    found = bsearch(
+        &p, dir->children, dir->num_children, sizeof(node_t*), _compare_nodes);
+
+    return found ? *found : NULL;
+}
+
+/* Find the node for a path relative to the top directory */
+static node_t* _find_path(image_t* img, char* path)
+{
+    node_t* node = img->root;
+    char* save = NULL;
+    char* p;
+
+    for (p = strtok_r(path, "/", &save); p; p = strtok_r(NULL, "/", &save))
+    {
+        if (strcmp(p, ".") == 0)
+            continue;
+
+        if (!(node = _find_child(node, p)))
+            return NULL;
+    }
+
+    return node;
+}
+
+/* Place the files named by the order file (one path per line) */
+static void _place_ordered_files(image_t* img, const char* order_file)
+{
+    FILE* is;
+    char* line = NULL;
+    size_t n = 0;
+
+    if (!(is = fopen(order_file, "r")))
+        _err("failed to open file for read: %s", order_file);
+
+    while (getline(&line, &n, is) > 0)
+    {
+        const size_t len = strcspn(line, "\r\n");
+        node_t* node;
+
+        line[len] = '\0';
+
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        /* ignore paths that are not in the tree */
+        if ((node = _find_path(img, line)))
+            _place_file(img, node);
+    }
+
+    free(line);
+    fclose(is);
+}
+
+static void _init_inode(image_t* img, node_t* node)
+{
+    ext2_inode_t* inode = _inode(img, node->ino);
+    const struct stat* st = &node->st;
+    const uint16_t uid_high = (uint16_t)(st->st_uid >> 16);
+    const uint16_t gid_high = (uint16_t)(st->st_gid >> 16);
+    const uint32_t major = major(st->st_rdev);
+    const uint32_t minor = minor(st->st_rdev);
+
+    inode->i_mode = (uint16_t)st->st_mode;
+    inode->i_uid = (uint16_t)st->st_uid;
+    inode->i_gid = (uint16_t)st->st_gid;
+    inode->i_atime = (uint32_t)st->st_mtime;
+    inode->i_ctime = (uint32_t)st->st_mtime;
+    inode->i_mtime = (uint32_t)st->st_mtime;
+    inode->i_links_count = node->links;
+
+    /* the Linux fields of osd2: l_i_uid_high and l_i_gid_high */
+    memcpy(&inode->i_osd2[4], &uid_high, sizeof(uid_high));
+    memcpy(&inode->i_osd2[6], &gid_high, sizeof(gid_high));
+
+    switch (st->st_mode & S_IFMT)
+    {
+        case S_IFREG:
+        {
+            inode->i_size = (uint32_t)st->st_size;
+            inode->i_dir_acl = (uint32_t)((uint64_t)st->st_size >> 32);
+            break;
+        }
+        case S_IFDIR:
+        {
+            inode->i_size = (uint32_t)(node->nblocks * BLOCK_SIZE);
+            break;
+        }
+        case S_IFLNK:
+        {
+            inode->i_size = (uint32_t)strlen(node->target);
+
+            /* a fast symbolic link keeps its target in the inode */
+            if (!node->nblocks)
+                memcpy(inode->i_block, node->target, inode->i_size);
+
+            break;
+        }
+        case S_IFCHR:
+        case S_IFBLK:
+        {
+            /* the old encoding if it fits (as Linux does) */
+            if (major < 256 && minor < 256)
+                inode->i_block[0] = (major << 8) | minor;
+            else
+                inode->i_block[1] =
+                    (minor & 0xff) | (major << 8) | ((minor & ~0xffU) << 12);
+
+            break;
+        }
+    }
+}
+
+static void _plan(
+    image_t* img,
+    const char* order_file,
+    size_t free_size,
+    size_t min_size)
+{
+    uint64_t data_blocks = 0;
+    size_t max_nodes;
+
+    /* number the inodes */
+    max_nodes = _count_nodes(img->root) + EXT2_FIRST_INO;
+    img->nodes = _calloc(max_nodes, sizeof(node_t*));
+    img->ninodes = EXT2_FIRST_INO - 1;
+    _number(img, img->root);
+
+    /* build the directories and count the blocks */
+    for (ext2_ino_t ino = EXT2_ROOT_INO; ino <= img->ninodes; ino++)
+    {
+        node_t* node = img->nodes[ino];
+
+        if (!node)
+            continue;
+
+        if (S_ISDIR(node->st.st_mode))
+            _build_dir(node);
+
+        data_blocks += node->nblocks + _indirect_blocks(node->nblocks);
+    }
+
+    data_blocks += _div_round_up(free_size, BLOCK_SIZE);
+    _plan_geometry(img, data_blocks, _div_round_up(min_size, BLOCK_SIZE));
+
+    img->itable = _calloc(
+        (size_t)img->group_count * img->inodes_per_group * INODE_SIZE +
+            sizeof(ext2_inode_t), /* as _inode() may point at the last one */
+        1);
+
+    for (ext2_ino_t ino = EXT2_ROOT_INO; ino <= img->ninodes; ino++)
+    {
+        if (img->nodes[ino])
+            _init_inode(img, img->nodes[ino]);
+    }
+
+    /* allocate the blocks: directories, ordered files and other files */
+    _place_dirs(img, img->root);
+
+    if (order_file)
+        _place_ordered_files(img, order_file);
+
+    _place_files(img, img->root);
+}
+
+/*
+**==============================================================================
+**
+** writing the image:
+**
+**==============================================================================
+*/
+
+static bool _block_in_use(const image_t* img, uint64_t blkno)
+{
+    const uint32_t g = blkno / BLOCKS_PER_GROUP;
+    const uint64_t start = (uint64_t)g * BLOCKS_PER_GROUP;
+
+    return blkno < img->next_block || blkno >= img->blocks_count ||
+           blkno < start + _overhead(img, g);
+}
+
+static void _init_metadata(image_t* img)
+{
+    ext2_super_block_t* sb = &img->sb;
+    uint64_t free_blocks = 0;
+    uint64_t free_inodes = 0;
+
+    img->groups = _calloc(img->gdt_blocks, BLOCK_SIZE);
+
+    for (uint32_t g = 0; g < img->group_count; g++)
+    {
+        ext2_group_desc_t* gd = &img->groups[g];
+        const uint64_t start = (uint64_t)g * BLOCKS_PER_GROUP;
+        const uint64_t end = start + BLOCKS_PER_GROUP < img->blocks_count
+                                 ? start + BLOCKS_PER_GROUP
+                                 : img->blocks_count;
+        const uint64_t first_ino = (uint64_t)g * img->inodes_per_group + 1;
+        uint64_t used_inodes = 0;
+        uint64_t cur = start + _overhead(img, g);
+
+        gd->bg_block_bitmap = (uint32_t)(start + _super_blocks(img, g));
+        gd->bg_inode_bitmap = gd->bg_block_bitmap + 1;
+        gd->bg_inode_table = gd->bg_block_bitmap + 2;
+
+        /* the blocks from the next one to allocate are free */
+        if (img->next_block > cur)
+            cur = img->next_block < end ? img->next_block : end;
+
+        gd->bg_free_blocks_count = (uint16_t)(end - cur);
+
+        if (img->ninodes >= first_ino)
+        {
+            used_inodes = img->ninodes - first_ino + 1;
+
+            if (used_inodes > img->inodes_per_group)
+                used_inodes = img->inodes_per_group;
+        }
+
+        gd->bg_free_inodes_count =
+            (uint16_t)(img->inodes_per_group - used_inodes);
+
+        for (uint64_t i = 0; i < used_inodes; i++)
+        {
+            const node_t* node = img->nodes[first_ino + i];
+
+            if (node && S_ISDIR(node->st.st_mode))
+                gd->bg_used_dirs_count++;
+        }
+
+        free_blocks += gd->bg_free_blocks_count;
+        free_inodes += gd->bg_free_inodes_count;
+    }
+
+    sb->s_inodes_count = img->group_count * img->inodes_per_group;
+    sb->s_blocks_count = (uint32_t)img->blocks_count;
+    sb->s_free_blocks_count = (uint32_t)free_blocks;
+    sb->s_free_inodes_count = (uint32_t)free_inodes;
+    sb->s_first_data_block = 0;
+    sb->s_log_block_size = LOG_BLOCK_SIZE;
+    sb->s_log_frag_size = LOG_BLOCK_SIZE;
+    sb->s_blocks_per_group = BLOCKS_PER_GROUP;
+    sb->s_frags_per_group = BLOCKS_PER_GROUP;
+    sb->s_inodes_per_group = img->inodes_per_group;
+    sb->s_wtime = (uint32_t)time(NULL);
+    sb->s_lastcheck = sb->s_wtime;
+    sb->s_max_mnt_count = 0xffff;
+    sb->s_magic = SUPER_MAGIC;
+    sb->s_state = STATE_VALID;
+    sb->s_errors = ERRORS_CONTINUE;
+    sb->s_rev_level = EXT2_DYNAMIC_REV;
+    sb->s_first_ino = EXT2_FIRST_INO;
+    sb->s_inode_size = INODE_SIZE;
+    sb->s_feature_incompat = EXT2_FEATURE_INCOMPAT_FILETYPE;
+    sb->s_feature_ro_compat = EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER;
+    sb->s_def_hash_version = EXT2_HASH_HALF_MD4;
+
+    if (img->large_file)
+        sb->s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+
+    if (getrandom(sb->s_uuid, sizeof(sb->s_uuid), 0) != sizeof(sb->s_uuid) ||
+        getrandom(sb->s_hash_seed, sizeof(sb->s_hash_seed), 0) !=
+            sizeof(sb->s_hash_seed))
+    {
+        _err("failed to get random bytes");
+    }
+}
+
+/* Fill in a metadata block (returning false for other blocks) */
+static bool _get_metadata(image_t* img, uint64_t blkno, uint8_t* block)
+{
+    const uint32_t g = blkno / BLOCKS_PER_GROUP;
+    const uint64_t start = (uint64_t)g * BLOCKS_PER_GROUP;
+    const uint64_t off = blkno - start;
+    const uint32_t super_blocks = _super_blocks(img, g);
+
+    if (off >= _overhead(img, g))
+        return false;
+
+    if (super_blocks && off == 0)
+    {
+        /* the first group's superblock follows the boot block */
+        const size_t offset = g == 0 ? EXT2_BASE_OFFSET : 0;
+
+        img->sb.s_block_group_nr = (uint16_t)g;
+        memcpy(block + offset, &img->sb, sizeof(img->sb));
+    }
+    else if (off < super_blocks)
+    {
+        const uint8_t* gdt = (const uint8_t*)img->groups;
+        memcpy(block, gdt + (off - 1) * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    else if (off == super_blocks)
+    {
+        /* the block bitmap */
+        for (uint32_t i = 0; i < BLOCKS_PER_GROUP; i++)
+        {
+            if (_block_in_use(img, start + i))
+                block[i / 8] |= (uint8_t)(1 << (i % 8));
+        }
+    }
+    else if (off == super_blocks + 1)
+    {
+        /* the inode bitmap (where the bits past the table are set) */
+        const uint64_t first_ino = (uint64_t)g * img->inodes_per_group + 1;
+
+        for (uint32_t i = 0; i < 8 * BLOCK_SIZE; i++)
+        {
+            if (i >= img->inodes_per_group || first_ino + i <= img->ninodes)
+                block[i / 8] |= (uint8_t)(1 << (i % 8));
+        }
+    }
+    else
+    {
+        const uint64_t i = off - super_blocks - 2;
+        const size_t size = (size_t)img->inodes_per_group * INODE_SIZE;
+        const uint8_t* table = img->itable + g * size;
+
+        memcpy(block, table + i * BLOCK_SIZE, BLOCK_SIZE);
+    }
+
+    return true;
+}
+
+/* Read part of a file into the block (zero-filling the rest) */
+static void _read_data(int fd, const node_t* node, uint64_t index, void* block)
+{
+    const off_t offset = (off_t)(index * BLOCK_SIZE);
+    size_t n = BLOCK_SIZE;
+
+    if ((uint64_t)node->st.st_size - offset < n)
+        n = node->st.st_size - offset;
+
+    if (pread(fd, block, n, offset) != (ssize_t)n)
+        _err("failed to read file (did it change?): %s", node->path);
+}
+
+static void _write_image(image_t* img, const char* image, hashtree_t* hashtree)
+{
+    const size_t bufsize = WRITE_BLOCKS * BLOCK_SIZE;
+    uint8_t* buf = _calloc(WRITE_BLOCKS, BLOCK_SIZE);
+    const node_t* open_node = NULL;
+    size_t r = 0;
+    int fd = -1;
+    FILE* os;
+
+    if (!(os = fopen(image, "wb")))
+        _err("failed to open file for write: %s", image);
+
+    for (uint64_t blkno = 0; blkno < img->blocks_count;)
+    {
+        size_t n = WRITE_BLOCKS;
+
+        if (n > img->blocks_count - blkno)
+            n = img->blocks_count - blkno;
+
+        memset(buf, 0, bufsize);
+
+        for (size_t i = 0; i < n; i++, blkno++)
+        {
+            uint8_t* block = buf + i * BLOCK_SIZE;
+            const run_t* run;
+            uint64_t index;
+
+            if (_get_metadata(img, blkno, block))
+                continue;
+
+            while (r < img->num_runs &&
+                   img->runs[r].blkno + img->runs[r].count <= blkno)
+            {
+                r++;
+            }
+
+            /* the free blocks are zero-filled */
+            if (r == img->num_runs || img->runs[r].blkno > blkno)
+                continue;
+
+            run = &img->runs[r];
+            index = run->index + (blkno - run->blkno);
+
+            switch (run->kind)
+            {
+                case RUN_DIR:
+                {
+                    const uint8_t* p = run->node->dir_data;
+                    memcpy(block, p + index * BLOCK_SIZE, BLOCK_SIZE);
+                    break;
+                }
+                case RUN_SYMLINK:
+                {
+                    strcpy((char*)block, run->node->target);
+                    break;
+                }
+                case RUN_INDIRECT:
+                {
+                    memcpy(block, run->addrs, BLOCK_SIZE);
+                    break;
+                }
+                case RUN_DATA:
+                {
+                    if (run->node != open_node)
+                    {
+                        if (fd >= 0)
+                            close(fd);
+
+                        if ((fd = open(run->node->path, O_RDONLY)) < 0)
+                            _err("failed to open file: %s", run->node->path);
+
+                        open_node = run->node;
+                    }
+
+                    _read_data(fd, run->node, index, block);
+                    break;
+                }
+            }
+        }
+
+        if (fwrite(buf, BLOCK_SIZE, n, os) != n)
+            _err("failed to write file: %s", image);
+
+        if (hashtree)
+            hashtree_add_blocks(hashtree, buf, n);
+    }
+
+    if (fd >= 0)
+        close(fd);
+
+    if (fclose(os) != 0)
+        _err("failed to write file: %s", image);
+
+    free(buf);
+}
+
+static void _free_node(node_t* node)
+{
+    for (size_t i = 0; i < node->num_children; i++)
+        _free_node(node->children[i]);
+
+    free(node->children);
+    free(node->dir_data);
+    free(node->target);
+    free(node->path);
+    free(node);
+}
+
+size_t ext2image_write(
+    const char* dirname,
+    const char* image,
+    const char* order_file,
+    size_t free_size,
+    size_t min_size,
+    hashtree_t* hashtree)
+{
+    image_t img;
+    size_t size;
+
+    memset(&img, 0, sizeof(img));
+
+    /* scan the directory tree */
+    img.root = _calloc(1, sizeof(node_t));
+
+    if (!(img.root->path = strdup(dirname)))
+        _err("out of memory");
+
+    img.root->name = "";
+
+    if (stat(dirname, &img.root->st) != 0 || !S_ISDIR(img.root->st.st_mode))
+        _err("no such directory: %s", dirname);
+
+    _scan(&img, img.root);
+    _add_lost_found(&img);
+
+    _plan(&img, order_file, free_size, min_size);
+    _init_metadata(&img);
+    _write_image(&img, image, hashtree);
+
+    size = img.blocks_count * BLOCK_SIZE;
+
+    for (size_t i = 0; i < img.num_runs; i++)
+        free(img.runs[i].addrs);
+
+    free(img.runs);
+    free(img.groups);
+    free(img.itable);
+    free(img.nodes);
+    _free_node(img.root);
+
+    return size;
+}
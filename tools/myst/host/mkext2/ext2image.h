@@ -0,0 +1,24 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_MKEXT2_EXT2IMAGE_H
+#define _MYST_MKEXT2_EXT2IMAGE_H
+
+#include <stddef.h>
+
+#include "hashtree.h"
+
+/* Write the directory tree as an ext2 image without mounting anything (see
+ * ext2image.c) and return the size of the image. The image has free_size
+ * bytes of free blocks and is at least min_size bytes. The files named by
+ * order_file (if any) are laid out first. If hashtree is not null then the
+ * blocks are added to it as they are written. */
+size_t ext2image_write(
+    const char* dirname,
+    const char* image,
+    const char* order_file,
+    size_t free_size,
+    size_t min_size,
+    hashtree_t* hashtree);
+
+#endif /* _MYST_MKEXT2_EXT2IMAGE_H */
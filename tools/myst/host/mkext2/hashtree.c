@@ -0,0 +1,204 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include "../utils.h"
+#include "hashtree.h"
+
+#define SALT_SIZE 32
+
+/* The hashes that fit in a hash block */
+#define DIGESTS_PER_BLOCK (HASHTREE_BLOCK_SIZE / sizeof(myst_sha256_t))
+
+/* Blocks read by one call when hashing a file (1 MB) */
+#define READ_BLOCKS 256
+
+static void _get_random(void* buf, size_t size)
+{
+    if (getrandom(buf, size, 0) != (ssize_t)size)
+        _err("failed to get random bytes");
+}
+
+void hashtree_init(hashtree_t* ht)
+{
+    memset(ht, 0, sizeof(hashtree_t));
+    memcpy(ht->sb.signature, "verity\0\0", sizeof(ht->sb.signature));
+    ht->sb.version = 1;
+    ht->sb.hash_type = 1;
+    strcpy(ht->sb.algorithm, "sha256");
+    ht->sb.data_block_size = HASHTREE_BLOCK_SIZE;
+    ht->sb.hash_block_size = HASHTREE_BLOCK_SIZE;
+    ht->sb.salt_size = SALT_SIZE;
+    _get_random(ht->sb.uuid, sizeof(ht->sb.uuid));
+    _get_random(ht->sb.salt, SALT_SIZE);
+}
+
+void hashtree_add_blocks(hashtree_t* ht, const void* blocks, size_t count)
+{
+    if (ht->num_leaves + count > ht->capacity)
+    {
+        size_t capacity = ht->capacity ? ht->capacity : 1024;
+        myst_sha256_t* leaves;
+
+        while (capacity < ht->num_leaves + count)
+            capacity *= 2;
+
+        if (!(leaves = realloc(ht->leaves, capacity * sizeof(*leaves))))
+            _err("out of memory");
+
+        ht->leaves = leaves;
+        ht->capacity = capacity;
+    }
+
+    if (myst_sha256_n(
+            ht->leaves + ht->num_leaves,
+            ht->sb.salt,
+            SALT_SIZE,
+            blocks,
+            HASHTREE_BLOCK_SIZE,
+            count) != 0)
+    {
+        _err("failed to compute hash");
+    }
+
+    ht->num_leaves += count;
+}
+
+void hashtree_add_file(hashtree_t* ht, const char* path, size_t size)
+{
+    const size_t bufsize = READ_BLOCKS * HASHTREE_BLOCK_SIZE;
+    FILE* is;
+    uint8_t* buf;
+
+    if (size % HASHTREE_BLOCK_SIZE)
+        _err("image size is not a multiple of %u", HASHTREE_BLOCK_SIZE);
+
+    if (!(buf = malloc(bufsize)))
+        _err("out of memory");
+
+    if (!(is = fopen(path, "rb")))
+        _err("failed to open file for read: %s", path);
+
+    while (size)
+    {
+        const size_t n = size < bufsize ? size : bufsize;
+
+        if (fread(buf, 1, n, is) != n)
+            _err("failed to read file: %s", path);
+
+        hashtree_add_blocks(ht, buf, n / HASHTREE_BLOCK_SIZE);
+        size -= n;
+    }
+
+    fclose(is);
+    free(buf);
+}
+
+/* Pack the hashes into zero-padded hash blocks (returning how many) */
+static uint8_t* _pack(const myst_sha256_t* hashes, size_t n, size_t* nblocks)
+{
+    uint8_t* blocks;
+
+    *nblocks = (n + DIGESTS_PER_BLOCK - 1) / DIGESTS_PER_BLOCK;
+
+    if (!(blocks = calloc(*nblocks, HASHTREE_BLOCK_SIZE)))
+        _err("out of memory");
+
+    memcpy(blocks, hashes, n * sizeof(myst_sha256_t));
+
+    return blocks;
+}
+
+void hashtree_append(
+    hashtree_t* ht,
+    const char* path,
+    myst_sha256_t* root_hash)
+{
+    /* the levels from the leaves up, where the last has one block */
+    uint8_t* levels[64];
+    size_t sizes[64];
+    size_t nlevels = 0;
+    FILE* os;
+
+    if (ht->num_leaves == 0)
+        _err("unexpected: empty image: %s", path);
+
+    ht->sb.data_blocks = ht->num_leaves;
+
+    /* build the levels (each holds the hashes of the blocks below it) */
+    {
+        const myst_sha256_t* hashes = ht->leaves;
+        myst_sha256_t* next = NULL;
+        size_t n = ht->num_leaves;
+
+        do
+        {
+            if (nlevels == sizeof(levels) / sizeof(levels[0]))
+                _err("unexpected: hash tree is too deep");
+
+            levels[nlevels] = _pack(hashes, n, &sizes[nlevels]);
+            n = sizes[nlevels];
+
+            free(next);
+
+            if (!(next = malloc(n * sizeof(myst_sha256_t))))
+                _err("out of memory");
+
+            if (myst_sha256_n(
+                    next,
+                    ht->sb.salt,
+                    SALT_SIZE,
+                    levels[nlevels],
+                    HASHTREE_BLOCK_SIZE,
+                    n) != 0)
+            {
+                _err("failed to compute hash");
+            }
+
+            hashes = next;
+            nlevels++;
+        } while (n > 1);
+
+        /* the root hash is the hash of the top block */
+        *root_hash = next[0];
+        free(next);
+    }
+
+    if (!(os = fopen(path, "ab")))
+        _err("cannot open file for write: %s", path);
+
+    /* the superblock takes the first hash block */
+    {
+        uint8_t block[HASHTREE_BLOCK_SIZE];
+
+        memset(block, 0, sizeof(block));
+        memcpy(block, &ht->sb, sizeof(ht->sb));
+
+        if (fwrite(block, 1, sizeof(block), os) != sizeof(block))
+            _err("failed to write file: %s", path);
+    }
+
+    /* the levels follow from the top down */
+    for (size_t i = nlevels; i > 0; i--)
+    {
+        const size_t n = sizes[i - 1] * HASHTREE_BLOCK_SIZE;
+
+        if (fwrite(levels[i - 1], 1, n, os) != n)
+            _err("failed to write file: %s", path);
+
+        free(levels[i - 1]);
+    }
+
+    if (fclose(os) != 0)
+        _err("failed to write file: %s", path);
+}
+
+void hashtree_free(hashtree_t* ht)
+{
+    free(ht->leaves);
+    memset(ht, 0, sizeof(hashtree_t));
+}
@@ -0,0 +1,42 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_MKEXT2_HASHTREE_H
+#define _MYST_MKEXT2_HASHTREE_H
+
+#include <stddef.h>
+
+#include <myst/sha256.h>
+#include <myst/verity.h>
+
+/* The data and hash block size (the only one that Mystikos supports) */
+#define HASHTREE_BLOCK_SIZE 4096
+
+/* Builds the dm-verity hash tree of an image as its blocks are given, in the
+ * layout of "veritysetup format" (the superblock and then the levels) */
+typedef struct hashtree
+{
+    myst_verity_sb_t sb;
+    myst_sha256_t* leaves; /* the salted hash of each data block */
+    size_t num_leaves;
+    size_t capacity;
+} hashtree_t;
+
+/* Start a new tree with a random salt */
+void hashtree_init(hashtree_t* ht);
+
+/* Hash the next count data blocks (of HASHTREE_BLOCK_SIZE bytes each) */
+void hashtree_add_blocks(hashtree_t* ht, const void* blocks, size_t count);
+
+/* Hash the first size bytes of the file (a multiple of the block size) */
+void hashtree_add_file(hashtree_t* ht, const char* path, size_t size);
+
+/* Append the tree to the file (just after the data blocks) */
+void hashtree_append(
+    hashtree_t* ht,
+    const char* path,
+    myst_sha256_t* root_hash);
+
+void hashtree_free(hashtree_t* ht);
+
+#endif /* _MYST_MKEXT2_HASHTREE_H */
@@ -12,11 +12,15 @@
 #include <myst/fssig.h>
 #include <myst/getopt.h>
 #include <myst/hex.h>
+#include <myst/lz.h>
 #include <myst/paths.h>
 #include <myst/sha256.h>
 #include <myst/strings.h>
+#include <myst/zimage.h>
 #include <oeprivate/rsa.h>
 #include "../utils.h"
+#include "ext2image.h"
+#include "hashtree.h"
 
 typedef enum _oe_result
 {
@@ -30,36 +34,44 @@ static bool _trace = false;
 Usage: %s %s [options] <directory> <disk-image>\n\
 \n\
 Synopsis:\n\
-    This tool converts a directory into an ext2 disk image. The image is\n\
+    This tool converts a directory into an ext2 disk image (without\n\
+    mounting it, except to encrypt it). The image is\n\
     integrity-protected by appending a hash tree. The image may also be\n\
-    encrypted (--encrypt) and/or digitally signed (--sign). This tool\n\
-    employs standard Linux tools so that the image may be mounted by\n\
-    Linux as well as Mystikos.\n\
+    encrypted (--encrypt) or compressed (--compress), and it may be\n\
+    digitally signed (--sign). This tool employs standard Linux tools so\n\
+    that the image may be mounted by Linux as well as Mystikos (except\n\
+    for compressed images, which only Mystikos can mount).\n\
 \n\
 Examples:\n\
     $ %s %s <dir> <image>\n\
     $ %s %s --encrypt=<keyfile> <dir> <image>\n\
     $ %s %s --encrypt=<keyfile> -sign=<pubkey>:<privkey> <dir> <image>\n\
+    $ %s %s --compress <dir> <image>\n\
 \n\
     These examples respectively generate the following disk image layouts.\n\
 \n\
     [EXT2|HASH-TREE|FSSIG]\n\
-    [LUKS1-HEADERS|ENCRYPTED-EXT2|HASH-TREE|FSSIG]\n\
-    [LUKS1-HEADERS|ENCRYPTED-EXT2|HASH-TREE|FSSIG]\n\
+    [LUKS2-HEADERS|ENCRYPTED-EXT2|HASH-TREE|FSSIG]\n\
+    [LUKS2-HEADERS|ENCRYPTED-EXT2|HASH-TREE|FSSIG]\n\
+    [COMPRESSED-EXT2|HASH-TREE|FSSIG]\n\
 \n\
 Options:\n\
     -h, --help                  Print this help message\n\
-    --size=<size>               Size of the image in bytes\n\
+    --size=<size>               Least size of the image in bytes\n\
+    --order=<file>              Lay out the files listed in <file> first\n\
+    --layout-profile=<file>     Same as --order (for the file written by\n\
+                                myst exec --layout-profile)\n\
     --encrypt=<keyfile>         Encrypt image with the given binary key file\n\
     --passphrase=<keystr>       Add LUKS key slot with this passphrase\n\
     --sign=<pubkey:privkey>     Sign image with public and private key (PEM)\n\
+    --compress                  Compress image (read a chunk at a time)\n\
     --force                     Overwrite existing disk image without asking\n\
     --trace                     Enable tracing\n\
 \n"
 
 static void _print_usage(const char* arg0, const char* arg1)
 {
-    printf(USAGE, arg0, arg1, arg0, arg1, arg0, arg1, arg0, arg1);
+    printf(USAGE, arg0, arg1, arg0, arg1, arg0, arg1, arg0, arg1, arg0, arg1);
 }
 
 static int _getopt(
@@ -92,6 +104,9 @@ static void _check_regular_file(const char* path)
 
 #define MIN_PASSPHRASE_LENGTH 14
 
+/* The free space in a new image (for files written at run time) */
+#define FREE_SPACE_SIZE (8 * 1024 * 1024)
+
 static void _rtrim(char* str)
 {
     char* p = str + strlen(str);
@@ -178,60 +193,6 @@ __attribute__((format(printf, 1, 2))) static void _systemf(const char* fmt, ...)
     free(cmd);
 }
 
-static void _create_zero_filled_image(const char* path, size_t size)
-{
-    FILE* is;
-    static uint8_t _block[1024];
-
-    if (size < sizeof(_block))
-        _err("image size too small: %s: %zu", path, sizeof(_block));
-
-    if (!(is = fopen(path, "wb")))
-        _err("failed to open file for write: %s", path);
-
-    if (fseek(is, size - sizeof(_block), SEEK_SET) != 0)
-        _err("failed to seek file: %s: %zu", path, size);
-
-    if (fwrite(_block, 1, sizeof(_block), is) != sizeof(_block))
-        _err("failed to write file: %s", path);
-
-    fclose(is);
-}
-
-static void _create_ext2_image(
-    const char* dirname,
-    const char* image,
-    size_t size)
-{
-    char loop[PATH_MAX];
-    char mntdir[] = "/tmp/mystXXXXXX";
-
-    /* create a zero-filled image with holes */
-    _create_zero_filled_image(image, size);
-
-    /* format the ext2 file system */
-    _systemf("/sbin/mke2fs -q %s", image);
-
-    /* associate the image with a loopback device */
-    _execf(loop, sizeof(loop), "/sbin/losetup --show -f %s", image);
-
-    /* create the mount directory */
-    if (!mkdtemp(mntdir))
-        _err("failed to create temporary directory");
-
-    /* mount the ext2 image */
-    _systemf("/bin/mount %s %s", loop, mntdir);
-
-    /* copy the directory into the mounted ext2 file system */
-    _systemf("/bin/tar c -C %s -f - .|/bin/tar x -C %s -f -", dirname, mntdir);
-
-    /* unmount the ext2 image */
-    _systemf("/bin/umount %s", mntdir);
-
-    /* detach the loopback device */
-    _systemf("/sbin/losetup -d %s", loop);
-}
-
 static void _create_luks_image(
     const char* dirname,
     const char* image,
@@ -275,7 +236,8 @@ static void _create_luks_image(
     /* do luksFormat on image */
     _systemf(
         "/bin/echo %s | /sbin/cryptsetup luksFormat "
-        "--type luks1 "
+        "--type luks2 "
+        "--sector-size=4096 "
         "--key-size=%zu "
         "--cipher=aes-xts-plain64 "
         "--master-key-file=%s "
@@ -306,7 +268,7 @@ static void _create_luks_image(
         dmname);
 
     /* format the ext2 file system */
-    _systemf("/sbin/mke2fs -q %s", dmpath);
+    _systemf("/sbin/mke2fs -q -b 4096 %s", dmpath);
 
     /* create the mount directory */
     if (!mkdtemp(mntdir))
@@ -334,32 +296,116 @@ static void _create_luks_image(
     _systemf("/sbin/cryptsetup luksClose %s", dmname);
 }
 
-static void _append_hash_tree(
-    const char* image,
-    size_t size,
-    myst_sha256_t* root_hash)
+/* Replace the image with its compressed form (see myst/zimage.h) and return
+ * the size of the compressed image */
+static size_t _compress_image(const char* image, size_t size)
 {
-    struct stat st;
-    char buf[256];
-    ssize_t n;
+    const size_t chunk_size = MYST_ZIMAGE_CHUNK_SIZE;
+    const size_t num_chunks = (size + chunk_size - 1) / chunk_size;
+    const size_t index_size = (num_chunks + 1) * sizeof(uint64_t);
+    myst_zimage_header_t header;
+    uint64_t* index = NULL;
+    uint8_t* chunk = NULL;
+    uint8_t* zchunk = NULL;
+    char* tmp;
+    FILE* is;
+    FILE* os;
+    size_t offset;
 
-    if (stat(image, &st) != 0)
-        _err("unexpected: image does not exist: %s", image);
+    if (!(index = malloc(index_size)) || !(chunk = malloc(chunk_size)) ||
+        !(zchunk = malloc(chunk_size)))
+    {
+        _err("out of memory");
+    }
 
-    if (st.st_size != size)
-        _err("unexpected: image size mismatch: %zu/%zu\n", st.st_size, size);
+    if (asprintf(&tmp, "%s.zimage", image) < 0)
+        _err("out of memory");
 
-    _execf(
-        buf,
-        sizeof(buf),
-        "veritysetup format --hash-offset=%zu %s %s | "
-        "grep '^Root hash:' | sed 's/Root hash:[\\t ]*//g'",
-        size,
-        image,
-        image);
+    if (!(is = fopen(image, "rb")))
+        _err("failed to open file for read: %s", image);
+
+    if (!(os = fopen(tmp, "wb")))
+        _err("failed to open file for write: %s", tmp);
+
+    /* the chunks follow the header and the index */
+    offset = sizeof(header) + index_size;
+
+    if (fseek(os, offset, SEEK_SET) != 0)
+        _err("failed to seek file: %s: %zu", tmp, offset);
+
+    for (size_t i = 0; i < num_chunks; i++)
+    {
+        const size_t rem = size - i * chunk_size;
+        const size_t n = rem < chunk_size ? rem : chunk_size;
+        const void* data = chunk;
+        ssize_t zn;
 
-    if ((n = myst_ascii_to_bin(buf, root_hash->data, sizeof(*root_hash))) < 0)
-        _err("malformed root hash: %s", root_hash);
+        if (fread(chunk, 1, n, is) != n)
+            _err("failed to read file: %s", image);
+
+        /* store the chunk as is unless it gets smaller */
+        if ((zn = myst_lz_compress(chunk, n, zchunk, n - 1)) > 0)
+            data = zchunk;
+        else
+            zn = n;
+
+        if (fwrite(data, 1, zn, os) != (size_t)zn)
+            _err("failed to write file: %s", tmp);
+
+        index[i] = offset;
+        offset += zn;
+    }
+
+    index[num_chunks] = offset;
+
+    /* pad to the verity data block size */
+    {
+        static const uint8_t _zeros[4096];
+        const size_t n = (sizeof(_zeros) - offset % 4096) % 4096;
+
+        if (fwrite(_zeros, 1, n, os) != n)
+            _err("failed to write file: %s", tmp);
+
+        offset += n;
+    }
+
+    /* write the header and the index */
+    {
+        memset(&header, 0, sizeof(header));
+        header.magic = MYST_ZIMAGE_MAGIC;
+        header.version = MYST_ZIMAGE_VERSION;
+        header.size = size;
+        header.chunk_size = chunk_size;
+        header.num_chunks = num_chunks;
+        header.index_offset = sizeof(header);
+
+        if (fseek(os, 0, SEEK_SET) != 0)
+            _err("failed to seek file: %s", tmp);
+
+        if (fwrite(&header, 1, sizeof(header), os) != sizeof(header) ||
+            fwrite(index, 1, index_size, os) != index_size)
+        {
+            _err("failed to write file: %s", tmp);
+        }
+    }
+
+    fclose(is);
+
+    if (fclose(os) != 0)
+        _err("failed to write file: %s", tmp);
+
+    if (rename(tmp, image) != 0)
+        _err("failed to rename %s to %s", tmp, image);
+
+    if (_trace)
+        printf("compressed %zu bytes to %zu bytes\n", size, offset);
+
+    free(tmp);
+    free(zchunk);
+    free(chunk);
+    free(index);
+
+    return offset;
 }
 
 static int _sign(
@@ -497,9 +543,12 @@ int mkext2_action(int argc, const char* argv[])
     bool help = false;
     bool luks = false;
     bool force = false;
+    bool compress = false;
     const char* key_file = NULL;
     const char* passphrase = NULL;
     const char* size_opt = NULL;
+    const char* order_file = NULL;
+    hashtree_t hashtree;
     size_t size = 0;
     struct stat st;
     const size_t mb = 1048576;
@@ -538,6 +587,17 @@ int mkext2_action(int argc, const char* argv[])
         force = true;
     }
 
+    /* get the --compress option */
+    if (_getopt(&argc, argv, "--compress", NULL) == 0 ||
+        _getopt(&argc, argv, "-z", NULL) == 0)
+    {
+        compress = true;
+    }
+
+    /* encrypted data does not compress */
+    if (compress && luks)
+        _err("--compress and --encrypt options are mutually exclusive");
+
     /* get the --passphrase */
     if (_getopt(&argc, argv, "--passphrase", &passphrase) == 0 ||
         _getopt(&argc, argv, "-p", &passphrase) == 0)
@@ -565,6 +625,32 @@ int mkext2_action(int argc, const char* argv[])
         _check_regular_file(privkey);
     }
 
+    /* get the --order option (relative paths in the order of their use) */
+    if (_getopt(&argc, argv, "--order", &order_file) == 0)
+    {
+        if (luks)
+            _err("--order and --encrypt options are mutually exclusive");
+
+        _check_regular_file(order_file);
+    }
+
+    /* get the --layout-profile option (an order file written by exec) */
+    {
+        const char* profile;
+
+        if (_getopt(&argc, argv, "--layout-profile", &profile) == 0)
+        {
+            if (order_file)
+                _err("--order and --layout-profile are mutually exclusive");
+
+            if (luks)
+                _err("--layout-profile and --encrypt are mutually exclusive");
+
+            _check_regular_file(profile);
+            order_file = profile;
+        }
+    }
+
     /* get the --size option */
     if (_getopt(&argc, argv, "--size", &size_opt) == 0)
     {
@@ -595,26 +681,41 @@ int mkext2_action(int argc, const char* argv[])
     if (!force && stat(image, &st) == 0)
         _err("%s already exists: cautiously use --force to override", image);
 
-    /* calculate the minimum required size */
+    hashtree_init(&hashtree);
+
+    if (luks)
     {
         size_t n;
 
+        /* calculate the minimum required size */
         _calculate_required_image_size(dirname, &n);
 
         if (n > size)
             size = n;
-    }
 
-    if (luks)
-    {
+        /* whole encryption sectors */
+        size = (size + 4095) & ~(size_t)4095;
+
         _create_luks_image(dirname, image, size, key_file, passphrase);
+        hashtree_add_file(&hashtree, image, size);
+    }
+    else if (compress)
+    {
+        /* the hash tree covers the compressed image */
+        size = ext2image_write(
+            dirname, image, order_file, FREE_SPACE_SIZE, size, NULL);
+        size = _compress_image(image, size);
+        hashtree_add_file(&hashtree, image, size);
     }
     else
     {
-        _create_ext2_image(dirname, image, size);
+        /* the blocks are hashed as they are written */
+        size = ext2image_write(
+            dirname, image, order_file, FREE_SPACE_SIZE, size, &hashtree);
     }
 
-    _append_hash_tree(image, size, &root_hash);
+    hashtree_append(&hashtree, image, &root_hash);
+    hashtree_free(&hashtree);
     _sign(image, pubkey, privkey, size, &root_hash);
 
     return 0;
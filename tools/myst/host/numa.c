@@ -0,0 +1,150 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "numa.h"
+
+/*
+**==============================================================================
+**
+** NUMA placement (--numa).
+**
+**     The nodes are read from sysfs and limited to the CPUs that the process
+**     may run on. A pool thread is pinned to the CPUs of one node before it
+**     runs a kernel thread, taking the nodes in turn, so the threads of the
+**     program are spread evenly over the sockets and stay there. For the
+**     Linux target, the pages of the kernel memory are interleaved over the
+**     nodes, which halves the cross-socket traffic of the worst placement;
+**     the EPC pages of an enclave are placed by the SGX driver.
+**
+**==============================================================================
+*/
+
+static bool _initialized;
+static cpu_set_t _process_cpus;
+static cpu_set_t _node_cpus[NUMA_MAX_NODES];
+static size_t _num_nodes;
+static unsigned long _node_mask;
+static unsigned int _next_node;
+
+/* Parse a CPU list such as "0-15,32-47" */
+static void _parse_cpulist(const char* str, cpu_set_t* set)
+{
+    const char* p = str;
+
+    CPU_ZERO(set);
+
+    while (*p)
+    {
+        char* end;
+        unsigned long first = strtoul(p, &end, 10);
+        unsigned long last = first;
+
+        if (end == p)
+            break;
+
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+        }
+
+        for (unsigned long i = first; i <= last && i < CPU_SETSIZE; i++)
+            CPU_SET(i, set);
+
+        if (*end != ',')
+            break;
+
+        p = end + 1;
+    }
+}
+
+static void _read_nodes(void)
+{
+    for (size_t i = 0; i < NUMA_MAX_NODES; i++)
+    {
+        char path[64];
+        char buf[4096];
+        cpu_set_t set;
+        FILE* is;
+        size_t n;
+
+        snprintf(
+            path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", i);
+
+        if (!(is = fopen(path, "r")))
+            continue;
+
+        n = fread(buf, 1, sizeof(buf) - 1, is);
+        fclose(is);
+        buf[n] = '\0';
+
+        _parse_cpulist(buf, &set);
+        CPU_AND(&set, &set, &_process_cpus);
+
+        /* skip nodes with only memory (or no allowed CPUs) */
+        if (CPU_COUNT(&set) == 0)
+            continue;
+
+        _node_cpus[_num_nodes++] = set;
+        _node_mask |= 1UL << i;
+    }
+
+    /* a single node needs no placement */
+    if (_num_nodes < 2)
+    {
+        _num_nodes = 0;
+        _node_mask = 0;
+    }
+}
+
+void numa_init(bool enable)
+{
+    if (sched_getaffinity(0, sizeof(_process_cpus), &_process_cpus) != 0)
+        return;
+
+    if (enable)
+        _read_nodes();
+
+    _initialized = true;
+}
+
+void numa_place_thread(void)
+{
+    const cpu_set_t* set = &_process_cpus;
+
+    if (!_initialized)
+        return;
+
+    if (_num_nodes)
+    {
+        unsigned int n = __atomic_fetch_add(&_next_node, 1, __ATOMIC_RELAXED);
+        set = &_node_cpus[n % _num_nodes];
+    }
+
+    sched_setaffinity(0, sizeof(cpu_set_t), set);
+}
+
+void numa_interleave(void* addr, size_t size)
+{
+    if (!_node_mask)
+        return;
+
+    /* only a hint: without NUMA support the pages stay where they fault */
+    syscall(
+        SYS_mbind,
+        addr,
+        size,
+        MPOL_INTERLEAVE,
+        &_node_mask,
+        sizeof(_node_mask) * 8,
+        0);
+}
@@ -0,0 +1,25 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_HOST_NUMA_H
+#define _MYST_HOST_NUMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The most NUMA nodes that --numa spreads threads over */
+#define NUMA_MAX_NODES 64
+
+/* Read the CPUs of the process (and with enable, its NUMA nodes); call it
+ * before the kernel creates threads */
+void numa_init(bool enable);
+
+/* Pin a pool thread before it runs a kernel thread: to the next node in
+ * turn with --numa, else back to the CPUs of the process (undoing the
+ * affinity of the kernel thread it ran before) */
+void numa_place_thread(void);
+
+/* Interleave the pages of the region over the nodes (with --numa) */
+void numa_interleave(void* addr, size_t size);
+
+#endif /* _MYST_HOST_NUMA_H */
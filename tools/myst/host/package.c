@@ -14,12 +14,15 @@
 #include <unistd.h>
 
 #include <myst/elf.h>
+#include <myst/fssig.h>
 #include <myst/getopt.h>
+#include <myst/startuptrace.h>
 #include <myst/strings.h>
 #include <openenclave/bits/sgx/region.h>
 #include <openenclave/host.h>
 
 #include "../config.h"
+#include "../shared.h"
 #include "archive.h"
 #include "cpio.h"
 #include "exec.h"
@@ -51,6 +54,13 @@ and <options> are one of:\n\
     --help                -- this message\n\
     --pubkey=pem_file     -- trust disks signed by this key (repeatable)\n\
     --roothash=ascii_file -- trust disks with this roothash (repeatable)\n\
+    --rootfs=ext2_image   -- use this EXT2 image (made by mkext2) as the\n\
+                             root file system instead of <app_dir>; the\n\
+                             image is not loaded into the enclave but\n\
+                             verified block by block with the root hash\n\
+                             of its hash tree, which the package trusts,\n\
+                             and is installed next to the package\n\
+                             executable as <name>.rootfs\n\
 \n\
 "
 
@@ -82,6 +92,31 @@ done:
     return ret;
 }
 
+/* Write the root hash of the EXT2 image's hash tree to a temporary file
+ * (as --roothash expects) so that the archive trusts the image */
+static void _write_roothash_file(const char* image, char path[PATH_MAX])
+{
+    myst_fssig_t fssig;
+    FILE* os;
+    int fd;
+
+    if (myst_load_fssig(image, &fssig) != 0)
+        _err("--rootfs image does not have the fssig trailer: %s", image);
+
+    strcpy(path, "/tmp/mystXXXXXX");
+
+    if ((fd = mkstemp(path)) < 0 || !(os = fdopen(fd, "w")))
+        _err("cannot create temporary file");
+
+    for (size_t i = 0; i < sizeof(fssig.root_hash); i++)
+        fprintf(os, "%02x", fssig.root_hash[i]);
+
+    fprintf(os, "\n");
+
+    if (fclose(os) != 0)
+        _err("failed to write file: %s", path);
+}
+
 #define DIR_MODE                                                          \
     S_IROTH | S_IXOTH | S_IXGRP | S_IWGRP | S_IRGRP | S_IXUSR | S_IWUSR | \
         S_IRUSR
@@ -108,6 +143,8 @@ int _package(int argc, const char* argv[])
     static const size_t max_roothashes = 128;
     const char* roothashes[max_roothashes];
     size_t num_roothashes = 0;
+    const char* rootfs_image = NULL;
+    char roothash_file[PATH_MAX] = "";
 
     /* Get --pubkey=filename and --roothash=filename options */
     get_archive_options(
@@ -120,6 +157,16 @@ int _package(int argc, const char* argv[])
         max_roothashes,
         &num_roothashes);
 
+    /* Get --rootfs=ext2_image option (and trust the image's root hash) */
+    if (cli_getopt(&argc, argv, "--rootfs", &rootfs_image) == 0)
+    {
+        if (num_roothashes == max_roothashes)
+            _err("too many --roothash options (> %zu)", max_roothashes);
+
+        _write_roothash_file(rootfs_image, roothash_file);
+        roothashes[num_roothashes++] = roothash_file;
+    }
+
     if ((argc < 4) || (cli_getopt(&argc, argv, "--help", NULL) == 0) ||
         (cli_getopt(&argc, argv, "-h", NULL) == 0))
     {
@@ -145,6 +192,12 @@ int _package(int argc, const char* argv[])
         config_file = argv[3];
     }
 
+    if (app_dir && rootfs_image)
+    {
+        fprintf(stderr, "--rootfs cannot be used with <app_dir>\n");
+        goto done;
+    }
+
     create_archive(
         pubkeys, num_pubkeys, roothashes, num_roothashes, archive_file);
 
@@ -182,7 +235,8 @@ int _package(int argc, const char* argv[])
     }
     else
     {
-        /* generate a dummy CPIO rootfs with one page of zero bytes */
+        /* generate a dummy CPIO rootfs with one page of zero bytes (which
+         * tells the package to use an EXT2 rootfs outside the enclave) */
         int fd;
         uint8_t page[PAGE_SIZE];
         const int flags = O_CREAT | O_WRONLY | O_TRUNC;
@@ -240,7 +294,8 @@ int _package(int argc, const char* argv[])
                                "--archive",
                                archive_file,
                                "--outdir",
-                               tmp_dir};
+                               tmp_dir,
+                               "--reference-data"};
 
     // Sign and copy everything into app.signed directory
     if (_sign(sizeof(sign_args) / sizeof(sign_args[0]), sign_args) != 0)
@@ -408,7 +463,9 @@ int _package(int argc, const char* argv[])
         goto done;
     }
 
-    if (myst_copy_file(scratch_path2, scratch_path) != 0)
+    /* move the package out of the temporary directory if it can */
+    if (rename(scratch_path2, scratch_path) != 0 &&
+        clone_file(scratch_path2, scratch_path) != 0)
     {
         fprintf(
             stderr,
@@ -418,6 +475,28 @@ int _package(int argc, const char* argv[])
         goto done;
     }
 
+    /* Install the --rootfs image where the package looks for it */
+    if (rootfs_image)
+    {
+        if (snprintf(
+                scratch_path, PATH_MAX, "myst/bin/%s.rootfs", appname) >=
+            PATH_MAX)
+        {
+            fprintf(stderr, "File path to long: myst/bin/%s.rootfs", appname);
+            goto done;
+        }
+
+        if (clone_file(rootfs_image, scratch_path) != 0)
+        {
+            fprintf(
+                stderr,
+                "Failed to copy rootfs from %s to %s",
+                rootfs_image,
+                scratch_path);
+            goto done;
+        }
+    }
+
     ret = 0;
 
 done:
@@ -425,6 +504,9 @@ done:
     if (tmp_dir)
         remove_recursive(tmp_dir);
 
+    if (*roothash_file)
+        unlink(roothash_file);
+
     return ret;
 }
 
@@ -470,6 +552,8 @@ int _exec_package(
     char* unpack_dir = NULL;
     int ret = -1;
     const char** exec_args = NULL;
+    const char* startup_trace_path = NULL;
+    uint64_t start;
 
     /* Get options */
     {
@@ -479,6 +563,15 @@ int _exec_package(
         {
             options.trace_syscalls = true;
         }
+
+        /* Get --startup-trace option */
+        cli_getopt(&argc, argv, "--startup-trace", &startup_trace_path);
+
+        if (startup_trace_path && !myst_startup_trace_start())
+        {
+            fprintf(stderr, "--startup-trace <file> -- out of memory\n");
+            goto done;
+        }
     }
 
     /* Get --trace option */
@@ -488,6 +581,9 @@ int _exec_package(
         options.trace_errors = true;
     }
 
+    /* Buffer console output by line only when it goes to a terminal */
+    options.console_buffering = myst_get_console_buffering(NULL);
+
     if (!realpath(argv[0], full_app_path))
     {
         fprintf(stderr, "Invalid path %s\n", argv[0]);
@@ -626,6 +722,8 @@ int _exec_package(
         goto done;
     }
 
+    start = myst_startup_trace_now();
+
     if ((details = create_region_details_from_package(
              &myst_elf, parsed_data.heap_pages)) == NULL)
     {
@@ -633,14 +731,28 @@ int _exec_package(
         goto done;
     }
 
+    myst_startup_trace_event("load_package", start);
+
     if (_is_null_rootfs(details->rootfs.buffer, details->rootfs.buffer_size))
     {
         char* env;
 
+        /* default to the image installed by package --rootfs */
         if (!(env = getenv("MYST_ROOTFS_PATH")))
         {
-            fprintf(stderr, "MYST_ROOTFS_PATH is undefined\n");
-            goto done;
+            if (snprintf(
+                    scratch_path,
+                    PATH_MAX,
+                    "%s/%s.rootfs",
+                    app_dir,
+                    app_name) >= PATH_MAX ||
+                access(scratch_path, R_OK) != 0)
+            {
+                fprintf(stderr, "MYST_ROOTFS_PATH is undefined\n");
+                goto done;
+            }
+
+            env = scratch_path;
         }
 
         if (access(env, R_OK) != 0)
@@ -704,6 +816,12 @@ int _exec_package(
     }
 
 done:
+    if (myst_startup_trace_get() &&
+        myst_startup_trace_write(startup_trace_path) != 0)
+    {
+        fprintf(stderr, "failed to write %s\n", startup_trace_path);
+    }
+
     if (unpack_dir)
         remove_recursive(unpack_dir);
 
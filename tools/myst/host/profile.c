@@ -0,0 +1,381 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/elf.h>
+#include <myst/eraise.h>
+#include <myst/file.h>
+#include <myst/profile.h>
+#include <myst/strings.h>
+
+#include "utils.h"
+
+typedef struct symbol
+{
+    uint64_t addr;
+    uint64_t size;
+    const char* name; /* in image_t.strtab */
+} symbol_t;
+
+typedef struct image image_t;
+
+/* The function symbols of an ELF image (as loaded at base) */
+struct image
+{
+    image_t* next;
+    uint64_t base;
+    uint64_t size;
+    symbol_t* symbols; /* sorted by address */
+    size_t nsymbols;
+    char* strtab;
+};
+
+/* A folded stack and its total weight */
+typedef struct folded
+{
+    char* str;
+    uint64_t weight;
+} folded_t;
+
+static myst_profile_t* _profile;
+static image_t* _images;
+
+myst_profile_t* myst_profile_start(void)
+{
+    if (!_profile)
+        _profile = calloc(1, sizeof(myst_profile_t));
+
+    return _profile;
+}
+
+myst_profile_t* myst_profile_get(void)
+{
+    return _profile;
+}
+
+static int _compare_symbols(const void* p1, const void* p2)
+{
+    const symbol_t* s1 = (const symbol_t*)p1;
+    const symbol_t* s2 = (const symbol_t*)p2;
+
+    if (s1->addr < s2->addr)
+        return -1;
+
+    return s1->addr > s2->addr ? 1 : 0;
+}
+
+static void _free_image(image_t* image)
+{
+    free(image->symbols);
+    free(image->strtab);
+    free(image);
+}
+
+/* Keep the symbols now, since the symbol files are deleted on exit */
+int myst_profile_add_symbols(
+    const void* file_data,
+    size_t file_size,
+    const void* text,
+    size_t text_size)
+{
+    int ret = 0;
+    elf_t elf;
+    uint8_t* symtab;
+    size_t symtab_size;
+    uint8_t* strtab;
+    size_t strtab_size;
+    image_t* image = NULL;
+    const elf_sym_t* syms;
+    uint64_t bias;
+    size_t n;
+
+    if (!_profile)
+        goto done;
+
+    if (!file_data || !text)
+        ERAISE(-EINVAL);
+
+    if (elf_from_buffer((void*)file_data, file_size, &elf) != 0)
+        ERAISE(-EINVAL);
+
+    /* a file without a symbol table adds nothing */
+    if (elf_find_section(&elf, ".symtab", &symtab, &symtab_size) != 0 ||
+        elf_find_section(&elf, ".strtab", &strtab, &strtab_size) != 0 ||
+        strtab_size == 0)
+    {
+        goto done;
+    }
+
+    if (!(image = calloc(1, sizeof(image_t))))
+        ERAISE(-ENOMEM);
+
+    syms = (const elf_sym_t*)symtab;
+    n = symtab_size / sizeof(elf_sym_t);
+
+    if (!(image->symbols = calloc(n ? n : 1, sizeof(symbol_t))))
+        ERAISE(-ENOMEM);
+
+    if (!(image->strtab = malloc(strtab_size)))
+        ERAISE(-ENOMEM);
+
+    memcpy(image->strtab, strtab, strtab_size);
+    image->strtab[strtab_size - 1] = '\0';
+    image->base = (uint64_t)text;
+    image->size = text_size;
+
+    /* the symbols of a shared object (or PIE) are relative to its base */
+    bias = elf_get_header(&elf)->e_type == ET_EXEC ? 0 : image->base;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const elf_sym_t* sym = &syms[i];
+
+        if ((sym->st_info & 0xf) != STT_FUNC || !sym->st_value ||
+            sym->st_name >= strtab_size)
+        {
+            continue;
+        }
+
+        image->symbols[image->nsymbols].addr = bias + sym->st_value;
+        image->symbols[image->nsymbols].size = sym->st_size;
+        image->symbols[image->nsymbols].name = image->strtab + sym->st_name;
+        image->nsymbols++;
+    }
+
+    qsort(image->symbols, image->nsymbols, sizeof(symbol_t), _compare_symbols);
+
+    image->next = _images;
+    _images = image;
+    image = NULL;
+
+done:
+
+    if (image)
+        _free_image(image);
+
+    return ret;
+}
+
+static const char* _find_name(uint64_t addr)
+{
+    for (const image_t* p = _images; p; p = p->next)
+    {
+        size_t lo = 0;
+        size_t hi = p->nsymbols;
+
+        if (addr < p->base || addr - p->base >= p->size)
+            continue;
+
+        /* find the last symbol at or below the address */
+        while (lo < hi)
+        {
+            const size_t mid = lo + (hi - lo) / 2;
+
+            if (p->symbols[mid].addr <= addr)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo > 0)
+        {
+            const symbol_t* s = &p->symbols[lo - 1];
+
+            if (addr < s->addr + (s->size ? s->size : 1))
+                return s->name;
+        }
+    }
+
+    return NULL;
+}
+
+/* Add the kernel symbols unless its image was added (as for exec-linux) */
+static void _add_kernel_symbols(void)
+{
+    const uint64_t base = _profile->kernel_base;
+    char path[PATH_MAX];
+    void* data;
+    size_t size;
+
+    if (!base)
+        return;
+
+    for (const image_t* p = _images; p; p = p->next)
+    {
+        if (base >= p->base && base - p->base < p->size)
+            return;
+    }
+
+    if (format_libmystkernel(path, sizeof(path), "sgx") != 0)
+        return;
+
+    if (myst_load_file(path, &data, &size) != 0)
+        return;
+
+    myst_profile_add_symbols(
+        data, size, (const void*)base, _profile->kernel_size);
+    free(data);
+}
+
+static int _append(char** str, size_t* len, const char* s)
+{
+    const size_t n = strlen(s);
+    char* p;
+
+    if (!(p = realloc(*str, *len + n + 2)))
+        return -ENOMEM;
+
+    if (*len)
+        p[(*len)++] = ';';
+
+    memcpy(p + *len, s, n + 1);
+    *len += n;
+    *str = p;
+
+    return 0;
+}
+
+/* Format a sample as a folded stack: outermost frame first */
+static int _fold(const myst_profile_sample_t* sample, char** str_out)
+{
+    int ret = 0;
+    char* str = NULL;
+    size_t len = 0;
+    size_t nframes = sample->nframes;
+
+    if (nframes > MYST_PROFILE_MAX_FRAMES)
+        nframes = MYST_PROFILE_MAX_FRAMES;
+
+    for (size_t i = nframes; i > 0; i--)
+    {
+        /* look up the call (rather than the address after it) */
+        const uint64_t addr = sample->frames[i - 1] - 1;
+        const char* name = _find_name(addr);
+        char buf[32];
+
+        if (!name)
+        {
+            snprintf(buf, sizeof(buf), "0x%lx", addr);
+            name = buf;
+        }
+
+        ECHECK(_append(&str, &len, name));
+    }
+
+    /* time in the kernel ends with the syscall */
+    if (sample->syscall[0])
+    {
+        char buf[sizeof(sample->syscall) + 8];
+
+        snprintf(
+            buf,
+            sizeof(buf),
+            "[%.*s]",
+            (int)sizeof(sample->syscall),
+            sample->syscall);
+        ECHECK(_append(&str, &len, buf));
+    }
+
+    if (!str)
+        ECHECK(_append(&str, &len, "[unknown]"));
+
+    *str_out = str;
+    str = NULL;
+
+done:
+    free(str);
+    return ret;
+}
+
+static int _compare_stacks(const void* p1, const void* p2)
+{
+    return strcmp(((const folded_t*)p1)->str, ((const folded_t*)p2)->str);
+}
+
+int myst_profile_write(const char* path)
+{
+    int ret = 0;
+    FILE* os = NULL;
+    folded_t* stacks = NULL;
+    uint64_t n;
+    size_t nstacks = 0;
+
+    if (!_profile || !path)
+        ERAISE(-EINVAL);
+
+    /* the enclave wrote the count, so keep it within the buffer */
+    if ((n = _profile->nsamples) > MYST_PROFILE_MAX_SAMPLES)
+        n = MYST_PROFILE_MAX_SAMPLES;
+
+    _add_kernel_symbols();
+
+    if (!(stacks = calloc(n ? n : 1, sizeof(folded_t))))
+        ERAISE(-ENOMEM);
+
+    for (; nstacks < n; nstacks++)
+    {
+        const myst_profile_sample_t* sample = &_profile->samples[nstacks];
+
+        ECHECK(_fold(sample, &stacks[nstacks].str));
+        stacks[nstacks].weight = sample->weight;
+    }
+
+    /* merge the identical stacks */
+    qsort(stacks, nstacks, sizeof(folded_t), _compare_stacks);
+
+    if (!(os = fopen(path, "w")))
+        ERAISE(-errno);
+
+    for (size_t i = 0; i < nstacks;)
+    {
+        uint64_t weight = 0;
+        size_t j = i;
+
+        for (; j < nstacks && strcmp(stacks[j].str, stacks[i].str) == 0; j++)
+            weight += stacks[j].weight;
+
+        fprintf(os, "%s %lu\n", stacks[i].str, weight);
+        i = j;
+    }
+
+    if (fclose(os) != 0)
+    {
+        os = NULL;
+        ERAISE(-errno);
+    }
+
+    os = NULL;
+
+    if (_profile->dropped)
+    {
+        fprintf(
+            stderr,
+            "myst: %s: %lu samples did not fit in the profile\n",
+            path,
+            _profile->dropped);
+    }
+
+done:
+
+    if (os)
+        fclose(os);
+
+    for (size_t i = 0; i < nstacks; i++)
+        free(stacks[i].str);
+
+    free(stacks);
+
+    while (_images)
+    {
+        image_t* next = _images->next;
+        _free_image(_images);
+        _images = next;
+    }
+
+    return ret;
+}
@@ -13,14 +13,190 @@
 #include <myst/strings.h>
 #include <openenclave/bits/sgx/region.h>
 #include <openenclave/host.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "../config.h"
+#include "../config_blob.h"
 #include "../shared.h"
 #include "utils.h"
 
 region_details _details = {0};
 
+/*
+**==============================================================================
+**
+** Background file loading.
+**
+**     The rootfs and the archive are read into page-aligned mappings by a
+**     thread of their own while the enclave is created, so that reading a
+**     large image overlaps with the EADD and EEXTEND of the regions before
+**     it (and of its own earlier pages). The pages are added straight from
+**     the mapping, whose tail is zero, rather than copied one at a time.
+**
+**==============================================================================
+*/
+
+/* The most bytes read at once (the pages become available in these steps) */
+#define LOADER_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef struct _region_loader
+{
+    region_details_item* item;
+    int fd;
+    size_t map_size; /* buffer_size rounded up to the page size */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    size_t loaded; /* bytes read so far */
+    int err;       /* the read error (zero if none) */
+} region_loader;
+
+static region_loader _rootfs_loader;
+static region_loader _archive_loader;
+
+static void* _loader_thread(void* arg)
+{
+    region_loader* loader = (region_loader*)arg;
+    uint8_t* data = loader->item->buffer;
+    const size_t size = loader->item->buffer_size;
+    size_t loaded = 0;
+    int err = 0;
+
+    while (loaded < size)
+    {
+        size_t n = size - loaded;
+        ssize_t r;
+
+        if (n > LOADER_CHUNK_SIZE)
+            n = LOADER_CHUNK_SIZE;
+
+        if ((r = pread(loader->fd, data + loaded, n, (off_t)loaded)) <= 0)
+        {
+            if (r < 0 && errno == EINTR)
+                continue;
+
+            err = (r < 0) ? errno : EIO;
+            break;
+        }
+
+        loaded += (size_t)r;
+
+        pthread_mutex_lock(&loader->mutex);
+        loader->loaded = loaded;
+        pthread_cond_broadcast(&loader->cond);
+        pthread_mutex_unlock(&loader->mutex);
+    }
+
+    pthread_mutex_lock(&loader->mutex);
+    loader->err = err;
+    pthread_cond_broadcast(&loader->cond);
+    pthread_mutex_unlock(&loader->mutex);
+
+    close(loader->fd);
+    loader->fd = -1;
+
+    return NULL;
+}
+
+/* Map the file and start reading it into the item's buffer */
+static int _start_loader(
+    region_loader* loader,
+    region_details_item* item,
+    const char* path)
+{
+    int ret = 0;
+    struct stat st;
+    void* data = MAP_FAILED;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        ERAISE(-errno);
+
+    if (fstat(fd, &st) != 0)
+        ERAISE(-errno);
+
+    if (!S_ISREG(st.st_mode) || st.st_size == 0)
+        ERAISE(-EINVAL);
+
+    loader->map_size = ((size_t)st.st_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    data = mmap(
+        NULL,
+        loader->map_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+
+    if (data == MAP_FAILED)
+        ERAISE(-ENOMEM);
+
+    item->buffer = data;
+    item->buffer_size = (size_t)st.st_size;
+    loader->item = item;
+    loader->fd = fd;
+    pthread_mutex_init(&loader->mutex, NULL);
+    pthread_cond_init(&loader->cond, NULL);
+
+    if ((ret = -pthread_create(&loader->thread, NULL, _loader_thread, loader)))
+    {
+        item->buffer = NULL;
+        item->buffer_size = 0;
+        loader->item = NULL;
+        ERAISE(ret);
+    }
+
+    item->status = REGION_ITEM_MAPPED;
+    data = MAP_FAILED;
+    fd = -1;
+
+done:
+
+    if (data != MAP_FAILED)
+        munmap(data, loader->map_size);
+
+    if (fd >= 0)
+        close(fd);
+
+    return ret;
+}
+
+/* Wait until the first 'offset' bytes are read (or up to the end) */
+static int _wait_loader(region_loader* loader, size_t offset)
+{
+    int err;
+
+    if (offset > loader->item->buffer_size)
+        offset = loader->item->buffer_size;
+
+    pthread_mutex_lock(&loader->mutex);
+
+    while (loader->loaded < offset && !loader->err)
+        pthread_cond_wait(&loader->cond, &loader->mutex);
+
+    err = (loader->loaded < offset) ? loader->err : 0;
+    pthread_mutex_unlock(&loader->mutex);
+
+    return -err;
+}
+
+static void _stop_loader(region_loader* loader)
+{
+    if (!loader->item)
+        return;
+
+    pthread_join(loader->thread, NULL);
+    munmap(loader->item->buffer, loader->map_size);
+    pthread_mutex_destroy(&loader->mutex);
+    pthread_cond_destroy(&loader->cond);
+    loader->item->buffer = NULL;
+    loader->item->buffer_size = 0;
+    loader->item = NULL;
+}
+
 const region_details* create_region_details_from_package(
     elf_image_t* myst_elf,
     size_t heap_pages)
@@ -130,25 +306,12 @@ const region_details* create_region_details_from_files(
     const char* config_path,
     size_t ram)
 {
-    if (myst_load_file(
-            rootfs_path,
-            &_details.rootfs.buffer,
-            &_details.rootfs.buffer_size) != 0)
+    /* read the rootfs and the archive while the enclave is created */
+    if (_start_loader(&_rootfs_loader, &_details.rootfs, rootfs_path) != 0)
         _err("failed to load rootfs: %s", rootfs_path);
-    _details.rootfs.status = REGION_ITEM_OWNED;
 
-    /* load archive file */
-    {
-        if (myst_load_file(
-                archive_path,
-                (void**)&_details.archive.buffer,
-                &_details.archive.buffer_size) != 0)
-        {
-            _err("failed to load archive: %s", archive_path);
-        }
-
-        _details.archive.status = REGION_ITEM_OWNED;
-    }
+    if (_start_loader(&_archive_loader, &_details.archive, archive_path) != 0)
+        _err("failed to load archive: %s", archive_path);
 
     if (program_path[0] != '/')
     {
@@ -167,7 +330,7 @@ const region_details* create_region_details_from_files(
             _err("buffer overflow when forming libmystcrt.so path");
 
         if (format_libmystkernel(
-                _details.kernel.path, sizeof(_details.kernel.path)) != 0)
+                _details.kernel.path, sizeof(_details.kernel.path), "sgx") != 0)
             _err("buffer overflow when forming libmystcrt.so path");
 
         if (access(_details.enc.path, R_OK) != 0)
@@ -274,8 +437,12 @@ void free_region_details()
 {
     if (_details.rootfs.status == REGION_ITEM_OWNED)
         free(_details.rootfs.buffer);
+    if (_details.rootfs.status == REGION_ITEM_MAPPED)
+        _stop_loader(&_rootfs_loader);
     if (_details.archive.status == REGION_ITEM_OWNED)
         free(_details.archive.buffer);
+    if (_details.archive.status == REGION_ITEM_MAPPED)
+        _stop_loader(&_archive_loader);
     if (_details.crt.status == REGION_ITEM_OWNED)
         elf_image_free(&_details.crt.image);
     if (_details.kernel.status == REGION_ITEM_OWNED)
@@ -751,19 +918,26 @@ done:
     return ret;
 }
 
-static int _add_rootfs_region(oe_region_context_t* context, uint64_t* vaddr)
+/* Add the rootfs or the archive (waiting for pages still being read) */
+static int _add_data_region(
+    oe_region_context_t* context,
+    uint64_t* vaddr,
+    uint64_t id,
+    const region_details_item* item,
+    region_loader* loader)
 {
     int ret = 0;
-    const uint8_t* p = _details.rootfs.buffer;
-    size_t n = _details.rootfs.buffer_size;
-    size_t r = n;
-    const uint64_t id = MYST_ROOTFS_REGION_ID;
+    const bool mapped = (item->status == REGION_ITEM_MAPPED);
+    const uint8_t* p = item->buffer;
+    size_t r = item->buffer_size;
+    size_t offset = 0;
+    size_t available = 0;
 
     if (!context || !vaddr)
         ERAISE(-EINVAL);
 
-    assert(_details.rootfs.buffer != NULL);
-    assert(_details.rootfs.buffer_size != 0);
+    assert(item->buffer != NULL);
+    assert(item->buffer_size != 0);
 
     if (oe_region_start(context, id, false, NULL) != OE_OK)
         ERAISE(-EINVAL);
@@ -773,66 +947,29 @@ static int _add_rootfs_region(oe_region_context_t* context, uint64_t* vaddr)
         __attribute__((__aligned__(PAGE_SIZE))) uint8_t page[PAGE_SIZE];
         const bool extend = true;
         const size_t min = (r < sizeof(page)) ? r : sizeof(page);
+        const void* src = p;
 
-        memcpy(page, p, min);
-
-        if (min < sizeof(page))
-            memset(page + r, 0, sizeof(page) - r);
-
-        if (oe_region_add_page(
-                context,
-                *vaddr,
-                page,
-                SGX_SECINFO_REG | SGX_SECINFO_R,
-                extend) != OE_OK)
+        if (mapped && offset + min > available)
         {
-            ERAISE(-EINVAL);
+            available = offset + LOADER_CHUNK_SIZE;
+            ECHECK(_wait_loader(loader, available));
         }
 
-        *vaddr += sizeof(page);
-        p += min;
-        r -= min;
-    }
-
-    if (oe_region_end(context) != OE_OK)
-        ERAISE(-EINVAL);
-
-done:
-    return ret;
-}
-
-static int _add_archive_region(oe_region_context_t* context, uint64_t* vaddr)
-{
-    int ret = 0;
-    const uint8_t* p = _details.archive.buffer;
-    size_t n = _details.archive.buffer_size;
-    size_t r = n;
-    const uint64_t id = MYST_ARCHIVE_REGION_ID;
-
-    if (!context || !vaddr)
-        ERAISE(-EINVAL);
-
-    assert(_details.archive.buffer != NULL);
-    assert(_details.archive.buffer_size != 0);
-
-    if (oe_region_start(context, id, false, NULL) != OE_OK)
-        ERAISE(-EINVAL);
-
-    while (r)
-    {
-        __attribute__((__aligned__(PAGE_SIZE))) uint8_t page[PAGE_SIZE];
-        const bool extend = true;
-        const size_t min = (r < sizeof(page)) ? r : sizeof(page);
+        /* a mapping is page-aligned and its tail is zero */
+        if (!mapped && ((uintptr_t)p % sizeof(page) || min < sizeof(page)))
+        {
+            memcpy(page, p, min);
 
-        memcpy(page, p, min);
+            if (min < sizeof(page))
+                memset(page + min, 0, sizeof(page) - min);
 
-        if (min < sizeof(page))
-            memset(page + r, 0, sizeof(page) - r);
+            src = page;
+        }
 
         if (oe_region_add_page(
                 context,
                 *vaddr,
-                page,
+                src,
                 SGX_SECINFO_REG | SGX_SECINFO_R,
                 extend) != OE_OK)
         {
@@ -842,6 +979,7 @@ static int _add_archive_region(oe_region_context_t* context, uint64_t* vaddr)
         *vaddr += sizeof(page);
         p += min;
         r -= min;
+        offset += min;
     }
 
     if (oe_region_end(context) != OE_OK)
@@ -851,12 +989,35 @@ done:
     return ret;
 }
 
+static int _add_rootfs_region(oe_region_context_t* context, uint64_t* vaddr)
+{
+    return _add_data_region(
+        context,
+        vaddr,
+        MYST_ROOTFS_REGION_ID,
+        &_details.rootfs,
+        &_rootfs_loader);
+}
+
+static int _add_archive_region(oe_region_context_t* context, uint64_t* vaddr)
+{
+    return _add_data_region(
+        context,
+        vaddr,
+        MYST_ARCHIVE_REGION_ID,
+        &_details.archive,
+        &_archive_loader);
+}
+
+/* The config region holds the configuration compiled into a config_blob_t,
+ * which the enclave reads in place (the JSON itself is not measured) */
 static int _add_config_region(oe_region_context_t* context, uint64_t* vaddr)
 {
     int ret = 0;
-    const uint8_t* p = (uint8_t*)_details.config.buffer;
-    size_t n = _details.config.buffer_size;
-    size_t r = n;
+    config_parsed_data_t parsed_data = {0};
+    config_blob_t* blob = NULL;
+    const uint8_t* p;
+    size_t r;
     const uint64_t id = MYST_CONFIG_REGION_ID;
 
     if (!context || !vaddr)
@@ -868,6 +1029,17 @@ static int _add_config_region(oe_region_context_t* context, uint64_t* vaddr)
         return 0;
     }
 
+    if (parse_config_from_buffer(
+            _details.config.buffer,
+            _details.config.buffer_size,
+            &parsed_data) != 0)
+    {
+        ERAISE(-EINVAL);
+    }
+
+    ECHECK(compile_config_blob(&parsed_data, &blob, &r));
+    p = (const uint8_t*)blob;
+
     if (oe_region_start(context, id, false, NULL) != OE_OK)
         ERAISE(-EINVAL);
 
@@ -901,6 +1073,8 @@ static int _add_config_region(oe_region_context_t* context, uint64_t* vaddr)
         ERAISE(-EINVAL);
 
 done:
+    free(blob);
+    free_config(&parsed_data);
     return ret;
 }
 
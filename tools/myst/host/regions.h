@@ -10,7 +10,8 @@ typedef struct _region_details_item
     {
         REGION_ITEM_EMPTY,
         REGION_ITEM_BORROWED,
-        REGION_ITEM_OWNED
+        REGION_ITEM_OWNED,
+        REGION_ITEM_MAPPED /* read in the background (see regions.c) */
     } status;
     char path[PATH_MAX];
     elf_image_t image;
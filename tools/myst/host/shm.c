@@ -3,11 +3,22 @@
 
 #include <myst/shm.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 static pthread_t _clock_thread;
 
+static unsigned long _rdtsc(void)
+{
+    uint32_t hi;
+    uint32_t lo;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+
+    return ((unsigned long)hi << 32) | lo;
+}
+
 static void* _host_clock_task(void* args)
 {
     struct timespec tp, sleep_tp;
@@ -24,6 +35,7 @@ static void* _host_clock_task(void* args)
         nanosleep(&sleep_tp, NULL);
         clock_gettime(CLOCK_MONOTONIC, &tp);
         ctrl->now = tp.tv_sec * NANO_IN_SECOND + tp.tv_nsec;
+        ctrl->tsc = _rdtsc();
     }
     return NULL;
 }
@@ -50,6 +62,7 @@ int shm_create_clock(struct myst_shm* shm, unsigned long clock_tick)
     clock_gettime(CLOCK_MONOTONIC, &tp);
     shm->clock->monotime0 = tp.tv_sec * NANO_IN_SECOND + tp.tv_nsec;
     shm->clock->now = shm->clock->monotime0;
+    shm->clock->tsc = _rdtsc();
 
     if (pthread_create(&_clock_thread, 0, _host_clock_task, (void*)shm->clock))
     {
@@ -7,6 +7,7 @@
 #include <limits.h>
 #include <myst/getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -55,18 +56,36 @@ and <options> are one of:\n\
     --outdir <path>             -- optional output directory path. If not\n\
                                    specified goes into the configurations\n\
                                    <appdir>.signed directpry\n\
+    --reference-data            -- put symbolic links to the rootfs and the\n\
+                                   archive in the output directory rather\n\
+                                   than copies of them\n\
 \n\
 "
 
 static const char* user_sign_dir = NULL;
 
+/* Put a symbolic link to the file (by its absolute path) at linkpath */
+static int _reference_file(const char* path, const char* linkpath)
+{
+    char target[PATH_MAX];
+
+    if (!realpath(path, target))
+        return -1;
+
+    if (unlink(linkpath) != 0 && errno != ENOENT)
+        return -1;
+
+    return symlink(target, linkpath);
+}
+
 int copy_files_to_signing_directory(
     const char* sign_dir,
     const char* program_file,
     const char* rootfs_file,
     const char* archive_file,
     const char* config_file,
-    const region_details* details)
+    const region_details* details,
+    bool reference_data)
 {
     char scratch_path[PATH_MAX];
     const mode_t mode = S_IROTH | S_IXOTH | S_IXGRP | S_IWGRP | S_IRGRP |
@@ -108,7 +127,7 @@ int copy_files_to_signing_directory(
     {
         _err("File path to long: %s/lib/libmystcrt.so", sign_dir);
     }
-    if (myst_copy_file(details->crt.path, scratch_path) != 0)
+    if (clone_file(details->crt.path, scratch_path) != 0)
     {
         _err(
             "Failed to copy \"%s\" to \"%s\"", details->crt.path, scratch_path);
@@ -120,7 +139,7 @@ int copy_files_to_signing_directory(
     {
         _err("File path to long: %s/lib/libmystkernel.so", sign_dir);
     }
-    if (myst_copy_file(details->kernel.path, scratch_path) != 0)
+    if (clone_file(details->kernel.path, scratch_path) != 0)
     {
         _err(
             "Failed to copy \"%s\" to \"%s\"", details->crt.path, scratch_path);
@@ -131,7 +150,7 @@ int copy_files_to_signing_directory(
     {
         _err("File path to long: %s/bin/myst", sign_dir);
     }
-    if (myst_copy_file(program_file, scratch_path) != 0)
+    if (clone_file(program_file, scratch_path) != 0)
     {
         _err("Failed to copy \"%s\" to \"%s\"", program_file, scratch_path);
     }
@@ -145,7 +164,8 @@ int copy_files_to_signing_directory(
     {
         _err("File path to long: %s/rootfs", sign_dir);
     }
-    if (myst_copy_file(rootfs_file, scratch_path) != 0)
+    if (reference_data ? _reference_file(rootfs_file, scratch_path) != 0
+                       : clone_file(rootfs_file, scratch_path) != 0)
     {
         _err("Failed to copy \"%s\" to \"%s\"", rootfs_file, scratch_path);
     }
@@ -155,7 +175,8 @@ int copy_files_to_signing_directory(
     {
         _err("File path to long: %s/archive", sign_dir);
     }
-    if (myst_copy_file(archive_file, scratch_path) != 0)
+    if (reference_data ? _reference_file(archive_file, scratch_path) != 0
+                       : clone_file(archive_file, scratch_path) != 0)
     {
         _err("Failed to copy \"%s\" to \"%s\"", archive_file, scratch_path);
     }
@@ -166,7 +187,7 @@ int copy_files_to_signing_directory(
     {
         _err("File path to long: %s/config.json", sign_dir);
     }
-    if (myst_copy_file(config_file, scratch_path) != 0)
+    if (clone_file(config_file, scratch_path) != 0)
     {
         _err("Failed to copy \"%s\" to \"%s\"", config_file, scratch_path);
     }
@@ -180,7 +201,7 @@ int copy_files_to_signing_directory(
     {
         _err("File path to long: %s/lib/openenclave/mystenc.so", sign_dir);
     }
-    if (myst_copy_file(details->enc.path, scratch_path) != 0)
+    if (clone_file(details->enc.path, scratch_path) != 0)
     {
         _err(
             "Failed to copy \"%s\" to \"%s\"", details->enc.path, scratch_path);
@@ -260,6 +281,7 @@ int _sign(int argc, const char* argv[])
     static const size_t max_roothashes = 128;
     const char* roothashes[max_roothashes];
     size_t num_roothashes = 0;
+    bool reference_data = false;
 
     // We are in the right operation, right?
     assert(
@@ -291,6 +313,8 @@ int _sign(int argc, const char* argv[])
     {
         // we have the optional signing dir
     }
+    if (cli_getopt(&argc, argv, "--reference-data", NULL) == 0)
+        reference_data = true;
 
     const char* program_file = get_program_file();
     const char* rootfs_file = argv[2];
@@ -397,7 +421,8 @@ int _sign(int argc, const char* argv[])
             rootfs_file,
             archive,
             config_file,
-            details) != 0)
+            details,
+            reference_data) != 0)
     {
         unlink(temp_oeconfig_file);
         _err("Failed to copy files to signing directory");
@@ -0,0 +1,125 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <myst/clock.h>
+#include <myst/startuptrace.h>
+#include <myst/strings.h>
+
+static myst_startup_trace_t* _trace;
+
+myst_startup_trace_t* myst_startup_trace_start(void)
+{
+    if (!_trace)
+        _trace = calloc(1, sizeof(myst_startup_trace_t));
+
+    return _trace;
+}
+
+myst_startup_trace_t* myst_startup_trace_get(void)
+{
+    return _trace;
+}
+
+uint64_t myst_startup_trace_now(void)
+{
+    struct timespec ts;
+
+    if (!_trace || clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+
+    return (uint64_t)ts.tv_sec * NANO_IN_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+void myst_startup_trace_event(const char* name, uint64_t start)
+{
+    myst_startup_event_t* event;
+    uint64_t index;
+
+    if (!_trace || !start)
+        return;
+
+    index = __atomic_fetch_add(&_trace->num_events, 1, __ATOMIC_SEQ_CST);
+
+    if (index >= MYST_STARTUP_TRACE_MAX_EVENTS)
+        return;
+
+    event = &_trace->events[index];
+    event->end = myst_startup_trace_now();
+    event->start = start;
+    event->side = MYST_STARTUP_TRACE_HOST;
+    myst_strlcpy(event->name, name, sizeof(event->name));
+}
+
+int myst_startup_trace_write(const char* path)
+{
+    FILE* os;
+    uint64_t n;
+    uint64_t base = UINT64_MAX;
+
+    if (!_trace || !path)
+        return -EINVAL;
+
+    if ((n = _trace->num_events) > MYST_STARTUP_TRACE_MAX_EVENTS)
+        n = MYST_STARTUP_TRACE_MAX_EVENTS;
+
+    /* the timeline starts at the earliest event */
+    for (uint64_t i = 0; i < n; i++)
+    {
+        if (_trace->events[i].start < base)
+            base = _trace->events[i].start;
+    }
+
+    if (!(os = fopen(path, "w")))
+        return -errno;
+
+    fprintf(os, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(
+        os,
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"args\":{\"name\":\"host\"}},\n",
+        MYST_STARTUP_TRACE_HOST);
+    fprintf(
+        os,
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"args\":{\"name\":\"enclave\"}}",
+        MYST_STARTUP_TRACE_ENCLAVE);
+
+    /* complete events with microsecond timestamps */
+    for (uint64_t i = 0; i < n; i++)
+    {
+        const myst_startup_event_t* e = &_trace->events[i];
+        const uint64_t end = (e->end > e->start) ? e->end : e->start;
+        char name[sizeof(e->name)];
+
+        /* the names are plain identifiers, but the enclave wrote them */
+        myst_strlcpy(name, e->name, sizeof(name));
+
+        for (char* p = name; *p; p++)
+        {
+            if (*p == '"' || *p == '\\' || (unsigned char)*p < ' ')
+                *p = '_';
+        }
+
+        fprintf(
+            os,
+            ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%lu,\"tid\":1,"
+            "\"ts\":%.3f,\"dur\":%.3f}",
+            name,
+            e->side,
+            (double)(e->start - base) / 1000.0,
+            (double)(end - e->start) / 1000.0);
+    }
+
+    fprintf(os, "\n]}\n");
+
+    if (fclose(os) != 0)
+        return -errno;
+
+    return 0;
+}
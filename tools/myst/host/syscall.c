@@ -1,7 +1,11 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
 #include <sys/syscall.h>
@@ -9,6 +13,9 @@
 
 #include "myst_u.h"
 
+/* Most messages of one sendmmsg() or recvmmsg() batch (UIO_MAXIOV) */
+#define MMSG_MAX 1024
+
 #define RETURN(EXPR)                     \
     do                                   \
     {                                    \
@@ -82,6 +89,61 @@ long myst_sendto_ocall(
     RETURN(sendto(sockfd, buf, len, flags, dest_addr, addrlen));
 }
 
+long myst_send_hostbuf_ocall(
+    int sockfd,
+    const void* buf,
+    size_t len,
+    int flags)
+{
+    RETURN(send(sockfd, buf, len, flags));
+}
+
+long myst_recv_hostbuf_ocall(int sockfd, void* buf, size_t len, int flags)
+{
+    RETURN(recv(sockfd, buf, len, flags));
+}
+
+long myst_accept_batch_ocall(
+    int sockfd,
+    struct myst_accepted* conns,
+    size_t count,
+    int flags)
+{
+    size_t n = 0;
+
+    while (n < count)
+    {
+        struct myst_accepted* c = &conns[n];
+        socklen_t addrlen = sizeof(c->addr);
+        int fd;
+
+        /* only the first accept may block */
+        if (n > 0)
+        {
+            struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+
+            if (poll(&pfd, 1, 0) != 1)
+                break;
+        }
+
+        if ((fd = accept4(sockfd, (struct sockaddr*)c->addr, &addrlen, flags)) <
+            0)
+        {
+            /* report the connections accepted so far rather than the error */
+            if (n == 0)
+                return -errno;
+
+            break;
+        }
+
+        c->fd = fd;
+        c->addrlen = addrlen;
+        n++;
+    }
+
+    return (long)n;
+}
+
 long myst_socket_ocall(int domain, int type, int protocol)
 {
     RETURN(socket(domain, type, protocol));
@@ -184,6 +246,189 @@ done:
     return ret;
 }
 
+/* Point each message header at its slices of the names, data and controls
+ * buffers of a batch (see struct myst_mmsg) */
+static int _init_mmsghdrs(
+    struct mmsghdr* msgvec,
+    struct iovec* iov,
+    const struct myst_mmsg* msgs,
+    unsigned int vlen,
+    void* names,
+    size_t names_size,
+    void* data,
+    size_t data_size,
+    void* controls,
+    size_t controls_size)
+{
+    size_t name_off = 0;
+    size_t data_off = 0;
+    size_t control_off = 0;
+
+    for (unsigned int i = 0; i < vlen; i++)
+    {
+        struct msghdr* msg = &msgvec[i].msg_hdr;
+
+        if (msgs[i].namelen > names_size - name_off ||
+            msgs[i].len > data_size - data_off ||
+            msgs[i].controllen > controls_size - control_off)
+        {
+            return -EINVAL;
+        }
+
+        iov[i].iov_base = (char*)data + data_off;
+        iov[i].iov_len = msgs[i].len;
+        msg->msg_name = msgs[i].namelen ? (char*)names + name_off : NULL;
+        msg->msg_namelen = msgs[i].namelen;
+        msg->msg_iov = &iov[i];
+        msg->msg_iovlen = 1;
+        msg->msg_control =
+            msgs[i].controllen ? (char*)controls + control_off : NULL;
+        msg->msg_controllen = msgs[i].controllen;
+        msg->msg_flags = 0;
+        msgvec[i].msg_len = 0;
+
+        name_off += msgs[i].namelen;
+        data_off += msgs[i].len;
+        control_off += msgs[i].controllen;
+    }
+
+    return 0;
+}
+
+long myst_sendmmsg_ocall(
+    int sockfd,
+    struct myst_mmsg* msgs,
+    unsigned int vlen,
+    const void* names,
+    size_t names_size,
+    const void* data,
+    size_t data_size,
+    const void* controls,
+    size_t controls_size,
+    int flags)
+{
+    long ret = 0;
+    struct mmsghdr* msgvec = NULL;
+    struct iovec* iov = NULL;
+    int retval;
+
+    if (vlen > MMSG_MAX)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (!(msgvec = calloc(vlen + 1, sizeof(struct mmsghdr))) ||
+        !(iov = calloc(vlen + 1, sizeof(struct iovec))))
+    {
+        ret = -ENOMEM;
+        goto done;
+    }
+
+    if ((ret = _init_mmsghdrs(
+             msgvec,
+             iov,
+             msgs,
+             vlen,
+             (void*)names,
+             names_size,
+             (void*)data,
+             data_size,
+             (void*)controls,
+             controls_size)) < 0)
+    {
+        goto done;
+    }
+
+    if ((retval = sendmmsg(sockfd, msgvec, vlen, flags)) < 0)
+    {
+        ret = -errno;
+        goto done;
+    }
+
+    for (int i = 0; i < retval; i++)
+        msgs[i].msg_len = msgvec[i].msg_len;
+
+    ret = retval;
+
+done:
+
+    free(msgvec);
+    free(iov);
+
+    return ret;
+}
+
+long myst_recvmmsg_ocall(
+    int sockfd,
+    struct myst_mmsg* msgs,
+    unsigned int vlen,
+    void* names,
+    size_t names_size,
+    void* data,
+    size_t data_size,
+    void* controls,
+    size_t controls_size,
+    int flags,
+    struct timespec* timeout)
+{
+    long ret = 0;
+    struct mmsghdr* msgvec = NULL;
+    struct iovec* iov = NULL;
+    int retval;
+
+    if (vlen > MMSG_MAX)
+    {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    if (!(msgvec = calloc(vlen + 1, sizeof(struct mmsghdr))) ||
+        !(iov = calloc(vlen + 1, sizeof(struct iovec))))
+    {
+        ret = -ENOMEM;
+        goto done;
+    }
+
+    if ((ret = _init_mmsghdrs(
+             msgvec,
+             iov,
+             msgs,
+             vlen,
+             names,
+             names_size,
+             data,
+             data_size,
+             controls,
+             controls_size)) < 0)
+    {
+        goto done;
+    }
+
+    if ((retval = recvmmsg(sockfd, msgvec, vlen, flags, timeout)) < 0)
+    {
+        ret = -errno;
+        goto done;
+    }
+
+    for (int i = 0; i < retval; i++)
+    {
+        msgs[i].namelen = msgvec[i].msg_hdr.msg_namelen;
+        msgs[i].controllen = msgvec[i].msg_hdr.msg_controllen;
+        msgs[i].flags = msgvec[i].msg_hdr.msg_flags;
+        msgs[i].msg_len = msgvec[i].msg_len;
+    }
+
+    ret = retval;
+
+done:
+
+    free(msgvec);
+    free(iov);
+
+    return ret;
+}
+
 long myst_shutdown_ocall(int sockfd, int how)
 {
     RETURN(shutdown(sockfd, how));
@@ -282,6 +527,11 @@ long myst_pwrite64_ocall(int fd, const void* buf, size_t count, off_t offset)
     RETURN(pwrite(fd, buf, count, offset));
 }
 
+long myst_sendfile_ocall(int out_fd, int in_fd, off_t* offset, size_t count)
+{
+    RETURN(sendfile(out_fd, in_fd, offset, count));
+}
+
 long myst_link_ocall(const char* oldpath, const char* newpath)
 {
     RETURN(link(oldpath, newpath));
@@ -0,0 +1,327 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <myst/defs.h>
+#include <myst/eventtrace.h>
+#include <myst/tcall.h>
+
+#include "tcallsim.h"
+
+/*
+**==============================================================================
+**
+** Transition-cost simulation (exec-linux --sim-tcall-latency).
+**
+**     The Linux target runs the kernel in the host process, so a tcall costs
+**     a function call where SGX pays an enclave exit and re-entry. Each tcall
+**     that would be an OCALL under SGX (the forwarded syscalls and the tcalls
+**     that the enclave cannot serve itself) is counted here and spins for the
+**     given latency first, which shows how a program would fare with the
+**     transitions without an SGX machine.
+**
+**     The paging model (--sim-epc-size) estimates what an EPC smaller than
+**     the kernel memory would cost. Every TCALLSIM_SAMPLE_MSEC a thread reads
+**     how much of the mman region the host marked referenced since the last
+**     sample (/proc/self/smaps, after clearing the bits through
+**     /proc/self/clear_refs). The pages touched in one interval beyond the
+**     EPC size cannot all have stayed resident, so each of them is charged
+**     one page swap. The charge is paid by the next tcall of any thread, the
+**     way an enclave thread pays for the faults of the driver before it goes
+**     on. It is a lower bound: the pages evicted in an earlier interval and
+**     touched again later are not charged.
+**
+**==============================================================================
+*/
+
+static bool _started;
+static tcallsim_options_t _options;
+static uint64_t _counts[TCALLSIM_MAX_TCALLS];
+
+/* the paging state */
+static uintptr_t _mman_start;
+static uintptr_t _mman_end;
+static pthread_t _sampler;
+static volatile bool _stop_sampler;
+static uint64_t _debt_nsec;
+static uint64_t _num_samples;
+static uint64_t _num_swaps;
+static size_t _max_working_set;
+
+/* Whether a tcall would leave the enclave under SGX (see the tcall table of
+ * target/sgx/enclave/tcall.c) */
+static bool _is_ocall(long n)
+{
+    switch (n)
+    {
+        case MYST_TCALL_RANDOM:
+        case MYST_TCALL_VSNPRINTF:
+        case MYST_TCALL_GEN_CREDS:
+        case MYST_TCALL_FREE_CREDS:
+        case MYST_TCALL_VERIFY_CERT:
+        case MYST_TCALL_CLOCK_GETRES:
+        case MYST_TCALL_CLOCK_GETTIME:
+        case MYST_TCALL_SET_RUN_THREAD_FUNCTION:
+        case MYST_TCALL_SET_SYSCALL_TRAMPOLINE:
+        case MYST_TCALL_TARGET_STAT:
+        case MYST_TCALL_SET_TSD:
+        case MYST_TCALL_GET_TSD:
+        case MYST_TCALL_GET_ERRNO_LOCATION:
+        case MYST_TCALL_LUKS_ENCRYPT:
+        case MYST_TCALL_LUKS_DECRYPT:
+        case MYST_TCALL_SHA256_START:
+        case MYST_TCALL_SHA256_UPDATE:
+        case MYST_TCALL_SHA256_FINISH:
+        case MYST_TCALL_SHA256_N:
+        case MYST_TCALL_GCM_NEW:
+        case MYST_TCALL_GCM_FREE:
+        case MYST_TCALL_GCM_SEAL:
+        case MYST_TCALL_GCM_OPEN:
+        case MYST_TCALL_VERIFY_SIGNATURE:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+static void _spin(uint64_t nsec)
+{
+    const uint64_t end = _now() + nsec;
+
+    while (_now() < end)
+        __asm__ __volatile__("pause" : : : "memory");
+}
+
+/* Clear the referenced bits of the pages of the process */
+static int _clear_refs(void)
+{
+    int fd;
+    int ret = 0;
+
+    if ((fd = open("/proc/self/clear_refs", O_WRONLY)) < 0)
+        return -1;
+
+    if (write(fd, "1", 1) != 1)
+        ret = -1;
+
+    close(fd);
+    return ret;
+}
+
+/* The bytes of the mman region marked referenced (over all of its mappings,
+ * since the kernel may have split it with mprotect) */
+static ssize_t _referenced(void)
+{
+    FILE* is;
+    char line[256];
+    bool inside = false;
+    size_t total = 0;
+
+    if (!(is = fopen("/proc/self/smaps", "r")))
+        return -1;
+
+    while (fgets(line, sizeof(line), is))
+    {
+        unsigned long start;
+        unsigned long end;
+        size_t kb;
+
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+            inside = start >= _mman_start && end <= _mman_end;
+        else if (inside && sscanf(line, "Referenced: %zu kB", &kb) == 1)
+            total += kb * 1024;
+    }
+
+    fclose(is);
+    return (ssize_t)total;
+}
+
+static void* _sampler_thread(void* arg)
+{
+    (void)arg;
+
+    while (!_stop_sampler)
+    {
+        ssize_t n;
+
+        usleep(TCALLSIM_SAMPLE_MSEC * 1000);
+
+        if ((n = _referenced()) < 0 || _clear_refs() != 0)
+            break;
+
+        _num_samples++;
+
+        if ((size_t)n > _max_working_set)
+            _max_working_set = (size_t)n;
+
+        if ((size_t)n > _options.epc_size)
+        {
+            const size_t swaps = ((size_t)n - _options.epc_size) / PAGE_SIZE;
+
+            __atomic_add_fetch(&_num_swaps, swaps, __ATOMIC_RELAXED);
+            __atomic_add_fetch(
+                &_debt_nsec, swaps * _options.fault_nsec, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+int tcallsim_start(
+    const tcallsim_options_t* options,
+    const void* mman_data,
+    size_t mman_size)
+{
+    if (!options)
+        return -1;
+
+    _options = *options;
+
+    if (_options.fault_nsec == 0)
+        _options.fault_nsec = TCALLSIM_DEFAULT_FAULT_NSEC;
+
+    if (_options.epc_size)
+    {
+        _mman_start = (uintptr_t)mman_data;
+        _mman_end = _mman_start + mman_size;
+
+        if (_clear_refs() != 0)
+        {
+            fprintf(
+                stderr,
+                "myst: --sim-epc-size: cannot clear the referenced bits "
+                "(/proc/self/clear_refs); the paging model is off\n");
+            _options.epc_size = 0;
+        }
+        else if (pthread_create(&_sampler, NULL, _sampler_thread, NULL) != 0)
+        {
+            return -1;
+        }
+    }
+
+    _started = true;
+    return 0;
+}
+
+void tcallsim_enter(long n)
+{
+    uint64_t debt;
+
+    if (!_started)
+        return;
+
+    /* pay for the page swaps charged since the last tcall */
+    if (__atomic_load_n(&_debt_nsec, __ATOMIC_RELAXED) &&
+        (debt = __atomic_exchange_n(&_debt_nsec, 0, __ATOMIC_RELAXED)))
+    {
+        _spin(debt);
+    }
+
+    if (!_is_ocall(n))
+        return;
+
+    if (n >= 0 && n < TCALLSIM_MAX_TCALLS)
+        __atomic_add_fetch(&_counts[n], 1, __ATOMIC_RELAXED);
+
+    if (_options.latency_nsec)
+        _spin(_options.latency_nsec);
+}
+
+static const char* _name(long n, char buf[32])
+{
+    const char* name;
+
+    if ((name = myst_event_tcall_name(n)))
+        return name;
+
+    snprintf(buf, 32, "syscall_%ld", n);
+    return buf;
+}
+
+static int _compare(const void* a, const void* b)
+{
+    const uint64_t x = _counts[*(const long*)a];
+    const uint64_t y = _counts[*(const long*)b];
+
+    return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+void tcallsim_stop(FILE* os)
+{
+    static long numbers[TCALLSIM_MAX_TCALLS];
+    size_t count = 0;
+    uint64_t total = 0;
+
+    if (!_started)
+        return;
+
+    _started = false;
+
+    if (_options.epc_size)
+    {
+        _stop_sampler = true;
+        pthread_join(_sampler, NULL);
+    }
+
+    for (long n = 0; n < TCALLSIM_MAX_TCALLS; n++)
+    {
+        if (_counts[n])
+        {
+            numbers[count++] = n;
+            total += _counts[n];
+        }
+    }
+
+    qsort(numbers, count, sizeof(long), _compare);
+
+    fprintf(
+        os, "=== tcall simulation (latency %lu ns)\n", _options.latency_nsec);
+    fprintf(os, "%12s %14s  %s\n", "calls", "added-usec", "tcall");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const long n = numbers[i];
+        const uint64_t usec = _counts[n] * _options.latency_nsec / 1000;
+        char buf[32];
+
+        fprintf(os, "%12lu %14lu  %s\n", _counts[n], usec, _name(n, buf));
+    }
+
+    fprintf(
+        os,
+        "%12lu %14lu  total\n",
+        total,
+        total * _options.latency_nsec / 1000);
+
+    if (_options.epc_size)
+    {
+        fprintf(
+            os,
+            "=== EPC paging model (EPC %zu kB, %lu ns per swap)\n"
+            "samples: %lu, max working set: %zu kB, swaps: %lu "
+            "(%lu usec added)\n",
+            _options.epc_size / 1024,
+            _options.fault_nsec,
+            _num_samples,
+            _max_working_set / 1024,
+            _num_swaps,
+            _num_swaps * _options.fault_nsec / 1000);
+    }
+}
@@ -0,0 +1,46 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_HOST_TCALLSIM_H
+#define _MYST_HOST_TCALLSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The tcalls (and forwarded syscalls) that the simulation counts */
+#define TCALLSIM_MAX_TCALLS 4096
+
+/* How often the paging model samples the pages that the kernel touched */
+#define TCALLSIM_SAMPLE_MSEC 10
+
+/* The default cost of one EPC page swap (an eviction and a reload) */
+#define TCALLSIM_DEFAULT_FAULT_NSEC 12000
+
+typedef struct tcallsim_options
+{
+    /* the latency added to each tcall that would leave an SGX enclave */
+    uint64_t latency_nsec;
+
+    /* the modelled EPC size (zero disables the paging model) */
+    size_t epc_size;
+
+    /* the cost of one page swap beyond the EPC size */
+    uint64_t fault_nsec;
+} tcallsim_options_t;
+
+/* Start the simulation for the kernel memory (the mman region); the paging
+ * model samples it on a thread of its own */
+int tcallsim_start(
+    const tcallsim_options_t* options,
+    const void* mman_data,
+    size_t mman_size);
+
+/* Called by the tcall dispatcher on each tcall (does nothing unless the
+ * simulation was started) */
+void tcallsim_enter(long n);
+
+/* Stop the sampling thread and write the counts to the stream */
+void tcallsim_stop(FILE* os);
+
+#endif /* _MYST_HOST_TCALLSIM_H */
@@ -0,0 +1,155 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "numa.h"
+#include "threadpool.h"
+
+/*
+**==============================================================================
+**
+** When a kernel thread exits, the host thread that ran it is not destroyed.
+** Instead it parks on its own condition variable in the idle list. The next
+** myst_tcall_create_thread() hands it a cookie and wakes it, which avoids
+** pthread_create() and the allocation of a fresh stack and TLS block.
+**
+**==============================================================================
+*/
+
+typedef struct worker
+{
+    struct worker* next;
+    pthread_cond_t cond;
+    threadpool_run_t run;
+    uint64_t cookie;
+} worker_t;
+
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static worker_t* _idle;
+static size_t _num_idle;
+
+/* the address of this is eventually passed to futex (uaddr argument) */
+static __thread int _thread_event;
+
+static void _remove_idle(worker_t* worker)
+{
+    for (worker_t** p = &_idle; *p; p = &(*p)->next)
+    {
+        if (*p == worker)
+        {
+            *p = worker->next;
+            _num_idle--;
+            break;
+        }
+    }
+}
+
+/* Park the worker until it is given a new cookie; false if it should exit */
+static bool _park(worker_t* worker)
+{
+    bool ret = false;
+    struct timespec ts;
+
+    pthread_mutex_lock(&_lock);
+
+    if (_num_idle >= THREADPOOL_MAX_IDLE)
+        goto done;
+
+    worker->run = NULL;
+    worker->next = _idle;
+    _idle = worker;
+    _num_idle++;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += THREADPOOL_IDLE_TIMEOUT;
+
+    while (!worker->run)
+    {
+        if (pthread_cond_timedwait(&worker->cond, &_lock, &ts) == ETIMEDOUT &&
+            !worker->run)
+        {
+            _remove_idle(worker);
+            goto done;
+        }
+    }
+
+    ret = true;
+
+done:
+    pthread_mutex_unlock(&_lock);
+    return ret;
+}
+
+static void* _worker_func(void* arg)
+{
+    worker_t* worker = (worker_t*)arg;
+
+    do
+    {
+        /* a stale wakeup from the previous kernel thread is harmless */
+        _thread_event = 0;
+        numa_place_thread();
+        (*worker->run)(worker->cookie, (uint64_t)&_thread_event);
+    } while (_park(worker));
+
+    pthread_cond_destroy(&worker->cond);
+    free(worker);
+
+    return NULL;
+}
+
+long threadpool_create_thread(threadpool_run_t run, uint64_t cookie)
+{
+    long ret = 0;
+    worker_t* worker;
+    pthread_t t;
+    pthread_attr_t attr;
+
+    if (!run)
+        return -EINVAL;
+
+    /* Hand the cookie to an idle worker if there is one */
+    pthread_mutex_lock(&_lock);
+
+    if ((worker = _idle))
+    {
+        _idle = worker->next;
+        _num_idle--;
+        worker->run = run;
+        worker->cookie = cookie;
+        pthread_cond_signal(&worker->cond);
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    if (worker)
+        return 0;
+
+    /* Otherwise start a new worker */
+    if (!(worker = calloc(1, sizeof(worker_t))))
+        return -ENOMEM;
+
+    pthread_cond_init(&worker->cond, NULL);
+    worker->run = run;
+    worker->cookie = cookie;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&t, &attr, _worker_func, worker) != 0)
+    {
+        pthread_cond_destroy(&worker->cond);
+        free(worker);
+        ret = -EINVAL;
+        goto done;
+    }
+
+done:
+    pthread_attr_destroy(&attr);
+    return ret;
+}
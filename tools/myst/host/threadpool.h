@@ -0,0 +1,21 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_HOST_THREADPOOL_H
+#define _MYST_HOST_THREADPOOL_H
+
+#include <stdint.h>
+
+/* Maximum number of host threads that may sit idle in the pool */
+#define THREADPOOL_MAX_IDLE 64
+
+/* Idle threads exit after this many seconds without work */
+#define THREADPOOL_IDLE_TIMEOUT 10
+
+/* Runs a kernel thread (given its cookie and the host thread event) */
+typedef void (*threadpool_run_t)(uint64_t cookie, uint64_t event);
+
+/* Run the cookie on an idle pool thread, or on a new one if none is idle */
+long threadpool_create_thread(threadpool_run_t run, uint64_t cookie);
+
+#endif /* _MYST_HOST_THREADPOOL_H */
@@ -150,8 +150,20 @@ const int format_libmystcrt(char* path, size_t size)
     return _format_lib(path, size, "lib/libmystcrt.so");
 }
 
-const int format_libmystkernel(char* path, size_t size)
+/* The kernel built for the target ("sgx" or "linux", see kernel/Makefile)
+ * if it was installed, else the generic kernel */
+const int format_libmystkernel(char* path, size_t size, const char* target)
 {
+    char suffix[64];
+
+    if (target)
+    {
+        snprintf(suffix, sizeof(suffix), "lib/libmystkernel-%s.so", target);
+
+        if (_format_lib(path, size, suffix) == 0 && access(path, R_OK) == 0)
+            return 0;
+    }
+
     return _format_lib(path, size, "lib/libmystkernel.so");
 }
 
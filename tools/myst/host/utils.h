@@ -23,12 +23,16 @@ const int format_mystenc(char* path, size_t size);
 
 const int format_libmystcrt(char* path, size_t size);
 
-const int format_libmystkernel(char* path, size_t size);
+const int format_libmystkernel(char* path, size_t size, const char* target);
 
 // delete a directory and anything in it
 // NOTE: this is not thread safe!
 int remove_recursive(const char* path);
 
+// copy a file: share its blocks (reflink) where the file system can, else
+// copy within the kernel, else read and write it
+int clone_file(const char* oldpath, const char* newpath);
+
 int cli_getopt(
     int* argc,
     const char* argv[],
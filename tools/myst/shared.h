@@ -8,4 +8,9 @@
 
 int myst_expand_size_string_to_ulong(const char* size_string, size_t* size);
 
+/* Get the console buffering mode named by the --console-buffering option
+ * (line, full or none), or for a null name, line buffering if the standard
+ * output is a terminal and full buffering otherwise (-1 for a bad name) */
+int myst_get_console_buffering(const char* name);
+
 #endif /* _MYST_MYST_SHARED_H */
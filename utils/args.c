@@ -229,6 +229,7 @@ int myst_args_unpack(
     buf.size = packed_size;
     buf.cap = packed_size;
     buf.offset = 0;
+    buf.flags = 0;
     const char** data;
     size_t size;
 
@@ -6,18 +6,28 @@
 #include <string.h>
 
 #include <myst/buf.h>
+#include <myst/memops.h>
 #include <stdlib.h>
 
 #include <myst/round.h>
 #include <myst/strings.h>
 
 #define MYST_BUF_CHUNK_SIZE 1024
+#define MYST_BUF_PAGE_SIZE 4096
+
+void myst_buf_init_storage(myst_buf_t* buf, void* storage, size_t size)
+{
+    memset(buf, 0, sizeof(myst_buf_t));
+    buf->data = storage;
+    buf->cap = size;
+    buf->flags = MYST_BUF_STORAGE;
+}
 
 void myst_buf_release(myst_buf_t* buf)
 {
-    if (buf && buf->data)
+    if (buf && buf->data && !(buf->flags & MYST_BUF_STORAGE))
     {
-        memset(buf->data, 0xDD, buf->size);
+        myst_memset_nt(buf->data, 0xDD, buf->size);
         free(buf->data);
     }
 
@@ -44,20 +54,44 @@ int myst_buf_reserve(myst_buf_t* buf, size_t cap)
     {
         void* new_data;
         size_t new_cap;
+        size_t n;
 
-        /* Double current capacity (will be zero the first time) */
-        new_cap = buf->cap * 2;
-
-        /* If capacity still insufficent, round to multiple of chunk size */
-        if (cap > new_cap)
+        /* Grow geometrically, so that appending n bytes a few at a time
+         * copies O(n) bytes: double small buffers (the capacity is zero the
+         * first time), but grow large ones by half, whose slack is memory
+         * that may never be used */
+        if (buf->cap < MYST_BUF_LARGE_SIZE)
+            new_cap = buf->cap * 2;
+        else
+            new_cap = buf->cap + buf->cap / 2;
+
+        if (new_cap < cap)
+            new_cap = cap;
+
+        /* Round small capacities to chunks and large ones to whole pages,
+         * which is what such allocations take anyway */
+        if (new_cap < MYST_BUF_LARGE_SIZE)
+            n = MYST_BUF_CHUNK_SIZE;
+        else
+            n = MYST_BUF_PAGE_SIZE;
+
+        new_cap = (new_cap + n - 1) / n * n;
+
+        /* Expand allocation (moving out of the caller's storage) */
+        if (buf->flags & MYST_BUF_STORAGE)
         {
-            const size_t N = MYST_BUF_CHUNK_SIZE;
-            new_cap = (cap + N - 1) / N * N;
-        }
+            if (!(new_data = malloc(new_cap)))
+                return -1;
+
+            if (buf->size)
+                memcpy(new_data, buf->data, buf->size);
 
-        /* Expand allocation */
-        if (!(new_data = realloc(buf->data, new_cap)))
+            buf->flags &= ~MYST_BUF_STORAGE;
+        }
+        else if (!(new_data = realloc(buf->data, new_cap)))
+        {
             return -1;
+        }
 
         buf->data = new_data;
         buf->cap = new_cap;
@@ -71,6 +105,13 @@ int myst_buf_resize(myst_buf_t* buf, size_t new_size)
     if (!buf)
         return -1;
 
+    /* keep the caller's storage */
+    if (new_size == 0 && (buf->flags & MYST_BUF_STORAGE))
+    {
+        buf->size = 0;
+        return 0;
+    }
+
     if (new_size == 0)
     {
         myst_buf_release(buf);
@@ -81,8 +122,9 @@ int myst_buf_resize(myst_buf_t* buf, size_t new_size)
     if (myst_buf_reserve(buf, new_size) != 0)
         return -1;
 
+    /* a large extension (such as a ramfs truncate) is not read soon */
     if (new_size > buf->size)
-        memset(buf->data + buf->size, 0, new_size - buf->size);
+        myst_memzero_nt(buf->data + buf->size, new_size - buf->size);
 
     buf->size = new_size;
 
@@ -21,7 +21,7 @@ int myst_bufu64_init(myst_bufu64_t* buf, uint64_t* data, size_t size)
 
 void myst_bufu64_release(myst_bufu64_t* buf)
 {
-    myst_buf_t tmp;
+    myst_buf_t tmp = MYST_BUF_INITIALIZER;
     const size_t n = sizeof(uint64_t);
 
     tmp.data = (uint8_t*)buf->data;
@@ -32,7 +32,7 @@ void myst_bufu64_release(myst_bufu64_t* buf)
 
 int myst_bufu64_reserve(myst_bufu64_t* buf, size_t cap)
 {
-    myst_buf_t tmp;
+    myst_buf_t tmp = MYST_BUF_INITIALIZER;
     const size_t n = sizeof(uint64_t);
 
     tmp.data = (uint8_t*)buf->data;
@@ -52,7 +52,7 @@ int myst_bufu64_reserve(myst_bufu64_t* buf, size_t cap)
 
 int myst_bufu64_resize(myst_bufu64_t* buf, size_t new_size)
 {
-    myst_buf_t tmp;
+    myst_buf_t tmp = MYST_BUF_INITIALIZER;
     const size_t n = sizeof(uint64_t);
 
     tmp.data = (uint8_t*)buf->data;
@@ -80,7 +80,7 @@ void myst_bufu64_clear(myst_bufu64_t* buf)
 
 int myst_bufu64_append(myst_bufu64_t* buf, const uint64_t* data, size_t size)
 {
-    myst_buf_t tmp;
+    myst_buf_t tmp = MYST_BUF_INITIALIZER;
     const size_t n = sizeof(uint64_t);
 
     tmp.data = (uint8_t*)buf->data;
@@ -109,7 +109,7 @@ int myst_bufu64_insert(
     const uint64_t* data,
     size_t size)
 {
-    myst_buf_t tmp;
+    myst_buf_t tmp = MYST_BUF_INITIALIZER;
     const size_t n = sizeof(uint64_t);
 
     tmp.data = (uint8_t*)buf->data;
@@ -131,7 +131,7 @@ int myst_bufu64_insert(
 
 int myst_bufu64_remove(myst_bufu64_t* buf, size_t pos, size_t size)
 {
-    myst_buf_t tmp;
+    myst_buf_t tmp = MYST_BUF_INITIALIZER;
     const size_t n = sizeof(uint64_t);
 
     tmp.data = (uint8_t*)buf->data;
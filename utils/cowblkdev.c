@@ -0,0 +1,320 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/blkdev.h>
+#include <myst/eraise.h>
+#include <myst/slab.h>
+
+/*
+**==============================================================================
+**
+** The copy-on-write overlay:
+**
+**     This device makes a read-only device (such as a verity or a read-only
+**     raw image) writable. The blocks written to it are kept in memory (the
+**     "delta") and never reach the lower device, while the blocks never
+**     written are read from the lower device (which verifies them). The
+**     delta is grouped into 4K pages (of 8 blocks each) that are carved from
+**     64K arenas, so writing a few files costs a few large allocations rather
+**     than one per block (or copies of whole files). A page also records
+**     which of its blocks were written, so the others are still read from the
+**     lower device, and no block is read just to be overwritten.
+**
+**==============================================================================
+*/
+
+#define PAGE_BLOCKS 8
+#define DELTA_PAGE_SIZE (PAGE_BLOCKS * MYST_BLKSIZE)
+
+/* Number of hash chains (a power of two) */
+#define DELTA_CHAINS 4096
+
+/* Number of pages in each arena */
+#define ARENA_PAGES 16
+
+/* The most blocks read from the lower device in one request (1 MB) */
+#define MAX_TRANSFER_BLOCKS 2048
+
+#define COWBLKDEV_MAGIC 0x5c0b7e19
+
+typedef struct delta_page delta_page_t;
+
+struct delta_page
+{
+    delta_page_t* next;
+    uint64_t pageno;
+    uint8_t valid; /* a bit for each block written to the device */
+    uint8_t* data;
+};
+
+static myst_slab_cache_t _page_cache =
+    MYST_SLAB_CACHE_INIT("cowblkdev delta_page_t", delta_page_t);
+
+typedef struct arena arena_t;
+
+struct arena
+{
+    arena_t* next;
+    uint8_t pages[ARENA_PAGES][DELTA_PAGE_SIZE];
+};
+
+typedef struct blkdev
+{
+    myst_blkdev_t base;
+    uint64_t magic;
+    myst_blkdev_t* lower;
+
+    /* the delta */
+    delta_page_t** chains;
+    arena_t* arenas;
+    size_t arena_used; /* pages given out from the first arena */
+} blkdev_t;
+
+static bool _blkdev_valid(const blkdev_t* dev)
+{
+    return dev && dev->magic == COWBLKDEV_MAGIC;
+}
+
+static delta_page_t** _chain(blkdev_t* dev, uint64_t pageno)
+{
+    return &dev->chains[pageno & (DELTA_CHAINS - 1)];
+}
+
+static delta_page_t* _find_page(blkdev_t* dev, uint64_t pageno)
+{
+    delta_page_t* p;
+
+    for (p = *_chain(dev, pageno); p; p = p->next)
+    {
+        if (p->pageno == pageno)
+            return p;
+    }
+
+    return NULL;
+}
+
+static delta_page_t* _new_page(blkdev_t* dev, uint64_t pageno)
+{
+    delta_page_t* page;
+
+    if (!dev->arenas || dev->arena_used == ARENA_PAGES)
+    {
+        arena_t* arena;
+
+        if (!(arena = malloc(sizeof(arena_t))))
+            return NULL;
+
+        arena->next = dev->arenas;
+        dev->arenas = arena;
+        dev->arena_used = 0;
+    }
+
+    if (!(page = myst_slab_alloc(&_page_cache)))
+        return NULL;
+
+    page->data = dev->arenas->pages[dev->arena_used++];
+    page->pageno = pageno;
+    page->valid = 0;
+    page->next = *_chain(dev, pageno);
+    *_chain(dev, pageno) = page;
+
+    return page;
+}
+
+/* Get a written block (returning false if the block was never written) */
+static bool _get_delta(blkdev_t* dev, uint64_t blkno, void* data)
+{
+    delta_page_t* page;
+    const uint8_t bit = 1 << (blkno % PAGE_BLOCKS);
+
+    if (!(page = _find_page(dev, blkno / PAGE_BLOCKS)) || !(page->valid & bit))
+        return false;
+
+    if (data)
+    {
+        memcpy(
+            data,
+            page->data + (blkno % PAGE_BLOCKS) * MYST_BLKSIZE,
+            MYST_BLKSIZE);
+    }
+
+    return true;
+}
+
+/* Put n written blocks that lie in one page */
+static int _put_delta(
+    blkdev_t* dev,
+    uint64_t blkno,
+    size_t n,
+    const void* data)
+{
+    int ret = 0;
+    const uint64_t pageno = blkno / PAGE_BLOCKS;
+    const size_t index = blkno % PAGE_BLOCKS;
+    delta_page_t* page;
+
+    if (!(page = _find_page(dev, pageno)) && !(page = _new_page(dev, pageno)))
+        ERAISE(-ENOMEM);
+
+    memcpy(page->data + index * MYST_BLKSIZE, data, n * MYST_BLKSIZE);
+    page->valid |= (uint8_t)(((1U << n) - 1) << index);
+
+done:
+    return ret;
+}
+
+static int _close(myst_blkdev_t* dev_)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+
+    if (!_blkdev_valid(dev))
+        ERAISE(-EINVAL);
+
+    for (size_t i = 0; i < DELTA_CHAINS; i++)
+    {
+        delta_page_t* p;
+        delta_page_t* next;
+
+        for (p = dev->chains[i]; p; p = next)
+        {
+            next = p->next;
+            myst_slab_free(p);
+        }
+    }
+
+    while (dev->arenas)
+    {
+        arena_t* next = dev->arenas->next;
+        free(dev->arenas);
+        dev->arenas = next;
+    }
+
+    ECHECK((dev->lower->close)(dev->lower));
+
+    free(dev->chains);
+    dev->magic = 0;
+    free(dev);
+
+done:
+    return ret;
+}
+
+static int _get_n(myst_blkdev_t* dev_, uint64_t blkno, size_t n, void* data)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+    uint8_t* p = data;
+
+    if (!_blkdev_valid(dev) || !data)
+        ERAISE(-EINVAL);
+
+    while (n)
+    {
+        size_t count = 1;
+
+        if (!_get_delta(dev, blkno, p))
+        {
+            /* read the run of blocks up to the next written one at once */
+            while (count < n && count < MAX_TRANSFER_BLOCKS &&
+                   !_get_delta(dev, blkno + count, NULL))
+            {
+                count++;
+            }
+
+            ECHECK(myst_blkdev_get_n(dev->lower, blkno, count, p));
+        }
+
+        blkno += count;
+        p += count * MYST_BLKSIZE;
+        n -= count;
+    }
+
+done:
+    return ret;
+}
+
+static int _get(myst_blkdev_t* dev, uint64_t blkno, void* data)
+{
+    return _get_n(dev, blkno, 1, data);
+}
+
+static int _put_n(
+    myst_blkdev_t* dev_,
+    uint64_t blkno,
+    size_t n,
+    const void* data)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+    const uint8_t* p = data;
+
+    if (!_blkdev_valid(dev) || !data)
+        ERAISE(-EINVAL);
+
+    /* copy a page at a time */
+    while (n)
+    {
+        size_t count = PAGE_BLOCKS - blkno % PAGE_BLOCKS;
+
+        if (count > n)
+            count = n;
+
+        ECHECK(_put_delta(dev, blkno, count, p));
+
+        blkno += count;
+        p += count * MYST_BLKSIZE;
+        n -= count;
+    }
+
+done:
+    return ret;
+}
+
+static int _put(myst_blkdev_t* dev, uint64_t blkno, const void* data)
+{
+    return _put_n(dev, blkno, 1, data);
+}
+
+int myst_cowblkdev_open(myst_blkdev_t* lower, myst_blkdev_t** blkdev)
+{
+    int ret = 0;
+    blkdev_t* dev = NULL;
+
+    if (blkdev)
+        *blkdev = NULL;
+
+    if (!lower || !blkdev)
+        ERAISE(-EINVAL);
+
+    if (!(dev = calloc(1, sizeof(blkdev_t))))
+        ERAISE(-ENOMEM);
+
+    if (!(dev->chains = calloc(DELTA_CHAINS, sizeof(delta_page_t*))))
+        ERAISE(-ENOMEM);
+
+    dev->base.close = _close;
+    dev->base.get = _get;
+    dev->base.put = _put;
+    dev->base.get_n = _get_n;
+    dev->base.put_n = _put_n;
+    dev->magic = COWBLKDEV_MAGIC;
+    dev->lower = lower;
+
+    *blkdev = &dev->base;
+    dev = NULL;
+
+done:
+
+    if (dev)
+    {
+        free(dev->chains);
+        free(dev);
+    }
+
+    return ret;
+}
@@ -5,8 +5,6 @@
 #define _GNU_SOURCE
 #endif
 
-#include <assert.h>
-#include <dirent.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,14 +16,20 @@
 #include <myst/cpio.h>
 #include <myst/eraise.h>
 #include <myst/round.h>
-#include <myst/strarr.h>
 #include <myst/strings.h>
 
 void* calloc(size_t nmemb, size_t size);
+void* realloc(void* ptr, size_t size);
 void free(void* ptr);
 
 #define CPIO_BLOCK_SIZE 512
 
+/* archives are written through a buffer of this size */
+#define CPIO_WRITE_BUFFER_SIZE (1024 * 1024)
+
+/* files are extracted with reads of this size */
+#define CPIO_READ_BUFFER_SIZE (64 * 1024)
+
 //#define TRACE
 #define PRINTF printf
 
@@ -61,14 +65,19 @@ typedef struct _cpio_header
     char check[8];
 } cpio_header_t;
 
+/* the newc header (see MYST_CPIO_ENTRY_MAX_SIZE) */
+MYST_STATIC_ASSERT(sizeof(cpio_header_t) == 110);
+
 struct _myst_cpio
 {
     int fd;
     cpio_header_t header;
     size_t entry_size;
     off_t eof_offset;
-    off_t offset;
+    off_t offset; /* the next entry (or the end of the written data) */
     bool write;
+    uint8_t* wbuf; /* the data not yet written (if write) */
+    size_t wlen;
 };
 
 typedef struct _entry
@@ -223,6 +232,16 @@ static ssize_t _get_mode(const cpio_header_t* header)
     return _hex_to_ssize(header->mode, 8);
 }
 
+static ssize_t _get_ino(const cpio_header_t* header)
+{
+    return _hex_to_ssize(header->ino, 8);
+}
+
+static ssize_t _get_nlink(const cpio_header_t* header)
+{
+    return _hex_to_ssize(header->nlink, 8);
+}
+
 static ssize_t _get_filesize(const cpio_header_t* header)
 {
     return _hex_to_ssize(header->filesize, 8);
@@ -254,30 +273,70 @@ done:
     return ret;
 }
 
-static int _write_padding(int fd, size_t n)
+static int _writen(int fd, const void* data, size_t size)
 {
-    int ret = -1;
-    int64_t pos;
-    int64_t new_pos;
+    const uint8_t* p = (const uint8_t*)data;
 
-    if ((pos = lseek(fd, 0, SEEK_CUR)) < 0)
-        GOTO(done);
+    while (size > 0)
+    {
+        ssize_t n;
 
-    if (myst_round_up_signed(pos, n, &new_pos) != 0)
-        GOTO(done);
+        if ((n = write(fd, p, size)) <= 0)
+            return -1;
+
+        p += n;
+        size -= (size_t)n;
+    }
 
-    for (int64_t i = pos; i < new_pos; i++)
+    return 0;
+}
+
+static int _flush(myst_cpio_t* cpio)
+{
+    if (cpio->wlen && _writen(cpio->fd, cpio->wbuf, cpio->wlen) != 0)
+        return -1;
+
+    cpio->wlen = 0;
+    return 0;
+}
+
+/* Write to the archive through its buffer (large writes go straight out) */
+static int _write(myst_cpio_t* cpio, const void* data, size_t size)
+{
+    if (cpio->wlen + size > CPIO_WRITE_BUFFER_SIZE)
     {
-        char c = '\0';
+        if (_flush(cpio) != 0)
+            return -1;
+    }
 
-        if (write(fd, &c, sizeof(c)) != 1)
-            GOTO(done);
+    if (size >= CPIO_WRITE_BUFFER_SIZE)
+    {
+        if (_writen(cpio->fd, data, size) != 0)
+            return -1;
+    }
+    else
+    {
+        memcpy(cpio->wbuf + cpio->wlen, data, size);
+        cpio->wlen += size;
     }
 
-    ret = 0;
+    cpio->offset += (off_t)size;
+    return 0;
+}
 
-done:
-    return ret;
+/* Write zeros up to the next multiple of n */
+static int _write_padding(myst_cpio_t* cpio, size_t n)
+{
+    static const uint8_t _zeros[CPIO_BLOCK_SIZE];
+    int64_t new_pos;
+
+    if (n > sizeof(_zeros))
+        return -1;
+
+    if (myst_round_up_signed(cpio->offset, (int64_t)n, &new_pos) != 0)
+        return -1;
+
+    return _write(cpio, _zeros, (size_t)(new_pos - cpio->offset));
 }
 
 myst_cpio_t* myst_cpio_open(const char* path, uint32_t flags)
@@ -294,15 +353,21 @@ myst_cpio_t* myst_cpio_open(const char* path, uint32_t flags)
 
     if ((flags & MYST_CPIO_FLAG_CREATE))
     {
-        if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+        if (!(cpio->wbuf = malloc(CPIO_WRITE_BUFFER_SIZE)))
             GOTO(done);
 
-        if (write(fd, &_dot, _dot.size) != (ssize_t)_dot.size)
+        if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
             GOTO(done);
 
         cpio->fd = fd;
         cpio->write = true;
         fd = -1;
+
+        if (_write(cpio, &_dot, _dot.size) != 0)
+        {
+            close(cpio->fd);
+            GOTO(done);
+        }
     }
     else
     {
@@ -322,7 +387,10 @@ done:
         close(fd);
 
     if (cpio)
+    {
+        free(cpio->wbuf);
         free(cpio);
+    }
 
     return ret;
 }
@@ -339,16 +407,19 @@ int myst_cpio_close(myst_cpio_t* cpio)
         const size_t size = _trailer.size;
 
         /* Write the trailer. */
-        if (write(cpio->fd, &_trailer, size) != (ssize_t)size)
+        if (_write(cpio, &_trailer, size) != 0)
         {
             GOTO(done);
         }
 
         /* Pad the trailer out to the block size boundary. */
-        if (_write_padding(cpio->fd, CPIO_BLOCK_SIZE) != 0)
+        if (_write_padding(cpio, CPIO_BLOCK_SIZE) != 0)
         {
             GOTO(done);
         }
+
+        if (_flush(cpio) != 0)
+            GOTO(done);
     }
 
     ret = 0;
@@ -356,6 +427,7 @@ int myst_cpio_close(myst_cpio_t* cpio)
 done:
 
     close(cpio->fd);
+    free(cpio->wbuf);
     memset(cpio, 0, sizeof(myst_cpio_t));
     free(cpio);
 
@@ -404,6 +476,19 @@ int myst_cpio_read_entry(myst_cpio_t* cpio, myst_cpio_entry_t* entry_out)
         entry.mode = (uint32_t)r;
     }
 
+    /* Get the inode number and the link count. */
+    {
+        if ((r = _get_ino(&hdr)) < 0 || r > UINT32_MAX)
+            GOTO(done);
+
+        entry.ino = (uint32_t)r;
+
+        if ((r = _get_nlink(&hdr)) < 0 || r > UINT32_MAX)
+            GOTO(done);
+
+        entry.nlink = (uint32_t)r;
+    }
+
     /* Get the name size. */
     {
         if ((r = _get_namesize(&hdr)) < 0 || r >= MYST_CPIO_PATH_MAX)
@@ -491,7 +576,7 @@ int myst_cpio_write_entry(myst_cpio_t* cpio, const myst_cpio_entry_t* entry)
     cpio_header_t h;
     size_t namesize;
 
-    if (!cpio || cpio->fd < 0 || !entry)
+    if (!cpio || cpio->fd < 0 || !entry || !cpio->write)
         GOTO(done);
 
     /* ATTN: Skip character files */
@@ -516,11 +601,11 @@ int myst_cpio_write_entry(myst_cpio_t* cpio, const myst_cpio_entry_t* entry)
     {
         memset(&h, 0, sizeof(h));
         memcpy(h.magic, "070701", sizeof(h.magic));
-        _uint_to_hex(h.ino, 0);
+        _uint_to_hex(h.ino, entry->ino);
         _uint_to_hex(h.mode, entry->mode);
         _uint_to_hex(h.uid, 0);
         _uint_to_hex(h.gid, 0);
-        _uint_to_hex(h.nlink, 1);
+        _uint_to_hex(h.nlink, entry->nlink ? entry->nlink : 1);
         _uint_to_hex(h.mtime, 0x56734BA4); /* hardcode a time */
         _uint_to_hex(h.filesize, (unsigned int)entry->size);
         _uint_to_hex(h.devmajor, 8);
@@ -530,17 +615,17 @@ int myst_cpio_write_entry(myst_cpio_t* cpio, const myst_cpio_entry_t* entry)
         _uint_to_hex(h.namesize, (unsigned int)namesize);
         _uint_to_hex(h.check, 0);
 
-        if (write(cpio->fd, &h, sizeof(h)) != sizeof(h))
+        if (_write(cpio, &h, sizeof(h)) != 0)
             GOTO(done);
     }
 
     /* Write the file name. */
     {
-        if (write(cpio->fd, entry->name, namesize) != (ssize_t)namesize)
+        if (_write(cpio, entry->name, namesize) != 0)
             GOTO(done);
 
         /* Pad to four-byte boundary. */
-        if (_write_padding(cpio->fd, 4) != 0)
+        if (_write_padding(cpio, 4) != 0)
             GOTO(done);
     }
 
@@ -550,6 +635,58 @@ done:
     return ret;
 }
 
+ssize_t myst_cpio_format_entry(
+    const myst_cpio_entry_t* entry,
+    void* buf,
+    size_t size)
+{
+    ssize_t ret = -1;
+    cpio_header_t h;
+    size_t namesize;
+    size_t n;
+    uint8_t* p = buf;
+
+    if (!entry || !buf)
+        GOTO(done);
+
+    if ((namesize = strlen(entry->name) + 1) > MYST_CPIO_PATH_MAX)
+        GOTO(done);
+
+    if (entry->size > UINT32_MAX)
+        GOTO(done);
+
+    /* the header and the name are padded to a multiple of four */
+    n = (sizeof(h) + namesize + 3) & ~(size_t)3;
+
+    if (n > size)
+        GOTO(done);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "070701", sizeof(h.magic));
+    _uint_to_hex(h.ino, entry->ino);
+    _uint_to_hex(h.mode, entry->mode);
+    _uint_to_hex(h.uid, 0);
+    _uint_to_hex(h.gid, 0);
+    _uint_to_hex(h.nlink, entry->nlink ? entry->nlink : 1);
+    _uint_to_hex(h.mtime, 0x56734BA4); /* hardcode a time */
+    _uint_to_hex(h.filesize, (unsigned int)entry->size);
+    _uint_to_hex(h.devmajor, 8);
+    _uint_to_hex(h.devminor, 2);
+    _uint_to_hex(h.rdevmajor, 0);
+    _uint_to_hex(h.rdevminor, 0);
+    _uint_to_hex(h.namesize, (unsigned int)namesize);
+    _uint_to_hex(h.check, 0);
+
+    memcpy(p, &h, sizeof(h));
+    memcpy(p + sizeof(h), entry->name, namesize);
+    memset(p + sizeof(h) + namesize, 0, n - sizeof(h) - namesize);
+
+    ret = (ssize_t)n;
+
+done:
+    return ret;
+}
+
 ssize_t myst_cpio_write_data(myst_cpio_t* cpio, const void* data, size_t size)
 {
     ssize_t ret = -1;
@@ -559,12 +696,12 @@ ssize_t myst_cpio_write_data(myst_cpio_t* cpio, const void* data, size_t size)
 
     if (size)
     {
-        if (write(cpio->fd, data, size) != (ssize_t)size)
+        if (_write(cpio, data, size) != 0)
             GOTO(done);
     }
     else
     {
-        if (_write_padding(cpio->fd, 4) != 0)
+        if (_write_padding(cpio, 4) != 0)
             GOTO(done);
     }
 
@@ -582,10 +719,15 @@ int myst_cpio_unpack(const char* source, const char* target)
     myst_cpio_entry_t entry;
     char path[MYST_CPIO_PATH_MAX];
     int fd = -1;
+    void* data = NULL;
+    myst_cpio_files_t files = MYST_CPIO_FILES_INITIALIZER;
 
     if (!source || !target)
         GOTO(done);
 
+    if (!(data = malloc(CPIO_READ_BUFFER_SIZE)))
+        GOTO(done);
+
     if (!(cpio = myst_cpio_open(source, 0)))
         GOTO(done);
 
@@ -620,16 +762,49 @@ int myst_cpio_unpack(const char* source, const char* target)
         }
         else if (S_ISREG(entry.mode))
         {
-            char data[512];
+            const size_t size = CPIO_READ_BUFFER_SIZE;
+            const myst_cpio_file_t* link;
+            off_t offset;
             ssize_t n;
 
+            if ((offset = lseek(cpio->fd, 0, SEEK_CUR)) < 0)
+                GOTO(done);
+
+            if (myst_cpio_files_add(&files, &entry, (size_t)offset) != 0)
+                GOTO(done);
+
             if ((fd = open(path, O_WRONLY | O_CREAT, 0666)) < 0)
                 GOTO(done);
 
-            while ((n = myst_cpio_read_data(cpio, data, sizeof(data))) > 0)
+            if ((link = myst_cpio_files_find(&files, &entry)))
             {
-                if (write(fd, data, (size_t)n) != n)
+                /* copy the data of the earlier file (the next read of an
+                 * entry seeks to it) */
+                size_t rem = link->size;
+
+                if (lseek(cpio->fd, (off_t)link->offset, SEEK_SET) < 0)
                     GOTO(done);
+
+                while (rem > 0)
+                {
+                    const size_t m = (rem < size) ? rem : size;
+
+                    if (read(cpio->fd, data, m) != (ssize_t)m)
+                        GOTO(done);
+
+                    if (_writen(fd, data, m) != 0)
+                        GOTO(done);
+
+                    rem -= m;
+                }
+            }
+            else
+            {
+                while ((n = myst_cpio_read_data(cpio, data, size)) > 0)
+                {
+                    if (_writen(fd, data, (size_t)n) != 0)
+                        GOTO(done);
+                }
             }
 
             if (close(fd) != 0)
@@ -669,197 +844,8 @@ done:
     if (fd >= 0)
         close(fd);
 
-    return ret;
-}
-
-static int _append_file(myst_cpio_t* cpio, const char* path, const char* name)
-{
-    int ret = -1;
-    struct stat st;
-    int fd = -1;
-    ssize_t n;
-
-    if (!cpio || !path)
-        GOTO(done);
-
-    /* Stat the file to get the size and mode. */
-    if (lstat(path, &st) != 0)
-        GOTO(done);
-
-    /* Write the CPIO header. */
-    {
-        myst_cpio_entry_t ent;
-
-        memset(&ent, 0, sizeof(ent));
-
-        if (S_ISDIR(st.st_mode))
-            st.st_size = 0;
-        else
-            ent.size = (size_t)st.st_size;
-
-        ent.mode = st.st_mode;
-
-        if (MYST_STRLCPY(ent.name, name) >= sizeof(ent.name))
-            GOTO(done);
-
-        if (myst_cpio_write_entry(cpio, &ent) != 0)
-        {
-            GOTO(done);
-        }
-    }
-
-    /* Write the CPIO data. */
-    if (S_ISREG(st.st_mode))
-    {
-        char buf[4096];
-
-        if ((fd = open(path, O_RDONLY, 444)) < 0)
-            GOTO(done);
-
-        while ((n = read(fd, buf, sizeof(buf))) > 0)
-        {
-            if (myst_cpio_write_data(cpio, buf, (size_t)n) != 0)
-                GOTO(done);
-        }
-
-        if (n < 0)
-            GOTO(done);
-    }
-    else if (S_ISLNK(st.st_mode))
-    {
-        char buf[PATH_MAX];
-        ssize_t n;
-
-        n = readlink(path, buf, sizeof(buf));
-
-        if (n <= 0 || n >= (ssize_t)sizeof(buf))
-            GOTO(done);
-
-        if (myst_cpio_write_data(cpio, buf, (size_t)n) != 0)
-            GOTO(done);
-    }
-
-    if (myst_cpio_write_data(cpio, NULL, 0) != 0)
-        GOTO(done);
-
-    ret = 0;
-
-done:
-
-    if (fd >= 0)
-        close(fd);
-
-    return ret;
-}
-
-static int _pack(myst_cpio_t* cpio, const char* dirname, const char* root)
-{
-    int ret = -1;
-    DIR* dir = NULL;
-    struct dirent* ent;
-    char path[MYST_CPIO_PATH_MAX];
-    myst_strarr_t dirs = MYST_STRARR_INITIALIZER;
-
-    if (!(dir = opendir(root)))
-        GOTO(done);
-
-    /* Append this directory to the CPIO archive. */
-    if (strcmp(dirname, root) != 0)
-    {
-        const char* p = root + strlen(dirname);
-
-        assert(*p == '/');
-
-        if (*p == '/')
-            p++;
-
-        if (_append_file(cpio, root, p) != 0)
-            GOTO(done);
-    }
-
-    /* Find all children of this directory. */
-    while ((ent = readdir(dir)))
-    {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
-        {
-            continue;
-        }
-
-        *path = '\0';
-
-        if (strcmp(root, ".") != 0)
-        {
-            MYST_STRLCAT(path, root);
-            MYST_STRLCAT(path, "/");
-        }
-
-        MYST_STRLCAT(path, ent->d_name);
-
-        /* Append to dirs[] array */
-        if (ent->d_type & DT_DIR)
-        {
-            if (myst_strarr_append(&dirs, path) != 0)
-                GOTO(done);
-        }
-        else
-        {
-            /* Append this file to the CPIO archive (remove the dirname). */
-
-            const char* p = path + strlen(dirname);
-
-            assert(*p == '/');
-
-            if (*p == '/')
-                p++;
-
-            if (_append_file(cpio, path, p) != 0)
-                GOTO(done);
-        }
-    }
-
-    /* Recurse into child directories */
-    {
-        size_t i;
-
-        for (i = 0; i < dirs.size; i++)
-        {
-            if (_pack(cpio, dirname, dirs.data[i]) != 0)
-                GOTO(done);
-        }
-    }
-
-    ret = 0;
-
-done:
-
-    if (dir)
-        closedir(dir);
-
-    myst_strarr_release(&dirs);
-
-    return ret;
-}
-
-int myst_cpio_pack(const char* source, const char* target)
-{
-    int ret = -1;
-    myst_cpio_t* cpio = NULL;
-
-    if (!source || !target)
-        GOTO(done);
-
-    if (!(cpio = myst_cpio_open(target, MYST_CPIO_FLAG_CREATE)))
-        GOTO(done);
-
-    if (_pack(cpio, source, source) != 0)
-        GOTO(done);
-
-    ret = 0;
-
-done:
-
-    if (cpio)
-        myst_cpio_close(cpio);
+    free(data);
+    myst_cpio_files_release(&files);
 
     return ret;
 }
@@ -930,6 +916,19 @@ int myst_cpio_next_entry(
         entry.mode = (uint32_t)r;
     }
 
+    /* Get the inode number and the link count. */
+    {
+        if ((r = _get_ino(&hdr)) < 0 || r > UINT32_MAX)
+            GOTO(done);
+
+        entry.ino = (uint32_t)r;
+
+        if ((r = _get_nlink(&hdr)) < 0 || r > UINT32_MAX)
+            GOTO(done);
+
+        entry.nlink = (uint32_t)r;
+    }
+
     /* Get the name size. */
     {
         if ((r = _get_namesize(&hdr)) < 0 || r >= MYST_CPIO_PATH_MAX)
@@ -1011,107 +1010,77 @@ done:
     return ret;
 }
 
-int myst_cpio_mem_unpack(
-    const void* cpio_data,
-    size_t cpio_size,
-    const char* target,
-    myst_cpio_create_file_function_t create_file)
-{
-    int ret = -1;
-    char path[MYST_CPIO_PATH_MAX];
-    size_t pos = 0;
-
-    for (;;)
-    {
-        myst_cpio_entry_t ent;
-        const void* file_data;
-        int r;
-
-        if ((r = myst_cpio_next_entry(
-                 cpio_data, cpio_size, &pos, &ent, &file_data)) == 0)
-        {
-            break;
-        }
-
-        if (strcmp(ent.name, ".") == 0)
-            continue;
+/*
+**==============================================================================
+**
+** shared file data:
+**
+**==============================================================================
+*/
 
-        MYST_STRLCPY(path, target);
-        MYST_STRLCAT(path, "/");
-        MYST_STRLCAT(path, ent.name);
+int myst_cpio_files_add(
+    myst_cpio_files_t* files,
+    const myst_cpio_entry_t* entry,
+    size_t offset)
+{
+    int ret = 0;
+    myst_cpio_file_t* f;
 
-        if (S_ISDIR(ent.mode))
-        {
-            struct stat st;
+    if (!files || !entry)
+        ERAISE(-EINVAL);
 
-            if (stat(path, &st) == 0)
-            {
-                if (!S_ISDIR(st.st_mode))
-                {
-                    PRINTF("*** cpio: already exists: %s\n", path);
-                    GOTO(done);
-                }
-            }
-            else if (mkdir(path, ent.mode) != 0)
-            {
-                GOTO(done);
-            }
-        }
-        else if (S_ISREG(ent.mode))
-        {
-            if (create_file)
-            {
-                if ((*create_file)(path, file_data, ent.size) != 0)
-                    GOTO(done);
-            }
-            else
-            {
-                int fd;
-                ssize_t n = (ssize_t)ent.size;
+    if (!S_ISREG(entry->mode) || entry->size == 0)
+        goto done;
 
-                if ((fd = open(path, O_WRONLY | O_CREAT, 0666)) < 0)
-                    GOTO(done);
+    if (files->size == files->capacity)
+    {
+        size_t n = files->capacity ? files->capacity * 2 : 1024;
+        myst_cpio_file_t* data;
 
-                if (write(fd, file_data, (size_t)n) != n)
-                {
-                    close(fd);
-                    GOTO(done);
-                }
+        if (!(data = realloc(files->data, n * sizeof(myst_cpio_file_t))))
+            ERAISE(-ENOMEM);
 
-                close(fd);
-                fd = -1;
-            }
-        }
-        else if (S_ISLNK(ent.mode))
-        {
-            char target[PATH_MAX];
+        files->data = data;
+        files->capacity = n;
+    }
 
-            /* read the target from CPIO archive */
-            {
-                ssize_t n = (ssize_t)ent.size;
+    f = &files->data[files->size++];
+    f->ino = entry->ino;
+    f->size = entry->size;
+    f->offset = offset;
 
-                if (n < 1 || n >= (ssize_t)sizeof(target))
-                    GOTO(done);
+done:
+    return ret;
+}
 
-                memcpy(target, file_data, ent.size);
-                target[n] = '\0';
-            }
+const myst_cpio_file_t* myst_cpio_files_find(
+    const myst_cpio_files_t* files,
+    const myst_cpio_entry_t* entry)
+{
+    const myst_cpio_file_t* f;
 
-            /* create the symlink */
-            if (symlink(target, path) != 0)
-                GOTO(done);
-        }
-        else
-        {
-            GOTO(done);
-        }
+    if (!files || !entry || !S_ISREG(entry->mode) || entry->size ||
+        entry->nlink < 2 || entry->ino == 0 || entry->ino > files->size)
+    {
+        return NULL;
     }
 
-    ret = 0;
+    /* the files are numbered in archive order (so the number is the index)
+     * and this also checks that the entry was not numbered otherwise */
+    f = &files->data[entry->ino - 1];
 
-done:
+    return (f->ino == entry->ino) ? f : NULL;
+}
 
-    return ret;
+void myst_cpio_files_release(myst_cpio_files_t* files)
+{
+    if (files)
+    {
+        free(files->data);
+        files->data = NULL;
+        files->size = 0;
+        files->capacity = 0;
+    }
 }
 
 int myst_cpio_test(const char* path)
@@ -0,0 +1,1033 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <myst/cpio.h>
+#include <myst/strarr.h>
+#include <myst/strings.h>
+
+/*
+**==============================================================================
+**
+** Packing and unpacking with threads.
+**
+**     myst_cpio_pack() is a pipeline: one thread walks the directory tree and
+**     lists the entries in archive order, reader threads load the files
+**     ahead of the writer, and the calling thread writes the entries in
+**     order. Files bigger than PACK_STREAM_SIZE are not loaded but streamed
+**     by the writer, and the readers stay at most PACK_MAX_BUFFERED bytes
+**     ahead of it.
+**
+**     The readers also hash the contents of the files, and the writer stores
+**     the data of identical files once: a file with the size and the hash of
+**     one already written (and the same bytes, which are compared) becomes a
+**     link to it (see "Shared file data" in myst/cpio.h).
+**
+**     myst_cpio_mem_unpack() creates the directories in archive order, then
+**     writes the files and symbolic links from several threads.
+**
+**     This is apart from cpio.c, since the kernel and the enclave link the
+**     rest of the CPIO code and have no pthreads.
+**
+**==============================================================================
+*/
+
+#define MAX_THREADS 8
+
+#define PACK_STREAM_SIZE (4 * 1024 * 1024)
+#define PACK_MAX_BUFFERED (64 * 1024 * 1024)
+#define PACK_READ_SIZE (1024 * 1024)
+
+/* Number of hash chains of the files written with data (a power of two) */
+#define PACK_FILE_CHAINS 4096
+
+#define PRINTF printf
+
+static size_t _num_threads(size_t max)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1)
+        n = 1;
+
+    if (n > MAX_THREADS)
+        n = MAX_THREADS;
+
+    return ((size_t)n < max) ? (size_t)n : max;
+}
+
+static int _writen(int fd, const void* data, size_t size)
+{
+    const uint8_t* p = (const uint8_t*)data;
+
+    while (size > 0)
+    {
+        ssize_t n;
+
+        if ((n = write(fd, p, size)) <= 0)
+            return -1;
+
+        p += n;
+        size -= (size_t)n;
+    }
+
+    return 0;
+}
+
+/* Read exactly size bytes (fail if the file is shorter) */
+static int _readn(int fd, void* data, size_t size)
+{
+    uint8_t* p = (uint8_t*)data;
+
+    while (size > 0)
+    {
+        ssize_t n;
+
+        if ((n = read(fd, p, size)) <= 0)
+            return -1;
+
+        p += n;
+        size -= (size_t)n;
+    }
+
+    return 0;
+}
+
+/*
+**==============================================================================
+**
+** myst_cpio_pack()
+**
+**==============================================================================
+*/
+
+typedef enum pack_state
+{
+    PACK_LISTED,  /* found by the walk */
+    PACK_LOADING, /* claimed by a reader (or the writer) */
+    PACK_READY,   /* ready for the writer */
+} pack_state_t;
+
+typedef struct pack_entry
+{
+    char* path;
+    const char* name; /* the path relative to the source directory */
+    struct stat st;
+    pack_state_t state;
+    void* data;    /* the file or the target of the symbolic link */
+    size_t size;   /* the bytes of data */
+    bool stream;   /* the writer reads the file itself */
+    uint64_t hash; /* the hash of the contents of a regular file */
+} pack_entry_t;
+
+/* A file written with data (that identical files link to) */
+typedef struct pack_file pack_file_t;
+
+struct pack_file
+{
+    pack_file_t* next;
+    char* path;
+    size_t size;
+    uint64_t hash;
+    uint32_t ino;
+};
+
+typedef struct packer
+{
+    const char* source;
+    size_t source_len;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; /* broadcast on every change */
+    pack_entry_t** entries;
+    size_t num_entries;
+    size_t capacity;
+    bool listed; /* the walk is done */
+    bool failed;
+    size_t next_read;  /* the next entry for the readers */
+    size_t next_write; /* the next entry for the writer */
+    size_t buffered;   /* bytes loaded but not yet written */
+
+    /* the files written with data (used by the writer only) */
+    pack_file_t* files[PACK_FILE_CHAINS];
+    uint32_t num_files;
+} packer_t;
+
+/* The 64-bit FNV-1a hash, continued from h */
+static uint64_t _hash(uint64_t h, const void* data, size_t size)
+{
+    const uint8_t* p = (const uint8_t*)data;
+
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ p[i]) * 0x100000001b3;
+
+    return h;
+}
+
+#define HASH_INIT 0xcbf29ce484222325
+
+/* The bytes that loading the entry adds to the read-ahead buffer */
+static size_t _load_size(const pack_entry_t* e)
+{
+    if (S_ISREG(e->st.st_mode) && e->st.st_size <= PACK_STREAM_SIZE)
+        return (size_t)e->st.st_size;
+
+    return 0;
+}
+
+static void _fail(packer_t* p)
+{
+    pthread_mutex_lock(&p->mutex);
+    p->failed = true;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+static int _add_entry(packer_t* p, const char* path, const struct stat* st)
+{
+    int ret = -1;
+    pack_entry_t* e;
+
+    if (strlen(path) <= p->source_len)
+        return -1;
+
+    if (!(e = calloc(1, sizeof(pack_entry_t))))
+        return -1;
+
+    if (!(e->path = strdup(path)))
+    {
+        free(e);
+        return -1;
+    }
+
+    /* skip the source directory and the slash after it */
+    e->name = e->path + p->source_len + 1;
+    e->st = *st;
+    e->stream = S_ISREG(st->st_mode) && st->st_size > PACK_STREAM_SIZE;
+
+    pthread_mutex_lock(&p->mutex);
+
+    if (p->num_entries == p->capacity)
+    {
+        size_t n = p->capacity ? p->capacity * 2 : 1024;
+        pack_entry_t** entries;
+
+        if (!(entries = realloc(p->entries, n * sizeof(pack_entry_t*))))
+            goto done;
+
+        p->entries = entries;
+        p->capacity = n;
+    }
+
+    p->entries[p->num_entries++] = e;
+    e = NULL;
+    pthread_cond_broadcast(&p->cond);
+    ret = 0;
+
+done:
+    pthread_mutex_unlock(&p->mutex);
+
+    if (e)
+    {
+        free(e->path);
+        free(e);
+    }
+
+    return ret;
+}
+
+/* List the directory, its files and then its subdirectories (sorted by
+ * name, so the archive does not depend on the order of readdir()) */
+static int _walk(packer_t* p, const char* dirname)
+{
+    int ret = -1;
+    DIR* dir = NULL;
+    struct dirent* ent;
+    myst_strarr_t names = MYST_STRARR_INITIALIZER;
+    myst_strarr_t dirs = MYST_STRARR_INITIALIZER;
+    char path[PATH_MAX];
+
+    if (p->failed)
+        goto done;
+
+    if (!(dir = opendir(dirname)))
+        goto done;
+
+    while ((ent = readdir(dir)))
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        if (myst_strarr_append(&names, ent->d_name) != 0)
+            goto done;
+    }
+
+    myst_strarr_sort(&names);
+
+    for (size_t i = 0; i < names.size; i++)
+    {
+        struct stat st;
+
+        if (snprintf(path, sizeof(path), "%s/%s", dirname, names.data[i]) >=
+            (int)sizeof(path))
+        {
+            goto done;
+        }
+
+        if (lstat(path, &st) != 0)
+            goto done;
+
+        if (S_ISDIR(st.st_mode))
+        {
+            /* the directory entry comes before those of its children */
+            if (_add_entry(p, path, &st) != 0)
+                goto done;
+
+            if (myst_strarr_append(&dirs, path) != 0)
+                goto done;
+        }
+        else if (_add_entry(p, path, &st) != 0)
+        {
+            goto done;
+        }
+    }
+
+    for (size_t i = 0; i < dirs.size; i++)
+    {
+        if (_walk(p, dirs.data[i]) != 0)
+            goto done;
+    }
+
+    ret = 0;
+
+done:
+
+    if (dir)
+        closedir(dir);
+
+    myst_strarr_release(&names);
+    myst_strarr_release(&dirs);
+
+    return ret;
+}
+
+static void* _walker(void* arg)
+{
+    packer_t* p = (packer_t*)arg;
+
+    if (_walk(p, p->source) != 0)
+    {
+        if (!p->failed)
+            PRINTF("*** cpio: failed to walk: %s\n", p->source);
+
+        _fail(p);
+    }
+
+    pthread_mutex_lock(&p->mutex);
+    p->listed = true;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+
+    return NULL;
+}
+
+/* Load the file (unless streamed) or the target of the symbolic link */
+static int _load(pack_entry_t* e)
+{
+    int ret = -1;
+    int fd = -1;
+
+    if (S_ISREG(e->st.st_mode) && !e->stream && e->st.st_size > 0)
+    {
+        e->size = (size_t)e->st.st_size;
+
+        if (!(e->data = malloc(e->size)))
+            goto done;
+
+        if ((fd = open(e->path, O_RDONLY)) < 0)
+            goto done;
+
+        if (_readn(fd, e->data, e->size) != 0)
+            goto done;
+
+        e->hash = _hash(HASH_INIT, e->data, e->size);
+    }
+    else if (S_ISREG(e->st.st_mode) && e->stream)
+    {
+        size_t rem = (size_t)e->st.st_size;
+
+        /* hash the file here, although the writer reads it again */
+        if (!(e->data = malloc(PACK_READ_SIZE)))
+            goto done;
+
+        if ((fd = open(e->path, O_RDONLY)) < 0)
+            goto done;
+
+        e->hash = HASH_INIT;
+
+        while (rem > 0)
+        {
+            const size_t n = (rem < PACK_READ_SIZE) ? rem : PACK_READ_SIZE;
+
+            if (_readn(fd, e->data, n) != 0)
+                goto done;
+
+            e->hash = _hash(e->hash, e->data, n);
+            rem -= n;
+        }
+
+        free(e->data);
+        e->data = NULL;
+    }
+    else if (S_ISLNK(e->st.st_mode))
+    {
+        ssize_t n;
+
+        if (!(e->data = malloc(PATH_MAX)))
+            goto done;
+
+        n = readlink(e->path, e->data, PATH_MAX);
+
+        if (n <= 0 || n >= PATH_MAX)
+            goto done;
+
+        e->size = (size_t)n;
+    }
+
+    ret = 0;
+
+done:
+
+    if (fd >= 0)
+        close(fd);
+
+    if (ret != 0)
+        PRINTF("*** cpio: failed to read: %s\n", e->path);
+
+    return ret;
+}
+
+/* Claim the next entry and load it (called and returns with the lock) */
+static void _claim_and_load(packer_t* p)
+{
+    pack_entry_t* e = p->entries[p->next_read++];
+    int r;
+
+    e->state = PACK_LOADING;
+    p->buffered += _load_size(e);
+    pthread_mutex_unlock(&p->mutex);
+
+    r = _load(e);
+
+    pthread_mutex_lock(&p->mutex);
+
+    if (r == 0)
+        e->state = PACK_READY;
+    else
+        p->failed = true;
+
+    pthread_cond_broadcast(&p->cond);
+}
+
+static void* _reader(void* arg)
+{
+    packer_t* p = (packer_t*)arg;
+
+    pthread_mutex_lock(&p->mutex);
+
+    while (!p->failed)
+    {
+        if (p->next_read < p->num_entries)
+        {
+            const pack_entry_t* e = p->entries[p->next_read];
+
+            /* wait until the entry fits in the read-ahead buffer */
+            if (p->buffered + _load_size(e) <= PACK_MAX_BUFFERED)
+            {
+                _claim_and_load(p);
+                continue;
+            }
+        }
+        else if (p->listed)
+        {
+            break;
+        }
+
+        pthread_cond_wait(&p->cond, &p->mutex);
+    }
+
+    pthread_mutex_unlock(&p->mutex);
+
+    return NULL;
+}
+
+/* Copy a big file to the archive a chunk at a time */
+static int _stream(myst_cpio_t* cpio, const pack_entry_t* e, void* buf)
+{
+    int ret = -1;
+    int fd;
+    size_t rem = (size_t)e->st.st_size;
+
+    if ((fd = open(e->path, O_RDONLY)) < 0)
+        goto done;
+
+    while (rem > 0)
+    {
+        const size_t n = (rem < PACK_READ_SIZE) ? rem : PACK_READ_SIZE;
+
+        if (_readn(fd, buf, n) != 0)
+            goto done;
+
+        if (myst_cpio_write_data(cpio, buf, n) != 0)
+            goto done;
+
+        rem -= n;
+    }
+
+    ret = 0;
+
+done:
+
+    if (fd >= 0)
+        close(fd);
+
+    if (ret != 0)
+        PRINTF("*** cpio: failed to read: %s\n", e->path);
+
+    return ret;
+}
+
+/* Whether the file has the same bytes as the entry (of the same size) */
+static bool _same_contents(const char* path, const pack_entry_t* e, void* buf)
+{
+    bool ret = false;
+    const size_t half = PACK_READ_SIZE / 2;
+    uint8_t* p = (uint8_t*)buf;
+    int fd = -1;
+    int efd = -1;
+    size_t rem = (size_t)e->st.st_size;
+    const uint8_t* data = (const uint8_t*)e->data;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        goto done;
+
+    if (e->stream && (efd = open(e->path, O_RDONLY)) < 0)
+        goto done;
+
+    while (rem > 0)
+    {
+        const size_t n = (rem < half) ? rem : half;
+
+        if (_readn(fd, p, n) != 0)
+            goto done;
+
+        /* compare with the next bytes of the entry */
+        if (e->stream)
+        {
+            if (_readn(efd, p + half, n) != 0)
+                goto done;
+
+            data = p + half;
+        }
+
+        if (memcmp(p, data, n) != 0)
+            goto done;
+
+        if (!e->stream)
+            data += n;
+
+        rem -= n;
+    }
+
+    ret = true;
+
+done:
+
+    if (fd >= 0)
+        close(fd);
+
+    if (efd >= 0)
+        close(efd);
+
+    return ret;
+}
+
+/* Find a file written with the same contents as the entry */
+static const pack_file_t* _find_file(
+    packer_t* p,
+    const pack_entry_t* e,
+    void* buf)
+{
+    const size_t size = (size_t)e->st.st_size;
+    pack_file_t* f;
+
+    for (f = p->files[e->hash & (PACK_FILE_CHAINS - 1)]; f; f = f->next)
+    {
+        if (f->size == size && f->hash == e->hash &&
+            _same_contents(f->path, e, buf))
+        {
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+static int _add_file(packer_t* p, const pack_entry_t* e)
+{
+    pack_file_t* f;
+    pack_file_t** chain = &p->files[e->hash & (PACK_FILE_CHAINS - 1)];
+
+    if (!(f = calloc(1, sizeof(pack_file_t))))
+        return -1;
+
+    if (!(f->path = strdup(e->path)))
+    {
+        free(f);
+        return -1;
+    }
+
+    f->size = (size_t)e->st.st_size;
+    f->hash = e->hash;
+    f->ino = ++p->num_files;
+    f->next = *chain;
+    *chain = f;
+
+    return 0;
+}
+
+static void _release_files(packer_t* p)
+{
+    for (size_t i = 0; i < PACK_FILE_CHAINS; i++)
+    {
+        pack_file_t* next;
+
+        for (pack_file_t* f = p->files[i]; f; f = next)
+        {
+            next = f->next;
+            free(f->path);
+            free(f);
+        }
+    }
+}
+
+static int _write_entry(
+    packer_t* p,
+    myst_cpio_t* cpio,
+    const pack_entry_t* e,
+    void* buf)
+{
+    myst_cpio_entry_t ent;
+    const pack_file_t* link = NULL;
+
+    memset(&ent, 0, sizeof(ent));
+    ent.mode = e->st.st_mode;
+
+    if (S_ISREG(e->st.st_mode))
+        ent.size = (size_t)e->st.st_size;
+    else if (S_ISLNK(e->st.st_mode))
+        ent.size = e->size;
+
+    if (MYST_STRLCPY(ent.name, e->name) >= sizeof(ent.name))
+        return -1;
+
+    /* number the files with data, or link to one with the same contents */
+    if (S_ISREG(e->st.st_mode) && ent.size > 0)
+    {
+        if ((link = _find_file(p, e, buf)))
+        {
+            ent.ino = link->ino;
+            ent.nlink = 2;
+            ent.size = 0;
+        }
+        else
+        {
+            if (_add_file(p, e) != 0)
+                return -1;
+
+            ent.ino = p->num_files;
+        }
+    }
+
+    if (myst_cpio_write_entry(cpio, &ent) != 0)
+        return -1;
+
+    /* a link has no data (it shares that of the earlier file) */
+    if (!link && e->stream)
+    {
+        if (_stream(cpio, e, buf) != 0)
+            return -1;
+    }
+    else if (!link && e->size)
+    {
+        if (myst_cpio_write_data(cpio, e->data, e->size) != 0)
+            return -1;
+    }
+
+    if (myst_cpio_write_data(cpio, NULL, 0) != 0)
+        return -1;
+
+    return 0;
+}
+
+/* Write the entries in order as they become ready */
+static int _write_entries(packer_t* p, myst_cpio_t* cpio)
+{
+    int ret = -1;
+    void* buf;
+
+    if (!(buf = malloc(PACK_READ_SIZE)))
+        return -1;
+
+    pthread_mutex_lock(&p->mutex);
+
+    while (!p->failed)
+    {
+        pack_entry_t* e;
+        int r;
+
+        if (p->next_write == p->num_entries)
+        {
+            if (p->listed)
+            {
+                ret = 0;
+                break;
+            }
+
+            pthread_cond_wait(&p->cond, &p->mutex);
+            continue;
+        }
+
+        e = p->entries[p->next_write];
+
+        if (e->state == PACK_LISTED)
+        {
+            /* no reader got to it yet, so load it here */
+            _claim_and_load(p);
+            continue;
+        }
+
+        if (e->state != PACK_READY)
+        {
+            pthread_cond_wait(&p->cond, &p->mutex);
+            continue;
+        }
+
+        pthread_mutex_unlock(&p->mutex);
+
+        r = _write_entry(p, cpio, e, buf);
+
+        pthread_mutex_lock(&p->mutex);
+
+        if (r != 0)
+        {
+            PRINTF("*** cpio: failed to write: %s\n", e->path);
+            p->failed = true;
+        }
+
+        p->buffered -= _load_size(e);
+        p->entries[p->next_write++] = NULL;
+        pthread_cond_broadcast(&p->cond);
+
+        free(e->data);
+        free(e->path);
+        free(e);
+    }
+
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+
+    free(buf);
+
+    return ret;
+}
+
+int myst_cpio_pack(const char* source, const char* target)
+{
+    int ret = -1;
+    myst_cpio_t* cpio = NULL;
+    packer_t p;
+    pthread_t walker;
+    bool have_walker = false;
+    pthread_t readers[MAX_THREADS];
+    size_t num_readers = 0;
+
+    memset(&p, 0, sizeof(p));
+    pthread_mutex_init(&p.mutex, NULL);
+    pthread_cond_init(&p.cond, NULL);
+
+    if (!source || !target)
+        goto done;
+
+    p.source = source;
+    p.source_len = strlen(source);
+
+    if (!(cpio = myst_cpio_open(target, MYST_CPIO_FLAG_CREATE)))
+        goto done;
+
+    /* without threads, walk first (and the writer loads the files) */
+    if (pthread_create(&walker, NULL, _walker, &p) == 0)
+        have_walker = true;
+    else
+        _walker(&p);
+
+    for (size_t i = 0, n = _num_threads(MAX_THREADS); i < n; i++)
+    {
+        if (pthread_create(&readers[num_readers], NULL, _reader, &p) != 0)
+            break;
+
+        num_readers++;
+    }
+
+    if (_write_entries(&p, cpio) != 0)
+        goto done;
+
+    ret = 0;
+
+done:
+
+    if (ret != 0)
+        _fail(&p);
+
+    if (have_walker)
+        pthread_join(walker, NULL);
+
+    for (size_t i = 0; i < num_readers; i++)
+        pthread_join(readers[i], NULL);
+
+    for (size_t i = p.next_write; i < p.num_entries; i++)
+    {
+        free(p.entries[i]->data);
+        free(p.entries[i]->path);
+        free(p.entries[i]);
+    }
+
+    free(p.entries);
+    _release_files(&p);
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.mutex);
+
+    if (cpio && myst_cpio_close(cpio) != 0)
+        ret = -1;
+
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** myst_cpio_mem_unpack()
+**
+**==============================================================================
+*/
+
+typedef struct unpack_file
+{
+    char path[MYST_CPIO_PATH_MAX];
+    uint32_t mode;
+    const void* data;
+    size_t size;
+} unpack_file_t;
+
+typedef struct unpacker
+{
+    unpack_file_t* files;
+    size_t num_files;
+    _Atomic(size_t) next;
+    _Atomic(bool) failed;
+} unpacker_t;
+
+static int _create_file(const unpack_file_t* f)
+{
+    if (S_ISREG(f->mode))
+    {
+        int fd;
+        int r;
+
+        if ((fd = open(f->path, O_WRONLY | O_CREAT, 0666)) < 0)
+            return -1;
+
+        r = _writen(fd, f->data, f->size);
+
+        if (close(fd) != 0)
+            r = -1;
+
+        return r;
+    }
+    else if (S_ISLNK(f->mode))
+    {
+        char target[PATH_MAX];
+
+        if (f->size < 1 || f->size >= sizeof(target))
+            return -1;
+
+        memcpy(target, f->data, f->size);
+        target[f->size] = '\0';
+
+        return symlink(target, f->path);
+    }
+
+    return -1;
+}
+
+static void* _unpacker(void* arg)
+{
+    unpacker_t* u = (unpacker_t*)arg;
+    size_t i;
+
+    while (!u->failed && (i = u->next++) < u->num_files)
+    {
+        if (_create_file(&u->files[i]) != 0)
+            u->failed = true;
+    }
+
+    return NULL;
+}
+
+int myst_cpio_mem_unpack(
+    const void* cpio_data,
+    size_t cpio_size,
+    const char* target,
+    myst_cpio_create_file_function_t create_file)
+{
+    int ret = -1;
+    char path[MYST_CPIO_PATH_MAX];
+    size_t pos = 0;
+    unpacker_t u;
+    size_t capacity = 0;
+    pthread_t threads[MAX_THREADS];
+    size_t num_threads = 0;
+    myst_cpio_files_t files = MYST_CPIO_FILES_INITIALIZER;
+
+    memset(&u, 0, sizeof(u));
+
+    /* create the directories in order and list the other entries */
+    for (;;)
+    {
+        myst_cpio_entry_t ent;
+        const void* file_data;
+        int r;
+
+        if ((r = myst_cpio_next_entry(
+                 cpio_data, cpio_size, &pos, &ent, &file_data)) == 0)
+        {
+            break;
+        }
+
+        if (r < 0)
+            goto done;
+
+        if (strcmp(ent.name, ".") == 0)
+            continue;
+
+        /* a link to an earlier file takes its data */
+        if (S_ISREG(ent.mode))
+        {
+            const uint8_t* base = (const uint8_t*)cpio_data;
+            const size_t offset = (const uint8_t*)file_data - base;
+            const myst_cpio_file_t* link;
+
+            if (myst_cpio_files_add(&files, &ent, offset) != 0)
+                goto done;
+
+            if ((link = myst_cpio_files_find(&files, &ent)))
+            {
+                file_data = base + link->offset;
+                ent.size = link->size;
+            }
+        }
+
+        MYST_STRLCPY(path, target);
+        MYST_STRLCAT(path, "/");
+        MYST_STRLCAT(path, ent.name);
+
+        if (S_ISDIR(ent.mode))
+        {
+            struct stat st;
+
+            if (stat(path, &st) == 0)
+            {
+                if (!S_ISDIR(st.st_mode))
+                {
+                    PRINTF("*** cpio: already exists: %s\n", path);
+                    goto done;
+                }
+            }
+            else if (mkdir(path, ent.mode) != 0)
+            {
+                goto done;
+            }
+        }
+        else if (S_ISREG(ent.mode) && create_file)
+        {
+            /* the callback is called in archive order on this thread */
+            if ((*create_file)(path, file_data, ent.size) != 0)
+                goto done;
+        }
+        else if (S_ISREG(ent.mode) || S_ISLNK(ent.mode))
+        {
+            unpack_file_t* f;
+
+            if (u.num_files == capacity)
+            {
+                size_t n = capacity ? capacity * 2 : 1024;
+                unpack_file_t* files;
+
+                if (!(files = realloc(u.files, n * sizeof(unpack_file_t))))
+                    goto done;
+
+                u.files = files;
+                capacity = n;
+            }
+
+            f = &u.files[u.num_files++];
+            MYST_STRLCPY(f->path, path);
+            f->mode = ent.mode;
+            f->data = file_data;
+            f->size = ent.size;
+        }
+        else
+        {
+            goto done;
+        }
+    }
+
+    /* create the files on this thread and on the others */
+    for (size_t i = 1, n = _num_threads(u.num_files); i < n; i++)
+    {
+        if (pthread_create(&threads[num_threads], NULL, _unpacker, &u) != 0)
+            break;
+
+        num_threads++;
+    }
+
+    _unpacker(&u);
+
+    for (size_t i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    if (u.failed)
+        goto done;
+
+    ret = 0;
+
+done:
+
+    free(u.files);
+    myst_cpio_files_release(&files);
+
+    return ret;
+}
@@ -0,0 +1,217 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <string.h>
+
+#include <myst/defs.h>
+#include <myst/eventtrace.h>
+#include <myst/tcall.h>
+
+static const char* _categories[] = {
+    "syscall",
+    "tcall",
+    "futex",
+    "sched",
+    "fs",
+    "args",
+};
+
+/* indexed by myst_event_type_t */
+static const char* _types[] = {
+    NULL,
+    "syscall_enter",
+    "syscall_exit",
+    "tcall_enter",
+    "tcall_exit",
+    "futex_wait",
+    "futex_woke",
+    "futex_wake",
+    "sched_start",
+    "sched_exit",
+    "sched_block",
+    "sched_unblock",
+    "sched_wakeup",
+    "sched_yield",
+    "fs_open",
+    "fs_close",
+    "fs_read",
+    "fs_write",
+    "syscall_args01",
+    "syscall_args23",
+    "syscall_args45",
+};
+
+MYST_STATIC_ASSERT(MYST_COUNTOF(_types) == MYST_EVENT_SYSCALL_ARGS45 + 1);
+
+/* indexed from MYST_TCALL_RANDOM, in the order of myst_tcall_number_t */
+static const char* _tcalls[] = {
+    "random",
+    "vsnprintf",
+    "write_console",
+    "gen_creds",
+    "free_creds",
+    "verify_cert",
+    "clock_gettime",
+    "clock_settime",
+    "isatty",
+    "add_symbol_file",
+    "load_symbols",
+    "unload_symbols",
+    "create_thread",
+    "wait",
+    "wake",
+    "wake_wait",
+    "export_file",
+    "set_run_thread_function",
+    "target_stat",
+    "set_tsd",
+    "get_tsd",
+    "get_errno_location",
+    "read_console",
+    "poll_wake",
+    "open_block_device",
+    "close_block_device",
+    "read_block_device",
+    "write_block_device",
+    "luks_encrypt",
+    "luks_decrypt",
+    "sha256_start",
+    "sha256_update",
+    "sha256_finish",
+    "verify_signature",
+    "load_fssig",
+    "clock_getres",
+    "hostbuf_alloc",
+    "hostbuf_send",
+    "hostbuf_recv",
+    "accept_batch",
+    "sha256_n",
+    "set_syscall_trampoline",
+    "wake_many",
+    "gcm_new",
+    "gcm_free",
+    "gcm_seal",
+    "gcm_open",
+    "export_cpio",
+    "debugger_attached",
+    "map_host_file",
+    "unmap_host_file",
+};
+
+MYST_STATIC_ASSERT(
+    MYST_COUNTOF(_tcalls) ==
+    MYST_TCALL_UNMAP_HOST_FILE - MYST_TCALL_RANDOM + 1);
+
+const char* myst_event_category_name(uint32_t category)
+{
+    for (size_t i = 0; i < MYST_COUNTOF(_categories); i++)
+    {
+        if (category == (1U << i))
+            return _categories[i];
+    }
+
+    return NULL;
+}
+
+const char* myst_event_type_name(uint32_t type)
+{
+    return type < MYST_COUNTOF(_types) ? _types[type] : NULL;
+}
+
+const char* myst_event_tcall_name(long n)
+{
+    if (n < MYST_TCALL_RANDOM || n > MYST_TCALL_UNMAP_HOST_FILE)
+        return NULL;
+
+    return _tcalls[n - MYST_TCALL_RANDOM];
+}
+
+static bool _is_separator(char c)
+{
+    return c == ',' || c == ' ' || c == '\t' || c == '\n';
+}
+
+int myst_parse_event_categories(const char* list, uint32_t* categories)
+{
+    uint32_t mask = 0;
+    const char* p = list;
+
+    if (!list || !categories)
+        return -EINVAL;
+
+    while (*p)
+    {
+        const char* start;
+        size_t n;
+        bool found = false;
+
+        while (_is_separator(*p))
+            p++;
+
+        if (!*p)
+            break;
+
+        for (start = p; *p && !_is_separator(*p); p++)
+            ;
+
+        n = (size_t)(p - start);
+
+        if (n == 3 && strncmp(start, "all", n) == 0)
+        {
+            mask = MYST_EVENT_ALL;
+            continue;
+        }
+
+        if (n == 4 && strncmp(start, "none", n) == 0)
+        {
+            mask = 0;
+            continue;
+        }
+
+        for (size_t i = 0; i < MYST_COUNTOF(_categories); i++)
+        {
+            if (strlen(_categories[i]) == n &&
+                strncmp(start, _categories[i], n) == 0)
+            {
+                mask |= (1U << i);
+                found = true;
+            }
+        }
+
+        if (!found)
+            return -EINVAL;
+    }
+
+    *categories = mask;
+    return 0;
+}
+
+int myst_format_event_categories(myst_buf_t* buf, uint32_t categories)
+{
+    bool first = true;
+
+    if (!buf)
+        return -EINVAL;
+
+    if (!categories)
+        return myst_buf_append(buf, "none", 4);
+
+    for (size_t i = 0; i < MYST_COUNTOF(_categories); i++)
+    {
+        const char* name = _categories[i];
+
+        if (!(categories & (1U << i)))
+            continue;
+
+        if ((!first && myst_buf_append(buf, ",", 1) != 0) ||
+            myst_buf_append(buf, name, strlen(name)) != 0)
+        {
+            return -ENOMEM;
+        }
+
+        first = false;
+    }
+
+    return 0;
+}
@@ -46,7 +46,7 @@ ssize_t myst_fdops_readv(
     ssize_t count = 0;
     uint8_t scratch[SCRATCH_BUF_SIZE];
     void* buf = NULL;
-    size_t r;
+    ssize_t r;
 
     if (!fdops || (!iov && iovcnt) || iovcnt < 0)
         ERAISE(-EINVAL);
@@ -68,10 +68,10 @@ ssize_t myst_fdops_readv(
     if ((r = (*fdops->fd_read)(fdops, object, buf, count)) < 0)
         ERAISE(r);
 
-    /* Copy the data back to the caller's buffer */
+    /* Copy only the bytes actually read back to the caller's buffer */
     {
         const uint8_t* ptr = buf;
-        size_t rem = r;
+        size_t rem = (size_t)r;
 
         for (int i = 0; i < iovcnt && rem; i++)
         {
@@ -107,7 +107,7 @@ ssize_t myst_fdops_writev(
     ssize_t count = 0;
     uint8_t scratch[SCRATCH_BUF_SIZE];
     void* buf = NULL;
-    size_t r;
+    ssize_t r;
 
     if (!fdops || (!iov && iovcnt) || iovcnt < 0)
         ERAISE(-EINVAL);
@@ -12,6 +12,9 @@
 #include <myst/strings.h>
 #include <myst/types.h>
 
+/* files are copied with reads of this size */
+#define COPY_BUFFER_SIZE (64 * 1024)
+
 int myst_load_file(const char* path, void** data_out, size_t* size_out)
 {
     int ret = 0;
@@ -95,20 +98,23 @@ int myst_copy_file_fd(char* oldpath, int newfd)
 {
     int ret = 0;
     int oldfd = -1;
-    char buf[512];
+    char* buf = NULL;
     ssize_t n;
     struct stat st;
 
     if (!oldpath || newfd < 0)
         ERAISE(-EINVAL);
 
+    if (!(buf = malloc(COPY_BUFFER_SIZE)))
+        ERAISE(-ENOMEM);
+
     if ((oldfd = open(oldpath, O_RDONLY, 0)) < 0)
         ERAISE(oldfd);
 
     if (fstat(oldfd, &st) != 0)
         ERAISE(-EINVAL);
 
-    while ((n = read(oldfd, buf, sizeof(buf))) > 0)
+    while ((n = read(oldfd, buf, COPY_BUFFER_SIZE)) > 0)
     {
         ECHECK(myst_writen(newfd, buf, (size_t)n));
     }
@@ -121,6 +127,8 @@ done:
     if (oldfd >= 0)
         close(oldfd);
 
+    free(buf);
+
     return ret;
 }
 
@@ -129,7 +137,7 @@ int myst_copy_file(const char* oldpath, const char* newpath)
     int ret = 0;
     int oldfd = -1;
     int newfd = -1;
-    char buf[512];
+    char* buf = NULL;
     ssize_t n;
     struct stat st;
     mode_t mode;
@@ -137,6 +145,9 @@ int myst_copy_file(const char* oldpath, const char* newpath)
     if (!oldpath || !newpath)
         ERAISE(-EINVAL);
 
+    if (!(buf = malloc(COPY_BUFFER_SIZE)))
+        ERAISE(-ENOMEM);
+
     if ((oldfd = open(oldpath, O_RDONLY, 0)) < 0)
         ERAISE(oldfd);
 
@@ -148,7 +159,7 @@ int myst_copy_file(const char* oldpath, const char* newpath)
     if ((newfd = open(newpath, O_WRONLY | O_CREAT | O_TRUNC, mode)) < 0)
         ERAISE(newfd);
 
-    while ((n = read(oldfd, buf, sizeof(buf))) > 0)
+    while ((n = read(oldfd, buf, COPY_BUFFER_SIZE)) > 0)
     {
         ECHECK(myst_writen(newfd, buf, (size_t)n));
     }
@@ -164,6 +175,8 @@ done:
     if (newfd >= 0)
         close(newfd);
 
+    free(buf);
+
     return ret;
 }
 
@@ -180,9 +193,9 @@ const char* myst_basename(const char* path)
 int myst_mkdirhier(const char* pathname, mode_t mode)
 {
     int ret = 0;
-    char** toks = NULL;
-    size_t ntoks;
+    myst_path_iter_t it;
     char path[PATH_MAX];
+    size_t len = 0;
     struct stat buf;
 
     if (!pathname)
@@ -192,17 +205,17 @@ int myst_mkdirhier(const char* pathname, mode_t mode)
     if (stat(pathname, &buf) == 0 && S_ISDIR(buf.st_mode))
         goto done;
 
-    ECHECK(myst_strsplit(pathname, "/", &toks, &ntoks));
-
-    *path = '\0';
+    myst_path_iter_init(&it, pathname);
 
-    for (size_t i = 0; i < ntoks; i++)
+    while (myst_path_next(&it))
     {
-        if (MYST_STRLCAT(path, "/") >= PATH_MAX)
+        if (len + 1 + it.len >= PATH_MAX)
             ERAISE(-ENAMETOOLONG);
 
-        if (MYST_STRLCAT(path, toks[i]) >= PATH_MAX)
-            ERAISE(-ENAMETOOLONG);
+        path[len++] = '/';
+        memcpy(path + len, it.name, it.len);
+        len += it.len;
+        path[len] = '\0';
 
         if (stat(path, &buf) == 0)
         {
@@ -219,9 +232,5 @@ int myst_mkdirhier(const char* pathname, mode_t mode)
         ERAISE(-EPERM);
 
 done:
-
-    if (toks)
-        free(toks);
-
     return ret;
 }
@@ -0,0 +1,223 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <myst/hashmap.h>
+
+/* the value of a slot whose key was removed (probes go on past it) */
+static char _removed;
+#define REMOVED ((void*)&_removed)
+
+/* Mix the bits of the key, since keys such as block numbers are sequential
+ * and linear probing needs them spread */
+static uint64_t _hash(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdUL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53UL;
+    x ^= x >> 33;
+    return x;
+}
+
+static int _live(const myst_hashmap_slot_t* slot)
+{
+    return slot->value && slot->value != REMOVED;
+}
+
+/* Find the slot of a key in one table (or null) */
+static myst_hashmap_slot_t* _lookup(
+    myst_hashmap_slot_t* slots,
+    size_t nslots,
+    uint64_t key)
+{
+    const size_t mask = nslots - 1;
+
+    if (!slots)
+        return NULL;
+
+    for (size_t i = _hash(key) & mask, n = 0; n < nslots; n++)
+    {
+        myst_hashmap_slot_t* slot = &slots[i];
+
+        if (!slot->value)
+            return NULL;
+
+        if (slot->value != REMOVED && slot->key == key)
+            return slot;
+
+        i = (i + 1) & mask;
+    }
+
+    return NULL;
+}
+
+/* Add a key that is not in the new table (which has room for it) */
+static void _insert(myst_hashmap_t* map, uint64_t key, void* value)
+{
+    const size_t mask = map->nslots - 1;
+    size_t i = _hash(key) & mask;
+
+    while (_live(&map->slots[i]))
+        i = (i + 1) & mask;
+
+    if (!map->slots[i].value)
+        map->nused++;
+
+    map->slots[i].key = key;
+    map->slots[i].value = value;
+}
+
+/* Move up to n slots of the old table to the new one */
+static void _migrate(myst_hashmap_t* map, size_t n)
+{
+    if (!map->old)
+        return;
+
+    while (n-- && map->old_pos < map->old_nslots)
+    {
+        myst_hashmap_slot_t* slot = &map->old[map->old_pos++];
+
+        if (_live(slot))
+        {
+            _insert(map, slot->key, slot->value);
+
+            /* so that the lookups of the old table no longer find it */
+            slot->value = REMOVED;
+        }
+    }
+
+    if (map->old_pos == map->old_nslots)
+    {
+        free(map->old);
+        map->old = NULL;
+        map->old_nslots = 0;
+        map->old_pos = 0;
+    }
+}
+
+/* Make room in the new table for one more key, starting a resize (which
+ * drops the removed markers too) when three quarters of it are used */
+static int _reserve(myst_hashmap_t* map)
+{
+    myst_hashmap_slot_t* slots;
+    size_t nslots;
+
+    if (map->nslots && map->nused + 1 <= map->nslots / 4 * 3)
+        return 0;
+
+    /* finish the resize in progress (which is rare, see below) */
+    _migrate(map, SIZE_MAX);
+
+    if (map->nslots && map->nused + 1 <= map->nslots / 4 * 3)
+        return 0;
+
+    /* double the table unless most of the used slots were removed. Either
+     * way, the old values move over before the new table is three quarters
+     * used, since each put moves MYST_HASHMAP_MIGRATE_SLOTS of them */
+    if (!(nslots = map->nslots))
+        nslots = MYST_HASHMAP_MIN_SLOTS;
+    else if (map->size + 1 > nslots / 2)
+        nslots *= 2;
+
+    if (!(slots = calloc(nslots, sizeof(myst_hashmap_slot_t))))
+        return -ENOMEM;
+
+    map->old = map->slots;
+    map->old_nslots = map->old ? map->nslots : 0;
+    map->old_pos = 0;
+    map->slots = slots;
+    map->nslots = nslots;
+    map->nused = 0;
+
+    return 0;
+}
+
+void* myst_hashmap_get(const myst_hashmap_t* map, uint64_t key)
+{
+    myst_hashmap_slot_t* slot;
+
+    if ((slot = _lookup(map->slots, map->nslots, key)) ||
+        (slot = _lookup(map->old, map->old_nslots, key)))
+    {
+        return slot->value;
+    }
+
+    return NULL;
+}
+
+int myst_hashmap_put(myst_hashmap_t* map, uint64_t key, void* value)
+{
+    int ret;
+    myst_hashmap_slot_t* slot;
+
+    if (!map || !value || value == REMOVED)
+        return -EINVAL;
+
+    if ((ret = _reserve(map)) != 0)
+        return ret;
+
+    if ((slot = _lookup(map->slots, map->nslots, key)))
+    {
+        slot->value = value;
+        return 0;
+    }
+
+    /* a key that is still in the old table moves now */
+    if ((slot = _lookup(map->old, map->old_nslots, key)))
+    {
+        slot->value = REMOVED;
+        map->size--;
+    }
+
+    _insert(map, key, value);
+    map->size++;
+    _migrate(map, MYST_HASHMAP_MIGRATE_SLOTS);
+
+    return 0;
+}
+
+void* myst_hashmap_remove(myst_hashmap_t* map, uint64_t key)
+{
+    myst_hashmap_slot_t* slot;
+    void* value = NULL;
+
+    if ((slot = _lookup(map->slots, map->nslots, key)) ||
+        (slot = _lookup(map->old, map->old_nslots, key)))
+    {
+        value = slot->value;
+        slot->value = REMOVED;
+        map->size--;
+    }
+
+    _migrate(map, MYST_HASHMAP_MIGRATE_SLOTS);
+
+    return value;
+}
+
+void myst_hashmap_foreach(
+    const myst_hashmap_t* map,
+    void (*f)(uint64_t key, void* value, void* arg),
+    void* arg)
+{
+    for (size_t i = 0; i < map->nslots; i++)
+    {
+        if (_live(&map->slots[i]))
+            (*f)(map->slots[i].key, map->slots[i].value, arg);
+    }
+
+    for (size_t i = map->old_pos; i < map->old_nslots; i++)
+    {
+        if (_live(&map->old[i]))
+            (*f)(map->old[i].key, map->old[i].value, arg);
+    }
+}
+
+void myst_hashmap_release(myst_hashmap_t* map)
+{
+    free(map->slots);
+    free(map->old);
+    *map = (myst_hashmap_t)MYST_HASHMAP_INITIALIZER;
+}
@@ -35,6 +35,22 @@ done:
     return ret;
 }
 
+void myst_iov_copy(const struct iovec* iov, int iovcnt, void* buf)
+{
+    uint8_t* ptr = buf;
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        const struct iovec* v = &iov[i];
+
+        if (v->iov_len)
+        {
+            memcpy(ptr, v->iov_base, v->iov_len);
+            ptr += v->iov_len;
+        }
+    }
+}
+
 ssize_t myst_iov_gather(const struct iovec* iov, int iovcnt, void** buf_out)
 {
     ssize_t ret = 0;
@@ -72,20 +88,7 @@ ssize_t myst_iov_gather(const struct iovec* iov, int iovcnt, void** buf_out)
     }
 
     /* copy iov onto flat buffer */
-    {
-        uint8_t* ptr = buf;
-
-        for (int i = 0; i < iovcnt; i++)
-        {
-            const struct iovec* v = &iov[i];
-
-            if (v->iov_len)
-            {
-                memcpy(ptr, v->iov_base, v->iov_len);
-                ptr += v->iov_len;
-            }
-        }
-    }
+    myst_iov_copy(iov, iovcnt, buf);
 
     *buf_out = buf;
     buf = NULL;
@@ -8,6 +8,7 @@
 #include <myst/byteorder.h>
 #include <myst/eraise.h>
 #include <myst/luks.h>
+#include <myst/workers.h>
 
 // clang-format off
 #define LUKS_MAGIC_INITIALIZER { 'L', 'U', 'K', 'S', 0xba, 0xbe }
@@ -17,6 +18,40 @@
 
 _Static_assert(MYST_BLKSIZE == LUKS_SECTOR_SIZE, "");
 
+/* The most sectors decrypted or encrypted by one call (128 KB) */
+#define MAX_CHUNK_SECTORS 256
+
+/* The size of the LUKS2 binary header (which the JSON area follows) */
+#define LUKS2_BINARY_HEADER_SIZE 4096
+
+/* The largest LUKS2 header (binary header and JSON area) */
+#define LUKS2_MAX_HEADER_SIZE (4 * 1024 * 1024)
+
+/* Nesting deeper than this is taken to be a corrupt LUKS2 JSON area */
+#define JSON_MAX_DEPTH 16
+
+/*
+**==============================================================================
+**
+** Sectors:
+**
+**     In this file a sector is a block of the device (MYST_BLKSIZE bytes).
+**     The image is encrypted in units of phdr.sector_size (512 bytes for
+**     LUKS1 and up to 4096 bytes for LUKS2), each with its own IV, so a
+**     transfer of part of such a unit goes through the whole unit.
+**
+**==============================================================================
+*/
+
+/* Reads of at least this many sectors are decrypted by the kernel worker
+ * threads when there are any (see myst/workers.h) */
+#define PARALLEL_MIN_SECTORS 128
+
+/* The sectors read from the raw device at a time by such reads (512 KB),
+ * which are split into works of at least MIN_WORK_SECTORS */
+#define PARALLEL_CHUNK_SECTORS 1024
+#define MIN_WORK_SECTORS 32
+
 typedef struct blkdev
 {
     myst_blkdev_t base;
@@ -24,9 +59,40 @@ typedef struct blkdev
     luks_phdr_t phdr;
     myst_blkdev_t* rawdev;   /* underlying raw LUKS device */
     uint8_t* masterkey; /* size given by phdr->key_bytes */
+    size_t unit_sectors; /* the sectors of each encryption unit */
 }
 blkdev_t;
 
+/* The start of a LUKS2 binary header (all integers are big endian) */
+typedef struct luks2_hdr
+{
+    uint8_t magic[LUKS_MAGIC_SIZE];
+    uint16_t version;
+    uint64_t hdr_size; /* the binary header and the JSON area */
+    uint64_t seqid;
+    char label[48];
+    char checksum_alg[32];
+    uint8_t salt[64];
+    char uuid[LUKS_UUID_STRING_SIZE];
+    char subsystem[48];
+    uint64_t hdr_offset;
+}
+__attribute__((packed)) luks2_hdr_t;
+
+_Static_assert(sizeof(luks2_hdr_t) == 264, "");
+
+/* Decrypts one part of a chunk on a kernel worker thread */
+typedef struct decrypt_work
+{
+    myst_work_t base;
+    blkdev_t* dev;
+    const uint8_t* in;
+    uint8_t* out;
+    size_t size;
+    uint64_t blkno;
+}
+decrypt_work_t;
+
 static bool _luksblkdev_valid(blkdev_t* dev)
 {
     return dev != NULL && dev->magic == LUKSBLKDEV_MAGIC;
@@ -52,64 +118,312 @@ done:
     return ret;
 }
 
-static int _get(myst_blkdev_t* dev_, size_t blkno, void* data)
+/* Decrypt or encrypt whole units, starting with the unit at sector blkno */
+static int _crypt(
+    blkdev_t* dev,
+    bool encrypt,
+    const uint8_t* in,
+    uint8_t* out,
+    size_t size,
+    uint64_t blkno)
+{
+    const uint64_t unit = blkno / dev->unit_sectors;
+
+    if (encrypt)
+        return myst_luks_encrypt(
+            &dev->phdr, dev->masterkey, in, out, size, unit);
+    else
+        return myst_luks_decrypt(
+            &dev->phdr, dev->masterkey, in, out, size, unit);
+}
+
+static int _decrypt_work(myst_work_t* work_)
+{
+    decrypt_work_t* work = (decrypt_work_t*)work_;
+    blkdev_t* dev = work->dev;
+
+    if (_crypt(dev, false, work->in, work->out, work->size, work->blkno) != 0)
+        return -EIO;
+
+    return 0;
+}
+
+/* Read a large run of sectors a chunk at a time, decrypting each chunk on
+ * the worker threads while the next one is read from the raw device */
+static int _get_n_parallel(
+    blkdev_t* dev,
+    uint64_t blkno,
+    size_t n,
+    uint8_t* data)
+{
+    int ret = 0;
+    const size_t chunk_size = PARALLEL_CHUNK_SECTORS * LUKS_SECTOR_SIZE;
+    const uint64_t offset = dev->phdr.payload_offset;
+    myst_blkdev_t* rawdev = dev->rawdev;
+    decrypt_work_t works[MYST_MAX_WORKERS + 1];
+    myst_workgroup_t group = MYST_WORKGROUP_INITIALIZER;
+    uint8_t* bufs = NULL;
+    size_t m = (n < PARALLEL_CHUNK_SECTORS) ? n : PARALLEL_CHUNK_SECTORS;
+
+    if (!(bufs = malloc(2 * chunk_size)))
+        ERAISE(-ENOMEM);
+
+    /* read the first chunk */
+    ECHECK(myst_blkdev_get_n(rawdev, blkno + offset, m, bufs));
+
+    for (size_t i = 0; n; i++)
+    {
+        uint8_t* buf = bufs + (i % 2) * chunk_size;
+        uint8_t* next = bufs + ((i + 1) % 2) * chunk_size;
+        size_t nworks = myst_num_workers() + 1;
+        size_t per_work;
+        int r = 0;
+
+        /* split the chunk evenly into works */
+        if (nworks > m / MIN_WORK_SECTORS)
+            nworks = (m + MIN_WORK_SECTORS - 1) / MIN_WORK_SECTORS;
+
+        per_work = (m + nworks - 1) / nworks;
+
+        /* the works start at units */
+        per_work += dev->unit_sectors - 1;
+        per_work -= per_work % dev->unit_sectors;
+
+        for (size_t j = 0, k = 0; k < m; j++, k += per_work)
+        {
+            const size_t count = (m - k < per_work) ? m - k : per_work;
+
+            works[j].base.fn = _decrypt_work;
+            works[j].dev = dev;
+            works[j].in = buf + k * LUKS_SECTOR_SIZE;
+            works[j].out = data + k * LUKS_SECTOR_SIZE;
+            works[j].size = count * LUKS_SECTOR_SIZE;
+            works[j].blkno = blkno + k;
+            myst_submit_work(&group, &works[j].base);
+        }
+
+        /* read the next chunk meanwhile */
+        if (n > m)
+        {
+            const size_t nnext = n - m;
+            const size_t mnext = (nnext < PARALLEL_CHUNK_SECTORS)
+                ? nnext : PARALLEL_CHUNK_SECTORS;
+
+            r = myst_blkdev_get_n(rawdev, blkno + m + offset, mnext, next);
+        }
+
+        /* the works use buf and data, so wait for them even on failure */
+        if (myst_wait_workgroup(&group) != 0)
+            ERAISE(-EIO);
+
+        ECHECK(r);
+
+        blkno += m;
+        data += m * LUKS_SECTOR_SIZE;
+        n -= m;
+        m = (n < PARALLEL_CHUNK_SECTORS) ? n : PARALLEL_CHUNK_SECTORS;
+    }
+
+done:
+
+    if (bufs)
+        free(bufs);
+
+    return ret;
+}
+
+/* Read whole units, starting with the unit at sector blkno */
+static int _get_units(blkdev_t* dev, uint64_t blkno, size_t n, uint8_t* p)
+{
+    int ret = 0;
+    uint8_t small[LUKS_MAX_SECTOR_SIZE];
+    uint8_t* buf = small;
+
+    if (n >= PARALLEL_MIN_SECTORS && myst_num_workers() > 0)
+    {
+        ECHECK(_get_n_parallel(dev, blkno, n, p));
+        goto done;
+    }
+
+    if (n * LUKS_SECTOR_SIZE > sizeof(small) &&
+        !(buf = malloc(MAX_CHUNK_SECTORS * LUKS_SECTOR_SIZE)))
+    {
+        ERAISE(-ENOMEM);
+    }
+
+    while (n)
+    {
+        const size_t m = (n < MAX_CHUNK_SECTORS) ? n : MAX_CHUNK_SECTORS;
+        const size_t size = m * LUKS_SECTOR_SIZE;
+
+        /* read the encrypted sectors */
+        myst_blkdev_t* rawdev = dev->rawdev;
+        ECHECK(myst_blkdev_get_n(
+            rawdev, blkno + dev->phdr.payload_offset, m, buf));
+
+        /* decrypt them all at once (each unit with its own IV) */
+        if (_crypt(dev, false, buf, p, size, blkno) != 0)
+            ERAISE(-EIO);
+
+        blkno += m;
+        p += size;
+        n -= m;
+    }
+
+done:
+
+    if (buf != small)
+        free(buf);
+
+    return ret;
+}
+
+/* Write whole units, starting with the unit at sector blkno */
+static int _put_units(
+    blkdev_t* dev,
+    uint64_t blkno,
+    size_t n,
+    const uint8_t* p)
+{
+    int ret = 0;
+    uint8_t small[LUKS_MAX_SECTOR_SIZE];
+    uint8_t* buf = small;
+
+    if (n * LUKS_SECTOR_SIZE > sizeof(small) &&
+        !(buf = malloc(MAX_CHUNK_SECTORS * LUKS_SECTOR_SIZE)))
+    {
+        ERAISE(-ENOMEM);
+    }
+
+    while (n)
+    {
+        const size_t m = (n < MAX_CHUNK_SECTORS) ? n : MAX_CHUNK_SECTORS;
+        const size_t size = m * LUKS_SECTOR_SIZE;
+
+        /* encrypt the sectors with the master key */
+        if (_crypt(dev, true, p, buf, size, blkno) != 0)
+            ERAISE(-EIO);
+
+        /* write the encrypted sectors */
+        myst_blkdev_t* rawdev = dev->rawdev;
+        ECHECK(myst_blkdev_put_n(
+            rawdev, blkno + dev->phdr.payload_offset, m, buf));
+
+        blkno += m;
+        p += size;
+        n -= m;
+    }
+
+done:
+
+    if (buf != small)
+        free(buf);
+
+    return ret;
+}
+
+static int _get_n(myst_blkdev_t* dev_, uint64_t blkno, size_t n, void* data)
 {
     int ret = 0;
     blkdev_t* dev = (blkdev_t*)dev_;
-    uint8_t buf[LUKS_SECTOR_SIZE];
+    uint8_t* p = data;
 
     if (!_luksblkdev_valid(dev) || !data)
         ERAISE(-EINVAL);
 
-    /* read the encrypted sector */
-    myst_blkdev_t* rawdev = dev->rawdev;
-    ECHECK((*rawdev->get)(rawdev, blkno + dev->phdr.payload_offset, buf));
-
-    /* decrypt the sector with the master key */
-    if (myst_luks_decrypt(
-        &dev->phdr,
-        dev->masterkey,
-        buf,
-        data,
-        LUKS_SECTOR_SIZE,
-        blkno) != 0)
+    while (n)
     {
-        ERAISE(-EIO);
+        const size_t skip = blkno % dev->unit_sectors;
+        size_t count;
+
+        if (skip || n < dev->unit_sectors)
+        {
+            /* part of a unit: decrypt the whole unit */
+            uint8_t unit[LUKS_MAX_SECTOR_SIZE];
+
+            count = dev->unit_sectors - skip;
+
+            if (count > n)
+                count = n;
+
+            ECHECK(_get_units(dev, blkno - skip, dev->unit_sectors, unit));
+            memcpy(
+                p, unit + skip * LUKS_SECTOR_SIZE, count * LUKS_SECTOR_SIZE);
+        }
+        else
+        {
+            count = n - n % dev->unit_sectors;
+            ECHECK(_get_units(dev, blkno, count, p));
+        }
+
+        blkno += count;
+        p += count * LUKS_SECTOR_SIZE;
+        n -= count;
     }
 
 done:
     return ret;
 }
 
-static int _put(myst_blkdev_t* dev_, size_t blkno, const void* data)
+static int _put_n(
+    myst_blkdev_t* dev_,
+    uint64_t blkno,
+    size_t n,
+    const void* data)
 {
     int ret = 0;
     blkdev_t* dev = (blkdev_t*)dev_;
-    uint8_t buf[LUKS_SECTOR_SIZE];
+    const uint8_t* p = data;
 
     if (!_luksblkdev_valid(dev) || !data)
         ERAISE(-EINVAL);
 
-    /* encrypt the sector with the master key */
-    if (myst_luks_encrypt(
-        &dev->phdr,
-        dev->masterkey,
-        data,
-        buf,
-        LUKS_SECTOR_SIZE,
-        blkno) != 0)
+    while (n)
     {
-        ERAISE(-EIO);
-    }
+        const size_t skip = blkno % dev->unit_sectors;
+        size_t count;
 
-    /* write the encrypted sector */
-    myst_blkdev_t* rawdev = dev->rawdev;
-    ECHECK((*rawdev->put)(rawdev, blkno + dev->phdr.payload_offset, buf));
+        if (skip || n < dev->unit_sectors)
+        {
+            /* part of a unit: read, change and write the whole unit */
+            uint8_t unit[LUKS_MAX_SECTOR_SIZE];
+            const uint64_t start = blkno - skip;
+
+            count = dev->unit_sectors - skip;
+
+            if (count > n)
+                count = n;
+
+            ECHECK(_get_units(dev, start, dev->unit_sectors, unit));
+            memcpy(
+                unit + skip * LUKS_SECTOR_SIZE, p, count * LUKS_SECTOR_SIZE);
+            ECHECK(_put_units(dev, start, dev->unit_sectors, unit));
+        }
+        else
+        {
+            count = n - n % dev->unit_sectors;
+            ECHECK(_put_units(dev, blkno, count, p));
+        }
+
+        blkno += count;
+        p += count * LUKS_SECTOR_SIZE;
+        n -= count;
+    }
 
 done:
     return ret;
 }
 
+static int _get(myst_blkdev_t* dev, size_t blkno, void* data)
+{
+    return _get_n(dev, blkno, 1, data);
+}
+
+static int _put(myst_blkdev_t* dev, size_t blkno, const void* data)
+{
+    return _put_n(dev, blkno, 1, data);
+}
+
 static void _fix_phdr_byte_order(luks_phdr_t* phdr)
 {
     if (!myst_is_big_endian())
@@ -130,30 +444,379 @@ static void _fix_phdr_byte_order(luks_phdr_t* phdr)
     }
 }
 
+static uint16_t _be16(uint16_t x)
+{
+    return myst_is_big_endian() ? x : (uint16_t)myst_swap_u16((int16_t)x);
+}
+
+static uint64_t _be64(uint64_t x)
+{
+    return myst_is_big_endian() ? x : myst_swap_u64(x);
+}
+
+/*
+**==============================================================================
+**
+** The LUKS2 JSON area:
+**
+**     Only the few values needed are read, by walking the JSON text in
+**     place (the kernel has no JSON parser). The values are found by key
+**     among the members of an object (nested objects are skipped over).
+**
+**==============================================================================
+*/
+
+static const char* _json_skip_space(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+
+    return p;
+}
+
+/* Skip the string at p (returning NULL if malformed) */
+static const char* _json_skip_string(const char* p, const char* end)
+{
+    if (p == end || *p++ != '"')
+        return NULL;
+
+    while (p < end && *p != '"')
+    {
+        if (*p++ == '\\')
+        {
+            if (p == end)
+                return NULL;
+
+            p++;
+        }
+    }
+
+    return (p < end) ? p + 1 : NULL;
+}
+
+/* Skip the value at p (returning NULL if malformed) */
+static const char* _json_skip_value(const char* p, const char* end, int depth)
+{
+    if (p == end || depth > JSON_MAX_DEPTH)
+        return NULL;
+
+    if (*p == '"')
+        return _json_skip_string(p, end);
+
+    if (*p == '{' || *p == '[')
+    {
+        const char close = (*p == '{') ? '}' : ']';
+
+        p = _json_skip_space(p + 1, end);
+
+        if (p < end && *p == close)
+            return p + 1;
+
+        for (;;)
+        {
+            /* the key of an object member */
+            if (close == '}')
+            {
+                if (!(p = _json_skip_string(p, end)))
+                    return NULL;
+
+                p = _json_skip_space(p, end);
+
+                if (p == end || *p++ != ':')
+                    return NULL;
+
+                p = _json_skip_space(p, end);
+            }
+
+            if (!(p = _json_skip_value(p, end, depth + 1)))
+                return NULL;
+
+            p = _json_skip_space(p, end);
+
+            if (p == end)
+                return NULL;
+
+            if (*p == close)
+                return p + 1;
+
+            if (*p++ != ',')
+                return NULL;
+
+            p = _json_skip_space(p, end);
+        }
+    }
+
+    /* a number or a literal */
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' &&
+           *p != '\n' && *p != '\r' && *p != '\t')
+    {
+        p++;
+    }
+
+    return p;
+}
+
+/* Find the value of a member of the object at obj (or of its first member
+ * if key is null) */
+static const char* _json_find(const char* obj, const char* end, const char* key)
+{
+    const size_t len = key ? strlen(key) : 0;
+    const char* p;
+
+    if (!obj || obj == end || *obj != '{')
+        return NULL;
+
+    p = _json_skip_space(obj + 1, end);
+
+    while (p < end && *p == '"')
+    {
+        const char* name = p + 1;
+        const char* value;
+
+        if (!(p = _json_skip_string(p, end)))
+            return NULL;
+
+        const size_t name_len = (size_t)(p - 1 - name);
+        const bool match =
+            !key || (name_len == len && memcmp(name, key, len) == 0);
+
+        p = _json_skip_space(p, end);
+
+        if (p == end || *p++ != ':')
+            return NULL;
+
+        value = _json_skip_space(p, end);
+
+        if (match)
+            return value;
+
+        if (!(p = _json_skip_value(value, end, 1)))
+            return NULL;
+
+        p = _json_skip_space(p, end);
+
+        if (p < end && *p == ',')
+            p = _json_skip_space(p + 1, end);
+    }
+
+    return NULL;
+}
+
+/* Get a string value (without escapes) */
+static int _json_get_string(
+    const char* value,
+    const char* end,
+    char* buf,
+    size_t size)
+{
+    const char* p;
+    size_t len;
+
+    if (!value || !(p = _json_skip_string(value, end)))
+        return -EINVAL;
+
+    len = (size_t)(p - value) - 2;
+
+    if (len >= size || memchr(value + 1, '\\', len))
+        return -EINVAL;
+
+    memcpy(buf, value + 1, len);
+    buf[len] = '\0';
+
+    return 0;
+}
+
+/* Get an unsigned integer (LUKS2 writes 64-bit values as strings) */
+static int _json_get_uint(const char* value, const char* end, uint64_t* x)
+{
+    const char* p = value;
+    const bool quoted = p && p < end && *p == '"';
+    size_t digits = 0;
+
+    if (!p)
+        return -EINVAL;
+
+    if (quoted)
+        p++;
+
+    for (*x = 0; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+    {
+        if (*x > (UINT64_MAX - (uint64_t)(*p - '0')) / 10)
+            return -EINVAL;
+
+        *x = *x * 10 + (uint64_t)(*p - '0');
+    }
+
+    if (digits == 0 || (quoted && (p == end || *p != '"')))
+        return -EINVAL;
+
+    return 0;
+}
+
+/* Convert the data segment of a LUKS2 header to the LUKS1 fields */
+static int _parse_luks2_json(
+    const char* json,
+    const char* end,
+    luks_phdr_t* phdr)
+{
+    int ret = 0;
+    const char* root = _json_skip_space(json, end);
+    const char* segment;
+    const char* keyslot;
+    char str[LUKS_CIPHER_NAME_SIZE + LUKS_CIPHER_MODE_SIZE];
+    char* dash;
+    uint64_t offset;
+    uint64_t sector_size;
+    uint64_t iv_tweak;
+    uint64_t key_size;
+
+    /* the first segment holds the file system */
+    if (!(segment = _json_find(_json_find(root, end, "segments"), end, NULL)))
+        ERAISE(-EINVAL);
+
+    ECHECK(_json_get_string(_json_find(segment, end, "type"), end, str, 8));
+
+    if (strcmp(str, "crypt") != 0)
+        ERAISE(-ENOTSUP);
+
+    /* authenticated encryption (dm-integrity) is not supported */
+    if (_json_find(segment, end, "integrity"))
+        ERAISE(-ENOTSUP);
+
+    /* such as "aes-xts-plain64" */
+    ECHECK(_json_get_string(
+        _json_find(segment, end, "encryption"), end, str, sizeof(str)));
+
+    if (!(dash = strchr(str, '-')) || dash - str >= LUKS_CIPHER_NAME_SIZE ||
+        strlen(dash + 1) >= LUKS_CIPHER_MODE_SIZE)
+    {
+        ERAISE(-ENOTSUP);
+    }
+
+    *dash = '\0';
+    strcpy(phdr->cipher_name, str);
+    strcpy(phdr->cipher_mode, dash + 1);
+
+    ECHECK(_json_get_uint(_json_find(segment, end, "offset"), end, &offset));
+
+    if (offset % LUKS_SECTOR_SIZE || offset / LUKS_SECTOR_SIZE > UINT32_MAX)
+        ERAISE(-EINVAL);
+
+    phdr->payload_offset = (uint32_t)(offset / LUKS_SECTOR_SIZE);
+
+    ECHECK(_json_get_uint(
+        _json_find(segment, end, "sector_size"), end, &sector_size));
+
+    if (sector_size < LUKS_SECTOR_SIZE || sector_size > LUKS_MAX_SECTOR_SIZE ||
+        (sector_size & (sector_size - 1)))
+    {
+        ERAISE(-ENOTSUP);
+    }
+
+    phdr->sector_size = (uint32_t)sector_size;
+
+    /* the sector numbers of the IVs must start at zero */
+    ECHECK(_json_get_uint(
+        _json_find(segment, end, "iv_tweak"), end, &iv_tweak));
+
+    if (iv_tweak != 0)
+        ERAISE(-ENOTSUP);
+
+    /* the key size is that of a key slot (if none is left, the key given to
+     * myst_luksblkdev_open() is taken to have the right size) */
+    if ((keyslot = _json_find(_json_find(root, end, "keyslots"), end, NULL)))
+    {
+        ECHECK(_json_get_uint(
+            _json_find(keyslot, end, "key_size"), end, &key_size));
+
+        if (key_size == 0 || key_size > UINT32_MAX)
+            ERAISE(-EINVAL);
+
+        phdr->key_bytes = (uint32_t)key_size;
+    }
+
+done:
+    return ret;
+}
+
+/* Read a LUKS2 header into the LUKS1 fields of phdr */
+static int _read_luks2_phdr(
+    myst_blkdev_t* rawdev,
+    const luks2_hdr_t* hdr,
+    luks_phdr_t* phdr)
+{
+    int ret = 0;
+    const uint64_t hdr_size = _be64(hdr->hdr_size);
+    uint8_t* buf = NULL;
+
+    if (hdr_size <= LUKS2_BINARY_HEADER_SIZE ||
+        hdr_size > LUKS2_MAX_HEADER_SIZE || hdr_size % LUKS_SECTOR_SIZE)
+    {
+        ERAISE(-EINVAL);
+    }
+
+    if (!(buf = malloc(hdr_size)))
+        ERAISE(-ENOMEM);
+
+    ECHECK(myst_blkdev_get_n(rawdev, 0, hdr_size / LUKS_SECTOR_SIZE, buf));
+
+    memset(phdr, 0, sizeof(luks_phdr_t));
+    memcpy(phdr->magic, hdr->magic, LUKS_MAGIC_SIZE);
+    phdr->version = 2;
+    memcpy(phdr->uuid, hdr->uuid, LUKS_UUID_STRING_SIZE);
+    phdr->uuid[LUKS_UUID_STRING_SIZE - 1] = '\0';
+
+    /* the JSON text ends with a null byte (or at the end of the area) */
+    {
+        const char* json = (const char*)buf + LUKS2_BINARY_HEADER_SIZE;
+        const size_t max = hdr_size - LUKS2_BINARY_HEADER_SIZE;
+        const char* end = memchr(json, '\0', max);
+
+        ECHECK(_parse_luks2_json(json, end ? end : json + max, phdr));
+    }
+
+done:
+
+    if (buf)
+        free(buf);
+
+    return ret;
+}
+
 static int _read_phdr(myst_blkdev_t* rawdev, luks_phdr_t* phdr)
 {
     int ret = 0;
     union {
         luks_phdr_t phdr;
+        luks2_hdr_t hdr2;
         uint8_t sectors[2*LUKS_SECTOR_SIZE];
     } u;
     static uint8_t _magic[] = LUKS_MAGIC_INITIALIZER;
+    uint16_t version;
 
     if (!rawdev)
         ERAISE(-EINVAL);
 
     /* read the first two sectors of the raw devices */
-    ECHECK((rawdev->get)(rawdev, 0, &u.sectors[0]));
-    ECHECK((rawdev->get)(rawdev, 0, &u.sectors[LUKS_SECTOR_SIZE]));
+    ECHECK(myst_blkdev_get_n(rawdev, 0, 2, &u.sectors[0]));
 
     /* check the LUKS magic bytes */
     if (memcmp(u.phdr.magic, _magic, LUKS_MAGIC_SIZE) != 0)
         ERAISE(-EINVAL);
 
-    if (phdr)
+    /* both versions have the version after the magic bytes */
+    if ((version = _be16(u.phdr.version)) != 1 && version != 2)
+        ERAISE(-ENOTSUP);
+
+    if (phdr && version == 2)
+    {
+        ECHECK(_read_luks2_phdr(rawdev, &u.hdr2, phdr));
+    }
+    else if (phdr)
     {
-        memcpy(phdr, &u.phdr, sizeof(luks_phdr_t));
+        memcpy(phdr, &u.phdr, offsetof(luks_phdr_t, sector_size));
         _fix_phdr_byte_order(phdr);
+        phdr->sector_size = LUKS_SECTOR_SIZE;
     }
 
 done:
@@ -181,6 +844,10 @@ int myst_luksblkdev_open(
     /* read the LUKS phdr */
     ECHECK(_read_phdr(rawdev, &phdr));
 
+    /* a LUKS2 header without key slots does not give the key size */
+    if (phdr.key_bytes == 0)
+        phdr.key_bytes = masterkey_bytes;
+
     /* if masterkey size is wrong */
     if (masterkey_bytes != phdr.key_bytes)
         ERAISE(-EINVAL);
@@ -200,10 +867,13 @@ int myst_luksblkdev_open(
     dev->base.close = _close;
     dev->base.put = _put;
     dev->base.get = _get;
+    dev->base.get_n = _get_n;
+    dev->base.put_n = _put_n;
     dev->rawdev = rawdev;
     dev->magic = LUKSBLKDEV_MAGIC;
     dev->phdr = phdr;
     dev->masterkey = mk;
+    dev->unit_sectors = phdr.sector_size / LUKS_SECTOR_SIZE;
 
     *blkdev = &dev->base;
     dev = NULL;
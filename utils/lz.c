@@ -0,0 +1,246 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <myst/eraise.h>
+#include <myst/lz.h>
+
+/* The shortest match that is encoded (shorter ones stay literals) */
+#define MIN_MATCH 4
+
+/* The farthest back a match may start (the offset is 16 bits) */
+#define MAX_OFFSET 65535
+
+/* The size of the table that finds earlier occurrences of four bytes */
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+
+static uint32_t _hash(const uint8_t* p)
+{
+    uint32_t x;
+
+    memcpy(&x, p, sizeof(x));
+    return (x * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static int _put_length(uint8_t** op, const uint8_t* oend, size_t n)
+{
+    int ret = 0;
+    uint8_t* p = *op;
+
+    for (;;)
+    {
+        if (p == oend)
+            ERAISE(-ENOSPC);
+
+        if (n < 255)
+        {
+            *p++ = (uint8_t)n;
+            break;
+        }
+
+        *p++ = 255;
+        n -= 255;
+    }
+
+    *op = p;
+
+done:
+    return ret;
+}
+
+static int _get_length(const uint8_t** ip, const uint8_t* iend, size_t* n)
+{
+    int ret = 0;
+    const uint8_t* p = *ip;
+    uint8_t byte;
+
+    do
+    {
+        if (p == iend)
+            ERAISE(-EINVAL);
+
+        byte = *p++;
+        *n += byte;
+    } while (byte == 255);
+
+    *ip = p;
+
+done:
+    return ret;
+}
+
+/* Write one sequence (with no match when match_len is zero) */
+static int _put_sequence(
+    uint8_t** op_,
+    const uint8_t* oend,
+    const uint8_t* literals,
+    size_t num_literals,
+    size_t offset,
+    size_t match_len)
+{
+    int ret = 0;
+    uint8_t* op = *op_;
+    uint8_t* token;
+
+    if (op == oend)
+        ERAISE(-ENOSPC);
+
+    token = op++;
+    *token = (uint8_t)((num_literals < 15 ? num_literals : 15) << 4);
+
+    if (num_literals >= 15)
+        ECHECK(_put_length(&op, oend, num_literals - 15));
+
+    if ((size_t)(oend - op) < num_literals)
+        ERAISE(-ENOSPC);
+
+    memcpy(op, literals, num_literals);
+    op += num_literals;
+
+    if (match_len)
+    {
+        const size_t n = match_len - MIN_MATCH;
+
+        if (oend - op < 2)
+            ERAISE(-ENOSPC);
+
+        *op++ = (uint8_t)(offset & 0xff);
+        *op++ = (uint8_t)(offset >> 8);
+        *token |= (uint8_t)(n < 15 ? n : 15);
+
+        if (n >= 15)
+            ECHECK(_put_length(&op, oend, n - 15));
+    }
+
+    *op_ = op;
+
+done:
+    return ret;
+}
+
+ssize_t myst_lz_compress(
+    const void* in,
+    size_t in_size,
+    void* out,
+    size_t out_size)
+{
+    ssize_t ret = 0;
+    const uint8_t* base = (const uint8_t*)in;
+    const uint8_t* end = base + in_size;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    uint8_t* op = (uint8_t*)out;
+    const uint8_t* oend = op + out_size;
+    /* one more than the offset of the last position with a hash (or 0) */
+    uint32_t table[HASH_SIZE];
+
+    if ((!in && in_size) || !out || in_size > UINT32_MAX)
+        ERAISE(-EINVAL);
+
+    memset(table, 0, sizeof(table));
+
+    while (end - ip >= MIN_MATCH)
+    {
+        const uint32_t h = _hash(ip);
+        const uint8_t* ref = table[h] ? base + table[h] - 1 : NULL;
+        size_t len = MIN_MATCH;
+
+        table[h] = (uint32_t)(ip - base) + 1;
+
+        if (!ref || ip - ref > MAX_OFFSET || memcmp(ref, ip, MIN_MATCH) != 0)
+        {
+            ip++;
+            continue;
+        }
+
+        /* the match may run into the bytes it copies (as the decoder
+         * copies forward one byte at a time) */
+        while (ip + len < end && ref[len] == ip[len])
+            len++;
+
+        ECHECK(_put_sequence(
+            &op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), len));
+
+        ip += len;
+        anchor = ip;
+    }
+
+    /* the remaining bytes are literals */
+    ECHECK(_put_sequence(&op, oend, anchor, (size_t)(end - anchor), 0, 0));
+
+    ret = op - (uint8_t*)out;
+
+done:
+    return ret;
+}
+
+ssize_t myst_lz_decompress(
+    const void* in,
+    size_t in_size,
+    void* out,
+    size_t out_size)
+{
+    ssize_t ret = 0;
+    const uint8_t* ip = (const uint8_t*)in;
+    const uint8_t* iend = ip + in_size;
+    uint8_t* op = (uint8_t*)out;
+    const uint8_t* oend = op + out_size;
+
+    if ((!in && in_size) || (!out && out_size))
+        ERAISE(-EINVAL);
+
+    while (ip < iend)
+    {
+        const uint8_t token = *ip++;
+        size_t n = token >> 4;
+        size_t offset;
+        const uint8_t* ref;
+
+        /* the literals */
+        if (n == 15)
+            ECHECK(_get_length(&ip, iend, &n));
+
+        if (n > (size_t)(iend - ip) || n > (size_t)(oend - op))
+            ERAISE(-EINVAL);
+
+        memcpy(op, ip, n);
+        ip += n;
+        op += n;
+
+        /* the last sequence has no match */
+        if (ip == iend)
+            break;
+
+        /* the match */
+        if (iend - ip < 2)
+            ERAISE(-EINVAL);
+
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > (size_t)(op - (uint8_t*)out))
+            ERAISE(-EINVAL);
+
+        n = token & 15;
+
+        if (n == 15)
+            ECHECK(_get_length(&ip, iend, &n));
+
+        n += MIN_MATCH;
+
+        if (n > (size_t)(oend - op))
+            ERAISE(-EINVAL);
+
+        for (ref = op - offset; n--;)
+            *op++ = *ref++;
+    }
+
+    ret = op - (uint8_t*)out;
+
+done:
+    return ret;
+}
@@ -0,0 +1,578 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <myst/memops.h>
+
+/*
+**==============================================================================
+**
+** Feature detection
+**
+**==============================================================================
+*/
+
+#define XCR0_SSE_AVX 0x06 /* the xmm and ymm state */
+#define XCR0_AVX512 0xe6  /* and the opmask and zmm state */
+
+static void _cpuid(uint32_t leaf, uint32_t r[4])
+{
+    __asm__ __volatile__("cpuid"
+                         : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3])
+                         : "a"(leaf), "c"(0));
+}
+
+static uint64_t _xgetbv(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint32_t myst_memops_detect(void)
+{
+    uint32_t features = 0;
+    uint32_t r[4];
+    bool avx;
+    uint64_t xcr0 = 0;
+
+    /* the string and vector features are all in leaf 7 */
+    _cpuid(0, r);
+
+    if (r[0] < 7)
+        return 0;
+
+    _cpuid(1, r);
+    avx = (r[2] & (1 << 28)) != 0;
+
+    /* OSXSAVE: the OS (or the enclave) enabled XGETBV */
+    if (r[2] & (1 << 27))
+        xcr0 = _xgetbv();
+
+    _cpuid(7, r);
+
+    if (r[1] & (1 << 9))
+        features |= MYST_MEMOPS_ERMS;
+
+    if (r[3] & (1 << 4))
+        features |= MYST_MEMOPS_FSRM;
+
+    if (avx && (r[1] & (1 << 5)) && (xcr0 & XCR0_SSE_AVX) == XCR0_SSE_AVX)
+        features |= MYST_MEMOPS_AVX2;
+
+    if ((r[1] & (1 << 16)) && (xcr0 & XCR0_AVX512) == XCR0_AVX512)
+        features |= MYST_MEMOPS_AVX512;
+
+    return features;
+}
+
+/*
+**==============================================================================
+**
+** memcpy(): each version loads the last vector first, copies whole vectors
+** forward (four at a time) and then stores the last vector. So a copy to a
+** lower address that overlaps the source is also correct (for memmove).
+**
+**==============================================================================
+*/
+
+void myst_memcpy_erms(void* dest, const void* src, size_t n)
+{
+    __asm__ __volatile__("rep movsb"
+                         : "+D"(dest), "+S"(src), "+c"(n)
+                         :
+                         : "memory");
+}
+
+void myst_memcpy_sse2(void* dest, const void* src, size_t n)
+{
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    uint8_t* dt = d + n - 16;
+    const uint8_t* st = s + n - 16;
+
+    __asm__ __volatile__("movdqu (%[st]), %%xmm4\n"
+                         "1:\n"
+                         "mov %[dt], %%rax\n"
+                         "sub %[d], %%rax\n"
+                         "cmp $64, %%rax\n"
+                         "jb 2f\n"
+                         "movdqu (%[s]), %%xmm0\n"
+                         "movdqu 16(%[s]), %%xmm1\n"
+                         "movdqu 32(%[s]), %%xmm2\n"
+                         "movdqu 48(%[s]), %%xmm3\n"
+                         "movdqu %%xmm0, (%[d])\n"
+                         "movdqu %%xmm1, 16(%[d])\n"
+                         "movdqu %%xmm2, 32(%[d])\n"
+                         "movdqu %%xmm3, 48(%[d])\n"
+                         "add $64, %[d]\n"
+                         "add $64, %[s]\n"
+                         "jmp 1b\n"
+                         "2:\n"
+                         "cmp %[dt], %[d]\n"
+                         "jae 3f\n"
+                         "movdqu (%[s]), %%xmm0\n"
+                         "movdqu %%xmm0, (%[d])\n"
+                         "add $16, %[d]\n"
+                         "add $16, %[s]\n"
+                         "jmp 2b\n"
+                         "3:\n"
+                         "movdqu %%xmm4, (%[dt])\n"
+                         : [d] "+r"(d), [s] "+r"(s)
+                         : [dt] "r"(dt), [st] "r"(st)
+                         : "rax",
+                           "xmm0",
+                           "xmm1",
+                           "xmm2",
+                           "xmm3",
+                           "xmm4",
+                           "memory",
+                           "cc");
+}
+
+void myst_memcpy_avx2(void* dest, const void* src, size_t n)
+{
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    uint8_t* dt = d + n - 32;
+    const uint8_t* st = s + n - 32;
+
+    __asm__ __volatile__("vmovdqu (%[st]), %%ymm4\n"
+                         "1:\n"
+                         "mov %[dt], %%rax\n"
+                         "sub %[d], %%rax\n"
+                         "cmp $128, %%rax\n"
+                         "jb 2f\n"
+                         "vmovdqu (%[s]), %%ymm0\n"
+                         "vmovdqu 32(%[s]), %%ymm1\n"
+                         "vmovdqu 64(%[s]), %%ymm2\n"
+                         "vmovdqu 96(%[s]), %%ymm3\n"
+                         "vmovdqu %%ymm0, (%[d])\n"
+                         "vmovdqu %%ymm1, 32(%[d])\n"
+                         "vmovdqu %%ymm2, 64(%[d])\n"
+                         "vmovdqu %%ymm3, 96(%[d])\n"
+                         "add $128, %[d]\n"
+                         "add $128, %[s]\n"
+                         "jmp 1b\n"
+                         "2:\n"
+                         "cmp %[dt], %[d]\n"
+                         "jae 3f\n"
+                         "vmovdqu (%[s]), %%ymm0\n"
+                         "vmovdqu %%ymm0, (%[d])\n"
+                         "add $32, %[d]\n"
+                         "add $32, %[s]\n"
+                         "jmp 2b\n"
+                         "3:\n"
+                         "vmovdqu %%ymm4, (%[dt])\n"
+                         "vzeroupper\n"
+                         : [d] "+r"(d), [s] "+r"(s)
+                         : [dt] "r"(dt), [st] "r"(st)
+                         : "rax",
+                           "xmm0",
+                           "xmm1",
+                           "xmm2",
+                           "xmm3",
+                           "xmm4",
+                           "memory",
+                           "cc");
+}
+
+void myst_memcpy_avx512(void* dest, const void* src, size_t n)
+{
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    uint8_t* dt = d + n - 64;
+    const uint8_t* st = s + n - 64;
+
+    __asm__ __volatile__("vmovdqu64 (%[st]), %%zmm4\n"
+                         "1:\n"
+                         "mov %[dt], %%rax\n"
+                         "sub %[d], %%rax\n"
+                         "cmp $256, %%rax\n"
+                         "jb 2f\n"
+                         "vmovdqu64 (%[s]), %%zmm0\n"
+                         "vmovdqu64 64(%[s]), %%zmm1\n"
+                         "vmovdqu64 128(%[s]), %%zmm2\n"
+                         "vmovdqu64 192(%[s]), %%zmm3\n"
+                         "vmovdqu64 %%zmm0, (%[d])\n"
+                         "vmovdqu64 %%zmm1, 64(%[d])\n"
+                         "vmovdqu64 %%zmm2, 128(%[d])\n"
+                         "vmovdqu64 %%zmm3, 192(%[d])\n"
+                         "add $256, %[d]\n"
+                         "add $256, %[s]\n"
+                         "jmp 1b\n"
+                         "2:\n"
+                         "cmp %[dt], %[d]\n"
+                         "jae 3f\n"
+                         "vmovdqu64 (%[s]), %%zmm0\n"
+                         "vmovdqu64 %%zmm0, (%[d])\n"
+                         "add $64, %[d]\n"
+                         "add $64, %[s]\n"
+                         "jmp 2b\n"
+                         "3:\n"
+                         "vmovdqu64 %%zmm4, (%[dt])\n"
+                         "vzeroupper\n"
+                         : [d] "+r"(d), [s] "+r"(s)
+                         : [dt] "r"(dt), [st] "r"(st)
+                         : "rax",
+                           "xmm0",
+                           "xmm1",
+                           "xmm2",
+                           "xmm3",
+                           "xmm4",
+                           "memory",
+                           "cc");
+}
+
+/*
+**==============================================================================
+**
+** memset(): as memcpy(), with the byte repeated in a vector register.
+**
+**==============================================================================
+*/
+
+#define REPEAT_BYTE(C) ((uint64_t)(uint8_t)(C)*0x0101010101010101)
+
+void myst_memset_erms(void* s, int c, size_t n)
+{
+    __asm__ __volatile__("rep stosb"
+                         : "+D"(s), "+c"(n)
+                         : "a"(c)
+                         : "memory");
+}
+
+void myst_memset_sse2(void* s, int c, size_t n)
+{
+    uint8_t* d = (uint8_t*)s;
+    uint8_t* dt = d + n - 16;
+
+    __asm__ __volatile__("movq %[cc], %%xmm0\n"
+                         "punpcklqdq %%xmm0, %%xmm0\n"
+                         "1:\n"
+                         "mov %[dt], %%rax\n"
+                         "sub %[d], %%rax\n"
+                         "cmp $64, %%rax\n"
+                         "jb 2f\n"
+                         "movdqu %%xmm0, (%[d])\n"
+                         "movdqu %%xmm0, 16(%[d])\n"
+                         "movdqu %%xmm0, 32(%[d])\n"
+                         "movdqu %%xmm0, 48(%[d])\n"
+                         "add $64, %[d]\n"
+                         "jmp 1b\n"
+                         "2:\n"
+                         "cmp %[dt], %[d]\n"
+                         "jae 3f\n"
+                         "movdqu %%xmm0, (%[d])\n"
+                         "add $16, %[d]\n"
+                         "jmp 2b\n"
+                         "3:\n"
+                         "movdqu %%xmm0, (%[dt])\n"
+                         : [d] "+r"(d)
+                         : [dt] "r"(dt), [cc] "r"(REPEAT_BYTE(c))
+                         : "rax", "xmm0", "memory", "cc");
+}
+
+void myst_memset_avx2(void* s, int c, size_t n)
+{
+    uint8_t* d = (uint8_t*)s;
+    uint8_t* dt = d + n - 32;
+
+    __asm__ __volatile__("vmovq %[cc], %%xmm0\n"
+                         "vpbroadcastq %%xmm0, %%ymm0\n"
+                         "1:\n"
+                         "mov %[dt], %%rax\n"
+                         "sub %[d], %%rax\n"
+                         "cmp $128, %%rax\n"
+                         "jb 2f\n"
+                         "vmovdqu %%ymm0, (%[d])\n"
+                         "vmovdqu %%ymm0, 32(%[d])\n"
+                         "vmovdqu %%ymm0, 64(%[d])\n"
+                         "vmovdqu %%ymm0, 96(%[d])\n"
+                         "add $128, %[d]\n"
+                         "jmp 1b\n"
+                         "2:\n"
+                         "cmp %[dt], %[d]\n"
+                         "jae 3f\n"
+                         "vmovdqu %%ymm0, (%[d])\n"
+                         "add $32, %[d]\n"
+                         "jmp 2b\n"
+                         "3:\n"
+                         "vmovdqu %%ymm0, (%[dt])\n"
+                         "vzeroupper\n"
+                         : [d] "+r"(d)
+                         : [dt] "r"(dt), [cc] "r"(REPEAT_BYTE(c))
+                         : "rax", "xmm0", "memory", "cc");
+}
+
+void myst_memset_avx512(void* s, int c, size_t n)
+{
+    uint8_t* d = (uint8_t*)s;
+    uint8_t* dt = d + n - 64;
+
+    __asm__ __volatile__("vpbroadcastq %[cc], %%zmm0\n"
+                         "1:\n"
+                         "mov %[dt], %%rax\n"
+                         "sub %[d], %%rax\n"
+                         "cmp $256, %%rax\n"
+                         "jb 2f\n"
+                         "vmovdqu64 %%zmm0, (%[d])\n"
+                         "vmovdqu64 %%zmm0, 64(%[d])\n"
+                         "vmovdqu64 %%zmm0, 128(%[d])\n"
+                         "vmovdqu64 %%zmm0, 192(%[d])\n"
+                         "add $256, %[d]\n"
+                         "jmp 1b\n"
+                         "2:\n"
+                         "cmp %[dt], %[d]\n"
+                         "jae 3f\n"
+                         "vmovdqu64 %%zmm0, (%[d])\n"
+                         "add $64, %[d]\n"
+                         "jmp 2b\n"
+                         "3:\n"
+                         "vmovdqu64 %%zmm0, (%[dt])\n"
+                         "vzeroupper\n"
+                         : [d] "+r"(d)
+                         : [dt] "r"(dt), [cc] "r"(REPEAT_BYTE(c))
+                         : "rax", "xmm0", "memory", "cc");
+}
+
+/*
+**==============================================================================
+**
+** Non-temporal fill and copy: movntdq (SSE2) needs an aligned destination,
+** so the unaligned ends use memset() and memcpy(). The sfence orders the
+** streaming stores before any later store (such as an unlock).
+**
+**==============================================================================
+*/
+
+#define NT_ALIGN 64 /* one cache line per iteration */
+
+static size_t _nt_head(const void* p)
+{
+    return (NT_ALIGN - ((uintptr_t)p & (NT_ALIGN - 1))) & (NT_ALIGN - 1);
+}
+
+void myst_memset_nt(void* s, int c, size_t n)
+{
+    uint8_t* p = (uint8_t*)s;
+    size_t head;
+    size_t body;
+
+    if (n < MYST_MEMOPS_NT_THRESHOLD)
+    {
+        memset(s, c, n);
+        return;
+    }
+
+    head = _nt_head(p);
+    memset(p, c, head);
+    p += head;
+    n -= head;
+    body = n & ~(size_t)(NT_ALIGN - 1);
+
+    __asm__ __volatile__("movq %[cc], %%xmm0\n"
+                         "punpcklqdq %%xmm0, %%xmm0\n"
+                         "1:\n"
+                         "movntdq %%xmm0, (%[p])\n"
+                         "movntdq %%xmm0, 16(%[p])\n"
+                         "movntdq %%xmm0, 32(%[p])\n"
+                         "movntdq %%xmm0, 48(%[p])\n"
+                         "add $64, %[p]\n"
+                         "sub $64, %[n]\n"
+                         "jnz 1b\n"
+                         "sfence\n"
+                         : [p] "+r"(p), [n] "+r"(body)
+                         : [cc] "r"(REPEAT_BYTE(c))
+                         : "xmm0", "memory", "cc");
+
+    memset(p, c, n & (NT_ALIGN - 1));
+}
+
+void myst_memcpy_nt(void* dest, const void* src, size_t n)
+{
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    size_t head;
+    size_t body;
+
+    if (n < MYST_MEMOPS_NT_THRESHOLD)
+    {
+        memcpy(dest, src, n);
+        return;
+    }
+
+    head = _nt_head(d);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    body = n & ~(size_t)(NT_ALIGN - 1);
+
+    /* prefetchnta keeps the source out of the outer caches as well */
+    __asm__ __volatile__("1:\n"
+                         "prefetchnta 512(%[s])\n"
+                         "movdqu (%[s]), %%xmm0\n"
+                         "movdqu 16(%[s]), %%xmm1\n"
+                         "movdqu 32(%[s]), %%xmm2\n"
+                         "movdqu 48(%[s]), %%xmm3\n"
+                         "movntdq %%xmm0, (%[d])\n"
+                         "movntdq %%xmm1, 16(%[d])\n"
+                         "movntdq %%xmm2, 32(%[d])\n"
+                         "movntdq %%xmm3, 48(%[d])\n"
+                         "add $64, %[s]\n"
+                         "add $64, %[d]\n"
+                         "sub $64, %[n]\n"
+                         "jnz 1b\n"
+                         "sfence\n"
+                         : [d] "+r"(d), [s] "+r"(s), [n] "+r"(body)
+                         :
+                         : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+
+    memcpy(d, s, n & (NT_ALIGN - 1));
+}
+
+/*
+**==============================================================================
+**
+** memcmp() and strlen(): compare a vector at a time and locate the byte
+** from the mask of equal bytes. The last vector of a comparison overlaps
+** the one before, whose bytes were all equal.
+**
+**==============================================================================
+*/
+
+static size_t _mismatch_sse2(const uint8_t* p, const uint8_t* q, size_t i)
+{
+    uint32_t mask;
+
+    __asm__ __volatile__("movdqu (%1), %%xmm0\n"
+                         "movdqu (%2), %%xmm1\n"
+                         "pcmpeqb %%xmm1, %%xmm0\n"
+                         "pmovmskb %%xmm0, %0\n"
+                         : "=r"(mask)
+                         : "r"(p + i), "r"(q + i)
+                         : "xmm0", "xmm1", "memory");
+
+    return mask == 0xffff ? 16 : (size_t)__builtin_ctz(~mask);
+}
+
+size_t myst_mismatch_sse2(const void* s1, const void* s2, size_t n)
+{
+    const uint8_t* p = (const uint8_t*)s1;
+    const uint8_t* q = (const uint8_t*)s2;
+    size_t i;
+    size_t k;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        if ((k = _mismatch_sse2(p, q, i)) < 16)
+            return i + k;
+    }
+
+    if (i < n && (k = _mismatch_sse2(p, q, n - 16)) < 16)
+        return n - 16 + k;
+
+    return n;
+}
+
+size_t myst_mismatch_avx2(const void* s1, const void* s2, size_t n)
+{
+    const size_t last = n - 32;
+    size_t i = 0;
+    uint32_t mask;
+
+    __asm__ __volatile__("1:\n"
+                         "vmovdqu (%[p],%[i]), %%ymm0\n"
+                         "vpcmpeqb (%[q],%[i]), %%ymm0, %%ymm0\n"
+                         "vpmovmskb %%ymm0, %[m]\n"
+                         "cmp $-1, %[m]\n"
+                         "jne 3f\n"
+                         "cmp %[last], %[i]\n"
+                         "jae 2f\n"
+                         "add $32, %[i]\n"
+                         "cmp %[last], %[i]\n"
+                         "jbe 1b\n"
+                         "mov %[last], %[i]\n"
+                         "jmp 1b\n"
+                         "2:\n"
+                         "mov $-1, %[m]\n"
+                         "3:\n"
+                         "vzeroupper\n"
+                         : [i] "+r"(i), [m] "=&r"(mask)
+                         : [p] "r"(s1), [q] "r"(s2), [last] "r"(last)
+                         : "xmm0", "memory", "cc");
+
+    return mask == 0xffffffff ? n : i + (size_t)__builtin_ctz(~mask);
+}
+
+/* The mask of the zero bytes in an aligned vector */
+static uint32_t _zero_mask_sse2(const char* p)
+{
+    uint32_t mask;
+
+    __asm__ __volatile__("pxor %%xmm0, %%xmm0\n"
+                         "pcmpeqb (%1), %%xmm0\n"
+                         "pmovmskb %%xmm0, %0\n"
+                         : "=r"(mask)
+                         : "r"(p)
+                         : "xmm0", "memory");
+
+    return mask;
+}
+
+size_t myst_strlen_sse2(const char* s)
+{
+    const char* p = (const char*)((uintptr_t)s & ~(uintptr_t)15);
+    uint32_t mask;
+
+    /* ignore the bytes before the string in the first vector */
+    if ((mask = _zero_mask_sse2(p) >> (size_t)(s - p)))
+        return (size_t)__builtin_ctz(mask);
+
+    for (;;)
+    {
+        p += 16;
+
+        if ((mask = _zero_mask_sse2(p)))
+            return (size_t)(p - s) + (size_t)__builtin_ctz(mask);
+    }
+}
+
+size_t myst_strlen_avx2(const char* s)
+{
+    const char* p = (const char*)((uintptr_t)s & ~(uintptr_t)31);
+    uint32_t mask;
+
+    __asm__ __volatile__("vpxor %%xmm1, %%xmm1, %%xmm1\n"
+                         "vpcmpeqb (%[p]), %%ymm1, %%ymm0\n"
+                         "vpmovmskb %%ymm0, %[m]\n"
+                         "vzeroupper\n"
+                         : [m] "=r"(mask)
+                         : [p] "r"(p)
+                         : "xmm0", "xmm1", "memory");
+
+    /* ignore the bytes before the string in the first vector */
+    mask >>= (size_t)(s - p);
+
+    if (mask)
+        return (size_t)__builtin_ctz(mask);
+
+    __asm__ __volatile__("vpxor %%xmm1, %%xmm1, %%xmm1\n"
+                         "1:\n"
+                         "add $32, %[p]\n"
+                         "vpcmpeqb (%[p]), %%ymm1, %%ymm0\n"
+                         "vpmovmskb %%ymm0, %[m]\n"
+                         "test %[m], %[m]\n"
+                         "jz 1b\n"
+                         "vzeroupper\n"
+                         : [p] "+r"(p), [m] "=&r"(mask)
+                         :
+                         : "xmm0", "xmm1", "memory", "cc");
+
+    return (size_t)(p - s) + (size_t)__builtin_ctz(mask);
+}
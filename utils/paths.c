@@ -83,32 +83,51 @@ done:
     return ret;
 }
 
+/* Like myst_tok_normalize() over the components of path, but without
+ * splitting it: the result is written straight to buf */
 int myst_normalize(const char* path, char* buf, size_t size)
 {
     int ret = 0;
-    char** toks = NULL;
-    size_t ntoks;
-    char* str = NULL;
+    myst_path_iter_t it;
+    size_t n = 0;
 
-    if (!path)
+    if (!path || !buf || !size)
         ERAISE(-EINVAL);
 
-    ECHECK(myst_strsplit(path, "/", &toks, &ntoks));
-    ECHECK(myst_tok_normalize((const char**)toks));
-    ntoks = myst_tokslen((const char**)toks);
-    ECHECK(myst_strjoin((const char**)toks, ntoks, "/", "/", NULL, &str));
+    myst_path_iter_init(&it, path);
 
-    if (myst_strlcpy(buf, str, size) >= size)
-        ERAISE(-ERANGE);
+    while (myst_path_next(&it))
+    {
+        if (it.len == 1 && it.name[0] == '.')
+            continue;
 
-done:
+        if (it.len == 2 && it.name[0] == '.' && it.name[1] == '.')
+        {
+            /* remove the previous component */
+            while (n > 0 && buf[--n] != '/')
+                ;
+            continue;
+        }
 
-    if (toks)
-        free(toks);
+        if (n + 1 + it.len >= size)
+            ERAISE(-ERANGE);
 
-    if (str)
-        free(str);
+        buf[n++] = '/';
+        memmove(buf + n, it.name, it.len);
+        n += it.len;
+    }
+
+    if (n == 0)
+    {
+        if (size < 2)
+            ERAISE(-ERANGE);
 
+        buf[n++] = '/';
+    }
+
+    buf[n] = '\0';
+
+done:
     return ret;
 }
 
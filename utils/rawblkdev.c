@@ -11,80 +11,225 @@
 #include <myst/blkdev.h>
 #include <myst/blockdevice.h>
 #include <myst/eraise.h>
+#include <myst/hashmap.h>
+#include <myst/slab.h>
+
+/* The most blocks moved by one host call (1 MB) */
+#define MAX_TRANSFER_BLOCKS 2048
+
+/*
+**==============================================================================
+**
+** The read cache:
+**
+**     A read-only device keeps recently read blocks, which spares host calls
+**     when they are read again (writes are kept by an overlay device stacked
+**     on top, see cowblkdev.c). Blocks are grouped into 4K pages (of 8
+**     blocks each) that are carved from 64K arenas, so the heap sees a few
+**     large allocations rather than one per block. The pages are found by
+**     page number in a hash map. Once MAX_CACHE_PAGES pages are cached, the
+**     least recently used is reused for the next page needed.
+**
+**==============================================================================
+*/
+
+#define PAGE_BLOCKS 8
+#define CACHE_PAGE_SIZE (PAGE_BLOCKS * MYST_BLKSIZE)
+
+/* Most pages kept in the cache (4 MB) */
+#define MAX_CACHE_PAGES 1024
+
+/* Number of pages in each arena */
+#define ARENA_PAGES 16
+
+typedef struct cache_page cache_page_t;
+
+struct cache_page
+{
+    cache_page_t* lru_prev;
+    cache_page_t* lru_next;
+    uint64_t pageno;
+    uint8_t valid; /* a bit for each block the page holds */
+    uint8_t* data;
+};
 
-#define MAX_CHAINS (64 * 1024)
+static myst_slab_cache_t _page_cache =
+    MYST_SLAB_CACHE_INIT("rawblkdev cache_page_t", cache_page_t);
 
-typedef struct cache_block cache_block_t;
+typedef struct arena arena_t;
 
-struct cache_block
+struct arena
 {
-    cache_block_t* next;
-    uint64_t blkno;
-    uint8_t data[MYST_BLKSIZE];
+    arena_t* next;
+    uint8_t pages[ARENA_PAGES][CACHE_PAGE_SIZE];
 };
 
 typedef struct blkdev
 {
     myst_blkdev_t base;
-    bool ephemeral;
+    bool read_only;
     uint64_t blkno_offset;
     int fd;
-    cache_block_t* chains[MAX_CHAINS];
+
+    /* the read cache */
+    myst_hashmap_t pages; /* the pages by page number */
+    struct
+    {
+        cache_page_t* head; /* least recently used */
+        cache_page_t* tail;
+        size_t size;
+    } lru;
+    arena_t* arenas;
+    size_t arena_used; /* pages given out from the first arena */
 } blkdev_t;
 
 static void _release_cache(blkdev_t* dev)
 {
-    size_t i;
+    /* every page is on the LRU list */
+    for (cache_page_t* p = dev->lru.head; p;)
+    {
+        cache_page_t* next = p->lru_next;
+        myst_slab_free(p);
+        p = next;
+    }
+
+    while (dev->arenas)
+    {
+        arena_t* next = dev->arenas->next;
+        free(dev->arenas);
+        dev->arenas = next;
+    }
+
+    myst_hashmap_release(&dev->pages);
+}
+
+static void _lru_append(blkdev_t* dev, cache_page_t* page)
+{
+    page->lru_next = NULL;
+    page->lru_prev = dev->lru.tail;
+
+    if (dev->lru.tail)
+        dev->lru.tail->lru_next = page;
+    else
+        dev->lru.head = page;
+
+    dev->lru.tail = page;
+    dev->lru.size++;
+}
+
+static void _lru_remove(blkdev_t* dev, cache_page_t* page)
+{
+    if (page->lru_prev)
+        page->lru_prev->lru_next = page->lru_next;
+    else
+        dev->lru.head = page->lru_next;
+
+    if (page->lru_next)
+        page->lru_next->lru_prev = page->lru_prev;
+    else
+        dev->lru.tail = page->lru_prev;
+
+    dev->lru.size--;
+}
+
+static cache_page_t* _find_page(blkdev_t* dev, uint64_t pageno)
+{
+    return myst_hashmap_get(&dev->pages, pageno);
+}
+
+/* Add a page with no blocks yet (reusing the least recently used page once
+ * there are enough of them) */
+static cache_page_t* _new_page(blkdev_t* dev, uint64_t pageno)
+{
+    cache_page_t* page;
+
+    if (dev->lru.size >= MAX_CACHE_PAGES)
+    {
+        page = dev->lru.head;
+
+        if (myst_hashmap_put(&dev->pages, pageno, page) != 0)
+            return NULL;
 
-    for (i = 0; i < MAX_CHAINS; i++)
+        myst_hashmap_remove(&dev->pages, page->pageno);
+        _lru_remove(dev, page);
+    }
+    else
     {
-        cache_block_t* p;
-        cache_block_t* next;
+        if (!dev->arenas || dev->arena_used == ARENA_PAGES)
+        {
+            arena_t* arena;
+
+            if (!(arena = malloc(sizeof(arena_t))))
+                return NULL;
+
+            arena->next = dev->arenas;
+            dev->arenas = arena;
+            dev->arena_used = 0;
+        }
+
+        if (!(page = myst_slab_alloc(&_page_cache)))
+            return NULL;
 
-        for (p = dev->chains[i]; p; p = next)
+        if (myst_hashmap_put(&dev->pages, pageno, page) != 0)
         {
-            next = p->next;
-            free(p);
+            myst_slab_free(page);
+            return NULL;
         }
+
+        page->data = dev->arenas->pages[dev->arena_used++];
     }
+
+    page->pageno = pageno;
+    page->valid = 0;
+    _lru_append(dev, page);
+
+    return page;
 }
 
-static cache_block_t* _get_cache(blkdev_t* dev, uint64_t blkno)
+/* Get a block from the cache (returning false when it is not there) */
+static bool _get_cache(blkdev_t* dev, uint64_t blkno, void* data)
 {
-    cache_block_t* p;
-    size_t slot = blkno % MAX_CHAINS;
+    cache_page_t* page;
+    const uint8_t bit = 1 << (blkno % PAGE_BLOCKS);
 
-    for (p = dev->chains[slot]; p; p = p->next)
+    if (!(page = _find_page(dev, blkno / PAGE_BLOCKS)) || !(page->valid & bit))
+        return false;
+
+    if (data)
     {
-        if (p->blkno == blkno)
-            return p;
+        memcpy(
+            data,
+            page->data + (blkno % PAGE_BLOCKS) * MYST_BLKSIZE,
+            MYST_BLKSIZE);
+
+        /* move to the back of the LRU list */
+        if (page != dev->lru.tail)
+        {
+            _lru_remove(dev, page);
+            _lru_append(dev, page);
+        }
     }
 
-    return NULL;
+    return true;
 }
 
+/* Put a block read from the host in the cache */
 static int _put_cache(blkdev_t* dev, uint64_t blkno, const void* data)
 {
-    int rc = -1;
-    size_t slot = blkno % MAX_CHAINS;
-    cache_block_t* block;
-
-    /* Allocate new block */
-    if (!(block = calloc(1, sizeof(cache_block_t))))
-        goto done;
-
-    /* Initialize the block */
-    memcpy(block->data, data, sizeof(block->data));
-    block->blkno = blkno;
+    int ret = 0;
+    const uint64_t pageno = blkno / PAGE_BLOCKS;
+    const uint8_t bit = 1 << (blkno % PAGE_BLOCKS);
+    cache_page_t* page;
 
-    /* Add to cache */
-    block->next = dev->chains[slot];
-    dev->chains[slot] = block;
+    if (!(page = _find_page(dev, pageno)) && !(page = _new_page(dev, pageno)))
+        ERAISE(-ENOMEM);
 
-    rc = 0;
+    memcpy(
+        page->data + (blkno % PAGE_BLOCKS) * MYST_BLKSIZE, data, MYST_BLKSIZE);
+    page->valid |= bit;
 
 done:
-    return rc;
+    return ret;
 }
 
 static int _close(myst_blkdev_t* dev)
@@ -95,7 +240,7 @@ static int _close(myst_blkdev_t* dev)
     if (!dev)
         ERAISE(-EINVAL);
 
-    if (impl->ephemeral)
+    if (impl->read_only)
         _release_cache(impl);
 
     ECHECK(myst_close_block_device(impl->fd));
@@ -114,20 +259,15 @@ static int _get(myst_blkdev_t* dev, uint64_t blkno, void* data)
         ERAISE(-EINVAL);
 
     /* check the cache */
-    if (impl->ephemeral)
-    {
-        const cache_block_t* cache_block;
-
-        if ((cache_block = _get_cache(impl, blkno)))
-        {
-            memcpy(data, cache_block->data, MYST_BLKSIZE);
-            goto done;
-        }
-    }
+    if (impl->read_only && _get_cache(impl, blkno, data))
+        goto done;
 
     const uint64_t rawblkno = blkno + impl->blkno_offset;
     ECHECK(myst_read_block_device(impl->fd, rawblkno, data, 1));
 
+    if (impl->read_only)
+        ECHECK(_put_cache(impl, blkno, data));
+
 done:
     return ret;
 }
@@ -140,25 +280,90 @@ static int _put(myst_blkdev_t* dev, uint64_t blkno, const void* data)
     if (!dev || !data)
         ERAISE(-EINVAL);
 
-    /* put the block in the cache */
-    if (impl->ephemeral)
+    if (impl->read_only)
+        ERAISE(-EROFS);
+
+    const uint64_t rawblkno = blkno + impl->blkno_offset;
+    ECHECK(myst_write_block_device(impl->fd, rawblkno, data, 1));
+
+done:
+    return ret;
+}
+
+static int _get_n(myst_blkdev_t* dev, uint64_t blkno, size_t n, void* data)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+    uint8_t* p = data;
+
+    if (!dev || !data)
+        ERAISE(-EINVAL);
+
+    while (n)
     {
-        cache_block_t* cache_block;
+        size_t count = 1;
 
-        if ((cache_block = _get_cache(impl, blkno)))
-        {
-            memcpy(cache_block->data, data, MYST_BLKSIZE);
-        }
-        else if (_put_cache(impl, blkno, data) != 0)
+        if (!impl->read_only || !_get_cache(impl, blkno, p))
         {
-            ERAISE(-ENOMEM);
+            /* read the run of blocks up to the next cached one at once */
+            while (count < n && count < MAX_TRANSFER_BLOCKS &&
+                   !(impl->read_only && _get_cache(impl, blkno + count, NULL)))
+            {
+                count++;
+            }
+
+            const uint64_t rawblkno = blkno + impl->blkno_offset;
+            ECHECK(myst_read_block_device(impl->fd, rawblkno, (void*)p, count));
+
+            /* cache short reads only (streaming reads would flush the
+             * cache of the blocks read again and again) */
+            if (impl->read_only && count <= PAGE_BLOCKS)
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    const void* block = p + i * MYST_BLKSIZE;
+                    ECHECK(_put_cache(impl, blkno + i, block));
+                }
+            }
         }
 
-        goto done;
+        blkno += count;
+        p += count * MYST_BLKSIZE;
+        n -= count;
     }
 
-    const uint64_t rawblkno = blkno + impl->blkno_offset;
-    ECHECK(myst_write_block_device(impl->fd, rawblkno, data, 1));
+done:
+    return ret;
+}
+
+static int _put_n(
+    myst_blkdev_t* dev,
+    uint64_t blkno,
+    size_t n,
+    const void* data)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+    const uint8_t* p = data;
+
+    if (!dev || !data)
+        ERAISE(-EINVAL);
+
+    if (impl->read_only)
+        ERAISE(-EROFS);
+
+    while (n)
+    {
+        const size_t count = (n < MAX_TRANSFER_BLOCKS) ? n
+                                                       : MAX_TRANSFER_BLOCKS;
+        const uint64_t rawblkno = blkno + impl->blkno_offset;
+
+        ECHECK(myst_write_block_device(impl->fd, rawblkno, (void*)p, count));
+
+        blkno += count;
+        p += count * MYST_BLKSIZE;
+        n -= count;
+    }
 
 done:
     return ret;
@@ -166,7 +371,7 @@ done:
 
 int myst_rawblkdev_open(
     const char* path,
-    bool ephemeral,
+    bool read_only,
     uint64_t blkno_offset,
     myst_blkdev_t** dev)
 {
@@ -180,7 +385,7 @@ int myst_rawblkdev_open(
     if (!path || !dev)
         ERAISE(-EINVAL);
 
-    if ((fd = myst_open_block_device(path, ephemeral)) < 0)
+    if ((fd = myst_open_block_device(path, read_only)) < 0)
         ERAISE(-errno);
 
     if (!(impl = calloc(1, sizeof(blkdev_t))))
@@ -189,7 +394,9 @@ int myst_rawblkdev_open(
     impl->base.close = _close;
     impl->base.get = _get;
     impl->base.put = _put;
-    impl->ephemeral = ephemeral;
+    impl->base.get_n = _get_n;
+    impl->base.put_n = _put_n;
+    impl->read_only = read_only;
     impl->blkno_offset = blkno_offset;
     impl->fd = fd;
 
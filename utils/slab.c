@@ -0,0 +1,268 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/slab.h>
+
+/*
+**==============================================================================
+**
+** Each slab is a MYST_SLAB_SIZE block (aligned on a MYST_SLAB_SIZE boundary)
+** that starts with a header followed by an array of objects. The alignment
+** lets myst_slab_free() find the header of any object by masking its
+** address. Free objects are chained through their first word.
+**
+** Slabs with free objects are kept on the cache's partial list. At most one
+** empty slab is retained per cache; others are returned to the heap.
+**
+**==============================================================================
+*/
+
+#define HEADER_SIZE 64
+#define MIN_OBJECTS 8
+
+struct myst_slab
+{
+    myst_slab_cache_t* cache;
+    myst_slab_t* prev;
+    myst_slab_t* next;
+    void* free_list;
+    size_t in_use;
+    bool partial;
+};
+
+MYST_STATIC_ASSERT(sizeof(myst_slab_t) <= HEADER_SIZE);
+
+static myst_slab_cache_t* _caches;
+static myst_spinlock_t _caches_lock = MYST_SPINLOCK_INITIALIZER;
+
+static size_t _stride(const myst_slab_cache_t* cache)
+{
+    size_t n = cache->object_size;
+
+    if (n < sizeof(void*))
+        n = sizeof(void*);
+
+    return (n + 15) & ~(size_t)15;
+}
+
+static void _register(myst_slab_cache_t* cache)
+{
+    myst_spin_lock(&_caches_lock);
+
+    if (!cache->registered)
+    {
+        cache->next = _caches;
+        _caches = cache;
+        cache->registered = true;
+    }
+
+    myst_spin_unlock(&_caches_lock);
+}
+
+static void _partial_insert(myst_slab_cache_t* cache, myst_slab_t* slab)
+{
+    slab->prev = NULL;
+
+    if ((slab->next = cache->partial))
+        cache->partial->prev = slab;
+
+    cache->partial = slab;
+    slab->partial = true;
+}
+
+static void _partial_remove(myst_slab_cache_t* cache, myst_slab_t* slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        cache->partial = slab->next;
+
+    if (slab->next)
+        slab->next->prev = slab->prev;
+
+    slab->prev = NULL;
+    slab->next = NULL;
+    slab->partial = false;
+}
+
+static myst_slab_t* _new_slab(myst_slab_cache_t* cache)
+{
+    const size_t stride = _stride(cache);
+    const size_t n = (MYST_SLAB_SIZE - HEADER_SIZE) / stride;
+    myst_slab_t* slab;
+    uint8_t* p;
+
+    if (!(slab = memalign(MYST_SLAB_SIZE, MYST_SLAB_SIZE)))
+        return NULL;
+
+    memset(slab, 0, sizeof(myst_slab_t));
+    slab->cache = cache;
+
+    /* Chain the objects in address order */
+    p = (uint8_t*)slab + HEADER_SIZE + (n - 1) * stride;
+
+    for (size_t i = 0; i < n; i++, p -= stride)
+    {
+        *(void**)p = slab->free_list;
+        slab->free_list = p;
+    }
+
+    return slab;
+}
+
+void* myst_slab_alloc(myst_slab_cache_t* cache)
+{
+    myst_slab_t* slab;
+    void* object;
+
+    if (!cache || _stride(cache) > (MYST_SLAB_SIZE - HEADER_SIZE) / MIN_OBJECTS)
+        return NULL;
+
+    if (!cache->registered)
+        _register(cache);
+
+    myst_spin_lock(&cache->lock);
+
+    if (!(slab = cache->partial))
+    {
+        /* Allocate the new slab without holding the lock */
+        myst_spin_unlock(&cache->lock);
+
+        if (!(slab = _new_slab(cache)))
+            return NULL;
+
+        myst_spin_lock(&cache->lock);
+        _partial_insert(cache, slab);
+        cache->num_slabs++;
+        cache->num_empty++;
+    }
+
+    if (slab->in_use++ == 0)
+        cache->num_empty--;
+
+    object = slab->free_list;
+    slab->free_list = *(void**)object;
+
+    if (!slab->free_list)
+        _partial_remove(cache, slab);
+
+    cache->in_use++;
+    cache->num_allocs++;
+
+    myst_spin_unlock(&cache->lock);
+
+    memset(object, 0, cache->object_size);
+
+    return object;
+}
+
+void myst_slab_free(void* object)
+{
+    myst_slab_t* slab;
+    myst_slab_cache_t* cache;
+    myst_slab_t* release = NULL;
+
+    if (!object)
+        return;
+
+    slab = (myst_slab_t*)((uintptr_t)object & ~(uintptr_t)(MYST_SLAB_SIZE - 1));
+    cache = slab->cache;
+
+    myst_spin_lock(&cache->lock);
+
+    *(void**)object = slab->free_list;
+    slab->free_list = object;
+
+    if (!slab->partial)
+        _partial_insert(cache, slab);
+
+    cache->in_use--;
+    cache->num_frees++;
+
+    if (--slab->in_use == 0)
+    {
+        /* Keep one empty slab to avoid thrashing */
+        if (cache->num_empty)
+        {
+            _partial_remove(cache, slab);
+            cache->num_slabs--;
+            release = slab;
+        }
+        else
+        {
+            cache->num_empty++;
+        }
+    }
+
+    myst_spin_unlock(&cache->lock);
+
+    if (release)
+        free(release);
+}
+
+void myst_slab_shrink(myst_slab_cache_t* cache)
+{
+    myst_slab_t* list = NULL;
+
+    if (!cache)
+        return;
+
+    myst_spin_lock(&cache->lock);
+
+    for (myst_slab_t* p = cache->partial; p;)
+    {
+        myst_slab_t* next = p->next;
+
+        if (p->in_use == 0)
+        {
+            _partial_remove(cache, p);
+            cache->num_slabs--;
+            cache->num_empty--;
+            p->next = list;
+            list = p;
+        }
+
+        p = next;
+    }
+
+    myst_spin_unlock(&cache->lock);
+
+    for (myst_slab_t* p = list; p;)
+    {
+        myst_slab_t* next = p->next;
+        free(p);
+        p = next;
+    }
+}
+
+size_t myst_slab_get_stats(myst_slab_stats_t* stats, size_t count)
+{
+    size_t n = 0;
+
+    myst_spin_lock(&_caches_lock);
+
+    for (myst_slab_cache_t* p = _caches; p; p = p->next, n++)
+    {
+        if (stats && n < count)
+        {
+            myst_slab_stats_t* s = &stats[n];
+
+            myst_spin_lock(&p->lock);
+            s->name = p->name;
+            s->object_size = p->object_size;
+            s->num_slabs = p->num_slabs;
+            s->in_use = p->in_use;
+            s->num_allocs = p->num_allocs;
+            s->num_frees = p->num_frees;
+            myst_spin_unlock(&p->lock);
+        }
+    }
+
+    myst_spin_unlock(&_caches_lock);
+
+    return n;
+}
@@ -107,6 +107,51 @@ done:
     return ret;
 }
 
+void myst_path_iter_init(myst_path_iter_t* it, const char* path)
+{
+    it->name = path;
+    it->len = 0;
+    it->rest = path;
+}
+
+bool myst_path_next(myst_path_iter_t* it)
+{
+    const char* p = it->rest;
+
+    while (*p == '/')
+        p++;
+
+    it->name = p;
+
+    while (*p && *p != '/')
+        p++;
+
+    it->len = (size_t)(p - it->name);
+    it->rest = p;
+
+    return it->len != 0;
+}
+
+bool myst_path_last(const myst_path_iter_t* it)
+{
+    const char* p = it->rest;
+
+    while (*p == '/')
+        p++;
+
+    return *p == '\0';
+}
+
+int myst_path_copy_name(const myst_path_iter_t* it, char* buf, size_t size)
+{
+    if (it->len >= size)
+        return -ENAMETOOLONG;
+
+    memcpy(buf, it->name, it->len);
+    buf[it->len] = '\0';
+    return 0;
+}
+
 int myst_strjoin(
     const char* toks[],
     size_t ntoks,
@@ -7,48 +7,88 @@
 
 #include <myst/blkdev.h>
 #include <myst/blockdevice.h>
-#include <myst/buf.h>
 #include <myst/eraise.h>
+#include <myst/hashmap.h>
 #include <myst/hex.h>
-#include <myst/list.h>
 #include <myst/round.h>
 #include <myst/sha256.h>
 #include <myst/verity.h>
+#include <myst/workers.h>
 
 #define VERITYBLKDEV_MAGIC 0x5acdeed9
 
 #define MAX_ROOTHASH_SIZE 256
 
-#define MAX_CHAINS (64 * 1024)
+/* The default number of verified data blocks kept in memory (1 MB) and of
+ * blocks read ahead by sequential readers (64 KB) */
+#define DEFAULT_CACHE_BLOCKS 256
+#define DEFAULT_PREFETCH_BLOCKS 16
 
-#define MAX_CACHE_BLOCKS 32
+/* The most bytes read from the underlying device by one call */
+#define MAX_TRANSFER_SIZE (1024 * 1024)
+
+/* The most data blocks (of 4096 bytes) in a run read by _get_raw_blocks() */
+#define MAX_RUN_BLOCKS (MAX_TRANSFER_SIZE / 4096)
+
+/* The most data blocks hashed by one call (the CPU may hash them at once) */
+#define HASH_BATCH_BLOCKS 16
+
+/* The most levels of the hash tree */
+#define MAX_LEVELS 32
+
+/* The most verified hash tree nodes kept in memory (4 MB), enough for the
+ * leaf hashes of 512 MB of data */
+#define MAX_HASH_NODES 1024
+
+/* The image of the verified nodes (see myst_verityblkdev_export_nodes()),
+ * where each node follows its index (a uint64_t) */
+#define NODES_IMAGE_MAGIC 0x5345444f4e524556 /* "VERNODES" */
+
+typedef struct nodes_image
+{
+    uint64_t magic;
+    uint64_t total_nodes;
+    uint64_t count;
+    uint32_t hash_block_size;
+    uint32_t roothash_size;
+    uint8_t roothash[MAX_ROOTHASH_SIZE];
+} nodes_image_t;
 
 MYST_STATIC_ASSERT(sizeof(myst_verity_sb_t) == MYST_BLKSIZE);
 
 typedef struct cache_block
 {
-    /* links for the hash table chains */
-    /* caution: these fields must be first to align with myst_list_node_t */
-    struct cache_block* prev;
-    struct cache_block* next;
-
     /* links for the LRU list (where first is least recently used) */
     struct cache_block* lru_prev;
     struct cache_block* lru_next;
 
-    /* the index to the chains[] entry that contains this node */
-    size_t slot;
-
     /* the block number of this data */
     uint64_t blkno;
 
     /* whether block is dirty (has been written to) */
     bool dirty;
 
+    /* whether block was read ahead and has not been used yet */
+    bool prefetched;
+
     /* the data for this block */
     uint8_t data[];
 } cache_block_t;
 
+/* A hash tree node that has been verified against its parent (and so
+ * against the root hash) */
+typedef struct hash_node
+{
+    /* links for the node LRU list (where first is least recently used) */
+    struct hash_node* lru_prev;
+    struct hash_node* lru_next;
+
+    /* the index of the node in the hash tree (see blkdev.levels) */
+    size_t index;
+
+    uint8_t data[];
+} hash_node_t;
+
 typedef struct blkdev
 {
     myst_blkdev_t base;
@@ -58,8 +98,33 @@ typedef struct blkdev
     size_t roothash_size;
     int rawblkdev;
     myst_verity_sb_t sb;
-    myst_buf_t hashtree;
-    myst_list_t chains[MAX_CHAINS];
+
+    /* the levels of the hash tree, with the leaves first; the nodes of all
+     * levels are numbered from the root down (and stored in that order on
+     * the hash device, after the superblock) */
+    struct
+    {
+        size_t nnodes;
+        size_t offset;
+    } levels[MAX_LEVELS];
+    size_t nlevels;
+    size_t total_nodes;
+
+    /* the verified nodes (indexed by node number) and their LRU list */
+    hash_node_t** nodes;
+    struct
+    {
+        hash_node_t* head;
+        hash_node_t* tail;
+        size_t size;
+    } node_lru;
+
+    /* the expected hashes of the run being verified by _get_raw_blocks() */
+    myst_sha256_t run_hashes[MAX_RUN_BLOCKS];
+
+    /* the cached data blocks by block number (the dirty ones are not on
+     * the LRU list, so they are never evicted) */
+    myst_hashmap_t blocks;
     struct
     {
         cache_block_t* head;
@@ -67,9 +132,11 @@ typedef struct blkdev
         size_t size;
     } lru;
     size_t max_cache_blocks;
-    const uint8_t* leaves_start;
-    const uint8_t* leaves_end;
-    size_t num_leaves;
+
+    /* blocks read ahead on a cache miss at next_blkno (the block after the
+     * one last read through the cache) */
+    size_t prefetch_blocks;
+    size_t next_blkno;
 } blkdev_t;
 
 typedef struct block
@@ -77,6 +144,22 @@ typedef struct block
     uint8_t data[4096];
 } block_t;
 
+/* Verifies some of the data blocks of a run on a kernel worker thread */
+typedef struct verify_work
+{
+    myst_work_t base;
+    blkdev_t* dev;
+    const myst_sha256_t* hashes; /* the expected hashes of the blocks */
+    size_t count;
+    uint8_t* data;
+} verify_work_t;
+
+/* The statistics of all verity devices (see myst_verityblkdev_get_stats()) */
+static myst_verity_stats_t _stats;
+
+#define STATS_INC(FIELD, N) \
+    __atomic_fetch_add(&_stats.FIELD, N, __ATOMIC_RELAXED)
+
 /*
 **==============================================================================
 **
@@ -95,23 +178,16 @@ static __inline__ size_t _min_size(size_t x, size_t y)
     return x < y ? x : y;
 }
 
-static int _hash2(
-    const void* s1,
-    size_t n1,
-    const void* s2,
-    size_t n2,
-    myst_sha256_t* hash)
+/* Hash consecutive blocks of the given size, each preceded by the salt */
+static int _hash_blocks(
+    const blkdev_t* dev,
+    const void* blocks,
+    size_t block_size,
+    size_t count,
+    myst_sha256_t* hashes)
 {
-    int ret = 0;
-    myst_sha256_ctx_t ctx;
-
-    ECHECK(myst_sha256_start(&ctx));
-    ECHECK(myst_sha256_update(&ctx, s1, n1));
-    ECHECK(myst_sha256_update(&ctx, s2, n2));
-    ECHECK(myst_sha256_finish(&ctx, hash));
-
-done:
-    return ret;
+    return myst_sha256_n(
+        hashes, dev->sb.salt, dev->sb.salt_size, blocks, block_size, count);
 }
 
 /*
@@ -171,36 +247,26 @@ static cache_block_t* _new_cache_block(blkdev_t* dev)
     return p;
 }
 
-static void _release_cache(blkdev_t* dev)
+static void _free_cache_block(uint64_t blkno, void* value, void* arg)
 {
-    for (size_t i = 0; i < MAX_CHAINS; i++)
-    {
-        cache_block_t* head = (cache_block_t*)dev->chains[i].head;
+    (void)blkno;
+    (void)arg;
+    free(value);
+}
 
-        for (cache_block_t* p = head; p;)
-        {
-            cache_block_t* next = p->next;
-            free(p);
-            p = next;
-        }
-    }
+static void _release_cache(blkdev_t* dev)
+{
+    myst_hashmap_foreach(&dev->blocks, _free_cache_block, NULL);
+    myst_hashmap_release(&dev->blocks);
 }
 
 static cache_block_t* _get_cache(blkdev_t* dev, uint64_t blkno)
 {
-    cache_block_t* p;
-    const size_t slot = blkno % MAX_CHAINS;
-    cache_block_t* head = (cache_block_t*)dev->chains[slot].head;
+    cache_block_t* p = myst_hashmap_get(&dev->blocks, blkno);
 
-    for (p = head; p; p = p->next)
-    {
-        if (p->blkno == blkno)
-            break;
-    }
-
-    /* if found, not dirty, and not the only entry; move to the back of the LRU
+    /* if found, not dirty, and not already last; move to the back of the LRU
      * list */
-    if (p && p != head && !p->dirty)
+    if (p && p != dev->lru.tail && !p->dirty)
     {
         _lru_remove(dev, p);
         _lru_append(dev, p);
@@ -211,28 +277,32 @@ static cache_block_t* _get_cache(blkdev_t* dev, uint64_t blkno)
 
 static void _cache_evict(blkdev_t* dev)
 {
-    if (dev->lru.size >= dev->max_cache_blocks)
+    if (dev->lru.size > dev->max_cache_blocks)
     {
         /* evict the first block on the LRU list */
         cache_block_t* cb = dev->lru.head;
 
         assert(cb->dirty == false);
 
-        /* remove from the chain */
-        myst_list_remove(&dev->chains[cb->slot], (myst_list_node_t*)cb);
+        /* remove from the hash map */
+        myst_hashmap_remove(&dev->blocks, cb->blkno);
 
         /* remove from the LRU list */
         _lru_remove(dev, cb);
 
         /* release the cache block */
         free(cb);
+        STATS_INC(evictions, 1);
     }
 }
 
-static int _put_cache(blkdev_t* dev, uint64_t blkno, const void* data)
+static int _put_cache(
+    blkdev_t* dev,
+    uint64_t blkno,
+    const void* data,
+    bool prefetched)
 {
     int ret = 0;
-    const size_t slot = blkno % MAX_CHAINS;
     cache_block_t* p;
 
     /* allocate new block */
@@ -240,12 +310,16 @@ static int _put_cache(blkdev_t* dev, uint64_t blkno, const void* data)
         ERAISE(-ENOMEM);
 
     /* initialize the block */
-    p->slot = slot;
     p->blkno = blkno;
+    p->prefetched = prefetched;
     memcpy(p->data, data, dev->sb.data_block_size);
 
-    /* insert into the given hash table chain */
-    myst_list_prepend(&dev->chains[slot], (myst_list_node_t*)p);
+    /* insert into the hash map */
+    if ((ret = myst_hashmap_put(&dev->blocks, blkno, p)) != 0)
+    {
+        free(p);
+        ERAISE(ret);
+    }
 
     /* insert at end of the LRU list */
     _lru_append(dev, p);
@@ -320,34 +394,342 @@ done:
     return ret;
 }
 
+/*
+**==============================================================================
+**
+** hash tree implementation:
+**
+**     The hash tree is read and verified lazily. A node is read when a data
+**     block under it is first verified. The node is checked against its
+**     parent, which is read and checked first if need be, and so on up to
+**     the root node, which is checked against the root hash. Verified nodes
+**     are kept in memory, up to MAX_HASH_NODES of them (evicting the least
+**     recently used).
+**
+**==============================================================================
+*/
+
+static void _node_lru_append(blkdev_t* dev, hash_node_t* node)
+{
+    node->lru_next = NULL;
+    node->lru_prev = dev->node_lru.tail;
+
+    if (dev->node_lru.tail)
+        dev->node_lru.tail->lru_next = node;
+    else
+        dev->node_lru.head = node;
+
+    dev->node_lru.tail = node;
+    dev->node_lru.size++;
+}
+
+static void _node_lru_remove(blkdev_t* dev, hash_node_t* node)
+{
+    if (node->lru_prev)
+        node->lru_prev->lru_next = node->lru_next;
+    else
+        dev->node_lru.head = node->lru_next;
+
+    if (node->lru_next)
+        node->lru_next->lru_prev = node->lru_prev;
+    else
+        dev->node_lru.tail = node->lru_prev;
+
+    dev->node_lru.size--;
+}
+
+/* Evict the least recently used node if the nodes are at their limit */
+static void _evict_node(blkdev_t* dev)
+{
+    if (dev->node_lru.size >= MAX_HASH_NODES)
+    {
+        hash_node_t* p = dev->node_lru.head;
+
+        _node_lru_remove(dev, p);
+        dev->nodes[p->index] = NULL;
+        free(p);
+    }
+}
+
+static void _release_nodes(blkdev_t* dev)
+{
+    if (dev->nodes)
+    {
+        for (size_t i = 0; i < dev->total_nodes; i++)
+            free(dev->nodes[i]);
+
+        free(dev->nodes);
+        dev->nodes = NULL;
+    }
+}
+
+/* Get node j of the given level, verified (caution: the node is only valid
+ * until the next call, which may evict it) */
+static int _get_node(
+    blkdev_t* dev,
+    size_t level,
+    size_t j,
+    const uint8_t** data)
+{
+    int ret = 0;
+    const size_t blksz = dev->sb.hash_block_size;
+    const size_t hash_size = sizeof(myst_sha256_t);
+    const size_t digests_per_block = blksz / hash_size;
+    const size_t index = dev->levels[level].offset + j;
+    hash_node_t* node = NULL;
+    myst_sha256_t hash;
+
+    assert(level < dev->nlevels && j < dev->levels[level].nnodes);
+
+    /* if already verified, move it to the back of the LRU list */
+    if (dev->nodes[index])
+    {
+        hash_node_t* p = dev->nodes[index];
+
+        if (p != dev->node_lru.tail)
+        {
+            _node_lru_remove(dev, p);
+            _node_lru_append(dev, p);
+        }
+
+        *data = p->data;
+        goto done;
+    }
+
+    if (!(node = malloc(sizeof(hash_node_t) + blksz)))
+        ERAISE(-ENOMEM);
+
+    /* read the node (the superblock comes first) */
+    ECHECK(_read_hash_block(dev, index + 1, (block_t*)node->data));
+    ECHECK(_hash_blocks(dev, node->data, blksz, 1, &hash));
+
+    /* check its hash against the root hash or against its parent */
+    if (level + 1 == dev->nlevels)
+    {
+        if (memcmp(dev->roothash, &hash, dev->roothash_size) != 0)
+            ERAISE(-EIO);
+    }
+    else
+    {
+        const uint8_t* parent;
+
+        ECHECK(_get_node(dev, level + 1, j / digests_per_block, &parent));
+        parent += (j % digests_per_block) * hash_size;
+
+        if (memcmp(parent, &hash, hash_size) != 0)
+            ERAISE(-EIO);
+    }
+
+    STATS_INC(nodes_hashed, 1);
+
+    /* evict the least recently used node if necessary */
+    _evict_node(dev);
+
+    node->index = index;
+    dev->nodes[index] = node;
+    _node_lru_append(dev, node);
+    *data = node->data;
+    node = NULL;
+
+done:
+
+    if (node)
+        free(node);
+
+    return ret;
+}
+
+/* Find the expected hash of a data block (see _get_node() for how long the
+ * hash remains valid) */
+static int _find_leaf_hash(blkdev_t* dev, size_t blkno, const uint8_t** hash)
+{
+    int ret = 0;
+    const size_t hash_size = sizeof(myst_sha256_t);
+    const size_t digests_per_block = dev->sb.hash_block_size / hash_size;
+    const uint8_t* leaf;
+
+    if (blkno >= dev->sb.data_blocks)
+        ERAISE(-EIO);
+
+    ECHECK(_get_node(dev, 0, blkno / digests_per_block, &leaf));
+    *hash = leaf + (blkno % digests_per_block) * hash_size;
+
+done:
+    return ret;
+}
+
+/* Check consecutive data blocks against their expected hashes (zeroing the
+ * first one that does not match) */
+static int _check_data_blocks(
+    blkdev_t* dev,
+    const myst_sha256_t* expected,
+    uint8_t* blocks,
+    size_t count)
+{
+    int ret = 0;
+    const size_t block_size = dev->sb.data_block_size;
+    myst_sha256_t hashes[HASH_BATCH_BLOCKS];
+
+    for (size_t i = 0; i < count; i += HASH_BATCH_BLOCKS)
+    {
+        const size_t n = _min_size(count - i, HASH_BATCH_BLOCKS);
+        uint8_t* p = blocks + i * block_size;
+
+        /* calculate the hashes of these blocks (several at once) */
+        ECHECK(_hash_blocks(dev, p, block_size, n, hashes));
+
+        for (size_t j = 0; j < n; j++)
+        {
+            if (memcmp(&hashes[j], &expected[i + j], sizeof(hashes[j])) != 0)
+            {
+                memset(blocks + (i + j) * block_size, 0, block_size);
+                ERAISE(-EIO);
+            }
+        }
+    }
+
+done:
+    return ret;
+}
+
+/* Verify a data block that was read from the underlying device */
+static int _verify_data_block(blkdev_t* dev, size_t blkno, void* block)
+{
+    int ret = 0;
+    const uint8_t* leaf_hash;
+    const myst_sha256_t* expected;
+
+    ECHECK(_find_leaf_hash(dev, blkno, &leaf_hash));
+    expected = (const myst_sha256_t*)leaf_hash;
+    ECHECK(_check_data_blocks(dev, expected, block, 1));
+
+done:
+    return ret;
+}
+
+/* Check some blocks of a run against the hashes found for them beforehand,
+ * since the hash tree itself is only used by the reading thread */
+static int _verify_work(myst_work_t* work_)
+{
+    verify_work_t* work = (verify_work_t*)work_;
+
+    return _check_data_blocks(
+        work->dev, work->hashes, work->data, work->count);
+}
+
+/* Split the verification of a run of data blocks among the kernel worker
+ * threads (or verify them now if there are none) */
+static int _submit_verify_works(
+    blkdev_t* dev,
+    verify_work_t* works,
+    myst_workgroup_t* group,
+    size_t blkno,
+    size_t count,
+    uint8_t* data)
+{
+    int ret = 0;
+    size_t nworks = myst_num_workers() + 1;
+    size_t per_work;
+
+    assert(count <= MAX_RUN_BLOCKS);
+
+    /* find the expected hashes (the previous run no longer uses them) */
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t* hash;
+
+        ECHECK(_find_leaf_hash(dev, blkno + i, &hash));
+        memcpy(&dev->run_hashes[i], hash, sizeof(myst_sha256_t));
+    }
+
+    if (nworks > count)
+        nworks = count;
+
+    per_work = (count + nworks - 1) / nworks;
+
+    for (size_t j = 0, k = 0; k < count; j++, k += per_work)
+    {
+        works[j].base.fn = _verify_work;
+        works[j].dev = dev;
+        works[j].hashes = &dev->run_hashes[k];
+        works[j].count = (count - k < per_work) ? count - k : per_work;
+        works[j].data = data + k * dev->sb.data_block_size;
+        myst_submit_work(group, &works[j].base);
+    }
+
+done:
+    return ret;
+}
+
 static int _read_data_block(blkdev_t* dev, size_t blkno, block_t* block)
 {
     int ret = 0;
     const size_t block_size = dev->sb.data_block_size;
     const size_t blkno_offset = 0;
-    myst_sha256_t hash;
 
     /* read the block from the underlying deivce */
     ECHECK(_read_block(dev, block_size, blkno_offset, blkno, block));
 
-    /* calculate the hash of this block */
-    _hash2(dev->sb.salt, dev->sb.salt_size, block, block_size, &hash);
+    ECHECK(_verify_data_block(dev, blkno, block));
+
+done:
+    return ret;
+}
 
-    /* verify the hash of this block against the hash tree */
+/* Read the data block and the uncached ones after it (up to the prefetch
+ * window) in one transfer, verify them all and add them to the cache. Fail
+ * with -EAGAIN if any of them does not verify, so the caller can read the
+ * wanted block alone (and so only fail if that one is bad) */
+static int _prefetch_data_blocks(blkdev_t* dev, size_t blkno, void* block)
+{
+    int ret = 0;
+    const size_t block_size = dev->sb.data_block_size;
+    const size_t block_factor = block_size / MYST_BLKSIZE;
+    verify_work_t works[MYST_MAX_WORKERS + 1];
+    myst_workgroup_t group = MYST_WORKGROUP_INITIALIZER;
+    uint8_t* buf = NULL;
+    size_t count = 1;
+
+    /* extend the run up to a cached block or the end of the device */
+    while (count < dev->prefetch_blocks &&
+           blkno + count < dev->sb.data_blocks &&
+           !_get_cache(dev, blkno + count))
     {
-        const size_t hash_size = sizeof(myst_sha256_t);
-        const uint8_t* phash = dev->leaves_start + blkno * hash_size;
+        count++;
+    }
 
-        assert(phash >= dev->leaves_start && phash < dev->leaves_end);
+    if (!(buf = malloc(count * block_size)))
+        ERAISE(-ENOMEM);
 
-        if (memcmp(&hash, phash, hash_size) != 0)
-        {
-            memset(block, 0, block_size);
-            ERAISE(-EIO);
-        }
+    ECHECK(myst_read_block_device(
+        dev->rawblkdev,
+        blkno * block_factor,
+        (myst_block_t*)buf,
+        count * block_factor));
+
+    if (_submit_verify_works(dev, works, &group, blkno, count, buf) != 0 ||
+        myst_wait_workgroup(&group) != 0)
+    {
+        ERAISE(-EAGAIN);
     }
 
+    for (size_t i = 0; i < count; i++)
+    {
+        const bool prefetched = i > 0;
+        ECHECK(_put_cache(dev, blkno + i, buf + i * block_size, prefetched));
+    }
+
+    memcpy(block, buf, block_size);
+    STATS_INC(prefetched, count - 1);
+
 done:
+
+    /* the works verify buf in place, so wait for them in any case */
+    myst_wait_workgroup(&group);
+
+    if (buf)
+        free(buf);
+
     return ret;
 }
 
@@ -357,25 +739,114 @@ static int _get_raw_block(blkdev_t* dev, size_t rawblkno, void* data)
     const size_t block_factor = dev->sb.data_block_size / MYST_BLKSIZE;
     const size_t blkno = rawblkno / block_factor;
     const size_t offset = (rawblkno % block_factor) * MYST_BLKSIZE;
-    const cache_block_t* cb;
+    cache_block_t* cb;
     block_t block;
     const uint8_t* ptr;
 
     /* first check the cache */
     if ((cb = _get_cache(dev, blkno)))
     {
+        STATS_INC(hits, 1);
+
+        if (cb->prefetched)
+        {
+            STATS_INC(prefetch_hits, 1);
+            cb->prefetched = false;
+        }
+
         ptr = cb->data;
     }
     else
     {
-        ECHECK(_read_data_block(dev, blkno, &block));
-        ECHECK(_put_cache(dev, blkno, block.data));
+        int r = -EAGAIN;
+
+        STATS_INC(misses, 1);
+
+        /* read ahead if this block follows the last one */
+        if (dev->prefetch_blocks > 1 && blkno == dev->next_blkno)
+        {
+            if ((r = _prefetch_data_blocks(dev, blkno, &block)) != -EAGAIN)
+                ECHECK(r);
+        }
+
+        if (r == -EAGAIN)
+        {
+            ECHECK(_read_data_block(dev, blkno, &block));
+            ECHECK(_put_cache(dev, blkno, block.data, false));
+        }
+
         ptr = block.data;
     }
 
     memcpy(data, ptr + offset, MYST_BLKSIZE);
+    dev->next_blkno = blkno + 1;
+
+done:
+    return ret;
+}
+
+/* Read n raw blocks: whole uncached data blocks are read from the underlying
+ * device a run at a time and verified in place (without caching them, since
+ * such reads are mostly sequential); the rest go through the cache. Each run
+ * is verified on the kernel worker threads while the next one is read */
+static int _get_raw_blocks(
+    blkdev_t* dev,
+    size_t rawblkno,
+    size_t n,
+    uint8_t* data)
+{
+    int ret = 0;
+    const size_t block_size = dev->sb.data_block_size;
+    const size_t block_factor = block_size / MYST_BLKSIZE;
+    const size_t max_run = MAX_TRANSFER_SIZE / block_size;
+    verify_work_t works[MYST_MAX_WORKERS + 1];
+    myst_workgroup_t group = MYST_WORKGROUP_INITIALIZER;
+
+    while (n)
+    {
+        const size_t blkno = rawblkno / block_factor;
+        size_t count = 0;
+
+        if (rawblkno % block_factor == 0 && n >= block_factor)
+        {
+            while (count < max_run && n >= (count + 1) * block_factor &&
+                   !_get_cache(dev, blkno + count))
+            {
+                count++;
+            }
+        }
+
+        if (count)
+        {
+            const size_t nblocks = count * block_factor;
+
+            ECHECK(myst_read_block_device(
+                dev->rawblkdev, rawblkno, (myst_block_t*)data, nblocks));
+
+            /* finish verifying the previous run before reusing the works */
+            ECHECK(myst_wait_workgroup(&group));
+            ECHECK(
+                _submit_verify_works(dev, works, &group, blkno, count, data));
+
+            rawblkno += nblocks;
+            data += nblocks * MYST_BLKSIZE;
+            n -= nblocks;
+        }
+        else
+        {
+            ECHECK(_get_raw_block(dev, rawblkno, data));
+            rawblkno++;
+            data += MYST_BLKSIZE;
+            n--;
+        }
+    }
 
 done:
+
+    /* the works verify the data in place, so wait for them in any case */
+    if (myst_wait_workgroup(&group) != 0 && ret == 0)
+        ret = -EIO;
+
     return ret;
 }
 
@@ -409,40 +880,33 @@ static int _put_raw_block(blkdev_t* dev, size_t rawblkno, const void* data)
         memcpy(block.data + offset, data, MYST_BLKSIZE);
 
         /* add the new block to the cache */
-        ECHECK(_put_cache(dev, blkno, block.data));
+        ECHECK(_put_cache(dev, blkno, block.data, false));
     }
 
 done:
     return ret;
 }
 
-static int _load_hash_tree(blkdev_t* dev)
+/* Lay out the levels of the hash tree and verify its root node */
+static int _init_hash_tree(blkdev_t* dev)
 {
     int ret = 0;
     const myst_verity_sb_t* sb = &dev->sb;
-    const size_t hash_size = sb->salt_size;
-    const size_t num_blocks = sb->data_blocks;
+    const size_t hash_size = sizeof(myst_sha256_t);
     const size_t digests_per_block = sb->hash_block_size / hash_size;
-    const size_t max_levels = 32;
-    const size_t blksz = sb->hash_block_size;
-    struct level
-    {
-        size_t nnodes;
-        size_t offset;
-    };
-    struct level levels[max_levels];
-    size_t nlevels = 0;
-    size_t nchecks = 0;
-    size_t total_nodes = 0;
+    const uint8_t* root;
 
     /* count the number of nodes at every level of the hash tree */
     {
-        size_t n = num_blocks;
+        size_t n = sb->data_blocks;
 
         do
         {
+            if (dev->nlevels == MAX_LEVELS)
+                ERAISE(-EINVAL);
+
             n = _next_multiple(n, digests_per_block);
-            levels[nlevels++].nnodes = n;
+            dev->levels[dev->nlevels++].nnodes = n;
         } while (n > 1);
     }
 
@@ -450,83 +914,21 @@ static int _load_hash_tree(blkdev_t* dev)
     {
         size_t offset = 0;
 
-        for (ssize_t i = (ssize_t)nlevels - 1; i >= 0; i--)
+        for (ssize_t i = (ssize_t)dev->nlevels - 1; i >= 0; i--)
         {
-            levels[i].offset = offset;
-            offset += levels[i].nnodes;
+            dev->levels[i].offset = offset;
+            offset += dev->levels[i].nnodes;
         }
-    }
 
-    /* calculate the total number of nodes in the hash tree */
-    for (size_t i = 0; i < nlevels; i++)
-    {
-        total_nodes += levels[i].nnodes;
-#if 0
-        printf(
-              "levels(index=%zu, nnodes=%zu offset=%zu)\n",
-              i,
-              levels[i].nnodes,
-              levels[i].offset);
-#endif
-    }
-
-    /* read the hash blocks into memory (skip the superblock) */
-    for (size_t i = 0; i < total_nodes; i++)
-    {
-        size_t blkno = i + 1;
-        block_t block;
-        ECHECK(_read_hash_block(dev, blkno, &block));
-        ECHECK(myst_buf_append(&dev->hashtree, &block, blksz));
+        dev->total_nodes = offset;
     }
 
-    /* save pointer to the start of the hash leaves */
-    dev->leaves_start = dev->hashtree.data + (levels[0].offset * blksz);
-    dev->leaves_end = dev->hashtree.data + dev->hashtree.size;
-
-    /* verify the hash tree from the bottom up */
-    for (size_t i = 0; i < nlevels; i++)
-    {
-        const size_t nnodes = levels[i].nnodes;
-        const size_t offset = levels[i].offset;
-        size_t parent = 0;
-        const uint8_t* htree = dev->hashtree.data;
-        const uint8_t* phash = NULL;
-
-        /* set pointer to current parent hash */
-        if (i + 1 != nlevels)
-            phash = htree + (levels[i + 1].offset * blksz);
-
-        for (size_t j = 0; j < nnodes; j++)
-        {
-            size_t index = j + offset;
-            const void* data = htree + (index * blksz);
-            myst_sha256_t hash;
-
-            _hash2(dev->sb.salt, dev->sb.salt_size, data, blksz, &hash);
-
-            /* find parent hash and see if it matched */
-            if (phash)
-            {
-                if (memcmp(phash, &hash, sizeof(myst_sha256_t)) != 0)
-                    ERAISE(-EIO);
-
-                phash += sizeof(myst_sha256_t);
-            }
-            else if (memcmp(dev->roothash, &hash, dev->roothash_size) != 0)
-            {
-                ERAISE(-EIO);
-            }
-
-            /* count the number of hash verification checks performed */
-            nchecks++;
-
-            if (j > 0 && (j % digests_per_block) == 0)
-                parent++;
-        }
-    }
+    if (!(dev->nodes = calloc(dev->total_nodes + 1, sizeof(hash_node_t*))))
+        ERAISE(-ENOMEM);
 
-    if (nchecks != total_nodes)
-        ERAISE(-EIO);
+    /* check the root hash now, so that a wrong one fails the open */
+    if (dev->total_nodes)
+        ECHECK(_get_node(dev, dev->nlevels - 1, 0, &root));
 
 done:
 
@@ -541,7 +943,7 @@ static int _close(myst_blkdev_t* dev_)
     if (!_blkdev_valid(dev))
         ERAISE(-EINVAL);
 
-    myst_buf_release(&dev->hashtree);
+    _release_nodes(dev);
     _release_cache(dev);
     free(dev);
 
@@ -563,6 +965,20 @@ done:
     return ret;
 }
 
+static int _get_n(myst_blkdev_t* dev_, uint64_t blkno, size_t n, void* data)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+
+    if (!_blkdev_valid(dev) || !data)
+        ERAISE(-EINVAL);
+
+    ECHECK(_get_raw_blocks(dev, blkno, n, data));
+
+done:
+    return ret;
+}
+
 static int _put(myst_blkdev_t* dev_, size_t blkno, const void* data)
 {
     int ret = 0;
@@ -582,6 +998,8 @@ int myst_verityblkdev_open(
     size_t hash_offset,
     const uint8_t* roothash,
     size_t roothash_size,
+    size_t cache_blocks,
+    size_t prefetch_blocks,
     myst_blkdev_t** blkdev)
 {
     int ret = 0;
@@ -635,10 +1053,21 @@ int myst_verityblkdev_open(
     dev->base.close = _close;
     dev->base.put = _put;
     dev->base.get = _get;
+    dev->base.get_n = _get_n;
     dev->magic = VERITYBLKDEV_MAGIC;
     dev->first_hash_blkno = first_hash_blkno;
     dev->rawblkdev = rawblkdev;
-    dev->max_cache_blocks = MAX_CACHE_BLOCKS;
+    dev->max_cache_blocks = cache_blocks ? cache_blocks : DEFAULT_CACHE_BLOCKS;
+    dev->prefetch_blocks =
+        prefetch_blocks ? prefetch_blocks : DEFAULT_PREFETCH_BLOCKS;
+
+    /* read ahead no more than one run, nor more than half the cache */
+    if (dev->prefetch_blocks > MAX_RUN_BLOCKS)
+        dev->prefetch_blocks = MAX_RUN_BLOCKS;
+
+    if (dev->prefetch_blocks > dev->max_cache_blocks / 2)
+        dev->prefetch_blocks = dev->max_cache_blocks / 2;
+
     rawblkdev = -1;
     memcpy(&dev->sb, &sb, sizeof(myst_verity_sb_t));
 
@@ -650,8 +1079,8 @@ int myst_verityblkdev_open(
     if (dev->roothash_size != sb.salt_size)
         ERAISE(-EINVAL);
 
-    /* load the hash tree into memory */
-    ECHECK(_load_hash_tree(dev));
+    /* prepare to read the hash tree on demand */
+    ECHECK(_init_hash_tree(dev));
 
     *blkdev = &dev->base;
     dev = NULL;
@@ -659,10 +1088,140 @@ int myst_verityblkdev_open(
 done:
 
     if (dev)
+    {
+        _release_nodes(dev);
         free(dev);
+    }
 
     if (rawblkdev >= 0)
         myst_close_block_device(rawblkdev);
 
     return ret;
 }
+
+int myst_verityblkdev_export_nodes(
+    myst_blkdev_t* blkdev,
+    void** data_out,
+    size_t* size_out)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)blkdev;
+    size_t entry_size;
+    size_t size;
+    nodes_image_t* image;
+    uint8_t* p;
+
+    if (data_out)
+        *data_out = NULL;
+
+    if (size_out)
+        *size_out = 0;
+
+    if (!_blkdev_valid(dev) || !data_out || !size_out)
+        ERAISE(-EINVAL);
+
+    entry_size = sizeof(uint64_t) + dev->sb.hash_block_size;
+    size = sizeof(nodes_image_t) + dev->node_lru.size * entry_size;
+
+    if (!(image = calloc(1, size)))
+        ERAISE(-ENOMEM);
+
+    image->magic = NODES_IMAGE_MAGIC;
+    image->total_nodes = dev->total_nodes;
+    image->count = dev->node_lru.size;
+    image->hash_block_size = dev->sb.hash_block_size;
+    image->roothash_size = (uint32_t)dev->roothash_size;
+    memcpy(image->roothash, dev->roothash, dev->roothash_size);
+
+    /* least recently used first, so that an import keeps the LRU order */
+    p = (uint8_t*)(image + 1);
+
+    for (hash_node_t* node = dev->node_lru.head; node; node = node->lru_next)
+    {
+        const uint64_t index = node->index;
+
+        memcpy(p, &index, sizeof(index));
+        memcpy(p + sizeof(index), node->data, dev->sb.hash_block_size);
+        p += entry_size;
+    }
+
+    *data_out = image;
+    *size_out = size;
+
+done:
+    return ret;
+}
+
+int myst_verityblkdev_import_nodes(
+    myst_blkdev_t* blkdev,
+    const void* data,
+    size_t size)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)blkdev;
+    const nodes_image_t* image = data;
+    size_t entry_size;
+    const uint8_t* p;
+
+    if (!_blkdev_valid(dev) || !data || size < sizeof(nodes_image_t))
+        ERAISE(-EINVAL);
+
+    entry_size = sizeof(uint64_t) + dev->sb.hash_block_size;
+
+    /* the image must be of this hash tree */
+    if (image->magic != NODES_IMAGE_MAGIC ||
+        image->total_nodes != dev->total_nodes ||
+        image->hash_block_size != dev->sb.hash_block_size ||
+        image->roothash_size != dev->roothash_size ||
+        memcmp(image->roothash, dev->roothash, dev->roothash_size) != 0 ||
+        image->count > MAX_HASH_NODES ||
+        size != sizeof(nodes_image_t) + image->count * entry_size)
+    {
+        ERAISE(-EINVAL);
+    }
+
+    p = (const uint8_t*)(image + 1);
+
+    for (size_t i = 0; i < image->count; i++, p += entry_size)
+    {
+        uint64_t index;
+        hash_node_t* node;
+
+        memcpy(&index, p, sizeof(index));
+
+        if (index >= dev->total_nodes)
+            ERAISE(-EINVAL);
+
+        /* the root node was verified by the open */
+        if (dev->nodes[index])
+            continue;
+
+        _evict_node(dev);
+
+        if (!(node = malloc(sizeof(hash_node_t) + dev->sb.hash_block_size)))
+            ERAISE(-ENOMEM);
+
+        node->index = index;
+        memcpy(node->data, p + sizeof(index), dev->sb.hash_block_size);
+        dev->nodes[index] = node;
+        _node_lru_append(dev, node);
+        STATS_INC(nodes_imported, 1);
+    }
+
+done:
+    return ret;
+}
+
+void myst_verityblkdev_get_stats(myst_verity_stats_t* stats)
+{
+    stats->hits = __atomic_load_n(&_stats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&_stats.misses, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&_stats.evictions, __ATOMIC_RELAXED);
+    stats->prefetched = __atomic_load_n(&_stats.prefetched, __ATOMIC_RELAXED);
+    stats->prefetch_hits =
+        __atomic_load_n(&_stats.prefetch_hits, __ATOMIC_RELAXED);
+    stats->nodes_hashed =
+        __atomic_load_n(&_stats.nodes_hashed, __ATOMIC_RELAXED);
+    stats->nodes_imported =
+        __atomic_load_n(&_stats.nodes_imported, __ATOMIC_RELAXED);
+}
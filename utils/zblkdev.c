@@ -0,0 +1,533 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/blkdev.h>
+#include <myst/eraise.h>
+#include <myst/lz.h>
+#include <myst/zimage.h>
+
+#define ZBLKDEV_MAGIC 0x3e81c0f4
+
+/* The default number of decompressed chunks kept in memory (4 MB of the
+ * default chunk size) */
+#define DEFAULT_CACHE_CHUNKS 64
+
+/*
+**==============================================================================
+**
+** The compressed block device:
+**
+**     A read-only view of a compressed image (see myst/zimage.h) as the disk
+**     image it was made from. A block is read by decompressing the chunk
+**     that holds it (from the lower device) into the chunk cache, which
+**     keeps the most recently used chunks up to a bounded number. Blocks
+**     written to the device are kept in memory in their (decompressed)
+**     chunks, which are marked dirty and never dropped, so the image itself
+**     is never changed.
+**
+**==============================================================================
+*/
+
+typedef struct chunk
+{
+    /* links for the LRU list (where first is least recently used) */
+    struct chunk* lru_prev;
+    struct chunk* lru_next;
+
+    /* the index of this chunk */
+    uint64_t index;
+
+    /* whether chunk is dirty (has been written to) */
+    bool dirty;
+
+    /* the decompressed data for this chunk */
+    uint8_t data[];
+} chunk_t;
+
+typedef struct blkdev
+{
+    myst_blkdev_t base;
+    uint32_t magic;
+    myst_blkdev_t* lower;
+    myst_zimage_header_t header;
+
+    /* the offsets of the chunks (num_chunks + 1 of them) */
+    uint64_t* index;
+
+    /* the cached chunks (indexed by chunk number) */
+    chunk_t** chunks;
+
+    /* the LRU list of clean chunks */
+    chunk_t* lru_head;
+    chunk_t* lru_tail;
+    size_t num_clean;
+    size_t max_clean;
+
+    /* the blocks of the lower device that hold one compressed chunk */
+    uint8_t* zbuf;
+    size_t zbuf_size;
+} blkdev_t;
+
+static bool _blkdev_valid(blkdev_t* dev)
+{
+    return dev && dev->magic == ZBLKDEV_MAGIC;
+}
+
+static void _lru_append(blkdev_t* dev, chunk_t* c)
+{
+    c->lru_prev = dev->lru_tail;
+    c->lru_next = NULL;
+
+    if (dev->lru_tail)
+        dev->lru_tail->lru_next = c;
+    else
+        dev->lru_head = c;
+
+    dev->lru_tail = c;
+    dev->num_clean++;
+}
+
+static void _lru_remove(blkdev_t* dev, chunk_t* c)
+{
+    if (c->lru_prev)
+        c->lru_prev->lru_next = c->lru_next;
+    else
+        dev->lru_head = c->lru_next;
+
+    if (c->lru_next)
+        c->lru_next->lru_prev = c->lru_prev;
+    else
+        dev->lru_tail = c->lru_prev;
+
+    c->lru_prev = NULL;
+    c->lru_next = NULL;
+    dev->num_clean--;
+}
+
+/* The size of the given chunk before compression */
+static size_t _chunk_size(blkdev_t* dev, uint64_t index)
+{
+    const uint64_t offset = index * dev->header.chunk_size;
+    const uint64_t rem = dev->header.size - offset;
+
+    return rem < dev->header.chunk_size ? rem : dev->header.chunk_size;
+}
+
+/* Read bytes from the lower device (which need not be block aligned) */
+static int _read_lower(blkdev_t* dev, uint64_t offset, size_t size, void* buf)
+{
+    int ret = 0;
+    const uint64_t first = offset / MYST_BLKSIZE;
+    const uint64_t last = (offset + size + MYST_BLKSIZE - 1) / MYST_BLKSIZE;
+    const size_t skip = offset % MYST_BLKSIZE;
+
+    if ((last - first) * MYST_BLKSIZE > dev->zbuf_size)
+        ERAISE(-EINVAL);
+
+    ECHECK(myst_blkdev_get_n(dev->lower, first, last - first, dev->zbuf));
+    memcpy(buf, dev->zbuf + skip, size);
+
+done:
+    return ret;
+}
+
+/* Decompress the given chunk into c->data[] */
+static int _load_chunk(blkdev_t* dev, uint64_t index, chunk_t* c)
+{
+    int ret = 0;
+    const uint64_t offset = dev->index[index];
+    const size_t zsize = dev->index[index + 1] - offset;
+    const size_t size = _chunk_size(dev, index);
+    const uint64_t first = offset / MYST_BLKSIZE;
+    const uint64_t last = (offset + zsize + MYST_BLKSIZE - 1) / MYST_BLKSIZE;
+    const uint8_t* zdata = dev->zbuf + offset % MYST_BLKSIZE;
+    ssize_t n;
+
+    ECHECK(myst_blkdev_get_n(dev->lower, first, last - first, dev->zbuf));
+
+    if (zsize == size)
+    {
+        /* the chunk was stored as is */
+        memcpy(c->data, zdata, size);
+    }
+    else
+    {
+        ECHECK(n = myst_lz_decompress(zdata, zsize, c->data, size));
+
+        if ((size_t)n != size)
+            ERAISE(-EIO);
+    }
+
+done:
+    return ret;
+}
+
+/* Get the given chunk from the cache (loading it if not there) */
+static int _get_chunk(blkdev_t* dev, uint64_t index, chunk_t** chunk_out)
+{
+    int ret = 0;
+    chunk_t* c;
+    int r;
+
+    if ((c = dev->chunks[index]))
+    {
+        /* make this the most recently used chunk */
+        if (!c->dirty)
+        {
+            _lru_remove(dev, c);
+            _lru_append(dev, c);
+        }
+
+        *chunk_out = c;
+        goto done;
+    }
+
+    if (dev->num_clean >= dev->max_clean && dev->lru_head)
+    {
+        /* reuse the least recently used clean chunk */
+        c = dev->lru_head;
+        _lru_remove(dev, c);
+        dev->chunks[c->index] = NULL;
+    }
+    else
+    {
+        const size_t size = sizeof(chunk_t) + dev->header.chunk_size;
+
+        if (!(c = malloc(size)))
+            ERAISE(-ENOMEM);
+    }
+
+    c->dirty = false;
+    c->index = index;
+
+    if ((r = _load_chunk(dev, index, c)) != 0)
+    {
+        free(c);
+        ERAISE(r);
+    }
+
+    _lru_append(dev, c);
+    dev->chunks[index] = c;
+    *chunk_out = c;
+
+done:
+    return ret;
+}
+
+/* Copy n blocks (all in one chunk) out of the cache or into it */
+static int _transfer(
+    blkdev_t* dev,
+    uint64_t blkno,
+    size_t n,
+    void* data,
+    bool write)
+{
+    int ret = 0;
+    const uint64_t offset = blkno * MYST_BLKSIZE;
+    const uint64_t index = offset / dev->header.chunk_size;
+    const size_t skip = offset % dev->header.chunk_size;
+    chunk_t* c;
+
+    if (index >= dev->header.num_chunks ||
+        skip + n * MYST_BLKSIZE > _chunk_size(dev, index))
+    {
+        ERAISE(-EINVAL);
+    }
+
+    ECHECK(_get_chunk(dev, index, &c));
+
+    if (write)
+    {
+        memcpy(c->data + skip, data, n * MYST_BLKSIZE);
+
+        /* remove this chunk from LRU list so it won't be evicted */
+        if (!c->dirty)
+        {
+            _lru_remove(dev, c);
+            c->dirty = true;
+        }
+    }
+    else
+    {
+        memcpy(data, c->data + skip, n * MYST_BLKSIZE);
+    }
+
+done:
+    return ret;
+}
+
+/* Transfer n blocks a chunk at a time */
+static int _transfer_n(
+    blkdev_t* dev,
+    uint64_t blkno,
+    size_t n,
+    uint8_t* data,
+    bool write)
+{
+    int ret = 0;
+    const size_t chunk_blocks = dev->header.chunk_size / MYST_BLKSIZE;
+
+    while (n)
+    {
+        size_t count = chunk_blocks - blkno % chunk_blocks;
+
+        if (count > n)
+            count = n;
+
+        ECHECK(_transfer(dev, blkno, count, data, write));
+        blkno += count;
+        data += count * MYST_BLKSIZE;
+        n -= count;
+    }
+
+done:
+    return ret;
+}
+
+static int _close(myst_blkdev_t* dev_)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+
+    if (!_blkdev_valid(dev))
+        ERAISE(-EINVAL);
+
+    /* a failed open may not have allocated the chunks yet */
+    for (size_t i = 0; dev->chunks && i < dev->header.num_chunks; i++)
+        free(dev->chunks[i]);
+
+    if (dev->lower)
+        dev->lower->close(dev->lower);
+
+    free(dev->chunks);
+    free(dev->index);
+    free(dev->zbuf);
+    free(dev);
+
+done:
+    return ret;
+}
+
+static int _get(myst_blkdev_t* dev_, uint64_t blkno, void* data)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+
+    if (!_blkdev_valid(dev) || !data)
+        ERAISE(-EINVAL);
+
+    ECHECK(_transfer(dev, blkno, 1, data, false));
+
+done:
+    return ret;
+}
+
+static int _get_n(myst_blkdev_t* dev_, uint64_t blkno, size_t n, void* data)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+
+    if (!_blkdev_valid(dev) || !data)
+        ERAISE(-EINVAL);
+
+    ECHECK(_transfer_n(dev, blkno, n, data, false));
+
+done:
+    return ret;
+}
+
+static int _put(myst_blkdev_t* dev_, uint64_t blkno, const void* data)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+
+    if (!_blkdev_valid(dev) || !data)
+        ERAISE(-EINVAL);
+
+    ECHECK(_transfer(dev, blkno, 1, (void*)data, true));
+
+done:
+    return ret;
+}
+
+static int _put_n(
+    myst_blkdev_t* dev_,
+    uint64_t blkno,
+    size_t n,
+    const void* data)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+
+    if (!_blkdev_valid(dev) || !data)
+        ERAISE(-EINVAL);
+
+    ECHECK(_transfer_n(dev, blkno, n, (uint8_t*)data, true));
+
+done:
+    return ret;
+}
+
+static int _read_header(myst_blkdev_t* lower, myst_zimage_header_t* header)
+{
+    int ret = 0;
+
+    ECHECK((lower->get)(lower, 0, header));
+
+    if (header->magic != MYST_ZIMAGE_MAGIC)
+        ERAISE(-ENOTSUP);
+
+done:
+    return ret;
+}
+
+int myst_zblkdev_check_header(myst_blkdev_t* lower)
+{
+    myst_zimage_header_t header;
+    int r;
+
+    if (!lower)
+        return -EINVAL;
+
+    if ((r = (lower->get)(lower, 0, &header)) != 0)
+        return r;
+
+    /* not raised as an error (since most images are not compressed) */
+    return header.magic == MYST_ZIMAGE_MAGIC ? 0 : -ENOTSUP;
+}
+
+/* Check the header and the index (so that reads need not) */
+static int _check_image(blkdev_t* dev)
+{
+    int ret = 0;
+    const myst_zimage_header_t* h = &dev->header;
+    const size_t index_size = (h->num_chunks + 1) * sizeof(uint64_t);
+
+    for (size_t i = 0; i < h->num_chunks; i++)
+    {
+        if (dev->index[i + 1] < dev->index[i])
+            ERAISE(-EINVAL);
+
+        /* a chunk does not get bigger (it is stored as is instead) */
+        if (dev->index[i + 1] - dev->index[i] > _chunk_size(dev, i))
+            ERAISE(-EINVAL);
+    }
+
+    if (dev->index[0] < h->index_offset + index_size)
+        ERAISE(-EINVAL);
+
+done:
+    return ret;
+}
+
+int myst_zblkdev_open(
+    myst_blkdev_t* lower,
+    size_t cache_chunks,
+    myst_blkdev_t** blkdev)
+{
+    int ret = 0;
+    blkdev_t* dev = NULL;
+    myst_zimage_header_t* h;
+    size_t index_size;
+
+    if (blkdev)
+        *blkdev = NULL;
+
+    if (!lower || !blkdev)
+        ERAISE(-EINVAL);
+
+    /* allocate the new block device */
+    if (!(dev = (blkdev_t*)calloc(1, sizeof(blkdev_t))))
+        ERAISE(-ENOMEM);
+
+    dev->magic = ZBLKDEV_MAGIC;
+    dev->lower = lower;
+
+    /* read and check the header */
+    {
+        h = &dev->header;
+        ECHECK(_read_header(lower, h));
+
+        if (h->version != MYST_ZIMAGE_VERSION)
+            ERAISE(-ENOTSUP);
+
+        if (h->chunk_size < MYST_BLKSIZE ||
+            h->chunk_size > MYST_ZIMAGE_MAX_CHUNK_SIZE ||
+            (h->chunk_size & (h->chunk_size - 1)))
+        {
+            ERAISE(-ENOTSUP);
+        }
+
+        if (h->size % MYST_BLKSIZE ||
+            h->num_chunks != (h->size + h->chunk_size - 1) / h->chunk_size)
+        {
+            ERAISE(-EINVAL);
+        }
+
+        if (h->index_offset < sizeof(myst_zimage_header_t) ||
+            h->index_offset % MYST_BLKSIZE)
+        {
+            ERAISE(-EINVAL);
+        }
+    }
+
+    /* room for a chunk that starts and ends within a block */
+    dev->zbuf_size = h->chunk_size + 2 * MYST_BLKSIZE;
+
+    if (!(dev->zbuf = malloc(dev->zbuf_size)))
+        ERAISE(-ENOMEM);
+
+    if (!(dev->chunks = calloc(h->num_chunks, sizeof(chunk_t*))))
+        ERAISE(-ENOMEM);
+
+    /* read the index (a chunk at a time, since the buffer holds that much) */
+    {
+        uint8_t* p;
+
+        index_size = (h->num_chunks + 1) * sizeof(uint64_t);
+
+        if (!(dev->index = malloc(index_size)))
+            ERAISE(-ENOMEM);
+
+        p = (uint8_t*)dev->index;
+
+        for (size_t offset = 0; offset < index_size;)
+        {
+            size_t n = index_size - offset;
+
+            if (n > h->chunk_size)
+                n = h->chunk_size;
+
+            ECHECK(_read_lower(dev, h->index_offset + offset, n, p + offset));
+            offset += n;
+        }
+    }
+
+    ECHECK(_check_image(dev));
+
+    /* initialize the block device */
+    dev->base.close = _close;
+    dev->base.get = _get;
+    dev->base.put = _put;
+    dev->base.get_n = _get_n;
+    dev->base.put_n = _put_n;
+    dev->max_clean = cache_chunks ? cache_chunks : DEFAULT_CACHE_CHUNKS;
+
+    *blkdev = &dev->base;
+    dev = NULL;
+
+done:
+
+    if (dev)
+    {
+        /* the caller still owns the lower device */
+        dev->lower = NULL;
+        _close(&dev->base);
+    }
+
+    return ret;
+}